@@ -0,0 +1,66 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+/// What the benchmarks share: the corpus of sources they run over, and the
+/// timing and percentiles of their samples.
+namespace clice::bench {
+
+using Clock = std::chrono::steady_clock;
+
+inline bool is_source(llvm::StringRef path) {
+    auto ext = llvm::sys::path::extension(path);
+    return ext == ".cpp" || ext == ".cc" || ext == ".cxx" || ext == ".c";
+}
+
+/// The C and C++ sources under `dir`, sorted.
+inline std::vector<std::string> collect_corpus(llvm::StringRef dir) {
+    std::vector<std::string> files;
+    std::error_code ec;
+    for(llvm::sys::fs::recursive_directory_iterator it(dir, ec), end; it != end && !ec;
+        it.increment(ec)) {
+        if(it->type() == llvm::sys::fs::file_type::regular_file && is_source(it->path())) {
+            files.push_back(it->path());
+        }
+    }
+    std::ranges::sort(files);
+    return files;
+}
+
+inline double to_ms(Clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+/// Call `fn` and record its duration in `samples` (microseconds), even when
+/// it throws; returns what `fn` returns.
+template <typename Fn>
+decltype(auto) measure(std::vector<double>& samples, Fn&& fn) {
+    struct Record {
+        std::vector<double>& samples;
+        Clock::time_point start = Clock::now();
+
+        ~Record() {
+            std::chrono::duration<double, std::micro> elapsed = Clock::now() - start;
+            samples.push_back(elapsed.count());
+        }
+    } record{samples};
+    return fn();
+}
+
+/// The sample at fraction `p` of the ascending `sorted`, which is not empty.
+inline double percentile(llvm::ArrayRef<double> sorted, double p) {
+    auto rank = static_cast<std::size_t>(p * static_cast<double>(sorted.size() - 1));
+    return sorted[rank];
+}
+
+}  // namespace clice::bench
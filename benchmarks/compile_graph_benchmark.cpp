@@ -0,0 +1,354 @@
+/// Benchmark for CompileGraph scheduling on large synthetic module DAGs.
+///
+/// The graph is a random DAG of `--units` module units, each importing about
+/// `--imports` others: half from the few units just before it (deep chains),
+/// half from anywhere before it (wide fan-in).  The dispatch_fn is a stub that
+/// spins for `--work-us` and then yields to the event loop, so many units are
+/// in flight and waiting on each other at once.  Time spent spinning is
+/// reported as compile time; the rest of the wall time is scheduling
+/// overhead: the graph's bookkeeping, waits, slot hand-off and the loop.
+///
+/// Phases:
+///   cold     every root requested at once on a fresh graph
+///   warm     the same requests again, with nothing left to compile
+///   update   `--rounds` times: update() a random unit, then request the
+///            roots again
+///
+/// Usage:
+///   compile_graph_benchmark [OPTIONS]
+///
+/// Example:
+///   ./build/RelWithDebInfo/bin/compile_graph_benchmark --units 10000 --max-parallel 8
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <print>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "server/compiler/compile_graph.h"
+#include "benchmark_utils.h"
+
+#include "kota/async/async.h"
+#include "kota/codec/json/json.h"
+#include "kota/deco/deco.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+
+using namespace clice;
+
+struct BenchmarkOptions {
+    DecoKV(names = {"--export"}; help = "Export the report as JSON to this path";
+           required = false;)
+    <std::string> export_path;
+
+    DecoKV(names = {"--units"}; help = "Number of module units"; required = false;)
+    <int> units = 10000;
+
+    DecoKV(names = {"--imports"}; help = "Average imports per unit"; required = false;)
+    <int> imports = 4;
+
+    DecoKV(names = {"--roots"}; help = "Units requested at once, taken from those nothing imports";
+           required = false;)
+    <int> roots = 256;
+
+    DecoKV(names = {"--rounds"}; help = "Update rounds"; required = false;)
+    <int> rounds = 20;
+
+    DecoKV(names = {"--work-us"}; help = "Microseconds each stub compile spins";
+           required = false;)
+    <int> work_us = 0;
+
+    DecoKV(names = {"--max-parallel"}; help = "Dispatch slots (0 for no limit)";
+           required = false;)
+    <int> max_parallel = 0;
+
+    DecoKV(names = {"--seed"}; help = "Seed of the random DAG"; required = false;)
+    <int> seed = 1;
+
+    DecoFlag(names = {"--inline"}; help = "Finish stub compiles without yielding to the loop";
+             required = false;)
+    inline_dispatch;
+
+    DecoFlag(names = {"-h", "--help"}; help = "Show help message"; required = false;)
+    help;
+};
+
+namespace {
+
+using bench::Clock;
+using bench::to_ms;
+
+struct Dag {
+    /// imports[id] lists the units id imports; ids start at 1.
+    std::vector<llvm::SmallVector<std::uint32_t>> imports;
+    std::vector<std::uint32_t> roots;
+    std::uint64_t edges = 0;
+    std::uint32_t depth = 0;
+};
+
+Dag make_dag(std::uint32_t units, std::uint32_t imports, std::uint32_t roots, std::mt19937& rng) {
+    constexpr std::uint32_t window = 32;
+
+    Dag dag;
+    dag.imports.resize(units + 1);
+    std::vector<std::uint32_t> depth(units + 1, 0);
+    std::vector<bool> imported(units + 1, false);
+    for(std::uint32_t id = 2; id <= units; ++id) {
+        auto count = std::uniform_int_distribution<std::uint32_t>(0, imports * 2)(rng);
+        auto& list = dag.imports[id];
+        for(std::uint32_t i = 0; i < count; ++i) {
+            auto near_first = id > window ? id - window : 1;
+            auto first = rng() % 2 == 0 ? near_first : 1;
+            auto dep = std::uniform_int_distribution<std::uint32_t>(first, id - 1)(rng);
+            if(std::ranges::find(list, dep) == list.end()) {
+                list.push_back(dep);
+            }
+        }
+        for(auto dep: list) {
+            depth[id] = std::max(depth[id], depth[dep] + 1);
+            imported[dep] = true;
+        }
+        dag.edges += list.size();
+        dag.depth = std::max(dag.depth, depth[id]);
+    }
+
+    for(std::uint32_t id = 1; id <= units; ++id) {
+        if(!imported[id]) {
+            dag.roots.push_back(id);
+        }
+    }
+    std::ranges::shuffle(dag.roots, rng);
+    if(dag.roots.size() > roots) {
+        dag.roots.resize(roots);
+    }
+    return dag;
+}
+
+struct Stats {
+    std::uint64_t dispatches = 0;
+    Clock::duration compiling{};
+};
+
+struct PhaseReport {
+    std::string name;
+    std::uint32_t requests = 0;
+    std::uint32_t failed = 0;
+    std::uint64_t dispatches = 0;
+    std::uint64_t dirtied = 0;
+    double wall_ms = 0;
+    double compile_ms = 0;
+    double update_ms = 0;
+    double overhead_ms = 0;
+    double overhead_us_per_dispatch = 0;
+};
+
+struct BenchmarkReport {
+    std::uint32_t units = 0;
+    std::uint64_t edges = 0;
+    std::uint32_t depth = 0;
+    std::uint32_t max_parallel = 0;
+    std::vector<PhaseReport> phases;
+};
+
+/// Request every root at once and wait for all of them.
+kota::task<std::uint32_t> request_roots(CompileGraph& graph, llvm::ArrayRef<std::uint32_t> roots) {
+    std::vector<kota::task<bool>> waits;
+    waits.reserve(roots.size());
+    for(auto root: roots) {
+        waits.push_back(graph.compile(root));
+    }
+    auto results = co_await kota::when_all(std::move(waits));
+    co_return static_cast<std::uint32_t>(std::ranges::count(results, false));
+}
+
+/// Requests the roots and fills in the timings of `phase`; `update` is the
+/// time already spent in update() before the requests.
+kota::task<> run_phase(CompileGraph& graph,
+                       const Dag& dag,
+                       Stats& stats,
+                       PhaseReport& phase,
+                       Clock::duration update) {
+    auto dispatches = stats.dispatches;
+    auto compiling = stats.compiling;
+    auto start = Clock::now();
+    phase.failed += co_await request_roots(graph, dag.roots);
+    auto wall = Clock::now() - start;
+
+    auto spent = stats.compiling - compiling;
+    phase.requests += static_cast<std::uint32_t>(dag.roots.size());
+    phase.dispatches += stats.dispatches - dispatches;
+    phase.wall_ms += to_ms(wall + update);
+    phase.compile_ms += to_ms(spent);
+    phase.update_ms += to_ms(update);
+    phase.overhead_ms += to_ms(wall + update - spent);
+}
+
+kota::task<> run_benchmark(CompileGraph& graph,
+                           const Dag& dag,
+                           std::uint32_t rounds,
+                           std::mt19937& rng,
+                           Stats& stats,
+                           BenchmarkReport& report) {
+    PhaseReport cold{.name = "cold"};
+    co_await run_phase(graph, dag, stats, cold, {});
+    report.phases.push_back(std::move(cold));
+
+    PhaseReport warm{.name = "warm"};
+    co_await run_phase(graph, dag, stats, warm, {});
+    report.phases.push_back(std::move(warm));
+
+    // Low ids are imported by most of the graph, so their updates cascade
+    // furthest; draw from the whole range to mix both ends.
+    PhaseReport update{.name = "update"};
+    auto last = static_cast<std::uint32_t>(dag.imports.size() - 1);
+    std::uniform_int_distribution<std::uint32_t> pick(1, last);
+    for(std::uint32_t round = 0; round < rounds; ++round) {
+        auto start = Clock::now();
+        update.dirtied += graph.update(pick(rng)).size();
+        co_await run_phase(graph, dag, stats, update, Clock::now() - start);
+    }
+    report.phases.push_back(std::move(update));
+
+    for(auto& phase: report.phases) {
+        if(phase.dispatches > 0) {
+            phase.overhead_us_per_dispatch =
+                phase.overhead_ms * 1000.0 / static_cast<double>(phase.dispatches);
+        }
+    }
+
+    co_await graph.shutdown();
+}
+
+void print_report(const BenchmarkReport& report) {
+    std::println("===============================================================");
+    std::println("                    Compile Graph Report");
+    std::println("===============================================================");
+    std::println("");
+    std::println("  Units: {}, imports: {}, longest chain: {}, slots: {}",
+                 report.units,
+                 report.edges,
+                 report.depth,
+                 report.max_parallel == 0 ? std::string("unlimited")
+                                          : std::to_string(report.max_parallel));
+    std::println("");
+    std::println("  {:<8s} {:>8s} {:>7s} {:>10s} {:>9s} {:>10s} {:>10s} {:>10s} {:>11s} {:>9s}",
+                 "Phase",
+                 "Requests",
+                 "Failed",
+                 "Dispatches",
+                 "Dirtied",
+                 "Wall(ms)",
+                 "Compile",
+                 "Update",
+                 "Overhead",
+                 "us/unit");
+    for(auto& phase: report.phases) {
+        std::println(
+            "  {:<8s} {:>8} {:>7} {:>10} {:>9} {:>10.1f} {:>10.1f} {:>10.2f} {:>11.1f} {:>9.2f}",
+            phase.name,
+            phase.requests,
+            phase.failed,
+            phase.dispatches,
+            phase.dirtied,
+            phase.wall_ms,
+            phase.compile_ms,
+            phase.update_ms,
+            phase.overhead_ms,
+            phase.overhead_us_per_dispatch);
+    }
+    std::println("");
+    std::println("===============================================================");
+}
+
+void export_report_json(const BenchmarkReport& report, llvm::StringRef output_path) {
+    auto json = kota::codec::json::to_json(report);
+    if(!json) {
+        std::println(stderr, "Failed to serialize report");
+        return;
+    }
+
+    std::ofstream out(output_path.str());
+    if(!out) {
+        std::println(stderr, "Failed to open output file: {}", output_path);
+        return;
+    }
+    out << *json;
+    std::println("Report exported to {}", output_path);
+}
+
+}  // namespace
+
+int main(int argc, const char** argv) {
+    auto args = kota::deco::util::argvify(argc, argv);
+    auto result = kota::deco::cli::parse<BenchmarkOptions>(args);
+
+    if(!result.has_value()) {
+        std::println(stderr, "Error: {}", result.error().message);
+        return 1;
+    }
+
+    auto& opts = result->options;
+
+    if(opts.help.value_or(false)) {
+        std::ostringstream oss;
+        kota::deco::cli::write_usage_for<BenchmarkOptions>(oss,
+                                                           "compile_graph_benchmark [OPTIONS]");
+        std::print("{}", oss.str());
+        return 0;
+    }
+
+    if(*opts.units < 2 || *opts.imports < 0 || *opts.roots <= 0 || *opts.rounds < 0 ||
+       *opts.work_us < 0 || *opts.max_parallel < 0) {
+        std::println(stderr, "Error: --units must be at least 2, --roots positive, the rest "
+                             "non-negative");
+        return 1;
+    }
+
+    std::mt19937 rng(static_cast<std::uint32_t>(*opts.seed));
+    auto dag = make_dag(*opts.units, *opts.imports, *opts.roots, rng);
+
+    Stats stats;
+    auto work = std::chrono::microseconds(*opts.work_us);
+    bool yield = !opts.inline_dispatch.value_or(false);
+    auto dispatch = [&](std::uint32_t) -> kota::task<bool> {
+        stats.dispatches += 1;
+        auto start = Clock::now();
+        while(Clock::now() - start < work) {}
+        stats.compiling += Clock::now() - start;
+        if(yield) {
+            co_await kota::sleep(0);
+        }
+        co_return true;
+    };
+    auto resolve = [&](std::uint32_t path_id) -> llvm::SmallVector<std::uint32_t> {
+        return path_id < dag.imports.size() ? dag.imports[path_id]
+                                            : llvm::SmallVector<std::uint32_t>();
+    };
+
+    BenchmarkReport report;
+    report.units = *opts.units;
+    report.edges = dag.edges;
+    report.depth = dag.depth;
+    report.max_parallel = *opts.max_parallel;
+    {
+        kota::event_loop loop;
+        CompileGraph graph(loop, dispatch, resolve);
+        graph.set_max_parallel(*opts.max_parallel);
+        loop.schedule(run_benchmark(graph, dag, *opts.rounds, rng, stats, report));
+        loop.run();
+    }
+
+    print_report(report);
+
+    if(opts.export_path.has_value()) {
+        export_report_json(report, *opts.export_path);
+    }
+
+    return 0;
+}
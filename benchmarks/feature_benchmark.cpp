@@ -0,0 +1,431 @@
+/// Benchmark for the editor features of src/feature on parsed translation units.
+///
+/// Every file is compiled once, as the stateful worker does for an open file.
+/// The whole-file features then run on its AST `--iterations` times, hover at
+/// `--points` identifiers spread over the file, and code completion and
+/// signature help, which parse the file again for each request, at a few of
+/// those places.  The report lists latency percentiles per feature and the
+/// allocations each call makes through operator new.
+///
+/// Files are the sources under `--corpus` (the fixtures of tests/data by
+/// default) and those named by `--file`, with the commands of the compilation
+/// database when one is given, otherwise those the database synthesizes.
+///
+/// Usage:
+///   feature_benchmark [OPTIONS] [compile_commands.json]
+///
+/// Example:
+///   ./build/RelWithDebInfo/bin/feature_benchmark --iterations 50
+///
+///   ./build/RelWithDebInfo/bin/feature_benchmark --corpus "" \
+///       --file src/server/compiler/compiler.cpp build/compile_commands.json
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <print>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "command/command.h"
+#include "command/toolchain.h"
+#include "compile/compilation.h"
+#include "feature/feature.h"
+#include "support/logging.h"
+#include "benchmark_utils.h"
+
+#include "kota/codec/json/json.h"
+#include "kota/deco/deco.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+using namespace clice;
+
+namespace {
+
+/// Calls of operator new and the bytes they asked for, since the start.
+std::atomic<std::uint64_t> allocations = 0;
+std::atomic<std::uint64_t> allocated_bytes = 0;
+
+}  // namespace
+
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if(auto* pointer = std::malloc(size ? size : 1)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return ::operator new(size);
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+struct BenchmarkOptions {
+    DecoKV(names = {"--log-level"}; help = "Log level: trace, debug, info, warn, error, off";
+           required = false;)
+    <std::string> log_level = "off";
+
+    DecoKV(names = {"--export"}; help = "Export the report as JSON to this path";
+           required = false;)
+    <std::string> export_path;
+
+    DecoKV(names = {"--corpus"}; help = "Measure the C/C++ sources under this directory";
+           required = false;)
+    <std::string> corpus = "tests/data";
+
+    DecoKV(names = {"--file"}; help = "Also measure these files, separated by commas";
+           required = false;)
+    <std::string> file;
+
+    DecoKV(names = {"--iterations"}; help = "Runs of each feature per file and position";
+           required = false;)
+    <int> iterations = 20;
+
+    DecoKV(names = {"--points"}; help = "Hover positions per file"; required = false;)
+    <int> points = 16;
+
+    DecoKV(names = {"--completion-points"};
+           help = "Completion and signature help positions per file";
+           required = false;)
+    <int> completion_points = 2;
+
+    DecoFlag(names = {"-h", "--help"}; help = "Show help message"; required = false;)
+    help;
+
+    DecoInput(meta_var = "CDB"; help = "Path to compile_commands.json"; required = false;)
+    <std::string> cdb_path;
+};
+
+/// Latency of one feature in microseconds per call, and what a call
+/// allocates on average.
+struct FeatureReport {
+    std::string name;
+    std::size_t count = 0;
+    double total_ms = 0;
+    double p50_us = 0;
+    double p90_us = 0;
+    double p99_us = 0;
+    double max_us = 0;
+    double allocations = 0;
+    double allocated_kb = 0;
+};
+
+struct BenchmarkReport {
+    std::size_t files = 0;
+    std::size_t failed = 0;
+    double compile_ms = 0;
+    std::vector<FeatureReport> features;
+};
+
+namespace {
+
+/// The samples and allocations of one feature over all files.
+struct Samples {
+    std::vector<double> us;
+    std::uint64_t allocations = 0;
+    std::uint64_t bytes = 0;
+};
+
+/// Call `fn` and record its duration and allocations in `samples`.
+template <typename Fn>
+void measure(Samples& samples, Fn&& fn) {
+    auto count = allocations.load(std::memory_order_relaxed);
+    auto bytes = allocated_bytes.load(std::memory_order_relaxed);
+    bench::measure(samples.us, [&] {
+        // The result is destroyed inside the measurement, as a worker drops
+        // it once serialized.
+        auto result = fn();
+        (void)result;
+    });
+    samples.allocations += allocations.load(std::memory_order_relaxed) - count;
+    samples.bytes += allocated_bytes.load(std::memory_order_relaxed) - bytes;
+}
+
+FeatureReport summarize(std::string name, Samples& samples) {
+    FeatureReport report;
+    report.name = std::move(name);
+    report.count = samples.us.size();
+    if(samples.us.empty()) {
+        return report;
+    }
+
+    auto& us = samples.us;
+    std::ranges::sort(us);
+
+    double total_us = 0;
+    for(auto sample: us) {
+        total_us += sample;
+    }
+    auto count = static_cast<double>(us.size());
+    report.total_ms = total_us / 1000.0;
+    report.p50_us = bench::percentile(us, 0.50);
+    report.p90_us = bench::percentile(us, 0.90);
+    report.p99_us = bench::percentile(us, 0.99);
+    report.max_us = us.back();
+    report.allocations = static_cast<double>(samples.allocations) / count;
+    report.allocated_kb = static_cast<double>(samples.bytes) / 1024.0 / count;
+    return report;
+}
+
+/// Offsets of `count` identifiers spread over `content`, at their first
+/// character.
+std::vector<std::uint32_t> identifier_points(llvm::StringRef content, std::size_t count) {
+    std::vector<std::uint32_t> starts;
+    for(std::uint32_t i = 0; i < content.size(); ++i) {
+        bool start = llvm::isAlpha(content[i]) || content[i] == '_';
+        if(start && (i == 0 || !(llvm::isAlnum(content[i - 1]) || content[i - 1] == '_'))) {
+            starts.push_back(i);
+        }
+    }
+    if(starts.size() <= count) {
+        return starts;
+    }
+    std::vector<std::uint32_t> result;
+    auto stride = starts.size() / count;
+    for(std::size_t i = 0; i < count; ++i) {
+        result.push_back(starts[i * stride]);
+    }
+    return result;
+}
+
+/// Offsets just inside `count` call parentheses spread over `content`.
+std::vector<std::uint32_t> call_points(llvm::StringRef content, std::size_t count) {
+    std::vector<std::uint32_t> opens;
+    for(std::uint32_t i = 1; i < content.size(); ++i) {
+        if(content[i] == '(' && (llvm::isAlnum(content[i - 1]) || content[i - 1] == '_')) {
+            opens.push_back(i + 1);
+        }
+    }
+    if(opens.size() <= count) {
+        return opens;
+    }
+    std::vector<std::uint32_t> result;
+    auto stride = opens.size() / count;
+    for(std::size_t i = 0; i < count; ++i) {
+        result.push_back(opens[i * stride]);
+    }
+    return result;
+}
+
+void print_report(const BenchmarkReport& report) {
+    std::println("===============================================================");
+    std::println("                       Feature Report");
+    std::println("===============================================================");
+    std::println("");
+    std::println("  Files:              {} ({} failed)", report.files, report.failed);
+    std::println("  Compile:            {:.1f}ms", report.compile_ms);
+    std::println("");
+    std::println("  {:<18s} {:>7s} {:>10s} {:>10s} {:>10s} {:>10s} {:>9s} {:>9s}",
+                 "Feature",
+                 "Count",
+                 "p50(us)",
+                 "p90(us)",
+                 "p99(us)",
+                 "Max(us)",
+                 "Allocs",
+                 "KB");
+    for(auto& feature: report.features) {
+        std::println("  {:<18s} {:>7} {:>10.1f} {:>10.1f} {:>10.1f} {:>10.1f} {:>9.0f} {:>9.1f}",
+                     feature.name,
+                     feature.count,
+                     feature.p50_us,
+                     feature.p90_us,
+                     feature.p99_us,
+                     feature.max_us,
+                     feature.allocations,
+                     feature.allocated_kb);
+    }
+    std::println("");
+    std::println("  Allocs and KB are per call, through operator new only.");
+    std::println("===============================================================");
+}
+
+void export_report_json(const BenchmarkReport& report, llvm::StringRef output_path) {
+    auto json = kota::codec::json::to_json(report);
+    if(!json) {
+        std::println(stderr, "Failed to serialize report");
+        return;
+    }
+
+    std::ofstream out(output_path.str());
+    if(!out) {
+        std::println(stderr, "Failed to open output file: {}", output_path);
+        return;
+    }
+    out << *json;
+    std::println("Report exported to {}", output_path);
+}
+
+}  // namespace
+
+int main(int argc, const char** argv) {
+    auto args = kota::deco::util::argvify(argc, argv);
+    auto result = kota::deco::cli::parse<BenchmarkOptions>(args);
+
+    if(!result.has_value()) {
+        std::println(stderr, "Error: {}", result.error().message);
+        return 1;
+    }
+
+    auto& opts = result->options;
+
+    if(opts.help.value_or(false)) {
+        std::ostringstream oss;
+        kota::deco::cli::write_usage_for<BenchmarkOptions>(oss,
+                                                           "feature_benchmark [OPTIONS] [cdb]");
+        std::print("{}", oss.str());
+        return 0;
+    }
+
+    auto iterations = *opts.iterations;
+    auto points = *opts.points;
+    auto completion_points = *opts.completion_points;
+    if(iterations <= 0 || points < 0 || completion_points < 0) {
+        std::println(stderr,
+                     "Error: --iterations must be positive, --points and "
+                     "--completion-points not negative");
+        return 1;
+    }
+
+    auto level = spdlog::level::from_str(*opts.log_level);
+    clice::logging::options.level = level;
+    clice::logging::stderr_logger("feature_benchmark", clice::logging::options);
+
+    CompilationDatabase cdb;
+    Toolchain toolchain;
+    if(opts.cdb_path.has_value()) {
+        cdb.load(*opts.cdb_path);
+    }
+
+    std::vector<std::string> files;
+    if(!opts.corpus->empty()) {
+        files = bench::collect_corpus(*opts.corpus);
+    }
+    if(opts.file.has_value()) {
+        llvm::SmallVector<llvm::StringRef> named;
+        llvm::StringRef(*opts.file).split(named, ',', -1, false);
+        for(auto file: named) {
+            files.push_back(file.trim().str());
+        }
+    }
+    if(files.empty()) {
+        std::println(stderr, "Error: no files to measure");
+        return 1;
+    }
+
+    BenchmarkReport report;
+    Samples semantic_tokens, inlay_hints, folding_ranges, document_symbols;
+    Samples hover, code_complete, signature_help;
+    constexpr auto encoding = feature::PositionEncoding::UTF16;
+
+    for(std::size_t i = 0; i < files.size(); ++i) {
+        auto& file = files[i];
+        auto commands = cdb.lookup(file);
+        if(commands.empty()) {
+            report.failed += 1;
+            continue;
+        }
+        toolchain.resolve_or_warn(commands.front());
+        auto arguments = commands.front().to_string_argv();
+        auto directory = commands.front().resolved.directory.str();
+
+        auto params = [&](CompilationKind kind) {
+            CompilationParams cp;
+            cp.kind = kind;
+            cp.directory = directory;
+            for(auto& arg: arguments) {
+                cp.arguments.push_back(arg.c_str());
+            }
+            return cp;
+        };
+
+        auto cp = params(CompilationKind::Content);
+        auto start = std::chrono::steady_clock::now();
+        auto unit = compile(cp);
+        std::chrono::duration<double, std::milli> compile_ms =
+            std::chrono::steady_clock::now() - start;
+        if(!unit.completed()) {
+            std::println("[{:4}] failed to compile {}", i + 1, file);
+            report.failed += 1;
+            continue;
+        }
+        report.compile_ms += compile_ms.count();
+
+        auto content = unit.interested_content().str();
+        auto whole = LocalSourceRange{0, static_cast<std::uint32_t>(content.size())};
+        auto hover_points = identifier_points(content, points);
+
+        for(int n = 0; n < iterations; ++n) {
+            measure(semantic_tokens, [&] { return feature::semantic_tokens(unit, encoding); });
+            measure(inlay_hints, [&] { return feature::inlay_hints(unit, whole, {}, encoding); });
+            measure(folding_ranges, [&] { return feature::folding_ranges(unit, encoding); });
+            measure(document_symbols, [&] { return feature::document_symbols(unit, encoding); });
+            for(auto offset: hover_points) {
+                measure(hover, [&] { return feature::hover(unit, offset, {}, encoding); });
+            }
+        }
+
+        // Each request parses the file again, with the cursor in the buffer.
+        auto complete_at = identifier_points(content, completion_points);
+        auto help_at = call_points(content, completion_points);
+        for(int n = 0; n < iterations; ++n) {
+            for(auto offset: complete_at) {
+                auto cp = params(CompilationKind::Completion);
+                cp.add_remapped_file(file, content);
+                cp.completion = {file, offset};
+                measure(code_complete, [&] { return feature::code_complete(cp, {}, encoding); });
+            }
+            for(auto offset: help_at) {
+                auto cp = params(CompilationKind::Completion);
+                cp.add_remapped_file(file, content);
+                cp.completion = {file, offset};
+                measure(signature_help, [&] { return feature::signature_help(cp); });
+            }
+        }
+
+        report.files += 1;
+        std::println("[{:4}] {} ({:.1f}ms)", i + 1, file, compile_ms.count());
+    }
+
+    report.features.push_back(summarize("semantic_tokens", semantic_tokens));
+    report.features.push_back(summarize("inlay_hints", inlay_hints));
+    report.features.push_back(summarize("folding_ranges", folding_ranges));
+    report.features.push_back(summarize("document_symbols", document_symbols));
+    report.features.push_back(summarize("hover", hover));
+    report.features.push_back(summarize("code_complete", code_complete));
+    report.features.push_back(summarize("signature_help", signature_help));
+
+    std::println("");
+    print_report(report);
+
+    if(opts.export_path.has_value()) {
+        export_report_json(report, *opts.export_path);
+    }
+
+    return report.files == 0 ? 1 : 0;
+}
@@ -0,0 +1,166 @@
+/// Microbenchmark for GlobPattern and GlobSet matching on synthetic paths.
+///
+/// Usage:
+///   glob_benchmark [OPTIONS]
+///
+/// Example:
+///   ./build/RelWithDebInfo/bin/glob_benchmark --paths 300000 --rules 200
+
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <print>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "support/glob_pattern.h"
+
+#include "kota/deco/deco.h"
+#include "llvm/ADT/SmallVector.h"
+
+using namespace clice;
+
+struct BenchmarkOptions {
+    DecoKV(names = {"--paths"}; help = "Number of synthetic paths"; required = false;)
+    <int> paths = 300000;
+
+    DecoKV(names = {"--rules"}; help = "Number of synthetic rule patterns"; required = false;)
+    <int> rules = 200;
+
+    DecoKV(names = {"--runs"}; help = "Passes over the paths per measurement"; required = false;)
+    <int> runs = 5;
+
+    DecoFlag(names = {"-h", "--help"}; help = "Show help message"; required = false;)
+    help;
+};
+
+namespace {
+
+/// Paths shaped like a large C++ tree: /work/project/<component>/<dir>/<file>.
+std::vector<std::string> make_paths(int count) {
+    constexpr const char* components[] = {"src", "include", "tests", "third_party", "tools"};
+    constexpr const char* extensions[] = {".cpp", ".h", ".cc", ".hpp", ".inc", ".c"};
+    std::vector<std::string> paths;
+    paths.reserve(count);
+    for(int i = 0; i < count; ++i) {
+        paths.push_back(std::format("/work/project/{}/module{}/sub{}/file{}{}",
+                                    components[i % 5],
+                                    i % 97,
+                                    i % 13,
+                                    i,
+                                    extensions[i % 6]));
+    }
+    return paths;
+}
+
+/// A mix of the pattern shapes config rules use: anchored directories,
+/// extension filters, and brace groups.
+std::vector<std::string> make_patterns(int count) {
+    std::vector<std::string> patterns;
+    patterns.reserve(count);
+    for(int i = 0; i < count; ++i) {
+        switch(i % 4) {
+            case 0: patterns.push_back(std::format("/work/project/src/module{}/**", i)); break;
+            case 1: patterns.push_back(std::format("**/sub{}/*.cpp", i % 13)); break;
+            case 2: patterns.push_back(std::format("**/module{}/*/*.{{h,hpp}}", i)); break;
+            case 3: patterns.push_back(std::format("/work/project/tests/**/file{}*.cc", i)); break;
+        }
+    }
+    return patterns;
+}
+
+template <typename F>
+double measure(int runs, const std::vector<std::string>& paths, F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    std::uint64_t matched = 0;
+    for(int run = 0; run < runs; ++run) {
+        for(auto& path: paths) {
+            matched += f(path);
+        }
+    }
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+    std::println("    {} matches", matched / runs);
+    return seconds.count();
+}
+
+}  // namespace
+
+int main(int argc, const char** argv) {
+    auto args = kota::deco::util::argvify(argc, argv);
+    auto result = kota::deco::cli::parse<BenchmarkOptions>(args);
+
+    if(!result.has_value()) {
+        std::println(stderr, "Error: {}", result.error().message);
+        return 1;
+    }
+
+    auto& opts = result->options;
+
+    if(opts.help.value_or(false)) {
+        std::ostringstream oss;
+        kota::deco::cli::write_usage_for<BenchmarkOptions>(oss, "glob_benchmark [OPTIONS]");
+        std::print("{}", oss.str());
+        return 0;
+    }
+
+    auto runs = *opts.runs;
+    if(runs <= 0 || *opts.paths <= 0 || *opts.rules <= 0) {
+        std::println(stderr, "Error: --paths, --rules and --runs must be positive");
+        return 1;
+    }
+
+    auto paths = make_paths(*opts.paths);
+    auto sources = make_patterns(*opts.rules);
+
+    std::vector<GlobPattern> backtracking;
+    std::vector<GlobPattern> compiled;
+    GlobSet set;
+    std::size_t compiled_count = 0;
+    for(std::uint32_t i = 0; i < sources.size(); ++i) {
+        auto pattern = GlobPattern::create(sources[i]);
+        if(!pattern) {
+            std::println(stderr, "Error: invalid pattern {}: {}", sources[i], pattern.error());
+            return 1;
+        }
+        backtracking.push_back(*pattern);
+        compiled_count += pattern->compile();
+        compiled.push_back(*pattern);
+        set.add(std::move(*pattern), i);
+    }
+
+    std::println("Paths: {}", paths.size());
+    std::println("Patterns: {} ({} compiled)", sources.size(), compiled_count);
+    std::println("Runs: {}", runs);
+    std::println("");
+
+    auto total = double(paths.size()) * double(sources.size()) * runs;
+    auto report = [&](llvm::StringRef name, double seconds) {
+        std::println("  {:<14} {:>8.3f}s  {:>12.0f} pattern matches/s",
+                     name,
+                     seconds,
+                     total / seconds);
+    };
+
+    auto each = [](const std::vector<GlobPattern>& patterns) {
+        return [&patterns](const std::string& path) {
+            std::uint64_t n = 0;
+            for(auto& pattern: patterns) {
+                n += pattern.match(path);
+            }
+            return n;
+        };
+    };
+
+    std::println("  backtracking:");
+    report("backtracking", measure(runs, paths, each(backtracking)));
+    std::println("  compiled:");
+    report("compiled", measure(runs, paths, each(compiled)));
+    std::println("  glob set:");
+    report("glob set", measure(runs, paths, [&](const std::string& path) {
+               llvm::SmallVector<std::uint32_t> values;
+               set.match(path, values);
+               return std::uint64_t(values.size());
+           }));
+    return 0;
+}
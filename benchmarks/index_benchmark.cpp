@@ -0,0 +1,423 @@
+/// Benchmark for building, merging and querying the index on a real compilation
+/// database.
+///
+/// Every TU is compiled and indexed in this process, one at a time, and its
+/// index goes through the same steps the server takes: serialize, deserialize,
+/// merge into the project index and the per-file shards.  The sealed shards
+/// are then queried at the offsets of their occurrences, and the project
+/// symbols are searched by name.
+///
+/// Usage:
+///   index_benchmark [OPTIONS] <compile_commands.json>
+///
+/// Example:
+///   ./build/RelWithDebInfo/bin/index_benchmark --files 50 \
+///       /home/ykiko/C++/clice/build/compile_commands.json
+///
+///   ./build/RelWithDebInfo/bin/index_benchmark --export index.json \
+///       /home/ykiko/C++/clice/build/compile_commands.json
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <print>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "command/command.h"
+#include "command/toolchain.h"
+#include "compile/compilation.h"
+#include "index/merged_index.h"
+#include "index/project_index.h"
+#include "index/tu_index.h"
+#include "server/compiler/compiler.h"
+#include "server/compiler/indexer.h"
+#include "server/worker/worker_pool.h"
+#include "server/workspace/workspace.h"
+#include "support/logging.h"
+#include "benchmark_utils.h"
+
+#include "kota/codec/json/json.h"
+#include "kota/deco/deco.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+using namespace clice;
+
+struct BenchmarkOptions {
+    DecoKV(names = {"--log-level"}; help = "Log level: trace, debug, info, warn, error, off";
+           required = false;)
+    <std::string> log_level = "off";
+
+    DecoKV(names = {"--export"}; help = "Export the report as JSON to this path";
+           required = false;)
+    <std::string> export_path;
+
+    DecoKV(names = {"--files"}; help = "Number of TUs to index, 0 for all"; required = false;)
+    <int> files = 100;
+
+    DecoKV(names = {"--lookups"}; help = "Occurrence lookups per shard"; required = false;)
+    <int> lookups = 64;
+
+    DecoKV(names = {"--queries"}; help = "Number of symbol searches"; required = false;)
+    <int> queries = 200;
+
+    DecoFlag(names = {"-h", "--help"}; help = "Show help message"; required = false;)
+    help;
+
+    DecoInput(meta_var = "CDB"; help = "Path to compile_commands.json"; required = false;)
+    <std::string> cdb_path;
+};
+
+/// Timings of one phase, in microseconds per operation.
+struct PhaseReport {
+    std::string name;
+    std::size_t count = 0;
+    double total_ms = 0;
+    double per_second = 0;
+    double p50_us = 0;
+    double p99_us = 0;
+    double max_us = 0;
+};
+
+struct BenchmarkReport {
+    std::string cdb;
+    std::size_t files = 0;
+    std::size_t failed = 0;
+    std::size_t shards = 0;
+    std::size_t symbols = 0;
+    std::uint64_t serialized_bytes = 0;
+    std::uint64_t peak_rss_bytes = 0;
+    std::vector<PhaseReport> phases;
+};
+
+/// Peak resident set size of this process in bytes, 0 when unavailable.
+std::uint64_t peak_rss() {
+#if defined(__APPLE__)
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<std::uint64_t>(usage.ru_maxrss);
+#elif defined(__unix__)
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024;
+#else
+    return 0;
+#endif
+}
+
+PhaseReport summarize(std::string name, std::vector<double>& samples) {
+    PhaseReport report;
+    report.name = std::move(name);
+    report.count = samples.size();
+    if(samples.empty()) {
+        return report;
+    }
+
+    std::ranges::sort(samples);
+
+    double total_us = 0;
+    for(auto us: samples) {
+        total_us += us;
+    }
+    report.total_ms = total_us / 1000.0;
+    report.per_second = total_us > 0 ? static_cast<double>(samples.size()) * 1e6 / total_us : 0;
+    report.p50_us = bench::percentile(samples, 0.50);
+    report.p99_us = bench::percentile(samples, 0.99);
+    report.max_us = samples.back();
+    return report;
+}
+
+void print_report(const BenchmarkReport& report) {
+    std::println("===============================================================");
+    std::println("                        Index Report");
+    std::println("===============================================================");
+    std::println("");
+    std::println("  TUs indexed:        {} ({} failed)", report.files, report.failed);
+    std::println("  Shards:             {}", report.shards);
+    std::println("  Project symbols:    {}", report.symbols);
+    std::println("  Serialized indices: {:.1f}MB",
+                 static_cast<double>(report.serialized_bytes) / (1024.0 * 1024.0));
+    std::println("  Peak RSS:           {:.1f}MB",
+                 static_cast<double>(report.peak_rss_bytes) / (1024.0 * 1024.0));
+    std::println("");
+    std::println("  {:<18s} {:>8s} {:>11s} {:>11s} {:>10s} {:>10s} {:>10s}",
+                 "Phase",
+                 "Count",
+                 "Total(ms)",
+                 "Ops/s",
+                 "p50(us)",
+                 "p99(us)",
+                 "Max(us)");
+    for(auto& phase: report.phases) {
+        std::println("  {:<18s} {:>8} {:>11.1f} {:>11.1f} {:>10.1f} {:>10.1f} {:>10.1f}",
+                     phase.name,
+                     phase.count,
+                     phase.total_ms,
+                     phase.per_second,
+                     phase.p50_us,
+                     phase.p99_us,
+                     phase.max_us);
+    }
+    std::println("");
+    std::println("===============================================================");
+}
+
+void export_report_json(const BenchmarkReport& report, llvm::StringRef output_path) {
+    auto json = kota::codec::json::to_json(report);
+    if(!json) {
+        std::println(stderr, "Failed to serialize report");
+        return;
+    }
+
+    std::ofstream out(output_path.str());
+    if(!out) {
+        std::println(stderr, "Failed to open output file: {}", output_path);
+        return;
+    }
+    out << *json;
+    std::println("Report exported to {}", output_path);
+}
+
+int main(int argc, const char** argv) {
+    auto args = kota::deco::util::argvify(argc, argv);
+    auto result = kota::deco::cli::parse<BenchmarkOptions>(args);
+
+    if(!result.has_value()) {
+        std::println(stderr, "Error: {}", result.error().message);
+        return 1;
+    }
+
+    auto& opts = result->options;
+
+    if(opts.help.value_or(false) || !opts.cdb_path.has_value()) {
+        std::ostringstream oss;
+        kota::deco::cli::write_usage_for<BenchmarkOptions>(oss, "index_benchmark [OPTIONS] <cdb>");
+        std::print("{}", oss.str());
+        return opts.help.value_or(false) ? 0 : 1;
+    }
+
+    auto level = spdlog::level::from_str(*opts.log_level);
+    clice::logging::options.level = level;
+    clice::logging::stderr_logger("index_benchmark", clice::logging::options);
+
+    auto max_files = *opts.files;
+    auto lookups = *opts.lookups;
+    auto queries = *opts.queries;
+    if(max_files < 0 || lookups < 0 || queries < 0) {
+        std::println(stderr, "Error: --files, --lookups and --queries must not be negative");
+        return 1;
+    }
+
+    BenchmarkReport report;
+    report.cdb = *opts.cdb_path;
+
+    CompilationDatabase cdb;
+    Toolchain toolchain;
+    auto count = cdb.load(report.cdb);
+    std::println("CDB: {} ({} entries)", report.cdb, count);
+
+    // A file with several commands is indexed once, as the server does.
+    std::vector<std::string> files;
+    llvm::DenseSet<std::uint32_t> seen;
+    for(auto& entry: cdb.get_entries()) {
+        if(max_files != 0 && files.size() >= static_cast<std::size_t>(max_files)) {
+            break;
+        }
+        if(seen.insert(entry.file).second) {
+            files.push_back(cdb.resolve_path(entry.file).str());
+        }
+    }
+    std::println("Indexing {} TU(s)...\n", files.size());
+
+    std::vector<double> compile_us, build_us, serialize_us, deserialize_us;
+    std::vector<double> project_merge_us, shard_merge_us, seal_us;
+    std::vector<double> lookup_us, context_lookup_us, search_us;
+
+    index::ProjectIndex project;
+    llvm::DenseMap<std::uint32_t, index::MergedIndex> shards;
+
+    /// Offsets of the occurrences each shard got, to look up afterwards.
+    llvm::DenseMap<std::uint32_t, std::vector<std::uint32_t>> offsets;
+
+    for(std::size_t i = 0; i < files.size(); ++i) {
+        auto& file = files[i];
+        auto commands = cdb.lookup(file);
+        if(commands.empty()) {
+            report.failed += 1;
+            continue;
+        }
+        toolchain.resolve_or_warn(commands.front());
+        auto arguments = commands.front().to_string_argv();
+
+        CompilationParams cp;
+        cp.kind = CompilationKind::Indexing;
+        cp.directory = commands.front().resolved.directory.str();
+        for(auto& arg: arguments) {
+            cp.arguments.push_back(arg.c_str());
+        }
+
+        // The AST is dropped before merging, like a worker would.
+        std::string buffer;
+        {
+            auto unit = bench::measure(compile_us, [&] { return compile(cp); });
+            if(!unit.completed()) {
+                std::println("[{:4}] failed to compile {}", i + 1, file);
+                report.failed += 1;
+                continue;
+            }
+
+            auto built = bench::measure(build_us, [&] { return index::TUIndex::build(unit); });
+
+            llvm::raw_string_ostream os(buffer);
+            bench::measure(serialize_us, [&] { built.serialize(os); });
+        }
+        report.serialized_bytes += buffer.size();
+
+        auto tu =
+            bench::measure(deserialize_us, [&] { return index::TUIndex::from(buffer.data()); });
+        if(tu.graph.paths.empty()) {
+            report.failed += 1;
+            continue;
+        }
+
+        auto ids = bench::measure(project_merge_us, [&] { return project.merge(tu); });
+        auto main_tu_path_id = static_cast<std::uint32_t>(tu.graph.paths.size() - 1);
+
+        auto merge_shard = [&](std::uint32_t tu_path_id, index::FileIndex& file_index) {
+            auto path_id = ids[tu_path_id];
+            auto& sampled = offsets[path_id];
+            for(auto& occurrence: file_index.occurrences) {
+                if(sampled.size() >= static_cast<std::size_t>(lookups)) {
+                    break;
+                }
+                sampled.push_back(occurrence.range.begin);
+            }
+
+            std::string content;
+            if(auto buf = llvm::MemoryBuffer::getFile(project.path_pool.path(path_id))) {
+                content = (*buf)->getBuffer().str();
+            }
+
+            auto& shard = shards[path_id];
+            if(tu_path_id == main_tu_path_id) {
+                std::vector<index::IncludeLocation> include_locations;
+                for(auto& location: tu.graph.locations) {
+                    index::IncludeLocation remapped = location;
+                    remapped.path_id = ids[location.path_id];
+                    include_locations.push_back(remapped);
+                }
+                bench::measure(shard_merge_us, [&] {
+                    return shard.merge(path_id,
+                                       tu.built_at,
+                                       std::move(include_locations),
+                                       file_index,
+                                       content);
+                });
+                return;
+            }
+
+            auto& locations = tu.graph.locations;
+            auto it = std::ranges::find(locations, tu_path_id, &index::IncludeLocation::path_id);
+            if(it == locations.end()) {
+                return;
+            }
+            auto include_id = static_cast<std::uint32_t>(it - locations.begin());
+            bench::measure(shard_merge_us,
+                    [&] { return shard.merge(path_id, include_id, file_index, content); });
+        };
+        for(auto& [tu_path_id, file_index]: tu.path_file_indices) {
+            merge_shard(tu_path_id, file_index);
+        }
+        merge_shard(main_tu_path_id, tu.main_file_index);
+
+        report.files += 1;
+        std::println("[{:4}] {} ({} paths, {} symbols)",
+                     i + 1,
+                     file,
+                     tu.graph.paths.size(),
+                     tu.symbols.size());
+    }
+
+    // Queries run on sealed shards, the form the server keeps them in.
+    for(auto& [path_id, shard]: shards) {
+        bench::measure(seal_us, [&] { shard.seal(); });
+
+        auto context = shard.context_index(path_id);
+        for(auto offset: offsets[path_id]) {
+            bench::measure(lookup_us, [&] {
+                shard.lookup(offset, [](const index::Occurrence&) { return true; });
+            });
+            if(context) {
+                bench::measure(context_lookup_us, [&] {
+                    shard.lookup_in_context(*context,
+                                            offset,
+                                            [](const index::Occurrence&) { return true; });
+                });
+            }
+        }
+    }
+
+    report.shards = shards.size();
+    report.symbols = project.symbols.size();
+
+    // Queries are the leading characters of project symbols, spread over
+    // the table, so most of them match something.
+    std::vector<std::string> names;
+    if(queries > 0 && !project.symbols.empty()) {
+        auto stride = std::max<std::size_t>(1, project.symbols.size() / queries);
+        std::size_t n = 0;
+        for(auto& [hash, symbol]: project.symbols) {
+            if(names.size() >= static_cast<std::size_t>(queries)) {
+                break;
+            }
+            auto name = project.name_of(symbol);
+            if(n++ % stride == 0 && !name.empty()) {
+                names.push_back(name.take_front(4).str());
+            }
+        }
+    }
+
+    {
+        kota::event_loop loop;
+        Workspace workspace;
+        workspace.project_index = std::move(project);
+        workspace.merged_indices = std::move(shards);
+        WorkerPool pool(loop);
+        Compiler compiler(loop, workspace, pool);
+        Indexer indexer(loop, workspace, pool, compiler);
+
+        for(auto& name: names) {
+            bench::measure(search_us, [&] { return indexer.search_symbols(name, 100); });
+        }
+    }
+
+    report.peak_rss_bytes = peak_rss();
+    report.phases.push_back(summarize("compile", compile_us));
+    report.phases.push_back(summarize("build", build_us));
+    report.phases.push_back(summarize("serialize", serialize_us));
+    report.phases.push_back(summarize("deserialize", deserialize_us));
+    report.phases.push_back(summarize("project_merge", project_merge_us));
+    report.phases.push_back(summarize("shard_merge", shard_merge_us));
+    report.phases.push_back(summarize("seal", seal_us));
+    report.phases.push_back(summarize("lookup", lookup_us));
+    report.phases.push_back(summarize("lookup_in_context", context_lookup_us));
+    report.phases.push_back(summarize("search_symbols", search_us));
+
+    std::println("");
+    print_report(report);
+
+    if(opts.export_path.has_value()) {
+        export_report_json(report, *opts.export_path);
+    }
+
+    return 0;
+}
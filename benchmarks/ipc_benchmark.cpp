@@ -0,0 +1,446 @@
+/// Benchmark for the transport between the master and its workers.
+///
+/// The benchmark spawns itself twice with `--child`, as a stateful and as a
+/// stateless worker.  Each child opens its stdio transport and BincodePeer
+/// the way run_stateful_worker_mode() and run_stateless_worker_mode() do, but
+/// answers with stub handlers, so only encoding, pipes and dispatch are timed:
+///
+///   compile  CompileParams carrying the payload as text, small CompileResult
+///   query    small QueryParams, a JSON result of the payload size
+///   index    small BuildParams, a BuildResult whose tu_index_data is the payload
+///
+/// Every scenario runs at each `--payloads` size: one request at a time for
+/// the round-trip latency, then `--inflight` at a time for messages and MB
+/// per second.
+///
+/// Usage:
+///   ipc_benchmark [OPTIONS]
+///
+/// Example:
+///   ./build/RelWithDebInfo/bin/ipc_benchmark --payloads 0,4096,1048576 --inflight 16
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <print>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "server/protocol/worker.h"
+#include "support/logging.h"
+#include "benchmark_utils.h"
+
+#include "kota/async/async.h"
+#include "kota/codec/json/json.h"
+#include "kota/deco/deco.h"
+#include "kota/ipc/codec/bincode.h"
+#include "kota/ipc/peer.h"
+#include "kota/ipc/transport.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/FileSystem.h"
+
+using namespace clice;
+
+struct BenchmarkOptions {
+    DecoKV(names = {"--log-level"}; help = "Log level: trace, debug, info, warn, error, off";
+           required = false;)
+    <std::string> log_level = "off";
+
+    DecoKV(names = {"--export"}; help = "Export the report as JSON to this path";
+           required = false;)
+    <std::string> export_path;
+
+    DecoKV(names = {"--payloads"}; help = "Payload sizes in bytes, separated by commas";
+           required = false;)
+    <std::string> payloads = "0,1024,65536,1048576,16777216";
+
+    DecoKV(names = {"--messages"}; help = "Requests per scenario and payload size";
+           required = false;)
+    <int> messages = 2000;
+
+    DecoKV(names = {"--budget"}; help = "Megabytes sent per scenario and size at most";
+           required = false;)
+    <int> budget = 512;
+
+    DecoKV(names = {"--inflight"}; help = "Requests in flight for the throughput runs";
+           required = false;)
+    <int> inflight = 16;
+
+    DecoKV(names = {"--child"}; help = "Internal: serve as a stub stateful or stateless worker";
+           required = false;)
+    <std::string> child;
+
+    DecoFlag(names = {"-h", "--help"}; help = "Show help message"; required = false;)
+    help;
+};
+
+/// One scenario at one payload size.
+struct ScenarioReport {
+    std::string name;
+    std::uint64_t payload = 0;
+    std::size_t count = 0;
+    double p50_us = 0;
+    double p99_us = 0;
+    double max_us = 0;
+    double messages_per_second = 0;
+    double mb_per_second = 0;
+};
+
+struct BenchmarkReport {
+    int inflight = 0;
+    std::vector<ScenarioReport> scenarios;
+};
+
+namespace {
+
+using kota::ipc::RequestResult;
+using RequestContext = kota::ipc::BincodePeer::RequestContext;
+
+/// A JSON string of `size` bytes in all.
+kota::codec::RawValue json_payload(std::uint64_t size) {
+    auto length = size < 2 ? 0 : size - 2;
+    return kota::codec::RawValue{"\"" + std::string(length, 'x') + "\""};
+}
+
+/// The stub worker: the transport of the real worker modes, without their
+/// handlers' work.
+int run_child(llvm::StringRef mode) {
+    kota::event_loop loop;
+
+    auto transport_result = kota::ipc::StreamTransport::open_stdio(loop);
+    if(!transport_result) {
+        LOG_ERROR("Failed to open stdio transport");
+        return 1;
+    }
+
+    kota::ipc::BincodePeer peer(loop, std::move(*transport_result));
+
+    if(mode == "stateful") {
+        peer.on_request([](RequestContext&, const worker::CompileParams& params)
+                            -> RequestResult<worker::CompileParams> {
+            co_return worker::CompileResult{
+                .version = params.version,
+                .diagnostics = kota::codec::RawValue{"[]"},
+            };
+        });
+        peer.on_request([](RequestContext&, const worker::QueryParams& params)
+                            -> RequestResult<worker::QueryParams> {
+            co_return json_payload(params.offset);
+        });
+    } else {
+        peer.on_request([](RequestContext&, const worker::BuildParams& params)
+                            -> RequestResult<worker::BuildParams> {
+            worker::BuildResult result;
+            result.tu_index_data.assign(params.offset, 'x');
+            co_return result;
+        });
+    }
+
+    loop.schedule(peer.run());
+    return loop.run();
+}
+
+/// A stub worker spawned from this binary, and the master's end of its pipes.
+struct Child {
+    kota::process proc;
+    std::unique_ptr<kota::ipc::BincodePeer> peer;
+};
+
+std::optional<Child> spawn_child(kota::event_loop& loop,
+                                 const std::string& self,
+                                 const std::string& mode,
+                                 kota::task_group<>& io_group) {
+    kota::process::options opts;
+    opts.file = self;
+    opts.args = {self, "--child", mode};
+    opts.streams = {
+        kota::process::stdio::pipe(true, false),
+        kota::process::stdio::pipe(false, true),
+        kota::process::stdio::pipe(false, true),
+    };
+
+    auto result = kota::process::spawn(opts, loop);
+    if(!result) {
+        std::println(stderr, "Failed to spawn {} child: {}", mode, result.error().message());
+        return std::nullopt;
+    }
+
+    auto& spawn = *result;
+    auto transport = std::make_unique<kota::ipc::StreamTransport>(std::move(spawn.stdout_pipe),
+                                                                  std::move(spawn.stdin_pipe));
+    Child child{
+        .proc = std::move(spawn.proc),
+        .peer = std::make_unique<kota::ipc::BincodePeer>(loop, std::move(transport)),
+    };
+
+    // Stub workers do not log; their stderr is read only so that it never
+    // fills up.
+    io_group.spawn([](kota::pipe pipe) -> kota::task<> {
+        while(true) {
+            auto chunk = co_await pipe.read();
+            if(!chunk.has_value() || chunk.value().empty())
+                break;
+        }
+    }(std::move(spawn.stderr_pipe)));
+    io_group.spawn(child.peer->run());
+    return child;
+}
+
+/// Sends one request of a scenario and checks its answer arrived.
+using Send = std::function<kota::task<bool>()>;
+
+struct Scenario {
+    std::string name;
+    std::uint64_t payload = 0;
+    Send send;
+};
+
+/// Send `count` requests, `inflight` at a time; the duration of each, in
+/// microseconds, goes to `samples`.  Returns the wall time in seconds, or
+/// a negative value if a request failed.
+kota::task<double> run_requests(kota::event_loop& loop,
+                                const Send& send,
+                                std::size_t count,
+                                std::size_t inflight,
+                                std::vector<double>& samples) {
+    std::size_t next = 0;
+    bool failed = false;
+    auto sender = [&]() -> kota::task<> {
+        while(next < count && !failed) {
+            next += 1;
+            auto start = std::chrono::steady_clock::now();
+            if(!co_await send()) {
+                failed = true;
+                co_return;
+            }
+            std::chrono::duration<double, std::micro> elapsed =
+                std::chrono::steady_clock::now() - start;
+            samples.push_back(elapsed.count());
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    kota::task_group<> group{loop};
+    for(std::size_t i = 0; i < inflight; ++i) {
+        group.spawn(sender());
+    }
+    co_await group.join();
+    std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+    co_return failed ? -1.0 : wall.count();
+}
+
+kota::task<> run_benchmark(kota::event_loop& loop,
+                           const std::string& self,
+                           llvm::ArrayRef<std::uint64_t> payloads,
+                           const BenchmarkOptions& opts,
+                           BenchmarkReport& report,
+                           int& exit_code) {
+    kota::task_group<> io_group{loop};
+    auto stateful = spawn_child(loop, self, "stateful", io_group);
+    auto stateless = spawn_child(loop, self, "stateless", io_group);
+    if(!stateful || !stateless) {
+        co_return;
+    }
+
+    std::vector<Scenario> scenarios;
+    for(auto size: payloads) {
+        auto text = std::make_shared<std::string>(size, 'x');
+        scenarios.push_back({"compile", size, [&stateful, text]() -> kota::task<bool> {
+                                 worker::CompileParams params{
+                                     .path = "/bench/main.cpp",
+                                     .version = 1,
+                                     .text = *text,
+                                 };
+                                 auto result = co_await stateful->peer->send_request(params);
+                                 co_return result.has_value();
+                             }});
+        scenarios.push_back({"query", size, [&stateful, size]() -> kota::task<bool> {
+                                 worker::QueryParams params{
+                                     .kind = worker::QueryKind::Hover,
+                                     .path = "/bench/main.cpp",
+                                     .offset = static_cast<std::uint32_t>(size),
+                                 };
+                                 auto result = co_await stateful->peer->send_request(params);
+                                 co_return result.has_value() && result->data.size() >= size;
+                             }});
+        scenarios.push_back({"index", size, [&stateless, size]() -> kota::task<bool> {
+                                 worker::BuildParams params;
+                                 params.kind = worker::BuildKind::Index;
+                                 params.file = "/bench/main.cpp";
+                                 params.offset = static_cast<std::uint32_t>(size);
+                                 auto result = co_await stateless->peer->send_request(params);
+                                 co_return result.has_value() &&
+                                     result->tu_index_data.size() == size;
+                             }});
+    }
+
+    auto budget = static_cast<std::uint64_t>(*opts.budget) * 1024 * 1024;
+    auto inflight = static_cast<std::size_t>(*opts.inflight);
+    for(auto& scenario: scenarios) {
+        auto count = static_cast<std::size_t>(*opts.messages);
+        if(scenario.payload != 0) {
+            count = std::clamp<std::size_t>(budget / scenario.payload, 8, count);
+        }
+
+        // Round trips one at a time give the latency, with nothing queued
+        // ahead of them.
+        std::vector<double> samples;
+        auto serial = co_await run_requests(loop, scenario.send, count, 1, samples);
+        std::vector<double> pipelined_samples;
+        auto pipelined =
+            co_await run_requests(loop, scenario.send, count, inflight, pipelined_samples);
+        if(serial < 0 || pipelined < 0) {
+            std::println(stderr, "Error: a {} request failed", scenario.name);
+            co_return;
+        }
+
+        ScenarioReport entry;
+        entry.name = scenario.name;
+        entry.payload = scenario.payload;
+        entry.count = samples.size();
+        std::ranges::sort(samples);
+        entry.p50_us = bench::percentile(samples, 0.50);
+        entry.p99_us = bench::percentile(samples, 0.99);
+        entry.max_us = samples.back();
+        if(pipelined > 0) {
+            entry.messages_per_second = static_cast<double>(count) / pipelined;
+            entry.mb_per_second = static_cast<double>(count * scenario.payload) / pipelined /
+                                  (1024.0 * 1024.0);
+        }
+        report.scenarios.push_back(std::move(entry));
+    }
+
+    // The children exit once their input is closed.
+    stateful->peer->close_output();
+    stateless->peer->close_output();
+    co_await stateful->proc.wait();
+    co_await stateless->proc.wait();
+    co_await io_group.join();
+    exit_code = 0;
+}
+
+void print_report(const BenchmarkReport& report) {
+    std::println("===============================================================");
+    std::println("                         IPC Report");
+    std::println("===============================================================");
+    std::println("");
+    std::println("  Latency one request at a time, throughput with {} in flight.",
+                 report.inflight);
+    std::println("");
+    std::println("  {:<10s} {:>10s} {:>7s} {:>10s} {:>10s} {:>10s} {:>10s} {:>9s}",
+                 "Scenario",
+                 "Payload",
+                 "Count",
+                 "p50(us)",
+                 "p99(us)",
+                 "Max(us)",
+                 "Msgs/s",
+                 "MB/s");
+    for(auto& scenario: report.scenarios) {
+        std::println("  {:<10s} {:>10} {:>7} {:>10.1f} {:>10.1f} {:>10.1f} {:>10.0f} {:>9.1f}",
+                     scenario.name,
+                     scenario.payload,
+                     scenario.count,
+                     scenario.p50_us,
+                     scenario.p99_us,
+                     scenario.max_us,
+                     scenario.messages_per_second,
+                     scenario.mb_per_second);
+    }
+    std::println("");
+    std::println("===============================================================");
+}
+
+void export_report_json(const BenchmarkReport& report, llvm::StringRef output_path) {
+    auto json = kota::codec::json::to_json(report);
+    if(!json) {
+        std::println(stderr, "Failed to serialize report");
+        return;
+    }
+
+    std::ofstream out(output_path.str());
+    if(!out) {
+        std::println(stderr, "Failed to open output file: {}", output_path);
+        return;
+    }
+    out << *json;
+    std::println("Report exported to {}", output_path);
+}
+
+}  // namespace
+
+int main(int argc, const char** argv) {
+    auto args = kota::deco::util::argvify(argc, argv);
+    auto result = kota::deco::cli::parse<BenchmarkOptions>(args);
+
+    if(!result.has_value()) {
+        std::println(stderr, "Error: {}", result.error().message);
+        return 1;
+    }
+
+    auto& opts = result->options;
+
+    if(opts.help.value_or(false)) {
+        std::ostringstream oss;
+        kota::deco::cli::write_usage_for<BenchmarkOptions>(oss, "ipc_benchmark [OPTIONS]");
+        std::print("{}", oss.str());
+        return 0;
+    }
+
+    auto level = spdlog::level::from_str(*opts.log_level);
+    clice::logging::options.level = level;
+    clice::logging::stderr_logger("ipc_benchmark", clice::logging::options);
+
+    if(opts.child.has_value()) {
+        return run_child(*opts.child);
+    }
+
+    if(*opts.messages <= 0 || *opts.budget <= 0 || *opts.inflight <= 0) {
+        std::println(stderr, "Error: --messages, --budget and --inflight must be positive");
+        return 1;
+    }
+
+    std::vector<std::uint64_t> payloads;
+    llvm::SmallVector<llvm::StringRef> sizes;
+    llvm::StringRef(*opts.payloads).split(sizes, ',', -1, false);
+    for(auto size: sizes) {
+        std::uint64_t value = 0;
+        if(size.trim().getAsInteger(10, value) || value > UINT32_MAX) {
+            std::println(stderr, "Error: invalid payload size '{}'", size);
+            return 1;
+        }
+        payloads.push_back(value);
+    }
+    if(payloads.empty()) {
+        std::println(stderr, "Error: no payload sizes");
+        return 1;
+    }
+
+    auto self = llvm::sys::fs::getMainExecutable(argv[0], reinterpret_cast<void*>(&run_child));
+
+    BenchmarkReport report;
+    report.inflight = *opts.inflight;
+    int exit_code = 1;
+    {
+        kota::event_loop loop;
+        loop.schedule(run_benchmark(loop, self, payloads, opts, report, exit_code));
+        loop.run();
+    }
+    if(exit_code != 0) {
+        return exit_code;
+    }
+
+    print_report(report);
+
+    if(opts.export_path.has_value()) {
+        export_report_json(report, *opts.export_path);
+    }
+
+    return 0;
+}
@@ -0,0 +1,185 @@
+/// Microbenchmark for markup::Document rendering, over the hovers recorded
+/// in the hover snapshots.
+///
+/// Usage:
+///   markup_benchmark [OPTIONS]
+///
+/// Example:
+///   ./build/RelWithDebInfo/bin/markup_benchmark --snapshots tests/snapshots/hover/snapshot
+
+#include <chrono>
+#include <cstdint>
+#include <print>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "feature/feature.h"
+#include "support/filesystem.h"
+#include "support/markup.h"
+
+#include "kota/deco/deco.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/YAMLParser.h"
+
+using namespace clice;
+
+struct BenchmarkOptions {
+    DecoKV(names = {"--snapshots"}; help = "Directory of hover snapshots"; required = false;)
+    <std::string> snapshots = "tests/snapshots/hover/snapshot";
+
+    DecoKV(names = {"--runs"}; help = "Passes over the documents per measurement";
+           required = false;)
+    <int> runs = 2000;
+
+    DecoFlag(names = {"-h", "--help"}; help = "Show help message"; required = false;)
+    help;
+};
+
+namespace {
+
+/// The string fields of one recorded hover.
+void read_hover(llvm::yaml::MappingNode& node, feature::HoverInfo& info) {
+    for(auto& field: node) {
+        auto* key = llvm::dyn_cast_or_null<llvm::yaml::ScalarNode>(field.getKey());
+        auto* value = llvm::dyn_cast_or_null<llvm::yaml::ScalarNode>(field.getValue());
+        if(!key || !value) {
+            continue;
+        }
+
+        llvm::SmallString<64> key_storage;
+        llvm::SmallString<256> value_storage;
+        auto name = key->getValue(key_storage);
+        auto text = value->getValue(value_storage).str();
+        if(name == "name") {
+            info.name = std::move(text);
+        } else if(name == "namespace_scope") {
+            info.namespace_scope = std::move(text);
+        } else if(name == "local_scope") {
+            info.local_scope = std::move(text);
+        } else if(name == "documentation") {
+            info.documentation = std::move(text);
+        } else if(name == "definition") {
+            info.definition = std::move(text);
+        } else if(name == "type") {
+            info.type = feature::HoverInfo::PrintedType(text);
+        } else if(name == "return_type") {
+            info.return_type = feature::HoverInfo::PrintedType(text);
+        } else if(name == "value") {
+            info.value = std::move(text);
+        }
+    }
+}
+
+/// Every hover of every snapshot under `dir`, laid out as documents.
+std::vector<markup::Document> load_documents(llvm::StringRef dir) {
+    std::vector<markup::Document> documents;
+    std::error_code ec;
+    for(fs::directory_iterator it(dir, ec), end; it != end && !ec; it.increment(ec)) {
+        auto buffer = llvm::MemoryBuffer::getFile(it->path());
+        if(!buffer) {
+            continue;
+        }
+
+        llvm::SourceMgr sm;
+        llvm::yaml::Stream stream((*buffer)->getBuffer(), sm);
+        for(auto& document: stream) {
+            auto* entries = llvm::dyn_cast_or_null<llvm::yaml::MappingNode>(document.getRoot());
+            if(!entries) {
+                continue;
+            }
+            for(auto& entry: *entries) {
+                auto* hover = llvm::dyn_cast_or_null<llvm::yaml::MappingNode>(entry.getValue());
+                if(!hover) {
+                    continue;
+                }
+                feature::HoverInfo info;
+                read_hover(*hover, info);
+                if(!info.name.empty()) {
+                    documents.push_back(info.present());
+                }
+            }
+        }
+    }
+    return documents;
+}
+
+template <typename F>
+double measure(int runs, const std::vector<markup::Document>& documents, F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    std::uint64_t bytes = 0;
+    for(int run = 0; run < runs; ++run) {
+        for(auto& document: documents) {
+            bytes += f(document);
+        }
+    }
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+    std::println("    {} bytes per pass", bytes / runs);
+    return seconds.count();
+}
+
+}  // namespace
+
+int main(int argc, const char** argv) {
+    auto args = kota::deco::util::argvify(argc, argv);
+    auto result = kota::deco::cli::parse<BenchmarkOptions>(args);
+
+    if(!result.has_value()) {
+        std::println(stderr, "Error: {}", result.error().message);
+        return 1;
+    }
+
+    auto& opts = result->options;
+
+    if(opts.help.value_or(false)) {
+        std::ostringstream oss;
+        kota::deco::cli::write_usage_for<BenchmarkOptions>(oss, "markup_benchmark [OPTIONS]");
+        std::print("{}", oss.str());
+        return 0;
+    }
+
+    auto runs = *opts.runs;
+    if(runs <= 0) {
+        std::println(stderr, "Error: --runs must be positive");
+        return 1;
+    }
+
+    auto documents = load_documents(*opts.snapshots);
+    if(documents.empty()) {
+        std::println(stderr, "Error: no hovers found in {}", *opts.snapshots);
+        return 1;
+    }
+
+    std::println("Documents: {}", documents.size());
+    std::println("Runs: {}", runs);
+    std::println("");
+
+    auto total = double(documents.size()) * runs;
+    auto report = [&](llvm::StringRef name, double seconds) {
+        std::println("  {:<16} {:>8.3f}s  {:>12.0f} documents/s", name, seconds, total / seconds);
+    };
+
+    std::string buffer;
+    std::println("  markdown:");
+    report("as_markdown", measure(runs, documents, [](const markup::Document& document) {
+               return document.as_markdown().size();
+           }));
+    report("reused buffer", measure(runs, documents, [&](const markup::Document& document) {
+               buffer.clear();
+               document.render_markdown(buffer);
+               return buffer.size();
+           }));
+
+    std::println("  plain text:");
+    report("as_plain_text", measure(runs, documents, [](const markup::Document& document) {
+               return document.as_plain_text().size();
+           }));
+    report("reused buffer", measure(runs, documents, [&](const markup::Document& document) {
+               buffer.clear();
+               document.render_plain_text(buffer);
+               return buffer.size();
+           }));
+    return 0;
+}
@@ -0,0 +1,509 @@
+/// Benchmark replaying an LSP session recorded with `clice serve --record`.
+///
+/// The trace is sent to a fresh `clice serve` with its original timing,
+/// scaled by `--speed` (0 sends every message as soon as the previous one
+/// is written).  Requests of the trace are timed until their response, and
+/// before the trace shuts the server down its `clice/workerStats` are read.
+/// The report lists latency percentiles per method, worker utilization and
+/// peak memory, builds per kind and the peak RSS of the master, so two
+/// clice builds can be compared on the same trace.
+///
+/// Usage:
+///   replay_benchmark [OPTIONS] <trace.jsonl>
+///
+/// Example:
+///   ./build/RelWithDebInfo/bin/replay_benchmark --speed 4 tests/smoke/session.jsonl
+///
+///   ./build/RelWithDebInfo/bin/replay_benchmark --clice /opt/clice-old/bin/clice \
+///       --workspace ~/src/project ~/traces/project.jsonl
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <format>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <print>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "benchmark_utils.h"
+
+#include "kota/deco/deco.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+
+struct BenchmarkOptions {
+    DecoKV(names = {"--clice"}; help = "clice executable, by default the one next to this binary";
+           required = false;)
+    <std::string> clice;
+
+    DecoKV(names = {"--speed"}; help = "Timing factor, 2 replays twice as fast, 0 without pauses";
+           required = false;)
+    <double> speed = 1.0;
+
+    DecoKV(names = {"--workspace"}; help = "Replace the recorded workspace root by this directory";
+           required = false;)
+    <std::string> workspace;
+
+    DecoKV(names = {"--timeout"}; help = "Seconds to wait for outstanding responses";
+           required = false;)
+    <int> timeout = 60;
+
+    DecoFlag(names = {"-h", "--help"}; help = "Show help message"; required = false;)
+    help;
+
+    DecoInput(meta_var = "TRACE"; help = "Trace recorded with clice serve --record";
+              required = false;)
+    <std::string> trace;
+};
+
+namespace {
+
+struct Record {
+    double ts = 0;
+    std::string message;
+};
+
+std::optional<std::vector<Record>> load_trace(llvm::StringRef path) {
+    auto buffer = llvm::MemoryBuffer::getFile(path);
+    if(!buffer)
+        return std::nullopt;
+    std::vector<Record> records;
+    llvm::SmallVector<llvm::StringRef> lines;
+    (*buffer)->getBuffer().split(lines, '\n', -1, false);
+    for(auto line: lines) {
+        if(line.trim().empty())
+            continue;
+        auto value = llvm::json::parse(line);
+        if(!value) {
+            llvm::consumeError(value.takeError());
+            return std::nullopt;
+        }
+        auto* object = value->getAsObject();
+        auto ts = object ? object->getNumber("ts") : std::nullopt;
+        auto message = object ? object->getString("msg") : std::nullopt;
+        if(!ts || !message)
+            return std::nullopt;
+        records.push_back({*ts, message->str()});
+    }
+    return records;
+}
+
+/// The path of the rootUri that the trace's initialize sent.
+std::optional<std::string> recorded_root(llvm::ArrayRef<Record> records) {
+    for(auto& record: records) {
+        auto value = llvm::json::parse(record.message);
+        if(!value) {
+            llvm::consumeError(value.takeError());
+            continue;
+        }
+        auto* object = value->getAsObject();
+        if(!object || object->getString("method") != "initialize")
+            continue;
+        auto* params = object->getObject("params");
+        auto uri = params ? params->getString("rootUri") : std::nullopt;
+        if(!uri || !uri->consume_front("file://"))
+            return std::nullopt;
+        return uri->str();
+    }
+    return std::nullopt;
+}
+
+/// The method of a JSON-RPC message, empty for responses.
+std::string method_of(llvm::StringRef message) {
+    auto value = llvm::json::parse(message);
+    if(!value) {
+        llvm::consumeError(value.takeError());
+        return {};
+    }
+    auto* object = value->getAsObject();
+    auto method = object ? object->getString("method") : std::nullopt;
+    return method ? method->str() : std::string();
+}
+
+/// Key of a JSON-RPC id, integer or string.
+std::string id_key(const llvm::json::Value& id) {
+    std::string key;
+    llvm::raw_string_ostream os(key);
+    os << id;
+    return key;
+}
+
+/// Peak resident set size of `pid` in bytes, 0 where unavailable.
+std::uint64_t peak_resident_memory(pid_t pid) {
+    auto status = llvm::MemoryBuffer::getFileAsStream(std::format("/proc/{}/status", pid));
+    if(!status)
+        return 0;
+    llvm::StringRef rest = (*status)->getBuffer();
+    while(!rest.empty()) {
+        auto [line, tail] = rest.split('\n');
+        rest = tail;
+        if(!line.consume_front("VmHWM:"))
+            continue;
+        auto value = line.trim();
+        value.consume_back("kB");
+        std::uint64_t kb = 0;
+        return value.trim().getAsInteger(10, kb) ? 0 : kb * 1024;
+    }
+    return 0;
+}
+
+/// A `clice serve` child and the LSP framing on its pipes.  Responses are
+/// read on a thread of their own, so that waiting for the next message of
+/// the trace does not delay their timestamps.
+class Server {
+public:
+    bool start(const std::string& clice) {
+        int to_child[2];
+        int from_child[2];
+        if(pipe(to_child) != 0 || pipe(from_child) != 0)
+            return false;
+        pid = fork();
+        if(pid < 0)
+            return false;
+        if(pid == 0) {
+            dup2(to_child[0], STDIN_FILENO);
+            dup2(from_child[1], STDOUT_FILENO);
+            close(to_child[1]);
+            close(from_child[0]);
+            const char* argv[] = {clice.c_str(), "serve", nullptr};
+            execv(clice.c_str(), const_cast<char**>(argv));
+            _exit(127);
+        }
+        close(to_child[0]);
+        close(from_child[1]);
+        input = to_child[1];
+        output = fdopen(from_child[0], "rb");
+        reader = std::thread([this] { read_loop(); });
+        return true;
+    }
+
+    bool send(llvm::StringRef message) {
+        std::lock_guard lock(write_mutex);
+        auto frame = std::format("Content-Length: {}\r\n\r\n", message.size()) + message.str();
+        llvm::StringRef rest = frame;
+        while(!rest.empty()) {
+            auto written = write(input, rest.data(), rest.size());
+            if(written <= 0)
+                return false;
+            rest = rest.drop_front(written);
+        }
+        return true;
+    }
+
+    /// Send `message`, timing it under `method` if it is a request.
+    bool send_record(llvm::StringRef message) {
+        auto value = llvm::json::parse(message);
+        if(!value) {
+            llvm::consumeError(value.takeError());
+            return send(message);
+        }
+        auto* object = value->getAsObject();
+        auto* id = object ? object->get("id") : nullptr;
+        auto method = object ? object->getString("method") : std::nullopt;
+        if(id && method) {
+            std::lock_guard lock(state_mutex);
+            pending[id_key(*id)] = {method->str(), std::chrono::steady_clock::now()};
+        }
+        return send(message);
+    }
+
+    /// Wait until every timed request got its response.
+    bool drain(std::chrono::seconds timeout) {
+        std::unique_lock lock(state_mutex);
+        return changed.wait_for(lock, timeout, [&] { return pending.empty() || closed; }) &&
+               pending.empty();
+    }
+
+    std::optional<llvm::json::Value> worker_stats(std::chrono::seconds timeout) {
+        send(R"({"jsonrpc":"2.0","id":"replay-benchmark-stats","method":"clice/workerStats",)"
+             R"("params":{"reset":false}})");
+        std::unique_lock lock(state_mutex);
+        changed.wait_for(lock, timeout, [&] { return stats.has_value() || closed; });
+        return std::move(stats);
+    }
+
+    int finish() {
+        close(input);
+        int status = 0;
+        waitpid(pid, &status, 0);
+        reader.join();
+        fclose(output);
+        return status;
+    }
+
+    pid_t pid = -1;
+
+    /// Round-trip times of the trace's requests by method, in milliseconds.
+    std::map<std::string, std::vector<double>> latencies;
+
+    std::size_t errors = 0;
+
+private:
+    std::optional<std::string> read_message() {
+        std::size_t length = 0;
+        char line[256];
+        while(std::fgets(line, sizeof(line), output)) {
+            llvm::StringRef header(line);
+            header = header.trim();
+            if(header.empty())
+                break;
+            if(header.consume_front_insensitive("content-length:"))
+                header.trim().getAsInteger(10, length);
+        }
+        if(length == 0)
+            return std::nullopt;
+        std::string body(length, '\0');
+        if(std::fread(body.data(), 1, length, output) != length)
+            return std::nullopt;
+        return body;
+    }
+
+    void read_loop() {
+        while(auto body = read_message()) {
+            auto value = llvm::json::parse(*body);
+            if(!value) {
+                llvm::consumeError(value.takeError());
+                continue;
+            }
+            auto* object = value->getAsObject();
+            auto* id = object ? object->get("id") : nullptr;
+            if(!id)
+                continue;
+            if(object->getString("method")) {
+                // Requests of the server get what an editor would answer.
+                auto method = *object->getString("method");
+                llvm::json::Value result = nullptr;
+                if(method == "workspace/configuration")
+                    result = llvm::json::Array{llvm::json::Object{}};
+                std::string reply;
+                llvm::raw_string_ostream os(reply);
+                os << llvm::json::Value(llvm::json::Object{
+                    {"jsonrpc", "2.0"},
+                    {"id",      *id  },
+                    {"result",  result},
+                });
+                send(reply);
+                continue;
+            }
+
+            std::lock_guard lock(state_mutex);
+            auto key = id_key(*id);
+            if(key == "\"replay-benchmark-stats\"") {
+                if(auto* result = object->get("result"))
+                    stats = *result;
+            } else if(auto it = pending.find(key); it != pending.end()) {
+                auto elapsed = std::chrono::steady_clock::now() - it->second.second;
+                latencies[it->second.first].push_back(
+                    std::chrono::duration<double, std::milli>(elapsed).count());
+                errors += object->get("error") != nullptr;
+                pending.erase(it);
+            }
+            changed.notify_all();
+        }
+        std::lock_guard lock(state_mutex);
+        closed = true;
+        changed.notify_all();
+    }
+
+    int input = -1;
+    std::FILE* output = nullptr;
+    std::thread reader;
+    std::mutex write_mutex;
+
+    std::mutex state_mutex;
+    std::condition_variable changed;
+    std::map<std::string, std::pair<std::string, std::chrono::steady_clock::time_point>> pending;
+    std::optional<llvm::json::Value> stats;
+    bool closed = false;
+};
+
+void print_report(Server& server, const std::optional<llvm::json::Value>& stats, double wall_ms) {
+    std::println("{:<40} {:>6} {:>9} {:>9} {:>9} {:>9}",
+                 "method",
+                 "count",
+                 "p50 ms",
+                 "p90 ms",
+                 "p99 ms",
+                 "max ms");
+    for(auto& [method, samples]: server.latencies) {
+        std::ranges::sort(samples);
+        std::println("{:<40} {:>6} {:>9.1f} {:>9.1f} {:>9.1f} {:>9.1f}",
+                     method,
+                     samples.size(),
+                     clice::bench::percentile(samples, 0.5),
+                     clice::bench::percentile(samples, 0.9),
+                     clice::bench::percentile(samples, 0.99),
+                     samples.back());
+    }
+    if(server.errors != 0) {
+        std::println("{} request(s) answered with an error", server.errors);
+    }
+
+    auto* object = stats ? stats->getAsObject() : nullptr;
+    if(!object) {
+        std::println("No worker statistics, clice/workerStats was not answered");
+        return;
+    }
+    std::println("\n{:<24} {:>8} {:>10} {:>12}", "worker", "busy %", "requests", "peak MiB");
+    if(auto* workers = object->getArray("workers")) {
+        for(auto& worker: *workers) {
+            auto* entry = worker.getAsObject();
+            if(!entry)
+                continue;
+            auto* latency = entry->getObject("latency");
+            std::println("{:<24} {:>8.1f} {:>10} {:>12.1f}",
+                         entry->getString("name").value_or("?").str(),
+                         entry->getNumber("busyMs").value_or(0) / wall_ms * 100,
+                         latency ? latency->getInteger("count").value_or(0) : 0,
+                         entry->getNumber("peakMemory").value_or(0) / (1024.0 * 1024.0));
+        }
+    }
+    std::println("\n{:<24} {:>8} {:>10}", "build kind", "count", "mean ms");
+    if(auto* kinds = object->getArray("buildKinds")) {
+        for(auto& kind: *kinds) {
+            auto* entry = kind.getAsObject();
+            auto* latency = entry ? entry->getObject("latency") : nullptr;
+            if(!latency || latency->getInteger("count").value_or(0) == 0)
+                continue;
+            std::println("{:<24} {:>8} {:>10.1f}",
+                         entry->getString("kind").value_or("?").str(),
+                         latency->getInteger("count").value_or(0),
+                         latency->getNumber("meanMs").value_or(0));
+        }
+    }
+    std::println("\ncrashes {}, evictions {}, migrations {}, preemptions {}",
+                 object->getInteger("crashes").value_or(0),
+                 object->getInteger("evictions").value_or(0),
+                 object->getInteger("migrations").value_or(0),
+                 object->getInteger("preemptions").value_or(0));
+}
+
+}  // namespace
+
+int main(int argc, const char** argv) {
+    auto args = kota::deco::util::argvify(argc, argv);
+    auto result = kota::deco::cli::parse<BenchmarkOptions>(args);
+
+    if(!result.has_value()) {
+        std::println(stderr, "Error: {}", result.error().message);
+        return 1;
+    }
+
+    auto& opts = result->options;
+
+    if(opts.help.value_or(false) || !opts.trace.has_value()) {
+        std::ostringstream oss;
+        kota::deco::cli::write_usage_for<BenchmarkOptions>(oss,
+                                                           "replay_benchmark [OPTIONS] <trace>");
+        std::print("{}", oss.str());
+        return opts.help.value_or(false) ? 0 : 1;
+    }
+
+    auto speed = *opts.speed;
+    auto timeout = std::chrono::seconds(*opts.timeout);
+    if(speed < 0 || *opts.timeout <= 0) {
+        std::println(stderr, "Error: --speed must not be negative and --timeout positive");
+        return 1;
+    }
+
+    std::string clice;
+    if(opts.clice.has_value()) {
+        clice = *opts.clice;
+    } else {
+        auto self = llvm::sys::fs::getMainExecutable(argv[0], reinterpret_cast<void*>(&load_trace));
+        llvm::SmallString<256> sibling(llvm::sys::path::parent_path(self));
+        llvm::sys::path::append(sibling, "clice");
+        clice = sibling.str().str();
+    }
+    if(!llvm::sys::fs::can_execute(clice)) {
+        std::println(stderr, "Error: cannot execute {}", clice);
+        return 1;
+    }
+
+    auto records = load_trace(*opts.trace);
+    if(!records || records->empty()) {
+        std::println(stderr, "Error: cannot read a trace from {}", *opts.trace);
+        return 1;
+    }
+    if(opts.workspace.has_value()) {
+        auto root = recorded_root(*records);
+        if(!root) {
+            std::println(stderr, "Error: the trace has no initialize with a file rootUri");
+            return 1;
+        }
+        for(auto& record: *records) {
+            record.message = llvm::join(llvm::split(record.message, *root), *opts.workspace);
+        }
+    }
+
+    // A crashed server must not end the benchmark with SIGPIPE.
+    signal(SIGPIPE, SIG_IGN);
+
+    Server server;
+    if(!server.start(clice)) {
+        std::println(stderr, "Error: failed to start {}", clice);
+        return 1;
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    std::optional<llvm::json::Value> stats;
+    std::uint64_t master_peak = 0;
+    auto collect = [&] {
+        if(!server.drain(timeout)) {
+            std::println(stderr, "Warning: responses still outstanding after {}s", *opts.timeout);
+        }
+        stats = server.worker_stats(timeout);
+        master_peak = peak_resident_memory(server.pid);
+    };
+
+    bool sent = true;
+    for(std::size_t i = 0; i < records->size() && sent; ++i) {
+        auto& record = (*records)[i];
+        if(i > 0 && speed > 0) {
+            auto delay = (record.ts - (*records)[i - 1].ts) / speed;
+            if(delay > 0) {
+                std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(delay));
+            }
+        }
+        if(!stats) {
+            auto method = method_of(record.message);
+            if(method == "shutdown" || method == "exit") {
+                collect();
+            }
+        }
+        sent = server.send_record(record.message);
+    }
+    if(!sent) {
+        std::println(stderr, "Error: the server stopped reading, it may have crashed");
+    } else if(!stats) {
+        collect();
+    }
+    auto wall_ms =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started)
+            .count();
+
+    auto status = server.finish();
+    print_report(server, stats, wall_ms);
+    std::println("\n{} messages in {:.1f}s, master peak RSS {:.1f} MiB",
+                 records->size(),
+                 wall_ms / 1000,
+                 master_peak / (1024.0 * 1024.0));
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::println(stderr, "Error: clice exited abnormally (status {})", status);
+        return 1;
+    }
+    return 0;
+}
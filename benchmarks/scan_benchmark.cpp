@@ -9,15 +9,27 @@
 ///
 ///   ./build/RelWithDebInfo/bin/scan_benchmark --log-level info --export graph.json \
 ///       /home/ykiko/C++/clice/.llvm/build-debug/compile_commands.json
+///
+/// Thread scaling, cold and warm, with the timings kept as JSON:
+///   ./build/RelWithDebInfo/bin/scan_benchmark --threads 1,2,4,8,16,32,64 \
+///       --runs 5 --warm-runs 5 --report scan.json \
+///       --drop-caches "sync; echo 3 | sudo tee /proc/sys/vm/drop_caches" \
+///       /home/ykiko/C++/clice/.llvm/build-debug/compile_commands.json
+///
+/// libuv sizes its thread pool once per process, so each thread count of a
+/// sweep runs in a child process of its own.
 
 #include <algorithm>
+#include <array>
 #include <chrono>
+#include <cmath>
 #include <cstdlib>
 #include <fstream>
 #include <map>
 #include <numeric>
 #include <print>
 #include <set>
+#include <sstream>
 #include <thread>
 
 #include "command/command.h"
@@ -29,7 +41,9 @@
 
 #include "kota/codec/json/json.h"
 #include "kota/deco/deco.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Program.h"
 
 using namespace clice;
 
@@ -45,6 +59,29 @@ struct BenchmarkOptions {
     DecoKV(names = {"--runs"}; help = "Number of cold start iterations"; required = false;)
     <int> runs = 20;
 
+    DecoKV(names = {"--warm-runs"};
+           help = "Scans after the cold ones, reusing the last cold run's ScanCache";
+           required = false;)
+    <int> warm_runs = 0;
+
+    DecoKV(names = {"--threads"};
+           help = "Comma-separated thread pool sizes to sweep, each in its own process";
+           required = false;)
+    <std::string> threads;
+
+    DecoKV(names = {"--drop-caches"};
+           help = "Shell command run before each cold scan, e.g. to drop the page cache";
+           required = false;)
+    <std::string> drop_caches;
+
+    DecoKV(names = {"--report"}; help = "Write the per-phase timings as JSON to this path";
+           required = false;)
+    <std::string> report_path;
+
+    DecoFlag(names = {"--summary-only"}; help = "Print only the per-run lines and summaries";
+             required = false;)
+    summary_only;
+
     DecoFlag(names = {"-h", "--help"}; help = "Show help message"; required = false;)
     help;
 
@@ -74,14 +111,14 @@ void export_graph_json(const PathPool& path_pool,
     }
 
     GraphExport export_data;
-    for(std::uint32_t id = 0; id < path_pool.paths.size(); id++) {
+    for(std::uint32_t id = 0; id < path_pool.size(); id++) {
         auto inc_ids = graph.get_all_includes(id);
         if(inc_ids.empty()) {
             continue;
         }
 
         FileNode node;
-        node.path = path_pool.paths[id].str();
+        node.path = path_pool.resolve(id).str();
 
         auto mod_it = path_to_module.find(id);
         if(mod_it != path_to_module.end()) {
@@ -90,7 +127,7 @@ void export_graph_json(const PathPool& path_pool,
 
         for(auto flagged_id: inc_ids) {
             auto raw_id = flagged_id & DependencyGraph::PATH_ID_MASK;
-            node.includes.push_back(path_pool.paths[raw_id].str());
+            node.includes.push_back(path_pool.resolve(raw_id).str());
         }
 
         export_data.files.push_back(std::move(node));
@@ -111,6 +148,185 @@ void export_graph_json(const PathPool& path_pool,
     std::println("Graph exported to {} ({} files)", output_path, export_data.files.size());
 }
 
+/// Phases timed per scan.  `read` and `lex` add up the time of every
+/// thread; the others are wall-clock.
+constexpr std::array<const char*, 7> phase_names = {
+    "total",
+    "config",
+    "read_lex",
+    "resolve",
+    "graph",
+    "read",
+    "lex",
+};
+
+using PhaseTimings = std::array<double, phase_names.size()>;
+
+PhaseTimings phase_timings(const ScanReport& report) {
+    return {
+        static_cast<double>(report.elapsed_ms),
+        static_cast<double>(report.config_ms),
+        static_cast<double>(report.phase1_ms),
+        static_cast<double>(report.phase2_ms),
+        static_cast<double>(report.phase3_ms),
+        report.read_us / 1000.0,
+        report.scan_us / 1000.0,
+    };
+}
+
+struct PhaseStats {
+    std::string name;
+    double min_ms = 0;
+    double median_ms = 0;
+    double mean_ms = 0;
+    double max_ms = 0;
+    double stddev_ms = 0;
+};
+
+/// The runs of one mode ("cold" or "warm") at one thread pool size.
+struct SweepPoint {
+    std::uint32_t threads = 0;
+    std::string mode;
+    std::uint32_t runs = 0;
+    std::vector<PhaseStats> phases;
+};
+
+struct SweepReport {
+    std::string cdb;
+    std::uint32_t hardware_threads = 0;
+    std::vector<SweepPoint> points;
+};
+
+SweepPoint summarize(std::uint32_t threads,
+                     std::string mode,
+                     const std::vector<PhaseTimings>& timings) {
+    SweepPoint point;
+    point.threads = threads;
+    point.mode = std::move(mode);
+    point.runs = static_cast<std::uint32_t>(timings.size());
+    if(timings.empty()) {
+        return point;
+    }
+
+    for(std::size_t phase = 0; phase < phase_names.size(); phase++) {
+        std::vector<double> values;
+        for(auto& run: timings) {
+            values.push_back(run[phase]);
+        }
+        std::ranges::sort(values);
+
+        auto n = values.size();
+        auto mean = std::accumulate(values.begin(), values.end(), 0.0) / n;
+        double squares = 0;
+        for(auto value: values) {
+            squares += (value - mean) * (value - mean);
+        }
+
+        PhaseStats stats;
+        stats.name = phase_names[phase];
+        stats.min_ms = values.front();
+        stats.median_ms = n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+        stats.mean_ms = mean;
+        stats.max_ms = values.back();
+        stats.stddev_ms = n > 1 ? std::sqrt(squares / (n - 1)) : 0;
+        point.phases.push_back(std::move(stats));
+    }
+    return point;
+}
+
+void print_summary(const SweepReport& report) {
+    for(auto& point: report.points) {
+        if(point.runs == 0) {
+            continue;
+        }
+        std::println("\n  {} {} run(s), {} threads (ms)    min  median    mean     max  stddev",
+                     point.runs,
+                     point.mode,
+                     point.threads);
+        for(auto& stats: point.phases) {
+            std::println("    {:<10} {:>14.1f} {:>7.1f} {:>7.1f} {:>7.1f} {:>7.1f}",
+                         stats.name,
+                         stats.min_ms,
+                         stats.median_ms,
+                         stats.mean_ms,
+                         stats.max_ms,
+                         stats.stddev_ms);
+        }
+    }
+}
+
+void export_report_json(const SweepReport& report, llvm::StringRef output_path) {
+    auto json = kota::codec::json::to_json(report);
+    if(!json) {
+        std::println(stderr, "Failed to serialize report");
+        return;
+    }
+
+    std::ofstream out(output_path.str());
+    if(!out) {
+        std::println(stderr, "Failed to open output file: {}", output_path);
+        return;
+    }
+    out << *json;
+}
+
+/// Run each of `thread_counts` in a child process of this benchmark, whose
+/// pool libuv sizes afresh, and collect their points into `report`.
+bool run_sweep(const BenchmarkOptions& opts,
+               llvm::ArrayRef<std::uint32_t> thread_counts,
+               const char* argv0,
+               SweepReport& report) {
+    auto self = llvm::sys::fs::getMainExecutable(argv0, reinterpret_cast<void*>(&run_sweep));
+    for(auto threads: thread_counts) {
+        llvm::SmallString<128> child_report;
+        if(auto ec = llvm::sys::fs::createTemporaryFile("scan_benchmark", "json", child_report)) {
+            std::println(stderr, "Failed to create a temporary file: {}", ec.message());
+            return false;
+        }
+
+        std::vector<std::string> args = {
+            self,
+            "--threads",
+            std::to_string(threads),
+            "--runs",
+            std::to_string(*opts.runs),
+            "--warm-runs",
+            std::to_string(*opts.warm_runs),
+            "--log-level",
+            *opts.log_level,
+            "--report",
+            child_report.str().str(),
+            "--summary-only",
+        };
+        if(opts.drop_caches.has_value()) {
+            args.push_back("--drop-caches");
+            args.push_back(*opts.drop_caches);
+        }
+        args.push_back(*opts.cdb_path);
+
+        std::println("\n--- {} threads ---", threads);
+        std::vector<llvm::StringRef> argv(args.begin(), args.end());
+        std::string error;
+        auto code = llvm::sys::ExecuteAndWait(self, argv, std::nullopt, {}, 0, 0, &error);
+        auto content = fs::read(child_report);
+        llvm::sys::fs::remove(child_report);
+        if(code != 0 || !content) {
+            std::println(stderr, "Run with {} threads failed (exit {}) {}", threads, code, error);
+            return false;
+        }
+
+        SweepReport child;
+        if(!kota::codec::json::parse(*content, child)) {
+            std::println(stderr, "Unreadable report of the run with {} threads", threads);
+            return false;
+        }
+        for(auto& point: child.points) {
+            report.points.push_back(std::move(point));
+        }
+    }
+    return true;
+}
+
 void print_report(const ScanReport& report) {
     std::println("===============================================================");
     std::println("                    Dependency Scan Report");
@@ -128,6 +344,8 @@ void print_report(const ScanReport& report) {
     std::println("    Header files (discovered): {}", report.header_files);
     std::println("    Total:                     {}", report.total_files);
     std::println("    Modules:                   {}", report.modules);
+    std::println("    Conditional decls decided: {}", report.module_decls_evaluated);
+    std::println("    Preprocessor fallbacks:    {}", report.module_decl_fallbacks);
 
     // Include edges.
     std::println("");
@@ -192,8 +410,8 @@ void print_report(const ScanReport& report) {
     if(report.p2_resolve_us > 0) {
         auto other_us = report.phase2_ms * 1000 - report.p2_resolve_us;
         std::println("");
-        std::println("  Phase 2 Breakdown (single-threaded)");
-        std::println("    resolve_include: {:.1f}ms", report.p2_resolve_us / 1000.0);
+        std::println("  Phase 2 Breakdown");
+        std::println("    resolve_include (parallel): {:.1f}ms", report.p2_resolve_us / 1000.0);
         std::println("    Other (cache lookup, intern, graph): {:.1f}ms", other_us / 1000.0);
     }
 
@@ -247,14 +465,52 @@ int main(int argc, const char** argv) {
     auto& cdb_path = *opts.cdb_path;
     auto hw_threads = std::thread::hardware_concurrency();
     auto runs = *opts.runs;
+    auto warm_runs = *opts.warm_runs;
     if(runs <= 0) {
         std::println(stderr, "Error: --runs must be positive (got {})", runs);
         return 1;
     }
+    if(warm_runs < 0) {
+        std::println(stderr, "Error: --warm-runs must not be negative (got {})", warm_runs);
+        return 1;
+    }
+
+    std::vector<std::uint32_t> thread_counts;
+    if(opts.threads.has_value()) {
+        llvm::SmallVector<llvm::StringRef> parts;
+        llvm::StringRef(*opts.threads).split(parts, ',', -1, false);
+        for(auto part: parts) {
+            std::uint32_t count = 0;
+            if(part.trim().getAsInteger(10, count) || count == 0) {
+                std::println(stderr, "Error: invalid thread count '{}' in --threads", part);
+                return 1;
+            }
+            thread_counts.push_back(count);
+        }
+    }
+
+    SweepReport sweep;
+    sweep.cdb = cdb_path;
+    sweep.hardware_threads = hw_threads;
+    if(thread_counts.size() > 1) {
+        std::println("Hardware threads: {}", hw_threads);
+        std::println("CDB: {}", cdb_path);
+        if(!run_sweep(opts, thread_counts, argv[0], sweep)) {
+            return 1;
+        }
+        print_summary(sweep);
+        if(opts.report_path.has_value()) {
+            export_report_json(sweep, *opts.report_path);
+            std::println("Report exported to {}", *opts.report_path);
+        }
+        return 0;
+    }
 
-    // Set UV_THREADPOOL_SIZE if not already set.
-    // Use at least libuv's default (4) so low-core CI runners don't regress.
-    if(!std::getenv("UV_THREADPOOL_SIZE")) {
+    if(!thread_counts.empty()) {
+        static std::string env = "UV_THREADPOOL_SIZE=" + std::to_string(thread_counts[0]);
+        putenv(env.data());
+    } else if(!std::getenv("UV_THREADPOOL_SIZE")) {
+        // Use at least libuv's default (4) so low-core CI runners don't regress.
         auto pool_size = std::max(hw_threads, 4u);
         static std::string env = "UV_THREADPOOL_SIZE=" + std::to_string(pool_size);
         putenv(env.data());
@@ -278,7 +534,7 @@ int main(int argc, const char** argv) {
 
     std::println("CDB loaded: {} entries in {}ms", count, load_ms);
 
-    {
+    if(!opts.summary_only.value_or(false)) {
         std::set<const CompilationInfo*> unique_contexts;
         std::set<const CanonicalCommand*> unique_canonicals;
         std::map<const CanonicalCommand*, int> canonical_hist;
@@ -344,65 +600,76 @@ int main(int argc, const char** argv) {
 
     std::println("\nRunning {} cold start scan(s)...\n", runs);
 
+    auto drop_caches = [&] {
+        if(!opts.drop_caches.has_value()) {
+            return;
+        }
+        if(auto code = std::system(opts.drop_caches->c_str()); code != 0) {
+            std::println(stderr, "Warning: --drop-caches command exited with {}", code);
+        }
+    };
+
+    auto print_run = [](llvm::StringRef mode, int index, const ScanReport& report) {
+        std::println("[{} {:2}] {}ms | config={}ms phase1={}ms phase2={}ms phase3={}ms | files={}",
+                     mode,
+                     index + 1,
+                     report.elapsed_ms,
+                     report.config_ms,
+                     report.phase1_ms,
+                     report.phase2_ms,
+                     report.phase3_ms,
+                     report.total_files);
+    };
+
     PathPool path_pool;
     DependencyGraph graph;
-    std::vector<std::int64_t> elapsed_times;
-    std::vector<std::int64_t> config_times;
-    std::vector<std::int64_t> phase1_times;
-    std::vector<std::int64_t> phase2_times;
-    elapsed_times.reserve(runs);
-    config_times.reserve(runs);
-    phase1_times.reserve(runs);
-    phase2_times.reserve(runs);
+    ScanCache cache;
+    std::vector<PhaseTimings> cold_timings;
+    std::vector<PhaseTimings> warm_timings;
+    cold_timings.reserve(runs);
+    warm_timings.reserve(warm_runs);
 
     for(int i = 0; i < runs; i++) {
         // True cold start: rebuild CDB (clears toolchain & config caches),
-        // reset PathPool and DependencyGraph.
+        // reset PathPool, DependencyGraph and ScanCache.
         cdb = CompilationDatabase{};
         toolchain = Toolchain{};
         cdb.load(cdb_path);
         path_pool = PathPool{};
         graph = DependencyGraph{};
+        cache = ScanCache{};
+        drop_caches();
 
-        auto report = scan_dependency_graph(cdb, toolchain, path_pool, graph);
-
-        elapsed_times.push_back(report.elapsed_ms);
-        config_times.push_back(report.config_ms);
-        phase1_times.push_back(report.phase1_ms);
-        phase2_times.push_back(report.phase2_ms);
-
-        std::println("[run {:2}] {}ms | config={}ms phase1={}ms phase2={}ms | files={}",
-                     i + 1,
-                     report.elapsed_ms,
-                     report.config_ms,
-                     report.phase1_ms,
-                     report.phase2_ms,
-                     report.total_files);
+        auto report = scan_dependency_graph(cdb, toolchain, path_pool, graph, &cache);
+        cold_timings.push_back(phase_timings(report));
+        print_run("cold", i, report);
 
         // Print detailed report for the first run only.
-        if(i == 0) {
+        if(i == 0 && !opts.summary_only.value_or(false)) {
             std::println("");
             print_report(report);
         }
     }
 
-    // Summary statistics.
-    if(runs > 1) {
-        auto stats = [](std::vector<std::int64_t>& v) {
-            std::ranges::sort(v);
-            auto sum = std::accumulate(v.begin(), v.end(), std::int64_t{0});
-            return std::tuple{v.front(), sum / static_cast<std::int64_t>(v.size()), v.back()};
-        };
-        auto [e_min, e_avg, e_max] = stats(elapsed_times);
-        auto [c_min, c_avg, c_max] = stats(config_times);
-        auto [p1_min, p1_avg, p1_max] = stats(phase1_times);
-        auto [p2_min, p2_avg, p2_max] = stats(phase2_times);
-
-        std::println("\n  Summary ({} runs)             min    avg    max", runs);
-        std::println("    Total:              {:>7} {:>6} {:>6}", e_min, e_avg, e_max);
-        std::println("    Config extraction:  {:>7} {:>6} {:>6}", c_min, c_avg, c_max);
-        std::println("    Phase 1 (read+scan):{:>7} {:>6} {:>6}", p1_min, p1_avg, p1_max);
-        std::println("    Phase 2 (resolve):  {:>7} {:>6} {:>6}", p2_min, p2_avg, p2_max);
+    // A rescan of the server: configs, scan results and include resolutions
+    // are kept from the last scan, the graph is built again.
+    for(int i = 0; i < warm_runs; i++) {
+        graph = DependencyGraph{};
+        auto report = scan_dependency_graph(cdb, toolchain, path_pool, graph, &cache);
+        warm_timings.push_back(phase_timings(report));
+        print_run("warm", i, report);
+    }
+
+    std::uint32_t pool_size = 0;
+    llvm::StringRef(std::getenv("UV_THREADPOOL_SIZE")).getAsInteger(10, pool_size);
+    sweep.points.push_back(summarize(pool_size, "cold", cold_timings));
+    if(warm_runs > 0) {
+        sweep.points.push_back(summarize(pool_size, "warm", warm_timings));
+    }
+    print_summary(sweep);
+
+    if(opts.report_path.has_value()) {
+        export_report_json(sweep, *opts.report_path);
     }
 
     // Export dependency graph as JSON if requested.
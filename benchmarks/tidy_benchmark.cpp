@@ -0,0 +1,275 @@
+/// Benchmark measuring what each clang-tidy check adds to parsing a corpus.
+///
+/// Every file is compiled without clang-tidy, then with the selected checks
+/// and their matchers timed.  A check's cost is its matcher time over the
+/// whole corpus relative to the plain parses; those above the latency budget
+/// are SLOW.  The result is the table of src/compile/tidy_fast_checks.inc,
+/// listing every registered check the selection covers, so checks added by a
+/// new LLVM are classified instead of staying disabled.  Preprocessor
+/// callbacks are not timed, only AST matchers.
+///
+/// Files come from the compilation database (`--file` picks one), or from
+/// `--corpus`, whose files get the database's nearest command or a default.
+///
+/// Usage:
+///   tidy_benchmark [OPTIONS] [compile_commands.json]
+///
+/// Example:
+///   ./build/RelWithDebInfo/bin/tidy_benchmark --file clang/lib/Sema/Sema.cpp \
+///       --output src/compile/tidy_fast_checks.inc llvm-project/build/compile_commands.json
+///
+///   ./build/RelWithDebInfo/bin/tidy_benchmark --corpus tests/data --budget 5
+
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <print>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "command/command.h"
+#include "command/toolchain.h"
+#include "compile/compilation.h"
+#include "support/logging.h"
+#include "benchmark_utils.h"
+
+#include "kota/deco/deco.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "clang-tidy/GlobList.h"
+
+using namespace clice;
+
+struct BenchmarkOptions {
+    DecoKV(names = {"--log-level"}; help = "Log level: trace, debug, info, warn, error, off";
+           required = false;)
+    <std::string> log_level = "off";
+
+    DecoKV(names = {"--checks"}; help = "clang-tidy checks to measure, as a glob list";
+           required = false;)
+    <std::string> checks = "*";
+
+    DecoKV(names = {"--runs"}; help = "Compiles per measurement, the fastest is kept";
+           required = false;)
+    <int> runs = 3;
+
+    DecoKV(names = {"--budget"}; help = "Parse time percentage above which a check is SLOW";
+           required = false;)
+    <double> budget = 8.0;
+
+    DecoKV(names = {"--file"}; help = "Measure only this file of the database";
+           required = false;)
+    <std::string> file;
+
+    DecoKV(names = {"--corpus"}; help = "Measure the C/C++ sources under this directory";
+           required = false;)
+    <std::string> corpus;
+
+    DecoKV(names = {"--files"}; help = "Number of files to measure, 0 for all"; required = false;)
+    <int> files = 0;
+
+    DecoKV(names = {"--output"}; help = "Write the generated table to this path";
+           required = false;)
+    <std::string> output;
+
+    DecoFlag(names = {"-h", "--help"}; help = "Show help message"; required = false;)
+    help;
+
+    DecoInput(meta_var = "CDB"; help = "Path to compile_commands.json"; required = false;)
+    <std::string> cdb_path;
+};
+
+namespace {
+
+/// Time of a file's fastest plain parse, and of its fastest parse with
+/// clang-tidy along with the matcher time of each check in it.
+struct FileReport {
+    double parse = 0;
+    double with_tidy = 0;
+    llvm::StringMap<double> checks;
+};
+
+std::optional<FileReport> measure(CompilationDatabase& cdb,
+                                  Toolchain& toolchain,
+                                  const std::string& file,
+                                  const std::string& checks,
+                                  int runs) {
+    auto commands = cdb.lookup(file);
+    if(commands.empty()) {
+        return std::nullopt;
+    }
+    toolchain.resolve_or_warn(commands.front());
+    auto arguments = commands.front().to_string_argv();
+
+    FileReport report;
+    for(bool tidy: {false, true}) {
+        std::optional<double> best;
+        for(int i = 0; i < runs; ++i) {
+            CompilationParams cp;
+            cp.kind = CompilationKind::Content;
+            cp.directory = commands.front().resolved.directory.str();
+            for(auto& arg: arguments) {
+                cp.arguments.push_back(arg.c_str());
+            }
+            cp.clang_tidy = tidy;
+            cp.tidy_profile = tidy;
+            cp.tidy_checks = checks;
+
+            auto start = std::chrono::steady_clock::now();
+            auto unit = compile(cp);
+            auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+            if(!unit.completed()) {
+                return std::nullopt;
+            }
+            if(best && seconds.count() >= *best) {
+                continue;
+            }
+            best = seconds.count();
+            if(tidy) {
+                report.checks.clear();
+                for(auto& [check, time]: unit.tidy_timings()) {
+                    report.checks[check] = time;
+                }
+            }
+        }
+        (tidy ? report.with_tidy : report.parse) = *best;
+    }
+    return report;
+}
+
+}  // namespace
+
+int main(int argc, const char** argv) {
+    auto args = kota::deco::util::argvify(argc, argv);
+    auto result = kota::deco::cli::parse<BenchmarkOptions>(args);
+
+    if(!result.has_value()) {
+        std::println(stderr, "Error: {}", result.error().message);
+        return 1;
+    }
+
+    auto& opts = result->options;
+
+    if(opts.help.value_or(false) || (!opts.cdb_path.has_value() && !opts.corpus.has_value())) {
+        std::ostringstream oss;
+        kota::deco::cli::write_usage_for<BenchmarkOptions>(oss, "tidy_benchmark [OPTIONS] [cdb]");
+        std::print("{}", oss.str());
+        return opts.help.value_or(false) ? 0 : 1;
+    }
+
+    auto runs = *opts.runs;
+    auto max_files = *opts.files;
+    if(runs <= 0 || max_files < 0) {
+        std::println(stderr, "Error: --runs must be positive and --files not negative");
+        return 1;
+    }
+
+    auto level = spdlog::level::from_str(*opts.log_level);
+    clice::logging::options.level = level;
+    clice::logging::stderr_logger("tidy_benchmark", clice::logging::options);
+
+    CompilationDatabase cdb;
+    Toolchain toolchain;
+    std::vector<std::string> files;
+    if(opts.cdb_path.has_value()) {
+        cdb.load(*opts.cdb_path);
+    }
+    if(opts.file.has_value()) {
+        files.push_back(*opts.file);
+    } else if(opts.corpus.has_value()) {
+        files = bench::collect_corpus(*opts.corpus);
+    } else {
+        llvm::DenseSet<std::uint32_t> seen;
+        for(auto& entry: cdb.get_entries()) {
+            if(seen.insert(entry.file).second) {
+                files.push_back(cdb.resolve_path(entry.file).str());
+            }
+        }
+    }
+    if(max_files != 0 && files.size() > static_cast<std::size_t>(max_files)) {
+        files.resize(max_files);
+    }
+    if(files.empty()) {
+        std::println(stderr, "Error: no files to measure");
+        return 1;
+    }
+
+    double parse = 0;
+    double with_tidy = 0;
+    llvm::StringMap<double> totals;
+    std::size_t measured = 0;
+    for(std::size_t i = 0; i < files.size(); ++i) {
+        auto report = measure(cdb, toolchain, files[i], *opts.checks, runs);
+        if(!report) {
+            std::println(stderr, "[{}/{}] failed to compile {}", i + 1, files.size(), files[i]);
+            continue;
+        }
+        std::println(stderr,
+                     "[{}/{}] {}: {:.3f}s, with clang-tidy {:+.1f}%",
+                     i + 1,
+                     files.size(),
+                     files[i],
+                     report->parse,
+                     (report->with_tidy - report->parse) / report->parse * 100);
+        measured += 1;
+        parse += report->parse;
+        with_tidy += report->with_tidy;
+        for(auto& entry: report->checks) {
+            totals[entry.getKey()] += entry.getValue();
+        }
+    }
+    if(measured == 0) {
+        std::println(stderr, "Error: no file compiled");
+        return 1;
+    }
+
+    // Selected checks that never matched cost nothing; they are listed too,
+    // so that they get enabled.
+    clang::tidy::GlobList selected(*opts.checks);
+    std::string table = std::format(
+        "// This file is generated, do not edit it directly!\n"
+        "// Deltas are percentage regression in parsing {} file(s) ({:.3f}s),\n"
+        "// as printed by benchmarks/tidy_benchmark.cpp with a {:.1f}% budget.\n"
+        "#ifndef FAST\n#define FAST(CHECK, DELTA)\n#endif\n"
+        "#ifndef SLOW\n#define SLOW(CHECK, DELTA)\n#endif\n\n",
+        measured,
+        parse,
+        *opts.budget);
+    std::size_t slow = 0;
+    for(auto& check: registered_tidy_checks()) {
+        if(!selected.contains(check)) {
+            continue;
+        }
+        auto it = totals.find(check);
+        auto delta = it == totals.end() ? 0.0 : it->getValue() / parse * 100;
+        bool fast = delta <= *opts.budget;
+        slow += !fast;
+        table += std::format("{}({}, {:.1f})\n", fast ? "FAST" : "SLOW", check, delta);
+    }
+    table += "\n#undef FAST\n#undef SLOW\n";
+
+    std::println(stderr,
+                 "{} file(s): parse {:.3f}s, with clang-tidy {:.3f}s, {} slow check(s)",
+                 measured,
+                 parse,
+                 with_tidy,
+                 slow);
+
+    if(!opts.output.has_value()) {
+        std::print("{}", table);
+        return 0;
+    }
+    std::ofstream out(*opts.output);
+    if(!out) {
+        std::println(stderr, "Error: cannot write {}", *opts.output);
+        return 1;
+    }
+    out << table;
+    std::println(stderr, "Table written to {}", *opts.output);
+    return 0;
+}
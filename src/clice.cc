@@ -8,7 +8,9 @@
 #include "server/service/master_server.h"
 #include "server/worker/stateful_worker.h"
 #include "server/worker/stateless_worker.h"
+#include "server/worker/zygote.h"
 #include "support/logging.h"
+#include "support/shared_blob.h"
 
 #include "kota/deco/deco.h"
 
@@ -36,6 +38,11 @@ struct WorkerOptions {
              required = false)
     stateful;
 
+    DecoFlag(names = {"--zygote"},
+             help = "Run as the fork server that spawns workers",
+             required = false)
+    zygote;
+
     DecoKV(style = KVStyle::JoinedOrSeparate,
            names = {"--memory-limit", "--memory-limit="},
            help = "Memory limit in bytes (stateful worker only)",
@@ -49,6 +56,12 @@ struct WorkerOptions {
 
     DecoKV(style = KVStyle::JoinedOrSeparate, names = {"--log-dir", "--log-dir="}, required = false)
     <std::string> log_dir;
+
+    DecoKV(style = KVStyle::JoinedOrSeparate,
+           names = {"--master-pid", "--master-pid="},
+           help = "Process id of the master to hand shared segments to",
+           required = false)
+    <std::uint32_t> master_pid;
 };
 
 bool apply_log_level(const std::string& level_str) {
@@ -127,7 +140,10 @@ int main(int argc, const char** argv) {
             }
             auto name = opts.worker_name.value_or("worker");
             auto log_dir = opts.log_dir.value_or("");
-            if(opts.stateful) {
+            clice::shared_blob::set_receiver(opts.master_pid.value_or(0));
+            if(opts.zygote) {
+                exit_code = clice::run_zygote_mode(log_dir);
+            } else if(opts.stateful) {
                 auto limit = opts.memory_limit.value_or(4ULL * 1024 * 1024 * 1024);
                 exit_code = clice::run_stateful_worker_mode(limit, name, log_dir);
             } else {
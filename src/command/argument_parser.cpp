@@ -1,5 +1,6 @@
 #include "command/argument_parser.h"
 
+#include <format>
 #include <span>
 #include <string_view>
 #include <utility>
@@ -10,6 +11,7 @@
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
 #include "clang/Driver/Driver.h"
 #include "clang/Driver/Types.h"
 
@@ -272,15 +274,17 @@ bool is_diagnostics_option(unsigned id) {
     return false;
 }
 
-std::string canonicalize(llvm::ArrayRef<std::string> args, ArgsProfile profile) {
-    std::string buf;
+/// Append the canonicalize() rendering of `args` to `buf`.
+static void render_profile(llvm::ArrayRef<std::string> args,
+                           ArgsProfile profile,
+                           std::string& buf) {
     if(args.empty()) {
-        return buf;
+        return;
     }
 
-    llvm::raw_string_ostream os(buf);
     auto append = [&](std::string_view fragment) {
-        os << fragment << '\0';
+        buf += fragment;
+        buf += '\0';
     };
 
     /// The driver affects language defaults (clang vs clang++ vs clang-cl).
@@ -326,10 +330,39 @@ std::string canonicalize(llvm::ArrayRef<std::string> args, ArgsProfile profile)
             option::table().render(arg, append);
         }
     }
+}
 
+std::string canonicalize(llvm::ArrayRef<std::string> args, ArgsProfile profile) {
+    std::string buf;
+    render_profile(args, profile, buf);
     return buf;
 }
 
+std::string canonical_hash(llvm::ArrayRef<std::string> args, ArgsProfile profile) {
+    std::string buf;
+    render_profile(args, profile, buf);
+    auto hash = llvm::xxh3_128bits(llvm::arrayRefFromStringRef(buf));
+    return std::format("{:016x}{:016x}", hash.high64, hash.low64);
+}
+
+llvm::StringRef CanonicalHashCache::get(llvm::ArrayRef<std::string> args, ArgsProfile profile) {
+    raw.clear();
+    raw += static_cast<char>(profile);
+    for(auto& arg: args) {
+        raw += arg;
+        raw += '\0';
+    }
+
+    if(auto it = hashes.find(raw); it != hashes.end()) {
+        return it->second;
+    }
+
+    if(hashes.size() >= max_entries) {
+        hashes.clear();
+    }
+    return hashes.try_emplace(raw, canonical_hash(args, profile)).first->second;
+}
+
 std::string print_argv(llvm::ArrayRef<const char*> args) {
     std::string buf;
     llvm::raw_string_ostream os(buf);
@@ -6,6 +6,7 @@
 #include <kota/deco/option.h>
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
 
 namespace clice {
@@ -104,6 +105,31 @@ enum class ArgsProfile : std::uint8_t {
 /// not.
 std::string canonicalize(llvm::ArrayRef<std::string> args, ArgsProfile profile);
 
+/// The 128-bit xxh3 hash of canonicalize(), as 32 hex digits.  Cheaper to
+/// carry into cache keys than the rendering itself.
+std::string canonical_hash(llvm::ArrayRef<std::string> args, ArgsProfile profile);
+
+/// Memoizes canonical_hash() by the raw argument list: a command seen
+/// before is neither parsed nor rendered again, only its raw spelling is
+/// looked up.  Not thread-safe.
+class CanonicalHashCache {
+public:
+    llvm::StringRef get(llvm::ArrayRef<std::string> args, ArgsProfile profile);
+
+    std::size_t size() const {
+        return hashes.size();
+    }
+
+private:
+    /// Distinct commands remembered before the memo starts over.
+    constexpr static std::size_t max_entries = 4096;
+
+    /// Reused buffer for the raw lookup key.
+    std::string raw;
+
+    llvm::StringMap<std::string> hashes;
+};
+
 /// Get the resource directory for clang builtin headers. Computed once
 /// from the current executable path using Driver::GetResourcesPath.
 llvm::StringRef resource_dir();
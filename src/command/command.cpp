@@ -4,14 +4,19 @@
 #include <array>
 #include <cassert>
 #include <cctype>
+#include <cstring>
 #include <ranges>
 #include <string_view>
+#include <thread>
 
 #include "simdjson.h"
 #include "support/filesystem.h"
 #include "support/logging.h"
 
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Parallel.h"
 #include "llvm/Support/StringSaver.h"
 
 namespace clice {
@@ -20,83 +25,26 @@ namespace {
 
 namespace ranges = std::ranges;
 
-}  // namespace
-
-std::vector<const char*> CompileCommand::to_argv() const {
-    std::vector<const char*> argv;
-    argv.reserve(resolved.flags.size() + 4);
-
-    if(resolved.is_cc1 && source_file) {
-        // cc1 mode requires TWO file-related arguments (both are needed):
-        //   1. -main-file-name <basename>  — used by clang for diagnostics/debug info
-        //   2. <source_file> at the end    — the actual input file path
-        // These are NOT duplicates: (1) is just the basename, (2) is the full path.
-        for(std::size_t i = 0; i < resolved.flags.size(); ++i) {
-            argv.push_back(resolved.flags[i]);
-            if(resolved.flags[i] == llvm::StringRef("-cc1")) {
-                argv.push_back("-main-file-name");
-                // path::filename returns a suffix of source_file (a pointer into
-                // the same buffer), so .data() is null-terminated because source_file is.
-                argv.push_back(path::filename(source_file).data());
-            }
-        }
-    } else {
-        argv.insert(argv.end(), resolved.flags.begin(), resolved.flags.end());
-    }
-
-    if(source_file) {
-        argv.push_back(source_file);
-    }
-    return argv;
-}
-
-std::vector<std::string> CompileCommand::to_string_argv() const {
-    auto argv = to_argv();
-    std::vector<std::string> result;
-    result.reserve(argv.size());
-    for(auto* arg: argv) {
-        result.emplace_back(arg);
-    }
-    return result;
-}
-
-CompilationDatabase::CompilationDatabase() = default;
-
-CompilationDatabase::~CompilationDatabase() = default;
-
-llvm::ArrayRef<CompilationEntry> CompilationDatabase::find_entries(std::uint32_t path_id) const {
-    auto [first, last] = ranges::equal_range(entries, path_id, {}, &CompilationEntry::file);
-    if(first == last)
-        return {};
-    return {&*first, static_cast<size_t>(last - first)};
-}
-
-llvm::ArrayRef<const char*> CompilationDatabase::persist_args(llvm::ArrayRef<const char*> args) {
-    if(args.empty())
-        return {};
-    auto* buf = allocator->Allocate<const char*>(args.size());
-    ranges::copy(args, buf);
-    return {buf, args.size()};
-}
-
-object_ptr<CompilationInfo>
-    CompilationDatabase::save_compilation_info(llvm::StringRef file,
-                                               llvm::StringRef directory,
-                                               llvm::ArrayRef<const char*> arguments) {
+/// Split a command into the canonical arguments (driver and semantic flags)
+/// and the per-file patch, saving the rendered strings in `saver`.  Touches
+/// no database state, so load() runs it for many entries at once.
+void classify_arguments(llvm::StringRef file,
+                        llvm::StringRef directory,
+                        llvm::ArrayRef<const char*> arguments,
+                        llvm::StringSaver& saver,
+                        llvm::SmallVectorImpl<const char*>& canonical_args,
+                        llvm::SmallVectorImpl<const char*>& patch_args) {
     assert(!arguments.empty() && "arguments must contain at least the driver");
 
     auto render_arg = [&](auto& out, const kota::option::ParsedArg& arg) {
         auto cb = [&](std::string_view s) {
-            out.push_back(strings.save(s).data());
+            out.push_back(saver.save(s).data());
         };
         option::table().render(arg, cb);
     };
 
-    llvm::SmallVector<const char*, 32> canonical_args;
-    llvm::SmallVector<const char*, 16> patch_args;
-
     /// Driver goes into canonical.
-    canonical_args.push_back(strings.save(arguments[0]).data());
+    canonical_args.push_back(saver.save(arguments[0]).data());
 
     bool remove_pch = false;
 
@@ -141,12 +89,12 @@ object_ptr<CompilationInfo>
             /// Absolutize relative paths for include-path options.
             if(is_include_path_option(id) && arg.values.size() == 1) {
                 patch_args.push_back(
-                    strings.save(option::table().option(id)->prefixed_name()).data());
+                    saver.save(option::table().option(id)->prefixed_name()).data());
                 llvm::StringRef value(arg.values[0]);
                 if(!value.empty() && !path::is_absolute(value)) {
-                    patch_args.push_back(strings.save(path::join(directory, value)).data());
+                    patch_args.push_back(saver.save(path::join(directory, value)).data());
                 } else {
-                    patch_args.push_back(strings.save(value).data());
+                    patch_args.push_back(saver.save(value).data());
                 }
                 continue;
             }
@@ -157,74 +105,149 @@ object_ptr<CompilationInfo>
         /// Everything else goes into canonical.
         render_arg(canonical_args, arg);
     }
-
-    /// Dedup canonical command.
-    auto canonical_id = canonicals.get(CanonicalCommand{canonical_args});
-    auto canonical = canonicals.get(canonical_id);
-    if(canonical->arguments.data() == canonical_args.data()) {
-        canonical->arguments = persist_args(canonical_args);
-    }
-
-    /// Build and dedup CompilationInfo.
-    auto dir = strings.save(directory).data();
-    auto info_id = infos.get(CompilationInfo{dir, canonical, patch_args});
-    auto info = infos.get(info_id);
-    if(info->patch.data() == patch_args.data()) {
-        info->patch = persist_args(patch_args);
-    }
-
-    return info;
 }
 
-object_ptr<CompilationInfo> CompilationDatabase::save_compilation_info(llvm::StringRef file,
-                                                                       llvm::StringRef directory,
-                                                                       llvm::StringRef command) {
-    llvm::BumpPtrAllocator local;
-    llvm::StringSaver saver(local);
-
-    llvm::SmallVector<const char*, 32> arguments;
-
+void tokenize_command(llvm::StringRef command,
+                      llvm::StringSaver& saver,
+                      llvm::SmallVectorImpl<const char*>& arguments) {
 #ifdef _WIN32
     llvm::cl::TokenizeWindowsCommandLineFull(command, saver, arguments);
 #else
     llvm::cl::TokenizeGNUCommandLine(command, saver, arguments);
 #endif
+}
 
-    if(arguments.empty()) {
-        return {nullptr};
+/// A run of consecutive elements of the root array of compile_commands.json.
+struct JsonChunk {
+    /// The elements with the commas between them, without the brackets.
+    llvm::StringRef text;
+
+    /// Index of the first element in the whole array.
+    std::size_t first_index = 0;
+};
+
+/// Split the root array of `json` at its top-level commas into chunks of
+/// about `chunk_size` bytes.  Only strings and nesting are tracked, which is
+/// enough to find the commas; the chunks are validated when parsed.  Returns
+/// false if the root is not an array or never closes.
+bool split_json_array(llvm::StringRef json,
+                      std::size_t chunk_size,
+                      std::vector<JsonChunk>& chunks) {
+    auto p = json.begin();
+    auto end = json.end();
+    if(json.starts_with("\xEF\xBB\xBF")) {
+        p += 3;
     }
-
-    return save_compilation_info(file, directory, arguments);
+    while(p != end && llvm::isSpace(*p)) {
+        ++p;
+    }
+    if(p == end || *p != '[') {
+        return false;
+    }
+    ++p;
+
+    auto start = p;
+    std::size_t first_index = 0;
+    std::size_t elements = 0;
+    int depth = 1;
+    while(p != end) {
+        switch(*p) {
+            case '"': {
+                // Find the closing quote: one not escaped by an odd number
+                // of backslashes.
+                ++p;
+                while(true) {
+                    auto quote = static_cast<const char*>(std::memchr(p, '"', end - p));
+                    if(!quote) {
+                        return false;
+                    }
+                    auto escapes = quote;
+                    while(escapes != p && escapes[-1] == '\\') {
+                        --escapes;
+                    }
+                    p = quote + 1;
+                    if((quote - escapes) % 2 == 0) {
+                        break;
+                    }
+                }
+                continue;
+            }
+            case '[':
+            case '{': {
+                ++depth;
+                break;
+            }
+            case ']':
+            case '}': {
+                if(--depth == 0) {
+                    auto text = llvm::StringRef(start, p - start);
+                    if(!text.trim().empty()) {
+                        chunks.push_back({text, first_index});
+                    }
+                    return true;
+                }
+                break;
+            }
+            case ',': {
+                if(depth != 1) {
+                    break;
+                }
+                ++elements;
+                if(static_cast<std::size_t>(p - start) >= chunk_size) {
+                    chunks.push_back({llvm::StringRef(start, p - start), first_index});
+                    first_index = elements;
+                    start = p + 1;
+                }
+                break;
+            }
+        }
+        ++p;
+    }
+    return false;
 }
 
-std::size_t CompilationDatabase::load(llvm::StringRef path) {
-    entries.clear();
-
-    simdjson::padded_string json_buf;
-    if(auto error = simdjson::padded_string::load(std::string(path)).get(json_buf)) {
-        LOG_ERROR("Failed to read compilation database from {}: {}",
-                  path,
-                  simdjson::error_message(error));
-        return 0;
-    }
+/// An entry of compile_commands.json parsed and classified, with its strings
+/// in the allocator of its chunk until load() interns them.
+struct ParsedEntry {
+    llvm::StringRef file;
+    llvm::StringRef directory;
+    llvm::SmallVector<const char*, 32> canonical;
+    llvm::SmallVector<const char*, 16> patch;
+    object_ptr<CompilationInfo> info;
+};
+
+struct ParsedChunk {
+    llvm::BumpPtrAllocator allocator;
+    std::vector<ParsedEntry> entries;
+};
+
+/// Parse the elements of one chunk and classify their commands.
+void parse_chunk(llvm::StringRef path, const JsonChunk& chunk, ParsedChunk& parsed) {
+    llvm::StringSaver saver(parsed.allocator);
+
+    // Wrapped in brackets, the chunk is an array of its own.
+    simdjson::padded_string json_buf(chunk.text.size() + 2);
+    json_buf.data()[0] = '[';
+    std::memcpy(json_buf.data() + 1, chunk.text.data(), chunk.text.size());
+    json_buf.data()[chunk.text.size() + 1] = ']';
 
     simdjson::ondemand::parser json_parser;
     simdjson::ondemand::document doc;
+    simdjson::ondemand::array arr;
     if(auto error = json_parser.iterate(json_buf).get(doc)) {
         LOG_ERROR("Failed to parse compilation database from {}: {}",
                   path,
                   simdjson::error_message(error));
-        return 0;
+        return;
     }
-
-    simdjson::ondemand::array arr;
     if(auto error = doc.get_array().get(arr)) {
-        LOG_ERROR("Invalid compilation database format in {}: root element must be an array.",
-                  path);
-        return 0;
+        LOG_ERROR("Failed to parse compilation database from {}: {}",
+                  path,
+                  simdjson::error_message(error));
+        return;
     }
 
-    std::size_t index = 0;
+    std::size_t index = chunk.first_index;
     for(auto element: arr) {
         simdjson::ondemand::object obj;
         if(element.get_object().get(obj)) {
@@ -273,11 +296,10 @@ std::size_t CompilationDatabase::load(llvm::StringRef path) {
             file_ref = file_abs;
         }
 
+        // The strings of the parser are reused by the next element.
+        llvm::SmallVector<const char*, 32> args;
         simdjson::ondemand::array args_arr;
         if(!obj["arguments"].get_array().get(args_arr)) {
-            llvm::BumpPtrAllocator local;
-            llvm::StringSaver saver(local);
-            llvm::SmallVector<const char*, 32> args;
             bool malformed = false;
             for(auto arg_val: args_arr) {
                 std::string_view sv;
@@ -287,11 +309,8 @@ std::size_t CompilationDatabase::load(llvm::StringRef path) {
                 }
                 args.push_back(saver.save(llvm::StringRef(sv.data(), sv.size())).data());
             }
-            if(!malformed && !args.empty()) {
-                auto info = save_compilation_info(file_ref, dir_ref, args);
-                assert(info && "save_compilation_info must succeed with non-empty args");
-                auto path_id = paths.intern(file_ref);
-                entries.push_back({path_id, info});
+            if(malformed) {
+                args.clear();
             }
         } else {
             std::string_view cmd_sv;
@@ -303,26 +322,271 @@ std::size_t CompilationDatabase::load(llvm::StringRef path) {
                 ++index;
                 continue;
             }
-            auto info = save_compilation_info(file_ref,
-                                              dir_ref,
-                                              llvm::StringRef(cmd_sv.data(), cmd_sv.size()));
-            if(!info) {
-                ++index;
-                continue;
-            }
-            auto path_id = paths.intern(file_ref);
-            entries.push_back({path_id, info});
+            tokenize_command(llvm::StringRef(cmd_sv.data(), cmd_sv.size()), saver, args);
+        }
+
+        if(!args.empty()) {
+            auto& entry = parsed.entries.emplace_back();
+            entry.file = saver.save(file_ref);
+            entry.directory = saver.save(dir_ref);
+            classify_arguments(file_ref, dir_ref, args, saver, entry.canonical, entry.patch);
         }
 
         ++index;
     }
+}
+
+/// Compare two entry lists sorted by file.  Infos are interned, so equal
+/// commands are the same pointer; a file's entries are compared as a set of
+/// them, since the sort does not keep their order.
+void diff_entries(llvm::ArrayRef<CompilationEntry> old_entries,
+                  llvm::ArrayRef<CompilationEntry> new_entries,
+                  CompilationChanges& changes) {
+    auto next_group = [](llvm::ArrayRef<CompilationEntry>& rest) {
+        auto file = rest.front().file;
+        std::size_t count = 1;
+        while(count < rest.size() && rest[count].file == file) {
+            ++count;
+        }
+        llvm::SmallVector<CompilationInfo*, 2> infos;
+        for(auto& entry: rest.take_front(count)) {
+            infos.push_back(entry.info.ptr);
+        }
+        ranges::sort(infos);
+        rest = rest.drop_front(count);
+        return infos;
+    };
+
+    while(!old_entries.empty() || !new_entries.empty()) {
+        if(new_entries.empty() ||
+           (!old_entries.empty() && old_entries.front().file < new_entries.front().file)) {
+            changes.removed.push_back(old_entries.front().file);
+            next_group(old_entries);
+        } else if(old_entries.empty() || new_entries.front().file < old_entries.front().file) {
+            changes.added.push_back(new_entries.front().file);
+            next_group(new_entries);
+        } else {
+            auto file = new_entries.front().file;
+            if(next_group(old_entries) != next_group(new_entries)) {
+                changes.changed.push_back(file);
+            }
+        }
+    }
+}
+
+}  // namespace
+
+std::vector<const char*> CompileCommand::to_argv() const {
+    std::vector<const char*> argv;
+    argv.reserve(resolved.flags.size() + 4);
+
+    if(resolved.is_cc1 && source_file) {
+        // cc1 mode requires TWO file-related arguments (both are needed):
+        //   1. -main-file-name <basename>  — used by clang for diagnostics/debug info
+        //   2. <source_file> at the end    — the actual input file path
+        // These are NOT duplicates: (1) is just the basename, (2) is the full path.
+        for(std::size_t i = 0; i < resolved.flags.size(); ++i) {
+            argv.push_back(resolved.flags[i]);
+            if(resolved.flags[i] == llvm::StringRef("-cc1")) {
+                argv.push_back("-main-file-name");
+                // path::filename returns a suffix of source_file (a pointer into
+                // the same buffer), so .data() is null-terminated because source_file is.
+                argv.push_back(path::filename(source_file).data());
+            }
+        }
+    } else {
+        argv.insert(argv.end(), resolved.flags.begin(), resolved.flags.end());
+    }
+
+    if(source_file) {
+        argv.push_back(source_file);
+    }
+    return argv;
+}
+
+std::vector<std::string> CompileCommand::to_string_argv() const {
+    auto argv = to_argv();
+    std::vector<std::string> result;
+    result.reserve(argv.size());
+    for(auto* arg: argv) {
+        result.emplace_back(arg);
+    }
+    return result;
+}
+
+CompilationDatabase::CompilationDatabase() = default;
+
+CompilationDatabase::~CompilationDatabase() = default;
+
+llvm::ArrayRef<CompilationEntry> CompilationDatabase::find_entries(std::uint32_t path_id) const {
+    auto [first, last] = ranges::equal_range(entries, path_id, {}, &CompilationEntry::file);
+    if(first == last)
+        return {};
+    return {&*first, static_cast<size_t>(last - first)};
+}
+
+object_ptr<CompilationInfo>
+    CompilationDatabase::intern_compilation_info(llvm::StringRef directory,
+                                                 llvm::ArrayRef<const char*> canonical_args,
+                                                 llvm::ArrayRef<const char*> patch_args) {
+    auto intern = [&](llvm::ArrayRef<const char*> args, auto& out) {
+        out.reserve(args.size());
+        for(auto* arg: args) {
+            out.push_back(strings.save(arg).data());
+        }
+    };
+
+    llvm::SmallVector<const char*, 32> canonical_saved;
+    llvm::SmallVector<const char*, 16> patch_saved;
+    intern(canonical_args, canonical_saved);
+    intern(patch_args, patch_saved);
+
+    /// A new object still borrows the arrays above: copy them while its
+    /// shard is locked, before another thread can see it.
+    auto persist = [](llvm::ArrayRef<const char*>& args, llvm::BumpPtrAllocator& allocator) {
+        if(args.empty())
+            return;
+        auto* buf = allocator.Allocate<const char*>(args.size());
+        ranges::copy(args, buf);
+        args = {buf, args.size()};
+    };
+
+    /// Dedup canonical command.
+    auto canonical = canonicals.save(CanonicalCommand{canonical_saved},
+                                     [&](CanonicalCommand& command, auto& allocator) {
+                                         persist(command.arguments, allocator);
+                                     });
+
+    /// Build and dedup CompilationInfo.
+    auto dir = strings.save(directory).data();
+    return infos.save(CompilationInfo{dir, canonical, patch_saved},
+                      [&](CompilationInfo& info, auto& allocator) {
+                          persist(info.patch, allocator);
+                      });
+}
+
+object_ptr<CompilationInfo>
+    CompilationDatabase::save_compilation_info(llvm::StringRef file,
+                                               llvm::StringRef directory,
+                                               llvm::ArrayRef<const char*> arguments) {
+    llvm::BumpPtrAllocator local;
+    llvm::StringSaver saver(local);
+
+    llvm::SmallVector<const char*, 32> canonical_args;
+    llvm::SmallVector<const char*, 16> patch_args;
+    classify_arguments(file, directory, arguments, saver, canonical_args, patch_args);
+    return intern_compilation_info(directory, canonical_args, patch_args);
+}
+
+object_ptr<CompilationInfo> CompilationDatabase::save_compilation_info(llvm::StringRef file,
+                                                                       llvm::StringRef directory,
+                                                                       llvm::StringRef command) {
+    llvm::BumpPtrAllocator local;
+    llvm::StringSaver saver(local);
+
+    llvm::SmallVector<const char*, 32> arguments;
+    tokenize_command(command, saver, arguments);
+
+    if(arguments.empty()) {
+        return {nullptr};
+    }
+
+    return save_compilation_info(file, directory, arguments);
+}
+
+bool CompilationDatabase::read_entries(llvm::StringRef path,
+                                       std::uint32_t source,
+                                       std::vector<CompilationEntry>& out) {
+    // Large databases are mapped rather than read; only the chunk being
+    // parsed is copied into a padded buffer for simdjson.
+    auto buffer = llvm::MemoryBuffer::getFile(path,
+                                              /*FileSize=*/-1,
+                                              /*RequiresNullTerminator=*/false);
+    if(!buffer) {
+        LOG_ERROR("Failed to read compilation database from {}: {}",
+                  path,
+                  buffer.getError().message());
+        return false;
+    }
+
+    // A few chunks per thread keep the threads busy when entries differ in
+    // size; tiny chunks would spend more on parser setup than on parsing.
+    auto json = (*buffer)->getBuffer();
+    auto threads = std::max(1u, std::thread::hardware_concurrency());
+    auto chunk_size = std::max<std::size_t>(json.size() / (threads * 4), 256 * 1024);
+
+    std::vector<JsonChunk> chunks;
+    if(!split_json_array(json, chunk_size, chunks)) {
+        LOG_ERROR("Invalid compilation database format in {}: root element must be an array.",
+                  path);
+        return false;
+    }
+
+    // Parsing, classifying and interning the commands run in parallel;
+    // paths are numbered here, in file order, so that IDs stay reproducible.
+    std::vector<ParsedChunk> parsed(chunks.size());
+    llvm::parallelFor(0, chunks.size(), [&](std::size_t i) {
+        parse_chunk(path, chunks[i], parsed[i]);
+        for(auto& entry: parsed[i].entries) {
+            entry.info = intern_compilation_info(entry.directory, entry.canonical, entry.patch);
+        }
+    });
+
+    for(auto& chunk: parsed) {
+        for(auto& entry: chunk.entries) {
+            auto path_id = paths.intern(entry.file);
+            out.push_back({path_id, entry.info, source});
+        }
+    }
+    return true;
+}
+
+std::size_t CompilationDatabase::load(llvm::StringRef path, CompilationChanges* changes) {
+    auto previous = std::move(entries);
+    entries.clear();
+    source_paths.assign(1, path.str());
+    indices_stale = true;
+
+    if(!read_entries(path, 0, entries)) {
+        return 0;
+    }
 
     // Sort by file path_id for binary search.
     ranges::sort(entries, {}, &CompilationEntry::file);
 
+    if(changes) {
+        diff_entries(previous, entries, *changes);
+    }
+
     return entries.size();
 }
 
+std::size_t CompilationDatabase::add(llvm::StringRef path, CompilationChanges* changes) {
+    auto it = ranges::find(source_paths, path);
+    auto source = static_cast<std::uint32_t>(it - source_paths.begin());
+
+    std::vector<CompilationEntry> loaded;
+    if(!read_entries(path, source, loaded)) {
+        return 0;
+    }
+    if(it == source_paths.end()) {
+        source_paths.push_back(path.str());
+    }
+    indices_stale = true;
+
+    auto previous = entries;
+    std::erase_if(entries, [&](const CompilationEntry& entry) { return entry.source == source; });
+    auto count = loaded.size();
+    entries.insert(entries.end(), loaded.begin(), loaded.end());
+    ranges::sort(entries, {}, &CompilationEntry::file);
+
+    if(changes) {
+        diff_entries(previous, entries, *changes);
+    }
+
+    return count;
+}
+
 CompileCommand CompilationDatabase::build_command(std::uint32_t path_id,
                                                   object_ptr<CompilationInfo> info,
                                                   const CommandOptions& options) {
@@ -421,6 +685,9 @@ llvm::SmallVector<CompileCommand> CompilationDatabase::lookup(llvm::StringRef fi
         for(auto& entry: matched) {
             results.push_back(build_command(path_id, entry.info, options));
         }
+    } else if(auto neighbour = find_neighbour(file)) {
+        // A new file most likely builds like the files next to it.
+        results.push_back(build_command(path_id, find_entries(*neighbour).front().info, options));
     } else {
         // No matching entry — synthesize a default command.
         std::vector<const char*> flags;
@@ -455,6 +722,101 @@ bool CompilationDatabase::has_entry(llvm::StringRef file) {
     return !find_entries(path_id).empty();
 }
 
+/// The language a source file compiles as, by extension; empty for headers
+/// and unknown extensions, which may take the command of any source.
+static llvm::StringRef source_language(llvm::StringRef file) {
+    auto extension = path::extension(file);
+    if(extension == ".c")
+        return "c";
+    if(extension == ".cpp" || extension == ".cc" || extension == ".cxx" || extension == ".c++" ||
+       extension == ".C")
+        return "c++";
+    if(extension == ".m")
+        return "objective-c";
+    if(extension == ".mm")
+        return "objective-c++";
+    if(extension == ".cu")
+        return "cuda";
+    return {};
+}
+
+void CompilationDatabase::update_indices() {
+    if(!indices_stale)
+        return;
+    neighbour_index.clear();
+    directory_index.clear();
+    for(auto& entry: entries) {
+        if(neighbour_index.empty() || neighbour_index.back().file != entry.file) {
+            auto path = paths.resolve(entry.file);
+            neighbour_index.push_back({source_language(path), path, entry.file});
+            directory_index[path::parent_path(path)].push_back(entry.file);
+        }
+    }
+    ranges::sort(neighbour_index, {}, [](const Neighbour& n) {
+        return std::pair(n.language, n.path);
+    });
+    indices_stale = false;
+}
+
+llvm::ArrayRef<std::uint32_t> CompilationDatabase::files_in(llvm::StringRef directory) {
+    update_indices();
+    auto it = directory_index.find(directory);
+    if(it == directory_index.end())
+        return {};
+    return it->second;
+}
+
+std::optional<std::uint32_t> CompilationDatabase::find_neighbour(llvm::StringRef file) {
+    update_indices();
+    auto key = [](const Neighbour& n) { return std::pair(n.language, n.path); };
+
+    // The longest common prefix with `file` is that of a path sorting right
+    // before or after it; only whole directories of that prefix count.
+    auto shared_directory = [&](llvm::StringRef other) -> std::size_t {
+        std::size_t common = 0;
+        auto limit = std::min(file.size(), other.size());
+        while(common < limit && file[common] == other[common]) {
+            ++common;
+        }
+        for(auto i = common; i > 0; --i) {
+            if(path::is_separator(file[i - 1]))
+                return i;
+        }
+        return 0;
+    };
+
+    std::optional<std::uint32_t> best;
+    std::size_t best_shared = path::root_path(file).size();
+    auto consider = [&](const Neighbour& neighbour) {
+        auto shared = shared_directory(neighbour.path);
+        if(shared > best_shared) {
+            best = neighbour.file;
+            best_shared = shared;
+        }
+    };
+    // Search the language of a source file, or every language for a header.
+    auto search = [&](llvm::StringRef language) {
+        auto it = ranges::lower_bound(neighbour_index, std::pair(language, file), {}, key);
+        if(it != neighbour_index.begin() && std::prev(it)->language == language) {
+            consider(*std::prev(it));
+        }
+        if(it != neighbour_index.end() && it->language == language) {
+            consider(*it);
+        }
+    };
+
+    if(auto language = source_language(file); !language.empty()) {
+        search(language);
+        return best;
+    }
+    for(auto it = neighbour_index.begin(); it != neighbour_index.end();) {
+        auto language = it->language;
+        search(language);
+        it = ranges::upper_bound(it, neighbour_index.end(), language, {}, &Neighbour::language);
+    }
+    return best;
+}
+
 llvm::ArrayRef<CompilationEntry> CompilationDatabase::get_entries() const {
     return entries;
 }
@@ -498,6 +860,7 @@ void CompilationDatabase::add_command(llvm::StringRef directory,
     // Insert in sorted position to maintain sort invariant.
     auto it = ranges::lower_bound(entries, path_id, {}, &CompilationEntry::file);
     entries.insert(it, {path_id, info});
+    indices_stale = true;
 }
 
 void CompilationDatabase::add_command(llvm::StringRef directory,
@@ -507,6 +870,7 @@ void CompilationDatabase::add_command(llvm::StringRef directory,
     auto info = save_compilation_info(file, directory, command);
     auto it = ranges::lower_bound(entries, path_id, {}, &CompilationEntry::file);
     entries.insert(it, {path_id, info});
+    indices_stale = true;
 }
 
 #endif
@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -89,6 +90,21 @@ struct CompilationInfo {
     friend bool operator==(const CompilationInfo&, const CompilationInfo&) = default;
 };
 
+/// What a reload changed, by file path_id (of the database's PathPool):
+/// files that gained or lost all entries, and files whose set of
+/// compilation infos differs.  Entries are compared by interned
+/// CompilationInfo, so an identical command counts as unchanged wherever it
+/// moved in the file.
+struct CompilationChanges {
+    llvm::SmallVector<std::uint32_t> added;
+    llvm::SmallVector<std::uint32_t> removed;
+    llvm::SmallVector<std::uint32_t> changed;
+
+    bool empty() const {
+        return added.empty() && removed.empty() && changed.empty();
+    }
+};
+
 /// A single entry in the compilation database, stored in a flat sorted vector.
 struct CompilationEntry {
     /// Interned path ID for the source file (from PathPool).
@@ -96,6 +112,10 @@ struct CompilationEntry {
 
     /// Parsed compilation info (directory + canonical + patch).
     object_ptr<CompilationInfo> info;
+
+    /// Index of the compile_commands.json the entry came from, in the
+    /// database's sources().
+    std::uint32_t source = 0;
 };
 
 }  // namespace clice
@@ -175,11 +195,25 @@ public:
 public:
     /// Load (or reload) the compilation database from the given file.
     /// Full reload: old entries are replaced, but string pool and canonical
-    /// commands survive. Returns the number of entries loaded.
-    std::size_t load(llvm::StringRef path);
+    /// commands survive. Returns the number of entries loaded.  With
+    /// `changes`, also reports which files the new entries differ for.
+    std::size_t load(llvm::StringRef path, CompilationChanges* changes = nullptr);
+
+    /// Load another compilation database next to those already loaded, or
+    /// reload one of them: only the entries that came from `path` are
+    /// replaced.  Returns the number of entries loaded from `path`; if it
+    /// cannot be read, the previous entries are kept and 0 is returned.
+    std::size_t add(llvm::StringRef path, CompilationChanges* changes = nullptr);
+
+    /// The compile_commands.json files loaded, in load order.
+    llvm::ArrayRef<std::string> sources() const {
+        return source_paths;
+    }
 
     /// Lookup the compile commands for a file. A file may have multiple
     /// compilation commands (e.g. different build configurations); all are returned.
+    /// A file without an entry gets the command of its nearest neighbour (see
+    /// find_neighbour()), or a synthesized default if it has none.
     llvm::SmallVector<CompileCommand> lookup(llvm::StringRef file,
                                              const CommandOptions& options = {});
 
@@ -193,6 +227,17 @@ public:
     /// (as opposed to a synthesized default).
     bool has_entry(llvm::StringRef file);
 
+    /// The path_id of the entry nearest to `file` in the directory tree: one
+    /// in the same directory, else under the closest common parent.  Only
+    /// entries compiling the same language as a source `file` qualify, and
+    /// none below the filesystem root alone.  O(log n) after the first call
+    /// following a load.
+    std::optional<std::uint32_t> find_neighbour(llvm::StringRef file);
+
+    /// The path_ids of the files with an entry directly in `directory`.
+    /// O(1) after the first call following a load, like find_neighbour().
+    llvm::ArrayRef<std::uint32_t> files_in(llvm::StringRef directory);
+
     /// All compilation entries (sorted by path_id).
     llvm::ArrayRef<CompilationEntry> get_entries() const;
 
@@ -233,6 +278,12 @@ public:
 #endif
 
 private:
+    /// Parse the compilation database at `path` and append its entries,
+    /// tagged with `source`, to `out` (unsorted).
+    bool read_entries(llvm::StringRef path,
+                      std::uint32_t source,
+                      std::vector<CompilationEntry>& out);
+
     CompileCommand build_command(std::uint32_t path_id,
                                  object_ptr<CompilationInfo> info,
                                  const CommandOptions& options);
@@ -241,8 +292,11 @@ private:
     /// Returns a sub-range of `entries`; may be empty.
     llvm::ArrayRef<CompilationEntry> find_entries(std::uint32_t path_id) const;
 
-    /// Allocate a persistent copy of a const char* array on the bump allocator.
-    llvm::ArrayRef<const char*> persist_args(llvm::ArrayRef<const char*> args);
+    /// Intern classified arguments into the string pool and dedup them
+    /// into a canonical command and compilation info.  Thread-safe.
+    object_ptr<CompilationInfo> intern_compilation_info(llvm::StringRef directory,
+                                                        llvm::ArrayRef<const char*> canonical_args,
+                                                        llvm::ArrayRef<const char*> patch_args);
 
     /// Parse and classify a compilation command into canonical + patch.
     object_ptr<CompilationInfo> save_compilation_info(llvm::StringRef file,
@@ -253,18 +307,15 @@ private:
                                                       llvm::StringRef directory,
                                                       llvm::StringRef command);
 
-    /// The memory pool which holds all elements of compilation database.
-    /// Heap-allocated so its address is stable across moves.
-    std::unique_ptr<llvm::BumpPtrAllocator> allocator = std::make_unique<llvm::BumpPtrAllocator>();
-
-    /// Keep all strings (arguments, directories, etc.).
-    StringSet strings{allocator.get()};
+    /// Keep all strings (arguments, directories, etc.).  Shared by the
+    /// threads of a load, as are the two sets below.
+    ConcurrentStringSet strings;
 
     /// Shared canonical commands — most files share one instance.
-    ObjectSet<CanonicalCommand> canonicals{allocator.get()};
+    ConcurrentObjectSet<CanonicalCommand> canonicals;
 
     /// Per-file compilation infos (canonical + patch + directory).
-    ObjectSet<CompilationInfo> infos{allocator.get()};
+    ConcurrentObjectSet<CompilationInfo> infos;
 
     /// Intern pool for file paths → compact uint32_t IDs.
     PathPool paths;
@@ -272,6 +323,29 @@ private:
     /// All compilation entries, sorted by file path_id.
     /// Multiple entries for the same file are adjacent.
     std::vector<CompilationEntry> entries;
+
+    /// Paths of the loaded databases, indexed by CompilationEntry::source.
+    std::vector<std::string> source_paths;
+
+    /// Rebuild the two indices below if the entries changed since.
+    void update_indices();
+
+    /// The files of `entries` sorted by language, then path, for
+    /// find_neighbour(): within a language, the file nearest to a path is
+    /// adjacent to where the path would sort.  Rebuilt on the first lookup
+    /// after the entries change.
+    struct Neighbour {
+        llvm::StringRef language;
+        llvm::StringRef path;
+        std::uint32_t file;
+    };
+
+    std::vector<Neighbour> neighbour_index;
+
+    /// The files of `entries` by their directory, for files_in().  Rebuilt
+    /// along with neighbour_index.
+    llvm::StringMap<llvm::SmallVector<std::uint32_t>> directory_index;
+    bool indices_stale = true;
 };
 
 }  // namespace clice
@@ -8,16 +8,19 @@
 
 #include "command/argument_parser.h"
 #include "command/command.h"
+#include "support/cache_store.h"
 #include "support/filesystem.h"
 #include "support/logging.h"
 
 #include "kota/async/async.h"
+#include "kota/codec/json/json.h"
 #include "kota/meta/enum.h"
 #include "llvm/ADT/ScopeExit.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/Program.h"
+#include "llvm/Support/xxhash.h"
 #include "llvm/TargetParser/Host.h"
 #include "clang/Driver/Compilation.h"
 #include "clang/Driver/Driver.h"
@@ -507,17 +510,120 @@ Toolchain::ToolchainExtract Toolchain::extract_flags(llvm::StringRef file,
     return result;
 }
 
+llvm::StringMap<std::vector<const char*>>::iterator
+    Toolchain::insert(std::string key, llvm::ArrayRef<std::string> result) {
+    std::vector<const char*> saved;
+    saved.reserve(result.size());
+    for(auto& s: result)
+        saved.push_back(strings.save(s).data());
+    return cache.try_emplace(std::move(key), std::move(saved)).first;
+}
+
+std::string Toolchain::driver_identity(llvm::StringRef driver) {
+    // A bare driver name runs whatever PATH finds.
+    std::string program = driver.str();
+    if(!llvm::sys::path::has_parent_path(driver)) {
+        auto found = llvm::sys::findProgramByName(driver);
+        if(!found)
+            return {};
+        program = std::move(*found);
+    }
+
+    llvm::sys::fs::file_status status;
+    if(llvm::sys::fs::status(program, status))
+        return {};
+    auto mtime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     status.getLastModificationTime().time_since_epoch())
+                     .count();
+
+    std::string identity = program;
+    identity += '\0';
+    identity += std::to_string(status.getSize());
+    identity += '\0';
+    identity += std::to_string(mtime);
+    return identity;
+}
+
+std::string Toolchain::store_key(llvm::StringRef key) {
+    auto driver = key.take_until([](char c) { return c == '\0'; });
+    std::string input = driver_identity(driver);
+    if(input.empty())
+        return {};
+    input += '\0';
+    input += key;
+    auto hash = llvm::xxh3_128bits(llvm::arrayRefFromStringRef(input));
+    return std::format("{:016x}{:016x}", hash.high64, hash.low64);
+}
+
+bool Toolchain::load_stored(llvm::StringRef key) {
+    if(!store)
+        return false;
+    auto stored_key = store_key(key);
+    if(stored_key.empty())
+        return false;
+    auto blob = store->lookup("toolchain", stored_key);
+    if(!blob)
+        return false;
+    auto content = fs::read(*blob);
+    std::vector<std::string> result;
+    if(!content || !kota::codec::json::from_json(*content, result) || result.empty()) {
+        store->invalidate("toolchain", stored_key);
+        return false;
+    }
+    insert(key.str(), result);
+    return true;
+}
+
+void Toolchain::save_stored(llvm::StringRef key, llvm::ArrayRef<std::string> result) {
+    if(!store)
+        return;
+    auto stored_key = store_key(key);
+    if(stored_key.empty())
+        return;
+    auto json = kota::codec::json::to_json(std::vector<std::string>(result.begin(), result.end()));
+    if(!json)
+        return;
+    auto pending = store->begin_store("toolchain", stored_key);
+    if(auto written = fs::write(pending.tmp_path, *json); !written) {
+        LOG_WARN("Failed to write toolchain query result: {}", written.error().message());
+        store->abort(pending);
+        return;
+    }
+    if(auto committed = store->commit(std::move(pending)); !committed) {
+        LOG_WARN("Failed to commit toolchain query result: {}", committed.error().message());
+    }
+}
+
 std::expected<void, std::string> Toolchain::resolve(CompileCommand& cmd) {
     if(cmd.resolved.flags.empty())
         return std::unexpected("empty flags");
 
+    // The query key is derived from the extension and flags alone, and so is
+    // everything appended below: equal inputs resolve to equal flags.
+    resolved_key.clear();
+    resolved_key += path::extension(cmd.source_file);
+    resolved_key += '\0';
+    for(llvm::StringRef arg: cmd.resolved.flags) {
+        resolved_key += arg;
+        resolved_key += '\0';
+    }
+    if(auto it = resolved.find(resolved_key); it != resolved.end()) {
+        cmd.resolved.flags.assign(it->second.flags.begin(), it->second.flags.end());
+        cmd.resolved.is_cc1 = it->second.is_cc1;
+        return {};
+    }
+
     auto [key, query_args] = extract_flags(cmd.source_file, cmd.resolved.flags);
 
+    // A known failure is not looked up in the store again on every resolve.
     auto it = cache.find(key);
     if(it == cache.end()) {
         if(auto failed_it = failed.find(key); failed_it != failed.end())
             return std::unexpected(failed_it->second);
-
+    }
+    if(it == cache.end() && load_stored(key))
+        it = cache.find(key);
+    if(it == cache.end()) {
         LOG_WARN("Toolchain cache miss: file={}", cmd.source_file);
 
         auto result = query(query_args, cmd.source_file);
@@ -526,11 +632,8 @@ std::expected<void, std::string> Toolchain::resolve(CompileCommand& cmd) {
             return std::unexpected(std::move(result.error()));
         }
 
-        std::vector<const char*> saved;
-        saved.reserve(result->size());
-        for(auto& s: *result)
-            saved.push_back(strings.save(s).data());
-        it = cache.try_emplace(std::move(key), std::move(saved)).first;
+        save_stored(key, *result);
+        it = insert(std::move(key), *result);
     }
 
     auto cached = llvm::ArrayRef(it->second);
@@ -587,6 +690,11 @@ std::expected<void, std::string> Toolchain::resolve(CompileCommand& cmd) {
 
     cmd.resolved.flags = std::move(cleaned);
     cmd.resolved.is_cc1 = ranges::contains(cmd.resolved.flags, llvm::StringRef("-cc1"));
+
+    auto* flags = allocator->Allocate<const char*>(cmd.resolved.flags.size());
+    ranges::copy(cmd.resolved.flags, flags);
+    llvm::ArrayRef<const char*> saved(flags, cmd.resolved.flags.size());
+    resolved.try_emplace(resolved_key, ResolvedTemplate{saved, cmd.resolved.is_cc1});
     return {};
 }
 
@@ -603,6 +711,7 @@ bool Toolchain::has_cache() const {
 void Toolchain::warm(llvm::ArrayRef<CompileCommand> commands) {
     llvm::StringMap<bool> seen;
     std::vector<PendingQuery> pending;
+    std::size_t restored = 0;
 
     for(auto& cmd: commands) {
         if(cmd.resolved.flags.empty())
@@ -612,9 +721,17 @@ void Toolchain::warm(llvm::ArrayRef<CompileCommand> commands) {
         if(cache.count(key) || failed.count(key) || !seen.try_emplace(key, true).second)
             continue;
 
+        if(load_stored(key)) {
+            restored += 1;
+            continue;
+        }
+
         pending.push_back({std::move(key), std::move(query_args), cmd.source_file});
     }
 
+    if(restored != 0)
+        LOG_INFO("Toolchain cache: {} queries restored from the cache store", restored);
+
     if(pending.empty())
         return;
 
@@ -657,11 +774,8 @@ void Toolchain::warm(llvm::ArrayRef<CompileCommand> commands) {
             continue;
         }
 
-        std::vector<const char*> saved;
-        saved.reserve(o.result->size());
-        for(auto& arg: *o.result)
-            saved.push_back(strings.save(arg).data());
-        cache.try_emplace(std::move(o.key), std::move(saved));
+        save_stored(o.key, *o.result);
+        insert(std::move(o.key), *o.result);
         succeeded += 1;
     }
 
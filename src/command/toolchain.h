@@ -14,6 +14,7 @@
 
 namespace clice {
 
+class CacheStore;
 struct CompileCommand;
 
 enum class CompilerFamily {
@@ -31,6 +32,8 @@ enum class CompilerFamily {
 /// the compiler driver. Results are cached by (driver, file extension,
 /// non-user-content flags); user-content flags (-I, -D, ...) don't affect
 /// the query and are re-appended from the original command after resolution.
+/// The finished cc1 flags are remembered per command, so the files sharing
+/// a command resolve to one copy without parsing it again.
 class Toolchain {
 public:
     Toolchain();
@@ -60,8 +63,21 @@ public:
 
     bool has_cache() const;
 
+    /// Also keep query results in the "toolchain" namespace of `store`, so a
+    /// restart whose drivers did not change spawns none of them.  A result
+    /// is stored under the cache key together with the path, size and mtime
+    /// of the driver binary it came from; rebuilding or replacing the driver
+    /// misses the old one.
+    void set_store(CacheStore* store) {
+        this->store = store;
+    }
+
     static CompilerFamily driver_family(llvm::StringRef driver);
 
+    /// The path, size and mtime of the binary `driver` runs, found on PATH
+    /// for a bare name.  Empty when there is no such binary.
+    static std::string driver_identity(llvm::StringRef driver);
+
 #ifdef CLICE_ENABLE_TEST
 
     /// Compute the cache key for the given file and driver-level arguments.
@@ -79,6 +95,11 @@ public:
         return failed.size();
     }
 
+    /// Number of distinct commands whose resolved flags are remembered.
+    std::size_t resolved_size() const {
+        return resolved.size();
+    }
+
     /// Parse the first `-cc1` line from driver `-###` output, dropping flags
     /// our linked cc1 does not understand (along with their values).
     static std::vector<std::string> parse_cc1(llvm::StringRef content);
@@ -91,8 +112,28 @@ private:
         std::vector<const char*> query_args;
     };
 
+    /// The cc1 flags a driver command resolved to, in `allocator`.
+    struct ResolvedTemplate {
+        llvm::ArrayRef<const char*> flags;
+        bool is_cc1 = false;
+    };
+
     ToolchainExtract extract_flags(llvm::StringRef file, llvm::ArrayRef<const char*> arguments);
 
+    /// Cache a query result under `key`, saving its strings.
+    llvm::StringMap<std::vector<const char*>>::iterator insert(std::string key,
+                                                               llvm::ArrayRef<std::string> result);
+
+    /// The key of `key` in the store: a hash over it and the identity of the
+    /// driver binary it starts with.  Empty when the driver is not found.
+    static std::string store_key(llvm::StringRef key);
+
+    /// Cache the result stored for `key`, if any; returns whether there was one.
+    bool load_stored(llvm::StringRef key);
+
+    /// Write a query result to the store.
+    void save_stored(llvm::StringRef key, llvm::ArrayRef<std::string> result);
+
     std::unique_ptr<llvm::BumpPtrAllocator> allocator;
     StringSet strings;
     llvm::StringMap<std::vector<const char*>> cache;
@@ -101,6 +142,16 @@ private:
     /// Avoids re-spawning the same failing driver probe for every file that
     /// shares the key (see clangd's SystemIncludeExtractor for precedent).
     llvm::StringMap<std::string> failed;
+
+    /// Resolved flags by file extension and driver command ('\0'-joined).
+    /// The source file is not part of the flags, to_argv() adds it.
+    llvm::StringMap<ResolvedTemplate> resolved;
+
+    /// Reused buffer for `resolved` lookups.
+    std::string resolved_key;
+
+    /// Persistent store of query results; not owned, may be null.
+    CacheStore* store = nullptr;
 };
 
 }  // namespace clice
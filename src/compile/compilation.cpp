@@ -5,11 +5,18 @@
 #include "compile/implement.h"
 #include "semantic/ast_utility.h"
 #include "support/logging.h"
+#include "syntax/scan.h"
 
 #include "llvm/Support/Error.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/raw_ostream.h"
 #include "clang/Frontend/MultiplexConsumer.h"
 #include "clang/Frontend/TextDiagnosticPrinter.h"
+#include "clang/Lex/Lexer.h"
+#include "clang/Lex/PPCallbacks.h"
 #include "clang/Lex/PreprocessorOptions.h"
+#include "clang/Sema/Sema.h"
+#include "clang/Sema/TemplateInstCallback.h"
 
 namespace clice {
 
@@ -102,6 +109,9 @@ std::unique_ptr<clang::CompilerInvocation>
 
     auto& header_search_opts = invocation->getHeaderSearchOpts();
     header_search_opts.Verbose = false;
+    // Record input file hashes and check them where mtimes disagree, so a
+    // PCM from the remote cache, built on another machine, still loads.
+    header_search_opts.ValidateASTInputFilesContent = true;
     for(auto& [name, path]: params.pcms) {
         header_search_opts.PrebuiltModuleFiles.try_emplace(name.str(), std::move(path));
     }
@@ -118,6 +128,7 @@ std::unique_ptr<clang::CompilerInvocation>
     front_opts.PrintSupportedCPUs = false;
     front_opts.PrintEnabledExtensions = false;
     front_opts.PrintSupportedExtensions = false;
+    front_opts.SkipFunctionBodies = params.skip_bodies || !params.skip_header_bodies.empty();
 
     /// Compiler flags (like gcc/clang's -M, -MD, -MMD, -H, or msvc's /showIncludes)
     /// can generate dependency files or print included headers to stdout/stderr.
@@ -151,23 +162,246 @@ void CompilationUnitRef::Self::configure_tidy(tidy::TidyParams tidy_params) {
     checker = tidy::configure(*instance, tidy_params);
 }
 
+std::vector<clang::Decl*> CompilationUnitRef::Self::select_tidy_decls() {
+    auto& sm = SM();
+    auto main_file = sm.getMainFileID();
+    std::vector<clang::Decl*> selected;
+    /// The main-file decls left out, whose previous results still hold.
+    std::vector<LocalSourceRange> kept;
+    for(auto decl: top_level_decls) {
+        auto range = sm.getExpansionRange(decl->getSourceRange()).getAsRange();
+        auto [fid, begin] = sm.getDecomposedLoc(range.getBegin());
+        auto [end_fid, end] = sm.getDecomposedLoc(range.getEnd());
+        if(fid != main_file || end_fid != fid) {
+            selected.push_back(decl);
+            continue;
+        }
+
+        LocalSourceRange decl_range{begin, end};
+        if(llvm::any_of(*tidy_ranges, [&](auto r) { return r.intersects(decl_range); })) {
+            selected.push_back(decl);
+        } else {
+            kept.push_back(decl_range);
+        }
+    }
+
+    /// A result is reused, with its notes, if it lies in a decl that is not
+    /// matched again.  Those elsewhere come from preprocessor callbacks or
+    /// whole-file checks, which report afresh.
+    bool keep = false;
+    for(auto& diag: tidy_reused) {
+        if(diag.id.level != DiagnosticLevel::Note) {
+            keep = !tidy::is_whole_file_check(diag.id.name) &&
+                   llvm::any_of(kept, [&](auto r) { return r.contains(diag.range.begin); });
+        }
+        if(keep) {
+            diagnostics.push_back(std::move(diag));
+            diagnostics.back().fid = main_file;
+        }
+    }
+    tidy_reused.clear();
+    return selected;
+}
+
 void CompilationUnitRef::Self::run_tidy() {
     if(checker) {
         // AST traversals should exclude the preamble, to avoid performance cliffs.
         // TODO: is it okay to affect the unit-level traversal scope here?
         auto& Ctx = instance->getASTContext();
         Ctx.setTraversalScope(top_level_decls);
-        checker->finder.matchAST(Ctx);
+        if(tidy_ranges) {
+            if(checker->has_whole_file_checks) {
+                checker->whole_file_finder.matchAST(Ctx);
+            }
+            Ctx.setTraversalScope(select_tidy_decls());
+            checker->finder.matchAST(Ctx);
+            Ctx.setTraversalScope(top_level_decls);
+        } else {
+            checker->finder.matchAST(Ctx);
+        }
 
         /// XXX: This is messy: clang-tidy checks flush some diagnostics at EOF.
         /// However Action->EndSourceFile() would destroy the ASTContext!
         /// So just inform the preprocessor of EOF, while keeping everything alive.
         instance->getPreprocessor().EndSourceFile();
+
+        for(auto& entry: checker->timings) {
+            tidy_timings.emplace_back(entry.getKey().str(), entry.getValue().getWallTime());
+        }
+        llvm::sort(tidy_timings, [](auto& lhs, auto& rhs) { return lhs.second > rhs.second; });
+    }
+}
+
+/// Locate the body of the function declared at `offset`: the first `{`
+/// outside parentheses, up to its matching `}`.  Braces of a constructor's
+/// member initializers (`x{1}`) are stepped over.  Raw lexing keeps this
+/// cheap; a wrong guess only lets a query land in a skipped body, which the
+/// caller answers by parsing it.
+static std::optional<LocalSourceRange> find_body(clang::SourceManager& sm,
+                                                 clang::FileID fid,
+                                                 std::uint32_t offset,
+                                                 const clang::LangOptions& lang_opts) {
+    auto text = sm.getBufferData(fid);
+    clang::Lexer lexer(sm.getLocForStartOfFile(fid),
+                       lang_opts,
+                       text.begin(),
+                       text.begin() + offset,
+                       text.end());
+
+    int parens = 0;
+    int braces = 0;
+    int initializer_braces = 0;
+    bool initializers = false;
+    std::uint32_t begin = 0;
+    auto previous = clang::tok::unknown;
+
+    clang::Token token;
+    while(true) {
+        bool last = lexer.LexFromRawLexer(token);
+        if(token.is(clang::tok::eof)) {
+            return std::nullopt;
+        }
+
+        auto kind = token.getKind();
+        auto at = sm.getFileOffset(token.getLocation());
+        if(braces != 0) {
+            if(kind == clang::tok::l_brace) {
+                braces += 1;
+            } else if(kind == clang::tok::r_brace && --braces == 0) {
+                return LocalSourceRange{begin, at + 1};
+            }
+        } else if(initializer_braces != 0) {
+            if(kind == clang::tok::l_brace) {
+                initializer_braces += 1;
+            } else if(kind == clang::tok::r_brace) {
+                initializer_braces -= 1;
+            }
+        } else if(kind == clang::tok::l_paren) {
+            parens += 1;
+        } else if(kind == clang::tok::r_paren) {
+            parens -= 1;
+        } else if(parens == 0) {
+            if(kind == clang::tok::semi) {
+                return std::nullopt;
+            } else if(kind == clang::tok::colon) {
+                initializers = true;
+            } else if(kind == clang::tok::l_brace) {
+                if(initializers && (previous == clang::tok::raw_identifier ||
+                                    previous == clang::tok::greater)) {
+                    initializer_braces = 1;
+                } else {
+                    begin = at;
+                    braces = 1;
+                }
+            }
+        }
+
+        previous = kind;
+        if(last) {
+            return std::nullopt;
+        }
+    }
+}
+
+bool CompilationUnitRef::Self::skip_body(clang::Decl* decl) {
+    auto& sm = SM();
+    auto location = decl->getLocation();
+
+    // Headers are decided once per file; their bodies need not be located.
+    if(!skip_header_bodies.empty() && location.isValid()) {
+        auto fid = sm.getFileID(sm.getExpansionLoc(location));
+        if(fid != sm.getMainFileID()) {
+            auto [it, inserted] = header_skips.try_emplace(fid, false);
+            if(inserted) {
+                auto path = CompilationUnitRef(this).file_path(fid);
+                it->second = !path.empty() && skip_header_bodies.contains(path);
+                if(it->second) {
+                    skipped_headers.push_back(path.str());
+                }
+            }
+            return it->second;
+        }
+    }
+
+    if(!skip_bodies) {
+        return false;
+    }
+
+    // Only the main file; a body spelled through a macro cannot be located
+    // in the text, so it is always parsed.
+    if(!location.isFileID() || sm.getFileID(location) != sm.getMainFileID()) {
+        return false;
+    }
+
+    auto body =
+        find_body(sm, sm.getMainFileID(), sm.getFileOffset(location), instance->getLangOpts());
+    if(!body) {
+        return false;
+    }
+    for(auto& range: parsed_bodies) {
+        if(range.intersects(*body)) {
+            return false;
+        }
+    }
+    skipped_bodies.push_back(*body);
+    return true;
+}
+
+bool CompilationUnitRef::Self::check_cancelled() {
+    if(!stop || !stop->load(std::memory_order_relaxed)) {
+        return false;
     }
+
+    if(!cancel_reported && instance) {
+        cancel_reported = true;
+        auto& diagnostics = instance->getDiagnostics();
+        diagnostics.Report(
+            diagnostics.getCustomDiagID(clang::DiagnosticsEngine::Fatal, "compilation cancelled"));
+    }
+    return true;
 }
 
 namespace {
 
+/// Polls for cancellation whenever the preprocessor enters a file.
+class CancellationCallbacks final : public clang::PPCallbacks {
+public:
+    CancellationCallbacks(CompilationUnitRef unit) : unit(unit) {}
+
+    void LexedFileChanged(clang::FileID,
+                          LexedFileChangeReason reason,
+                          clang::SrcMgr::CharacteristicKind,
+                          clang::FileID,
+                          clang::SourceLocation) override {
+        if(reason == LexedFileChangeReason::EnterFile) {
+            unit->check_cancelled();
+        }
+    }
+
+private:
+    CompilationUnitRef unit;
+};
+
+/// Polls for cancellation whenever Sema starts instantiating a template,
+/// which is where heavy headers spend most of their time.
+class CancellationInstCallback final : public clang::TemplateInstantiationCallback {
+public:
+    CancellationInstCallback(CompilationUnitRef unit) : unit(unit) {}
+
+    void initialize(const clang::Sema&) override {}
+
+    void finalize(const clang::Sema&) override {}
+
+    void atTemplateBegin(const clang::Sema&, const clang::Sema::CodeSynthesisContext&) override {
+        unit->check_cancelled();
+    }
+
+    void atTemplateEnd(const clang::Sema&, const clang::Sema::CodeSynthesisContext&) override {}
+
+private:
+    CompilationUnitRef unit;
+};
+
 /// A wrapper ast consumer, so that we can cancel the ast parse
 class ProxyASTConsumer final : public clang::MultiplexConsumer {
 public:
@@ -201,13 +435,26 @@ public:
 
         /// TODO: check atomic variable after the parse of each declaration
         /// may result in performance issue, benchmark in the future.
-        if(unit->stop && unit->stop->load()) {
+        if(unit->check_cancelled()) {
             return false;
         }
 
         return clang::MultiplexConsumer::HandleTopLevelDecl(group);
     }
 
+    /// Only consulted when the parser was told to skip bodies (constexpr
+    /// functions and those with deduced return types never are).
+    auto shouldSkipFunctionBody(clang::Decl* decl) -> bool final {
+        return clang::MultiplexConsumer::shouldSkipFunctionBody(decl) && unit->skip_body(decl);
+    }
+
+    void InitializeSema(clang::Sema& sema) final {
+        clang::MultiplexConsumer::InitializeSema(sema);
+        if(unit->stop) {
+            sema.TemplateInstCallbacks.push_back(std::make_unique<CancellationInstCallback>(unit));
+        }
+    }
+
 private:
     CompilationUnitRef unit;
 };
@@ -249,6 +496,21 @@ CompilationStatus CompilationUnitRef::Self::run_clang(
     auto& instance = *self.instance;
     instance.createDiagnostics(*params.vfs, diagnostic_consumer.release(), true);
 
+    if(params.skip_bodies) {
+        // Uses inside skipped bodies are never seen, so these would all be
+        // false positives.
+        for(auto group: {"unused-function",
+                         "unused-member-function",
+                         "unused-template",
+                         "unused-private-field",
+                         "unused-const-variable",
+                         "unneeded-internal-declaration"}) {
+            instance.getDiagnostics().setSeverityForGroup(clang::diag::Flavor::WarningOrError,
+                                                          group,
+                                                          clang::diag::Severity::Ignored);
+        }
+    }
+
     if(auto remapping = clang::createVFSFromCompilerInvocation(instance.getInvocation(),
                                                                instance.getDiagnostics(),
                                                                params.vfs)) {
@@ -277,15 +539,31 @@ CompilationStatus CompilationUnitRef::Self::run_clang(
 
     /// Add PPCallbacks to collect preprocessing information.
     self.collect_directives();
+    if(self.stop) {
+        instance.getPreprocessor().addPPCallbacks(std::make_unique<CancellationCallbacks>(&self));
+    }
 
     if(params.clang_tidy) {
-        self.configure_tidy({});
+        self.tidy_ranges = std::move(params.tidy_ranges);
+        self.tidy_reused = std::move(params.tidy_reused);
+        self.configure_tidy({
+            .checks = std::move(params.tidy_checks),
+            .incremental = self.tidy_ranges.has_value(),
+            .profile = params.tidy_profile,
+        });
     }
 
+    /// Tokens only serve the features queried on a content unit: the collector
+    /// keeps every expanded token of the TU and the spelled tokens of each file
+    /// they come from, which for a preamble or an index build is all headers.
+    /// Code completion would in fact fail an assertion with it.
+    ///
+    /// A content unit still gets the tokens of every file it lexes, not only
+    /// the main file: the collector takes no file filter and the TokenBuffer
+    /// can only be built by it.  Headers in the preamble are not lexed again,
+    /// so only those included after it add to the buffer.
     std::optional<clang::syntax::TokenCollector> token_collector;
-    if(!instance.hasCodeCompletionConsumer()) {
-        /// It is not necessary to collect tokens if we are running code completion.
-        /// And in fact will cause assertion failure.
+    if(self.kind == CompilationKind::Content && !instance.hasCodeCompletionConsumer()) {
         token_collector.emplace(instance.getPreprocessor());
     }
 
@@ -325,6 +603,13 @@ CompilationStatus CompilationUnitRef::Self::run_clang(
     return CompilationStatus::Completed;
 }
 
+/// Events shorter than this are not recorded, as clang's default for
+/// -ftime-trace-granularity.
+constexpr static unsigned time_trace_granularity_us = 500;
+
+/// Entries kept per list of a compile's time trace.
+constexpr static std::size_t time_trace_limit = 50;
+
 CompilationUnit run_clang(CompilationParams& params,
                           std::unique_ptr<clang::FrontendAction> action,
                           llvm::function_ref<void(clang::CompilerInstance&)> before_execute = {},
@@ -334,13 +619,33 @@ CompilationUnit run_clang(CompilationParams& params,
     auto self = new CompilationUnitRef::Self();
     self->kind = params.kind;
     self->stop = std::move(params.stop);
+    self->skip_bodies = params.skip_bodies;
+    self->parsed_bodies = std::move(params.parsed_bodies);
+    self->skip_header_bodies = std::move(params.skip_header_bodies);
+    self->directive_scope = params.directive_scope;
+    self->directive_files = std::move(params.directive_files);
 
     using namespace std::chrono;
     self->build_at = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
     auto build_start = steady_clock::now().time_since_epoch();
 
+    // The profiler is per thread: a compile on this thread already being
+    // traced is left alone.
+    bool time_trace = params.time_trace && !llvm::timeTraceProfilerEnabled();
+    if(time_trace) {
+        llvm::timeTraceProfilerInitialize(time_trace_granularity_us, "clice");
+    }
+
     self->status = self->run_clang(params, std::move(action), before_execute);
 
+    if(time_trace) {
+        llvm::SmallString<0> json;
+        llvm::raw_svector_ostream os(json);
+        llvm::timeTraceProfilerWrite(os);
+        llvm::timeTraceProfilerCleanup();
+        self->time_trace = summarize_time_trace(json, time_trace_limit);
+    }
+
     auto build_end = steady_clock::now().time_since_epoch();
     self->build_duration = duration_cast<milliseconds>(build_end - build_start);
 
@@ -352,7 +657,20 @@ CompilationUnit run_clang(CompilationParams& params,
 }
 
 CompilationUnit preprocess(CompilationParams& params) {
-    return run_clang(params, std::make_unique<clang::PreprocessOnlyAction>());
+    auto* cache = params.directives;
+    return run_clang(params,
+                     std::make_unique<clang::PreprocessOnlyAction>(),
+                     [&](clang::CompilerInstance& instance) {
+                         if(!cache) {
+                             return;
+                         }
+                         std::vector<std::string> remapped;
+                         for(auto& [file, _]: instance.getPreprocessorOpts().RemappedFileBuffers) {
+                             remapped.push_back(file);
+                         }
+                         instance.setDependencyDirectivesGetter(
+                             directives_getter(cache, instance.getFileManager(), remapped));
+                     });
 }
 
 CompilationUnit compile(CompilationParams& params) {
@@ -448,4 +766,12 @@ CompilationUnit complete(CompilationParams& params, clang::CodeCompleteConsumer*
                      });
 }
 
+void warm_up() {
+    tidy::warm_up();
+}
+
+std::vector<std::string> registered_tidy_checks() {
+    return tidy::registered_checks();
+}
+
 }  // namespace clice
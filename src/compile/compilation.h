@@ -4,6 +4,7 @@
 #include <cassert>
 #include <cstdint>
 #include <memory>
+#include <optional>
 #include <string>
 #include <tuple>
 #include <utility>
@@ -14,6 +15,7 @@
 
 #include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
 
 namespace clang {
 
@@ -23,6 +25,8 @@ class CodeCompleteConsumer;
 
 namespace clice {
 
+struct SharedScanCache;
+
 struct PCHInfo {
     /// The path of the output PCH file.
     std::string path;
@@ -70,6 +74,30 @@ struct CompilationParams {
     /// Whether to run clang-tidy.
     bool clang_tidy = false;
 
+    /// Incremental clang-tidy: when set, the AST matchers only visit the
+    /// main-file top-level decls overlapping one of these ranges (typically
+    /// the text edited since the last run), and the results for the other
+    /// decls are taken from `tidy_reused`.  Checks that need the whole
+    /// translation unit, and those working on the preprocessor, still see
+    /// all of it.
+    std::optional<std::vector<LocalSourceRange>> tidy_ranges;
+
+    /// Main-file clang-tidy diagnostics of the previous run, with their
+    /// notes, already moved to this text's offsets.
+    std::vector<Diagnostic> tidy_reused;
+
+    /// Time the matchers of each clang-tidy check, see
+    /// CompilationUnitRef::tidy_timings().
+    bool tidy_profile = false;
+
+    /// clang-tidy checks to run instead of the fast defaults, as a glob list
+    /// such as "bugprone-*"; slow checks are not filtered out.
+    std::optional<std::string> tidy_checks;
+
+    /// Profile the compile with clang's time trace (-ftime-trace), see
+    /// CompilationUnitRef::time_trace().
+    bool time_trace = false;
+
     /// Output file path.
     llvm::SmallString<128> output_file;
 
@@ -80,12 +108,41 @@ struct CompilationParams {
 
     llvm::IntrusiveRefCntPtr<vfs::FileSystem> vfs = new ThreadSafeFS();
 
+    /// preprocess() only: dependency directives of the files entered, kept
+    /// by the caller across runs so that headers are not tokenized again
+    /// (see syntax/scan.h).  Remapped files are always lexed in full.
+    SharedScanCache* directives = nullptr;
+
     /// Information about reuse PCH.
     std::pair<std::string, std::uint32_t> pch;
 
     /// Information about reuse PCM(name, path).
     llvm::StringMap<std::string> pcms;
 
+    /// Skip the bodies of functions defined in the main file, except those
+    /// overlapping a range in `parsed_bodies`.  Cuts parse time and AST
+    /// memory of large files; skipped bodies produce no diagnostics and no
+    /// semantic information.
+    bool skip_bodies = false;
+
+    /// Main-file byte ranges whose function bodies are parsed regardless.
+    std::vector<LocalSourceRange> parsed_bodies;
+
+    /// Headers, by the path the unit names them with, whose function bodies
+    /// are skipped so that only their declarations are seen.  For indexing
+    /// headers whose index the receiver already holds.
+    llvm::StringSet<> skip_header_bodies;
+
+    /// The files whose conditions, macro references, pragmas, imports and
+    /// embeds are recorded, see DirectiveScope.  A stateful AST of a
+    /// macro-heavy TU would otherwise carry the macro references of every
+    /// header.
+    DirectiveScope directive_scope = DirectiveScope::All;
+
+    /// Paths of the files recorded under DirectiveScope::Files, as the unit
+    /// names them.
+    llvm::StringSet<> directive_files;
+
     /// Code completion file:offset.
     std::tuple<std::string, std::uint32_t> completion;
 
@@ -107,7 +164,9 @@ struct CompilationParams {
     }
 };
 
-/// Only preprocess ths source flie.
+/// Only preprocess ths source flie.  With `params.directives`, the files
+/// not remapped are lexed for their directives alone: macro expansions
+/// outside directives are then not seen.
 CompilationUnit preprocess(CompilationParams& params);
 
 /// Build AST from given file path and content. If pch or pcm provided, apply them to the compiler.
@@ -124,4 +183,12 @@ CompilationUnit compile(CompilationParams& params, PCMInfo& out);
 /// Run code completion at the given location.
 CompilationUnit complete(CompilationParams& params, clang::CodeCompleteConsumer* consumer);
 
+/// Build the process-wide tables that are otherwise created lazily on the
+/// first compilation (clang-tidy check registry and default options).  Call
+/// it before forking so that children share the pages copy-on-write.
+void warm_up();
+
+/// Names of every clang-tidy check linked in, sorted, whether fast or not.
+std::vector<std::string> registered_tidy_checks();
+
 }  // namespace clice
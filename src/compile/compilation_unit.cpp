@@ -3,6 +3,8 @@
 #include "semantic/ast_utility.h"
 
 #include "kota/ipc/lsp/text.h"
+#include "clang/AST/ASTContext.h"
+#include "clang/Lex/Preprocessor.h"
 
 namespace clice {
 
@@ -136,6 +138,19 @@ auto CompilationUnitRef::line_starts() -> std::span<const std::uint32_t> {
     return self->line_starts_cache;
 }
 
+auto CompilationUnitRef::position_map(PositionMap::PositionEncoding encoding)
+    -> const PositionMap& {
+    auto& cache = self->position_map_cache;
+    if(!cache || cache->encoding() != encoding) {
+        auto starts = line_starts();
+        auto content = interested_content();
+        cache.emplace(std::string_view(content.data(), content.size()),
+                      std::vector<std::uint32_t>(starts.begin(), starts.end()),
+                      encoding);
+    }
+    return *cache;
+}
+
 bool CompilationUnitRef::is_builtin_file(clang::FileID fid) {
     // No FileEntryRef => built-in/command line/scratch.
     if(!self->SM().getFileEntryRefForID(fid)) {
@@ -236,6 +251,98 @@ auto CompilationUnitRef::top_level_decls() -> llvm::ArrayRef<clang::Decl*> {
     return self->top_level_decls;
 }
 
+void CompilationUnitRef::Self::build_decl_extents() {
+    auto& SM = instance->getSourceManager();
+    auto fid = SM.getMainFileID();
+    auto file_begin = SM.getLocForStartOfFile(fid);
+    auto file_end = SM.getLocForEndOfFile(fid);
+
+    // As the selection prunes: by where the extent's macro expansions start
+    // and end in the file, when they do.
+    auto offset_of = [&](clang::SourceLocation location,
+                         bool begin) -> std::optional<std::uint32_t> {
+        while(location.isMacroID()) {
+            auto expansion = SM.getImmediateExpansionRange(location);
+            location = begin ? expansion.getBegin() : expansion.getEnd();
+        }
+        if(location < file_begin || location >= file_end) {
+            return std::nullopt;
+        }
+        return location.getRawEncoding() - file_begin.getRawEncoding();
+    };
+
+    auto& extents = decl_extents.emplace();
+    for(std::uint32_t i = 0; i < top_level_decls.size(); ++i) {
+        auto* decl = top_level_decls[i];
+        // Extents often miss attributes, and implicit decls have none.
+        if(decl->isImplicit() || llvm::any_of(decl->attrs(), [](const clang::Attr* attr) {
+               return attr && !attr->isImplicit();
+           })) {
+            unranged_decls.push_back(i);
+            continue;
+        }
+        auto range = decl->getSourceRange();
+        extents.push_back({
+            .begin = offset_of(range.getBegin(), true).value_or(0),
+            .end = offset_of(range.getEnd(), false).value_or(UINT32_MAX),
+            .max_end = 0,
+            .index = i,
+        });
+    }
+
+    std::ranges::stable_sort(extents, {}, &DeclExtent::begin);
+    std::uint32_t max_end = 0;
+    for(auto& extent: extents) {
+        max_end = std::max(max_end, extent.end);
+        extent.max_end = max_end;
+    }
+}
+
+auto CompilationUnitRef::top_level_decls(LocalSourceRange range)
+    -> llvm::SmallVector<clang::Decl*> {
+    if(!self->decl_extents) {
+        self->build_decl_extents();
+    }
+
+    // Extents are sorted by begin and `max_end` grows along them: skip
+    // those ending before the range, stop at the first beginning after it.
+    auto& extents = *self->decl_extents;
+    auto it = llvm::partition_point(extents, [&](const Self::DeclExtent& extent) {
+        return extent.max_end < range.begin;
+    });
+    llvm::SmallVector<std::uint32_t> indices(self->unranged_decls.begin(),
+                                             self->unranged_decls.end());
+    for(; it != extents.end() && it->begin <= range.end; ++it) {
+        if(it->end >= range.begin) {
+            indices.push_back(it->index);
+        }
+    }
+    llvm::sort(indices);
+
+    llvm::SmallVector<clang::Decl*> decls;
+    decls.reserve(indices.size());
+    for(auto index: indices) {
+        decls.push_back(self->top_level_decls[index]);
+    }
+    return decls;
+}
+
+auto CompilationUnitRef::skipped_bodies() -> llvm::ArrayRef<LocalSourceRange> {
+    return self->skipped_bodies;
+}
+
+auto CompilationUnitRef::skipped_headers() -> llvm::ArrayRef<std::string> {
+    return self->skipped_headers;
+}
+
+auto CompilationUnitRef::tidy_timings() -> llvm::ArrayRef<std::pair<std::string, double>> {
+    return self->tidy_timings;
+}
+
+auto CompilationUnitRef::time_trace() -> const TimeTrace& {
+    return self->time_trace;
+}
+
 std::chrono::milliseconds CompilationUnitRef::build_at() {
     return self->build_at;
 }
@@ -289,7 +396,7 @@ index::SymbolID CompilationUnitRef::getSymbolID(const clang::NamedDecl* decl) {
         hash = iter->second;
     } else {
         llvm::SmallString<128> usr;
-        index::generateUSRForDecl(decl, usr);
+        index::generateUSRForDecl(decl, usr, &self->usr_cache);
         hash = llvm::xxh3_64bits(usr);
         self->symbol_hash_cache.try_emplace(decl, hash);
     }
@@ -347,6 +454,48 @@ clang::syntax::TokenBuffer& CompilationUnitRef::token_buffer() {
     return *self->buffer;
 }
 
+std::size_t CompilationUnitRef::memory_usage() {
+    if(!self || !self->instance) {
+        return 0;
+    }
+
+    auto& instance = *self->instance;
+    std::size_t total = self->path_storage.getTotalMemory();
+
+    if(instance.hasASTContext()) {
+        auto& context = instance.getASTContext();
+        total += context.getASTAllocatedMemory();
+        total += context.getSideTableAllocatedMemory();
+    }
+
+    if(instance.hasSourceManager()) {
+        auto& SM = instance.getSourceManager();
+        total += SM.getContentCacheSize();
+        total += SM.getDataStructureSizes();
+        total += SM.getMemoryBufferSizes().malloc_bytes;
+    }
+
+    if(instance.hasPreprocessor()) {
+        total += instance.getPreprocessor().getTotalMemory();
+    }
+
+    if(self->buffer) {
+        /// Spelled tokens are only counted for the interested file, other files
+        /// are usually covered by the PCH and contribute little.
+        auto expanded = self->buffer->expandedTokens().size();
+        auto spelled = self->buffer->spelledTokens(interested_file()).size();
+        total += (expanded + spelled) * sizeof(clang::syntax::Token);
+    }
+
+    for(auto& [fid, directive]: self->directives) {
+        total += directive.includes.capacity() * sizeof(Include);
+        total += directive.conditions.capacity() * sizeof(Condition);
+        total += directive.macros.capacity() * sizeof(MacroRef);
+    }
+
+    return total;
+}
+
 CompilationUnit::~CompilationUnit() {
     delete self;
 }
@@ -9,7 +9,9 @@
 
 #include "compile/diagnostic.h"
 #include "compile/directive.h"
+#include "compile/time_trace.h"
 #include "semantic/resolver.h"
+#include "support/position_map.h"
 #include "syntax/token.h"
 
 #include "llvm/ADT/ArrayRef.h"
@@ -58,6 +60,10 @@ enum class CompilationStatus : std::uint8_t {
     FatalError,
 };
 
+/// Not safe to use from two threads at once, even only to read: accessors
+/// fill caches as they go (file paths, line starts, symbol hashes, decl
+/// extents), and so does clang, which also deserializes the AST from a PCH
+/// on demand.
 class CompilationUnitRef {
 public:
     struct Self;
@@ -143,6 +149,10 @@ public:
     /// Lazily computed and cached.
     auto line_starts() -> std::span<const std::uint32_t>;
 
+    /// Get the position map of the interested file in `encoding`, built on
+    /// first use and kept for the last encoding asked for.
+    auto position_map(PositionMap::PositionEncoding encoding) -> const PositionMap&;
+
     /// Check if a file is a builtin file.
     bool is_builtin_file(clang::FileID fid);
 
@@ -174,6 +184,9 @@ public:
     /// Create a file location with given file id and offset.
     auto create_location(clang::FileID fid, std::uint32_t offset) -> clang::SourceLocation;
 
+    /// Tokens are only collected for `CompilationKind::Content` units, the
+    /// token functions below must not be called on others.  They cover the
+    /// main file and every header the unit lexes outside its preamble.
     using TokenRange = llvm::ArrayRef<clang::syntax::Token>;
 
     /// Get the spelled tokens(raw token) of the file id.
@@ -218,6 +231,28 @@ public:
 
     auto top_level_decls() -> llvm::ArrayRef<clang::Decl*>;
 
+    /// The top level decls that may touch the tokens from `range.begin` to
+    /// `range.end` (both offsets of a token start in the main file),
+    /// in the order of top_level_decls().  Decls out of it are skipped in
+    /// O(log n); those with attributes or macro-spun extents are kept.
+    auto top_level_decls(LocalSourceRange range) -> llvm::SmallVector<clang::Decl*>;
+
+    /// Main-file ranges, brace to brace, of the function bodies skipped by
+    /// `CompilationParams::skip_bodies`.  Empty for a full parse.
+    auto skipped_bodies() -> llvm::ArrayRef<LocalSourceRange>;
+
+    /// Headers of `CompilationParams::skip_header_bodies` that defined a
+    /// function of the unit, whose bodies were so skipped.
+    auto skipped_headers() -> llvm::ArrayRef<std::string>;
+
+    /// Wall time in seconds spent in the AST matchers of each clang-tidy
+    /// check, slowest first.  Empty unless `CompilationParams::tidy_profile`.
+    auto tidy_timings() -> llvm::ArrayRef<std::pair<std::string, double>>;
+
+    /// Headers and instantiations that took the longest, from clang's time
+    /// trace.  Empty unless `CompilationParams::time_trace`.
+    auto time_trace() -> const TimeTrace&;
+
     std::chrono::milliseconds build_at();
 
     std::chrono::milliseconds build_duration();
@@ -230,6 +265,8 @@ public:
 
     TemplateResolver& resolver();
 
+    /// Directives by file.  Files outside CompilationParams::directive_scope
+    /// only have their includes.
     llvm::DenseMap<clang::FileID, Directive>& directives();
 
     clang::TranslationUnitDecl* tu();
@@ -245,6 +282,11 @@ public:
     /// Get symbol ID for given marco.
     index::SymbolID getSymbolID(const clang::MacroInfo* macro);
 
+    /// Approximate heap footprint in bytes of everything this unit keeps alive:
+    /// ASTContext arenas, SourceManager buffers and tables, Preprocessor state
+    /// and the TokenBuffer. Used by the stateful worker for memory-based eviction.
+    std::size_t memory_usage();
+
 protected:
     Self* self;
 };
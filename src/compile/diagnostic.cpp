@@ -204,6 +204,40 @@ public:
         };
     }
 
+    /// A fix that cannot be applied whole is left out: half of it would
+    /// break the code.
+    void collect_fix_its(const clang::Diagnostic& raw_diagnostic, Diagnostic& diagnostic) {
+        auto& src_mgr = unit.context().getSourceManager();
+        for(auto& hint: raw_diagnostic.getFixItHints()) {
+            // Copying text from elsewhere is not an edit of its own.
+            auto range = hint.RemoveRange;
+            if(hint.InsertFromRange.isValid() || range.getBegin().isMacroID() ||
+               range.getEnd().isMacroID()) {
+                diagnostic.fix_its.clear();
+                return;
+            }
+            range = clang::Lexer::makeFileCharRange(range, src_mgr, unit.lang_options());
+            if(range.isInvalid()) {
+                diagnostic.fix_its.clear();
+                return;
+            }
+
+            auto [begin_fid, begin_offset] = unit.decompose_location(range.getBegin());
+            auto [end_fid, end_offset] = unit.decompose_location(range.getEnd());
+            if(begin_fid != diagnostic.fid || end_fid != diagnostic.fid) {
+                diagnostic.fix_its.clear();
+                return;
+            }
+            if(range.isTokenRange()) {
+                end_offset += unit.token_length(range.getEnd());
+            }
+            diagnostic.fix_its.push_back({
+                .range = LocalSourceRange{begin_offset, end_offset},
+                .text = hint.CodeToInsert,
+            });
+        }
+    }
+
     void BeginSourceFile(const clang::LangOptions&, const clang::Preprocessor*) override {}
 
     void HandleDiagnostic(clang::DiagnosticsEngine::Level level,
@@ -241,8 +275,9 @@ public:
             unit->checker->adjust_diag(diagnostic);
         }
 
-        /// TODO: handle FixIts
-        /// raw_diagnostic.getFixItHints();
+        if(diagnostic.fid.isValid()) {
+            collect_fix_its(raw_diagnostic, diagnostic);
+        }
     }
 
     void EndSourceFile() override {}
@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <optional>
 #include <string>
+#include <vector>
 
 #include "syntax/token.h"
 
@@ -52,6 +53,15 @@ struct DiagnosticID {
     bool is_unused() const;
 };
 
+/// A replacement clang suggests with a diagnostic, in the diagnostic's file.
+struct FixIt {
+    /// The text replaced; empty for an insertion.
+    LocalSourceRange range;
+
+    /// The text put there instead.
+    std::string text;
+};
+
 struct Diagnostic {
     /// The diagnostic id.
     DiagnosticID id;
@@ -65,6 +75,10 @@ struct Diagnostic {
 
     /// The error message of this diagnostic.
     std::string message;
+
+    /// The edits that together fix this diagnostic.  Only kept when all of
+    /// them fall in the diagnostic's file, outside macro expansions.
+    std::vector<FixIt> fix_its;
 };
 
 }  // namespace clice
@@ -15,11 +15,32 @@ public:
     DirectiveCollector(CompilationUnitRef unit) : unit(unit) {}
 
 private:
+    /// Whether the directives of `fid` other than includes are recorded.
+    bool records(clang::FileID fid) {
+        switch(unit->directive_scope) {
+            case DirectiveScope::All: return true;
+            case DirectiveScope::MainFile: return fid == unit.interested_file();
+            case DirectiveScope::Files: break;
+        }
+
+        auto [it, inserted] = unit->directive_recorded.try_emplace(fid, false);
+        if(inserted) {
+            auto path = unit.file_path(fid);
+            it->second = !path.empty() && unit->directive_files.contains(path);
+        }
+        return it->second;
+    }
+
     void add_condition(clang::SourceLocation location,
                        Condition::BranchKind kind,
                        Condition::ConditionValue value,
                        clang::SourceRange cond_range) {
-        auto& directive = unit->directives[unit.file_id(location)];
+        auto fid = unit.file_id(location);
+        if(!records(fid)) {
+            return;
+        }
+
+        auto& directive = unit->directives[fid];
         directive.conditions.emplace_back(kind, value, location, cond_range);
     }
 
@@ -52,11 +73,12 @@ private:
             return;
         }
 
-        if(unit.is_builtin_file(unit.file_id(loc))) {
+        auto fid = unit.file_id(loc);
+        if(!records(fid) || unit.is_builtin_file(fid)) {
             return;
         }
 
-        auto& directive = unit->directives[unit.file_id(loc)];
+        auto& directive = unit->directives[fid];
         directive.macros.emplace_back(MacroRef{def, kind, loc});
     }
 
@@ -69,7 +91,12 @@ public:
                   llvm::StringRef filename,
                   bool is_angled,
                   clang::OptionalFileEntryRef file) override {
-        unit->directives[unit.file_id(location)].has_embeds.emplace_back(clice::HasEmbed{
+        auto fid = unit.file_id(location);
+        if(!records(fid)) {
+            return;
+        }
+
+        unit->directives[fid].has_embeds.emplace_back(clice::HasEmbed{
             .file_name = filename,
             .file = file,
             .is_angled = is_angled,
@@ -82,7 +109,12 @@ public:
                         bool is_angled,
                         clang::OptionalFileEntryRef file,
                         const clang::LexEmbedParametersResult&) override {
-        unit->directives[unit.file_id(location)].embeds.emplace_back(Embed{
+        auto fid = unit.file_id(location);
+        if(!records(fid)) {
+            return;
+        }
+
+        unit->directives[fid].embeds.emplace_back(Embed{
             .file_name = filename,
             .file = file,
             .is_angled = is_angled,
@@ -145,6 +177,10 @@ public:
                       clang::ModuleIdPath names,
                       const clang::Module*) override {
         auto fid = unit.file_id(unit.expansion_location(import_location));
+        if(!records(fid)) {
+            return;
+        }
+
         auto& import = unit->directives[fid].imports.emplace_back();
         import.location = import_location;
         for(auto name: names) {
@@ -173,6 +209,9 @@ public:
             return;
 
         clang::FileID fid = unit.file_id(loc);
+        if(!records(fid)) {
+            return;
+        }
 
         llvm::StringRef text_to_end = unit.file_content(fid).substr(unit.file_offset(loc));
         llvm::StringRef that_line = text_to_end.take_until([](char ch) { return ch == '\n'; });
@@ -162,6 +162,22 @@ struct HasEmbed {
     clang::SourceLocation loc;
 };
 
+/// The files of a compilation whose directives are recorded.  Includes and
+/// `__has_include` are recorded in every file regardless: the dependencies
+/// and files of the unit are computed from them.
+enum class DirectiveScope : std::uint8_t {
+    /// Every file; indexing hashes the conditions and macros each header
+    /// was read under.
+    All,
+
+    /// The interested file, which is all the features of an opened file
+    /// look at.
+    MainFile,
+
+    /// The files in `CompilationParams::directive_files`.
+    Files,
+};
+
 struct Directive {
     std::vector<Include> includes;
     std::vector<HasInclude> has_includes;
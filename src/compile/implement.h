@@ -2,7 +2,10 @@
 
 #include "compile/compilation_unit.h"
 #include "compile/diagnostic.h"
+#include "index/usr.h"
 
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/Timer.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendActions.h"
 #include "clang-tidy/ClangTidyCheck.h"
@@ -17,7 +20,26 @@ bool is_registered_tidy_check(llvm::StringRef check);
 
 std::optional<bool> is_fast_tidy_check(llvm::StringRef check);
 
-struct TidyParams {};
+bool is_whole_file_check(llvm::StringRef check);
+
+/// Names of every check linked in, sorted.
+std::vector<std::string> registered_checks();
+
+/// Instantiate every registered check factory and the default options once.
+void warm_up();
+
+struct TidyParams {
+    /// Checks to enable instead of the defaults, as a clang-tidy glob list.
+    std::optional<std::string> checks;
+
+    /// The AST matchers will only visit part of the file (see
+    /// CompilationParams::tidy_ranges), so checks that judge the whole
+    /// translation unit get a finder of their own.
+    bool incremental = false;
+
+    /// Time the matchers of each check.
+    bool profile = false;
+};
 
 class ClangTidyChecker;
 
@@ -33,10 +55,18 @@ public:
     /// The instances of checks that are enabled for the current Language.
     std::vector<std::unique_ptr<ClangTidyCheck>> checks;
 
+    /// Time spent in the matchers of each check, when profiling.
+    llvm::StringMap<llvm::TimeRecord> timings;
+
     /// The match finder to run clang-tidy on ASTs.
     clang::ast_matchers::MatchFinder finder;
 
-    ClangTidyChecker(std::unique_ptr<ClangTidyOptionsProvider> provider);
+    /// The matchers of checks that need the whole AST, when an incremental
+    /// run restricts `finder` to part of it.
+    clang::ast_matchers::MatchFinder whole_file_finder;
+    bool has_whole_file_checks = false;
+
+    ClangTidyChecker(std::unique_ptr<ClangTidyOptionsProvider> provider, bool profile);
 
     clang::DiagnosticsEngine::Level adjust_level(clang::DiagnosticsEngine::Level level,
                                                  const clang::Diagnostic& diag);
@@ -59,6 +89,9 @@ struct CompilationUnitRef::Self {
 
     std::shared_ptr<std::atomic_bool> stop;
 
+    /// Whether the cancellation has been turned into a fatal error yet.
+    bool cancel_reported = false;
+
     llvm::StringMap<std::unique_ptr<llvm::MemoryBuffer>> remapped_buffers;
 
     /// The frontend action used to build the unit.
@@ -77,6 +110,12 @@ struct CompilationUnitRef::Self {
     /// All directive information collected during the preprocessing.
     llvm::DenseMap<clang::FileID, Directive> directives;
 
+    /// Which files record the directives beyond includes, from
+    /// CompilationParams; decided once per file under DirectiveScope::Files.
+    DirectiveScope directive_scope = DirectiveScope::All;
+    llvm::StringSet<> directive_files;
+    llvm::DenseMap<clang::FileID, bool> directive_recorded;
+
     llvm::DenseSet<clang::FileID> all_files;
 
     /// Cache for file path. It is used to avoid multiple file path lookup.
@@ -85,17 +124,60 @@ struct CompilationUnitRef::Self {
     /// Cache for symbol id.
     llvm::DenseMap<const void*, std::uint64_t> symbol_hash_cache;
 
+    /// USR fragments of the decl contexts hashed so far.
+    index::USRContextCache usr_cache;
+
     /// Cache for line starts of the interested file.
     std::vector<std::uint32_t> line_starts_cache;
 
+    std::optional<PositionMap> position_map_cache;
+
     llvm::BumpPtrAllocator path_storage;
 
     std::vector<Diagnostic> diagnostics;
 
     std::vector<clang::Decl*> top_level_decls;
 
+    /// Main-file extents of `top_level_decls` sorted by begin, and the
+    /// indices of those whose extent cannot be trusted.  Built by the first
+    /// top_level_decls(range) query.
+    struct DeclExtent {
+        std::uint32_t begin;
+        std::uint32_t end;
+        /// Largest `end` of this extent and those before it.
+        std::uint32_t max_end;
+        std::uint32_t index;
+    };
+
+    std::optional<std::vector<DeclExtent>> decl_extents;
+    std::vector<std::uint32_t> unranged_decls;
+
+    void build_decl_extents();
+
+    /// Whether main-file function bodies outside `parsed_bodies` are skipped,
+    /// and the bodies that were.
+    bool skip_bodies = false;
+    std::vector<LocalSourceRange> parsed_bodies;
+    std::vector<LocalSourceRange> skipped_bodies;
+
+    /// Headers whose function bodies are skipped, whether each file seen is
+    /// one of them, and the paths of those that are.
+    llvm::StringSet<> skip_header_bodies;
+    llvm::DenseMap<clang::FileID, bool> header_skips;
+    std::vector<std::string> skipped_headers;
+
     std::unique_ptr<tidy::ClangTidyChecker> checker;
 
+    /// Incremental clang-tidy, from CompilationParams: the ranges to check
+    /// again and the previous results for the rest.
+    std::optional<std::vector<LocalSourceRange>> tidy_ranges;
+    std::vector<Diagnostic> tidy_reused;
+
+    /// Wall time of each check's matchers in seconds, slowest first.
+    std::vector<std::pair<std::string, double>> tidy_timings;
+
+    TimeTrace time_trace;
+
     std::chrono::milliseconds build_at;
     std::chrono::milliseconds build_duration;
 
@@ -117,11 +199,24 @@ public:
 
     void collect_directives();
 
+    /// Whether `stop` is set.  The first time it is seen a fatal error is
+    /// reported, after which the preprocessor enters no more includes and
+    /// Sema instantiates no more templates, so the parse unwinds quickly.
+    bool check_cancelled();
+
     void configure_tidy(tidy::TidyParams tidy_params);
 
+    /// Decide whether Sema may skip the body of `decl`, recording it if so.
+    bool skip_body(clang::Decl* decl);
+
     // Must be called before EndSourceFile because the ast context can be destroyed later.
     void run_tidy();
 
+    /// The top-level decls an incremental tidy run matches: those in the
+    /// main file overlapping `tidy_ranges`, and any outside it.  Adds the
+    /// reused diagnostics that fall in the main-file decls left out.
+    std::vector<clang::Decl*> select_tidy_decls();
+
     CompilationStatus run_clang(this Self& self,
                                 CompilationParams& params,
                                 std::unique_ptr<clang::FrontendAction> action,
@@ -60,7 +60,52 @@ tidy::ClangTidyCheckFactories get_fast_checks(const tidy::ClangTidyCheckFactorie
     return fast;
 }
 
-tidy::ClangTidyOptions create_options() {
+/// Instantiating the factories walks every tidy module, so build them and
+/// the fast subset once per process instead of once per configured file.
+const tidy::ClangTidyCheckFactories& all_check_factories() {
+    const static auto all = [] {
+        tidy::ClangTidyCheckFactories all;
+        for(const auto& e: tidy::ClangTidyModuleRegistry::entries()) {
+            e.instantiate()->addCheckFactories(all);
+        }
+        return all;
+    }();
+    return all;
+}
+
+const tidy::ClangTidyCheckFactories& fast_check_factories() {
+    const static auto fast = [] {
+        auto& all = all_check_factories();
+        auto unknown = llvm::count_if(all, [](const auto& factory) {
+            return !is_fast_tidy_check(factory.getKey()).has_value();
+        });
+        if(unknown != 0) {
+            LOG_INFO("{} clang-tidy checks are not in tidy_fast_checks.inc and stay disabled; "
+                     "measure them with tidy_benchmark",
+                     unknown);
+        }
+        return get_fast_checks(all);
+    }();
+    return fast;
+}
+
+std::vector<std::string> registered_checks() {
+    std::vector<std::string> checks;
+    for(const auto& factory: all_check_factories()) {
+        checks.push_back(factory.getKey().str());
+    }
+    llvm::sort(checks);
+    return checks;
+}
+
+/// Checks that collect over the whole translation unit and report at its
+/// end, e.g. a using-declaration is unused only if no decl refers to it.
+/// Matching part of the AST would make them report false positives.
+bool is_whole_file_check(llvm::StringRef check) {
+    return check == "misc-unused-using-decls" || check == "misc-unused-alias-decls";
+}
+
+tidy::ClangTidyOptions create_options(const std::optional<std::string>& checks = std::nullopt) {
     // getDefaults instantiates all check factories, which are registered at link
     // time. So cache the results once.
     const static auto default_opts = [] {
@@ -115,6 +160,9 @@ tidy::ClangTidyOptions create_options() {
     }
     // TODO: Providers.push_back(provideClangTidyFiles(TFS)); Filename
     // TODO: if(EnableConfig) Providers.push_back(provideClangdConfig());
+    if(checks) {
+        opts.Checks = *checks;
+    }
     // clang::clangd::provideDefaultChecks
     if(!opts.Checks || opts.Checks->empty()) {
         opts.Checks = default_checks;
@@ -240,8 +288,19 @@ void apply_warning_options(llvm::ArrayRef<std::string> extra_args,
     }
 }
 
-ClangTidyChecker::ClangTidyChecker(std::unique_ptr<ClangTidyOptionsProvider> provider) :
-    context(std::move(provider)) {}
+static clang::ast_matchers::MatchFinder::MatchFinderOptions
+    finder_options(llvm::StringMap<llvm::TimeRecord>* timings) {
+    clang::ast_matchers::MatchFinder::MatchFinderOptions options;
+    if(timings) {
+        options.CheckProfiling.emplace(*timings);
+    }
+    return options;
+}
+
+ClangTidyChecker::ClangTidyChecker(std::unique_ptr<ClangTidyOptionsProvider> provider,
+                                   bool profile) :
+    context(std::move(provider)), finder(finder_options(profile ? &timings : nullptr)),
+    whole_file_finder(finder_options(profile ? &timings : nullptr)) {}
 
 clang::DiagnosticsEngine::Level
     ClangTidyChecker::adjust_level(clang::DiagnosticsEngine::Level level,
@@ -317,7 +376,7 @@ std::unique_ptr<ClangTidyChecker> configure(clang::CompilerInstance& instance,
     auto file_name = input.getFile();
     LOG_INFO("Tidy configure file: {}", file_name);
 
-    tidy::ClangTidyOptions opts = create_options();
+    tidy::ClangTidyOptions opts = create_options(params.checks);
     if(opts.Checks) {
         LOG_INFO("Tidy configure checks: {}", *opts.Checks);
     }
@@ -353,16 +412,11 @@ std::unique_ptr<ClangTidyChecker> configure(clang::CompilerInstance& instance,
 
     /// No need to run clang-tidy or IncludeFixerif we are not going to surface
     /// diagnostics.
-    const static auto all_factories = [] {
-        tidy::ClangTidyCheckFactories factories;
-        for(const auto& e: tidy::ClangTidyModuleRegistry::entries()) {
-            e.instantiate()->addCheckFactories(factories);
-        }
-        return factories;
-    }();
-    tidy::ClangTidyCheckFactories factories = get_fast_checks(all_factories);
+    // Checks named explicitly run even if slow: that is how they get measured.
+    const auto& factories = params.checks ? all_check_factories() : fast_check_factories();
     std::unique_ptr<ClangTidyChecker> checker = std::make_unique<ClangTidyChecker>(
-        std::make_unique<tidy::DefaultOptionsProvider>(tidy::ClangTidyGlobalOptions(), opts));
+        std::make_unique<tidy::DefaultOptionsProvider>(tidy::ClangTidyGlobalOptions(), opts),
+        params.profile);
 
     checker->context.setDiagnosticsEngine(
         std::make_unique<clang::DiagnosticOptions>(instance.getDiagnosticOpts()),
@@ -376,9 +430,19 @@ std::unique_ptr<ClangTidyChecker> configure(clang::CompilerInstance& instance,
     clang::Preprocessor* pp = &instance.getPreprocessor();
     for(const auto& check: checker->checks) {
         check->registerPPCallbacks(instance.getSourceManager(), pp, pp);
-        check->registerMatchers(&checker->finder);
+        if(params.incremental && is_whole_file_check(check->getID())) {
+            check->registerMatchers(&checker->whole_file_finder);
+            checker->has_whole_file_checks = true;
+        } else {
+            check->registerMatchers(&checker->finder);
+        }
     }
     return checker;
 }
 
+void warm_up() {
+    create_options();
+    fast_check_factories();
+}
+
 }  // namespace clice::tidy
@@ -0,0 +1,125 @@
+#include "compile/time_trace.h"
+
+#include <algorithm>
+
+#include "support/logging.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/JSON.h"
+
+namespace clice {
+
+namespace {
+
+/// Accumulates entries by name.
+struct Tally {
+    llvm::StringMap<TimeTraceEntry> entries;
+
+    void add(llvm::StringRef name, double ms, std::uint32_t count) {
+        auto& entry = entries[name];
+        entry.ms += ms;
+        entry.count += count;
+    }
+
+    std::vector<TimeTraceEntry> take(std::size_t limit) {
+        std::vector<TimeTraceEntry> result;
+        result.reserve(entries.size());
+        for(auto& entry: entries) {
+            result.push_back(std::move(entry.second));
+            result.back().name = entry.getKey().str();
+        }
+        std::ranges::sort(result, [](auto& lhs, auto& rhs) {
+            return lhs.ms != rhs.ms ? lhs.ms > rhs.ms : lhs.name < rhs.name;
+        });
+        if(result.size() > limit)
+            result.resize(limit);
+        return result;
+    }
+};
+
+/// `std::vector<int>::push_back` instantiates `std::vector::push_back`.
+std::string template_name(llvm::StringRef specialization) {
+    std::string result;
+    int depth = 0;
+    for(char c: specialization) {
+        if(c == '<') {
+            depth += 1;
+        } else if(c == '>' && depth > 0) {
+            depth -= 1;
+        } else if(depth == 0) {
+            result += c;
+        }
+    }
+    return result;
+}
+
+}  // namespace
+
+TimeTrace summarize_time_trace(llvm::StringRef json, std::size_t limit) {
+    auto parsed = llvm::json::parse(json);
+    if(!parsed) {
+        LOG_WARN("Failed to parse time trace: {}", parsed.takeError());
+        return {};
+    }
+
+    auto* object = parsed->getAsObject();
+    auto* events = object ? object->getArray("traceEvents") : nullptr;
+    if(!events)
+        return {};
+
+    Tally headers;
+    Tally templates;
+    Tally instantiations;
+    for(auto& value: *events) {
+        auto* event = value.getAsObject();
+        if(!event || event->getString("ph") != "X")
+            continue;
+        auto name = event->getString("name");
+        auto dur = event->getNumber("dur");
+        auto* args = event->getObject("args");
+        auto detail = args ? args->getString("detail") : std::nullopt;
+        if(!name || !dur || !detail)
+            continue;
+
+        auto ms = *dur / 1000;
+        if(*name == "Source") {
+            // Command line and predefines buffers.
+            if(!detail->starts_with("<"))
+                headers.add(*detail, ms, 1);
+        } else if(*name == "InstantiateClass" || *name == "InstantiateFunction") {
+            instantiations.add(*detail, ms, 1);
+            templates.add(template_name(*detail), ms, 1);
+        }
+    }
+
+    return {
+        .headers = headers.take(limit),
+        .templates = templates.take(limit),
+        .instantiations = instantiations.take(limit),
+    };
+}
+
+void TimeTraceReport::record(std::uint32_t path_id, CompilationKind kind, TimeTrace trace) {
+    traces.insert_or_assign({path_id, static_cast<std::uint8_t>(kind)}, std::move(trace));
+}
+
+TimeTrace TimeTraceReport::summary(std::size_t limit) const {
+    Tally headers;
+    Tally templates;
+    Tally instantiations;
+    for(auto& [key, trace]: traces) {
+        for(auto& entry: trace.headers)
+            headers.add(entry.name, entry.ms, 1);
+        for(auto& entry: trace.templates)
+            templates.add(entry.name, entry.ms, 1);
+        for(auto& entry: trace.instantiations)
+            instantiations.add(entry.name, entry.ms, 1);
+    }
+    return {
+        .headers = headers.take(limit),
+        .templates = templates.take(limit),
+        .instantiations = instantiations.take(limit),
+    };
+}
+
+}  // namespace clice
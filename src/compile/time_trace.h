@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace clice {
+
+enum class CompilationKind : std::uint8_t;
+
+struct TimeTraceEntry {
+    std::string name;
+
+    /// Inclusive: a header counts the headers it includes, an instantiation
+    /// those it triggers.
+    double ms = 0;
+
+    /// Events summed: inclusions, instantiations, or for a report compiles.
+    std::uint32_t count = 0;
+};
+
+/// Where a compilation spent its time, by clang's time-trace events.  Each
+/// list is sorted slowest first.
+struct TimeTrace {
+    /// Time spent in each included file ("Source" events).
+    std::vector<TimeTraceEntry> headers;
+
+    /// Class and function instantiations, by template: the name up to its
+    /// template arguments.
+    std::vector<TimeTraceEntry> templates;
+
+    /// Class and function instantiations, by specialization.
+    std::vector<TimeTraceEntry> instantiations;
+};
+
+/// Summarize the JSON that llvm::timeTraceProfilerWrite() produces, keeping
+/// the `limit` slowest entries of each list.
+TimeTrace summarize_time_trace(llvm::StringRef json, std::size_t limit);
+
+/// Time traces of the project's compiles, the last one of each file and
+/// kind, summed up for a report.
+class TimeTraceReport {
+public:
+    void record(std::uint32_t path_id, CompilationKind kind, TimeTrace trace);
+
+    /// Compiles recorded.
+    std::size_t size() const {
+        return traces.size();
+    }
+
+    /// Each entry summed over every compile, `count` being the compiles it
+    /// appears in; the `limit` slowest of each list.
+    TimeTrace summary(std::size_t limit) const;
+
+    void clear() {
+        traces.clear();
+    }
+
+private:
+    llvm::DenseMap<std::pair<std::uint32_t, std::uint8_t>, TimeTrace> traces;
+};
+
+}  // namespace clice
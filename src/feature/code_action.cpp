@@ -0,0 +1,78 @@
+#include <format>
+#include <string>
+#include <vector>
+
+#include "feature/feature.h"
+
+#include "kota/ipc/lsp/uri.h"
+#include "llvm/ADT/StringSet.h"
+
+namespace clice::feature {
+
+namespace {
+
+bool offers_fix(CompilationUnitRef unit, const Diagnostic& raw) {
+    return raw.id.level != DiagnosticLevel::Ignored && !raw.fix_its.empty() &&
+           raw.fid == unit.interested_file() && raw.range.valid();
+}
+
+}  // namespace
+
+auto code_actions(CompilationUnitRef unit, LocalSourceRange range) -> std::vector<QuickFix> {
+    std::vector<QuickFix> fixes;
+    // Instantiating one template many times repeats its fixes.
+    llvm::StringSet<> seen;
+    auto& diagnostics = unit.diagnostics();
+    for(std::size_t i = 0; i < diagnostics.size(); ++i) {
+        auto& raw = diagnostics[i];
+        if(!offers_fix(unit, raw)) {
+            continue;
+        }
+        if(range.valid() && !raw.range.intersects(range)) {
+            continue;
+        }
+        auto key = std::format("{}:{}:{}", raw.range.begin, raw.range.end, raw.message);
+        if(!seen.insert(key).second) {
+            continue;
+        }
+
+        QuickFix fix{.title = raw.message, .data = static_cast<std::int64_t>(i)};
+        // A note's fix is one of several ways out; the diagnostic's own is
+        // what clang would apply.
+        if(raw.id.level != DiagnosticLevel::Note) {
+            fix.is_preferred = true;
+        }
+        fixes.push_back(std::move(fix));
+    }
+    return fixes;
+}
+
+bool resolve_code_action(CompilationUnitRef unit, QuickFix& fix, PositionEncoding encoding) {
+    auto& diagnostics = unit.diagnostics();
+    if(fix.data < 0 || static_cast<std::size_t>(fix.data) >= diagnostics.size()) {
+        return false;
+    }
+    auto& raw = diagnostics[fix.data];
+    if(!offers_fix(unit, raw) || raw.message != fix.title) {
+        return false;
+    }
+
+    LineMap map(unit.interested_content(), unit.line_starts(), encoding);
+    std::vector<protocol::TextEdit> edits;
+    for(auto& fix_it: raw.fix_its) {
+        auto range = map.to_range(fix_it.range.begin, fix_it.range.end);
+        if(!range) {
+            return false;
+        }
+        edits.push_back(protocol::TextEdit{.range = *range, .new_text = fix_it.text});
+    }
+
+    auto path = unit.file_path(raw.fid);
+    auto uri = lsp::URI::from_file_path(std::string_view(path.data(), path.size()));
+    protocol::WorkspaceEdit edit;
+    edit.changes.emplace()[uri ? uri->str() : path.str()] = std::move(edits);
+    fix.edit = std::move(edit);
+    return true;
+}
+
+}  // namespace clice::feature
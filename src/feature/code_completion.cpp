@@ -9,14 +9,18 @@
 #include <vector>
 
 #include "feature/feature.h"
+#include "index/usr.h"
 #include "semantic/ast_utility.h"
 #include "support/fuzzy_matcher.h"
 
 #include "llvm/ADT/SmallString.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
 #include "clang/AST/DeclCXX.h"
 #include "clang/AST/DeclTemplate.h"
+#include "clang/AST/RecursiveASTVisitor.h"
 #include "clang/Basic/CharInfo.h"
+#include "clang/Basic/SourceManager.h"
 #include "clang/Sema/CodeCompleteConsumer.h"
 #include "clang/Sema/Sema.h"
 
@@ -109,6 +113,19 @@ auto completion_kind(const clang::NamedDecl* decl) -> protocol::CompletionItemKi
     return protocol::CompletionItemKind::Text;
 }
 
+/// For constructors and deduction guides, the class name (without template
+/// args) instead of the full type name, e.g. "vector" instead of
+/// "vector<_Tp, _Alloc>".
+auto completion_label(const clang::NamedDecl* decl) -> std::string {
+    if(auto* ctor = llvm::dyn_cast<clang::CXXConstructorDecl>(decl)) {
+        return ctor->getParent()->getName().str();
+    }
+    if(auto* guide = llvm::dyn_cast<clang::CXXDeductionGuideDecl>(decl)) {
+        return guide->getDeducedTemplate()->getName().str();
+    }
+    return ast::name_of(decl);
+}
+
 /// Extract the function signature (parameter list) from a CodeCompletionString.
 /// Returns something like "(int x, float y)" for display in labelDetails.detail.
 auto extract_signature(const clang::CodeCompletionString& ccs) -> std::string {
@@ -218,17 +235,62 @@ auto extract_return_type(const clang::CodeCompletionString& ccs) -> std::string
     return {};
 }
 
-struct OverloadItem {
-    protocol::CompletionItem item;
+/// A candidate that passed filtering, before anything is built for it.
+struct Candidate {
+    /// The Sema result shown, the first of its overloads when bundled.
+    clang::CodeCompletionResult* result;
+    std::string label;
+    protocol::CompletionItemKind kind;
     float score = 0.0F;
-    std::uint32_t count = 0;
+    std::uint32_t overloads = 1;
 };
 
+/// How likely `result` is wanted, independent of what was typed: Sema's
+/// priority, then how close its declaration is to the file being edited.
+float relevance(const clang::CodeCompletionResult& result, const clang::SourceManager& sm) {
+    // Better candidates have lower priorities, CCP_LocalDeclaration (8)
+    // the best; CCP_Unlikely (80) and worse get no boost.
+    auto priority = std::min(result.Priority, unsigned(clang::CCP_Unlikely));
+    float boost = 2.0F - float(priority) / float(clang::CCP_Unlikely);
+
+    if(result.Kind == clang::CodeCompletionResult::RK_Declaration && result.Declaration) {
+        auto location = sm.getSpellingLoc(result.Declaration->getLocation());
+        if(sm.isInMainFile(location)) {
+            boost *= 1.5F;
+        } else if(location.isValid() && !sm.isInSystemHeader(location)) {
+            boost *= 1.2F;
+        }
+    }
+    if(result.Availability == CXAvailability_Deprecated) {
+        boost *= 0.5F;
+    }
+    return boost;
+}
+
+/// In bundle mode, of a class and its constructors or deduction guides
+/// named alike the class is kept.
+int kind_priority(protocol::CompletionItemKind kind) {
+    switch(kind) {
+        case protocol::CompletionItemKind::Class:
+        case protocol::CompletionItemKind::Struct: return 3;
+        case protocol::CompletionItemKind::Function:
+        case protocol::CompletionItemKind::Method: return 2;
+        case protocol::CompletionItemKind::Constructor: return 1;
+        default: return 0;
+    }
+}
+
+bool is_callable(protocol::CompletionItemKind kind) {
+    return kind == protocol::CompletionItemKind::Function ||
+           kind == protocol::CompletionItemKind::Method ||
+           kind == protocol::CompletionItemKind::Constructor;
+}
+
 class CodeCompletionCollector final : public clang::CodeCompleteConsumer {
 public:
     CodeCompletionCollector(std::uint32_t offset,
                             PositionEncoding encoding,
-                            std::vector<protocol::CompletionItem>& output,
+                            protocol::CompletionList& output,
                             const CodeCompletionOptions& options) :
         clang::CodeCompleteConsumer({}), offset(offset), encoding(encoding), output(output),
         options(options), info(std::make_shared<clang::GlobalCodeCompletionAllocator>()) {}
@@ -241,6 +303,9 @@ public:
         return info;
     }
 
+    /// Candidates are filtered and ranked from their names alone; only the
+    /// `limit` best get a CodeCompletionString and an item built, which is
+    /// most of the cost in a scope with thousands of visible names.
     void ProcessCodeCompleteResults(clang::Sema& sema,
                                     clang::CodeCompletionContext context,
                                     clang::CodeCompletionResult* candidates,
@@ -254,272 +319,274 @@ public:
         auto content = source_manager.getBufferData(source_manager.getMainFileID());
         auto prefix = CompletionPrefix::from(content, offset);
         FuzzyMatcher matcher(prefix.spelling);
+        bool prefix_starts_with_underscore = prefix.spelling.starts_with("_");
 
-        LineMap map(content, encoding);
-        auto replace_range = *map.to_range(prefix.range.begin, prefix.range.end);
-
-        std::vector<protocol::CompletionItem> collected;
-        collected.reserve(candidate_count);
-
-        std::vector<OverloadItem> overloads;
-        overloads.reserve(candidate_count);
+        std::vector<Candidate> kept;
+        kept.reserve(candidate_count);
         std::unordered_map<std::string, std::size_t> overload_index;
+        std::unordered_map<std::string, std::size_t> label_index;
 
-        bool prefix_starts_with_underscore = prefix.spelling.starts_with("_");
-
-        auto build_item = [&](llvm::StringRef label,
-                              protocol::CompletionItemKind kind,
-                              llvm::StringRef insert,
-                              bool is_snippet = false) {
-            protocol::CompletionItem item{
-                .label = label.str(),
-            };
-            item.kind = kind;
-
-            protocol::TextEdit edit{
-                .range = replace_range,
-                .new_text = insert.empty() ? label.str() : insert.str(),
-            };
-            item.text_edit = std::move(edit);
-            if(is_snippet) {
-                item.insert_text_format = protocol::InsertTextFormat::Snippet;
+        for(auto& candidate: llvm::make_range(candidates, candidates + candidate_count)) {
+            std::string label;
+            auto kind = protocol::CompletionItemKind::Text;
+            switch(candidate.Kind) {
+                case clang::CodeCompletionResult::RK_Keyword:
+                    label = candidate.Keyword;
+                    kind = protocol::CompletionItemKind::Keyword;
+                    break;
+                case clang::CodeCompletionResult::RK_Pattern:
+                    label = candidate.Pattern->getAllTypedText();
+                    kind = protocol::CompletionItemKind::Snippet;
+                    break;
+                case clang::CodeCompletionResult::RK_Macro:
+                    label = candidate.Macro->getName();
+                    kind = protocol::CompletionItemKind::Unit;
+                    break;
+                case clang::CodeCompletionResult::RK_Declaration: {
+                    auto* declaration = candidate.Declaration;
+                    if(!declaration) {
+                        continue;
+                    }
+                    kind = completion_kind(declaration);
+                    label = completion_label(declaration);
+                    break;
+                }
             }
-            return item;
-        };
 
-        auto try_add = [&](llvm::StringRef label,
-                           protocol::CompletionItemKind kind,
-                           llvm::StringRef insert_text,
-                           llvm::StringRef overload_key,
-                           llvm::StringRef signature = {},
-                           llvm::StringRef return_type = {},
-                           bool is_snippet = false,
-                           bool is_deprecated = false) {
             if(label.empty()) {
-                return;
+                continue;
             }
 
             // Filter out _/__ prefixed internal symbols unless user typed _.
-            if(!prefix_starts_with_underscore && label.starts_with("_")) {
-                return;
+            if(!prefix_starts_with_underscore && llvm::StringRef(label).starts_with("_")) {
+                continue;
             }
 
             auto score = matcher.match(label);
             if(!score.has_value()) {
-                return;
+                continue;
             }
-
-            if(!overload_key.empty()) {
-                auto [it, inserted] =
-                    overload_index.try_emplace(overload_key.str(), overloads.size());
-                if(inserted) {
-                    auto item = build_item(label, kind, insert_text, is_snippet);
-                    item.sort_text = std::format("{}", *score);
-                    if(!signature.empty() || !return_type.empty()) {
-                        protocol::CompletionItemLabelDetails details;
-                        if(!signature.empty()) {
-                            details.detail = signature.str();
-                        }
-                        if(!return_type.empty()) {
-                            details.description = return_type.str();
-                        }
-                        item.label_details = std::move(details);
-                    }
-                    if(is_deprecated) {
-                        item.tags = std::vector{protocol::CompletionItemTag::Deprecated};
-                    }
-                    overloads.push_back({
-                        .item = std::move(item),
-                        .score = *score,
-                        .count = 1,
-                    });
-                } else {
-                    auto& existing = overloads[it->second];
-                    existing.count += 1;
-                    if(*score > existing.score) {
-                        existing.score = *score;
-                        existing.item.sort_text = std::format("{}", *score);
-                    }
+            auto ranked = *score * relevance(candidate, source_manager);
+
+            // Overloads of one function become one item, ranked as the best.
+            std::optional<std::string> overload_key;
+            if(options.bundle_overloads && is_callable(kind)) {
+                llvm::SmallString<256> qualified_name;
+                llvm::raw_svector_ostream stream(qualified_name);
+                candidate.Declaration->printQualifiedName(stream);
+                auto it = overload_index.find(qualified_name.str().str());
+                if(it != overload_index.end()) {
+                    auto& existing = kept[it->second];
+                    existing.overloads += 1;
+                    existing.score = std::max(existing.score, ranked);
+                    continue;
                 }
-                return;
+                overload_key = qualified_name.str().str();
             }
 
-            auto item = build_item(label, kind, insert_text, is_snippet);
-            item.sort_text = std::format("{}", *score);
-            if(!signature.empty() || !return_type.empty()) {
-                protocol::CompletionItemLabelDetails details;
-                if(!signature.empty()) {
-                    details.detail = signature.str();
-                }
-                if(!return_type.empty()) {
-                    details.description = return_type.str();
+            // In bundle mode, deduplicate by label: when the same name appears
+            // as both a class and its constructors/deduction guides, keep only
+            // the highest-priority kind (Class > Function/Method > others).
+            auto slot = kept.size();
+            if(options.bundle_overloads) {
+                auto [it, inserted] = label_index.try_emplace(label, slot);
+                if(!inserted) {
+                    if(kind_priority(kind) <= kind_priority(kept[it->second].kind)) {
+                        continue;
+                    }
+                    slot = it->second;
+                    std::erase_if(overload_index, [&](const auto& entry) {
+                        return entry.second == slot;
+                    });
                 }
-                item.label_details = std::move(details);
             }
-            if(is_deprecated) {
-                item.tags = std::vector{protocol::CompletionItemTag::Deprecated};
+            if(overload_key) {
+                overload_index.try_emplace(std::move(*overload_key), slot);
             }
-            collected.push_back(std::move(item));
-        };
-
-        for(auto& candidate: llvm::make_range(candidates, candidates + candidate_count)) {
-            switch(candidate.Kind) {
-                case clang::CodeCompletionResult::RK_Keyword:
-                    try_add(candidate.Keyword,
-                            protocol::CompletionItemKind::Keyword,
-                            candidate.Keyword,
-                            "");
-                    break;
-
-                case clang::CodeCompletionResult::RK_Pattern: {
-                    auto text = candidate.Pattern->getAllTypedText();
-                    try_add(text, protocol::CompletionItemKind::Snippet, text, "");
-                    break;
-                }
 
-                case clang::CodeCompletionResult::RK_Macro:
-                    try_add(candidate.Macro->getName(),
-                            protocol::CompletionItemKind::Unit,
-                            candidate.Macro->getName(),
-                            "");
-                    break;
+            Candidate entry{&candidate, std::move(label), kind, ranked};
+            if(slot == kept.size()) {
+                kept.push_back(std::move(entry));
+            } else {
+                kept[slot] = std::move(entry);
+            }
+        }
 
-                case clang::CodeCompletionResult::RK_Declaration: {
-                    auto* declaration = candidate.Declaration;
-                    if(!declaration) {
-                        break;
-                    }
+        output.is_incomplete = false;
+        if(options.limit != 0 && kept.size() > options.limit) {
+            std::ranges::stable_sort(kept, [](const Candidate& lhs, const Candidate& rhs) {
+                return lhs.score > rhs.score;
+            });
+            kept.resize(options.limit);
+            // A longer prefix may bring back what was cut: the client must
+            // ask again instead of filtering these items.
+            output.is_incomplete = true;
+        }
 
-                    auto kind = completion_kind(declaration);
-
-                    // For constructors and deduction guides, use the class name
-                    // (without template args) instead of the full type name.
-                    // e.g. "vector" instead of "vector<_Tp, _Alloc>".
-                    std::string label;
-                    if(auto* ctor = llvm::dyn_cast<clang::CXXConstructorDecl>(declaration)) {
-                        label = ctor->getParent()->getName().str();
-                    } else if(auto* guide =
-                                  llvm::dyn_cast<clang::CXXDeductionGuideDecl>(declaration)) {
-                        label = guide->getDeducedTemplate()->getName().str();
-                    } else {
-                        label = ast::name_of(declaration);
-                    }
+        LineMap map(content, encoding);
+        auto replace_range = *map.to_range(prefix.range.begin, prefix.range.end);
 
-                    llvm::SmallString<256> qualified_name;
-                    bool is_callable = kind == protocol::CompletionItemKind::Function ||
-                                       kind == protocol::CompletionItemKind::Method ||
-                                       kind == protocol::CompletionItemKind::Constructor;
-                    if(options.bundle_overloads && is_callable) {
-                        llvm::raw_svector_ostream stream(qualified_name);
-                        declaration->printQualifiedName(stream);
-                    }
+        output.items.clear();
+        output.items.reserve(kept.size());
+        for(auto& candidate: kept) {
+            output.items.push_back(build_item(sema, context, candidate, replace_range));
+        }
+    }
 
-                    std::string signature;
-                    std::string return_type;
-                    std::string snippet;
-                    auto* ccs =
-                        candidate.CreateCodeCompletionString(sema,
-                                                             context,
-                                                             getAllocator(),
-                                                             getCodeCompletionTUInfo(),
-                                                             /*IncludeBriefComments=*/false);
-                    if(ccs) {
-                        signature = extract_signature(*ccs);
-                        return_type = extract_return_type(*ccs);
-                        // Generate snippet for non-bundled callables.
-                        if(is_callable && !options.bundle_overloads &&
-                           options.enable_function_arguments_snippet) {
-                            snippet = build_snippet(*ccs);
-                        }
+private:
+    auto build_item(clang::Sema& sema,
+                    clang::CodeCompletionContext context,
+                    const Candidate& candidate,
+                    const protocol::Range& replace_range) -> protocol::CompletionItem {
+        protocol::CompletionItem item{
+            .label = candidate.label,
+        };
+        item.kind = candidate.kind;
+        item.sort_text = std::format("{}", candidate.score);
+
+        auto& result = *candidate.result;
+        std::string insert = candidate.label;
+        if(result.Kind == clang::CodeCompletionResult::RK_Declaration) {
+            auto* ccs = result.CreateCodeCompletionString(sema,
+                                                          context,
+                                                          getAllocator(),
+                                                          getCodeCompletionTUInfo(),
+                                                          /*IncludeBriefComments=*/false);
+
+            protocol::CompletionItemLabelDetails details;
+            if(ccs) {
+                if(auto signature = extract_signature(*ccs); !signature.empty()) {
+                    details.detail = std::move(signature);
+                }
+                if(auto return_type = extract_return_type(*ccs); !return_type.empty()) {
+                    details.description = std::move(return_type);
+                }
+                // Generate snippet for non-bundled callables.
+                if(is_callable(candidate.kind) && !options.bundle_overloads &&
+                   options.enable_function_arguments_snippet) {
+                    if(auto snippet = build_snippet(*ccs); !snippet.empty()) {
+                        insert = std::move(snippet);
+                        item.insert_text_format = protocol::InsertTextFormat::Snippet;
                     }
-
-                    bool has_snippet = !snippet.empty();
-                    auto insert = has_snippet ? llvm::StringRef(snippet) : llvm::StringRef(label);
-                    bool deprecated = candidate.Availability == CXAvailability_Deprecated;
-                    try_add(label,
-                            kind,
-                            insert,
-                            qualified_name.str(),
-                            signature,
-                            return_type,
-                            has_snippet,
-                            deprecated);
-                    break;
                 }
             }
-        }
-
-        for(auto& entry: overloads) {
-            if(entry.count > 1) {
-                protocol::CompletionItemLabelDetails details;
-                details.detail = std::format("(…) +{} overloads", entry.count);
-                entry.item.label_details = std::move(details);
+            if(candidate.overloads > 1) {
+                details = {};
+                details.detail = std::format("(…) +{} overloads", candidate.overloads);
+            }
+            if(details.detail || details.description) {
+                item.label_details = std::move(details);
+            }
+            if(result.Availability == CXAvailability_Deprecated) {
+                item.tags = std::vector{protocol::CompletionItemTag::Deprecated};
             }
-            collected.push_back(std::move(entry.item));
-        }
 
-        // In bundle mode, deduplicate by label: when the same name appears as
-        // both a class and its constructors/deduction guides, keep only the
-        // highest-priority kind (Class > Function/Method > others).
-        if(options.bundle_overloads) {
-            auto kind_priority = [](protocol::CompletionItemKind k) -> int {
-                switch(k) {
-                    case protocol::CompletionItemKind::Class:
-                    case protocol::CompletionItemKind::Struct: return 3;
-                    case protocol::CompletionItemKind::Function:
-                    case protocol::CompletionItemKind::Method: return 2;
-                    case protocol::CompletionItemKind::Constructor: return 1;
-                    default: return 0;
-                }
-            };
-
-            std::unordered_map<std::string, std::size_t> label_index;
-            std::vector<protocol::CompletionItem> deduped;
-            deduped.reserve(collected.size());
-
-            for(auto& item: collected) {
-                auto [it, inserted] = label_index.try_emplace(item.label, deduped.size());
-                if(inserted) {
-                    deduped.push_back(std::move(item));
-                } else {
-                    auto& existing = deduped[it->second];
-                    int old_prio = existing.kind.has_value() ? kind_priority(*existing.kind) : 0;
-                    int new_prio = item.kind.has_value() ? kind_priority(*item.kind) : 0;
-                    if(new_prio > old_prio) {
-                        existing = std::move(item);
-                    }
-                }
+            // The symbol, for completionItem/resolve and for ranking by the
+            // project index.
+            llvm::SmallString<128> usr;
+            if(!index::generateUSRForDecl(result.Declaration, usr)) {
+                item.data = protocol::LSPAny(static_cast<std::int64_t>(llvm::xxh3_64bits(usr)));
             }
-            collected.swap(deduped);
         }
 
-        output.clear();
-        output.swap(collected);
+        item.text_edit = protocol::TextEdit{
+            .range = replace_range,
+            .new_text = std::move(insert),
+        };
+        return item;
     }
 
-private:
     std::uint32_t offset;
     PositionEncoding encoding;
-    std::vector<protocol::CompletionItem>& output;
+    protocol::CompletionList& output;
     const CodeCompletionOptions& options;
     clang::CodeCompletionTUInfo info;
 };
 
+/// The declaration of `unit` a completion item was made for.  Function
+/// bodies are not entered: what they declare has no documentation worth a
+/// resolve.
+class CompletedDeclFinder : public clang::RecursiveASTVisitor<CompletedDeclFinder> {
+public:
+    CompletedDeclFinder(CompilationUnitRef unit, llvm::StringRef label, std::uint64_t hash) :
+        unit(unit), label(label), hash(hash) {}
+
+    bool TraverseStmt(clang::Stmt*) {
+        return true;
+    }
+
+    bool VisitNamedDecl(clang::NamedDecl* decl) {
+        auto* name = decl->getDeclName().getAsIdentifierInfo();
+        if(!name && !llvm::isa<clang::CXXConstructorDecl, clang::CXXDeductionGuideDecl>(decl)) {
+            return true;
+        }
+        if((name ? name->getName().str() : completion_label(decl)) != label ||
+           unit.getSymbolID(decl).hash != hash) {
+            return true;
+        }
+        found = decl;
+        return false;
+    }
+
+    clang::NamedDecl* found = nullptr;
+
+private:
+    CompilationUnitRef unit;
+    llvm::StringRef label;
+    std::uint64_t hash;
+};
+
 }  // namespace
 
 auto code_complete(CompilationParams& params,
                    const CodeCompletionOptions& options,
-                   PositionEncoding encoding) -> std::vector<protocol::CompletionItem> {
-    std::vector<protocol::CompletionItem> items;
+                   PositionEncoding encoding) -> protocol::CompletionList {
+    protocol::CompletionList list;
 
     auto& [file, offset] = params.completion;
     (void)file;
 
-    auto* consumer = new CodeCompletionCollector(offset, encoding, items, options);
+    auto* consumer = new CodeCompletionCollector(offset, encoding, list, options);
     auto unit = complete(params, consumer);
     (void)unit;
 
-    return items;
+    return list;
+}
+
+bool resolve_completion(CompilationUnitRef unit,
+                        protocol::CompletionItem& item,
+                        HoverCache* cache) {
+    auto* data = item.data ? std::get_if<std::int64_t>(&*item.data) : nullptr;
+    if(!data) {
+        return false;
+    }
+    CompletedDeclFinder finder(unit, item.label, static_cast<std::uint64_t>(*data));
+    finder.TraverseDecl(unit.tu());
+    auto* decl = finder.found;
+    if(!decl) {
+        return false;
+    }
+
+    auto policy = unit.context().getPrintingPolicy();
+    policy.TerseOutput = true;
+    policy.PolishForDeclaration = true;
+    policy.SuppressInitializers = true;
+    policy.AnonymousTagLocations = false;
+    std::string detail;
+    llvm::raw_string_ostream os(detail);
+    decl->print(os, policy);
+    item.detail = std::move(detail);
+
+    auto comment = cache ? cache->comment(*decl).str() : ast::decl_comment(unit.context(), *decl);
+    if(!comment.empty()) {
+        markup::Document document;
+        parse_documentation(comment, document);
+        item.documentation = protocol::MarkupContent{
+            .kind = protocol::MarkupKind::markdown,
+            .value = document.as_markdown(),
+        };
+    }
+    return true;
 }
 
 }  // namespace clice::feature
@@ -1,3 +1,4 @@
+#include <format>
 #include <optional>
 #include <string>
 #include <vector>
@@ -5,6 +6,11 @@
 #include "feature/feature.h"
 
 #include "kota/ipc/lsp/uri.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
 
 namespace clice::feature {
 
@@ -24,60 +30,55 @@ auto to_uri(llvm::StringRef file) -> std::string {
     return file.str();
 }
 
-void add_tag(protocol::Diagnostic& diagnostic, DiagnosticID id) {
-    if(id.is_deprecated()) {
-        if(!diagnostic.tags.has_value()) {
-            diagnostic.tags = std::vector<protocol::DiagnosticTag>();
-        }
-        diagnostic.tags->push_back(protocol::DiagnosticTag::Deprecated);
-    } else if(id.is_unused()) {
-        if(!diagnostic.tags.has_value()) {
-            diagnostic.tags = std::vector<protocol::DiagnosticTag>();
-        }
-        diagnostic.tags->push_back(protocol::DiagnosticTag::Unnecessary);
-    }
-}
-
-void add_related(protocol::Diagnostic& diagnostic,
-                 CompilationUnitRef unit,
-                 const Diagnostic& raw,
-                 PositionEncoding encoding) {
-    if(raw.fid.isInvalid() || !raw.range.valid()) {
-        return;
-    }
-
-    auto content = unit.file_content(raw.fid);
-    LineMap map(content, encoding);
-
-    protocol::DiagnosticRelatedInformation related{
-        .location =
-            protocol::Location{
-                               .uri = to_uri(unit.file_path(raw.fid)),
-                               .range = *map.to_range(raw.range.begin, raw.range.end),
-                               },
-        .message = raw.message,
+/// The URI and line starts of each file notes point into, worked out once
+/// per file: template-heavy errors carry thousands of notes in a few headers.
+class NoteFiles {
+public:
+    struct File {
+        std::string uri;
+        std::vector<std::uint32_t> line_starts;
     };
 
-    if(!diagnostic.related_information.has_value()) {
-        diagnostic.related_information = std::vector<protocol::DiagnosticRelatedInformation>();
-    }
-    diagnostic.related_information->push_back(std::move(related));
-}
+    explicit NoteFiles(CompilationUnitRef unit) : unit(unit) {}
 
-}  // namespace
+    const File& get(clang::FileID fid) {
+        auto [it, inserted] = files.try_emplace(fid);
+        if(inserted) {
+            it->second.uri = to_uri(unit.file_path(fid));
+            it->second.line_starts = lsp::build_line_starts(unit.file_content(fid));
+        }
+        return it->second;
+    }
 
-auto diagnostics(CompilationUnitRef unit, PositionEncoding encoding)
-    -> std::vector<protocol::Diagnostic> {
-    LineMap map(unit.interested_content(), unit.line_starts(), encoding);
-    std::vector<protocol::Diagnostic> result;
-    std::optional<protocol::Diagnostic> current;
+private:
+    CompilationUnitRef unit;
+    llvm::DenseMap<clang::FileID, File> files;
+};
+
+/// What makes two diagnostics the same to the reader.
+auto identity(const Diagnostic& raw) -> std::string {
+    return std::format("{}:{}:{}:{}:{}",
+                       static_cast<int>(raw.id.level),
+                       raw.fid.getHashValue(),
+                       raw.range.begin,
+                       raw.range.end,
+                       raw.message);
+}
 
-    auto flush = [&]() {
-        if(current.has_value()) {
-            result.push_back(std::move(*current));
-            current.reset();
-        }
-    };
+/// Walk the diagnostics worth reporting, in order, handing `sink` each one
+/// with the range it shows at in the interested file, then its notes with
+/// theirs.  Stops after `limit` diagnostics, unless it is 0.
+template <typename Sink>
+void walk(CompilationUnitRef unit, PositionEncoding encoding, Sink& sink, std::uint32_t limit = 0) {
+    auto& map = unit.position_map(encoding);
+    NoteFiles files(unit);
+    bool open = false;
+    std::uint32_t count = 0;
+
+    // Instantiating one template many times repeats its errors, each with
+    // all of its notes: only the first copy of each goes out.
+    llvm::StringSet<> seen;
+    llvm::StringSet<> seen_notes;
 
     for(const auto& raw: unit.diagnostics()) {
         auto level = raw.id.level;
@@ -87,29 +88,91 @@ auto diagnostics(CompilationUnitRef unit, PositionEncoding encoding)
         }
 
         if(level == DiagnosticLevel::Note || level == DiagnosticLevel::Remark) {
-            if(current.has_value()) {
-                add_related(*current, unit, raw, encoding);
+            if(open && raw.fid.isValid() && raw.range.valid() &&
+               seen_notes.insert(identity(raw)).second) {
+                auto& file = files.get(raw.fid);
+                LineMap note_map(unit.file_content(raw.fid), file.line_starts, encoding);
+                sink.note(raw, file.uri, *note_map.to_range(raw.range.begin, raw.range.end));
             }
             continue;
         }
 
-        flush();
+        if(open) {
+            sink.end();
+            open = false;
+        }
+        seen_notes.clear();
+        if(limit != 0 && count == limit) {
+            break;
+        }
+        if(!seen.insert(identity(raw)).second) {
+            continue;
+        }
+        count += 1;
 
-        protocol::Diagnostic diagnostic{
-            .range =
-                protocol::Range{
-                                .start = protocol::Position{.line = 0, .character = 0},
-                                .end = protocol::Position{.line = 0, .character = 0},
-                                },
-            .message = raw.message,
+        protocol::Range range{
+            .start = protocol::Position{.line = 0, .character = 0},
+            .end = protocol::Position{.line = 0, .character = 0},
         };
 
-        if(level == DiagnosticLevel::Warning) {
-            diagnostic.severity = protocol::DiagnosticSeverity::Warning;
-        } else if(level == DiagnosticLevel::Error || level == DiagnosticLevel::Fatal) {
-            diagnostic.severity = protocol::DiagnosticSeverity::Error;
+        if(raw.fid == unit.interested_file()) {
+            range = *map.to_range(raw.range.begin, raw.range.end);
+        } else if(raw.fid.isValid()) {
+            auto include_location = unit.include_location(raw.fid);
+            while(true) {
+                auto parent = unit.file_id(include_location);
+                if(parent.isValid()) {
+                    include_location = unit.include_location(parent);
+                } else {
+                    break;
+                }
+            }
+
+            auto offset = unit.file_offset(include_location);
+            auto end_offset =
+                static_cast<std::uint32_t>(offset + unit.token_spelling(include_location).size());
+            range = *map.to_range(offset, end_offset);
         }
 
+        sink.begin(raw, range);
+        open = true;
+    }
+
+    if(open) {
+        sink.end();
+    }
+}
+
+auto severity(DiagnosticLevel level) -> std::optional<protocol::DiagnosticSeverity> {
+    if(level == DiagnosticLevel::Warning) {
+        return protocol::DiagnosticSeverity::Warning;
+    } else if(level == DiagnosticLevel::Error || level == DiagnosticLevel::Fatal) {
+        return protocol::DiagnosticSeverity::Error;
+    }
+    return std::nullopt;
+}
+
+auto tag(DiagnosticID id) -> std::optional<protocol::DiagnosticTag> {
+    if(id.is_deprecated()) {
+        return protocol::DiagnosticTag::Deprecated;
+    } else if(id.is_unused()) {
+        return protocol::DiagnosticTag::Unnecessary;
+    }
+    return std::nullopt;
+}
+
+/// Builds the protocol objects.
+class Collector {
+public:
+    std::vector<protocol::Diagnostic> result;
+
+    void begin(const Diagnostic& raw, const protocol::Range& range) {
+        protocol::Diagnostic diagnostic{
+            .range = range,
+            .severity = severity(raw.id.level),
+            .message = raw.message,
+        };
+
         if(auto code = raw.id.diagnostic_code(); !code.empty()) {
             diagnostic.code = code.str();
         }
@@ -121,43 +184,144 @@ auto diagnostics(CompilationUnitRef unit, PositionEncoding encoding)
         // Keep legacy behavior: always report clang as source.
         diagnostic.source = "clang";
 
-        add_tag(diagnostic, raw.id);
+        if(auto kind = tag(raw.id)) {
+            diagnostic.tags = std::vector<protocol::DiagnosticTag>{*kind};
+        }
 
-        if(raw.fid.isInvalid()) {
-            diagnostic.range = protocol::Range{
-                .start = protocol::Position{.line = 0, .character = 0},
-                .end = protocol::Position{.line = 0, .character = 0},
-            };
-            current = std::move(diagnostic);
-            continue;
+        result.push_back(std::move(diagnostic));
+    }
+
+    void note(const Diagnostic& raw, llvm::StringRef uri, const protocol::Range& range) {
+        auto& related = result.back().related_information;
+        if(!related.has_value()) {
+            related = std::vector<protocol::DiagnosticRelatedInformation>();
         }
+        related->push_back(protocol::DiagnosticRelatedInformation{
+            .location = protocol::Location{.uri = uri.str(), .range = range},
+            .message = raw.message,
+        });
+    }
 
-        if(raw.fid == unit.interested_file()) {
-            diagnostic.range = *map.to_range(raw.range.begin, raw.range.end);
-            current = std::move(diagnostic);
-            continue;
+    void end() {}
+};
+
+/// Writes the JSON of the protocol objects straight into one buffer.  The
+/// escaped text of messages and URIs is kept, as the notes of one error
+/// mostly repeat those of the last.
+class Encoder {
+public:
+    explicit Encoder(std::string& buffer) : os(buffer), json(os) {
+        json.arrayBegin();
+    }
+
+    void begin(const Diagnostic& raw, const protocol::Range& range) {
+        json.objectBegin();
+        write_range("range", range);
+        if(auto level = severity(raw.id.level)) {
+            json.attribute("severity", static_cast<std::int64_t>(*level));
         }
+        if(auto code = raw.id.diagnostic_code(); !code.empty()) {
+            json.attribute("code", code);
+        }
+        if(auto uri = raw.id.diagnostic_document_uri()) {
+            json.attributeObject("codeDescription", [&] { json.attribute("href", *uri); });
+        }
+        json.attribute("source", "clang");
+        json.attributeBegin("message");
+        json.rawValue(escaped(raw.message));
+        json.attributeEnd();
+        if(auto kind = tag(raw.id)) {
+            json.attributeArray("tags", [&] { json.value(static_cast<std::int64_t>(*kind)); });
+        }
+        has_related = false;
+    }
 
-        auto include_location = unit.include_location(raw.fid);
-        while(true) {
-            auto parent = unit.file_id(include_location);
-            if(parent.isValid()) {
-                include_location = unit.include_location(parent);
-            } else {
-                break;
-            }
+    void note(const Diagnostic& raw, llvm::StringRef uri, const protocol::Range& range) {
+        if(!has_related) {
+            json.attributeBegin("relatedInformation");
+            json.arrayBegin();
+            has_related = true;
+        }
+        json.objectBegin();
+        json.attributeObject("location", [&] {
+            json.attributeBegin("uri");
+            json.rawValue(escaped(uri));
+            json.attributeEnd();
+            write_range("range", range);
+        });
+        json.attributeBegin("message");
+        json.rawValue(escaped(raw.message));
+        json.attributeEnd();
+        json.objectEnd();
+    }
+
+    void end() {
+        if(has_related) {
+            json.arrayEnd();
+            json.attributeEnd();
         }
+        json.objectEnd();
+    }
 
-        auto offset = unit.file_offset(include_location);
-        auto end_offset =
-            static_cast<std::uint32_t>(offset + unit.token_spelling(include_location).size());
-        diagnostic.range = *map.to_range(offset, end_offset);
+    void finish() {
+        json.arrayEnd();
+        json.flush();
+    }
 
-        current = std::move(diagnostic);
+private:
+    void write_position(llvm::StringRef key, const protocol::Position& position) {
+        json.attributeObject(key, [&] {
+            json.attribute("line", static_cast<std::int64_t>(position.line));
+            json.attribute("character", static_cast<std::int64_t>(position.character));
+        });
+    }
+
+    void write_range(llvm::StringRef key, const protocol::Range& range) {
+        json.attributeObject(key, [&] {
+            write_position("start", range.start);
+            write_position("end", range.end);
+        });
+    }
+
+    llvm::StringRef escaped(llvm::StringRef text) {
+        auto [it, inserted] = strings.try_emplace(text);
+        if(inserted) {
+            llvm::raw_string_ostream text_os(it->second);
+            llvm::json::OStream(text_os).value(text);
+        }
+        return it->second;
+    }
+
+    llvm::raw_string_ostream os;
+    llvm::json::OStream json;
+    llvm::StringMap<std::string> strings;
+    bool has_related = false;
+};
+
+}  // namespace
+
+auto diagnostics(CompilationUnitRef unit, PositionEncoding encoding)
+    -> std::vector<protocol::Diagnostic> {
+    Collector collector;
+    walk(unit, encoding, collector);
+    return std::move(collector.result);
+}
+
+auto diagnostics_json(CompilationUnitRef unit, PositionEncoding encoding, std::uint32_t limit)
+    -> std::string {
+    // Roughly what each diagnostic takes besides its message.
+    constexpr std::size_t overhead = 160;
+    std::size_t estimate = 2;
+    for(const auto& raw: unit.diagnostics()) {
+        estimate += raw.message.size() + overhead;
     }
 
-    flush();
-    return result;
+    std::string buffer;
+    buffer.reserve(estimate);
+    Encoder encoder(buffer);
+    walk(unit, encoding, encoder, limit);
+    encoder.finish();
+    return buffer;
 }
 
 }  // namespace clice::feature
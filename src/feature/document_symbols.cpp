@@ -178,7 +178,7 @@ void sort_symbols(std::vector<DocumentSymbol>& symbols) {
     }
 }
 
-auto to_protocol_symbol(const DocumentSymbol& symbol, const LineMap& map)
+auto to_protocol_symbol(const DocumentSymbol& symbol, const PositionMap& map)
     -> protocol::DocumentSymbol {
     protocol::DocumentSymbol result{
         .name = symbol.name,
@@ -215,7 +215,22 @@ auto document_symbols(CompilationUnitRef unit) -> std::vector<DocumentSymbol> {
 auto document_symbols(CompilationUnitRef unit, PositionEncoding encoding)
     -> std::vector<protocol::DocumentSymbol> {
     auto internal = document_symbols(unit);
-    LineMap map(unit.interested_content(), unit.line_starts(), encoding);
+    auto& map = unit.position_map(encoding);
+
+    std::vector<protocol::DocumentSymbol> symbols;
+    symbols.reserve(internal.size());
+
+    for(const auto& symbol: internal) {
+        symbols.push_back(to_protocol_symbol(symbol, map));
+    }
+
+    return symbols;
+}
+
+auto document_symbols(llvm::StringRef content,
+                      llvm::ArrayRef<DocumentSymbol> internal,
+                      PositionEncoding encoding) -> std::vector<protocol::DocumentSymbol> {
+    PositionMap map(content, encoding);
 
     std::vector<protocol::DocumentSymbol> symbols;
     symbols.reserve(internal.size());
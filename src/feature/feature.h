@@ -1,6 +1,8 @@
 #pragma once
 
 #include <cstdint>
+#include <expected>
+#include <memory>
 #include <optional>
 #include <string>
 #include <vector>
@@ -12,6 +14,16 @@
 
 #include "kota/ipc/lsp/position.h"
 #include "kota/ipc/lsp/protocol.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/StringMap.h"
+
+namespace clang::format {
+
+struct FormatStyle;
+
+}
 
 namespace clice::feature {
 
@@ -30,9 +42,13 @@ struct CodeCompletionOptions {
     bool enable_template_arguments_snippet = false;
     bool insert_paren_in_function_call = false;
     bool bundle_overloads = true;
-    std::uint32_t limit = 0;
+    /// Items kept of the best ranked candidates, 0 for all.  A cut list is
+    /// marked incomplete, so the client asks again as the prefix grows.
+    std::uint32_t limit = 100;
 };
 
+class HoverCache;
+
 struct HoverOptions {
     /// Render the hover card as markdown rather than plain text.
     bool parse_comment_as_markdown = true;
@@ -40,6 +56,10 @@ struct HoverOptions {
     /// Show the desugared form of a type, e.g. `vector<int>::size_type (aka
     /// unsigned long)`.
     bool show_aka = true;
+
+    /// Documentation already fetched and parsed from the unit hovered, if
+    /// the caller keeps it.
+    HoverCache* cache = nullptr;
 };
 
 /// Contains detailed information about a symbol. Especially useful when
@@ -177,8 +197,9 @@ struct HoverInfo {
     /// Set only if callee_arg_info is set.
     std::optional<PassType> call_pass_type;
 
-    /// Produce a user-readable information.
-    markup::Document present() const;
+    /// Produce a user-readable information.  The documentation is taken
+    /// parsed from `cache` when given.
+    markup::Document present(HoverCache* cache = nullptr) const;
 };
 
 llvm::raw_ostream& operator<<(llvm::raw_ostream& os, const HoverInfo::PrintedType& type);
@@ -188,6 +209,30 @@ llvm::raw_ostream& operator<<(llvm::raw_ostream& os, const HoverInfo::Param& par
 /// Try to infer structure of a documentation comment (e.g. line breaks).
 void parse_documentation(llvm::StringRef input, markup::Document& output);
 
+/// The hover work that depends only on a declaration, done once per AST:
+/// its formatted comment, and comments parsed into markup.  Hovering the
+/// same symbol again, the usual case, skips both.  Belongs with the unit it
+/// was filled from and must be cleared when that unit is replaced.
+class HoverCache {
+public:
+    /// The comment documenting `decl` (ast::decl_comment()).
+    llvm::StringRef comment(const clang::NamedDecl& decl);
+
+    /// `documentation` laid out by parse_documentation().
+    const markup::Document& parsed(llvm::StringRef documentation);
+
+    void clear() {
+        comments.clear();
+        documents.clear();
+    }
+
+private:
+    llvm::DenseMap<const clang::Decl*, std::string> comments;
+    llvm::StringMap<markup::Document> documents;
+};
+
+class InlayHintCache;
+
 struct InlayHintsOptions {
     bool enabled = true;
     bool parameters = true;
@@ -196,6 +241,10 @@ struct InlayHintsOptions {
     bool block_end = false;
     bool default_arguments = false;
     std::uint32_t type_name_limit = 32;
+
+    /// Hints already computed on the unit, if the caller keeps them; only
+    /// the part of the target no earlier request covered is visited.
+    InlayHintCache* cache = nullptr;
 };
 
 struct SignatureHelpOptions {};
@@ -237,17 +286,93 @@ struct InlayHint {
     bool padding_right = false;
 };
 
-auto semantic_tokens(CompilationUnitRef unit) -> std::vector<SemanticToken>;
+/// The inlay hints of one unit, by the ranges they were computed for, as
+/// editors ask for overlapping viewports while scrolling.  Only valid for
+/// the unit and the options it was filled with.
+class InlayHintCache {
+public:
+    /// The parts of `target` no range stored so far covers.
+    std::vector<LocalSourceRange> missing(LocalSourceRange target) const;
+
+    /// Record the sorted `hints` computed for `ranges`.
+    void add(llvm::ArrayRef<LocalSourceRange> ranges, std::vector<InlayHint> hints);
+
+    /// The stored hints at offsets in `target`.
+    std::vector<InlayHint> lookup(LocalSourceRange target) const;
+
+    void clear() {
+        covered.clear();
+        hints.clear();
+    }
+
+private:
+    /// Disjoint ranges, by begin.
+    std::vector<LocalSourceRange> covered;
+    /// Sorted as inlay_hints() returns them.
+    std::vector<InlayHint> hints;
+};
+
+/// A quick fix for a diagnostic, from the fix-its clang attached to it.
+/// code_actions() leaves `edit` empty and `data` naming the diagnostic;
+/// resolve_code_action() fills the edit.  Serializes as an LSP CodeAction.
+struct QuickFix {
+    std::string title;
+    std::string kind = "quickfix";
+    std::optional<bool> is_preferred;
+    std::optional<protocol::WorkspaceEdit> edit;
+    /// Index of the diagnostic in unit.diagnostics().
+    std::int64_t data = 0;
+};
+
+/// With a valid `range`, only the tokens intersecting it; declarations
+/// outside it are not visited, so a viewport costs little in a large file.
+auto semantic_tokens(CompilationUnitRef unit, LocalSourceRange range = {})
+    -> std::vector<SemanticToken>;
 auto semantic_tokens(CompilationUnitRef unit, PositionEncoding encoding)
     -> protocol::SemanticTokens;
+auto semantic_tokens(CompilationUnitRef unit, LocalSourceRange range, PositionEncoding encoding)
+    -> protocol::SemanticTokens;
+
+/// Encode tokens whose ranges index `content` rather than the unit's own
+/// text, e.g. tokens of an older AST remapped onto the current buffer.
+auto semantic_tokens(llvm::StringRef content,
+                     llvm::ArrayRef<SemanticToken> tokens,
+                     PositionEncoding encoding) -> protocol::SemanticTokens;
+
+/// Tokens read off `content` alone, for a file whose AST is not built yet:
+/// comments, literals, directives, keywords and the macros the file
+/// defines.  Other identifiers are left `SymbolKind::Invalid` for the
+/// caller to classify by name; drop those it cannot.
+auto syntactic_semantic_tokens(llvm::StringRef content) -> std::vector<SemanticToken>;
+
+/// Edits turning encoded token data `previous` into `current`: a single
+/// replacement of whole tokens between their common prefix and suffix,
+/// or none when they are equal.
+auto semantic_tokens_edits(llvm::ArrayRef<std::uint32_t> previous,
+                           llvm::ArrayRef<std::uint32_t> current)
+    -> std::vector<protocol::SemanticTokensEdit>;
 
 auto folding_ranges(CompilationUnitRef unit) -> std::vector<FoldingRange>;
 auto folding_ranges(CompilationUnitRef unit, PositionEncoding encoding)
     -> std::vector<protocol::FoldingRange>;
+auto folding_ranges(llvm::StringRef content,
+                    llvm::ArrayRef<FoldingRange> ranges,
+                    PositionEncoding encoding) -> std::vector<protocol::FoldingRange>;
 
 auto document_symbols(CompilationUnitRef unit) -> std::vector<DocumentSymbol>;
 auto document_symbols(CompilationUnitRef unit, PositionEncoding encoding)
     -> std::vector<protocol::DocumentSymbol>;
+auto document_symbols(llvm::StringRef content,
+                      llvm::ArrayRef<DocumentSymbol> symbols,
+                      PositionEncoding encoding) -> std::vector<protocol::DocumentSymbol>;
+
+/// Folding ranges and an outline read off the tokens of `content` alone,
+/// for a file whose AST is not built yet: braces, comment blocks and
+/// `#pragma region`s fold, and namespaces, classes, enums and functions
+/// are listed by the names they show.  Macros are not expanded and
+/// nothing is resolved, so results are coarser than those of an AST.
+auto syntactic_folding_ranges(llvm::StringRef content) -> std::vector<FoldingRange>;
+auto syntactic_document_symbols(llvm::StringRef content) -> std::vector<DocumentSymbol>;
 
 auto inlay_hints(CompilationUnitRef unit,
                  LocalSourceRange target,
@@ -263,10 +388,38 @@ auto document_links(CompilationUnitRef unit, PositionEncoding encoding = Positio
 auto diagnostics(CompilationUnitRef unit, PositionEncoding encoding = PositionEncoding::UTF16)
     -> std::vector<protocol::Diagnostic>;
 
+/// The JSON of diagnostics(), written straight into one buffer without
+/// building the protocol objects: for units with thousands of notes.  With
+/// a `limit`, only the first that many diagnostics go out, with their notes.
+auto diagnostics_json(CompilationUnitRef unit,
+                      PositionEncoding encoding = PositionEncoding::UTF16,
+                      std::uint32_t limit = 0) -> std::string;
+
+/// The quick fixes of the interested file's diagnostics in `range`, without
+/// their edits: a client asks for code actions at every cursor move and
+/// resolves the one the user picks.
+auto code_actions(CompilationUnitRef unit, LocalSourceRange range) -> std::vector<QuickFix>;
+
+/// Fill the edit of a fix code_actions() offered.  Returns false when the
+/// diagnostic `fix.data` names is no longer that fix's in `unit`.
+bool resolve_code_action(CompilationUnitRef unit,
+                         QuickFix& fix,
+                         PositionEncoding encoding = PositionEncoding::UTF16);
+
+/// Candidates are ranked by how well they match the prefix typed, Sema's
+/// priority and how near the file their declaration is; `sort_text` is that
+/// score.  Declarations carry their symbol hash in `data`.
 auto code_complete(CompilationParams& params,
                    const CodeCompletionOptions& options = {},
                    PositionEncoding encoding = PositionEncoding::UTF16)
-    -> std::vector<protocol::CompletionItem>;
+    -> protocol::CompletionList;
+
+/// Fill `detail` and `documentation` of an item code_complete() made, for
+/// completionItem/resolve, from the declaration of `unit` its label and
+/// `data` name.  Returns false when `unit` does not declare it.
+bool resolve_completion(CompilationUnitRef unit,
+                        protocol::CompletionItem& item,
+                        HoverCache* cache = nullptr);
 
 /// Get the hover information for the symbol at the given offset in the
 /// interested file of the unit.
@@ -281,10 +434,51 @@ auto hover(CompilationUnitRef unit,
 auto signature_help(CompilationParams& params, const SignatureHelpOptions& options = {})
     -> protocol::SignatureHelp;
 
+/// Signature help from an AST already built, without a completion parse.
+/// `offset` is the cursor in `text`, the current buffer, and `to_unit` maps
+/// offsets of `text` onto the text `unit` was built from.  Fails when the
+/// callee is not in the AST as written, e.g. a name typed since, or is not
+/// a plain name; the completion parse then has to answer.
+auto signature_help(CompilationUnitRef unit,
+                    llvm::StringRef text,
+                    std::uint32_t offset,
+                    llvm::function_ref<std::optional<std::uint32_t>(std::uint32_t)> to_unit,
+                    const SignatureHelpOptions& options = {})
+    -> std::optional<protocol::SignatureHelp>;
+
+/// clang-format styles by directory and language, so that formatting does
+/// not search the directory tree for `.clang-format` and parse it on every
+/// request.  Must be cleared when a style file changes.
+class FormatStyleCache {
+public:
+    FormatStyleCache();
+    ~FormatStyleCache();
+
+    /// The style `file` is formatted with, resolved on first use.
+    auto style(llvm::StringRef file)
+        -> std::expected<const clang::format::FormatStyle*, std::string>;
+
+    void clear() {
+        styles.clear();
+    }
+
+private:
+    llvm::StringMap<std::unique_ptr<clang::format::FormatStyle>> styles;
+};
+
 auto document_format(llvm::StringRef file,
                      llvm::StringRef content,
                      std::optional<LocalSourceRange> range,
-                     PositionEncoding encoding = PositionEncoding::UTF16)
-    -> std::vector<protocol::TextEdit>;
+                     PositionEncoding encoding = PositionEncoding::UTF16,
+                     FormatStyleCache* cache = nullptr) -> std::vector<protocol::TextEdit>;
+
+/// Format the code completed by typing `;` or `}` right before `offset`:
+/// the statement that `;` ends, or the block that `}` closes.  No edits
+/// when the character is neither, or is inside a comment or literal.
+auto on_type_format(llvm::StringRef file,
+                    llvm::StringRef content,
+                    std::uint32_t offset,
+                    PositionEncoding encoding = PositionEncoding::UTF16,
+                    FormatStyleCache* cache = nullptr) -> std::vector<protocol::TextEdit>;
 
 }  // namespace clice::feature
@@ -340,17 +340,8 @@ private:
     std::vector<FoldingRange> ranges;
 };
 
-}  // namespace
-
-auto folding_ranges(CompilationUnitRef unit) -> std::vector<FoldingRange> {
-    return FoldingRangeCollector(unit).collect();
-}
-
-auto folding_ranges(CompilationUnitRef unit, PositionEncoding encoding)
+auto to_protocol_ranges(llvm::ArrayRef<FoldingRange> collected, const PositionMap& map)
     -> std::vector<protocol::FoldingRange> {
-    auto collected = folding_ranges(unit);
-    LineMap map(unit.interested_content(), unit.line_starts(), encoding);
-
     std::vector<protocol::FoldingRange> result;
     result.reserve(collected.size());
 
@@ -378,4 +369,21 @@ auto folding_ranges(CompilationUnitRef unit, PositionEncoding encoding)
     return result;
 }
 
+}  // namespace
+
+auto folding_ranges(CompilationUnitRef unit) -> std::vector<FoldingRange> {
+    return FoldingRangeCollector(unit).collect();
+}
+
+auto folding_ranges(CompilationUnitRef unit, PositionEncoding encoding)
+    -> std::vector<protocol::FoldingRange> {
+    return to_protocol_ranges(folding_ranges(unit), unit.position_map(encoding));
+}
+
+auto folding_ranges(llvm::StringRef content,
+                    llvm::ArrayRef<FoldingRange> ranges,
+                    PositionEncoding encoding) -> std::vector<protocol::FoldingRange> {
+    return to_protocol_ranges(ranges, PositionMap(content, encoding));
+}
+
 }  // namespace clice::feature
@@ -5,7 +5,10 @@
 
 #include "feature/feature.h"
 #include "support/logging.h"
+#include "syntax/lexer.h"
 
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Path.h"
 #include "clang/Format/Format.h"
 
 namespace clice::feature {
@@ -13,8 +16,7 @@ namespace clice::feature {
 namespace {
 namespace tooling = clang::tooling;
 
-auto format_content(llvm::StringRef file, llvm::StringRef content, tooling::Range range)
-    -> std::expected<tooling::Replacements, std::string> {
+auto resolve_style(llvm::StringRef file) -> std::expected<clang::format::FormatStyle, std::string> {
     // Set code to empty to avoid meaningless file type guess.
     auto style = clang::format::getStyle(clang::format::DefaultFormatStyle,
                                          file,
@@ -23,31 +25,123 @@ auto format_content(llvm::StringRef file, llvm::StringRef content, tooling::Rang
     if(!style) {
         return std::unexpected(std::format("{}", style.takeError()));
     }
+    return std::move(*style);
+}
 
+auto format_content(const clang::format::FormatStyle& style,
+                    llvm::StringRef file,
+                    llvm::StringRef content,
+                    tooling::Range range) -> std::expected<tooling::Replacements, std::string> {
     std::vector<tooling::Range> ranges = {range};
-    auto include_replacements = clang::format::sortIncludes(*style, content, ranges, file);
+    auto include_replacements = clang::format::sortIncludes(style, content, ranges, file);
     auto changed = tooling::applyAllReplacements(content, include_replacements);
     if(!changed) {
         return std::unexpected(std::format("{}", changed.takeError()));
     }
 
     return include_replacements.merge(clang::format::reformat(
-        *style,
+        style,
         *changed,
         tooling::calculateRangesAfterReplacements(include_replacements, ranges)));
 }
 
+/// Where the code ended by the `;` or `}` that ends `content` begins: the
+/// statement's first token, or the matching `{`.
+std::optional<std::uint32_t> typed_code_begin(llvm::StringRef content) {
+    Lexer lexer(content, true, &cxx_lang_options());
+    llvm::SmallVector<std::uint32_t> braces;
+    std::optional<std::uint32_t> statement;
+    std::optional<std::uint32_t> begin;
+    Token last;
+    while(true) {
+        auto token = lexer.advance();
+        if(token.is_eof()) {
+            break;
+        }
+        if(token.is_eod()) {
+            continue;
+        }
+        if(!statement) {
+            statement = token.range.begin;
+        }
+        last = token;
+        begin = statement;
+        switch(token.kind) {
+            case clang::tok::l_brace:
+                braces.push_back(token.range.begin);
+                statement.reset();
+                break;
+            case clang::tok::r_brace:
+                begin = braces.empty() ? 0 : braces.pop_back_val();
+                statement.reset();
+                break;
+            case clang::tok::semi: statement.reset(); break;
+            default: break;
+        }
+    }
+
+    // A `;` or `}` in a comment or literal is not the last token.
+    if(!last.valid() || last.range.end != content.size() ||
+       (last.kind != clang::tok::semi && last.kind != clang::tok::r_brace)) {
+        return std::nullopt;
+    }
+    return begin;
+}
+
 }  // namespace
 
+FormatStyleCache::FormatStyleCache() = default;
+
+FormatStyleCache::~FormatStyleCache() = default;
+
+auto FormatStyleCache::style(llvm::StringRef file)
+    -> std::expected<const clang::format::FormatStyle*, std::string> {
+    // The style read from a directory depends on the language too.
+    auto language = clang::format::guessLanguage(file, "");
+    auto key =
+        std::format("{}:{}", static_cast<int>(language), llvm::sys::path::parent_path(file).str());
+    auto it = styles.find(key);
+    if(it != styles.end()) {
+        return it->second.get();
+    }
+
+    auto style = resolve_style(file);
+    if(!style) {
+        return std::unexpected(std::move(style.error()));
+    }
+    auto& slot = styles[key];
+    slot = std::make_unique<clang::format::FormatStyle>(std::move(*style));
+    return slot.get();
+}
+
 auto document_format(llvm::StringRef file,
                      llvm::StringRef content,
                      std::optional<LocalSourceRange> range,
-                     PositionEncoding encoding) -> std::vector<protocol::TextEdit> {
+                     PositionEncoding encoding,
+                     FormatStyleCache* cache) -> std::vector<protocol::TextEdit> {
     std::vector<protocol::TextEdit> edits;
 
+    std::optional<clang::format::FormatStyle> resolved;
+    const clang::format::FormatStyle* style = nullptr;
+    if(cache) {
+        auto cached = cache->style(file);
+        if(!cached) {
+            LOG_WARN("Failed to format {}: {}", file, cached.error());
+            return edits;
+        }
+        style = *cached;
+    } else {
+        auto fresh = resolve_style(file);
+        if(!fresh) {
+            LOG_WARN("Failed to format {}: {}", file, fresh.error());
+            return edits;
+        }
+        style = &resolved.emplace(std::move(*fresh));
+    }
+
     auto selection =
         range ? tooling::Range(range->begin, range->length()) : tooling::Range(0, content.size());
-    auto replacements = format_content(file, content, selection);
+    auto replacements = format_content(*style, file, content, selection);
     if(!replacements) {
         LOG_WARN("Failed to format {}: {}", file, replacements.error());
         return edits;
@@ -68,4 +162,19 @@ auto document_format(llvm::StringRef file,
     return edits;
 }
 
+auto on_type_format(llvm::StringRef file,
+                    llvm::StringRef content,
+                    std::uint32_t offset,
+                    PositionEncoding encoding,
+                    FormatStyleCache* cache) -> std::vector<protocol::TextEdit> {
+    if(offset == 0 || offset > content.size()) {
+        return {};
+    }
+    auto begin = typed_code_begin(content.take_front(offset));
+    if(!begin) {
+        return {};
+    }
+    return document_format(file, content, LocalSourceRange{*begin, offset}, encoding, cache);
+}
+
 }  // namespace clice::feature
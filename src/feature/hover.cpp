@@ -670,7 +670,8 @@ auto decl_hover(const clang::NamedDecl* decl,
 
     info.name = ast::print_name(*decl);
     const auto* comment_decl = decl_for_comment(decl);
-    info.documentation = ast::decl_comment(context, *comment_decl);
+    info.documentation = options.cache ? options.cache->comment(*comment_decl).str()
+                                       : ast::decl_comment(context, *comment_decl);
     if(info.documentation.empty()) {
         info.documentation = synthesize_documentation(decl);
     }
@@ -1294,7 +1295,7 @@ auto to_protocol_hover(CompilationUnitRef unit,
                        const HoverInfo& info,
                        const HoverOptions& options,
                        PositionEncoding encoding) -> protocol::Hover {
-    auto document = info.present();
+    auto document = info.present(options.cache);
 
     protocol::MarkupContent content;
     if(options.parse_comment_as_markdown) {
@@ -1350,7 +1351,23 @@ void parse_documentation(llvm::StringRef input, markup::Document& output) {
     flush_paragraph();
 }
 
-markup::Document HoverInfo::present() const {
+llvm::StringRef HoverCache::comment(const clang::NamedDecl& decl) {
+    auto [it, inserted] = comments.try_emplace(&decl);
+    if(inserted) {
+        it->second = ast::decl_comment(decl.getASTContext(), decl);
+    }
+    return it->second;
+}
+
+const markup::Document& HoverCache::parsed(llvm::StringRef documentation) {
+    auto [it, inserted] = documents.try_emplace(documentation);
+    if(inserted) {
+        parse_documentation(documentation, it->second);
+    }
+    return it->second;
+}
+
+markup::Document HoverInfo::present(HoverCache* cache) const {
     markup::Document output;
 
     /// Header contains a text of the form:
@@ -1445,7 +1462,9 @@ markup::Document HoverInfo::present() const {
         output.add_paragraph().append_text(buffer);
     }
 
-    if(!documentation.empty()) {
+    if(cache && !documentation.empty()) {
+        output.append(cache->parsed(documentation));
+    } else if(!documentation.empty()) {
         parse_documentation(documentation, output);
     }
 
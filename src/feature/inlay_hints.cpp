@@ -2,6 +2,7 @@
 #include <cassert>
 #include <cstdint>
 #include <format>
+#include <iterator>
 #include <optional>
 #include <ranges>
 #include <string>
@@ -895,32 +896,103 @@ private:
     llvm::DenseSet<const clang::IfStmt*> else_ifs;  // not eligible for names
 };
 
+void sort_hints(std::vector<InlayHint>& hints) {
+    std::ranges::sort(hints, [](const InlayHint& lhs, const InlayHint& rhs) {
+        return std::tie(lhs.offset, lhs.label, lhs.kind, lhs.padding_left, lhs.padding_right) <
+               std::tie(rhs.offset, rhs.label, rhs.kind, rhs.padding_left, rhs.padding_right);
+    });
+    auto unique_begin = std::ranges::unique(hints, [](const InlayHint& lhs, const InlayHint& rhs) {
+        return lhs.offset == rhs.offset && lhs.kind == rhs.kind && lhs.label == rhs.label &&
+               lhs.padding_left == rhs.padding_left && lhs.padding_right == rhs.padding_right;
+    });
+    hints.erase(unique_begin.begin(), unique_begin.end());
+}
+
 }  // namespace
 
+std::vector<LocalSourceRange> InlayHintCache::missing(LocalSourceRange target) const {
+    // Ranges hold the offsets at both ends, so neighbouring parts share
+    // one; hints found twice there are made unique by add().
+    std::vector<LocalSourceRange> parts;
+    auto cursor = target.begin;
+    for(auto& range: covered) {
+        if(range.end < cursor) {
+            continue;
+        }
+        if(range.begin > target.end) {
+            break;
+        }
+        if(range.begin > cursor) {
+            parts.push_back({cursor, range.begin});
+        }
+        if(range.end >= target.end) {
+            return parts;
+        }
+        cursor = range.end;
+    }
+    parts.push_back({cursor, target.end});
+    return parts;
+}
+
+void InlayHintCache::add(llvm::ArrayRef<LocalSourceRange> ranges, std::vector<InlayHint> added) {
+    covered.insert(covered.end(), ranges.begin(), ranges.end());
+    std::ranges::sort(covered, {}, &LocalSourceRange::begin);
+    std::vector<LocalSourceRange> merged;
+    for(auto& range: covered) {
+        if(!merged.empty() && range.begin <= merged.back().end) {
+            merged.back().end = std::max(merged.back().end, range.end);
+        } else {
+            merged.push_back(range);
+        }
+    }
+    covered = std::move(merged);
+
+    hints.insert(hints.end(),
+                 std::make_move_iterator(added.begin()),
+                 std::make_move_iterator(added.end()));
+    sort_hints(hints);
+}
+
+std::vector<InlayHint> InlayHintCache::lookup(LocalSourceRange target) const {
+    auto begin = std::ranges::partition_point(hints, [&](const InlayHint& hint) {
+        return hint.offset < target.begin;
+    });
+    auto end = std::ranges::partition_point(begin, hints.end(), [&](const InlayHint& hint) {
+        return hint.offset <= target.end;
+    });
+    return {begin, end};
+}
+
 auto inlay_hints(CompilationUnitRef unit, LocalSourceRange target, const InlayHintsOptions& options)
     -> std::vector<InlayHint> {
     if(!options.enabled) {
         return {};
     }
 
-    std::vector<InlayHint> raw_hints;
+    auto* cache = options.cache;
+    if(cache && !target.valid()) {
+        target = {0, static_cast<std::uint32_t>(unit.interested_content().size())};
+    }
+    std::vector<LocalSourceRange> parts{target};
+    if(cache) {
+        parts = cache->missing(target);
+    }
 
-    Builder builder(raw_hints, unit, target, options);
-    Visitor visitor(builder, unit, target, options);
-    visitor.TraverseDecl(unit.tu());
+    std::vector<InlayHint> raw_hints;
+    for(auto part: parts) {
+        Builder builder(raw_hints, unit, part, options);
+        Visitor visitor(builder, unit, part, options);
+        visitor.TraverseDecl(unit.tu());
+    }
+    sort_hints(raw_hints);
 
-    std::ranges::sort(raw_hints, [](const InlayHint& lhs, const InlayHint& rhs) {
-        return std::tie(lhs.offset, lhs.label, lhs.kind, lhs.padding_left, lhs.padding_right) <
-               std::tie(rhs.offset, rhs.label, rhs.kind, rhs.padding_left, rhs.padding_right);
-    });
-    auto unique_begin =
-        std::ranges::unique(raw_hints, [](const InlayHint& lhs, const InlayHint& rhs) {
-            return lhs.offset == rhs.offset && lhs.kind == rhs.kind && lhs.label == rhs.label &&
-                   lhs.padding_left == rhs.padding_left && lhs.padding_right == rhs.padding_right;
-        });
-    raw_hints.erase(unique_begin.begin(), unique_begin.end());
-
-    return raw_hints;
+    if(!cache) {
+        return raw_hints;
+    }
+    if(!parts.empty()) {
+        cache->add(parts, std::move(raw_hints));
+    }
+    return cache->lookup(target);
 }
 
 auto inlay_hints(CompilationUnitRef unit,
@@ -928,7 +1000,7 @@ auto inlay_hints(CompilationUnitRef unit,
                  const InlayHintsOptions& options,
                  PositionEncoding encoding) -> std::vector<protocol::InlayHint> {
     auto collected = inlay_hints(unit, target, options);
-    LineMap map(unit.interested_content(), unit.line_starts(), encoding);
+    auto& map = unit.position_map(encoding);
 
     std::vector<protocol::InlayHint> hints;
     hints.reserve(collected.size());
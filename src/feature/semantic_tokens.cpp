@@ -10,6 +10,7 @@
 #include "semantic/symbol_kind.h"
 #include "syntax/lexer.h"
 
+#include "llvm/ADT/StringSet.h"
 #include "clang/AST/Attr.h"
 #include "clang/Basic/IdentifierTable.h"
 #include "clang/Basic/Module.h"
@@ -30,6 +31,45 @@ auto encode_modifiers(std::uint32_t modifiers) -> std::uint32_t {
     return modifiers;
 }
 
+/// The kind of `token`, just read by `lexer`, as told by the text alone.
+/// Identifiers are Invalid but for keywords and the name of a `#define`.
+SymbolKind lexical_kind(const Token& token,
+                        Lexer& lexer,
+                        llvm::StringRef content,
+                        clang::IdentifierTable& identifiers,
+                        const clang::LangOptions& lang_opts) {
+    if(token.is_directive_hash() || token.is_pp_keyword) {
+        return SymbolKind::Directive;
+    }
+
+    switch(token.kind) {
+        case clang::tok::comment: return SymbolKind::Comment;
+        case clang::tok::numeric_constant: return SymbolKind::Number;
+        case clang::tok::char_constant:
+        case clang::tok::wide_char_constant:
+        case clang::tok::utf8_char_constant:
+        case clang::tok::utf16_char_constant:
+        case clang::tok::utf32_char_constant: return SymbolKind::Character;
+        case clang::tok::string_literal:
+        case clang::tok::wide_string_literal:
+        case clang::tok::utf8_string_literal:
+        case clang::tok::utf16_string_literal:
+        case clang::tok::utf32_string_literal: return SymbolKind::String;
+        case clang::tok::header_name: return SymbolKind::Header;
+        case clang::tok::raw_identifier: {
+            auto previous = lexer.last();
+            if(previous.is_pp_keyword && previous.text(content) == "define") {
+                return SymbolKind::Macro;
+            }
+            if(identifiers.get(token.text(content)).isKeyword(lang_opts)) {
+                return SymbolKind::Keyword;
+            }
+            return SymbolKind::Invalid;
+        }
+        default: return SymbolKind::Invalid;
+    }
+}
+
 bool is_dependent(const clang::Decl* D) {
     return isa<clang::UnresolvedUsingValueDecl>(D);
 }
@@ -186,12 +226,19 @@ bool is_virtual(const clang::Decl* decl) {
 
 class SemanticTokensCollector : public SemanticVisitor<SemanticTokensCollector> {
 public:
-    explicit SemanticTokensCollector(CompilationUnitRef unit) : SemanticVisitor(unit, true) {}
+    SemanticTokensCollector(CompilationUnitRef unit, LocalSourceRange range) :
+        SemanticVisitor(unit, true, range) {}
 
     auto collect() -> std::vector<SemanticToken> {
         highlight_lexical(unit.interested_file());
         run();
         highlight_modules();
+        // Lexing and macro references cover the whole file regardless.
+        if(restrict_range.valid()) {
+            std::erase_if(tokens, [&](const SemanticToken& token) {
+                return !token.range.intersects(restrict_range);
+            });
+        }
         merge_tokens();
         return std::move(tokens);
     }
@@ -382,45 +429,7 @@ private:
             if(token.is_eof()) {
                 break;
             }
-
-            SymbolKind kind = SymbolKind::Invalid;
-
-            if(token.is_directive_hash() || token.is_pp_keyword) {
-                kind = SymbolKind::Directive;
-            } else {
-                switch(token.kind) {
-                    case clang::tok::comment: kind = SymbolKind::Comment; break;
-                    case clang::tok::numeric_constant: kind = SymbolKind::Number; break;
-                    case clang::tok::char_constant:
-                    case clang::tok::wide_char_constant:
-                    case clang::tok::utf8_char_constant:
-                    case clang::tok::utf16_char_constant:
-                    case clang::tok::utf32_char_constant: kind = SymbolKind::Character; break;
-                    case clang::tok::string_literal:
-                    case clang::tok::wide_string_literal:
-                    case clang::tok::utf8_string_literal:
-                    case clang::tok::utf16_string_literal:
-                    case clang::tok::utf32_string_literal: kind = SymbolKind::String; break;
-                    case clang::tok::header_name: kind = SymbolKind::Header; break;
-                    case clang::tok::raw_identifier: {
-                        auto previous = lexer.last();
-                        if(previous.is_pp_keyword && previous.text(content) == "define") {
-                            kind = SymbolKind::Macro;
-                            break;
-                        }
-
-                        auto spelling = token.text(content);
-                        if(identifiers.get(spelling).isKeyword(lang_opts)) {
-                            kind = SymbolKind::Keyword;
-                        }
-                        break;
-                    }
-
-                    default: break;
-                }
-            }
-
-            add_token(fid, token, kind, 0);
+            add_token(fid, token, lexical_kind(token, lexer, content, identifiers, lang_opts), 0);
         }
     }
 
@@ -479,11 +488,10 @@ public:
 
 class SemanticTokenEncoder {
 public:
-    SemanticTokenEncoder(CompilationUnitRef unit,
+    SemanticTokenEncoder(const PositionMap& map,
                          PositionEncoding encoding,
                          protocol::SemanticTokens& output) :
-        map(unit.interested_content(), unit.line_starts(), encoding), encoding(encoding),
-        output(output) {}
+        map(map), encoding(encoding), output(output) {}
 
     void append(const SemanticToken& token) {
         auto content = map.content();
@@ -561,7 +569,7 @@ private:
     }
 
 private:
-    lsp::LineMap map;
+    const PositionMap& map;
     PositionEncoding encoding;
     protocol::SemanticTokens& output;
     std::uint32_t last_line = 0;
@@ -570,19 +578,25 @@ private:
 
 }  // namespace
 
-auto semantic_tokens(CompilationUnitRef unit) -> std::vector<SemanticToken> {
-    SemanticTokensCollector collector(unit);
+auto semantic_tokens(CompilationUnitRef unit, LocalSourceRange range)
+    -> std::vector<SemanticToken> {
+    SemanticTokensCollector collector(unit, range);
     return collector.collect();
 }
 
 auto semantic_tokens(CompilationUnitRef unit, PositionEncoding encoding)
     -> protocol::SemanticTokens {
-    auto tokens = semantic_tokens(unit);
+    return semantic_tokens(unit, LocalSourceRange{}, encoding);
+}
+
+auto semantic_tokens(CompilationUnitRef unit, LocalSourceRange range, PositionEncoding encoding)
+    -> protocol::SemanticTokens {
+    auto tokens = semantic_tokens(unit, range);
 
     protocol::SemanticTokens result;
     result.data.reserve(tokens.size() * 5);
 
-    SemanticTokenEncoder encoder(unit, encoding, result);
+    SemanticTokenEncoder encoder(unit.position_map(encoding), encoding, result);
     for(const auto& token: tokens) {
         encoder.append(token);
     }
@@ -590,4 +604,81 @@ auto semantic_tokens(CompilationUnitRef unit, PositionEncoding encoding)
     return result;
 }
 
+auto semantic_tokens(llvm::StringRef content,
+                     llvm::ArrayRef<SemanticToken> tokens,
+                     PositionEncoding encoding) -> protocol::SemanticTokens {
+    protocol::SemanticTokens result;
+    result.data.reserve(tokens.size() * 5);
+
+    PositionMap map(content, encoding);
+    SemanticTokenEncoder encoder(map, encoding, result);
+    for(const auto& token: tokens) {
+        encoder.append(token);
+    }
+
+    return result;
+}
+
+auto syntactic_semantic_tokens(llvm::StringRef content) -> std::vector<SemanticToken> {
+    auto& lang_opts = cxx_lang_options();
+    clang::IdentifierTable identifiers(lang_opts);
+    Lexer lexer(content, false, &lang_opts);
+    llvm::StringSet<> macros;
+
+    std::vector<SemanticToken> tokens;
+    while(true) {
+        Token token = lexer.advance();
+        if(token.is_eof()) {
+            break;
+        }
+        auto kind = lexical_kind(token, lexer, content, identifiers, lang_opts);
+        if(token.kind == clang::tok::raw_identifier) {
+            // Macros defined earlier in the file are known by their name.
+            auto name = token.text(content);
+            if(kind == SymbolKind::Macro) {
+                macros.insert(name);
+            } else if(kind == SymbolKind::Invalid && macros.contains(name)) {
+                kind = SymbolKind::Macro;
+            }
+        } else if(kind == SymbolKind::Invalid) {
+            continue;
+        }
+        tokens.push_back({.range = token.range, .kind = kind, .modifiers = 0});
+    }
+    return tokens;
+}
+
+auto semantic_tokens_edits(llvm::ArrayRef<std::uint32_t> previous,
+                           llvm::ArrayRef<std::uint32_t> current)
+    -> std::vector<protocol::SemanticTokensEdit> {
+    // Positions are relative to the token before, so an edit changes the
+    // tokens it touches and the first one after; the rest match.
+    constexpr std::size_t stride = 5;
+    auto size = std::min(previous.size(), current.size());
+    std::size_t prefix = 0;
+    while(prefix < size && previous[prefix] == current[prefix]) {
+        prefix += 1;
+    }
+    prefix -= prefix % stride;
+    std::size_t suffix = 0;
+    while(suffix < size - prefix &&
+          previous[previous.size() - 1 - suffix] == current[current.size() - 1 - suffix]) {
+        suffix += 1;
+    }
+    suffix -= suffix % stride;
+
+    std::vector<protocol::SemanticTokensEdit> edits;
+    if(prefix == previous.size() && prefix == current.size()) {
+        return edits;
+    }
+    auto& edit = edits.emplace_back();
+    edit.start = prefix;
+    edit.delete_count = previous.size() - prefix - suffix;
+    auto inserted = current.slice(prefix, current.size() - prefix - suffix);
+    if(!inserted.empty()) {
+        edit.data = std::vector<std::uint32_t>(inserted.begin(), inserted.end());
+    }
+    return edits;
+}
+
 }  // namespace clice::feature
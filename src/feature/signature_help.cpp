@@ -1,12 +1,158 @@
 #include "feature/feature.h"
+#include "semantic/find_target.h"
+#include "semantic/selection.h"
+#include "syntax/lexer.h"
 
+#include "llvm/ADT/SmallPtrSet.h"
 #include "clang/Sema/CodeCompleteConsumer.h"
+#include "clang/Sema/HeuristicResolver.h"
 #include "clang/Sema/Sema.h"
 
 namespace clice::feature {
 
 namespace {
 
+using OverloadCandidate = clang::CodeCompleteConsumer::OverloadCandidate;
+
+clang::PrintingPolicy signature_policy(clang::PrintingPolicy policy) {
+    policy.AnonymousTagLocations = false;
+    policy.SuppressStrongLifetime = true;
+    policy.SuppressUnwrittenScope = true;
+    policy.SuppressScope = true;
+    policy.CleanUglifiedParameters = true;
+    policy.SuppressTemplateArgsInCXXConstructors = true;
+    return policy;
+}
+
+/// Append the signature of `candidate`, named after the template pattern
+/// when it is an instantiation.
+void add_signature(protocol::SignatureHelp& help,
+                   OverloadCandidate candidate,
+                   std::uint32_t current_arg,
+                   const clang::PrintingPolicy& policy) {
+    if(auto* function = candidate.getFunction()) {
+        if(auto* pattern = function->getTemplateInstantiationPattern()) {
+            candidate = OverloadCandidate(pattern);
+        }
+    }
+
+    llvm::SmallString<128> buffer;
+    llvm::raw_svector_ostream stream(buffer);
+
+    auto& signature = help.signatures.emplace_back();
+    signature.active_parameter = protocol::nullable<protocol::uinteger>(current_arg);
+
+    auto add_parameter = [&](auto&& param) {
+        if(!signature.parameters.has_value()) {
+            signature.parameters = std::vector<protocol::ParameterInformation>();
+        }
+
+        if(!signature.parameters->empty()) {
+            stream << ", ";
+        }
+
+        protocol::ParameterInformation parameter;
+        auto begin = static_cast<protocol::uinteger>(buffer.size());
+        param.print(stream, policy);
+        auto end = static_cast<protocol::uinteger>(buffer.size());
+        parameter.label = std::tuple<protocol::uinteger, protocol::uinteger>{begin, end};
+        signature.parameters->push_back(std::move(parameter));
+    };
+
+    switch(candidate.getKind()) {
+        case OverloadCandidate::CK_Function:
+        case OverloadCandidate::CK_FunctionTemplate: {
+            auto* function = candidate.getFunction();
+            function->getDeclName().print(stream, policy);
+            stream << "(";
+            for(auto* parameter: function->parameters()) {
+                add_parameter(*parameter);
+            }
+            stream << ")";
+
+            if(!llvm::isa<clang::CXXConstructorDecl, clang::CXXDestructorDecl>(function)) {
+                stream << " -> ";
+                function->getReturnType().print(stream, policy);
+            }
+            break;
+        }
+
+        case OverloadCandidate::CK_FunctionType: {
+            auto type = candidate.getFunctionType();
+            stream << "(";
+            if(auto* proto = llvm::dyn_cast<clang::FunctionProtoType>(type)) {
+                for(auto param_type: proto->param_types()) {
+                    add_parameter(param_type);
+                }
+            }
+            stream << ") -> ";
+            type->getReturnType().print(stream, policy);
+            break;
+        }
+
+        case OverloadCandidate::CK_FunctionProtoTypeLoc: {
+            auto location = candidate.getFunctionProtoTypeLoc();
+            stream << "(";
+            for(auto param: location.getParams()) {
+                add_parameter(*param);
+            }
+            stream << ") -> ";
+            location.getTypePtr()->getReturnType().print(stream, policy);
+            break;
+        }
+
+        case OverloadCandidate::CK_Template: {
+            auto* declaration = candidate.getTemplate();
+            declaration->getDeclName().print(stream, policy);
+            stream << "<";
+            for(auto* parameter: *declaration->getTemplateParameters()) {
+                add_parameter(*parameter);
+            }
+            stream << ">";
+
+            if(auto* cls = llvm::dyn_cast<clang::ClassTemplateDecl>(declaration)) {
+                stream << " -> " << cls->getTemplatedDecl()->getKindName();
+            } else if(auto* fn = llvm::dyn_cast<clang::FunctionTemplateDecl>(declaration)) {
+                stream << "() -> ";
+                fn->getTemplatedDecl()->getReturnType().print(stream, policy);
+            } else if(auto* alias =
+                          llvm::dyn_cast<clang::TypeAliasTemplateDecl>(declaration)) {
+                stream << " -> ";
+                alias->getTemplatedDecl()->getUnderlyingType().print(stream, policy);
+            } else if(auto* var = llvm::dyn_cast<clang::VarTemplateDecl>(declaration)) {
+                stream << " -> ";
+                var->getTemplatedDecl()->getType().print(stream, policy);
+            } else if(llvm::isa<clang::TemplateTemplateParmDecl>(declaration)) {
+                stream << " -> type";
+            } else if(llvm::isa<clang::ConceptDecl>(declaration)) {
+                stream << " -> concept";
+            }
+            break;
+        }
+
+        case OverloadCandidate::CK_Aggregate: {
+            auto* cls = candidate.getAggregate();
+            cls->getDeclName().print(stream, policy);
+            stream << "{";
+
+            if(auto* record = llvm::dyn_cast<clang::CXXRecordDecl>(cls)) {
+                for(const auto& base: record->bases()) {
+                    add_parameter(base.getType());
+                }
+            }
+
+            for(auto* field: cls->fields()) {
+                add_parameter(*field);
+            }
+            stream << "}";
+            break;
+        }
+    }
+
+
+    signature.label = buffer.str().str();
+}
+
 class SignatureCollector final : public clang::CodeCompleteConsumer {
 public:
     SignatureCollector(protocol::SignatureHelp& help, clang::CodeCompleteOptions complete_options) :
@@ -22,151 +168,191 @@ public:
         help.signatures.reserve(candidate_count);
         help.active_signature = 0;
 
-        auto range = llvm::make_range(candidates, candidates + candidate_count);
-
-        auto policy = sema.getPrintingPolicy();
-        policy.AnonymousTagLocations = false;
-        policy.SuppressStrongLifetime = true;
-        policy.SuppressUnwrittenScope = true;
-        policy.SuppressScope = true;
-        policy.CleanUglifiedParameters = true;
-        policy.SuppressTemplateArgsInCXXConstructors = true;
+        auto policy = signature_policy(sema.getPrintingPolicy());
+        for(auto& candidate: llvm::make_range(candidates, candidates + candidate_count)) {
+            add_signature(help, candidate, current_arg, policy);
+        }
+    }
 
-        for(auto& candidate: range) {
-            if(auto* function = candidate.getFunction()) {
-                if(auto* pattern = function->getTemplateInstantiationPattern()) {
-                    candidate = OverloadCandidate(pattern);
-                }
-            }
+    clang::CodeCompletionAllocator& getAllocator() final {
+        return info.getAllocator();
+    }
 
-            llvm::SmallString<128> buffer;
-            llvm::raw_svector_ostream stream(buffer);
+    clang::CodeCompletionTUInfo& getCodeCompletionTUInfo() final {
+        return info;
+    }
 
-            auto& signature = help.signatures.emplace_back();
-            signature.active_parameter = protocol::nullable<protocol::uinteger>(current_arg);
+private:
+    protocol::SignatureHelp& help;
+    clang::CodeCompletionTUInfo info;
+};
 
-            auto add_parameter = [&](auto&& param) {
-                if(!signature.parameters.has_value()) {
-                    signature.parameters = std::vector<protocol::ParameterInformation>();
-                }
+/// Where the cursor is, as far as the text tells without Sema.
+struct CallSite {
+    /// Not in the arguments of a call: outside any bracket, or in the
+    /// parentheses of a keyword such as `if` or `sizeof`.
+    bool none = false;
+    /// The name before the open bracket.
+    LocalSourceRange callee;
+    std::uint32_t argument = 0;
+};
 
-                if(!signature.parameters->empty()) {
-                    stream << ", ";
+/// Find the innermost bracket open at `offset` and the name before it.
+/// Fails when that is not a plain name, e.g. the `>` of template arguments
+/// or the `)` of a call result, which only a completion parse resolves.
+std::optional<CallSite> find_call_site(CompilationUnitRef unit,
+                                       llvm::StringRef text,
+                                       std::uint32_t offset) {
+    struct Open {
+        clang::tok::TokenKind kind;
+        std::uint32_t commas = 0;
+        std::optional<Token> before;
+    };
+
+    llvm::SmallVector<Open> opens;
+    std::optional<Token> previous;
+    Lexer lexer(text, true, &cxx_lang_options());
+    while(true) {
+        auto token = lexer.advance();
+        if(token.is_eof() || token.range.begin >= offset) {
+            break;
+        }
+        switch(token.kind) {
+            case clang::tok::l_paren:
+            case clang::tok::l_square:
+            case clang::tok::l_brace: opens.push_back({token.kind, 0, previous}); break;
+            case clang::tok::r_paren:
+            case clang::tok::r_square:
+            case clang::tok::r_brace:
+                if(!opens.empty()) {
+                    opens.pop_back();
                 }
-
-                protocol::ParameterInformation parameter;
-                auto begin = static_cast<protocol::uinteger>(buffer.size());
-                param.print(stream, policy);
-                auto end = static_cast<protocol::uinteger>(buffer.size());
-                parameter.label = std::tuple<protocol::uinteger, protocol::uinteger>{begin, end};
-                signature.parameters->push_back(std::move(parameter));
-            };
-
-            switch(candidate.getKind()) {
-                case clang::CodeCompleteConsumer::OverloadCandidate::CK_Function:
-                case clang::CodeCompleteConsumer::OverloadCandidate::CK_FunctionTemplate: {
-                    auto* function = candidate.getFunction();
-                    function->getDeclName().print(stream, policy);
-                    stream << "(";
-                    for(auto* parameter: function->parameters()) {
-                        add_parameter(*parameter);
-                    }
-                    stream << ")";
-
-                    if(!llvm::isa<clang::CXXConstructorDecl, clang::CXXDestructorDecl>(function)) {
-                        stream << " -> ";
-                        function->getReturnType().print(stream, policy);
-                    }
-                    break;
+                break;
+            case clang::tok::comma:
+                if(!opens.empty()) {
+                    opens.back().commas += 1;
                 }
+                break;
+            default: break;
+        }
+        previous = token;
+    }
 
-                case clang::CodeCompleteConsumer::OverloadCandidate::CK_FunctionType: {
-                    auto type = candidate.getFunctionType();
-                    stream << "(";
-                    if(auto* proto = llvm::dyn_cast<clang::FunctionProtoType>(type)) {
-                        for(auto param_type: proto->param_types()) {
-                            add_parameter(param_type);
-                        }
-                    }
-                    stream << ") -> ";
-                    type->getReturnType().print(stream, policy);
-                    break;
-                }
+    if(opens.empty() || opens.back().kind == clang::tok::l_square) {
+        return CallSite{.none = true};
+    }
+    auto& open = opens.back();
+    bool named = open.before && open.before->is_identifier();
+    if(open.kind == clang::tok::l_brace) {
+        // Bodies follow `)` or a keyword; a name may start an initializer
+        // or a class body, which the completion parse tells apart.
+        if(!named) {
+            return CallSite{.none = true};
+        }
+    } else if(!named) {
+        return std::nullopt;
+    }
 
-                case clang::CodeCompleteConsumer::OverloadCandidate::CK_FunctionProtoTypeLoc: {
-                    auto location = candidate.getFunctionProtoTypeLoc();
-                    stream << "(";
-                    for(auto param: location.getParams()) {
-                        add_parameter(*param);
-                    }
-                    stream << ") -> ";
-                    location.getTypePtr()->getReturnType().print(stream, policy);
-                    break;
-                }
+    auto& idents = unit.context().Idents;
+    auto it = idents.find(open.before->text(text));
+    if(it != idents.end() && it->getValue()->isKeyword(unit.lang_options())) {
+        return CallSite{.none = true};
+    }
+    if(open.kind == clang::tok::l_brace) {
+        return std::nullopt;
+    }
+    return CallSite{.callee = open.before->range, .argument = open.commas};
+}
 
-                case clang::CodeCompleteConsumer::OverloadCandidate::CK_Template: {
-                    auto* declaration = candidate.getTemplate();
-                    declaration->getDeclName().print(stream, policy);
-                    stream << "<";
-                    for(auto* parameter: *declaration->getTemplateParameters()) {
-                        add_parameter(*parameter);
-                    }
-                    stream << ">";
-
-                    if(auto* cls = llvm::dyn_cast<clang::ClassTemplateDecl>(declaration)) {
-                        stream << " -> " << cls->getTemplatedDecl()->getKindName();
-                    } else if(auto* fn = llvm::dyn_cast<clang::FunctionTemplateDecl>(declaration)) {
-                        stream << "() -> ";
-                        fn->getTemplatedDecl()->getReturnType().print(stream, policy);
-                    } else if(auto* alias =
-                                  llvm::dyn_cast<clang::TypeAliasTemplateDecl>(declaration)) {
-                        stream << " -> ";
-                        alias->getTemplatedDecl()->getUnderlyingType().print(stream, policy);
-                    } else if(auto* var = llvm::dyn_cast<clang::VarTemplateDecl>(declaration)) {
-                        stream << " -> ";
-                        var->getTemplatedDecl()->getType().print(stream, policy);
-                    } else if(llvm::isa<clang::TemplateTemplateParmDecl>(declaration)) {
-                        stream << " -> type";
-                    } else if(llvm::isa<clang::ConceptDecl>(declaration)) {
-                        stream << " -> concept";
-                    }
-                    break;
-                }
+/// The signatures a call through the declarations found at its callee may
+/// take, each declaration once.
+class CandidateCollector {
+public:
+    void add(const clang::NamedDecl* decl) {
+        decl = decl->getUnderlyingDecl();
+        if(auto* function = llvm::dyn_cast<clang::FunctionDecl>(decl)) {
+            if(auto* primary = function->getPrimaryTemplate()) {
+                decl = primary;
+            }
+        }
 
-                case clang::CodeCompleteConsumer::OverloadCandidate::CK_Aggregate: {
-                    auto* cls = candidate.getAggregate();
-                    cls->getDeclName().print(stream, policy);
-                    stream << "{";
-
-                    if(auto* record = llvm::dyn_cast<clang::CXXRecordDecl>(cls)) {
-                        for(const auto& base: record->bases()) {
-                            add_parameter(base.getType());
-                        }
-                    }
-
-                    for(auto* field: cls->fields()) {
-                        add_parameter(*field);
-                    }
-                    stream << "}";
-                    break;
-                }
+        if(llvm::isa<clang::FunctionDecl, clang::FunctionTemplateDecl>(decl)) {
+            // Overloads of the name in the scope it was found in.
+            auto* context = decl->getDeclContext()->getRedeclContext();
+            for(auto* overload: context->lookup(decl->getDeclName())) {
+                add_function(overload->getUnderlyingDecl());
             }
+            add_function(decl);
+        } else if(auto* record = llvm::dyn_cast<clang::CXXRecordDecl>(decl)) {
+            add_constructors(record);
+        } else if(auto* tmpl = llvm::dyn_cast<clang::ClassTemplateDecl>(decl)) {
+            add_constructors(tmpl->getTemplatedDecl());
+        } else if(auto* alias = llvm::dyn_cast<clang::TypedefNameDecl>(decl)) {
+            add_constructors(alias->getUnderlyingType()->getAsCXXRecordDecl());
+        } else if(auto* value = llvm::dyn_cast<clang::ValueDecl>(decl)) {
+            add_callable(value->getType());
+        }
+    }
 
-            signature.label = buffer.str().str();
+    /// The declared constructors of `record`, or its aggregate
+    /// initialization.  Implicit ones exist only once Sema needed them.
+    void add_constructors(const clang::CXXRecordDecl* record) {
+        record = record ? record->getDefinition() : nullptr;
+        if(!record) {
+            return;
+        }
+        auto count = candidates.size();
+        add_members(record, [](const clang::FunctionDecl* function) {
+            return llvm::isa<clang::CXXConstructorDecl>(function) && !function->isImplicit();
+        });
+        if(candidates.size() == count && record->isAggregate()) {
+            candidates.push_back(OverloadCandidate(record));
         }
     }
 
-    clang::CodeCompletionAllocator& getAllocator() final {
-        return info.getAllocator();
+    llvm::SmallVector<OverloadCandidate> candidates;
+
+private:
+    void add_function(const clang::NamedDecl* decl) {
+        if(!seen.insert(decl->getCanonicalDecl()).second) {
+            return;
+        }
+        if(auto* tmpl = llvm::dyn_cast<clang::FunctionTemplateDecl>(decl)) {
+            candidates.push_back(OverloadCandidate(const_cast<clang::FunctionTemplateDecl*>(tmpl)));
+        } else if(auto* function = llvm::dyn_cast<clang::FunctionDecl>(decl)) {
+            if(!function->isDeleted()) {
+                candidates.push_back(OverloadCandidate(const_cast<clang::FunctionDecl*>(function)));
+            }
+        }
     }
 
-    clang::CodeCompletionTUInfo& getCodeCompletionTUInfo() final {
-        return info;
+    /// Members of `record`, templates included, whose function matches.
+    template <typename Filter>
+    void add_members(const clang::CXXRecordDecl* record, const Filter& filter) {
+        for(auto* member: record->decls()) {
+            auto* function = member->getAsFunction();
+            if(function && filter(function)) {
+                add_function(llvm::cast<clang::NamedDecl>(member));
+            }
+        }
     }
 
-private:
-    protocol::SignatureHelp& help;
-    clang::CodeCompletionTUInfo info;
+    /// Function pointers, and objects with a call operator like lambdas.
+    void add_callable(clang::QualType type) {
+        type = type.getNonReferenceType();
+        if(auto* pointer = type->getAs<clang::PointerType>()) {
+            type = pointer->getPointeeType();
+        }
+        if(auto* function = type->getAs<clang::FunctionType>()) {
+            candidates.push_back(OverloadCandidate(function));
+        } else if(auto* record = type->getAsCXXRecordDecl(); record && record->hasDefinition()) {
+            add_members(record->getDefinition(), [](const clang::FunctionDecl* function) {
+                return function->getOverloadedOperator() == clang::OO_Call;
+            });
+        }
+    }
+
+    llvm::SmallPtrSet<const clang::Decl*, 8> seen;
 };
 
 }  // namespace
@@ -191,4 +377,71 @@ auto signature_help(CompilationParams& params, const SignatureHelpOptions&)
     return help;
 }
 
+auto signature_help(CompilationUnitRef unit,
+                    llvm::StringRef text,
+                    std::uint32_t offset,
+                    llvm::function_ref<std::optional<std::uint32_t>(std::uint32_t)> to_unit,
+                    const SignatureHelpOptions&) -> std::optional<protocol::SignatureHelp> {
+    auto site = find_call_site(unit, text, offset);
+    if(!site) {
+        return std::nullopt;
+    }
+    protocol::SignatureHelp help;
+    if(site->none) {
+        return help;
+    }
+
+    // The callee must be in the AST as it is in the text: a name typed
+    // since is not.
+    auto name = text.slice(site->callee.begin, site->callee.end);
+    auto begin = to_unit(site->callee.begin);
+    auto content = unit.interested_content();
+    if(!begin || content.substr(*begin, name.size()) != name ||
+       to_unit(site->callee.end) != *begin + name.size()) {
+        return std::nullopt;
+    }
+
+    auto tree = SelectionTree::create_right(unit, LocalSourceRange(*begin, *begin));
+    auto* node = tree.common_ancestor();
+    if(!node) {
+        return std::nullopt;
+    }
+
+    CandidateCollector collector;
+    if(auto* decl = node->get<clang::Decl>()) {
+        // `T name(` declares a function, or a variable when T constructs.
+        auto* var = llvm::dyn_cast<clang::VarDecl>(decl);
+        if(!var) {
+            return help;
+        }
+        collector.add_constructors(var->getType()->getAsCXXRecordDecl());
+    } else {
+        clang::HeuristicResolver resolver(unit.context());
+        for(auto* decl:
+            ast::explicit_reference_targets(node->data, ast::DeclRelation::Alias, &resolver)) {
+            collector.add(decl);
+        }
+    }
+    if(collector.candidates.empty()) {
+        return std::nullopt;
+    }
+
+    auto policy = signature_policy(unit.context().getPrintingPolicy());
+    for(auto& candidate: collector.candidates) {
+        add_signature(help, candidate, site->argument, policy);
+    }
+
+    // Sema ranks by viability; short of that, the first that takes the
+    // argument at the cursor.
+    help.active_signature = 0;
+    for(std::uint32_t i = 0; i < help.signatures.size(); ++i) {
+        auto& parameters = help.signatures[i].parameters;
+        if(parameters && parameters->size() > site->argument) {
+            help.active_signature = i;
+            break;
+        }
+    }
+    return help;
+}
+
 }  // namespace clice::feature
@@ -0,0 +1,401 @@
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "feature/feature.h"
+#include "syntax/lexer.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringSwitch.h"
+
+namespace clice::feature {
+
+namespace {
+
+/// Identifiers followed by `(` that never name a declared function.
+bool is_operator_keyword(llvm::StringRef name) {
+    return llvm::StringSwitch<bool>(name)
+        .Cases("alignas", "alignof", "decltype", "noexcept", "sizeof", true)
+        .Cases("static_assert", "requires", "explicit", "typeof", true)
+        .Cases("__attribute__", "__declspec", "_Pragma", "return", true)
+        .Default(false);
+}
+
+bool is_multiline(llvm::StringRef content, LocalSourceRange range) {
+    return content.substr(range.begin, range.length()).contains('\n');
+}
+
+/// Declarations are recognized by the tokens since the last `;`, `{` or
+/// `}`: a tag or namespace keyword and the name after it, or the first
+/// identifier followed by a parameter list.  Templates, attributes and
+/// initializers are skipped over, not understood.
+class OutlineScanner {
+public:
+    explicit OutlineScanner(llvm::StringRef content) :
+        content(content), lexer(content, false, &cxx_lang_options()) {}
+
+    void scan() {
+        while(true) {
+            auto token = lexer.advance();
+            if(token.is_eof()) {
+                break;
+            }
+            if(token.kind == clang::tok::comment) {
+                on_comment(token);
+                continue;
+            }
+            flush_comments();
+            if(token.is_directive_hash()) {
+                on_directive(token);
+                continue;
+            }
+            if(token.is_eod()) {
+                continue;
+            }
+            on_token(token);
+        }
+        flush_comments();
+    }
+
+    std::vector<FoldingRange> ranges;
+    std::vector<DocumentSymbol> symbols;
+
+private:
+    enum class ScopeKind : std::uint8_t {
+        /// Namespaces, `extern "C"` blocks and the file itself: declarations
+        /// in them are listed.
+        Namespace,
+        /// Class bodies: their functions are methods.
+        Class,
+        /// Enums, function bodies, initializers: nothing inside is listed.
+        Opaque,
+    };
+
+    struct Scope {
+        ScopeKind kind;
+        std::uint32_t open;
+        /// Braces inside a declaration (an initializer, a member
+        /// initializer, an argument) that it goes on after.
+        bool nested = false;
+        /// Symbol whose body this is, to set its range end on `}`.
+        DocumentSymbol* symbol = nullptr;
+    };
+
+    /// What the tokens of the current declaration said so far.
+    struct Head {
+        std::uint32_t begin = static_cast<std::uint32_t>(-1);
+        SymbolKind tag = SymbolKind::Invalid;
+        std::optional<LocalSourceRange> name;
+        std::optional<LocalSourceRange> function;
+        bool after_tag = false;
+        bool base_clause = false;
+        bool initializer = false;
+        bool linkage = false;
+        bool member_init = false;
+        int parens = 0;
+        int angles = 0;
+        std::optional<Token> previous;
+    };
+
+    bool listing() const {
+        return scopes.empty() || scopes.back().kind != ScopeKind::Opaque;
+    }
+
+    /// The children of the innermost enclosing symbol.
+    std::vector<DocumentSymbol>& siblings() {
+        for(auto& scope: llvm::reverse(scopes)) {
+            if(scope.symbol) {
+                return scope.symbol->children;
+            }
+        }
+        return symbols;
+    }
+
+    void on_token(const Token& token) {
+        // Nothing in a function body or an initializer is listed, only
+        // its braces matter.
+        if(!listing()) {
+            if(token.kind == clang::tok::l_brace) {
+                scopes.push_back({.kind = ScopeKind::Opaque, .open = token.range.begin});
+            } else if(token.kind == clang::tok::r_brace) {
+                close_brace(token);
+            }
+            return;
+        }
+
+        auto text = token.text(content);
+        if(head.begin == static_cast<std::uint32_t>(-1)) {
+            head.begin = token.range.begin;
+        }
+
+        // Template parameter lists may hold `class`, skip over them.
+        if(head.angles > 0) {
+            if(token.kind == clang::tok::less) {
+                head.angles += 1;
+            } else if(token.kind == clang::tok::greater) {
+                head.angles -= 1;
+            } else if(token.kind == clang::tok::greatergreater) {
+                head.angles = std::max(head.angles - 2, 0);
+            }
+            head.previous = token;
+            return;
+        }
+
+        switch(token.kind) {
+            case clang::tok::l_paren:
+                if(head.parens == 0 && !head.function && !head.initializer &&
+                   head.tag == SymbolKind::Invalid && head.previous &&
+                   head.previous->is_identifier() &&
+                   !is_operator_keyword(head.previous->text(content))) {
+                    head.function = head.previous->range;
+                }
+                head.parens += 1;
+                break;
+            case clang::tok::r_paren: head.parens = std::max(head.parens - 1, 0); break;
+            case clang::tok::l_brace: open_brace(token); return;
+            case clang::tok::r_brace: close_brace(token); return;
+            case clang::tok::semi:
+                if(head.parens == 0) {
+                    end_declaration(token);
+                    return;
+                }
+                break;
+            case clang::tok::equal:
+                if(head.parens == 0) {
+                    head.initializer = true;
+                }
+                break;
+            case clang::tok::colon:
+                if(head.parens != 0 || head.initializer) {
+                    break;
+                }
+                if(head.after_tag) {
+                    head.base_clause = true;
+                } else if(head.function) {
+                    head.member_init = true;
+                } else {
+                    // An access specifier or a label.
+                    head = {};
+                    return;
+                }
+                break;
+            case clang::tok::less:
+                if(head.previous && head.previous->is_identifier() &&
+                   head.previous->text(content) == "template") {
+                    head.angles = 1;
+                }
+                break;
+            case clang::tok::string_literal:
+                if(head.previous && head.previous->is_identifier() &&
+                   head.previous->text(content) == "extern") {
+                    head.linkage = true;
+                }
+                break;
+            case clang::tok::raw_identifier: on_identifier(token, text); break;
+            default: break;
+        }
+        head.previous = token;
+    }
+
+    void on_identifier(const Token& token, llvm::StringRef text) {
+        if(head.parens != 0 || head.initializer || head.function) {
+            return;
+        }
+        auto tag = llvm::StringSwitch<SymbolKind>(text)
+                       .Case("namespace", SymbolKind::Namespace)
+                       .Case("class", SymbolKind::Class)
+                       .Case("struct", SymbolKind::Struct)
+                       .Case("union", SymbolKind::Union)
+                       .Case("enum", SymbolKind::Enum)
+                       .Default(SymbolKind::Invalid);
+        if(tag != SymbolKind::Invalid) {
+            // `enum class` and `enum struct` stay enums.
+            if(head.tag == SymbolKind::Invalid) {
+                head.tag = tag;
+                head.after_tag = true;
+            }
+            return;
+        }
+        if(!head.after_tag || head.base_clause || text == "final" || text == "inline") {
+            return;
+        }
+        // A qualified namespace name keeps its qualifier.
+        if(head.tag == SymbolKind::Namespace && head.name && head.previous &&
+           head.previous->kind == clang::tok::coloncolon) {
+            head.name->end = token.range.end;
+        } else {
+            head.name = token.range;
+        }
+    }
+
+    void open_brace(const Token& token) {
+        Scope scope{.kind = ScopeKind::Opaque, .open = token.range.begin};
+        auto member_init = head.member_init && head.previous &&
+                           (head.previous->is_identifier() ||
+                            head.previous->kind == clang::tok::greater);
+        if(head.parens > 0 || head.initializer || member_init) {
+            scope.nested = true;
+            scopes.push_back(scope);
+            return;
+        }
+
+        if(head.tag == SymbolKind::Namespace || head.linkage) {
+            scope.kind = ScopeKind::Namespace;
+        } else if(head.tag != SymbolKind::Invalid && head.tag != SymbolKind::Enum) {
+            scope.kind = ScopeKind::Class;
+        }
+        scope.symbol = add_symbol(token.range.begin);
+        scopes.push_back(scope);
+        head = {};
+    }
+
+    void close_brace(const Token& token) {
+        if(scopes.empty()) {
+            head = {};
+            return;
+        }
+        auto scope = scopes.pop_back_val();
+        LocalSourceRange range{scope.open, token.range.end};
+        if(is_multiline(content, range)) {
+            ranges.push_back({.range = range, .collapsed_text = "{...}"});
+        }
+        if(scope.symbol) {
+            scope.symbol->range.end = token.range.end;
+        }
+        if(!listing()) {
+            return;
+        }
+        if(scope.nested) {
+            head.previous = token;
+        } else {
+            head = {};
+        }
+    }
+
+    void end_declaration(const Token& token) {
+        if(head.function) {
+            if(auto* symbol = add_symbol(token.range.end)) {
+                symbol->range.end = token.range.end;
+            }
+        }
+        head = {};
+    }
+
+    /// List the declaration `head` describes, if it names anything.
+    DocumentSymbol* add_symbol(std::uint32_t end) {
+        std::optional<LocalSourceRange> name;
+        auto kind = SymbolKind::Invalid;
+        if(head.tag != SymbolKind::Invalid && !head.initializer) {
+            // Anonymous namespaces and unnamed tags are left out.
+            name = head.name;
+            kind = head.tag;
+        } else if(head.function && head.tag == SymbolKind::Invalid) {
+            name = head.function;
+            auto member = !scopes.empty() && scopes.back().kind == ScopeKind::Class;
+            kind = member ? SymbolKind::Method : SymbolKind::Function;
+        }
+        if(!name) {
+            return nullptr;
+        }
+
+        auto& symbol = siblings().emplace_back();
+        symbol.name = content.substr(name->begin, name->length()).str();
+        symbol.kind = kind;
+        symbol.selection_range = *name;
+        symbol.range = {head.begin, end};
+        switch(kind) {
+            case SymbolKind::Class: symbol.detail = "class"; break;
+            case SymbolKind::Struct: symbol.detail = "struct"; break;
+            case SymbolKind::Union: symbol.detail = "union"; break;
+            case SymbolKind::Enum: symbol.detail = "enum"; break;
+            default: break;
+        }
+        return &symbol;
+    }
+
+    void on_directive(const Token& hash) {
+        auto keyword = lexer.advance();
+        if(keyword.is_eod() || keyword.is_eof()) {
+            return;
+        }
+        auto name = keyword.text(content);
+        std::optional<Token> argument;
+        if(name == "pragma" && !lexer.next().is_eod()) {
+            argument = lexer.advance();
+        }
+
+        if(argument && argument->text(content) == "region") {
+            regions.push_back(hash.range.begin);
+        } else if(argument && argument->text(content) == "endregion" && !regions.empty()) {
+            LocalSourceRange range{regions.pop_back_val(), keyword.range.begin};
+            if(is_multiline(content, range)) {
+                ranges.push_back({
+                    .range = range,
+                    .kind = protocol::FoldingRangeKind(protocol::FoldingRangeKind::region),
+                });
+            }
+        }
+
+        while(true) {
+            auto token = lexer.advance();
+            if(token.is_eod() || token.is_eof()) {
+                break;
+            }
+        }
+    }
+
+    /// Line comments on consecutive lines fold together, as one block.
+    void on_comment(const Token& token) {
+        auto line_comment = [&](LocalSourceRange range) {
+            return content.substr(range.begin).starts_with("//");
+        };
+        if(comments && line_comment(*comments) && line_comment(token.range) &&
+           content.slice(comments->end, token.range.begin).count('\n') == 1) {
+            comments->end = token.range.end;
+            return;
+        }
+        flush_comments();
+        comments = token.range;
+    }
+
+    void flush_comments() {
+        if(comments && is_multiline(content, *comments)) {
+            ranges.push_back({
+                .range = *comments,
+                .kind = protocol::FoldingRangeKind(protocol::FoldingRangeKind::comment),
+            });
+        }
+        comments.reset();
+    }
+
+private:
+    llvm::StringRef content;
+    Lexer lexer;
+    Head head;
+    llvm::SmallVector<Scope> scopes;
+    llvm::SmallVector<std::uint32_t> regions;
+    std::optional<LocalSourceRange> comments;
+};
+
+}  // namespace
+
+auto syntactic_folding_ranges(llvm::StringRef content) -> std::vector<FoldingRange> {
+    OutlineScanner scanner(content);
+    scanner.scan();
+    std::ranges::sort(scanner.ranges, [](const FoldingRange& lhs, const FoldingRange& rhs) {
+        return lhs.range.begin < rhs.range.begin;
+    });
+    return std::move(scanner.ranges);
+}
+
+auto syntactic_document_symbols(llvm::StringRef content) -> std::vector<DocumentSymbol> {
+    OutlineScanner scanner(content);
+    scanner.scan();
+    return std::move(scanner.symbols);
+}
+
+}  // namespace clice::feature
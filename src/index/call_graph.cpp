@@ -0,0 +1,157 @@
+#include "index/call_graph.h"
+
+#include <algorithm>
+#include <numeric>
+#include <tuple>
+
+namespace clice::index {
+
+namespace {
+
+using Call = CallGraph::Call;
+
+/// Order of the calls under one key.
+auto site(const Call& call) {
+    return std::tuple(call.file, call.range.begin, call.range.end);
+}
+
+/// Fill `keys` and `offsets` with the runs of equal keys in a sequence
+/// sorted by key.
+template <typename KeyOf>
+void group(std::size_t size,
+           KeyOf key_of,
+           std::vector<SymbolHash>& keys,
+           std::vector<std::uint32_t>& offsets) {
+    keys.clear();
+    offsets.clear();
+    for(std::uint32_t i = 0; i < size; ++i) {
+        auto key = key_of(i);
+        if(keys.empty() || keys.back() != key) {
+            keys.push_back(key);
+            offsets.push_back(i);
+        }
+    }
+    offsets.push_back(size);
+}
+
+/// The positions [begin, end) of the run of `key`, empty if it has none.
+std::pair<std::uint32_t, std::uint32_t> run_of(const std::vector<SymbolHash>& keys,
+                                               const std::vector<std::uint32_t>& offsets,
+                                               SymbolHash key) {
+    auto it = std::ranges::lower_bound(keys, key);
+    if(it == keys.end() || *it != key)
+        return {0, 0};
+    auto i = it - keys.begin();
+    return {offsets[i], offsets[i + 1]};
+}
+
+}  // namespace
+
+std::vector<Call> CallGraph::collect(std::uint32_t file, const MergedIndex& shard) {
+    std::vector<Call> result;
+    shard.referenced_symbols([&](SymbolHash callee) {
+        shard.lookup(callee, RelationKind::Caller, [&](const Relation& relation) {
+            result.push_back({
+                .caller = relation.target_symbol,
+                .callee = callee,
+                .file = file,
+                .range = relation.range,
+            });
+            return true;
+        });
+    });
+    return result;
+}
+
+void CallGraph::set(std::uint32_t file, std::vector<Call> file_calls) {
+    stale.erase(file);
+    auto& entry = files[file];
+    count = count - entry.size() + file_calls.size();
+    entry = std::move(file_calls);
+    packed = false;
+}
+
+void CallGraph::invalidate(std::uint32_t file) {
+    remove(file);
+    stale.insert(file);
+}
+
+void CallGraph::remove(std::uint32_t file) {
+    stale.erase(file);
+    if(auto it = files.find(file); it != files.end()) {
+        count -= it->second.size();
+        files.erase(it);
+        packed = false;
+    }
+}
+
+void CallGraph::clear() {
+    files.clear();
+    stale.clear();
+    count = 0;
+    packed = false;
+}
+
+void CallGraph::refresh(llvm::function_ref<const MergedIndex*(std::uint32_t)> shard) {
+    if(stale.empty())
+        return;
+    auto pending = std::move(stale);
+    stale.clear();
+    for(auto file: pending) {
+        if(auto* index = shard(file))
+            set(file, collect(file, *index));
+    }
+}
+
+void CallGraph::callers(SymbolHash callee, llvm::function_ref<bool(const Call&)> fn) {
+    pack();
+    auto [begin, end] = run_of(callee_keys, callee_offsets, callee);
+    for(auto i = begin; i < end; ++i) {
+        if(!fn(calls[i]))
+            return;
+    }
+}
+
+void CallGraph::callees(SymbolHash caller, llvm::function_ref<bool(const Call&)> fn) {
+    pack();
+    auto [begin, end] = run_of(caller_keys, caller_offsets, caller);
+    for(auto i = begin; i < end; ++i) {
+        if(!fn(calls[by_caller[i]]))
+            return;
+    }
+}
+
+void CallGraph::pack() {
+    if(packed)
+        return;
+    packed = true;
+
+    calls.clear();
+    calls.reserve(count);
+    for(auto& [file, file_calls]: files) {
+        calls.insert(calls.end(), file_calls.begin(), file_calls.end());
+    }
+    std::ranges::sort(calls, [](const Call& lhs, const Call& rhs) {
+        return std::tuple(lhs.callee, site(lhs), lhs.caller) <
+               std::tuple(rhs.callee, site(rhs), rhs.caller);
+    });
+    group(
+        calls.size(),
+        [&](std::uint32_t i) { return calls[i].callee; },
+        callee_keys,
+        callee_offsets);
+
+    by_caller.resize(calls.size());
+    std::iota(by_caller.begin(), by_caller.end(), 0u);
+    std::ranges::sort(by_caller, [&](std::uint32_t lhs, std::uint32_t rhs) {
+        return std::tuple(calls[lhs].caller, site(calls[lhs]), lhs) <
+               std::tuple(calls[rhs].caller, site(calls[rhs]), rhs);
+    });
+    group(
+        by_caller.size(),
+        [&](std::uint32_t i) { return calls[by_caller[i]].caller; },
+        caller_keys,
+        caller_offsets);
+}
+
+}  // namespace clice::index
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "index/merged_index.h"
+#include "index/tu_index.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+
+namespace clice::index {
+
+/// The calls of every MergedIndex shard, packed by callee and by caller so
+/// that call hierarchies of any depth are walked in memory instead of by
+/// looking up each level's relations in the shards.
+///
+/// Calls are kept per shard and replaced as a whole when it is merged;
+/// shards loaded from disk are only read on the first query after it.  The
+/// packed arrays are rebuilt on the next query after any change.
+class CallGraph {
+public:
+    struct Call {
+        SymbolHash caller = 0;
+        SymbolHash callee = 0;
+
+        /// The project path id of the shard the call is in, and its range
+        /// there.
+        std::uint32_t file = 0;
+        LocalSourceRange range;
+    };
+
+    /// The calls recorded in `shard`, by its Caller relations.
+    static std::vector<Call> collect(std::uint32_t file, const MergedIndex& shard);
+
+    /// Replace the calls of `file`.
+    void set(std::uint32_t file, std::vector<Call> calls);
+
+    /// Have refresh() collect the calls of `file` from its shard.
+    void invalidate(std::uint32_t file);
+
+    void remove(std::uint32_t file);
+
+    void clear();
+
+    /// Collect the calls of the invalidated files; `shard` returns the shard
+    /// of a file, or nullptr if it has none.
+    void refresh(llvm::function_ref<const MergedIndex*(std::uint32_t)> shard);
+
+    /// Call `fn` with each call to `callee`, ordered by file and range,
+    /// until it returns false.
+    void callers(SymbolHash callee, llvm::function_ref<bool(const Call&)> fn);
+
+    /// Call `fn` with each call made by `caller`, ordered as above.
+    void callees(SymbolHash caller, llvm::function_ref<bool(const Call&)> fn);
+
+    /// Calls known, not counting invalidated files.
+    std::size_t size() const {
+        return count;
+    }
+
+private:
+    void pack();
+
+    llvm::DenseMap<std::uint32_t, std::vector<Call>> files;
+    llvm::DenseSet<std::uint32_t> stale;
+    std::size_t count = 0;
+
+    /// Every call sorted by callee; `callee_offsets[i]` begins the calls of
+    /// `callee_keys[i]`, the last offset ending them.
+    std::vector<Call> calls;
+    std::vector<SymbolHash> callee_keys;
+    std::vector<std::uint32_t> callee_offsets;
+
+    /// The same calls by caller, as positions in `calls`.
+    std::vector<std::uint32_t> by_caller;
+    std::vector<SymbolHash> caller_keys;
+    std::vector<std::uint32_t> caller_offsets;
+
+    bool packed = true;
+};
+
+}  // namespace clice::index
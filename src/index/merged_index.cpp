@@ -1,5 +1,7 @@
 #include "index/merged_index.h"
 
+#include <algorithm>
+#include <limits>
 #include <ranges>
 #include <tuple>
 
@@ -8,7 +10,9 @@
 
 #include "kota/ipc/lsp/position.h"
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/Support/raw_os_ostream.h"
+#include "llvm/Support/xxhash.h"
 
 namespace llvm {
 
@@ -106,8 +110,9 @@ struct CompilationContext {
 };
 
 struct MergedIndex::Impl {
-    /// The content of corresponding source file.
-    std::string content;
+    /// xxh3 of the source text the entries were indexed from, 0 until some
+    /// text is recorded.  The text itself stays on disk.
+    std::uint64_t content_hash = 0;
 
     /// Line start offsets for position mapping.
     std::vector<std::uint32_t> line_starts;
@@ -126,6 +131,10 @@ struct MergedIndex::Impl {
     /// The same indices will be given same canonical id.
     llvm::StringMap<std::uint32_t> canonical_cache;
 
+    /// SHA256 of the text and preprocessor state a header was indexed under
+    /// (FileIndex::context_hash) → the canonical id of the index it produced.
+    llvm::StringMap<std::uint32_t> context_cache;
+
     /// The max canonical id we have allocated.
     std::uint32_t max_canonical_id = 0;
 
@@ -144,9 +153,33 @@ struct MergedIndex::Impl {
     /// Symbols local to this file (FileLocal) or TU (TULocal).
     SymbolTable symbols;
 
+    /// The doc comments of the symbols declared in this file, as of the
+    /// latest index that recorded them.
+    llvm::DenseMap<SymbolHash, std::string> documents;
+
     /// Sorted occurrences cache for fast lookup.
     std::vector<Occurrence> occurrences_cache;
 
+    /// Drop a context's reference to its canonical index.
+    void release(this Impl& self, std::uint32_t canonical_id) {
+        auto& ref_counts = self.canonical_ref_counts[canonical_id];
+        ref_counts -= 1;
+        if(ref_counts == 0) {
+            self.removed.add(canonical_id);
+        }
+    }
+
+    /// Whether `index` can be merged: a hash-only index needs the entries of
+    /// an earlier merge with that hash.
+    bool can_merge(this const Impl& self, const FileIndex& index) {
+        if(!index.known_hash) {
+            return true;
+        }
+        auto& hash = *index.known_hash;
+        return self.canonical_cache.contains(
+            llvm::StringRef(reinterpret_cast<const char*>(hash.data()), hash.size()));
+    }
+
     void merge(this Impl& self, std::uint32_t path_id, FileIndex& index, auto&& add_context) {
         auto hash = index.hash();
         auto hash_key = llvm::StringRef(reinterpret_cast<char*>(hash.data()), hash.size());
@@ -155,6 +188,12 @@ struct MergedIndex::Impl {
         auto canonical_id = it->second;
         add_context(self, canonical_id);
 
+        if(auto& context = index.context_hash) {
+            auto key = llvm::StringRef(reinterpret_cast<const char*>(context->data()),
+                                       context->size());
+            self.context_cache.insert_or_assign(key, canonical_id);
+        }
+
         if(!success) {
             self.canonical_ref_counts[canonical_id] += 1;
             self.removed.remove(canonical_id);
@@ -172,13 +211,250 @@ struct MergedIndex::Impl {
             }
         }
 
+        for(auto& [symbol_id, text]: index.documents) {
+            self.documents.insert_or_assign(symbol_id, text);
+        }
+
         self.canonical_ref_counts.emplace_back(1);
         self.max_canonical_id += 1;
     }
 
+    /// Drop the removed canonical ids and the entries seen only in them,
+    /// then number the ids left densely, keeping their order.
+    void compact(this Impl& self) {
+        constexpr auto dead = std::numeric_limits<std::uint32_t>::max();
+        std::vector<std::uint32_t> ids(self.max_canonical_id, dead);
+        std::uint32_t live = 0;
+        for(std::uint32_t id = 0; id < self.max_canonical_id; ++id) {
+            if(!self.removed.contains(id)) {
+                ids[id] = live++;
+            }
+        }
+
+        auto renumber = [&](const Bitmap& bitmap) {
+            Bitmap result;
+            for(auto id: bitmap) {
+                if(id < ids.size() && ids[id] != dead) {
+                    result.add(ids[id]);
+                }
+            }
+            result.runOptimize();
+            result.shrinkToFit();
+            return result;
+        };
+
+        auto drop_dead = [&](llvm::StringMap<std::uint32_t>& cache) {
+            for(auto it = cache.begin(); it != cache.end();) {
+                auto current = it++;
+                auto id = current->second;
+                if(id >= ids.size() || ids[id] == dead) {
+                    cache.erase(current);
+                } else {
+                    current->second = ids[id];
+                }
+            }
+        };
+        drop_dead(self.canonical_cache);
+        drop_dead(self.context_cache);
+
+        for(auto& [_, context]: self.header_contexts) {
+            for(auto& include: context.includes) {
+                include.canonical_id = ids[include.canonical_id];
+            }
+        }
+        for(auto& [_, context]: self.compilation_contexts) {
+            context.canonical_id = ids[context.canonical_id];
+        }
+
+        llvm::DenseMap<Occurrence, Bitmap> occurrences;
+        for(auto& [occurrence, bitmap]: self.occurrences) {
+            if(auto result = renumber(bitmap); !result.isEmpty()) {
+                occurrences.try_emplace(occurrence, std::move(result));
+            }
+        }
+        self.occurrences = std::move(occurrences);
+
+        llvm::DenseMap<SymbolHash, llvm::DenseMap<Relation, Bitmap>> relations;
+        for(auto& [symbol, symbol_relations]: self.relations) {
+            for(auto& [relation, bitmap]: symbol_relations) {
+                if(auto result = renumber(bitmap); !result.isEmpty()) {
+                    relations[symbol].try_emplace(relation, std::move(result));
+                }
+            }
+        }
+        self.relations = std::move(relations);
+
+        // A comment outlives the contexts only while the symbol is still here.
+        for(auto it = self.documents.begin(); it != self.documents.end();) {
+            auto current = it++;
+            if(!self.relations.contains(current->first)) {
+                self.documents.erase(current);
+            }
+        }
+
+        std::vector<std::uint32_t> ref_counts(live);
+        for(std::uint32_t id = 0; id < ids.size(); ++id) {
+            if(ids[id] != dead) {
+                ref_counts[ids[id]] = self.canonical_ref_counts[id];
+            }
+        }
+        self.canonical_ref_counts = std::move(ref_counts);
+        self.max_canonical_id = live;
+        self.removed = Bitmap();
+        self.occurrences_cache.clear();
+    }
+
     friend bool operator==(const Impl&, const Impl&) = default;
 };
 
+namespace {
+
+/// The canonical ids dropped from a serialized index, empty if none.
+Bitmap read_removed(const binary::MergedIndex* index) {
+    if(!index->removed() || index->removed()->size() == 0) {
+        return Bitmap();
+    }
+    return read_bitmap(index->removed());
+}
+
+/// Whether every context an entry was seen in has been removed.
+bool all_removed(const fbs::Vector<uint8_t>* context, const Bitmap& removed) {
+    return !removed.isEmpty() && read_bitmap(context).isSubset(removed);
+}
+
+/// Occurrences per block of the serialized layout.  A point lookup binary
+/// searches the block headers and decodes only the blocks in reach.
+constexpr std::size_t occurrence_block_size = 32;
+
+/// Relation kinds fit in the low bits of the varint carrying the context code.
+constexpr unsigned relation_kind_bits = 4;
+static_assert(RelationKind::Callee < (1u << relation_kind_bits));
+
+void write_varint(llvm::SmallVectorImpl<std::uint8_t>& out, std::uint64_t value) {
+    while(value >= 0x80) {
+        out.push_back(static_cast<std::uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(static_cast<std::uint8_t>(value));
+}
+
+std::uint64_t read_varint(const std::uint8_t*& data) {
+    std::uint64_t value = 0;
+    for(unsigned shift = 0;; shift += 7) {
+        auto byte = *data++;
+        value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+        if(!(byte & 0x80)) {
+            return value;
+        }
+    }
+}
+
+/// Whether a relation's target is a symbol, which is dictionary-coded, as
+/// opposed to a definition range or nothing.
+bool targets_symbol(RelationKind kind) {
+    return kind.isBetweenSymbol() || kind.isCall();
+}
+
+/// Decoder for the columnar occurrences and relations of a serialized index.
+///
+/// Occurrences are sorted by (begin, end, target) and cut into blocks; each
+/// entry stores its begin as a delta from the previous one, its length, and
+/// dictionary codes for its target symbol and context bitmap.  Relations are
+/// grouped by symbol and encoded the same way, with the kind packed below
+/// the context code.  Offsets are uint32 deltas, so the unset ranges of
+/// between-symbol relations round-trip too.
+struct Columns {
+    const binary::MergedIndex* root;
+
+    SymbolHash symbol(std::uint64_t code) const {
+        return root->symbol_dictionary()->Get(static_cast<fbs::uoffset_t>(code));
+    }
+
+    const fbs::Vector<uint8_t>* context(std::uint64_t code) const {
+        return root->contexts()->Get(static_cast<fbs::uoffset_t>(code))->bitmap();
+    }
+
+    /// Decode the entries of a block until `fn(occurrence, context)` returns false.
+    bool each_occurrence(const binary::OccurrenceBlock* block,
+                         llvm::function_ref<bool(const Occurrence&, std::uint32_t)> fn) const {
+        auto data = root->occurrence_data()->data() + block->offset();
+        auto begin = block->first_begin();
+        for(std::uint32_t i = 0; i < block->count(); ++i) {
+            Occurrence occurrence;
+            begin += static_cast<std::uint32_t>(read_varint(data));
+            occurrence.range.begin = begin;
+            occurrence.range.end = begin + static_cast<std::uint32_t>(read_varint(data));
+            occurrence.target = symbol(read_varint(data));
+            if(!fn(occurrence, static_cast<std::uint32_t>(read_varint(data)))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// Decode the relations of a symbol until `fn(relation, context)` returns false.
+    bool each_relation(const binary::RelationGroup* group,
+                       llvm::function_ref<bool(const Relation&, std::uint32_t)> fn) const {
+        auto data = root->relation_data()->data() + group->offset();
+        std::uint32_t begin = 0;
+        for(std::uint32_t i = 0; i < group->count(); ++i) {
+            auto packed = read_varint(data);
+            Relation relation{
+                .kind = RelationKind::Kind(packed & ((1u << relation_kind_bits) - 1)),
+            };
+            begin += static_cast<std::uint32_t>(read_varint(data));
+            relation.range.begin = begin;
+            relation.range.end = begin + static_cast<std::uint32_t>(read_varint(data));
+            auto target = read_varint(data);
+            relation.target_symbol =
+                targets_symbol(relation.kind) ? symbol(target) : target;
+            if(!fn(relation, static_cast<std::uint32_t>(packed >> relation_kind_bits))) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+/// The outline of a shard from its live Definition relations.
+std::vector<OutlineEntry> derive_outline(const MergedIndex& index) {
+    std::vector<OutlineEntry> entries;
+    index.referenced_symbols([&](SymbolHash symbol) {
+        index.lookup(symbol, RelationKind::Definition, [&](const Relation& relation) {
+            // An implicit definition has no range of its own; use its name.
+            auto range = std::bit_cast<LocalSourceRange>(relation.target_symbol);
+            if(range.begin >= range.end)
+                range = relation.range;
+            entries.push_back({.symbol = symbol, .range = range, .selection = relation.range});
+            return true;
+        });
+    });
+    arrange_outline(entries);
+    return entries;
+}
+
+}  // namespace
+
+void arrange_outline(std::vector<OutlineEntry>& entries) {
+    auto key = [](const OutlineEntry& entry) {
+        return std::tuple(entry.range.begin, ~entry.range.end, entry.symbol);
+    };
+    std::ranges::sort(entries, {}, key);
+    auto [first, last] = std::ranges::unique(entries, {}, key);
+    entries.erase(first, last);
+
+    // Definitions still open at the current one, innermost last.
+    llvm::SmallVector<std::uint32_t> open;
+    for(std::uint32_t i = 0; i < entries.size(); ++i) {
+        auto& entry = entries[i];
+        while(!open.empty() && entries[open.back()].range.end < entry.range.end) {
+            open.pop_back();
+        }
+        entry.parent = open.empty() ? OutlineEntry::no_parent : open.back();
+        open.push_back(i);
+    }
+}
+
 MergedIndex::MergedIndex(std::unique_ptr<llvm::MemoryBuffer> buffer, std::unique_ptr<Impl> impl) :
     buffer(std::move(buffer)), impl(std::move(impl)) {}
 
@@ -193,12 +469,34 @@ MergedIndex& MergedIndex::operator=(MergedIndex&& other) = default;
 
 MergedIndex::~MergedIndex() = default;
 
+MergedIndex MergedIndex::clone(this const Self& self) {
+    MergedIndex copy;
+    if(self.buffer) {
+        copy.buffer = llvm::MemoryBuffer::getMemBufferCopy(self.buffer->getBuffer(),
+                                                           self.buffer->getBufferIdentifier());
+    }
+    if(self.impl) {
+        copy.impl = std::make_unique<Impl>(*self.impl);
+    }
+    copy.unsaved = self.unsaved;
+    copy.outdated = self.outdated;
+    copy.stale = self.stale;
+    return copy;
+}
+
 void MergedIndex::load_in_memory(this Self& self) {
     if(self.impl) {
         return;
     }
 
     self.impl = std::make_unique<MergedIndex::Impl>();
+    if(self.stale) {
+        // Nothing of a blob too old to upgrade survives a modification.
+        self.stale = false;
+        self.buffer.reset();
+        self.context_occurrences.clear();
+        return;
+    }
     if(!self.buffer) {
         return;
     }
@@ -212,6 +510,13 @@ void MergedIndex::load_in_memory(this Self& self) {
         index.canonical_cache.try_emplace(entry->sha256()->string_view(), entry->canonical_id());
     }
 
+    if(auto contexts = root->context_cache()) {
+        for(auto entry: *contexts) {
+            index.context_cache.try_emplace(entry->sha256()->string_view(),
+                                            entry->canonical_id());
+        }
+    }
+
     index.canonical_ref_counts.resize(index.max_canonical_id, 0);
 
     for(auto entry: *root->header_contexts()) {
@@ -247,28 +552,46 @@ void MergedIndex::load_in_memory(this Self& self) {
         index.removed = read_bitmap(root->removed());
     }
 
-    for(auto entry: *root->occurrences()) {
-        index.occurrences.try_emplace(*safe_cast<Occurrence>(entry->occurrence()),
-                                      read_bitmap(entry->context()));
+    // The columns are not optional, but a blob of another layout lacks them.
+    llvm::SmallVector<Bitmap, 0> contexts;
+    if(root->contexts()) {
+        for(auto entry: *root->contexts()) {
+            contexts.emplace_back(read_bitmap(entry->bitmap()));
+        }
     }
 
-    for(auto entry: *root->relations()) {
-        auto& relations = index.relations[entry->symbol()];
-        for(auto relation_entry: *entry->relations()) {
-            relations.try_emplace(*safe_cast<Relation>(relation_entry->relation()),
-                                  read_bitmap(relation_entry->context()));
+    Columns columns{root};
+    if(root->occurrence_blocks()) {
+        for(auto block: *root->occurrence_blocks()) {
+            columns.each_occurrence(block, [&](const Occurrence& occurrence, std::uint32_t ctx) {
+                index.occurrences.try_emplace(occurrence, contexts[ctx]);
+                return true;
+            });
         }
     }
 
-    if(root->content()) {
-        index.content = root->content()->str();
+    if(root->relation_groups()) {
+        for(auto group: *root->relation_groups()) {
+            auto& relations = index.relations[group->symbol()];
+            columns.each_relation(group, [&](const Relation& relation, std::uint32_t context) {
+                relations.try_emplace(relation, contexts[context]);
+                return true;
+            });
+        }
+    }
+
+    // Blobs from before version 2 embed the text instead of its hash.
+    if(root->content_hash()) {
+        index.content_hash = root->content_hash();
+    } else if(root->content()) {
+        index.content_hash = llvm::xxh3_64bits(root->content()->string_view());
     }
 
     if(root->line_starts() && root->line_starts()->size() > 0) {
         auto* ls = root->line_starts();
         index.line_starts.assign(ls->begin(), ls->end());
-    } else if(!index.content.empty()) {
-        index.line_starts = kota::ipc::lsp::build_line_starts(index.content);
+    } else if(root->content() && root->content()->size() > 0) {
+        index.line_starts = kota::ipc::lsp::build_line_starts(root->content()->string_view());
     }
 
     if(root->symbols()) {
@@ -284,15 +607,59 @@ void MergedIndex::load_in_memory(this Self& self) {
         }
     }
 
+    if(root->documents()) {
+        for(auto entry: *root->documents()) {
+            index.documents.try_emplace(entry->symbol(),
+                                        entry->text() ? entry->text()->str() : "");
+        }
+    }
+
     self.buffer.reset();
 }
 
+void MergedIndex::seal(this Self& self) {
+    if(!self.impl) {
+        if(!self.outdated) {
+            return;
+        }
+        self.load_in_memory();
+    }
+    self.outdated = false;
+
+    llvm::SmallString<4096> data;
+    llvm::raw_svector_ostream os(data);
+    self.serialize(os);
+    self.buffer = llvm::MemoryBuffer::getMemBufferCopy(data);
+    self.impl.reset();
+    self.unsaved = true;
+}
+
 MergedIndex MergedIndex::load(llvm::StringRef path) {
-    auto buffer = llvm::MemoryBuffer::getFile(path);
+    // No null terminator is needed by FlatBuffers; requiring one would make
+    // LLVM copy page-aligned files to the heap instead of mapping them.
+    // Blobs are replaced by rename, never rewritten in place, so the mapping
+    // stays valid until the shard is inflated or dropped.
+    auto buffer = llvm::MemoryBuffer::getFile(path,
+                                              /*IsText=*/false,
+                                              /*RequiresNullTerminator=*/false);
     if(!buffer) {
         return MergedIndex();
     }
-    return MergedIndex(std::move(*buffer), nullptr);
+
+    auto version = fbs::GetRoot<binary::MergedIndex>((*buffer)->getBufferStart())->version();
+    if(version > merged_index_version) {
+        return MergedIndex();
+    }
+    // A blob too old to upgrade has another layout: nothing of it is read,
+    // and the shard is indexed again.
+    if(version < merged_index_upgradable) {
+        MergedIndex index;
+        index.stale = true;
+        return index;
+    }
+    MergedIndex index(std::move(*buffer), nullptr);
+    index.outdated = version < merged_index_version;
+    return index;
 }
 
 void MergedIndex::serialize(this const Self& self, llvm::raw_ostream& out) {
@@ -316,6 +683,11 @@ void MergedIndex::serialize(this const Self& self, llvm::raw_ostream& out) {
         return binary::CreateCacheEntry(builder, CreateString(builder, hash), canonical_id);
     });
 
+    auto context_cache = transform(index->context_cache, [&](auto&& value) {
+        auto&& [hash, canonical_id] = value;
+        return binary::CreateCacheEntry(builder, CreateString(builder, hash), canonical_id);
+    });
+
     auto header_contexts = transform(index->header_contexts, [&](auto&& value) {
         auto& [path_id, context] = value;
         return binary::CreateHeaderContextEntry(
@@ -336,46 +708,119 @@ void MergedIndex::serialize(this const Self& self, llvm::raw_ostream& out) {
             CreateStructVector<binary::IncludeLocation>(builder, context.include_locations));
     });
 
-    llvm::SmallVector<const Occurrence*> occurrence_keys;
-    occurrence_keys.reserve(index->occurrences.size());
-    auto occurrences = transform(index->occurrences, [&](auto&& value) {
-        auto&& [occurrence, bitmap] = value;
+    // Symbol and context dictionaries shared by the occurrence and relation
+    // columns; most entries of a shard are seen in the same contexts.
+    std::vector<SymbolHash> symbol_dictionary;
+    for(auto& [occurrence, _]: index->occurrences) {
+        symbol_dictionary.emplace_back(occurrence.target);
+    }
+    for(auto& [_, symbol_relations]: index->relations) {
+        for(auto& [relation, _]: symbol_relations) {
+            if(targets_symbol(relation.kind)) {
+                symbol_dictionary.emplace_back(relation.target_symbol);
+            }
+        }
+    }
+    std::ranges::sort(symbol_dictionary);
+    symbol_dictionary.erase(std::unique(symbol_dictionary.begin(), symbol_dictionary.end()),
+                            symbol_dictionary.end());
+
+    llvm::DenseMap<SymbolHash, std::uint32_t> symbol_codes;
+    for(std::uint32_t code = 0; code < symbol_dictionary.size(); ++code) {
+        symbol_codes.try_emplace(symbol_dictionary[code], code);
+    }
+
+    llvm::StringMap<std::uint32_t> context_codes;
+    Offsets<binary::ContextBitmap> contexts;
+    auto context_code = [&](const Bitmap& bitmap) {
         buffer.clear();
         buffer.resize_for_overwrite(bitmap.getSizeInBytes(false));
         bitmap.write(buffer.data(), false);
-        occurrence_keys.emplace_back(&occurrence);
-        return binary::CreateOccurrenceEntry(builder,
-                                             safe_cast<binary::Occurrence>(&occurrence),
-                                             CreateVector(builder, buffer));
-    });
-    std::ranges::sort(std::views::zip(occurrence_keys, occurrences), [](auto lhs, auto rhs) {
-        const auto& lo = *std::get<0>(lhs);
-        const auto& ro = *std::get<0>(rhs);
-        return std::tuple(lo.range.begin, lo.range.end, lo.target) <
-               std::tuple(ro.range.begin, ro.range.end, ro.target);
+        auto [it, inserted] = context_codes.try_emplace(llvm::StringRef(buffer.data(),
+                                                                        buffer.size()),
+                                                        contexts.size());
+        if(inserted) {
+            contexts.emplace_back(
+                binary::CreateContextBitmap(builder, CreateVector(builder, buffer)));
+        }
+        return it->second;
+    };
+
+    llvm::SmallVector<std::pair<const Occurrence*, const Bitmap*>, 0> sorted_occurrences;
+    sorted_occurrences.reserve(index->occurrences.size());
+    for(auto& [occurrence, bitmap]: index->occurrences) {
+        sorted_occurrences.emplace_back(&occurrence, &bitmap);
+    }
+    std::ranges::sort(sorted_occurrences, {}, [](auto& entry) {
+        auto& o = *entry.first;
+        return std::tuple(o.range.begin, o.range.end, o.target);
     });
 
-    llvm::SmallVector<std::uint64_t> relation_keys;
-    relation_keys.reserve(index->relations.size());
-    auto relations = transform(index->relations, [&](auto&& value) {
-        auto&& [symbol_id, symbol_relations] = value;
-        auto relations = transform(symbol_relations, [&](auto&& value) {
-            auto&& [relation, bitmap] = value;
-            buffer.clear();
-            buffer.resize_for_overwrite(bitmap.getSizeInBytes(false));
-            bitmap.write(buffer.data(), false);
-            return binary::CreateRelationEntry(builder,
-                                               safe_cast<binary::Relation>(&relation),
-                                               CreateVector(builder, buffer));
+    // Block headers keep the first begin and the largest end seen up to and
+    // including the block, both non-decreasing, so lookups can bisect them.
+    std::vector<binary::OccurrenceBlock> occurrence_blocks;
+    llvm::SmallVector<std::uint8_t, 0> occurrence_data;
+    std::uint32_t reach = 0;
+    for(std::size_t start = 0; start < sorted_occurrences.size();
+        start += occurrence_block_size) {
+        auto end = std::min(start + occurrence_block_size, sorted_occurrences.size());
+        auto offset = static_cast<std::uint32_t>(occurrence_data.size());
+        auto first_begin = sorted_occurrences[start].first->range.begin;
+        auto previous = first_begin;
+        for(auto i = start; i < end; ++i) {
+            auto& [occurrence, bitmap] = sorted_occurrences[i];
+            auto range = occurrence->range;
+            write_varint(occurrence_data, range.begin - previous);
+            write_varint(occurrence_data, range.end - range.begin);
+            write_varint(occurrence_data, symbol_codes.lookup(occurrence->target));
+            write_varint(occurrence_data, context_code(*bitmap));
+            previous = range.begin;
+            reach = std::max(reach, range.end);
+        }
+        occurrence_blocks.emplace_back(first_begin,
+                                       reach,
+                                       offset,
+                                       static_cast<std::uint32_t>(end - start));
+    }
+
+    llvm::SmallVector<SymbolHash, 0> relation_symbols;
+    for(auto& [symbol_id, _]: index->relations) {
+        relation_symbols.emplace_back(symbol_id);
+    }
+    std::ranges::sort(relation_symbols);
+
+    std::vector<binary::RelationGroup> relation_groups;
+    llvm::SmallVector<std::uint8_t, 0> relation_data;
+    llvm::SmallVector<std::pair<const Relation*, const Bitmap*>, 0> sorted_relations;
+    for(auto symbol_id: relation_symbols) {
+        sorted_relations.clear();
+        for(auto& [relation, bitmap]: index->relations.find(symbol_id)->second) {
+            sorted_relations.emplace_back(&relation, &bitmap);
+        }
+        std::ranges::sort(sorted_relations, {}, [](auto& entry) {
+            auto& r = *entry.first;
+            return std::tuple(r.range.begin, r.range.end, r.kind.value(), r.target_symbol);
         });
-        relation_keys.emplace_back(symbol_id);
-        return binary::CreateSymbolRelationsEntry(builder,
-                                                  symbol_id,
-                                                  CreateVector(builder, relations));
-    });
-    std::ranges::sort(std::views::zip(relation_keys, relations), {}, [](auto e) {
-        return std::get<0>(e);
-    });
+
+        auto offset = static_cast<std::uint32_t>(relation_data.size());
+        std::uint32_t previous = 0;
+        for(auto& [relation, bitmap]: sorted_relations) {
+            auto range = relation->range;
+            write_varint(relation_data,
+                         std::uint64_t(context_code(*bitmap)) << relation_kind_bits |
+                             relation->kind.value());
+            write_varint(relation_data, range.begin - previous);
+            write_varint(relation_data, range.end - range.begin);
+            write_varint(relation_data,
+                         targets_symbol(relation->kind)
+                             ? symbol_codes.lookup(relation->target_symbol)
+                             : relation->target_symbol);
+            previous = range.begin;
+        }
+        relation_groups.emplace_back(symbol_id,
+                                     offset,
+                                     static_cast<std::uint32_t>(sorted_relations.size()));
+    }
 
     // Serialize removed bitmap.
     buffer.clear();
@@ -385,11 +830,14 @@ void MergedIndex::serialize(this const Self& self, llvm::raw_ostream& out) {
     }
     auto removed = CreateVector(builder, buffer);
 
-    auto content_offset = CreateString(builder, index->content);
     auto line_starts_offset = builder.CreateVector(index->line_starts);
+    auto outline = CreateStructVector<binary::OutlineEntry>(builder, derive_outline(self));
 
+    llvm::SmallVector<SymbolHash> symbol_keys;
+    symbol_keys.reserve(index->symbols.size());
     auto symbols = transform(index->symbols, [&](auto&& value) {
         auto& [symbol_id, symbol] = value;
+        symbol_keys.emplace_back(symbol_id);
         buffer.clear();
         buffer.resize_for_overwrite(symbol.reference_files.getSizeInBytes(false));
         symbol.reference_files.write(buffer.data(), false);
@@ -401,18 +849,41 @@ void MergedIndex::serialize(this const Self& self, llvm::raw_ostream& out) {
                                                               CreateVector(builder, buffer),
                                                               static_cast<uint8_t>(symbol.scope)));
     });
+    std::ranges::sort(std::views::zip(symbol_keys, symbols), {}, [](auto e) {
+        return std::get<0>(e);
+    });
+
+    llvm::SmallVector<SymbolHash> document_keys;
+    document_keys.reserve(index->documents.size());
+    auto documents = transform(index->documents, [&](auto&& value) {
+        auto& [symbol_id, text] = value;
+        document_keys.emplace_back(symbol_id);
+        return binary::CreateDocumentEntry(builder, symbol_id, CreateString(builder, text));
+    });
+    std::ranges::sort(std::views::zip(document_keys, documents), {}, [](auto e) {
+        return std::get<0>(e);
+    });
 
     auto merged_index = binary::CreateMergedIndex(builder,
                                                   index->max_canonical_id,
                                                   CreateVector(builder, canonical_cache),
                                                   CreateVector(builder, header_contexts),
                                                   CreateVector(builder, compilation_contexts),
-                                                  CreateVector(builder, occurrences),
-                                                  CreateVector(builder, relations),
+                                                  CreateVector(builder, symbol_dictionary),
+                                                  CreateVector(builder, contexts),
+                                                  builder.CreateVectorOfStructs(occurrence_blocks),
+                                                  CreateVector(builder, occurrence_data),
+                                                  builder.CreateVectorOfStructs(relation_groups),
+                                                  CreateVector(builder, relation_data),
                                                   removed,
-                                                  content_offset,
+                                                  /*content=*/0,
                                                   line_starts_offset,
-                                                  CreateVector(builder, symbols));
+                                                  CreateVector(builder, symbols),
+                                                  CreateVector(builder, context_cache),
+                                                  merged_index_version,
+                                                  outline,
+                                                  CreateVector(builder, documents),
+                                                  index->content_hash);
     builder.Finish(merged_index);
 
     out.write(safe_cast<char>(builder.GetBufferPointer()), builder.GetSize());
@@ -464,23 +935,110 @@ void MergedIndex::lookup(this const Self& self,
         }
     } else if(self.buffer) {
         auto index = fbs::GetRoot<binary::MergedIndex>(self.buffer->getBufferStart());
-        auto& occurrences = *index->occurrences();
-
-        auto it = std::ranges::lower_bound(occurrences, offset, {}, [](auto o) {
-            return o->occurrence()->range().end();
+        if(!index->occurrence_blocks()) [[unlikely]] {
+            return;
+        }
+        auto removed = read_removed(index);
+        Columns columns{index};
+
+        // Only blocks that start at or before `offset` and whose reach gets
+        // to it can hold a range containing it; both bounds are monotonic.
+        auto& blocks = *index->occurrence_blocks();
+        auto first = std::ranges::lower_bound(blocks, offset, {}, [](auto block) {
+            return block->reach();
+        });
+        auto last = std::ranges::upper_bound(blocks, offset, {}, [](auto block) {
+            return block->first_begin();
         });
 
-        while(it != occurrences.end()) {
-            auto o = safe_cast<Occurrence>(it->occurrence());
-            if(o->range.contains(offset)) {
-                if(!callback(*o)) {
-                    break;
+        bool stopped = false;
+        for(auto it = first; !stopped && it < last; ++it) {
+            columns.each_occurrence(*it, [&](const Occurrence& o, std::uint32_t context) {
+                if(o.range.begin > offset) {
+                    return false;
                 }
+                if(o.range.contains(offset) && !all_removed(columns.context(context), removed)) {
+                    stopped = !callback(o);
+                }
+                return !stopped;
+            });
+        }
+    }
+}
 
-                it++;
-                continue;
+std::optional<std::uint32_t> MergedIndex::context_index(this const Self& self,
+                                                       std::uint32_t host) {
+    if(self.impl) {
+        if(auto it = self.impl->compilation_contexts.find(host);
+           it != self.impl->compilation_contexts.end()) {
+            return it->second.canonical_id;
+        }
+        if(auto it = self.impl->header_contexts.find(host);
+           it != self.impl->header_contexts.end() && !it->second.includes.empty()) {
+            return it->second.includes.front().canonical_id;
+        }
+    } else if(self.buffer) {
+        auto index = fbs::GetRoot<binary::MergedIndex>(self.buffer->getBufferStart());
+        for(auto entry: *index->compilation_contexts()) {
+            if(entry->path_id() == host) {
+                return entry->canonical_id();
+            }
+        }
+        for(auto entry: *index->header_contexts()) {
+            if(entry->path_id() == host && entry->includes()->size() > 0) {
+                return entry->includes()->Get(0)->canonical_id();
             }
+        }
+    }
+    return std::nullopt;
+}
+
+void MergedIndex::lookup_in_context(this const Self& self,
+                                    std::uint32_t canonical_id,
+                                    std::uint32_t offset,
+                                    llvm::function_ref<bool(const Occurrence&)> callback) {
+    auto [cached, inserted] = self.context_occurrences.try_emplace(canonical_id);
+    auto& occurrences = cached->second;
+    if(inserted) {
+        if(self.impl) {
+            for(auto& [o, bitmap]: self.impl->occurrences) {
+                if(bitmap.contains(canonical_id)) {
+                    occurrences.emplace_back(o);
+                }
+            }
+        } else if(self.buffer) {
+            auto index = fbs::GetRoot<binary::MergedIndex>(self.buffer->getBufferStart());
+            if(!index->occurrence_blocks() || !index->contexts()) [[unlikely]] {
+                return;
+            }
+            Columns columns{index};
+
+            // Entries share few distinct context bitmaps; decode each once.
+            llvm::SmallVector<std::int8_t, 0> in_context(index->contexts()->size(), -1);
+            for(auto block: *index->occurrence_blocks()) {
+                columns.each_occurrence(block, [&](const Occurrence& o, std::uint32_t context) {
+                    auto& member = in_context[context];
+                    if(member < 0) {
+                        member = read_bitmap(columns.context(context)).contains(canonical_id);
+                    }
+                    if(member) {
+                        occurrences.emplace_back(o);
+                    }
+                    return true;
+                });
+            }
+        }
+        std::ranges::sort(occurrences, [](const Occurrence& lhs, const Occurrence& rhs) {
+            return std::tuple(lhs.range.begin, lhs.range.end, lhs.target) <
+                   std::tuple(rhs.range.begin, rhs.range.end, rhs.target);
+        });
+    }
 
+    auto it = std::ranges::lower_bound(occurrences, offset, {}, [](const Occurrence& o) {
+        return o.range.end;
+    });
+    for(; it != occurrences.end() && it->range.contains(offset); ++it) {
+        if(!callback(*it)) {
             break;
         }
     }
@@ -514,25 +1072,131 @@ void MergedIndex::lookup(this const Self& self,
         }
     } else if(self.buffer) {
         auto index = fbs::GetRoot<binary::MergedIndex>(self.buffer->getBufferStart());
-        auto& entries = *index->relations();
+        if(!index->relation_groups()) [[unlikely]] {
+            return;
+        }
+        auto& groups = *index->relation_groups();
 
-        auto it = std::ranges::lower_bound(entries, symbol, {}, [](auto e) { return e->symbol(); });
-        if(it == entries.end() || it->symbol() != symbol) [[unlikely]] {
+        auto it = std::ranges::lower_bound(groups, symbol, {}, [](auto g) { return g->symbol(); });
+        if(it == groups.end() || it->symbol() != symbol) [[unlikely]] {
             return;
         }
 
-        for(auto entry: *it->relations()) {
-            auto r = safe_cast<Relation>(entry->relation());
-            if(r->kind & kind) {
-                if(!callback(*r)) {
-                    break;
-                }
+        auto removed = read_removed(index);
+        Columns columns{index};
+        columns.each_relation(*it, [&](const Relation& r, std::uint32_t context) {
+            if(!(r.kind & kind) || all_removed(columns.context(context), removed)) {
+                return true;
+            }
+            return callback(r);
+        });
+    }
+}
+
+void MergedIndex::canonical_hashes(this const Self& self,
+                                   llvm::function_ref<void(llvm::StringRef)> callback) {
+    if(self.impl) {
+        for(auto& entry: self.impl->canonical_cache) {
+            callback(entry.getKey());
+        }
+    } else if(self.buffer) {
+        auto index = fbs::GetRoot<binary::MergedIndex>(self.buffer->getBufferStart());
+        for(auto entry: *index->canonical_cache()) {
+            callback(entry->sha256()->string_view());
+        }
+    }
+}
+
+void MergedIndex::known_contexts(
+    this const Self& self,
+    llvm::function_ref<void(llvm::StringRef context, llvm::StringRef hash)> callback) {
+    // Canonical id → index hash, for the ids a context maps to.
+    llvm::DenseMap<std::uint32_t, llvm::StringRef> hashes;
+    if(self.impl) {
+        if(self.impl->context_cache.empty()) {
+            return;
+        }
+        for(auto& entry: self.impl->canonical_cache) {
+            hashes.try_emplace(entry.getValue(), entry.getKey());
+        }
+        for(auto& entry: self.impl->context_cache) {
+            if(auto it = hashes.find(entry.getValue()); it != hashes.end()) {
+                callback(entry.getKey(), it->second);
+            }
+        }
+    } else if(self.buffer) {
+        auto index = fbs::GetRoot<binary::MergedIndex>(self.buffer->getBufferStart());
+        auto contexts = index->context_cache();
+        if(!contexts || contexts->size() == 0) {
+            return;
+        }
+        for(auto entry: *index->canonical_cache()) {
+            hashes.try_emplace(entry->canonical_id(), entry->sha256()->string_view());
+        }
+        for(auto entry: *contexts) {
+            if(auto it = hashes.find(entry->canonical_id()); it != hashes.end()) {
+                callback(entry->sha256()->string_view(), it->second);
+            }
+        }
+    }
+}
+
+void MergedIndex::included_paths(this const Self& self,
+                                 llvm::function_ref<void(std::uint32_t)> callback) {
+    if(self.impl) {
+        for(auto& [_, context]: self.impl->compilation_contexts) {
+            for(auto& location: context.include_locations) {
+                callback(location.path_id);
+            }
+        }
+    } else if(self.buffer) {
+        auto index = fbs::GetRoot<binary::MergedIndex>(self.buffer->getBufferStart());
+        for(auto context: *index->compilation_contexts()) {
+            for(auto location: *context->include_locations()) {
+                callback(location->path_id());
+            }
+        }
+    }
+}
+
+void MergedIndex::referenced_symbols(this const Self& self,
+                                     llvm::function_ref<void(SymbolHash)> callback) {
+    if(self.impl) {
+        auto& removed = self.impl->removed;
+        for(auto& [symbol, relations]: self.impl->relations) {
+            auto live = std::ranges::any_of(relations, [&](auto& entry) {
+                return removed.isEmpty() || !entry.second.isSubset(removed);
+            });
+            if(live) {
+                callback(symbol);
+            }
+        }
+    } else if(self.buffer) {
+        auto index = fbs::GetRoot<binary::MergedIndex>(self.buffer->getBufferStart());
+        if(!index->relation_groups()) [[unlikely]] {
+            return;
+        }
+        auto removed = read_removed(index);
+        Columns columns{index};
+        for(auto group: *index->relation_groups()) {
+            // each_relation stops, returning false, at the first live relation.
+            auto live = !columns.each_relation(group, [&](const Relation&, std::uint32_t context) {
+                return all_removed(columns.context(context), removed);
+            });
+            if(live) {
+                callback(group->symbol());
             }
         }
     }
 }
 
-bool MergedIndex::need_update(this const Self& self, llvm::ArrayRef<llvm::StringRef> path_mapping) {
+bool MergedIndex::need_update(this const Self& self,
+                              llvm::ArrayRef<llvm::StringRef> path_mapping,
+                              llvm::function_ref<bool(std::uint32_t)> unchanged) {
+    if(self.stale) {
+        return true;
+    }
+
     if(self.impl) {
         if(self.impl->compilation_contexts.empty()) {
             return true;
@@ -551,7 +1215,8 @@ bool MergedIndex::need_update(this const Self& self, llvm::ArrayRef<llvm::String
 
                 auto time = std::chrono::duration_cast<std::chrono::milliseconds>(
                     status.getLastModificationTime().time_since_epoch());
-                if(time.count() > context.build_at) {
+                if(time.count() > context.build_at &&
+                   !(unchanged && unchanged(location.path_id))) {
                     return true;
                 }
             }
@@ -577,7 +1242,8 @@ bool MergedIndex::need_update(this const Self& self, llvm::ArrayRef<llvm::String
 
                 auto time = std::chrono::duration_cast<std::chrono::milliseconds>(
                     status.getLastModificationTime().time_since_epoch());
-                if(time.count() > context->build_at()) {
+                if(time.count() > context->build_at() &&
+                   !(unchanged && unchanged(location->path_id()))) {
                     return true;
                 }
             }
@@ -597,11 +1263,7 @@ void MergedIndex::remove(this Self& self, std::uint32_t path_id) {
     auto hc_it = index.header_contexts.find(path_id);
     if(hc_it != index.header_contexts.end()) {
         for(auto& [_, canonical_id]: hc_it->second.includes) {
-            auto& ref_counts = index.canonical_ref_counts[canonical_id];
-            ref_counts -= 1;
-            if(ref_counts == 0) {
-                index.removed.add(canonical_id);
-            }
+            index.release(canonical_id);
         }
         index.header_contexts.erase(hc_it);
     }
@@ -609,17 +1271,38 @@ void MergedIndex::remove(this Self& self, std::uint32_t path_id) {
     // Handle compilation context removal.
     auto cc_it = index.compilation_contexts.find(path_id);
     if(cc_it != index.compilation_contexts.end()) {
-        auto canonical_id = cc_it->second.canonical_id;
-        auto& ref_counts = index.canonical_ref_counts[canonical_id];
-        ref_counts -= 1;
-        if(ref_counts == 0) {
-            index.removed.add(canonical_id);
-        }
+        index.release(cc_it->second.canonical_id);
         index.compilation_contexts.erase(cc_it);
     }
 
     // Invalidate cached occurrences.
     index.occurrences_cache.clear();
+    self.context_occurrences.clear();
+}
+
+double MergedIndex::garbage_ratio(this const Self& self) {
+    if(self.impl) {
+        if(self.impl->max_canonical_id == 0) {
+            return 0;
+        }
+        return double(self.impl->removed.cardinality()) / self.impl->max_canonical_id;
+    } else if(self.buffer && !self.stale) {
+        auto index = fbs::GetRoot<binary::MergedIndex>(self.buffer->getBufferStart());
+        if(index->max_canonical_id() == 0) {
+            return 0;
+        }
+        return double(read_removed(index).cardinality()) / index->max_canonical_id();
+    }
+    return 0;
+}
+
+void MergedIndex::compact(this Self& self) {
+    self.load_in_memory();
+    if(self.impl->removed.isEmpty()) {
+        return;
+    }
+    self.impl->compact();
+    self.context_occurrences.clear();
 }
 
 bool MergedIndex::find_symbol(this const Self& self,
@@ -636,21 +1319,42 @@ bool MergedIndex::find_symbol(this const Self& self,
     } else if(self.buffer) {
         auto root = fbs::GetRoot<binary::MergedIndex>(self.buffer->getBufferStart());
         if(root->symbols()) {
-            for(auto entry: *root->symbols()) {
-                if(entry->symbol_id() == hash) {
-                    if(auto* s = entry->symbol()) {
-                        if(s->name())
-                            name = s->name()->str();
-                        kind = SymbolKind(static_cast<std::uint8_t>(s->kind()));
-                    }
-                    return true;
+            auto& entries = *root->symbols();
+            auto it = std::ranges::lower_bound(entries, hash, {}, [](auto e) {
+                return e->symbol_id();
+            });
+            if(it != entries.end() && it->symbol_id() == hash) {
+                if(auto* s = it->symbol()) {
+                    if(s->name())
+                        name = s->name()->str();
+                    kind = SymbolKind(static_cast<std::uint8_t>(s->kind()));
                 }
+                return true;
             }
         }
     }
     return false;
 }
 
+std::optional<std::string> MergedIndex::documentation(this const Self& self, SymbolHash hash) {
+    if(self.impl) {
+        if(auto it = self.impl->documents.find(hash); it != self.impl->documents.end()) {
+            return it->second;
+        }
+    } else if(self.buffer) {
+        auto root = fbs::GetRoot<binary::MergedIndex>(self.buffer->getBufferStart());
+        if(auto* entries = root->documents()) {
+            auto it = std::ranges::lower_bound(*entries, hash, {}, [](auto e) {
+                return e->symbol();
+            });
+            if(it != entries->end() && it->symbol() == hash && it->text()) {
+                return it->text()->str();
+            }
+        }
+    }
+    return std::nullopt;
+}
+
 void MergedIndex::merge_symbols(this Self& self, const SymbolTable& symbols) {
     self.load_in_memory();
     for(auto& [hash, symbol]: symbols) {
@@ -663,15 +1367,27 @@ void MergedIndex::merge_symbols(this Self& self, const SymbolTable& symbols) {
     }
 }
 
-void MergedIndex::merge(this Self& self,
+bool MergedIndex::merge(this Self& self,
                         std::uint32_t path_id,
                         std::chrono::milliseconds build_at,
                         std::vector<IncludeLocation> include_locations,
                         FileIndex& index,
                         llvm::StringRef content) {
     self.load_in_memory();
-    self.impl->content = content.str();
-    self.impl->line_starts = kota::ipc::lsp::build_line_starts(self.impl->content);
+    if(!self.impl->can_merge(index)) {
+        return false;
+    }
+    if(!index.known_hash) {
+        self.impl->content_hash = llvm::xxh3_64bits(content);
+        self.impl->line_starts = kota::ipc::lsp::build_line_starts(content);
+    }
+
+    // A recompiled file replaces its previous context.
+    if(auto it = self.impl->compilation_contexts.find(path_id);
+       it != self.impl->compilation_contexts.end()) {
+        self.impl->release(it->second.canonical_id);
+    }
+
     self.impl->merge(path_id, index, [&](Impl& self, std::uint32_t canonical_id) {
         auto& context = self.compilation_contexts[path_id];
         context.canonical_id = canonical_id;
@@ -679,29 +1395,60 @@ void MergedIndex::merge(this Self& self,
         context.include_locations = std::move(include_locations);
     });
     self.impl->occurrences_cache.clear();
+    self.context_occurrences.clear();
+    return true;
 }
 
-void MergedIndex::merge(this Self& self,
-                        std::uint32_t path_id,
+bool MergedIndex::merge(this Self& self,
+                        std::uint32_t host_id,
                         std::uint32_t include_id,
                         FileIndex& index,
                         llvm::StringRef content) {
     self.load_in_memory();
-    if(self.impl->content.empty() && !content.empty()) {
-        self.impl->content = content.str();
-        self.impl->line_starts = kota::ipc::lsp::build_line_starts(self.impl->content);
+    if(!self.impl->can_merge(index)) {
+        return false;
     }
-    self.impl->merge(path_id, index, [&](Impl& self, std::uint32_t canonical_id) {
-        auto& context = self.header_contexts[path_id];
+    if(self.impl->content_hash == 0 && !content.empty()) {
+        self.impl->content_hash = llvm::xxh3_64bits(content);
+        self.impl->line_starts = kota::ipc::lsp::build_line_starts(content);
+    }
+
+    // Likewise the same inclusion seen again by a recompiled source file.
+    if(auto it = self.impl->header_contexts.find(host_id); it != self.impl->header_contexts.end()) {
+        auto& includes = it->second.includes;
+        auto include = std::ranges::find(includes, include_id, &IncludeContext::include_id);
+        if(include != includes.end()) {
+            self.impl->release(include->canonical_id);
+            includes.erase(include);
+        }
+    }
+
+    self.impl->merge(host_id, index, [&](Impl& self, std::uint32_t canonical_id) {
+        auto& context = self.header_contexts[host_id];
         context.includes.emplace_back(include_id, canonical_id);
     });
     self.impl->occurrences_cache.clear();
+    self.context_occurrences.clear();
+    return true;
 }
 
-llvm::StringRef MergedIndex::content(this const Self& self) {
+std::uint64_t MergedIndex::content_hash(this const Self& self) {
     if(self.impl) {
-        return self.impl->content;
+        return self.impl->content_hash;
     } else if(self.buffer) {
+        auto root = fbs::GetRoot<binary::MergedIndex>(self.buffer->getBufferStart());
+        if(root->content_hash()) {
+            return root->content_hash();
+        }
+        if(root->content()) {
+            return llvm::xxh3_64bits(root->content()->string_view());
+        }
+    }
+    return 0;
+}
+
+llvm::StringRef MergedIndex::stored_content(this const Self& self) {
+    if(!self.impl && self.buffer) {
         auto root = fbs::GetRoot<binary::MergedIndex>(self.buffer->getBufferStart());
         if(root->content()) {
             return root->content()->string_view();
@@ -722,6 +1469,21 @@ std::span<const std::uint32_t> MergedIndex::line_starts(this const Self& self) {
     return {};
 }
 
+std::vector<OutlineEntry> MergedIndex::outline(this const Self& self) {
+    if(!self.impl && self.buffer) {
+        auto root = fbs::GetRoot<binary::MergedIndex>(self.buffer->getBufferStart());
+        if(auto* entries = root->outline()) {
+            std::vector<OutlineEntry> result;
+            result.reserve(entries->size());
+            for(auto entry: *entries) {
+                result.emplace_back(*safe_cast<OutlineEntry>(entry));
+            }
+            return result;
+        }
+    }
+    return derive_outline(self);
+}
+
 bool operator==(MergedIndex& lhs, MergedIndex& rhs) {
     lhs.load_in_memory();
     rhs.load_in_memory();
@@ -3,16 +3,37 @@
 #include <chrono>
 #include <cstdint>
 #include <memory>
+#include <optional>
 #include <span>
 #include <vector>
 
 #include "index/tu_index.h"
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/Support/Allocator.h"
 #include "llvm/Support/MemoryBuffer.h"
 
 namespace clice::index {
 
+/// A definition in the outline of a file.
+struct OutlineEntry {
+    constexpr static std::uint32_t no_parent = static_cast<std::uint32_t>(-1);
+
+    SymbolHash symbol = 0;
+
+    /// The whole definition, and its name.
+    LocalSourceRange range;
+    LocalSourceRange selection;
+
+    /// Position in the outline of the innermost definition containing this
+    /// one, or no_parent.
+    std::uint32_t parent = no_parent;
+};
+
+/// Sort definitions by position, outer ones first, drop the repeated ones
+/// and link each to its parent.
+void arrange_outline(std::vector<OutlineEntry>& entries);
+
 class MergedIndex {
 private:
     struct Impl;
@@ -38,7 +59,13 @@ public:
 
     ~MergedIndex();
 
-    /// Load merged index from disk
+    /// A deep copy, for merging into while readers keep using this one.
+    MergedIndex clone(this const Self& self);
+
+    /// Map merged index from disk. Lookups read the mapped buffer directly; it
+    /// is inflated only when the index is modified.  A blob of an older
+    /// schema version is upgraded on its next save, or, if too old for
+    /// that, served until it is re-indexed; a newer one loads empty.
     static MergedIndex load(llvm::StringRef path);
 
     /// Serialize it to binary format.
@@ -49,45 +76,119 @@ public:
                 std::uint32_t offset,
                 llvm::function_ref<bool(const Occurrence&)> callback);
 
+    /// The canonical id of the index this file got in the context of `host`:
+    /// its compilation context if `host` is the file itself, otherwise the
+    /// first inclusion of the file by `host`.  Nullopt if there is none.
+    std::optional<std::uint32_t> context_index(this const Self& self, std::uint32_t host);
+
+    /// Lookup the occurrence in corresponding offset, seen in the index of
+    /// one context only (see context_index()).  The occurrences of a context
+    /// are collected and sorted once, so later lookups are binary searches.
+    void lookup_in_context(this const Self& self,
+                           std::uint32_t canonical_id,
+                           std::uint32_t offset,
+                           llvm::function_ref<bool(const Occurrence&)> callback);
+
     /// Lookup the relations of given symbol.
     void lookup(this const Self& self,
                 SymbolHash symbol,
                 RelationKind kind,
                 llvm::function_ref<bool(const Relation&)> callback);
 
-    /// Whether this index needs rebuilding.
-    bool need_update(this const Self& self, llvm::ArrayRef<llvm::StringRef> path_mapping);
+    /// Call `callback` with every symbol that has a relation in a context
+    /// which is not removed, i.e. the symbols this file references.
+    void referenced_symbols(this const Self& self, llvm::function_ref<void(SymbolHash)> callback);
+
+    /// Whether this index needs rebuilding.  A dependency modified since the
+    /// build still counts as current when `unchanged` says its contents are.
+    bool need_update(this const Self& self,
+                     llvm::ArrayRef<llvm::StringRef> path_mapping,
+                     llvm::function_ref<bool(std::uint32_t)> unchanged = {});
 
     bool need_rewrite() {
-        return impl != nullptr;
+        return impl != nullptr || unsaved || outdated;
+    }
+
+    /// Replace the in-memory data of a shard whose merging is done with its
+    /// compact serialized form.  Lookups keep working on it; the next
+    /// modification inflates it again.  A sealed shard still needs rewriting
+    /// until mark_saved().
+    void seal(this Self& self);
+
+    /// Record that the sealed buffer has been written to disk.  No effect on
+    /// a shard modified since it was sealed.
+    void mark_saved() {
+        unsaved = false;
     }
 
+    /// The fraction of canonical ids whose contexts were all removed: the
+    /// part of the shard compact() would drop.
+    double garbage_ratio(this const Self& self);
+
+    /// Drop the entries only removed contexts had and renumber the canonical
+    /// ids left densely, shrinking the bitmaps.  Lookups are unaffected; the
+    /// shard needs rewriting afterwards.
+    void compact(this Self& self);
+
     /// Remove the index of specific path id.
     void remove(this Self& self, std::uint32_t path_id);
 
-    /// Get the stored source content for position mapping.
-    llvm::StringRef content(this const Self& self);
+    /// xxh3 of the source text the shard was indexed from, 0 if none was.
+    /// Only the hash and the line starts are kept: readers needing the text
+    /// take it from the file, once it still hashes the same.
+    std::uint64_t content_hash(this const Self& self);
+
+    /// The text a blob from before version 2 embeds; empty for newer blobs
+    /// and once the shard is inflated, since it is never written again.
+    llvm::StringRef stored_content(this const Self& self);
 
     /// Get line starts for position mapping.
     std::span<const std::uint32_t> line_starts(this const Self& self);
 
+    /// The definitions of the file, arranged by arrange_outline().  Stored
+    /// in the blob when it is written; a blob written before outlines were
+    /// has them derived from its Definition relations.
+    std::vector<OutlineEntry> outline(this const Self& self);
+
     /// Look up a symbol in this shard's local symbol table.
     bool find_symbol(this const Self& self, SymbolHash hash, std::string& name, SymbolKind& kind);
 
+    /// The doc comment of a symbol declared in this file, if the index
+    /// recorded one.  A binary search of the blob when it is not inflated.
+    std::optional<std::string> documentation(this const Self& self, SymbolHash hash);
+
     /// Add symbols to this shard's local symbol table (idempotent by hash).
     void merge_symbols(this Self& self, const SymbolTable& symbols);
 
-    /// Merge the index with given compilation context.
-    void merge(this Self& self,
+    /// Call `callback` with the hash (FileIndex::hash()) of every index merged
+    /// so far; a hash-only FileIndex with one of them can be merged.
+    void canonical_hashes(this const Self& self,
+                          llvm::function_ref<void(llvm::StringRef)> callback);
+
+    /// Call `callback` with each header context hash (FileIndex::context_hash)
+    /// seen so far and the hash of the index it produced.
+    void known_contexts(
+        this const Self& self,
+        llvm::function_ref<void(llvm::StringRef context, llvm::StringRef hash)> callback);
+
+    /// Call `callback` with the path id of every include location of the
+    /// compilation contexts, possibly repeated.
+    void included_paths(this const Self& self, llvm::function_ref<void(std::uint32_t)> callback);
+
+    /// Merge the index with given compilation context.  Returns false, and
+    /// changes nothing, for a hash-only index whose hash is unknown here.
+    bool merge(this Self& self,
                std::uint32_t path_id,
                std::chrono::milliseconds build_at,
                std::vector<IncludeLocation> include_locations,
                FileIndex& index,
                llvm::StringRef content);
 
-    /// Merge the index with given header context.
-    void merge(this Self& self,
-               std::uint32_t path_id,
+    /// Merge the index with given header context: the inclusion `include_id`
+    /// seen by compiling the source file `host_id`.  Only an earlier context
+    /// of the same host and inclusion is replaced.  Returns false as above.
+    bool merge(this Self& self,
+               std::uint32_t host_id,
                std::uint32_t include_id,
                FileIndex& index,
                llvm::StringRef content);
@@ -102,6 +203,21 @@ private:
 
     /// The in memory data of the index.
     std::unique_ptr<Impl> impl;
+
+    /// Canonical id → the occurrences of that index, sorted by range; filled
+    /// by lookup_in_context() and dropped when the occurrences change.
+    mutable llvm::DenseMap<std::uint32_t, std::vector<Occurrence>> context_occurrences;
+
+    /// Whether the buffer was sealed from in-memory data not yet on disk.
+    bool unsaved = false;
+
+    /// Whether the buffer was loaded from an older schema version that the
+    /// next seal() rewrites in the current one.
+    bool outdated = false;
+
+    /// Whether the blob was too old to upgrade: the shard is empty until it
+    /// is indexed again, from scratch.
+    bool stale = false;
 };
 
 }  // namespace clice::index
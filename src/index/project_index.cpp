@@ -1,5 +1,7 @@
 #include "index/project_index.h"
 
+#include <array>
+
 #include "index/serialization.h"
 
 namespace clice::index {
@@ -16,10 +18,13 @@ llvm::SmallVector<std::uint32_t> ProjectIndex::merge(this ProjectIndex& self, TU
     for(auto& [symbol_id, symbol]: index.symbols) {
         if(symbol.scope != SymbolScope::External)
             continue;
+        self.dirty_segments |= std::uint64_t(1) << segment_of(symbol_id);
         auto& target_symbol = self.symbols[symbol_id];
-        if(target_symbol.name.empty()) {
-            target_symbol.name = symbol.name;
+        if(target_symbol.name == 0) {
+            target_symbol.name = self.names.get(symbol.name);
             target_symbol.kind = symbol.kind;
+            self.name_index.insert(symbol_id, self.name_of(target_symbol));
+            self.add_name_kind(target_symbol.name, symbol.kind);
         }
         for(auto ref: symbol.reference_files) {
             target_symbol.reference_files.add(file_ids_map[ref]);
@@ -29,50 +34,207 @@ llvm::SmallVector<std::uint32_t> ProjectIndex::merge(this ProjectIndex& self, TU
     return file_ids_map;
 }
 
-void ProjectIndex::serialize(this ProjectIndex& self, llvm::raw_ostream& os) {
+void ProjectIndex::update_references(this ProjectIndex& self,
+                                     std::uint32_t path_id,
+                                     llvm::ArrayRef<SymbolHash> added,
+                                     llvm::ArrayRef<SymbolHash> dropped) {
+    auto update = [&](SymbolHash hash, bool referenced) {
+        auto it = self.symbols.find(hash);
+        if(it == self.symbols.end())
+            return;
+        auto& files = it->second.reference_files;
+        if(files.contains(path_id) == referenced)
+            return;
+        if(referenced) {
+            files.add(path_id);
+        } else {
+            files.remove(path_id);
+        }
+        self.dirty_segments |= std::uint64_t(1) << segment_of(hash);
+    };
+
+    for(auto hash: added) {
+        update(hash, true);
+    }
+    for(auto hash: dropped) {
+        update(hash, false);
+    }
+}
+
+void ProjectIndex::update_definitions(
+    this ProjectIndex& self,
+    std::uint32_t path_id,
+    llvm::ArrayRef<std::pair<SymbolHash, DefinitionLocation>> defined,
+    llvm::ArrayRef<SymbolHash> undefined) {
+    for(auto hash: undefined) {
+        auto it = self.symbols.find(hash);
+        if(it == self.symbols.end())
+            continue;
+        auto& definition = it->second.definition;
+        if(definition && definition->path_id == path_id) {
+            definition.reset();
+            self.dirty_segments |= std::uint64_t(1) << segment_of(hash);
+        }
+    }
+
+    for(auto& [hash, location]: defined) {
+        auto it = self.symbols.find(hash);
+        if(it == self.symbols.end())
+            continue;
+        auto& definition = it->second.definition;
+        if(definition != location) {
+            definition = location;
+            self.dirty_segments |= std::uint64_t(1) << segment_of(hash);
+        }
+    }
+}
+
+namespace {
+
+using SymbolEntries = llvm::ArrayRef<const ProjectSymbolTable::value_type*>;
+
+/// Write a ProjectIndex table holding `symbols`, plus the paths and path map
+/// when `header` is set.
+void write_project(ProjectIndex& self,
+                   bool header,
+                   SymbolEntries symbols,
+                   llvm::ArrayRef<std::uint32_t> segments,
+                   llvm::raw_ostream& os) {
     fbs::FlatBufferBuilder builder(1024);
 
     llvm::SmallVector<char, 1024> buffer;
 
-    auto i = 0;
-    auto paths = transform(self.path_pool.paths, [&](llvm::StringRef path) {
-        auto entry =
-            binary::CreatePathEntry(builder, CreateString(builder, self.path_pool.paths[i]), i);
-        i += 1;
-        return entry;
-    });
+    Offsets<binary::PathEntry> paths;
+    llvm::SmallVector<binary::PathMapEntry, 0> indices;
+    if(header) {
+        auto i = 0;
+        paths = transform(self.path_pool.paths, [&](llvm::StringRef path) {
+            auto entry = binary::CreatePathEntry(builder,
+                                                 CreateString(builder, self.path_pool.paths[i]),
+                                                 i);
+            i += 1;
+            return entry;
+        });
 
-    auto indices = transform(self.indices, [&](auto&& value) {
-        auto&& [source, index] = value;
-        return binary::PathMapEntry(source, index);
-    });
+        indices = transform(self.indices, [&](auto&& value) {
+            auto&& [source, index] = value;
+            return binary::PathMapEntry(source, index);
+        });
+    }
+
+    // Symbols sharing a name point at one string in the blob.
+    llvm::DenseMap<StringSet::ID, fbs::Offset<fbs::String>> name_offsets;
+    auto symbol_entries = transform(symbols, [&](const ProjectSymbolTable::value_type* value) {
+        auto& [symbol_id, symbol] = *value;
 
-    auto symbols = transform(self.symbols, [&](auto&& value) {
-        auto& [symbol_id, symbol] = value;
+        auto [name, inserted] = name_offsets.try_emplace(symbol.name);
+        if(inserted) {
+            name->second = CreateString(builder, self.name_of(symbol));
+        }
 
         buffer.clear();
         buffer.resize_for_overwrite(symbol.reference_files.getSizeInBytes(false));
         symbol.reference_files.write(buffer.data(), false);
 
+        std::optional<binary::Definition> definition;
+        if(auto& location = symbol.definition) {
+            definition.emplace(location->path_id,
+                               location->begin_line,
+                               location->begin_character,
+                               location->end_line,
+                               location->end_character);
+        }
+
         return binary::CreateSymbolEntry(builder,
                                          symbol_id,
                                          binary::CreateSymbol(builder,
-                                                              CreateString(builder, symbol.name),
+                                                              name->second,
                                                               symbol.kind.value(),
                                                               CreateVector(builder, buffer),
-                                                              static_cast<uint8_t>(symbol.scope)));
+                                                              static_cast<uint8_t>(symbol.scope),
+                                                              definition ? &*definition : nullptr));
     });
 
     auto project_index =
         binary::CreateProjectIndex(builder,
                                    CreateVector(builder, paths),
                                    CreateStructVector<binary::PathMapEntry>(builder, indices),
-                                   CreateVector(builder, symbols));
+                                   CreateVector(builder, symbol_entries),
+                                   CreateVector(builder, segments),
+                                   project_index_version);
 
     builder.Finish(project_index);
     os.write(safe_cast<const char>(builder.GetBufferPointer()), builder.GetSize());
 }
 
+void read_symbols(const binary::ProjectIndex* root, ProjectIndex& index) {
+    for(auto entry: *root->symbols()) {
+        auto& symbol = index.symbols[entry->symbol_id()];
+        auto* fb_symbol = entry->symbol();
+        if(auto* name = fb_symbol->name()) {
+            symbol.name = index.names.get(name->string_view());
+        }
+        symbol.kind = SymbolKind(static_cast<std::uint8_t>(fb_symbol->kind()));
+        symbol.scope = static_cast<index::SymbolScope>(fb_symbol->scope());
+        symbol.reference_files = read_bitmap(fb_symbol->refs());
+        if(auto* definition = fb_symbol->definition()) {
+            symbol.definition = DefinitionLocation{
+                .path_id = definition->path_id(),
+                .begin_line = definition->begin_line(),
+                .begin_character = definition->begin_character(),
+                .end_line = definition->end_line(),
+                .end_character = definition->end_character(),
+            };
+        }
+        index.name_index.insert(entry->symbol_id(), index.name_of(symbol));
+        index.add_name_kind(symbol.name, symbol.kind);
+    }
+}
+
+}  // namespace
+
+void ProjectIndex::serialize(this ProjectIndex& self, llvm::raw_ostream& os) {
+    llvm::SmallVector<const ProjectSymbolTable::value_type*, 0> symbols;
+    symbols.reserve(self.symbols.size());
+    for(auto& entry: self.symbols) {
+        symbols.emplace_back(&entry);
+    }
+    write_project(self, true, symbols, {}, os);
+}
+
+void ProjectIndex::serialize_header(this ProjectIndex& self, llvm::raw_ostream& os) {
+    write_project(self, true, {}, self.segment_versions, os);
+}
+
+void ProjectIndex::serialize_segments(
+    this ProjectIndex& self,
+    std::uint64_t segments,
+    llvm::function_ref<void(std::uint32_t, llvm::StringRef)> emit) {
+    std::array<llvm::SmallVector<const ProjectSymbolTable::value_type*, 0>, segment_count> buckets;
+    for(auto& entry: self.symbols) {
+        auto segment = segment_of(entry.first);
+        if(segments >> segment & 1) {
+            buckets[segment].emplace_back(&entry);
+        }
+    }
+
+    llvm::SmallString<0> data;
+    for(std::uint32_t segment = 0; segment < segment_count; ++segment) {
+        if(!(segments >> segment & 1)) {
+            continue;
+        }
+        data.clear();
+        llvm::raw_svector_ostream os(data);
+        write_project(self, false, buckets[segment], {}, os);
+        emit(segment, data);
+    }
+}
+
+bool ProjectIndex::readable(const void* data) {
+    auto version = fbs::GetRoot<binary::ProjectIndex>(data)->version();
+    return version >= project_index_upgradable && version <= project_index_version;
+}
+
 ProjectIndex ProjectIndex::from(const void* data) {
     auto root = fbs::GetRoot<binary::ProjectIndex>(data);
 
@@ -94,18 +256,23 @@ ProjectIndex ProjectIndex::from(const void* data) {
         index.indices.try_emplace(entry->source(), entry->index());
     }
 
-    for(auto entry: *root->symbols()) {
-        auto& symbol = index.symbols[entry->symbol_id()];
-        auto* fb_symbol = entry->symbol();
-        if(auto* name = fb_symbol->name()) {
-            symbol.name = name->str();
+    read_symbols(root, index);
+    // Definitions are kept from version 2 on.
+    index.definitions_complete = root->version() >= 2;
+
+    // Blobs written before segmenting carry no versions and stay fully dirty.
+    if(auto* segments = root->segments(); segments && segments->size() == segment_count) {
+        index.segment_versions.assign(segments->begin(), segments->end());
+        if(root->version() == project_index_version) {
+            index.dirty_segments = 0;
         }
-        symbol.kind = SymbolKind(static_cast<std::uint8_t>(fb_symbol->kind()));
-        symbol.scope = static_cast<index::SymbolScope>(fb_symbol->scope());
-        symbol.reference_files = read_bitmap(fb_symbol->refs());
     }
 
     return index;
 }
 
+void ProjectIndex::load_segment(this ProjectIndex& self, const void* data) {
+    read_symbols(fbs::GetRoot<binary::ProjectIndex>(data), self);
+}
+
 }  // namespace clice::index
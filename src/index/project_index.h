@@ -2,9 +2,15 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
 #include <vector>
 
+#include "index/trigram_index.h"
 #include "index/tu_index.h"
+#include "index/type_hierarchy.h"
+#include "support/object_pool.h"
 
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallString.h"
@@ -67,24 +73,165 @@ struct PathPool {
         }
         return cache.find(path);
     }
+
+    /// Move every path under the directory `from` to the same place under
+    /// `to`, keeping its id.  Paths outside `from` are left as they are.
+    void remap(llvm::StringRef from, llvm::StringRef to) {
+        from = from.rtrim('/');
+        to = to.rtrim('/');
+        cache.clear();
+        for(std::uint32_t id = 0; id < paths.size(); ++id) {
+            auto& p = paths[id];
+            if(p.starts_with(from) && (p.size() == from.size() || p[from.size()] == '/')) {
+                p = save((to + p.substr(from.size())).str());
+            }
+            cache.try_emplace(p, id);
+        }
+    }
 };
 
 struct FileInfo {
     std::int64_t mtime;
 };
 
+/// Where a symbol is defined: a file of the project and the range of the
+/// definition's name, in lines and UTF-16 code units as LSP locations are.
+struct DefinitionLocation {
+    std::uint32_t path_id = 0;
+    std::uint32_t begin_line = 0;
+    std::uint32_t begin_character = 0;
+    std::uint32_t end_line = 0;
+    std::uint32_t end_character = 0;
+
+    friend bool operator==(const DefinitionLocation&, const DefinitionLocation&) = default;
+};
+
+/// A symbol of the project table.  Its name is an id into
+/// ProjectIndex::names, so the many symbols sharing a name (overloads,
+/// specializations, members of the same name) store it once.
+struct ProjectSymbol {
+    StringSet::ID name = 0;
+
+    SymbolKind kind;
+
+    SymbolScope scope = SymbolScope::External;
+
+    /// All files that referenced this symbol.
+    Bitmap reference_files;
+
+    /// Where the symbol is defined, if a merged shard defines it.  Of
+    /// several files defining it, the one merged last.
+    std::optional<DefinitionLocation> definition;
+};
+
+using ProjectSymbolTable = llvm::DenseMap<SymbolHash, ProjectSymbol>;
+
 struct ProjectIndex {
+    /// The symbol table is persisted in segments split by the top bits of the
+    /// symbol hash, so a save only rewrites the segments merges touched.
+    constexpr static std::uint32_t segment_bits = 6;
+    constexpr static std::uint32_t segment_count = 1u << segment_bits;
+
     PathPool path_pool;
 
     llvm::DenseMap<std::uint32_t, std::uint32_t> indices;
 
-    SymbolTable symbols;
+    std::unique_ptr<llvm::BumpPtrAllocator> allocator =
+        std::make_unique<llvm::BumpPtrAllocator>();
+
+    /// Names of `symbols`, interned.
+    StringSet names{allocator.get()};
+
+    ProjectSymbolTable symbols;
+
+    /// Name search over `symbols`, kept in step by merge() and loading.
+    TrigramIndex name_index;
+
+    /// Kind of the symbols of each name, Conflict when they differ; kept
+    /// like `name_index`.
+    llvm::DenseMap<StringSet::ID, SymbolKind> name_kinds;
+
+    /// Inheritance between `symbols`.  Not persisted: the Indexer fills it
+    /// from the shards as they are merged or loaded.
+    TypeHierarchy type_hierarchy;
+
+    /// Version of the blob each segment was last written as; empty until
+    /// the index is saved in segments.  Zero means never written.
+    std::vector<std::uint32_t> segment_versions;
+
+    /// Bit mask of the segments whose symbols changed since they were last
+    /// written.  Everything is dirty unless loaded from segments.
+    std::uint64_t dirty_segments = ~std::uint64_t(0);
+
+    /// False for an index read from a blob written before definitions were
+    /// kept, until they are derived from the shards again.
+    bool definitions_complete = true;
+
+    llvm::StringRef name_of(const ProjectSymbol& symbol) const {
+        return names.get(symbol.name);
+    }
+
+    /// Kind of the symbols named `name`: Invalid when there is none,
+    /// Conflict when they are of several kinds.
+    SymbolKind kind_of(llvm::StringRef name) const {
+        auto it = name_kinds.find(names.find(name));
+        return it == name_kinds.end() ? SymbolKind::Invalid : it->second;
+    }
+
+    void add_name_kind(StringSet::ID name, SymbolKind kind) {
+        auto [it, inserted] = name_kinds.try_emplace(name, kind);
+        if(!inserted && it->second != kind) {
+            it->second = SymbolKind::Conflict;
+        }
+    }
+
+    static std::uint32_t segment_of(SymbolHash symbol) {
+        return static_cast<std::uint32_t>(symbol >> (64 - segment_bits));
+    }
 
     llvm::SmallVector<std::uint32_t> merge(this ProjectIndex& self, TUIndex& index);
 
+    /// Bring the reference files of symbols in step with a shard: `path_id`
+    /// gained references to `added` and no longer references `dropped`.
+    /// Symbols not in the table are ignored.
+    void update_references(this ProjectIndex& self,
+                           std::uint32_t path_id,
+                           llvm::ArrayRef<SymbolHash> added,
+                           llvm::ArrayRef<SymbolHash> dropped);
+
+    /// Bring the definitions of symbols in step with the shard of `path_id`:
+    /// it defines `defined` and none of `undefined`, whose definitions in
+    /// other files are kept.  Symbols not in the table are ignored.
+    void update_definitions(this ProjectIndex& self,
+                            std::uint32_t path_id,
+                            llvm::ArrayRef<std::pair<SymbolHash, DefinitionLocation>> defined,
+                            llvm::ArrayRef<SymbolHash> undefined);
+
+    /// Serialize paths, path map and all symbols into one blob.
     void serialize(this ProjectIndex& self, llvm::raw_ostream& os);
 
+    /// Serialize paths and path map with the current segment versions; the
+    /// symbols are written apart by serialize_segments().
+    void serialize_header(this ProjectIndex& self, llvm::raw_ostream& os);
+
+    /// Serialize the symbols of every segment in the `segments` mask into a
+    /// blob of its own.
+    void serialize_segments(this ProjectIndex& self,
+                            std::uint64_t segments,
+                            llvm::function_ref<void(std::uint32_t, llvm::StringRef)> emit);
+
+    /// Whether from() can read a blob: its schema version is neither newer
+    /// than this code nor too old to upgrade.
+    static bool readable(const void* data);
+
+    /// Load a blob written by serialize() or serialize_header().  A header
+    /// carries no symbols; load its segments with load_segment().  One of
+    /// an older schema version leaves every segment dirty, so the next save
+    /// rewrites the whole index in the current version.
     static ProjectIndex from(const void* data);
+
+    /// Add the symbols of a segment blob.
+    void load_segment(this ProjectIndex& self, const void* data);
 };
 
 }  // namespace clice::index
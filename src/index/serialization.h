@@ -12,6 +12,19 @@ namespace clice::index {
 
 namespace fbs = flatbuffers;
 
+/// Schema versions recorded in MergedIndex and ProjectIndex blobs; blobs
+/// from before versioning read as 0.  Bump one with any change a reader of
+/// the previous version would misread, keeping the loader able to read
+/// the versions from its `upgradable` bound on.  Those are upgraded lazily:
+/// loaded as they are and rewritten in the current version on their next
+/// save.  An older shard is not read at all, but counts as stale so that
+/// indexing replaces it.  Blobs newer than the current version are not
+/// read.  Version 0 shards hold the rows of before the column layout.
+constexpr std::uint32_t merged_index_version = 2;
+constexpr std::uint32_t merged_index_upgradable = 1;
+constexpr std::uint32_t project_index_version = 2;
+constexpr std::uint32_t project_index_upgradable = 0;
+
 namespace {
 
 template <typename Range>
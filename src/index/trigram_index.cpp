@@ -0,0 +1,120 @@
+#include "index/trigram_index.h"
+
+#include <algorithm>
+
+#include "support/fuzzy_matcher.h"
+
+#include "llvm/ADT/SmallVector.h"
+
+namespace clice::index {
+
+namespace {
+
+/// Trigrams use the low 24 bits; prefix tokens are tagged above them.
+std::uint32_t trigram(char a, char b, char c) {
+    return std::uint32_t(std::uint8_t(a)) << 16 | std::uint32_t(std::uint8_t(b)) << 8 |
+           std::uint8_t(c);
+}
+
+std::uint32_t prefix(llvm::StringRef lower) {
+    std::uint32_t token = std::uint32_t(lower.size()) << 24;
+    for(std::size_t i = 0; i < lower.size(); ++i) {
+        token |= std::uint32_t(std::uint8_t(lower[i])) << (8 * i);
+    }
+    return token;
+}
+
+/// Names longer than FuzzyMatcher looks at are cut to the same length.
+constexpr std::size_t max_name = 127;
+
+void name_tokens(llvm::StringRef name, llvm::SmallVectorImpl<std::uint32_t>& tokens) {
+    name = name.take_front(max_name);
+    auto lower = name.lower();
+
+    for(std::size_t size = 1; size <= 2 && size <= lower.size(); ++size) {
+        tokens.push_back(prefix(llvm::StringRef(lower).take_front(size)));
+    }
+
+    for(std::size_t i = 0; i + 2 < lower.size(); ++i) {
+        tokens.push_back(trigram(lower[i], lower[i + 1], lower[i + 2]));
+    }
+
+    llvm::SmallVector<CharRole, max_name> roles(name.size());
+    calculate_roles(name, roles);
+    llvm::SmallVector<char, max_name> heads;
+    for(std::size_t i = 0; i < name.size(); ++i) {
+        if(roles[i] == Head) {
+            heads.push_back(lower[i]);
+        }
+    }
+    for(std::size_t i = 0; i + 2 < heads.size(); ++i) {
+        tokens.push_back(trigram(heads[i], heads[i + 1], heads[i + 2]));
+    }
+
+    std::ranges::sort(tokens);
+    tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+}
+
+void query_tokens(llvm::StringRef query, llvm::SmallVectorImpl<std::uint32_t>& tokens) {
+    auto lower = query.take_front(max_name).lower();
+    if(lower.size() < 3) {
+        tokens.push_back(prefix(lower));
+        return;
+    }
+    for(std::size_t i = 0; i + 2 < lower.size(); ++i) {
+        tokens.push_back(trigram(lower[i], lower[i + 1], lower[i + 2]));
+    }
+}
+
+}  // namespace
+
+void TrigramIndex::insert(SymbolHash symbol, llvm::StringRef name) {
+    if(name.empty()) {
+        return;
+    }
+
+    auto id = static_cast<std::uint32_t>(symbols.size());
+    symbols.push_back(symbol);
+    words.emplace_back(name, roles);
+
+    llvm::SmallVector<std::uint32_t, 64> tokens;
+    name_tokens(name, tokens);
+    for(auto token: tokens) {
+        postings[token].add(id);
+    }
+}
+
+void TrigramIndex::candidates(llvm::StringRef query,
+                              llvm::function_ref<void(SymbolHash, const PreparedWord&)> fn) const {
+    if(query.empty()) {
+        return;
+    }
+
+    llvm::SmallVector<std::uint32_t, 64> tokens;
+    query_tokens(query, tokens);
+
+    llvm::SmallVector<const Bitmap*, 64> lists;
+    for(auto token: tokens) {
+        auto it = postings.find(token);
+        if(it == postings.end()) {
+            return;
+        }
+        lists.push_back(&it->second);
+    }
+
+    // Intersect from the rarest token so the running set stays small.
+    std::ranges::sort(lists, {}, [](const Bitmap* list) { return list->cardinality(); });
+    Bitmap result = *lists.front();
+    for(auto list: llvm::ArrayRef(lists).drop_front()) {
+        if(result.isEmpty()) {
+            return;
+        }
+        result &= *list;
+    }
+
+    for(auto id: result) {
+        fn(symbols[id], words[id]);
+    }
+}
+
+}  // namespace clice::index
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "index/tu_index.h"
+#include "support/bitmap.h"
+#include "support/fuzzy_matcher.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace clice::index {
+
+/// Posting lists from name tokens to symbols, narrowing workspace symbol
+/// search to the names that can match before they are fuzzy-scored.
+///
+/// A name is indexed under its lowercase trigrams, the trigrams of its
+/// segment heads ("fbb" for "fooBarBaz") and its first one and two
+/// characters.  A query of three or more characters must contain only
+/// trigrams the name has; a shorter one must be a prefix of the name.
+///
+/// Each name is also kept as a PreparedWord, so the candidates can be
+/// fuzzy-scored on every keystroke without segmenting them again.  The word
+/// refers to the name, and only its roles are stored here.
+class TrigramIndex {
+public:
+    /// Index the name of `symbol`, which must outlive the index, as the
+    /// interned names of ProjectIndex do.  Each symbol must be inserted once.
+    void insert(SymbolHash symbol, llvm::StringRef name);
+
+    /// Call `fn` with every symbol whose name may match `query`, and the
+    /// name prepared for matching.  Nothing is reported for an empty query.
+    void candidates(llvm::StringRef query,
+                    llvm::function_ref<void(SymbolHash, const PreparedWord&)> fn) const;
+
+    std::size_t size() const {
+        return symbols.size();
+    }
+
+private:
+    /// Dense id (bitmap member) → symbol.
+    std::vector<SymbolHash> symbols;
+
+    /// Dense id → the symbol's name, prepared for FuzzyMatcher, and the
+    /// roles of its characters.
+    std::vector<PreparedWord> words;
+    llvm::BumpPtrAllocator roles;
+
+    /// Packed token → ids of the names containing it.
+    llvm::DenseMap<std::uint32_t, Bitmap> postings;
+};
+
+}  // namespace clice::index
@@ -7,8 +7,12 @@
 #include "semantic/ast_utility.h"
 #include "semantic/semantic_visitor.h"
 
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Parallel.h"
 #include "llvm/Support/SHA256.h"
 #include "clang/AST/DeclCXX.h"
+#include "clang/Lex/MacroInfo.h"
 
 namespace clice::index {
 
@@ -50,6 +54,9 @@ public:
         }
 
         auto [fid, range] = unit.decompose_range(location);
+        if(skipped.contains(fid)) {
+            return;
+        }
         auto& index = result.file_indices[fid];
 
         auto symbol_id = unit.getSymbolID(decl);
@@ -61,6 +68,14 @@ public:
             symbol.scope = classify_scope(decl);
         }
         index.occurrences.emplace_back(range, symbol_id.hash);
+
+        /// The comment is looked up once per file, where the symbol is declared.
+        if(kind.isDeclOrDef() && !index.documents.contains(symbol_id.hash)) {
+            auto comment = ast::decl_comment(unit.context(), *decl);
+            if(!comment.empty()) {
+                index.documents.try_emplace(symbol_id.hash, std::move(comment));
+            }
+        }
     }
 
     void handleMacroOccurrence(const clang::MacroInfo* def,
@@ -72,6 +87,9 @@ public:
         }
 
         auto [fid, range] = unit.decompose_range(location);
+        if(skipped.contains(fid)) {
+            return;
+        }
         auto& index = result.file_indices[fid];
 
         auto symbol_id = unit.getSymbolID(def);
@@ -91,6 +109,9 @@ public:
                         const clang::NamedDecl* target,
                         clang::SourceRange range) {
         auto [fid, relation_range] = unit.decompose_expansion_range(range);
+        if(skipped.contains(fid)) {
+            return;
+        }
 
         Relation relation{.kind = kind};
 
@@ -123,50 +144,161 @@ public:
         index.relations[symbol_id.hash].emplace_back(relation);
     }
 
-    void build() {
+    void build(TUIndex::KnownIndex known, TUIndex::KnownContext known_context) {
+        // Headers are keyed by what they were read under before visiting, so
+        // the ones the receiver has can be left out of the traversal.
+        llvm::DenseMap<clang::FileID, FileIndexHash> contexts;
+        llvm::DenseMap<clang::FileID, FileIndexHash> reused;
+        if(!interested_only) {
+            for(auto& [fid, include]: result.graph.file_table) {
+                if(fid == unit.interested_file() || include == std::uint32_t(-1)) {
+                    continue;
+                }
+                auto context = context_hash(fid);
+                contexts.try_emplace(fid, context);
+                if(!known_context) {
+                    continue;
+                }
+                if(auto hash = known_context(result.graph.paths[result.graph.path_id(fid)],
+                                             context)) {
+                    reused.try_emplace(fid, *hash);
+                    skipped.insert(fid);
+                }
+            }
+        }
+
         run();
 
+        llvm::SmallVector<std::pair<clang::FileID, FileIndex*>> files;
+        files.reserve(result.file_indices.size());
         for(auto& [fid, index]: result.file_indices) {
-            for(auto& [symbol_id, relations]: index.relations) {
-                std::ranges::sort(relations, [](const Relation& lhs, const Relation& rhs) {
-                    return std::tuple(lhs.kind.value(),
-                                      lhs.range.begin,
-                                      lhs.range.end,
-                                      lhs.target_symbol) < std::tuple(rhs.kind.value(),
-                                                                      rhs.range.begin,
-                                                                      rhs.range.end,
-                                                                      rhs.target_symbol);
-                });
-                auto range =
-                    std::ranges::unique(relations, [](const Relation& lhs, const Relation& rhs) {
-                        return lhs.kind == rhs.kind && lhs.range == rhs.range &&
-                               lhs.target_symbol == rhs.target_symbol;
-                    });
-                relations.erase(range.begin(), range.end());
+            files.emplace_back(fid, &index);
+        }
+
+        // Files are finalized independently, so a TU with many headers
+        // spreads the sorting over threads.
+        if(files.size() < parallel_files_threshold) {
+            for(auto& [_, index]: files) {
+                finalize(*index);
+            }
+        } else {
+            llvm::parallelFor(0, files.size(), [&](std::size_t i) { finalize(*files[i].second); });
+        }
+
+        for(auto& [fid, index]: files) {
+            for(auto& [symbol_id, _]: index->relations) {
                 result.symbols[symbol_id].reference_files.add(result.graph.path_id(fid));
             }
+        }
 
-            std::ranges::sort(index.occurrences, [](const Occurrence& lhs, const Occurrence& rhs) {
-                return std::tuple(lhs.range.begin, lhs.range.end, lhs.target) <
-                       std::tuple(rhs.range.begin, rhs.range.end, rhs.target);
-            });
-            auto range =
-                std::ranges::unique(index.occurrences,
-                                    [](const Occurrence& lhs, const Occurrence& rhs) {
-                                        return lhs.range == rhs.range && lhs.target == rhs.target;
-                                    });
-            index.occurrences.erase(range.begin(), range.end());
-
-            if(fid == unit.interested_file()) {
-                result.main_file_index = std::move(index);
+        if(known) {
+            // Drop the entries of headers the receiver has, keeping the hash
+            // it finds them by.  Reference files are already recorded.
+            auto drop_known = [&](std::size_t i) {
+                auto [fid, index] = files[i];
+                if(fid == unit.interested_file() || skipped.contains(fid))
+                    return;
+                auto hash = index->hash();
+                if(known(result.graph.paths[result.graph.path_id(fid)], hash)) {
+                    *index = FileIndex{.known_hash = hash};
+                }
+            };
+            if(files.size() < parallel_files_threshold) {
+                for(std::size_t i = 0; i < files.size(); ++i) {
+                    drop_known(i);
+                }
+            } else {
+                llvm::parallelFor(0, files.size(), drop_known);
+            }
+        }
+
+        for(auto& [fid, hash]: reused) {
+            result.file_indices[fid] = FileIndex{.known_hash = hash};
+        }
+        for(auto& [fid, context]: contexts) {
+            if(auto it = result.file_indices.find(fid); it != result.file_indices.end()) {
+                it->second.context_hash = context;
             }
         }
 
-        result.file_indices.erase(unit.interested_file());
+        auto main = result.file_indices.find(unit.interested_file());
+        if(main != result.file_indices.end()) {
+            result.main_file_index = std::move(main->second);
+            result.file_indices.erase(main);
+        }
     }
 
 private:
+    /// SHA256 of the text of `fid` and of the preprocessor state that decides
+    /// what it declares: the branches taken and the definitions it expands.
+    FileIndexHash context_hash(clang::FileID fid) {
+        using u8 = std::uint8_t;
+
+        llvm::SHA256 hasher;
+        hasher.update(unit.file_content(fid));
+
+        auto it = unit.directives().find(fid);
+        if(it != unit.directives().end()) {
+            for(auto& condition: it->second.conditions) {
+                hasher.update(std::array{u8(condition.kind), u8(condition.value)});
+            }
+            for(auto& macro: it->second.macros) {
+                if(macro.kind != MacroRef::Ref || !macro.macro) {
+                    continue;
+                }
+                hasher.update(std::array{u8(macro.macro->isFunctionLike()),
+                                         u8(macro.macro->getNumParams())});
+                for(auto& token: macro.macro->tokens()) {
+                    hasher.update(unit.token_spelling(token.getLocation()));
+                    hasher.update(" ");
+                }
+                hasher.update("\n");
+            }
+        }
+        return hasher.final();
+    }
+
+    /// Below this many files the thread pool costs more than it saves.
+    constexpr static std::size_t parallel_files_threshold = 16;
+
+    /// Sort and deduplicate the entries of one file.
+    static void finalize(FileIndex& index) {
+        for(auto& [_, relations]: index.relations) {
+            std::ranges::sort(relations, [](const Relation& lhs, const Relation& rhs) {
+                return std::tuple(lhs.kind.value(),
+                                  lhs.range.begin,
+                                  lhs.range.end,
+                                  lhs.target_symbol) < std::tuple(rhs.kind.value(),
+                                                                  rhs.range.begin,
+                                                                  rhs.range.end,
+                                                                  rhs.target_symbol);
+            });
+            auto range =
+                std::ranges::unique(relations, [](const Relation& lhs, const Relation& rhs) {
+                    return lhs.kind == rhs.kind && lhs.range == rhs.range &&
+                           lhs.target_symbol == rhs.target_symbol;
+                });
+            relations.erase(range.begin(), range.end());
+        }
+
+        std::ranges::sort(index.occurrences, [](const Occurrence& lhs, const Occurrence& rhs) {
+            return std::tuple(lhs.range.begin, lhs.range.end, lhs.target) <
+                   std::tuple(rhs.range.begin, rhs.range.end, rhs.target);
+        });
+        auto range =
+            std::ranges::unique(index.occurrences,
+                                [](const Occurrence& lhs, const Occurrence& rhs) {
+                                    return lhs.range == rhs.range && lhs.target == rhs.target;
+                                });
+        index.occurrences.erase(range.begin(), range.end());
+    }
+
     TUIndex& result;
+
+    /// Headers left out because the receiver has their index. Their entries
+    /// are dropped as they are recorded: a declaration in such a header may
+    /// textually include another file, whose entries are still wanted.
+    llvm::DenseSet<clang::FileID> skipped;
 };
 
 }  // namespace
@@ -197,7 +329,11 @@ void FileIndex::lookup(SymbolHash symbol,
     }
 }
 
-std::array<std::uint8_t, 32> FileIndex::hash() {
+FileIndexHash FileIndex::hash() {
+    if(known_hash) {
+        return *known_hash;
+    }
+
     llvm::SHA256 hasher;
 
     using u8 = std::uint8_t;
@@ -210,28 +346,53 @@ std::array<std::uint8_t, 32> FileIndex::hash() {
         hasher.update(llvm::ArrayRef(data, size));
     }
 
-    for(auto& [symbol_id, relations]: relations) {
+    // In symbol order: the map iterates in a different order on the worker
+    // that built the index and on the master that deserialized it.
+    llvm::SmallVector<SymbolHash> symbols;
+    symbols.reserve(relations.size());
+    for(auto& [symbol_id, _]: relations) {
+        symbols.push_back(symbol_id);
+    }
+    std::ranges::sort(symbols);
+
+    for(auto symbol_id: symbols) {
+        auto& entries = relations.find(symbol_id)->second;
         hasher.update(std::bit_cast<std::array<u8, sizeof(symbol_id)>>(symbol_id));
         static_assert(sizeof(Relation) ==
                       sizeof(RelationKind) + 4 + sizeof(Range) + sizeof(SymbolHash));
         static_assert(sizeof(Relation) % 8 == 0);
 
-        if(!relations.empty()) {
-            auto data = reinterpret_cast<u8*>(relations.data());
-            auto size = relations.size() * sizeof(Relation);
+        if(!entries.empty()) {
+            auto data = reinterpret_cast<u8*>(entries.data());
+            auto size = entries.size() * sizeof(Relation);
             hasher.update(llvm::ArrayRef(data, size));
         }
     }
 
+    llvm::SmallVector<SymbolHash> documented;
+    documented.reserve(documents.size());
+    for(auto& [symbol_id, _]: documents) {
+        documented.push_back(symbol_id);
+    }
+    std::ranges::sort(documented);
+
+    for(auto symbol_id: documented) {
+        hasher.update(std::bit_cast<std::array<u8, sizeof(symbol_id)>>(symbol_id));
+        hasher.update(documents.find(symbol_id)->second);
+    }
+
     return hasher.final();
 }
 
-TUIndex TUIndex::build(CompilationUnitRef unit, bool interested_only) {
+TUIndex TUIndex::build(CompilationUnitRef unit,
+                       bool interested_only,
+                       KnownIndex known,
+                       KnownContext known_context) {
     TUIndex index;
     index.built_at = unit.build_at();
 
     Builder builder(index, unit, interested_only);
-    builder.build();
+    builder.build(known, known_context);
 
     return index;
 }
@@ -268,7 +429,24 @@ void TUIndex::serialize(llvm::raw_ostream& os) const {
                 symbol_id,
                 CreateStructVector<binary::Relation>(builder, relations));
         });
-        return binary::CreateTUFileIndexEntry(builder, fid, occs, CreateVector(builder, rels));
+        auto create_hash = [&](const std::optional<FileIndexHash>& hash) {
+            fbs::Offset<fbs::Vector<std::uint8_t>> offset = 0;
+            if(hash) {
+                offset = builder.CreateVector(hash->data(), hash->size());
+            }
+            return offset;
+        };
+        auto docs = transform(index.documents, [&](auto&& value) {
+            auto& [symbol_id, text] = value;
+            return binary::CreateDocumentEntry(builder, symbol_id, CreateString(builder, text));
+        });
+        return binary::CreateTUFileIndexEntry(builder,
+                                              fid,
+                                              occs,
+                                              CreateVector(builder, rels),
+                                              create_hash(index.known_hash),
+                                              create_hash(index.context_hash),
+                                              CreateVector(builder, docs));
     };
 
     /// Convert FileID-keyed file_indices to path_id-keyed entries.
@@ -319,7 +497,15 @@ TUIndex TUIndex::from(const void* data) {
 
     /// Helper to deserialize a TUFileIndexEntry into a FileIndex.
     auto deserialize_file_index = [](const binary::TUFileIndexEntry* entry) -> FileIndex {
+        auto read_hash = [](const fbs::Vector<std::uint8_t>* hash,
+                            std::optional<FileIndexHash>& out) {
+            if(hash && hash->size() == sizeof(FileIndexHash)) {
+                std::ranges::copy(*hash, out.emplace().begin());
+            }
+        };
         FileIndex fi;
+        read_hash(entry->known_hash(), fi.known_hash);
+        read_hash(entry->context_hash(), fi.context_hash);
         if(entry->occurrences()) {
             fi.occurrences.reserve(entry->occurrences()->size());
             for(auto o: *entry->occurrences()) {
@@ -337,6 +523,11 @@ TUIndex TUIndex::from(const void* data) {
                 }
             }
         }
+        if(entry->documents()) {
+            for(auto doc: *entry->documents()) {
+                fi.documents.try_emplace(doc->symbol(), doc->text() ? doc->text()->str() : "");
+            }
+        }
         return fi;
     };
 
@@ -4,6 +4,7 @@
 #include <bit>
 #include <chrono>
 #include <cstdint>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -62,18 +63,34 @@ struct Occurrence {
     friend bool operator==(const Occurrence&, const Occurrence&) = default;
 };
 
+using FileIndexHash = std::array<std::uint8_t, 32>;
+
 struct FileIndex {
     llvm::DenseMap<SymbolHash, std::vector<Relation>> relations;
 
     std::vector<Occurrence> occurrences;
 
+    /// The raw doc comment of each symbol declared in this file that has one.
+    llvm::DenseMap<SymbolHash, std::string> documents;
+
+    /// Set when the builder dropped the entries of this file because the
+    /// receiver already holds an index with this hash; see TUIndex::build().
+    std::optional<FileIndexHash> known_hash;
+
+    /// SHA256 of the header text and the preprocessor state it was read
+    /// under (branches taken, definitions of the macros it expands).  Unset
+    /// for the main file.
+    std::optional<FileIndexHash> context_hash;
+
     void lookup(std::uint32_t offset, llvm::function_ref<bool(const Occurrence&)> callback) const;
 
     void lookup(SymbolHash symbol,
                 RelationKind kind,
                 llvm::function_ref<bool(const Relation&)> callback) const;
 
-    std::array<std::uint8_t, 32> hash();
+    /// SHA256 of the entries, independent of the order of `relations`; the
+    /// known hash for an index without entries.
+    FileIndexHash hash();
 };
 
 struct Symbol {
@@ -108,7 +125,24 @@ struct TUIndex {
 
     FileIndex main_file_index;
 
-    static TUIndex build(CompilationUnitRef unit, bool interested_only = false);
+    /// Whether the receiver already holds the index with `hash` for `path`.
+    using KnownIndex = llvm::function_ref<bool(llvm::StringRef path, const FileIndexHash& hash)>;
+
+    /// The hash of the index the receiver holds for `path` read under
+    /// `context` (see FileIndex::context_hash), if any.
+    using KnownContext = llvm::function_ref<std::optional<FileIndexHash>(
+        llvm::StringRef path,
+        const FileIndexHash& context)>;
+
+    /// Index the AST of `unit`.  Headers for which `known_context` names an
+    /// index are not visited at all, and headers for which `known` returns
+    /// true after visiting drop their entries; both keep only known_hash.
+    /// The main file is always indexed in full.  `known` may be called from
+    /// several threads at once.
+    static TUIndex build(CompilationUnitRef unit,
+                         bool interested_only = false,
+                         KnownIndex known = {},
+                         KnownContext known_context = {});
 
     void serialize(llvm::raw_ostream& os) const;
 
@@ -0,0 +1,137 @@
+#include "index/type_hierarchy.h"
+
+#include <algorithm>
+#include <tuple>
+
+namespace clice::index {
+
+namespace {
+
+void erase_one(llvm::SmallVector<SymbolHash, 2>& list, SymbolHash symbol) {
+    if(auto it = std::ranges::find(list, symbol); it != list.end())
+        list.erase(it);
+}
+
+}  // namespace
+
+std::vector<TypeHierarchy::Edge> TypeHierarchy::collect(const MergedIndex& shard) {
+    std::vector<Edge> result;
+    shard.referenced_symbols([&](SymbolHash derived) {
+        shard.lookup(derived, RelationKind::Base, [&](const Relation& relation) {
+            result.push_back({.derived = derived, .base = relation.target_symbol});
+            return true;
+        });
+    });
+
+    // One type may name its base in several contexts.
+    std::ranges::sort(result, [](const Edge& lhs, const Edge& rhs) {
+        return std::tuple(lhs.derived, lhs.base) < std::tuple(rhs.derived, rhs.base);
+    });
+    auto [first, last] = std::ranges::unique(result);
+    result.erase(first, last);
+    return result;
+}
+
+void TypeHierarchy::set(std::uint32_t file, std::vector<Edge> edges) {
+    stale.erase(file);
+    auto& entry = files[file];
+    for(auto& edge: entry)
+        drop(edge);
+    entry = std::move(edges);
+    for(auto& edge: entry)
+        add(edge);
+}
+
+void TypeHierarchy::invalidate(std::uint32_t file) {
+    remove(file);
+    stale.insert(file);
+}
+
+void TypeHierarchy::remove(std::uint32_t file) {
+    stale.erase(file);
+    if(auto it = files.find(file); it != files.end()) {
+        for(auto& edge: it->second)
+            drop(edge);
+        files.erase(it);
+    }
+}
+
+void TypeHierarchy::clear() {
+    files.clear();
+    stale.clear();
+    counts.clear();
+    base_edges.clear();
+    derived_edges.clear();
+}
+
+void TypeHierarchy::refresh(llvm::function_ref<const MergedIndex*(std::uint32_t)> shard) {
+    if(stale.empty())
+        return;
+    auto pending = std::move(stale);
+    stale.clear();
+    for(auto file: pending) {
+        if(auto* index = shard(file))
+            set(file, collect(*index));
+    }
+}
+
+llvm::ArrayRef<SymbolHash> TypeHierarchy::bases(SymbolHash symbol) const {
+    auto it = base_edges.find(symbol);
+    return it == base_edges.end() ? llvm::ArrayRef<SymbolHash>() : it->second;
+}
+
+llvm::ArrayRef<SymbolHash> TypeHierarchy::derived(SymbolHash symbol) const {
+    auto it = derived_edges.find(symbol);
+    return it == derived_edges.end() ? llvm::ArrayRef<SymbolHash>() : it->second;
+}
+
+void TypeHierarchy::walk(SymbolHash symbol,
+                         bool supertypes,
+                         std::uint32_t max_depth,
+                         llvm::function_ref<void(SymbolHash, std::uint32_t)> fn,
+                         Neighbours more) const {
+    llvm::DenseSet<SymbolHash> seen;
+    seen.insert(symbol);
+    std::vector<SymbolHash> level = {symbol};
+    std::vector<SymbolHash> next;
+    llvm::SmallVector<SymbolHash> extra;
+    for(std::uint32_t depth = 1; !level.empty() && (max_depth == 0 || depth <= max_depth);
+        ++depth) {
+        next.clear();
+        for(auto current: level) {
+            auto visit = [&](SymbolHash neighbour) {
+                if(seen.insert(neighbour).second) {
+                    next.push_back(neighbour);
+                    fn(neighbour, depth);
+                }
+            };
+            for(auto neighbour: supertypes ? bases(current) : derived(current))
+                visit(neighbour);
+            if(more) {
+                extra.clear();
+                more(current, extra);
+                for(auto neighbour: extra)
+                    visit(neighbour);
+            }
+        }
+        std::swap(level, next);
+    }
+}
+
+void TypeHierarchy::add(const Edge& edge) {
+    if(counts[{edge.derived, edge.base}]++ == 0) {
+        base_edges[edge.derived].push_back(edge.base);
+        derived_edges[edge.base].push_back(edge.derived);
+    }
+}
+
+void TypeHierarchy::drop(const Edge& edge) {
+    auto it = counts.find({edge.derived, edge.base});
+    if(it == counts.end() || --it->second != 0)
+        return;
+    counts.erase(it);
+    erase_one(base_edges[edge.derived], edge.base);
+    erase_one(derived_edges[edge.base], edge.derived);
+}
+
+}  // namespace clice::index
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "index/merged_index.h"
+#include "index/tu_index.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/SmallVector.h"
+
+namespace clice::index {
+
+/// Inheritance between the types of the project, from the Base relations
+/// of every MergedIndex shard, so that whole hierarchies are walked in
+/// memory instead of a level per lookup in the shards.
+///
+/// Edges are kept per shard and counted across them, so replacing the
+/// edges of one shard updates the graph without rebuilding it.  Shards
+/// loaded from disk are only read on the first query after it.
+class TypeHierarchy {
+public:
+    struct Edge {
+        SymbolHash derived = 0;
+        SymbolHash base = 0;
+
+        friend bool operator==(const Edge&, const Edge&) = default;
+    };
+
+    /// The edges recorded in `shard`, each once.
+    static std::vector<Edge> collect(const MergedIndex& shard);
+
+    /// Replace the edges of `file`.
+    void set(std::uint32_t file, std::vector<Edge> edges);
+
+    /// Have refresh() collect the edges of `file` from its shard.
+    void invalidate(std::uint32_t file);
+
+    void remove(std::uint32_t file);
+
+    void clear();
+
+    /// Collect the edges of the invalidated files; `shard` returns the shard
+    /// of a file, or nullptr if it has none.
+    void refresh(llvm::function_ref<const MergedIndex*(std::uint32_t)> shard);
+
+    llvm::ArrayRef<SymbolHash> bases(SymbolHash symbol) const;
+
+    llvm::ArrayRef<SymbolHash> derived(SymbolHash symbol) const;
+
+    /// Adds the neighbours of a symbol in one direction that the graph may
+    /// not hold, such as those of unsaved buffers.
+    using Neighbours =
+        llvm::function_ref<void(SymbolHash symbol, llvm::SmallVectorImpl<SymbolHash>& out)>;
+
+    /// Call `fn` with the supertypes (or subtypes) of `symbol` breadth first,
+    /// each once at the depth it is first reached: 1 for a direct base, up
+    /// to `max_depth`, or all of them for 0.
+    void walk(SymbolHash symbol,
+              bool supertypes,
+              std::uint32_t max_depth,
+              llvm::function_ref<void(SymbolHash, std::uint32_t depth)> fn,
+              Neighbours more = {}) const;
+
+    /// Distinct edges.
+    std::size_t size() const {
+        return counts.size();
+    }
+
+private:
+    void add(const Edge& edge);
+
+    void drop(const Edge& edge);
+
+    llvm::DenseMap<std::uint32_t, std::vector<Edge>> files;
+    llvm::DenseSet<std::uint32_t> stale;
+
+    /// Edge → the files recording it.
+    llvm::DenseMap<std::pair<SymbolHash, SymbolHash>, std::uint32_t> counts;
+
+    llvm::DenseMap<SymbolHash, llvm::SmallVector<SymbolHash, 2>> base_edges;
+    llvm::DenseMap<SymbolHash, llvm::SmallVector<SymbolHash, 2>> derived_edges;
+};
+
+}  // namespace clice::index
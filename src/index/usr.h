@@ -1,5 +1,9 @@
 #pragma once
 
+#include <string>
+#include <utility>
+
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
 #include "clang/AST/Decl.h"
@@ -7,7 +11,24 @@
 
 namespace clice::index {
 
-bool generateUSRForDecl(const clang::Decl* D, llvm::SmallVectorImpl<char>& buffer);
+/// USR fragments of the declaration contexts printed so far in one AST.  The
+/// members of a namespace or class template share their context's fragment,
+/// so with a cache each context is printed once instead of once per member.
+/// Only valid for the AST it was filled from.
+struct USRContextCache {
+    struct Entry {
+        std::string usr;
+        /// Type substitutions the fragment recorded, replayed with it.
+        llvm::SmallVector<std::pair<const clang::Type*, unsigned>, 0> substitutions;
+        bool generated_loc = false;
+    };
+
+    llvm::DenseMap<const clang::DeclContext*, Entry> contexts;
+};
+
+bool generateUSRForDecl(const clang::Decl* D,
+                        llvm::SmallVectorImpl<char>& buffer,
+                        USRContextCache* cache = nullptr);
 
 bool generateUSRForMacro(llvm::StringRef name,
                          clang::SourceLocation location,
@@ -63,9 +63,14 @@ class USRGenerator : public ConstDeclVisitor<USRGenerator> {
 
     llvm::DenseMap<const Type*, unsigned> TypeSubstitutions;
 
+    clice::index::USRContextCache* Cache;
+
 public:
-    USRGenerator(ASTContext* Ctx, SmallVectorImpl<char>& Buf, const LangOptions& LangOpts) :
-        Buf(Buf), Out(Buf), Context(Ctx), LangOpts(LangOpts) {
+    USRGenerator(ASTContext* Ctx,
+                 SmallVectorImpl<char>& Buf,
+                 const LangOptions& LangOpts,
+                 clice::index::USRContextCache* Cache) :
+        Buf(Buf), Out(Buf), Context(Ctx), LangOpts(LangOpts), Cache(Cache) {
         // Add the USR space prefix.
         Out << "c:";
     }
@@ -169,10 +174,31 @@ bool USRGenerator::ShouldGenerateLocation(const NamedDecl* D) {
 }
 
 void USRGenerator::VisitDeclContext(const DeclContext* DC) {
+    // Printed into a USR with no substitutions or location yet, the fragment
+    // of a context depends on the context alone and can be replayed.
+    bool Cacheable = Cache && TypeSubstitutions.empty() && !generatedLoc && !IgnoreResults;
+    if(Cacheable) {
+        if(auto It = Cache->contexts.find(DC); It != Cache->contexts.end()) {
+            auto& Entry = It->second;
+            Out << Entry.usr;
+            TypeSubstitutions.insert(Entry.substitutions.begin(), Entry.substitutions.end());
+            generatedLoc = Entry.generated_loc;
+            return;
+        }
+    }
+
+    auto Start = Buf.size();
     if(const NamedDecl* D = dyn_cast<NamedDecl>(DC))
         Visit(D);
     else if(isa<LinkageSpecDecl>(DC))  // Linkage specs are transparent in USRs.
         VisitDeclContext(DC->getParent());
+
+    if(Cacheable && !IgnoreResults) {
+        auto& Entry = Cache->contexts[DC];
+        Entry.usr.assign(Buf.begin() + Start, Buf.end());
+        Entry.substitutions.assign(TypeSubstitutions.begin(), TypeSubstitutions.end());
+        Entry.generated_loc = generatedLoc;
+    }
 }
 
 void USRGenerator::VisitFieldDecl(const FieldDecl* D) {
@@ -928,7 +954,10 @@ void USRGenerator::VisitMSGuidDecl(const MSGuidDecl* D) {
 
 namespace clice::index {
 
-bool generateUSRForDecl(const Decl* D, SmallVectorImpl<char>& Buf, const LangOptions& LangOpts) {
+bool generateUSRForDecl(const Decl* D,
+                        SmallVectorImpl<char>& Buf,
+                        const LangOptions& LangOpts,
+                        USRContextCache* Cache) {
     if(!D)
         return true;
     // We don't ignore decls with invalid source locations. Implicit decls, like
@@ -944,15 +973,15 @@ bool generateUSRForDecl(const Decl* D, SmallVectorImpl<char>& Buf, const LangOpt
             return false;
         }
     }
-    USRGenerator UG(&D->getASTContext(), Buf, LangOpts);
+    USRGenerator UG(&D->getASTContext(), Buf, LangOpts, Cache);
     UG.Visit(D);
     return UG.ignoreResults();
 }
 
-bool generateUSRForDecl(const Decl* D, SmallVectorImpl<char>& Buf) {
+bool generateUSRForDecl(const Decl* D, SmallVectorImpl<char>& Buf, USRContextCache* Cache) {
     if(!D)
         return true;
-    return generateUSRForDecl(D, Buf, D->getASTContext().getLangOpts());
+    return generateUSRForDecl(D, Buf, D->getASTContext().getLangOpts(), Cache);
 }
 
 bool generateUSRForMacro(StringRef MacroName,
@@ -9,14 +9,18 @@
 namespace clice {
 
 /// A visitor class that extends clang::RecursiveASTVisitor to traverse
-/// AST nodes with an additional filtering mechanism.
+/// AST nodes with an additional filtering mechanism.  With a valid
+/// `restrict_range`, declarations of the interested file lying wholly
+/// outside it are skipped with everything they contain.
 template <typename Derived>
 class FilteredASTVisitor : public clang::RecursiveASTVisitor<Derived> {
 public:
     using Base = clang::RecursiveASTVisitor<Derived>;
 
-    FilteredASTVisitor(CompilationUnitRef unit, bool interested_only) :
-        unit(unit), interested_only(interested_only) {}
+    FilteredASTVisitor(CompilationUnitRef unit,
+                       bool interested_only,
+                       LocalSourceRange restrict_range = {}) :
+        unit(unit), interested_only(interested_only), restrict_range(restrict_range) {}
 
 #define CHECK_DERIVED_IMPL(func)                                                                   \
     static_assert(std::same_as<decltype(&FilteredASTVisitor::func), decltype(&Derived::func)>,     \
@@ -50,6 +54,10 @@ public:
             return true;
         }
 
+        if(outside_restrict_range(decl->getSourceRange())) {
+            return true;
+        }
+
         /// We don't want to visit implicit instantiation.
         if(auto SD = llvm::dyn_cast<clang::ClassTemplateSpecializationDecl>(decl)) {
             if(SD->getSpecializationKind() == clang::TSK_ImplicitInstantiation) {
@@ -182,8 +190,19 @@ public:
 #undef CHECK_DERIVED_IMPL
 
 protected:
+    /// Whether `range` is in the interested file and misses restrict_range.
+    /// Ranges elsewhere are kept: what they expand to may still land in it.
+    bool outside_restrict_range(clang::SourceRange range) {
+        if(!restrict_range.valid() || range.isInvalid()) {
+            return false;
+        }
+        auto [fid, local] = unit.decompose_expansion_range(range);
+        return fid == unit.interested_file() && local.valid() && !local.intersects(restrict_range);
+    }
+
     CompilationUnitRef unit;
     bool interested_only;
+    LocalSourceRange restrict_range;
 };
 
 }  // namespace clice
@@ -1128,9 +1128,22 @@ private:
 
 }  // namespace
 
+TemplateResolver::~TemplateResolver() {
+    if(counters.hits + counters.misses != 0) {
+        LOG_DEBUG("Template resolver: {} hits, {} misses", counters.hits, counters.misses);
+    }
+}
+
 clang::QualType TemplateResolver::resolve(clang::QualType type) {
+    auto [it, inserted] = types.try_emplace(type.getAsOpaquePtr());
+    if(!inserted) {
+        counters.hits += 1;
+        return it->second;
+    }
+    counters.misses += 1;
     PseudoInstantiator instantiator(sema, resolved);
-    return instantiator.TransformType(type);
+    it->second = instantiator.TransformType(type);
+    return it->second;
 }
 
 clang::QualType TemplateResolver::resugar(clang::QualType type, clang::Decl* decl) {
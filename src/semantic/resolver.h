@@ -24,6 +24,19 @@ class TemplateResolver {
 public:
     explicit TemplateResolver(clang::Sema& sema) : sema(sema) {}
 
+    ~TemplateResolver();
+
+    /// How many resolve() calls the unit's queries made, and how many of
+    /// them were answered from `types` without pseudo-instantiating again.
+    struct Stats {
+        std::size_t hits = 0;
+        std::size_t misses = 0;
+    };
+
+    const Stats& stats() const {
+        return counters;
+    }
+
     clang::QualType resolve(clang::QualType type);
 
     void resolve(clang::CXXUnresolvedConstructExpr* expr);
@@ -100,6 +113,13 @@ private:
     /// syntactic occurrence. Different syntactic occurrences of the "same" type
     /// have different AST node pointers.
     llvm::DenseMap<const void*, clang::QualType> resolved;
+
+    /// Results of resolve(), by the type asked for.  The resolver lives as
+    /// long as its unit, so hover, semantic tokens and inlay hints over the
+    /// same dependent code share them until a recompile drops the unit.
+    llvm::DenseMap<void*, clang::QualType> types;
+
+    Stats counters;
 };
 
 }  // namespace clice
@@ -602,6 +602,14 @@ private:
         return no_tokens;
     }
 
+    // Offsets of the first and last (partially) selected tokens, if any.
+    std::optional<LocalSourceRange> bounds() const {
+        if(selected_spelled.empty()) {
+            return std::nullopt;
+        }
+        return LocalSourceRange{selected_spelled.front().offset, selected_spelled.back().offset};
+    }
+
     // Decomposes Loc and returns the offset if the file ID is SelFile.
     std::optional<unsigned> offset_in_sel_file(clang::SourceLocation location) const {
         // Decoding Loc with SM.getDecomposedLoc is relatively expensive.
@@ -708,19 +716,28 @@ bool is_implicit(const clang::Stmt* statement) {
 // selected or contain some nodes that are.
 //
 // For simple cases (not inside macros) we prune subtrees that don't intersect.
+//
+// Several selections can be found in one traversal: each keeps its own stack,
+// nodes and claimed tokens, and a subtree is only pruned when no selection
+// intersects it.
 class SelectionVisitor : public clang::RecursiveASTVisitor<SelectionVisitor> {
 public:
-    // Runs the visitor to gather selected nodes and their ancestors.
-    // If there is any selection, the root (TUDecl) is the first node.
-    static std::deque<Node> collect(CompilationUnitRef unit,
-                                    const clang::PrintingPolicy& printing_policy,
-                                    LocalSourceRange range,
-                                    clang::FileID fid) {
-        SelectionVisitor V(unit, printing_policy, range, fid);
+    // Runs the visitor to gather selected nodes and their ancestors for each
+    // range. If there is any selection, the root (TUDecl) is the first node.
+    static std::vector<std::deque<Node>> collect(CompilationUnitRef unit,
+                                                 const clang::PrintingPolicy& printing_policy,
+                                                 llvm::ArrayRef<LocalSourceRange> ranges,
+                                                 clang::FileID fid) {
+        SelectionVisitor V(unit, printing_policy, ranges, fid);
         V.TraverseAST(unit.context());
-        assert(V.stack.size() == 1 && "Unpaired push/pop?");
-        assert(V.stack.top() == &V.nodes.front());
-        return std::move(V.nodes);
+        std::vector<std::deque<Node>> result;
+        result.reserve(V.lanes.size());
+        for(auto& lane: V.lanes) {
+            assert(lane.stack.size() == 1 && "Unpaired push/pop?");
+            assert(lane.stack.top() == &lane.nodes.front());
+            result.push_back(std::move(lane.nodes));
+        }
+        return result;
     }
 
     // We traverse all "well-behaved" nodes the same way:
@@ -736,8 +753,20 @@ public:
     bool TraverseDecl(clang::Decl* X) {
         // Already pushed by constructor.
         if(llvm::isa_and_nonnull<clang::TranslationUnitDecl>(X)) {
-            /// Top level decls cover the selection.
-            for(auto decl: unit.top_level_decls()) {
+            // Only top level decls around some selected token can hold a
+            // selected node, the index of the unit finds them.
+            std::optional<LocalSourceRange> bounds;
+            for(auto& lane: lanes) {
+                if(auto lane_bounds = lane.checker.bounds()) {
+                    bounds = bounds ? LocalSourceRange{std::min(bounds->begin, lane_bounds->begin),
+                                                       std::max(bounds->end, lane_bounds->end)}
+                                    : *lane_bounds;
+                }
+            }
+            if(!bounds) {
+                return true;
+            }
+            for(auto decl: unit.top_level_decls(*bounds)) {
                 if(!TraverseDecl(decl)) {
                     return false;
                 }
@@ -871,19 +900,45 @@ public:
 private:
     using Base = RecursiveASTVisitor<SelectionVisitor>;
 
+    // The traversal state of one selection.
+    struct Lane {
+        Lane(CompilationUnitRef unit,
+             clang::FileID selected_file,
+             LocalSourceRange range,
+             const clang::SourceManager& SM) :
+            checker(unit, selected_file, range, SM),
+            unclaimed_expanded_tokens(unit.expanded_tokens()) {
+            // Ensure we have a node for the TU decl, regardless of traversal scope.
+            nodes.emplace_back();
+            nodes.back().data =
+                clang::DynTypedNode::create(*unit.context().getTranslationUnitDecl());
+            nodes.back().parent = nullptr;
+            nodes.back().selected = SelectionTree::Unselected;
+            stack.push(&nodes.back());
+        }
+
+        SelectionTester checker;
+        IntervalSet unclaimed_expanded_tokens;
+        std::deque<Node> nodes;  // Stable pointers as we add more nodes.
+        std::stack<Node*> stack;
+        // Depth of the node whose subtree this selection prunes, 0 if none.
+        // Nodes inside it are neither pushed nor claimed for it.
+        unsigned skipped = 0;
+
+        bool active() const {
+            return skipped == 0;
+        }
+    };
+
     SelectionVisitor(CompilationUnitRef unit,
                      const clang::PrintingPolicy& printing_policy,
-                     LocalSourceRange range,
+                     llvm::ArrayRef<LocalSourceRange> ranges,
                      clang::FileID selected_file) :
         unit(unit), SM(unit.context().getSourceManager()), lang_opts(unit.context().getLangOpts()),
-        print_policy(printing_policy), checker(unit, selected_file, range, SM),
-        unclaimed_expanded_tokens(unit.expanded_tokens()) {
-        // Ensure we have a node for the TU decl, regardless of traversal scope.
-        nodes.emplace_back();
-        nodes.back().data = clang::DynTypedNode::create(*unit.context().getTranslationUnitDecl());
-        nodes.back().parent = nullptr;
-        nodes.back().selected = SelectionTree::Unselected;
-        stack.push(&nodes.back());
+        print_policy(printing_policy) {
+        for(auto range: ranges) {
+            lanes.emplace_back(unit, selected_file, range, SM);
+        }
     }
 
     // Generic case of TraverseFoo. Func should be the call to Base::TraverseFoo.
@@ -950,7 +1005,26 @@ private:
             return false;
         }
 
-        if(!checker.may_hit(S)) {
+        // The node is entered at depth + 1; selections it cannot hit prune it
+        // there, the traversal only when all of them do.
+        bool needed = false;
+        for(auto& lane: lanes) {
+            if(!lane.active()) {
+                continue;
+            }
+            if(lane.checker.may_hit(S)) {
+                needed = true;
+            } else {
+                lane.skipped = depth + 1;
+            }
+        }
+
+        if(!needed) {
+            for(auto& lane: lanes) {
+                if(lane.skipped == depth + 1) {
+                    lane.skipped = 0;
+                }
+            }
             LOG_DEBUG("{2}skip: {0} {1}",
                       print_node_to_string(N, print_policy),
                       S.printToString(SM),
@@ -978,34 +1052,53 @@ private:
                   print_node_to_string(node, print_policy),
                   node.getSourceRange().printToString(SM),
                   indent());
-        nodes.emplace_back();
-        nodes.back().data = std::move(node);
-        nodes.back().parent = stack.top();
-        nodes.back().selected = no_tokens;
-        stack.push(&nodes.back());
-        claim_range(Early, nodes.back().selected);
+        depth += 1;
+        for(auto& lane: lanes) {
+            if(!lane.active()) {
+                continue;
+            }
+            lane.nodes.emplace_back();
+            lane.nodes.back().data = node;
+            lane.nodes.back().parent = lane.stack.top();
+            lane.nodes.back().selected = no_tokens;
+            lane.stack.push(&lane.nodes.back());
+        }
+        traversal.push_back(std::move(node));
+        claim_range(Early);
     }
 
     // Pops a node off the ancestor stack, and finalizes it. Pairs with push().
     // Performs primary hit detection.
     void pop() {
-        Node& N = *stack.top();
-        LOG_DEBUG("{1}pop: {0}", print_node_to_string(N.data, print_policy), indent(-1));
-        claim_tokens_for(N.data, N.selected);
-        if(N.selected == no_tokens) {
-            N.selected = SelectionTree::Unselected;
-        }
+        auto data = traversal.pop_back_val();
+        LOG_DEBUG("{1}pop: {0}", print_node_to_string(data, print_policy), indent(-1));
+        claim_tokens_for(data);
+        for(auto& lane: lanes) {
+            if(lane.skipped == depth) {
+                lane.skipped = 0;
+                continue;
+            }
+            if(!lane.active()) {
+                continue;
+            }
 
-        if(N.selected || !N.children.empty()) {
-            // Attach to the tree.
-            N.parent->children.push_back(&N);
-        } else {
-            // Neither N any children are selected, it doesn't belong in the tree.
-            assert(&N == &nodes.back());
-            nodes.pop_back();
-        }
+            Node& N = *lane.stack.top();
+            if(N.selected == no_tokens) {
+                N.selected = SelectionTree::Unselected;
+            }
+
+            if(N.selected || !N.children.empty()) {
+                // Attach to the tree.
+                N.parent->children.push_back(&N);
+            } else {
+                // Neither N any children are selected, it doesn't belong in the tree.
+                assert(&N == &lane.nodes.back());
+                lane.nodes.pop_back();
+            }
 
-        stack.pop();
+            lane.stack.pop();
+        }
+        depth -= 1;
     }
 
     // Returns the range of tokens that this node will claim directly, and
@@ -1045,12 +1138,12 @@ private:
     // Claim tokens for N, after processing its children.
     // By default this claims all unclaimed tokens in getSourceRange().
     // We override this if we want to claim fewer tokens (e.g. there are gaps).
-    void claim_tokens_for(const clang::DynTypedNode& N, SelectionTree::SelectionKind& result) {
+    void claim_tokens_for(const clang::DynTypedNode& N) {
         // CXXConstructExpr often shows implicit construction, like `string s;`.
         // Don't associate any tokens with it unless there's some syntax like {}.
         // This prevents it from claiming 's', its primary location.
         if(const auto* CCE = N.get<clang::CXXConstructExpr>()) {
-            claim_range(CCE->getParenOrBraceRange(), result);
+            claim_range(CCE->getParenOrBraceRange());
             return;
         }
 
@@ -1087,47 +1180,54 @@ private:
         //   ### represents parts that children already claimed.
         if(const auto* TL = N.get<clang::TypeLoc>()) {
             if(auto PTL = TL->getAs<clang::ParenTypeLoc>()) {
-                claim_range(PTL.getLParenLoc(), result);
-                claim_range(PTL.getRParenLoc(), result);
+                claim_range(PTL.getLParenLoc());
+                claim_range(PTL.getRParenLoc());
                 return;
             }
 
             if(auto ATL = TL->getAs<clang::ArrayTypeLoc>()) {
-                claim_range(ATL.getBracketsRange(), result);
+                claim_range(ATL.getBracketsRange());
                 return;
             }
 
             if(auto PTL = TL->getAs<clang::PointerTypeLoc>()) {
-                claim_range(PTL.getStarLoc(), result);
+                claim_range(PTL.getStarLoc());
                 return;
             }
 
             if(auto FTL = TL->getAs<clang::FunctionTypeLoc>()) {
-                claim_range(clang::SourceRange(FTL.getLParenLoc(), FTL.getEndLoc()), result);
+                claim_range(clang::SourceRange(FTL.getLParenLoc(), FTL.getEndLoc()));
                 return;
             }
         }
 
-        claim_range(get_source_range(N), result);
+        claim_range(get_source_range(N));
     }
 
     // Perform hit-testing of a complete Node against the selection.
     // This runs for every node in the AST, and must be fast in common cases.
     // This is usually called from pop(), so we can take children into account.
-    // The existing state of Result is relevant.
-    void claim_range(clang::SourceRange S, SelectionTree::SelectionKind& result) {
-        for(const auto& claimed_range: unclaimed_expanded_tokens.erase(unit.expanded_tokens(S))) {
-            update(result, checker.test(claimed_range));
-        }
+    // The existing state of each selection's top node is relevant.
+    void claim_range(clang::SourceRange S) {
+        auto tokens = unit.expanded_tokens(S);
+        for(auto& lane: lanes) {
+            if(!lane.active()) {
+                continue;
+            }
+            auto& result = lane.stack.top()->selected;
+            for(const auto& claimed_range: lane.unclaimed_expanded_tokens.erase(tokens)) {
+                update(result, lane.checker.test(claimed_range));
+            }
 
-        if(result && result != no_tokens) {
-            LOG_DEBUG("{1}hit selection: {0}", S.printToString(SM), indent());
+            if(result && result != no_tokens) {
+                LOG_DEBUG("{1}hit selection: {0}", S.printToString(SM), indent());
+            }
         }
     }
 
     std::string indent(int offset = 0) {
         // Cast for signed arithmetic.
-        int amount = int(stack.size()) + offset;
+        int amount = int(depth) + 1 + offset;
         assert(amount >= 0);
         return std::string(amount, ' ');
     }
@@ -1136,10 +1236,11 @@ private:
     const clang::LangOptions& lang_opts;
     const clang::PrintingPolicy& print_policy;
     CompilationUnitRef unit;
-    std::stack<Node*> stack;
-    SelectionTester checker;
-    IntervalSet unclaimed_expanded_tokens;
-    std::deque<Node> nodes;  // Stable pointers as we add more nodes.
+    // Lanes refer to their own nodes: a deque keeps them in place.
+    std::deque<Lane> lanes;
+    // The nodes entered and not yet left, shared by all selections.
+    llvm::SmallVector<clang::DynTypedNode> traversal;
+    unsigned depth = 0;
 };
 
 }  // namespace
@@ -1195,13 +1296,24 @@ bool SelectionTree::create_each(CompilationUnitRef unit,
         return callback(SelectionTree(unit, range));
     }
 
+    for(auto range: point_ranges(unit, begin)) {
+        if(callback(SelectionTree(unit, range))) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+llvm::SmallVector<LocalSourceRange, 2> SelectionTree::point_ranges(CompilationUnitRef unit,
+                                                                   std::uint32_t offset) {
     // Decide which selections emulate a "point" query in between characters.
     // If it's ambiguous (the neighboring characters are selectable tokens), returns
     // both possibilities in preference order. Always returns at least one range
     // - if no tokens touched, and empty range.
     llvm::SmallVector<LocalSourceRange, 2> ranges;
 
-    auto location = unit.create_location(unit.interested_file(), begin);
+    auto location = unit.create_location(unit.interested_file(), offset);
 
     // Prefer right token over left.
     for(const clang::syntax::Token& token: llvm::reverse(unit.spelled_tokens_touch(location))) {
@@ -1215,16 +1327,10 @@ bool SelectionTree::create_each(CompilationUnitRef unit,
 
     /// Make sure, we have at least one range.
     if(ranges.empty()) {
-        ranges.emplace_back(begin, begin);
-    }
-
-    for(auto range: ranges) {
-        if(callback(SelectionTree(unit, range))) {
-            return true;
-        }
+        ranges.emplace_back(offset, offset);
     }
 
-    return false;
+    return ranges;
 }
 
 SelectionTree SelectionTree::create_right(CompilationUnitRef unit, LocalSourceRange range) {
@@ -1236,6 +1342,36 @@ SelectionTree SelectionTree::create_right(CompilationUnitRef unit, LocalSourceRa
     return std::move(*result);
 }
 
+std::vector<SelectionTree> SelectionTree::create_right(CompilationUnitRef unit,
+                                                       llvm::ArrayRef<LocalSourceRange> ranges) {
+    llvm::SmallVector<LocalSourceRange> selections;
+    selections.reserve(ranges.size());
+    for(auto range: ranges) {
+        selections.push_back(range.begin != range.end ? range
+                                                      : point_ranges(unit, range.begin).front());
+    }
+
+    clang::PrintingPolicy policy(unit.context().getLangOpts());
+    policy.TerseOutput = true;
+    policy.IncludeNewlines = false;
+    auto fid = unit.context().getSourceManager().getMainFileID();
+
+    std::vector<SelectionTree> trees;
+    trees.reserve(ranges.size());
+    for(auto& nodes: SelectionVisitor::collect(unit, policy, selections, fid)) {
+        trees.push_back(SelectionTree(unit, std::move(nodes)));
+    }
+    return trees;
+}
+
+SelectionTree::SelectionTree(CompilationUnitRef unit, std::deque<Node> collected) :
+    nodes(std::move(collected)), print_policy(unit.context().getLangOpts()) {
+    print_policy.TerseOutput = true;
+    print_policy.IncludeNewlines = false;
+    m_root = nodes.empty() ? nullptr : &nodes.front();
+    record_metrics(*this, unit.context().getLangOpts());
+}
+
 SelectionTree::SelectionTree(CompilationUnitRef unit, LocalSourceRange range) :
     print_policy(unit.context().getLangOpts()) {
     // No fundamental reason the selection needs to be in the main file,
@@ -1250,7 +1386,7 @@ SelectionTree::SelectionTree(CompilationUnitRef unit, LocalSourceRange range) :
               clang::SourceRange(SM.getComposedLoc(fid, begin), SM.getComposedLoc(fid, end))
                   .printToString(SM));
 
-    nodes = SelectionVisitor::collect(unit, print_policy, range, fid);
+    nodes = std::move(SelectionVisitor::collect(unit, print_policy, range, fid).front());
     m_root = nodes.empty() ? nullptr : &nodes.front();
     record_metrics(*this, unit.context().getLangOpts());
     /// FIXME: dlog("Built selection tree\n{0}", *this);
@@ -1,9 +1,12 @@
 #pragma once
 
+#include <deque>
 #include <stack>
+#include <vector>
 
 #include "syntax/token.h"
 
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/SmallVector.h"
 #include "clang/AST/ASTTypeTraits.h"
 #include "clang/AST/PrettyPrinter.h"
@@ -57,6 +60,11 @@ public:
     /// on the right.
     static SelectionTree create_right(CompilationUnitRef unit, LocalSourceRange range);
 
+    /// create_right() for each of `ranges`, in one traversal of the AST
+    /// instead of one per range.  The trees are in the order of `ranges`.
+    static std::vector<SelectionTree> create_right(CompilationUnitRef unit,
+                                                   llvm::ArrayRef<LocalSourceRange> ranges);
+
     /// Copies are no good - contain pointers to other nodes.
     SelectionTree(const SelectionTree&) = delete;
     SelectionTree& operator=(const SelectionTree&) = delete;
@@ -141,6 +149,14 @@ private:
     // The range includes bytes [Start, End).
     SelectionTree(CompilationUnitRef unit, LocalSourceRange range);
 
+    // Adopts the nodes a traversal collected.
+    SelectionTree(CompilationUnitRef unit, std::deque<Node> nodes);
+
+    // The ranges a point query may mean, in order of preference: the token
+    // right of it, the one left of it, or the empty range between them.
+    static llvm::SmallVector<LocalSourceRange, 2> point_ranges(CompilationUnitRef unit,
+                                                               std::uint32_t offset);
+
     // Stable-pointer storage, FIXME: use memory pool instead?
     std::deque<Node> nodes;
 
@@ -13,8 +13,10 @@ class SemanticVisitor : public FilteredASTVisitor<SemanticVisitor<Derived>> {
 public:
     using Base = FilteredASTVisitor<SemanticVisitor>;
 
-    SemanticVisitor(CompilationUnitRef unit, bool interested_only) :
-        Base(unit, interested_only), unit(unit), resolver(unit.resolver()) {}
+    SemanticVisitor(CompilationUnitRef unit,
+                    bool interested_only,
+                    LocalSourceRange restrict_range = {}) :
+        Base(unit, interested_only, restrict_range), unit(unit), resolver(unit.resolver()) {}
 
 public:
     Derived& getDerived() {
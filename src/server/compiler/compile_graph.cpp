@@ -3,6 +3,8 @@
 #include <algorithm>
 #include <cassert>
 
+#include "support/trace.h"
+
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/DenseSet.h"
 
@@ -16,11 +18,16 @@ namespace ranges = std::ranges;
 struct CompileGraph::RefGuard {
     CompileGraph& graph;
     llvm::SmallVector<std::uint32_t, 4> held;
+    bool urgent;
 
-    RefGuard(CompileGraph& graph, llvm::ArrayRef<std::uint32_t> ids) :
-        graph(graph), held(ids.begin(), ids.end()) {
+    RefGuard(CompileGraph& graph, llvm::ArrayRef<std::uint32_t> ids, bool urgent) :
+        graph(graph), held(ids.begin(), ids.end()), urgent(urgent) {
         for(auto id: held) {
             graph.acquire(id);
+            if(urgent) {
+                graph.units.find(id)->second.urgent_refcount += 1;
+                graph.promote(id);
+            }
         }
     }
 
@@ -29,6 +36,9 @@ struct CompileGraph::RefGuard {
 
     ~RefGuard() {
         for(auto id: held) {
+            if(urgent) {
+                graph.units.find(id)->second.urgent_refcount -= 1;
+            }
             graph.release(id);
         }
     }
@@ -49,6 +59,9 @@ struct CompileGraph::UnitGuard {
     /// synchronous with the matching refcount increment.
     llvm::SmallVector<std::uint32_t, 8> acquired;
 
+    /// Dispatch slot claim, set once the dependencies are done.
+    std::shared_ptr<SlotTicket> slot;
+
     ~UnitGuard() {
         // Publish the outcome, clear the compiling flag, release edge
         // references, then wake waiters — all synchronous. Resumes triggered
@@ -64,20 +77,35 @@ struct CompileGraph::UnitGuard {
             graph.release(dep_id);
         }
 
+        if(slot && slot->granted) {
+            graph.release_slot();
+        } else if(slot) {
+            std::erase(graph.slot_queue, slot);
+        }
+
         round->completion.set();
+        graph.round_finished();
     }
 };
 
 CompileGraph::CompileGraph(kota::event_loop& loop, dispatch_fn dispatch, resolve_fn resolve) :
     dispatch(std::move(dispatch)), resolve(std::move(resolve)), tasks(loop) {}
 
-void CompileGraph::ensure_resolved(std::uint32_t path_id) {
+CompileUnit& CompileGraph::unit_of(std::uint32_t path_id) {
     auto& unit = units[path_id];
+    if(unit.order == 0) {
+        unit.path_id = path_id;
+        unit.order = ++next_order;
+    }
+    return unit;
+}
+
+void CompileGraph::ensure_resolved(std::uint32_t path_id) {
+    auto& unit = unit_of(path_id);
     if(unit.resolved) {
         return;
     }
 
-    unit.path_id = path_id;
     unit.resolved = true;
     unit.dependencies = resolve(path_id);
 
@@ -87,16 +115,95 @@ void CompileGraph::ensure_resolved(std::uint32_t path_id) {
 
     // Back-populate dependents.
     for(auto dep_id: deps) {
-        auto& dep = units[dep_id];
-        dep.path_id = dep_id;
-        dep.dependents.push_back(path_id);
+        unit_of(dep_id).dependents.push_back(path_id);
+        order_edge(path_id, dep_id);
+    }
+}
+
+void CompileGraph::order_edge(std::uint32_t dependent, std::uint32_t dependency) {
+    auto lower = units.find(dependent)->second.order;
+    auto upper = units.find(dependency)->second.order;
+    if(upper < lower) {
+        return;
+    }
+    if(dependent == dependency) {
+        cyclic_edges.insert({dependent, dependency});
+        return;
+    }
+
+    // Pearce-Kelly: only units ordered between the two ends can be out of
+    // place. Collect those reachable from `dependent` forwards and from
+    // `dependency` backwards, over the edges the order holds for.
+    auto ordered = [&](std::uint32_t from, std::uint32_t to) {
+        return cyclic_edges.empty() || !cyclic_edges.contains({to, from});
+    };
+
+    llvm::SmallVector<std::uint32_t> forward;
+    llvm::SmallVector<std::uint32_t> stack = {dependent};
+    llvm::DenseSet<std::uint32_t> seen;
+    seen.insert(dependent);
+    while(!stack.empty()) {
+        auto current = stack.pop_back_val();
+        forward.push_back(current);
+        for(auto next: units.find(current)->second.dependents) {
+            if(!ordered(current, next) || units.find(next)->second.order > upper) {
+                continue;
+            }
+            if(next == dependency) {
+                // `dependency` already waits on `dependent`.
+                cyclic_edges.insert({dependent, dependency});
+                return;
+            }
+            if(seen.insert(next).second) {
+                stack.push_back(next);
+            }
+        }
+    }
+
+    llvm::SmallVector<std::uint32_t> backward;
+    stack.push_back(dependency);
+    seen.insert(dependency);
+    while(!stack.empty()) {
+        auto current = stack.pop_back_val();
+        backward.push_back(current);
+        for(auto next: units.find(current)->second.dependencies) {
+            if(!ordered(next, current) || units.find(next)->second.order < lower) {
+                continue;
+            }
+            if(seen.insert(next).second) {
+                stack.push_back(next);
+            }
+        }
+    }
+
+    // Hand the same positions back, dependencies first, each side keeping
+    // its own relative order.
+    auto by_order = [&](std::uint32_t lhs, std::uint32_t rhs) {
+        return units.find(lhs)->second.order < units.find(rhs)->second.order;
+    };
+    ranges::sort(forward, by_order);
+    ranges::sort(backward, by_order);
+
+    llvm::SmallVector<std::uint32_t> positions;
+    for(auto id: backward) {
+        positions.push_back(units.find(id)->second.order);
+    }
+    for(auto id: forward) {
+        positions.push_back(units.find(id)->second.order);
+    }
+    ranges::sort(positions);
+
+    std::size_t next = 0;
+    for(auto id: backward) {
+        units.find(id)->second.order = positions[next++];
+    }
+    for(auto id: forward) {
+        units.find(id)->second.order = positions[next++];
     }
 }
 
 void CompileGraph::acquire(std::uint32_t path_id) {
-    auto& unit = units[path_id];
-    unit.path_id = path_id;
-    unit.refcount += 1;
+    unit_of(path_id).refcount += 1;
 }
 
 void CompileGraph::release(std::uint32_t path_id) {
@@ -145,6 +252,7 @@ bool CompileGraph::spawn_unit(std::uint32_t path_id) {
     unit.round = std::make_shared<CompileUnit::Round>();
     auto round = unit.round;
     auto token = unit.source->token();
+    round_started();
 
     // spawn resumes the body synchronously up to its first suspension point,
     // which may insert units and invalidate `unit` — don't touch it below.
@@ -156,6 +264,7 @@ bool CompileGraph::spawn_unit(std::uint32_t path_id) {
     // stale, completed round instead of hanging.
     units.find(path_id)->second.compiling = false;
     round->completion.set();
+    round_finished();
     return false;
 }
 
@@ -170,6 +279,7 @@ kota::task<> CompileGraph::unit_task(std::uint32_t path_id,
 kota::task<> CompileGraph::unit_body(std::uint32_t path_id,
                                      std::shared_ptr<CompileUnit::Round> round) {
     UnitGuard guard{*this, path_id, std::move(round)};
+    trace::Span span("CompileUnit");
 
     ensure_resolved(path_id);
 
@@ -191,6 +301,14 @@ kota::task<> CompileGraph::unit_body(std::uint32_t path_id,
         guard.acquired.push_back(dep_id);
     }
 
+    // Dependencies first seen now were out of reach when the urgent request
+    // arrived; one of them may already be compiling for someone else.
+    if(on_promote && urgent(path_id)) {
+        for(auto dep_id: deps) {
+            promote(dep_id);
+        }
+    }
+
     if(!deps.empty()) {
         std::vector<kota::task<bool>> waits;
         waits.reserve(deps.size());
@@ -205,6 +323,13 @@ kota::task<> CompileGraph::unit_body(std::uint32_t path_id,
         }
     }
 
+    guard.slot = std::make_shared<SlotTicket>();
+    guard.slot->path_id = path_id;
+    request_slot(guard.slot);
+    if(!guard.slot->granted) {
+        co_await guard.slot->ready.wait();
+    }
+
     bool ok = co_await dispatch(path_id);
 
     // Synchronous tail: nothing can interleave between dispatch resuming us
@@ -260,14 +385,14 @@ kota::task<bool> CompileGraph::await_unit(std::uint32_t path_id,
     }
 }
 
-kota::task<bool> CompileGraph::compile(std::uint32_t path_id) {
+kota::task<bool> CompileGraph::compile(std::uint32_t path_id, bool urgent) {
     // Request scope: one root reference, dropped when the requester exits or
     // its frame is cancelled.
-    RefGuard scope(*this, {path_id});
+    RefGuard scope(*this, {path_id}, urgent);
     co_return co_await await_unit(path_id, std::nullopt);
 }
 
-kota::task<bool> CompileGraph::compile_deps(std::uint32_t path_id) {
+kota::task<bool> CompileGraph::compile_deps(std::uint32_t path_id, bool urgent) {
     ensure_resolved(path_id);
 
     // Copy deps — the map may rehash while this frame is suspended.
@@ -278,7 +403,7 @@ kota::task<bool> CompileGraph::compile_deps(std::uint32_t path_id) {
 
     // Request scope: root references on each direct dependency (path_id
     // itself is never dispatched here).
-    RefGuard scope(*this, deps);
+    RefGuard scope(*this, deps, urgent);
 
     std::vector<kota::task<bool>> waits;
     waits.reserve(deps.size());
@@ -318,6 +443,7 @@ llvm::SmallVector<std::uint32_t> CompileGraph::update(std::uint32_t path_id) {
             unit.resolved = false;
             // Clear stale dependency edges — they'll be rebuilt by ensure_resolved.
             for(auto dep_id: unit.dependencies) {
+                cyclic_edges.erase({path_id, dep_id});
                 auto dep_it = units.find(dep_id);
                 if(dep_it != units.end()) {
                     auto& dependents = dep_it->second.dependents;
@@ -345,6 +471,12 @@ llvm::SmallVector<std::uint32_t> CompileGraph::update(std::uint32_t path_id) {
 }
 
 bool CompileGraph::has_wait_cycle(std::uint32_t target, std::uint32_t waiter) const {
+    // Every wait follows a resolved edge; with none of them closing a cycle,
+    // no chain of waits can come back around.
+    if(cyclic_edges.empty()) {
+        return false;
+    }
+
     // BFS through the target's dependency chain, following only compiling
     // units. If any dependency reaches the waiting unit, waiting would deadlock.
     llvm::SmallVector<std::uint32_t> queue;
@@ -373,6 +505,170 @@ bool CompileGraph::has_wait_cycle(std::uint32_t target, std::uint32_t waiter) co
     return false;
 }
 
+std::uint32_t CompileGraph::remaining_path(std::uint32_t path_id) const {
+    llvm::DenseMap<std::uint32_t, std::uint32_t> memo;
+    return remaining_path(path_id, memo);
+}
+
+std::uint32_t
+    CompileGraph::remaining_path(std::uint32_t path_id,
+                                 llvm::DenseMap<std::uint32_t, std::uint32_t>& memo) const {
+    // Seeded before recursing so a dependency cycle terminates.
+    auto [memo_it, inserted] = memo.try_emplace(path_id, 0);
+    if(!inserted) {
+        return memo_it->second;
+    }
+
+    std::uint32_t longest = 0;
+    auto it = units.find(path_id);
+    if(it != units.end()) {
+        for(auto dependent: it->second.dependents) {
+            auto dep_it = units.find(dependent);
+            if(dep_it != units.end() && dep_it->second.dirty) {
+                longest = std::max(longest, remaining_path(dependent, memo) + 1);
+            }
+        }
+    }
+
+    memo[path_id] = longest;
+    return longest;
+}
+
+bool CompileGraph::urgent(std::uint32_t path_id) const {
+    llvm::DenseMap<std::uint32_t, bool> memo;
+    return urgent(path_id, memo);
+}
+
+bool CompileGraph::urgent(std::uint32_t path_id, llvm::DenseMap<std::uint32_t, bool>& memo) const {
+    // Seeded before recursing so a dependency cycle terminates.
+    auto [memo_it, inserted] = memo.try_emplace(path_id, false);
+    if(!inserted) {
+        return memo_it->second;
+    }
+
+    auto it = units.find(path_id);
+    if(it == units.end()) {
+        return false;
+    }
+
+    // A compiling dependent holds an edge reference on each of its
+    // dependencies, so it is waiting on this unit on behalf of its own
+    // requesters.
+    bool result = it->second.urgent_refcount > 0;
+    for(auto dependent: it->second.dependents) {
+        if(result) {
+            break;
+        }
+        auto dep_it = units.find(dependent);
+        if(dep_it != units.end() && dep_it->second.compiling) {
+            result = urgent(dependent, memo);
+        }
+    }
+
+    memo[path_id] = result;
+    return result;
+}
+
+void CompileGraph::promote(std::uint32_t path_id) {
+    if(!on_promote) {
+        return;
+    }
+
+    // Units that have not started yet pick up the priority from urgent()
+    // when they dispatch; only compiling ones may already sit in a queue.
+    llvm::SmallVector<std::uint32_t> queue;
+    llvm::DenseSet<std::uint32_t> visited;
+    queue.push_back(path_id);
+    while(!queue.empty()) {
+        auto current = queue.pop_back_val();
+        if(!visited.insert(current).second) {
+            continue;
+        }
+        auto it = units.find(current);
+        if(it == units.end()) {
+            continue;
+        }
+        if(it->second.compiling) {
+            on_promote(current);
+        }
+        for(auto dep_id: it->second.dependencies) {
+            queue.push_back(dep_id);
+        }
+    }
+}
+
+void CompileGraph::set_max_parallel(std::uint32_t limit) {
+    max_parallel = limit;
+
+    // Raising the limit frees slots for queued units right away.
+    grant_slots();
+}
+
+void CompileGraph::request_slot(const std::shared_ptr<SlotTicket>& ticket) {
+    if(max_parallel == 0 || active_slots < max_parallel) {
+        active_slots += 1;
+        ticket->granted = true;
+        return;
+    }
+    slot_queue.push_back(ticket);
+}
+
+void CompileGraph::release_slot() {
+    assert(active_slots > 0 && "released more dispatch slots than granted");
+    active_slots -= 1;
+    grant_slots();
+}
+
+void CompileGraph::grant_slots() {
+    if(slot_queue.empty()) {
+        return;
+    }
+
+    // Ranks change as other units finish and requests come and go, so they
+    // are computed at hand-off rather than at enqueue. Ties go to the
+    // earliest ticket.
+    llvm::DenseMap<std::uint32_t, std::uint32_t> memo;
+    llvm::DenseMap<std::uint32_t, bool> urgent_memo;
+    auto rank_of = [&](std::uint32_t path_id) {
+        return std::pair{urgent(path_id, urgent_memo), remaining_path(path_id, memo)};
+    };
+    while(!slot_queue.empty() && (max_parallel == 0 || active_slots < max_parallel)) {
+        auto best = slot_queue.begin();
+        auto best_rank = rank_of((*best)->path_id);
+        for(auto it = std::next(best); it != slot_queue.end(); ++it) {
+            auto rank = rank_of((*it)->path_id);
+            if(rank > best_rank) {
+                best = it;
+                best_rank = rank;
+            }
+        }
+
+        auto ticket = std::move(*best);
+        slot_queue.erase(best);
+        active_slots += 1;
+        ticket->granted = true;
+        ticket->ready.set();
+    }
+}
+
+void CompileGraph::round_started() {
+    rounds_started += 1;
+    if(on_progress) {
+        on_progress(rounds_finished, rounds_started);
+    }
+}
+
+void CompileGraph::round_finished() {
+    rounds_finished += 1;
+    if(on_progress) {
+        on_progress(rounds_finished, rounds_started);
+    }
+    if(rounds_finished == rounds_started) {
+        rounds_started = 0;
+        rounds_finished = 0;
+    }
+}
+
 void CompileGraph::cancel_all() {
     for(auto& [_, unit]: units) {
         cancel_round(unit);
@@ -401,11 +697,35 @@ bool CompileGraph::is_compiling(std::uint32_t path_id) const {
     return it != units.end() && it->second.compiling;
 }
 
+llvm::ArrayRef<std::uint32_t> CompileGraph::dependencies(std::uint32_t path_id) const {
+    auto it = units.find(path_id);
+    if(it == units.end() || !it->second.resolved) {
+        return {};
+    }
+    return it->second.dependencies;
+}
+
+llvm::ArrayRef<std::uint32_t> CompileGraph::dependents(std::uint32_t path_id) const {
+    auto it = units.find(path_id);
+    if(it == units.end()) {
+        return {};
+    }
+    return it->second.dependents;
+}
+
 std::uint32_t CompileGraph::refcount(std::uint32_t path_id) const {
     auto it = units.find(path_id);
     return it != units.end() ? it->second.refcount : 0;
 }
 
+std::uint32_t CompileGraph::dispatching() const {
+    return active_slots;
+}
+
+bool CompileGraph::acyclic() const {
+    return cyclic_edges.empty();
+}
+
 bool CompileGraph::idle() const {
     return ranges::all_of(units, [](const auto& entry) {
         const auto& unit = entry.second;
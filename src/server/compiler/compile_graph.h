@@ -4,9 +4,11 @@
 #include <functional>
 #include <memory>
 #include <optional>
+#include <vector>
 
 #include "kota/async/async.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/SmallVector.h"
 
 namespace clice {
@@ -43,6 +45,10 @@ struct CompileUnit {
     /// Whether resolve_fn has been called for this unit.
     bool resolved = false;
 
+    /// Position in the graph's topological order: below that of every
+    /// dependent, across the edges resolved so far.
+    std::uint32_t order = 0;
+
     bool dirty = true;
     bool compiling = false;
 
@@ -51,6 +57,10 @@ struct CompileUnit {
     /// compiling cancels this unit's round. Not a lifetime count.
     std::uint32_t refcount = 0;
 
+    /// The part of refcount held by interactive requests (see
+    /// CompileGraph::urgent()).
+    std::uint32_t urgent_refcount = 0;
+
     /// A zero-interest cancellation check is already queued for this unit.
     bool zero_check_pending = false;
 
@@ -92,6 +102,21 @@ struct CompileUnit {
 /// - Compile finish: the unit task publishes success/failure through its
 ///   round and wakes waiters; success clears dirty, failure (compile error,
 ///   dependency cycle) propagates to waiters without retry.
+///
+/// Units whose dependencies are done queue for one of max_parallel dispatch
+/// slots. A freed slot goes to the queued unit with the longest chain of
+/// dirty dependents still waiting on it, so the critical path of a deep
+/// module chain is never held up by leaves that unblock nothing.
+///
+/// A request marked urgent (an interactive one, as opposed to indexing)
+/// lends its priority to everything it waits on: those units take free
+/// slots first, their dispatches ask for high priority, and on_promote
+/// hears about the ones already compiling so a queued job can be raised.
+///
+/// The topological order is repaired edge by edge as dependencies resolve,
+/// touching only the units between the two ends, so an acyclic graph
+/// answers every wait-cycle check without a walk; only edges that close a
+/// cycle are set aside and make waits walk the chain of compiling units.
 class CompileGraph {
 public:
     /// Performs the actual compilation (e.g. produce PCM file).
@@ -100,14 +125,29 @@ public:
     /// Returns the dependency path_ids for a given path_id (called lazily on first compile).
     using resolve_fn = std::function<llvm::SmallVector<std::uint32_t>(std::uint32_t path_id)>;
 
+    /// Reports build progress: rounds finished out of rounds started since
+    /// the graph was last quiet. Called once more with finished == started
+    /// when the last round ends.
+    using progress_fn = std::function<void(std::uint32_t finished, std::uint32_t started)>;
+
+    /// Reports a compiling unit that an urgent request has come to wait on.
+    using promote_fn = std::function<void(std::uint32_t path_id)>;
+
     CompileGraph(kota::event_loop& loop, dispatch_fn dispatch, resolve_fn resolve);
 
+    /// Limit concurrent dispatches (0, the default, means no limit).
+    void set_max_parallel(std::uint32_t limit);
+
+    progress_fn on_progress;
+
+    promote_fn on_promote;
+
     /// Compile a unit and all its transitive dependencies.
-    kota::task<bool> compile(std::uint32_t path_id);
+    kota::task<bool> compile(std::uint32_t path_id, bool urgent = false);
 
     /// Compile all transitive module dependencies of path_id, but NOT path_id itself.
     /// Used for non-module files (plain .cpp) that import modules.
-    kota::task<bool> compile_deps(std::uint32_t path_id);
+    kota::task<bool> compile_deps(std::uint32_t path_id, bool urgent = false);
 
     /// Mark path_id and all transitive dependents as dirty,
     /// cancelling any in-progress compilations (their results are stale).
@@ -127,9 +167,31 @@ public:
     bool is_dirty(std::uint32_t path_id) const;
     bool is_compiling(std::uint32_t path_id) const;
 
+    /// Direct dependencies of a unit, once resolved; empty before.
+    llvm::ArrayRef<std::uint32_t> dependencies(std::uint32_t path_id) const;
+
+    /// Units known to depend on this one directly: those whose dependencies
+    /// were resolved so far.
+    llvm::ArrayRef<std::uint32_t> dependents(std::uint32_t path_id) const;
+
     /// Current in-flight interest count for a unit (testing/diagnostics).
     std::uint32_t refcount(std::uint32_t path_id) const;
 
+    /// Dispatch slots currently granted (testing/diagnostics).
+    std::uint32_t dispatching() const;
+
+    /// No resolved dependency edges form a cycle (testing/diagnostics).
+    bool acyclic() const;
+
+    /// Length of the longest chain of dirty dependents waiting on path_id;
+    /// the scheduling priority of a unit that is ready to dispatch.
+    std::uint32_t remaining_path(std::uint32_t path_id) const;
+
+    /// An urgent request waits on path_id, directly or through compiling
+    /// units that depend on it.  Dispatchers read this when a unit's turn
+    /// comes, so it reflects the requests in flight at that moment.
+    bool urgent(std::uint32_t path_id) const;
+
     /// All bookkeeping is quiesced: nothing compiling, no interest held and
     /// every round's completion has fired. Holds whenever no request is in
     /// flight and all unit tasks have unwound (e.g. after shutdown()).
@@ -144,9 +206,24 @@ private:
     struct RefGuard;
     struct UnitGuard;
 
+    /// A unit's claim on a dispatch slot. Queued until granted; the unit's
+    /// guard returns a granted slot or withdraws a queued claim.
+    struct SlotTicket {
+        std::uint32_t path_id = 0;
+        bool granted = false;
+        kota::event ready{};
+    };
+
+    /// Get or create a unit, giving a new one the last place in the order.
+    CompileUnit& unit_of(std::uint32_t path_id);
+
     /// Get or create a unit, resolving its dependencies if needed.
     void ensure_resolved(std::uint32_t path_id);
 
+    /// Move units so that `dependency` orders before `dependent`, or set the
+    /// edge aside in cyclic_edges if it closes a cycle.
+    void order_edge(std::uint32_t dependent, std::uint32_t dependency);
+
     /// Interest +1; creates the unit if needed.
     void acquire(std::uint32_t path_id);
 
@@ -187,13 +264,48 @@ private:
 
     /// Check if waiting on `target` would deadlock: walks the dependency
     /// graph through compiling units to see if any dependency transitively
-    /// reaches the waiting unit.
+    /// reaches the waiting unit. Free while the graph is acyclic.
     bool has_wait_cycle(std::uint32_t target, std::uint32_t waiter) const;
 
+    std::uint32_t remaining_path(std::uint32_t path_id,
+                                 llvm::DenseMap<std::uint32_t, std::uint32_t>& memo) const;
+
+    bool urgent(std::uint32_t path_id, llvm::DenseMap<std::uint32_t, bool>& memo) const;
+
+    /// Report path_id and its compiling transitive dependencies to on_promote.
+    void promote(std::uint32_t path_id);
+
+    /// Grant a slot right away if one is free, else queue the ticket.
+    void request_slot(const std::shared_ptr<SlotTicket>& ticket);
+
+    /// Return a granted slot and hand it on.
+    void release_slot();
+
+    /// Hand free slots to queued tickets: urgent units first, then the
+    /// longest remaining path.
+    void grant_slots();
+
+    /// Round bookkeeping for on_progress.
+    void round_started();
+    void round_finished();
+
     dispatch_fn dispatch;
     resolve_fn resolve;
     llvm::DenseMap<std::uint32_t, CompileUnit> units;
 
+    std::uint32_t next_order = 0;
+
+    /// (dependent, dependency) edges that would have closed a cycle; the
+    /// order holds across all other edges.
+    llvm::DenseSet<std::pair<std::uint32_t, std::uint32_t>> cyclic_edges;
+
+    std::uint32_t max_parallel = 0;
+    std::uint32_t active_slots = 0;
+    std::vector<std::shared_ptr<SlotTicket>> slot_queue;
+
+    std::uint32_t rounds_started = 0;
+    std::uint32_t rounds_finished = 0;
+
     /// Owns every unit task; structured shutdown via shutdown().
     /// Note: kota::task_group only reclaims completed child frames on
     /// destruction, so frames accumulate over the graph's lifetime — one per
@@ -1,23 +1,40 @@
 #include "server/compiler/compiler.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <expected>
 #include <format>
 #include <ranges>
 #include <string>
+#include <utility>
+#include <variant>
 
 #include "command/argument_parser.h"
 #include "command/search_config.h"
+#include "feature/feature.h"
 #include "index/tu_index.h"
+#include "server/protocol/extension.h"
 #include "server/protocol/worker.h"
 #include "support/filesystem.h"
+#include "support/fuzzy_matcher.h"
 #include "support/logging.h"
+#include "support/shared_blob.h"
+#include "support/trace.h"
 #include "syntax/include_resolver.h"
+#include "syntax/lexer.h"
 #include "syntax/scan.h"
 
 #include "kota/async/async.h"
 #include "kota/codec/json/json.h"
 #include "kota/ipc/lsp/position.h"
+#include "kota/ipc/lsp/progress.h"
 #include "kota/ipc/lsp/uri.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/ScopeExit.h"
 #include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
@@ -47,19 +64,167 @@ static std::string cache_key(std::initializer_list<llvm::StringRef> parts) {
     return std::format("{:016x}{:016x}", hash.high64, hash.low64);
 }
 
+/// The standard library modules of libc++ and libstdc++.  They include
+/// only standard headers, so their PCMs depend on the toolchain and the
+/// language flags but not on the project.
+static bool is_toolchain_module(llvm::StringRef name) {
+    return name == "std" || name == "std.compat";
+}
+
+/// PCM key of a standard library module in the toolchain store: that of
+/// any module without the build directory and the user search paths, which
+/// differ between checkouts.  No standard header is expected to resolve
+/// through them.
+static std::string toolchain_pcm_key(llvm::StringRef file,
+                                     llvm::ArrayRef<std::string> arguments) {
+    std::vector<std::string> kept;
+    kept.reserve(arguments.size());
+    for(std::size_t i = 0; i < arguments.size(); ++i) {
+        llvm::StringRef arg = arguments[i];
+        if(arg == "-I" || arg == "-iquote") {
+            i += 1;
+            continue;
+        }
+        if(arg.starts_with("-I") || arg.starts_with("-iquote")) {
+            continue;
+        }
+        kept.push_back(arguments[i]);
+    }
+    return cache_key({clang::getClangFullVersion(),
+                      resource_dir(),
+                      file,
+                      canonical_hash(kept, ArgsProfile::Preprocessing)});
+}
+
+/// Companion of a PCM in the remote cache, under the same key in the
+/// "pcm_meta" namespace: what another machine checks before adopting it.
+struct RemotePCMMeta {
+    /// Files the PCM was built from, and their content hashes then.
+    std::vector<std::string> deps;
+    std::vector<std::uint64_t> hashes;
+    /// Keys of the PCMs of the modules it imports directly.
+    std::vector<std::string> imports;
+};
+
+/// Keys of the PCMs selected for the direct imports of a module; nullopt if
+/// one has none or, with `remote_only`, if one was built here.
+static std::optional<std::vector<std::string>>
+    import_keys(Workspace& workspace, std::uint32_t path_id, bool remote_only) {
+    std::vector<std::string> keys;
+    for(auto dep: workspace.compile_graph->dependencies(path_id)) {
+        auto path_it = workspace.pcm_paths.find(dep);
+        if(path_it == workspace.pcm_paths.end()) {
+            return std::nullopt;
+        }
+        auto key = path::stem(path_it->second).str();
+        if(remote_only) {
+            auto it = workspace.pcm_cache.find(key);
+            if(it == workspace.pcm_cache.end() || !it->second.remote) {
+                return std::nullopt;
+            }
+        }
+        keys.push_back(std::move(key));
+    }
+    return keys;
+}
+
+/// Take the PCM `key` from `store`, the workspace's store with a remote
+/// tier or the toolchain store, if the files it was built from match the
+/// local ones byte for byte.  clang checks the same on load, by content
+/// where mtimes differ (ValidateASTInputFilesContent).
+static kota::task<bool> adopt_shared_pcm(Workspace& workspace,
+                                         CacheStore& store,
+                                         std::string key,
+                                         std::uint32_t path_id) {
+    auto imports = import_keys(workspace, path_id, true);
+    if(!imports) {
+        co_return false;
+    }
+
+    auto meta_path = co_await kota::queue([&] { return store.fetch("pcm_meta", key); });
+    if(!meta_path.has_value() || !meta_path.value()) {
+        co_return false;
+    }
+    RemotePCMMeta meta;
+    auto content = fs::read(*meta_path.value());
+    if(!content || !kota::codec::json::from_json(*content, meta) ||
+       meta.deps.size() != meta.hashes.size() || meta.imports != *imports) {
+        co_return false;
+    }
+
+    // The builder's clock says nothing about local mtimes: with build_at
+    // 0 the check hashes every dependency.
+    auto checked_at = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    DepsSnapshot deps;
+    for(std::size_t i = 0; i < meta.deps.size(); ++i) {
+        deps.path_ids.push_back(workspace.path_pool.intern(meta.deps[i]));
+        deps.hashes.push_back(meta.hashes[i]);
+    }
+    if(workspace.deps_stale(deps)) {
+        // Let a later attempt fetch a newer companion.
+        store.invalidate("pcm_meta", key);
+        co_return false;
+    }
+
+    auto pcm_path = co_await kota::queue([&] { return store.fetch("pcm", key); });
+    if(!pcm_path.has_value() || !pcm_path.value()) {
+        co_return false;
+    }
+
+    deps.build_at = checked_at;
+    workspace.pcm_paths[path_id] = *pcm_path.value();
+    workspace.pcm_cache[key] = {*pcm_path.value(), key, path_id, std::move(deps), true};
+    LOG_INFO("Fetched PCM {} from {}", key, store.base_dir());
+    co_return true;
+}
+
+/// Commit the companion of a PCM built here to `store`, for other machines
+/// or workspaces to adopt it by (see adopt_shared_pcm).
+static kota::task<> share_pcm(Workspace& workspace,
+                              CacheStore& store,
+                              std::string key,
+                              std::uint32_t path_id) {
+    auto imports = import_keys(workspace, path_id, false);
+    auto it = workspace.pcm_cache.find(key);
+    if(!imports || it == workspace.pcm_cache.end()) {
+        co_return;
+    }
+
+    RemotePCMMeta meta{.imports = std::move(*imports)};
+    auto& deps = it->second.deps;
+    for(std::size_t i = 0; i < deps.path_ids.size(); ++i) {
+        meta.deps.push_back(workspace.path_pool.resolve(deps.path_ids[i]).str());
+        meta.hashes.push_back(deps.hashes[i]);
+    }
+    auto json = kota::codec::json::to_json(meta);
+    if(!json) {
+        co_return;
+    }
+
+    auto pending = store.begin_store("pcm_meta", key);
+    if(!fs::write(pending.tmp_path, *json)) {
+        store.abort(pending);
+        co_return;
+    }
+    auto committed = co_await kota::queue([&] { return store.commit(std::move(pending)); });
+    if(!committed.has_value() || !committed.value().has_value()) {
+        LOG_DEBUG("Failed to share the PCM {}", key);
+    }
+}
+
 /// RAII completion of an in-flight PCH build registration: wakes waiters
 /// and clears the building marker on every exit path — crucially also when
 /// the coroutine is cancelled and its frame unwinds at a suspension point,
 /// which would otherwise leave waiters suspended on the event forever.
 struct BuildingGuard {
     Workspace& workspace;
-    std::uint32_t path_id;
+    std::string key;
     std::shared_ptr<kota::event> completion;
 
     ~BuildingGuard() {
         // Reset only our own registration: the entry may have been erased
-        // (didClose) and re-registered by a newer build in the meantime.
-        if(auto it = workspace.pch_cache.find(path_id);
+        // and re-registered by a newer build in the meantime.
+        if(auto it = workspace.pch_cache.find(key);
            it != workspace.pch_cache.end() && it->second.building == completion) {
             it->second.building.reset();
         }
@@ -67,6 +232,38 @@ struct BuildingGuard {
     }
 };
 
+/// Longest chain of delta PCHs ensure_pch builds before it falls back to a
+/// full rebuild.  Every link adds a file clang has to open and validate.
+constexpr std::uint32_t max_pch_chain = 4;
+
+/// Walk a PCH and the PCHs it is chained on.  Returns the number of links,
+/// or 0 when any link is missing, evicted, or was rebuilt after the PCH on
+/// top of it (the chained blob references the old one).  Only the head's
+/// deps are checked: a delta's snapshot includes those of its bases.
+static std::uint32_t pch_chain_length(Workspace& workspace, const PCHState& head) {
+    if(!workspace.store || workspace.deps_stale(head.deps)) {
+        return 0;
+    }
+
+    std::uint32_t length = 0;
+    for(auto* st = &head;;) {
+        if(st->path.empty() || !workspace.store->lookup("pch", st->key)) {
+            return 0;
+        }
+        length += 1;
+        if(st->base.empty()) {
+            return length;
+        }
+
+        auto it = workspace.pch_cache.find(st->base);
+        if(it == workspace.pch_cache.end() || it->second.deps.build_at > st->deps.build_at ||
+           length >= max_pch_chain) {
+            return 0;
+        }
+        st = &it->second;
+    }
+}
+
 /// Detect whether the cursor is inside a preamble directive (include/import).
 
 Compiler::Compiler(kota::event_loop& loop, Workspace& workspace, WorkerPool& pool) :
@@ -105,10 +302,31 @@ void Compiler::init_compile_graph() {
         workspace.toolchain.resolve_or_warn(results[0]);
 
         auto& cmd = results[0];
-        auto scan_result = scan_precise(cmd.to_argv(), cmd.resolved.directory);
+        auto argv = cmd.to_argv();
+        std::vector<std::string> arguments(argv.begin(), argv.end());
+        auto key = cache_key({cmd.resolved.directory,
+                              canonical_hashes.get(arguments, ArgsProfile::Preprocessing)});
+
+        // The last scan holds while the command and the files it read are
+        // the same, as after a restart: cache.bin keeps it.
+        auto& scan = workspace.module_scans[path_id];
+        if(scan.key != key || workspace.deps_stale(scan.deps)) {
+            auto epoch = workspace.fs_epoch;
+            auto scan_result = scan_precise(argv, cmd.resolved.directory, {}, &module_scan_cache);
+            std::vector<std::string> read{file_path.str()};
+            for(auto& include: scan_result.includes) {
+                if(!include.not_found)
+                    read.push_back(std::move(include.path));
+            }
+            scan = {std::move(key),
+                    workspace.snapshot_deps(read, epoch),
+                    std::move(scan_result.module_name),
+                    scan_result.is_interface_unit,
+                    std::move(scan_result.modules)};
+        }
 
         llvm::SmallVector<std::uint32_t> deps;
-        for(auto& mod_name: scan_result.modules) {
+        for(auto& mod_name: scan.imports) {
             auto mod_ids = workspace.dep_graph.lookup_module(mod_name);
             if(!mod_ids.empty()) {
                 deps.push_back(mod_ids[0]);
@@ -116,8 +334,8 @@ void Compiler::init_compile_graph() {
         }
 
         // Module implementation units implicitly depend on their interface unit.
-        if(!scan_result.module_name.empty() && !scan_result.is_interface_unit) {
-            auto mod_ids = workspace.dep_graph.lookup_module(scan_result.module_name);
+        if(!scan.module_name.empty() && !scan.is_interface_unit) {
+            auto mod_ids = workspace.dep_graph.lookup_module(scan.module_name);
             if(!mod_ids.empty()) {
                 deps.push_back(mod_ids[0]);
             }
@@ -137,6 +355,8 @@ void Compiler::init_compile_graph() {
         worker::BuildParams bp;
         bp.kind = worker::BuildKind::BuildPCM;
         bp.file = file_path;
+        if(workspace.compile_graph->urgent(path_id))
+            bp.priority = worker::Priority::High;
         if(!fill_compile_args(file_path, bp.directory, bp.arguments))
             co_return false;
 
@@ -146,27 +366,43 @@ void Compiler::init_compile_graph() {
         }
 
         // Deterministic content-addressed PCM key over the source path and
-        // the frontend-relevant subset of the compile flags.
+        // the flags that can change the PCM.  Warning flags are left out, so
+        // targets that differ only in diagnostics share one PCM.  Standard
+        // library modules go to the toolchain store, keyed on the toolchain
+        // rather than the project (see toolchain_pcm_key).
         auto safe_module_name = mod_it->second;
         std::ranges::replace(safe_module_name, ':', '-');
-        auto pcm_key = std::format("{}-{}",
-                                   safe_module_name,
-                                   cache_key({clang::getClangFullVersion(),
-                                              bp.directory,
-                                              file_path,
-                                              canonicalize(bp.arguments, ArgsProfile::Frontend)}));
-
-        // Check if cached PCM is still valid.
-        if(auto pcm_it = workspace.pcm_cache.find(path_id); pcm_it != workspace.pcm_cache.end()) {
-            if(pcm_it->second.key == pcm_key && workspace.store->lookup("pcm", pcm_key) &&
-               !deps_changed(workspace.path_pool, pcm_it->second.deps)) {
+        bool toolchain_module = workspace.toolchain_store && is_toolchain_module(mod_it->second);
+        auto& store = toolchain_module ? *workspace.toolchain_store : *workspace.store;
+        auto pcm_key = std::format(
+            "{}-{}",
+            safe_module_name,
+            toolchain_module
+                ? toolchain_pcm_key(file_path, bp.arguments)
+                : cache_key({clang::getClangFullVersion(),
+                             bp.directory,
+                             file_path,
+                             canonical_hashes.get(bp.arguments, ArgsProfile::Preprocessing)}));
+
+        // Check if a cached PCM of this variant is still valid.
+        if(auto pcm_it = workspace.pcm_cache.find(pcm_key); pcm_it != workspace.pcm_cache.end()) {
+            if(store.lookup("pcm", pcm_key) && !workspace.deps_stale(pcm_it->second.deps)) {
                 workspace.pcm_paths[path_id] = pcm_it->second.path;
                 co_return true;
             }
         }
 
+        // Another machine, or another workspace, may have built this
+        // variant already.
+        if(toolchain_module || store.is_shared("pcm_meta")) {
+            if(co_await adopt_shared_pcm(workspace, store, pcm_key, path_id)) {
+                workspace.save_cache();
+                co_return true;
+            }
+        }
+
         bp.module_name = mod_it->second;
-        auto pending = workspace.store->begin_store("pcm", pcm_key);
+        auto pending = store.begin_store("pcm", pcm_key);
         bp.output_path = pending.tmp_path;
 
         // Clang needs ALL transitive PCM deps, not just direct imports.
@@ -174,9 +410,10 @@ void Compiler::init_compile_graph() {
         // in pcm_paths from a previous (now-invalidated) build.
         workspace.fill_pcm_deps(bp.pcms, path_id);
 
+        auto epoch = workspace.fs_epoch;
         auto result = co_await pool.send_stateless(bp);
         if(!result.has_value() || !result.value().success) {
-            workspace.store->abort(pending);
+            store.abort(pending);
             LOG_WARN("BuildPCM failed for module {}: {}",
                      mod_it->second,
                      result.has_value() ? result.value().error : result.error().message);
@@ -184,20 +421,25 @@ void Compiler::init_compile_graph() {
         }
 
         // Commit on the thread pool: it fsyncs the freshly written PCM.
-        auto committed =
-            co_await kota::queue([&] { return workspace.store->commit(std::move(pending)); });
+        auto committed = co_await kota::queue([&] { return store.commit(std::move(pending)); });
         if(!committed.has_value() || !committed.value().has_value()) {
             LOG_WARN("Failed to commit PCM for module {}", mod_it->second);
             co_return false;
         }
 
+        // One in the toolchain store is shared as well: the PCMs importing
+        // it there were built against this very file.
         auto pcm_path = std::move(committed.value().value());
         workspace.pcm_paths[path_id] = pcm_path;
-        workspace.pcm_cache[path_id] = {
-            pcm_path,
-            pcm_key,
-            capture_deps_snapshot(workspace.path_pool, result.value().deps)};
+        workspace.pcm_cache[pcm_key] = {pcm_path,
+                                        pcm_key,
+                                        path_id,
+                                        workspace.snapshot_deps(result.value().deps, epoch),
+                                        toolchain_module};
         LOG_INFO("Built PCM for module {}: {}", mod_it->second, pcm_path);
+        if(toolchain_module || store.is_shared("pcm_meta")) {
+            co_await share_pcm(workspace, store, pcm_key, path_id);
+        }
 
         // Persist cache metadata after successful build.
         workspace.save_cache();
@@ -211,6 +453,27 @@ void Compiler::init_compile_graph() {
 
     workspace.compile_graph =
         std::make_unique<CompileGraph>(loop, std::move(dispatch), std::move(resolve));
+
+    // Ready modules wait for a slot in the graph, where the one blocking the
+    // longest chain goes first, instead of piling into the pool's low queue
+    // where they are ordered by estimated cost and mixed with indexing.
+    workspace.compile_graph->set_max_parallel(workspace.config.project.stateless_worker_count);
+    workspace.compile_graph->on_progress = [this](std::uint32_t finished, std::uint32_t started) {
+        modules_built = finished;
+        modules_total = started;
+        module_progress_changed.set();
+        if(peer && !module_progress_active && finished < started) {
+            module_progress_active = true;
+            compile_tasks.spawn(report_module_progress());
+        }
+    };
+
+    // A module build queued for indexing that a hover or completion now
+    // waits on jumps ahead of the rest of the low queue.
+    workspace.compile_graph->on_promote = [this](std::uint32_t path_id) {
+        pool.promote(worker::BuildKind::BuildPCM, workspace.path_pool.resolve(path_id));
+    };
+
     LOG_INFO("CompileGraph initialized with {} module(s)", workspace.path_to_module.size());
 }
 
@@ -317,8 +580,11 @@ bool Compiler::fill_header_context_args(llvm::StringRef path,
 
 std::optional<HeaderFileContext> Compiler::resolve_header_context(std::uint32_t header_path_id,
                                                                   Session* session) {
-    // Find source files that transitively include this header.
-    auto hosts = workspace.dep_graph.find_host_sources(header_path_id);
+    // Find source files that transitively include this header.  One of the
+    // first few nearly always has a CDB entry, so a header included by most
+    // of the project is not searched all the way up unless none does.
+    constexpr std::size_t first_hosts = 8;
+    auto hosts = workspace.dep_graph.find_host_sources(header_path_id, first_hosts);
     if(hosts.empty()) {
         LOG_DEBUG("resolve_header_context: no host sources for path_id={}", header_path_id);
         return std::nullopt;
@@ -341,8 +607,8 @@ std::optional<HeaderFileContext> Compiler::resolve_header_context(std::uint32_t
     }
 
     // Fall back to the first available host that has a CDB entry.
-    if(chain.empty()) {
-        for(auto candidate: hosts) {
+    auto pick_host = [&](llvm::ArrayRef<std::uint32_t> candidates) {
+        for(auto candidate: candidates) {
             auto candidate_path = workspace.path_pool.resolve(candidate);
             auto results = workspace.cdb.lookup(candidate_path);
             if(results.empty())
@@ -352,8 +618,16 @@ std::optional<HeaderFileContext> Compiler::resolve_header_context(std::uint32_t
                 continue;
             host_path_id = candidate;
             chain = std::move(c);
-            break;
+            return;
         }
+    };
+    if(chain.empty()) {
+        pick_host(hosts);
+    }
+    if(chain.empty() && hosts.size() == first_hosts) {
+        // The full list starts with the hosts just tried.
+        auto all_hosts = workspace.dep_graph.find_host_sources(header_path_id);
+        pick_host(llvm::ArrayRef(all_hosts).drop_front(first_hosts));
     }
 
     if(chain.empty()) {
@@ -468,10 +742,23 @@ std::string uri_to_path(const std::string& uri) {
     return uri;
 }
 
-void Compiler::publish_diagnostics(const std::string& uri,
+void Compiler::publish_diagnostics(Session& session,
+                                   const std::string& uri,
                                    int version,
                                    const kota::codec::RawValue& diagnostics_json) {
-    if(!peer)
+    llvm::StringRef json = diagnostics_json.empty() ? "[]" : diagnostics_json.data;
+    auto id = std::format("{:016x}", llvm::xxh3_64bits(json));
+    // Clients expect one publish per edit, even an unchanged one, so only
+    // repeats for the same version are dropped.
+    if(id == session.diagnostics_id && version == session.diagnostics_version) {
+        LOG_DEBUG("Diagnostics of {} unchanged, not published", uri);
+        return;
+    }
+    session.diagnostics = json.str();
+    session.diagnostics_id = std::move(id);
+    session.diagnostics_version = version;
+
+    if(!peer || pull_mode || session.speculative)
         return;
     std::vector<protocol::Diagnostic> diagnostics;
     if(!diagnostics_json.empty()) {
@@ -484,28 +771,61 @@ void Compiler::publish_diagnostics(const std::string& uri,
     params.uri = uri;
     params.version = version;
     params.diagnostics = std::move(diagnostics);
-    peer->send_notification(params);
+    for(auto* client: peers) {
+        client->send_notification(params);
+    }
 }
 
-void Compiler::clear_diagnostics(const std::string& uri) {
-    if(!peer)
+void Compiler::clear_diagnostics(Session& session, const std::string& uri) {
+    publish_diagnostics(session, uri, session.version, serde_raw{"[]"});
+}
+
+void Compiler::share_diagnostics(const Session& session, kota::ipc::JsonPeer& client) {
+    if(pull_mode || session.diagnostics_id.empty()) {
+        return;
+    }
+    auto uri = lsp::URI::from_file_path(std::string(workspace.path_pool.resolve(session.path_id)));
+    if(!uri) {
         return;
+    }
     protocol::PublishDiagnosticsParams params;
-    params.uri = uri;
-    params.diagnostics = {};
-    peer->send_notification(params);
+    params.uri = uri->str();
+    params.version = session.diagnostics_version;
+    if(!kota::codec::json::from_json(session.diagnostics, params.diagnostics)) {
+        LOG_WARN("Failed to deserialize diagnostics JSON for {}", params.uri);
+        return;
+    }
+    client.send_notification(params);
+}
+
+Compiler::RawResult Compiler::pull_diagnostics(std::shared_ptr<Session> session,
+                                               std::string previous_result_id) {
+    // A failed compile has cleared them; the report says so.
+    co_await ensure_compiled(session);
+
+    auto& id = session->diagnostics_id;
+    if(id.empty()) {
+        co_return serde_raw{R"({"kind":"full","items":[]})"};
+    }
+    if(id == previous_result_id) {
+        co_return serde_raw{std::format(R"({{"kind":"unchanged","resultId":"{}"}})", id)};
+    }
+    co_return serde_raw{
+        std::format(R"({{"kind":"full","resultId":"{}","items":{}}})", id, session->diagnostics)};
 }
 
 kota::task<bool> Compiler::ensure_pch(Session& session,
                                       const std::string& directory,
-                                      const std::vector<std::string>& arguments) {
+                                      const std::vector<std::string>& arguments,
+                                      worker::Priority priority) {
     auto path_id = session.path_id;
     auto path = workspace.path_pool.resolve(path_id);
+    trace::Span span("EnsurePCH", path);
     auto& text = session.text;
-    auto bound = compute_preamble_bound(text);
+    auto bounds = compute_preamble_bounds(text);
+    auto bound = bounds.empty() ? 0 : bounds.back();
     if(bound == 0) {
-        // No preamble directives — PCH would be empty. Clear any stale entry.
-        workspace.pch_cache.erase(path_id);
+        // No preamble directives — PCH would be empty.
         session.pch_ref.reset();
         co_return true;
     }
@@ -513,7 +833,8 @@ kota::task<bool> Compiler::ensure_pch(Session& session,
     // Key the PCH by preamble text plus the frontend-relevant compile flags,
     // so files with the same preamble text but different flags (-D, -I, -std)
     // produce separate PCHs.  The source file path stays out of the key so
-    // files with identical preambles share one PCH — but its DIRECTORY (and
+    // files with identical preambles share one entry and one blob, whichever
+    // of them built it.  Its DIRECTORY (and
     // the working directory) must stay in: quote includes and relative paths
     // resolve against them, so equal preamble text in different directories
     // can mean different content.  The clang version guards against reusing
@@ -523,53 +844,89 @@ kota::task<bool> Compiler::ensure_pch(Session& session,
                               directory,
                               path::parent_path(path),
                               preamble_text,
-                              canonicalize(arguments, ArgsProfile::Frontend)});
-
-    // Reuse existing PCH if the key and deps haven't changed.  The store
-    // lookup refreshes the blob's LRU position and catches eviction.
-    if(auto it = workspace.pch_cache.find(path_id); it != workspace.pch_cache.end()) {
-        auto& st = it->second;
-        if(st.key == pch_key && !st.path.empty() && workspace.store &&
-           workspace.store->lookup("pch", pch_key) && !deps_changed(workspace.path_pool, st.deps)) {
-            st.bound = bound;
-            session.pch_ref = Session::PCHRef{path_id, pch_key, bound};
-            co_return true;
-        }
+                              canonical_hashes.get(arguments, ArgsProfile::Frontend)});
+
+    // Reuse the PCH if its deps haven't changed, no matter which file built
+    // it.  The store lookup refreshes the blob's LRU position and catches
+    // eviction, for every link when the PCH is chained.
+    auto usable = [&](const PCHState& st) {
+        return pch_chain_length(workspace, st) != 0;
+    };
+    if(auto it = workspace.pch_cache.find(pch_key);
+       it != workspace.pch_cache.end() && !it->second.building && usable(it->second)) {
+        it->second.last_used = ++workspace.pch_clock;
+        session.pch_ref = Session::PCHRef{pch_key, bound};
+        co_return true;
     }
 
     // Preamble incomplete (user still typing) — defer rebuild, reuse old PCH if available.
+    auto has_old_pch = [&] {
+        if(!session.pch_ref)
+            return false;
+        auto it = workspace.pch_cache.find(session.pch_ref->key);
+        return it != workspace.pch_cache.end() && !it->second.path.empty();
+    };
     if(!is_preamble_complete(text, bound)) {
         LOG_DEBUG("Preamble incomplete for {}, deferring PCH rebuild", path);
-        co_return workspace.pch_cache.count(path_id) && !workspace.pch_cache[path_id].path.empty();
+        co_return has_old_pch();
     }
 
-    // If another coroutine is already building PCH for this file, wait for it.
-    if(auto it = workspace.pch_cache.find(path_id);
+    // If another coroutine is already building this PCH (for this file or
+    // any other with the same key), wait for it.
+    if(auto it = workspace.pch_cache.find(pch_key);
        it != workspace.pch_cache.end() && it->second.building) {
-        co_await it->second.building->wait();
-        if(auto it2 = workspace.pch_cache.find(path_id); it2 != workspace.pch_cache.end()) {
-            session.pch_ref = Session::PCHRef{path_id, it2->second.key, it2->second.bound};
+        auto building = it->second.building;
+        co_await building->wait();
+        if(auto it2 = workspace.pch_cache.find(pch_key);
+           it2 != workspace.pch_cache.end() && !it2->second.path.empty()) {
+            it2->second.last_used = ++workspace.pch_clock;
+            session.pch_ref = Session::PCHRef{pch_key, it2->second.bound};
+            co_return true;
         }
-        co_return workspace.pch_cache.count(path_id) && !workspace.pch_cache[path_id].path.empty();
+        co_return false;
     }
 
     // Register in-flight build so concurrent requests wait on us.  The
     // guard wakes them on every exit, including cancellation mid-await.
     auto completion = std::make_shared<kota::event>();
-    workspace.pch_cache[path_id].building = completion;
-    BuildingGuard guard{workspace, path_id, completion};
+    workspace.pch_cache[pch_key].building = completion;
+    BuildingGuard guard{workspace, pch_key, completion};
 
     if(!workspace.store) {
         LOG_WARN("PCH build skipped: cache store is unavailable");
         co_return false;
     }
 
+    // Chain onto the PCH of the longest directive prefix that is still up
+    // to date, so appending an include only compiles the new directives
+    // instead of the whole preamble.
+    std::string base_key;
+    for(auto prefix: llvm::reverse(bounds)) {
+        if(prefix >= bound) {
+            continue;
+        }
+        auto key = cache_key({clang::getClangFullVersion(),
+                              directory,
+                              path::parent_path(path),
+                              llvm::StringRef(text).substr(0, prefix),
+                              canonical_hashes.get(arguments, ArgsProfile::Frontend)});
+        auto it = workspace.pch_cache.find(key);
+        if(it == workspace.pch_cache.end() || it->second.building) {
+            continue;
+        }
+        auto length = pch_chain_length(workspace, it->second);
+        if(length != 0 && length < max_pch_chain) {
+            base_key = std::move(key);
+        }
+        break;
+    }
+
     // Build a new PCH via stateless worker: it writes the blob to the tmp
     // path allocated here; the store commits (fsync + rename) on success.
     auto pending = workspace.store->begin_store("pch", pch_key);
 
     worker::BuildParams bp;
-    bp.priority = worker::Priority::High;
+    bp.priority = priority;
     bp.kind = worker::BuildKind::BuildPCH;
     bp.file = std::string(path);
     bp.directory = directory;
@@ -577,11 +934,27 @@ kota::task<bool> Compiler::ensure_pch(Session& session,
     bp.text = text;
     bp.preamble_bound = bound;
     bp.output_path = pending.tmp_path;
+    bp.time_trace = *workspace.config.project.time_trace;
+
+    if(!base_key.empty()) {
+        auto& base = workspace.pch_cache[base_key];
+        bp.pch = {base.path, base.bound};
+    }
 
-    LOG_DEBUG("Building PCH for {}, bound={}, key={}", path, bound, pch_key);
+    LOG_DEBUG("Building PCH for {}, bound={}, key={}, base={}", path, bound, pch_key, base_key);
 
+    auto epoch = workspace.fs_epoch;
     auto result = co_await pool.send_stateless(bp);
 
+    // A delta that fails to build (the base was evicted or rebuilt under
+    // us) is retried as a full PCH before giving up.
+    if(!base_key.empty() && (!result.has_value() || !result.value().success)) {
+        LOG_INFO("Chained PCH build failed for {}, rebuilding in full", path);
+        base_key.clear();
+        bp.pch = {};
+        result = co_await pool.send_stateless(bp);
+    }
+
     if(!result.has_value() || !result.value().success) {
         workspace.store->abort(pending);
         LOG_WARN("PCH build failed for {}: {}",
@@ -598,16 +971,54 @@ kota::task<bool> Compiler::ensure_pch(Session& session,
         co_return false;
     }
 
-    auto& st = workspace.pch_cache[path_id];
+    auto& st = workspace.pch_cache[pch_key];
     st.path = committed.value().value();
     st.bound = bound;
     st.key = pch_key;
-    st.deps = capture_deps_snapshot(workspace.path_pool, result.value().deps);
+    st.source = path_id;
+    st.base = base_key;
+    st.deps = workspace.snapshot_deps(result.value().deps, epoch);
     st.document_links_json = std::move(result.value().pch_links_json);
+    if(bp.time_trace) {
+        workspace.time_traces.record(path_id,
+                                     CompilationKind::Preamble,
+                                     std::move(result.value().time_trace));
+    }
 
-    session.pch_ref = Session::PCHRef{path_id, pch_key, bound};
+    // A delta only sees the directives past its base: fold the base's deps
+    // and links in, so staleness checks and document links cover the whole
+    // preamble.
+    if(auto it = workspace.pch_cache.find(base_key);
+       !base_key.empty() && it != workspace.pch_cache.end()) {
+        auto& base = it->second;
+        llvm::DenseSet<std::uint32_t> seen(st.deps.path_ids.begin(), st.deps.path_ids.end());
+        for(std::size_t i = 0; i < base.deps.path_ids.size(); ++i) {
+            if(seen.insert(base.deps.path_ids[i]).second) {
+                st.deps.path_ids.push_back(base.deps.path_ids[i]);
+                st.deps.hashes.push_back(base.deps.hashes[i]);
+            }
+        }
+        if(base.deps.epoch == 0) {
+            st.deps.epoch = 0;
+        }
 
-    LOG_INFO("PCH built for {}: {}", path, st.path);
+        auto& links = st.document_links_json;
+        auto& base_links = base.document_links_json;
+        if(base_links.size() > 2) {
+            if(links.size() > 2) {
+                links.pop_back();
+                links += ',';
+                links.append(base_links.begin() + 1, base_links.end());
+            } else {
+                links = base_links;
+            }
+        }
+    }
+
+    st.last_used = ++workspace.pch_clock;
+    session.pch_ref = Session::PCHRef{pch_key, bound};
+
+    LOG_INFO("PCH built for {}: {}{}", path, st.path, st.base.empty() ? "" : " (chained)");
 
     // Persist cache metadata after successful build.
     workspace.save_cache();
@@ -615,6 +1026,207 @@ kota::task<bool> Compiler::ensure_pch(Session& session,
     co_return true;
 }
 
+void Compiler::prefetch(std::uint32_t path_id) {
+    if(!workspace.store)
+        return;
+
+    std::vector<std::pair<llvm::StringRef, std::string>> blobs;
+    for(auto& [key, st]: workspace.pch_cache) {
+        if(st.source != path_id || st.path.empty())
+            continue;
+        blobs.emplace_back("pch", key.str());
+        auto* link = &st;
+        for(std::uint32_t length = 1; length < max_pch_chain && !link->base.empty(); ++length) {
+            auto it = workspace.pch_cache.find(link->base);
+            if(it == workspace.pch_cache.end())
+                break;
+            blobs.emplace_back("pch", link->base);
+            link = &it->second;
+        }
+    }
+    if(workspace.compile_graph) {
+        if(auto keys = import_keys(workspace, path_id, false)) {
+            for(auto& key: *keys) {
+                blobs.emplace_back("pcm", std::move(key));
+            }
+        }
+    }
+    if(blobs.empty())
+        return;
+
+    // fadvise queues the reads without waiting on them, but may still
+    // block allocating pages for a large file: keep it off the loop.
+    compile_tasks.spawn([](CacheStore& store, decltype(blobs) blobs) -> kota::task<> {
+        co_await kota::queue([&] {
+            for(auto& [ns, key]: blobs) {
+                store.prefetch(ns, key);
+            }
+        });
+    }(*workspace.store, std::move(blobs)));
+}
+
+void Compiler::prewarm_pch(std::shared_ptr<Session> session) {
+    if(!*workspace.config.project.speculative_pch || !workspace.store)
+        return;
+    compile_tasks.spawn(run_prewarm(std::move(session)));
+}
+
+kota::task<> Compiler::run_prewarm(std::shared_ptr<Session> session) {
+    auto path = std::string(workspace.path_pool.resolve(session->path_id));
+    std::string directory;
+    std::vector<std::string> arguments;
+    if(!fill_compile_args(path, directory, arguments, session.get()))
+        co_return;
+
+    LOG_DEBUG("Prewarming PCH for {}", path);
+    co_await ensure_pch(*session, directory, arguments);
+}
+
+void Compiler::warm_neighbours(std::uint32_t path_id) {
+    if(!*workspace.config.project.speculative_pch || !workspace.store)
+        return;
+
+    // A few neighbours per open is enough to cover the files the user is
+    // likely to jump to next without flooding the pool on large directories.
+    constexpr std::size_t max_neighbours = 8;
+    std::size_t queued = 0;
+    auto enqueue = [&](std::uint32_t id) {
+        if(id == path_id || queued >= max_neighbours || !warm_seen.insert(id).second)
+            return;
+        warm_queue.push_back(id);
+        queued += 1;
+    };
+
+    for(auto id: workspace.dep_graph.get_includers(path_id)) {
+        if(workspace.cdb.has_entry(workspace.path_pool.resolve(id)))
+            enqueue(id);
+    }
+
+    auto directory = path::parent_path(workspace.path_pool.resolve(path_id));
+    for(auto file_id: workspace.cdb.files_in(directory)) {
+        if(queued >= max_neighbours)
+            break;
+        enqueue(workspace.path_pool.intern(workspace.cdb.resolve_path(file_id)));
+    }
+
+    start_warming();
+}
+
+void Compiler::warm_files(llvm::ArrayRef<std::uint32_t> path_ids) {
+    if(!*workspace.config.project.speculative_pch || !workspace.store)
+        return;
+    // In reverse, so the best candidate ends up first.  One queued as a
+    // neighbour already moves up; one warmed already is left alone.
+    for(auto id: llvm::reverse(path_ids)) {
+        if(!warm_seen.insert(id).second) {
+            auto it = std::ranges::find(warm_queue, id);
+            if(it == warm_queue.end())
+                continue;
+            warm_queue.erase(it);
+        }
+        warm_queue.push_front(id);
+    }
+    start_warming();
+}
+
+void Compiler::start_warming() {
+    if(!warming && !warm_queue.empty()) {
+        warming = true;
+        compile_tasks.spawn(run_warm_queue());
+    }
+}
+
+void Compiler::compile_speculative(std::shared_ptr<Session> session) {
+    compile_tasks.spawn(run_speculative(session));
+}
+
+kota::task<> Compiler::run_speculative(std::weak_ptr<Session> weak) {
+    // Like neighbour warm-up, this only fills idle time.
+    while(is_idle && !is_idle()) {
+        co_await kota::sleep(std::chrono::milliseconds(500), loop);
+        if(weak.expired())
+            co_return;
+    }
+    auto session = weak.lock();
+    if(!session || !session->ast_dirty)
+        co_return;
+    LOG_DEBUG("Compiling predicted file {} ahead of its open",
+              workspace.path_pool.resolve(session->path_id));
+    co_await ensure_compiled(std::move(session), /*urgent=*/true);
+}
+
+kota::task<> Compiler::refresh_semantic_tokens() {
+    auto result = co_await peer->send_request(ext::SemanticTokensRefreshParams{});
+    if(!result.has_value()) {
+        LOG_DEBUG("Semantic tokens refresh failed: {}", result.error().message);
+    }
+}
+
+kota::task<> Compiler::report_module_progress() {
+    // Most rounds only revalidate a cached PCM; don't flash a progress bar
+    // for those.
+    co_await kota::sleep(std::chrono::milliseconds(500), loop);
+    if(modules_built >= modules_total) {
+        module_progress_active = false;
+        co_return;
+    }
+
+    lsp::ProgressReporter<kota::ipc::JsonPeer> progress(
+        *peer,
+        protocol::ProgressToken(std::string("clice/buildModules")));
+    auto created = co_await progress.create({.timeout = std::chrono::milliseconds(3000)});
+    if(created.has_error()) {
+        module_progress_active = false;
+        co_return;
+    }
+
+    auto percent = [&] {
+        return static_cast<std::uint32_t>(modules_built * 100 / std::max(modules_total, 1u));
+    };
+    progress.begin("Building modules",
+                   std::format("{}/{} modules", modules_built, modules_total),
+                   percent());
+    while(modules_built < modules_total) {
+        module_progress_changed.reset();
+        co_await module_progress_changed.wait();
+        progress.report(std::format("{}/{} modules", modules_built, modules_total), percent());
+    }
+    progress.end(std::format("Built {} modules", modules_total));
+    module_progress_active = false;
+}
+
+kota::task<> Compiler::run_warm_queue() {
+    while(!warm_queue.empty()) {
+        // Background indexing and user-driven builds come first; poll until
+        // the indexer has drained its queue.
+        while(is_idle && !is_idle()) {
+            co_await kota::sleep(std::chrono::milliseconds(500), loop);
+        }
+
+        auto path_id = warm_queue.front();
+        warm_queue.pop_front();
+
+        auto path = std::string(workspace.path_pool.resolve(path_id));
+        auto content = fs::read(path);
+        if(!content)
+            continue;
+
+        std::string directory;
+        std::vector<std::string> arguments;
+        if(!fill_compile_args(path, directory, arguments))
+            continue;
+
+        // A scratch session carries the disk text through ensure_pch; only
+        // the shared pch_cache entry it leaves behind matters.
+        Session scratch;
+        scratch.path_id = path_id;
+        scratch.text = std::move(*content);
+        LOG_DEBUG("Warming PCH for neighbour {}", path);
+        co_await ensure_pch(scratch, directory, arguments, worker::Priority::Low);
+    }
+    warming = false;
+}
+
 /// Compile module dependencies, build/reuse PCH, and fill PCM paths.
 /// Shared preparation step used by both ensure_compiled() (stateful path)
 /// and forward_stateless() (completion/signatureHelp path).
@@ -629,11 +1241,14 @@ kota::task<bool> Compiler::ensure_deps(Session& session,
     // Compile module dependencies within the request scope: cancelling the
     // scope unwinds the wait and releases this request's interest in the
     // dependency graph, without touching the shared compilations themselves.
+    // Only interactive requests get here, so the builds they wait on are
+    // urgent.
     auto compile_deps = [&](std::uint32_t pid) -> kota::task<bool> {
+        auto& graph = *workspace.compile_graph;
         if(!scope) {
-            co_return co_await workspace.compile_graph->compile_deps(pid);
+            co_return co_await graph.compile_deps(pid, true);
         }
-        auto result = co_await kota::with_token(workspace.compile_graph->compile_deps(pid), *scope);
+        auto result = co_await kota::with_token(graph.compile_deps(pid, true), *scope);
         co_return result.has_value() && *result;
     };
 
@@ -662,11 +1277,9 @@ kota::task<bool> Compiler::ensure_deps(Session& session,
 
             for(auto pid: evicted) {
                 for(auto id: workspace.compile_graph->update(pid)) {
-                    workspace.pcm_paths.erase(id);
-                    workspace.pcm_cache.erase(id);
+                    workspace.forget_pcm(id);
                 }
-                workspace.pcm_paths.erase(pid);
-                workspace.pcm_cache.erase(pid);
+                workspace.forget_pcm(pid);
             }
 
             if(!co_await compile_deps(path_id)) {
@@ -710,8 +1323,9 @@ kota::task<bool> Compiler::ensure_deps(Session& session,
 
     // Build or reuse PCH.
     auto pch_ok = co_await ensure_pch(session, directory, arguments);
-    if(pch_ok) {
-        if(auto pch_it = workspace.pch_cache.find(path_id); pch_it != workspace.pch_cache.end()) {
+    if(pch_ok && session.pch_ref) {
+        if(auto pch_it = workspace.pch_cache.find(session.pch_ref->key);
+           pch_it != workspace.pch_cache.end()) {
             pch = {pch_it->second.path, pch_it->second.bound};
         }
     }
@@ -723,23 +1337,127 @@ kota::task<bool> Compiler::ensure_deps(Session& session,
     co_return true;
 }
 
+bool Compiler::lean(const Session& session) const {
+    auto& project = workspace.config.project;
+    return session.many_decls || session.text.size() > project.large_file_bytes.value;
+}
+
 bool Compiler::is_stale(const Session& session) {
-    if(session.ast_deps.has_value() && deps_changed(workspace.path_pool, *session.ast_deps))
+    if(session.ast_deps.has_value() && workspace.deps_stale(*session.ast_deps))
         return true;
 
     // Check PCH staleness via the session's pch_ref.
     if(session.pch_ref.has_value()) {
-        auto pch_it = workspace.pch_cache.find(session.pch_ref->path_id);
+        auto pch_it = workspace.pch_cache.find(session.pch_ref->key);
         if(pch_it != workspace.pch_cache.end() &&
-           deps_changed(workspace.path_pool, pch_it->second.deps))
+           workspace.deps_stale(pch_it->second.deps))
             return true;
     }
 
     return false;
 }
 
-void Compiler::record_deps(Session& session, llvm::ArrayRef<std::string> deps) {
-    session.ast_deps = capture_deps_snapshot(workspace.path_pool, deps);
+void Compiler::record_deps(Session& session,
+                           llvm::ArrayRef<std::string> deps,
+                           std::uint64_t epoch) {
+    session.ast_deps = workspace.snapshot_deps(deps, epoch);
+}
+
+std::string Compiler::result_key(llvm::StringRef path,
+                                 llvm::StringRef text,
+                                 const std::string& directory,
+                                 const std::vector<std::string>& arguments,
+                                 bool lean) {
+    // The PCH and PCMs are content-addressed over the same text and flags;
+    // what else could change them is in the dependency snapshot.  A lean
+    // compile skips bodies whatever the config says, and caps diagnostics.
+    bool skip_bodies = lean || *workspace.config.project.lazy_function_bodies;
+    return cache_key({clang::getClangFullVersion(),
+                      directory,
+                      path,
+                      canonical_hashes.get(arguments, ArgsProfile::Frontend),
+                      skip_bodies ? "lazy-bodies" : "",
+                      lean ? "lean" : "",
+                      text});
+}
+
+kota::task<> Compiler::save_result(std::uint32_t path_id,
+                                   std::string key,
+                                   std::string diagnostics,
+                                   DepsSnapshot deps) {
+    auto& store = *workspace.store;
+    if(auto it = workspace.compile_results.find(path_id);
+       it != workspace.compile_results.end() && it->second.key == key) {
+        // Same content compiled again (a reopen): only the snapshot moves.
+        if(store.lookup("compile", key)) {
+            it->second.deps = std::move(deps);
+            workspace.save_cache();
+            co_return;
+        }
+    }
+
+    // Write and commit on the thread pool: the commit fsyncs the blob.
+    auto pending = store.begin_store("compile", key);
+    auto committed = co_await kota::queue([&]() -> std::expected<std::string, std::error_code> {
+        if(auto written = fs::write(pending.tmp_path, diagnostics); !written) {
+            store.abort(pending);
+            return std::unexpected(written.error());
+        }
+        return store.commit(std::move(pending));
+    });
+    if(!committed.has_value() || !committed.value().has_value()) {
+        LOG_WARN("Failed to cache compile result for {}", workspace.path_pool.resolve(path_id));
+        co_return;
+    }
+
+    auto& entry = workspace.compile_results[path_id];
+    if(!entry.key.empty() && entry.key != key) {
+        store.invalidate("compile", entry.key);
+    }
+    entry = {std::move(key), std::move(deps)};
+    workspace.save_cache();
+}
+
+void Compiler::publish_cached(std::shared_ptr<Session> session) {
+    if(!workspace.store || !workspace.compile_results.contains(session->path_id))
+        return;
+    compile_tasks.spawn(run_publish_cached(std::move(session)));
+}
+
+kota::task<> Compiler::run_publish_cached(std::shared_ptr<Session> session) {
+    auto path_id = session->path_id;
+    auto gen = session->generation;
+    auto path = std::string(workspace.path_pool.resolve(path_id));
+
+    std::string directory;
+    std::vector<std::string> arguments;
+    if(!fill_compile_args(path, directory, arguments, session.get()))
+        co_return;
+
+    auto it = workspace.compile_results.find(path_id);
+    if(it == workspace.compile_results.end() ||
+       it->second.key != result_key(path, session->text, directory, arguments, lean(*session)) ||
+       workspace.deps_stale(it->second.deps))
+        co_return;
+
+    auto blob_path = workspace.store->lookup("compile", it->second.key);
+    if(!blob_path)
+        co_return;
+
+    auto content = co_await kota::queue([&] { return fs::read(*blob_path); });
+    if(!content.has_value() || !content.value().has_value())
+        co_return;
+
+    // An edit or a finished compile has made the cached result obsolete.
+    if(session->generation != gen || !session->ast_dirty)
+        co_return;
+
+    auto uri = lsp::URI::from_file_path(path);
+    LOG_INFO("Published cached diagnostics for {}", path);
+    publish_diagnostics(*session,
+                        uri.has_value() ? uri->str() : path,
+                        session->version,
+                        kota::codec::RawValue{std::move(*content.value())});
 }
 
 /// Pull-based compilation entry point for user-opened files.
@@ -751,6 +1469,8 @@ kota::task<> Compiler::run_compile(std::shared_ptr<Session> session) {
     auto pc = session->compiling;
     auto pid = session->path_id;
     auto gen = session->generation;
+    auto epoch = workspace.fs_epoch;
+    trace::Span span("Compile", workspace.path_pool.resolve(pid));
 
     auto finish_compile = [&]() {
         if(session->compiling == pc) {
@@ -769,7 +1489,6 @@ kota::task<> Compiler::run_compile(std::shared_ptr<Session> session) {
     worker::CompileParams params;
     params.path = file_path;
     params.version = session->version;
-    params.text = session->text;
     if(!fill_compile_args(file_path, params.directory, params.arguments, session.get())) {
         finish_compile();
         co_return;
@@ -797,8 +1516,38 @@ kota::task<> Compiler::run_compile(std::shared_ptr<Session> session) {
         co_return;
     }
 
+    // The worker already holds this version when every edit since its last
+    // full-text compile reached it as a DocumentUpdate delta.
+    params.synced = session->worker_synced_version == params.version;
+    if(!params.synced)
+        params.text = session->text;
+    params.deps_fresh = session->ast_deps.has_value() && !is_stale(*session);
+    params.skip_bodies = *workspace.config.project.lazy_function_bodies;
+    params.precompute_features = *workspace.config.project.precompute_features;
+    params.clang_tidy = workspace.config.project.clang_tidy.value;
+    params.incremental_tidy = *workspace.config.project.incremental_tidy;
+    params.time_trace = *workspace.config.project.time_trace;
+    bool lean_compile = lean(*session);
+    if(lean_compile) {
+        // Nobody reads the bodies of a generated file, nor a thousand of
+        // its warnings.
+        params.skip_bodies = true;
+        params.precompute_features = false;
+        params.clang_tidy = false;
+        params.max_diagnostics = lean_diagnostics;
+    }
+
+    auto started = std::chrono::steady_clock::now();
     auto result = co_await pool.send_stateful(pid, params);
 
+    if(result.has_value() && result.value().out_of_sync && session->generation == gen) {
+        LOG_DEBUG("ensure_compiled: worker copy out of sync, resending text for {}", uri_str);
+        session->worker_synced_version = -1;
+        params.synced = false;
+        params.text = session->text;
+        result = co_await pool.send_stateful(pid, params);
+    }
+
     if(session->generation != gen) {
         LOG_INFO("ensure_compiled: generation mismatch ({} vs {}) for {}",
                  session->generation,
@@ -808,27 +1557,67 @@ kota::task<> Compiler::run_compile(std::shared_ptr<Session> session) {
         co_return;
     }
 
-    if(!result.has_value()) {
-        LOG_WARN("Compile failed for {}: {}", uri_str, result.error().message);
-        clear_diagnostics(uri_str);
+    if(!result.has_value() || result.value().out_of_sync) {
+        LOG_WARN("Compile failed for {}: {}",
+                 uri_str,
+                 result.has_value() ? "worker copy out of sync" : result.error().message);
+        session->worker_synced_version = -1;
+        clear_diagnostics(*session, uri_str);
         finish_compile();
         co_return;
     }
 
     session->ast_dirty = false;
+    session->worker_synced_version = params.version;
     pc->succeeded = true;
-    record_deps(*session, result.value().deps);
+    auto took = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - started);
+    session->compile_time = session->compile_time.count() == 0
+                                ? took
+                                : (session->compile_time * 3 + took) / 4;
+    if(!result.value().deps_unchanged) {
+        record_deps(*session, result.value().deps, epoch);
+    }
+    if(params.time_trace) {
+        workspace.time_traces.record(pid,
+                                     CompilationKind::Content,
+                                     std::move(result.value().time_trace));
+    }
 
-    if(!result.value().tu_index_data.empty()) {
-        auto tu_index = index::TUIndex::from(result.value().tu_index_data.data());
+    session->main_links = std::move(result.value().links.data);
+    session->document_links.clear();
+    session->many_decls =
+        result.value().top_level_decls > workspace.config.project.large_file_decls.value;
+
+    shared_blob::Payload tu_index_data(result.value().tu_index_data,
+                                       result.value().tu_index_segment);
+    if(!tu_index_data.empty()) {
+        auto tu_index = index::TUIndex::from(tu_index_data.data());
         session->file_index = std::move(tu_index.main_file_index);
+        session->index_edits.clear();
         session->symbols = std::move(tu_index.symbols);
     }
 
     auto version = session->version;
     finish_compile();
 
-    publish_diagnostics(uri_str, version, result.value().diagnostics);
+    publish_diagnostics(*session, uri_str, version, result.value().diagnostics);
+    if(session->syntactic_tokens) {
+        session->syntactic_tokens = false;
+        if(peer && semantic_tokens_refresh) {
+            compile_tasks.spawn(refresh_semantic_tokens());
+        }
+    }
+    if(session->unedited && workspace.store && session->ast_deps) {
+        compile_tasks.spawn(save_result(pid,
+                                        result_key(file_path,
+                                                   session->text,
+                                                   params.directory,
+                                                   params.arguments,
+                                                   lean_compile),
+                                        result.value().diagnostics.data,
+                                        *session->ast_deps));
+    }
     if(on_indexing_needed)
         on_indexing_needed();
 }
@@ -837,10 +1626,12 @@ kota::task<> Compiler::run_compile(std::shared_ptr<Session> session) {
 ///
 /// Lifecycle overview (pull-based model):
 ///
-///   didOpen / didChange          – only update Session, mark ast_dirty
+///   didOpen / didChange          – only update Session, mark ast_dirty;
+///                                  didChange schedules an idle compile
 ///   didSave                      – mark dependents dirty, queue indexing
 ///   feature request arrives      – calls ensure_compiled() first
-///     1. Fast-path exit if AST is already clean (!ast_dirty).
+///     1. Fast-path exit if AST is already clean (!ast_dirty).  Otherwise,
+///        unless urgent, wait for the typing to pause (debounce()).
 ///     2. Compile any C++20 module dependencies (PCMs) via CompileGraph.
 ///     3. Build / reuse the precompiled header (PCH) via ensure_pch().
 ///     4. Send CompileParams to the stateful worker, which builds the AST.
@@ -856,7 +1647,7 @@ kota::task<> Compiler::run_compile(std::shared_ptr<Session> session) {
 /// Compiler's task_group; subsequent ones wait on the shared event.
 /// The spawned task is not cancelled by LSP $/cancelRequest, preventing
 /// the race where cancellation wakes all waiters and they all start compiles.
-kota::task<bool> Compiler::ensure_compiled(std::shared_ptr<Session> session) {
+kota::task<bool> Compiler::ensure_compiled(std::shared_ptr<Session> session, bool urgent) {
     auto path_id = session->path_id;
     auto gen = session->generation;
 
@@ -866,6 +1657,19 @@ kota::task<bool> Compiler::ensure_compiled(std::shared_ptr<Session> session) {
               gen,
               session->ast_dirty);
 
+    if(!project_loaded.is_set()) {
+        co_await project_loaded.wait();
+        if(session->generation != gen) {
+            co_return false;
+        }
+    }
+    if(!session->scanned.is_set()) {
+        co_await session->scanned.wait();
+        if(session->generation != gen) {
+            co_return false;
+        }
+    }
+
     if(!session->ast_dirty) {
         if(!is_stale(*session)) {
             co_return true;
@@ -873,6 +1677,16 @@ kota::task<bool> Compiler::ensure_compiled(std::shared_ptr<Session> session) {
         session->ast_dirty = true;
     }
 
+    // Edits made while waiting are folded into this compile, instead of
+    // each restarting it.
+    if(!urgent && !session->compiling) {
+        co_await debounce(session);
+        if(!session->ast_dirty) {
+            co_return true;
+        }
+        gen = session->generation;
+    }
+
     // If an up-to-date compile is already in flight, wait for it.
     // This co_await may be cancelled by LSP $/cancelRequest — that's fine,
     // it just means this particular feature request is abandoned.  The
@@ -922,26 +1736,283 @@ kota::task<bool> Compiler::ensure_compiled(std::shared_ptr<Session> session) {
     co_return !session->ast_dirty;
 }
 
+kota::task<> Compiler::compile_in_background(std::shared_ptr<Session> session) {
+    co_await ensure_compiled(std::move(session));
+}
+
+std::chrono::milliseconds Compiler::debounce_delay(const Session& session) {
+    std::chrono::milliseconds limit(*workspace.config.project.compile_debounce_ms);
+    auto delay = std::max(session.edit_interval * 3 / 2, session.compile_time / 4);
+    return std::clamp(delay, std::chrono::milliseconds(0), limit);
+}
+
+kota::task<bool> Compiler::debounce(std::weak_ptr<Session> weak) {
+    using namespace std::chrono;
+    auto give_up =
+        steady_clock::now() + milliseconds(*workspace.config.project.compile_debounce_ms);
+    while(true) {
+        auto session = weak.lock();
+        if(!session) {
+            co_return false;
+        }
+        auto deadline = std::min(session->last_edit + debounce_delay(*session), give_up);
+        auto wait = duration_cast<milliseconds>(deadline - steady_clock::now());
+        if(wait.count() <= 0) {
+            co_return true;
+        }
+        session.reset();
+        co_await kota::sleep(wait, loop);
+    }
+}
+
+void Compiler::schedule_compile(std::shared_ptr<Session> session) {
+    if(*workspace.config.project.compile_debounce_ms <= 0 || session->idle_compile) {
+        return;
+    }
+    session->idle_compile = true;
+    compile_tasks.spawn(compile_when_idle(session));
+}
+
+kota::task<> Compiler::compile_when_idle(std::weak_ptr<Session> weak) {
+    if(!co_await debounce(weak)) {
+        co_return;
+    }
+    auto session = weak.lock();
+    if(!session) {
+        co_return;
+    }
+    session->idle_compile = false;
+    // A query got there first; its compile publishes the diagnostics.
+    if(!session->ast_dirty || session->compiling) {
+        co_return;
+    }
+    LOG_DEBUG("Idle compile: path_id={} gen={}", session->path_id, session->generation);
+    co_await ensure_compiled(std::move(session), true);
+}
+
+kota::task<std::optional<kota::codec::RawValue>>
+    Compiler::forward_stale_query(worker::QueryKind kind,
+                                  std::shared_ptr<Session> session,
+                                  std::optional<protocol::Position> position,
+                                  std::string previous_result_id) {
+    using K = worker::QueryKind;
+    if(!*workspace.config.project.stale_queries) {
+        co_return std::nullopt;
+    }
+    if(kind != K::Hover && kind != K::SemanticTokens && kind != K::FoldingRange &&
+       kind != K::DocumentSymbol) {
+        co_return std::nullopt;
+    }
+
+    // Only worth it when the answer would otherwise wait for a compile, and
+    // only possible when the worker's text matches ours.
+    if(!session->compiling && !session->ast_dirty) {
+        co_return std::nullopt;
+    }
+    if(session->worker_synced_version != session->version) {
+        co_return std::nullopt;
+    }
+
+    worker::QueryParams wp;
+    wp.kind = kind;
+    wp.path = std::string(workspace.path_pool.resolve(session->path_id));
+    wp.stale = true;
+    wp.version = session->version;
+    wp.previous_result_id = std::move(previous_result_id);
+    if(position) {
+        auto offset = session->line_map().to_offset(*position);
+        if(!offset) {
+            co_return std::nullopt;
+        }
+        wp.offset = *offset;
+    }
+
+    // Nothing is compiling the latest edits yet: start that now so the
+    // fresh results follow the stale ones.
+    if(!session->compiling) {
+        compile_tasks.spawn(compile_in_background(session));
+    }
+
+    auto result = co_await pool.send_stateful(session->path_id, wp);
+    if(!result.has_value()) {
+        LOG_DEBUG("Stale query fell back: path_id={}, {}",
+                  session->path_id,
+                  result.error().message);
+        co_return std::nullopt;
+    }
+    co_return std::move(result.value());
+}
+
+kota::task<std::optional<kota::codec::RawValue>>
+    Compiler::syntactic_query(worker::QueryKind kind, std::shared_ptr<Session> session) {
+    using K = worker::QueryKind;
+    auto& project = workspace.config.project;
+    bool outline =
+        *project.syntactic_outline && (kind == K::FoldingRange || kind == K::DocumentSymbol);
+    // Lexical tokens only stand in for the first AST: later, each edit would
+    // trade the AST's colors for them until the refresh.
+    bool highlight =
+        *project.syntactic_highlighting && kind == K::SemanticTokens && !session->ast_deps;
+    if(!outline && !highlight) {
+        co_return std::nullopt;
+    }
+    if(!session->compiling && !session->ast_dirty) {
+        co_return std::nullopt;
+    }
+    if(!session->compiling) {
+        compile_tasks.spawn(compile_in_background(session));
+    }
+
+    auto text = session->text;
+    if(kind == K::SemanticTokens) {
+        auto lexed = co_await kota::queue([&] { return feature::syntactic_semantic_tokens(text); });
+        auto& tokens = lexed.value();
+
+        // Other identifiers are named by the project index, when all the
+        // symbols of that name are of one kind.
+        auto& index = workspace.project_index;
+        std::erase_if(tokens, [&](feature::SemanticToken& token) {
+            if(token.kind != SymbolKind::Invalid) {
+                return false;
+            }
+            auto name = llvm::StringRef(text).substr(token.range.begin, token.range.length());
+            token.kind = index.kind_of(name);
+            return token.kind == SymbolKind::Invalid || token.kind == SymbolKind::Conflict;
+        });
+
+        auto encoded = feature::semantic_tokens(text, tokens, feature::PositionEncoding::UTF16);
+        auto json = kota::codec::json::to_json<kota::ipc::lsp_config>(encoded);
+        if(!json) {
+            co_return std::nullopt;
+        }
+        session->syntactic_tokens = true;
+        co_return serde_raw{std::move(*json)};
+    }
+
+    auto json = co_await kota::queue([&]() -> std::optional<std::string> {
+        constexpr auto encoding = feature::PositionEncoding::UTF16;
+        auto encode = [](const auto& value) -> std::optional<std::string> {
+            auto json = kota::codec::json::to_json<kota::ipc::lsp_config>(value);
+            return json ? std::optional(std::move(*json)) : std::nullopt;
+        };
+        if(kind == K::FoldingRange) {
+            auto ranges = feature::syntactic_folding_ranges(text);
+            return encode(feature::folding_ranges(text, ranges, encoding));
+        }
+        auto symbols = feature::syntactic_document_symbols(text);
+        return encode(feature::document_symbols(text, symbols, encoding));
+    });
+    if(!json.value()) {
+        co_return std::nullopt;
+    }
+    co_return serde_raw{std::move(*json.value())};
+}
+
+/// How directly a query answers the user: those at the cursor, those that
+/// decorate the viewport, and those that fill side panels.
+enum QueryClass : std::uint8_t {
+    Interactive,
+    Viewport,
+    Background,
+};
+
+static QueryClass query_class(worker::QueryKind kind) {
+    using K = worker::QueryKind;
+    switch(kind) {
+        case K::Hover:
+        case K::GoToDefinition:
+        case K::CodeAction:
+        case K::CompletionResolve:
+        case K::CodeActionResolve:
+        case K::SignatureHelp: return Interactive;
+        case K::SemanticTokens:
+        case K::SemanticTokensRange:
+        case K::InlayHints: return Viewport;
+        case K::FoldingRange:
+        case K::DocumentSymbol: return Background;
+    }
+    return Background;
+}
+
+/// Counts a query in Session::queries_in_flight until it returns.
+struct QueryInFlight {
+    Session& session;
+    QueryClass klass;
+
+    QueryInFlight(Session& session, QueryClass klass) : session(session), klass(klass) {
+        session.queries_in_flight[klass] += 1;
+    }
+
+    ~QueryInFlight() {
+        session.queries_in_flight[klass] -= 1;
+        session.query_finished.set();
+    }
+};
+
+/// Wait until no query of a class above `klass` is in flight on `session`.
+static kota::task<> give_way(Session& session, QueryClass klass) {
+    auto ahead = [&] {
+        return std::any_of(session.queries_in_flight.begin(),
+                           session.queries_in_flight.begin() + klass,
+                           [](std::uint32_t count) { return count != 0; });
+    };
+    while(ahead()) {
+        session.query_finished.reset();
+        co_await session.query_finished.wait();
+    }
+}
+
 Compiler::RawResult Compiler::forward_query(worker::QueryKind kind,
                                             std::shared_ptr<Session> session,
                                             std::optional<protocol::Position> position,
-                                            std::optional<protocol::Range> range) {
+                                            std::optional<protocol::Range> range,
+                                            std::string previous_result_id) {
     auto path_id = session->path_id;
     auto path = std::string(workspace.path_pool.resolve(path_id));
     auto gen = session->generation;
     auto map = session->line_map();
 
-    if(!co_await ensure_compiled(session)) {
+    // Queries at the cursor go first, decorations after them; of those, a
+    // newer request of the same kind replaces one still waiting.
+    auto klass = query_class(kind);
+    auto serial = ++session->query_serials[static_cast<std::uint8_t>(kind)];
+    QueryInFlight in_flight(*session, klass);
+    auto superseded = [&] {
+        return klass != Interactive &&
+               session->query_serials[static_cast<std::uint8_t>(kind)] != serial;
+    };
+
+    // Tokens of a lean file are only computed for the range on screen.
+    if(lean(*session)) {
+        if(kind == worker::QueryKind::SemanticTokens) {
+            co_return serde_raw{R"({"data":[]})"};
+        }
+        if(kind == worker::QueryKind::InlayHints) {
+            co_return serde_raw{"[]"};
+        }
+    }
+
+    if(auto result = co_await forward_stale_query(kind, session, position, previous_result_id)) {
+        co_return std::move(*result);
+    }
+    if(auto result = co_await syntactic_query(kind, session)) {
+        co_return std::move(*result);
+    }
+
+    // Explicit actions are answered without waiting for the typing to pause.
+    if(!co_await ensure_compiled(session, klass == Interactive)) {
         co_return serde_raw{"null"};
     }
 
-    if(session->generation != gen) {
+    co_await give_way(*session, klass);
+    if(session->generation != gen || superseded()) {
         co_return serde_raw{"null"};
     }
 
     worker::QueryParams wp;
     wp.kind = kind;
     wp.path = path;
+    wp.previous_result_id = std::move(previous_result_id);
 
     if(position) {
         auto offset = map.to_offset(*position);
@@ -958,13 +2029,106 @@ Compiler::RawResult Compiler::forward_query(worker::QueryKind kind,
         }
     }
 
-    auto result = co_await pool.send_stateful(path_id, wp);
+    auto result = co_await send_query(session, std::move(wp));
     if(!result.has_value()) {
         co_return serde_raw{};
     }
     co_return std::move(result.value());
 }
 
+/// Queries of one document sent in a single QueryBatchParams.
+struct QueryBatch {
+    worker::QueryBatchParams params;
+    std::vector<kota::codec::RawValue> results;
+    kota::event done;
+};
+
+/// How long the first decoration query of a burst waits for the others.
+constexpr auto query_batch_window = std::chrono::milliseconds(2);
+
+RequestResult<worker::QueryParams> Compiler::send_query(std::shared_ptr<Session> session,
+                                                        worker::QueryParams params) {
+    auto path_id = session->path_id;
+    if(query_class(params.kind) == Interactive) {
+        co_return co_await pool.send_stateful(path_id, params);
+    }
+
+    // The first query opens the batch, which a task of its own sends when
+    // the window closes: $/cancelRequest cancels the query, and must not
+    // strand the others.  Each query takes the answer at its own index.
+    auto batch = session->query_batch;
+    if(!batch) {
+        batch = std::make_shared<QueryBatch>();
+        batch->params.path = params.path;
+        session->query_batch = batch;
+        compile_tasks.spawn(send_batch(session, batch));
+    }
+    auto index = batch->params.queries.size();
+    batch->params.queries.push_back(std::move(params));
+    co_await batch->done.wait();
+
+    if(index >= batch->results.size() || batch->results[index].data.empty()) {
+        co_return kota::outcome_error(kota::ipc::Error{"Batched query failed"});
+    }
+    co_return std::move(batch->results[index]);
+}
+
+kota::task<> Compiler::send_batch(std::shared_ptr<Session> session,
+                                  std::shared_ptr<QueryBatch> batch) {
+    // The batch closes and its queries are answered however this ends.
+    auto close = llvm::make_scope_exit([&] {
+        if(session->query_batch == batch) {
+            session->query_batch.reset();
+        }
+        batch->done.set();
+    });
+    co_await kota::sleep(query_batch_window, loop);
+    if(session->query_batch == batch) {
+        session->query_batch.reset();
+    }
+
+    auto& queries = batch->params.queries;
+    if(queries.size() == 1) {
+        auto result = co_await pool.send_stateful(session->path_id, queries.front());
+        if(result.has_value()) {
+            batch->results.push_back(std::move(result.value()));
+        }
+    } else {
+        auto result = co_await pool.send_stateful(session->path_id, batch->params);
+        if(result.has_value()) {
+            batch->results = std::move(result.value());
+        }
+    }
+}
+
+Compiler::RawResult Compiler::document_links(std::shared_ptr<Session> session) {
+    auto gen = session->generation;
+    if(!co_await ensure_compiled(session) || session->generation != gen) {
+        co_return serde_raw{"null"};
+    }
+
+    std::string pch_key = session->pch_ref ? session->pch_ref->key : "";
+    if(session->document_links.empty() || session->document_links_pch != pch_key) {
+        std::string links = session->main_links.size() > 2 ? session->main_links : "[]";
+        auto pch_it = workspace.pch_cache.find(pch_key);
+        if(!pch_key.empty() && pch_it != workspace.pch_cache.end()) {
+            auto& pch_links = pch_it->second.document_links_json;
+            if(pch_links.size() > 2) {
+                if(links.size() > 2) {
+                    links.pop_back();
+                    links += ',';
+                    links.append(pch_links.begin() + 1, pch_links.end());
+                } else {
+                    links = pch_links;
+                }
+            }
+        }
+        session->document_links = std::move(links);
+        session->document_links_pch = std::move(pch_key);
+    }
+    co_return serde_raw{session->document_links};
+}
+
 Compiler::RawResult Compiler::forward_build(worker::BuildKind kind,
                                             const protocol::Position& position,
                                             std::shared_ptr<Session> session) {
@@ -996,13 +2160,128 @@ Compiler::RawResult Compiler::forward_build(worker::BuildKind kind,
         co_return serde_raw{"null"};
     wp.offset = *offset;
 
-    auto result = co_await pool.send_stateless(wp);
+    // The user kept typing: the result of the previous request is stale, so
+    // stop its compile instead of letting it hold a stateless worker.
+    auto& in_flight = kind == worker::BuildKind::Completion ? session->completion_scope
+                                                            : session->signature_help_scope;
+    if(in_flight)
+        in_flight->cancel();
+    auto scope = std::make_shared<kota::cancellation_source>();
+    in_flight = scope;
+
+    kota::ipc::request_options opts;
+    opts.token = scope->token();
+    auto result = co_await pool.send_stateless(wp, opts);
+    if(in_flight == scope)
+        in_flight.reset();
     if(!result.has_value()) {
         co_return serde_raw{};
     }
     co_return std::move(result.value().result_json);
 }
 
+Compiler::RawResult Compiler::forward_signature_help(const protocol::Position& position,
+                                                     std::shared_ptr<Session> session) {
+    // The worker's copy of the text must be ours for the cursor to map; a
+    // header changed on disk may have changed the declarations.
+    if(session->ast_deps && session->worker_synced_version == session->version &&
+       !is_stale(*session)) {
+        if(auto offset = session->line_map().to_offset(position)) {
+            worker::QueryParams wp;
+            wp.kind = worker::QueryKind::SignatureHelp;
+            wp.path = std::string(workspace.path_pool.resolve(session->path_id));
+            wp.offset = *offset;
+            wp.version = session->version;
+            auto result = co_await pool.send_stateful(session->path_id, wp);
+            if(result.has_value()) {
+                co_return std::move(result.value());
+            }
+            LOG_DEBUG("Stateful signature help fell back: path_id={}, {}",
+                      session->path_id,
+                      result.error().message);
+        }
+    }
+    co_return co_await forward_build(worker::BuildKind::SignatureHelp, position, session);
+}
+
+kota::task<std::optional<kota::codec::RawValue>>
+    Compiler::forward_completion(const protocol::Position& position,
+                                 std::shared_ptr<Session> session) {
+    if(!session->ast_deps) {
+        co_return std::nullopt;
+    }
+
+    auto path_id = session->path_id;
+    auto gen = session->generation;
+
+    worker::CompletionParams wp;
+    wp.path = std::string(workspace.path_pool.resolve(path_id));
+    wp.version = session->version;
+    if(!fill_compile_args(wp.path, wp.directory, wp.arguments, session.get())) {
+        co_return std::nullopt;
+    }
+
+    if(!co_await ensure_deps(*session, wp.directory, wp.arguments, wp.pch, wp.pcms)) {
+        co_return std::nullopt;
+    }
+
+    if(session->generation != gen) {
+        co_return std::nullopt;
+    }
+
+    auto offset = session->line_map().to_offset(position);
+    if(!offset) {
+        co_return std::nullopt;
+    }
+    wp.offset = *offset;
+
+    wp.synced = session->worker_synced_version == wp.version;
+    if(!wp.synced)
+        wp.text = session->text;
+    wp.deps_fresh = !is_stale(*session);
+
+    auto& in_flight = session->completion_scope;
+    if(in_flight)
+        in_flight->cancel();
+    auto scope = std::make_shared<kota::cancellation_source>();
+    in_flight = scope;
+
+    kota::ipc::request_options opts;
+    opts.token = scope->token();
+    auto result = co_await pool.send_stateful(path_id, wp, opts);
+    if(!result.has_value() && wp.synced && !scope->cancelled()) {
+        wp.synced = false;
+        wp.text = session->text;
+        result = co_await pool.send_stateful(path_id, wp, opts);
+    }
+    if(in_flight == scope)
+        in_flight.reset();
+    // Superseded by a newer completion: nothing to fall back for.
+    if(scope->cancelled()) {
+        co_return serde_raw{};
+    }
+    if(!result.has_value()) {
+        LOG_DEBUG("Stateful completion fell back: path_id={}, {}",
+                  path_id,
+                  result.error().message);
+        co_return std::nullopt;
+    }
+    co_return std::move(result.value());
+}
+
+/// Workspace::format_epoch when the watcher covers every directory that
+/// clang-format looks for `file`'s style in, else 0 for a fresh lookup.
+static std::uint64_t format_epoch(Workspace& workspace, llvm::StringRef file) {
+    if(!workspace.watcher || workspace.format_epoch == 0)
+        return 0;
+    for(auto dir = llvm::sys::path::parent_path(file); !dir.empty();
+        dir = llvm::sys::path::parent_path(dir)) {
+        if(!workspace.watcher->watches(dir) && workspace.watcher->add_directory(dir))
+            return 0;
+    }
+    return workspace.format_epoch;
+}
+
 Compiler::RawResult Compiler::forward_format(std::shared_ptr<Session> session,
                                              std::optional<protocol::Range> range) {
     auto path_id = session->path_id;
@@ -1013,6 +2292,7 @@ Compiler::RawResult Compiler::forward_format(std::shared_ptr<Session> session,
     wp.kind = worker::BuildKind::Format;
     wp.file = path;
     wp.text = session->text;
+    wp.format_epoch = format_epoch(workspace, path);
 
     if(range) {
         lsp::LineMap map(wp.text);
@@ -1030,6 +2310,65 @@ Compiler::RawResult Compiler::forward_format(std::shared_ptr<Session> session,
     co_return std::move(result.value().result_json);
 }
 
+Compiler::RawResult Compiler::forward_on_type_format(std::shared_ptr<Session> session,
+                                                     const protocol::Position& position) {
+    auto path = std::string(workspace.path_pool.resolve(session->path_id));
+    auto offset = session->line_map().to_offset(position);
+    if(!offset)
+        co_return serde_raw{"null"};
+
+    worker::BuildParams wp;
+    wp.priority = worker::Priority::High;
+    wp.kind = worker::BuildKind::OnTypeFormat;
+    wp.file = path;
+    wp.text = session->text;
+    wp.offset = *offset;
+    wp.format_epoch = format_epoch(workspace, path);
+
+    auto result = co_await pool.send_stateless(wp);
+    if(!result.has_value()) {
+        co_return serde_raw{"null"};
+    }
+    co_return std::move(result.value().result_json);
+}
+
+/// Raise the score of items whose symbol many files of the project use.
+/// The worker only sees one translation unit; this is the project-wide
+/// signal, applied to the items it kept.
+static void rank_by_references(std::vector<protocol::CompletionItem>& items,
+                               const index::ProjectIndex& project_index) {
+    for(auto& item: items) {
+        auto* data = item.data ? std::get_if<std::int64_t>(&*item.data) : nullptr;
+        double score = 0;
+        if(!data || !item.sort_text || llvm::StringRef(*item.sort_text).getAsDouble(score)) {
+            continue;
+        }
+        auto it = project_index.symbols.find(static_cast<index::SymbolHash>(*data));
+        if(it == project_index.symbols.end()) {
+            continue;
+        }
+        auto files = static_cast<double>(it->second.reference_files.cardinality());
+        item.sort_text = std::format("{}", score * (1.0 + std::log2(1.0 + files) / 10.0));
+    }
+}
+
+/// The identifier around `offset`, as code completion replaces it.
+static std::pair<std::uint32_t, std::uint32_t> identifier_at(llvm::StringRef text,
+                                                             std::uint32_t offset) {
+    auto is_identifier = [](char c) {
+        return llvm::isAlnum(c) || c == '_';
+    };
+    auto begin = offset;
+    while(begin > 0 && is_identifier(text[begin - 1])) {
+        --begin;
+    }
+    auto end = offset;
+    while(end < text.size() && is_identifier(text[end])) {
+        ++end;
+    }
+    return {begin, end};
+}
+
 Compiler::RawResult Compiler::handle_completion(const protocol::Position& position,
                                                 std::shared_ptr<Session> session) {
     auto path_id = session->path_id;
@@ -1051,11 +2390,13 @@ Compiler::RawResult Compiler::handle_completion(const protocol::Position& positi
             for(auto& arg: arguments)
                 args_ptrs.push_back(arg.c_str());
 
+            // The scan has listed the search directories of every command
+            // already; only those it never reached are read here.
             auto search_config = extract_search_config(args_ptrs, directory);
-            DirListingCache dir_cache;
+            auto& dir_cache = workspace.scan_cache.dir_cache;
             auto resolved = resolve_search_config(search_config, dir_cache);
             bool angled = (pctx.kind == CompletionContext::IncludeAngled);
-            auto candidates = complete_include_path(resolved, pctx.prefix, angled, dir_cache);
+            auto candidates = include_completion.complete(resolved, pctx.prefix, angled, dir_cache);
 
             std::vector<protocol::CompletionItem> items;
             items.reserve(candidates.size());
@@ -1085,7 +2426,322 @@ Compiler::RawResult Compiler::handle_completion(const protocol::Position& positi
         }
     }
 
-    co_return co_await forward_build(worker::BuildKind::Completion, position, std::move(session));
+    if(offset) {
+        if(auto narrowed = narrow_completion(*session, *offset)) {
+            co_return serde_raw{std::move(*narrowed)};
+        }
+    }
+
+    auto version = session->version;
+    kota::codec::RawValue result;
+    if(auto pinned = co_await forward_completion(position, session)) {
+        result = std::move(*pinned);
+    } else {
+        result = co_await forward_build(worker::BuildKind::Completion, position, session);
+    }
+    protocol::CompletionList list;
+    if(result.data.empty() || result.data == "null" ||
+       !kota::codec::json::from_json(result.data, list)) {
+        co_return std::move(result);
+    }
+    completion_path = path_id;
+
+    if(offset && session->version == version) {
+        add_indexed_completions(*session, *offset, list);
+    }
+    rank_by_references(list.items, workspace.project_index);
+    auto json = kota::codec::json::to_json<kota::ipc::lsp_config>(list);
+    if(!json) {
+        co_return std::move(result);
+    }
+    // A cut list cannot be narrowed: a longer prefix may match what was cut.
+    if(offset && session->version == version && !list.is_incomplete) {
+        auto [begin, end] = identifier_at(session->text, *offset);
+        session->completion_cache = Session::CompletionCache{
+            .text = session->text,
+            .begin = begin,
+            .offset = *offset,
+            .end = end,
+            .items = std::move(list.items),
+        };
+    }
+    co_return serde_raw{std::move(*json)};
+}
+
+static auto completion_kind(SymbolKind kind) -> protocol::CompletionItemKind {
+    switch(kind) {
+        case SymbolKind::Class:
+        case SymbolKind::Union: return protocol::CompletionItemKind::Class;
+        case SymbolKind::Struct: return protocol::CompletionItemKind::Struct;
+        case SymbolKind::Enum: return protocol::CompletionItemKind::Enum;
+        case SymbolKind::Function: return protocol::CompletionItemKind::Function;
+        case SymbolKind::Variable: return protocol::CompletionItemKind::Variable;
+        case SymbolKind::Macro: return protocol::CompletionItemKind::Unit;
+        default: return protocol::CompletionItemKind::TypeParameter;
+    }
+}
+
+/// The shortest include of `header` from a file in `file_dir`: quoted
+/// relative to that directory or a quoted search path, angled relative to
+/// an angled or system one.
+static std::optional<std::string> include_spelling(llvm::StringRef header,
+                                                   llvm::StringRef file_dir,
+                                                   const SearchConfig& config) {
+    std::optional<std::string> best;
+    auto consider = [&](llvm::StringRef dir, bool angled) {
+        dir = dir.rtrim("/\\");
+        if(dir.empty() || !header.starts_with(dir) || header.size() <= dir.size() + 1 ||
+           !llvm::sys::path::is_separator(header[dir.size()])) {
+            return;
+        }
+        auto relative = llvm::sys::path::convert_to_slash(header.drop_front(dir.size() + 1));
+        auto spelled = angled ? std::format("<{}>", relative) : std::format("\"{}\"", relative);
+        if(!best || spelled.size() < best->size()) {
+            best = std::move(spelled);
+        }
+    };
+    consider(file_dir, false);
+    for(std::size_t i = 0; i < config.dirs.size(); ++i) {
+        consider(config.dirs[i].path, i >= config.angled_start_idx);
+    }
+    return best;
+}
+
+/// Whether `offset` is inside a comment or a literal of `text`, where no
+/// symbol is completed.
+static bool in_comment_or_literal(llvm::StringRef text, std::uint32_t offset) {
+    Lexer lexer(text, false, &cxx_lang_options());
+    while(true) {
+        auto token = lexer.advance();
+        if(token.is_eof() || token.range.begin >= offset) {
+            return false;
+        }
+        if(token.range.end < offset) {
+            continue;
+        }
+        if(token.kind == clang::tok::comment) {
+            // A line comment goes on to the end of the line.
+            return offset < token.range.end || !text.substr(token.range.begin).starts_with("/*");
+        }
+        return clang::tok::isLiteral(token.kind) && offset < token.range.end;
+    }
+}
+
+void Compiler::add_indexed_completions(Session& session,
+                                       std::uint32_t offset,
+                                       protocol::CompletionList& list) {
+    // Members and qualified names need a scope the index does not record.
+    llvm::StringRef text = session.text;
+    auto [begin, end] = identifier_at(text, offset);
+    auto before = text.take_front(begin).rtrim(" \t");
+    if(!index_symbols || begin == offset || llvm::isDigit(text[begin]) ||
+       before.ends_with(".") || before.ends_with("->") || before.ends_with("::") ||
+       in_comment_or_literal(text, offset)) {
+        return;
+    }
+
+    llvm::StringSet<> labels;
+    for(auto& item: list.items) {
+        labels.insert(item.label);
+    }
+    auto symbols = index_symbols(text.slice(begin, offset), 50);
+    if(symbols.empty()) {
+        return;
+    }
+
+    auto path = workspace.path_pool.resolve(session.path_id);
+    std::string directory;
+    std::vector<std::string> arguments;
+    if(!fill_compile_args(path, directory, arguments, &session)) {
+        return;
+    }
+    std::vector<const char*> argv;
+    argv.reserve(arguments.size());
+    for(auto& argument: arguments) {
+        argv.push_back(argument.c_str());
+    }
+    auto config = extract_search_config(argv, directory);
+
+    auto map = session.line_map();
+    auto range = map.to_range(begin, end);
+    // A new include goes on the line after the last directive of the
+    // preamble, or first in the file.
+    auto bound = compute_preamble_bound(text);
+    auto newline = bound == 0 ? std::uint32_t(0) : std::uint32_t(text.find('\n', bound));
+    auto at_end = newline == std::uint32_t(llvm::StringRef::npos);
+    auto insert_offset = bound == 0 ? 0 : at_end ? text.size() : newline + 1;
+    auto insert = map.to_range(insert_offset, insert_offset);
+    if(!range || !insert) {
+        return;
+    }
+
+    std::size_t added = 0;
+    for(auto& symbol: symbols) {
+        if(labels.contains(symbol.name)) {
+            continue;
+        }
+        std::optional<std::string> spelling;
+        for(auto& header: symbol.headers) {
+            auto header_id = workspace.path_pool.find(header);
+            if(header_id &&
+               !workspace.dep_graph.find_include_chain(session.path_id, *header_id).empty()) {
+                spelling.reset();
+                break;
+            }
+            auto spelled = include_spelling(header, llvm::sys::path::parent_path(path), config);
+            if(spelled && (!spelling || spelled->size() < spelling->size())) {
+                spelling = std::move(spelled);
+            }
+        }
+        if(!spelling) {
+            continue;
+        }
+
+        protocol::CompletionItem item{.label = symbol.name};
+        item.kind = completion_kind(symbol.kind);
+        // Under what Sema offers: the user has to accept an include too.
+        item.sort_text = std::format("{}", symbol.score * 0.5F);
+        item.text_edit = protocol::TextEdit{.range = *range, .new_text = symbol.name};
+        item.additional_text_edits = std::vector{protocol::TextEdit{
+            .range = *insert,
+            .new_text = std::format("{}#include {}\n", at_end ? "\n" : "", *spelling),
+        }};
+        protocol::CompletionItemLabelDetails details;
+        details.description = *spelling;
+        item.label_details = std::move(details);
+        item.data = protocol::LSPAny(static_cast<std::int64_t>(symbol.hash));
+        labels.insert(symbol.name);
+        list.items.push_back(std::move(item));
+        added += 1;
+    }
+    // A longer prefix queries the index again.
+    if(added != 0) {
+        list.is_incomplete = true;
+    }
+    LOG_DEBUG("Completion: {} of {} indexed symbols offered with an include",
+              added,
+              symbols.size());
+}
+
+Compiler::RawResult Compiler::resolve_completion(protocol::CompletionItem item,
+                                                 std::shared_ptr<Session> session) {
+    auto* data = item.data ? std::get_if<std::int64_t>(&*item.data) : nullptr;
+    if(data && session) {
+        worker::QueryParams wp;
+        wp.kind = worker::QueryKind::CompletionResolve;
+        wp.path = std::string(workspace.path_pool.resolve(session->path_id));
+        wp.label = item.label;
+        wp.symbol = static_cast<std::uint64_t>(*data);
+        auto result = co_await pool.send_stateful(session->path_id, wp);
+        protocol::CompletionItem resolved;
+        if(result.has_value() && result->data != "null" &&
+           kota::codec::json::from_json(result->data, resolved)) {
+            item.detail = std::move(resolved.detail);
+            item.documentation = std::move(resolved.documentation);
+        }
+    }
+    // Items offered from the index name headers the unit does not include.
+    if(data && !item.documentation && index_documentation) {
+        auto comment = index_documentation(static_cast<index::SymbolHash>(*data));
+        if(!comment.empty()) {
+            markup::Document document;
+            feature::parse_documentation(comment, document);
+            item.documentation = protocol::MarkupContent{
+                .kind = protocol::MarkupKind::markdown,
+                .value = document.as_markdown(),
+            };
+        }
+    }
+    auto json = kota::codec::json::to_json<kota::ipc::lsp_config>(item);
+    co_return serde_raw{json ? std::move(*json) : "null"};
+}
+
+Compiler::RawResult Compiler::code_actions(protocol::Range range,
+                                           std::shared_ptr<Session> session) {
+    code_action_path = session->path_id;
+    co_return co_await forward_query(worker::QueryKind::CodeAction, std::move(session), {}, range);
+}
+
+Compiler::RawResult Compiler::resolve_code_action(protocol::CodeAction action,
+                                                  std::shared_ptr<Session> session) {
+    auto* data = action.data ? std::get_if<std::int64_t>(&*action.data) : nullptr;
+    if(data && session) {
+        worker::QueryParams wp;
+        wp.kind = worker::QueryKind::CodeActionResolve;
+        wp.path = std::string(workspace.path_pool.resolve(session->path_id));
+        wp.label = action.title;
+        wp.symbol = static_cast<std::uint64_t>(*data);
+        auto result = co_await pool.send_stateful(session->path_id, wp);
+        if(result.has_value() && !result->data.empty() && result->data != "null") {
+            co_return std::move(*result);
+        }
+    }
+    auto json = kota::codec::json::to_json<kota::ipc::lsp_config>(action);
+    co_return serde_raw{json ? std::move(*json) : "null"};
+}
+
+std::optional<std::string> Compiler::narrow_completion(Session& session, std::uint32_t offset) {
+    auto& cache = session.completion_cache;
+    if(!cache) {
+        return std::nullopt;
+    }
+
+    // Only the identifier may have changed, and only by growing its prefix;
+    // anything else can change what Sema offers.
+    llvm::StringRef text = session.text;
+    llvm::StringRef old_text = cache->text;
+    auto [begin, end] = identifier_at(text, offset);
+    auto prefix = text.slice(begin, offset);
+    if(begin != cache->begin || !prefix.starts_with(old_text.slice(cache->begin, cache->offset)) ||
+       text.take_front(begin) != old_text.take_front(begin) ||
+       text.drop_front(end) != old_text.drop_front(cache->end)) {
+        return std::nullopt;
+    }
+
+    auto range = session.line_map().to_range(begin, end);
+    if(!range) {
+        return std::nullopt;
+    }
+
+    // Same filtering and scoring as feature::code_complete.  An item's
+    // score is its match of the prefix times what it was ranked for
+    // otherwise; that factor is kept from the cached score.
+    FuzzyMatcher matcher(prefix);
+    FuzzyMatcher old_matcher(old_text.slice(cache->begin, cache->offset));
+    bool underscore = prefix.starts_with("_");
+    std::vector<protocol::CompletionItem> items;
+    for(auto& item: cache->items) {
+        if(!underscore && llvm::StringRef(item.label).starts_with("_")) {
+            continue;
+        }
+        auto score = matcher.match(item.label);
+        if(!score) {
+            continue;
+        }
+        double relevance = 1.0;
+        auto old_score = old_matcher.match(item.label);
+        if(item.sort_text && old_score && *old_score > 0 &&
+           !llvm::StringRef(*item.sort_text).getAsDouble(relevance)) {
+            relevance /= *old_score;
+        } else {
+            relevance = 1.0;
+        }
+
+        auto& narrowed = items.emplace_back(item);
+        narrowed.sort_text = std::format("{}", *score * relevance);
+        if(narrowed.text_edit) {
+            if(auto edit = std::get_if<protocol::TextEdit>(&*narrowed.text_edit)) {
+                edit->range = *range;
+            }
+        }
+    }
+    LOG_DEBUG("Narrowed {} cached completion items to {}", cache->items.size(), items.size());
+
+    auto json = kota::codec::json::to_json<kota::ipc::lsp_config>(items);
+    if(!json) {
+        return std::nullopt;
+    }
+    return std::move(*json);
 }
 
 }  // namespace clice
@@ -1,17 +1,23 @@
 #pragma once
 
+#include <chrono>
 #include <cstdint>
+#include <deque>
 #include <functional>
+#include <memory>
 #include <optional>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "command/argument_parser.h"
 #include "command/command.h"
+#include "server/compiler/indexer.h"
 #include "server/service/session.h"
 #include "server/worker/worker_pool.h"
 #include "server/workspace/workspace.h"
 #include "syntax/completion.h"
+#include "syntax/scan.h"
 
 #include "kota/async/async.h"
 #include "kota/codec/json/json.h"
@@ -19,6 +25,7 @@
 #include "kota/ipc/lsp/protocol.h"
 #include "kota/ipc/peer.h"
 #include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
 
@@ -50,8 +57,35 @@ class Compiler {
 public:
     Compiler(kota::event_loop& loop, Workspace& workspace, WorkerPool& pool);
 
-    void set_peer(kota::ipc::JsonPeer* p) {
-        peer = p;
+    /// LSP clients connected to this server.  Diagnostics are published to
+    /// all of them; requests (refreshes) and progress go to the first one.
+    void add_peer(kota::ipc::JsonPeer* p) {
+        peers.push_back(p);
+        peer = peers.front();
+    }
+
+    void remove_peer(kota::ipc::JsonPeer* p) {
+        std::erase(peers, p);
+        peer = peers.empty() ? nullptr : peers.front();
+    }
+
+    kota::ipc::JsonPeer* primary_peer() const {
+        return peer;
+    }
+
+    std::size_t peer_count() const {
+        return peers.size();
+    }
+
+    /// The client pulls diagnostics (textDocument/diagnostic), so they are
+    /// recorded for pull_diagnostics() instead of pushed.
+    void set_pull_diagnostics(bool pull) {
+        pull_mode = pull;
+    }
+
+    /// Whether the client takes workspace/semanticTokens/refresh requests.
+    void set_semantic_tokens_refresh(bool supported) {
+        semantic_tokens_refresh = supported;
     }
 
     ~Compiler();
@@ -66,19 +100,35 @@ public:
                            Session* session = nullptr);
 
     /// Compile an open file's AST if dirty.  On success, updates session's
-    /// file_index, pch_ref, ast_deps, and publishes diagnostics.
-    kota::task<bool> ensure_compiled(std::shared_ptr<Session> session);
+    /// file_index, pch_ref, ast_deps, and publishes diagnostics.  Unless
+    /// `urgent`, a compile is only started once the typing pauses (see
+    /// debounce()); explicit user actions like hover and goto pass it.
+    kota::task<bool> ensure_compiled(std::shared_ptr<Session> session, bool urgent = false);
+
+    /// Reset while the server loads the CDB and the dependency graph at
+    /// startup: compiles wait for it, since their commands come from them.
+    kota::event project_loaded{true};
+
+    /// Compile an edited file for its diagnostics once the typing pauses,
+    /// when no query did it before (`project.compile_debounce_ms`).
+    void schedule_compile(std::shared_ptr<Session> session);
 
     using RawResult = kota::task<kota::codec::RawValue, kota::ipc::Error>;
 
     /// Forward a query to the stateful worker that holds this file's AST.
     /// Ensures compilation first.  For position-sensitive queries (hover,
     /// goto-definition), pass a Position.  For range-sensitive queries
-    /// (inlay hints), pass a Range.
+    /// (inlay hints), pass a Range.  Semantic token deltas pass the result
+    /// id the client holds.
     RawResult forward_query(worker::QueryKind kind,
                             std::shared_ptr<Session> session,
                             std::optional<protocol::Position> position = {},
-                            std::optional<protocol::Range> range = {});
+                            std::optional<protocol::Range> range = {},
+                            std::string previous_result_id = {});
+
+    /// Document links of the compiled buffer: those the last compile found
+    /// in the main file and those of its PCH, joined on the master.
+    RawResult document_links(std::shared_ptr<Session> session);
 
     /// Forward a build request (signature help, etc.) to a stateless worker.
     /// Sends the full buffer content and compile arguments.
@@ -86,21 +136,121 @@ public:
                             const protocol::Position& position,
                             std::shared_ptr<Session> session);
 
+    /// Signature help from the AST the document's stateful worker holds,
+    /// moved across the edits made since; when the call is not in it, from
+    /// a completion parse on a stateless worker.
+    RawResult forward_signature_help(const protocol::Position& position,
+                                     std::shared_ptr<Session> session);
+
     /// Forward a formatting request to a stateless worker.
     RawResult forward_format(std::shared_ptr<Session> session,
                              std::optional<protocol::Range> range = {});
 
+    /// Format the statement or block completed by the character typed just
+    /// before `position` (textDocument/onTypeFormatting).
+    RawResult forward_on_type_format(std::shared_ptr<Session> session,
+                                     const protocol::Position& position);
+
     /// Handle completion requests.  Detects preamble context (include/import)
-    /// and serves those locally; delegates code completion to a stateless worker.
+    /// and serves those locally; delegates code completion to the document's
+    /// stateful worker (see forward_completion()), or a stateless one.
+    /// While the user extends the identifier that was last completed, the
+    /// previous items are narrowed locally instead (see narrow_completion()).
     RawResult handle_completion(const protocol::Position& position,
                                 std::shared_ptr<Session> session);
 
+    /// Answer a completion at `offset` from session.completion_cache, if the
+    /// buffer only grew the cached identifier's prefix since: the items are
+    /// re-filtered and re-scored with FuzzyMatcher and their edits moved to
+    /// the new identifier range.  Only lists the worker did not cut to its
+    /// limit are cached, so every candidate for the longer prefix is among
+    /// them.
+    std::optional<std::string> narrow_completion(Session& session, std::uint32_t offset);
+
+    /// Answer completionItem/resolve: fill the detail and documentation of
+    /// an item of the last completion in `session`, from the declaration
+    /// its `data` names in the document's AST.  Items the AST does not
+    /// declare are returned as they came.
+    RawResult resolve_completion(protocol::CompletionItem item, std::shared_ptr<Session> session);
+
+    /// Answer textDocument/codeAction with the quick fixes of the diagnostics
+    /// in `range`, whose edits are only computed by resolve_code_action().
+    RawResult code_actions(protocol::Range range, std::shared_ptr<Session> session);
+
+    /// Answer codeAction/resolve: fill the edit of an action of the last
+    /// code action request in `session` from the fix-its of the diagnostic
+    /// its `data` names.  An action whose diagnostic has changed since is
+    /// returned as it came.
+    RawResult resolve_code_action(protocol::CodeAction action, std::shared_ptr<Session> session);
+
+    /// The file the last code actions were computed for.
+    std::optional<std::uint32_t> last_code_action_path() const {
+        return code_action_path;
+    }
+
+    /// The file the last code completion was computed for, whose items the
+    /// client resolves.
+    std::optional<std::uint32_t> last_completion_path() const {
+        return completion_path;
+    }
+
     /// Send an empty diagnostics notification to clear stale markers in the editor.
-    void clear_diagnostics(const std::string& uri);
+    void clear_diagnostics(Session& session, const std::string& uri);
+
+    /// Send the diagnostics last published for `session` to a client that
+    /// just opened it too.
+    void share_diagnostics(const Session& session, kota::ipc::JsonPeer& client);
+
+    /// Answer textDocument/diagnostic once the file is compiled: a full
+    /// report, or "unchanged" when `previous_result_id` names the last one.
+    RawResult pull_diagnostics(std::shared_ptr<Session> session, std::string previous_result_id);
+
+    /// Start building the PCH of a just-opened file, so the first feature
+    /// request finds it ready instead of waiting for the whole preamble.
+    /// Compiles that need the PCH meanwhile wait on the same build.
+    void prewarm_pch(std::shared_ptr<Session> session);
+
+    /// Have the OS read the cached PCHs a just-opened file built, with the
+    /// links they are chained on, and the PCMs it imports, in the
+    /// background: clang mapping them for the first compile then finds
+    /// them in the page cache.
+    void prefetch(std::uint32_t path_id);
+
+    /// Publish the diagnostics cached for a just-opened file whose text,
+    /// flags and dependencies match the last compile of it that was cached.
+    /// The AST is still built by the first feature request.
+    void publish_cached(std::shared_ptr<Session> session);
+
+    /// Queue PCH warm-up for files next to `path_id`: its direct includers
+    /// and the source files in its directory.  They are built one at a time
+    /// at low priority, and only while `is_idle` reports no background work.
+    void warm_neighbours(std::uint32_t path_id);
+
+    /// Queue PCH warm-up for files predicted to be opened next, ahead of
+    /// the neighbours queued before.  Built like them.
+    void warm_files(llvm::ArrayRef<std::uint32_t> path_ids);
+
+    /// Compile a speculative session once `is_idle` reports no background
+    /// work, unless it was dropped meanwhile.
+    void compile_speculative(std::shared_ptr<Session> session);
 
     /// Callback invoked when indexing should be scheduled.
     std::function<void()> on_indexing_needed;
 
+    /// Project symbols named like a prefix that the file may not see yet,
+    /// offered by completion with an #include (Indexer::complete_symbols);
+    /// unset means completion only has what the translation unit sees.
+    std::function<std::vector<IndexedSymbol>(llvm::StringRef query, std::size_t limit)>
+        index_symbols;
+
+    /// The doc comment the index recorded for a symbol, empty if none; fills
+    /// the documentation of a completion item the worker cannot resolve.
+    std::function<std::string(index::SymbolHash)> index_documentation;
+
+    /// Whether background work may run now (the indexer has nothing to do).
+    /// Neighbour warm-up waits until it returns true; unset means always idle.
+    std::function<bool()> is_idle;
+
     /// Cancel in-flight compile tasks and wait for them to finish.
     kota::task<> stop();
 
@@ -118,12 +268,113 @@ private:
 
     kota::task<bool> ensure_pch(Session& session,
                                 const std::string& directory,
-                                const std::vector<std::string>& arguments);
+                                const std::vector<std::string>& arguments,
+                                worker::Priority priority = worker::Priority::High);
+
+    kota::task<> run_prewarm(std::shared_ptr<Session> session);
+
+    /// Run code completion on the stateful worker that compiled the document,
+    /// which keeps the stats and reads of that compile (the PCH among them)
+    /// in memory.  Returns nullopt when the document has no AST there yet or
+    /// the worker fails; the caller then falls back to forward_build().
+    kota::task<std::optional<kota::codec::RawValue>>
+        forward_completion(const protocol::Position& position, std::shared_ptr<Session> session);
+
+    /// Add to `list` the index_symbols() for the identifier completed at
+    /// `offset` that it does not have, each with an edit including the
+    /// header that declares it, spelled the shortest way the file's search
+    /// paths allow.  Headers the file already reaches are not offered.
+    void add_indexed_completions(Session& session,
+                                 std::uint32_t offset,
+                                 protocol::CompletionList& list);
+
+    /// Answer a read-only query from the worker's last AST when the fresh
+    /// one would have to wait for a compile (`project.stale_queries`).
+    /// Returns nullopt when the query must take the normal path.
+    kota::task<std::optional<kota::codec::RawValue>>
+        forward_stale_query(worker::QueryKind kind,
+                            std::shared_ptr<Session> session,
+                            std::optional<protocol::Position> position,
+                            std::string previous_result_id);
+
+    /// Answer folding ranges and document symbols from the lexer alone
+    /// when they would have to wait for a compile, which is started
+    /// (`project.syntactic_outline`).  The next request after the compile
+    /// gets the AST's results.  Semantic tokens are answered the same way
+    /// until the first compile (`project.syntactic_highlighting`), and the
+    /// client is then asked to refresh them.  Returns nullopt for any
+    /// other query.
+    kota::task<std::optional<kota::codec::RawValue>>
+        syntactic_query(worker::QueryKind kind, std::shared_ptr<Session> session);
+
+    /// Send a query to the document's stateful worker.  Decoration queries
+    /// arriving within a couple of milliseconds of each other, as an editor
+    /// sends them after a file switch, share one QueryBatchParams message.
+    RequestResult<worker::QueryParams> send_query(std::shared_ptr<Session> session,
+                                                  worker::QueryParams params);
+
+    /// Send the queries of `batch` once its window closes, then answer them.
+    kota::task<> send_batch(std::shared_ptr<Session> session, std::shared_ptr<QueryBatch> batch);
+    kota::task<> compile_in_background(std::shared_ptr<Session> session);
+
+    /// How long after its last edit a compile of `session` waits: about the
+    /// gap between keystrokes while typing, and a quarter of its usual
+    /// compile time, so fast files lag little behind and slow ones are not
+    /// restarted per keystroke.  Never more than `compile_debounce_ms`.
+    std::chrono::milliseconds debounce_delay(const Session& session);
+
+    /// Wait until the session was not edited for debounce_delay(), or at
+    /// most `compile_debounce_ms` in all.  Returns false if it was closed.
+    kota::task<bool> debounce(std::weak_ptr<Session> session);
+
+    kota::task<> compile_when_idle(std::weak_ptr<Session> session);
+
+    kota::task<> run_warm_queue();
+
+    /// Start run_warm_queue() unless it is running.
+    void start_warming();
+
+    kota::task<> run_speculative(std::weak_ptr<Session> session);
+
+    /// Send workspace/semanticTokens/refresh to the client.
+    kota::task<> refresh_semantic_tokens();
+
+    /// Mirror CompileGraph progress to the client as $/progress while
+    /// module builds are running.
+    kota::task<> report_module_progress();
+
+    /// The file is generated-code sized: over `project.large_file_bytes`
+    /// or, at its last compile, `project.large_file_decls`.  Its compiles
+    /// skip function bodies, clang-tidy and precomputed features and report
+    /// at most `lean_diagnostics` diagnostics; semantic tokens are served
+    /// for ranges only and inlay hints not at all.
+    bool lean(const Session& session) const;
+
+    constexpr static std::uint32_t lean_diagnostics = 200;
 
     bool is_stale(const Session& session);
-    void record_deps(Session& session, llvm::ArrayRef<std::string> deps);
+    void record_deps(Session& session, llvm::ArrayRef<std::string> deps, std::uint64_t epoch);
+
+    /// Key of the cached result of compiling `text` as `path`, leanly or
+    /// not (see Workspace::compile_results).
+    std::string result_key(llvm::StringRef path,
+                           llvm::StringRef text,
+                           const std::string& directory,
+                           const std::vector<std::string>& arguments,
+                           bool lean);
+
+    /// Store the diagnostics of an unedited file's compile in the cache.
+    kota::task<> save_result(std::uint32_t path_id,
+                             std::string key,
+                             std::string diagnostics,
+                             DepsSnapshot deps);
 
-    void publish_diagnostics(const std::string& uri,
+    kota::task<> run_publish_cached(std::shared_ptr<Session> session);
+
+    /// Record `diags` as the file's diagnostics and push them to the
+    /// client, unless they are the ones it has already.
+    void publish_diagnostics(Session& session,
+                             const std::string& uri,
                              int version,
                              const kota::codec::RawValue& diags);
 
@@ -139,9 +390,40 @@ private:
 private:
     kota::event_loop& loop;
     kota::ipc::JsonPeer* peer = nullptr;
+    std::vector<kota::ipc::JsonPeer*> peers;
+    bool pull_mode = false;
+    bool semantic_tokens_refresh = false;
     Workspace& workspace;
     WorkerPool& pool;
     kota::task_group<> compile_tasks{loop};
+
+    /// Directives of the headers the module import scans of the compile
+    /// graph went through; std headers are only tokenized by the first.
+    SharedScanCache module_scan_cache;
+
+    /// Header names for #include completion, over the directory listings
+    /// of the dependency scan.
+    IncludeCompletionIndex include_completion;
+
+    /// Canonical flag hashes of the commands cache keys were derived from.
+    CanonicalHashCache canonical_hashes;
+
+    /// The files the last completion and code actions were computed for,
+    /// whose items resolve requests go back to.
+    std::optional<std::uint32_t> completion_path;
+    std::optional<std::uint32_t> code_action_path;
+
+    /// Files waiting for neighbour PCH warm-up, oldest first.  `warm_seen`
+    /// keeps each file from being queued twice per server run.
+    std::deque<std::uint32_t> warm_queue;
+    llvm::DenseSet<std::uint32_t> warm_seen;
+    bool warming = false;
+
+    /// Latest CompileGraph progress, read by report_module_progress().
+    std::uint32_t modules_built = 0;
+    std::uint32_t modules_total = 0;
+    kota::event module_progress_changed{};
+    bool module_progress_active = false;
 };
 
 }  // namespace clice
@@ -1,7 +1,11 @@
 #include "server/compiler/indexer.h"
 
 #include <algorithm>
+#include <deque>
+#include <limits>
 #include <string>
+#include <tuple>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -11,7 +15,11 @@
 #include "server/service/session.h"
 #include "server/worker/worker_pool.h"
 #include "support/filesystem.h"
+#include "support/fuzzy_matcher.h"
 #include "support/logging.h"
+#include "support/position_map.h"
+#include "support/shared_blob.h"
+#include "support/trace.h"
 
 #include "kota/ipc/lsp/position.h"
 #include "kota/ipc/lsp/protocol.h"
@@ -21,99 +29,352 @@
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
 
 namespace clice {
 
 namespace lsp = kota::ipc::lsp;
 
+/// Reference files whose shards rename() reads in one thread pool job.
+constexpr std::size_t rename_read_chunk = 64;
+
+/// One FileIndex of a TU and what its shard merge needs, resolved on the
+/// event loop so the pool thread never reads shared workspace state.
+struct Indexer::ShardMerge {
+    std::uint32_t path_id = 0;
+
+    /// Points into the TUIndex the merge task keeps alive.
+    index::FileIndex* file_index = nullptr;
+
+    /// Read on the pool thread for position mapping.
+    std::string path;
+
+    /// Set for the TU's main file, which is merged as a compilation context.
+    std::optional<std::vector<index::IncludeLocation>> include_locations;
+
+    /// For headers: the source file whose compilation included the header,
+    /// and its include location; together they key the header context.
+    std::uint32_t host_id = 0;
+    std::uint32_t include_id = 0;
+};
+
+/// Collect non-External symbols referenced in a FileIndex.  Each file's
+/// MergedIndex shard stores exactly the local symbols its occurrences
+/// reference, so lookup is a single shard check — no scanning.
+static index::SymbolTable collect_local_symbols(const index::TUIndex& tu_index,
+                                                const index::FileIndex& file_idx) {
+    index::SymbolTable result;
+    for(auto& occ: file_idx.occurrences) {
+        auto it = tu_index.symbols.find(occ.target);
+        if(it != tu_index.symbols.end() && it->second.scope != index::SymbolScope::External) {
+            result.try_emplace(occ.target, it->second);
+        }
+    }
+    return result;
+}
+
+/// Store key of the copy of an indexed source text in the "source" namespace.
+static std::string source_key(std::uint64_t content_hash) {
+    return std::format("{:016x}", content_hash);
+}
+
+/// Keep `content`, the text a shard hashing it was indexed from, in the
+/// "source" namespace: the shard only records the hash, and its offsets
+/// must still be mapped once the file changes on disk.
+static void keep_source(CacheStore& store, std::uint64_t content_hash, llvm::StringRef content) {
+    auto key = source_key(content_hash);
+    auto pending = store.begin_store("source", key);
+    std::error_code ec;
+    llvm::raw_fd_ostream os(pending.tmp_path, ec);
+    if(!ec) {
+        os << content;
+        os.close();
+    }
+    if(ec || os.has_error()) {
+        LOG_WARN("Failed to write source copy {}: {}", key, (ec ? ec : os.error()).message());
+        os.clear_error();
+        store.abort(pending);
+        return;
+    }
+    if(auto result = store.commit(std::move(pending)); !result) {
+        LOG_WARN("Failed to commit source copy {}: {}", key, result.error().message());
+    }
+}
+
+/// The text `shard` was indexed from: the file at `path` while it hashes the
+/// same, else the copy a blob from before version 2 embeds or the one
+/// keep_source() left in `store`.  Safe on any thread.
+static std::optional<std::string> indexed_content(llvm::StringRef path,
+                                                  const index::MergedIndex& shard,
+                                                  CacheStore* store) {
+    auto hash = shard.content_hash();
+    if(hash == 0)
+        return std::nullopt;
+    auto read = [hash](llvm::StringRef file) -> std::optional<std::string> {
+        auto buf = llvm::MemoryBuffer::getFile(file,
+                                               /*IsText=*/false,
+                                               /*RequiresNullTerminator=*/false);
+        if(!buf || llvm::xxh3_64bits((*buf)->getBuffer()) != hash)
+            return std::nullopt;
+        return (*buf)->getBuffer().str();
+    };
+    if(auto content = read(path))
+        return content;
+    if(auto stored = shard.stored_content(); !stored.empty())
+        return stored.str();
+    if(!store)
+        return std::nullopt;
+    auto copy = store->lookup("source", source_key(hash));
+    return copy ? read(*copy) : std::nullopt;
+}
+
+/// The definitions `shard` holds, located for ProjectIndex, and the symbols
+/// it references without defining them.  `content` is the text it was
+/// indexed from.
+static void collect_definitions(
+    std::uint32_t path_id,
+    const index::MergedIndex& shard,
+    llvm::StringRef content,
+    std::vector<std::pair<index::SymbolHash, index::DefinitionLocation>>& defined,
+    std::vector<index::SymbolHash>& undefined) {
+    auto starts = shard.line_starts();
+    PositionMap map(content, std::vector<std::uint32_t>(starts.begin(), starts.end()));
+    llvm::DenseSet<index::SymbolHash> seen;
+    // The outline is in text order, the order PositionMap converts fastest.
+    for(auto& entry: shard.outline()) {
+        auto range = map.to_range(entry.selection.begin, entry.selection.end);
+        if(!range || !seen.insert(entry.symbol).second)
+            continue;
+        defined.emplace_back(entry.symbol,
+                             index::DefinitionLocation{
+                                 .path_id = path_id,
+                                 .begin_line = range->start.line,
+                                 .begin_character = range->start.character,
+                                 .end_line = range->end.line,
+                                 .end_character = range->end.character,
+                             });
+    }
+    shard.referenced_symbols([&](index::SymbolHash hash) {
+        if(!seen.contains(hash)) {
+            undefined.push_back(hash);
+        }
+    });
+}
+
+void Indexer::index_definitions(std::uint32_t path_id, const index::MergedIndex& shard) {
+    std::vector<std::pair<index::SymbolHash, index::DefinitionLocation>> defined;
+    std::vector<index::SymbolHash> undefined;
+    auto content = shard_content(path_id, shard);
+    collect_definitions(path_id, shard, content.value_or(""), defined, undefined);
+    workspace.project_index.update_definitions(path_id, defined, undefined);
+}
+
+std::optional<std::string> Indexer::shard_content(std::uint32_t proj_path_id,
+                                                  const index::MergedIndex& shard) {
+    return indexed_content(workspace.project_index.path_pool.path(proj_path_id),
+                           shard,
+                           workspace.store ? &*workspace.store : nullptr);
+}
+
 void Indexer::merge(const void* tu_index_data, std::size_t size) {
-    auto tu_index = index::TUIndex::from(tu_index_data);
-    if(tu_index.graph.paths.empty()) {
+    trace::Span span("IndexMerge");
+    auto tu_index = std::make_shared<index::TUIndex>(index::TUIndex::from(tu_index_data));
+    if(tu_index->graph.paths.empty()) {
         LOG_WARN("Ignoring TUIndex with empty path graph");
         return;
     }
-    auto file_ids_map = workspace.project_index.merge(tu_index);
-    auto main_tu_path_id = static_cast<std::uint32_t>(tu_index.graph.paths.size() - 1);
-
-    // Collect non-External symbols referenced in a FileIndex.  Each file's
-    // MergedIndex shard stores exactly the local symbols its occurrences
-    // reference, so lookup is a single shard check — no scanning.
-    auto collect_local_symbols = [&](const index::FileIndex& file_idx) {
-        index::SymbolTable result;
-        for(auto& occ: file_idx.occurrences) {
-            auto it = tu_index.symbols.find(occ.target);
-            if(it != tu_index.symbols.end() && it->second.scope != index::SymbolScope::External) {
-                result.try_emplace(occ.target, it->second);
-            }
-        }
-        return result;
-    };
+    auto file_ids_map = workspace.project_index.merge(*tu_index);
+    auto main_tu_path_id = static_cast<std::uint32_t>(tu_index->graph.paths.size() - 1);
 
-    auto merge_file_index = [&](std::uint32_t tu_path_id, index::FileIndex& file_idx) {
-        auto global_path_id = file_ids_map[tu_path_id];
-        auto& shard = workspace.merged_indices[global_path_id];
+    auto shard_merge = [&](std::uint32_t tu_path_id,
+                           index::FileIndex& file_idx) -> std::optional<ShardMerge> {
+        ShardMerge job;
+        job.path_id = file_ids_map[tu_path_id];
+        job.file_index = &file_idx;
+        job.path = workspace.project_index.path_pool.path(job.path_id).str();
 
         if(tu_path_id == main_tu_path_id) {
-            std::vector<index::IncludeLocation> include_locs;
-            for(auto& loc: tu_index.graph.locations) {
+            auto& include_locs = job.include_locations.emplace();
+            for(auto& loc: tu_index->graph.locations) {
                 index::IncludeLocation remapped = loc;
                 remapped.path_id = file_ids_map[loc.path_id];
                 include_locs.push_back(remapped);
             }
-            auto file_path = workspace.project_index.path_pool.path(global_path_id);
-            llvm::StringRef file_content;
-            std::string file_content_storage;
-            auto buf = llvm::MemoryBuffer::getFile(file_path);
-            if(buf) {
-                file_content_storage = (*buf)->getBuffer().str();
-                file_content = file_content_storage;
-            }
-            shard.merge(global_path_id,
-                        tu_index.built_at,
-                        std::move(include_locs),
-                        file_idx,
-                        file_content);
-            shard.merge_symbols(collect_local_symbols(file_idx));
-        } else {
-            std::optional<std::uint32_t> include_id;
-            for(std::uint32_t i = 0; i < tu_index.graph.locations.size(); ++i) {
-                if(tu_index.graph.locations[i].path_id == tu_path_id) {
-                    include_id = i;
-                    break;
-                }
-            }
-            if(!include_id) {
-                LOG_WARN("Skip merge for path {}: include location not found", global_path_id);
-                return;
-            }
-            auto header_path = workspace.project_index.path_pool.path(global_path_id);
-            llvm::StringRef header_content;
-            std::string header_content_storage;
-            auto header_buf = llvm::MemoryBuffer::getFile(header_path);
-            if(header_buf) {
-                header_content_storage = (*header_buf)->getBuffer().str();
-                header_content = header_content_storage;
-            }
-            shard.merge(global_path_id, *include_id, file_idx, header_content);
-            shard.merge_symbols(collect_local_symbols(file_idx));
+            return job;
+        }
+
+        auto& locations = tu_index->graph.locations;
+        auto it = std::ranges::find(locations, tu_path_id, &index::IncludeLocation::path_id);
+        if(it == locations.end()) {
+            LOG_WARN("Skip merge for path {}: include location not found", job.path_id);
+            return std::nullopt;
         }
+        job.host_id = file_ids_map[main_tu_path_id];
+        job.include_id = static_cast<std::uint32_t>(it - locations.begin());
+        return job;
     };
 
-    for(auto& [tu_path_id, file_idx]: tu_index.path_file_indices) {
-        merge_file_index(tu_path_id, file_idx);
+    // Counted before spawning, so indexing never reports completion between
+    // a merge's spawn and its first step.
+    auto spawn = [&](std::optional<ShardMerge> job) {
+        if(!job) {
+            return;
+        }
+        if(merges_in_flight++ == 0) {
+            merges_idle.reset();
+        }
+        if(!merge_tasks.spawn(merge_shard(tu_index, std::move(*job)))) {
+            if(--merges_in_flight == 0) {
+                merges_idle.set();
+            }
+        }
+    };
+    for(auto& [tu_path_id, file_idx]: tu_index->path_file_indices) {
+        spawn(shard_merge(tu_path_id, file_idx));
     }
-    merge_file_index(main_tu_path_id, tu_index.main_file_index);
+    spawn(shard_merge(main_tu_path_id, tu_index->main_file_index));
 
-    auto external_count = std::ranges::count_if(tu_index.symbols, [](auto& kv) {
+    auto external_count = std::ranges::count_if(tu_index->symbols, [](auto& kv) {
         return kv.second.scope == index::SymbolScope::External;
     });
     LOG_INFO("Merged TUIndex: {} paths, {} symbols ({} external), {} merged_shards",
-             tu_index.graph.paths.size(),
-             tu_index.symbols.size(),
+             tu_index->graph.paths.size(),
+             tu_index->symbols.size(),
              external_count,
              workspace.merged_indices.size());
 }
 
+kota::task<> Indexer::merge_shard(std::shared_ptr<index::TUIndex> tu_index, ShardMerge job) {
+    auto path_id = job.path_id;
+    auto tu_path_id = job.include_locations ? job.path_id : job.host_id;
+    while(auto it = merging_shards.find(path_id); it != merging_shards.end()) {
+        auto done = it->second;
+        co_await done->wait();
+    }
+    auto done = std::make_shared<kota::event>();
+    merging_shards.try_emplace(path_id, done);
+
+    // The pool thread merges into a copy and queries keep serving the shard
+    // as it was; the merged copy replaces it once no reader holds it.
+    auto shard = std::make_shared<index::MergedIndex>();
+    if(auto it = workspace.merged_indices.find(path_id); it != workspace.merged_indices.end()) {
+        *shard = it->second.clone();
+    }
+
+    // Symbols the shard starts and stops referencing, for the reference
+    // files of ProjectIndex.  Filled on the pool thread.
+    struct References {
+        std::vector<index::SymbolHash> added;
+        std::vector<index::SymbolHash> dropped;
+
+        /// False if the shard lost the index a hash-only FileIndex refers to.
+        bool merged = true;
+
+        /// The calls and inheritance of the merged shard, for the call graph
+        /// and type hierarchy.
+        std::vector<index::CallGraph::Call> calls;
+        std::vector<index::TypeHierarchy::Edge> bases;
+
+        /// The definitions the merged shard holds, and the symbols it no
+        /// longer defines, for the definition table of ProjectIndex.
+        std::vector<std::pair<index::SymbolHash, index::DefinitionLocation>> defined;
+        std::vector<index::SymbolHash> undefined;
+    };
+    auto references = std::make_shared<References>();
+
+    auto* store = workspace.store && !read_only ? &*workspace.store : nullptr;
+    auto merge = [tu_index, shard, references, path_id, store, job = std::move(job)]() mutable {
+        llvm::DenseSet<index::SymbolHash> before;
+        shard->referenced_symbols([&](index::SymbolHash hash) { before.insert(hash); });
+        auto previous_hash = shard->content_hash();
+        // Inflating a blob from before version 2 drops the text it embeds.
+        auto legacy = shard->stored_content().str();
+
+        // A hash-only header reuses the shard's entries, content included.
+        std::string content;
+        if(!job.file_index->known_hash) {
+            if(auto buf = llvm::MemoryBuffer::getFile(job.path)) {
+                content = (*buf)->getBuffer().str();
+            }
+        }
+        if(job.include_locations) {
+            references->merged = shard->merge(job.path_id,
+                                              tu_index->built_at,
+                                              std::move(*job.include_locations),
+                                              *job.file_index,
+                                              content);
+        } else {
+            references->merged =
+                shard->merge(job.host_id, job.include_id, *job.file_index, content);
+        }
+        shard->merge_symbols(collect_local_symbols(*tu_index, *job.file_index));
+
+        // The side copy is written when the text changes, and once for a
+        // shard whose blob embedded it.
+        auto hash = shard->content_hash();
+        llvm::StringRef text = content.empty() ? llvm::StringRef(legacy) : content;
+        if(store && hash != 0 && (hash != previous_hash || !legacy.empty()) &&
+           llvm::xxh3_64bits(text) == hash) {
+            keep_source(*store, hash, text);
+        }
+        if(content.empty()) {
+            content = indexed_content(job.path, *shard, store).value_or("");
+        }
+
+        shard->referenced_symbols([&](index::SymbolHash hash) {
+            if(!before.erase(hash)) {
+                references->added.push_back(hash);
+            }
+        });
+        references->dropped.assign(before.begin(), before.end());
+        collect_definitions(path_id,
+                            *shard,
+                            content,
+                            references->defined,
+                            references->undefined);
+        llvm::append_range(references->undefined, references->dropped);
+        references->calls = index::CallGraph::collect(path_id, *shard);
+        references->bases = index::TypeHierarchy::collect(*shard);
+    };
+    auto result = co_await kota::queue(std::move(merge));
+    // The shard in place stays as long as a pool reader points at it.
+    while(shard_readers.contains(path_id)) {
+        co_await shards_unread.wait();
+    }
+    if(!result.has_value()) {
+        LOG_WARN("Failed to merge index shard {}", path_id);
+    } else if(!references->merged) {
+        // The TU left out an index it took the shard to hold; indexing it
+        // again with nothing known sends the whole file.
+        auto tu_path = workspace.project_index.path_pool.path(tu_path_id);
+        auto server_path_id = workspace.path_pool.intern(tu_path);
+        LOG_WARN("Index shard {} no longer holds the index {} reused, indexing it again",
+                 path_id,
+                 tu_path);
+        if(full_reindex.insert(server_path_id).second) {
+            reindex(server_path_id);
+            schedule();
+        }
+    } else {
+        workspace.project_index.update_references(path_id,
+                                                  references->added,
+                                                  references->dropped);
+        workspace.project_index.update_definitions(path_id,
+                                                   references->defined,
+                                                   references->undefined);
+        workspace.call_graph.set(path_id, std::move(references->calls));
+        workspace.project_index.type_hierarchy.set(path_id, std::move(references->bases));
+        workspace.merged_indices[path_id] = std::move(*shard);
+    }
+
+    merging_shards.erase(path_id);
+    done->set();
+
+    if(--merges_in_flight == 0) {
+        merges_idle.set();
+    }
+}
+
 /// Begin a two-phase store write and serialize the blob to its tmp path.
 /// Returns the entry to commit, or nullopt if serialization failed.
 static std::optional<CacheStore::PendingEntry>
@@ -141,10 +402,16 @@ static std::optional<CacheStore::PendingEntry>
     return pending;
 }
 
+/// Store key of a ProjectIndex symbol segment blob.
+static std::string segment_key(std::uint32_t segment, std::uint32_t version) {
+    return std::format("project.{}.{}", segment, version);
+}
+
 kota::task<> Indexer::save() {
-    if(!workspace.store)
+    if(!workspace.store || read_only)
         co_return;
     auto& store = *workspace.store;
+    auto& project = workspace.project_index;
 
     // Phase 1, synchronous: serialize the ProjectIndex and every dirty
     // shard to tmp files.  No suspension point in between, so the batch is
@@ -152,31 +419,94 @@ kota::task<> Indexer::save() {
     // are done.  Shards are only published together with the ProjectIndex
     // they were built against: pairing new shards with an old project blob
     // (or vice versa) would serve a mixed snapshot after restart.
-    auto project_pending = serialize_blob(store, "project", [&](llvm::raw_ostream& os) {
-        workspace.project_index.serialize(os);
+    //
+    // The ProjectIndex is a small "project" header plus one blob per symbol
+    // segment; only segments touched since the last save are written, each
+    // under a new version.  The header names the versions and is committed
+    // after them, so it is what moves a restart over to the new snapshot.
+    auto written = std::exchange(project.dirty_segments, 0);
+    auto previous = project.segment_versions;
+    project.segment_versions.resize(index::ProjectIndex::segment_count, 0);
+    for(std::uint32_t segment = 0; segment < index::ProjectIndex::segment_count; ++segment) {
+        if(written >> segment & 1)
+            project.segment_versions[segment] += 1;
+    }
+    auto restore = [&] {
+        project.segment_versions = previous;
+        project.dirty_segments |= written;
+    };
+
+    std::vector<CacheStore::PendingEntry> segments;
+    bool segments_ok = true;
+    project.serialize_segments(written, [&](std::uint32_t segment, llvm::StringRef data) {
+        auto key = segment_key(segment, project.segment_versions[segment]);
+        if(auto pending =
+               serialize_blob(store, key, [&](llvm::raw_ostream& os) { os << data; })) {
+            segments.push_back(std::move(*pending));
+        } else {
+            segments_ok = false;
+        }
     });
+
+    std::optional<CacheStore::PendingEntry> project_pending;
+    if(segments_ok) {
+        project_pending = serialize_blob(store, "project", [&](llvm::raw_ostream& os) {
+            project.serialize_header(os);
+        });
+    }
     if(!project_pending) {
         LOG_WARN("Skipping index save: ProjectIndex serialization failed");
+        for(auto& pending: segments) {
+            store.abort(pending);
+        }
+        restore();
         co_return;
     }
-    LOG_INFO("Saved ProjectIndex ({} symbols)", workspace.project_index.symbols.size());
-
-    llvm::SmallVector<CacheStore::PendingEntry> shards;
+    LOG_INFO("Saved ProjectIndex ({} symbols, {} of {} segments)",
+             project.symbols.size(),
+             segments.size(),
+             index::ProjectIndex::segment_count);
+
+    // Shards written here are done merging for now: seal them, so their
+    // in-memory maps give way to the compact buffer that is written out.
+    std::vector<CacheStore::PendingEntry> shards;
+    llvm::SmallVector<std::uint32_t> shard_ids;
     std::size_t total = workspace.merged_indices.size();
     for(auto& [path_id, shard]: workspace.merged_indices) {
-        if(!shard.need_rewrite())
+        if(!shard.need_rewrite() || shard_readers.contains(path_id))
             continue;
+        shard.seal();
         if(auto pending = serialize_blob(store,
                                          std::to_string(path_id),
                                          [&](llvm::raw_ostream& os) { shard.serialize(os); })) {
             shards.push_back(std::move(*pending));
+            shard_ids.push_back(path_id);
         }
     }
     LOG_INFO("Saved {} MergedIndex shards (of {} total)", shards.size(), total);
 
-    // Phase 2: commit each blob (fsync + atomic rename) on the kota thread
-    // pool, keeping the heavy IO off the event loop.  The project blob goes
-    // first; if it cannot be published, drop the shards of this snapshot.
+    // Phase 2: commit the blobs (fsync + atomic rename) in batches on the
+    // kota thread pool, keeping the heavy IO off the event loop.  Segments
+    // go first, then the project header; if either cannot be published,
+    // drop the rest of this snapshot.
+    std::vector<std::string> segment_keys;
+    for(auto& pending: segments) {
+        segment_keys.push_back(pending.key);
+    }
+    auto segment_results = co_await store.commit_batch_async(std::move(segments));
+    for(std::size_t i = 0; i < segment_results.size(); ++i) {
+        if(!segment_results[i].has_value()) {
+            LOG_WARN("Failed to commit ProjectIndex segment {}, dropping the snapshot",
+                     segment_keys[i]);
+            store.abort(*project_pending);
+            for(auto& pending: shards) {
+                store.abort(pending);
+            }
+            restore();
+            co_return;
+        }
+    }
+
     auto committed =
         co_await kota::queue([&] { return store.commit(std::move(*project_pending)); });
     if(!committed.has_value() || !committed.value().has_value()) {
@@ -184,67 +514,291 @@ kota::task<> Indexer::save() {
         for(auto& pending: shards) {
             store.abort(pending);
         }
+        restore();
         co_return;
     }
 
-    // FIXME: shard commits are strictly sequential (one co_await per shard).
-    // For large projects this adds ~N×2ms of round-trip overhead.  Consider
-    // batching commits or dispatching them in parallel on the thread pool.
+    // The local index now holds the base it adopted in full.
+    if(!pending_base.empty() &&
+       fs::write(path::join(store.base_dir(), "index.base"), pending_base).has_value()) {
+        pending_base.clear();
+    }
+
+    // The new header no longer references the segment versions it replaced.
+    for(std::uint32_t segment = 0; segment < previous.size(); ++segment) {
+        if((written >> segment & 1) && previous[segment] != 0)
+            store.invalidate("index", segment_key(segment, previous[segment]));
+    }
+
+    std::vector<std::string> shard_keys;
     for(auto& pending: shards) {
-        auto key = pending.key;
-        auto result = co_await kota::queue([&] { return store.commit(std::move(pending)); });
-        if(!result.has_value() || !result.value().has_value()) {
-            LOG_WARN("Failed to commit index blob {}", key);
+        shard_keys.push_back(pending.key);
+    }
+    auto shard_results = co_await store.commit_batch_async(std::move(shards));
+    for(std::size_t i = 0; i < shard_results.size(); ++i) {
+        if(!shard_results[i].has_value()) {
+            LOG_WARN("Failed to commit index blob {}", shard_keys[i]);
+            continue;
         }
+        // A shard merged into meanwhile is inflated and stays dirty anyway.
+        if(auto it = workspace.merged_indices.find(shard_ids[i]);
+           it != workspace.merged_indices.end()) {
+            it->second.mark_saved();
+        }
+        base_shards.erase(shard_ids[i]);
     }
 }
 
-void Indexer::load() {
+namespace {
+
+/// How reading a ProjectIndex snapshot went.
+enum class Snapshot {
+    /// Absent, of an unreadable schema version, or missing a segment.
+    Missing,
+    Loaded,
+    /// A blob could not be read, but may be on the next try.
+    Unreadable,
+};
+
+using BlobLookup = llvm::function_ref<std::optional<std::string>(llvm::StringRef key)>;
+
+}  // namespace
+
+/// Read the ProjectIndex header and the symbol segments it names into
+/// `project`, adding the segment keys to `segments`.  `project` is left
+/// empty unless the snapshot is loaded.
+static Snapshot read_snapshot(BlobLookup lookup,
+                              index::ProjectIndex& project,
+                              llvm::StringSet<>& segments) {
+    auto project_path = lookup("project");
+    if(!project_path)
+        return Snapshot::Missing;
+
+    auto buf = llvm::MemoryBuffer::getFile(*project_path);
+    if(!buf) {
+        LOG_WARN("Failed to read ProjectIndex blob: {}", buf.getError().message());
+        return Snapshot::Unreadable;
+    }
+    if(!index::ProjectIndex::readable((*buf)->getBufferStart())) {
+        LOG_WARN("ProjectIndex blob has an unreadable schema version, discarding the index");
+        return Snapshot::Missing;
+    }
+    project = index::ProjectIndex::from((*buf)->getBufferStart());
+
+    // The header names the version of each symbol segment it was committed
+    // with.  A missing one leaves the snapshot incomplete: discard it all.
+    auto& versions = project.segment_versions;
+    for(std::uint32_t segment = 0; segment < versions.size(); ++segment) {
+        if(versions[segment] == 0)
+            continue;
+        auto key = segment_key(segment, versions[segment]);
+        auto segment_path = lookup(key);
+        if(!segment_path) {
+            LOG_WARN("ProjectIndex segment {} is missing, discarding the index", key);
+            project = index::ProjectIndex();
+            return Snapshot::Missing;
+        }
+        auto segment_buf = llvm::MemoryBuffer::getFile(*segment_path);
+        if(!segment_buf) {
+            LOG_WARN("Failed to read ProjectIndex segment {}: {}",
+                     key,
+                     segment_buf.getError().message());
+            project = index::ProjectIndex();
+            return Snapshot::Unreadable;
+        }
+        project.load_segment((*segment_buf)->getBufferStart());
+        segments.insert(key);
+    }
+    return Snapshot::Loaded;
+}
+
+/// The index namespace directory of the store project.base_index names:
+/// read in place, never opened as a CacheStore, so it stays untouched.
+static std::string base_index_dir(const Config& config) {
+    auto& root = config.project.base_index;
+    if(root.empty())
+        return {};
+    return path::join(CacheStore::versioned_dir(root, cache_format_version), "index");
+}
+
+void Indexer::load(llvm::StringRef workspace_root) {
     if(!workspace.store)
         return;
+    auto& store = *workspace.store;
+    base_shards.clear();
+    base_matches.clear();
+
+    // A base index is a store another machine (a build farm) filled for the
+    // same project.  Each new snapshot of it replaces the local index once;
+    // from then on only files that differ from it are indexed here, and its
+    // shards are mapped from the base directory until they are.
+    auto base_dir = base_index_dir(workspace.config);
+    auto from_base = [&](llvm::StringRef key) -> std::optional<std::string> {
+        auto blob = path::join(base_dir, key.str() + ".idx");
+        if(!fs::exists(blob))
+            return std::nullopt;
+        return blob;
+    };
+    std::string base_id;
+    if(!base_dir.empty()) {
+        if(auto header = from_base("project")) {
+            if(auto buf = llvm::MemoryBuffer::getFile(*header)) {
+                base_id = std::format("{:016x}", llvm::xxh3_64bits((*buf)->getBuffer()));
+            }
+        }
+    }
+    auto adopted = fs::read(path::join(store.base_dir(), "index.base")).value_or("");
 
     bool has_project = false;
-    auto project_path = workspace.store->lookup("index", "project");
-    if(project_path) {
-        auto buf = llvm::MemoryBuffer::getFile(*project_path);
-        if(!buf) {
-            // Transient read failure — don't load shards (useless without
-            // the project index), but don't destroy them either.
-            LOG_WARN("Failed to read ProjectIndex blob: {}", buf.getError().message());
+    bool adopting = false;
+    llvm::StringSet<> live_segments;
+    if(!base_id.empty() && base_id != adopted && !read_only) {
+        llvm::StringSet<> base_segments;
+        auto& project = workspace.project_index;
+        if(read_snapshot(from_base, project, base_segments) == Snapshot::Loaded) {
+            auto& base_root = workspace.config.project.base_index_root;
+            if(!base_root.empty() && !workspace_root.empty())
+                project.path_pool.remap(base_root, workspace_root);
+            // Written out whole on the next save, under local segment keys.
+            project.dirty_segments = ~std::uint64_t(0);
+            has_project = true;
+            adopting = true;
+            adopted = base_id;
+            pending_base = base_id;
+            LOG_INFO("Adopted base index {}: {} symbols",
+                     std::string_view(workspace.config.project.base_index),
+                     project.symbols.size());
+        }
+    }
+
+    if(!has_project) {
+        auto local = [&](llvm::StringRef key) { return store.lookup("index", key); };
+        auto state = read_snapshot(local, workspace.project_index, live_segments);
+        // Transient read failure — don't load shards (useless without the
+        // project index), but don't destroy them either.
+        if(state == Snapshot::Unreadable)
             return;
+        has_project = state == Snapshot::Loaded;
+        if(has_project) {
+            LOG_INFO("Loaded ProjectIndex: {} symbols", workspace.project_index.symbols.size());
         }
-        workspace.project_index = index::ProjectIndex::from((*buf)->getBufferStart());
-        has_project = true;
-        LOG_INFO("Loaded ProjectIndex: {} symbols", workspace.project_index.symbols.size());
     }
 
     // Load shards; sweep blobs that no longer correspond to anything —
     // unparseable keys, or all shards when the project index itself is
-    // gone (Persistent namespace cleanup is the caller's mark-and-sweep).
+    // gone or replaced by a base (Persistent namespace cleanup is the
+    // caller's mark-and-sweep).
     llvm::SmallVector<std::string> orphans;
-    workspace.store->for_each_key("index", [&](llvm::StringRef key) {
+    store.for_each_key("index", [&](llvm::StringRef key) {
         if(key == "project")
             return;
 
+        if(key.starts_with("project.")) {
+            if(!live_segments.contains(key))
+                orphans.push_back(key.str());
+            return;
+        }
+
         std::uint32_t path_id = 0;
-        if(key.getAsInteger(10, path_id) || !has_project) {
+        if(key.getAsInteger(10, path_id) || !has_project || adopting) {
             orphans.push_back(key.str());
             return;
         }
 
-        auto shard_path = workspace.store->lookup("index", key);
+        auto shard_path = store.lookup("index", key);
         if(shard_path) {
             workspace.merged_indices[path_id] = index::MergedIndex::load(*shard_path);
+            workspace.call_graph.invalidate(path_id);
+            workspace.project_index.type_hierarchy.invalidate(path_id);
         }
     });
 
+    // A reader may see an owner's save halfway; what looks orphaned here is
+    // the owner's to sweep.
+    if(read_only)
+        orphans.clear();
     for(auto& key: orphans) {
-        workspace.store->invalidate("index", key);
+        store.invalidate("index", key);
+    }
+
+    if(has_project && !base_id.empty() && adopted == base_id) {
+        std::error_code ec;
+        auto paths = workspace.project_index.path_pool.paths.size();
+        for(fs::directory_iterator it(base_dir, ec), end; it != end && !ec; it.increment(ec)) {
+            auto name = path::filename(it->path());
+            std::uint32_t path_id = 0;
+            if(!name.consume_back(".idx") || name.getAsInteger(10, path_id) || path_id >= paths)
+                continue;
+            if(workspace.merged_indices.contains(path_id))
+                continue;
+            workspace.merged_indices[path_id] = index::MergedIndex::load(it->path());
+            workspace.call_graph.invalidate(path_id);
+            workspace.project_index.type_hierarchy.invalidate(path_id);
+            base_shards.insert(path_id);
+        }
+        LOG_INFO("Mapped {} MergedIndex shards from the base index", base_shards.size());
     }
 
     if(!workspace.merged_indices.empty()) {
         LOG_INFO("Loaded {} MergedIndex shards", workspace.merged_indices.size());
     }
+
+    // Once per upgrade of an index written before it kept definitions; its
+    // segments are all dirty, so the next save keeps them.
+    auto& project = workspace.project_index;
+    if(!project.definitions_complete) {
+        for(auto& [path_id, shard]: workspace.merged_indices) {
+            index_definitions(path_id, shard);
+        }
+        project.definitions_complete = true;
+        LOG_INFO("Derived symbol definitions from {} MergedIndex shards",
+                 workspace.merged_indices.size());
+    }
+}
+
+void Indexer::refresh() {
+    // Shards read on the thread pool must stay put; the next call catches up.
+    if(!workspace.store || !shard_readers.empty())
+        return;
+
+    bool project_changed = false;
+    llvm::SmallVector<std::pair<std::uint32_t, std::string>> shards;
+    workspace.store->rescan("index", [&](llvm::StringRef key) {
+        std::uint32_t path_id = 0;
+        if(key == "project") {
+            project_changed = true;
+        } else if(!key.getAsInteger(10, path_id)) {
+            shards.emplace_back(path_id, key.str());
+        }
+    });
+
+    // Segments are committed before the header naming them, and the shards
+    // after it: a new header means a new snapshot, anything else is one
+    // shard of the current snapshot catching up.
+    if(project_changed) {
+        workspace.project_index = index::ProjectIndex();
+        workspace.merged_indices.clear();
+        workspace.call_graph.clear();
+        load();
+        return;
+    }
+
+    for(auto& [path_id, key]: shards) {
+        if(auto shard_path = workspace.store->lookup("index", key)) {
+            auto& shard = workspace.merged_indices[path_id];
+            shard = index::MergedIndex::load(*shard_path);
+            workspace.call_graph.invalidate(path_id);
+            workspace.project_index.type_hierarchy.invalidate(path_id);
+            index_definitions(path_id, shard);
+        } else {
+            workspace.merged_indices.erase(path_id);
+            workspace.call_graph.remove(path_id);
+            workspace.project_index.type_hierarchy.remove(path_id);
+        }
+    }
+    if(!shards.empty()) {
+        LOG_DEBUG("Reloaded {} MergedIndex shards of the shared index", shards.size());
+    }
 }
 
 bool Indexer::need_update(llvm::StringRef file_path) {
@@ -260,7 +814,71 @@ bool Indexer::need_update(llvm::StringRef file_path) {
     for(auto& p: workspace.project_index.path_pool.paths) {
         path_mapping.push_back(p);
     }
-    return merged_it->second.need_update(path_mapping);
+    if(!base_shards.contains(cache_it->second))
+        return merged_it->second.need_update(path_mapping);
+
+    // The build farm's checkout is older than every file here: its files
+    // count as current as long as they have the contents that were indexed.
+    auto same = [&](std::uint32_t path_id) { return same_as_base(path_id, path_mapping); };
+    return !same(cache_it->second) || merged_it->second.need_update(path_mapping, same);
+}
+
+bool Indexer::same_as_base(std::uint32_t path_id, llvm::ArrayRef<llvm::StringRef> paths) {
+    auto shard = workspace.merged_indices.find(path_id);
+    if(shard == workspace.merged_indices.end() || path_id >= paths.size())
+        return false;
+
+    fs::file_status status;
+    if(fs::status(paths[path_id], status))
+        return false;
+    auto mtime = status.getLastModificationTime();
+    auto [it, inserted] = base_matches.try_emplace(path_id, mtime, false);
+    if(inserted || it->second.first != mtime) {
+        auto hash = shard->second.content_hash();
+        it->second = {mtime, hash != 0 && hash_file(paths[path_id]) == hash};
+    }
+    return it->second.second;
+}
+
+void Indexer::fill_known_indices(llvm::StringRef file_path, worker::BuildParams& params) {
+    auto& path_pool = workspace.project_index.path_pool;
+    auto cache_it = path_pool.find(file_path);
+    if(cache_it == path_pool.cache.end())
+        return;
+
+    auto merged_it = workspace.merged_indices.find(cache_it->second);
+    if(merged_it == workspace.merged_indices.end())
+        return;
+
+    llvm::DenseSet<std::uint32_t> headers;
+    merged_it->second.included_paths([&](std::uint32_t path_id) { headers.insert(path_id); });
+    llvm::SmallVector<llvm::StringRef> path_mapping;
+    for(auto& p: path_pool.paths) {
+        path_mapping.push_back(p);
+    }
+    for(auto path_id: headers) {
+        auto shard_it = workspace.merged_indices.find(path_id);
+        if(shard_it == workspace.merged_indices.end())
+            continue;
+        auto path = path_pool.path(path_id).str();
+        auto& hashes = params.known_indices[path];
+        shard_it->second.canonical_hashes([&](llvm::StringRef hash) {
+            if(std::ranges::find(hashes, hash) == hashes.end())
+                hashes.push_back(hash.str());
+        });
+        auto [contexts_it, first] = params.known_contexts.try_emplace(path);
+        auto& contexts = contexts_it->second;
+        shard_it->second.known_contexts([&](llvm::StringRef context, llvm::StringRef hash) {
+            contexts.try_emplace(context.str(), hash.str());
+        });
+
+        // A header unchanged since its shard was built is most likely read
+        // under a context the shard knows, which leaves it out of the index:
+        // its function bodies are not parsed.
+        if(first && !contexts.empty() && !base_shards.contains(path_id) &&
+           !shard_it->second.need_update(path_mapping))
+            params.skip_bodies_in.push_back(path);
+    }
 }
 
 bool Indexer::find_symbol_info(index::SymbolHash hash, std::string& name, SymbolKind& kind) const {
@@ -284,7 +902,7 @@ bool Indexer::find_symbol_info(index::SymbolHash hash, std::string& name, Symbol
     // Check ProjectIndex (external symbols).
     auto it = workspace.project_index.symbols.find(hash);
     if(it != workspace.project_index.symbols.end()) {
-        name = it->second.name;
+        name = workspace.project_index.name_of(it->second);
         kind = it->second.kind;
         return true;
     }
@@ -299,18 +917,72 @@ bool Indexer::find_symbol_info(index::SymbolHash hash, std::string& name, Symbol
     return false;
 }
 
+std::optional<index::Relation> Indexer::move_overlay(const Session& session,
+                                                    const index::Relation& relation) {
+    auto& edits = session.index_edits;
+    if(edits.empty())
+        return relation;
+    auto name = edits.to_new_exact(relation.range.begin, relation.range.end);
+    if(!name)
+        return std::nullopt;
+
+    auto moved = relation;
+    moved.range = {name->first, name->second};
+    // The extent of a definition is typed into, as the name is not.
+    if(relation.kind.isDeclOrDef()) {
+        auto extent = moved.definition_range();
+        auto begin = edits.to_new(extent.begin);
+        auto end = edits.to_new(extent.end);
+        if(begin && end && *begin <= *end)
+            moved.set_definition_range({*begin, *end});
+        else
+            moved.set_definition_range(moved.range);
+    }
+    return moved;
+}
+
+void Indexer::lookup_overlay(const Session& session,
+                             index::SymbolHash hash,
+                             RelationKind kind,
+                             llvm::function_ref<bool(const index::Relation&)> fn) {
+    if(session.index_edits.empty()) {
+        session.file_index->lookup(hash, kind, fn);
+        return;
+    }
+    session.file_index->lookup(hash, kind, [&](const index::Relation& relation) {
+        auto moved = move_overlay(session, relation);
+        return !moved || fn(*moved);
+    });
+}
+
+void Indexer::lookup_overlay(const Session& session,
+                             std::uint32_t offset,
+                             llvm::function_ref<bool(const index::Occurrence&)> fn) {
+    auto& edits = session.index_edits;
+    auto old_offset = edits.to_old(offset);
+    if(!old_offset)
+        return;
+    session.file_index->lookup(*old_offset, [&](const index::Occurrence& occurrence) {
+        auto range = edits.to_new_exact(occurrence.range.begin, occurrence.range.end);
+        if(!range)
+            return true;
+        return fn(index::Occurrence{.range = {range->first, range->second},
+                                    .target = occurrence.target});
+    });
+}
+
 Indexer::CursorHit Indexer::resolve_cursor(llvm::StringRef path,
                                            const protocol::Position& position,
                                            Session* session) {
-    // FIXME: when ast_dirty, we fall back to MergedIndex which may be staler.
-    // Consider awaiting the pending recompilation to serve fresher results.
-    if(session && session->file_index && !session->ast_dirty) {
+    // The overlay answers for a dirty buffer too: the names not edited since
+    // its compile are still where it says, once moved over the edits.
+    if(session && session->file_index) {
         auto map = session->line_map();
         auto offset = map.to_offset(position);
         if(!offset)
             return {};
         CursorHit hit;
-        session->file_index->lookup(*offset, [&](const index::Occurrence& occ) {
+        lookup_overlay(*session, *offset, [&](const index::Occurrence& occ) {
             auto range = map.to_range(occ.range.begin, occ.range.end);
             if(range) {
                 hit = {occ.target, *range};
@@ -339,64 +1011,454 @@ Indexer::CursorHit Indexer::resolve_cursor(llvm::StringRef path,
     auto ls = merged_index.line_starts();
     if(ls.empty())
         return {};
-    lsp::LineMap map(merged_index.content(), ls);
+    auto content = shard_content(proj_it->second, merged_index);
+    if(!content)
+        return {};
+    lsp::LineMap map(*content, ls);
     CursorHit hit;
-    merged_index.lookup(*offset, [&](const index::Occurrence& o) {
+    auto on_hit = [&](const index::Occurrence& o) {
         auto range = map.to_range(o.range.begin, o.range.end);
         if(range)
             hit = {o.target, *range};
         return false;
-    });
+    };
+
+    // A header is answered in the context of the source file hosting it,
+    // when that file's inclusion of it was indexed.
+    std::optional<std::uint32_t> context;
+    if(session->header_context) {
+        auto host = workspace.path_pool.resolve(session->header_context->host_path_id);
+        auto host_it = workspace.project_index.path_pool.find(host);
+        if(host_it != workspace.project_index.path_pool.cache.end())
+            context = merged_index.context_index(host_it->second);
+    }
+    if(context)
+        merged_index.lookup_in_context(*context, *offset, on_hit);
+    else
+        merged_index.lookup(*offset, on_hit);
     return hit;
 }
 
-std::vector<protocol::Location> Indexer::query_relations(llvm::StringRef path,
-                                                         const protocol::Position& position,
-                                                         RelationKind kind,
-                                                         Session* session) {
-    auto hit = resolve_cursor(path, position, session);
-    if(hit.hash == 0)
-        return {};
-
-    std::vector<protocol::Location> locations;
+bool Indexer::visit_relations(index::SymbolHash hash,
+                              RelationKind kind,
+                              RelationCursor& cursor,
+                              RelationVisitor visitor) {
+    // Open files come first: their buffers supersede the shards on disk.
+    llvm::SmallVector<std::uint32_t> open_files;
+    foreach_session([&](std::uint32_t id, const Session&) -> bool {
+        open_files.push_back(id);
+        return true;
+    });
+    std::ranges::sort(open_files);
 
-    auto sym_it = workspace.project_index.symbols.find(hit.hash);
-    if(sym_it != workspace.project_index.symbols.end()) {
+    // Calls of the shards come from the call graph, as one more file.
+    auto calls = kind.isCall();
+    llvm::SmallVector<std::uint32_t> indexed_files;
+    auto sym_it = workspace.project_index.symbols.find(hash);
+    if(!calls && sym_it != workspace.project_index.symbols.end()) {
         for(auto file_id: sym_it->second.reference_files) {
-            if(is_proj_path_open(file_id))
-                continue;
-            auto shard_it = workspace.merged_indices.find(file_id);
-            if(shard_it == workspace.merged_indices.end())
-                continue;
-            auto uri = lsp::URI::from_file_path(workspace.project_index.path_pool.path(file_id));
-            if(!uri)
-                continue;
-            auto& merged_index = shard_it->second;
-            auto ls = merged_index.line_starts();
-            if(ls.empty())
-                continue;
-            lsp::LineMap map(merged_index.content(), ls);
-            merged_index.lookup(hit.hash, kind, [&](const index::Relation& r) {
-                if(auto range = map.to_range(r.range.begin, r.range.end))
-                    locations.push_back({uri->str(), *range});
+            if(!is_proj_path_open(file_id))
+                indexed_files.push_back(file_id);
+        }
+        std::ranges::sort(indexed_files);
+    }
+
+    // Visit one file's relations past `cursor.skip`; false if the visitor stopped.
+    auto visit_file = [&](llvm::StringRef path,
+                          llvm::StringRef content,
+                          const lsp::LineMap& map,
+                          auto&& lookup) {
+        std::uint32_t seen = 0;
+        bool stopped = false;
+        lookup([&](const index::Relation& r) {
+            if(seen++ < cursor.skip)
                 return true;
+            cursor.skip = seen;
+            stopped = !visitor(path, content, map, r);
+            return !stopped;
+        });
+        return !stopped;
+    };
+
+    // Resume at the first file of the phase from `cursor.path_id` on; the
+    // relations produced of a file that is gone do not count for the next.
+    auto files_from = [&](llvm::ArrayRef<std::uint32_t> files) {
+        auto it = std::ranges::lower_bound(files, cursor.path_id);
+        if(it == files.end() || *it != cursor.path_id) {
+            cursor.skip = 0;
+        }
+        return files.drop_front(it - files.begin());
+    };
+
+    if(cursor.phase == RelationCursor::Open) {
+        for(auto id: files_from(open_files)) {
+            cursor.path_id = id;
+            bool more = true;
+            with_session(id, [&](const Session& session) {
+                more = visit_file(workspace.path_pool.resolve(id),
+                                  session.text,
+                                  session.line_map(),
+                                  [&](auto&& fn) { lookup_overlay(session, hash, kind, fn); });
             });
+            if(!more)
+                return false;
+            cursor.skip = 0;
         }
+        cursor = {RelationCursor::Indexed, 0, 0};
     }
 
-    foreach_session([&](std::uint32_t id, const Session& session) -> bool {
-        auto uri = lsp::URI::from_file_path(std::string(workspace.path_pool.resolve(id)));
-        if(!uri)
+    if(calls) {
+        return visit_indexed_calls(hash, kind, cursor, visitor);
+    }
+    for(auto file_id: files_from(indexed_files)) {
+        cursor.path_id = file_id;
+        auto* shard = find_shard(file_id);
+        auto ls = shard ? shard->line_starts() : std::span<const std::uint32_t>();
+        auto content = ls.empty() ? std::nullopt : shard_content(file_id, *shard);
+        if(content && !visit_file(workspace.project_index.path_pool.path(file_id),
+                                  *content,
+                                  lsp::LineMap(*content, ls),
+                                  [&](auto&& fn) { shard->lookup(hash, kind, fn); })) {
+            return false;
+        }
+        cursor.skip = 0;
+    }
+    return true;
+}
+
+bool Indexer::visit_indexed_calls(index::SymbolHash hash,
+                                  RelationKind kind,
+                                  RelationCursor& cursor,
+                                  RelationVisitor visitor) {
+    auto& graph = workspace.call_graph;
+    graph.refresh([&](std::uint32_t file_id) { return find_shard(file_id); });
+
+    // Calls arrive grouped by file; map each file once.  Open files were
+    // visited from their sessions.
+    std::uint32_t seen = 0;
+    bool stopped = false;
+    std::optional<std::uint32_t> last_file;
+    llvm::StringRef path;
+    std::string content;
+    std::optional<lsp::LineMap> map;
+    auto visit = [&](const index::CallGraph::Call& call) {
+        if(seen++ < cursor.skip)
             return true;
-        auto map = session.line_map();
-        session.file_index->lookup(hit.hash, kind, [&](const index::Relation& r) {
+        cursor.skip = seen;
+        if(call.file != last_file) {
+            last_file = call.file;
+            map.reset();
+            auto shard_it = workspace.merged_indices.find(call.file);
+            if(shard_it != workspace.merged_indices.end() && !is_proj_path_open(call.file)) {
+                auto ls = shard_it->second.line_starts();
+                auto text = ls.empty() ? std::nullopt : shard_content(call.file, shard_it->second);
+                if(text) {
+                    path = workspace.project_index.path_pool.path(call.file);
+                    content = std::move(*text);
+                    map.emplace(content, ls);
+                }
+            }
+        }
+        if(!map)
+            return true;
+
+        index::Relation relation{
+            .kind = kind,
+            .range = call.range,
+            .target_symbol = kind == RelationKind::Caller ? call.caller : call.callee,
+        };
+        stopped = !visitor(path, content, *map, relation);
+        return !stopped;
+    };
+    if(kind == RelationKind::Caller)
+        graph.callers(hash, visit);
+    else
+        graph.callees(hash, visit);
+    return !stopped;
+}
+
+bool Indexer::collect_locations(index::SymbolHash hash,
+                                RelationKind kind,
+                                RelationCursor& cursor,
+                                std::size_t limit,
+                                std::vector<protocol::Location>& locations) {
+    auto start = locations.size();
+    llvm::StringRef last_path;
+    std::optional<std::string> uri;
+    return visit_relations(hash, kind, cursor, [&](llvm::StringRef path,
+                                                   llvm::StringRef,
+                                                   const lsp::LineMap& map,
+                                                   const index::Relation& r) {
+        // Relations arrive grouped by file; convert each path once.
+        if(path.data() != last_path.data()) {
+            last_path = path;
+            uri.reset();
+            if(auto file_uri = lsp::URI::from_file_path(path.str()))
+                uri = file_uri->str();
+        }
+        if(uri) {
             if(auto range = map.to_range(r.range.begin, r.range.end))
-                locations.push_back({uri->str(), *range});
+                locations.push_back({*uri, *range});
+        }
+        return locations.size() - start < limit;
+    });
+}
+
+struct Indexer::ShardRead {
+    std::vector<std::uint32_t> ids;
+    std::vector<std::pair<std::string, const index::MergedIndex*>> shards;
+    std::function<void(llvm::StringRef, const index::MergedIndex&)> read;
+    kota::event done;
+};
+
+kota::task<> Indexer::read_shards(
+    std::vector<std::uint32_t> files,
+    std::function<void(llvm::StringRef path, const index::MergedIndex& shard)> read) {
+    auto job = std::make_shared<ShardRead>();
+    job->read = std::move(read);
+    for(auto file_id: files) {
+        auto it = workspace.merged_indices.find(file_id);
+        if(it == workspace.merged_indices.end())
+            continue;
+        if(shard_readers.empty())
+            shards_unread.reset();
+        shard_readers[file_id] += 1;
+        job->ids.push_back(file_id);
+        job->shards.emplace_back(workspace.project_index.path_pool.path(file_id).str(),
+                                 &it->second);
+    }
+    if(job->shards.empty())
+        co_return;
+    if(!read_tasks.spawn(run_shard_read(job)))
+        co_return;
+    co_await job->done.wait();
+}
+
+kota::task<> Indexer::run_shard_read(std::shared_ptr<ShardRead> job) {
+    auto result = co_await kota::queue([job] {
+        for(auto& [path, shard]: job->shards) {
+            job->read(path, *shard);
+        }
+    });
+    if(!result.has_value()) {
+        LOG_WARN("Failed to read {} index shards", job->shards.size());
+    }
+    for(auto file_id: job->ids) {
+        auto it = shard_readers.find(file_id);
+        if(--it->second == 0)
+            shard_readers.erase(it);
+    }
+    if(shard_readers.empty())
+        shards_unread.set();
+    job->done.set();
+}
+
+kota::task<std::vector<protocol::Location>> Indexer::find_locations(index::SymbolHash hash,
+                                                                      RelationKind kind) {
+    auto locations = std::make_shared<std::vector<protocol::Location>>();
+    auto add = [hash, kind](std::vector<protocol::Location>& out,
+                            llvm::StringRef path,
+                            const lsp::LineMap& map,
+                            auto&& lookup) {
+        auto uri = lsp::URI::from_file_path(path.str());
+        if(!uri)
+            return;
+        auto uri_str = uri->str();
+        lookup(hash, kind, [&](const index::Relation& r) {
+            if(auto range = map.to_range(r.range.begin, r.range.end))
+                out.push_back({uri_str, *range});
             return true;
         });
+    };
+
+    // Open files come first, in the order visit_relations() takes them;
+    // their buffers change on the loop, so they are read here.
+    llvm::SmallVector<std::uint32_t> open_files;
+    foreach_session([&](std::uint32_t id, const Session&) -> bool {
+        open_files.push_back(id);
         return true;
     });
+    std::ranges::sort(open_files);
+    for(auto id: open_files) {
+        with_session(id, [&](const Session& session) {
+            add(*locations,
+                workspace.path_pool.resolve(id),
+                session.line_map(),
+                [&](auto... args) { lookup_overlay(session, args...); });
+        });
+    }
 
+    std::vector<std::uint32_t> indexed_files;
+    auto sym_it = workspace.project_index.symbols.find(hash);
+    if(sym_it != workspace.project_index.symbols.end()) {
+        for(auto file_id: sym_it->second.reference_files) {
+            if(!is_proj_path_open(file_id))
+                indexed_files.push_back(file_id);
+        }
+    }
+    auto* store = workspace.store ? &*workspace.store : nullptr;
+    co_await read_shards(std::move(indexed_files),
+                         [locations, add, store](llvm::StringRef path,
+                                                 const index::MergedIndex& shard) {
+                             auto ls = shard.line_starts();
+                             auto content =
+                                 ls.empty() ? std::nullopt : indexed_content(path, shard, store);
+                             if(!content)
+                                 return;
+                             add(*locations,
+                                 path,
+                                 lsp::LineMap(*content, ls),
+                                 [&](auto... args) { shard.lookup(args...); });
+                         });
+    co_return std::move(*locations);
+}
+
+kota::task<std::optional<protocol::WorkspaceEdit>> Indexer::rename(index::SymbolHash hash,
+                                                                   std::string new_name) {
+    std::string name;
+    SymbolKind symbol_kind;
+    if(!find_symbol_info(hash, name, symbol_kind))
+        co_return std::nullopt;
+
+    // Occurrences spell the unqualified name.
+    llvm::StringRef old_name = name;
+    if(auto pos = old_name.rfind("::"); pos != llvm::StringRef::npos)
+        old_name = old_name.drop_front(pos + 2);
+
+    using FileEdits = std::vector<std::pair<std::string, std::vector<protocol::TextEdit>>>;
+    auto add = [hash, old_name = old_name.str(), new_name](FileEdits& out,
+                                                           llvm::StringRef path,
+                                                           llvm::StringRef content,
+                                                           const lsp::LineMap& map,
+                                                           auto&& lookup) {
+        // A definition is also recorded as a declaration at the same name.
+        std::vector<std::pair<std::uint32_t, std::uint32_t>> ranges;
+        for(auto kind:
+            {RelationKind::Definition, RelationKind::Declaration, RelationKind::Reference}) {
+            lookup(hash, kind, [&](const index::Relation& r) {
+                if(r.range.end <= content.size() &&
+                   content.slice(r.range.begin, r.range.end) == old_name)
+                    ranges.emplace_back(r.range.begin, r.range.end);
+                return true;
+            });
+        }
+        if(ranges.empty())
+            return;
+        auto uri = lsp::URI::from_file_path(path.str());
+        if(!uri)
+            return;
+        std::ranges::sort(ranges);
+        auto [first, last] = std::ranges::unique(ranges);
+        ranges.erase(first, last);
+
+        std::vector<protocol::TextEdit> edits;
+        for(auto [begin, end]: ranges) {
+            if(auto range = map.to_range(begin, end))
+                edits.push_back(protocol::TextEdit{.range = *range, .new_text = new_name});
+        }
+        if(!edits.empty())
+            out.emplace_back(uri->str(), std::move(edits));
+    };
+
+    auto indexed_files = [&] {
+        std::vector<std::uint32_t> files;
+        auto sym_it = workspace.project_index.symbols.find(hash);
+        if(sym_it != workspace.project_index.symbols.end()) {
+            for(auto file_id: sym_it->second.reference_files) {
+                if(!is_proj_path_open(file_id))
+                    files.push_back(file_id);
+            }
+        }
+        return files;
+    };
+
+    // Only the files changed since they were indexed are compiled again;
+    // the shards of the others are current.
+    if(!read_only) {
+        std::vector<std::uint32_t> stale;
+        for(auto file_id: indexed_files()) {
+            auto path = workspace.project_index.path_pool.path(file_id);
+            if(need_update(path))
+                stale.push_back(workspace.path_pool.intern(path));
+        }
+        if(!stale.empty()) {
+            LOG_INFO("Rename: indexing {} changed files first", stale.size());
+            kota::task_group<> workers(loop);
+            for(std::size_t i = 0; i < stale.size(); ++i)
+                workers.spawn(index_one(stale[i], i + 1, stale.size()));
+            co_await workers.join();
+            co_await merges_idle.wait();
+        }
+    }
+
+    protocol::WorkspaceEdit edit;
+    auto& changes = edit.changes.emplace();
+
+    // Open files first, on the loop: their buffers supersede the shards.
+    FileEdits open_edits;
+    foreach_session([&](std::uint32_t id, const Session& session) -> bool {
+        if(session.file_index) {
+            add(open_edits,
+                workspace.path_pool.resolve(id),
+                session.text,
+                session.line_map(),
+                [&](auto... args) { lookup_overlay(session, args...); });
+        }
+        return true;
+    });
+    for(auto& [uri, edits]: open_edits)
+        changes[uri] = std::move(edits);
+
+    // A file that could not be indexed again may differ from its shard, so
+    // the occurrences are checked against the file on disk.  Each chunk is
+    // one job on the thread pool, all of them under way at once.
+    auto files = indexed_files();
+    std::vector<std::shared_ptr<FileEdits>> parts;
+    kota::task_group<> readers(loop);
+    for(std::size_t begin = 0; begin < files.size(); begin += rename_read_chunk) {
+        auto end = std::min(files.size(), begin + rename_read_chunk);
+        auto part = parts.emplace_back(std::make_shared<FileEdits>());
+        readers.spawn(read_shards(
+            std::vector<std::uint32_t>(files.begin() + begin, files.begin() + end),
+            [part, add](llvm::StringRef path, const index::MergedIndex& shard) {
+                auto buf = llvm::MemoryBuffer::getFile(path);
+                if(!buf)
+                    return;
+                auto content = (*buf)->getBuffer();
+                auto line_starts = lsp::build_line_starts(content);
+                add(*part,
+                    path,
+                    content,
+                    lsp::LineMap(content, line_starts),
+                    [&](auto... args) { shard.lookup(args...); });
+            }));
+    }
+    co_await readers.join();
+
+    for(auto& part: parts) {
+        for(auto& [uri, edits]: *part)
+            changes[uri] = std::move(edits);
+    }
+    co_return edit;
+}
+
+index::SymbolHash Indexer::symbol_at(llvm::StringRef path,
+                                     const protocol::Position& position,
+                                     Session* session) {
+    return resolve_cursor(path, position, session).hash;
+}
+
+std::vector<protocol::Location> Indexer::query_relations(llvm::StringRef path,
+                                                         const protocol::Position& position,
+                                                         RelationKind kind,
+                                                         Session* session) {
+    auto hash = symbol_at(path, position, session);
+    if(hash == 0)
+        return {};
+
+    std::vector<protocol::Location> locations;
+    RelationCursor cursor;
+    collect_locations(hash, kind, cursor, std::numeric_limits<std::size_t>::max(), locations);
     return locations;
 }
 
@@ -423,7 +1485,7 @@ std::optional<protocol::Location> Indexer::find_definition_location(index::Symbo
         if(!uri)
             return true;
         auto map = session.line_map();
-        session.file_index->lookup(hash, RelationKind::Definition, [&](const index::Relation& r) {
+        lookup_overlay(session, hash, RelationKind::Definition, [&](const index::Relation& r) {
             if(auto range = map.to_range(r.range.begin, r.range.end)) {
                 session_result = protocol::Location{uri->str(), *range};
                 return false;
@@ -435,38 +1497,25 @@ std::optional<protocol::Location> Indexer::find_definition_location(index::Symbo
     if(session_result)
         return session_result;
 
-    // Fall back to ProjectIndex reference files.
+    // Fall back to the definition table of ProjectIndex; the open files'
+    // definitions are their sessions'.
     auto sym_it = workspace.project_index.symbols.find(hash);
     if(sym_it == workspace.project_index.symbols.end())
         return std::nullopt;
+    auto& definition = sym_it->second.definition;
+    if(!definition || is_proj_path_open(definition->path_id))
+        return std::nullopt;
+    auto path = workspace.project_index.path_pool.path(definition->path_id);
+    auto uri = lsp::URI::from_file_path(path);
+    if(!uri)
+        return std::nullopt;
 
-    for(auto file_id: sym_it->second.reference_files) {
-        if(is_proj_path_open(file_id))
-            continue;
-        auto shard_it = workspace.merged_indices.find(file_id);
-        if(shard_it == workspace.merged_indices.end())
-            continue;
-        auto uri = lsp::URI::from_file_path(workspace.project_index.path_pool.path(file_id));
-        if(!uri)
-            continue;
-        auto& merged_index = shard_it->second;
-        auto ls = merged_index.line_starts();
-        if(ls.empty())
-            continue;
-        lsp::LineMap map(merged_index.content(), ls);
-        std::optional<protocol::Location> result;
-        merged_index.lookup(hash, RelationKind::Definition, [&](const index::Relation& r) {
-            if(auto range = map.to_range(r.range.begin, r.range.end)) {
-                result = protocol::Location{uri->str(), *range};
-                return false;
-            }
-            return true;
-        });
-        if(result)
-            return result;
-    }
-
-    return std::nullopt;
+    protocol::Range range;
+    range.start.line = definition->begin_line;
+    range.start.character = definition->begin_character;
+    range.end.line = definition->end_line;
+    range.end.character = definition->end_character;
+    return protocol::Location{uri->str(), range};
 }
 
 std::optional<SymbolInfo>
@@ -488,73 +1537,22 @@ std::optional<SymbolInfo>
     return lookup_symbol(uri, path, range.start, session);
 }
 
-void Indexer::collect_grouped_relations(
+bool Indexer::collect_grouped_relations(
     index::SymbolHash hash,
     RelationKind kind,
+    RelationCursor& cursor,
+    std::size_t limit,
     llvm::DenseMap<index::SymbolHash, std::vector<protocol::Range>>& target_ranges) {
-    auto sym_it = workspace.project_index.symbols.find(hash);
-    if(sym_it != workspace.project_index.symbols.end()) {
-        for(auto file_id: sym_it->second.reference_files) {
-            if(is_proj_path_open(file_id))
-                continue;
-            auto shard_it = workspace.merged_indices.find(file_id);
-            if(shard_it == workspace.merged_indices.end())
-                continue;
-            auto& merged_index = shard_it->second;
-            auto ls = merged_index.line_starts();
-            if(ls.empty())
-                continue;
-            lsp::LineMap map(merged_index.content(), ls);
-            merged_index.lookup(hash, kind, [&](const index::Relation& r) {
-                if(auto range = map.to_range(r.range.begin, r.range.end))
-                    target_ranges[r.target_symbol].push_back(*range);
-                return true;
-            });
-        }
-    }
-    foreach_session([&](std::uint32_t, const Session& session) -> bool {
-        auto map = session.line_map();
-        session.file_index->lookup(hash, kind, [&](const index::Relation& r) {
-            if(auto range = map.to_range(r.range.begin, r.range.end))
-                target_ranges[r.target_symbol].push_back(*range);
-            return true;
-        });
-        return true;
-    });
-}
-
-void Indexer::collect_unique_targets(index::SymbolHash hash,
-                                     RelationKind kind,
-                                     llvm::SmallVectorImpl<index::SymbolHash>& targets) {
-    llvm::DenseSet<index::SymbolHash> seen;
-    auto sym_it = workspace.project_index.symbols.find(hash);
-    if(sym_it != workspace.project_index.symbols.end()) {
-        for(auto file_id: sym_it->second.reference_files) {
-            if(is_proj_path_open(file_id))
-                continue;
-            auto shard_it = workspace.merged_indices.find(file_id);
-            if(shard_it == workspace.merged_indices.end())
-                continue;
-            shard_it->second.lookup(hash, kind, [&](const index::Relation& r) {
-                if(seen.insert(r.target_symbol).second) {
-                    targets.push_back(r.target_symbol);
-                }
-                return true;
-            });
-        }
-    }
-    foreach_session([&](std::uint32_t, const Session& session) -> bool {
-        auto rel_it = session.file_index->relations.find(hash);
-        if(rel_it == session.file_index->relations.end())
-            return true;
-        for(auto& r: rel_it->second) {
-            if(r.kind & kind) {
-                if(seen.insert(r.target_symbol).second) {
-                    targets.push_back(r.target_symbol);
-                }
-            }
+    std::size_t count = 0;
+    return visit_relations(hash, kind, cursor, [&](llvm::StringRef,
+                                                   llvm::StringRef,
+                                                   const lsp::LineMap& map,
+                                                   const index::Relation& r) {
+        if(auto range = map.to_range(r.range.begin, r.range.end)) {
+            target_ranges[r.target_symbol].push_back(*range);
+            count += 1;
         }
-        return true;
+        return count < limit;
     });
 }
 
@@ -586,11 +1584,12 @@ static std::string extract_line(llvm::StringRef content, std::uint32_t offset) {
     return content.slice(line_start, line_end).str();
 }
 
-std::optional<Indexer::DefinitionText> Indexer::get_definition_text(index::SymbolHash hash) {
+std::optional<Indexer::DefinitionText> Indexer::get_definition_text(index::SymbolHash hash,
+                                                                   llvm::StringRef file) {
     std::optional<DefinitionText> session_result;
     foreach_session([&](std::uint32_t id, const Session& session) -> bool {
         auto map = session.line_map();
-        session.file_index->lookup(hash, RelationKind::Definition, [&](const index::Relation& rel) {
+        lookup_overlay(session, hash, RelationKind::Definition, [&](const index::Relation& rel) {
             auto def_range = std::bit_cast<LocalSourceRange>(rel.target_symbol);
             if(def_range.begin >= def_range.end || def_range.end > session.text.size())
                 return true;
@@ -611,6 +1610,34 @@ std::optional<Indexer::DefinitionText> Indexer::get_definition_text(index::Symbo
     if(session_result)
         return session_result;
 
+    // The outline of the file named gives the range without a lookup in
+    // every shard referencing the symbol.
+    auto file_it = file.empty() ? workspace.project_index.path_pool.cache.end()
+                                : workspace.project_index.path_pool.find(file);
+    if(file_it != workspace.project_index.path_pool.cache.end() &&
+       !is_proj_path_open(file_it->second)) {
+        auto* shard = find_shard(file_it->second);
+        auto text = shard ? shard_content(file_it->second, *shard) : std::nullopt;
+        if(text) {
+            llvm::StringRef content = *text;
+            auto ls = shard->line_starts();
+            for(auto& entry: shard->outline()) {
+                auto def_range = entry.range;
+                if(entry.symbol != hash || ls.empty() || def_range.end > content.size())
+                    continue;
+                auto range = lsp::LineMap(content, ls).to_range(def_range.begin, def_range.end);
+                if(!range)
+                    continue;
+                return DefinitionText{
+                    .file = workspace.project_index.path_pool.path(file_it->second).str(),
+                    .start_line = static_cast<int>(range->start.line) + 1,
+                    .end_line = static_cast<int>(range->end.line) + 1,
+                    .text = content.substr(def_range.begin, def_range.end - def_range.begin).str(),
+                };
+            }
+        }
+    }
+
     auto sym_it = workspace.project_index.symbols.find(hash);
     if(sym_it == workspace.project_index.symbols.end())
         return std::nullopt;
@@ -625,7 +1652,10 @@ std::optional<Indexer::DefinitionText> Indexer::get_definition_text(index::Symbo
         auto ls = merged_index.line_starts();
         if(ls.empty())
             continue;
-        auto content = merged_index.content();
+        auto text = shard_content(file_id, merged_index);
+        if(!text)
+            continue;
+        llvm::StringRef content = *text;
         lsp::LineMap map(content, ls);
 
         std::optional<DefinitionText> result;
@@ -652,79 +1682,107 @@ std::optional<Indexer::DefinitionText> Indexer::get_definition_text(index::Symbo
     return std::nullopt;
 }
 
-std::vector<Indexer::ReferenceWithContext> Indexer::collect_references(index::SymbolHash hash,
-                                                                       RelationKind kind) {
-    std::vector<ReferenceWithContext> results;
+std::string Indexer::documentation(index::SymbolHash hash, llvm::StringRef file) {
+    std::string result;
+    foreach_session([&](std::uint32_t, const Session& session) -> bool {
+        if(!session.file_index)
+            return true;
+        if(auto it = session.file_index->documents.find(hash);
+           it != session.file_index->documents.end()) {
+            result = it->second;
+        }
+        return result.empty();
+    });
+    if(!result.empty())
+        return result;
+
+    auto file_it = file.empty() ? workspace.project_index.path_pool.cache.end()
+                                : workspace.project_index.path_pool.find(file);
+    if(file_it != workspace.project_index.path_pool.cache.end() &&
+       !is_proj_path_open(file_it->second)) {
+        if(auto* shard = find_shard(file_it->second)) {
+            if(auto text = shard->documentation(hash))
+                return std::move(*text);
+        }
+    }
 
     auto sym_it = workspace.project_index.symbols.find(hash);
-    if(sym_it != workspace.project_index.symbols.end()) {
-        for(auto file_id: sym_it->second.reference_files) {
-            if(is_proj_path_open(file_id))
-                continue;
-            auto shard_it = workspace.merged_indices.find(file_id);
-            if(shard_it == workspace.merged_indices.end())
-                continue;
-            auto& merged_index = shard_it->second;
-            auto ls = merged_index.line_starts();
-            if(ls.empty())
-                continue;
-            auto content = merged_index.content();
-            lsp::LineMap map(content, ls);
-            auto file_path = workspace.project_index.path_pool.path(file_id);
-
-            merged_index.lookup(hash, kind, [&](const index::Relation& r) {
-                auto pos = map.to_position(r.range.begin);
-                if(!pos)
-                    return true;
-                results.push_back(ReferenceWithContext{
-                    .file = file_path.str(),
-                    .line = static_cast<int>(pos->line) + 1,
-                    .context = extract_line(content, r.range.begin),
-                });
-                return true;
-            });
+    if(sym_it == workspace.project_index.symbols.end())
+        return result;
+
+    for(auto file_id: sym_it->second.reference_files) {
+        if(is_proj_path_open(file_id))
+            continue;
+        if(auto* shard = find_shard(file_id)) {
+            if(auto text = shard->documentation(hash))
+                return std::move(*text);
         }
     }
+    return result;
+}
 
-    foreach_session([&](std::uint32_t id, const Session& session) -> bool {
-        auto map = session.line_map();
-        auto file_path = workspace.path_pool.resolve(id);
-        session.file_index->lookup(hash, kind, [&](const index::Relation& rel) {
-            auto pos = map.to_position(rel.range.begin);
-            if(!pos)
-                return true;
+bool Indexer::collect_references(index::SymbolHash hash,
+                                 RelationKind kind,
+                                 RelationCursor& cursor,
+                                 std::size_t limit,
+                                 std::vector<ReferenceWithContext>& results) {
+    auto start = results.size();
+    return visit_relations(hash, kind, cursor, [&](llvm::StringRef path,
+                                                   llvm::StringRef content,
+                                                   const lsp::LineMap& map,
+                                                   const index::Relation& r) {
+        if(auto pos = map.to_position(r.range.begin)) {
             results.push_back(ReferenceWithContext{
-                .file = file_path.str(),
+                .file = path.str(),
                 .line = static_cast<int>(pos->line) + 1,
-                .context = extract_line(session.text, rel.range.begin),
+                .context = extract_line(content, r.range.begin),
             });
-            return true;
-        });
-        return true;
+        }
+        return results.size() - start < limit;
     });
+}
 
+std::vector<Indexer::ReferenceWithContext> Indexer::collect_references(index::SymbolHash hash,
+                                                                       RelationKind kind) {
+    std::vector<ReferenceWithContext> results;
+    RelationCursor cursor;
+    collect_references(hash, kind, cursor, std::numeric_limits<std::size_t>::max(), results);
     return results;
 }
 
-std::vector<protocol::CallHierarchyIncomingCall>
-    Indexer::find_incoming_calls(index::SymbolHash hash) {
+bool Indexer::find_incoming_calls(index::SymbolHash hash,
+                                  RelationCursor& cursor,
+                                  std::size_t limit,
+                                  std::vector<protocol::CallHierarchyIncomingCall>& results) {
     llvm::DenseMap<index::SymbolHash, std::vector<protocol::Range>> caller_ranges;
-    collect_grouped_relations(hash, RelationKind::Caller, caller_ranges);
+    auto done = collect_grouped_relations(hash, RelationKind::Caller, cursor, limit, caller_ranges);
 
-    std::vector<protocol::CallHierarchyIncomingCall> results;
     for(auto& [caller_hash, ranges]: caller_ranges) {
         auto info = resolve_symbol(caller_hash);
         if(!info)
             continue;
         results.push_back({build_call_hierarchy_item(*info), std::move(ranges)});
     }
+    return done;
+}
+
+std::vector<protocol::CallHierarchyIncomingCall>
+    Indexer::find_incoming_calls(index::SymbolHash hash) {
+    std::vector<protocol::CallHierarchyIncomingCall> results;
+    RelationCursor cursor;
+    find_incoming_calls(hash, cursor, std::numeric_limits<std::size_t>::max(), results);
     return results;
 }
 
 std::vector<protocol::CallHierarchyOutgoingCall>
     Indexer::find_outgoing_calls(index::SymbolHash hash) {
     llvm::DenseMap<index::SymbolHash, std::vector<protocol::Range>> callee_ranges;
-    collect_grouped_relations(hash, RelationKind::Callee, callee_ranges);
+    RelationCursor cursor;
+    collect_grouped_relations(hash,
+                              RelationKind::Callee,
+                              cursor,
+                              std::numeric_limits<std::size_t>::max(),
+                              callee_ranges);
 
     std::vector<protocol::CallHierarchyOutgoingCall> results;
     for(auto& [callee_hash, ranges]: callee_ranges) {
@@ -736,38 +1794,53 @@ std::vector<protocol::CallHierarchyOutgoingCall>
     return results;
 }
 
-std::vector<protocol::TypeHierarchyItem> Indexer::find_supertypes(index::SymbolHash hash) {
-    llvm::SmallVector<index::SymbolHash> base_hashes;
-    collect_unique_targets(hash, RelationKind::Base, base_hashes);
+std::vector<Indexer::TypeHierarchyNode> Indexer::walk_type_hierarchy(index::SymbolHash hash,
+                                                                     bool supertypes,
+                                                                     std::uint32_t max_depth) {
+    auto& hierarchy = workspace.project_index.type_hierarchy;
+    hierarchy.refresh([&](std::uint32_t file_id) { return find_shard(file_id); });
+
+    // Open files add the bases their buffers name beyond their shards.
+    auto kind = supertypes ? RelationKind::Base : RelationKind::Derived;
+    auto unsaved = [&](index::SymbolHash symbol, llvm::SmallVectorImpl<index::SymbolHash>& out) {
+        foreach_session([&](std::uint32_t, const Session& session) -> bool {
+            session.file_index->lookup(symbol, kind, [&](const index::Relation& r) {
+                out.push_back(r.target_symbol);
+                return true;
+            });
+            return true;
+        });
+    };
+
+    std::vector<TypeHierarchyNode> results;
+    hierarchy.walk(
+        hash,
+        supertypes,
+        max_depth,
+        [&](index::SymbolHash target, std::uint32_t depth) {
+            if(auto info = resolve_symbol(target))
+                results.push_back({build_type_hierarchy_item(*info), depth});
+        },
+        unsaved);
+    return results;
+}
 
+std::vector<protocol::TypeHierarchyItem> Indexer::find_supertypes(index::SymbolHash hash) {
     std::vector<protocol::TypeHierarchyItem> results;
-    for(auto target_hash: base_hashes) {
-        auto info = resolve_symbol(target_hash);
-        if(!info)
-            continue;
-        results.push_back(build_type_hierarchy_item(*info));
-    }
+    for(auto& node: walk_type_hierarchy(hash, true, 1))
+        results.push_back(std::move(node.item));
     return results;
 }
 
 std::vector<protocol::TypeHierarchyItem> Indexer::find_subtypes(index::SymbolHash hash) {
-    llvm::SmallVector<index::SymbolHash> derived_hashes;
-    collect_unique_targets(hash, RelationKind::Derived, derived_hashes);
-
     std::vector<protocol::TypeHierarchyItem> results;
-    for(auto target_hash: derived_hashes) {
-        auto info = resolve_symbol(target_hash);
-        if(!info)
-            continue;
-        results.push_back(build_type_hierarchy_item(*info));
-    }
+    for(auto& node: walk_type_hierarchy(hash, false, 1))
+        results.push_back(std::move(node.item));
     return results;
 }
 
 std::vector<protocol::SymbolInformation> Indexer::search_symbols(llvm::StringRef query,
                                                                  std::size_t max_results) {
-    std::string query_lower = query.lower();
-
     auto is_indexable_kind = [](SymbolKind sk) {
         return sk == SymbolKind::Namespace || sk == SymbolKind::Class || sk == SymbolKind::Struct ||
                sk == SymbolKind::Union || sk == SymbolKind::Enum || sk == SymbolKind::Type ||
@@ -779,59 +1852,161 @@ std::vector<protocol::SymbolInformation> Indexer::search_symbols(llvm::StringRef
                sk == SymbolKind::Label || sk == SymbolKind::Attribute;
     };
 
-    auto matches_query = [&](llvm::StringRef name) {
-        if(query_lower.empty())
-            return true;
-        return llvm::StringRef(name).lower().find(query_lower) != std::string::npos;
+    struct Candidate {
+        index::SymbolHash hash;
+        llvm::StringRef name;
+        SymbolKind kind;
     };
 
-    std::vector<protocol::SymbolInformation> results;
+    // Collected first and scored as one batch below.  Names from the trigram
+    // index come prepared; the few others are prepared here.
+    std::vector<Candidate> candidates;
+    std::vector<const PreparedWord*> words;
+    std::deque<PreparedWord> prepared;
     llvm::DenseSet<index::SymbolHash> seen;
 
-    for(auto& [hash, symbol]: workspace.project_index.symbols) {
+    auto consider = [&](index::SymbolHash hash,
+                        llvm::StringRef name,
+                        SymbolKind kind,
+                        const PreparedWord* word = nullptr) {
+        if(!is_indexable_kind(kind) || name.empty())
+            return;
+        if(!seen.insert(hash).second)
+            return;
+        candidates.push_back({hash, name, kind});
+        words.push_back(word ? word : &prepared.emplace_back(name));
+    };
+
+    // The trigram index narrows the project symbols to names that can match;
+    // an empty query matches everything, so take the first few instead.
+    auto& project = workspace.project_index;
+    if(query.empty()) {
+        for(auto& [hash, symbol]: project.symbols) {
+            if(candidates.size() >= max_results)
+                break;
+            consider(hash, project.name_of(symbol), symbol.kind);
+        }
+    } else {
+        auto visit = [&](index::SymbolHash hash, const PreparedWord& word) {
+            if(auto it = project.symbols.find(hash); it != project.symbols.end())
+                consider(hash, project.name_of(it->second), it->second.kind, &word);
+        };
+        project.name_index.candidates(query, visit);
+    }
+
+    // Open files add their TU-local symbols; there are few of them.
+    foreach_session([&](std::uint32_t, const Session& session) -> bool {
+        if(session.symbols) {
+            for(auto& [hash, symbol]: *session.symbols)
+                consider(hash, symbol.name, symbol.kind);
+        }
+        return true;
+    });
+
+    // Matches without a definition location are skipped below, so the batch
+    // is not cut to max_results.
+    auto matches = FuzzyMatcher(query).match_batch(words);
+    using Scored = FuzzyMatcher::Scored;
+    std::ranges::sort(matches, [&](const Scored& lhs, const Scored& rhs) {
+        if(lhs.score != rhs.score)
+            return lhs.score > rhs.score;
+        return candidates[lhs.index].name < candidates[rhs.index].name;
+    });
+
+    std::vector<protocol::SymbolInformation> results;
+    for(auto& match: matches) {
         if(results.size() >= max_results)
             break;
-        if(!is_indexable_kind(symbol.kind) || symbol.name.empty())
-            continue;
-        if(!matches_query(symbol.name))
-            continue;
-        auto def_loc = find_definition_location(hash);
+        auto& candidate = candidates[match.index];
+        auto def_loc = find_definition_location(candidate.hash);
         if(!def_loc)
             continue;
 
         protocol::SymbolInformation info;
-        info.name = symbol.name;
-        info.kind = to_lsp_symbol_kind(symbol.kind);
+        info.name = candidate.name.str();
+        info.kind = to_lsp_symbol_kind(candidate.kind);
         info.location = std::move(*def_loc);
         results.push_back(std::move(info));
-        seen.insert(hash);
     }
+    return results;
+}
 
-    foreach_session([&](std::uint32_t, const Session& session) -> bool {
-        if(results.size() >= max_results)
-            return false;
-        for(auto& [hash, symbol]: *session.symbols) {
-            if(results.size() >= max_results)
-                return false;
-            if(seen.contains(hash))
-                continue;
-            if(!is_indexable_kind(symbol.kind) || symbol.name.empty())
-                continue;
-            if(!matches_query(symbol.name))
+std::vector<IndexedSymbol> Indexer::complete_symbols(llvm::StringRef query, std::size_t limit) {
+    if(query.empty() || limit == 0)
+        return {};
+
+    auto is_offered_kind = [](SymbolKind sk) {
+        return sk == SymbolKind::Class || sk == SymbolKind::Struct || sk == SymbolKind::Union ||
+               sk == SymbolKind::Enum || sk == SymbolKind::Type || sk == SymbolKind::Function ||
+               sk == SymbolKind::Variable || sk == SymbolKind::Concept ||
+               sk == SymbolKind::Macro;
+    };
+
+    // A short query can be a prefix of a good part of the index; past this
+    // many candidates the rest are not scored.
+    constexpr std::size_t max_candidates = 20000;
+    // Headers looked for among the files referencing a symbol.
+    constexpr std::size_t max_files = 64;
+
+    auto& project = workspace.project_index;
+    std::vector<std::pair<index::SymbolHash, const index::ProjectSymbol*>> candidates;
+    std::vector<const PreparedWord*> words;
+    project.name_index.candidates(query, [&](index::SymbolHash hash, const PreparedWord& word) {
+        if(candidates.size() >= max_candidates)
+            return;
+        auto it = project.symbols.find(hash);
+        if(it == project.symbols.end() || it->second.scope != index::SymbolScope::External ||
+           !is_offered_kind(it->second.kind))
+            return;
+        candidates.emplace_back(hash, &it->second);
+        words.push_back(&word);
+    });
+
+    // Symbols only a source file declares cannot be included; a few more
+    // than `limit` are scored for them.
+    auto matches = FuzzyMatcher(query).match_batch(words, limit * 2);
+
+    std::vector<IndexedSymbol> results;
+    for(auto& match: matches) {
+        if(results.size() >= limit)
+            break;
+        auto [hash, symbol] = candidates[match.index];
+        IndexedSymbol result{
+            .hash = hash,
+            .name = project.name_of(*symbol).str(),
+            .kind = symbol->kind,
+            .score = match.score,
+        };
+
+        std::size_t examined = 0;
+        for(auto file_id: symbol->reference_files) {
+            if(++examined > max_files)
+                break;
+            auto shard_it = workspace.merged_indices.find(file_id);
+            if(shard_it == workspace.merged_indices.end())
                 continue;
-            auto def_loc = find_definition_location(hash);
-            if(!def_loc)
+            bool declares = false;
+            for(auto kind: {RelationKind::Declaration, RelationKind::Definition}) {
+                shard_it->second.lookup(hash, kind, [&](const index::Relation&) {
+                    declares = true;
+                    return false;
+                });
+                if(declares)
+                    break;
+            }
+            if(!declares)
                 continue;
 
-            protocol::SymbolInformation info;
-            info.name = symbol.name;
-            info.kind = to_lsp_symbol_kind(symbol.kind);
-            info.location = std::move(*def_loc);
-            results.push_back(std::move(info));
-            seen.insert(hash);
+            // A header is a file something includes.
+            auto path = project.path_pool.path(file_id);
+            auto path_id = workspace.path_pool.find(path);
+            if(!path_id || workspace.dep_graph.get_includers(*path_id).empty())
+                continue;
+            result.headers.emplace_back(path);
         }
-        return true;
-    });
+        if(!result.headers.empty())
+            results.push_back(std::move(result));
+    }
     return results;
 }
 
@@ -883,6 +2058,11 @@ void Indexer::enqueue(std::uint32_t server_path_id) {
     index_queue.push_back(server_path_id);
 }
 
+void Indexer::reindex(std::uint32_t server_path_id) {
+    forced_updates.insert(server_path_id);
+    index_queue.push_back(server_path_id);
+}
+
 void Indexer::pause_indexing() {
     ++pause_depth;
     if(pause_depth == 1) {
@@ -903,10 +2083,13 @@ void Indexer::resume_indexing() {
 kota::task<> Indexer::stop() {
     bg_tasks.cancel();
     co_await bg_tasks.join();
+    co_await merge_tasks.join();
+    co_await read_tasks.join();
 }
 
 void Indexer::schedule() {
-    if(!*workspace.config.project.enable_indexing || indexing_active || indexing_scheduled)
+    if(!*workspace.config.project.enable_indexing || read_only || indexing_active ||
+       indexing_scheduled)
         return;
     indexing_scheduled = true;
 
@@ -929,7 +2112,7 @@ kota::task<> Indexer::index_one(std::uint32_t server_path_id,
     if(is_open && is_open(server_path_id))
         co_return;
 
-    if(!need_update(file_path))
+    if(!forced_updates.erase(server_path_id) && !need_update(file_path))
         co_return;
 
     // For module interface units, compile their PCM (and transitive deps)
@@ -941,24 +2124,38 @@ kota::task<> Indexer::index_one(std::uint32_t server_path_id,
     worker::BuildParams params;
     params.kind = worker::BuildKind::Index;
     params.file = file_path;
+    params.time_trace = *workspace.config.project.time_trace;
     if(!compiler.fill_compile_args(file_path, params.directory, params.arguments, nullptr))
         co_return;
 
     workspace.fill_pcm_deps(params.pcms);
+    if(!full_reindex.erase(server_path_id)) {
+        fill_known_indices(file_path, params);
+    }
 
     LOG_INFO("[{}/{}] Indexing {}", index, total, file_path);
 
     auto result = co_await pool.send_stateless(params);
-    if(result.has_value() && result.value().success && !result.value().tu_index_data.empty()) {
-        LOG_INFO("[{}/{}] Indexed {}: {} bytes",
+    std::optional<shared_blob::Payload> tu_index;
+    if(result.has_value())
+        tu_index.emplace(result.value().tu_index_data, result.value().tu_index_segment);
+
+    if(result.has_value() && result.value().success && !tu_index->empty()) {
+        LOG_INFO("[{}/{}] Indexed {}: {} bytes{}",
                  index,
                  total,
                  file_path,
-                 result.value().tu_index_data.size());
-        merge(result.value().tu_index_data.data(), result.value().tu_index_data.size());
+                 tu_index->size(),
+                 result.value().tu_index_segment.empty() ? "" : " (shared)");
+        merge(tu_index->data(), tu_index->size());
+        if(params.time_trace) {
+            workspace.time_traces.record(server_path_id,
+                                         CompilationKind::Indexing,
+                                         std::move(result.value().time_trace));
+        }
     } else if(result.has_value() && !result.value().success) {
         LOG_WARN("[{}/{}] Index failed for {}: {}", index, total, file_path, result.value().error);
-    } else if(result.has_value() && result.value().tu_index_data.empty()) {
+    } else if(result.has_value() && tu_index->empty()) {
         LOG_WARN("[{}/{}] Index returned empty TUIndex for {}", index, total, file_path);
     } else {
         LOG_WARN("[{}/{}] Index IPC error for {}: {}",
@@ -969,6 +2166,133 @@ kota::task<> Indexer::index_one(std::uint32_t server_path_id,
     }
 }
 
+kota::task<> Indexer::index_batch(llvm::SmallVector<std::uint32_t> server_path_ids,
+                                  std::size_t index,
+                                  std::size_t total) {
+    worker::BuildParams params;
+    params.kind = worker::BuildKind::Index;
+    params.time_trace = *workspace.config.project.time_trace;
+    for(auto server_path_id: server_path_ids) {
+        auto file_path = std::string(workspace.path_pool.resolve(server_path_id));
+        if((is_open && is_open(server_path_id)) ||
+           (!forced_updates.erase(server_path_id) && !need_update(file_path)))
+            continue;
+
+        worker::IndexTarget target;
+        target.file = file_path;
+        if(!compiler.fill_compile_args(file_path, target.directory, target.arguments, nullptr))
+            continue;
+        params.batch.push_back(std::move(target));
+    }
+    if(params.batch.empty())
+        co_return;
+
+    params.file = params.batch.front().file;
+    workspace.fill_pcm_deps(params.pcms);
+    for(auto& target: params.batch) {
+        batch_pending.insert(target.file);
+        fill_known_indices(target.file, params);
+    }
+
+    LOG_INFO("[{}/{}] Indexing batch of {} files from {}",
+             index,
+             total,
+             params.batch.size(),
+             params.file);
+
+    auto result = co_await pool.send_stateless(params);
+    if(!result.has_value()) {
+        LOG_WARN("[{}/{}] Index batch IPC error for {}: {}",
+                 index,
+                 total,
+                 params.file,
+                 result.error().message);
+    }
+
+    // Preempted or lost with the worker: index the rest on their own.
+    for(std::size_t i = 0; i < params.batch.size(); ++i) {
+        auto& file_path = params.batch[i].file;
+        if(batch_pending.erase(file_path))
+            co_await index_one(workspace.path_pool.intern(file_path), index + i, total);
+    }
+}
+
+void Indexer::merge_streamed(const worker::IndexedParams& params) {
+    batch_pending.erase(params.file);
+
+    shared_blob::Payload tu_index(params.tu_index_data, params.tu_index_segment);
+    if(!params.success) {
+        LOG_WARN("Index failed for {}: {}", params.file, params.error);
+    } else if(tu_index.empty()) {
+        LOG_WARN("Index returned empty TUIndex for {}", params.file);
+    } else {
+        LOG_INFO("Indexed {}: {} bytes{}",
+                 params.file,
+                 tu_index.size(),
+                 params.tu_index_segment.empty() ? "" : " (shared)");
+        merge(tu_index.data(), tu_index.size());
+        if(*workspace.config.project.time_trace) {
+            workspace.time_traces.record(workspace.path_pool.intern(params.file),
+                                         CompilationKind::Indexing,
+                                         params.time_trace);
+        }
+    }
+}
+
+void Indexer::rank_queue() {
+    auto& graph = workspace.dep_graph;
+
+    llvm::DenseSet<std::uint32_t> near;
+    llvm::DenseSet<std::uint32_t> open_dirs;
+    foreach_session([&](std::uint32_t id, const Session&) -> bool {
+        near.insert(id);
+        for(auto host: graph.find_host_sources(id))
+            near.insert(host);
+        open_dirs.insert(workspace.path_pool.directory_of(id));
+        return true;
+    });
+
+    // Headers cover a file's include fan-in once, however often it recurs.
+    llvm::DenseMap<std::uint32_t, std::size_t> fan_in;
+    auto fan_in_of = [&](std::uint32_t header) {
+        auto [it, inserted] = fan_in.try_emplace(header, 0);
+        if(inserted)
+            it->second = graph.get_includers(header).size();
+        return it->second;
+    };
+
+    struct Rank {
+        bool module;
+        bool near;
+        bool stale;
+        std::size_t fan_in;
+    };
+    llvm::DenseMap<std::uint32_t, Rank> ranks;
+    auto& path_pool = workspace.project_index.path_pool;
+    for(auto id: llvm::ArrayRef(index_queue).drop_front(index_queue_pos)) {
+        auto file = workspace.path_pool.resolve(id);
+        Rank rank{
+            .module = workspace.path_to_module.contains(id),
+            .near = near.contains(id) || open_dirs.contains(workspace.path_pool.directory_of(id)),
+            .stale = false,
+            .fan_in = 0,
+        };
+        if(auto it = path_pool.find(file); it != path_pool.cache.end())
+            rank.stale = workspace.merged_indices.contains(it->second);
+        for(auto include: graph.get_all_includes(id))
+            rank.fan_in += fan_in_of(include & DependencyGraph::PATH_ID_MASK);
+        ranks.try_emplace(id, rank);
+    }
+
+    std::ranges::stable_sort(index_queue.begin() + index_queue_pos,
+                             index_queue.end(),
+                             std::ranges::greater{},
+                             [&](std::uint32_t id) {
+                                 auto& rank = ranks.find(id)->second;
+                                 return std::tuple(rank.module, rank.near, rank.stale, rank.fan_in);
+                             });
+}
+
 kota::task<> Indexer::run_background_indexing() {
     if(index_idle_timer) {
         co_await index_idle_timer->wait();
@@ -984,10 +2308,7 @@ kota::task<> Indexer::run_background_indexing() {
     LOG_DEBUG("Background indexing: starting, {} files queued",
               index_queue.size() - index_queue_pos);
 
-    std::stable_partition(
-        index_queue.begin() + index_queue_pos,
-        index_queue.end(),
-        [this](std::uint32_t id) { return workspace.path_to_module.contains(id); });
+    rank_queue();
 
     auto total = index_queue.size() - index_queue_pos;
     std::size_t dispatched = 0;
@@ -1006,32 +2327,81 @@ kota::task<> Indexer::run_background_indexing() {
         }
     }
 
+    // Files sharing a compile configuration are indexed in batches, so the
+    // worker stats system headers and loads modules once per batch.  Module
+    // interface units still go one by one after their PCM is built.
+    auto batch_size =
+        static_cast<std::size_t>(std::max(*workspace.config.project.index_batch_size, 1));
+    llvm::DenseMap<std::uint32_t, std::size_t> config_of;
+    std::vector<llvm::SmallVector<std::uint32_t>> batches;
+    if(batch_size > 1) {
+        auto groups = workspace.cdb.unique_configs();
+        batches.resize(groups.size());
+        for(std::size_t i = 0; i < groups.size(); ++i) {
+            for(auto file_id: groups[i].file_ids) {
+                if(auto id = workspace.path_pool.find(workspace.cdb.resolve_path(file_id)))
+                    config_of.try_emplace(*id, i);
+            }
+        }
+    }
+
     kota::task_group<> workers(loop);
 
+    auto run = [&](llvm::SmallVector<std::uint32_t> ids, std::size_t n) -> kota::task<> {
+        auto files = ids.size();
+        if(files == 1)
+            co_await index_one(ids.front(), n, total);
+        else
+            co_await index_batch(std::move(ids), n, total);
+
+        completed += files;
+        if(progress) {
+            auto pct = total > 0 ? static_cast<std::uint32_t>(completed * 100 / total) : 100;
+            progress->report(std::format("{}/{} files", completed, total), pct);
+        }
+    };
+
+    auto dispatch = [&](llvm::SmallVector<std::uint32_t> ids) {
+        auto n = dispatched + 1;
+        dispatched += ids.size();
+        workers.spawn(run(std::move(ids), n));
+    };
+
     while(index_queue_pos < index_queue.size()) {
         if(pause_depth > 0)
             co_await resume_event.wait();
 
         auto server_path_id = index_queue[index_queue_pos++];
         auto file_path = std::string(workspace.path_pool.resolve(server_path_id));
-        if((is_open && is_open(server_path_id)) || !need_update(file_path)) {
+        if((is_open && is_open(server_path_id)) ||
+           (!forced_updates.contains(server_path_id) && !need_update(file_path))) {
             ++completed;
             continue;
         }
 
-        ++dispatched;
-        workers.spawn([&, server_path_id, n = dispatched]() -> kota::task<> {
-            co_await index_one(server_path_id, n, total);
-            ++completed;
-            if(progress) {
-                auto pct = total > 0 ? static_cast<std::uint32_t>(completed * 100 / total) : 100;
-                progress->report(std::format("{}/{} files", completed, total), pct);
-            }
-        }());
+        // A batch shares the known indices of its headers, so a file that
+        // must send them all is indexed on its own.
+        auto config = config_of.find(server_path_id);
+        if(config == config_of.end() || workspace.path_to_module.contains(server_path_id) ||
+           full_reindex.contains(server_path_id)) {
+            dispatch({server_path_id});
+            continue;
+        }
+
+        auto& batch = batches[config->second];
+        batch.push_back(server_path_id);
+        if(batch.size() >= batch_size)
+            dispatch(std::exchange(batch, {}));
+    }
+
+    for(auto& batch: batches) {
+        if(!batch.empty())
+            dispatch(std::move(batch));
     }
 
     LOG_DEBUG("Background indexing: all {} tasks spawned, waiting for completion", dispatched);
     co_await workers.join();
+    co_await merges_idle.wait();
 
     if(progress) {
         progress->end(std::format("Indexed {} files", dispatched));
@@ -1039,7 +2409,66 @@ kota::task<> Indexer::run_background_indexing() {
 
     indexing_active = false;
     LOG_INFO("Background indexing complete: {} files dispatched", dispatched);
+    co_await compact_shards();
     co_await save();
 }
 
+kota::task<> Indexer::compact_shards() {
+    // Contexts are mostly removed by recompiles on another branch; half of
+    // a shard being dead is when rewriting it starts to pay off.
+    constexpr double threshold = 0.5;
+    std::vector<std::uint32_t> candidates;
+    for(auto& [path_id, shard]: workspace.merged_indices) {
+        if(shard.garbage_ratio() > threshold) {
+            candidates.push_back(path_id);
+        }
+    }
+
+    // One shard at a time, each compacted into a copy on the thread pool
+    // as merges do: queries keep serving the shard meanwhile.  It counts as
+    // read until then, so refreshes leave it alone, and holds the merge
+    // slot, so no merge is lost when the copy replaces it.
+    std::size_t compacted = 0;
+    for(auto path_id: candidates) {
+        auto it = workspace.merged_indices.find(path_id);
+        if(it == workspace.merged_indices.end() || merging_shards.contains(path_id) ||
+           it->second.garbage_ratio() <= threshold) {
+            continue;
+        }
+        auto done = std::make_shared<kota::event>();
+        merging_shards.try_emplace(path_id, done);
+        if(shard_readers.empty())
+            shards_unread.reset();
+        shard_readers[path_id] += 1;
+
+        auto* source = &it->second;
+        auto result = co_await kota::queue([source] {
+            auto shard = source->clone();
+            shard.compact();
+            return shard;
+        });
+
+        auto reader = shard_readers.find(path_id);
+        if(--reader->second == 0)
+            shard_readers.erase(reader);
+        if(shard_readers.empty())
+            shards_unread.set();
+        while(shard_readers.contains(path_id)) {
+            co_await shards_unread.wait();
+        }
+        if(!result.has_value()) {
+            LOG_WARN("Failed to compact index shard {}", path_id);
+        } else if(auto shard = workspace.merged_indices.find(path_id);
+                  shard != workspace.merged_indices.end()) {
+            shard->second = std::move(*result);
+            compacted += 1;
+        }
+        merging_shards.erase(path_id);
+        done->set();
+    }
+    if(compacted != 0) {
+        LOG_INFO("Compacted {} MergedIndex shards", compacted);
+    }
+}
+
 }  // namespace clice
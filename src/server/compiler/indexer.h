@@ -17,8 +17,12 @@
 #include "kota/ipc/lsp/progress.h"
 #include "kota/ipc/lsp/protocol.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/Chrono.h"
 
 namespace clice {
 
@@ -29,6 +33,11 @@ struct Session;
 class Compiler;
 class WorkerPool;
 
+namespace worker {
+struct BuildParams;
+struct IndexedParams;
+}
+
 /// Information about a symbol at a given position.
 struct SymbolInfo {
     index::SymbolHash hash = 0;
@@ -38,6 +47,18 @@ struct SymbolInfo {
     protocol::Range range;
 };
 
+/// A project symbol that code completion can offer from a header the file
+/// does not include yet.
+struct IndexedSymbol {
+    index::SymbolHash hash = 0;
+    std::string name;
+    SymbolKind kind;
+    /// How well the name matches the query, FuzzyMatcher's score.
+    float score = 0;
+    /// Headers of the project declaring it.
+    llvm::SmallVector<std::string, 1> headers;
+};
+
 /// Index query layer and background indexing scheduler.
 ///
 /// Indexer holds no index data of its own.  All persistent data lives in
@@ -65,8 +86,8 @@ public:
             Compiler& compiler,
             std::function<bool(std::uint32_t)> is_open = {},
             std::function<void(SessionVisitor)> each_session = {}) :
-        loop(loop), bg_tasks(loop), workspace(workspace), pool(pool), compiler(compiler),
-        is_open(std::move(is_open)), each_session(std::move(each_session)) {}
+        loop(loop), bg_tasks(loop), merge_tasks(loop), workspace(workspace), pool(pool),
+        compiler(compiler), is_open(std::move(is_open)), each_session(std::move(each_session)) {}
 
     /// Set the LSP peer for progress reporting.  Must be called before
     /// schedule() if progress notifications are desired.
@@ -105,25 +126,108 @@ public:
     /// Add a file to the background indexing queue.
     void enqueue(std::uint32_t server_path_id);
 
+    /// Queue a file to be indexed again even though its contents did not
+    /// change, e.g. because its compile command did.
+    void reindex(std::uint32_t server_path_id);
+
     /// Schedule background indexing (respects idle timeout and dedup).
     void schedule();
 
     /// Merge a TUIndex result into Workspace's ProjectIndex and MergedIndex shards.
+    /// The ProjectIndex is updated before this returns; each shard is merged
+    /// on the thread pool afterwards (see merge_shard()).
     void merge(const void* tu_index_data, std::size_t size);
 
+    /// Merge one TU streamed back from a batched Index build.
+    void merge_streamed(const worker::IndexedParams& params);
+
     /// Save Workspace's ProjectIndex and MergedIndex shards to the cache
     /// store ("index" namespace, Persistent policy).  Serialization runs
     /// on the event loop; each blob's commit (fsync + rename) is offloaded
-    /// to the kota thread pool.
+    /// to the kota thread pool.  Shards written are sealed in memory.
     kota::task<> save();
 
     /// Load Workspace's ProjectIndex and MergedIndex shards from the cache
     /// store, sweeping orphaned shard blobs.
-    void load();
+    ///
+    /// With project.base_index set, a base snapshot not adopted yet replaces
+    /// the local index, its paths under project.base_index_root moved under
+    /// `workspace_root`; the shards of the adopted base that were not
+    /// indexed over locally are mapped from the base directory.
+    void load(llvm::StringRef workspace_root = {});
+
+    /// Serve the index another instance writes to the shared store instead
+    /// of building one (project.shared_index): schedule() and save() do
+    /// nothing and load() leaves orphans to the owner.  Open files are still
+    /// answered from their Sessions.
+    void set_read_only(bool value) {
+        read_only = value;
+    }
+
+    bool is_read_only() const {
+        return read_only;
+    }
+
+    /// Pick up what the owner of the shared index committed since the last
+    /// call: reload the shards it replaced, or everything once it published
+    /// a new ProjectIndex.
+    void refresh();
 
     /// Check whether a file needs re-indexing (stale or missing shard).
+    /// Files of a shard from the base index are compared by contents.
     bool need_update(llvm::StringRef file_path);
 
+    /// Add the index and context hashes held for the headers `file_path`
+    /// included when it was last indexed, so the worker can skip or send
+    /// hash-only the ones that did not change.
+    void fill_known_indices(llvm::StringRef file_path, worker::BuildParams& params);
+
+    /// Position in the relations of a symbol, so that large results can be
+    /// produced a page at a time.  Files are visited in two phases: open
+    /// files by server path id, then the symbol's indexed reference files by
+    /// project path id, or for calls the call graph as one file.  `skip`
+    /// counts the relations of file `path_id` already produced.  A page
+    /// resumes at the first file from `path_id` on, so files opened, closed
+    /// or indexed between pages shift no other file's position.
+    struct RelationCursor {
+        enum Phase : std::uint32_t {
+            Open,
+            Indexed,
+        };
+
+        Phase phase = Open;
+        std::uint32_t path_id = 0;
+        std::uint32_t skip = 0;
+    };
+
+    /// Called with each relation and the file (path, content, line map) it
+    /// was found in.  Return false to stop after this relation.
+    using RelationVisitor = llvm::function_ref<bool(llvm::StringRef path,
+                                                    llvm::StringRef content,
+                                                    const lsp::LineMap& map,
+                                                    const index::Relation& relation)>;
+
+    /// Visit the relations of `hash` from `cursor` on, advancing it past each
+    /// one visited.  Returns true once every file has been visited.
+    bool visit_relations(index::SymbolHash hash,
+                         RelationKind kind,
+                         RelationCursor& cursor,
+                         RelationVisitor visitor);
+
+    /// Append up to `limit` locations of the relations of `hash` from
+    /// `cursor` on.  Returns true once all have been produced.
+    bool collect_locations(index::SymbolHash hash,
+                           RelationKind kind,
+                           RelationCursor& cursor,
+                           std::size_t limit,
+                           std::vector<protocol::Location>& locations);
+
+    /// The symbol at cursor, or 0 if there is none.
+    /// @param session  Active Session for this file, or nullptr to use MergedIndex only.
+    index::SymbolHash symbol_at(llvm::StringRef path,
+                                const protocol::Position& position,
+                                Session* session);
+
     /// Query relations (Definition, Reference, etc.) for a symbol at cursor.
     /// @param session  Active Session for this file, or nullptr to use MergedIndex only.
     std::vector<protocol::Location> query_relations(llvm::StringRef path,
@@ -155,6 +259,14 @@ public:
     /// Find incoming calls to a function.
     std::vector<protocol::CallHierarchyIncomingCall> find_incoming_calls(index::SymbolHash hash);
 
+    /// Append the incoming calls among the next `limit` call sites from
+    /// `cursor` on.  A caller whose calls span pages appears in each of them.
+    /// Returns true once all call sites have been produced.
+    bool find_incoming_calls(index::SymbolHash hash,
+                             RelationCursor& cursor,
+                             std::size_t limit,
+                             std::vector<protocol::CallHierarchyIncomingCall>& results);
+
     /// Find outgoing calls from a function.
     std::vector<protocol::CallHierarchyOutgoingCall> find_outgoing_calls(index::SymbolHash hash);
 
@@ -164,10 +276,30 @@ public:
     /// Find subtypes (derived classes) of a type.
     std::vector<protocol::TypeHierarchyItem> find_subtypes(index::SymbolHash hash);
 
+    /// A type reached from the root of a hierarchy walk, `depth` levels away.
+    struct TypeHierarchyNode {
+        protocol::TypeHierarchyItem item;
+        std::uint32_t depth = 0;
+    };
+
+    /// The supertypes, or subtypes, of a type breadth first, up to
+    /// `max_depth` levels away or all of them for 0.  Answered from the type
+    /// hierarchy of ProjectIndex and the open files.
+    std::vector<TypeHierarchyNode> walk_type_hierarchy(index::SymbolHash hash,
+                                                       bool supertypes,
+                                                       std::uint32_t max_depth);
+
     /// Search symbols by name substring.
     std::vector<protocol::SymbolInformation> search_symbols(llvm::StringRef query,
                                                             std::size_t max_results = 100);
 
+    /// The `limit` best matches of `query` among the project's external
+    /// types, functions, variables, concepts and macros that a header
+    /// declares, for completing names the file does not see yet.  Only the
+    /// trigram candidates are scored and only the best have their headers
+    /// looked up, so the cost does not grow with the index.
+    std::vector<IndexedSymbol> complete_symbols(llvm::StringRef query, std::size_t limit);
+
     struct DefinitionText {
         std::string file;
         int start_line;
@@ -175,8 +307,22 @@ public:
         std::string text;
     };
 
+    /// The source text the shard of `proj_path_id` was indexed from, which
+    /// its offsets refer to: the file on disk while it still hashes the
+    /// same, else the copy kept aside by the merge.  None once both are gone.
+    std::optional<std::string> shard_content(std::uint32_t proj_path_id,
+                                             const index::MergedIndex& shard);
+
     /// Get full definition text for a symbol, using stored index ranges and content.
-    std::optional<DefinitionText> get_definition_text(index::SymbolHash hash);
+    /// `file`, where the symbol is likely defined, is tried first from the
+    /// outline of its shard.
+    std::optional<DefinitionText> get_definition_text(index::SymbolHash hash,
+                                                      llvm::StringRef file = {});
+
+    /// The doc comment of a symbol as the index recorded it, without an AST:
+    /// from the open files first, then the shard of `file` and those of the
+    /// files referencing the symbol.  Empty if none has one.
+    std::string documentation(index::SymbolHash hash, llvm::StringRef file = {});
 
     struct ReferenceWithContext {
         std::string file;
@@ -184,9 +330,34 @@ public:
         std::string context;
     };
 
+    /// All the locations of the relations of `hash`, as collect_locations()
+    /// produces them, with the indexed shards read on the thread pool so
+    /// that a large query does not hold up the loop.  Open files are read
+    /// on the loop first.
+    kota::task<std::vector<protocol::Location>> find_locations(index::SymbolHash hash,
+                                                               RelationKind kind);
+
+    /// The edits renaming every occurrence of `hash` to `new_name`, or
+    /// nullopt if the symbol is unknown.  The reference files whose shards
+    /// are older than the files are indexed again first, in parallel on
+    /// stateless workers; the shards are then read on the thread pool in
+    /// chunks.  Each edit is checked against the text it applies to, open
+    /// buffers or the files on disk, and occurrences no longer spelling the
+    /// old name are left out.
+    kota::task<std::optional<protocol::WorkspaceEdit>> rename(index::SymbolHash hash,
+                                                              std::string new_name);
+
     /// Collect references (or definitions) with context lines from stored content.
     std::vector<ReferenceWithContext> collect_references(index::SymbolHash hash, RelationKind kind);
 
+    /// Append up to `limit` references from `cursor` on.  Returns true once
+    /// all have been produced.
+    bool collect_references(index::SymbolHash hash,
+                            RelationKind kind,
+                            RelationCursor& cursor,
+                            std::size_t limit,
+                            std::vector<ReferenceWithContext>& results);
+
     /// Cancel background indexing and wait for all tasks to settle.
     kota::task<> stop();
 
@@ -224,6 +395,26 @@ public:
         return index_queue.size();
     }
 
+    /// The overlay of an open file is the index of its last compile, which
+    /// shadows the shard of the file.  While the buffer has unsaved edits
+    /// past that compile, its ranges are moved onto the current text; a
+    /// relation whose name was edited has no place there and is nullopt.
+    static std::optional<index::Relation> move_overlay(const Session& session,
+                                                       const index::Relation& relation);
+
+    /// The relations of `hash` in the overlay of `session`, moved onto its
+    /// current text.
+    static void lookup_overlay(const Session& session,
+                               index::SymbolHash hash,
+                               RelationKind kind,
+                               llvm::function_ref<bool(const index::Relation&)> fn);
+
+    /// The occurrences of the overlay of `session` at `offset` of its current
+    /// text, moved onto it.
+    static void lookup_overlay(const Session& session,
+                               std::uint32_t offset,
+                               llvm::function_ref<bool(const index::Occurrence&)> fn);
+
     /// Convert internal SymbolKind to LSP SymbolKind.
     static protocol::SymbolKind to_lsp_symbol_kind(SymbolKind kind);
 
@@ -232,6 +423,10 @@ public:
     static protocol::TypeHierarchyItem build_type_hierarchy_item(const SymbolInfo& info);
 
 private:
+    /// Record the definitions of `shard`, the shard of `path_id`, in the
+    /// definition table of ProjectIndex.
+    void index_definitions(std::uint32_t path_id, const index::MergedIndex& shard);
+
     /// Result of resolving a symbol at a cursor position.
     struct CursorHit {
         index::SymbolHash hash = 0;
@@ -244,16 +439,35 @@ private:
                              const protocol::Position& position,
                              Session* session);
 
-    /// Collect relations grouped by target symbol, across all index sources.
-    void collect_grouped_relations(
+    /// The visit_relations() of Caller or Callee past the open files: the
+    /// calls of the call graph, `cursor.skip` counting those produced.
+    bool visit_indexed_calls(index::SymbolHash hash,
+                             RelationKind kind,
+                             RelationCursor& cursor,
+                             RelationVisitor visitor);
+
+    /// Collect up to `limit` relations from `cursor` on, grouped by target
+    /// symbol.  Returns true once all have been collected.
+    bool collect_grouped_relations(
         index::SymbolHash hash,
         RelationKind kind,
+        RelationCursor& cursor,
+        std::size_t limit,
         llvm::DenseMap<index::SymbolHash, std::vector<protocol::Range>>& target_ranges);
 
-    /// Collect unique target symbol hashes for a relation kind.
-    void collect_unique_targets(index::SymbolHash hash,
-                                RelationKind kind,
-                                llvm::SmallVectorImpl<index::SymbolHash>& targets);
+    /// The shard of a project path id, or nullptr if it has none.
+    const index::MergedIndex* find_shard(std::uint32_t proj_path_id) const {
+        auto it = workspace.merged_indices.find(proj_path_id);
+        return it == workspace.merged_indices.end() ? nullptr : &it->second;
+    }
+
+    /// Compact the shards mostly made of removed contexts, so the save that
+    /// ends an indexing round rewrites them at their live size.
+    kota::task<> compact_shards();
+
+    /// Whether the file of `path_id` still has the contents its shard was
+    /// built from; memoized per mtime.
+    bool same_as_base(std::uint32_t path_id, llvm::ArrayRef<llvm::StringRef> paths);
 
     /// Resolve a symbol hash into a SymbolInfo with definition location.
     std::optional<SymbolInfo> resolve_symbol(index::SymbolHash hash);
@@ -263,15 +477,18 @@ private:
         if(!is_open)
             return false;
         auto path = workspace.project_index.path_pool.path(proj_path_id);
-        auto it = workspace.path_pool.cache.find(path);
-        if(it == workspace.path_pool.cache.end())
-            return false;
-        return is_open(it->second);
+        auto id = workspace.path_pool.find(path);
+        return id && is_open(*id);
     }
 
 private:
     kota::event_loop& loop;
     kota::task_group<> bg_tasks;
+
+    /// Shard merges.  Never cancelled: stop() lets them finish so every
+    /// merged copy is in place before the shards are saved.
+    kota::task_group<> merge_tasks;
+
     Workspace& workspace;
     WorkerPool& pool;
     Compiler& compiler;
@@ -288,17 +505,91 @@ private:
     /// Background indexing queue and scheduling state.
     std::vector<std::uint32_t> index_queue;
     std::size_t index_queue_pos = 0;
+
+    /// Queued files indexed even if need_update() says they are current.
+    llvm::DenseSet<std::uint32_t> forced_updates;
+
+    /// Queued files indexed with no known indices or contexts, because a
+    /// shard lost an index their last build reused.
+    llvm::DenseSet<std::uint32_t> full_reindex;
     bool indexing_active = false;
     bool indexing_scheduled = false;
     std::shared_ptr<kota::timer> index_idle_timer;
 
+    /// See set_read_only().
+    bool read_only = false;
+
+    /// Shards still mapped from the base index, by path id.
+    llvm::DenseSet<std::uint32_t> base_shards;
+
+    /// Path id → the mtime its file was compared at, and whether its
+    /// contents were those of its shard then.
+    llvm::DenseMap<std::uint32_t, std::pair<llvm::sys::TimePoint<>, bool>> base_matches;
+
+    /// Identity of the base snapshot load() adopted, recorded once save()
+    /// has published the local index built from it.
+    std::string pending_base;
+
     /// Pause/resume: when paused, new index tasks wait on this event.
     /// Uses a counter so nested pause/resume pairs work correctly.
     std::size_t pause_depth = 0;
     kota::event resume_event{true};
 
+    /// Files of in-flight batches whose TUIndex has not streamed back yet.
+    llvm::StringSet<> batch_pending;
+
+    /// Shards being merged into a copy, each with the event set once the copy
+    /// is in place.  A later TU touching the same shard waits on it: one
+    /// writer per shard.
+    llvm::DenseMap<std::uint32_t, std::shared_ptr<kota::event>> merging_shards;
+
+    /// Shard merges spawned but not finished; merges_idle is set at zero.
+    std::size_t merges_in_flight = 0;
+    kota::event merges_idle{true};
+
+    /// Readers on the thread pool per shard they read; shards_unread is set
+    /// when there are none.  A shard being read is not moved or modified:
+    /// merges wait for it before putting their copy in place, saves and
+    /// compactions leave it for later.
+    llvm::DenseMap<std::uint32_t, std::uint32_t> shard_readers;
+    kota::event shards_unread{true};
+
+    /// Reads of shards on the thread pool.  Never cancelled, as the pool
+    /// thread may still be on a shard when the request is.
+    kota::task_group<> read_tasks{loop};
+
+    struct ShardRead;
+
+    /// Call `read` on the thread pool with the path and shard of each of
+    /// `files` that has one, then release them.  Shards being merged are
+    /// missed, as queries on the loop miss them.  `read` must own what it
+    /// writes to: it runs to the end even if the caller is cancelled.
+    kota::task<> read_shards(
+        std::vector<std::uint32_t> files,
+        std::function<void(llvm::StringRef path, const index::MergedIndex& shard)> read);
+
+    kota::task<> run_shard_read(std::shared_ptr<ShardRead> job);
+
+    struct ShardMerge;
+
+    /// Merge one FileIndex of `tu_index` into its shard on the thread pool.
+    kota::task<> merge_shard(std::shared_ptr<index::TUIndex> tu_index, ShardMerge job);
+
+    /// Order the unprocessed part of the queue by how soon each file pays
+    /// off: module interface units, then files near the open sessions
+    /// (hosts of an open header, or in an open file's directory), then
+    /// files with a stale shard, then by the includer fan-in of the headers
+    /// they pull in.  Ties keep enqueue order.
+    void rank_queue();
+
     kota::task<> run_background_indexing();
     kota::task<> index_one(std::uint32_t server_path_id, std::size_t index, std::size_t total);
+
+    /// Index files that share a compile configuration in one worker session;
+    /// files the worker does not get to are indexed one by one.
+    kota::task<> index_batch(llvm::SmallVector<std::uint32_t> server_path_ids,
+                             std::size_t index,
+                             std::size_t total);
 };
 
 }  // namespace clice
@@ -19,19 +19,66 @@ struct CompileCommandResult {
     std::vector<std::string> arguments;
 };
 
-struct FileInfo {
+/// A path first sent in compact mode, and the id standing for it in later
+/// replies on the same connection.
+struct PathEntry {
+    int id = 0;
     std::string path;
-    std::string kind;
+};
+
+struct ConfigureParams {
+    /// Send each path once per connection and then only its id: results
+    /// list the paths they introduce in `new_paths`, and entries carry
+    /// `path_id` (or `file_id`) in place of the path.
+    std::optional<bool> compact_paths;
+};
+
+struct ConfigureResult {
+    bool compact_paths = false;
+};
+
+struct FileInfo {
+    std::optional<std::string> path;
+    std::optional<int> path_id;
+    std::optional<std::string> kind;
     std::optional<std::string> module_name;
 };
 
 struct ProjectFilesParams {
+    /// "all" (the default), "source", "header" or "module".
     std::optional<std::string> filter;
+
+    /// Keep the paths matching this glob, e.g. "**/src/**/*.cpp".
+    std::optional<std::string> glob;
+
+    /// Keep the paths fuzzily matching this, best match first instead of
+    /// by directory.
+    std::optional<std::string> query;
+
+    /// Fields of FileInfo to fill besides the path: "kind", "module_name".
+    /// All of them when unset.
+    std::optional<std::vector<std::string>> fields;
+
+    /// Page size; every match is returned in one reply when unset.
+    std::optional<int> limit;
+
+    /// `next_cursor` of the previous page.
+    std::optional<std::string> cursor;
 };
 
 struct ProjectFilesResult {
     std::vector<FileInfo> files;
+
+    /// Number of files in this reply.
     int total = 0;
+
+    /// Number of files matching the filters, over all pages.
+    int matched = 0;
+
+    /// Set when more files follow; pass it back as `cursor`.
+    std::optional<std::string> next_cursor;
+
+    std::optional<std::vector<PathEntry>> new_paths;
 };
 
 struct DepEntry {
@@ -53,12 +100,17 @@ struct FileDepsResult {
 
 struct ImpactAnalysisParams {
     std::string path;
+    /// Page of transitive_dependents to return, in a stable order.
+    std::optional<int> offset;
+    std::optional<int> limit;
 };
 
 struct ImpactAnalysisResult {
     std::vector<std::string> direct_dependents;
     std::vector<std::string> transitive_dependents;
     std::vector<std::string> affected_modules;
+    /// Number of transitive dependents, of which one page is listed.
+    int transitive_count = 0;
 };
 
 struct SymbolEntry {
@@ -95,6 +147,7 @@ struct ReadSymbolResult {
     int end_line = 0;
     std::string text;
     std::optional<std::string> signature;
+    std::optional<std::string> documentation;
     std::uint64_t symbol_id = 0;
 };
 
@@ -104,6 +157,9 @@ struct DocumentSymbolEntry {
     int start_line = 0;
     int end_line = 0;
     std::uint64_t symbol_id = 0;
+
+    /// The innermost entry containing this one, 0 at the top level.
+    std::uint64_t parent_id = 0;
 };
 
 struct DocumentSymbolsParams {
@@ -136,7 +192,8 @@ struct DefinitionResult {
 };
 
 struct ReferenceEntry {
-    std::string file;
+    std::optional<std::string> file;
+    std::optional<int> file_id;
     int line = 0;
     std::string context;
 };
@@ -147,6 +204,12 @@ struct ReferencesParams {
     std::optional<int> line;
     std::optional<std::uint64_t> symbol_id;
     std::optional<bool> include_declaration;
+
+    /// Page size; everything is returned in one reply when unset.
+    std::optional<int> limit;
+
+    /// `next_cursor` of the previous page.
+    std::optional<std::string> cursor;
 };
 
 struct ReferencesResult {
@@ -154,7 +217,14 @@ struct ReferencesResult {
     std::string kind;
     std::uint64_t symbol_id = 0;
     std::vector<ReferenceEntry> references;
+
+    /// Number of references in this reply.
     int total = 0;
+
+    /// Set when more references follow; pass it back as `cursor`.
+    std::optional<std::string> next_cursor;
+
+    std::optional<std::vector<PathEntry>> new_paths;
 };
 
 struct CallGraphEntry {
@@ -163,6 +233,9 @@ struct CallGraphEntry {
     std::string file;
     int line = 0;
     std::uint64_t symbol_id = 0;
+
+    /// Calls between it and the root: 1 for a direct caller or callee.
+    int depth = 0;
 };
 
 struct CallGraphParams {
@@ -186,6 +259,10 @@ struct TypeHierarchyEntry {
     std::string file;
     int line = 0;
     std::uint64_t symbol_id = 0;
+
+    /// Inheritance levels between it and the root: 1 for a direct base or
+    /// derived type.
+    int depth = 0;
 };
 
 struct TypeHierarchyParams {
@@ -194,6 +271,7 @@ struct TypeHierarchyParams {
     std::optional<int> line;
     std::optional<std::uint64_t> symbol_id;
     std::optional<std::string> direction;
+    std::optional<int> depth;
 };
 
 struct TypeHierarchyResult {
@@ -202,6 +280,34 @@ struct TypeHierarchyResult {
     std::vector<TypeHierarchyEntry> subtypes;
 };
 
+/// One query of a batch; exactly one member is set.
+struct BatchQuery {
+    std::optional<SymbolSearchParams> symbol_search;
+    std::optional<ReadSymbolParams> read_symbol;
+    std::optional<DefinitionParams> definition;
+    std::optional<ReferencesParams> references;
+    std::optional<CallGraphParams> call_graph;
+};
+
+/// The answer to a BatchQuery: the member matching the query, or `error`.
+struct BatchAnswer {
+    std::optional<SymbolSearchResult> symbol_search;
+    std::optional<ReadSymbolResult> read_symbol;
+    std::optional<DefinitionResult> definition;
+    std::optional<ReferencesResult> references;
+    std::optional<CallGraphResult> call_graph;
+    std::optional<std::string> error;
+};
+
+struct BatchParams {
+    std::vector<BatchQuery> queries;
+};
+
+struct BatchResult {
+    /// One answer per query, in order.
+    std::vector<BatchAnswer> answers;
+};
+
 struct StatusParams {};
 
 struct StatusResult {
@@ -217,6 +323,12 @@ struct ShutdownParams {};
 
 namespace kota::ipc::protocol {
 
+template <>
+struct RequestTraits<clice::agentic::ConfigureParams> {
+    using Result = clice::agentic::ConfigureResult;
+    constexpr inline static std::string_view method = "agentic/configure";
+};
+
 template <>
 struct RequestTraits<clice::agentic::CompileCommandParams> {
     using Result = clice::agentic::CompileCommandResult;
@@ -283,6 +395,12 @@ struct RequestTraits<clice::agentic::TypeHierarchyParams> {
     constexpr inline static std::string_view method = "agentic/typeHierarchy";
 };
 
+template <>
+struct RequestTraits<clice::agentic::BatchParams> {
+    using Result = clice::agentic::BatchResult;
+    constexpr inline static std::string_view method = "agentic/batch";
+};
+
 template <>
 struct RequestTraits<clice::agentic::StatusParams> {
     using Result = clice::agentic::StatusResult;
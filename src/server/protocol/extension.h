@@ -1,11 +1,30 @@
 #pragma once
 
+#include <cstdint>
 #include <optional>
 #include <string>
 #include <vector>
 
+#include "compile/time_trace.h"
+#include "support/cache_store.h"
+
+#include "kota/codec/json/json.h"
+#include "kota/ipc/lsp/protocol.h"
+
 namespace clice::ext {
 
+/// A batch of partial results, sent as `$/progress` for a request that
+/// carried a partialResultToken.  The final response then holds none.
+template <typename T>
+struct PartialResultParams {
+    kota::ipc::protocol::ProgressToken token;
+    std::vector<T> value;
+};
+
+/// workspace/semanticTokens/refresh: the client requests the semantic
+/// tokens of its open documents again.  The request takes no parameters.
+struct SemanticTokensRefreshParams {};
+
 struct ContextItem {
     std::string label;
     std::string description;
@@ -39,4 +58,123 @@ struct SwitchContextResult {
     bool success = false;
 };
 
+struct WorkerStatsParams {
+    /// Clear histograms and counters after reading them, so periodic
+    /// scrapes see per-interval figures.
+    bool reset = false;
+};
+
+struct LatencyStats {
+    std::uint64_t count = 0;
+    double mean_ms = 0;
+    double max_ms = 0;
+
+    /// Samples per bucket: bucket i counts those up to bucket_bounds_ms[i],
+    /// the last bucket everything slower.
+    std::vector<std::uint64_t> buckets;
+};
+
+struct WorkerStats {
+    std::string name;
+    bool stateful = false;
+    bool alive = false;
+    bool busy = false;
+    unsigned restarts = 0;
+    std::uint64_t failures = 0;
+
+    /// Time spent serving requests.
+    double busy_ms = 0;
+
+    /// Peak resident memory in bytes, 0 where the platform does not report
+    /// it.
+    std::uint64_t peak_memory = 0;
+
+    /// Stateful only: open documents and their last reported AST memory.
+    std::uint64_t documents = 0;
+    std::uint64_t ast_memory = 0;
+
+    /// Stateful only: the worker's malloc at its last compile, bytes taken
+    /// from the system and bytes in use.
+    std::uint64_t heap_reserved = 0;
+    std::uint64_t heap_in_use = 0;
+
+    LatencyStats latency;
+};
+
+struct QueueStats {
+    std::string priority;
+    std::uint64_t depth = 0;
+    LatencyStats wait;
+};
+
+struct BuildKindStats {
+    std::string kind;
+    LatencyStats latency;
+};
+
+/// What the requests of one kind used on the stateful or the stateless
+/// workers, summed over them.
+struct RequestUsageStats {
+    std::string kind;
+    bool stateful = false;
+    std::uint64_t requests = 0;
+
+    /// Allocations through operator new and the bytes they asked for; 0
+    /// unless `allocations_counted`.
+    std::uint64_t allocations = 0;
+    std::uint64_t allocated_bytes = 0;
+
+    /// CPU time of the threads serving them.
+    double cpu_ms = 0;
+};
+
+struct WorkerStatsResult {
+    std::vector<double> bucket_bounds_ms;
+    std::vector<WorkerStats> workers;
+    std::vector<QueueStats> queues;
+    std::vector<BuildKindStats> build_kinds;
+    std::vector<RequestUsageStats> request_usage;
+    /// The server is built with CLICE_ALLOCATION_ACCOUNTING.
+    bool allocations_counted = false;
+    /// Per namespace of the on-disk cache, when there is one.
+    std::vector<CacheStats> caches;
+    std::uint64_t crashes = 0;
+    std::uint64_t evictions = 0;
+    std::uint64_t migrations = 0;
+    std::uint64_t preemptions = 0;
+};
+
+/// clice/timeTrace: where the compiles profiled with project.time_trace
+/// spent their time, the last compile of each file and kind (preamble,
+/// main file, index) summed.
+struct TimeTraceParams {
+    /// Entries per list.
+    std::uint32_t limit = 50;
+    /// Forget the compiles recorded so far after reading them.
+    bool reset = false;
+};
+
+struct TimeTraceResult {
+    std::uint64_t compiles = 0;
+    /// Slowest first; `count` is the compiles an entry appears in.
+    std::vector<TimeTraceEntry> headers;
+    std::vector<TimeTraceEntry> templates;
+    std::vector<TimeTraceEntry> instantiations;
+};
+
 }  // namespace clice::ext
+
+namespace kota::ipc::protocol {
+
+template <typename T>
+struct NotificationTraits<clice::ext::PartialResultParams<T>> {
+    constexpr inline static std::string_view method = "$/progress";
+};
+
+template <>
+struct RequestTraits<clice::ext::SemanticTokensRefreshParams> {
+    using Result = kota::codec::RawValue;
+    constexpr inline static std::string_view method = "workspace/semanticTokens/refresh";
+};
+
+}  // namespace kota::ipc::protocol
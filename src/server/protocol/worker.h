@@ -6,6 +6,7 @@
 #include <utility>
 #include <vector>
 
+#include "compile/time_trace.h"
 #include "syntax/token.h"
 
 #include "kota/codec/json/json.h"
@@ -20,11 +21,14 @@ enum class QueryKind : uint8_t {
     Hover,
     GoToDefinition,
     SemanticTokens,
+    SemanticTokensRange,
     InlayHints,
     FoldingRange,
     DocumentSymbol,
-    DocumentLink,
     CodeAction,
+    CompletionResolve,
+    CodeActionResolve,
+    SignatureHelp,
 };
 
 /// Unified parameters for all stateful AST queries.
@@ -33,28 +37,136 @@ struct QueryParams {
     QueryKind kind;
     std::string path;
     uint32_t offset = 0;  ///< Byte offset for position-sensitive queries (Hover, GoToDefinition).
-    LocalSourceRange range;  ///< Byte range for range-sensitive queries (InlayHints).
+    /// Byte range for range-sensitive queries (InlayHints, SemanticTokensRange).
+    LocalSourceRange range;
+
+    /// Answer from the AST the worker already holds instead of waiting for
+    /// an in-flight compile.  `offset` and the result refer to the worker's
+    /// copy of the text at `version`; the worker fails the request when it
+    /// cannot map its AST onto that copy.  SignatureHelp is always served
+    /// this way: it fails when the call is not in the AST, for the master to
+    /// fall back to a completion parse.
+    bool stale = false;
+    int version = 0;
+
+    /// SemanticTokens: the result id the client holds, for
+    /// textDocument/semanticTokens/full/delta.  The worker answers with
+    /// edits against it when it still has that result, else in full.
+    std::string previous_result_id;
+
+    /// CompletionResolve: the item's label and the symbol hash its `data`
+    /// holds.  The worker answers with the item, detail and documentation
+    /// filled, or null when its AST does not declare the symbol.
+    /// CodeActionResolve: `label` holds the action's title and `symbol` the
+    /// diagnostic index its `data` holds.  The worker answers with the
+    /// action, edit filled, or null when the diagnostic has changed since.
+    std::string label;
+    uint64_t symbol = 0;
+};
+
+/// Several queries of one document in one message: the decorations an
+/// editor asks for together after a file switch or an edit, which would
+/// each wait for the same compile.  None of them is `stale`.  The result
+/// holds an answer per query, in order, empty for one that failed.
+struct QueryBatchParams {
+    std::string path;
+    std::vector<QueryParams> queries;
 };
 
 /// Parameters for stateful compilation (builds AST, publishes diagnostics).
 struct CompileParams {
     std::string path;
     int version;
+    /// Full document text; empty when `synced` is set.
     std::string text;
+    /// The worker already holds the text at `version` (kept current by
+    /// DocumentUpdate edits) and should compile its own copy.
+    bool synced = false;
     std::string directory;
     std::vector<std::string> arguments;
+    /// Template id of `arguments` (see server/worker/argument_cache.h).  With
+    /// `arguments_known`, the worker holds the template and `arguments` only
+    /// carry the source file and the -main-file-name value.
+    uint64_t arguments_id = 0;
+    bool arguments_known = false;
     std::pair<std::string, uint32_t> pch;
     std::unordered_map<std::string, std::string> pcms;
+    /// No dependency of the previous compile changed on disk since, so the
+    /// worker may keep serving stats and reads from that compile's cache.
+    bool deps_fresh = false;
+    /// Skip main-file function bodies that no query or edit has touched
+    /// (project.lazy_function_bodies).
+    bool skip_bodies = false;
+    /// Compute semantic tokens, document symbols, folding ranges and
+    /// document links once the compile is done, before they are asked for
+    /// (project.precompute_features).
+    bool precompute_features = false;
+    /// Run clang-tidy's fast checks (project.clang_tidy).
+    bool clang_tidy = false;
+    /// Check again only the top-level decls touched since the previous
+    /// compile and keep the earlier clang-tidy results for the rest
+    /// (project.incremental_tidy).
+    bool incremental_tidy = false;
+    /// Profile the compile with clang's time trace (project.time_trace).
+    bool time_trace = false;
+    /// Report at most this many diagnostics, notes aside; 0 for all.
+    std::uint32_t max_diagnostics = 0;
 };
 
 struct CompileResult {
     int version;
     /// Diagnostics serialized as JSON (RawValue) to avoid bincode/serde annotation conflicts.
     kota::codec::RawValue diagnostics;
-    std::size_t memory_usage;
+    /// Measured heap footprint of this document's AST in the worker, in bytes.
+    std::size_t memory_usage = 0;
+    /// The worker's malloc after the compile: bytes taken from the system
+    /// and bytes in use, 0 where unknown (see support/heap.h).  The gap is
+    /// what freed ASTs left behind.
+    std::size_t heap_reserved = 0;
+    std::size_t heap_in_use = 0;
     std::vector<std::string> deps;
+    /// `deps` is left empty: the compile saw the same files as the previous
+    /// one, whose snapshot the master can keep.
+    bool deps_unchanged = false;
     /// Serialized TUIndex for the main file (interested_only=true).
     std::string tu_index_data;
+    /// Shared segment holding tu_index_data instead, when it is large
+    /// (see support/shared_blob.h).
+    std::string tu_index_segment;
+    /// DocumentLink[] of the main-file directives the compile saw, those of
+    /// the preamble are in the PCH's links.  The master answers documentLink
+    /// requests from them without asking the worker again.
+    kota::codec::RawValue links;
+    /// A `synced` compile found the worker's copy at another version; nothing
+    /// was compiled and the master should resend the full text.
+    bool out_of_sync = false;
+    /// When `time_trace` was asked for.
+    TimeTrace time_trace;
+    /// Top-level decls of the main file, for project.large_file_decls.
+    std::uint32_t top_level_decls = 0;
+};
+
+/// Code completion on the stateful worker holding the document.  The worker
+/// completes against the stats and reads its last compile of the document
+/// cached (the PCH among them), so a completion costs little more than a
+/// reparse of the main file.
+struct CompletionParams {
+    std::string path;
+    int version;
+    /// Full document text; empty when `synced` is set.
+    std::string text;
+    /// The worker already holds the text at `version`.
+    bool synced = false;
+    uint32_t offset = 0;
+    std::string directory;
+    std::vector<std::string> arguments;
+    /// As in CompileParams.
+    uint64_t arguments_id = 0;
+    bool arguments_known = false;
+    std::pair<std::string, uint32_t> pch;
+    std::unordered_map<std::string, std::string> pcms;
+    /// As in CompileParams: the cached reads of the last compile are current.
+    bool deps_fresh = false;
 };
 
 enum class Priority : uint8_t { High, Low };
@@ -67,38 +179,97 @@ enum class BuildKind : uint8_t {
     Completion,
     SignatureHelp,
     Format,
+    OnTypeFormat,
+};
+
+/// One translation unit of a batched Index build.
+struct IndexTarget {
+    std::string file;
+    std::string directory;
+    std::vector<std::string> arguments;
+    /// As in CompileParams.
+    uint64_t arguments_id = 0;
+    bool arguments_known = false;
 };
 
 /// Unified parameters for all stateless build/compilation tasks.
 /// Fields are used selectively based on `kind`:
 ///   - All:           file, directory, arguments
 ///   - BuildPCH:      + content, preamble_bound, output_path
-///   - BuildPCM:      + module_name, pcms, output_path
-///   - Index:         + pcms
+///   - BuildPCM:      + module_name, pcms, output_path (a reduced BMI, no index)
+///   - Index:         + pcms, known_indices, known_contexts, skip_bodies_in,
+///                      batch (optional)
 ///   - Completion:    + text, version, offset, pch, pcms
 ///   - SignatureHelp: + text, version, offset, pch, pcms
-///   - Format:        + text, format_range (optional)
+///   - Format:        + text, format_range (optional), format_epoch
+///   - OnTypeFormat:  + text, offset (just after the typed character), format_epoch
 struct BuildParams {
-    // FIXME: BuildPCM dispatched via compile_graph defaults to Low, which can
-    // starve interactive dep-resolution (hover/completion) behind indexing.
-    // Consider routing module-dep builds as High when triggered by a user request.
+    /// BuildPCM from the compile graph goes out High while an interactive
+    /// request waits on the module (see CompileGraph::urgent()).
     Priority priority = Priority::Low;
     BuildKind kind;
     std::string file;
     std::string directory;
     std::vector<std::string> arguments;
+    /// As in CompileParams.
+    uint64_t arguments_id = 0;
+    bool arguments_known = false;
 
     /// Source text for Completion/SignatureHelp, preamble content for BuildPCH.
     std::string text;
     int version = 0;
     uint32_t offset = 0;
-    std::pair<std::string, uint32_t> pch;
+    std::pair<std::string, uint32_t> pch;  ///< BuildPCH: base to chain on, if any
     std::unordered_map<std::string, std::string> pcms;
 
     std::string output_path;               ///< BuildPCH, BuildPCM
     std::string module_name;               ///< BuildPCM
     uint32_t preamble_bound = UINT32_MAX;  ///< BuildPCH
     LocalSourceRange format_range;         ///< Format (default = full document)
+
+    /// Format, OnTypeFormat: generation of the clang-format style files,
+    /// bumped by the master whenever one changes.  Styles resolved in the
+    /// same generation are reused; 0 resolves them afresh, as when the
+    /// master cannot watch the directories they are looked up in.
+    uint64_t format_epoch = 0;
+
+    /// All but Format: files read are kept for the builds of the same
+    /// epoch (see server/worker/file_changes.h); 0 reads everything afresh.
+    /// `fs_changed` lists what changed since the epoch this worker was last
+    /// sent, `fs_reset` that the changes are not known and nothing it kept
+    /// is to be trusted.
+    uint64_t fs_epoch = 0;
+    std::vector<std::string> fs_changed;
+    bool fs_reset = false;
+
+    /// Index: index these TUs in one session instead of `file` alone.  Each
+    /// result is streamed back as an IndexedParams notification and the
+    /// BuildResult only reports completion; `file` names the batch for
+    /// preemption.
+    std::vector<IndexTarget> batch;
+
+    /// Index: header path → FileIndex hashes (raw SHA256) the master already
+    /// holds.  Headers whose index hashes to one of them are sent hash-only.
+    std::unordered_map<std::string, std::vector<std::string>> known_indices;
+
+    /// Index: header path → context hash → FileIndex hash (raw SHA256) the
+    /// master holds.  Headers read under a known context are not indexed.
+    std::unordered_map<std::string, std::unordered_map<std::string, std::string>> known_contexts;
+
+    /// Index: headers of `known_contexts` whose function bodies are not
+    /// parsed.  A TU reading one of them under a context the master does not
+    /// know is compiled again in full, so that its index is complete.
+    std::vector<std::string> skip_bodies_in;
+
+    /// BuildPCH, Index: profile the compiles with clang's time trace
+    /// (project.time_trace).
+    bool time_trace = false;
+
+    /// Index: sent to a remote executor (project.remote_index_executors),
+    /// whose payloads always travel inline.  The paths it reports are moved
+    /// by `path_map`, pairs of its directory prefix and the master's.
+    bool remote = false;
+    std::vector<std::pair<std::string, std::string>> path_map;
 };
 
 /// Unified result for stateless build tasks.
@@ -110,13 +281,28 @@ struct BuildResult {
     std::string output_path;  ///< PCH or PCM path
     std::vector<std::string> deps;
     std::string tu_index_data;
+    std::string tu_index_segment;       ///< Index only: shared segment replacing tu_index_data
     std::string pch_links_json;         ///< Pre-serialized DocumentLink[] from PCH
     kota::codec::RawValue result_json;  ///< Completion/SignatureHelp result
+    TimeTrace time_trace;               ///< BuildPCH, Index: when asked for
+};
+
+/// Replace `length` bytes at `offset` with `text`.
+struct TextDelta {
+    uint32_t offset = 0;
+    uint32_t length = 0;
+    std::string text;
 };
 
 struct DocumentUpdateParams {
     std::string path;
     int version;
+    /// Version of the worker's copy the edits apply to.
+    int base_version = 0;
+    /// Edits turning `base_version` into `version`, applied in order.  Empty
+    /// when the master does not know the worker's copy to be current; the
+    /// worker then drops its copy and the next Compile carries full text.
+    std::vector<TextDelta> edits;
 };
 
 struct EvictParams {
@@ -127,6 +313,47 @@ struct EvictedParams {
     std::string path;
 };
 
+/// Sent by a stateless worker for each TU of a batched Index build as soon as
+/// it is indexed.
+struct IndexedParams {
+    std::string file;
+    bool success = true;
+    std::string error;
+    std::string tu_index_data;
+    std::string tu_index_segment;
+    double elapsed_ms = 0;
+    TimeTrace time_trace;
+};
+
+/// Sent to a stateless worker to abort its in-flight build of `file`: an
+/// Index build preempted for a waiting high-priority request, or a
+/// Completion/SignatureHelp whose caller gave up on it.
+struct PreemptParams {
+    std::string file;
+};
+
+/// What a worker's requests of one kind used since the master last asked
+/// (see support/usage.h).  `kind` names a QueryKind or BuildKind, or on a
+/// stateful worker Compile, Completion or PrecomputeFeatures, the features
+/// computed ahead after a compile.
+struct KindUsage {
+    std::string kind;
+    std::uint64_t requests = 0;
+    std::uint64_t allocations = 0;
+    std::uint64_t allocated_bytes = 0;
+    std::uint64_t cpu_us = 0;
+};
+
+/// Asks a worker for its KindUsage figures, which it forgets once sent.
+struct UsageParams {};
+
+/// Sent to a worker right after it starts, when the master traces: the
+/// worker begins writing its own trace file, its clock set apart from the
+/// master's by `clock` minus its own reading on arrival.
+struct TraceParams {
+    std::int64_t clock = 0;
+};
+
 }  // namespace clice::worker
 
 namespace kota::ipc::protocol {
@@ -143,12 +370,30 @@ struct RequestTraits<clice::worker::QueryParams> {
     constexpr inline static std::string_view method = "clice/worker/query";
 };
 
+template <>
+struct RequestTraits<clice::worker::QueryBatchParams> {
+    using Result = std::vector<kota::codec::RawValue>;
+    constexpr inline static std::string_view method = "clice/worker/queryBatch";
+};
+
+template <>
+struct RequestTraits<clice::worker::CompletionParams> {
+    using Result = kota::codec::RawValue;
+    constexpr inline static std::string_view method = "clice/worker/completion";
+};
+
 template <>
 struct RequestTraits<clice::worker::BuildParams> {
     using Result = clice::worker::BuildResult;
     constexpr inline static std::string_view method = "clice/worker/build";
 };
 
+template <>
+struct RequestTraits<clice::worker::UsageParams> {
+    using Result = std::vector<clice::worker::KindUsage>;
+    constexpr inline static std::string_view method = "clice/worker/usage";
+};
+
 template <>
 struct NotificationTraits<clice::worker::DocumentUpdateParams> {
     constexpr inline static std::string_view method = "clice/worker/documentUpdate";
@@ -164,4 +409,19 @@ struct NotificationTraits<clice::worker::EvictedParams> {
     constexpr inline static std::string_view method = "clice/worker/evicted";
 };
 
+template <>
+struct NotificationTraits<clice::worker::IndexedParams> {
+    constexpr inline static std::string_view method = "clice/worker/indexed";
+};
+
+template <>
+struct NotificationTraits<clice::worker::PreemptParams> {
+    constexpr inline static std::string_view method = "clice/worker/preempt";
+};
+
+template <>
+struct NotificationTraits<clice::worker::TraceParams> {
+    constexpr inline static std::string_view method = "clice/worker/trace";
+};
+
 }  // namespace kota::ipc::protocol
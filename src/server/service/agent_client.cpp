@@ -1,7 +1,9 @@
 #include "server/service/agent_client.h"
 
 #include <algorithm>
+#include <array>
 #include <format>
+#include <limits>
 #include <ranges>
 #include <string>
 #include <vector>
@@ -9,6 +11,8 @@
 #include "server/protocol/agentic.h"
 #include "server/service/master_server.h"
 #include "support/filesystem.h"
+#include "support/fuzzy_matcher.h"
+#include "support/glob_pattern.h"
 #include "support/logging.h"
 
 #include "kota/ipc/lsp/position.h"
@@ -65,10 +69,10 @@ static std::vector<ResolvedSymbol> resolve_locator(const agentic::ReadSymbolPara
         std::vector<ResolvedSymbol> exact_matches;
         llvm::DenseSet<index::SymbolHash> seen;
 
-        auto try_symbol = [&](index::SymbolHash hash, const index::Symbol& symbol) {
-            if(symbol.name.empty())
+        auto try_symbol = [&](index::SymbolHash hash, llvm::StringRef name, SymbolKind kind) {
+            if(name.empty())
                 return;
-            if(llvm::StringRef(symbol.name).lower().find(query_lower) == std::string::npos)
+            if(name.lower().find(query_lower) == std::string::npos)
                 return;
             auto def_loc = indexer.find_definition_location(hash);
             if(!def_loc)
@@ -90,21 +94,21 @@ static std::vector<ResolvedSymbol> resolve_locator(const agentic::ReadSymbolPara
                 }
             }
 
-            bool is_exact = llvm::StringRef(symbol.name).lower() == query_lower ||
-                            llvm::StringRef(symbol.name).ends_with("::" + *loc.name);
+            bool is_exact = name.lower() == query_lower || name.ends_with("::" + *loc.name);
 
-            ResolvedSymbol rs{hash, symbol.name, symbol.kind, std::move(file), line_num};
+            ResolvedSymbol rs{hash, name.str(), kind, std::move(file), line_num};
             if(is_exact)
                 exact_matches.push_back(std::move(rs));
             else
                 candidates.push_back(std::move(rs));
         };
 
-        for(auto& [hash, symbol]: workspace.project_index.symbols)
-            try_symbol(hash, symbol);
+        auto& project = workspace.project_index;
+        for(auto& [hash, symbol]: project.symbols)
+            try_symbol(hash, project.name_of(symbol), symbol.kind);
         indexer.foreach_session([&](std::uint32_t, const Session& session) -> bool {
             for(auto& [hash, symbol]: *session.symbols)
-                try_symbol(hash, symbol);
+                try_symbol(hash, symbol.name, symbol.kind);
             return true;
         });
 
@@ -117,17 +121,19 @@ static std::vector<ResolvedSymbol> resolve_locator(const agentic::ReadSymbolPara
         auto path_str = *loc.path;
         auto target_line = static_cast<protocol::uinteger>(*loc.line - 1);
 
-        auto pool_it = workspace.path_pool.cache.find(path_str);
-        auto server_id = pool_it != workspace.path_pool.cache.end() ? pool_it->second : ~0u;
+        auto server_id = workspace.path_pool.find(path_str).value_or(~0u);
         if(server_id != ~0u) {
             std::vector<ResolvedSymbol> session_result;
             indexer.with_session(server_id, [&](const Session& session) {
                 auto map = session.line_map();
                 for(auto& [hash, rels]: session.file_index->relations) {
-                    for(auto& rel: rels) {
-                        if(rel.kind.value() != RelationKind::Definition)
+                    for(auto& relation: rels) {
+                        if(relation.kind.value() != RelationKind::Definition)
                             continue;
-                        auto start = map.to_position(rel.range.begin);
+                        auto rel = Indexer::move_overlay(session, relation);
+                        if(!rel)
+                            continue;
+                        auto start = map.to_position(rel->range.begin);
                         if(start && start->line == target_line) {
                             std::string name;
                             SymbolKind kind;
@@ -158,7 +164,10 @@ static std::vector<ResolvedSymbol> resolve_locator(const agentic::ReadSymbolPara
         auto ls = merged_index.line_starts();
         if(ls.empty())
             return {};
-        lsp::LineMap map(merged_index.content(), ls);
+        auto content = indexer.shard_content(proj_id, merged_index);
+        if(!content)
+            return {};
+        lsp::LineMap map(*content, ls);
 
         for(auto& [hash, symbol]: workspace.project_index.symbols) {
             if(!symbol.reference_files.contains(proj_id))
@@ -175,7 +184,8 @@ static std::vector<ResolvedSymbol> resolve_locator(const agentic::ReadSymbolPara
             });
             if(found)
                 return {
-                    {hash, symbol.name, symbol.kind, path_str, *loc.line}
+                    {hash, workspace.project_index.name_of(symbol).str(), symbol.kind, path_str,
+                     *loc.line}
                 };
         }
 
@@ -185,6 +195,22 @@ static std::vector<ResolvedSymbol> resolve_locator(const agentic::ReadSymbolPara
     return {};
 }
 
+/// Run `handler` on the query `params` of a batch, if set, into `slot`.
+template <typename Handler, typename Params, typename Result>
+static kota::task<> answer_query(Handler& handler,
+                                 RequestContext& context,
+                                 const std::optional<Params>& params,
+                                 std::optional<Result>& slot,
+                                 std::optional<std::string>& error) {
+    if(!params)
+        co_return;
+    auto result = co_await handler(context, *params);
+    if(result.has_value())
+        slot = std::move(result.value());
+    else
+        error = std::move(result.error().message);
+}
+
 static std::uint64_t extract_symbol_id(const std::optional<protocol::LSPAny>& data) {
     if(!data.has_value())
         return 0;
@@ -194,11 +220,103 @@ static std::uint64_t extract_symbol_id(const std::optional<protocol::LSPAny>& da
     return 0;
 }
 
+void PathDictionary::compact(std::optional<std::string>& path,
+                             std::optional<int>& id,
+                             std::optional<std::vector<agentic::PathEntry>>& added) {
+    if(!enabled || !path)
+        return;
+    auto [it, inserted] = ids.try_emplace(*path, static_cast<int>(ids.size()));
+    if(inserted) {
+        if(!added)
+            added.emplace();
+        added->push_back({.id = it->second, .path = std::move(*path)});
+    }
+    id = it->second;
+    path.reset();
+}
+
+static bool is_header(llvm::StringRef path) {
+    auto ext = llvm::sys::path::extension(path);
+    return ext == ".h" || ext == ".hpp" || ext == ".hxx" || ext == ".hh";
+}
+
+const std::vector<ProjectFileIndex::Entry>& ProjectFileIndex::get(Workspace& workspace) {
+    auto cdb = workspace.cdb.get_entries();
+    if(!built || cdb_entries != cdb.data() || cdb_size != cdb.size() ||
+       shards != workspace.merged_indices.size() || modules != workspace.path_to_module.size()) {
+        build(workspace);
+    }
+    return entries;
+}
+
+void ProjectFileIndex::build(Workspace& ws) {
+    auto cdb = ws.cdb.get_entries();
+    built = true;
+    cdb_entries = cdb.data();
+    cdb_size = cdb.size();
+    shards = ws.merged_indices.size();
+    modules = ws.path_to_module.size();
+
+    entries.clear();
+    llvm::DenseSet<std::uint32_t> seen;
+    auto add = [&](llvm::StringRef path, llvm::StringRef kind, std::string module_name) {
+        auto dir_size = llvm::sys::path::parent_path(path).size();
+        entries.push_back({
+            .path = path.str(),
+            .dir_size = static_cast<std::uint32_t>(dir_size == 0 ? 0 : dir_size + 1),
+            .kind = kind,
+            .module_name = std::move(module_name),
+        });
+    };
+
+    for(auto& entry: cdb) {
+        auto file_path = ws.cdb.resolve_path(entry.file);
+        if(file_path.empty())
+            continue;
+
+        auto proj_it = ws.project_index.path_pool.find(file_path);
+        if(proj_it != ws.project_index.path_pool.cache.end()) {
+            if(!seen.insert(proj_it->second).second)
+                continue;
+        }
+
+        auto mod_it = ws.path_to_module.find(ws.path_pool.intern(file_path));
+        if(mod_it != ws.path_to_module.end()) {
+            add(file_path, "module", mod_it->second);
+        } else {
+            add(file_path, is_header(file_path) ? "header" : "source", {});
+        }
+    }
+
+    // Headers are not in the database; those the index has seen are listed.
+    for(auto& [path_id, shard]: ws.merged_indices) {
+        if(seen.contains(path_id))
+            continue;
+        auto path_str = ws.project_index.path_pool.path(path_id);
+        if(is_header(path_str)) {
+            seen.insert(path_id);
+            add(path_str, "header", {});
+        }
+    }
+
+    std::ranges::sort(entries, [](const Entry& lhs, const Entry& rhs) {
+        return std::pair(lhs.dir(), lhs.name()) < std::pair(rhs.dir(), rhs.name());
+    });
+}
+
 AgentClient::AgentClient(MasterServer& server, kota::ipc::JsonPeer& peer) :
     server(server), peer(peer) {
     using namespace agentic;
 
     auto& srv = this->server;
+    auto& paths = this->paths;
+
+    peer.on_request([&paths](RequestContext&,
+                             const ConfigureParams& params) -> RequestResult<ConfigureParams> {
+        if(params.compact_paths)
+            paths.enabled = *params.compact_paths;
+        co_return ConfigureResult{.compact_paths = paths.enabled};
+    });
 
     peer.on_request(
         [&srv](RequestContext&,
@@ -217,75 +335,147 @@ AgentClient::AgentClient(MasterServer& server, kota::ipc::JsonPeer& peer) :
             };
         });
 
-    peer.on_request([&srv](RequestContext&,
-                           const ProjectFilesParams& params) -> RequestResult<ProjectFilesParams> {
-        auto& ws = srv.workspace;
+    auto& files = this->files;
+    peer.on_request([&srv, &paths, &files](RequestContext&, const ProjectFilesParams& params)
+                        -> RequestResult<ProjectFilesParams> {
+        using Entry = ProjectFileIndex::Entry;
+        auto& entries = files.get(srv.workspace);
         auto filter = params.filter.value_or("all");
 
-        ProjectFilesResult result;
-        llvm::DenseSet<std::uint32_t> seen;
+        bool with_kind = !params.fields;
+        bool with_module = !params.fields;
+        for(auto& field: params.fields.value_or(std::vector<std::string>{})) {
+            if(field == "kind") {
+                with_kind = true;
+            } else if(field == "module_name") {
+                with_module = true;
+            } else {
+                co_return kota::outcome_error(
+                    kota::ipc::Error{std::format("unknown field '{}'", field)});
+            }
+        }
 
-        for(auto& entry: ws.cdb.get_entries()) {
-            auto file_path = ws.cdb.resolve_path(entry.file);
-            if(file_path.empty())
-                continue;
+        // Paths matching a glob start with its literal prefix, so only the
+        // directories starting with that prefix up to its last slash are
+        // looked at.
+        std::optional<GlobPattern> glob;
+        auto first = entries.begin();
+        auto last = entries.end();
+        if(params.glob) {
+            auto pattern = GlobPattern::create(*params.glob);
+            if(!pattern) {
+                co_return kota::outcome_error(
+                    kota::ipc::Error{std::format("invalid glob: {}", pattern.error())});
+            }
+            glob = std::move(*pattern);
+            glob->compile();
+
+            auto literal = glob->literal_prefix();
+            auto dir = literal.take_front(literal.rfind('/') + 1);
+            if(!dir.empty()) {
+                first = std::ranges::lower_bound(entries, dir, {}, &Entry::dir);
+                last = std::find_if(first, entries.end(), [&](const Entry& entry) {
+                    return !entry.dir().starts_with(dir);
+                });
+            }
+        }
+
+        auto matches = [&](const Entry& entry) {
+            return (filter == "all" || filter == entry.kind) && (!glob || glob->match(entry.path));
+        };
 
-            auto proj_it = ws.project_index.path_pool.find(file_path);
-            if(proj_it != ws.project_index.path_pool.cache.end()) {
-                if(!seen.insert(proj_it->second).second)
+        // Fuzzy queries rank by score, so their cursor is a position in the
+        // ranking ("#N"); otherwise it is the last path returned.
+        std::vector<std::uint32_t> order;
+        std::size_t skip = 0;
+        if(params.query && !params.query->empty()) {
+            FuzzyMatcher matcher(*params.query);
+            std::vector<std::pair<float, std::uint32_t>> scored;
+            for(auto it = first; it != last; ++it) {
+                if(!matches(*it)) {
                     continue;
+                }
+                // The matcher keeps the front of long words; the file name
+                // is at the back.
+                if(auto score = matcher.match(llvm::StringRef(it->path).take_back(127))) {
+                    scored.emplace_back(-*score, static_cast<std::uint32_t>(it - entries.begin()));
+                }
             }
-
-            std::string kind_str;
-            auto mod_it = ws.path_to_module.find(ws.path_pool.intern(file_path));
-            if(mod_it != ws.path_to_module.end()) {
-                kind_str = "module";
-            } else {
-                auto ext = llvm::sys::path::extension(file_path);
-                if(ext == ".h" || ext == ".hpp" || ext == ".hxx" || ext == ".hh")
-                    kind_str = "header";
-                else
-                    kind_str = "source";
+            std::ranges::sort(scored);
+            for(auto& [_, index]: scored) {
+                order.push_back(index);
+            }
+            if(params.cursor) {
+                llvm::StringRef text(*params.cursor);
+                if(!text.consume_front("#") || text.getAsInteger(10, skip)) {
+                    co_return kota::outcome_error(kota::ipc::Error{"invalid cursor"});
+                }
+            }
+        } else {
+            auto begin = first;
+            if(params.cursor) {
+                auto dir_size = llvm::sys::path::parent_path(*params.cursor).size();
+                if(dir_size == 0 || dir_size >= params.cursor->size()) {
+                    co_return kota::outcome_error(kota::ipc::Error{"invalid cursor"});
+                }
+                Entry after{.path = *params.cursor,
+                            .dir_size = static_cast<std::uint32_t>(dir_size + 1)};
+                auto key = [](const Entry& entry) {
+                    return std::pair(entry.dir(), entry.name());
+                };
+                begin = std::upper_bound(first, last, after, [&](const Entry& l, const Entry& r) {
+                    return key(l) < key(r);
+                });
             }
+            for(auto it = first; it != last; ++it) {
+                if(matches(*it)) {
+                    order.push_back(static_cast<std::uint32_t>(it - entries.begin()));
+                    if(it < begin) {
+                        skip += 1;
+                    }
+                }
+            }
+        }
 
-            if(filter != "all" && filter != kind_str)
-                continue;
+        auto limit = params.limit ? static_cast<std::size_t>(std::max(*params.limit, 1))
+                                  : std::numeric_limits<std::size_t>::max();
 
-            FileInfo fi;
-            fi.path = file_path.str();
-            fi.kind = std::move(kind_str);
-            if(mod_it != ws.path_to_module.end())
-                fi.module_name = mod_it->second;
-            result.files.push_back(std::move(fi));
+        ProjectFilesResult result;
+        result.matched = static_cast<int>(order.size());
+        for(auto i = skip; i < order.size() && result.files.size() < limit; ++i) {
+            auto& entry = entries[order[i]];
+            FileInfo info;
+            info.path = entry.path;
+            if(with_kind) {
+                info.kind = entry.kind.str();
+            }
+            if(with_module && !entry.module_name.empty()) {
+                info.module_name = entry.module_name;
+            }
+            result.files.push_back(std::move(info));
         }
 
-        if(filter == "all" || filter == "header") {
-            for(auto& [path_id, shard]: ws.merged_indices) {
-                if(seen.contains(path_id))
-                    continue;
-                auto path_str = ws.project_index.path_pool.path(path_id);
-                auto ext = llvm::sys::path::extension(path_str);
-                if(ext == ".h" || ext == ".hpp" || ext == ".hxx" || ext == ".hh") {
-                    seen.insert(path_id);
-                    result.files.push_back(FileInfo{
-                        .path = path_str.str(),
-                        .kind = "header",
-                    });
-                }
-            }
+        auto next = skip + result.files.size();
+        if(next < order.size()) {
+            result.next_cursor = params.query && !params.query->empty()
+                                     ? std::format("#{}", next)
+                                     : entries[order[next - 1]].path;
         }
 
         result.total = static_cast<int>(result.files.size());
+        for(auto& file: result.files) {
+            paths.compact(file.path, file.path_id, result.new_paths);
+        }
         co_return result;
     });
 
     peer.on_request(
         [&srv](RequestContext&, const FileDepsParams& params) -> RequestResult<FileDepsParams> {
             auto& ws = srv.workspace;
-            auto pool_it = ws.path_pool.cache.find(params.path);
-            if(pool_it == ws.path_pool.cache.end())
+            auto found = ws.path_pool.find(params.path);
+            if(!found)
                 co_return FileDepsResult{.file = params.path};
-            auto path_id = pool_it->second;
+            auto path_id = *found;
             auto direction = params.direction.value_or("both");
             auto max_depth = params.depth.value_or(1);
 
@@ -336,18 +526,17 @@ AgentClient::AgentClient(MasterServer& server, kota::ipc::JsonPeer& peer) :
                     llvm::DenseSet<std::uint32_t> visited;
                     visited.insert(path_id);
                     for(auto& dep: result.includers) {
-                        auto it = ws.path_pool.cache.find(dep.path);
-                        if(it != ws.path_pool.cache.end())
-                            visited.insert(it->second);
+                        if(auto dep_id = ws.path_pool.find(dep.path))
+                            visited.insert(*dep_id);
                     }
 
                     for(std::size_t i = 0; i < result.includers.size(); ++i) {
                         if(max_depth > 0 && result.includers[i].depth >= max_depth)
                             continue;
-                        auto dep_it = ws.path_pool.cache.find(result.includers[i].path);
-                        if(dep_it == ws.path_pool.cache.end())
+                        auto dep_id = ws.path_pool.find(result.includers[i].path);
+                        if(!dep_id)
                             continue;
-                        auto sub = ws.dep_graph.get_includers(dep_it->second);
+                        auto sub = ws.dep_graph.get_includers(*dep_id);
                         for(auto sub_id: sub) {
                             if(!visited.insert(sub_id).second)
                                 continue;
@@ -368,10 +557,10 @@ AgentClient::AgentClient(MasterServer& server, kota::ipc::JsonPeer& peer) :
         [&srv](RequestContext&,
                const ImpactAnalysisParams& params) -> RequestResult<ImpactAnalysisParams> {
             auto& ws = srv.workspace;
-            auto pool_it = ws.path_pool.cache.find(params.path);
-            if(pool_it == ws.path_pool.cache.end())
+            auto found = ws.path_pool.find(params.path);
+            if(!found)
                 co_return ImpactAnalysisResult{};
-            auto path_id = pool_it->second;
+            auto path_id = *found;
 
             ImpactAnalysisResult result;
 
@@ -380,46 +569,69 @@ AgentClient::AgentClient(MasterServer& server, kota::ipc::JsonPeer& peer) :
                 result.direct_dependents.push_back(ws.path_pool.resolve(inc_id).str());
             }
 
-            auto hosts = ws.dep_graph.find_host_sources(path_id);
-            llvm::DenseSet<std::uint32_t> seen;
-            seen.insert(path_id);
-            for(auto inc_id: direct_includers)
-                seen.insert(inc_id);
-            for(auto host_id: hosts) {
-                if(seen.insert(host_id).second)
-                    result.transitive_dependents.push_back(ws.path_pool.resolve(host_id).str());
+            // The host set is memoized by the graph; only the units importing
+            // an affected module are walked here, through the module DAG.
+            Bitmap affected = ws.dep_graph.host_set(path_id);
+            auto modules = ws.dep_graph.dependents(path_id);
+            llvm::SmallVector<std::uint32_t> worklist;
+            for(auto id: modules) {
+                if(ws.path_to_module.contains(id))
+                    worklist.push_back(id);
+            }
+            if(ws.compile_graph) {
+                while(!worklist.empty()) {
+                    for(auto importer: ws.compile_graph->dependents(worklist.pop_back_val())) {
+                        if(!affected.addChecked(importer))
+                            continue;
+                        if(ws.path_to_module.contains(importer) && modules.addChecked(importer))
+                            worklist.push_back(importer);
+                    }
+                }
             }
 
-            for(auto host_id: hosts) {
-                auto it = ws.path_to_module.find(host_id);
+            for(auto id: modules) {
+                auto it = ws.path_to_module.find(id);
                 if(it != ws.path_to_module.end())
                     result.affected_modules.push_back(it->second);
             }
-            auto mod_it = ws.path_to_module.find(path_id);
-            if(mod_it != ws.path_to_module.end())
-                result.affected_modules.push_back(mod_it->second);
+
+            affected.remove(path_id);
+            for(auto inc_id: direct_includers)
+                affected.remove(inc_id);
+            result.transitive_count = static_cast<int>(affected.cardinality());
+
+            constexpr int unlimited = std::numeric_limits<int>::max();
+            auto offset = static_cast<std::uint64_t>(std::max(params.offset.value_or(0), 0));
+            auto limit = static_cast<std::uint64_t>(std::max(params.limit.value_or(unlimited), 0));
+            std::uint64_t index = 0;
+            for(auto id: affected) {
+                if(index++ < offset)
+                    continue;
+                if(result.transitive_dependents.size() >= limit)
+                    break;
+                result.transitive_dependents.push_back(ws.path_pool.resolve(id).str());
+            }
 
             co_return result;
         });
 
-    peer.on_request([&srv](RequestContext&,
-                           const SymbolSearchParams& params) -> RequestResult<SymbolSearchParams> {
+    auto symbol_search = [&srv](RequestContext&, const SymbolSearchParams& params)
+        -> RequestResult<SymbolSearchParams> {
         auto max = params.max_results.value_or(100);
         std::string query_lower = llvm::StringRef(params.query).lower();
 
         SymbolSearchResult result;
         llvm::DenseSet<index::SymbolHash> seen;
 
-        auto try_symbol = [&](index::SymbolHash hash, const index::Symbol& symbol) {
+        auto try_symbol = [&](index::SymbolHash hash, llvm::StringRef name, SymbolKind kind) {
             if(static_cast<int>(result.symbols.size()) >= max)
                 return;
-            if(symbol.name.empty())
+            if(name.empty())
                 return;
-            if(!query_lower.empty() &&
-               llvm::StringRef(symbol.name).lower().find(query_lower) == std::string::npos)
+            if(!query_lower.empty() && name.lower().find(query_lower) == std::string::npos)
                 return;
             if(params.kind_filter.has_value()) {
-                auto kind_name = std::string(symbol_kind_name(symbol.kind));
+                auto kind_name = std::string(symbol_kind_name(kind));
                 auto& filter = *params.kind_filter;
                 if(std::ranges::find(filter, kind_name) == filter.end())
                     return;
@@ -431,51 +643,57 @@ AgentClient::AgentClient(MasterServer& server, kota::ipc::JsonPeer& peer) :
                 return;
             auto file = uri_to_path(def_loc->uri);
             result.symbols.push_back(SymbolEntry{
-                .name = symbol.name,
-                .kind = std::string(symbol_kind_name(symbol.kind)),
+                .name = name.str(),
+                .kind = std::string(symbol_kind_name(kind)),
                 .file = std::move(file),
                 .line = static_cast<int>(def_loc->range.start.line) + 1,
                 .symbol_id = hash,
             });
         };
 
-        for(auto& [hash, symbol]: srv.workspace.project_index.symbols)
-            try_symbol(hash, symbol);
+        auto& project = srv.workspace.project_index;
+        for(auto& [hash, symbol]: project.symbols)
+            try_symbol(hash, project.name_of(symbol), symbol.kind);
         srv.indexer.foreach_session([&](std::uint32_t, const Session& session) -> bool {
             for(auto& [hash, symbol]: *session.symbols)
-                try_symbol(hash, symbol);
+                try_symbol(hash, symbol.name, symbol.kind);
             return true;
         });
 
         co_return result;
-    });
-
-    peer.on_request(
-        [&srv](RequestContext&, const ReadSymbolParams& params) -> RequestResult<ReadSymbolParams> {
-            auto candidates = resolve_locator(params, srv.workspace, srv.indexer);
-            if(candidates.empty())
-                co_return kota::outcome_error(kota::ipc::Error{"symbol not found"});
-            if(candidates.size() > 1) {
-                co_return kota::outcome_error(kota::ipc::Error{
-                    std::format("ambiguous: {} candidates, use symbolId to disambiguate",
-                                candidates.size())});
-            }
-
-            auto& rs = candidates[0];
-            auto def_text = srv.indexer.get_definition_text(rs.hash);
-            if(!def_text)
-                co_return kota::outcome_error(kota::ipc::Error{"definition not found"});
+    };
+    peer.on_request(symbol_search);
+
+    auto read_symbol = [&srv](RequestContext&,
+                              const ReadSymbolParams& params) -> RequestResult<ReadSymbolParams> {
+        auto candidates = resolve_locator(params, srv.workspace, srv.indexer);
+        if(candidates.empty())
+            co_return kota::outcome_error(kota::ipc::Error{"symbol not found"});
+        if(candidates.size() > 1) {
+            co_return kota::outcome_error(kota::ipc::Error{
+                std::format("ambiguous: {} candidates, use symbolId to disambiguate",
+                            candidates.size())});
+        }
 
-            co_return ReadSymbolResult{
-                .name = rs.name,
-                .kind = std::string(symbol_kind_name(rs.kind)),
-                .file = std::move(def_text->file),
-                .start_line = def_text->start_line,
-                .end_line = def_text->end_line,
-                .text = std::move(def_text->text),
-                .symbol_id = rs.hash,
-            };
-        });
+        auto& rs = candidates[0];
+        auto def_text = srv.indexer.get_definition_text(rs.hash, rs.file);
+        if(!def_text)
+            co_return kota::outcome_error(kota::ipc::Error{"definition not found"});
+
+        ReadSymbolResult result{
+            .name = rs.name,
+            .kind = std::string(symbol_kind_name(rs.kind)),
+            .file = std::move(def_text->file),
+            .start_line = def_text->start_line,
+            .end_line = def_text->end_line,
+            .text = std::move(def_text->text),
+            .symbol_id = rs.hash,
+        };
+        if(auto doc = srv.indexer.documentation(rs.hash, rs.file); !doc.empty())
+            result.documentation = std::move(doc);
+        co_return result;
+    };
+    peer.on_request(read_symbol);
 
     peer.on_request(
         [&srv](RequestContext&,
@@ -493,223 +711,323 @@ AgentClient::AgentClient(MasterServer& server, kota::ipc::JsonPeer& peer) :
 
             DocumentSymbolsResult result;
 
-            auto pool_it = srv.workspace.path_pool.cache.find(params.path);
-            if(pool_it == srv.workspace.path_pool.cache.end())
+            // The document-level definitions, each with the innermost one
+            // listed that contains it as parent.
+            auto add_outline = [&](const std::vector<index::OutlineEntry>& outline,
+                                   const lsp::LineMap& map) {
+                std::vector<std::uint64_t> listed(outline.size(), 0);
+                for(std::size_t i = 0; i < outline.size(); ++i) {
+                    auto& entry = outline[i];
+                    std::string name;
+                    SymbolKind kind;
+                    if(!srv.indexer.find_symbol_info(entry.symbol, name, kind))
+                        continue;
+                    if(!is_document_level(kind))
+                        continue;
+                    auto range = map.to_range(entry.range.begin, entry.range.end);
+                    if(!range)
+                        continue;
+                    std::uint64_t parent = 0;
+                    for(auto p = entry.parent; p != index::OutlineEntry::no_parent && parent == 0;
+                        p = outline[p].parent) {
+                        parent = listed[p];
+                    }
+                    listed[i] = entry.symbol;
+                    result.symbols.push_back(DocumentSymbolEntry{
+                        .name = std::move(name),
+                        .kind = std::string(symbol_kind_name(kind)),
+                        .start_line = static_cast<int>(range->start.line) + 1,
+                        .end_line = static_cast<int>(range->end.line) + 1,
+                        .symbol_id = entry.symbol,
+                        .parent_id = parent,
+                    });
+                }
+            };
+
+            auto found = srv.workspace.path_pool.find(params.path);
+            if(!found)
                 co_return result;
-            auto server_id = pool_it->second;
+            auto server_id = *found;
             bool found_session = false;
             srv.indexer.with_session(server_id, [&](const Session& session) {
                 found_session = true;
+                std::vector<index::OutlineEntry> outline;
                 for(auto& [hash, rels]: session.file_index->relations) {
-                    for(auto& rel: rels) {
-                        if(rel.kind.value() != RelationKind::Definition)
-                            continue;
-                        std::string name;
-                        SymbolKind kind;
-                        if(!srv.indexer.find_symbol_info(hash, name, kind))
+                    for(auto& relation: rels) {
+                        if(relation.kind.value() != RelationKind::Definition)
                             continue;
-                        if(!is_document_level(kind))
+                        auto rel = Indexer::move_overlay(session, relation);
+                        if(!rel)
                             continue;
-                        auto range = session.line_map().to_range(rel.range.begin, rel.range.end);
-                        if(range) {
-                            result.symbols.push_back(DocumentSymbolEntry{
-                                .name = std::move(name),
-                                .kind = std::string(symbol_kind_name(kind)),
-                                .start_line = static_cast<int>(range->start.line) + 1,
-                                .end_line = static_cast<int>(range->end.line) + 1,
-                                .symbol_id = hash,
-                            });
-                            break;
-                        }
+                        auto range = rel->definition_range();
+                        if(range.begin >= range.end)
+                            range = rel->range;
+                        outline.push_back(
+                            {.symbol = hash, .range = range, .selection = rel->range});
                     }
                 }
+                index::arrange_outline(outline);
+                add_outline(outline, session.line_map());
             });
             if(found_session)
                 co_return result;
 
+            // A closed file is answered from the outline its shard stores.
             auto it = srv.workspace.project_index.path_pool.find(params.path);
             if(it == srv.workspace.project_index.path_pool.cache.end())
                 co_return result;
 
-            auto proj_id = it->second;
-            auto shard_it = srv.workspace.merged_indices.find(proj_id);
+            auto shard_it = srv.workspace.merged_indices.find(it->second);
             if(shard_it == srv.workspace.merged_indices.end())
                 co_return result;
 
             auto& merged_index = shard_it->second;
             auto ls = merged_index.line_starts();
-            if(ls.empty())
+            auto content = srv.indexer.shard_content(it->second, merged_index);
+            if(ls.empty() || !content)
                 co_return result;
-            lsp::LineMap map(merged_index.content(), ls);
-
-            for(auto& [hash, symbol]: srv.workspace.project_index.symbols) {
-                if(symbol.name.empty())
-                    continue;
-                if(!is_document_level(symbol.kind))
-                    continue;
-                if(!symbol.reference_files.contains(proj_id))
-                    continue;
-
-                merged_index.lookup(hash, RelationKind::Definition, [&](const index::Relation& r) {
-                    // FIXME: unchecked optional dereference
-                    auto range = map.to_range(r.range.begin, r.range.end);
-                    if(range) {
-                        result.symbols.push_back(DocumentSymbolEntry{
-                            .name = symbol.name,
-                            .kind = std::string(symbol_kind_name(symbol.kind)),
-                            .start_line = static_cast<int>(range->start.line) + 1,
-                            .end_line = static_cast<int>(range->end.line) + 1,
-                            .symbol_id = hash,
-                        });
-                    }
-                    return true;
-                });
-            }
+            add_outline(merged_index.outline(), lsp::LineMap(*content, ls));
 
             co_return result;
         });
 
-    peer.on_request(
-        [&srv](RequestContext&, const DefinitionParams& params) -> RequestResult<DefinitionParams> {
-            auto candidates = resolve_locator(
-                ReadSymbolParams{params.name, params.path, params.line, params.symbol_id},
-                srv.workspace,
-                srv.indexer);
-            if(candidates.empty())
-                co_return kota::outcome_error(kota::ipc::Error{"symbol not found"});
-            if(candidates.size() > 1) {
-                co_return kota::outcome_error(kota::ipc::Error{
-                    std::format("ambiguous: {} candidates, use symbolId to disambiguate",
-                                candidates.size())});
-            }
-
-            auto& rs = candidates[0];
-
-            DefinitionResult result;
-            result.name = rs.name;
-            result.kind = std::string(symbol_kind_name(rs.kind));
-            result.symbol_id = rs.hash;
-
-            if(auto def_text = srv.indexer.get_definition_text(rs.hash)) {
-                result.definition = LocationEntry{
-                    .file = std::move(def_text->file),
-                    .start_line = def_text->start_line,
-                    .end_line = def_text->end_line,
-                    .text = std::move(def_text->text),
-                };
-            }
+    auto definition = [&srv](RequestContext&,
+                             const DefinitionParams& params) -> RequestResult<DefinitionParams> {
+        auto candidates = resolve_locator(
+            ReadSymbolParams{params.name, params.path, params.line, params.symbol_id},
+            srv.workspace,
+            srv.indexer);
+        if(candidates.empty())
+            co_return kota::outcome_error(kota::ipc::Error{"symbol not found"});
+        if(candidates.size() > 1) {
+            co_return kota::outcome_error(kota::ipc::Error{
+                std::format("ambiguous: {} candidates, use symbolId to disambiguate",
+                            candidates.size())});
+        }
 
-            co_return result;
-        });
+        auto& rs = candidates[0];
 
-    peer.on_request(
-        [&srv](RequestContext&, const ReferencesParams& params) -> RequestResult<ReferencesParams> {
-            auto candidates = resolve_locator(
-                ReadSymbolParams{params.name, params.path, params.line, params.symbol_id},
-                srv.workspace,
-                srv.indexer);
-            if(candidates.empty())
-                co_return kota::outcome_error(kota::ipc::Error{"symbol not found"});
-            if(candidates.size() > 1) {
-                co_return kota::outcome_error(kota::ipc::Error{
-                    std::format("ambiguous: {} candidates, use symbolId to disambiguate",
-                                candidates.size())});
-            }
+        DefinitionResult result;
+        result.name = rs.name;
+        result.kind = std::string(symbol_kind_name(rs.kind));
+        result.symbol_id = rs.hash;
 
-            auto& rs = candidates[0];
+        if(auto def_text = srv.indexer.get_definition_text(rs.hash)) {
+            result.definition = LocationEntry{
+                .file = std::move(def_text->file),
+                .start_line = def_text->start_line,
+                .end_line = def_text->end_line,
+                .text = std::move(def_text->text),
+            };
+        }
 
-            ReferencesResult result;
-            result.name = rs.name;
-            result.kind = std::string(symbol_kind_name(rs.kind));
-            result.symbol_id = rs.hash;
+        co_return result;
+    };
+    peer.on_request(definition);
+
+    auto references = [&srv, &paths](RequestContext&, const ReferencesParams& params)
+        -> RequestResult<ReferencesParams> {
+        auto candidates = resolve_locator(
+            ReadSymbolParams{params.name, params.path, params.line, params.symbol_id},
+            srv.workspace,
+            srv.indexer);
+        if(candidates.empty())
+            co_return kota::outcome_error(kota::ipc::Error{"symbol not found"});
+        if(candidates.size() > 1) {
+            co_return kota::outcome_error(kota::ipc::Error{
+                std::format("ambiguous: {} candidates, use symbolId to disambiguate",
+                            candidates.size())});
+        }
 
-            for(auto& ref: srv.indexer.collect_references(rs.hash, RelationKind::Reference)) {
-                result.references.push_back(ReferenceEntry{
-                    .file = std::move(ref.file),
-                    .line = ref.line,
-                    .context = std::move(ref.context),
-                });
+        auto& rs = candidates[0];
+
+        // References come first, then definitions; a cursor records the
+        // phase and the position within it as "phase.files.path_id.skip".
+        std::array phases = {RelationKind(RelationKind::Reference),
+                             RelationKind(RelationKind::Definition)};
+        std::size_t phase_count = params.include_declaration.value_or(false) ? 2 : 1;
+        std::size_t phase = 0;
+        Indexer::RelationCursor cursor;
+        if(params.cursor) {
+            llvm::SmallVector<llvm::StringRef, 4> fields;
+            llvm::StringRef(*params.cursor).split(fields, '.');
+            std::uint32_t files = 0;
+            if(fields.size() != 4 || fields[0].getAsInteger(10, phase) ||
+               fields[1].getAsInteger(10, files) || fields[2].getAsInteger(10, cursor.path_id) ||
+               fields[3].getAsInteger(10, cursor.skip) || phase >= phase_count ||
+               files > Indexer::RelationCursor::Indexed) {
+                co_return kota::outcome_error(kota::ipc::Error{"invalid cursor"});
             }
-            if(params.include_declaration.value_or(false)) {
-                for(auto& ref: srv.indexer.collect_references(rs.hash, RelationKind::Definition)) {
-                    result.references.push_back(ReferenceEntry{
-                        .file = std::move(ref.file),
-                        .line = ref.line,
-                        .context = std::move(ref.context),
-                    });
-                }
-            }
-
-            result.total = static_cast<int>(result.references.size());
-            co_return result;
-        });
-
-    peer.on_request(
-        [&srv](RequestContext&, const CallGraphParams& params) -> RequestResult<CallGraphParams> {
-            auto candidates = resolve_locator(
-                ReadSymbolParams{params.name, params.path, params.line, params.symbol_id},
-                srv.workspace,
-                srv.indexer);
-            if(candidates.empty())
-                co_return kota::outcome_error(kota::ipc::Error{"symbol not found"});
-            if(candidates.size() > 1) {
-                co_return kota::outcome_error(kota::ipc::Error{
-                    std::format("ambiguous: {} candidates, use symbolId to disambiguate",
-                                candidates.size())});
+            cursor.phase = static_cast<Indexer::RelationCursor::Phase>(files);
+        }
+        auto limit = params.limit ? static_cast<std::size_t>(std::max(*params.limit, 1))
+                                  : std::numeric_limits<std::size_t>::max();
+
+        std::vector<Indexer::ReferenceWithContext> refs;
+        for(; phase < phase_count; phase += 1, cursor = {}) {
+            if(!srv.indexer.collect_references(rs.hash,
+                                               phases[phase],
+                                               cursor,
+                                               limit - refs.size(),
+                                               refs)) {
+                break;
             }
+        }
 
-            auto& rs = candidates[0];
-            auto direction = params.direction.value_or("both");
+        ReferencesResult result;
+        result.name = rs.name;
+        result.kind = std::string(symbol_kind_name(rs.kind));
+        result.symbol_id = rs.hash;
+        for(auto& ref: refs) {
+            result.references.push_back(ReferenceEntry{
+                .file = std::move(ref.file),
+                .line = ref.line,
+                .context = std::move(ref.context),
+            });
+        }
+        result.total = static_cast<int>(result.references.size());
+        for(auto& reference: result.references) {
+            paths.compact(reference.file, reference.file_id, result.new_paths);
+        }
+        if(phase < phase_count) {
+            result.next_cursor = std::format("{}.{}.{}.{}",
+                                             phase,
+                                             static_cast<std::uint32_t>(cursor.phase),
+                                             cursor.path_id,
+                                             cursor.skip);
+        }
+        co_return result;
+    };
+    peer.on_request(references);
+
+    auto call_graph = [&srv](RequestContext&,
+                             const CallGraphParams& params) -> RequestResult<CallGraphParams> {
+        auto candidates = resolve_locator(
+            ReadSymbolParams{params.name, params.path, params.line, params.symbol_id},
+            srv.workspace,
+            srv.indexer);
+        if(candidates.empty())
+            co_return kota::outcome_error(kota::ipc::Error{"symbol not found"});
+        if(candidates.size() > 1) {
+            co_return kota::outcome_error(kota::ipc::Error{
+                std::format("ambiguous: {} candidates, use symbolId to disambiguate",
+                            candidates.size())});
+        }
 
-            CallGraphResult result;
-            result.root = CallGraphEntry{
-                .name = rs.name,
-                .kind = std::string(symbol_kind_name(rs.kind)),
-                .file = rs.file,
-                .line = rs.line,
-                .symbol_id = rs.hash,
-            };
+        auto& rs = candidates[0];
+        auto direction = params.direction.value_or("both");
+        auto max_depth = params.depth.value_or(1);
+
+        CallGraphResult result;
+        result.root = CallGraphEntry{
+            .name = rs.name,
+            .kind = std::string(symbol_kind_name(rs.kind)),
+            .file = rs.file,
+            .line = rs.line,
+            .symbol_id = rs.hash,
+        };
 
-            auto resolve_kind = [&](std::uint64_t sym_id) -> std::string {
-                if(sym_id == 0)
-                    return "Function";
-                std::string name;
-                SymbolKind kind;
-                if(srv.indexer.find_symbol_info(sym_id, name, kind))
-                    return std::string(symbol_kind_name(kind));
+        auto resolve_kind = [&](std::uint64_t sym_id) -> std::string {
+            if(sym_id == 0)
                 return "Function";
-            };
+            std::string name;
+            SymbolKind kind;
+            if(srv.indexer.find_symbol_info(sym_id, name, kind))
+                return std::string(symbol_kind_name(kind));
+            return "Function";
+        };
 
-            if(direction == "callers" || direction == "both") {
-                auto incoming = srv.indexer.find_incoming_calls(rs.hash);
-                for(auto& call: incoming) {
-                    auto sid = extract_symbol_id(call.from.data);
-                    result.callers.push_back(CallGraphEntry{
-                        .name = call.from.name,
+        // Breadth first from the root, each symbol listed at the depth it is
+        // first reached; depth 0 walks the whole graph.  The levels past the
+        // first are answered from the call graph of the index too.
+        auto walk = [&](std::vector<CallGraphEntry>& entries, auto&& neighbours) {
+            llvm::DenseSet<std::uint64_t> visited;
+            visited.insert(rs.hash);
+            auto expand = [&](std::uint64_t hash, int depth) {
+                neighbours(hash, [&](const protocol::CallHierarchyItem& item) {
+                    auto sid = extract_symbol_id(item.data);
+                    if(sid != 0 && !visited.insert(sid).second)
+                        return;
+                    entries.push_back(CallGraphEntry{
+                        .name = item.name,
                         .kind = resolve_kind(sid),
-                        .file = uri_to_path(call.from.uri),
-                        .line = static_cast<int>(call.from.range.start.line) + 1,
+                        .file = uri_to_path(item.uri),
+                        .line = static_cast<int>(item.range.start.line) + 1,
                         .symbol_id = sid,
+                        .depth = depth,
                     });
-                }
+                });
+            };
+            expand(rs.hash, 1);
+            for(std::size_t i = 0; i < entries.size(); ++i) {
+                auto depth = entries[i].depth;
+                if(entries[i].symbol_id == 0 || (max_depth > 0 && depth >= max_depth))
+                    continue;
+                expand(entries[i].symbol_id, depth + 1);
             }
+        };
 
-            if(direction == "callees" || direction == "both") {
-                auto outgoing = srv.indexer.find_outgoing_calls(rs.hash);
-                for(auto& call: outgoing) {
-                    auto sid = extract_symbol_id(call.to.data);
-                    result.callees.push_back(CallGraphEntry{
-                        .name = call.to.name,
-                        .kind = resolve_kind(sid),
-                        .file = uri_to_path(call.to.uri),
-                        .line = static_cast<int>(call.to.range.start.line) + 1,
-                        .symbol_id = sid,
-                    });
-                }
-            }
+        if(direction == "callers" || direction == "both") {
+            walk(result.callers, [&](std::uint64_t hash, auto&& add) {
+                for(auto& call: srv.indexer.find_incoming_calls(hash))
+                    add(call.from);
+            });
+        }
 
-            co_return result;
-        });
+        if(direction == "callees" || direction == "both") {
+            walk(result.callees, [&](std::uint64_t hash, auto&& add) {
+                for(auto& call: srv.indexer.find_outgoing_calls(hash))
+                    add(call.to);
+            });
+        }
+
+        co_return result;
+    };
+    peer.on_request(call_graph);
+
+    // The handlers above never suspend, so queries answered back to back on
+    // the loop all see the same index state, as one snapshot.
+    peer.on_request([=](RequestContext& context,
+                        const BatchParams& params) mutable -> RequestResult<BatchParams> {
+        BatchResult result;
+        result.answers.reserve(params.queries.size());
+        for(auto& query: params.queries) {
+            auto& answer = result.answers.emplace_back();
+            auto requests = query.symbol_search.has_value() + query.read_symbol.has_value() +
+                            query.definition.has_value() + query.references.has_value() +
+                            query.call_graph.has_value();
+            if(requests != 1) {
+                answer.error = "a batch query must set exactly one request";
+                continue;
+            }
+            co_await answer_query(symbol_search,
+                                  context,
+                                  query.symbol_search,
+                                  answer.symbol_search,
+                                  answer.error);
+            co_await answer_query(read_symbol,
+                                  context,
+                                  query.read_symbol,
+                                  answer.read_symbol,
+                                  answer.error);
+            co_await answer_query(definition,
+                                  context,
+                                  query.definition,
+                                  answer.definition,
+                                  answer.error);
+            co_await answer_query(references,
+                                  context,
+                                  query.references,
+                                  answer.references,
+                                  answer.error);
+            co_await answer_query(call_graph,
+                                  context,
+                                  query.call_graph,
+                                  answer.call_graph,
+                                  answer.error);
+        }
+        co_return result;
+    });
 
     peer.on_request(
         [&srv](RequestContext&,
@@ -728,6 +1046,7 @@ AgentClient::AgentClient(MasterServer& server, kota::ipc::JsonPeer& peer) :
 
             auto& rs = candidates[0];
             auto direction = params.direction.value_or("both");
+            auto max_depth = static_cast<std::uint32_t>(std::max(0, params.depth.value_or(1)));
 
             TypeHierarchyResult result;
             result.root = TypeHierarchyEntry{
@@ -748,31 +1067,27 @@ AgentClient::AgentClient(MasterServer& server, kota::ipc::JsonPeer& peer) :
                 return "Class";
             };
 
-            if(direction == "supertypes" || direction == "both") {
-                for(auto& item: srv.indexer.find_supertypes(rs.hash)) {
+            // Depth 0 walks the whole hierarchy, as for fileDeps.
+            auto walk = [&](bool supertypes, std::vector<TypeHierarchyEntry>& entries) {
+                for(auto& node: srv.indexer.walk_type_hierarchy(rs.hash, supertypes, max_depth)) {
+                    auto& item = node.item;
                     auto sid = extract_symbol_id(item.data);
-                    result.supertypes.push_back(TypeHierarchyEntry{
+                    entries.push_back(TypeHierarchyEntry{
                         .name = item.name,
                         .kind = resolve_kind(sid),
                         .file = uri_to_path(item.uri),
                         .line = static_cast<int>(item.range.start.line) + 1,
                         .symbol_id = sid,
+                        .depth = static_cast<int>(node.depth),
                     });
                 }
-            }
+            };
 
-            if(direction == "subtypes" || direction == "both") {
-                for(auto& item: srv.indexer.find_subtypes(rs.hash)) {
-                    auto sid = extract_symbol_id(item.data);
-                    result.subtypes.push_back(TypeHierarchyEntry{
-                        .name = item.name,
-                        .kind = resolve_kind(sid),
-                        .file = uri_to_path(item.uri),
-                        .line = static_cast<int>(item.range.start.line) + 1,
-                        .symbol_id = sid,
-                    });
-                }
-            }
+            if(direction == "supertypes" || direction == "both")
+                walk(true, result.supertypes);
+
+            if(direction == "subtypes" || direction == "both")
+                walk(false, result.subtypes);
 
             co_return result;
         });
@@ -1,10 +1,76 @@
 #pragma once
 
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "server/protocol/agentic.h"
+
 #include "kota/ipc/codec/json.h"
+#include "llvm/ADT/StringMap.h"
 
 namespace clice {
 
 class MasterServer;
+struct Workspace;
+
+/// Paths sent on one agentic connection in compact mode.  Each gets an id
+/// the first time a reply carries it, and only the id after that.
+class PathDictionary {
+public:
+    bool enabled = false;
+
+    /// Replace `path` by its id, listing it in `added` if it is new.  Does
+    /// nothing unless compact mode is on.
+    void compact(std::optional<std::string>& path,
+                 std::optional<int>& id,
+                 std::optional<std::vector<agentic::PathEntry>>& added);
+
+private:
+    llvm::StringMap<int> ids;
+};
+
+/// The files agentic/projectFiles answers from, sorted by directory and
+/// then by name, so that the files under one directory form one range.
+/// Built on the first request and again once the compilation database,
+/// the index shards or the module map change.
+class ProjectFileIndex {
+public:
+    struct Entry {
+        std::string path;
+
+        /// Length of the directory part of `path`.
+        std::uint32_t dir_size = 0;
+
+        /// "source", "header" or "module".
+        llvm::StringRef kind;
+
+        std::string module_name;
+
+        llvm::StringRef dir() const {
+            return llvm::StringRef(path).take_front(dir_size);
+        }
+
+        llvm::StringRef name() const {
+            return llvm::StringRef(path).drop_front(dir_size);
+        }
+    };
+
+    const std::vector<Entry>& get(Workspace& workspace);
+
+private:
+    void build(Workspace& workspace);
+
+    std::vector<Entry> entries;
+
+    /// What `entries` was built from.
+    const void* cdb_entries = nullptr;
+    std::size_t cdb_size = 0;
+    std::size_t shards = 0;
+    std::size_t modules = 0;
+    bool built = false;
+};
 
 class AgentClient {
 public:
@@ -13,6 +79,8 @@ public:
 private:
     MasterServer& server;
     kota::ipc::JsonPeer& peer;
+    PathDictionary paths;
+    ProjectFileIndex files;
 };
 
 }  // namespace clice
@@ -4,8 +4,10 @@
 #include <format>
 #include <string>
 #include <type_traits>
+#include <utility>
 #include <variant>
 
+#include "feature/feature.h"
 #include "semantic/symbol_kind.h"
 #include "server/protocol/extension.h"
 #include "server/protocol/worker.h"
@@ -36,33 +38,79 @@ static serde_raw to_raw(const T& value) {
     return serde_raw{json ? std::move(*json) : "null"};
 }
 
-LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(server), peer(peer) {
-    server.compiler.set_peer(&peer);
-    server.indexer.set_peer(&peer);
+/// Results per `$/progress` batch when a request streams partial results.
+/// The loop runs other requests between batches.
+constexpr std::size_t partial_result_batch = 1000;
+
+/// A hover card from the index alone, for when no AST answers: the kind and
+/// name of the symbol at the cursor and its recorded doc comment.
+static std::optional<protocol::Hover> index_hover(MasterServer& srv,
+                                                  const std::string& uri,
+                                                  llvm::StringRef path,
+                                                  const protocol::Position& position,
+                                                  Session* session) {
+    auto symbol = srv.indexer.lookup_symbol(uri, path, position, session);
+    if(!symbol || symbol->name.empty())
+        return std::nullopt;
+
+    feature::HoverInfo info;
+    info.name = std::move(symbol->name);
+    info.kind = symbol->kind;
+    info.documentation = srv.indexer.documentation(symbol->hash);
+    protocol::MarkupContent content{
+        .kind = protocol::MarkupKind::markdown,
+        .value = info.present().as_markdown(),
+    };
+    return protocol::Hover{.contents = std::move(content), .range = symbol->range};
+}
 
+LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(server), peer(peer) {
     using StringVec = std::vector<std::string>;
 
     peer.on_request([this](RequestContext& ctx, const protocol::InitializeParams& params)
                         -> RequestResult<protocol::InitializeParams> {
         auto& srv = this->server;
+        auto& init = params.lsp__initialize_params;
         if(srv.lifecycle != ServerLifecycle::Uninitialized) {
-            co_return kota::outcome_error(protocol::Error{"Server already initialized"});
+            // Another editor (or another window) on the same workspace shares
+            // its index, caches and sessions with the clients already here.
+            bool same_root =
+                !init.root_uri.has_value() || uri_to_path(*init.root_uri) == srv.workspace_root;
+            if(this->connected || srv.compiler.peer_count() == 0 || !same_root ||
+               srv.lifecycle == ServerLifecycle::ShuttingDown) {
+                co_return kota::outcome_error(protocol::Error{"Server already initialized"});
+            }
+            this->joined = true;
+            LOG_INFO("Client joined workspace: {}", srv.workspace_root);
         }
 
-        auto& init = params.lsp__initialize_params;
-        if(init.root_uri.has_value()) {
+        if(!this->joined && init.root_uri.has_value()) {
             srv.workspace_root = uri_to_path(*init.root_uri);
         }
 
-        if(init.initialization_options.has_value()) {
-            auto json =
-                kota::codec::json::to_json<kota::ipc::lsp_config>(*init.initialization_options);
-            if(json)
-                srv.init_options_json = std::move(*json);
-        }
+        // Options and capabilities are the first client's: the others get
+        // what it set up.
+        if(!this->joined) {
+            if(init.initialization_options.has_value()) {
+                auto json = kota::codec::json::to_json<kota::ipc::lsp_config>(
+                    *init.initialization_options);
+                if(json)
+                    srv.init_options_json = std::move(*json);
+            }
 
-        srv.lifecycle = ServerLifecycle::Initialized;
-        LOG_INFO("Initialized with workspace: {}", srv.workspace_root);
+            // Clients that pull diagnostics would show pushed ones twice.
+            auto& text_caps = init.capabilities.text_document;
+            srv.compiler.set_pull_diagnostics(text_caps.has_value() &&
+                                              text_caps->diagnostic.has_value());
+            auto& workspace_caps = init.capabilities.workspace;
+            srv.compiler.set_semantic_tokens_refresh(
+                workspace_caps.has_value() && workspace_caps->semantic_tokens.has_value() &&
+                workspace_caps->semantic_tokens->refresh_support.value_or(false));
+
+            srv.lifecycle = ServerLifecycle::Initialized;
+            LOG_INFO("Initialized with workspace: {}", srv.workspace_root);
+        }
+        this->connect();
 
         protocol::InitializeResult result;
         auto& caps = result.capabilities;
@@ -81,6 +129,7 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
         caps.hover_provider = true;
         caps.completion_provider = protocol::CompletionOptions{
             .trigger_characters = StringVec{".", "<", ">", ":", "\"", "/", "*"},
+            .resolve_provider = true,
         };
         caps.signature_help_provider = protocol::SignatureHelpOptions{
             .trigger_characters = StringVec{"(", ")", "{", "}", "<", ">", ","},
@@ -100,9 +149,12 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
         caps.references_provider = protocol::ReferenceOptions{
             .work_done_progress = false,
         };
+        caps.rename_provider = true;
         caps.document_symbol_provider = true;
         caps.document_link_provider = protocol::DocumentLinkOptions{};
-        caps.code_action_provider = true;
+        caps.code_action_provider = protocol::CodeActionOptions{
+            .resolve_provider = true,
+        };
         caps.folding_range_provider = true;
         caps.inlay_hint_provider = true;
         caps.call_hierarchy_provider = true;
@@ -110,6 +162,10 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
         caps.workspace_symbol_provider = true;
         caps.document_formatting_provider = true;
         caps.document_range_formatting_provider = true;
+        caps.document_on_type_formatting_provider = protocol::DocumentOnTypeFormattingOptions{
+            .first_trigger_character = ";",
+            .more_trigger_character = StringVec{"}"},
+        };
 
         protocol::SemanticTokensOptions sem_opts;
         {
@@ -130,9 +186,15 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
                 to_names(refl::reflection<SymbolModifiers::Kind>::member_names),
             };
         }
-        sem_opts.full = true;
+        sem_opts.full = protocol::SemanticTokensFullDelta{.delta = true};
+        sem_opts.range = true;
         result.capabilities.semantic_tokens_provider = std::move(sem_opts);
 
+        protocol::DiagnosticOptions diag_opts;
+        diag_opts.inter_file_dependencies = true;
+        diag_opts.workspace_diagnostics = false;
+        caps.diagnostic_provider = std::move(diag_opts);
+
         protocol::ServerInfo info;
         info.name = "clice";
         info.version = "0.1.0";
@@ -142,12 +204,21 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
     });
 
     peer.on_notification([this]([[maybe_unused]] const protocol::InitializedParams& params) {
-        this->server.initialize();
+        if(!this->joined) {
+            this->server.initialize();
+        }
     });
 
+    // While other clients are connected, a client's shutdown and exit only
+    // end its own connection.
     peer.on_request(
         [this](RequestContext& ctx,
                const protocol::ShutdownParams& params) -> RequestResult<protocol::ShutdownParams> {
+            if(this->server.compiler.peer_count() > 1) {
+                LOG_INFO("Shutdown requested by one of {} clients",
+                         this->server.compiler.peer_count());
+                co_return nullptr;
+            }
             this->server.lifecycle = ServerLifecycle::ShuttingDown;
             LOG_INFO("Shutdown requested");
             co_return nullptr;
@@ -155,6 +226,9 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
 
     peer.on_notification([this]([[maybe_unused]] const protocol::ExitParams& params) {
         LOG_INFO("Exit notification received");
+        if(this->server.compiler.peer_count() > 1) {
+            return;
+        }
         this->server.schedule_shutdown();
     });
 
@@ -166,14 +240,63 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
         auto path = uri_to_path(params.text_document.uri);
         auto path_id = srv.workspace.path_pool.intern(path);
 
+        // The file is open in another client already: share its session,
+        // taking this client's text if it differs.
+        if(!this->opened.contains(path_id)) {
+            if(auto session = srv.join_session(path_id)) {
+                this->opened.insert(path_id);
+                LOG_DEBUG("didOpen: {} (v{}), shared with {} client(s)",
+                          path,
+                          params.text_document.version,
+                          session->clients - 1);
+                if(session->text != params.text_document.text) {
+                    session->version = params.text_document.version;
+                    session->set_text(params.text_document.text);
+                    session->unedited = false;
+                    session->worker_synced_version = -1;
+                    session->generation++;
+                    session->ast_dirty = true;
+                    session->note_edit();
+                    srv.compiler.schedule_compile(session);
+                } else {
+                    srv.compiler.share_diagnostics(*session, this->peer);
+                }
+                return;
+            }
+        }
+        this->opened.insert(path_id);
+
         auto session = srv.open_session(path_id);
+        // A predicted file compiled from disk keeps its AST if the buffer is
+        // what was on disk; the worker's copy goes by another version.
+        bool predicted = std::exchange(session->speculative, false);
+        bool warm = predicted && session->text == params.text_document.text;
         session->version = params.text_document.version;
-        session->text = params.text_document.text;
-        session->line_starts = lsp::build_line_starts(session->text);
+        if(!warm) {
+            session->set_text(params.text_document.text);
+            session->ast_dirty = true;
+        }
+        session->unedited = true;
+        session->worker_synced_version = -1;
 
         session->generation++;
 
-        LOG_DEBUG("didOpen: {} (v{})", path, params.text_document.version);
+        LOG_DEBUG("didOpen: {} (v{}{})",
+                  path,
+                  params.text_document.version,
+                  warm ? ", predicted" : "");
+
+        srv.compiler.prefetch(path_id);
+        if(warm && !session->ast_dirty) {
+            session->diagnostics_version = session->version;
+            srv.compiler.share_diagnostics(*session, this->peer);
+        } else {
+            srv.compiler.publish_cached(session);
+        }
+        srv.compiler.prewarm_pch(session);
+        srv.compiler.warm_neighbours(path_id);
+        srv.predictor.record_open(path_id);
+        srv.predict_next(path_id);
     });
 
     peer.on_notification([this](const protocol::DidChangeTextDocumentParams& params) {
@@ -188,25 +311,38 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
         if(!session)
             return;
 
+        auto base_version = session->version;
         session->version = params.text_document.version;
+        session->unedited = false;
+        session->note_edit();
+        srv.pool.note_user_activity();
 
+        // Record each change as a byte-range edit so the stateful worker can
+        // replay it on its own copy instead of receiving the full text.
+        std::vector<worker::TextDelta> edits;
         for(auto& change: params.content_changes) {
             std::visit(
                 [&](auto& c) {
                     using T = std::remove_cvref_t<decltype(c)>;
                     if constexpr(std::is_same_v<T,
                                                 protocol::TextDocumentContentChangeWholeDocument>) {
-                        session->text = c.text;
+                        auto size = static_cast<std::uint32_t>(session->text.size());
+                        edits.push_back({0, size, c.text});
+                        session->set_text(c.text);
                     } else {
                         auto& range = c.range;
                         auto map = session->line_map();
                         auto start = map.to_offset(range.start);
                         auto end = map.to_offset(range.end);
                         if(start && end && *start <= *end) {
-                            session->text.replace(*start, *end - *start, c.text);
+                            edits.push_back({static_cast<std::uint32_t>(*start),
+                                             static_cast<std::uint32_t>(*end - *start),
+                                             c.text});
+                            session->edit(static_cast<std::uint32_t>(*start),
+                                          static_cast<std::uint32_t>(*end - *start),
+                                          c.text);
                         }
                     }
-                    session->line_starts = lsp::build_line_starts(session->text);
                 },
                 change);
         }
@@ -222,7 +358,15 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
         worker::DocumentUpdateParams update;
         update.path = path;
         update.version = session->version;
-        srv.pool.notify_stateful(path_id, update);
+        bool synced = session->worker_synced_version == base_version && !edits.empty();
+        if(synced) {
+            update.base_version = base_version;
+            update.edits = std::move(edits);
+        }
+        bool delivered = srv.pool.notify_stateful(path_id, update);
+        session->worker_synced_version = synced && delivered ? session->version : -1;
+
+        srv.compiler.schedule_compile(session);
     });
 
     peer.on_notification([this](const protocol::DidCloseTextDocumentParams& params) {
@@ -231,7 +375,9 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
             return;
 
         auto path_id = srv.workspace.path_pool.intern(uri_to_path(params.text_document.uri));
-        srv.close_session(path_id, this->peer);
+        if(this->opened.erase(path_id)) {
+            srv.close_session(path_id, &this->peer);
+        }
     });
 
     peer.on_notification([this](const protocol::DidSaveTextDocumentParams& params) {
@@ -241,11 +387,25 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
 
         auto path = uri_to_path(params.text_document.uri);
         auto path_id = srv.workspace.path_pool.intern(path);
+        if(auto session = srv.find_session(path_id))
+            session->unedited = true;
         srv.on_file_saved(path_id);
 
         LOG_DEBUG("didSave: {}", path);
     });
 
+    // Sent by clients configured to watch the workspace themselves; covers
+    // changes made outside the editor where the native watcher is missing.
+    peer.on_notification([this](const protocol::DidChangeWatchedFilesParams& params) {
+        auto& srv = this->server;
+        if(srv.lifecycle != ServerLifecycle::Ready)
+            return;
+
+        for(auto& change: params.changes) {
+            srv.on_file_changed(uri_to_path(change.uri));
+        }
+    });
+
     peer.on_request([this](RequestContext& ctx, const protocol::HoverParams& params) -> RawResult {
         auto& srv = this->server;
         auto path = uri_to_path(params.text_document_position_params.text_document.uri);
@@ -253,10 +413,19 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
         auto session = srv.find_session(path_id);
         if(!session)
             co_return serde_raw{"null"};
-        co_return co_await srv.compiler.forward_query(
-            worker::QueryKind::Hover,
-            session,
-            params.text_document_position_params.position);
+        // Hovering a symbol is a step towards jumping to it.
+        auto& position = params.text_document_position_params.position;
+        srv.predict_next(path_id, &position);
+        auto result = co_await srv.compiler.forward_query(worker::QueryKind::Hover,
+                                                          session,
+                                                          position);
+        // Without an AST, say what the index knows of the symbol.
+        if(result.data == "null") {
+            auto& uri = params.text_document_position_params.text_document.uri;
+            if(auto hover = index_hover(srv, uri, path, position, session.get()))
+                co_return to_raw(*hover);
+        }
+        co_return result;
     });
 
     peer.on_request([this](RequestContext& ctx,
@@ -270,6 +439,47 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
         co_return co_await srv.compiler.forward_query(worker::QueryKind::SemanticTokens, session);
     });
 
+    peer.on_request([this](RequestContext& ctx,
+                           const protocol::SemanticTokensDeltaParams& params) -> RawResult {
+        auto& srv = this->server;
+        auto path = uri_to_path(params.text_document.uri);
+        auto path_id = srv.workspace.path_pool.intern(path);
+        auto session = srv.find_session(path_id);
+        if(!session)
+            co_return serde_raw{"null"};
+        co_return co_await srv.compiler.forward_query(worker::QueryKind::SemanticTokens,
+                                                      session,
+                                                      {},
+                                                      {},
+                                                      params.previous_result_id);
+    });
+
+    peer.on_request([this](RequestContext& ctx,
+                           const protocol::DocumentDiagnosticParams& params) -> RawResult {
+        auto& srv = this->server;
+        auto path = uri_to_path(params.text_document.uri);
+        auto path_id = srv.workspace.path_pool.intern(path);
+        auto session = srv.find_session(path_id);
+        if(!session)
+            co_return serde_raw{R"({"kind":"full","items":[]})"};
+        co_return co_await srv.compiler.pull_diagnostics(session,
+                                                         params.previous_result_id.value_or(""));
+    });
+
+    peer.on_request([this](RequestContext& ctx,
+                           const protocol::SemanticTokensRangeParams& params) -> RawResult {
+        auto& srv = this->server;
+        auto path = uri_to_path(params.text_document.uri);
+        auto path_id = srv.workspace.path_pool.intern(path);
+        auto session = srv.find_session(path_id);
+        if(!session)
+            co_return serde_raw{"null"};
+        co_return co_await srv.compiler.forward_query(worker::QueryKind::SemanticTokensRange,
+                                                      session,
+                                                      {},
+                                                      params.range);
+    });
+
     peer.on_request(
         [this](RequestContext& ctx, const protocol::InlayHintParams& params) -> RawResult {
             auto& srv = this->server;
@@ -314,25 +524,7 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
         auto session = srv.find_session(path_id);
         if(!session)
             co_return serde_raw{"null"};
-        auto result = co_await srv.compiler.forward_query(worker::QueryKind::DocumentLink, session);
-        if(!result.has_value())
-            co_return serde_raw{"null"};
-        auto& links = result.value();
-        if(session->pch_ref) {
-            auto& pch_cache = srv.workspace.pch_cache;
-            auto pch_it = pch_cache.find(session->pch_ref->path_id);
-            if(pch_it != pch_cache.end() && !pch_it->second.document_links_json.empty()) {
-                auto& pch_json = pch_it->second.document_links_json;
-                if(!links.data.empty() && links.data != "null" && links.data.size() > 2) {
-                    links.data.pop_back();
-                    links.data += ',';
-                    links.data.append(pch_json.begin() + 1, pch_json.end());
-                } else {
-                    links.data = pch_json;
-                }
-            }
-        }
-        co_return std::move(links);
+        co_return co_await srv.compiler.document_links(session);
     });
 
     peer.on_request(
@@ -343,9 +535,16 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
             auto session = srv.find_session(path_id);
             if(!session)
                 co_return serde_raw{"null"};
-            co_return co_await srv.compiler.forward_query(worker::QueryKind::CodeAction, session);
+            co_return co_await srv.compiler.code_actions(params.range, std::move(session));
         });
 
+    peer.on_request([this](RequestContext& ctx, const protocol::CodeAction& action) -> RawResult {
+        auto& srv = this->server;
+        auto path_id = srv.compiler.last_code_action_path();
+        auto session = path_id ? srv.find_session(*path_id) : nullptr;
+        co_return co_await srv.compiler.resolve_code_action(action, std::move(session));
+    });
+
     auto resolve_uri = [this](const std::string& uri) {
         struct Result {
             std::string path;
@@ -399,15 +598,54 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
                                                       pos);
     });
 
-    peer.on_request([this, query_at](RequestContext& ctx,
-                                     const protocol::ReferenceParams& params) -> RawResult {
+    peer.on_request([this, resolve_uri](RequestContext& ctx,
+                                        const protocol::ReferenceParams& params) -> RawResult {
         auto& uri = params.text_document_position_params.text_document.uri;
         auto& pos = params.text_document_position_params.position;
 
-        auto locations = query_at(uri, pos, RelationKind::Reference);
+        if(auto& token = params.partial_result_params.partial_result_token) {
+            auto [path, path_id, session] = resolve_uri(uri);
+            auto& indexer = this->server.indexer;
+            auto hash = indexer.symbol_at(path, pos, session);
+
+            llvm::SmallVector<RelationKind, 2> kinds = {RelationKind::Reference};
+            if(params.context.include_declaration)
+                kinds.push_back(RelationKind::Definition);
+
+            // Each batch looks the files up afresh, so it sees files opened
+            // and shards merged while the loop ran other requests.
+            auto token_value = *token;
+            for(auto kind: kinds) {
+                Indexer::RelationCursor cursor;
+                bool done = hash == 0;
+                while(!done) {
+                    std::vector<protocol::Location> batch;
+                    done =
+                        indexer.collect_locations(hash, kind, cursor, partial_result_batch, batch);
+                    if(!batch.empty()) {
+                        peer.send_notification(
+                            ext::PartialResultParams<protocol::Location>{token_value,
+                                                                         std::move(batch)});
+                    }
+                    if(!done)
+                        co_await kota::sleep(0);
+                }
+            }
+            co_return serde_raw{"[]"};
+        }
+
+        // The shards are read on the thread pool, so that the loop goes on
+        // with edits and other requests meanwhile.
+        auto [path, path_id, session] = resolve_uri(uri);
+        auto& indexer = this->server.indexer;
+        auto hash = indexer.symbol_at(path, pos, session);
+        if(hash == 0)
+            co_return serde_raw{"null"};
+
+        auto locations = co_await indexer.find_locations(hash, RelationKind::Reference);
 
         if(params.context.include_declaration) {
-            auto defs = query_at(uri, pos, RelationKind::Definition);
+            auto defs = co_await indexer.find_locations(hash, RelationKind::Definition);
             locations.insert(locations.end(),
                              std::make_move_iterator(defs.begin()),
                              std::make_move_iterator(defs.end()));
@@ -418,6 +656,25 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
         co_return to_raw(locations);
     });
 
+    peer.on_request([this, resolve_uri](RequestContext& ctx,
+                                        const protocol::RenameParams& params) -> RawResult {
+        auto& uri = params.text_document_position_params.text_document.uri;
+        auto& pos = params.text_document_position_params.position;
+        if(params.new_name.empty())
+            co_return serde_raw{"null"};
+
+        auto [path, path_id, session] = resolve_uri(uri);
+        auto& indexer = this->server.indexer;
+        auto hash = indexer.symbol_at(path, pos, session);
+        if(hash == 0)
+            co_return serde_raw{"null"};
+
+        auto edit = co_await indexer.rename(hash, params.new_name);
+        if(!edit)
+            co_return serde_raw{"null"};
+        co_return to_raw(*edit);
+    });
+
     peer.on_request(
         [this](RequestContext& ctx, const protocol::TypeDefinitionParams& params) -> RawResult {
             co_return serde_raw{"null"};
@@ -448,6 +705,13 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
         co_return std::move(result);
     });
 
+    peer.on_request([this](RequestContext& ctx, const protocol::CompletionItem& item) -> RawResult {
+        auto& srv = this->server;
+        auto path_id = srv.compiler.last_completion_path();
+        auto session = path_id ? srv.find_session(*path_id) : nullptr;
+        co_return co_await srv.compiler.resolve_completion(item, std::move(session));
+    });
+
     peer.on_request(
         [this](RequestContext& ctx, const protocol::SignatureHelpParams& params) -> RawResult {
             auto& srv = this->server;
@@ -457,11 +721,9 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
             if(!session)
                 co_return serde_raw{"null"};
             auto pause = srv.indexer.scoped_pause();
-            auto result =
-                co_await srv.compiler.forward_build(worker::BuildKind::SignatureHelp,
-                                                    params.text_document_position_params.position,
-                                                    session);
-            co_return std::move(result);
+            co_return co_await srv.compiler.forward_signature_help(
+                params.text_document_position_params.position,
+                session);
         });
 
     peer.on_request(
@@ -488,6 +750,18 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
         co_return co_await srv.compiler.forward_format(session, params.range);
     });
 
+    peer.on_request([this](RequestContext& ctx,
+                           const protocol::DocumentOnTypeFormattingParams& params) -> RawResult {
+        auto& srv = this->server;
+        auto path = uri_to_path(params.text_document.uri);
+        auto path_id = srv.workspace.path_pool.intern(path);
+        auto session = srv.find_session(path_id);
+        if(!session)
+            co_return serde_raw{"null"};
+        auto pause = srv.indexer.scoped_pause();
+        co_return co_await srv.compiler.forward_on_type_format(session, params.position);
+    });
+
     peer.on_request(
         [this, lookup_at](RequestContext& ctx,
                           const protocol::CallHierarchyPrepareParams& params) -> RawResult {
@@ -511,6 +785,30 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
         auto info = resolve_item(params.item.uri, params.item.range, params.item.data);
         if(!info)
             co_return serde_raw{"null"};
+
+        if(auto& token = params.partial_result_params.partial_result_token) {
+            auto token_value = *token;
+            auto hash = info->hash;
+            Indexer::RelationCursor cursor;
+            bool done = false;
+            while(!done) {
+                std::vector<protocol::CallHierarchyIncomingCall> batch;
+                done = this->server.indexer.find_incoming_calls(hash,
+                                                                cursor,
+                                                                partial_result_batch,
+                                                                batch);
+                if(!batch.empty()) {
+                    peer.send_notification(
+                        ext::PartialResultParams<protocol::CallHierarchyIncomingCall>{
+                            token_value,
+                            std::move(batch)});
+                }
+                if(!done)
+                    co_await kota::sleep(0);
+            }
+            co_return serde_raw{"[]"};
+        }
+
         auto results = this->server.indexer.find_incoming_calls(info->hash);
         if(results.empty())
             co_return serde_raw{"null"};
@@ -591,53 +889,54 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
             ext::QueryContextResult result;
             std::vector<ext::ContextItem> all_items;
 
+            // Only the requested page of hosts is turned into items.
             auto& ws = srv.workspace;
-            auto hosts = ws.dep_graph.find_host_sources(path_id);
-            for(auto host_id: hosts) {
-                auto host_path = ws.path_pool.resolve(host_id);
-                auto host_cdb = ws.cdb.lookup(host_path);
-                if(host_cdb.empty())
-                    continue;
-                auto host_uri_opt = lsp::URI::from_file_path(std::string(host_path));
-                if(!host_uri_opt)
-                    continue;
-                ext::ContextItem item;
-                item.label = llvm::sys::path::filename(host_path).str();
-                item.description = std::string(host_path);
-                item.uri = host_uri_opt->str();
-                all_items.push_back(std::move(item));
+            auto hosts = ws.context_candidates(path_id);
+            if(!hosts.empty()) {
+                result.total = static_cast<int>(hosts.size());
+                for(auto host_id: hosts.drop_front(std::min<std::size_t>(offset_val, hosts.size()))
+                                      .take_front(page_size)) {
+                    auto host_path = ws.path_pool.resolve(host_id);
+                    auto host_uri_opt = lsp::URI::from_file_path(std::string(host_path));
+                    if(!host_uri_opt)
+                        continue;
+                    ext::ContextItem item;
+                    item.label = llvm::sys::path::filename(host_path).str();
+                    item.description = std::string(host_path);
+                    item.uri = host_uri_opt->str();
+                    result.contexts.push_back(std::move(item));
+                }
+                co_return to_raw(result);
             }
 
-            if(hosts.empty()) {
-                auto entries = ws.cdb.lookup(path);
-                for(std::size_t i = 0; i < entries.size(); ++i) {
-                    auto& cmd = entries[i];
-                    auto argv = cmd.to_argv();
-                    std::string desc;
-                    for(std::size_t j = 0; j < argv.size(); ++j) {
-                        llvm::StringRef a(argv[j]);
-                        if(a.starts_with("-D") || a.starts_with("-O") || a.starts_with("-std=") ||
-                           a.starts_with("-g")) {
-                            if(!desc.empty())
-                                desc += ' ';
-                            desc += argv[j];
-                            if((a == "-D" || a == "-O") && j + 1 < argv.size()) {
-                                desc += argv[++j];
-                            }
+            auto entries = ws.cdb.lookup(path);
+            for(std::size_t i = 0; i < entries.size(); ++i) {
+                auto& cmd = entries[i];
+                auto argv = cmd.to_argv();
+                std::string desc;
+                for(std::size_t j = 0; j < argv.size(); ++j) {
+                    llvm::StringRef a(argv[j]);
+                    if(a.starts_with("-D") || a.starts_with("-O") || a.starts_with("-std=") ||
+                       a.starts_with("-g")) {
+                        if(!desc.empty())
+                            desc += ' ';
+                        desc += argv[j];
+                        if((a == "-D" || a == "-O") && j + 1 < argv.size()) {
+                            desc += argv[++j];
                         }
                     }
-                    if(desc.empty())
-                        desc = std::format("config #{}", i);
-
-                    auto uri_opt = lsp::URI::from_file_path(std::string(path));
-                    if(!uri_opt)
-                        continue;
-                    ext::ContextItem item;
-                    item.label = desc;
-                    item.description = cmd.resolved.directory.str();
-                    item.uri = uri_opt->str();
-                    all_items.push_back(std::move(item));
                 }
+                if(desc.empty())
+                    desc = std::format("config #{}", i);
+
+                auto uri_opt = lsp::URI::from_file_path(std::string(path));
+                if(!uri_opt)
+                    continue;
+                ext::ContextItem item;
+                item.label = desc;
+                item.description = cmd.resolved.directory.str();
+                item.uri = uri_opt->str();
+                all_items.push_back(std::move(item));
             }
 
             result.total = static_cast<int>(all_items.size());
@@ -695,6 +994,14 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
                 co_return to_raw(result);
             }
 
+            // The context in use already: keep its preamble, PCH and AST.
+            auto& current = session->header_context;
+            if(current && current->host_path_id == context_path_id) {
+                session->active_context = context_path_id;
+                result.success = true;
+                co_return to_raw(result);
+            }
+
             session->active_context = context_path_id;
             session->header_context.reset();
             session->pch_ref.reset();
@@ -704,11 +1011,57 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
             result.success = true;
             co_return to_raw(result);
         });
+
+    peer.on_request(
+        "clice/workerStats",
+        [this](RequestContext& ctx, const ext::WorkerStatsParams& params) -> RawResult {
+            co_await this->server.pool.collect_usage();
+            auto result = this->server.pool.stats(params.reset);
+            if(auto& store = this->server.workspace.store) {
+                result.caches = store->stats(params.reset);
+            }
+            co_return to_raw(result);
+        });
+
+    peer.on_request(
+        "clice/timeTrace",
+        [this](RequestContext& ctx, const ext::TimeTraceParams& params) -> RawResult {
+            auto& report = this->server.workspace.time_traces;
+            auto summary = report.summary(params.limit);
+            ext::TimeTraceResult result{
+                .compiles = report.size(),
+                .headers = std::move(summary.headers),
+                .templates = std::move(summary.templates),
+                .instantiations = std::move(summary.instantiations),
+            };
+            if(params.reset)
+                report.clear();
+            co_return to_raw(result);
+        });
+}
+
+void LSPClient::connect() {
+    if(connected) {
+        return;
+    }
+    connected = true;
+    server.compiler.add_peer(&peer);
+    server.indexer.set_peer(server.compiler.primary_peer());
 }
 
 LSPClient::~LSPClient() {
-    server.compiler.set_peer(nullptr);
-    server.indexer.set_peer(nullptr);
+    if(!connected) {
+        return;
+    }
+    server.compiler.remove_peer(&peer);
+    server.indexer.set_peer(server.compiler.primary_peer());
+    // The files a disconnected client left open stay open for the others;
+    // the last client's are released by the shutdown.
+    if(server.compiler.peer_count() > 0) {
+        for(auto path_id: opened) {
+            server.close_session(path_id, nullptr);
+        }
+    }
 }
 
 }  // namespace clice
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <cstdint>
+
 #include "kota/async/async.h"
 #include "kota/codec/json/json.h"
 #include "kota/ipc/codec/json.h"
+#include "llvm/ADT/DenseSet.h"
 
 namespace clice {
 
@@ -16,8 +19,19 @@ public:
 private:
     using RawResult = kota::task<kota::codec::RawValue, kota::ipc::Error>;
 
+    /// Register this client for diagnostics and progress.
+    void connect();
+
     MasterServer& server;
     kota::ipc::JsonPeer& peer;
+
+    /// Initialized, as one of the clients of a server another client
+    /// initialized; its shutdown leaves the server to the others.
+    bool joined = false;
+    bool connected = false;
+
+    /// Files this client has open (path ids).
+    llvm::DenseSet<std::uint32_t> opened;
 };
 
 }  // namespace clice
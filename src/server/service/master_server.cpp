@@ -1,7 +1,9 @@
 #include "server/service/master_server.h"
 
+#include <algorithm>
 #include <list>
 #include <memory>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -10,6 +12,7 @@
 #include "server/service/lsp_client.h"
 #include "support/filesystem.h"
 #include "support/logging.h"
+#include "support/trace.h"
 
 #include "kota/async/async.h"
 #include "kota/codec/json/json.h"
@@ -18,9 +21,12 @@
 #include "kota/ipc/lsp/uri.h"
 #include "kota/ipc/recording_transport.h"
 #include "kota/ipc/transport.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/Process.h"
+#include "llvm/Support/xxhash.h"
+#include "clang/Basic/Version.h"
 
 namespace clice {
 
@@ -45,21 +51,29 @@ MasterServer::MasterServer(kota::event_loop& loop, std::string self_path) :
                 }
             }
         }),
-    self_path(std::move(self_path)) {}
+    self_path(std::move(self_path)) {
+    pool.file_changes = &workspace.file_changes;
+}
 
 MasterServer::~MasterServer() = default;
 
+/// Apply the client's initializationOptions over a loaded config.
+static void apply_init_options(Config& config,
+                               llvm::StringRef json,
+                               llvm::StringRef workspace_root) {
+    if(json.empty())
+        return;
+    if(auto ov = kota::codec::json::parse(json, config); !ov) {
+        LOG_WARN("Failed to apply initializationOptions: {}", ov.error().to_string());
+    } else {
+        config.apply_defaults(workspace_root);
+        LOG_INFO("Applied initializationOptions overlay");
+    }
+}
+
 void MasterServer::initialize() {
     workspace.config = Config::load_from_workspace(workspace_root);
-    if(!init_options_json.empty()) {
-        if(auto ov = kota::codec::json::parse(init_options_json, workspace.config); !ov) {
-            LOG_WARN("Failed to apply initializationOptions: {}", ov.error().to_string());
-        } else {
-            workspace.config.apply_defaults(workspace_root);
-            LOG_INFO("Applied initializationOptions overlay");
-        }
-        init_options_json.clear();
-    }
+    apply_init_options(workspace.config, init_options_json, workspace_root);
 
     auto& cfg = workspace.config.project;
 
@@ -69,6 +83,8 @@ void MasterServer::initialize() {
         session_log_dir =
             path::join(cfg.logging_dir, std::format("{:%Y-%m-%d_%H-%M-%S}_{}", now, pid));
         logging::file_logger("master", session_log_dir, logging::options);
+        if(*cfg.trace)
+            trace::start(session_log_dir, "master");
     }
 
     LOG_INFO("Server ready (stateful={}, stateless={}, idle={}ms)",
@@ -83,7 +99,25 @@ void MasterServer::initialize() {
     pool_opts.min_stateless = cfg.min_stateless_worker_count;
     pool_opts.max_stateless = cfg.max_stateless_worker_count;
     pool_opts.worker_memory_limit = cfg.worker_memory_limit;
+    pool_opts.stateful_migration = *cfg.stateful_worker_migration;
+    pool_opts.warm_standby = *cfg.stateless_worker_standby;
+    pool_opts.zygote = *cfg.worker_zygote;
+    pool_opts.adaptive_throttle = *cfg.adaptive_indexing;
+    pool_opts.stateful_cpus = cfg.stateful_worker_cpus;
+    pool_opts.cgroup = cfg.worker_cgroup;
+    pool_opts.indexing_cpu_weight = std::clamp<std::uint32_t>(cfg.indexing_cpu_weight, 1, 10000);
     pool_opts.log_dir = session_log_dir;
+    pool_opts.trace = trace::enabled();
+    for(llvm::StringRef command: cfg.remote_index_executors) {
+        llvm::SmallVector<llvm::StringRef> words;
+        command.split(words, ' ', -1, /*KeepEmpty=*/false);
+        if(words.empty())
+            continue;
+        auto& args = pool_opts.remote_executors.emplace_back();
+        for(auto word: words)
+            args.push_back(word.str());
+    }
+    pool_opts.remote_paths = PathMap::parse(cfg.remote_path_map);
     if(!pool.start(pool_opts)) {
         LOG_ERROR("Failed to start worker pool");
         return;
@@ -95,14 +129,56 @@ void MasterServer::initialize() {
         if(!info.stateful)
             return;
         for(auto path_id: info.lost_documents) {
-            if(auto it = sessions.find(path_id); it != sessions.end())
+            drop_speculative(path_id, /*evict=*/false);
+            if(auto it = sessions.find(path_id); it != sessions.end()) {
                 it->second->ast_dirty = true;
+                it->second->worker_synced_version = -1;
+            }
+        }
+    };
+
+    // A stateful worker dropped a document to stay under its memory budget:
+    // forget the ownership so the next request re-routes, and force a recompile.
+    pool.on_evicted = [this](const std::string& path) {
+        auto path_id = workspace.path_pool.intern(path);
+        pool.remove_owner(path_id);
+        drop_speculative(path_id, /*evict=*/false);
+        if(auto it = sessions.find(path_id); it != sessions.end()) {
+            it->second->ast_dirty = true;
+            it->second->worker_synced_version = -1;
+        }
+    };
+
+    // A batched background Index build streamed back one of its TUs.
+    pool.on_indexed = [this](const worker::IndexedParams& params) {
+        indexer.merge_streamed(params);
+    };
+
+    // Rebalancing picked a cold document on an overloaded worker: drop it there
+    // and let the next compile route it to the lightest worker.
+    pool.on_migrate = [this](std::uint32_t path_id) {
+        auto path = workspace.path_pool.resolve(path_id);
+        pool.notify_stateful(path_id, worker::EvictParams{std::string(path)});
+        pool.remove_owner(path_id);
+        drop_speculative(path_id, /*evict=*/false);
+        if(auto it = sessions.find(path_id); it != sessions.end()) {
+            it->second->ast_dirty = true;
+            it->second->worker_synced_version = -1;
         }
     };
 
     compiler.on_indexing_needed = [this]() {
         indexer.schedule();
     };
+    compiler.is_idle = [this]() {
+        return indexer.is_idle();
+    };
+    compiler.index_symbols = [this](llvm::StringRef query, std::size_t limit) {
+        return indexer.complete_symbols(query, limit);
+    };
+    compiler.index_documentation = [this](index::SymbolHash hash) {
+        return indexer.documentation(hash);
+    };
 
     load_workspace();
 }
@@ -122,27 +198,60 @@ std::shared_ptr<Session> MasterServer::open_session(std::uint32_t path_id) {
     if(it != sessions.end()) {
         it->second->generation++;
     }
-    auto session = std::make_shared<Session>();
-    session->path_id = path_id;
+    // A predicted file keeps what was compiled for it; didOpen clears
+    // `speculative` once it has compared the texts.
+    std::shared_ptr<Session> session;
+    if(auto spec = speculative_sessions.find(path_id); spec != speculative_sessions.end()) {
+        session = std::move(spec->second);
+        speculative_sessions.erase(spec);
+        std::erase(speculative_order, path_id);
+        session->clients = 1;
+        LOG_DEBUG("Opened predicted file {}", workspace.path_pool.resolve(path_id));
+    } else {
+        session = std::make_shared<Session>();
+        session->path_id = path_id;
+    }
     sessions[path_id] = session;
+    load_cdb_shard(workspace.path_pool.resolve(path_id));
+    if(!workspace.lazy_sources.empty()) {
+        session->scanned.reset();
+        bg_tasks.spawn(scan_opened(session));
+    }
     return session;
 }
 
-void MasterServer::close_session(std::uint32_t path_id, kota::ipc::JsonPeer& peer) {
+std::shared_ptr<Session> MasterServer::join_session(std::uint32_t path_id) {
+    auto it = sessions.find(path_id);
+    if(it == sessions.end()) {
+        return nullptr;
+    }
+    it->second->clients += 1;
+    return it->second;
+}
+
+void MasterServer::close_session(std::uint32_t path_id, kota::ipc::JsonPeer* peer) {
     namespace protocol = kota::ipc::protocol;
 
     auto path = workspace.path_pool.resolve(path_id);
+    if(peer) {
+        protocol::PublishDiagnosticsParams diag_params;
+        auto uri = lsp::URI::from_file_path(std::string(path));
+        if(uri)
+            diag_params.uri = uri->str();
+        diag_params.diagnostics = {};
+        peer->send_notification(diag_params);
+    }
+
+    auto it = sessions.find(path_id);
+    if(it != sessions.end() && it->second->clients > 1) {
+        it->second->clients -= 1;
+        LOG_DEBUG("didClose: {} (still open in {} client(s))", path, it->second->clients);
+        return;
+    }
+
     workspace.on_file_closed(path_id);
     pool.notify_stateful(path_id, worker::EvictParams{std::string(path)});
 
-    protocol::PublishDiagnosticsParams diag_params;
-    auto uri = lsp::URI::from_file_path(std::string(path));
-    if(uri)
-        diag_params.uri = uri->str();
-    diag_params.diagnostics = {};
-    peer.send_notification(diag_params);
-
-    auto it = sessions.find(path_id);
     if(it != sessions.end()) {
         it->second->generation++;
         sessions.erase(it);
@@ -150,16 +259,108 @@ void MasterServer::close_session(std::uint32_t path_id, kota::ipc::JsonPeer& pee
 
     indexer.enqueue(path_id);
     indexer.schedule();
+    prune_pch_cache();
 
     LOG_DEBUG("didClose: {}", path);
 }
 
+void MasterServer::prune_pch_cache(llvm::ArrayRef<std::uint32_t> stale_sources) {
+    llvm::StringSet<> in_use;
+    for(auto& [path_id, session]: sessions) {
+        if(session->pch_ref) {
+            in_use.insert(session->pch_ref->key);
+        }
+    }
+    if(workspace.prune_pch_cache(in_use, stale_sources)) {
+        workspace.save_cache();
+    }
+}
+
+void MasterServer::predict_next(std::uint32_t path_id, const protocol::Position* position) {
+    auto path = workspace.path_pool.resolve(path_id);
+
+    llvm::SmallVector<std::uint32_t, 1> definitions;
+    if(position) {
+        auto session = find_session(path_id);
+        auto hash = indexer.symbol_at(path, *position, session.get());
+        if(hash == 0 || hash == predicted_symbol)
+            return;
+        predicted_symbol = hash;
+        if(auto location = indexer.find_definition_location(hash)) {
+            auto target = workspace.path_pool.intern(uri_to_path(location->uri));
+            if(target != path_id)
+                definitions.push_back(target);
+        }
+        if(definitions.empty())
+            return;
+    }
+
+    // Only the project's own headers; the system ones are in every PCH.
+    llvm::SmallVector<std::uint32_t> includes;
+    for(auto id: workspace.dep_graph.get_all_includes(path_id)) {
+        if(!workspace_root.empty() && workspace.path_pool.resolve(id).starts_with(workspace_root))
+            includes.push_back(id);
+    }
+
+    auto candidates = predictor.rank(path_id,
+                                     definitions,
+                                     includes,
+                                     predicted_files,
+                                     [&](std::uint32_t id) { return sessions.contains(id); });
+    if(candidates.empty())
+        return;
+    compiler.warm_files(candidates);
+
+    auto budget = std::min<std::size_t>(workspace.config.project.speculative_compile,
+                                        candidates.size());
+    for(std::size_t i = 0; i < budget; ++i)
+        speculate(candidates[i]);
+}
+
+void MasterServer::speculate(std::uint32_t path_id) {
+    if(sessions.contains(path_id) || speculative_sessions.contains(path_id))
+        return;
+    auto path = std::string(workspace.path_pool.resolve(path_id));
+    auto content = fs::read(path);
+    if(!content)
+        return;
+
+    auto session = std::make_shared<Session>();
+    session->path_id = path_id;
+    session->speculative = true;
+    session->clients = 0;
+    session->set_text(std::move(*content));
+    speculative_sessions[path_id] = session;
+    speculative_order.push_back(path_id);
+
+    while(speculative_order.size() > workspace.config.project.speculative_compile)
+        drop_speculative(speculative_order.front());
+    if(speculative_sessions.contains(path_id))
+        compiler.compile_speculative(std::move(session));
+}
+
+void MasterServer::drop_speculative(std::uint32_t path_id, bool evict) {
+    auto it = speculative_sessions.find(path_id);
+    if(it == speculative_sessions.end())
+        return;
+    it->second->generation++;
+    speculative_sessions.erase(it);
+    std::erase(speculative_order, path_id);
+    if(!evict)
+        return;
+    auto path = workspace.path_pool.resolve(path_id);
+    pool.notify_stateful(path_id, worker::EvictParams{std::string(path)});
+    pool.remove_owner(path_id);
+}
+
 void MasterServer::on_file_saved(std::uint32_t path_id) {
     auto dirtied = workspace.on_file_saved(path_id);
     for(auto dirty_id: dirtied) {
         auto session = find_session(dirty_id);
         if(session) {
             session->ast_dirty = true;
+            // A dependency changed what Sema can offer.
+            session->completion_cache.reset();
         } else {
             indexer.enqueue(dirty_id);
         }
@@ -175,6 +376,41 @@ void MasterServer::on_file_saved(std::uint32_t path_id) {
     indexer.schedule();
 }
 
+void MasterServer::on_file_changed(llvm::StringRef path) {
+    workspace.file_changes.record(path);
+    auto name = llvm::sys::path::filename(path);
+    if(name == ".clang-format" || name == "_clang-format") {
+        if(workspace.format_epoch != 0)
+            workspace.format_epoch += 1;
+        return;
+    }
+
+    if(!cdb_path.empty() && path == cdb_path) {
+        reload_compilation_database(cdb_path);
+        return;
+    }
+    if(!workspace_root.empty() && (path == path::join(workspace_root, "clice.toml") ||
+                                   path == path::join(workspace_root, ".clice/config.toml"))) {
+        reload_config();
+        return;
+    }
+    for(auto& shard: cdb_shards) {
+        if(shard.loaded && path == shard.path) {
+            reload_compilation_database(shard.path);
+            return;
+        }
+    }
+
+    // Only files some build has seen can invalidate anything.
+    auto path_id = workspace.path_pool.find(path);
+    if(!path_id)
+        return;
+
+    if(workspace.fs_epoch != 0)
+        workspace.fs_epoch += 1;
+    on_file_saved(*path_id);
+}
+
 void MasterServer::schedule_shutdown() {
     if(lifecycle == ServerLifecycle::Exited)
         return;
@@ -194,9 +430,22 @@ kota::task<> MasterServer::shutdown_and_cleanup() {
     if(workspace.store) {
         workspace.store->shutdown();
     }
+    if(workspace.toolchain_store) {
+        workspace.toolchain_store->shutdown();
+    }
     lifecycle = ServerLifecycle::Exited;
 }
 
+kota::task<> MasterServer::index_and_exit() {
+    // Polled: indexing reports no completion, and next to it this is free.
+    constexpr auto interval = std::chrono::milliseconds(500);
+    co_await compiler.project_loaded.wait();
+    while(!indexer.is_idle()) {
+        co_await kota::sleep(interval);
+    }
+    co_await shutdown_and_cleanup();
+}
+
 kota::task<> MasterServer::cache_checkpoint_task() {
     constexpr auto interval = std::chrono::minutes(5);
     while(true) {
@@ -205,9 +454,75 @@ kota::task<> MasterServer::cache_checkpoint_task() {
             // Offload to the thread pool: checkpoint writes the manifest.
             co_await kota::queue([this] { workspace.store->checkpoint(); });
         }
+        if(workspace.toolchain_store) {
+            co_await kota::queue([this] { workspace.toolchain_store->checkpoint(); });
+        }
+    }
+}
+
+kota::task<> MasterServer::shared_index_task() {
+    // Polled rather than watched: the owner publishes by renaming blobs into
+    // place, and a rescan of the namespace directory is cheap.
+    constexpr auto interval = std::chrono::seconds(2);
+    while(indexer.is_read_only()) {
+        co_await kota::sleep(interval);
+        indexer.refresh();
+        if(workspace.store->try_lock("index")) {
+            LOG_INFO("Took over the shared index");
+            indexer.set_read_only(false);
+            indexer.schedule();
+        }
     }
 }
 
+kota::task<> MasterServer::file_watch_task() {
+    // Drained on a timer: reading an empty non-blocking queue is a single
+    // syscall, and a save is seen well before the next feature request.
+    constexpr auto interval = std::chrono::milliseconds(200);
+    llvm::SmallVector<FileWatcher::Event> events;
+    llvm::StringSet<> seen;
+    while(true) {
+        co_await kota::sleep(interval);
+        events.clear();
+        workspace.watcher->poll(events);
+        if(events.empty())
+            continue;
+
+        // Editors and build tools write a file several times per save.
+        seen.clear();
+        for(auto& event: events) {
+            if(event.change == FileWatcher::Change::Overflow) {
+                // Events were lost: every snapshot falls back to the stat
+                // check until it is verified again.
+                LOG_INFO("File watcher lost events; rechecking dependencies on demand");
+                workspace.fs_epoch += 1;
+                workspace.format_epoch += 1;
+                workspace.file_changes.reset();
+                continue;
+            }
+            if(seen.insert(event.path).second) {
+                on_file_changed(event.path);
+            }
+        }
+    }
+}
+
+void MasterServer::open_file_watcher() {
+    if(workspace.watcher || !*workspace.config.project.watch_files)
+        return;
+
+    auto watcher = FileWatcher::create();
+    if(!watcher) {
+        LOG_INFO("File watching unavailable: {}", watcher.error().message());
+        return;
+    }
+    workspace.watcher.emplace(std::move(*watcher));
+    workspace.fs_epoch = 1;
+    workspace.format_epoch = 1;
+    workspace.file_changes.start();
+    bg_tasks.spawn(file_watch_task());
+}
+
 void MasterServer::open_cache_store() {
     auto& cfg = workspace.config.project;
     if(workspace.store || cfg.cache_dir.empty())
@@ -224,21 +539,138 @@ void MasterServer::open_cache_store() {
     // Size budgets are deliberately generous: eviction exists to bound
     // disk usage, not to keep the working set tight.
     constexpr std::uint64_t GiB = 1ull << 30;
-    store->register_namespace(
-        {.name = "pch", .extension = ".pch", .policy = CachePolicy::LRU, .max_bytes = 8 * GiB});
-    store->register_namespace(
-        {.name = "pcm", .extension = ".pcm", .policy = CachePolicy::LRU, .max_bytes = 8 * GiB});
-    store->register_namespace(
-        {.name = "index", .extension = ".idx", .policy = CachePolicy::Persistent});
-    store->register_namespace(
-        {.name = "header_context", .extension = ".h", .policy = CachePolicy::Scratch});
+    // PCHs and PCMs compress several times over; the budget then holds the
+    // raw working set plus a much larger compressed cold set.  Sized from
+    // free space instead, they have no fixed cap.
+    auto disk_fraction = std::min(*cfg.cache_disk_percent, 100u) / 100.0;
+    auto module_budget = disk_fraction != 0 ? 0 : 8 * GiB;
+    // Each version is the format of that namespace's blobs: bump it when
+    // the format changes to drop just those blobs (Persistent ones are kept
+    // for their readers to upgrade), instead of cache_format_version.
+    store->register_namespace({.name = "pch",
+                               .extension = ".pch",
+                               .policy = CachePolicy::LRU,
+                               .max_bytes = module_budget,
+                               .disk_fraction = disk_fraction,
+                               .version = 1,
+                               .codec = CacheCodec::Chunked});
+    store->register_namespace({.name = "pcm",
+                               .extension = ".pcm",
+                               .policy = CachePolicy::LRU,
+                               .max_bytes = module_budget,
+                               .disk_fraction = disk_fraction,
+                               .version = 1,
+                               .codec = CacheCodec::Zstd,
+                               .shared = true});
+    store->register_namespace({.name = "pcm_meta",
+                               .extension = ".json",
+                               .policy = CachePolicy::LRU,
+                               .max_bytes = 64ull << 20,
+                               .version = 1,
+                               .shared = true});
+    // Shards also carry their own schema version (index/serialization.h).
+    store->register_namespace({.name = "index",
+                               .extension = ".idx",
+                               .policy = CachePolicy::Persistent,
+                               .version = 1});
+    store->register_namespace({.name = "compile",
+                               .extension = ".json",
+                               .policy = CachePolicy::LRU,
+                               .max_bytes = GiB,
+                               .version = 1});
+    store->register_namespace({.name = "scan",
+                               .extension = ".json",
+                               .policy = CachePolicy::Persistent,
+                               .version = 1});
+    store->register_namespace({.name = "header_context",
+                               .extension = ".h",
+                               .policy = CachePolicy::Scratch,
+                               .version = 1});
+    // Copies of indexed source text, for shards whose files changed since.
+    store->register_namespace({.name = "source",
+                               .extension = ".txt",
+                               .policy = CachePolicy::LRU,
+                               .max_bytes = GiB,
+                               .version = 1,
+                               .codec = CacheCodec::Zstd});
+    store->register_namespace({.name = "toolchain",
+                               .extension = ".json",
+                               .policy = CachePolicy::LRU,
+                               .max_bytes = 64ull << 20,
+                               .version = 1});
+
+    // Only PCMs are shared: their keys hold no machine-local state, and a
+    // fetched one is checked against the local files before use.  PCHs
+    // chain onto each other by path, and index keys are local path ids.
+    if(!cfg.remote_cache.empty()) {
+        store->set_remote(CacheRemote::directory(cfg.remote_cache, cache_format_version),
+                          *cfg.remote_cache_upload);
+        LOG_INFO("Remote cache: {}", std::string_view(cfg.remote_cache));
+    }
     workspace.store.emplace(std::move(*store));
+    workspace.toolchain.set_store(&*workspace.store);
     LOG_INFO("Cache store: {}", workspace.store->base_dir());
 
+    // The standard library modules build the same for every workspace with
+    // the same toolchain and flags; keep them where all of them look.
+    if(!cfg.toolchain_cache.empty()) {
+        auto shared = CacheStore::open(cfg.toolchain_cache, cache_format_version);
+        if(shared) {
+            shared->register_namespace({.name = "pcm",
+                                        .extension = ".pcm",
+                                        .policy = CachePolicy::LRU,
+                                        .max_bytes = 2 * GiB,
+                                        .version = 1,
+                                        .codec = CacheCodec::Zstd});
+            shared->register_namespace({.name = "pcm_meta",
+                                        .extension = ".json",
+                                        .policy = CachePolicy::LRU,
+                                        .max_bytes = 16ull << 20,
+                                        .version = 1});
+            workspace.toolchain_store.emplace(std::move(*shared));
+            LOG_INFO("Toolchain cache: {}", workspace.toolchain_store->base_dir());
+        } else {
+            LOG_WARN("Failed to open toolchain cache at {}: {}",
+                     std::string_view(cfg.toolchain_cache),
+                     shared.error().message());
+        }
+    }
+
+    // Instances of one workspace share its store; with shared_index only the
+    // one holding the index lock builds and saves the index.
+    if(*cfg.shared_index && !workspace.store->try_lock("index")) {
+        LOG_INFO("Index is owned by another instance, serving it read-only");
+        indexer.set_read_only(true);
+        bg_tasks.spawn(shared_index_task());
+    }
+
     workspace.load_cache();
     bg_tasks.spawn(cache_checkpoint_task());
 }
 
+/// The project a compile_commands.json builds: its directory, or the parent
+/// of a build directory (one with build system files or a build-like name).
+static std::string cdb_root(llvm::StringRef cdb) {
+    auto dir = path::parent_path(cdb);
+    auto name = path::filename(dir);
+    bool build_dir = name.starts_with("build") || name.starts_with("out") ||
+                     name.starts_with("cmake-build") ||
+                     llvm::sys::fs::exists(path::join(dir, "CMakeCache.txt")) ||
+                     llvm::sys::fs::exists(path::join(dir, "build.ninja"));
+    if(build_dir && path::has_parent_path(dir)) {
+        dir = path::parent_path(dir);
+    }
+    return dir.str();
+}
+
+/// Whether `file` is `dir` or lies below it.
+static bool is_under(llvm::StringRef file, llvm::StringRef dir) {
+    if(!file.starts_with(dir))
+        return false;
+    return file.size() == dir.size() || dir.ends_with("/") ||
+           path::is_separator(file[dir.size()]);
+}
+
 void MasterServer::load_workspace() {
     if(workspace_root.empty())
         return;
@@ -246,21 +678,42 @@ void MasterServer::load_workspace() {
     auto& cfg = workspace.config.project;
 
     open_cache_store();
-
-    std::string cdb_path;
+    open_file_watcher();
+    watch_config();
+
+    // The first configured CDB found is loaded now.  The others are shards
+    // of a multi-root workspace, loaded when a file of theirs is opened,
+    // unless they build the same project (alternative build directories).
+    cdb_path.clear();
+    cdb_shards.clear();
+    std::string primary_root;
     for(auto& configured: cfg.compile_commands_paths) {
+        std::string candidate;
         if(llvm::sys::fs::is_directory(configured)) {
-            auto candidate = path::join(configured, "compile_commands.json");
-            if(llvm::sys::fs::exists(candidate)) {
-                cdb_path = std::move(candidate);
-                break;
-            }
+            candidate = path::join(configured, "compile_commands.json");
+            if(!llvm::sys::fs::exists(candidate))
+                continue;
         } else if(llvm::sys::fs::exists(configured)) {
-            cdb_path = configured;
-            break;
+            candidate = configured;
         } else {
             LOG_WARN("Configured compile_commands_path not found: {}", configured);
+            continue;
+        }
+
+        if(cdb_path.empty()) {
+            cdb_path = std::move(candidate);
+            primary_root = cdb_root(cdb_path);
+            continue;
         }
+        if(candidate == cdb_path || std::ranges::contains(cdb_shards, candidate, &CdbShard::path))
+            continue;
+        auto root = cdb_root(candidate);
+        if(is_under(primary_root, root)) {
+            LOG_INFO("Ignoring {}: {} already builds {}", candidate, cdb_path, root);
+            continue;
+        }
+        LOG_INFO("CDB shard {} covers {}", candidate, root);
+        cdb_shards.push_back({std::move(candidate), std::move(root)});
     }
 
     if(cdb_path.empty()) {
@@ -290,20 +743,215 @@ void MasterServer::load_workspace() {
         return;
     }
 
-    auto count = workspace.cdb.load(cdb_path);
-    LOG_INFO("Loaded CDB from {} with {} entries", cdb_path, count);
+    // The persisted index answers index queries on its own, so the server
+    // serves them from it while the project itself loads in the background.
+    indexer.load(workspace_root);
+    compiler.project_loaded.reset();
+    bg_tasks.spawn(load_project());
+}
+
+kota::task<> MasterServer::load_project() {
+    auto& cfg = workspace.config.project;
+    auto started = std::chrono::steady_clock::now();
+
+    // Parsing a large CDB takes a while; nothing reads workspace.cdb before
+    // project_loaded, but it is only replaced back on the loop.
+    auto cdb = co_await kota::queue([path = cdb_path] {
+        CompilationDatabase cdb;
+        cdb.load(path);
+        return cdb;
+    });
+    if(!cdb.has_value()) {
+        LOG_ERROR("Failed to load CDB from {}", cdb_path);
+        compiler.project_loaded.set();
+        co_return;
+    }
+    workspace.cdb = std::move(*cdb);
+    LOG_INFO("Loaded CDB from {} with {} entries", cdb_path, workspace.cdb.get_entries().size());
+    watch_cdb(cdb_path);
+
+    scan_dependencies();
+    if(workspace.lazy_sources.empty()) {
+        workspace.scan_cache.scan_results.clear();
+    }
+    workspace.dep_graph.build_reverse_map();
+
+    workspace.build_module_map();
+
+    if(*cfg.enable_indexing) {
+        for(auto& entry: workspace.cdb.get_entries()) {
+            auto file = workspace.cdb.resolve_path(entry.file);
+            auto server_id = workspace.path_pool.intern(file);
+            indexer.enqueue(server_id);
+        }
+        indexer.schedule();
+    }
+
+    compiler.init_compile_graph();
+    compiler.project_loaded.set();
+    LOG_INFO("Project loaded in {}ms",
+             std::chrono::duration_cast<std::chrono::milliseconds>(
+                 std::chrono::steady_clock::now() - started)
+                 .count());
+
+    if(config_reload_pending) {
+        reload_config();
+    }
+}
+
+void MasterServer::watch_config() {
+    if(!workspace.watcher)
+        return;
+    for(auto dir: {workspace_root, path::join(workspace_root, ".clice")}) {
+        if(!llvm::sys::fs::is_directory(dir) || workspace.watcher->watches(dir))
+            continue;
+        if(workspace.watcher->add_directory(dir)) {
+            LOG_INFO("Not watching {}; config changes need a restart", dir);
+        }
+    }
+}
+
+void MasterServer::watch_cdb(llvm::StringRef path) {
+    if(!workspace.watcher)
+        return;
+    auto dir = path::parent_path(path);
+    if(!workspace.watcher->watches(dir) && workspace.watcher->add_directory(dir)) {
+        LOG_INFO("Not watching {}; CDB changes need a restart", dir);
+    }
+}
+
+void MasterServer::load_cdb_shard(llvm::StringRef path) {
+    CdbShard* owner = nullptr;
+    for(auto& shard: cdb_shards) {
+        if(!is_under(path, shard.root))
+            continue;
+        if(!owner || shard.root.size() > owner->root.size()) {
+            owner = &shard;
+        }
+    }
+    if(!owner || owner->loaded)
+        return;
+
+    owner->loaded = true;
+    LOG_INFO("Loading CDB shard {} for {}", owner->path, path);
+    watch_cdb(owner->path);
+    reload_compilation_database(owner->path);
+}
+
+/// Store key of the dependency scan snapshot: the CDBs it scanned, the
+/// rules that changed its search configs, and the toolchain that listed
+/// the system search dirs: our clang and the driver binaries queried.
+static std::string scan_snapshot_key(llvm::ArrayRef<std::string> cdb_contents,
+                                     CompilationDatabase& cdb,
+                                     const Config& config) {
+    std::string input;
+    auto add = [&](llvm::StringRef part) {
+        input += std::format("{}:", part.size());
+        input += part;
+    };
+    for(auto& content: cdb_contents) {
+        add(content);
+    }
+    add(clang::getClangFullVersion());
+    std::set<llvm::StringRef> drivers;
+    for(auto& entry: cdb.get_entries()) {
+        auto& arguments = entry.info->canonical->arguments;
+        if(!arguments.empty()) {
+            drivers.insert(arguments.front());
+        }
+    }
+    for(auto driver: drivers) {
+        add(driver);
+        add(Toolchain::driver_identity(driver));
+    }
+    for(auto& rule: *config.rules) {
+        for(auto* flags: {&*rule.patterns, &*rule.append, &*rule.remove}) {
+            add(std::to_string(flags->size()));
+            for(auto& flag: *flags) {
+                add(flag);
+            }
+        }
+    }
+    auto hash = llvm::xxh3_128bits(llvm::arrayRefFromStringRef(input));
+    return std::format("{:016x}{:016x}", hash.high64, hash.low64);
+}
+
+void MasterServer::scan_dependencies() {
+    auto& cache = workspace.scan_cache;
+    std::string key;
+    if(workspace.store) {
+        std::vector<std::string> contents;
+        for(auto& source: workspace.cdb.sources()) {
+            auto content = fs::read(source);
+            if(!content) {
+                contents.clear();
+                break;
+            }
+            contents.push_back(std::move(*content));
+        }
+        if(!contents.empty()) {
+            key = scan_snapshot_key(contents, workspace.cdb, workspace.config);
+        }
+    }
+    scan_key = key;
+
+    std::optional<std::size_t> changed;
+    if(!key.empty()) {
+        if(auto blob = workspace.store->lookup("scan", key)) {
+            if(auto snapshot = fs::read(*blob)) {
+                changed = load_scan_snapshot(*snapshot,
+                                             workspace.path_pool,
+                                             workspace.dep_graph,
+                                             cache);
+            }
+            if(!changed) {
+                LOG_WARN("Discarding unreadable dependency scan snapshot {}", key);
+            }
+        }
+    }
+    if(changed == 0) {
+        LOG_INFO("Dependency graph restored: {} files, {} edges, {} modules",
+                 workspace.dep_graph.file_count(),
+                 workspace.dep_graph.edge_count(),
+                 workspace.dep_graph.module_count());
+        return;
+    }
+    if(changed) {
+        LOG_INFO("Dependency scan snapshot is stale ({} changed), rescanning", *changed);
+    }
+
+    auto scanned_at = std::chrono::system_clock::now();
+    if(*workspace.config.project.lazy_dependency_scan) {
+        // Scan what the open files need now and the rest in the background.
+        auto& sources = workspace.lazy_sources;
+        for(auto& entry: workspace.cdb.get_entries()) {
+            sources.push_back(workspace.path_pool.intern(workspace.cdb.resolve_path(entry.file)));
+        }
+        llvm::sort(sources, [&](std::uint32_t lhs, std::uint32_t rhs) {
+            return workspace.path_pool.resolve(lhs) < workspace.path_pool.resolve(rhs);
+        });
+        sources.erase(std::unique(sources.begin(), sources.end()), sources.end());
+        for(auto& [path_id, session]: sessions) {
+            session->scanned.reset();
+            bg_tasks.spawn(scan_opened(session));
+        }
+        LOG_INFO("Lazy dependency scan: {} sources, {} open files scanned first",
+                 sources.size(),
+                 sessions.size());
+        bg_tasks.spawn(dependency_crawl_task(std::move(key), scanned_at));
+        return;
+    }
 
     auto report = scan_dependency_graph(workspace.cdb,
                                         workspace.toolchain,
                                         workspace.path_pool,
                                         workspace.dep_graph,
-                                        /*cache=*/nullptr,
+                                        &cache,
                                         [this](llvm::StringRef path,
                                                std::vector<std::string>& append,
                                                std::vector<std::string>& remove) {
                                             workspace.config.match_rules(path, append, remove);
                                         });
-    workspace.dep_graph.build_reverse_map();
 
     auto unresolved = report.includes_found - report.includes_resolved;
     double accuracy =
@@ -324,19 +972,345 @@ void MasterServer::load_workspace() {
     if(unresolved > 0)
         LOG_WARN("{} unresolved includes", unresolved);
 
+    if(!key.empty()) {
+        store_scan_snapshot(key, scanned_at);
+    }
+}
+
+kota::task<> MasterServer::dependency_crawl_task(std::string key,
+                                                  std::chrono::system_clock::time_point scanned_at) {
+    // One batch per tick on the loop thread, so requests are served between
+    // batches (and while a batch waits on the thread pool) and the files
+    // opened meanwhile are scanned ahead of the crawl.
+    constexpr auto interval = std::chrono::milliseconds(50);
+    constexpr std::size_t batch_size = 256;
+    auto start = std::chrono::steady_clock::now();
+    while(true) {
+        co_await kota::sleep(interval);
+        auto batch = workspace.next_lazy_sources(batch_size);
+        if(batch.empty()) {
+            break;
+        }
+        co_await workspace.scan_sources({batch.begin(), batch.end()}, loop);
+
+        // Headers opened without a host may have one now.
+        for(auto& [path_id, session]: sessions) {
+            auto path = workspace.path_pool.resolve(path_id);
+            if(session->header_context || workspace.cdb.has_entry(path))
+                continue;
+            if(!workspace.dep_graph.find_host_sources(path_id, 1).empty()) {
+                session->ast_dirty = true;
+            }
+        }
+    }
+
+    // A scan of an opened file may still be at work on the last sources.
+    co_await workspace.scan_lock.lock();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+    LOG_INFO("Dependency graph complete: {} sources in {}ms, {} files, {} edges, {} modules",
+             workspace.lazy_sources.size(),
+             elapsed.count(),
+             workspace.dep_graph.file_count(),
+             workspace.dep_graph.edge_count(),
+             workspace.dep_graph.module_count());
+
+    if(!key.empty()) {
+        store_scan_snapshot(key, scanned_at);
+    }
+    workspace.lazy_sources.clear();
+    workspace.lazy_scanned.clear();
+    workspace.lazy_cursor = 0;
+    workspace.scan_cache.scan_results.clear();
+    workspace.scan_lock.unlock();
+
+    // Modules are known only now that every source was scanned.
+    if(!workspace.compile_graph) {
+        compiler.init_compile_graph();
+    }
+
+    if(!cdb_reload_pending.empty()) {
+        auto pending = std::move(cdb_reload_pending);
+        cdb_reload_pending.clear();
+        reload_compilation_database(pending);
+    }
+    if(config_reload_pending) {
+        reload_config();
+    }
+}
+
+kota::task<> MasterServer::scan_opened(std::shared_ptr<Session> session) {
+    co_await workspace.scan_closure(session->path_id, loop);
+    session->scanned.set();
+}
+
+void MasterServer::reload_compilation_database(llvm::ArrayRef<std::string> paths) {
+    if(!workspace.lazy_sources.empty()) {
+        // The crawl owns the scan state until it finishes.
+        for(auto& path: paths) {
+            if(!std::ranges::contains(cdb_reload_pending, path)) {
+                cdb_reload_pending.push_back(path);
+            }
+        }
+        return;
+    }
+
+    // Each CDB replaces only its own entries, so the shards loaded so far
+    // stay when one of them (or the primary one) is rewritten.
+    CompilationChanges changes;
+    for(auto& path: paths) {
+        CompilationChanges loaded;
+        auto count = workspace.cdb.add(path, &loaded);
+        if(loaded.empty()) {
+            LOG_INFO("Reloaded CDB from {}: {} entries, none changed", path, count);
+            continue;
+        }
+        LOG_INFO("Reloaded CDB from {}: {} entries, {} added, {} removed, {} changed",
+                 path,
+                 count,
+                 loaded.added.size(),
+                 loaded.removed.size(),
+                 loaded.changed.size());
+        changes.added.append(loaded.added);
+        changes.removed.append(loaded.removed);
+        changes.changed.append(loaded.changed);
+    }
+    if(changes.empty()) {
+        return;
+    }
+
+    // Scan results follow file contents, not commands, so they are kept;
+    // what the snapshot derived from the old CDB goes.
+    seed_scan_results();
+    workspace.scan_cache.invalidate_configs();
+    auto module_units = rescan_dependencies();
+
+    // PCHs and PCMs are keyed by their flags, so a changed command selects
+    // new ones by itself; only the files using them need a rebuild.
+    bool modules_changed = false;
+    llvm::SmallVector<std::uint32_t> stale;
+    auto invalidate = [&](std::uint32_t cdb_id, bool index) {
+        auto path_id = workspace.path_pool.intern(workspace.cdb.resolve_path(cdb_id));
+        stale.push_back(path_id);
+        if(auto session = find_session(path_id)) {
+            session->ast_dirty = true;
+        }
+        if(module_units.contains(path_id) || workspace.path_to_module.contains(path_id)) {
+            modules_changed = true;
+        }
+        if(index && *workspace.config.project.enable_indexing) {
+            indexer.reindex(path_id);
+        }
+    };
+    for(auto id: changes.added) {
+        invalidate(id, true);
+    }
+    for(auto id: changes.changed) {
+        invalidate(id, true);
+    }
+    for(auto id: changes.removed) {
+        invalidate(id, false);
+    }
+    indexer.schedule();
+    prune_pch_cache(stale);
+
+    if(modules_changed) {
+        compiler.init_compile_graph();
+    }
+}
+
+void MasterServer::seed_scan_results() {
+    auto& cache = workspace.scan_cache;
+    if(scan_key.empty() || !cache.scan_results.empty())
+        return;
+    if(auto blob = workspace.store->lookup("scan", scan_key)) {
+        if(auto snapshot = fs::read(*blob)) {
+            DependencyGraph scratch;
+            load_scan_snapshot(*snapshot, workspace.path_pool, scratch, workspace.scan_cache);
+        }
+    }
+}
+
+llvm::DenseSet<std::uint32_t> MasterServer::rescan_dependencies() {
+    llvm::DenseSet<std::uint32_t> module_units;
+    for(auto& [path_id, name]: workspace.path_to_module) {
+        module_units.insert(path_id);
+    }
+
+    workspace.dep_graph = DependencyGraph();
+    scan_dependencies();
+    if(workspace.lazy_sources.empty()) {
+        workspace.scan_cache.scan_results.clear();
+    }
+    workspace.dep_graph.build_reverse_map();
+    workspace.path_to_module.clear();
     workspace.build_module_map();
-    indexer.load();
+    return module_units;
+}
 
-    if(*cfg.enable_indexing) {
+void MasterServer::reload_config() {
+    if(!workspace.lazy_sources.empty() || !compiler.project_loaded.is_set()) {
+        // The load and the crawl own the scan state until they finish.
+        config_reload_pending = true;
+        return;
+    }
+    config_reload_pending = false;
+
+    // A config in the middle of an edit may not parse: keep the current one
+    // until it does.
+    std::optional<Config> loaded;
+    for(auto* name: {"clice.toml", ".clice/config.toml"}) {
+        auto config_path = path::join(workspace_root, name);
+        if(!llvm::sys::fs::exists(config_path))
+            continue;
+        loaded = Config::load(config_path, workspace_root);
+        if(!loaded) {
+            LOG_WARN("Keeping the current configuration because {} is invalid", config_path);
+            return;
+        }
+        break;
+    }
+    if(!loaded) {
+        loaded.emplace();
+        loaded->apply_defaults(workspace_root);
+    }
+    apply_init_options(*loaded, init_options_json, workspace_root);
+
+    auto& old_cfg = workspace.config.project;
+    auto& new_cfg = loaded->project;
+    if(*old_cfg.cache_dir != *new_cfg.cache_dir || *old_cfg.logging_dir != *new_cfg.logging_dir ||
+       *old_cfg.compile_commands_paths != *new_cfg.compile_commands_paths ||
+       old_cfg.watch_files != new_cfg.watch_files ||
+       old_cfg.worker_zygote != new_cfg.worker_zygote ||
+       *old_cfg.worker_cgroup != *new_cfg.worker_cgroup ||
+       old_cfg.stateful_worker_cpus.value != new_cfg.stateful_worker_cpus.value ||
+       old_cfg.worker_memory_limit.value != new_cfg.worker_memory_limit.value) {
+        LOG_WARN("Changes to the cache, logging, CDB, watching or worker process settings of "
+                 "clice.toml take effect after a restart");
+    }
+
+    // The rules are the only part of the config that reaches a command: the
+    // files whose flags they change are rebuilt, and the search configs of
+    // the groups whose representative they change are extracted again.
+    llvm::SmallVector<std::uint32_t> changed;
+    llvm::SmallVector<std::uint32_t> stale_configs;
+    if(!workspace.config.same_rules(*loaded)) {
+        auto flags_differ = [&](llvm::StringRef path) {
+            std::vector<std::string> old_append, old_remove, new_append, new_remove;
+            workspace.config.match_rules(path, old_append, old_remove);
+            loaded->match_rules(path, new_append, new_remove);
+            return old_append != new_append || old_remove != new_remove;
+        };
+        llvm::DenseSet<std::uint32_t> seen;
+        auto check = [&](std::uint32_t path_id) {
+            if(seen.insert(path_id).second && flags_differ(workspace.path_pool.resolve(path_id))) {
+                changed.push_back(path_id);
+            }
+        };
         for(auto& entry: workspace.cdb.get_entries()) {
-            auto file = workspace.cdb.resolve_path(entry.file);
-            auto server_id = workspace.path_pool.intern(file);
-            indexer.enqueue(server_id);
+            check(workspace.path_pool.intern(workspace.cdb.resolve_path(entry.file)));
+        }
+        for(auto& [path_id, session]: sessions) {
+            check(path_id);
+        }
+
+        auto groups = workspace.cdb.unique_configs();
+        for(std::uint32_t config_id = 0; config_id < groups.size(); ++config_id) {
+            if(flags_differ(groups[config_id].command.source_file)) {
+                stale_configs.push_back(config_id);
+            }
         }
-        indexer.schedule();
     }
 
-    compiler.init_compile_graph();
+    bool resize = old_cfg.stateful_worker_count.value != new_cfg.stateful_worker_count.value ||
+                  old_cfg.stateless_worker_count.value != new_cfg.stateless_worker_count.value ||
+                  old_cfg.min_stateless_worker_count.value !=
+                      new_cfg.min_stateless_worker_count.value ||
+                  old_cfg.max_stateless_worker_count.value !=
+                      new_cfg.max_stateless_worker_count.value;
+
+    workspace.config = std::move(*loaded);
+    auto& cfg = workspace.config.project;
+    LOG_INFO("Reloaded configuration: {} files with changed flags, {} search configs stale",
+             changed.size(),
+             stale_configs.size());
+
+    if(resize) {
+        WorkerPoolOptions opts;
+        opts.stateful_count = cfg.stateful_worker_count;
+        opts.stateless_count = cfg.stateless_worker_count;
+        opts.min_stateless = cfg.min_stateless_worker_count;
+        opts.max_stateless = cfg.max_stateless_worker_count;
+        pool.resize(opts);
+    }
+
+    if(changed.empty()) {
+        return;
+    }
+
+    llvm::DenseSet<std::uint32_t> module_units;
+    if(!stale_configs.empty()) {
+        seed_scan_results();
+        workspace.scan_cache.invalidate_configs(stale_configs);
+        module_units = rescan_dependencies();
+    } else {
+        for(auto& [path_id, name]: workspace.path_to_module) {
+            module_units.insert(path_id);
+        }
+    }
+
+    // As for a CDB reload, PCHs and PCMs are keyed by their flags.
+    bool modules_changed = false;
+    for(auto path_id: changed) {
+        if(auto session = find_session(path_id)) {
+            session->ast_dirty = true;
+        }
+        if(module_units.contains(path_id) || workspace.path_to_module.contains(path_id)) {
+            modules_changed = true;
+        }
+        if(*cfg.enable_indexing && workspace.cdb.has_entry(workspace.path_pool.resolve(path_id))) {
+            indexer.reindex(path_id);
+        }
+    }
+    indexer.schedule();
+    prune_pch_cache(changed);
+
+    if(modules_changed) {
+        compiler.init_compile_graph();
+    }
+}
+
+void MasterServer::store_scan_snapshot(llvm::StringRef key,
+                                       std::chrono::system_clock::time_point scanned_at) {
+    // One snapshot per workspace: those of earlier CDBs are never read again.
+    auto& store = *workspace.store;
+    auto snapshot = save_scan_snapshot(workspace.path_pool,
+                                       workspace.dep_graph,
+                                       workspace.scan_cache,
+                                       scanned_at);
+    if(snapshot.empty()) {
+        return;
+    }
+    auto pending = store.begin_store("scan", key);
+    if(auto written = fs::write(pending.tmp_path, snapshot); !written) {
+        LOG_WARN("Failed to write dependency scan snapshot: {}", written.error().message());
+        store.abort(pending);
+        return;
+    }
+    if(auto committed = store.commit(std::move(pending)); !committed) {
+        LOG_WARN("Failed to commit dependency scan snapshot: {}", committed.error().message());
+        return;
+    }
+
+    std::vector<std::string> stale;
+    store.for_each_key("scan", [&](llvm::StringRef other) {
+        if(other != key) {
+            stale.push_back(other.str());
+        }
+    });
+    for(auto& other: stale) {
+        store.invalidate("scan", other);
+    }
 }
 
 struct Connection {
@@ -359,14 +1333,12 @@ static kota::task<> accept_connections(MasterServer& server,
                                        std::list<Connection>& connections) {
     auto& loop = kota::event_loop::current();
     kota::task_group<> group(loop);
-    bool lsp_registered = false;
 
     group.spawn([](MasterServer& server,
                    kota::tcp::acceptor& acceptor,
                    bool register_lsp,
                    std::list<Connection>& connections,
-                   kota::task_group<>& group,
-                   bool& lsp_registered) -> kota::task<> {
+                   kota::task_group<>& group) -> kota::task<> {
         auto& loop = kota::event_loop::current();
 
         while(true) {
@@ -379,10 +1351,11 @@ static kota::task<> accept_connections(MasterServer& server,
             auto transport = std::make_unique<kota::ipc::StreamTransport>(std::move(*conn));
             auto peer = std::make_unique<kota::ipc::JsonPeer>(loop, std::move(transport));
 
+            // Every connection may be an editor; those that initialize share
+            // the workspace with the ones already connected.
             std::unique_ptr<LSPClient> lsp;
-            if(register_lsp && !lsp_registered) {
+            if(register_lsp) {
                 lsp = std::make_unique<LSPClient>(server, *peer);
-                lsp_registered = true;
             }
             auto agent = std::make_unique<AgentClient>(server, *peer);
 
@@ -396,12 +1369,13 @@ static kota::task<> accept_connections(MasterServer& server,
 
             group.spawn(run_connection(peer_ptr, connections, it));
         }
-    }(server, acceptor, register_lsp, connections, group, lsp_registered));
+    }(server, acceptor, register_lsp, connections, group));
 
     co_await group.join();
 }
 
 int run_serve_mode(const ServerOptions& opts, const char* self_path) {
+    logging::options.async = bool(opts.log_async);
     logging::stderr_logger("master", logging::options);
 
     auto mode = opts.mode.value_or(ServerMode::Pipe);
@@ -419,6 +1393,17 @@ int run_serve_mode(const ServerOptions& opts, const char* self_path) {
     MasterServer server(loop, self_path);
     std::list<Connection> connections;
 
+    if(opts.index_only) {
+        if(ws.empty()) {
+            LOG_ERROR("--index-only requires --workspace");
+            return 1;
+        }
+        server.initialize(ws);
+        loop.schedule(server.index_and_exit());
+        loop.run();
+        return 0;
+    }
+
     if(mode == ServerMode::Pipe) {
         auto transport = kota::ipc::StreamTransport::open_stdio(loop);
         if(!transport) {
@@ -1,10 +1,13 @@
 #pragma once
 
+#include <chrono>
 #include <cstdint>
+#include <deque>
 #include <string>
 
 #include "server/compiler/compiler.h"
 #include "server/compiler/indexer.h"
+#include "server/service/predictor.h"
 #include "server/service/session.h"
 #include "server/worker/worker_pool.h"
 #include "server/workspace/workspace.h"
@@ -12,6 +15,7 @@
 #include "kota/async/async.h"
 #include "kota/deco/deco.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/StringRef.h"
 
 namespace clice {
@@ -49,11 +53,21 @@ struct ServerOptions {
            required = false)
     <std::string> workspace;
 
+    DecoFlag(names = {"--index-only"},
+             help = "Index --workspace into its cache directory and exit (no LSP)",
+             required = false)
+    index_only;
+
     DecoKV(style = deco::decl::KVStyle::JoinedOrSeparate,
            names = {"--log-level", "--log-level="},
            help = "Log level: trace, debug, info, warn, error, off",
            required = false)
     <std::string> log_level = "info";
+
+    DecoFlag(names = {"--log-async"},
+             help = "Write the master's log from a background thread, flushed periodically",
+             required = false)
+    log_async;
 };
 
 enum class ServerLifecycle : std::uint8_t {
@@ -80,15 +94,40 @@ public:
     void initialize();
     void initialize(llvm::StringRef root);
 
-    // TODO: add periodic stat-based file watching
     kota::task<> shutdown_and_cleanup();
 
+    /// Wait for background indexing of the initialized workspace to finish,
+    /// then shut down, leaving the index saved in the cache directory: what
+    /// a build farm publishes for project.base_index.
+    kota::task<> index_and_exit();
+
     std::shared_ptr<Session> find_session(std::uint32_t path_id);
     std::shared_ptr<Session> open_session(std::uint32_t path_id);
-    void close_session(std::uint32_t path_id, kota::ipc::JsonPeer& peer);
+
+    /// Open the session another client already has for `path_id`, if any.
+    std::shared_ptr<Session> join_session(std::uint32_t path_id);
+
+    /// Drop a client's reference to the session; the last one closes it.
+    /// The diagnostics `peer` (if any, and still connected) shows are cleared.
+    void close_session(std::uint32_t path_id, kota::ipc::JsonPeer* peer);
+
+    /// Prune the PCH cache down to what open sessions use and the recently
+    /// used rest (see Workspace::prune_pch_cache()).
+    void prune_pch_cache(llvm::ArrayRef<std::uint32_t> stale_sources = {});
 
     void on_file_saved(std::uint32_t path_id);
 
+    /// Guess the files the user opens after `path_id` (NextFilePredictor)
+    /// and get them ready: the PCHs of the best few, and the ASTs of the
+    /// best project.speculative_compile.  `position` is the cursor, if
+    /// known; the definition of its symbol is the strongest hint.
+    void predict_next(std::uint32_t path_id, const protocol::Position* position = nullptr);
+
+    /// A file changed on disk outside of a didSave, as reported by the file
+    /// watcher or the client's workspace/didChangeWatchedFiles.  Untracked
+    /// paths are ignored.
+    void on_file_changed(llvm::StringRef path);
+
     void schedule_shutdown();
 
     kota::event& get_shutdown_event() {
@@ -97,8 +136,68 @@ public:
 
 private:
     kota::event shutdown_event;
+
+    /// Open the cache store and the persisted index, find the CDB, and start
+    /// load_project() in the background.
     void load_workspace();
 
+    /// Load the CDB, scan dependencies and queue indexing, then set
+    /// compiler.project_loaded.
+    kota::task<> load_project();
+
+    /// Load the CDBs at `paths` again after the build system rewrote them
+    /// (or for the first time, for shards), and invalidate only what depends
+    /// on the entries that changed: the dependency graph is rescanned from
+    /// the kept scan results, and the open and indexed files whose commands
+    /// changed are rebuilt.
+    void reload_compilation_database(llvm::ArrayRef<std::string> paths);
+
+    /// Load clice.toml again after it changed on disk and invalidate only
+    /// what the change reaches: the files whose `[[rules]]` flags changed
+    /// are rescanned, rebuilt and reindexed, and the worker pool is resized
+    /// to new worker counts.  Deferred while the project loads or a lazy
+    /// dependency crawl runs.
+    void reload_config();
+
+    /// Watch the directories clice.toml may live in for edits.
+    void watch_config();
+
+    /// Seed the scan results from the snapshot of the last dependency scan,
+    /// so that a rescan only reads the files that changed on disk.
+    void seed_scan_results();
+
+    /// Rebuild workspace.dep_graph and the module map from the scan cache;
+    /// returns the module units there were before.
+    llvm::DenseSet<std::uint32_t> rescan_dependencies();
+
+    /// Load the CDB shard whose root holds `path`, if it is not loaded yet.
+    /// The shard with the longest root wins.
+    void load_cdb_shard(llvm::StringRef path);
+
+    /// Watch the directory of a loaded CDB for rewrites.
+    void watch_cdb(llvm::StringRef path);
+
+    /// Build workspace.dep_graph for the loaded CDBs.  The graph of the last
+    /// scan of the same CDBs is kept in the cache store and reused when no
+    /// file or directory it saw changed since; otherwise the rescan only
+    /// reads the files that did.
+    void scan_dependencies();
+
+    /// Scan the CDB sources a lazy dependency scan has not reached, a batch
+    /// at a time between requests, then save the snapshot under `key` (if
+    /// not empty) and drop the scan results.
+    kota::task<> dependency_crawl_task(std::string key,
+                                       std::chrono::system_clock::time_point scanned_at);
+
+    /// Scan what an open file needs of a lazy dependency graph, off the
+    /// request that opened it, then set its session's `scanned`.
+    kota::task<> scan_opened(std::shared_ptr<Session> session);
+
+    /// Save dep_graph and the scan cache as the snapshot under `key` and
+    /// drop the snapshots of other CDBs.
+    void store_scan_snapshot(llvm::StringRef key,
+                             std::chrono::system_clock::time_point scanned_at);
+
     /// Open the CacheStore under cache_dir and register the blob
     /// namespaces.  No-op if already open or caching is disabled.
     void open_cache_store();
@@ -107,14 +206,46 @@ private:
     /// times survive crashes (the store itself is passive by design).
     kota::task<> cache_checkpoint_task();
 
+    /// While another instance owns the shared index, follow what it commits
+    /// and try to take ownership over when it exits.
+    kota::task<> shared_index_task();
+
+    /// Compile `path_id` from disk in a speculative session, which the
+    /// oldest one makes room for past project.speculative_compile.
+    void speculate(std::uint32_t path_id);
+
+    /// Forget the speculative session of `path_id`, if any, and free its
+    /// AST on the worker unless `evict` is false (the worker lost it).
+    void drop_speculative(std::uint32_t path_id, bool evict = true);
+
+    /// Start the native file watcher if the platform and config allow it.
+    void open_file_watcher();
+
+    /// Drain the file watcher and feed its events into on_file_changed().
+    kota::task<> file_watch_task();
+
     kota::event_loop& loop;
 
-    /// Server-owned background tasks (cache checkpoint); cancelled and
-    /// joined in shutdown_and_cleanup().
+    /// Server-owned background tasks (cache checkpoint, file watching);
+    /// cancelled and joined in shutdown_and_cleanup().
     kota::task_group<> bg_tasks;
 
     Workspace workspace;
     llvm::DenseMap<std::uint32_t, std::shared_ptr<Session>> sessions;
+
+    /// Sessions compiled for predicted files, adopted by open_session();
+    /// `speculative_order` is oldest first.
+    llvm::DenseMap<std::uint32_t, std::shared_ptr<Session>> speculative_sessions;
+    std::deque<std::uint32_t> speculative_order;
+
+    NextFilePredictor predictor;
+
+    /// Files whose PCHs predict_next() warms.
+    constexpr static std::size_t predicted_files = 3;
+
+    /// The symbol predict_next() last looked up, so that hovering it again
+    /// does not repeat the lookup.
+    index::SymbolHash predicted_symbol = 0;
     WorkerPool pool;
     Compiler compiler;
     Indexer indexer;
@@ -122,7 +253,32 @@ private:
     ServerLifecycle lifecycle = ServerLifecycle::Uninitialized;
     std::string self_path;
     std::string workspace_root;
+
+    /// The compile_commands.json loaded at startup, and the key of the
+    /// dependency scan snapshot (empty without a cache store).
+    std::string cdb_path;
+    std::string scan_key;
+
+    /// Another configured compile_commands.json, loaded only once a file
+    /// under `root` (the project it builds) is opened.
+    struct CdbShard {
+        std::string path;
+        std::string root;
+        bool loaded = false;
+    };
+
+    std::vector<CdbShard> cdb_shards;
+
+    /// CDBs that changed or were requested during a lazy dependency crawl;
+    /// they are loaded once the crawl is done.
+    std::vector<std::string> cdb_reload_pending;
+
+    /// clice.toml changed while the project loaded or a crawl ran.
+    bool config_reload_pending = false;
     std::string session_log_dir;
+
+    /// The initializationOptions of the client, applied over every load
+    /// of clice.toml.
     std::string init_options_json;
 };
 
@@ -0,0 +1,64 @@
+#include "server/service/predictor.h"
+
+#include <algorithm>
+#include <tuple>
+
+namespace clice {
+
+void NextFilePredictor::record_open(std::uint32_t path_id) {
+    auto previous = std::exchange(last_opened, path_id);
+    if(!previous || *previous == path_id)
+        return;
+
+    if(successors.size() >= max_files && !successors.contains(*previous))
+        successors.clear();
+    auto& list = successors[*previous];
+    auto it = std::ranges::find(list, path_id, &std::pair<std::uint32_t, std::uint32_t>::first);
+    if(it != list.end()) {
+        it->second += 1;
+        return;
+    }
+    if(list.size() >= max_successors) {
+        list.erase(std::ranges::min_element(list, {}, [](auto& entry) { return entry.second; }));
+    }
+    list.emplace_back(path_id, 1);
+}
+
+std::vector<std::uint32_t>
+    NextFilePredictor::rank(std::uint32_t current,
+                            llvm::ArrayRef<std::uint32_t> definitions,
+                            llvm::ArrayRef<std::uint32_t> includes,
+                            std::size_t limit,
+                            llvm::function_ref<bool(std::uint32_t)> skip) const {
+    llvm::SmallDenseMap<std::uint32_t, std::uint32_t, 16> scores;
+    for(auto id: definitions)
+        scores[id] += definition_weight;
+    if(auto it = successors.find(current); it != successors.end()) {
+        // A habit counts for more than one jump, but never outweighs the
+        // symbol under the cursor by itself.
+        for(auto [id, count]: it->second)
+            scores[id] += history_weight * std::min<std::uint32_t>(count, 2);
+    }
+    for(auto id: includes)
+        scores[id] += include_weight;
+
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> ranked;
+    for(auto [id, score]: scores) {
+        if(id != current && !(skip && skip(id)))
+            ranked.emplace_back(id, score);
+    }
+    // Ties go to the lower path id, so the order does not depend on hashing.
+    std::ranges::sort(ranked, [](auto& lhs, auto& rhs) {
+        return std::tuple(rhs.second, lhs.first) < std::tuple(lhs.second, rhs.first);
+    });
+
+    std::vector<std::uint32_t> result;
+    for(auto& [id, score]: ranked) {
+        if(result.size() >= limit)
+            break;
+        result.push_back(id);
+    }
+    return result;
+}
+
+}  // namespace clice
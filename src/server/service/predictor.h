@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/SmallVector.h"
+
+namespace clice {
+
+/// Guesses which files the user opens next, so that their PCHs, and within
+/// a budget their ASTs, are built before the didOpen (see
+/// MasterServer::predict_next()).
+///
+/// Three signals are weighed, strongest first: the file defining the
+/// symbol under the cursor, the files opened after the current one
+/// before, and the project headers it includes.
+class NextFilePredictor {
+public:
+    /// Points per signal; a file named by several adds them up.
+    constexpr static std::uint32_t definition_weight = 4;
+    constexpr static std::uint32_t history_weight = 2;
+    constexpr static std::uint32_t include_weight = 1;
+
+    /// Learn that `path_id` was opened after the file opened before it.
+    void record_open(std::uint32_t path_id);
+
+    /// Up to `limit` candidates to follow `current`, best first.  Files
+    /// `skip` returns true for (those open already) are left out.
+    std::vector<std::uint32_t> rank(std::uint32_t current,
+                                    llvm::ArrayRef<std::uint32_t> definitions,
+                                    llvm::ArrayRef<std::uint32_t> includes,
+                                    std::size_t limit,
+                                    llvm::function_ref<bool(std::uint32_t)> skip = {}) const;
+
+private:
+    /// Files followed per file, with the times each did; the rarest makes
+    /// room for a new one.
+    constexpr static std::size_t max_successors = 8;
+
+    /// Files with a history kept; all is forgotten past it, which is rare
+    /// enough not to need a finer policy.
+    constexpr static std::size_t max_files = 4096;
+
+    std::optional<std::uint32_t> last_opened;
+    llvm::DenseMap<std::uint32_t,
+                   llvm::SmallVector<std::pair<std::uint32_t, std::uint32_t>, max_successors>>
+        successors;
+};
+
+}  // namespace clice
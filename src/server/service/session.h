@@ -1,5 +1,8 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <cstdint>
 #include <memory>
 #include <optional>
@@ -7,14 +10,20 @@
 #include <vector>
 
 #include "index/tu_index.h"
+#include "server/worker/edit_map.h"
 #include "server/workspace/workspace.h"
 
 #include "kota/async/async.h"
 #include "kota/ipc/lsp/position.h"
+#include "kota/ipc/lsp/protocol.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
 
 namespace clice {
 
+struct QueryBatch;
+
 /// An editing session for a single file opened in the editor.
 ///
 /// Design principle: open files are never depended upon by other files.
@@ -32,13 +41,66 @@ struct Session {
     /// LSP document version, incremented by the client on each edit.
     int version = 0;
 
+    /// Compiled ahead of its didOpen for a predicted file (see
+    /// MasterServer::speculate()): the text is the disk's, the diagnostics
+    /// are kept instead of published, and no client has it open yet.
+    bool speculative = false;
+
+    /// Number of connected clients that have the file open.  They share
+    /// this session, so the file is compiled once for all of them; the
+    /// session closes with the last one.
+    std::uint32_t clients = 1;
+
     /// Current buffer content (may differ from disk until saved).
     std::string text;
 
-    /// Byte offsets of each line start in `text`, built by `build_line_starts`.
-    /// Updated on didOpen and after every didChange.
+    /// Byte offsets of each line start in `text`, built by `build_line_starts`
+    /// on didOpen and kept up to date by `edit`.
     std::vector<std::uint32_t> line_starts;
 
+    /// Replace the whole buffer.
+    void set_text(std::string content) {
+        if(file_index) {
+            index_edits.push(0,
+                             static_cast<std::uint32_t>(text.size()),
+                             static_cast<std::uint32_t>(content.size()),
+                             version);
+        }
+        text = std::move(content);
+        line_starts = kota::ipc::lsp::build_line_starts(text);
+    }
+
+    /// Replace `length` bytes at `offset` by `replacement`.  Only the line
+    /// starts inside the edited span are recomputed, the ones after it are
+    /// shifted, so a keystroke does not rescan the whole file.
+    void edit(std::uint32_t offset, std::uint32_t length, llvm::StringRef replacement) {
+        if(file_index) {
+            index_edits.push(offset,
+                             length,
+                             static_cast<std::uint32_t>(replacement.size()),
+                             version);
+        }
+        text.replace(offset, length, replacement.data(), replacement.size());
+
+        // Lines starting in (offset, offset + length] began after a removed
+        // newline; those after the span move with it.
+        auto first = std::ranges::upper_bound(line_starts, offset);
+        auto last = std::upper_bound(first, line_starts.end(), offset + length);
+        auto delta = static_cast<std::uint32_t>(replacement.size()) - length;
+        for(auto it = last; it != line_starts.end(); ++it) {
+            *it += delta;
+        }
+
+        llvm::SmallVector<std::uint32_t> inserted;
+        for(std::size_t i = 0; i < replacement.size(); ++i) {
+            if(replacement[i] == '\n') {
+                inserted.push_back(offset + static_cast<std::uint32_t>(i) + 1);
+            }
+        }
+        auto at = line_starts.erase(first, last);
+        line_starts.insert(at, inserted.begin(), inserted.end());
+    }
+
     /// Construct a LineMap borrowing from this session's text and line_starts.
     kota::ipc::lsp::LineMap line_map() const {
         return kota::ipc::lsp::LineMap(text, line_starts);
@@ -51,6 +113,50 @@ struct Session {
     /// Whether the AST needs to be rebuilt before serving queries.
     bool ast_dirty = true;
 
+    /// When the buffer was last edited, and the moving average of the time
+    /// between edits while the user types (zero after a pause).  Compiles
+    /// wait for the typing to pause, see Compiler::debounce().
+    std::chrono::steady_clock::time_point last_edit;
+    std::chrono::milliseconds edit_interval{0};
+
+    /// Moving average of how long the worker took to compile this file.
+    std::chrono::milliseconds compile_time{0};
+
+    /// A compile for diagnostics is waiting for the typing to pause.
+    bool idle_compile = false;
+
+    /// Worker queries in flight per class (see Compiler::forward_query),
+    /// and an event set whenever one ends, for the queries of lower classes
+    /// waiting for them.
+    std::array<std::uint32_t, 3> queries_in_flight{};
+    kota::event query_finished;
+
+    /// Serial of the latest query of each worker::QueryKind; an older one
+    /// of a decoration kind that is still waiting is superseded by it.
+    llvm::SmallDenseMap<std::uint8_t, std::uint32_t> query_serials;
+
+    /// Decoration queries gathered for one worker message while its window
+    /// is open (see Compiler::send_query).
+    std::shared_ptr<QueryBatch> query_batch;
+
+    /// Record an edit made now, for the debounce of the next compile.
+    void note_edit() {
+        using namespace std::chrono;
+        auto now = steady_clock::now();
+        auto gap = duration_cast<milliseconds>(now - last_edit);
+        edit_interval = gap < seconds(1) ? (edit_interval * 3 + gap) / 4 : milliseconds(0);
+        last_edit = now;
+    }
+
+    /// No edit since the client opened or saved the buffer.  Only compiles
+    /// of such text are cached (see Workspace::compile_results).
+    bool unedited = true;
+
+    /// Version of `text` the owning stateful worker is known to hold, so
+    /// didChange can send edits and Compile can omit the text.  -1 when the
+    /// worker has no usable copy (not yet compiled, evicted, crashed).
+    int worker_synced_version = -1;
+
     /// Non-null while a compilation is in flight for this file.
     /// Other queries wait on the event; the compilation task itself
     /// runs independently and cannot be cancelled by LSP $/cancelRequest.
@@ -74,17 +180,65 @@ struct Session {
 
     std::shared_ptr<PendingCompile> compiling;
 
+    /// Cancel the Completion / SignatureHelp request in flight on a
+    /// stateless worker; the next request of the same kind supersedes it.
+    std::shared_ptr<kota::cancellation_source> completion_scope;
+    std::shared_ptr<kota::cancellation_source> signature_help_scope;
+
+    /// The last code completion a worker computed, kept so that requests
+    /// made while the user goes on typing the same identifier are answered
+    /// by narrowing it (see Compiler::handle_completion).
+    struct CompletionCache {
+        /// Buffer the items were computed on.
+        std::string text;
+
+        /// The identifier completed is [begin, end) of `text`; the prefix
+        /// the items were filtered by is [begin, offset).
+        std::uint32_t begin = 0;
+        std::uint32_t offset = 0;
+        std::uint32_t end = 0;
+
+        /// Items as ranked for the client; their `sort_text` is the score.
+        std::vector<kota::ipc::protocol::CompletionItem> items;
+    };
+
+    std::optional<CompletionCache> completion_cache;
+
+    /// The last compile found more top-level decls than
+    /// `project.large_file_decls` (see Compiler::lean()).
+    bool many_decls = false;
+
+    /// Semantic tokens were last answered from the lexer, before the first
+    /// AST; the client is asked to refresh them once it is built.
+    bool syntactic_tokens = false;
+
+    /// Diagnostics JSON last published for this file, the version it was
+    /// published for, and its result id (a hash of it; empty before the
+    /// first publish).  A recompile of the same version reproducing them is
+    /// not published again, and pull requests naming the id are answered
+    /// "unchanged".
+    std::string diagnostics;
+    std::string diagnostics_id;
+    int diagnostics_version = -1;
+
     /// Reference to the PCH entry in Workspace.pch_cache, if any.
     /// The PCH itself is owned by Workspace (shared, content-addressed);
     /// Session only stores enough to locate and validate it.
     struct PCHRef {
-        std::uint32_t path_id = 0;  ///< Key into Workspace.pch_cache.
-        std::string key;            ///< CacheStore key at build time.
-        std::uint32_t bound = 0;    ///< Preamble byte boundary.
+        std::string key;          ///< Key into Workspace.pch_cache and CacheStore.
+        std::uint32_t bound = 0;  ///< Preamble byte boundary.
     };
 
     std::optional<PCHRef> pch_ref;
 
+    /// DocumentLink[] JSON of the main-file directives, from the last
+    /// successful compile, and the full answer to documentLink: them and
+    /// the links of the PCH `document_links_pch` names.  The answer is
+    /// rebuilt when either changes.
+    std::string main_links;
+    std::string document_links;
+    std::string document_links_pch;
+
     /// Dependency snapshot from the last successful AST compilation.
     /// Used for two-layer staleness detection (mtime + content hash).
     std::optional<DepsSnapshot> ast_deps;
@@ -93,6 +247,11 @@ struct Session {
     /// Stores the host source file and synthesized preamble for this header.
     std::optional<HeaderFileContext> header_context;
 
+    /// Reset while a lazy dependency scan reaches this file (see
+    /// MasterServer::scan_opened()); compiles wait for it, as a header's
+    /// hosts come from the scan.
+    kota::event scanned{true};
+
     /// User-selected compilation context override (via clice/switchContext).
     /// When set, overrides automatic header context resolution.
     std::optional<std::uint32_t> active_context;
@@ -103,6 +262,11 @@ struct Session {
     /// data from background indexing.
     std::optional<index::FileIndex> file_index;
 
+    /// Edits made to `text` since `file_index` was built, so that queries
+    /// answered from it while the buffer is dirty land on the current text
+    /// (see Indexer::lookup_overlay()).  Cleared when a compile replaces it.
+    EditMap index_edits;
+
     /// Symbol table from the latest compilation, mapping symbol hashes to
     /// names and kinds.
     std::optional<index::SymbolTable> symbols;
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/xxhash.h"
+
+namespace clice {
+
+/// Compile arguments go to a worker in full once and by id after that.
+/// Files that build alike have commands differing only in the source file
+/// (the last argument) and the -main-file-name value; the rest, the
+/// template, is what the id names.  The master records per worker which
+/// templates it sent (ArgumentIds) and the worker keeps them
+/// (ArgumentCache), so a repeated dispatch carries an id and a short tail
+/// instead of the whole command.
+namespace argument_template {
+
+/// Error a worker answers with for a template it does not hold.
+inline constexpr llvm::StringLiteral unknown_error = "Unknown arguments template";
+
+/// Index of the -main-file-name value in `arguments`, if any.
+inline std::optional<std::size_t> main_file_slot(llvm::ArrayRef<std::string> arguments) {
+    for(std::size_t i = 0; i + 1 < arguments.size(); ++i) {
+        if(arguments[i] == "-main-file-name") {
+            return i + 1;
+        }
+    }
+    return std::nullopt;
+}
+
+/// Id of the template of `arguments` (not empty); never 0.
+inline std::uint64_t id(llvm::ArrayRef<std::string> arguments) {
+    auto slot = main_file_slot(arguments);
+    std::string input;
+    for(std::size_t i = 0; i + 1 < arguments.size(); ++i) {
+        if(i != slot) {
+            input += arguments[i];
+        }
+        input += '\0';
+    }
+    auto hash = llvm::xxh3_64bits(llvm::arrayRefFromStringRef(input));
+    // 0 means no template, and DenseSet reserves the largest two values.
+    return hash == 0 || hash >= ~std::uint64_t(1) ? 1 : hash;
+}
+
+}  // namespace argument_template
+
+/// Master side: the templates one worker process holds.  Reset with the
+/// process, since a respawned worker starts with an empty cache.
+class ArgumentIds {
+public:
+    /// Rewrite outgoing `arguments`: the first time a template is seen they
+    /// stay whole and are tagged with its `id` for the worker to keep; after
+    /// that only the tail is sent, with `known` set.  Past max_entries
+    /// templates, new ones go untagged so the worker's cache stays bounded.
+    void compact(std::uint64_t& id, bool& known, std::vector<std::string>& arguments) {
+        if(arguments.empty())
+            return;
+        auto template_id = argument_template::id(arguments);
+        if(sent.contains(template_id)) {
+            std::vector<std::string> tail{std::move(arguments.back())};
+            if(auto slot = argument_template::main_file_slot(arguments)) {
+                tail.push_back(std::move(arguments[*slot]));
+            }
+            arguments = std::move(tail);
+            id = template_id;
+            known = true;
+            return;
+        }
+        if(sent.size() < max_entries) {
+            sent.insert(template_id);
+            id = template_id;
+        }
+    }
+
+    void clear() {
+        sent.clear();
+    }
+
+    std::size_t size() const {
+        return sent.size();
+    }
+
+    constexpr static std::size_t max_entries = 2048;
+
+private:
+    llvm::DenseSet<std::uint64_t> sent;
+};
+
+/// Worker side: the templates sent so far, by id.
+class ArgumentCache {
+public:
+    /// The full arguments of a request: `arguments` themselves, kept as a
+    /// template when tagged with an `id`, or, when `known`, the template of
+    /// `id` completed with the tail in `arguments`.  Fails for a template
+    /// this process never received; the master then resends in full.
+    std::optional<std::vector<std::string>> resolve(std::uint64_t id,
+                                                    bool known,
+                                                    const std::vector<std::string>& arguments) {
+        if(id == 0) {
+            return arguments;
+        }
+        if(!known) {
+            if(!arguments.empty()) {
+                templates.try_emplace(id, arguments);
+            }
+            return arguments;
+        }
+
+        auto it = templates.find(id);
+        if(it == templates.end() || arguments.empty()) {
+            return std::nullopt;
+        }
+        auto result = it->second;
+        auto slot = argument_template::main_file_slot(result);
+        if(slot.has_value() != (arguments.size() == 2)) {
+            return std::nullopt;
+        }
+        if(slot) {
+            result[*slot] = arguments[1];
+        }
+        result.back() = arguments[0];
+        return result;
+    }
+
+    std::size_t size() const {
+        return templates.size();
+    }
+
+private:
+    llvm::DenseMap<std::uint64_t, std::vector<std::string>> templates;
+};
+
+}  // namespace clice
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <utility>
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+
+namespace clice {
+
+/// Maps byte offsets between a text and the text it became after a sequence
+/// of replacements.  The stateful worker keeps one per document so results
+/// computed on its last AST can be shown against the current buffer while a
+/// newer compile is still running.
+class EditMap {
+public:
+    struct Edit {
+        std::uint32_t offset = 0;
+        std::uint32_t length = 0;
+        std::uint32_t replacement = 0;
+
+        /// Document version the edit produced.
+        int version = 0;
+    };
+
+    /// Record that `length` bytes at `offset` (in the text as of the
+    /// previous edit) were replaced by `replacement` bytes.
+    void push(std::uint32_t offset, std::uint32_t length, std::uint32_t replacement, int version) {
+        edits.push_back({offset, length, replacement, version});
+    }
+
+    /// Forget the edits up to and including `version`; the map then starts
+    /// from the text at that version.
+    void drop_through(int version) {
+        auto it = edits.begin();
+        while(it != edits.end() && it->version <= version) {
+            ++it;
+        }
+        edits.erase(edits.begin(), it);
+    }
+
+    void clear() {
+        edits.clear();
+    }
+
+    bool empty() const {
+        return edits.empty();
+    }
+
+    /// Map an offset in the old text onto the new one.  Offsets strictly
+    /// inside a replaced region have no counterpart.
+    std::optional<std::uint32_t> to_new(std::uint32_t offset) const {
+        for(auto& edit: edits) {
+            if(offset <= edit.offset) {
+                continue;
+            }
+            if(offset < edit.offset + edit.length) {
+                return std::nullopt;
+            }
+            offset = offset - edit.length + edit.replacement;
+        }
+        return offset;
+    }
+
+    /// Map an offset in the new text back onto the old one.  Offsets strictly
+    /// inside replacement text have no counterpart.
+    std::optional<std::uint32_t> to_old(std::uint32_t offset) const {
+        for(auto it = edits.rbegin(); it != edits.rend(); ++it) {
+            if(offset <= it->offset) {
+                continue;
+            }
+            if(offset < it->offset + it->replacement) {
+                return std::nullopt;
+            }
+            offset = offset - it->replacement + it->length;
+        }
+        return offset;
+    }
+
+    /// Map a range whose text must be unchanged, such as a token: any edit
+    /// touching its interior, including an insertion, drops it.
+    std::optional<std::pair<std::uint32_t, std::uint32_t>> to_new_exact(std::uint32_t begin,
+                                                                        std::uint32_t end) const {
+        for(auto& edit: edits) {
+            if(end <= edit.offset) {
+                continue;
+            }
+            if(begin < edit.offset + edit.length) {
+                return std::nullopt;
+            }
+            begin = begin - edit.length + edit.replacement;
+            end = end - edit.length + edit.replacement;
+        }
+        return std::pair{begin, end};
+    }
+
+    /// The parts of the new text the replacements wrote, in order, merged
+    /// where they meet; a deletion leaves an empty range where it was.
+    llvm::SmallVector<std::pair<std::uint32_t, std::uint32_t>> touched() const {
+        llvm::SmallVector<std::pair<std::uint32_t, std::uint32_t>> ranges;
+        for(auto& edit: edits) {
+            auto removed_end = edit.offset + edit.length;
+            auto shift = [&](std::uint32_t position) {
+                return position - edit.length + edit.replacement;
+            };
+            std::pair merged{edit.offset, edit.offset + edit.replacement};
+            llvm::SmallVector<std::pair<std::uint32_t, std::uint32_t>> next;
+            for(auto [begin, end]: ranges) {
+                if(end < edit.offset) {
+                    next.emplace_back(begin, end);
+                } else if(begin > removed_end) {
+                    next.emplace_back(shift(begin), shift(end));
+                } else {
+                    merged.first = std::min(merged.first, begin);
+                    if(end > removed_end) {
+                        merged.second = std::max(merged.second, shift(end));
+                    }
+                }
+            }
+            next.push_back(merged);
+            llvm::sort(next);
+            ranges = std::move(next);
+        }
+        return ranges;
+    }
+
+private:
+    llvm::SmallVector<Edit> edits;
+};
+
+}  // namespace clice
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+
+namespace clice {
+
+/// Stateless workers keep the files they read across builds (a CachingFS
+/// per fs epoch) while the master's file watcher vouches for the disk.
+/// Each BuildParams carries the epoch and the paths changed since the one
+/// the worker last saw, which it drops when forking its cache for the new
+/// epoch.  Epoch 0 means nothing is vouched for: every read goes to disk.
+class FileChangeLog {
+public:
+    constexpr static std::size_t max_entries = 1024;
+
+    /// Begin vouching, once the watcher runs.
+    void start() {
+        if(current == 0 && !stopped) {
+            current = 1;
+            known_from = 1;
+        }
+    }
+
+    /// Stop for good: some file read may be outside what the watcher sees.
+    void stop() {
+        stopped = true;
+        current = 0;
+        entries.clear();
+    }
+
+    /// A change on disk to `path`.
+    void record(llvm::StringRef path) {
+        if(current == 0)
+            return;
+        current += 1;
+        entries.emplace_back(current, path.str());
+        if(entries.size() > max_entries) {
+            known_from = entries.front().first;
+            entries.pop_front();
+        }
+    }
+
+    /// Changes were lost: every cached file may be stale.
+    void reset() {
+        if(current == 0)
+            return;
+        current += 1;
+        known_from = current;
+        entries.clear();
+    }
+
+    std::uint64_t epoch() const {
+        return current;
+    }
+
+    /// Append the paths changed after epoch `since` to `out`.  False when
+    /// they are not all known any more, or `since` is 0: the worker's cache
+    /// is then to be dropped whole.
+    bool changes_since(std::uint64_t since, std::vector<std::string>& out) const {
+        if(since == 0 || since < known_from)
+            return false;
+        for(auto& [epoch, path]: entries) {
+            if(epoch > since)
+                out.push_back(path);
+        }
+        return true;
+    }
+
+private:
+    std::uint64_t current = 0;
+    /// Oldest epoch whose later changes are all in `entries`.
+    std::uint64_t known_from = 0;
+    bool stopped = false;
+    std::deque<std::pair<std::uint64_t, std::string>> entries;
+};
+
+}  // namespace clice
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+
+namespace clice {
+
+/// Directory prefixes to move paths by, for a remote executor that sees the
+/// workspace at other places than the master does (see
+/// WorkerPool::send_remote()).  A prefix matches whole path components, and
+/// the longest one that matches wins.
+class PathMap {
+public:
+    using Entries = std::vector<std::pair<std::string, std::string>>;
+
+    PathMap() = default;
+
+    explicit PathMap(const Entries& entries) {
+        for(auto& [from, to]: entries) {
+            add(from, to);
+        }
+    }
+
+    /// Parse `from=to` entries, as project.remote_path_map lists them;
+    /// those without a `=` are skipped.
+    static PathMap parse(const std::vector<std::string>& specs) {
+        PathMap map;
+        for(llvm::StringRef spec: specs) {
+            auto [from, to] = spec.split('=');
+            if(from.size() != spec.size()) {
+                map.add(from, to);
+            }
+        }
+        return map;
+    }
+
+    void add(llvm::StringRef from, llvm::StringRef to) {
+        from = from.rtrim('/');
+        to = to.rtrim('/');
+        if(from.empty()) {
+            return;
+        }
+        prefixes.emplace_back(from.str(), to.str());
+        std::ranges::stable_sort(prefixes, [](auto& lhs, auto& rhs) {
+            return lhs.first.size() > rhs.first.size();
+        });
+    }
+
+    bool empty() const {
+        return prefixes.empty();
+    }
+
+    const Entries& entries() const {
+        return prefixes;
+    }
+
+    /// The same prefixes the other way round, to map results back.
+    PathMap reversed() const {
+        PathMap map;
+        for(auto& [from, to]: prefixes) {
+            map.add(to, from);
+        }
+        return map;
+    }
+
+    /// `path` moved from under the longest matching prefix to the same
+    /// place under its replacement; unchanged when no prefix matches.
+    std::string map(llvm::StringRef path) const {
+        for(auto& [from, to]: prefixes) {
+            if(path.starts_with(from) && (path.size() == from.size() || path[from.size()] == '/')) {
+                return to + path.substr(from.size()).str();
+            }
+        }
+        return path.str();
+    }
+
+    /// Map the path a compile argument names, whole ("/x") or joined to
+    /// its option ("-I/x", "--sysroot=/x", "-fmodule-file=m=/x").
+    std::string map_argument(llvm::StringRef argument) const {
+        if(!argument.starts_with("-")) {
+            return map(argument);
+        }
+        auto split = argument.rfind('=');
+        if(split == llvm::StringRef::npos) {
+            split = argument.find('/');
+        } else {
+            split += 1;
+        }
+        if(split == llvm::StringRef::npos) {
+            return argument.str();
+        }
+        return argument.take_front(split).str() + map(argument.drop_front(split));
+    }
+
+private:
+    /// By decreasing length of the prefix.
+    Entries prefixes;
+};
+
+}  // namespace clice
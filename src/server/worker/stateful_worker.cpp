@@ -1,38 +1,117 @@
 #include "server/worker/stateful_worker.h"
 
+#include <algorithm>
 #include <atomic>
+#include <concepts>
 #include <cstdint>
+#include <format>
 #include <list>
 #include <memory>
+#include <optional>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 #include "compile/compilation.h"
 #include "feature/feature.h"
 #include "index/tu_index.h"
 #include "server/protocol/worker.h"
+#include "server/worker/argument_cache.h"
+#include "server/worker/edit_map.h"
 #include "server/worker/worker_common.h"
+#include "support/filesystem.h"
+#include "support/heap.h"
 #include "support/logging.h"
+#include "support/shared_blob.h"
 
 #include "kota/async/async.h"
 #include "kota/ipc/codec/bincode.h"
 #include "kota/ipc/peer.h"
 #include "kota/ipc/transport.h"
 #include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Process.h"
 #include "llvm/Support/raw_ostream.h"
 
 namespace clice {
 
+namespace protocol = kota::ipc::protocol;
+
 using kota::ipc::RequestResult;
 using RequestContext = kota::ipc::BincodePeer::RequestContext;
 
+/// Shared/exclusive lock for coroutines of one event loop.  A coroutine
+/// waiting for it exclusively keeps out shared holders that come after, so
+/// a stream of queries cannot starve a compile.
+class SharedStrand {
+public:
+    kota::task<> lock_shared() {
+        co_await exclusive.lock();
+        readers += 1;
+        idle.reset();
+        exclusive.unlock();
+    }
+
+    void unlock_shared() {
+        if(--readers == 0) {
+            idle.set();
+        }
+    }
+
+    kota::task<> lock() {
+        co_await exclusive.lock();
+        co_await idle.wait();
+        held = true;
+    }
+
+    void unlock() {
+        held = false;
+        exclusive.unlock();
+    }
+
+    /// Whether a compile or body reparse holds it.
+    bool locked() const {
+        return held;
+    }
+
+private:
+    kota::mutex exclusive;
+    bool held = false;
+    std::size_t readers = 0;
+    kota::event idle{true};
+};
+
 struct DocumentEntry {
     int version = 0;
     std::string text;
     bool has_ast = false;
     CompilationUnit unit{nullptr};
+
+    /// Footprint of `unit` in bytes, measured after each compile.
+    std::size_t memory_usage = 0;
     std::atomic<bool> dirty{false};
 
+    // Latest text known to the worker, kept current by DocumentUpdate edits
+    // so the master can skip resending it.  Only touched on the event loop,
+    // never by compile work on the thread pool; -1 means no usable copy.
+    std::string synced_text;
+    int synced_version = -1;
+
+    // Edits from the text `unit` was built from to synced_text, so stale
+    // queries can show the last AST's results against the current buffer.
+    // `edits_from` is the version the recorded chain starts at, -1 once the
+    // chain is lost; it is usable while it does not start after the AST.
+    EditMap edits;
+    int edits_from = -1;
+    int ast_version = -1;
+
+    // Serializes readers of `unit` with each other and with the swap at the
+    // end of a compile.  Stale queries take only this, not the strand, so
+    // they are not queued behind the compile that holds it.  Readers cannot
+    // share it: clang deserializes the AST from the PCH on demand and fills
+    // caches in ASTContext and SourceManager as it is read, and the unit's
+    // own accessors cache paths, line starts and symbol hashes.
+    kota::mutex unit_lock;
+
     // Signaled when the first compilation completes (has_ast becomes true).
     // Feature handlers co_await this before accessing the AST.
     kota::event ast_ready{false};
@@ -43,20 +122,394 @@ struct DocumentEntry {
     std::pair<std::string, uint32_t> pch;
     llvm::StringMap<std::string> pcms;
 
-    // Per-document serialization mutex
-    kota::mutex strand;
+    // Stats and reads of the last compile, reused by the next one while the
+    // master reports its dependencies unchanged and the context above stays
+    // the same.  Clang's PCH input validation and header lookups then hit
+    // memory, so a body edit costs little more than reparsing the main file.
+    llvm::IntrusiveRefCntPtr<CachingFS> fs;
+    // Dependencies of the last completed compile, as reported to the master.
+    std::vector<std::string> deps;
+
+    // Lazy function bodies: whether compiles skip main-file bodies, the
+    // bodies the current AST skipped (in `text`), and the ones queries and
+    // edits asked for (in `synced_text`, moved along by DocumentUpdate).
+    bool skip_bodies = false;
+    std::vector<LocalSourceRange> skipped_bodies;
+    std::vector<LocalSourceRange> parsed_bodies;
+
+    // The semantic tokens last sent, encoded, and their result id: what
+    // delta requests are answered against.  Guarded by unit_lock.
+    std::vector<std::uint32_t> tokens;
+    std::string tokens_id;
+
+    // The document-wide query results of `unit`, encoded: the first of
+    // these queries after a compile computes them all in one job, while the
+    // AST is hot, and the editor's follow-up queries are answered from
+    // here.  Guarded by unit_lock; `current` is cleared by every AST swap.
+    struct {
+        bool current = false;
+        std::vector<std::uint32_t> tokens;
+        kota::codec::RawValue symbols;
+        kota::codec::RawValue folding;
+    } features;
+
+    // Documentation hovered on `unit`.  Guarded by unit_lock, cleared with
+    // every AST swap.
+    feature::HoverCache hover;
+
+    // Inlay hints of `unit` for the viewports asked so far; a scrolled one
+    // only computes what it adds.  Guarded by unit_lock, cleared with every
+    // AST swap.
+    feature::InlayHintCache inlay_hints;
+
+    // The main-file clang-tidy results of `unit`, with their notes, in
+    // `text`; unset when its compile did not run clang-tidy.  An
+    // incremental compile carries them over for the decls it leaves alone.
+    std::optional<std::vector<Diagnostic>> tidy;
+
+    // Held exclusively by compiles and body reparses, shared by queries: a
+    // query waits for the compile in flight, but not for other queries.
+    SharedStrand strand;
+};
+
+/// What an evicted document's next compile can reuse, kept once its AST is
+/// dropped: the last compile's text and context, its cached file-system
+/// reads and dependencies, and its clang-tidy results.  The AST itself
+/// cannot be kept in less memory than it takes, and clang's AST files do
+/// not carry the token buffer and directives features read from a unit.
+struct Hibernated {
+    std::string text;
+    std::string directory;
+    std::vector<std::string> arguments;
+    std::pair<std::string, uint32_t> pch;
+    llvm::StringMap<std::string> pcms;
+    llvm::IntrusiveRefCntPtr<CachingFS> fs;
+    std::vector<std::string> deps;
+    bool skip_bodies = false;
+    std::vector<LocalSourceRange> parsed_bodies;
+    std::optional<std::vector<Diagnostic>> tidy;
+
+    /// Order of hibernation, the oldest being dropped first.
+    std::uint64_t sequence = 0;
+
+    /// What the entry holds, file contents of `fs` included, measured when
+    /// it is hibernated.  A fork of `fs` shares its buffers, so this is an
+    /// upper bound.
+    std::size_t bytes = 0;
+
+    std::size_t measure() const {
+        std::size_t total = text.size() + directory.size() + pch.first.size();
+        for(auto& argument: arguments) {
+            total += argument.size();
+        }
+        for(auto& entry: pcms) {
+            total += entry.getKeyLength() + entry.second.size();
+        }
+        for(auto& dep: deps) {
+            total += dep.size();
+        }
+        total += parsed_bodies.size() * sizeof(LocalSourceRange);
+        if(tidy) {
+            total += tidy->size() * sizeof(Diagnostic);
+        }
+        if(fs) {
+            total += fs->size_in_bytes();
+        }
+        return total;
+    }
 };
 
+/// Map a range of the last AST's text onto the current buffer; fails if
+/// either end falls inside an edit.
+static std::optional<LocalSourceRange> remap(const EditMap& edits, LocalSourceRange range) {
+    auto begin = edits.to_new(range.begin);
+    auto end = edits.to_new(range.end);
+    if(!begin || !end || *begin > *end) {
+        return std::nullopt;
+    }
+    return LocalSourceRange{*begin, *end};
+}
+
+/// Remap a symbol tree in place, dropping symbols (with their children)
+/// whose ranges were edited away.
+static void remap(const EditMap& edits, std::vector<feature::DocumentSymbol>& symbols) {
+    std::erase_if(symbols, [&](feature::DocumentSymbol& symbol) {
+        auto range = remap(edits, symbol.range);
+        auto selection = remap(edits, symbol.selection_range);
+        if(!range || !selection) {
+            return true;
+        }
+        symbol.range = *range;
+        symbol.selection_range = *selection;
+        remap(edits, symbol.children);
+        return false;
+    });
+}
+
+/// Answer a semantic tokens request with `data` and keep it as the
+/// document's last result.  A delta request (`previous` is the id of that
+/// result) gets edits; a full one, or one against a result since replaced,
+/// gets all of `data`.
+/// A query result as the master gets it; an empty one is "null".
+template <typename T>
+static kota::codec::RawValue encode(const std::optional<T>& value) {
+    return value ? to_raw(*value) : kota::codec::RawValue{"null"};
+}
+
+template <typename T>
+static kota::codec::RawValue encode(const T& value) {
+    return to_raw(value);
+}
+
+static kota::codec::RawValue reply_tokens(DocumentEntry& doc,
+                                          std::vector<std::uint32_t> data,
+                                          llvm::StringRef previous) {
+    bool delta = !previous.empty() && previous == doc.tokens_id;
+    std::vector<protocol::SemanticTokensEdit> edits;
+    if(doc.tokens_id.empty() || data != doc.tokens) {
+        if(delta) {
+            edits = feature::semantic_tokens_edits(doc.tokens, data);
+        }
+        // Unique across workers: a document may migrate between them.
+        static std::atomic<std::uint64_t> serial = 0;
+        doc.tokens = std::move(data);
+        doc.tokens_id = std::format("{}.{}", llvm::sys::Process::getProcessId(), ++serial);
+    }
+
+    if(delta) {
+        protocol::SemanticTokensDelta result;
+        result.result_id = doc.tokens_id;
+        result.edits = std::move(edits);
+        return to_raw(result);
+    }
+    protocol::SemanticTokens result;
+    result.result_id = doc.tokens_id;
+    result.data = doc.tokens;
+    return to_raw(result);
+}
+
+/// Fill doc.features from the current AST unless they are of it already.
+static void collect_features(DocumentEntry& doc) {
+    if(doc.features.current) {
+        return;
+    }
+    ScopedTimer timer;
+    constexpr auto encoding = feature::PositionEncoding::UTF16;
+    auto& features = doc.features;
+    features.tokens = std::move(feature::semantic_tokens(doc.unit, encoding).data);
+    features.symbols = to_raw(feature::document_symbols(doc.unit, encoding));
+    features.folding = to_raw(feature::folding_ranges(doc.unit, encoding));
+    features.current = true;
+    LOG_DEBUG("Collected document features: {}ms", timer.ms());
+}
+
+/// Most recent body ranges a document keeps parsed; older ones are
+/// skipped again by the next compile.
+constexpr std::size_t max_parsed_bodies = 64;
+
+/// Add `range` to the parsed bodies, merged with one it overlaps.
+static void add_parsed_body(DocumentEntry& doc, LocalSourceRange range) {
+    auto& bodies = doc.parsed_bodies;
+    for(auto it = bodies.begin(); it != bodies.end(); ++it) {
+        if(it->intersects(range)) {
+            range = {std::min(range.begin, it->begin), std::max(range.end, it->end)};
+            bodies.erase(it);
+            break;
+        }
+    }
+    if(bodies.size() >= max_parsed_bodies) {
+        bodies.erase(bodies.begin());
+    }
+    bodies.push_back(range);
+}
+
+/// Move ranges across the replacement of `length` bytes at `offset`; a
+/// range overlapping the replaced text grows to cover its replacement.
+static void shift_ranges(std::vector<LocalSourceRange>& ranges,
+                         std::uint32_t offset,
+                         std::uint32_t length,
+                         std::uint32_t replacement) {
+    auto shift = [&](std::uint32_t position, bool end) {
+        if(position <= offset) {
+            return position;
+        }
+        if(position >= offset + length) {
+            return position - length + replacement;
+        }
+        return end ? offset + replacement : offset;
+    };
+    for(auto& range: ranges) {
+        range = {shift(range.begin, false), shift(range.end, true)};
+    }
+}
+
+/// Plan an incremental clang-tidy run over `synced_text`: the ranges edited
+/// since the current AST, and that AST's results moved past the edits, with
+/// those an edit went through dropped.  Leaves `ranges` unset, for a full
+/// run, when the results or the edit chain are missing.
+static void plan_tidy(const DocumentEntry& doc,
+                      std::optional<std::vector<LocalSourceRange>>& ranges,
+                      std::vector<Diagnostic>& reused) {
+    if(!doc.has_ast || !doc.tidy || doc.edits_from == -1 || doc.edits_from > doc.ast_version) {
+        return;
+    }
+
+    ranges.emplace();
+    for(auto [begin, end]: doc.edits.touched()) {
+        ranges->push_back({begin, end});
+    }
+
+    // Notes go with their diagnostic.
+    bool keep = false;
+    for(auto& diag: *doc.tidy) {
+        auto range = diag.range.valid() ? remap(doc.edits, diag.range) : std::nullopt;
+        if(diag.id.level != DiagnosticLevel::Note) {
+            keep = range.has_value();
+        }
+        if(keep && range) {
+            reused.push_back(diag);
+            reused.back().range = *range;
+        }
+    }
+}
+
+/// Parameters to compile the document's `text` in its current context.
+static CompilationParams content_params(DocumentEntry& doc, llvm::StringRef path) {
+    CompilationParams cp;
+    cp.kind = CompilationKind::Content;
+    cp.vfs = doc.fs;
+    fill_args(cp, doc.directory, doc.arguments);
+    if(!doc.pch.first.empty()) {
+        cp.pch = doc.pch;
+    }
+    cp.add_remapped_file(path, doc.text);
+    for(auto& entry: doc.pcms) {
+        cp.pcms.try_emplace(entry.getKey(), entry.getValue());
+    }
+    cp.skip_bodies = doc.skip_bodies;
+    // Every feature of an opened file reads the directives of that file.
+    cp.directive_scope = DirectiveScope::MainFile;
+    return cp;
+}
+
+/// Whether a compile or completion with `params` and the full `arguments`
+/// runs in the same context (directory, flags, PCH and PCMs) as the
+/// document's previous compile.
+template <typename Params>
+static bool same_context(const DocumentEntry& doc,
+                         const Params& params,
+                         const std::vector<std::string>& arguments) {
+    if(doc.directory != params.directory || doc.arguments != arguments ||
+       doc.pch != params.pch || doc.pcms.size() != params.pcms.size()) {
+        return false;
+    }
+    for(auto& [name, pcm_path]: params.pcms) {
+        auto it = doc.pcms.find(name);
+        if(it == doc.pcms.end() || it->second != pcm_path) {
+            return false;
+        }
+    }
+    return true;
+}
+
 class StatefulWorker {
     kota::ipc::BincodePeer& peer;
     std::uint64_t memory_limit;
 
+    /// Feature precomputation started after compiles.
+    kota::task_group<> background;
+
     llvm::StringMap<std::shared_ptr<DocumentEntry>> documents;
 
+    /// Argument templates the master sent, shared by all documents.
+    ArgumentCache argument_cache;
+
+    /// What the requests used, for clice/worker/usage.
+    UsageLedger ledger;
+
     // LRU tracking — owns keys so they don't dangle after request handler returns
     std::list<std::string> lru;
     llvm::StringMap<std::list<std::string>::iterator> lru_index;
 
+    /// Evicted documents' reusable compile state, at most max_hibernated,
+    /// and the bytes it holds, which count toward memory_limit.
+    llvm::StringMap<Hibernated> hibernated;
+    std::size_t hibernated_bytes = 0;
+    std::uint64_t hibernations = 0;
+    constexpr static std::size_t max_hibernated = 32;
+
+    void forget(llvm::StringMap<Hibernated>::iterator it) {
+        hibernated_bytes -= it->second.bytes;
+        hibernated.erase(it);
+    }
+
+    void forget(llvm::StringRef path) {
+        if(auto it = hibernated.find(path); it != hibernated.end()) {
+            forget(it);
+        }
+    }
+
+    /// Drop the oldest hibernated entry; its bytes, zero if there is none.
+    std::size_t forget_oldest() {
+        if(hibernated.empty()) {
+            return 0;
+        }
+        auto oldest = hibernated.begin();
+        for(auto it = hibernated.begin(); it != hibernated.end(); ++it) {
+            if(it->second.sequence < oldest->second.sequence) {
+                oldest = it;
+            }
+        }
+        auto bytes = oldest->second.bytes;
+        forget(oldest);
+        return bytes;
+    }
+
+    void hibernate(llvm::StringRef path, DocumentEntry& doc) {
+        if(!doc.fs || doc.deps.empty()) {
+            return;
+        }
+        forget(path);
+        if(hibernated.size() >= max_hibernated) {
+            forget_oldest();
+        }
+
+        auto& entry = hibernated[path];
+        entry.text = std::move(doc.text);
+        entry.directory = std::move(doc.directory);
+        entry.arguments = std::move(doc.arguments);
+        entry.pch = std::move(doc.pch);
+        entry.pcms = std::move(doc.pcms);
+        entry.fs = std::move(doc.fs);
+        entry.deps = std::move(doc.deps);
+        entry.skip_bodies = doc.skip_bodies;
+        entry.parsed_bodies = std::move(doc.parsed_bodies);
+        entry.tidy = std::move(doc.tidy);
+        entry.sequence = ++hibernations;
+        entry.bytes = entry.measure();
+        hibernated_bytes += entry.bytes;
+    }
+
+    void restore(llvm::StringRef path, DocumentEntry& doc) {
+        auto it = hibernated.find(path);
+        if(it == hibernated.end()) {
+            return;
+        }
+        auto& entry = it->second;
+        doc.text = std::move(entry.text);
+        doc.directory = std::move(entry.directory);
+        doc.arguments = std::move(entry.arguments);
+        doc.pch = std::move(entry.pch);
+        doc.pcms = std::move(entry.pcms);
+        doc.fs = std::move(entry.fs);
+        doc.deps = std::move(entry.deps);
+        doc.skip_bodies = entry.skip_bodies;
+        doc.parsed_bodies = std::move(entry.parsed_bodies);
+        doc.tidy = std::move(entry.tidy);
+        forget(it);
+        LOG_DEBUG("Restored hibernated document: {}", path);
+    }
+
     void touch_lru(llvm::StringRef path) {
         auto it = lru_index.find(path);
         if(it != lru_index.end()) {
@@ -66,17 +519,70 @@ class StatefulWorker {
         lru_index[path] = lru.begin();
     }
 
-    void shrink_if_over_limit() {
-        // TODO: Implement memory-based eviction using memory_limit.
-        // For now, cap at a fixed number of documents.
-        while(documents.size() > 16 && !lru.empty()) {
-            auto path = lru.back();
-            lru.pop_back();
+    /// Sum of the last measured AST footprint of every resident document,
+    /// and of what hibernated documents hold.
+    std::size_t total_memory() const {
+        std::size_t total = hibernated_bytes;
+        for(auto& entry: documents) {
+            total += entry.second->memory_usage;
+        }
+        return total;
+    }
+
+    /// Evict least-recently-used documents until the resident ASTs fit in
+    /// memory_limit.  `keep` (the document that was just compiled) is never
+    /// evicted, otherwise the very next query would recompile it.  Entries
+    /// that have not finished a compile yet hold no AST and free nothing.
+    /// What the next compile of an evicted document reuses is hibernated,
+    /// unless a compile is rewriting it; hibernated state is dropped, the
+    /// oldest first, when evicting ASTs was not enough.
+    void shrink_if_over_limit(llvm::StringRef keep) {
+        auto total = total_memory();
+        bool evicted = false;
+        auto it = lru.end();
+        while(total > memory_limit && it != lru.begin()) {
+            --it;
+            if(*it == keep) {
+                continue;
+            }
+
+            auto doc_it = documents.find(*it);
+            auto usage = doc_it != documents.end() ? doc_it->second->memory_usage : 0;
+            if(doc_it != documents.end() && usage == 0) {
+                continue;
+            }
+
+            auto path = std::move(*it);
             lru_index.erase(path);
-            LOG_DEBUG("Evicting document: {}", path);
-            peer.send_notification(worker::EvictedParams{std::string(path)});
+            it = lru.erase(it);
+            total -= usage;
+
+            LOG_INFO("Evicting document: {} ({}MB, resident {}MB / limit {}MB)",
+                     path,
+                     usage / (1024 * 1024),
+                     total / (1024 * 1024),
+                     memory_limit / (1024 * 1024));
+            peer.send_notification(worker::EvictedParams{path});
+            if(doc_it != documents.end() && !doc_it->second->strand.locked()) {
+                auto before = hibernated_bytes;
+                hibernate(path, *doc_it->second);
+                total = total - before + hibernated_bytes;
+            }
             documents.erase(path);
+            evicted = true;
         }
+        while(total > memory_limit && !hibernated.empty()) {
+            total -= forget_oldest();
+        }
+        if(evicted) {
+            background.spawn(trim_heap());
+        }
+    }
+
+    /// Hand the memory of dropped ASTs back to the system.  One still held
+    /// by a request in flight is freed later, and trimmed with the next.
+    kota::task<> trim_heap() {
+        co_await kota::queue([] { heap::trim(); });
     }
 
     std::shared_ptr<DocumentEntry> get_or_create(llvm::StringRef path) {
@@ -84,14 +590,20 @@ class StatefulWorker {
         if(inserted) {
             it->second = std::make_shared<DocumentEntry>();
             LOG_DEBUG("Created new document entry: {}", path.str());
+            restore(path, *it->second);
         }
         return it->second;
     }
 
-    /// Look up document, wait for AST, lock strand, run fn(doc) on thread pool, unlock.
-    /// Returns "null" if document not found or AST not usable.
+    /// Look up document, wait for AST, share the strand, run fn(doc) on the
+    /// thread pool under unit_lock.  A result other than a RawValue is
+    /// serialized after unit_lock is released, alongside the next query's
+    /// AST work.  Returns "null" if document not found or AST not usable.
+    /// The work on the pool is added to `cost`.
     template <typename F>
-    kota::task<kota::codec::RawValue> with_ast(llvm::StringRef path, F&& fn) {
+    kota::task<kota::codec::RawValue> with_ast(usage::Sample& cost, llvm::StringRef path, F&& fn) {
+        using T = std::invoke_result_t<F&, DocumentEntry&>;
+
         auto it = documents.find(path);
         if(it == documents.end()) {
             co_return kota::codec::RawValue{"null"};
@@ -102,111 +614,382 @@ class StatefulWorker {
         touch_lru(path);
 
         co_await doc->ast_ready.wait();
-        co_await doc->strand.lock();
+        co_await doc->strand.lock_shared();
+        co_await doc->unit_lock.lock();
 
-        auto result = co_await kota::queue([&]() -> kota::codec::RawValue {
+        auto result = co_await kota::queue([&]() -> std::optional<T> {
+            usage::Meter meter(cost);
             if(!doc->has_ast || (!doc->unit.completed() && !doc->unit.fatal_error()))
-                return kota::codec::RawValue{"null"};
+                return std::nullopt;
             return fn(*doc);
         });
+        doc->unit_lock.unlock();
+
+        kota::codec::RawValue raw{"null"};
+        if(auto& value = result.value()) {
+            if constexpr(std::same_as<T, kota::codec::RawValue>) {
+                raw = std::move(*value);
+            } else {
+                auto encoded = co_await kota::queue([&] {
+                    usage::Meter meter(cost);
+                    return encode(*value);
+                });
+                raw = std::move(encoded.value());
+            }
+        }
+        doc->strand.unlock_shared();
+        co_return raw;
+    }
+
+    /// Lazy function bodies: before a query reads `range`, reparse with the
+    /// bodies there that the current AST skipped.  They join the parsed set,
+    /// so later compiles keep them.  Skipped when the text has moved past
+    /// the AST; the compile of the newer version is on its way.
+    kota::task<> parse_bodies(usage::Sample& cost, llvm::StringRef path, LocalSourceRange range) {
+        auto it = documents.find(path);
+        if(it == documents.end() || it->second->skipped_bodies.empty()) {
+            co_return;
+        }
+        auto doc = it->second;
 
+        co_await doc->strand.lock();
+        bool missing = false;
+        if(doc->synced_version == doc->version) {
+            for(auto& body: doc->skipped_bodies) {
+                if(body.intersects(range)) {
+                    add_parsed_body(*doc, body);
+                    missing = true;
+                }
+            }
+        }
+        if(!missing) {
+            doc->strand.unlock();
+            co_return;
+        }
+
+        auto parsed_bodies = doc->parsed_bodies;
+        CompilationUnit unit{nullptr};
+        std::size_t memory_usage = 0;
+        co_await kota::queue([&]() {
+            usage::Meter meter(cost);
+            ScopedTimer timer;
+            auto cp = content_params(*doc, path);
+            cp.parsed_bodies = std::move(parsed_bodies);
+            unit = compile(cp);
+            memory_usage = unit.memory_usage();
+            LOG_INFO("Parsed skipped bodies: path={}, {}ms", path, timer.ms());
+        });
+
+        if(unit.completed()) {
+            co_await doc->unit_lock.lock();
+            std::swap(doc->unit, unit);
+            doc->memory_usage = memory_usage;
+            doc->skipped_bodies = doc->unit.skipped_bodies().vec();
+            doc->features.current = false;
+            doc->hover.clear();
+            doc->inlay_hints.clear();
+            doc->unit_lock.unlock();
+        }
+        co_await kota::queue([&]() {
+            usage::Meter meter(cost);
+            unit = CompilationUnit{nullptr};
+        });
         doc->strand.unlock();
-        co_return result.value();
     }
 
+    /// Run fn(doc, edits, text) against the AST the document already holds,
+    /// without waiting for a compile in flight.  `edits` maps the AST's text
+    /// onto `text`, the worker's copy at `version`.  Fails when there is no
+    /// AST yet or the edit chain since it is lost, or when fn cannot map
+    /// the request; the master then falls back to a fresh compile.  The
+    /// work on the pool is added to `cost`.
+    template <typename F>
+    RequestResult<worker::QueryParams>
+        with_last_ast(usage::Sample& cost, llvm::StringRef path, int version, F&& fn) {
+        auto fail = [] {
+            return kota::outcome_error(kota::ipc::Error{"No AST to serve a stale query"});
+        };
+
+        auto it = documents.find(path);
+        if(it == documents.end()) {
+            co_return fail();
+        }
+        auto doc = it->second;
+        touch_lru(path);
+
+        co_await doc->unit_lock.lock();
+
+        // Check after locking: a compile may have swapped the AST meanwhile.
+        if(!doc->has_ast || doc->synced_version != version || doc->edits_from == -1 ||
+           doc->edits_from > doc->ast_version) {
+            doc->unit_lock.unlock();
+            co_return fail();
+        }
+
+        // DocumentUpdates may extend the map and text on the event loop
+        // while fn runs on the thread pool: hand it copies.
+        auto edits = doc->edits;
+        auto text = doc->synced_text;
+        auto result = co_await kota::queue([&]() -> std::optional<kota::codec::RawValue> {
+            usage::Meter meter(cost);
+            if(!doc->unit.completed() && !doc->unit.fatal_error())
+                return std::nullopt;
+            return fn(*doc, edits, llvm::StringRef(text));
+        });
+
+        doc->unit_lock.unlock();
+        if(!result.value()) {
+            co_return fail();
+        }
+        co_return std::move(*result.value());
+    }
+
+    /// Compute the document-wide query results of a fresh AST off the
+    /// request path, so the queries that follow a compile find them ready.
+    kota::task<> precompute_features(std::shared_ptr<DocumentEntry> doc) {
+        UsageScope scope{ledger, "PrecomputeFeatures"};
+        co_await doc->unit_lock.lock();
+        co_await kota::queue([&]() {
+            usage::Meter meter(scope.cost);
+            if(doc->has_ast && (doc->unit.completed() || doc->unit.fatal_error())) {
+                collect_features(*doc);
+            }
+        });
+        doc->unit_lock.unlock();
+    }
+
+    /// Answer one AST query, for the Query and QueryBatch handlers.
+    RequestResult<worker::QueryParams> query(const worker::QueryParams& params);
+
 public:
-    StatefulWorker(kota::ipc::BincodePeer& peer, std::uint64_t memory_limit) :
-        peer(peer), memory_limit(memory_limit) {}
+    StatefulWorker(kota::event_loop& loop,
+                   kota::ipc::BincodePeer& peer,
+                   std::uint64_t memory_limit) :
+        peer(peer), memory_limit(memory_limit), background(loop) {}
 
     void register_handlers();
 };
 
 void StatefulWorker::register_handlers() {
+    usage_on_request(peer, ledger);
+
     // === Compile ===
     peer.on_request(
         [this](RequestContext& ctx,
                const worker::CompileParams& params) -> RequestResult<worker::CompileParams> {
-            LOG_INFO("Compile request: path={}, version={}", params.path, params.version);
+            trace::Span span("Compile", params.path);
+            UsageScope scope{ledger, "Compile"};
+            LOG_INFO("Compile request: path={}, version={}{}",
+                     params.path,
+                     params.version,
+                     params.synced ? " (synced)" : "");
+
+            auto arguments = argument_cache.resolve(params.arguments_id,
+                                                    params.arguments_known,
+                                                    params.arguments);
+            if(!arguments) {
+                co_return kota::outcome_error(
+                    kota::ipc::Error{std::string(argument_template::unknown_error)});
+            }
 
             // Hold shared_ptr so Evict can't destroy the entry mid-compile.
             auto doc = get_or_create(params.path);
             touch_lru(params.path);
 
+            // Resolve the text before suspending: later DocumentUpdates may
+            // advance synced_text while we wait for the strand.
+            std::string text;
+            if(params.synced) {
+                if(doc->synced_version != params.version) {
+                    LOG_INFO("Compile out of sync: path={}, have v{}, want v{}",
+                             params.path,
+                             doc->synced_version,
+                             params.version);
+                    worker::CompileResult result;
+                    result.version = params.version;
+                    result.out_of_sync = true;
+                    co_return result;
+                }
+                text = doc->synced_text;
+            } else {
+                // The parsed bodies were placed in the previous text; keep
+                // them as a hint, the next query corrects what they miss.
+                text = params.text;
+                doc->synced_text = params.text;
+                doc->synced_version = params.version;
+                doc->edits.clear();
+                doc->edits_from = params.version;
+            }
+
+            // Same coordinates as `text`: DocumentUpdates keep moving the
+            // document's list while we wait for the strand.
+            auto parsed_bodies = doc->parsed_bodies;
+
+            // Likewise planned against `text`, from the edits as they are now.
+            std::optional<std::vector<LocalSourceRange>> tidy_ranges;
+            std::vector<Diagnostic> tidy_reused;
+            if(params.clang_tidy && params.incremental_tidy && params.synced) {
+                plan_tidy(*doc, tidy_ranges, tidy_reused);
+            }
+
             co_await doc->strand.lock();
 
+            bool reuse_fs =
+                params.deps_fresh && doc->fs && same_context(*doc, params, *arguments);
+            if(!reuse_fs) {
+                doc->fs = new CachingFS();
+                // Headers or flags changed, so every decl may report anew.
+                tidy_ranges.reset();
+                tidy_reused.clear();
+            } else {
+                // Unchanged dependencies say nothing of paths that were
+                // missing: a header created on an include path since must
+                // be found, so the reused cache forgets failed lookups.
+                doc->fs = doc->fs->fork({});
+                if(!doc->has_ast && doc->tidy && doc->text == text && params.clang_tidy &&
+                   params.incremental_tidy) {
+                    // Back from hibernation unchanged: clang-tidy has nothing
+                    // new to say about any of its decls.
+                    tidy_ranges.emplace();
+                    tidy_reused = *doc->tidy;
+                }
+            }
+
             // Copy params to doc AFTER acquiring the strand lock, so that
             // concurrent Compile requests waiting on the strand don't
             // overwrite our fields before we use them.
             doc->version = params.version;
-            doc->text = params.text;
+            doc->text = std::move(text);
             doc->directory = params.directory;
-            doc->arguments = params.arguments;
+            doc->arguments = std::move(*arguments);
             doc->pch = params.pch;
+            doc->skip_bodies = params.skip_bodies;
             doc->pcms.clear();
             for(auto& [name, pcm_path]: params.pcms) {
                 doc->pcms.try_emplace(name, pcm_path);
             }
 
+            // Build into a local unit so stale queries can keep reading the
+            // previous one until the swap below.
+            CompilationUnit unit{nullptr};
+            std::optional<std::vector<Diagnostic>> tidy;
             auto compile_result = co_await kota::queue([&]() -> worker::CompileResult {
+                usage::Meter meter(scope.cost);
                 ScopedTimer timer;
 
-                CompilationParams cp;
-                cp.kind = CompilationKind::Content;
-                fill_args(cp, doc->directory, doc->arguments);
-                if(!doc->pch.first.empty()) {
-                    cp.pch = doc->pch;
-                }
-                cp.add_remapped_file(params.path, doc->text);
-                for(auto& entry: doc->pcms) {
-                    cp.pcms.try_emplace(entry.getKey(), entry.getValue());
-                }
+                auto cp = content_params(*doc, params.path);
+                cp.parsed_bodies = std::move(parsed_bodies);
+                cp.clang_tidy = params.clang_tidy;
+                cp.tidy_ranges = std::move(tidy_ranges);
+                cp.tidy_reused = std::move(tidy_reused);
+                cp.time_trace = params.time_trace;
 
-                doc->unit = compile(cp);
-                doc->has_ast = true;
+                unit = compile(cp);
+                doc->memory_usage = unit.memory_usage();
                 doc->dirty.store(false, std::memory_order_release);
 
                 worker::CompileResult result;
                 result.version = doc->version;
-                if(doc->unit.completed() || doc->unit.fatal_error()) {
-                    auto diags = feature::diagnostics(doc->unit);
-                    auto json = kota::codec::json::to_json<kota::ipc::lsp_config>(diags);
-                    result.diagnostics = kota::codec::RawValue{json ? std::move(*json) : "[]"};
-                    LOG_INFO("Compile done: path={}, {}ms, {} diags, fatal={}",
+                if(unit.completed() || unit.fatal_error()) {
+                    result.diagnostics = kota::codec::RawValue{
+                        feature::diagnostics_json(unit,
+                                                  feature::PositionEncoding::UTF16,
+                                                  params.max_diagnostics)};
+                    result.top_level_decls =
+                        static_cast<std::uint32_t>(unit.top_level_decls().size());
+                    result.links = to_raw(
+                        feature::document_links(unit, feature::PositionEncoding::UTF16));
+                    LOG_INFO("Compile done: path={}, {}ms, {} diags, fatal={}, {}MB",
                              params.path,
                              timer.ms(),
-                             diags.size(),
-                             doc->unit.fatal_error());
+                             unit.diagnostics().size(),
+                             unit.fatal_error(),
+                             doc->memory_usage / (1024 * 1024));
                 } else {
                     result.diagnostics = kota::codec::RawValue{"[]"};
+                    result.links = kota::codec::RawValue{"[]"};
                     LOG_WARN("Compile incomplete: path={}, {}ms", params.path, timer.ms());
                 }
-                result.memory_usage = 0;  // TODO: query actual memory
-                if(doc->unit.completed()) {
-                    result.deps = doc->unit.deps();
+                result.memory_usage = doc->memory_usage;
+                auto malloc_stats = heap::stats();
+                result.heap_reserved = malloc_stats.reserved;
+                result.heap_in_use = malloc_stats.in_use;
+                if(unit.completed() && params.clang_tidy) {
+                    tidy.emplace();
+                    for(auto& diag: unit.diagnostics()) {
+                        if(diag.id.source == DiagnosticSource::ClangTidy &&
+                           diag.fid == unit.interested_file()) {
+                            tidy->push_back(diag);
+                        }
+                    }
+                }
+                if(unit.completed()) {
+                    auto deps = unit.deps();
+                    if(reuse_fs && deps == doc->deps) {
+                        result.deps_unchanged = true;
+                    } else {
+                        result.deps = deps;
+                        doc->deps = std::move(deps);
+                    }
 
                     // Build index for main file only (interested_only=true).
-                    auto tu_index = index::TUIndex::build(doc->unit, true);
+                    auto tu_index = index::TUIndex::build(unit, true);
                     llvm::raw_string_ostream os(result.tu_index_data);
                     tu_index.serialize(os);
+                    os.flush();
+                    shared_blob::offload(result.tu_index_data, result.tu_index_segment);
+                    result.time_trace = unit.time_trace();
+                } else {
+                    // The master records no snapshot for this compile.
+                    doc->deps.clear();
                 }
                 return result;
             });
 
+            co_await doc->unit_lock.lock();
+            std::swap(doc->unit, unit);
+            doc->has_ast = true;
+            doc->ast_version = params.version;
+            doc->features.current = false;
+            doc->hover.clear();
+            doc->inlay_hints.clear();
+            doc->skipped_bodies = doc->unit.skipped_bodies().vec();
+            doc->tidy = std::move(tidy);
+            if(doc->edits_from != -1 && doc->edits_from <= params.version) {
+                doc->edits.drop_through(params.version);
+                doc->edits_from = params.version;
+            }
+            doc->unit_lock.unlock();
+
+            // Tearing down an AST takes a while; keep it off the event loop.
+            co_await kota::queue([&]() {
+                usage::Meter meter(scope.cost);
+                unit = CompilationUnit{nullptr};
+            });
+
             doc->strand.unlock();
             doc->ast_ready.set();
-            shrink_if_over_limit();
+            shrink_if_over_limit(params.path);
+
+            if(params.precompute_features && documents.contains(params.path)) {
+                background.spawn(precompute_features(doc));
+            }
 
             co_return compile_result.value();
         });
 
     // === DocumentUpdate ===
-    // Only mark the document dirty — do NOT update doc.text or doc.version
-    // here.  The kota::queue compilation work may be reading doc.text on the
-    // thread pool concurrently, so writing it from the event loop would be
-    // a data race.  The next Compile request will bring the correct text
-    // and update it inside the strand lock.
+    // Mark the document dirty and apply the edits to synced_text — do NOT
+    // update doc.text or doc.version here.  The kota::queue compilation work
+    // may be reading doc.text on the thread pool concurrently, so writing it
+    // from the event loop would be a data race.  The next Compile request
+    // copies synced_text (or brings full text) into doc.text inside the
+    // strand lock.
     peer.on_notification([this](const worker::DocumentUpdateParams& params) {
-        LOG_TRACE("DocumentUpdate: path={}, version={}", params.path, params.version);
+        LOG_TRACE("DocumentUpdate: path={}, version={}, {} edits",
+                  params.path,
+                  params.version,
+                  params.edits.size());
 
         auto it = documents.find(params.path);
         if(it == documents.end()) {
@@ -214,7 +997,36 @@ void StatefulWorker::register_handlers() {
             return;
         }
 
-        it->second->dirty.store(true, std::memory_order_release);
+        auto& doc = *it->second;
+        doc.dirty.store(true, std::memory_order_release);
+
+        if(params.edits.empty() || doc.synced_version != params.base_version) {
+            doc.synced_version = -1;
+            doc.edits.clear();
+            doc.edits_from = -1;
+            return;
+        }
+        for(auto& edit: params.edits) {
+            if(edit.offset > doc.synced_text.size() ||
+               edit.length > doc.synced_text.size() - edit.offset) {
+                LOG_WARN("DocumentUpdate edit out of range: path={}, version={}",
+                         params.path,
+                         params.version);
+                doc.synced_version = -1;
+                doc.edits.clear();
+                doc.edits_from = -1;
+                return;
+            }
+            doc.synced_text.replace(edit.offset, edit.length, edit.text);
+            doc.edits.push(edit.offset, edit.length, edit.text.size(), params.version);
+            if(doc.skip_bodies) {
+                // A body being edited is one the user is looking at.
+                auto size = static_cast<std::uint32_t>(edit.text.size());
+                shift_ranges(doc.parsed_bodies, edit.offset, edit.length, size);
+                add_parsed_body(doc, {edit.offset, edit.offset + size});
+            }
+        }
+        doc.synced_version = params.version;
     });
 
     // === Evict ===
@@ -226,59 +1038,273 @@ void StatefulWorker::register_handlers() {
             lru.erase(it->second);
             lru_index.erase(it);
         }
-        documents.erase(params.path);
+        if(documents.erase(params.path)) {
+            background.spawn(trim_heap());
+        }
+        forget(params.path);
+    });
+
+    // === Completion ===
+    // Pinned to the worker holding the document: it neither waits for nor
+    // touches the AST, but reuses the file-system cache of the document's
+    // last compile, so the PCH and headers are not read from disk again.
+    peer.on_request([this](RequestContext& ctx, const worker::CompletionParams& params)
+                        -> RequestResult<worker::CompletionParams> {
+        trace::Span span("Completion", params.path);
+        UsageScope scope{ledger, "Completion"};
+        auto it = documents.find(params.path);
+        if(it == documents.end()) {
+            co_return kota::outcome_error(kota::ipc::Error{"Document not open on this worker"});
+        }
+        auto doc = it->second;
+        touch_lru(params.path);
+
+        auto arguments =
+            argument_cache.resolve(params.arguments_id, params.arguments_known, params.arguments);
+        if(!arguments) {
+            co_return kota::outcome_error(
+                kota::ipc::Error{std::string(argument_template::unknown_error)});
+        }
+
+        std::string text;
+        if(params.synced) {
+            if(doc->synced_version != params.version) {
+                co_return kota::outcome_error(kota::ipc::Error{"Completion out of sync"});
+            }
+            text = doc->synced_text;
+        } else {
+            text = params.text;
+        }
+
+        bool reuse_fs = params.deps_fresh && doc->fs && same_context(*doc, params, *arguments);
+        // A fork, so what completion reads never lands in the document's
+        // cache nor races the next compile over it.
+        llvm::IntrusiveRefCntPtr<CachingFS> fs = reuse_fs ? doc->fs->fork({}) : new CachingFS();
+
+        auto result = co_await kota::queue([&]() -> kota::codec::RawValue {
+            usage::Meter meter(scope.cost);
+            ScopedTimer timer;
+
+            CompilationParams cp;
+            cp.kind = CompilationKind::Completion;
+            cp.vfs = fs;
+            fill_args(cp, params.directory, *arguments);
+            if(!params.pch.first.empty()) {
+                cp.pch = params.pch;
+            }
+            for(auto& [name, pcm_path]: params.pcms) {
+                cp.pcms.try_emplace(name, pcm_path);
+            }
+            cp.add_remapped_file(params.path, text);
+            cp.completion = {params.path, params.offset};
+
+            auto list = feature::code_complete(cp);
+            LOG_DEBUG("Completion done: path={}, {} items{}, {}ms{}",
+                      params.path,
+                      list.items.size(),
+                      list.is_incomplete ? " (cut)" : "",
+                      timer.ms(),
+                      reuse_fs ? " (cached reads)" : "");
+            return to_raw(list);
+        });
+        co_return std::move(result.value());
     });
 
     // === Query (hover, definition, semantic tokens, etc.) ===
     peer.on_request(
         [this](RequestContext& ctx,
                const worker::QueryParams& params) -> RequestResult<worker::QueryParams> {
-            using K = worker::QueryKind;
-            switch(params.kind) {
-                case K::Hover:
-                    co_return co_await with_ast(params.path, [&](DocumentEntry& doc) {
-                        auto result = feature::hover(doc.unit, params.offset);
-                        return result ? to_raw(*result) : kota::codec::RawValue{"null"};
-                    });
-                case K::GoToDefinition:
-                    // TODO: Implement go-to-definition
-                    co_return kota::codec::RawValue{"[]"};
-                case K::SemanticTokens:
-                    co_return co_await with_ast(params.path, [&](DocumentEntry& doc) {
-                        return to_raw(
-                            feature::semantic_tokens(doc.unit, feature::PositionEncoding::UTF16));
-                    });
-                case K::InlayHints:
-                    co_return co_await with_ast(params.path, [&](DocumentEntry& doc) {
-                        auto range = params.range;
-                        if(range.begin == static_cast<uint32_t>(-1))
-                            range = LocalSourceRange{0, static_cast<uint32_t>(doc.text.size())};
-                        return to_raw(feature::inlay_hints(doc.unit,
-                                                           range,
-                                                           {},
-                                                           feature::PositionEncoding::UTF16));
+            co_return co_await query(params);
+        });
+
+    // === QueryBatch ===
+    // The queries of a burst, answered in order; the later ones find the
+    // AST, feature results and bodies the earlier ones waited for.
+    peer.on_request([this](RequestContext& ctx, const worker::QueryBatchParams& params)
+                        -> RequestResult<worker::QueryBatchParams> {
+        trace::Span span("QueryBatch", params.path);
+        std::vector<kota::codec::RawValue> results;
+        results.reserve(params.queries.size());
+        for(auto& entry: params.queries) {
+            auto result = co_await query(entry);
+            results.push_back(result.has_value() ? std::move(result.value())
+                                                 : kota::codec::RawValue{});
+        }
+        co_return results;
+    });
+}
+
+RequestResult<worker::QueryParams> StatefulWorker::query(const worker::QueryParams& params) {
+    using K = worker::QueryKind;
+    trace::Span span(kota::meta::enum_name(params.kind), params.path);
+    UsageScope scope{ledger, kota::meta::enum_name(params.kind)};
+    auto& cost = scope.cost;
+    constexpr auto encoding = feature::PositionEncoding::UTF16;
+
+    // Answer from the AST already built, with positions moved
+    // across the edits made since.  Results that cannot be moved
+    // exactly are dropped rather than shown misplaced.
+    if(params.stale) {
+        using Result = std::optional<kota::codec::RawValue>;
+        switch(params.kind) {
+            case K::Hover:
+                co_return co_await with_last_ast(
+                    cost,
+                    params.path,
+                    params.version,
+                    [&](DocumentEntry& doc, const EditMap& edits, llvm::StringRef)
+                        -> Result {
+                        auto offset = edits.to_old(params.offset);
+                        if(!offset) {
+                            return std::nullopt;
+                        }
+                        auto result =
+                            feature::hover(doc.unit, *offset, {.cache = &doc.hover});
+                        if(!result) {
+                            return kota::codec::RawValue{"null"};
+                        }
+                        // The highlight range is in the old text.
+                        result->range.reset();
+                        return to_raw(*result);
                     });
-                case K::FoldingRange:
-                    co_return co_await with_ast(params.path, [&](DocumentEntry& doc) {
-                        return to_raw(
-                            feature::folding_ranges(doc.unit, feature::PositionEncoding::UTF16));
+            case K::SemanticTokens:
+                co_return co_await with_last_ast(
+                    cost,
+                    params.path,
+                    params.version,
+                    [&](DocumentEntry& doc, const EditMap& edits, llvm::StringRef text)
+                        -> Result {
+                        auto tokens = feature::semantic_tokens(doc.unit);
+                        std::vector<feature::SemanticToken> moved;
+                        moved.reserve(tokens.size());
+                        for(auto& token: tokens) {
+                            auto range =
+                                edits.to_new_exact(token.range.begin, token.range.end);
+                            if(range) {
+                                token.range = {range->first, range->second};
+                                moved.push_back(token);
+                            }
+                        }
+                        auto encoded = feature::semantic_tokens(text, moved, encoding);
+                        return reply_tokens(doc,
+                                            std::move(encoded.data),
+                                            params.previous_result_id);
                     });
-                case K::DocumentSymbol:
-                    co_return co_await with_ast(params.path, [&](DocumentEntry& doc) {
-                        return to_raw(
-                            feature::document_symbols(doc.unit, feature::PositionEncoding::UTF16));
+            case K::FoldingRange:
+                co_return co_await with_last_ast(
+                    cost,
+                    params.path,
+                    params.version,
+                    [&](DocumentEntry& doc, const EditMap& edits, llvm::StringRef text)
+                        -> Result {
+                        auto ranges = feature::folding_ranges(doc.unit);
+                        std::erase_if(ranges, [&](feature::FoldingRange& folding) {
+                            auto range = remap(edits, folding.range);
+                            if(range) {
+                                folding.range = *range;
+                            }
+                            return !range;
+                        });
+                        return to_raw(feature::folding_ranges(text, ranges, encoding));
                     });
-                case K::DocumentLink:
-                    co_return co_await with_ast(params.path, [&](DocumentEntry& doc) {
-                        return to_raw(
-                            feature::document_links(doc.unit, feature::PositionEncoding::UTF16));
+            case K::DocumentSymbol:
+                co_return co_await with_last_ast(
+                    cost,
+                    params.path,
+                    params.version,
+                    [&](DocumentEntry& doc, const EditMap& edits, llvm::StringRef text)
+                        -> Result {
+                        auto symbols = feature::document_symbols(doc.unit);
+                        remap(edits, symbols);
+                        return to_raw(feature::document_symbols(text, symbols, encoding));
                     });
-                case K::CodeAction:
-                    // TODO: Implement code actions
-                    co_return kota::codec::RawValue{"[]"};
-            }
-            co_return kota::codec::RawValue{"null"};
-        });
+            default: break;
+        }
+    }
+
+    switch(params.kind) {
+        case K::Hover:
+            co_await parse_bodies(cost, params.path, {params.offset, params.offset});
+            co_return co_await with_ast(cost, params.path, [&](DocumentEntry& doc) {
+                return feature::hover(doc.unit, params.offset, {.cache = &doc.hover});
+            });
+        case K::GoToDefinition:
+            // TODO: Implement go-to-definition
+            co_return kota::codec::RawValue{"[]"};
+        case K::SemanticTokens:
+            co_return co_await with_ast(cost, params.path, [&](DocumentEntry& doc) {
+                collect_features(doc);
+                return reply_tokens(doc, doc.features.tokens, params.previous_result_id);
+            });
+        case K::SemanticTokensRange:
+            // Not kept for deltas: those are against full results.
+            co_return co_await with_ast(cost, params.path, [&](DocumentEntry& doc) {
+                return feature::semantic_tokens(doc.unit, params.range, encoding);
+            });
+        case K::InlayHints:
+            co_await parse_bodies(cost, params.path, params.range);
+            co_return co_await with_ast(cost, params.path, [&](DocumentEntry& doc) {
+                auto range = params.range;
+                if(range.begin == static_cast<uint32_t>(-1))
+                    range = LocalSourceRange{0, static_cast<uint32_t>(doc.text.size())};
+                return feature::inlay_hints(doc.unit,
+                                            range,
+                                            {.cache = &doc.inlay_hints},
+                                            feature::PositionEncoding::UTF16);
+            });
+        case K::FoldingRange:
+            co_return co_await with_ast(cost, params.path, [&](DocumentEntry& doc) {
+                collect_features(doc);
+                return doc.features.folding;
+            });
+        case K::DocumentSymbol:
+            co_return co_await with_ast(cost, params.path, [&](DocumentEntry& doc) {
+                collect_features(doc);
+                return doc.features.symbols;
+            });
+        case K::CodeAction:
+            co_return co_await with_ast(cost, params.path, [&](DocumentEntry& doc) {
+                return feature::code_actions(doc.unit, params.range);
+            });
+        case K::CodeActionResolve:
+            co_return co_await with_ast(cost, params.path, [&](DocumentEntry& doc) {
+                feature::QuickFix fix{
+                    .title = params.label,
+                    .data = static_cast<std::int64_t>(params.symbol),
+                };
+                if(!feature::resolve_code_action(doc.unit, fix)) {
+                    return kota::codec::RawValue{"null"};
+                }
+                return to_raw(fix);
+            });
+        case K::CompletionResolve:
+            co_return co_await with_ast(cost, params.path, [&](DocumentEntry& doc) {
+                protocol::CompletionItem item{.label = params.label};
+                item.data = protocol::LSPAny(static_cast<std::int64_t>(params.symbol));
+                if(!feature::resolve_completion(doc.unit, item, &doc.hover)) {
+                    return kota::codec::RawValue{"null"};
+                }
+                return to_raw(item);
+            });
+        case K::SignatureHelp:
+            co_return co_await with_last_ast(
+                cost,
+                params.path,
+                params.version,
+                [&](DocumentEntry& doc, const EditMap& edits, llvm::StringRef text)
+                    -> std::optional<kota::codec::RawValue> {
+                    auto help = feature::signature_help(
+                        doc.unit,
+                        text,
+                        params.offset,
+                        [&](std::uint32_t offset) { return edits.to_old(offset); });
+                    if(!help) {
+                        return std::nullopt;
+                    }
+                    return to_raw(*help);
+                });
+    }
+    co_return kota::codec::RawValue{"null"};
 }
 
 int run_stateful_worker_mode(std::uint64_t memory_limit,
@@ -301,8 +1327,9 @@ int run_stateful_worker_mode(std::uint64_t memory_limit,
 
     kota::ipc::BincodePeer peer(loop, std::move(*transport_result));
 
-    StatefulWorker worker(peer, memory_limit);
+    StatefulWorker worker(loop, peer, memory_limit);
     worker.register_handlers();
+    trace_on_request(peer, worker_name, log_dir);
 
     LOG_INFO("Stateful worker ready, waiting for requests");
     loop.schedule(peer.run());
@@ -1,26 +1,43 @@
 #include "server/worker/stateless_worker.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include "compile/compilation.h"
 #include "feature/feature.h"
 #include "index/tu_index.h"
 #include "server/protocol/worker.h"
+#include "server/worker/argument_cache.h"
+#include "server/worker/path_map.h"
 #include "server/worker/worker_common.h"
+#include "support/filesystem.h"
 #include "support/logging.h"
+#include "support/shared_blob.h"
+#include "support/system_load.h"
 
 #include "kota/async/async.h"
 #include "kota/ipc/codec/bincode.h"
 #include "kota/ipc/peer.h"
 #include "kota/ipc/transport.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/Support/raw_ostream.h"
 
 namespace clice {
 
-/// RAII guard that lowers the current process's scheduling priority and
-/// restores it on destruction.
+/// RAII guard that lowers the current process's scheduling priority, and
+/// the I/O priority of the thread, and restores them on destruction.
 struct ScopedNice {
     int saved;
+    system_load::ScopedBackground background;
 
     explicit ScopedNice(int increment = 10) {
         auto p = kota::sys::priority();
@@ -50,25 +67,58 @@ static std::string collect_errors(CompilationUnit& unit) {
 }
 
 /// Build a TUIndex, serialize it, and return as a string.
-static std::string serialize_tu_index(CompilationUnit& unit, bool interested_only = false) {
-    auto tu_index = index::TUIndex::build(unit, interested_only);
-    if(!interested_only) {
-        tu_index.main_file_index = index::FileIndex();
-    }
+static std::string serialize_tu_index(CompilationUnit& unit) {
+    auto tu_index = index::TUIndex::build(unit);
+    tu_index.main_file_index = index::FileIndex();
     std::string serialized;
     llvm::raw_string_ostream os(serialized);
     tu_index.serialize(os);
     return serialized;
 }
 
-static worker::BuildResult handle_build_pch(const worker::BuildParams& params) {
+/// Upper bound on the file contents kept across builds.
+constexpr std::size_t max_file_cache_bytes = std::size_t(256) << 20;
+
+/// The files read in fs epoch `params.fs_epoch` (see file_changes.h),
+/// carried over from the previous epoch without what changed since; none
+/// when it is 0.  Only for builds whose dependencies the master watches:
+/// an Index build reads headers no watched directory may cover.
+static llvm::IntrusiveRefCntPtr<vfs::FileSystem> file_cache(const worker::BuildParams& params) {
+    static llvm::IntrusiveRefCntPtr<CachingFS> cache;
+    static std::uint64_t cached_epoch = 0;
+    if(params.fs_epoch == 0) {
+        cache = nullptr;
+        return nullptr;
+    }
+    if(!cache || params.fs_reset || cache->size_in_bytes() > max_file_cache_bytes) {
+        cache = new CachingFS();
+        cache->skip_build_outputs = true;
+    } else if(params.fs_epoch != cached_epoch) {
+        cache = cache->fork(params.fs_changed);
+    }
+    cached_epoch = params.fs_epoch;
+    return cache;
+}
+
+static worker::BuildResult handle_build_pch(const worker::BuildParams& params,
+                                            const std::vector<std::string>& arguments,
+                                            llvm::IntrusiveRefCntPtr<vfs::FileSystem> vfs) {
     ScopedTimer timer;
 
     CompilationParams cp;
     cp.kind = CompilationKind::Preamble;
-    fill_args(cp, params.directory, params.arguments);
+    cp.time_trace = params.time_trace;
+    if(vfs)
+        cp.vfs = std::move(vfs);
+    fill_args(cp, params.directory, arguments);
     cp.add_remapped_file(params.file, params.text, params.preamble_bound);
 
+    // A base PCH makes this a chained build: clang skips the base's bytes
+    // of the preamble and the new PCH only holds the directives after them.
+    if(!params.pch.first.empty()) {
+        cp.pch = params.pch;
+    }
+
     // When the master provides an output path it is already a tmp path
     // allocated by its CacheStore: write directly, the master commits
     // (fsync + atomic rename) after we report success.
@@ -95,7 +145,9 @@ static worker::BuildResult handle_build_pch(const worker::BuildParams& params) {
 
     std::string tu_index_data;
     std::string pch_links_json;
+    TimeTrace time_trace;
     if(success) {
+        time_trace = unit.time_trace();
         tu_index_data = serialize_tu_index(unit);
         auto links = feature::document_links(unit);
         auto raw = to_raw(links);
@@ -113,6 +165,7 @@ static worker::BuildResult handle_build_pch(const worker::BuildParams& params) {
         result.deps = pch_info.deps;
         result.tu_index_data = std::move(tu_index_data);
         result.pch_links_json = std::move(pch_links_json);
+        result.time_trace = std::move(time_trace);
         return result;
     } else {
         LOG_WARN("BuildPCH failed: file={}, {}ms, errors=[{}]", params.file, timer.ms(), errors);
@@ -121,12 +174,16 @@ static worker::BuildResult handle_build_pch(const worker::BuildParams& params) {
     }
 }
 
-static worker::BuildResult handle_build_pcm(const worker::BuildParams& params) {
+static worker::BuildResult handle_build_pcm(const worker::BuildParams& params,
+                                            const std::vector<std::string>& arguments,
+                                            llvm::IntrusiveRefCntPtr<vfs::FileSystem> vfs) {
     ScopedTimer timer;
 
     CompilationParams cp;
     cp.kind = CompilationKind::ModuleInterface;
-    fill_args(cp, params.directory, params.arguments);
+    if(vfs)
+        cp.vfs = std::move(vfs);
+    fill_args(cp, params.directory, arguments);
     for(auto& [name, path]: params.pcms) {
         cp.pcms.try_emplace(name, path);
     }
@@ -153,10 +210,8 @@ static worker::BuildResult handle_build_pcm(const worker::BuildParams& params) {
     if(!success)
         errors = collect_errors(unit);
 
-    std::string tu_index_data;
-    if(success)
-        tu_index_data = serialize_tu_index(unit, true);
-
+    // Dependents wait on nothing but the reduced BMI: the unit's own index
+    // comes from the indexer's later compile of it, so none is built here.
     unit = CompilationUnit(nullptr);
 
     if(success) {
@@ -165,7 +220,6 @@ static worker::BuildResult handle_build_pcm(const worker::BuildParams& params) {
         result.success = true;
         result.output_path = tmp_path;
         result.deps = pcm_info.deps;
-        result.tu_index_data = std::move(tu_index_data);
         return result;
     } else {
         LOG_WARN("BuildPCM failed: module={}, {}ms, errors=[{}]",
@@ -177,43 +231,135 @@ static worker::BuildResult handle_build_pcm(const worker::BuildParams& params) {
     }
 }
 
-static worker::BuildResult handle_index(const worker::BuildParams& params) {
+/// Index one TU.  `vfs`, when given, is shared with the other TUs of a batch.
+static worker::BuildResult handle_index(const std::string& file,
+                                        const std::string& directory,
+                                        const std::vector<std::string>& arguments,
+                                        const worker::BuildParams& params,
+                                        std::shared_ptr<std::atomic_bool> stop,
+                                        llvm::IntrusiveRefCntPtr<vfs::FileSystem> vfs = nullptr) {
     ScopedTimer timer;
 
-    CompilationParams cp;
-    cp.kind = CompilationKind::Indexing;
-    fill_args(cp, params.directory, params.arguments);
-    for(auto& [name, path]: params.pcms) {
-        cp.pcms.try_emplace(name, path);
+    // Read-only, so safe for the builder to query from several threads.
+    auto& known_indices = params.known_indices;
+    auto known = [&](llvm::StringRef path, const index::FileIndexHash& hash) {
+        auto it = known_indices.find(path.str());
+        if(it == known_indices.end())
+            return false;
+        auto key = std::string_view(reinterpret_cast<const char*>(hash.data()), hash.size());
+        return std::ranges::find(it->second, key) != it->second.end();
+    };
+    auto& known_contexts = params.known_contexts;
+    auto known_context = [&](llvm::StringRef path, const index::FileIndexHash& context)
+        -> std::optional<index::FileIndexHash> {
+        auto it = known_contexts.find(path.str());
+        if(it == known_contexts.end())
+            return std::nullopt;
+        auto key = std::string(reinterpret_cast<const char*>(context.data()), context.size());
+        auto hash = it->second.find(key);
+        if(hash == it->second.end() || hash->second.size() != sizeof(index::FileIndexHash))
+            return std::nullopt;
+        index::FileIndexHash result;
+        std::ranges::copy(hash->second, result.begin());
+        return result;
+    };
+
+    // Headers the master holds are parsed without function bodies.  One read
+    // under a context it does not know is indexed, and a body-less index of
+    // it would replace its complete one: the TU is then compiled in full.
+    bool skip_headers = !params.skip_bodies_in.empty();
+    llvm::StringSet<> missed;
+    auto tracked_context = [&](llvm::StringRef path, const index::FileIndexHash& context) {
+        auto hash = known_context(path, context);
+        if(!hash)
+            missed.insert(path);
+        return hash;
+    };
+
+    std::optional<CompilationUnit> unit;
+    index::TUIndex tu_index;
+    while(true) {
+        CompilationParams cp;
+        cp.kind = CompilationKind::Indexing;
+        cp.time_trace = params.time_trace;
+        cp.stop = stop;
+        if(vfs)
+            cp.vfs = vfs;
+        fill_args(cp, directory, arguments);
+        for(auto& [name, path]: params.pcms) {
+            cp.pcms.try_emplace(name, path);
+        }
+        if(skip_headers) {
+            for(auto& path: params.skip_bodies_in) {
+                cp.skip_header_bodies.insert(path);
+            }
+        }
+
+        unit.reset();
+        unit.emplace(compile(cp));
+        if(stop->load()) {
+            LOG_INFO("Index preempted: file={}, {}ms", file, timer.ms());
+            return {false, "Index preempted"};
+        }
+        if(!unit->completed()) {
+            LOG_WARN("Index failed: file={}, {}ms", file, timer.ms());
+            return {false, "Index compilation failed"};
+        }
+
+        missed.clear();
+        tu_index = index::TUIndex::build(*unit, false, known, tracked_context);
+        if(!skip_headers ||
+           llvm::none_of(unit->skipped_headers(),
+                         [&](const std::string& path) { return missed.contains(path); })) {
+            break;
+        }
+        LOG_INFO("Index: {} read a header without bodies under a new context, again in full",
+                 file);
+        skip_headers = false;
     }
 
-    auto unit = compile(cp);
-    if(!unit.completed()) {
-        LOG_WARN("Index failed: file={}, {}ms", params.file, timer.ms());
-        return {false, "Index compilation failed"};
+    // A remote executor names the files where the master finds them.
+    if(!params.path_map.empty()) {
+        PathMap local(params.path_map);
+        for(auto& path: tu_index.graph.paths) {
+            path = local.map(path);
+        }
     }
 
-    auto tu_index = index::TUIndex::build(unit);
     std::string serialized;
     llvm::raw_string_ostream os(serialized);
     tu_index.serialize(os);
 
-    LOG_INFO("Index done: file={}, {} symbols, {}ms",
-             params.file,
+    auto reused = std::ranges::count_if(tu_index.file_indices, [](auto& entry) {
+        return entry.second.known_hash.has_value();
+    });
+    LOG_INFO("Index done: file={}, {} symbols, {} of {} headers reused, {}ms",
+             file,
              tu_index.symbols.size(),
+             reused,
+             tu_index.file_indices.size(),
              timer.ms());
     worker::BuildResult result;
     result.success = true;
     result.tu_index_data = std::move(serialized);
+    if(!params.remote)
+        shared_blob::offload(result.tu_index_data, result.tu_index_segment);
+    result.time_trace = unit->time_trace();
     return result;
 }
 
-static worker::BuildResult handle_completion(const worker::BuildParams& params) {
+static worker::BuildResult handle_completion(const worker::BuildParams& params,
+                                             const std::vector<std::string>& arguments,
+                                             std::shared_ptr<std::atomic_bool> stop,
+                                             llvm::IntrusiveRefCntPtr<vfs::FileSystem> vfs) {
     ScopedTimer timer;
 
     CompilationParams cp;
     cp.kind = CompilationKind::Completion;
-    fill_args(cp, params.directory, params.arguments);
+    cp.stop = stop;
+    if(vfs)
+        cp.vfs = std::move(vfs);
+    fill_args(cp, params.directory, arguments);
     if(!params.pch.first.empty()) {
         cp.pch = params.pch;
     }
@@ -223,20 +369,33 @@ static worker::BuildResult handle_completion(const worker::BuildParams& params)
     cp.add_remapped_file(params.file, params.text);
     cp.completion = {params.file, params.offset};
 
-    auto items = feature::code_complete(cp);
-    LOG_DEBUG("Completion done: {} items, {}ms", items.size(), timer.ms());
+    auto list = feature::code_complete(cp);
+    if(stop->load()) {
+        LOG_DEBUG("Completion cancelled: {}ms", timer.ms());
+        return {false, "Completion cancelled"};
+    }
+    LOG_DEBUG("Completion done: {} items{}, {}ms",
+              list.items.size(),
+              list.is_incomplete ? " (cut)" : "",
+              timer.ms());
 
     worker::BuildResult result;
-    result.result_json = to_raw(items);
+    result.result_json = to_raw(list);
     return result;
 }
 
-static worker::BuildResult handle_signature_help(const worker::BuildParams& params) {
+static worker::BuildResult handle_signature_help(const worker::BuildParams& params,
+                                                 const std::vector<std::string>& arguments,
+                                                 std::shared_ptr<std::atomic_bool> stop,
+                                                 llvm::IntrusiveRefCntPtr<vfs::FileSystem> vfs) {
     ScopedTimer timer;
 
     CompilationParams cp;
     cp.kind = CompilationKind::Completion;
-    fill_args(cp, params.directory, params.arguments);
+    cp.stop = stop;
+    if(vfs)
+        cp.vfs = std::move(vfs);
+    fill_args(cp, params.directory, arguments);
     if(!params.pch.first.empty()) {
         cp.pch = params.pch;
     }
@@ -247,6 +406,10 @@ static worker::BuildResult handle_signature_help(const worker::BuildParams& para
     cp.completion = {params.file, params.offset};
 
     auto help = feature::signature_help(cp);
+    if(stop->load()) {
+        LOG_DEBUG("SignatureHelp cancelled: {}ms", timer.ms());
+        return {false, "SignatureHelp cancelled"};
+    }
     LOG_DEBUG("SignatureHelp done: {}ms", timer.ms());
 
     worker::BuildResult result;
@@ -254,15 +417,35 @@ static worker::BuildResult handle_signature_help(const worker::BuildParams& para
     return result;
 }
 
+/// The styles resolved in format epoch `epoch`, none when it is 0.
+static feature::FormatStyleCache* format_styles(std::uint64_t epoch) {
+    static feature::FormatStyleCache cache;
+    static std::uint64_t cached_epoch = 0;
+    if(epoch == 0) {
+        return nullptr;
+    }
+    if(epoch != cached_epoch) {
+        cache.clear();
+        cached_epoch = epoch;
+    }
+    return &cache;
+}
+
 static worker::BuildResult handle_format(const worker::BuildParams& params) {
     ScopedTimer timer;
 
-    std::optional<LocalSourceRange> range;
-    if(params.format_range.valid()) {
-        range = params.format_range;
+    std::vector<kota::ipc::protocol::TextEdit> edits;
+    auto* styles = format_styles(params.format_epoch);
+    constexpr auto encoding = feature::PositionEncoding::UTF16;
+    if(params.kind == worker::BuildKind::OnTypeFormat) {
+        edits = feature::on_type_format(params.file, params.text, params.offset, encoding, styles);
+    } else {
+        std::optional<LocalSourceRange> range;
+        if(params.format_range.valid()) {
+            range = params.format_range;
+        }
+        edits = feature::document_format(params.file, params.text, range, encoding, styles);
     }
-
-    auto edits = feature::document_format(params.file, params.text, range);
     LOG_DEBUG("Format done: {} edits, {}ms", edits.size(), timer.ms());
 
     worker::BuildResult result;
@@ -298,23 +481,132 @@ int run_stateless_worker_mode(const std::string& worker_name, const std::string&
 
     kota::ipc::BincodePeer peer(loop, std::move(*transport_result));
 
+    // Stop flags of the builds queued or running on the thread pool, so a
+    // PreemptParams notification can abort them mid-compile.
+    llvm::SmallVector<std::pair<std::string, std::shared_ptr<std::atomic_bool>>> build_stops;
+
+    peer.on_notification([&](const worker::PreemptParams& params) {
+        for(auto& [file, stop]: build_stops) {
+            if(file == params.file)
+                stop->store(true);
+        }
+    });
+
+    trace_on_request(peer, worker_name, log_dir);
+
+    UsageLedger ledger;
+    usage_on_request(peer, ledger);
+
+    // Argument templates the master sent, for every build kind.
+    ArgumentCache argument_cache;
+
     peer.on_request([&](RequestContext& ctx,
                         const worker::BuildParams& params) -> RequestResult<worker::BuildParams> {
         using K = worker::BuildKind;
+        trace::Span span(kota::meta::enum_name(params.kind), params.file);
+
+        // Resolve every command up front: a missing template fails the whole
+        // request before any TU of a batch is reported.
+        auto arguments =
+            argument_cache.resolve(params.arguments_id, params.arguments_known, params.arguments);
+        std::vector<std::vector<std::string>> batch_arguments;
+        for(auto& target: params.batch) {
+            auto resolved = argument_cache.resolve(target.arguments_id,
+                                                   target.arguments_known,
+                                                   target.arguments);
+            if(!resolved) {
+                arguments.reset();
+                break;
+            }
+            batch_arguments.push_back(std::move(*resolved));
+        }
+        if(!arguments) {
+            co_return kota::outcome_error(
+                kota::ipc::Error{std::string(argument_template::unknown_error)});
+        }
+        // Taken for every request, Index too, so that every change the
+        // master sends is applied; here on the loop, between builds.
+        auto vfs = file_cache(params);
+        if(params.kind == K::Index)
+            vfs = nullptr;
+
+        std::shared_ptr<std::atomic_bool> stop;
+        if(params.kind == K::Index || params.kind == K::Completion ||
+           params.kind == K::SignatureHelp) {
+            stop = std::make_shared<std::atomic_bool>(false);
+            build_stops.emplace_back(params.file, stop);
+        }
+
+        if(params.kind == K::Index && !params.batch.empty()) {
+            // One file-system cache for the whole batch: headers and modules
+            // the TUs have in common are stat'ed and read once.
+            ScopedTimer timer;
+            llvm::IntrusiveRefCntPtr<vfs::FileSystem> vfs = new CachingFS();
+            PathMap local(params.path_map);
+            std::size_t indexed = 0;
+            for(std::size_t i = 0; i < params.batch.size(); ++i) {
+                auto& target = params.batch[i];
+                ScopedTimer tu_timer;
+                // Accounted per TU, like the master's Index latency.
+                UsageScope scope{ledger, kota::meta::enum_name(K::Index)};
+                auto tu = co_await kota::queue([&]() -> worker::BuildResult {
+                    usage::Meter meter(scope.cost);
+                    ScopedNice guard;
+                    trace::Span span("IndexTarget", target.file);
+                    return handle_index(target.file,
+                                        target.directory,
+                                        batch_arguments[i],
+                                        params,
+                                        stop,
+                                        vfs);
+                });
+                // A preempted TU is not reported; the master indexes it again.
+                if(stop->load())
+                    break;
+
+                auto& result = tu.value();
+                peer.send_notification(worker::IndexedParams{
+                    .file = local.map(target.file),
+                    .success = result.success,
+                    .error = std::move(result.error),
+                    .tu_index_data = std::move(result.tu_index_data),
+                    .tu_index_segment = std::move(result.tu_index_segment),
+                    .elapsed_ms = static_cast<double>(tu_timer.ms()),
+                    .time_trace = std::move(result.time_trace),
+                });
+                indexed += 1;
+            }
+            llvm::erase_if(build_stops, [&](auto& entry) { return entry.second == stop; });
+
+            LOG_INFO("Index batch done: {}/{} files, {}ms",
+                     indexed,
+                     params.batch.size(),
+                     timer.ms());
+            if(indexed < params.batch.size())
+                co_return worker::BuildResult{false, "Index preempted"};
+            co_return worker::BuildResult{};
+        }
+
+        UsageScope scope{ledger, kota::meta::enum_name(params.kind)};
         auto result = co_await kota::queue([&]() -> worker::BuildResult {
+            usage::Meter meter(scope.cost);
             switch(params.kind) {
-                case K::BuildPCH: return handle_build_pch(params);
-                case K::BuildPCM: return handle_build_pcm(params);
+                case K::BuildPCH: return handle_build_pch(params, *arguments, vfs);
+                case K::BuildPCM: return handle_build_pcm(params, *arguments, vfs);
                 case K::Index: {
                     ScopedNice guard;
-                    return handle_index(params);
+                    return handle_index(params.file, params.directory, *arguments, params, stop);
                 }
-                case K::Completion: return handle_completion(params);
-                case K::SignatureHelp: return handle_signature_help(params);
-                case K::Format: return handle_format(params);
+                case K::Completion: return handle_completion(params, *arguments, stop, vfs);
+                case K::SignatureHelp:
+                    return handle_signature_help(params, *arguments, stop, vfs);
+                case K::Format:
+                case K::OnTypeFormat: return handle_format(params);
             }
             return {false, "Unknown build kind"};
         });
+        if(stop)
+            llvm::erase_if(build_stops, [&](auto& entry) { return entry.second == stop; });
         co_return result.value();
     });
 
@@ -4,12 +4,18 @@
 
 #include <chrono>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "compile/compilation.h"
+#include "server/protocol/worker.h"
+#include "support/trace.h"
+#include "support/usage.h"
 
 #include "kota/codec/json/json.h"
 #include "kota/ipc/codec/json.h"
+#include "kota/ipc/peer.h"
+#include "llvm/ADT/StringMap.h"
 
 namespace clice {
 
@@ -34,6 +40,66 @@ inline void fill_args(CompilationParams& cp,
     }
 }
 
+/// Start writing this worker's trace file into `log_dir` once the master
+/// asks for it, on the master's clock.
+template <typename Peer>
+inline void trace_on_request(Peer& peer, std::string name, std::string log_dir) {
+    peer.on_notification([name = std::move(name), log_dir = std::move(log_dir)](
+                             const worker::TraceParams& params) {
+        if(!log_dir.empty())
+            trace::start(log_dir, name, params.clock - trace::clock());
+    });
+}
+
+/// What the requests a worker served used, by kind, until the master
+/// collects it with clice/worker/usage.  Lives on the event loop.
+class UsageLedger {
+public:
+    void record(std::string_view kind, const usage::Sample& cost) {
+        auto& entry = kinds[kind];
+        entry.requests += 1;
+        entry.allocations += cost.allocations;
+        entry.allocated_bytes += cost.allocated_bytes;
+        entry.cpu_us += cost.cpu_us;
+    }
+
+    /// The figures recorded since the last call.
+    std::vector<worker::KindUsage> take() {
+        std::vector<worker::KindUsage> result;
+        for(auto& entry: kinds) {
+            result.push_back(entry.second);
+            result.back().kind = entry.first().str();
+        }
+        kinds.clear();
+        return result;
+    }
+
+private:
+    llvm::StringMap<worker::KindUsage> kinds;
+};
+
+/// One request of `kind` in `ledger`, recorded when it ends however it
+/// does.  The work it runs on the thread pool adds itself to `cost` with a
+/// usage::Meter.
+struct UsageScope {
+    UsageLedger& ledger;
+    std::string_view kind;
+    usage::Sample cost;
+
+    ~UsageScope() {
+        ledger.record(kind, cost);
+    }
+};
+
+/// Answer the master's clice/worker/usage from `ledger`.
+template <typename Peer>
+inline void usage_on_request(Peer& peer, UsageLedger& ledger) {
+    peer.on_request([&ledger](typename Peer::RequestContext&, const worker::UsageParams&)
+                        -> kota::ipc::RequestResult<worker::UsageParams> {
+        co_return ledger.take();
+    });
+}
+
 /// Serialize a value to JSON RawValue using LSP config.
 template <typename T>
 inline kota::codec::RawValue to_raw(const T& value) {
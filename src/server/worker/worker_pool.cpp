@@ -2,17 +2,35 @@
 
 #include <algorithm>
 #include <csignal>
+#include <format>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
 
+#include "server/protocol/extension.h"
 #include "support/logging.h"
+#include "support/shared_blob.h"
+#include "support/system_load.h"
+#include "support/usage.h"
 
 #include "kota/async/io/system.h"
 #include "kota/ipc/transport.h"
+#include "kota/meta/enum.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/Program.h"
 
 namespace clice {
 
 namespace {
 
+/// Workers hand shared segments to this process, whoever forks them.
+std::uint32_t master_pid() {
+    return static_cast<std::uint32_t>(llvm::sys::Process::getProcessId());
+}
+
 /// Coroutine that drains a worker's stderr pipe.
 /// Workers write their own log files, so this only captures unexpected output
 /// (crash stacktraces, assertion failures, sanitizer reports, etc.).
@@ -47,18 +65,254 @@ kota::task<> drain_stderr(kota::pipe stderr_pipe, std::string prefix) {
     }
 }
 
+/// Fraction of (possibly cgroup-constrained) system memory still available,
+/// 1.0 when the platform does not report it.
+double available_memory_ratio() {
+    auto mem = kota::sys::memory();
+    auto effective =
+        (mem.constrained > 0 && mem.constrained < mem.total) ? mem.constrained : mem.total;
+    return effective > 0 ? static_cast<double>(mem.available) / effective : 1.0;
+}
+
+/// Peak resident set size of process `pid` in bytes (VmHWM), 0 when
+/// unavailable.
+std::uint64_t peak_resident_memory(int pid) {
+#ifdef __linux__
+    if(pid <= 0)
+        return 0;
+    auto status = llvm::MemoryBuffer::getFileAsStream(std::format("/proc/{}/status", pid));
+    if(!status)
+        return 0;
+    llvm::StringRef rest = (*status)->getBuffer();
+    while(!rest.empty()) {
+        auto [line, tail] = rest.split('\n');
+        rest = tail;
+        if(!line.consume_front("VmHWM:"))
+            continue;
+        auto value = line.trim();
+        value.consume_back("kB");
+        std::uint64_t kb = 0;
+        if(value.trim().getAsInteger(10, kb))
+            return 0;
+        return kb * 1024;
+    }
+#else
+    (void)pid;
+#endif
+    return 0;
+}
+
+/// `params` as a remote executor that finds the files per `paths` reads it.
+worker::BuildParams to_remote(const worker::BuildParams& params, const PathMap& paths) {
+    auto remote = params;
+    remote.remote = true;
+    if(paths.empty())
+        return remote;
+    remote.path_map = paths.reversed().entries();
+
+    auto move_command = [&](std::string& file,
+                            std::string& directory,
+                            std::vector<std::string>& arguments) {
+        file = paths.map(file);
+        directory = paths.map(directory);
+        for(auto& argument: arguments)
+            argument = paths.map_argument(argument);
+    };
+    move_command(remote.file, remote.directory, remote.arguments);
+    for(auto& target: remote.batch)
+        move_command(target.file, target.directory, target.arguments);
+    for(auto& [name, path]: remote.pcms)
+        path = paths.map(path);
+    for(auto& path: remote.skip_bodies_in)
+        path = paths.map(path);
+
+    remote.known_indices.clear();
+    for(auto& [path, hashes]: params.known_indices)
+        remote.known_indices.emplace(paths.map(path), hashes);
+    remote.known_contexts.clear();
+    for(auto& [path, contexts]: params.known_contexts)
+        remote.known_contexts.emplace(paths.map(path), contexts);
+    return remote;
+}
+
 }  // namespace
 
-bool WorkerPool::spawn_worker(const std::string& self_path,
-                              bool stateful,
-                              std::uint64_t memory_limit) {
-    auto& workers = stateful ? stateful_workers : stateless_workers;
-    auto worker_index = workers.size();
-    std::string worker_name = std::string(stateful ? "SF-" : "SL-") + std::to_string(worker_index);
+void LatencyHistogram::record(double ms) {
+    auto bucket = std::lower_bound(bounds_ms.begin(), bounds_ms.end(), ms) - bounds_ms.begin();
+    buckets[bucket] += 1;
+    count += 1;
+    sum_ms += ms;
+    max_ms = std::max(max_ms, ms);
+}
+
+ext::LatencyStats LatencyHistogram::snapshot() const {
+    ext::LatencyStats stats;
+    stats.count = count;
+    stats.mean_ms = count ? sum_ms / static_cast<double>(count) : 0;
+    stats.max_ms = max_ms;
+    stats.buckets.assign(buckets.begin(), buckets.end());
+    return stats;
+}
+
+void WorkerPool::record_request(WorkerProcess& w,
+                                std::chrono::steady_clock::time_point started,
+                                bool ok) {
+    auto elapsed = std::chrono::steady_clock::now() - started;
+    w.telemetry.busy_ms += std::chrono::duration<double, std::milli>(elapsed).count();
+    if(ok)
+        w.telemetry.latency.record(elapsed);
+    else
+        w.telemetry.failures += 1;
+}
+
+void WorkerPool::sample_peak_memory() {
+    for(auto* workers: {&stateless_workers, &stateful_workers}) {
+        for(auto& w: *workers) {
+            if(!w.alive || !w.peer)
+                continue;
+            auto pid = w.forked_pid > 0 ? w.forked_pid : w.proc.pid();
+            w.telemetry.peak_memory =
+                std::max(w.telemetry.peak_memory, peak_resident_memory(pid));
+        }
+    }
+}
+
+ext::WorkerStatsResult WorkerPool::stats(bool reset) {
+    sample_peak_memory();
+
+    ext::WorkerStatsResult result;
+    result.bucket_bounds_ms.assign(LatencyHistogram::bounds_ms.begin(),
+                                   LatencyHistogram::bounds_ms.end());
+
+    for(auto* workers: {&stateless_workers, &stateful_workers, &remote_workers}) {
+        bool stateful = workers == &stateful_workers;
+        for(auto& w: *workers) {
+            // Retired slots (scale-down, replaced standbys) stay in the
+            // vector without a peer; skip them.
+            if(!w.alive && !w.peer)
+                continue;
+            ext::WorkerStats entry;
+            entry.name = w.name;
+            entry.stateful = stateful;
+            entry.alive = w.alive;
+            entry.busy = w.busy;
+            entry.restarts = w.restart_count;
+            entry.failures = w.telemetry.failures;
+            entry.busy_ms = w.telemetry.busy_ms;
+            entry.peak_memory = w.telemetry.peak_memory;
+            if(stateful) {
+                entry.documents = w.owned_documents;
+                entry.ast_memory = w.memory_usage;
+                entry.heap_reserved = w.heap_reserved;
+                entry.heap_in_use = w.heap_in_use;
+            }
+            entry.latency = w.telemetry.latency.snapshot();
+            result.workers.push_back(std::move(entry));
+            if(reset)
+                w.telemetry = {};
+        }
+    }
+
+    for(auto priority: {worker::Priority::High, worker::Priority::Low}) {
+        auto& histogram = queue_wait[static_cast<std::size_t>(priority)];
+        ext::QueueStats entry;
+        entry.priority = std::string(kota::meta::enum_name(priority));
+        entry.depth = priority == worker::Priority::High ? high_queue.size() : low_queue.size();
+        entry.wait = histogram.snapshot();
+        result.queues.push_back(std::move(entry));
+        if(reset)
+            histogram = {};
+    }
+
+    for(std::size_t i = 0; i < build_kind_count; ++i) {
+        ext::BuildKindStats entry;
+        entry.kind = std::string(kota::meta::enum_name(static_cast<worker::BuildKind>(i)));
+        entry.latency = kind_latency[i].snapshot();
+        result.build_kinds.push_back(std::move(entry));
+        if(reset)
+            kind_latency[i] = {};
+    }
+
+    for(bool stateful: {false, true}) {
+        auto& kinds = request_usage[stateful];
+        for(auto& [kind, total]: kinds) {
+            result.request_usage.push_back({
+                .kind = kind.str(),
+                .stateful = stateful,
+                .requests = total.requests,
+                .allocations = total.allocations,
+                .allocated_bytes = total.allocated_bytes,
+                .cpu_ms = static_cast<double>(total.cpu_us) / 1000.0,
+            });
+        }
+        if(reset)
+            kinds.clear();
+    }
+    std::ranges::sort(result.request_usage, {}, [](const ext::RequestUsageStats& entry) {
+        return std::tie(entry.stateful, entry.kind);
+    });
+    result.allocations_counted = usage::counts_allocations();
+
+    result.crashes = crash_count;
+    result.evictions = eviction_count;
+    result.migrations = migration_count;
+    result.preemptions = preemption_count;
+    if(reset)
+        crash_count = eviction_count = migration_count = preemption_count = 0;
+    return result;
+}
+
+kota::task<> WorkerPool::collect_usage() {
+    for(bool stateful: {false, true}) {
+        auto& workers = stateful ? stateful_workers : stateless_workers;
+        // Indexed: a worker may be respawned or retired while one answers.
+        for(std::size_t i = 0; i < workers.size(); ++i) {
+            if(!workers[i].alive || !workers[i].peer)
+                continue;
+            // Answered from the worker's event loop, even mid-build.
+            auto result = co_await workers[i].peer->send_request(worker::UsageParams{});
+            if(!result.has_value())
+                continue;
+            for(auto& entry: result.value()) {
+                auto& total = request_usage[stateful][entry.kind];
+                total.requests += entry.requests;
+                total.allocations += entry.allocations;
+                total.allocated_bytes += entry.allocated_bytes;
+                total.cpu_us += entry.cpu_us;
+            }
+        }
+    }
+}
+
+bool WorkerPool::launch_worker(WorkerProcess& w, bool stateful, std::uint64_t memory_limit) {
+    std::string prefix = "[" + w.name + "]";
+
+    if(zygote && zygote->alive()) {
+        auto forked = zygote->fork_worker({
+            .worker_name = w.name,
+            .stateful = stateful,
+            .memory_limit = memory_limit,
+            .log_dir = log_dir,
+            .master_pid = master_pid(),
+        });
+        if(forked) {
+            auto transport = std::make_unique<kota::ipc::StreamTransport>(
+                std::move(forked->stdout_pipe),
+                std::move(forked->stdin_pipe));
+            w.peer = std::make_unique<kota::ipc::BincodePeer>(loop, std::move(transport));
+            w.forked_pid = forked->pid;
+            w.forked_exit = std::make_unique<ForkedExit>();
+            if(!stateful)
+                watch_indexed(w);
+            io_group.spawn(drain_stderr(std::move(forked->stderr_pipe), prefix));
+            isolate_worker(w, stateful);
+            return true;
+        }
+    }
 
     kota::process::options opts;
-    opts.file = self_path;
-    opts.args = {self_path, "worker"};
+    opts.file = options.self_path;
+    opts.args = {options.self_path, "worker"};
     if(stateful) {
         opts.args.push_back("--stateful");
         opts.args.push_back("--memory-limit");
@@ -66,7 +320,10 @@ bool WorkerPool::spawn_worker(const std::string& self_path,
     }
 
     opts.args.push_back("--worker-name");
-    opts.args.push_back(worker_name);
+    opts.args.push_back(w.name);
+
+    opts.args.push_back("--master-pid");
+    opts.args.push_back(std::to_string(master_pid()));
 
     if(!log_dir.empty()) {
         opts.args.push_back("--log-dir");
@@ -81,8 +338,9 @@ bool WorkerPool::spawn_worker(const std::string& self_path,
 
     auto result = kota::process::spawn(opts, loop);
     if(!result) {
-        LOG_ERROR("Failed to spawn {} worker: {}",
+        LOG_ERROR("Failed to spawn {} worker {}: {}",
                   stateful ? "stateful" : "stateless",
+                  w.name,
                   result.error().message());
         return false;
     }
@@ -93,23 +351,130 @@ bool WorkerPool::spawn_worker(const std::string& self_path,
     // writes)
     auto transport = std::make_unique<kota::ipc::StreamTransport>(std::move(spawn.stdout_pipe),
                                                                   std::move(spawn.stdin_pipe));
-    auto peer = std::make_unique<kota::ipc::BincodePeer>(loop, std::move(transport));
+    w.peer = std::make_unique<kota::ipc::BincodePeer>(loop, std::move(transport));
+    w.proc = std::move(spawn.proc);
+    if(!stateful)
+        watch_indexed(w);
 
-    std::string prefix = "[" + worker_name + "]";
     io_group.spawn(drain_stderr(std::move(spawn.stderr_pipe), prefix));
+    isolate_worker(w, stateful);
+    return true;
+}
 
-    workers.push_back(WorkerProcess{
-        .proc = std::move(spawn.proc),
-        .peer = std::move(peer),
-        .name = worker_name,
-        .owned_documents = 0,
+void WorkerPool::setup_isolation() {
+    if(options.stateful_cpus > 0) {
+        auto cpus = system_load::allowed_cpus();
+        if(cpus.size() > options.stateful_cpus) {
+            auto split = cpus.end() - options.stateful_cpus;
+            stateless_cpu_set.assign(cpus.begin(), split);
+            stateful_cpu_set.assign(split, cpus.end());
+            LOG_INFO("Pinning stateful workers to {} of {} CPUs",
+                     stateful_cpu_set.size(),
+                     cpus.size());
+        } else {
+            LOG_WARN("stateful_cpus={} leaves no CPU of {} for stateless workers; not pinning",
+                     options.stateful_cpus,
+                     cpus.size());
+        }
+    }
+
+    if(!options.cgroup.empty()) {
+        cgroups = cgroup::Tree::open(options.cgroup);
+        if(cgroups) {
+            LOG_INFO("Placing workers in cgroup {}", cgroups->path());
+        } else {
+            LOG_WARN("Cannot use cgroup {} (not writable, or lacks cpu/memory controllers)",
+                     options.cgroup);
+        }
+    }
+}
+
+void WorkerPool::isolate_worker(WorkerProcess& w, bool stateful) {
+    auto pid = w.forked_pid > 0 ? w.forked_pid : w.proc.pid();
+    auto& cpus = stateful ? stateful_cpu_set : stateless_cpu_set;
+    if(!cpus.empty() && !system_load::set_affinity(pid, cpus))
+        LOG_WARN("Failed to pin {} to its CPUs", w.name);
+
+    if(!cgroups)
+        return;
+    if(!cgroups->attach(w.name, pid)) {
+        LOG_WARN("Failed to move {} into cgroup {}", w.name, cgroups->path());
+        return;
+    }
+    // Soft limit first: the kernel reclaims and throttles above memory.high,
+    // and only kills above memory.max, which leaves room for a compile
+    // that peaks briefly.
+    auto limit = options.worker_memory_limit;
+    cgroups->set(w.name, "memory.high", std::to_string(limit));
+    cgroups->set(w.name, "memory.max", std::to_string(limit + limit / 2));
+    cgroups->set(w.name, "cpu.weight", "100");
+    w.oom_kills = cgroups->oom_kills(w.name);
+}
+
+void WorkerPool::weigh_worker(WorkerProcess& w) {
+    if(!cgroups)
+        return;
+    auto weight = w.low_priority ? options.indexing_cpu_weight : 100;
+    cgroups->set(w.name, "cpu.weight", std::to_string(weight));
+}
+
+void WorkerPool::watch_indexed(WorkerProcess& w) {
+    w.peer->on_notification([this](const worker::IndexedParams& params) {
+        if(params.success) {
+            record_cost(worker::BuildKind::Index, params.file, params.elapsed_ms);
+            kind_latency[static_cast<std::size_t>(worker::BuildKind::Index)].record(
+                params.elapsed_ms);
+        }
+        if(on_indexed)
+            on_indexed(params);
     });
+}
+
+void WorkerPool::signal_worker(WorkerProcess& w, int signal) {
+#ifdef __linux__
+    if(w.forked_pid > 0) {
+        ::kill(w.forked_pid, signal);
+        return;
+    }
+#endif
+    w.proc.kill(signal);
+}
+
+void WorkerPool::finish_forked(int pid, int status, int signal) {
+    for(auto* workers: {&stateless_workers, &stateful_workers}) {
+        for(auto& w: *workers) {
+            // A dead slot may still carry a pid the kernel has since reused.
+            if(w.forked_pid != pid || !w.forked_exit || w.forked_exit->exited.is_set())
+                continue;
+            w.forked_exit->status = status;
+            w.forked_exit->signal = signal;
+            w.forked_exit->exited.set();
+            return;
+        }
+    }
+}
+
+bool WorkerPool::spawn_worker(bool stateful, std::uint64_t memory_limit, bool standby) {
+    auto& workers = stateful ? stateful_workers : stateless_workers;
+    auto worker_index = workers.size();
+
+    WorkerProcess process{
+        .name = std::string(stateful ? "SF-" : "SL-") + std::to_string(worker_index),
+        .owned_documents = 0,
+    };
+    if(!launch_worker(process, stateful, memory_limit))
+        return false;
+
+    workers.push_back(std::move(process));
 
     auto& w = workers.back();
     w.alive = true;
-    if(!stateful)
+    w.standby = standby;
+    if(!stateful && !standby)
         alive_stateless_count += 1;
     io_group.spawn(w.peer->run());
+    if(options.trace)
+        w.peer->send_notification(worker::TraceParams{trace::clock()});
 
     return true;
 }
@@ -121,15 +486,22 @@ bool WorkerPool::start(const WorkerPoolOptions& opts) {
     stateless_workers.reserve(options.stateless_count);
     stateful_workers.reserve(options.stateful_count);
 
+    // Let workers hand large index payloads over through shared memory.
+    shared_blob::open_session();
+
+    setup_isolation();
+    if(options.zygote)
+        start_zygote();
+
     for(std::uint32_t i = 0; i < options.stateless_count; ++i) {
-        if(!spawn_worker(options.self_path, false, 0)) {
+        if(!spawn_worker(false, 0)) {
             return false;
         }
         monitor_group.spawn(monitor_worker(stateless_workers.size() - 1, false));
     }
 
     for(std::uint32_t i = 0; i < options.stateful_count; ++i) {
-        if(!spawn_worker(options.self_path, true, options.worker_memory_limit)) {
+        if(!spawn_worker(true, options.worker_memory_limit)) {
             return false;
         }
         monitor_group.spawn(monitor_worker(stateful_workers.size() - 1, true));
@@ -138,6 +510,7 @@ bool WorkerPool::start(const WorkerPoolOptions& opts) {
     // Register evicted notification handler for each stateful worker
     for(std::size_t i = 0; i < stateful_workers.size(); ++i) {
         stateful_workers[i].peer->on_notification([this](const worker::EvictedParams& params) {
+            eviction_count += 1;
             if(on_evicted) {
                 on_evicted(params.path);
             }
@@ -160,18 +533,71 @@ bool WorkerPool::start(const WorkerPoolOptions& opts) {
 
     slot_cancel_sources.resize(stateless_workers.size());
 
+    // A remote executor that cannot start leaves its builds to the others.
+    remote_workers.reserve(options.remote_executors.size());
+    for(std::size_t i = 0; i < options.remote_executors.size(); ++i) {
+        remote_workers.push_back(WorkerProcess{.name = "RX-" + std::to_string(i)});
+        auto& w = remote_workers.back();
+        w.alive = !options.remote_executors[i].empty() && launch_remote(w, i);
+        if(!w.alive)
+            continue;
+        alive_remote_count += 1;
+        monitor_group.spawn(monitor_remote(i));
+    }
+
+    ensure_standby();
     monitor_group.spawn(monitor_memory());
 
-    LOG_INFO("WorkerPool started: {} stateless, {} stateful workers",
+    LOG_INFO("WorkerPool started: {} stateless, {} stateful workers, {} remote executors",
              stateless_workers.size(),
-             stateful_workers.size());
+             stateful_workers.size(),
+             alive_remote_count);
     return true;
 }
 
+void WorkerPool::start_zygote() {
+    zygote = std::make_unique<ZygoteClient>(loop);
+    if(!zygote->start(options.self_path, log_dir)) {
+        zygote.reset();
+        return;
+    }
+
+    zygote->on_exit = [this](int pid, int status, int signal) {
+        finish_forked(pid, status, signal);
+    };
+
+    // Forked workers die with the zygote (PR_SET_PDEATHSIG) and their exit
+    // reports are lost: complete them all as killed, so monitor_worker
+    // respawns them through exec.
+    zygote->on_lost = [this]() {
+        if(!shutting_down)
+            LOG_WARN("Zygote exited, spawning workers directly from now on");
+        for(auto* workers: {&stateless_workers, &stateful_workers}) {
+            for(auto& w: *workers) {
+                if(!w.forked_exit || w.forked_exit->exited.is_set())
+                    continue;
+                signal_worker(w, SIGKILL);
+                w.forked_exit->signal = SIGKILL;
+                w.forked_exit->exited.set();
+            }
+        }
+    };
+
+    io_group.spawn(drain_stderr(std::move(*zygote->stderr_pipe), "[zygote]"));
+    monitor_group.spawn(zygote->run());
+    LOG_INFO("Forking workers from zygote");
+}
+
 kota::task<> WorkerPool::stop() {
     LOG_INFO("WorkerPool stopping...");
     shutting_down = true;
     fail_pending_requests();
+    while(!remote_queue.empty()) {
+        auto* next = remote_queue.front();
+        remote_queue.pop_front();
+        next->queued = false;
+        next->ready.set();
+    }
 
     // Retired workers (scale-down) have their peer moved to retired_peers
     // and their process already exited — skip them to avoid null deref / SEGV.
@@ -181,16 +607,29 @@ kota::task<> WorkerPool::stop() {
     for(auto& w: stateful_workers)
         if(w.peer)
             w.peer->close_output();
+    for(auto& w: remote_workers)
+        if(w.peer)
+            w.peer->close_output();
 
     for(auto& w: stateless_workers)
         if(w.alive)
-            w.proc.kill(SIGTERM);
+            signal_worker(w, SIGTERM);
     for(auto& w: stateful_workers)
         if(w.alive)
-            w.proc.kill(SIGTERM);
+            signal_worker(w, SIGTERM);
+    for(auto& w: remote_workers)
+        if(w.alive)
+            signal_worker(w, SIGTERM);
+
+    // The zygote exits on EOF; its run() then completes any forked worker
+    // exit it did not get to report.
+    if(zygote)
+        zygote->stop();
 
     co_await kota::when_all(monitor_group.join(), io_group.join());
 
+    shared_blob::close_session();
+
     LOG_INFO("WorkerPool stopped");
 }
 
@@ -219,16 +658,82 @@ std::size_t WorkerPool::assign_worker(std::uint32_t path_id) {
 std::size_t WorkerPool::pick_least_loaded() {
     std::size_t best = 0;
     for(std::size_t i = 1; i < stateful_workers.size(); ++i) {
-        if(!stateful_workers[i].alive)
+        auto& cur = stateful_workers[i];
+        if(!cur.alive || cur.retiring)
             continue;
-        if(!stateful_workers[best].alive ||
-           stateful_workers[i].owned_documents < stateful_workers[best].owned_documents) {
+        auto& top = stateful_workers[best];
+        if(!top.alive || top.retiring || cur.memory_usage < top.memory_usage ||
+           (cur.memory_usage == top.memory_usage && cur.owned_documents < top.owned_documents)) {
             best = i;
         }
     }
     return best;
 }
 
+void WorkerPool::record_memory(std::uint32_t path_id, std::size_t worker_index, std::size_t bytes) {
+    auto it = owner.find(path_id);
+    if(it == owner.end() || it->second != worker_index)
+        return;
+
+    auto& slot = owner_memory[path_id];
+    auto& w = stateful_workers[worker_index];
+    w.memory_usage = w.memory_usage - slot + bytes;
+    slot = bytes;
+}
+
+void WorkerPool::rebalance_stateful() {
+    if(!options.stateful_migration || !on_migrate || stateful_workers.size() < 2)
+        return;
+    if(migration_cooldown > 0) {
+        migration_cooldown -= 1;
+        return;
+    }
+
+    std::optional<std::size_t> heavy;
+    std::optional<std::size_t> light;
+    for(std::size_t i = 0; i < stateful_workers.size(); ++i) {
+        auto& w = stateful_workers[i];
+        if(!w.alive || w.retiring)
+            continue;
+        if(!heavy || w.memory_usage > stateful_workers[*heavy].memory_usage)
+            heavy = i;
+        if(!light || w.memory_usage < stateful_workers[*light].memory_usage)
+            light = i;
+    }
+    if(!heavy || !light || *heavy == *light)
+        return;
+
+    // Only act on a clear imbalance: twice the load of the lightest worker
+    // and a gap worth at least a quarter of the per-worker budget.
+    auto heavy_usage = stateful_workers[*heavy].memory_usage;
+    auto light_usage = stateful_workers[*light].memory_usage;
+    auto gap = heavy_usage - light_usage;
+    if(heavy_usage < light_usage * 2 || gap < options.worker_memory_limit / 4)
+        return;
+
+    // Move the coldest document that actually narrows the gap.
+    for(auto it = owner_lru.rbegin(); it != owner_lru.rend(); ++it) {
+        auto path_id = *it;
+        auto owner_it = owner.find(path_id);
+        if(owner_it == owner.end() || owner_it->second != *heavy)
+            continue;
+        auto mem_it = owner_memory.find(path_id);
+        if(mem_it == owner_memory.end() || mem_it->second == 0 || mem_it->second >= gap)
+            continue;
+
+        LOG_INFO("Migrating document {} off {} ({}MB held vs {}MB on {})",
+                 path_id,
+                 stateful_workers[*heavy].name,
+                 heavy_usage / (1024 * 1024),
+                 light_usage / (1024 * 1024),
+                 stateful_workers[*light].name);
+        migration_cooldown = migration_cooldown_ticks;
+        migration_count += 1;
+        on_migrate(path_id);
+        return;
+    }
+}
+
 void WorkerPool::remove_owner(std::uint32_t path_id) {
     auto it = owner.find(path_id);
     if(it == owner.end())
@@ -238,6 +743,11 @@ void WorkerPool::remove_owner(std::uint32_t path_id) {
     stateful_workers[worker_idx].owned_documents -= 1;
     owner.erase(it);
 
+    if(auto mem_it = owner_memory.find(path_id); mem_it != owner_memory.end()) {
+        stateful_workers[worker_idx].memory_usage -= mem_it->second;
+        owner_memory.erase(mem_it);
+    }
+
     auto lru_it = owner_lru_index.find(path_id);
     if(lru_it != owner_lru_index.end()) {
         owner_lru.erase(lru_it->second);
@@ -260,11 +770,52 @@ void WorkerPool::clear_owner(std::size_t worker_index) {
 kota::task<> WorkerPool::monitor_worker(std::size_t index, bool stateful) {
     auto& workers = stateful ? stateful_workers : stateless_workers;
 
-    auto result = co_await workers[index].proc.wait();
+    int exit_code = 0, exit_signal = 0;
+    if(auto* forked = workers[index].forked_exit.get()) {
+        co_await forked->exited.wait();
+        exit_code = forked->status;
+        exit_signal = forked->signal;
+    } else {
+        auto result = co_await workers[index].proc.wait();
+        if(result.has_value()) {
+            exit_code = result.value().status;
+            exit_signal = result.value().term_signal;
+        } else if(!shutting_down) {
+            LOG_ERROR("Worker {} lost: {}", workers[index].name, result.error().message());
+            exit_signal = 9;
+        }
+    }
 
     if(shutting_down)
         co_return;
 
+    // A standby was never in rotation: nothing to clean up but the peer.
+    // ensure_standby() replaces it on the next monitor tick.
+    if(!stateful && workers[index].standby) {
+        if(!workers[index].retiring) {
+            LOG_WARN("Standby worker {} exited unexpectedly", workers[index].name);
+            standby_failures += 1;
+        }
+        workers[index].alive = false;
+        workers[index].standby = false;
+        if(workers[index].peer) {
+            workers[index].peer->close();
+            retired_peers.push_back(std::move(workers[index].peer));
+        }
+        co_return;
+    }
+
+    // A stateful worker retired by resize() handed its documents over then.
+    if(stateful && workers[index].retiring) {
+        LOG_INFO("Worker {} retired gracefully", workers[index].name);
+        workers[index].alive = false;
+        if(workers[index].peer) {
+            workers[index].peer->close();
+            retired_peers.push_back(std::move(workers[index].peer));
+        }
+        co_return;
+    }
+
     // Intentional retirement (scale-down): skip crash processing and respawn.
     if(!stateful && workers[index].retiring) {
         LOG_INFO("Worker {} retired gracefully", workers[index].name);
@@ -288,15 +839,6 @@ kota::task<> WorkerPool::monitor_worker(std::size_t index, bool stateful) {
         co_return;
     }
 
-    int exit_code = 0, exit_signal = 0;
-    if(result.has_value()) {
-        exit_code = result.value().status;
-        exit_signal = result.value().term_signal;
-    } else {
-        LOG_ERROR("Worker {} lost: {}", workers[index].name, result.error().message());
-        exit_signal = 9;
-    }
-
     if(process_crash(index, stateful, exit_code, exit_signal)) {
         if(!respawn_worker(index, stateful)) {
             LOG_ERROR("Worker {} respawn failed", workers[index].name);
@@ -318,6 +860,7 @@ bool WorkerPool::process_crash(std::size_t index, bool stateful, int exit_code,
     auto& workers = stateful ? stateful_workers : stateless_workers;
     auto& w = workers[index];
     w.alive = false;
+    crash_count += 1;
 
     if(exit_signal != 0) {
         LOG_ERROR("Worker {} killed by signal {} (restarts: {})",
@@ -330,6 +873,11 @@ bool WorkerPool::process_crash(std::size_t index, bool stateful, int exit_code,
                   exit_code,
                   w.restart_count);
     }
+    if(cgroups && cgroups->oom_kills(w.name) > w.oom_kills) {
+        LOG_ERROR("Worker {} exceeded memory.max of its cgroup ({}MB)",
+                  w.name,
+                  (options.worker_memory_limit + options.worker_memory_limit / 2) / (1024 * 1024));
+    }
 
     WorkerCrashInfo info;
     info.worker_index = index;
@@ -397,56 +945,26 @@ bool WorkerPool::respawn_worker(std::size_t index, bool stateful) {
         retired_peers.push_back(std::move(workers[index].peer));
     }
 
-    kota::process::options opts;
-    opts.file = options.self_path;
-    opts.args = {options.self_path, "worker"};
-    if(stateful) {
-        opts.args.push_back("--stateful");
-        opts.args.push_back("--memory-limit");
-        opts.args.push_back(std::to_string(options.worker_memory_limit));
-    }
-    opts.args.push_back("--worker-name");
-    opts.args.push_back(worker_name);
-    if(!log_dir.empty()) {
-        opts.args.push_back("--log-dir");
-        opts.args.push_back(log_dir);
-    }
-    opts.streams = {
-        kota::process::stdio::pipe(true, false),
-        kota::process::stdio::pipe(false, true),
-        kota::process::stdio::pipe(false, true),
-    };
-
-    auto result = kota::process::spawn(opts, loop);
-    if(!result) {
-        LOG_ERROR("Failed to respawn worker {}: {}", worker_name, result.error().message());
-        return false;
-    }
-
-    auto& spawn = *result;
-    auto transport = std::make_unique<kota::ipc::StreamTransport>(std::move(spawn.stdout_pipe),
-                                                                  std::move(spawn.stdin_pipe));
-    auto peer = std::make_unique<kota::ipc::BincodePeer>(loop, std::move(transport));
-
-    std::string prefix = "[" + worker_name + "]";
-    io_group.spawn(drain_stderr(std::move(spawn.stderr_pipe), prefix));
-
-    workers[index] = WorkerProcess{
-        .proc = std::move(spawn.proc),
-        .peer = std::move(peer),
+    WorkerProcess process{
         .name = worker_name,
         .owned_documents = 0,
         .alive = true,
         .busy = false,
         .low_priority = false,
         .restart_count = old_restart_count,
+        .telemetry = workers[index].telemetry,
     };
+    if(!launch_worker(process, stateful, stateful ? options.worker_memory_limit : 0))
+        return false;
+    workers[index] = std::move(process);
 
     if(!stateful)
         alive_stateless_count += 1;
 
     auto& w = workers[index];
     io_group.spawn(w.peer->run());
+    if(options.trace)
+        w.peer->send_notification(worker::TraceParams{trace::clock()});
 
     // Dispatch pending requests now that a fresh worker is available.
     if(!stateful)
@@ -454,6 +972,7 @@ bool WorkerPool::respawn_worker(std::size_t index, bool stateful) {
 
     if(stateful) {
         w.peer->on_notification([this](const worker::EvictedParams& params) {
+            eviction_count += 1;
             if(on_evicted)
                 on_evicted(params.path);
         });
@@ -466,7 +985,9 @@ bool WorkerPool::respawn_worker(std::size_t index, bool stateful) {
 }
 
 kota::task<std::size_t> WorkerPool::acquire_stateless_slot(worker::Priority priority,
-                                                           std::size_t exclude) {
+                                                           std::size_t exclude,
+                                                           double cost_ms,
+                                                           const worker::BuildParams* build) {
     using P = worker::Priority;
     auto can_proceed = [&]() {
         auto idle = alive_stateless_count - stateless_busy_count;
@@ -477,13 +998,13 @@ kota::task<std::size_t> WorkerPool::acquire_stateless_slot(worker::Priority prio
             idle -= 1;
         // Don't count retiring workers — they are alive but won't accept work.
         for(auto& w: stateless_workers)
-            if(w.retiring && w.alive && !w.busy)
+            if(w.retiring && w.alive && !w.busy && !w.standby)
                 idle -= 1;
         if(idle == 0)
             return false;
         if(priority == P::High)
             return true;
-        return low_busy_count < low_limit;
+        return low_busy_count < effective_low_limit();
     };
 
     while(true) {
@@ -497,15 +1018,20 @@ kota::task<std::size_t> WorkerPool::acquire_stateless_slot(worker::Priority prio
             //   - dispatched but cancelled before StatelessSlot → releases slot
             PendingStateless pending(priority);
             pending.pool = this;
+            pending.cost_ms = cost_ms;
+            pending.build = build;
+            pending.enqueued_at = std::chrono::steady_clock::now();
             if(priority == P::High) {
                 high_queue.push_back(&pending);
                 pending.queue = &high_queue;
+                arm_preemption();
             } else {
-                low_queue.push_back(&pending);
-                pending.queue = &low_queue;
+                push_low_pending(pending);
             }
+            maybe_scale_ahead();
             co_await pending.ready.wait();
             pending.pool = nullptr;  // claimed — StatelessSlot will handle release
+            priority = pending.priority;  // promote() may have raised it
 
             if(pending.assigned_worker == SIZE_MAX)
                 co_return SIZE_MAX;
@@ -522,6 +1048,7 @@ kota::task<std::size_t> WorkerPool::acquire_stateless_slot(worker::Priority prio
         auto idx = pick_idle_stateless();
         stateless_workers[idx].busy = true;
         stateless_workers[idx].low_priority = (priority == P::Low);
+        weigh_worker(stateless_workers[idx]);
         stateless_busy_count += 1;
         if(priority == P::Low)
             low_busy_count += 1;
@@ -537,8 +1064,15 @@ void WorkerPool::release_stateless_slot(std::size_t worker_index) {
         slot_cancel_sources[worker_index].reset();
     if(stateless_workers[worker_index].low_priority)
         low_busy_count -= 1;
-    stateless_workers[worker_index].busy = false;
-    stateless_workers[worker_index].low_priority = false;
+    auto& w = stateless_workers[worker_index];
+    w.busy = false;
+    if(w.low_priority) {
+        w.low_priority = false;
+        weigh_worker(w);
+    }
+    w.preemptible = false;
+    w.preempted = false;
+    w.current_file.clear();
     stateless_busy_count -= 1;
     LOG_DEBUG("Release {} (busy={}, low_busy={})",
               stateless_workers[worker_index].name,
@@ -551,18 +1085,25 @@ void WorkerPool::try_dispatch_pending() {
     // Subtract retiring workers from idle count — they won't accept new work.
     std::size_t retiring_idle = 0;
     for(auto& w: stateless_workers)
-        if(w.retiring && w.alive && !w.busy)
+        if(w.retiring && w.alive && !w.busy && !w.standby)
             retiring_idle += 1;
     auto idle = alive_stateless_count - stateless_busy_count - retiring_idle;
 
-    auto dispatch = [&](std::deque<PendingStateless*>& queue, bool is_low) {
-        while(!queue.empty() && idle > 0 && (!is_low || low_busy_count < low_limit)) {
-            auto* next = queue.front();
-            queue.pop_front();
-            next->queue = nullptr;
+    auto dispatch = [&](bool is_low) {
+        while(!(is_low ? low_queue.empty() : high_queue.empty()) && idle > 0 &&
+              (!is_low || low_busy_count < effective_low_limit())) {
+            PendingStateless* next;
+            if(is_low) {
+                next = pop_low_pending();
+            } else {
+                next = high_queue.front();
+                high_queue.pop_front();
+                next->queue = nullptr;
+            }
             auto idx = pick_idle_stateless();
             stateless_workers[idx].busy = true;
             stateless_workers[idx].low_priority = is_low;
+            weigh_worker(stateless_workers[idx]);
             stateless_busy_count += 1;
             if(is_low)
                 low_busy_count += 1;
@@ -579,8 +1120,151 @@ void WorkerPool::try_dispatch_pending() {
         }
     };
 
-    dispatch(high_queue, false);
-    dispatch(low_queue, true);
+    dispatch(false);
+    dispatch(true);
+
+    maybe_scale_ahead();
+}
+
+bool WorkerPool::promote(worker::BuildKind kind, llvm::StringRef file) {
+    bool promoted = false;
+    for(auto it = low_queue.begin(); it != low_queue.end();) {
+        auto* pending = it->second;
+        if(!pending->build || pending->build->kind != kind || pending->build->file != file) {
+            ++it;
+            continue;
+        }
+        it = low_queue.erase(it);
+        pending->low_queue = nullptr;
+        pending->priority = worker::Priority::High;
+        high_queue.push_back(pending);
+        pending->queue = &high_queue;
+        promoted = true;
+    }
+
+    if(promoted) {
+        LOG_DEBUG("Promoted queued builds of {} to high priority", file);
+        try_dispatch_pending();
+        if(!high_queue.empty())
+            arm_preemption();
+    }
+    return promoted;
+}
+
+void WorkerPool::push_low_pending(PendingStateless& pending) {
+    // Whatever the heap still holds refers to entries gone.
+    if(low_queue.empty())
+        low_by_cost = {};
+    pending.low_seq = low_arrivals++;
+    pending.low_queue = &low_queue;
+    low_queue.emplace(pending.low_seq, &pending);
+    low_by_cost.emplace(pending.cost_ms, pending.low_seq);
+}
+
+WorkerPool::PendingStateless* WorkerPool::pop_low_pending() {
+    auto pick = low_queue.begin();
+    auto waited = std::chrono::steady_clock::now() - pick->second->enqueued_at;
+    if(waited < low_starvation) {
+        // Entries that left the queue another way are dropped on the way.
+        while(true) {
+            auto seq = low_by_cost.top().second;
+            low_by_cost.pop();
+            if(auto it = low_queue.find(seq); it != low_queue.end()) {
+                pick = it;
+                break;
+            }
+        }
+    }
+    auto* next = pick->second;
+    low_queue.erase(pick);
+    next->low_queue = nullptr;
+    return next;
+}
+
+double WorkerPool::estimate_cost(const worker::BuildParams& params) const {
+    auto kind = static_cast<std::size_t>(params.kind);
+    auto& files = file_cost_ms[kind];
+    auto cost = [&](llvm::StringRef file) {
+        if(auto it = files.find(file); it != files.end())
+            return it->second;
+        return kind_cost_ms[kind];
+    };
+
+    if(params.batch.empty())
+        return cost(params.file);
+    double total = 0;
+    for(auto& target: params.batch)
+        total += cost(target.file);
+    return total;
+}
+
+void WorkerPool::record_cost(const worker::BuildParams& params, double ms) {
+    record_cost(params.kind, params.file, ms);
+}
+
+void WorkerPool::record_cost(worker::BuildKind kind, llvm::StringRef file, double ms) {
+    // EWMA with alpha = 1/4: recent builds dominate, one outlier doesn't.
+    auto blend = [ms](double& slot) {
+        slot = slot == 0 ? ms : slot * 0.75 + ms * 0.25;
+    };
+    auto index = static_cast<std::size_t>(kind);
+    blend(kind_cost_ms[index]);
+    blend(file_cost_ms[index][file]);
+}
+
+void WorkerPool::arm_preemption() {
+    if(preemption_armed || shutting_down)
+        return;
+    preemption_armed = true;
+    monitor_group.spawn(preempt_after_deadline());
+}
+
+kota::task<> WorkerPool::preempt_after_deadline() {
+    auto deadline = std::chrono::milliseconds(options.high_wait_deadline_ms);
+    while(true) {
+        co_await kota::sleep(deadline, loop);
+        if(shutting_down || high_queue.empty()) {
+            preemption_armed = false;
+            co_return;
+        }
+
+        auto waited = std::chrono::steady_clock::now() - high_queue.front()->enqueued_at;
+        if(waited >= deadline)
+            preempt_low_for_high();
+    }
+}
+
+bool WorkerPool::preempt_low_for_high() {
+    auto now = std::chrono::steady_clock::now();
+    std::size_t victim = SIZE_MAX;
+    double victim_remaining = 0;
+    for(std::size_t i = 0; i < stateless_workers.size(); ++i) {
+        auto& w = stateless_workers[i];
+        if(!w.alive || !w.busy || !w.preemptible || w.preempted)
+            continue;
+        if(i >= slot_cancel_sources.size() || !slot_cancel_sources[i])
+            continue;
+        auto elapsed = std::chrono::duration<double, std::milli>(now - w.started_at).count();
+        auto remaining = w.current_cost_ms - elapsed;
+        if(victim == SIZE_MAX || remaining > victim_remaining) {
+            victim = i;
+            victim_remaining = remaining;
+        }
+    }
+    if(victim == SIZE_MAX)
+        return false;
+
+    auto& w = stateless_workers[victim];
+    LOG_INFO("Preempting {} on {} for high-priority request (~{:.0f}ms left)",
+             w.current_file,
+             w.name,
+             victim_remaining);
+    w.preempted = true;
+    if(w.peer)
+        w.peer->send_notification(worker::PreemptParams{w.current_file});
+    slot_cancel_sources[victim]->cancel();
+    preemption_count += 1;
+    return true;
 }
 
 void WorkerPool::fail_pending_requests() {
@@ -595,24 +1279,230 @@ void WorkerPool::fail_pending_requests() {
         }
     };
     drain(high_queue);
-    drain(low_queue);
+    for(auto& [seq, next]: low_queue) {
+        next->low_queue = nullptr;
+        next->assigned_worker = SIZE_MAX;
+        next->ready.set();
+    }
+    low_queue.clear();
+    low_by_cost = {};
 }
 
 std::size_t WorkerPool::pick_idle_stateless(std::size_t exclude) {
     for(std::size_t i = 0; i < stateless_workers.size(); ++i) {
         if(i != exclude && stateless_workers[i].alive && !stateless_workers[i].busy &&
-           !stateless_workers[i].retiring)
+           !stateless_workers[i].retiring && !stateless_workers[i].standby)
             return i;
     }
     llvm_unreachable("pick_idle_stateless called with no idle workers");
 }
 
+bool WorkerPool::prefer_remote() const {
+    if(alive_remote_count == 0)
+        return false;
+    if(remote_busy_count < alive_remote_count)
+        return true;
+    return remote_queue.size() * effective_low_limit() < low_queue.size() * alive_remote_count;
+}
+
+bool WorkerPool::launch_remote(WorkerProcess& w, std::size_t index) {
+    auto& command = options.remote_executors[index];
+    kota::process::options opts;
+    opts.file = command.front();
+    if(!llvm::StringRef(opts.file).contains('/')) {
+        if(auto found = llvm::sys::findProgramByName(opts.file))
+            opts.file = *found;
+    }
+    opts.args = command;
+    opts.args.push_back("worker");
+    opts.args.push_back("--worker-name");
+    opts.args.push_back(w.name);
+    opts.streams = {
+        kota::process::stdio::pipe(true, false),
+        kota::process::stdio::pipe(false, true),
+        kota::process::stdio::pipe(false, true),
+    };
+
+    auto result = kota::process::spawn(opts, loop);
+    if(!result) {
+        LOG_ERROR("Failed to start remote executor {} ({}): {}",
+                  w.name,
+                  command.front(),
+                  result.error().message());
+        return false;
+    }
+
+    auto& spawn = *result;
+    auto transport = std::make_unique<kota::ipc::StreamTransport>(std::move(spawn.stdout_pipe),
+                                                                  std::move(spawn.stdin_pipe));
+    w.peer = std::make_unique<kota::ipc::BincodePeer>(loop, std::move(transport));
+    w.proc = std::move(spawn.proc);
+    watch_indexed(w);
+    io_group.spawn(drain_stderr(std::move(spawn.stderr_pipe), "[" + w.name + "]"));
+    io_group.spawn(w.peer->run());
+    return true;
+}
+
+kota::task<> WorkerPool::monitor_remote(std::size_t index) {
+    auto result = co_await remote_workers[index].proc.wait();
+    if(shutting_down)
+        co_return;
+
+    auto& w = remote_workers[index];
+    if(result.has_value()) {
+        LOG_WARN("Remote executor {} exited with code {} (restarts: {})",
+                 w.name,
+                 result.value().status,
+                 w.restart_count);
+    } else {
+        LOG_WARN("Remote executor {} lost: {}", w.name, result.error().message());
+    }
+    w.alive = false;
+    alive_remote_count -= 1;
+    if(w.busy) {
+        w.busy = false;
+        remote_busy_count -= 1;
+    }
+    if(w.peer) {
+        w.peer->close();
+        retired_peers.push_back(std::move(w.peer));
+    }
+
+    if(w.restart_count < options.max_restarts) {
+        WorkerProcess process{
+            .name = w.name,
+            .restart_count = w.restart_count + 1,
+            .telemetry = w.telemetry,
+        };
+        if(launch_remote(process, index)) {
+            remote_workers[index] = std::move(process);
+            alive_remote_count += 1;
+            monitor_group.spawn(monitor_remote(index));
+            LOG_INFO("Remote executor {} restarted (attempt {})",
+                     remote_workers[index].name,
+                     remote_workers[index].restart_count);
+        }
+    } else {
+        LOG_ERROR("Remote executor {} exceeded max restarts ({}), giving up",
+                  w.name,
+                  options.max_restarts);
+    }
+
+    // Builds still waiting for an executor go back to the local workers
+    // once none is left.
+    if(alive_remote_count == 0) {
+        while(!remote_queue.empty()) {
+            auto* next = remote_queue.front();
+            remote_queue.pop_front();
+            next->queued = false;
+            next->ready.set();
+        }
+    } else {
+        release_remote_slot(SIZE_MAX);
+    }
+}
+
+kota::task<std::size_t> WorkerPool::acquire_remote_slot() {
+    while(true) {
+        if(alive_remote_count == 0 || shutting_down)
+            co_return SIZE_MAX;
+
+        if(remote_busy_count == alive_remote_count) {
+            PendingRemote pending;
+            pending.pool = this;
+            pending.queued = true;
+            remote_queue.push_back(&pending);
+            co_await pending.ready.wait();
+            pending.pool = nullptr;
+            if(pending.assigned == SIZE_MAX)
+                co_return SIZE_MAX;
+            if(remote_workers[pending.assigned].restart_count != pending.assigned_gen)
+                continue;
+            co_return pending.assigned;
+        }
+
+        for(std::size_t i = 0; i < remote_workers.size(); ++i) {
+            auto& w = remote_workers[i];
+            if(w.alive && !w.busy) {
+                w.busy = true;
+                remote_busy_count += 1;
+                co_return i;
+            }
+        }
+        llvm_unreachable("acquire_remote_slot found no idle executor");
+    }
+}
+
+void WorkerPool::release_remote_slot(std::size_t index) {
+    if(index < remote_workers.size() && remote_workers[index].busy) {
+        auto& w = remote_workers[index];
+        w.busy = false;
+        w.current_file.clear();
+        remote_busy_count -= 1;
+    }
+
+    // Hand the idle executors to the builds waiting for one.
+    for(std::size_t i = 0; i < remote_workers.size() && !remote_queue.empty(); ++i) {
+        auto& w = remote_workers[i];
+        if(!w.alive || w.busy)
+            continue;
+        auto* next = remote_queue.front();
+        remote_queue.pop_front();
+        next->queued = false;
+        next->assigned = i;
+        next->assigned_gen = w.restart_count;
+        w.busy = true;
+        remote_busy_count += 1;
+        next->ready.set();
+    }
+}
+
+RequestResult<worker::BuildParams> WorkerPool::send_remote(const worker::BuildParams& params,
+                                                           kota::ipc::request_options opts) {
+    auto idx = co_await acquire_remote_slot();
+    if(idx == SIZE_MAX)
+        co_return kota::outcome_error(kota::ipc::Error{"No remote executor available"});
+
+    struct Slot {
+        WorkerPool& pool;
+        std::size_t index;
+        unsigned gen;
+
+        ~Slot() {
+            if(pool.remote_workers[index].restart_count == gen)
+                pool.release_remote_slot(index);
+        }
+    } slot{*this, idx, remote_workers[idx].restart_count};
+
+    if(opts.token && opts.token->cancelled())
+        co_return kota::outcome_error(kota::ipc::Error{"Request cancelled"});
+
+    auto remote = to_remote(params, options.remote_paths);
+    auto started = std::chrono::steady_clock::now();
+    remote_workers[idx].current_file = params.file;
+    remote_workers[idx].started_at = started;
+    auto result = co_await send_compacted(remote_workers, idx, remote, opts);
+    record_request(remote_workers[idx], started, result.has_value());
+
+    if(!result.has_value()) {
+        LOG_WARN("Remote Index of {} failed: {}", params.file, result.error().message);
+    } else if(params.batch.empty()) {
+        // Batched builds are accounted per TU as they stream in.
+        auto elapsed = std::chrono::steady_clock::now() - started;
+        record_cost(params, std::chrono::duration<double, std::milli>(elapsed).count());
+        kind_latency[static_cast<std::size_t>(params.kind)].record(elapsed);
+    }
+    co_return std::move(result);
+}
+
 kota::task<> WorkerPool::monitor_memory() {
     while(true) {
         co_await kota::sleep(std::chrono::milliseconds(3000), loop);
         if(shutting_down)
             co_return;
 
+        sample_peak_memory();
+
         auto mem = kota::sys::memory();
         if(mem.total == 0)
             continue;
@@ -671,8 +1561,12 @@ kota::task<> WorkerPool::monitor_memory() {
             try_dispatch_pending();
         }
 
+        update_load_cap();
+
         // Outer loop: dynamic scaling.
         check_scaling();
+        ensure_standby();
+        rebalance_stateful();
 
         // Severe pressure: also scale down immediately.
         if(ratio < 0.10 && alive_stateless_count > options.min_stateless) {
@@ -698,26 +1592,109 @@ bool WorkerPool::scale_up_worker() {
     if(alive_stateless_count >= options.max_stateless)
         return false;
 
-    auto new_index = stateless_workers.size();
-    if(!spawn_worker(options.self_path, false, 0)) {
-        LOG_WARN("scale_up: spawn_worker failed");
-        return false;
+    auto new_index = promote_standby();
+    bool promoted = new_index != SIZE_MAX;
+    if(!promoted) {
+        new_index = stateless_workers.size();
+        if(!spawn_worker(false, 0)) {
+            LOG_WARN("scale_up: spawn_worker failed");
+            return false;
+        }
+        slot_cancel_sources.push_back(nullptr);
+        monitor_group.spawn(monitor_worker(new_index, false));
     }
 
-    slot_cancel_sources.push_back(nullptr);
-    monitor_group.spawn(monitor_worker(new_index, false));
-
     max_low_limit = alive_stateless_count > 1 ? alive_stateless_count - 1 : alive_stateless_count;
     low_limit = max_low_limit;
     w_max = 0;
-    try_dispatch_pending();
 
-    LOG_INFO("Scaled up: spawned {} (alive={})",
-             stateless_workers.back().name,
+    LOG_INFO("Scaled up: {} {} (alive={})",
+             promoted ? "promoted standby" : "spawned",
+             stateless_workers[new_index].name,
              alive_stateless_count);
+
+    try_dispatch_pending();
+    ensure_standby();
     return true;
 }
 
+std::size_t WorkerPool::promote_standby() {
+    for(std::size_t i = 0; i < stateless_workers.size(); ++i) {
+        auto& w = stateless_workers[i];
+        if(!w.alive || !w.standby || w.retiring)
+            continue;
+        w.standby = false;
+        alive_stateless_count += 1;
+        standby_failures = 0;
+        return i;
+    }
+    return SIZE_MAX;
+}
+
+void WorkerPool::ensure_standby() {
+    if(!options.warm_standby || shutting_down)
+        return;
+
+    std::size_t standby = SIZE_MAX;
+    for(std::size_t i = 0; i < stateless_workers.size(); ++i) {
+        auto& w = stateless_workers[i];
+        if(w.alive && w.standby && !w.retiring)
+            standby = i;
+    }
+
+    // A standby only pays off if it can be promoted, and is the first
+    // thing to give back under memory pressure.
+    bool wanted = alive_stateless_count < options.max_stateless;
+    if(standby != SIZE_MAX) {
+        if(!wanted || available_memory_ratio() < 0.10) {
+            auto& w = stateless_workers[standby];
+            w.retiring = true;
+            w.peer->close_output();
+            signal_worker(w, SIGTERM);
+            LOG_INFO("Retiring standby worker {}", w.name);
+        }
+        return;
+    }
+
+    if(!wanted || standby_failures > options.max_restarts || available_memory_ratio() <= 0.30)
+        return;
+
+    auto index = stateless_workers.size();
+    if(!spawn_worker(false, 0, /*standby=*/true)) {
+        standby_failures += 1;
+        return;
+    }
+    slot_cancel_sources.push_back(nullptr);
+    monitor_group.spawn(monitor_worker(index, false));
+    LOG_DEBUG("Spawned standby worker {}", stateless_workers[index].name);
+}
+
+void WorkerPool::maybe_scale_ahead() {
+    auto depth = high_queue.size() + low_queue.size();
+    bool growing = depth > last_queue_depth;
+    last_queue_depth = depth;
+
+    // Deep (at least two jobs queued per worker) and still growing: a
+    // burst like a branch switch dirtying hundreds of files.  Waiting for
+    // the monitor's saturation ticks would add seconds to every job.
+    if(!growing || depth < 2 * std::max<std::size_t>(alive_stateless_count, 1))
+        return;
+    if(alive_stateless_count >= options.max_stateless || shutting_down)
+        return;
+
+    auto now = std::chrono::steady_clock::now();
+    if(now - last_scale_ahead < scale_ahead_interval)
+        return;
+    last_scale_ahead = now;
+
+    if(available_memory_ratio() <= 0.30)
+        return;
+
+    LOG_INFO("Scaling ahead of demand: {} queued, {} workers", depth, alive_stateless_count);
+    if(scale_up_worker())
+        saturated_cycles = 0;
+}
+
 void WorkerPool::retire_idle_worker() {
     if(shutting_down)
         return;
@@ -725,7 +1702,7 @@ void WorkerPool::retire_idle_worker() {
     // monitor_worker) to avoid retiring below min_stateless.
     std::size_t pending_retires = 0;
     for(auto& w: stateless_workers)
-        if(w.retiring && w.alive)
+        if(w.retiring && w.alive && !w.standby)
             pending_retires += 1;
     if(alive_stateless_count - pending_retires <= options.min_stateless)
         return;
@@ -733,7 +1710,7 @@ void WorkerPool::retire_idle_worker() {
     std::size_t target = SIZE_MAX;
     for(std::size_t i = stateless_workers.size(); i-- > 0;) {
         auto& w = stateless_workers[i];
-        if(w.alive && !w.busy && !w.retiring) {
+        if(w.alive && !w.busy && !w.retiring && !w.standby) {
             target = i;
             break;
         }
@@ -745,11 +1722,140 @@ void WorkerPool::retire_idle_worker() {
     auto& w = stateless_workers[target];
     w.retiring = true;
     w.peer->close_output();
-    w.proc.kill(SIGTERM);
+    signal_worker(w, SIGTERM);
 
     LOG_INFO("Retiring worker {} (alive={})", w.name, alive_stateless_count);
 }
 
+bool WorkerPool::retire_stateful_worker() {
+    for(std::size_t i = stateful_workers.size(); i-- > 0;) {
+        auto& w = stateful_workers[i];
+        if(!w.alive || w.retiring)
+            continue;
+
+        WorkerCrashInfo info;
+        info.worker_index = i;
+        info.stateful = true;
+        info.restart_count = w.restart_count;
+        info.will_restart = false;
+        for(auto& [path_id, widx]: owner) {
+            if(widx == i)
+                info.lost_documents.push_back(path_id);
+        }
+        clear_owner(i);
+
+        w.retiring = true;
+        w.peer->close_output();
+        signal_worker(w, SIGTERM);
+        LOG_INFO("Retiring worker {} ({} documents)", w.name, info.lost_documents.size());
+        if(on_crash)
+            on_crash(info);
+        return true;
+    }
+    return false;
+}
+
+void WorkerPool::resize(const WorkerPoolOptions& opts) {
+    if(shutting_down)
+        return;
+
+    options.stateless_count = opts.stateless_count;
+    options.max_stateless = opts.max_stateless == 0 ? kota::sys::parallelism() : opts.max_stateless;
+    options.min_stateless = opts.min_stateless == 0 ? 1 : opts.min_stateless;
+    options.min_stateless = std::min(options.min_stateless, options.stateless_count);
+    options.max_stateless = std::max(options.max_stateless, options.stateless_count);
+
+    while(alive_stateless_count < options.stateless_count && scale_up_worker()) {}
+    for(auto count = alive_stateless_count; count > options.stateless_count; --count) {
+        retire_idle_worker();
+    }
+    ensure_standby();
+
+    std::uint32_t live = 0;
+    for(auto& w: stateful_workers) {
+        if(w.alive && !w.retiring)
+            live += 1;
+    }
+    for(; live > opts.stateful_count && live > 1; --live) {
+        if(!retire_stateful_worker())
+            break;
+    }
+    for(; live < opts.stateful_count; ++live) {
+        // Slots retired earlier are started again before new ones are added.
+        auto slot = std::ranges::find_if(stateful_workers, [](const WorkerProcess& w) {
+            return !w.alive && w.retiring;
+        });
+        if(slot != stateful_workers.end()) {
+            slot->retiring = false;
+            if(!respawn_worker(static_cast<std::size_t>(slot - stateful_workers.begin()), true))
+                break;
+            continue;
+        }
+
+        auto index = stateful_workers.size();
+        if(!spawn_worker(true, options.worker_memory_limit))
+            break;
+        stateful_workers[index].peer->on_notification(
+            [this](const worker::EvictedParams& params) {
+                eviction_count += 1;
+                if(on_evicted)
+                    on_evicted(params.path);
+            });
+        monitor_group.spawn(monitor_worker(index, true));
+    }
+    options.stateful_count = live;
+
+    LOG_INFO("WorkerPool resized: {} stateless (min={}, max={}), {} stateful workers",
+             alive_stateless_count,
+             options.min_stateless,
+             options.max_stateless,
+             live);
+}
+
+void WorkerPool::note_user_activity() {
+    last_user_activity = std::chrono::steady_clock::now();
+    if(options.adaptive_throttle && load_cap > 1) {
+        load_cap = 1;
+        LOG_DEBUG("load_cap -> 1 (user activity)");
+    }
+}
+
+void WorkerPool::update_load_cap() {
+    if(!options.adaptive_throttle)
+        return;
+
+    std::size_t cap = max_low_limit;
+    std::string_view reason = "idle machine";
+    if(auto load = system_load::load_average()) {
+        // The pool's busy workers are part of the load; the rest is other
+        // programs, which keep their cores.
+        auto cpus = static_cast<double>(std::max(1u, std::thread::hardware_concurrency()));
+        auto others = std::max(0.0, *load - static_cast<double>(stateless_busy_count));
+        auto free = others >= cpus ? 0 : static_cast<std::size_t>(cpus - others);
+        if(free < cap) {
+            cap = free;
+            reason = "system load";
+        }
+    }
+    if(cap > 1 && system_load::on_battery().value_or(false)) {
+        cap = 1;
+        reason = "on battery";
+    }
+    if(cap > 1 && std::chrono::steady_clock::now() - last_user_activity < user_activity_window) {
+        cap = 1;
+        reason = "user activity";
+    }
+    cap = std::max<std::size_t>(cap, 1);
+
+    if(cap == load_cap)
+        return;
+    bool raised = cap > load_cap;
+    load_cap = cap;
+    LOG_DEBUG("load_cap -> {} ({})", load_cap, reason);
+    if(raised)
+        try_dispatch_pending();
+}
+
 void WorkerPool::check_scaling() {
     if(shutting_down)
         return;
@@ -760,9 +1866,11 @@ void WorkerPool::check_scaling() {
     // The second condition handles the case where low_limit reserves a worker
     // for high-priority requests: the reserved slot stays idle, so busy_count
     // never equals alive_count, but the pool is effectively saturated for
-    // low-priority (indexing) work.
-    bool saturated = (stateless_busy_count == alive_stateless_count && has_queued) ||
-                     (low_busy_count >= low_limit && !low_queue.empty());
+    // low-priority (indexing) work.  Low-priority work held back by the
+    // load cap is not: more workers would sit idle.
+    bool saturated =
+        (stateless_busy_count == alive_stateless_count && has_queued) ||
+        (low_busy_count >= low_limit && load_cap >= low_limit && !low_queue.empty());
 
     if(saturated) {
         saturated_cycles += 1;
@@ -776,11 +1884,7 @@ void WorkerPool::check_scaling() {
     }
 
     if(saturated_cycles >= scale_up_ticks) {
-        auto mem = kota::sys::memory();
-        auto effective =
-            (mem.constrained > 0 && mem.constrained < mem.total) ? mem.constrained : mem.total;
-        auto ratio = effective > 0 ? static_cast<double>(mem.available) / effective : 1.0;
-        if(ratio > 0.30) {
+        if(available_memory_ratio() > 0.30) {
             if(scale_up_worker())
                 saturated_cycles = 0;
         }
@@ -1,19 +1,34 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <chrono>
 #include <cstdint>
 #include <deque>
 #include <functional>
 #include <list>
+#include <map>
 #include <memory>
+#include <optional>
+#include <queue>
+#include <string>
+#include <type_traits>
+#include <vector>
 
 #include "server/protocol/worker.h"
+#include "server/worker/argument_cache.h"
+#include "server/worker/file_changes.h"
+#include "server/worker/path_map.h"
+#include "server/worker/zygote.h"
+#include "support/cgroup.h"
+#include "support/trace.h"
 
 #include "kota/async/async.h"
 #include "kota/ipc/codec/bincode.h"
 #include "kota/ipc/peer.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
 
 namespace clice {
 
@@ -23,6 +38,13 @@ struct WorkerPoolFixture;
 
 }
 
+namespace ext {
+
+struct LatencyStats;
+struct WorkerStatsResult;
+
+}  // namespace ext
+
 using kota::ipc::RequestResult;
 
 /// Information about a worker crash, delivered via WorkerPool::on_crash.
@@ -60,6 +82,75 @@ struct WorkerPoolOptions {
     /// max_stateless: ceiling — never spawn above this count (0 = auto = CPU cores).
     std::uint32_t min_stateless = 1;
     std::uint32_t max_stateless = 0;
+
+    /// Live migration of stateful documents: when one worker holds far more
+    /// AST memory than the lightest one, move its coldest document over.
+    /// Requires an on_migrate handler.
+    bool stateful_migration = false;
+
+    /// Keep one extra stateless worker spawned but out of rotation, so
+    /// scaling up promotes a warm process instead of paying startup cost.
+    bool warm_standby = true;
+
+    /// Fork workers from a pre-initialized zygote process instead of
+    /// exec'ing self_path for each one (Linux only).  Spawns fall back to
+    /// exec whenever the zygote is unavailable.
+    bool zygote = false;
+
+    /// How long a high-priority stateless request may wait in the queue
+    /// before an in-flight low-priority Index job is preempted for it.
+    std::uint32_t high_wait_deadline_ms = 500;
+
+    /// Have every worker write a trace file into `log_dir` (see
+    /// support/trace.h), the master tracing already.
+    bool trace = false;
+
+    /// Cap concurrent low-priority jobs further by what else the machine
+    /// does: the cores other programs keep busy, the user typing, running
+    /// on battery (see update_load_cap()).
+    bool adaptive_throttle = false;
+
+    /// Dedicate the last `stateful_cpus` CPUs this process may use to the
+    /// stateful workers and keep stateless workers off them (Linux; 0 pins
+    /// nothing).
+    std::uint32_t stateful_cpus = 0;
+
+    /// Delegated cgroup v2 subtree to give every worker a leaf in (see
+    /// cgroup::Tree::open()), bounding each by worker_memory_limit through
+    /// memory.high and memory.max.  Empty to use no cgroups.
+    std::string cgroup;
+
+    /// With `cgroup`: the cpu.weight of a stateless worker while it runs a
+    /// low-priority job, against the default 100 of all others.
+    std::uint32_t indexing_cpu_weight = 20;
+
+    /// Commands that each start a worker on another machine, through ssh or
+    /// a build farm's job launcher, for low-priority Index builds besides
+    /// the local workers.  "worker --worker-name RX-<n>" is appended.
+    std::vector<std::vector<std::string>> remote_executors;
+
+    /// Where the remote executors find the master's files, by directory
+    /// prefix; empty when they see them at the same paths.
+    PathMap remote_paths;
+};
+
+/// Latency samples over fixed, roughly logarithmic buckets.
+struct LatencyHistogram {
+    constexpr static std::array<double, 12> bounds_ms =
+        {5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000};
+
+    std::array<std::uint64_t, bounds_ms.size() + 1> buckets{};
+    std::uint64_t count = 0;
+    double sum_ms = 0;
+    double max_ms = 0;
+
+    void record(double ms);
+
+    void record(std::chrono::steady_clock::duration elapsed) {
+        record(std::chrono::duration<double, std::milli>(elapsed).count());
+    }
+
+    ext::LatencyStats snapshot() const;
 };
 
 class WorkerPool {
@@ -72,6 +163,13 @@ public:
     /// Gracefully stop all workers.
     kota::task<> stop();
 
+    /// Apply the worker counts of `opts` (a reloaded configuration) to the
+    /// running pool.  The stateless bounds change and the pool scales to
+    /// them, busy workers retiring once idle.  Stateful workers are spawned,
+    /// or the last ones retired with their documents reported through
+    /// on_crash as lost, to compile again on the others.
+    void resize(const WorkerPoolOptions& opts);
+
     /// Send a request to a stateful worker with path_id affinity routing.
     template <typename Params>
     RequestResult<Params> send_stateful(std::uint32_t path_id,
@@ -84,13 +182,31 @@ public:
                                          kota::ipc::request_options opts = {});
 
     /// Send a notification to the stateful worker owning path_id (if any).
+    /// Returns false when no live worker owns the document.
     template <typename Params>
-    void notify_stateful(std::uint32_t path_id, const Params& params);
+    bool notify_stateful(std::uint32_t path_id, const Params& params);
+
+    /// Move queued low-priority `kind` builds of `file` to the high queue,
+    /// for a background build that an interactive request now waits on.
+    /// Returns false if none was queued (not sent yet, or already running).
+    bool promote(worker::BuildKind kind, llvm::StringRef file);
 
     /// Remove path_id from ownership tracking (e.g. when the master learns a
     /// document was evicted).
     void remove_owner(std::uint32_t path_id);
 
+    /// The user edited a document: with adaptive_throttle, low-priority jobs
+    /// run one at a time until the edits pause for user_activity_window.
+    void note_user_activity();
+
+    /// Snapshot of per-worker, per-queue and per-BuildKind telemetry
+    /// (served as clice/workerStats).  `reset` clears it afterwards.
+    ext::WorkerStatsResult stats(bool reset = false);
+
+    /// Ask every live worker what its requests used since it was last
+    /// asked, and add that to the per-kind figures stats() reports.
+    kota::task<> collect_usage();
+
     /// Callback invoked when a worker process crashes.
     std::function<void(const WorkerCrashInfo&)> on_crash;
 
@@ -98,17 +214,61 @@ public:
     /// The master should translate the path to a path_id and call remove_owner().
     std::function<void(const std::string& path)> on_evicted;
 
+    /// Callback invoked when rebalancing decides to move path_id off its
+    /// current stateful worker.  The master should send EvictParams to the
+    /// current owner, call remove_owner(), and mark the document dirty; the
+    /// recompile that follows lands on the lightest worker.
+    std::function<void(std::uint32_t path_id)> on_migrate;
+
+    /// Callback invoked for every TU a stateless worker streams back from a
+    /// batched Index build (BuildParams::batch).
+    std::function<void(const worker::IndexedParams&)> on_indexed;
+
+    /// Changes on disk, stamped onto every BuildParams so stateless workers
+    /// keep the files they read (see file_changes.h).  Null when unused.
+    const FileChangeLog* file_changes = nullptr;
+
 private:
+    /// Exit status of a zygote-forked worker, filled in from the zygote's
+    /// exit report since the worker is not our child.
+    struct ForkedExit {
+        kota::event exited{};
+        int status = 0;
+        int signal = 0;
+    };
+
+    /// Per-slot telemetry; survives respawns of the slot.
+    struct WorkerTelemetry {
+        LatencyHistogram latency;
+        std::uint64_t failures = 0;
+        double busy_ms = 0;
+        std::uint64_t peak_memory = 0;
+    };
+
     struct WorkerProcess {
         kota::process proc;
         std::unique_ptr<kota::ipc::BincodePeer> peer;
 
+        /// Non-zero when forked by the zygote; `proc` is then unused and
+        /// the exit arrives through `forked_exit`.
+        int forked_pid = 0;
+        std::unique_ptr<ForkedExit> forked_exit;
+
         /// Display name for logging, e.g. "SL-0" or "SF-1".
         std::string name;
 
         /// Stateful only: number of documents routed to this worker.
         std::size_t owned_documents = 0;
 
+        /// Stateful only: sum of the AST footprints last reported (via
+        /// CompileResult::memory_usage) by documents routed to this worker.
+        std::size_t memory_usage = 0;
+
+        /// Stateful only: CompileResult::heap_reserved and heap_in_use of
+        /// the last compile.
+        std::size_t heap_reserved = 0;
+        std::size_t heap_in_use = 0;
+
         bool alive = true;
 
         /// Stateless only: true while a request is in-flight on this worker.
@@ -117,37 +277,103 @@ private:
         /// Stateless only: true if the current in-flight request is low-priority.
         bool low_priority = false;
 
+        /// Stateless only: the in-flight request is a low-priority Index job
+        /// that may be cancelled and requeued for a waiting high-priority one.
+        bool preemptible = false;
+
+        /// Stateless only: set when the in-flight request was preempted; the
+        /// sender requeues it instead of reporting an error.
+        bool preempted = false;
+
+        /// Stateless only: file, estimated cost and start time of the
+        /// in-flight request, used to pick a preemption victim.
+        std::string current_file;
+        double current_cost_ms = 0;
+        std::chrono::steady_clock::time_point started_at;
+
         /// How many times this slot has been respawned.
         unsigned restart_count = 0;
 
         /// True when this worker is being intentionally shut down (scale-down),
         /// as opposed to an unexpected crash.
         bool retiring = false;
+
+        /// Stateless only: warm standby, alive but not counted in
+        /// alive_stateless_count and never dispatched to until promoted.
+        bool standby = false;
+
+        WorkerTelemetry telemetry;
+
+        /// Compile argument templates this process holds, so later requests
+        /// send their id instead (see argument_cache.h).
+        ArgumentIds argument_ids;
+
+        /// Stateless only: FileChangeLog epoch last sent to this process.
+        std::uint64_t fs_epoch = 0;
+
+        /// oom_kill count of the slot's cgroup leaf when this process
+        /// joined it.
+        std::uint64_t oom_kills = 0;
     };
 
     kota::event_loop& loop;
     llvm::SmallVector<WorkerProcess> stateless_workers;
     llvm::SmallVector<WorkerProcess> stateful_workers;
 
+    /// Remote executors (options.remote_executors), one build at a time
+    /// each.  Only low-priority Index builds go to them, so they take no
+    /// part in scaling, preemption or the low-priority limits.
+    llvm::SmallVector<WorkerProcess> remote_workers;
+    std::size_t alive_remote_count = 0;
+    std::size_t remote_busy_count = 0;
+
     // Stateful routing: each open document (path_id) is pinned to one worker.
     // LRU tracks access order so stale assignments can be evicted.
     llvm::DenseMap<std::uint32_t, std::size_t> owner;  // path_id -> worker index
     std::list<std::uint32_t> owner_lru;                // most-recent at front
     llvm::DenseMap<std::uint32_t, std::list<std::uint32_t>::iterator> owner_lru_index;
 
+    /// path_id -> last reported AST footprint, folded into WorkerProcess::memory_usage.
+    llvm::DenseMap<std::uint32_t, std::size_t> owner_memory;
+
     std::size_t assign_worker(std::uint32_t path_id);
     void clear_owner(std::size_t worker_index);
+
+    /// Pick the stateful worker with the most free memory (ties broken by
+    /// document count).
     std::size_t pick_least_loaded();
 
+    /// Record the footprint reported by a Compile on worker_index for path_id.
+    /// Ignored if the document was re-routed while the compile was in flight.
+    void record_memory(std::uint32_t path_id, std::size_t worker_index, std::size_t bytes);
+
+    /// Migrate one cold document off the heaviest stateful worker when it is
+    /// far above the lightest (called from monitor_memory).
+    void rebalance_stateful();
+
+    /// Monitor ticks to wait after a migration before considering another,
+    /// so the recompiled document can report its footprint first.
+    unsigned migration_cooldown = 0;
+    constexpr static unsigned migration_cooldown_ticks = 5;
+
     /// A coroutine waiting for a stateless worker slot.  Lives on the coroutine
     /// frame of acquire_stateless_slot(); the destructor handles two cancellation
     /// scenarios:
-    ///   - Still queued (queue != nullptr): removes itself from the queue.
+    ///   - Still queued (queue or low_queue set): removes itself from the queue.
     ///   - Dispatched but coroutine cancelled before StatelessSlot was created
     ///     (pool != nullptr): releases the assigned slot to prevent leak.
     struct PendingStateless {
         worker::Priority priority;
 
+        /// Estimated run time, used to order the low queue shortest-first.
+        double cost_ms = 0;
+
+        /// The waiting build, if any, so promote() can find it.
+        const worker::BuildParams* build = nullptr;
+
+        /// When the entry was queued, for starvation and deadline checks.
+        std::chrono::steady_clock::time_point enqueued_at;
+
         /// Signalled by try_dispatch_pending() when a worker becomes available.
         kota::event ready{};
 
@@ -158,10 +384,14 @@ private:
         /// restart_count of the assigned worker at dispatch time.
         unsigned assigned_gen = 0;
 
-        /// Points to whichever queue (high/low) this entry sits in; nullptr
-        /// once popped or if never enqueued.
+        /// Points to high_queue while this entry sits in it; nullptr once
+        /// popped or if never enqueued there.
         std::deque<PendingStateless*>* queue = nullptr;
 
+        /// Points to low_queue while this entry sits in it, under `low_seq`.
+        std::map<std::uint64_t, PendingStateless*>* low_queue = nullptr;
+        std::uint64_t low_seq = 0;
+
         /// Non-null while the slot hasn't been claimed by the coroutine.
         /// Cleared after co_await returns so the destructor doesn't release
         /// a slot that StatelessSlot now owns.
@@ -175,6 +405,8 @@ private:
         ~PendingStateless() {
             if(queue) {
                 std::erase(*queue, this);
+            } else if(low_queue) {
+                low_queue->erase(low_seq);
             } else if(assigned_worker != SIZE_MAX && pool) {
                 // Only release if the slot hasn't been crash-replaced.
                 if(pool->stateless_workers[assigned_worker].restart_count == assigned_gen)
@@ -203,10 +435,104 @@ private:
         }
     };
 
+    /// Aborts the worker's compile of `file` when the request is abandoned
+    /// mid-flight (cancelled by the caller, or its coroutine torn down), so a
+    /// superseded Completion/SignatureHelp stops occupying the worker.
+    /// Declared after the StatelessSlot so the abort reaches the worker
+    /// before the slot is handed on.
+    struct AbortOnExit {
+        WorkerPool& pool;
+        std::size_t worker_index;
+        unsigned gen;
+        std::string file;
+        bool armed = true;
+
+        AbortOnExit(WorkerPool& p, std::size_t idx, std::string file) :
+            pool(p), worker_index(idx), gen(p.stateless_workers[idx].restart_count),
+            file(std::move(file)) {}
+
+        AbortOnExit(const AbortOnExit&) = delete;
+        AbortOnExit& operator=(const AbortOnExit&) = delete;
+
+        ~AbortOnExit() {
+            auto& w = pool.stateless_workers[worker_index];
+            if(armed && w.alive && w.peer && w.restart_count == gen)
+                w.peer->send_notification(worker::PreemptParams{file});
+        }
+    };
+
     /// Pending requests waiting for a worker, split by priority.
-    /// High queue is drained first; low queue respects low_limit.
+    /// High queue is drained first in FIFO order; low queue respects
+    /// low_limit and runs the cheapest estimated job first, falling back to
+    /// FIFO once the oldest entry has waited past low_starvation.  It is
+    /// keyed by arrival, and `low_by_cost` is a min-heap of (cost, arrival)
+    /// over it whose entries for keys no longer queued are skipped.
     std::deque<PendingStateless*> high_queue;
-    std::deque<PendingStateless*> low_queue;
+    std::map<std::uint64_t, PendingStateless*> low_queue;
+    std::priority_queue<std::pair<double, std::uint64_t>,
+                        std::vector<std::pair<double, std::uint64_t>>,
+                        std::greater<>>
+        low_by_cost;
+    std::uint64_t low_arrivals = 0;
+
+    constexpr static auto low_starvation = std::chrono::seconds(30);
+
+    /// Append an entry to low_queue, and pop the next one to dispatch.
+    void push_low_pending(PendingStateless& pending);
+    PendingStateless* pop_low_pending();
+
+    // --- Cost model ---
+
+    constexpr static std::size_t build_kind_count =
+        static_cast<std::size_t>(worker::BuildKind::OnTypeFormat) + 1;
+
+    /// Smoothed build duration per kind and per (kind, file), in ms.  The
+    /// per-file figure wins once a file has been built at least once.
+    std::array<double, build_kind_count> kind_cost_ms{};
+    std::array<llvm::StringMap<double>, build_kind_count> file_cost_ms;
+
+    /// A batched Index build costs the sum of its TUs.
+    double estimate_cost(const worker::BuildParams& params) const;
+    void record_cost(const worker::BuildParams& params, double ms);
+    void record_cost(worker::BuildKind kind, llvm::StringRef file, double ms);
+
+    // --- Telemetry ---
+
+    /// Queue wait per Priority and stateless latency per BuildKind.
+    std::array<LatencyHistogram, 2> queue_wait;
+    std::array<LatencyHistogram, build_kind_count> kind_latency;
+
+    /// Usage of the stateless [0] and stateful [1] workers' requests by
+    /// kind, summed by collect_usage().
+    std::array<llvm::StringMap<worker::KindUsage>, 2> request_usage;
+
+    std::uint64_t crash_count = 0;
+    std::uint64_t eviction_count = 0;
+    std::uint64_t migration_count = 0;
+    std::uint64_t preemption_count = 0;
+
+    /// Record how a request on worker `w` went.
+    static void record_request(WorkerProcess& w,
+                               std::chrono::steady_clock::time_point started,
+                               bool ok);
+
+    /// Refresh each live worker's peak resident memory (Linux only).
+    void sample_peak_memory();
+
+    // --- Preemption ---
+
+    /// Arm the deadline timer for the oldest queued high-priority request.
+    void arm_preemption();
+    kota::task<> preempt_after_deadline();
+
+    /// Cancel the preemptible in-flight job with the most estimated time
+    /// remaining and tell its worker to abort.  Returns false if none.
+    bool preempt_low_for_high();
+
+    bool preemption_armed = false;
+
+    /// Times a single request may be preempted before it runs to completion.
+    constexpr static unsigned max_requeues = 2;
 
     std::size_t stateless_busy_count = 0;
     std::size_t low_busy_count = 0;
@@ -219,6 +545,22 @@ private:
     /// Ceiling for low_limit recovery (set once at start).
     std::size_t max_low_limit = 0;
 
+    /// Cap on concurrent low-priority tasks from the load of the machine,
+    /// set by update_load_cap(); low_limit bounds it as memory allows.
+    std::size_t load_cap = SIZE_MAX;
+
+    std::chrono::steady_clock::time_point last_user_activity;
+    constexpr static auto user_activity_window = std::chrono::seconds(5);
+
+    std::size_t effective_low_limit() const {
+        return std::max<std::size_t>(1, std::min(low_limit, load_cap));
+    }
+
+    /// Recompute load_cap (called from monitor_memory).  Low-priority jobs
+    /// get the cores the one-minute load average leaves to the pool's own
+    /// workers, one on battery or while the user types, and at least one.
+    void update_load_cap();
+
     /// Remaining monitor_memory cycles to skip after a crash backoff,
     /// prevents crash AIMD and memory pressure from compounding.
     unsigned backoff_cooldown = 0;
@@ -227,8 +569,12 @@ private:
     /// is dead (all workers down, no restarts left).
     /// @param exclude  worker index to skip (e.g. a peer that just failed
     ///                 but whose crash hasn't been processed yet).
+    /// @param cost_ms  estimated run time, orders the low queue.
+    /// @param build    the build waiting, for promote().
     kota::task<std::size_t> acquire_stateless_slot(worker::Priority priority,
-                                                   std::size_t exclude = SIZE_MAX);
+                                                   std::size_t exclude = SIZE_MAX,
+                                                   double cost_ms = 0,
+                                                   const worker::BuildParams* build = nullptr);
     void release_stateless_slot(std::size_t worker_index);
 
     /// Wake queued requests when a worker becomes available.
@@ -239,6 +585,58 @@ private:
 
     std::size_t pick_idle_stateless(std::size_t exclude = SIZE_MAX);
 
+    // --- Remote executors ---
+
+    /// A build waiting for a remote executor; like PendingStateless, it
+    /// leaves the queue or releases its executor when abandoned.
+    struct PendingRemote {
+        kota::event ready{};
+
+        /// SIZE_MAX while queued, and when no executor is left.
+        std::size_t assigned = SIZE_MAX;
+        unsigned assigned_gen = 0;
+
+        bool queued = false;
+
+        /// Non-null until the waiting build claims its executor.
+        WorkerPool* pool = nullptr;
+
+        PendingRemote() = default;
+
+        PendingRemote(const PendingRemote&) = delete;
+        PendingRemote& operator=(const PendingRemote&) = delete;
+
+        ~PendingRemote() {
+            if(queued) {
+                std::erase(pool->remote_queue, this);
+            } else if(pool && assigned != SIZE_MAX &&
+                      pool->remote_workers[assigned].restart_count == assigned_gen) {
+                pool->release_remote_slot(assigned);
+            }
+        }
+    };
+
+    std::deque<PendingRemote*> remote_queue;
+
+    /// Whether a low-priority Index build goes to a remote executor: one is
+    /// idle, or fewer builds wait per live executor than wait per local
+    /// low-priority slot.
+    bool prefer_remote() const;
+
+    /// Start the remote executor `w` (named already) from its command.
+    bool launch_remote(WorkerProcess& w, std::size_t index);
+
+    kota::task<> monitor_remote(std::size_t index);
+
+    /// Wait for an idle remote executor; SIZE_MAX when none is alive.
+    kota::task<std::size_t> acquire_remote_slot();
+    void release_remote_slot(std::size_t index);
+
+    /// Run `params` on a remote executor, its paths moved by
+    /// options.remote_paths.
+    RequestResult<worker::BuildParams> send_remote(const worker::BuildParams& params,
+                                                   kota::ipc::request_options opts);
+
     /// Periodically adjusts low_limit based on system memory pressure
     /// and triggers dynamic scaling checks.
     kota::task<> monitor_memory();
@@ -259,9 +657,34 @@ private:
     /// retiring, and close its output pipe + send SIGTERM.
     void retire_idle_worker();
 
+    /// Retire the highest-index live stateful worker, handing its documents
+    /// to on_crash.  Returns false when none is left to retire.
+    bool retire_stateful_worker();
+
     /// Evaluate scaling conditions and act (called from monitor_memory).
     void check_scaling();
 
+    /// Spawn a warm standby if there is none and room to scale; retire it
+    /// when the pool is at max_stateless or memory is tight.
+    void ensure_standby();
+
+    /// Promote the warm standby into rotation.  Returns its index, or
+    /// SIZE_MAX if there is no live standby.
+    std::size_t promote_standby();
+
+    /// Scale up immediately when the queue is deep and still growing,
+    /// instead of waiting scale_up_ticks monitor cycles (called from
+    /// try_dispatch_pending).
+    void maybe_scale_ahead();
+
+    std::size_t last_queue_depth = 0;
+    std::chrono::steady_clock::time_point last_scale_ahead;
+    constexpr static auto scale_ahead_interval = std::chrono::seconds(1);
+
+    /// Consecutive standby deaths without a promotion; stop replacing it
+    /// once this exceeds max_restarts.
+    unsigned standby_failures = 0;
+
     /// Cancel up to `count` in-flight low-priority requests to relieve
     /// memory pressure.
     void cancel_low_priority_requests(std::size_t count);
@@ -297,8 +720,54 @@ private:
     /// before the object is destroyed.
     llvm::SmallVector<std::unique_ptr<kota::ipc::BincodePeer>> retired_peers;
 
-    bool spawn_worker(const std::string& self_path, bool stateful, std::uint64_t memory_limit);
+    std::unique_ptr<ZygoteClient> zygote;
+
+    /// Start the zygote; leaves `zygote` null when it cannot run.
+    void start_zygote();
+
+    /// Start the process for `w` (named already): forked by the zygote when
+    /// it is running, spawned from self_path otherwise.  Sets its process
+    /// handle and peer and drains its stderr.
+    bool launch_worker(WorkerProcess& w, bool stateful, std::uint64_t memory_limit);
+
+    /// Leaves for the workers when options.cgroup could be opened.
+    std::optional<cgroup::Tree> cgroups;
+
+    /// CPUs the workers of each kind are pinned to, empty when unpinned.
+    std::vector<unsigned> stateful_cpu_set;
+    std::vector<unsigned> stateless_cpu_set;
+
+    /// Split the CPUs and open the cgroup tree per `options` (from start()).
+    void setup_isolation();
+
+    /// Pin a just-launched worker to its CPUs and move it into its leaf.
+    void isolate_worker(WorkerProcess& w, bool stateful);
+
+    /// Set the cpu.weight of a stateless worker's leaf for the priority of
+    /// its in-flight job.
+    void weigh_worker(WorkerProcess& w);
+
+    /// Route the IndexedParams a stateless worker streams to on_indexed.
+    void watch_indexed(WorkerProcess& w);
+
+    /// Deliver a signal to a worker however it was started.
+    static void signal_worker(WorkerProcess& w, int signal);
+
+    /// Complete the exit of the zygote-forked worker `pid`.
+    void finish_forked(int pid, int status, int signal);
+
+    bool spawn_worker(bool stateful, std::uint64_t memory_limit, bool standby = false);
     bool respawn_worker(std::size_t index, bool stateful);
+
+    /// Send `params` to `workers[index]` with their compile arguments
+    /// compacted against the templates it holds.  A worker missing a
+    /// template fails the request; it is then forgotten and the request
+    /// resent in full.
+    template <typename Params>
+    RequestResult<Params> send_compacted(llvm::SmallVectorImpl<WorkerProcess>& workers,
+                                         std::size_t index,
+                                         const Params& params,
+                                         kota::ipc::request_options opts);
     kota::task<> monitor_worker(std::size_t index, bool stateful);
 
     friend struct testing::WorkerPoolFixture;
@@ -315,7 +784,17 @@ RequestResult<Params> WorkerPool::send_stateful(std::uint32_t path_id,
     if(!stateful_workers[idx].alive) {
         co_return kota::outcome_error(kota::ipc::Error{"Assigned stateful worker is down"});
     }
-    co_return co_await stateful_workers[idx].peer->send_request(params, opts);
+    auto started = std::chrono::steady_clock::now();
+    auto result = co_await send_compacted(stateful_workers, idx, params, opts);
+    record_request(stateful_workers[idx], started, result.has_value());
+    if constexpr(std::is_same_v<Params, worker::CompileParams>) {
+        if(result.has_value()) {
+            record_memory(path_id, idx, result.value().memory_usage);
+            stateful_workers[idx].heap_reserved = result.value().heap_reserved;
+            stateful_workers[idx].heap_in_use = result.value().heap_in_use;
+        }
+    }
+    co_return std::move(result);
 }
 
 template <typename Params>
@@ -325,44 +804,127 @@ RequestResult<Params> WorkerPool::send_stateless(const Params& params,
         co_return kota::outcome_error(kota::ipc::Error{"No stateless workers available"});
     }
 
+    constexpr bool is_build = std::is_same_v<Params, worker::BuildParams>;
+    double cost_ms = 0;
+    bool preemptible = false;
+    const worker::BuildParams* build = nullptr;
+    if constexpr(is_build) {
+        build = &params;
+        cost_ms = estimate_cost(params);
+        preemptible =
+            params.priority == worker::Priority::Low && params.kind == worker::BuildKind::Index;
+
+        // A TU the remote executor could not take is indexed here instead;
+        // the rest of a batch is the caller's to dispatch again.
+        if(preemptible && prefer_remote()) {
+            auto result = co_await send_remote(params, opts);
+            if(result.has_value() || !params.batch.empty() ||
+               (opts.token && opts.token->cancelled()))
+                co_return std::move(result);
+        }
+    }
+
     // Retry once on transport error, excluding the failed peer so the
     // retry doesn't hit the same dead worker before process_crash runs.
     std::size_t exclude = SIZE_MAX;
+    unsigned requeues = 0;
     for(int attempt = 0; attempt < 2; ++attempt) {
-        auto idx = co_await acquire_stateless_slot(params.priority, exclude);
+        auto queued_at = std::chrono::steady_clock::now();
+        std::optional<trace::Span> queued;
+        if constexpr(is_build)
+            queued.emplace("Queued", params.file);
+        auto idx = co_await acquire_stateless_slot(params.priority, exclude, cost_ms, build);
+        queued.reset();
         if(idx >= stateless_workers.size())
             co_return kota::outcome_error(kota::ipc::Error{"All stateless workers are down"});
+        queue_wait[static_cast<std::size_t>(params.priority)].record(
+            std::chrono::steady_clock::now() - queued_at);
 
         StatelessSlot slot(*this, idx);
 
         if(!stateless_workers[idx].alive)
             continue;
 
+        if(opts.token && opts.token->cancelled())
+            co_return kota::outcome_error(kota::ipc::Error{"Request cancelled"});
+
+        auto& w = stateless_workers[idx];
+        w.preemptible = preemptible && requeues < max_requeues;
+        w.current_cost_ms = cost_ms;
+        w.started_at = std::chrono::steady_clock::now();
+        if constexpr(is_build)
+            w.current_file = params.file;
+
         // For low-priority requests, install a cancellation source so
-        // monitor_memory() can preempt under severe memory pressure.
-        // FIXME: cancelling only aborts the IPC wait — the worker process
+        // monitor_memory() can preempt under severe memory pressure, and
+        // preempt_low_for_high() can hand the slot to a waiting request.
+        // FIXME: memory-pressure cancellation only aborts the IPC wait — the worker process
         // continues compiling until it finishes. The slot is released here
         // but the worker won't accept new work until the in-flight RPC
         // completes, so the next request dispatched to it queues at the
         // IPC layer. Not a correctness bug, but limits preemption efficacy.
+        auto request_opts = opts;
         std::shared_ptr<kota::cancellation_source> preempt_src;
         if(params.priority == worker::Priority::Low) {
             preempt_src = std::make_shared<kota::cancellation_source>();
             if(idx < slot_cancel_sources.size())
                 slot_cancel_sources[idx] = preempt_src;
-            if(!opts.token)
-                opts.token = preempt_src->token();
+            if(!request_opts.token)
+                request_opts.token = preempt_src->token();
         }
 
-        auto result = co_await stateless_workers[idx].peer->send_request(params, opts);
+        std::optional<AbortOnExit> abort;
+        if constexpr(is_build) {
+            if(params.kind == worker::BuildKind::Completion ||
+               params.kind == worker::BuildKind::SignatureHelp)
+                abort.emplace(*this, idx, params.file);
+        }
 
-        if(result.has_value())
+        auto result = co_await send_compacted(stateless_workers, idx, params, request_opts);
+        bool abandoned = !result.has_value() && opts.token && opts.token->cancelled();
+        if(abort)
+            abort->armed = abandoned;
+        if(abandoned)
+            co_return kota::outcome_error(kota::ipc::Error{"Request cancelled"});
+
+        // Preemption and memory-pressure cancellations are not failures.
+        bool cancelled = preempt_src && preempt_src->cancelled();
+        record_request(stateless_workers[idx],
+                       stateless_workers[idx].started_at,
+                       result.has_value() || cancelled);
+
+        if(result.has_value()) {
+            // Batched builds are accounted per TU as they stream in.
+            if constexpr(is_build) {
+                if(!params.batch.empty())
+                    co_return std::move(result);
+                auto elapsed = std::chrono::steady_clock::now() - stateless_workers[idx].started_at;
+                record_cost(params,
+                            std::chrono::duration<double, std::milli>(elapsed).count());
+                kind_latency[static_cast<std::size_t>(params.kind)].record(elapsed);
+            }
             co_return std::move(result);
+        }
 
-        // If deliberately cancelled by memory pressure, don't retry.
-        if(preempt_src && preempt_src->cancelled())
+        if(cancelled) {
+            // Preempted for a waiting high-priority request: go back to the
+            // queue without spending a retry.
+            if(stateless_workers[idx].preempted) {
+                // A batch has already streamed part of its TUs; the caller
+                // re-dispatches the rest instead of redoing the whole batch.
+                if constexpr(is_build) {
+                    if(!params.batch.empty())
+                        co_return kota::outcome_error(kota::ipc::Error{"Index preempted"});
+                }
+                requeues += 1;
+                attempt -= 1;
+                exclude = SIZE_MAX;
+                continue;
+            }
+            // Cancelled by memory pressure, don't retry.
             co_return kota::outcome_error(
                 kota::ipc::Error{"Request cancelled due to memory pressure"});
+        }
 
         // Transport error — retry on a different worker.
         exclude = idx;
@@ -371,13 +933,63 @@ RequestResult<Params> WorkerPool::send_stateless(const Params& params,
 }
 
 template <typename Params>
-void WorkerPool::notify_stateful(std::uint32_t path_id, const Params& params) {
+RequestResult<Params> WorkerPool::send_compacted(llvm::SmallVectorImpl<WorkerProcess>& workers,
+                                                 std::size_t index,
+                                                 const Params& params,
+                                                 kota::ipc::request_options opts) {
+    std::string_view detail;
+    if constexpr(requires { params.file; })
+        detail = params.file;
+    else if constexpr(requires { params.path; })
+        detail = params.path;
+    std::string_view name = &workers == &stateful_workers ? "StatefulRequest"
+                            : &workers == &remote_workers ? "RemoteRequest"
+                                                          : "StatelessRequest";
+    trace::Span span(name, detail);
+    if constexpr(!requires { params.arguments_id; }) {
+        co_return co_await workers[index].peer->send_request(params, opts);
+    } else {
+        auto compacted = params;
+        auto& ids = workers[index].argument_ids;
+        ids.compact(compacted.arguments_id, compacted.arguments_known, compacted.arguments);
+        if constexpr(std::is_same_v<Params, worker::BuildParams>) {
+            for(auto& target: compacted.batch) {
+                ids.compact(target.arguments_id, target.arguments_known, target.arguments);
+            }
+            // A remote executor reads another file system, afresh each time.
+            if(file_changes && file_changes->epoch() != 0 && !compacted.remote) {
+                auto& sent = workers[index].fs_epoch;
+                compacted.fs_epoch = file_changes->epoch();
+                compacted.fs_reset = !file_changes->changes_since(sent, compacted.fs_changed);
+                sent = compacted.fs_epoch;
+            }
+        }
+
+        auto restart_count = workers[index].restart_count;
+        auto result = co_await workers[index].peer->send_request(compacted, opts);
+        if(result.has_value() ||
+           llvm::StringRef(result.error().message) != argument_template::unknown_error) {
+            co_return std::move(result);
+        }
+        // The slot may have been respawned meanwhile; its new process
+        // starts from an empty record anyway.
+        if(workers[index].restart_count != restart_count || !workers[index].alive) {
+            co_return std::move(result);
+        }
+        workers[index].argument_ids.clear();
+        co_return co_await workers[index].peer->send_request(params, opts);
+    }
+}
+
+template <typename Params>
+bool WorkerPool::notify_stateful(std::uint32_t path_id, const Params& params) {
     auto it = owner.find(path_id);
     if(it == owner.end())
-        return;
+        return false;
     if(!stateful_workers[it->second].alive)
-        return;
+        return false;
     stateful_workers[it->second].peer->send_notification(params);
+    return true;
 }
 
 }  // namespace clice
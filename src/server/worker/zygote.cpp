@@ -0,0 +1,420 @@
+#include "server/worker/zygote.h"
+
+#include <cerrno>
+#include <cstring>
+#include <format>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#endif
+
+#include "compile/compilation.h"
+#include "server/worker/stateful_worker.h"
+#include "server/worker/stateless_worker.h"
+#include "support/logging.h"
+#include "support/shared_blob.h"
+
+#include "kota/async/io/system.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace clice {
+
+namespace {
+
+#ifdef __linux__
+
+/// Fixed part of a fork request; the worker name and log directory follow
+/// it in the same datagram.
+struct ForkRequest {
+    std::uint64_t memory_limit;
+    std::uint32_t name_size;
+    std::uint32_t log_dir_size;
+    std::uint32_t master_pid;
+    std::uint8_t stateful;
+};
+
+/// Requests carry the child's stdin, stdout and stderr.
+constexpr int fork_fd_count = 3;
+
+/// Upper bound on a request datagram (names and paths are short).
+constexpr std::size_t max_request_size = 8192;
+
+int sigchld_write_fd = -1;
+
+void on_sigchld(int) {
+    int saved = errno;
+    char byte = 0;
+    (void)::write(sigchld_write_fd, &byte, 1);
+    errno = saved;
+}
+
+void close_fds(int* fds, int count) {
+    for(int i = 0; i < count; ++i) {
+        if(fds[i] >= 0)
+            ::close(fds[i]);
+        fds[i] = -1;
+    }
+}
+
+/// Write one "<pid> <status> <signal>" line per reaped child to stdout.
+void report_exits() {
+    int status = 0;
+    pid_t pid;
+    while((pid = ::waitpid(-1, &status, WNOHANG)) > 0) {
+        int code = WIFEXITED(status) ? WEXITSTATUS(status) : 0;
+        int signal = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+        auto line = std::format("{} {} {}\n", pid, code, signal);
+        // Short lines on a pipe are written atomically.
+        (void)::write(STDOUT_FILENO, line.data(), line.size());
+    }
+}
+
+/// Runs in the forked child: wire the received pipes to stdio and become
+/// the requested worker.
+int become_worker(const ZygoteSpawn& spawn, int* fds, int sigchld_fds[2]) {
+    ::signal(SIGCHLD, SIG_DFL);
+    close_fds(sigchld_fds, 2);
+
+    // Do not outlive the zygote: the master learns about worker exits only
+    // through it.
+    ::prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+    // Replaces the control socket (0) and the report pipe (1) as well.
+    for(int i = 0; i < fork_fd_count; ++i) {
+        if(::dup2(fds[i], i) < 0)
+            ::_exit(127);
+    }
+    for(int i = 0; i < fork_fd_count; ++i) {
+        if(fds[i] >= fork_fd_count)
+            ::close(fds[i]);
+    }
+
+    // The zygote is our parent, not the master.
+    shared_blob::set_receiver(spawn.master_pid);
+
+    if(spawn.stateful)
+        return run_stateful_worker_mode(spawn.memory_limit, spawn.worker_name, spawn.log_dir);
+    return run_stateless_worker_mode(spawn.worker_name, spawn.log_dir);
+}
+
+#endif
+
+}  // namespace
+
+int run_zygote_mode(const std::string& log_dir) {
+    logging::stderr_logger("zygote", logging::options);
+    if(!log_dir.empty()) {
+        logging::file_logger("zygote", log_dir, logging::options);
+    }
+
+#ifdef __linux__
+    // Everything done here is inherited by every worker.  Stay single
+    // threaded: fork() only duplicates the calling thread.
+    warm_up();
+
+    int sigchld_fds[2];
+    if(::pipe2(sigchld_fds, O_CLOEXEC | O_NONBLOCK) != 0) {
+        LOG_ERROR("Zygote failed to create signal pipe: {}", std::strerror(errno));
+        return 1;
+    }
+    sigchld_write_fd = sigchld_fds[1];
+
+    struct sigaction action{};
+    action.sa_handler = on_sigchld;
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&action.sa_mask);
+    ::sigaction(SIGCHLD, &action, nullptr);
+
+    LOG_INFO("Zygote ready, waiting for fork requests");
+
+    char buffer[max_request_size];
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * fork_fd_count)];
+
+    while(true) {
+        pollfd fds[2] = {
+            {STDIN_FILENO,   POLLIN, 0},
+            {sigchld_fds[0], POLLIN, 0},
+        };
+        if(::poll(fds, 2, -1) < 0) {
+            if(errno == EINTR)
+                continue;
+            LOG_ERROR("Zygote poll failed: {}", std::strerror(errno));
+            return 1;
+        }
+
+        if(fds[1].revents & POLLIN) {
+            char drain[64];
+            while(::read(sigchld_fds[0], drain, sizeof(drain)) > 0) {}
+            report_exits();
+        }
+
+        if(!(fds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+            continue;
+
+        iovec iov{buffer, sizeof(buffer)};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        auto received = ::recvmsg(STDIN_FILENO, &msg, MSG_CMSG_CLOEXEC);
+        if(received < 0 && errno == EINTR)
+            continue;
+        if(received <= 0) {
+            // The master closed the control socket: shut down.  Workers
+            // already forked die with us through PR_SET_PDEATHSIG.
+            LOG_INFO("Zygote exiting");
+            return 0;
+        }
+
+        int child_fds[fork_fd_count] = {-1, -1, -1};
+        auto* cmsg = CMSG_FIRSTHDR(&msg);
+        if(cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+           cmsg->cmsg_len == CMSG_LEN(sizeof(child_fds))) {
+            std::memcpy(child_fds, CMSG_DATA(cmsg), sizeof(child_fds));
+        }
+
+        ForkRequest request;
+        std::int32_t reply = -EINVAL;
+        bool valid = child_fds[0] >= 0 && static_cast<std::size_t>(received) >= sizeof(request);
+        if(valid) {
+            std::memcpy(&request, buffer, sizeof(request));
+            valid = sizeof(request) + request.name_size + request.log_dir_size ==
+                    static_cast<std::size_t>(received);
+        }
+
+        if(valid) {
+            llvm::StringRef rest(buffer + sizeof(request), received - sizeof(request));
+            ZygoteSpawn spawn{
+                .worker_name = rest.take_front(request.name_size).str(),
+                .stateful = request.stateful != 0,
+                .memory_limit = request.memory_limit,
+                .log_dir = rest.drop_front(request.name_size).str(),
+                .master_pid = request.master_pid,
+            };
+
+            auto pid = ::fork();
+            if(pid == 0)
+                return become_worker(spawn, child_fds, sigchld_fds);
+            reply = pid > 0 ? pid : -errno;
+            if(pid > 0)
+                LOG_DEBUG("Forked {} as pid {}", spawn.worker_name, pid);
+        }
+
+        close_fds(child_fds, fork_fd_count);
+        if(::send(STDIN_FILENO, &reply, sizeof(reply), MSG_NOSIGNAL) < 0) {
+            LOG_INFO("Zygote lost its master, exiting");
+            return 0;
+        }
+    }
+#else
+    LOG_ERROR("Zygote mode is only supported on Linux");
+    return 1;
+#endif
+}
+
+ZygoteClient::~ZygoteClient() {
+    stop();
+}
+
+#ifdef __linux__
+
+namespace {
+
+std::optional<kota::pipe> adopt_pipe(int fd, kota::event_loop& loop) {
+    auto pipe = kota::pipe::open(fd, loop);
+    if(!pipe) {
+        ::close(fd);
+        return std::nullopt;
+    }
+    return std::move(*pipe);
+}
+
+}  // namespace
+
+#endif
+
+bool ZygoteClient::start(const std::string& self_path, const std::string& log_dir) {
+#ifdef __linux__
+    int fds[2];
+    if(::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0) {
+        LOG_WARN("Zygote disabled, socketpair failed: {}", std::strerror(errno));
+        return false;
+    }
+
+    kota::process::options opts;
+    opts.file = self_path;
+    opts.args = {self_path, "worker", "--zygote"};
+    if(!log_dir.empty()) {
+        opts.args.push_back("--log-dir");
+        opts.args.push_back(log_dir);
+    }
+    opts.streams = {
+        kota::process::stdio::from_fd(fds[1]),     // stdin: control socket
+        kota::process::stdio::pipe(false, true),  // stdout: exit reports
+        kota::process::stdio::pipe(false, true),  // stderr: child writes
+    };
+
+    auto result = kota::process::spawn(opts, loop);
+    ::close(fds[1]);
+    if(!result) {
+        ::close(fds[0]);
+        LOG_WARN("Zygote disabled, spawn failed: {}", result.error().message());
+        return false;
+    }
+
+    // A wedged zygote must not hang the master's event loop forever.
+    timeval timeout{.tv_sec = 5, .tv_usec = 0};
+    ::setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    auto& spawn = *result;
+    proc = std::move(spawn.proc);
+    reports.emplace(std::move(spawn.stdout_pipe));
+    stderr_pipe.emplace(std::move(spawn.stderr_pipe));
+    control = fds[0];
+    return true;
+#else
+    (void)self_path;
+    (void)log_dir;
+    return false;
+#endif
+}
+
+std::optional<ZygoteClient::Forked> ZygoteClient::fork_worker(const ZygoteSpawn& spawn) {
+#ifdef __linux__
+    if(control < 0)
+        return std::nullopt;
+
+    // Pairs of (read end, write end); the child gets in[0], out[1], err[1].
+    int in[2] = {-1, -1}, out[2] = {-1, -1}, err[2] = {-1, -1};
+    if(::pipe2(in, O_CLOEXEC) != 0 || ::pipe2(out, O_CLOEXEC) != 0 ||
+       ::pipe2(err, O_CLOEXEC) != 0) {
+        LOG_WARN("Zygote fork of {} failed: {}", spawn.worker_name, std::strerror(errno));
+        close_fds(in, 2);
+        close_fds(out, 2);
+        close_fds(err, 2);
+        return std::nullopt;
+    }
+
+    ForkRequest request{
+        .memory_limit = spawn.memory_limit,
+        .name_size = static_cast<std::uint32_t>(spawn.worker_name.size()),
+        .log_dir_size = static_cast<std::uint32_t>(spawn.log_dir.size()),
+        .master_pid = spawn.master_pid,
+        .stateful = spawn.stateful,
+    };
+    std::string payload(reinterpret_cast<const char*>(&request), sizeof(request));
+    payload += spawn.worker_name;
+    payload += spawn.log_dir;
+
+    int child_fds[fork_fd_count] = {in[0], out[1], err[1]};
+    alignas(cmsghdr) char cmsg_buffer[CMSG_SPACE(sizeof(child_fds))] = {};
+    iovec iov{payload.data(), payload.size()};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg_buffer;
+    msg.msg_controllen = sizeof(cmsg_buffer);
+    auto* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(child_fds));
+    std::memcpy(CMSG_DATA(cmsg), child_fds, sizeof(child_fds));
+
+    std::int32_t pid = 0;
+    bool sent = ::sendmsg(control, &msg, MSG_NOSIGNAL) >= 0;
+    bool replied = sent && ::recv(control, &pid, sizeof(pid), 0) == sizeof(pid);
+    close_fds(child_fds, fork_fd_count);
+
+    if(!replied || pid <= 0) {
+        close_fds(&in[1], 1);
+        close_fds(&out[0], 1);
+        close_fds(&err[0], 1);
+        if(!replied) {
+            // Lost or wedged: stop using it, spawns fall back to exec.
+            LOG_WARN("Zygote not responding, disabling it");
+            stop();
+        } else {
+            LOG_WARN("Zygote fork of {} failed: {}", spawn.worker_name, std::strerror(-pid));
+        }
+        return std::nullopt;
+    }
+
+    auto stdin_pipe = adopt_pipe(in[1], loop);
+    auto stdout_pipe = adopt_pipe(out[0], loop);
+    auto stderr_pipe = adopt_pipe(err[0], loop);
+    if(!stdin_pipe || !stdout_pipe || !stderr_pipe) {
+        // The worker exits on its own once its stdin is closed.
+        LOG_WARN("Zygote fork of {}: failed to open pipes", spawn.worker_name);
+        return std::nullopt;
+    }
+
+    return Forked{
+        .pid = pid,
+        .stdin_pipe = std::move(*stdin_pipe),
+        .stdout_pipe = std::move(*stdout_pipe),
+        .stderr_pipe = std::move(*stderr_pipe),
+    };
+#else
+    (void)spawn;
+    return std::nullopt;
+#endif
+}
+
+kota::task<> ZygoteClient::run() {
+    if(!reports)
+        co_return;
+
+    std::string buffer;
+    while(true) {
+        auto result = co_await reports->read();
+        if(!result.has_value())
+            break;
+        auto& chunk = result.value();
+        if(chunk.empty())
+            break;
+
+        buffer += chunk;
+
+        std::size_t pos = 0;
+        while(true) {
+            auto nl = buffer.find('\n', pos);
+            if(nl == std::string::npos)
+                break;
+            llvm::StringRef line(buffer.data() + pos, nl - pos);
+            pos = nl + 1;
+
+            auto [pid, rest] = line.split(' ');
+            auto [status, signal] = rest.split(' ');
+            int pid_value = 0, status_value = 0, signal_value = 0;
+            if(pid.getAsInteger(10, pid_value) || status.getAsInteger(10, status_value) ||
+               signal.getAsInteger(10, signal_value))
+                continue;
+            if(on_exit)
+                on_exit(pid_value, status_value, signal_value);
+        }
+        buffer.erase(0, pos);
+    }
+
+    stop();
+    co_await proc.wait();
+    if(on_lost)
+        on_lost();
+}
+
+void ZygoteClient::stop() {
+#ifdef __linux__
+    if(control >= 0)
+        ::close(control);
+#endif
+    control = -1;
+}
+
+}  // namespace clice
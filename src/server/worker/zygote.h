@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+
+#include "kota/async/async.h"
+
+namespace clice {
+
+/// What a worker forked by the zygote should run as; mirrors the
+/// `clice worker` command line.
+struct ZygoteSpawn {
+    std::string worker_name;
+    bool stateful = false;
+    std::uint64_t memory_limit = 0;
+    std::string log_dir;
+
+    /// The master the worker hands shared segments to (`--master-pid`).
+    std::uint32_t master_pid = 0;
+};
+
+/// Run the zygote process mode.
+/// The zygote warms up process-wide compiler state once, then forks a
+/// stateless or stateful worker for every request on its stdin control
+/// socket, so workers start in milliseconds and share the warmed pages
+/// copy-on-write.  Exit statuses of its children are reported as lines on
+/// stdout.  Forked children return from here with their worker's exit code.
+int run_zygote_mode(const std::string& log_dir);
+
+/// Master side handle to a zygote process (Linux only).
+class ZygoteClient {
+public:
+    struct Forked {
+        int pid = 0;
+        kota::pipe stdin_pipe;
+        kota::pipe stdout_pipe;
+        kota::pipe stderr_pipe;
+    };
+
+    explicit ZygoteClient(kota::event_loop& loop) : loop(loop) {}
+
+    ZygoteClient(const ZygoteClient&) = delete;
+    ZygoteClient& operator=(const ZygoteClient&) = delete;
+
+    ~ZygoteClient();
+
+    /// Spawn `self_path worker --zygote`.  Returns false when the platform
+    /// has no fork server support or the zygote could not be started; the
+    /// caller then spawns workers directly.
+    bool start(const std::string& self_path, const std::string& log_dir);
+
+    /// Ask the zygote to fork a worker wired to three fresh pipes.  Blocks
+    /// the caller for the fork round trip only.
+    std::optional<Forked> fork_worker(const ZygoteSpawn& spawn);
+
+    /// Dispatch exit reports to on_exit until the zygote goes away, then
+    /// reap it and call on_lost.
+    kota::task<> run();
+
+    /// Close the control socket; the zygote exits once it sees EOF.
+    void stop();
+
+    bool alive() const {
+        return control >= 0;
+    }
+
+    /// The zygote's own stderr, for the owner to drain.
+    std::optional<kota::pipe> stderr_pipe;
+
+    /// A forked worker exited.  `status` is its exit code, `signal` the
+    /// terminating signal or 0.
+    std::function<void(int pid, int status, int signal)> on_exit;
+
+    /// The zygote exited; workers it forked are killed with it and no exit
+    /// report will arrive for them.
+    std::function<void()> on_lost;
+
+private:
+    kota::event_loop& loop;
+    kota::process proc{};
+    std::optional<kota::pipe> reports;
+    int control = -1;
+};
+
+}  // namespace clice
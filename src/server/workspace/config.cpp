@@ -30,22 +30,27 @@ static void substitute_workspace(std::string& value, llvm::StringRef workspace_r
     }
 }
 
+/// $XDG_CACHE_HOME/clice or ~/.cache/clice; empty when neither is set.
+static std::string xdg_cache_base() {
+    if(auto xdg = llvm::sys::Process::GetEnv("XDG_CACHE_HOME"); xdg && !xdg->empty()) {
+        return path::join(*xdg, "clice");
+    } else if(auto home = llvm::sys::Process::GetEnv("HOME"); home && !home->empty()) {
+        return path::join(*home, ".cache", "clice");
+    }
+    return {};
+}
+
 /// Try to resolve the default cache directory using XDG_CACHE_HOME.
 /// Returns empty string on failure.
 static std::string resolve_xdg_cache_dir(llvm::StringRef workspace_root) {
-    // Determine base: $XDG_CACHE_HOME or ~/.cache
-    std::string base;
-    if(auto xdg = llvm::sys::Process::GetEnv("XDG_CACHE_HOME"); xdg && !xdg->empty()) {
-        base = std::move(*xdg);
-    } else if(auto home = llvm::sys::Process::GetEnv("HOME"); home && !home->empty()) {
-        base = path::join(*home, ".cache");
-    } else {
+    auto base = xdg_cache_base();
+    if(base.empty()) {
         return {};
     }
 
     // Use a hash of workspace_root to create a unique subdirectory.
     auto hash = llvm::xxh3_64bits(workspace_root);
-    auto dir = path::join(base, "clice", std::format("{:016x}", hash));
+    auto dir = path::join(base, std::format("{:016x}", hash));
 
     if(auto ec = llvm::sys::fs::create_directories(dir)) {
         LOG_WARN("Failed to create XDG cache directory {}: {}", dir, ec.message());
@@ -63,6 +68,38 @@ void Config::apply_defaults(llvm::StringRef workspace_root) {
         p.enable_indexing = true;
     if(!p.idle_timeout_ms)
         p.idle_timeout_ms = 3000;
+    if(!p.index_batch_size)
+        p.index_batch_size = 8;
+    if(!p.compile_debounce_ms)
+        p.compile_debounce_ms = 300;
+    if(!p.speculative_pch)
+        p.speculative_pch = true;
+    if(!p.stale_queries)
+        p.stale_queries = false;
+    if(!p.syntactic_outline)
+        p.syntactic_outline = false;
+    if(!p.syntactic_highlighting)
+        p.syntactic_highlighting = false;
+    if(!p.watch_files)
+        p.watch_files = true;
+    if(!p.lazy_function_bodies)
+        p.lazy_function_bodies = false;
+    if(!p.precompute_features)
+        p.precompute_features = false;
+    if(!p.incremental_tidy)
+        p.incremental_tidy = false;
+    if(!p.shared_index)
+        p.shared_index = false;
+    if(!p.lazy_dependency_scan)
+        p.lazy_dependency_scan = false;
+    if(!p.trace)
+        p.trace = false;
+    if(!p.time_trace)
+        p.time_trace = false;
+    if(p.large_file_bytes == 0)
+        p.large_file_bytes = 4ULL * 1024 * 1024;  // 4MB
+    if(p.large_file_decls == 0)
+        p.large_file_decls = 20000;
 
     if(p.stateful_worker_count == 0)
         p.stateful_worker_count = 2;
@@ -73,6 +110,18 @@ void Config::apply_defaults(llvm::StringRef workspace_root) {
     // min/max default to 0 meaning "auto" — resolved by WorkerPool::start().
     if(p.worker_memory_limit == 0)
         p.worker_memory_limit = 4ULL * 1024 * 1024 * 1024;  // 4GB
+    if(!p.stateful_worker_migration)
+        p.stateful_worker_migration = false;
+    if(!p.stateless_worker_standby)
+        p.stateless_worker_standby = true;
+    if(!p.worker_zygote)
+        p.worker_zygote = false;
+    if(!p.adaptive_indexing)
+        p.adaptive_indexing = true;
+    if(p.indexing_cpu_weight == 0)
+        p.indexing_cpu_weight = 20;
+    if(!p.remote_cache_upload)
+        p.remote_cache_upload = false;
 
     if(p.cache_dir.empty() && !workspace_root.empty()) {
         p.cache_dir = resolve_xdg_cache_dir(workspace_root);
@@ -81,32 +130,52 @@ void Config::apply_defaults(llvm::StringRef workspace_root) {
     }
     if(p.logging_dir.empty() && !p.cache_dir.empty())
         p.logging_dir = path::join(p.cache_dir, "logs");
+    if(p.toolchain_cache.empty()) {
+        // Named so it cannot collide with the hashed workspace directories.
+        if(auto base = xdg_cache_base(); !base.empty())
+            p.toolchain_cache = path::join(base, "toolchain");
+    }
 
     // Variable substitution on string fields.
     substitute_workspace(p.cache_dir, workspace_root);
     substitute_workspace(p.logging_dir, workspace_root);
+    substitute_workspace(p.base_index, workspace_root);
+    substitute_workspace(p.base_index_root, workspace_root);
+    substitute_workspace(p.remote_cache, workspace_root);
+    substitute_workspace(p.toolchain_cache, workspace_root);
     for(auto& entry: p.compile_commands_paths)
         substitute_workspace(entry, workspace_root);
+    for(auto& entry: p.remote_path_map)
+        substitute_workspace(entry, workspace_root);
 
     // Pre-compile glob patterns from rules.
     compiled_rules.clear();
+    rule_patterns.clear();
     for(auto& rule: rules) {
-        CompiledRule compiled;
+        std::vector<GlobPattern> patterns;
         for(auto& pattern_str: rule.patterns) {
             auto pat = GlobPattern::create(pattern_str);
             if(!pat) {
                 LOG_WARN("Invalid glob pattern in rule: {}", pattern_str);
                 continue;
             }
-            compiled.patterns.push_back(std::move(*pat));
+            // Rules run against every file; a pattern the DFA cannot take
+            // still backtracks.
+            pat->compile();
+            patterns.push_back(std::move(*pat));
         }
         // Drop the whole rule if no pattern compiled successfully — otherwise the
         // append/remove flags would be silently attached to a rule that can never match.
-        if(compiled.patterns.empty()) {
+        if(patterns.empty()) {
             if(!rule.patterns.empty())
                 LOG_WARN("Rule dropped: all glob patterns failed to compile");
             continue;
         }
+        auto index = static_cast<std::uint32_t>(compiled_rules.size());
+        for(auto& pat: patterns) {
+            rule_patterns.add(std::move(pat), index);
+        }
+        CompiledRule compiled;
         compiled.append.assign(rule.append.begin(), rule.append.end());
         compiled.remove.assign(rule.remove.begin(), rule.remove.end());
         compiled_rules.push_back(std::move(compiled));
@@ -122,12 +191,13 @@ void Config::match_rules(llvm::StringRef file_path,
     // to `append` by an earlier matching rule — otherwise the append
     // would silently survive (lookup applies removes to the base flags
     // only, not to entries contributed via `append`).
-    for(auto& rule: compiled_rules) {
-        bool matched =
-            std::ranges::any_of(rule.patterns, [&](auto& pat) { return pat.match(file_path); });
-        if(!matched)
-            continue;
+    if(rule_patterns.empty())
+        return;
 
+    llvm::SmallVector<std::uint32_t, 8> matched;
+    rule_patterns.match(file_path, matched);
+    for(auto index: matched) {
+        auto& rule = compiled_rules[index];
         for(auto& r: rule.remove) {
             std::erase(append, r);
             remove.push_back(r);
@@ -136,6 +206,14 @@ void Config::match_rules(llvm::StringRef file_path,
     }
 }
 
+bool Config::same_rules(const Config& other) const {
+    auto same = [](const ConfigRule& lhs, const ConfigRule& rhs) {
+        return *lhs.patterns == *rhs.patterns && *lhs.append == *rhs.append &&
+               *lhs.remove == *rhs.remove;
+    };
+    return std::ranges::equal(*rules, *other.rules, same);
+}
+
 std::optional<Config> Config::load(llvm::StringRef path, llvm::StringRef workspace_root) {
     auto content = fs::read(path);
     if(!content)
@@ -34,16 +34,63 @@ struct ProjectConfig {
 
     std::optional<bool> enable_indexing;
     std::optional<int> idle_timeout_ms;
+    std::optional<int> index_batch_size;
+    std::optional<int> compile_debounce_ms;
+    std::optional<bool> speculative_pch;
+    defaulted<std::uint32_t> speculative_compile = {};
+    std::optional<bool> stale_queries;
+    std::optional<bool> syntactic_outline;
+    std::optional<bool> syntactic_highlighting;
+    std::optional<bool> watch_files;
+    std::optional<bool> lazy_function_bodies;
+    std::optional<bool> precompute_features;
+    std::optional<bool> incremental_tidy;
+    std::optional<bool> shared_index;
+    std::optional<bool> lazy_dependency_scan;
+    std::optional<bool> trace;
+    std::optional<bool> time_trace;
+
+    /// Files with more bytes or more main-file top-level decls than these
+    /// are served in a lean mode (see Compiler::lean()).
+    defaulted<std::uint64_t> large_file_bytes = {};
+    defaulted<std::uint32_t> large_file_decls = {};
+
+    defaulted<std::string> base_index;
+    defaulted<std::string> base_index_root;
+
+    defaulted<std::string> remote_cache;
+    std::optional<bool> remote_cache_upload;
+
+    /// Where the PCMs of the standard library modules are kept for every
+    /// workspace of the user; defaults to `$XDG_CACHE_HOME/clice/toolchain`.
+    defaulted<std::string> toolchain_cache;
+
+    /// Percent of the free space on the cache volume the PCH and PCM
+    /// caches may each grow to; 0 keeps their fixed budgets.
+    defaulted<std::uint32_t> cache_disk_percent = {};
 
     defaulted<std::uint32_t> stateful_worker_count = {};
     defaulted<std::uint32_t> stateless_worker_count = {};
     defaulted<std::uint32_t> min_stateless_worker_count = {};
     defaulted<std::uint32_t> max_stateless_worker_count = {};
     defaulted<std::uint64_t> worker_memory_limit = {};
+    std::optional<bool> stateful_worker_migration;
+    std::optional<bool> stateless_worker_standby;
+    std::optional<bool> worker_zygote;
+    std::optional<bool> adaptive_indexing;
+    defaulted<std::uint32_t> stateful_worker_cpus = {};
+    defaulted<std::string> worker_cgroup;
+    defaulted<std::uint32_t> indexing_cpu_weight = {};
+
+    /// Commands starting a clice worker on another machine for background
+    /// indexing, and the `local=remote` directory prefixes it sees the
+    /// workspace files at.
+    defaulted<std::vector<std::string>> remote_index_executors;
+    defaulted<std::vector<std::string>> remote_path_map;
 };
 
+/// The flags of a rule; its patterns live in Config::rule_patterns.
 struct CompiledRule {
-    std::vector<GlobPattern> patterns;
     std::vector<std::string> append;
     std::vector<std::string> remove;
 };
@@ -57,6 +104,10 @@ struct Config {
 
     kota::meta::annotation<std::vector<CompiledRule>, kota::meta::attrs::skip> compiled_rules;
 
+    /// The glob patterns of all compiled rules, each valued by its rule's
+    /// index in `compiled_rules`.
+    kota::meta::annotation<GlobSet, kota::meta::attrs::skip> rule_patterns;
+
     /// Compute default values for any field left at its zero/empty sentinel.
     void apply_defaults(llvm::StringRef workspace_root);
 
@@ -65,6 +116,9 @@ struct Config {
                      std::vector<std::string>& append,
                      std::vector<std::string>& remove) const;
 
+    /// Whether `other` has the same `[[rules]]`, in the same order.
+    bool same_rules(const Config& other) const;
+
     /// Try to load configuration from a TOML file.
     static std::optional<Config> load(llvm::StringRef path, llvm::StringRef workspace_root);
 
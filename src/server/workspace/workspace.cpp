@@ -1,15 +1,22 @@
 #include "server/workspace/workspace.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <mutex>
 
 #include "support/filesystem.h"
 #include "support/logging.h"
 #include "syntax/scan.h"
 
 #include "kota/codec/json/json.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/Support/Chrono.h"
+#include "llvm/Support/Endian.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Parallel.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/Process.h"
 #include "llvm/Support/xxhash.h"
@@ -19,10 +26,17 @@ namespace clice {
 llvm::SmallVector<std::uint32_t> Workspace::on_file_saved(std::uint32_t path_id) {
     llvm::SmallVector<std::uint32_t> dirtied;
 
-    // Re-scan the saved file for module declarations and update path_to_module.
+    // Re-scan the saved file for its includes and module declaration.
     auto file_path = path_pool.resolve(path_id);
     if(auto buf = llvm::MemoryBuffer::getFile(file_path)) {
         auto result = scan((*buf)->getBuffer());
+        auto changes = update_file_includes(dep_graph, path_pool, scan_cache, path_id, result);
+        if(!changes.added.empty() || !changes.removed.empty()) {
+            LOG_DEBUG("Include edges of {}: {} added, {} removed",
+                      file_path,
+                      changes.added.size(),
+                      changes.removed.size());
+        }
         if(!result.module_name.empty()) {
             path_to_module[path_id] = std::move(result.module_name);
         } else {
@@ -34,8 +48,7 @@ llvm::SmallVector<std::uint32_t> Workspace::on_file_saved(std::uint32_t path_id)
         auto result = compile_graph->update(path_id);
         for(auto id: result) {
             dirtied.push_back(id);
-            pcm_paths.erase(id);
-            pcm_cache.erase(id);
+            forget_pcm(id);
         }
     }
     return dirtied;
@@ -45,51 +58,188 @@ void Workspace::on_file_closed(std::uint32_t path_id) {
     if(compile_graph && compile_graph->has_unit(path_id)) {
         compile_graph->update(path_id);
     }
-    pch_cache.erase(path_id);
 }
 
 std::uint64_t hash_file(llvm::StringRef path) {
-    auto buf = llvm::MemoryBuffer::getFile(path);
+    // No null terminator needed, which lets large files be mapped rather
+    // than copied into a heap buffer.
+    auto buf = llvm::MemoryBuffer::getFile(path,
+                                           /*IsText=*/false,
+                                           /*RequiresNullTerminator=*/false);
     if(!buf)
         return 0;
     return llvm::xxh3_64bits((*buf)->getBuffer());
 }
 
+namespace {
+
+/// Process-wide memo of content hashes keyed by path and validated by
+/// (mtime, size), so a header shared by many PCHs and ASTs is hashed once
+/// per modification rather than once per artifact checked.
+struct HashMemo {
+    struct Entry {
+        std::int64_t mtime = 0;
+        std::uint64_t size = 0;
+        std::uint64_t hash = 0;
+    };
+
+    std::mutex lock;
+    llvm::StringMap<Entry> entries;
+};
+
+HashMemo& hash_memo() {
+    static HashMemo memo;
+    return memo;
+}
+
+/// Dependency lists shorter than this are checked on the calling thread;
+/// below it the fan-out costs more than the stats it overlaps.
+constexpr std::size_t parallel_deps_threshold = 64;
+
+/// hash_file() through the memo.  A file modified within the last couple
+/// of seconds is hashed but not remembered: on filesystems with coarse
+/// mtimes a second same-size write could otherwise reuse the old hash.
+std::uint64_t hash_file(llvm::StringRef path, const llvm::sys::fs::file_status& status) {
+    auto modified = status.getLastModificationTime();
+    auto mtime = modified.time_since_epoch().count();
+    auto size = status.getSize();
+    auto& memo = hash_memo();
+    {
+        std::lock_guard guard(memo.lock);
+        auto it = memo.entries.find(path);
+        if(it != memo.entries.end() && it->second.mtime == mtime && it->second.size == size) {
+            return it->second.hash;
+        }
+    }
+
+    auto hash = hash_file(path);
+    if(std::chrono::system_clock::now() - modified > std::chrono::seconds(2)) {
+        std::lock_guard guard(memo.lock);
+        memo.entries[path] = {mtime, size, hash};
+    }
+    return hash;
+}
+
+std::uint64_t hash_file_memoized(llvm::StringRef path) {
+    llvm::sys::fs::file_status status;
+    if(llvm::sys::fs::status(path, status))
+        return 0;
+    return hash_file(path, status);
+}
+
+}  // namespace
+
 DepsSnapshot capture_deps_snapshot(PathPool& pool, llvm::ArrayRef<std::string> deps) {
     DepsSnapshot snap;
     // Capture timestamp BEFORE hashing to avoid TOCTOU: if a file is modified
     // during hashing, its mtime will be > build_at, triggering Layer 2 re-hash.
     snap.build_at = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
     snap.path_ids.reserve(deps.size());
-    snap.hashes.reserve(deps.size());
+    snap.hashes.resize(deps.size());
     for(const auto& file: deps) {
         snap.path_ids.push_back(pool.intern(file));
-        snap.hashes.push_back(hash_file(file));
+    }
+
+    auto hash_one = [&](std::size_t i) {
+        snap.hashes[i] = hash_file_memoized(deps[i]);
+    };
+    if(deps.size() < parallel_deps_threshold) {
+        for(std::size_t i = 0; i < deps.size(); ++i) {
+            hash_one(i);
+        }
+    } else {
+        llvm::parallelFor(0, deps.size(), hash_one);
     }
     return snap;
 }
 
 bool deps_changed(const PathPool& pool, const DepsSnapshot& snap) {
-    for(std::size_t i = 0; i < snap.path_ids.size(); ++i) {
-        auto path = pool.resolve(snap.path_ids[i]);
+    // Resolve up front: the checks below may run on other threads.
+    llvm::SmallVector<llvm::StringRef> paths;
+    paths.reserve(snap.path_ids.size());
+    for(auto path_id: snap.path_ids) {
+        paths.push_back(pool.resolve(path_id));
+    }
+
+    auto changed_at = [&](std::size_t i) {
         llvm::sys::fs::file_status status;
-        if(auto ec = llvm::sys::fs::status(path, status)) {
-            // File disappeared — definitely changed.
-            if(snap.hashes[i] != 0)
-                return true;
-            continue;
+        if(auto ec = llvm::sys::fs::status(paths[i], status)) {
+            // File disappeared — changed unless it was missing at build time.
+            return snap.hashes[i] != 0;
         }
 
         // Layer 1: mtime check (cheap, stat only).
         auto current_mtime = llvm::sys::toTimeT(status.getLastModificationTime());
         if(current_mtime <= snap.build_at)
-            continue;
+            return false;
 
         // Layer 2: mtime is newer — re-hash content to confirm actual change.
-        auto current_hash = hash_file(path);
-        if(current_hash != snap.hashes[i])
-            return true;
+        return hash_file(paths[i], status) != snap.hashes[i];
+    };
+
+    if(paths.size() < parallel_deps_threshold) {
+        for(std::size_t i = 0; i < paths.size(); ++i) {
+            if(changed_at(i))
+                return true;
+        }
+        return false;
     }
+
+    // Stats dominate on network filesystems; overlap them and stop issuing
+    // new ones once any dependency is known to have changed.
+    std::atomic<bool> changed{false};
+    llvm::parallelFor(0, paths.size(), [&](std::size_t i) {
+        if(changed.load(std::memory_order_relaxed))
+            return;
+        if(changed_at(i))
+            changed.store(true, std::memory_order_relaxed);
+    });
+    return changed.load();
+}
+
+/// Upper bound on watched directories.  Leaves room in the per-user inotify
+/// budget (8192 watches on older kernels) for editors and other tools.
+constexpr std::size_t max_watched_directories = 4096;
+
+DepsSnapshot Workspace::snapshot_deps(llvm::ArrayRef<std::string> deps, std::uint64_t epoch) {
+    auto snap = capture_deps_snapshot(path_pool, deps);
+    if(!watcher || epoch == 0)
+        return snap;
+
+    llvm::StringRef last;
+    for(const auto& file: deps) {
+        auto dir = path::parent_path(file);
+        // Dependencies come in include order, which clusters by directory.
+        if(dir == last)
+            continue;
+        last = dir;
+        if(watcher->watches(dir))
+            continue;
+        if(watcher->directory_count() >= max_watched_directories ||
+           watcher->add_directory(dir)) {
+            // An unwatched dependency could change silently; leave the
+            // snapshot for the stat-based check, and stop caching reads.
+            file_changes.stop();
+            return snap;
+        }
+    }
+    snap.epoch = epoch;
+    return snap;
+}
+
+bool Workspace::deps_stale(const DepsSnapshot& snap) const {
+    if(snap.epoch == 0)
+        return deps_changed(path_pool, snap);
+    if(snap.epoch == fs_epoch)
+        return false;
+
+    // Something tracked changed since, not necessarily one of ours.  Check
+    // for real, and if nothing did, move the snapshot up so the next check
+    // is O(1) again.  Events still queued in the kernel describe changes
+    // the check below already sees, or ones that will bump the epoch again.
+    if(deps_changed(path_pool, snap))
+        return true;
+    snap.epoch = fs_epoch;
     return false;
 }
 
@@ -104,6 +254,7 @@ struct CachePCHEntry {
     std::string key;            // CacheStore key in the "pch" namespace
     std::uint32_t source_file;  // index into CacheData::paths
     std::uint32_t bound;
+    std::string base;  // key of the PCH this one is chained on, or empty
     std::int64_t build_at;
     std::vector<CacheDepEntry> deps;
 };
@@ -114,34 +265,270 @@ struct CachePCMEntry {
     std::string module_name;
     std::int64_t build_at;
     std::vector<CacheDepEntry> deps;
+    /// See PCMState::remote; absent from caches written before.
+    kota::meta::defaulted<bool> remote = {};
+};
+
+struct CacheCompileEntry {
+    std::string key;  // CacheStore key in the "compile" namespace
+    std::uint32_t source_file;
+    std::int64_t build_at;
+    std::vector<CacheDepEntry> deps;
+};
+
+struct CacheModuleScanEntry {
+    std::string key;  // ModuleScanState::key
+    std::uint32_t source_file;
+    std::int64_t build_at;
+    std::vector<CacheDepEntry> deps;
+    std::string module_name;
+    bool is_interface_unit;
+    std::vector<std::string> imports;
 };
 
 struct CacheData {
     std::vector<std::string> paths;
     std::vector<CachePCHEntry> pch;
     std::vector<CachePCMEntry> pcm;
+    /// Absent from caches written before compile results were kept.
+    kota::meta::defaulted<std::vector<CacheCompileEntry>> compile;
+    /// Absent from caches written before module scans were kept.
+    kota::meta::defaulted<std::vector<CacheModuleScanEntry>> module_scans;
+};
+
+/// cache.bin holds the metadata of the cached artifacts, as a Journal.
+/// Path records add their body to the path table, which the other records
+/// refer to by index; a Put of an entry supersedes the earlier ones of its
+/// id, and a Remove drops it.
+enum class CacheOp : std::uint8_t {
+    Path,
+    Put,
+    Remove,
+};
+
+/// The cache an entry belongs to.  Put and Remove bodies start with the id
+/// of the entry: the key of a PCH or PCM, the path index of the source of
+/// a compile result or module scan.
+enum class CacheKind : std::uint8_t {
+    None,
+    PCH,
+    PCM,
+    Compile,
+    ModuleScan,
+};
+
+/// Key of an entry in CacheJournal::entries.
+std::string entry_key(CacheKind kind, llvm::StringRef id) {
+    std::string key(1, static_cast<char>(kind));
+    key += id;
+    return key;
+}
+
+struct CacheEncoder {
+    llvm::SmallVectorImpl<char>& out;
+
+    void u8(std::uint8_t value) {
+        out.push_back(static_cast<char>(value));
+    }
+
+    void u32(std::uint32_t value) {
+        char field[sizeof(value)];
+        llvm::support::endian::write32le(field, value);
+        out.append(field, field + sizeof(field));
+    }
+
+    void u64(std::uint64_t value) {
+        char field[sizeof(value)];
+        llvm::support::endian::write64le(field, value);
+        out.append(field, field + sizeof(field));
+    }
+
+    void str(llvm::StringRef value) {
+        u32(static_cast<std::uint32_t>(value.size()));
+        out.append(value.begin(), value.end());
+    }
+};
+
+/// Reads what CacheEncoder wrote; past the end of `data` every field is
+/// empty and `failed` is set.
+struct CacheDecoder {
+    llvm::StringRef data;
+    bool failed = false;
+
+    llvm::StringRef take(std::size_t size) {
+        if(data.size() < size) {
+            failed = true;
+            data = {};
+            return {};
+        }
+        auto field = data.take_front(size);
+        data = data.drop_front(size);
+        return field;
+    }
+
+    std::uint8_t u8() {
+        auto field = take(1);
+        return field.empty() ? 0 : static_cast<std::uint8_t>(field[0]);
+    }
+
+    std::uint32_t u32() {
+        auto field = take(sizeof(std::uint32_t));
+        return field.empty() ? 0 : llvm::support::endian::read32le(field.data());
+    }
+
+    std::uint64_t u64() {
+        auto field = take(sizeof(std::uint64_t));
+        return field.empty() ? 0 : llvm::support::endian::read64le(field.data());
+    }
+
+    llvm::StringRef str() {
+        return take(u32());
+    }
 };
 
+void write_cache_record(llvm::SmallVectorImpl<char>& out,
+                        CacheOp op,
+                        CacheKind kind,
+                        llvm::StringRef body) {
+    Journal::write(out, static_cast<std::uint8_t>(op), static_cast<std::uint8_t>(kind), body);
+}
+
+void encode_deps(CacheEncoder& out,
+                 const DepsSnapshot& deps,
+                 llvm::function_ref<std::uint32_t(std::uint32_t)> path_index) {
+    out.u64(static_cast<std::uint64_t>(deps.build_at));
+    out.u32(static_cast<std::uint32_t>(deps.path_ids.size()));
+    for(std::size_t i = 0; i < deps.path_ids.size(); ++i) {
+        out.u32(path_index(deps.path_ids[i]));
+        out.u64(deps.hashes[i]);
+    }
+}
+
+std::int64_t decode_deps(CacheDecoder& in, std::vector<CacheDepEntry>& deps) {
+    auto build_at = static_cast<std::int64_t>(in.u64());
+    auto count = in.u32();
+    // Each dependency takes 12 bytes: a count past the rest is corrupt.
+    if(count > in.data.size() / 12) {
+        in.failed = true;
+        return build_at;
+    }
+    for(std::uint32_t i = 0; i < count; ++i) {
+        auto path = in.u32();
+        deps.push_back({path, in.u64()});
+    }
+    return build_at;
+}
+
+/// Decode the Put body of an entry into `data`.
+bool decode_entry(CacheKind kind, llvm::StringRef body, CacheData& data) {
+    CacheDecoder in{body};
+    auto id = in.str();
+    switch(kind) {
+        case CacheKind::PCH: {
+            auto& entry = data.pch.emplace_back();
+            entry.key = id.str();
+            entry.source_file = in.u32();
+            entry.bound = in.u32();
+            entry.base = in.str().str();
+            entry.build_at = decode_deps(in, entry.deps);
+            break;
+        }
+        case CacheKind::PCM: {
+            auto& entry = data.pcm.emplace_back();
+            entry.key = id.str();
+            entry.source_file = in.u32();
+            entry.module_name = in.str().str();
+            entry.build_at = decode_deps(in, entry.deps);
+            entry.remote = in.u8() != 0;
+            break;
+        }
+        case CacheKind::Compile: {
+            auto& entry = data.compile.emplace_back();
+            entry.source_file = in.u32();
+            entry.key = in.str().str();
+            entry.build_at = decode_deps(in, entry.deps);
+            break;
+        }
+        case CacheKind::ModuleScan: {
+            auto& entry = data.module_scans.emplace_back();
+            entry.source_file = in.u32();
+            entry.key = in.str().str();
+            entry.build_at = decode_deps(in, entry.deps);
+            entry.module_name = in.str().str();
+            entry.is_interface_unit = in.u8() != 0;
+            auto count = in.u32();
+            for(std::uint32_t i = 0; i < count && !in.failed; ++i) {
+                entry.imports.push_back(in.str().str());
+            }
+            break;
+        }
+        case CacheKind::None: return false;
+    }
+    return !in.failed;
+}
+
+/// Replay the cache.bin `content` into `data`, with the xxh3 of each live
+/// entry's record in `digests`.  False when it is not entirely valid: the
+/// records before a torn or corrupt one are still applied.
+bool read_cache(Journal& journal,
+                llvm::StringRef content,
+                CacheData& data,
+                llvm::StringMap<std::uint64_t>& digests) {
+    llvm::StringMap<std::pair<CacheKind, llvm::StringRef>> entries;
+    auto valid = journal.replay(content, [&](const Journal::Record& record) {
+        auto op = static_cast<CacheOp>(record.op);
+        auto kind = static_cast<CacheKind>(record.kind);
+        if(op > CacheOp::Remove || kind > CacheKind::ModuleScan) {
+            return false;
+        }
+        if(op == CacheOp::Path) {
+            data.paths.push_back(record.body.str());
+        } else if(op == CacheOp::Put) {
+            entries[entry_key(kind, CacheDecoder{record.body}.str())] = {kind, record.body};
+        } else {
+            entries.erase(entry_key(kind, record.body));
+        }
+        return true;
+    });
+
+    for(auto& entry: entries) {
+        auto [kind, body] = entry.second;
+        if(decode_entry(kind, body, data)) {
+            digests[entry.first()] = llvm::xxh3_64bits(llvm::arrayRefFromStringRef(body));
+        }
+    }
+    return valid;
+}
+
 }  // namespace
 
 void Workspace::load_cache() {
     if(!store)
         return;
 
-    auto cache_path = path::join(store->base_dir(), "cache.json");
-    auto content = fs::read(cache_path);
-    if(!content) {
-        LOG_DEBUG("No cache.json found at {}", cache_path);
-        return;
-    }
-
     CacheData data;
-    auto status = kota::codec::json::from_json(*content, data);
-    if(!status) {
-        LOG_WARN("Failed to parse cache.json");
+    llvm::StringRef loaded_from = "cache.bin";
+    auto cache_path = path::join(store->base_dir(), "cache.bin");
+    auto legacy_path = path::join(store->base_dir(), "cache.json");
+    if(auto buffer = llvm::MemoryBuffer::getFile(cache_path, false, false)) {
+        auto& journal = cache_journal;
+        if(!read_cache(journal.file, (*buffer)->getBuffer(), data, journal.entries)) {
+            LOG_WARN("Damaged cache.bin, kept {} entries", journal.entries.size());
+        }
+        for(std::uint32_t i = 0; i < data.paths.size(); ++i) {
+            journal.paths[path_pool.intern(data.paths[i])] = i;
+        }
+    } else if(auto content = fs::read(legacy_path)) {
+        // Written by older releases; the first save replaces it.
+        if(!kota::codec::json::from_json(*content, data)) {
+            LOG_WARN("Failed to parse cache.json");
+            return;
+        }
+        loaded_from = "cache.json";
+    } else {
+        LOG_DEBUG("No cache.bin found at {}", cache_path);
         return;
     }
-
     auto resolve = [&](std::uint32_t idx) -> llvm::StringRef {
         return idx < data.paths.size() ? llvm::StringRef(data.paths[idx]) : "";
     };
@@ -165,11 +552,12 @@ void Workspace::load_cache() {
         if(!pch_path || source.empty())
             continue;
 
-        auto path_id = path_pool.intern(source);
-        auto& st = pch_cache[path_id];
+        auto& st = pch_cache[entry.key];
         st.path = *pch_path;
         st.key = entry.key;
+        st.source = path_pool.intern(source);
         st.bound = entry.bound;
+        st.base = entry.base;
         st.deps = load_deps(entry.build_at, entry.deps);
 
         LOG_DEBUG("Loaded cached PCH: {} -> {}", source, *pch_path);
@@ -177,91 +565,191 @@ void Workspace::load_cache() {
 
     for(auto& entry: data.pcm) {
         auto pcm_path = store->lookup("pcm", entry.key);
+        if(!pcm_path && entry.remote && toolchain_store)
+            pcm_path = toolchain_store->lookup("pcm", entry.key);
         auto source = resolve(entry.source_file);
         if(!pcm_path || source.empty())
             continue;
 
         auto path_id = path_pool.intern(source);
-        pcm_cache[path_id] = {*pcm_path, entry.key, load_deps(entry.build_at, entry.deps)};
-        pcm_paths[path_id] = *pcm_path;
+        pcm_cache[entry.key] = {*pcm_path,
+                                entry.key,
+                                path_id,
+                                load_deps(entry.build_at, entry.deps),
+                                entry.remote};
+        // Provisional: the module's first dispatch selects the variant its
+        // current compile command keys to.
+        pcm_paths.try_emplace(path_id, *pcm_path);
 
         LOG_DEBUG("Loaded cached PCM: {} (module {}) -> {}", source, entry.module_name, *pcm_path);
     }
 
-    LOG_INFO("Loaded cache.json: {} PCH entries, {} PCM entries",
+    for(auto& entry: data.compile) {
+        auto source = resolve(entry.source_file);
+        if(source.empty() || !store->lookup("compile", entry.key))
+            continue;
+
+        compile_results[path_pool.intern(source)] = {entry.key,
+                                                     load_deps(entry.build_at, entry.deps)};
+    }
+
+    for(auto& entry: data.module_scans) {
+        auto source = resolve(entry.source_file);
+        if(source.empty())
+            continue;
+
+        module_scans[path_pool.intern(source)] = {entry.key,
+                                                  load_deps(entry.build_at, entry.deps),
+                                                  std::move(entry.module_name),
+                                                  entry.is_interface_unit,
+                                                  std::move(entry.imports)};
+    }
+
+    LOG_INFO("Loaded {}: {} PCH, {} PCM, {} compile result, {} module scan entries",
+             loaded_from,
              pch_cache.size(),
-             pcm_cache.size());
+             pcm_cache.size(),
+             compile_results.size(),
+             module_scans.size());
 }
 
 void Workspace::save_cache() {
     if(!store)
         return;
 
-    CacheData data;
-    std::unordered_map<std::string, std::uint32_t> index_map;
+    auto& journal = cache_journal;
+    auto cache_path = path::join(store->base_dir(), "cache.bin");
+    // Another instance of the workspace saved since: its records are not
+    // in our path table, so start over.
+    journal.file.check(cache_path);
+
+    llvm::SmallVector<char, 0> records;
+    llvm::SmallVector<char, 256> body;
+    llvm::StringMap<std::uint64_t> entries;
+    std::size_t appended = 0;
 
-    auto intern = [&](std::uint32_t runtime_path_id) -> std::uint32_t {
-        auto path = std::string(path_pool.resolve(runtime_path_id));
-        auto [it, inserted] =
-            index_map.try_emplace(path, static_cast<std::uint32_t>(data.paths.size()));
+    auto path_index = [&](std::uint32_t path_id) -> std::uint32_t {
+        auto next = static_cast<std::uint32_t>(journal.paths.size());
+        auto [it, inserted] = journal.paths.try_emplace(path_id, next);
         if(inserted) {
-            data.paths.push_back(path);
+            write_cache_record(records, CacheOp::Path, CacheKind::None, path_pool.resolve(path_id));
+            appended += 1;
         }
         return it->second;
     };
 
-    for(auto& [path_id, st]: pch_cache) {
-        if(st.path.empty())
-            continue;
+    // Put the entry encoded in `body` if its record changed.
+    auto put = [&](CacheKind kind, llvm::StringRef id) {
+        auto hash = llvm::xxh3_64bits(llvm::arrayRefFromStringRef(llvm::toStringRef(body)));
+        auto key = entry_key(kind, id);
+        auto it = journal.entries.find(key);
+        if(it == journal.entries.end() || it->second != hash) {
+            write_cache_record(records, CacheOp::Put, kind, llvm::toStringRef(body));
+            appended += 1;
+        }
+        entries[key] = hash;
+    };
 
-        CachePCHEntry entry;
-        entry.key = st.key;
-        entry.source_file = intern(path_id);
-        entry.bound = st.bound;
-        entry.build_at = st.deps.build_at;
-        for(std::size_t i = 0; i < st.deps.path_ids.size(); ++i) {
-            entry.deps.push_back({intern(st.deps.path_ids[i]), st.deps.hashes[i]});
+    auto encode = [&] {
+        CacheEncoder out{body};
+        for(auto& [key, st]: pch_cache) {
+            if(st.path.empty())
+                continue;
+            body.clear();
+            out.str(st.key);
+            out.u32(path_index(st.source));
+            out.u32(st.bound);
+            out.str(st.base);
+            encode_deps(out, st.deps, path_index);
+            put(CacheKind::PCH, st.key);
         }
-        data.pch.push_back(std::move(entry));
-    }
 
-    for(auto& [path_id, st]: pcm_cache) {
-        if(st.path.empty())
-            continue;
+        for(auto& [key, st]: pcm_cache) {
+            if(st.path.empty())
+                continue;
+            auto mod_it = path_to_module.find(st.source);
+            body.clear();
+            out.str(st.key);
+            out.u32(path_index(st.source));
+            out.str(mod_it != path_to_module.end() ? llvm::StringRef(mod_it->second) : "");
+            encode_deps(out, st.deps, path_index);
+            out.u8(st.remote);
+            put(CacheKind::PCM, st.key);
+        }
 
-        CachePCMEntry entry;
-        entry.key = st.key;
-        entry.source_file = intern(path_id);
-        auto mod_it = path_to_module.find(path_id);
-        entry.module_name = mod_it != path_to_module.end() ? mod_it->second : "";
-        entry.build_at = st.deps.build_at;
-        for(std::size_t i = 0; i < st.deps.path_ids.size(); ++i) {
-            entry.deps.push_back({intern(st.deps.path_ids[i]), st.deps.hashes[i]});
+        for(auto& [path_id, st]: compile_results) {
+            auto id = std::to_string(path_index(path_id));
+            body.clear();
+            out.str(id);
+            out.u32(path_index(path_id));
+            out.str(st.key);
+            encode_deps(out, st.deps, path_index);
+            put(CacheKind::Compile, id);
         }
-        data.pcm.push_back(std::move(entry));
+
+        for(auto& [path_id, st]: module_scans) {
+            auto id = std::to_string(path_index(path_id));
+            body.clear();
+            out.str(id);
+            out.u32(path_index(path_id));
+            out.str(st.key);
+            encode_deps(out, st.deps, path_index);
+            out.str(st.module_name);
+            out.u8(st.is_interface_unit);
+            out.u32(static_cast<std::uint32_t>(st.imports.size()));
+            for(auto& name: st.imports) {
+                out.str(name);
+            }
+            put(CacheKind::ModuleScan, id);
+        }
+
+        for(auto& entry: journal.entries) {
+            if(entries.contains(entry.first()))
+                continue;
+            auto kind = static_cast<CacheKind>(entry.first()[0]);
+            write_cache_record(records, CacheOp::Remove, kind, entry.first().drop_front());
+            appended += 1;
+        }
+    };
+
+    // A rewrite starts a new path table and puts every entry.
+    auto reset = [&] {
+        journal.paths.clear();
+        journal.entries.clear();
+        entries.clear();
+        journal.file.reset(records);
+        appended = 0;
+    };
+
+    auto compact = journal.file.rewrite;
+    if(compact)
+        reset();
+    encode();
+    if(!compact && journal.file.should_compact(appended, entries.size() + journal.paths.size())) {
+        compact = true;
+        reset();
+        encode();
     }
 
-    auto json_str = kota::codec::json::to_json(data);
-    if(!json_str) {
-        LOG_WARN("Failed to serialize cache.json");
+    if(!compact) {
+        if(auto ec = journal.file.append(cache_path, llvm::toStringRef(records), appended)) {
+            LOG_WARN("Failed to append to cache.bin: {}", ec.message());
+            return;
+        }
+        journal.entries = std::move(entries);
         return;
     }
 
-    auto cache_path = path::join(store->base_dir(), "cache.json");
     // Stage inside this instance's store tmp directory: other instances of
     // the same workspace must not clobber each other's half-written file.
     auto pid = llvm::sys::Process::getProcessId();
-    auto tmp_path = path::join(store->base_dir(), "tmp", std::to_string(pid), "cache.json");
-    auto write_result = fs::write(tmp_path, *json_str);
-    if(!write_result) {
-        LOG_WARN("Failed to write cache.json.tmp: {}", write_result.error().message());
+    auto tmp_path = path::join(store->base_dir(), "tmp", std::to_string(pid), "cache.bin");
+    if(auto ec = journal.file.compact(cache_path, tmp_path, llvm::toStringRef(records), appended)) {
+        LOG_WARN("Failed to write cache.bin: {}", ec.message());
         return;
     }
-    auto rename_result = fs::rename(tmp_path, cache_path);
-    if(!rename_result) {
-        LOG_WARN("Failed to rename cache.json.tmp to cache.json: {}",
-                 rename_result.error().message());
-    }
+    journal.entries = std::move(entries);
+    llvm::sys::fs::remove(path::join(store->base_dir(), "cache.json"));
 }
 
 void Workspace::build_module_map() {
@@ -272,6 +760,209 @@ void Workspace::build_module_map() {
     }
 }
 
+/// The body of Workspace::scan_sources(), for a caller holding scan_lock.
+static kota::task<> scan_locked(Workspace& self,
+                                std::vector<std::uint32_t> sources,
+                                kota::event_loop& loop) {
+    std::vector<std::uint32_t> pending;
+    for(auto source: sources) {
+        if(self.lazy_scanned.insert(source).second) {
+            pending.push_back(source);
+        }
+    }
+    if(pending.empty()) {
+        co_return;
+    }
+
+    auto report = co_await scan_dependency_sources_async(
+        self.cdb,
+        self.toolchain,
+        self.path_pool,
+        self.dep_graph,
+        self.scan_cache,
+        std::move(pending),
+        loop,
+        [&self](llvm::StringRef path,
+                std::vector<std::string>& append,
+                std::vector<std::string>& remove) {
+            self.config.match_rules(path, append, remove);
+        });
+    // Only the rows of the files this batch reached, so a crawl in batches
+    // costs what one whole scan does.
+    self.dep_graph.patch_reverse_map();
+    for(auto& [path_id, module_name]: report.interface_units) {
+        self.path_to_module[path_id] = std::move(module_name);
+    }
+    LOG_DEBUG("Lazy dependency scan: {} sources, {} files, {}ms ({}/{} sources done)",
+              report.source_files,
+              report.total_files,
+              report.elapsed_ms,
+              self.lazy_scanned.size(),
+              self.lazy_sources.size());
+}
+
+kota::task<> Workspace::scan_sources(std::vector<std::uint32_t> sources, kota::event_loop& loop) {
+    co_await scan_lock.lock();
+    co_await scan_locked(*this, std::move(sources), loop);
+    scan_lock.unlock();
+}
+
+kota::task<> Workspace::scan_closure(std::uint32_t path_id,
+                                     kota::event_loop& loop,
+                                     std::size_t limit) {
+    co_await scan_lock.lock();
+    // The crawl may have finished while this waited.
+    if(lazy_sources.empty()) {
+        scan_lock.unlock();
+        co_return;
+    }
+
+    auto by_path = [this](std::uint32_t id, llvm::StringRef path) {
+        return path_pool.resolve(id) < path;
+    };
+    auto file = path_pool.resolve(path_id);
+    if(auto it = llvm::lower_bound(lazy_sources, file, by_path);
+       it != lazy_sources.end() && *it == path_id) {
+        co_await scan_locked(*this, {path_id}, loop);
+        scan_lock.unlock();
+        co_return;
+    }
+
+    // A header: its includers are most likely next to it, so widen the
+    // search one directory level at a time.
+    auto dir = path::parent_path(file);
+    while(!dir.empty() && dep_graph.find_host_sources(path_id, 1).empty()) {
+        std::string prefix = dir.str();
+        if(!dir.ends_with("/")) {
+            prefix += '/';
+        }
+
+        std::vector<std::uint32_t> candidates;
+        bool crowded = false;
+        for(auto it = llvm::lower_bound(lazy_sources, prefix, by_path); it != lazy_sources.end();
+            ++it) {
+            if(!path_pool.resolve(*it).starts_with(prefix)) {
+                break;
+            }
+            if(lazy_scanned.contains(*it)) {
+                continue;
+            }
+            if(candidates.size() == limit) {
+                crowded = true;
+                break;
+            }
+            candidates.push_back(*it);
+        }
+        if(crowded) {
+            LOG_DEBUG("No host for {} yet; leaving {} to the background scan", file, dir);
+            break;
+        }
+        co_await scan_locked(*this, std::move(candidates), loop);
+
+        auto parent = path::parent_path(dir);
+        if(parent == dir) {
+            break;
+        }
+        dir = parent;
+    }
+    scan_lock.unlock();
+}
+
+llvm::SmallVector<std::uint32_t> Workspace::next_lazy_sources(std::size_t count) {
+    while(lazy_cursor < lazy_sources.size() && lazy_scanned.contains(lazy_sources[lazy_cursor])) {
+        ++lazy_cursor;
+    }
+
+    llvm::SmallVector<std::uint32_t> result;
+    for(auto i = lazy_cursor; i < lazy_sources.size() && result.size() < count; ++i) {
+        if(!lazy_scanned.contains(lazy_sources[i])) {
+            result.push_back(lazy_sources[i]);
+        }
+    }
+    return result;
+}
+
+llvm::ArrayRef<std::uint32_t> Workspace::context_candidates(std::uint32_t header_path_id) {
+    auto hosts = dep_graph.find_host_sources(header_path_id);
+    auto& contexts = header_contexts[header_path_id];
+    if(contexts.hosts == hosts && contexts.ranked.size() == hosts.size()) {
+        return contexts.ranked;
+    }
+
+    // A host whose preamble was compiled has its headers warm in the
+    // workers' caches; an indexed one answers cross-file queries at once.
+    llvm::DenseSet<std::uint32_t> compiled;
+    for(auto& entry: pch_cache) {
+        compiled.insert(entry.second.source);
+    }
+    auto rank = [&](std::uint32_t host) {
+        return (compiled.contains(host) ? 2 : 0) + (merged_indices.contains(host) ? 1 : 0);
+    };
+
+    contexts.ranked.assign(hosts.begin(), hosts.end());
+    std::ranges::stable_sort(contexts.ranked, std::ranges::greater{}, rank);
+    contexts.hosts = std::move(hosts);
+    return contexts.ranked;
+}
+
+/// Idle pch_cache entries prune_pch_cache() keeps, for files reopened soon.
+constexpr std::size_t max_idle_pch = 64;
+
+bool Workspace::prune_pch_cache(const llvm::StringSet<>& in_use,
+                                llvm::ArrayRef<std::uint32_t> stale_sources) {
+    llvm::DenseSet<std::uint32_t> stale(stale_sources.begin(), stale_sources.end());
+    llvm::StringSet<> kept;
+    std::vector<std::pair<std::uint64_t, llvm::StringRef>> idle;
+    for(auto& entry: pch_cache) {
+        auto& st = entry.second;
+        if(in_use.contains(entry.first()) || st.building) {
+            kept.insert(entry.first());
+        } else if(!stale.contains(st.source)) {
+            idle.emplace_back(st.last_used, entry.first());
+        }
+    }
+    std::ranges::sort(idle, std::ranges::greater{});
+    for(std::size_t i = 0; i < idle.size() && i < max_idle_pch; ++i) {
+        kept.insert(idle[i].second);
+    }
+
+    // A kept PCH keeps the chain it is built on.
+    llvm::SmallVector<llvm::StringRef> chained;
+    for(auto& entry: kept) {
+        chained.push_back(entry.getKey());
+    }
+    while(!chained.empty()) {
+        auto it = pch_cache.find(chained.pop_back_val());
+        if(it != pch_cache.end() && !it->second.base.empty() &&
+           kept.insert(it->second.base).second) {
+            chained.push_back(it->second.base);
+        }
+    }
+
+    std::size_t pruned = 0;
+    for(auto it = pch_cache.begin(); it != pch_cache.end();) {
+        auto current = it++;
+        if(!kept.contains(current->first())) {
+            pch_cache.erase(current);
+            pruned += 1;
+        }
+    }
+    if(pruned != 0) {
+        LOG_DEBUG("Pruned {} PCH cache entries, {} kept", pruned, pch_cache.size());
+    }
+    return pruned != 0;
+}
+
+void Workspace::forget_pcm(std::uint32_t path_id) {
+    pcm_paths.erase(path_id);
+    for(auto it = pcm_cache.begin(); it != pcm_cache.end();) {
+        auto current = it++;
+        if(current->second.source == path_id) {
+            pcm_cache.erase(current);
+        }
+    }
+}
+
 void Workspace::fill_pcm_deps(std::unordered_map<std::string, std::string>& pcms,
                               std::uint32_t exclude_path_id) const {
     for(auto& [pid, pcm_path]: pcm_paths) {
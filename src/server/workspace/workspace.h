@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <memory>
 #include <optional>
@@ -10,25 +11,36 @@
 
 #include "command/command.h"
 #include "command/toolchain.h"
+#include "compile/time_trace.h"
+#include "index/call_graph.h"
 #include "index/merged_index.h"
 #include "index/project_index.h"
 #include "semantic/relation_kind.h"
 #include "server/compiler/compile_graph.h"
+#include "server/worker/file_changes.h"
 #include "server/workspace/config.h"
 #include "support/cache_store.h"
+#include "support/file_watcher.h"
+#include "support/journal.h"
 #include "support/path_pool.h"
 #include "syntax/dependency_graph.h"
 
+#include "kota/async/async.h"
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
 
 namespace clice {
 
 /// On-disk cache layout version (CacheStore root `cache/v{N}`).
-/// Bump to discard all cached artifacts after incompatible format changes.
-constexpr inline std::uint32_t cache_format_version = 1;
+/// Bump to discard the rebuildable cached artifacts (PCH, PCM, compile
+/// results) after incompatible format changes.  The index survives a bump;
+/// its blobs carry their own schema versions (index/serialization.h).
+constexpr inline std::uint32_t cache_format_version = 3;
 
 /// Two-layer staleness snapshot for compilation artifacts (PCH, AST, etc.).
 ///
@@ -38,10 +50,17 @@ constexpr inline std::uint32_t cache_format_version = 1;
 /// Layer 2 (precise): for files whose mtime changed, re-hash their content
 ///   and compare against the stored hash.  If the hash matches, the file was
 ///   "touched" but not actually modified — skip the rebuild.
+///
+/// Both layers are skipped when the file watcher covers every dependency
+/// and has seen no change since the snapshot (see Workspace::fs_epoch).
 struct DepsSnapshot {
     llvm::SmallVector<std::uint32_t> path_ids;
     llvm::SmallVector<std::uint64_t> hashes;
     std::int64_t build_at = 0;
+    /// Workspace::fs_epoch at which the dependencies were last known
+    /// unchanged, or 0 when some of them live in a directory the watcher does
+    /// not cover.  Advanced by deps_stale() after a full check passes.
+    mutable std::uint64_t epoch = 0;
 };
 
 /// Context for compiling a header file that lacks its own CDB entry.
@@ -58,18 +77,57 @@ struct PCHState {
     std::uint32_t bound = 0;
     /// CacheStore key: hex of xxh3_128bits(preamble text + canonical flags).
     std::string key;
+    /// path_id of the file whose build produced the blob.
+    std::uint32_t source = 0;
+    /// Key of the PCH this one is chained on, empty for a self-contained PCH.
+    /// A chained PCH only holds the directives past its base's bound.
+    std::string base;
     DepsSnapshot deps;
     std::string document_links_json;  ///< Pre-serialized DocumentLink[] from PCH build
     std::shared_ptr<kota::event> building;
+    /// Workspace::pch_clock when a document last took the PCH; zero for an
+    /// entry loaded from cache.bin and not used since.
+    std::uint64_t last_used = 0;
 };
 
-/// Cached PCM state for a single C++20 module.  Shared across all files that
-/// import the same module.
+/// Cached PCM state for one build variant of a C++20 module.  Shared across
+/// all files that import the module under the same flags.
 struct PCMState {
     std::string path;
-    /// CacheStore key: "{module}-{hash}" over source path + canonical flags.
+    /// CacheStore key: "{module}-{hash}" over source path + the flags that
+    /// can change the PCM (ArgsProfile::Preprocessing).
+    std::string key;
+    /// path_id of the module source.
+    std::uint32_t source = 0;
+    DepsSnapshot deps;
+    /// Fetched from the remote cache rather than built here, or kept in the
+    /// toolchain store.  Only PCMs whose imports are such as well may be
+    /// fetched: a PCM names its imports by signature, which a local rebuild
+    /// does not reproduce.
+    bool remote = false;
+};
+
+/// The diagnostics of the last compile of a file whose buffer matched what
+/// the client opened or saved, so reopening it can publish them before the
+/// AST is rebuilt.  They are the blob in the "compile" namespace.
+struct CompileResultState {
+    /// CacheStore key: hex of xxh3_128bits over the clang version, directory,
+    /// path, frontend flags, whether bodies were skipped (lazily or for a
+    /// lean compile), whether the compile was lean, and the text.
+    std::string key;
+    DepsSnapshot deps;
+};
+
+/// What the precise scan of a module unit found, which CompileGraph's
+/// resolver derives the unit's dependencies from.  Valid while the
+/// unit's command keys to `key` and the files it read are unchanged.
+struct ModuleScanState {
+    /// Hex of xxh3_128bits(directory + ArgsProfile::Preprocessing flags).
     std::string key;
     DepsSnapshot deps;
+    std::string module_name;
+    bool is_interface_unit = false;
+    std::vector<std::string> imports;
 };
 
 /// All persistent, project-wide state derived from files on disk.
@@ -90,6 +148,7 @@ struct PCMState {
 /// paths are:
 ///   - Initialization  (load_workspace at startup)
 ///   - didSave         (on_file_saved: rescan disk, cascade invalidation)
+///   - file watcher    (on_file_saved for tracked files changed on disk)
 ///   - Background index (merge TUIndex results from stateless workers)
 struct Workspace {
     Config config;
@@ -101,13 +160,58 @@ struct Workspace {
     /// Unified on-disk blob store for PCH/PCM/index artifacts.  Opened by
     /// load_workspace() when cache_dir is configured; absent means caching
     /// is disabled.  Owns blob lifecycle (atomic writes, LRU, crash
-    /// recovery); validity metadata (deps snapshots) stays in cache.json.
+    /// recovery); validity metadata (deps snapshots) stays in cache.bin.
     std::optional<CacheStore> store;
 
+    /// The store under project.toolchain_cache that every workspace of the
+    /// user shares, holding the PCMs of the standard library modules ("pcm"
+    /// and "pcm_meta" namespaces).  Absent when it is not configured or
+    /// cannot be opened.
+    std::optional<CacheStore> toolchain_store;
+
+    /// Native change notification for the directories of known dependencies.
+    /// Absent when unsupported on this platform or disabled in the config.
+    std::optional<FileWatcher> watcher;
+
+    /// Bumped on every change the watcher (or the client) reports for a
+    /// tracked file, and on queue overflow.  0 while nothing is watched.
+    /// A snapshot taken at the current epoch is known fresh without I/O.
+    std::uint64_t fs_epoch = 0;
+
+    /// Bumped when a `.clang-format` or `_clang-format` file changes, and on
+    /// queue overflow; stateless workers reuse the styles they resolved
+    /// while it stays the same.  0 while nothing is watched.
+    std::uint64_t format_epoch = 0;
+
+    /// What changed on disk, for the workers' file caches.  Stopped once a
+    /// dependency's directory cannot be watched.
+    FileChangeLog file_changes;
+
+    /// Time traces of the compiles made with project.time_trace, for the
+    /// clice/timeTrace report.
+    TimeTraceReport time_traces;
+
     /// Include relationships between files on disk (#include edges).
     /// Built once at startup from CDB scan; updated incrementally on didSave.
     DependencyGraph dep_graph;
 
+    /// Search configs and directory listings of the startup scan, to
+    /// resolve the includes of a saved file.  Per-file scan results are
+    /// dropped once the scan is done.
+    ScanCache scan_cache;
+
+    /// CDB sources of a lazy dependency scan (project.lazy_dependency_scan),
+    /// sorted by path, and those of them scanned so far.  Both are empty
+    /// once dep_graph covers the whole CDB.  Sources before lazy_cursor
+    /// are all scanned.
+    std::vector<std::uint32_t> lazy_sources;
+    llvm::DenseSet<std::uint32_t> lazy_scanned;
+    std::size_t lazy_cursor = 0;
+
+    /// Held by each lazy scan, which runs on the master loop between its
+    /// awaits: one at a time over dep_graph and scan_cache.
+    kota::mutex scan_lock;
+
     /// C++20 module compilation ordering DAG.
     /// Lazily resolves module dependencies; updated on didSave via cascade.
     std::unique_ptr<CompileGraph> compile_graph;
@@ -117,25 +221,64 @@ struct Workspace {
     /// declarations change.
     llvm::DenseMap<std::uint32_t, std::string> path_to_module;
 
-    /// PCH cache, keyed by file path_id.  Hot-path mirror of CacheStore
-    /// state; blob paths come from the store.
-    /// TODO: re-key by content hash to enable cross-file sharing.
-    llvm::DenseMap<std::uint32_t, PCHState> pch_cache;
+    /// PCH cache, keyed by the content key (PCHState::key), so every file
+    /// with the same preamble and flags shares one entry and one blob.
+    /// Hot-path mirror of CacheStore state; blob paths come from the store.
+    llvm::StringMap<PCHState> pch_cache;
+    /// Ticks with each use of a pch_cache entry, for PCHState::last_used.
+    std::uint64_t pch_clock = 0;
 
-    /// PCM cache, keyed by module source path_id.
-    llvm::DenseMap<std::uint32_t, PCMState> pcm_cache;
+    /// PCM cache, keyed by the content key (PCMState::key).  A module built
+    /// under several flag variants keeps one entry per variant, and modules
+    /// whose flags differ only in warnings share one.
+    llvm::StringMap<PCMState> pcm_cache;
 
-    /// PCM output paths, keyed by module source path_id.
-    /// Maps to the .pcm file on disk used as -fmodule-file argument.
+    /// PCM output paths, keyed by module source path_id: the variant the
+    /// module's current compile command selects.  Maps to the .pcm file on
+    /// disk used as -fmodule-file argument.
     llvm::DenseMap<std::uint32_t, std::string> pcm_paths;
 
+    /// Last cached compile result per file path_id; one per file, replaced
+    /// (and its blob invalidated) when the file compiles with other content.
+    llvm::DenseMap<std::uint32_t, CompileResultState> compile_results;
+
+    /// Last precise scan per module unit path_id, kept in cache.bin so a
+    /// restart only scans the units that changed.
+    llvm::DenseMap<std::uint32_t, ModuleScanState> module_scans;
+
+    /// What cache.bin holds, so that save_cache() only appends the entries
+    /// that changed.  Read by load_cache().
+    struct CacheJournal {
+        /// path_id → index in the path table of the file.
+        llvm::DenseMap<std::uint32_t, std::uint32_t> paths;
+        /// Entry id → xxh3 of its last record.
+        llvm::StringMap<std::uint64_t> entries;
+        /// Records in the file and its size, for appends.
+        Journal file{"CLC1"};
+    };
+    CacheJournal cache_journal;
+
     /// Global symbol table across all indexed translation units.
     index::ProjectIndex project_index;
 
     /// Per-file index shards from background indexing, keyed by project-level
     /// path_id.  Contains symbol occurrences, relations, and stored content
-    /// for position mapping.
-    llvm::DenseMap<std::uint32_t, index::MergedIndex> merged_indices;
+    /// for position mapping.  Node-based, so that a shard read on the thread
+    /// pool stays in place while others are added (see Indexer::read_shards).
+    std::unordered_map<std::uint32_t, index::MergedIndex> merged_indices;
+
+    /// The calls of merged_indices, by callee and caller; kept in step with
+    /// the shards by Indexer.
+    index::CallGraph call_graph;
+
+    /// Hosts offered as contexts of a header (clice/queryContext), keyed by
+    /// its path_id: the dep_graph hosts they were ranked from, and the
+    /// ranking (see context_candidates()).
+    struct HeaderContexts {
+        llvm::SmallVector<std::uint32_t, 4> hosts;
+        std::vector<std::uint32_t> ranked;
+    };
+    llvm::DenseMap<std::uint32_t, HeaderContexts> header_contexts;
 
     /// Called when a file is saved to disk.  Cascades invalidation through
     /// compile_graph and clears affected PCM caches.
@@ -146,13 +289,50 @@ struct Workspace {
     /// is a module unit so dependents can be re-evaluated on next compile.
     void on_file_closed(std::uint32_t path_id);
 
-    /// Load PCH/PCM validity metadata from cache.json (under the store's
-    /// versioned root); entries whose blob is gone from the store are dropped.
+    /// Load PCH/PCM/compile-result validity metadata and module scans from
+    /// cache.bin (under the store's versioned root), or from the cache.json
+    /// older releases wrote; entries whose blob is gone from the store are
+    /// dropped.
     void load_cache();
-    /// Save PCH/PCM validity metadata to cache.json.
+    /// Save PCH/PCM/compile-result validity metadata and module scans to
+    /// cache.bin: appends the entries that changed since the last save.
     void save_cache();
     /// Build path_to_module reverse mapping from dep_graph.
     void build_module_map();
+    /// Add the files `sources` reach to dep_graph on `loop`, skipping those
+    /// a lazy scan already did, and patch the reverse and module maps for
+    /// what the scan added.
+    kota::task<> scan_sources(std::vector<std::uint32_t> sources, kota::event_loop& loop);
+    /// Make a lazily scanned dep_graph cover `path_id`, a file being opened.
+    /// An unscanned source is scanned.  For a header without hosts, the
+    /// unscanned sources under its directory are scanned, then those under
+    /// each parent in turn until one includes it; a directory with more
+    /// than `limit` of them is left to the background crawl.
+    kota::task<> scan_closure(std::uint32_t path_id,
+                              kota::event_loop& loop,
+                              std::size_t limit = 256);
+    /// Up to `count` sources the lazy scan has not reached, in path order.
+    llvm::SmallVector<std::uint32_t> next_lazy_sources(std::size_t count);
+    /// The sources including `header_path_id`, those with a PCH or an index
+    /// shard first, otherwise in dep_graph order.  Ranked again only when
+    /// the hosts change, so paging through a hub header's thousands of
+    /// hosts costs a lookup per page.
+    llvm::ArrayRef<std::uint32_t> context_candidates(std::uint32_t header_path_id);
+    /// Capture a snapshot for a build started at `epoch` and watch the
+    /// directories of its dependencies.  The epoch is kept only if all of
+    /// them could be watched.
+    DepsSnapshot snapshot_deps(llvm::ArrayRef<std::string> deps, std::uint64_t epoch);
+    /// Staleness check with the watcher fast path: O(1) when no tracked file
+    /// changed since the snapshot, deps_changed() otherwise.
+    bool deps_stale(const DepsSnapshot& snap) const;
+    /// Drop the selected PCM of a module and every cached variant of it.
+    void forget_pcm(std::uint32_t path_id);
+    /// Drop the pch_cache entries no open document uses (`in_use`, with the
+    /// bases they chain on), but for the most recently used idle ones.  Of
+    /// those, entries built from `stale_sources`, whose flags changed, go
+    /// too.  The blobs stay for the store to evict.  True if any went.
+    bool prune_pch_cache(const llvm::StringSet<>& in_use,
+                         llvm::ArrayRef<std::uint32_t> stale_sources = {});
     /// Fill PCM paths for all built modules, excluding exclude_path_id.
     void fill_pcm_deps(std::unordered_map<std::string, std::string>& pcms,
                        std::uint32_t exclude_path_id = UINT32_MAX) const;
@@ -165,11 +345,15 @@ std::uint64_t hash_file(llvm::StringRef path);
 
 /// Capture a two-layer staleness snapshot after a successful compilation.
 /// Interns dependency paths into the PathPool and hashes each file's content.
+/// Long dependency lists are hashed in parallel; hashes of unchanged files
+/// are reused from a process-wide memo.
 DepsSnapshot capture_deps_snapshot(PathPool& pool, llvm::ArrayRef<std::string> deps);
 
 /// Two-layer staleness check.
 /// Layer 1 (fast): stat each dep file, compare mtime against build_at.
 /// Layer 2 (precise): for files with mtime > build_at, re-hash content.
+/// Long dependency lists are checked in parallel and the check stops at the
+/// first change found.
 bool deps_changed(const PathPool& pool, const DepsSnapshot& snap);
 
 }  // namespace clice
@@ -1,34 +1,52 @@
 #include "support/cache_store.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <chrono>
 #include <format>
 #include <mutex>
+#include <shared_mutex>
 #include <vector>
 
 #ifdef _WIN32
-// The only direct windows.h include in clice.  The defines keep it from
-// spilling the min/max macros (and other clutter) that break LLVM and
-// standard headers; any future include of windows.h needs the same guards.
+// One of the two direct windows.h includes in clice, with support/usage.cpp.
+// The defines keep it from spilling the min/max macros (and other clutter)
+// that break LLVM and standard headers; any other include of windows.h
+// needs the same guards.
 #define WIN32_LEAN_AND_MEAN
 #define NOMINMAX
 #include <windows.h>
 #else
 #include <cerrno>
+#include <climits>
+#include <fcntl.h>
 #include <signal.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #endif
 
 #include "support/filesystem.h"
+#include "support/journal.h"
 #include "support/logging.h"
+#include "support/trace.h"
 
 #include "kota/codec/json/json.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/Compression.h"
+#include "llvm/Support/Endian.h"
 #include "llvm/Support/Error.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
 
 namespace clice {
 
@@ -37,13 +55,87 @@ namespace {
 /// Manifest checkpoint is forced after this many commits/invalidates.
 constexpr std::uint32_t checkpoint_interval = 16;
 
-/// JSON layout of manifest.json.  Only an acceleration structure: blob
-/// presence and size always come from the filesystem; the manifest merely
-/// carries last-accessed times across restarts.
+/// From this many files on, a batch commit flushes the whole filesystem
+/// once instead of each file.
+constexpr std::size_t sync_filesystem_threshold = 8;
+
+/// Eviction credit of a blob per millisecond it took to build, per MiB of
+/// its size, and the most any blob gets (see State::retention).  Blobs
+/// built faster than min_cost_ms get none: that much is noise.
+constexpr std::int64_t credit_per_cost_ms = 60'000;
+constexpr std::int64_t max_credit_ms = 24 * 60 * 60 * 1000;
+constexpr std::int64_t min_cost_ms = 100;
+
+/// manifest.bin carries the last-accessed time and build cost of each
+/// blob across restarts.  Only an acceleration structure: blob presence
+/// and size always come from the filesystem.  It is a Journal whose Put
+/// bodies are
+///   i64 atime | i64 cost ms | {ns}/{key}
+/// and whose Remove bodies are the id alone.  Files of the older layout
+/// (magic "CLM1") read as damaged, and the first checkpoint replaces them.
+constexpr llvm::StringLiteral manifest_magic = "CLM2";
+
+enum class ManifestOp : std::uint8_t {
+    Put,
+    Remove,
+};
+
+struct ManifestRecord {
+    std::int64_t atime = 0;
+    std::int64_t cost_ms = 0;
+
+    bool operator==(const ManifestRecord&) const = default;
+};
+
+/// The record of the blob `id`, "{ns}/{key}", at the end of `out`.
+void write_record(llvm::SmallVectorImpl<char>& out,
+                  ManifestOp op,
+                  llvm::StringRef id,
+                  const ManifestRecord& record) {
+    llvm::SmallString<128> body;
+    if(op == ManifestOp::Put) {
+        char fields[2 * sizeof(std::int64_t)];
+        llvm::support::endian::write64le(fields, record.atime);
+        llvm::support::endian::write64le(fields + 8, record.cost_ms);
+        body.append(fields, fields + sizeof(fields));
+    }
+    body += id;
+    Journal::write(out, static_cast<std::uint8_t>(op), 0, body);
+}
+
+/// Replay the manifest.bin `content` into `records`, keyed by
+/// "{ns}/{key}".  False when it is not entirely valid: the records before
+/// a torn or corrupt one are still applied.
+bool read_manifest(Journal& journal,
+                   llvm::StringRef content,
+                   llvm::StringMap<ManifestRecord>& records) {
+    return journal.replay(content, [&](const Journal::Record& record) {
+        auto op = static_cast<ManifestOp>(record.op);
+        if(op > ManifestOp::Remove || record.kind != 0) {
+            return false;
+        }
+        if(op == ManifestOp::Remove) {
+            records.erase(record.body);
+            return true;
+        }
+        if(record.body.size() < 2 * sizeof(std::int64_t)) {
+            return false;
+        }
+        auto* fields = record.body.data();
+        records[record.body.drop_front(2 * sizeof(std::int64_t))] = {
+            static_cast<std::int64_t>(llvm::support::endian::read64le(fields)),
+            static_cast<std::int64_t>(llvm::support::endian::read64le(fields + 8))};
+        return true;
+    });
+}
+
+/// JSON layout of the manifest.json older releases wrote, read once when
+/// there is no manifest.bin yet.
 struct ManifestEntry {
     std::string ns;
     std::string key;
     std::int64_t atime = 0;
+    kota::meta::defaulted<std::int64_t> cost = {};
 };
 
 struct ManifestData {
@@ -94,6 +186,71 @@ std::error_code sync_file(llvm::StringRef path) {
     return ec;
 }
 
+/// Have the OS start reading `path` into the page cache, without waiting
+/// for it.  False where the platform has no such hint (Windows).
+bool read_ahead(llvm::StringRef path) {
+#ifdef _WIN32
+    return false;
+#else
+    int fd = ::open(path.str().c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return false;
+    }
+#ifdef __APPLE__
+    struct stat st;
+    radvisory advice{};
+    advice.ra_count = ::fstat(fd, &st) == 0 ? static_cast<int>(std::min<off_t>(st.st_size, INT_MAX))
+                                           : 0;
+    bool started = advice.ra_count != 0 && ::fcntl(fd, F_RDADVISE, &advice) != -1;
+#else
+    bool started = ::posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED) == 0;
+#endif
+    ::close(fd);
+    return started;
+#endif
+}
+
+/// Flush every file of the filesystem holding `path`.  On ext4 each
+/// fsync of a new file forces a journal commit; this is one commit for a
+/// whole batch, at the price of also flushing unrelated dirty data.
+/// Linux only; elsewhere callers sync file by file.
+std::error_code sync_filesystem(llvm::StringRef path) {
+#ifdef __linux__
+    int fd = ::open(path.str().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0) {
+        return std::error_code(errno, std::generic_category());
+    }
+    std::error_code ec;
+    if(::syncfs(fd) != 0) {
+        ec = std::error_code(errno, std::generic_category());
+    }
+    ::close(fd);
+    return ec;
+#else
+    return std::make_error_code(std::errc::not_supported);
+#endif
+}
+
+/// Persist the renames into `dir`, so that a crash cannot lose blobs a
+/// commit reported as published.  A no-op on Windows: NTFS journals
+/// renames itself and has no directory fsync.
+std::error_code sync_directory(llvm::StringRef dir) {
+#ifdef _WIN32
+    return {};
+#else
+    int fd = ::open(dir.str().c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return std::error_code(errno, std::generic_category());
+    }
+    std::error_code ec;
+    if(::fsync(fd) != 0) {
+        ec = std::error_code(errno, std::generic_category());
+    }
+    ::close(fd);
+    return ec;
+#endif
+}
+
 /// On a rename collision, check whether the existing destination blob is
 /// byte-identical to the one we tried to publish.  This path is rare even
 /// on Windows: llvm::sys::fs::rename already moves an open destination
@@ -117,6 +274,393 @@ bool same_content(llvm::StringRef tmp_path, llvm::StringRef final_path) {
     return (*tmp_buf)->getBuffer() == (*final_buf)->getBuffer();
 }
 
+/// A compressed blob starts with the magic and its raw size (little
+/// endian).  Blobs without it are raw: written before the namespace was
+/// compressed, or by a build without zstd.
+constexpr llvm::StringLiteral packed_magic = "CLZ1";
+constexpr std::size_t packed_header_size = packed_magic.size() + sizeof(std::uint64_t);
+
+/// Write the compressed form of `raw` to `out`.  Favours speed: the
+/// blobs are large and written on every rebuild.
+void pack(llvm::StringRef raw, llvm::raw_ostream& out) {
+    llvm::SmallVector<std::uint8_t, 0> packed;
+    llvm::compression::zstd::compress(llvm::arrayRefFromStringRef(raw),
+                                      packed,
+                                      llvm::compression::zstd::BestSpeedCompression);
+
+    char size[sizeof(std::uint64_t)];
+    llvm::support::endian::write64le(size, raw.size());
+    out << packed_magic;
+    out.write(size, sizeof(size));
+    out << llvm::toStringRef(packed);
+}
+
+bool is_packed(llvm::StringRef content) {
+    return content.size() >= packed_header_size && content.starts_with(packed_magic);
+}
+
+/// Decompress `content`, which is_packed().
+std::error_code unpack(llvm::StringRef content, llvm::SmallVectorImpl<std::uint8_t>& raw) {
+    auto size = llvm::support::endian::read64le(content.data() + packed_magic.size());
+    auto input = llvm::arrayRefFromStringRef(content.drop_front(packed_header_size));
+    if(auto error = llvm::compression::zstd::decompress(input, raw, size)) {
+        return llvm::errorToErrorCode(std::move(error));
+    }
+    return {};
+}
+
+/// Compress `from` into a new file `to`.
+std::error_code pack_file(llvm::StringRef from, llvm::StringRef to) {
+    auto buffer = llvm::MemoryBuffer::getFile(from, false, false);
+    if(!buffer) {
+        return buffer.getError();
+    }
+
+    std::error_code ec;
+    llvm::raw_fd_ostream out(to, ec, llvm::sys::fs::OF_None);
+    if(ec) {
+        return ec;
+    }
+    pack((*buffer)->getBuffer(), out);
+    out.close();
+    return out.error();
+}
+
+/// Decompress the blob `from` into a new file `to` and report the raw
+/// size.  A raw blob is left alone, with `packed` cleared.
+std::error_code
+    unpack_file(llvm::StringRef from, llvm::StringRef to, bool& packed, std::uint64_t& size) {
+    auto buffer = llvm::MemoryBuffer::getFile(from, false, false);
+    if(!buffer) {
+        return buffer.getError();
+    }
+    auto content = (*buffer)->getBuffer();
+    packed = is_packed(content);
+    if(!packed) {
+        return {};
+    }
+
+    llvm::SmallVector<std::uint8_t, 0> raw;
+    if(auto ec = unpack(content, raw)) {
+        return ec;
+    }
+    size = raw.size();
+    if(auto result = fs::write(to, llvm::toStringRef(raw)); !result) {
+        return result.error();
+    }
+    return {};
+}
+
+/// FastCDC (Xia et al., USENIX ATC '16) with normalized chunking: a cut
+/// point depends only on the 64 bytes before it, so blobs sharing a run
+/// of bytes share its chunks however the bytes before the run differ.
+/// Chunks are between min_chunk and max_chunk bytes, mostly near
+/// avg_chunk: a stricter mask before it, a looser one after.
+constexpr std::size_t min_chunk = 16 * 1024;
+constexpr std::size_t avg_chunk = 64 * 1024;
+constexpr std::size_t max_chunk = 256 * 1024;
+constexpr std::uint64_t strict_mask = ~std::uint64_t(0) << (64 - 18);
+constexpr std::uint64_t loose_mask = ~std::uint64_t(0) << (64 - 14);
+
+/// Pseudo-random values of the gear hash, one per byte (splitmix64).
+constexpr auto gear_table = [] {
+    std::array<std::uint64_t, 256> table{};
+    std::uint64_t seed = 0;
+    for(auto& value: table) {
+        seed += 0x9E3779B97F4A7C15;
+        auto z = seed;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+        value = z ^ (z >> 31);
+    }
+    return table;
+}();
+
+/// Length of the chunk `data` starts with.
+std::size_t next_chunk(llvm::StringRef data) {
+    if(data.size() <= min_chunk) {
+        return data.size();
+    }
+    auto normal = std::min(data.size(), avg_chunk);
+    auto limit = std::min(data.size(), max_chunk);
+    std::uint64_t hash = 0;
+    std::size_t i = min_chunk;
+    for(; i < normal; ++i) {
+        hash = (hash << 1) + gear_table[static_cast<std::uint8_t>(data[i])];
+        if((hash & strict_mask) == 0) {
+            return i + 1;
+        }
+    }
+    for(; i < limit; ++i) {
+        hash = (hash << 1) + gear_table[static_cast<std::uint8_t>(data[i])];
+        if((hash & loose_mask) == 0) {
+            return i + 1;
+        }
+    }
+    return limit;
+}
+
+/// xxh3_128 of a chunk's raw bytes, which names it.
+using ChunkId = std::pair<std::uint64_t, std::uint64_t>;
+
+std::string chunk_name(ChunkId id) {
+    return std::format("{:016x}{:016x}", id.first, id.second);
+}
+
+/// A chunk list starts with the magic and the raw size of the blob,
+/// followed by the ids of its chunks in order, 16 bytes each.
+constexpr llvm::StringLiteral chunked_magic = "CLC1";
+constexpr std::size_t chunked_header_size = chunked_magic.size() + sizeof(std::uint64_t);
+
+/// Parse a chunk list into the ids of its chunks.
+bool read_chunk_list(llvm::StringRef content, std::vector<ChunkId>& ids, std::uint64_t& size) {
+    if(content.size() < chunked_header_size || !content.starts_with(chunked_magic) ||
+       (content.size() - chunked_header_size) % 16 != 0) {
+        return false;
+    }
+    size = llvm::support::endian::read64le(content.data() + chunked_magic.size());
+    for(auto* p = content.data() + chunked_header_size; p != content.end(); p += 16) {
+        ids.emplace_back(llvm::support::endian::read64le(p),
+                         llvm::support::endian::read64le(p + 8));
+    }
+    return true;
+}
+
+/// A chunk of a blob being committed, written to `tmp_path` when the
+/// namespace did not have it yet.
+struct StagedChunk {
+    ChunkId id;
+    std::string tmp_path;
+    std::uint64_t size = 0;
+};
+
+/// Split `from` into chunks: write its chunk list to the new file
+/// `list_path`, and each chunk missing from `chunk_dir` to a tmp file
+/// named by `tmp_path`.  `ids` gets the distinct chunks of the blob.
+std::error_code chunk_file(llvm::StringRef from,
+                           llvm::StringRef list_path,
+                           llvm::StringRef chunk_dir,
+                           llvm::function_ref<std::string()> tmp_path,
+                           std::vector<ChunkId>& ids,
+                           std::vector<StagedChunk>& written) {
+    auto buffer = llvm::MemoryBuffer::getFile(from, false, false);
+    if(!buffer) {
+        return buffer.getError();
+    }
+
+    std::error_code ec;
+    llvm::raw_fd_ostream list(list_path, ec, llvm::sys::fs::OF_None);
+    if(ec) {
+        return ec;
+    }
+    auto content = (*buffer)->getBuffer();
+    char field[sizeof(std::uint64_t)];
+    llvm::support::endian::write64le(field, content.size());
+    list << chunked_magic;
+    list.write(field, sizeof(field));
+
+    llvm::DenseSet<ChunkId> seen;
+    bool compress = llvm::compression::zstd::isAvailable();
+    while(!content.empty()) {
+        auto chunk = content.take_front(next_chunk(content));
+        content = content.drop_front(chunk.size());
+        auto hash = llvm::xxh3_128bits(llvm::arrayRefFromStringRef(chunk));
+        ChunkId id{hash.high64, hash.low64};
+        llvm::support::endian::write64le(field, id.first);
+        list.write(field, sizeof(field));
+        llvm::support::endian::write64le(field, id.second);
+        list.write(field, sizeof(field));
+
+        if(!seen.insert(id).second) {
+            continue;
+        }
+        ids.push_back(id);
+        // Publishing takes another look for chunks evicted meanwhile.
+        if(llvm::sys::fs::exists(path::join(chunk_dir, chunk_name(id)))) {
+            continue;
+        }
+        written.push_back({id, tmp_path()});
+        llvm::raw_fd_ostream out(written.back().tmp_path, ec, llvm::sys::fs::OF_None);
+        if(ec) {
+            return ec;
+        }
+        if(compress) {
+            pack(chunk, out);
+        } else {
+            out << chunk;
+        }
+        written.back().size = out.tell();
+        out.close();
+        if(out.has_error()) {
+            return out.error();
+        }
+    }
+    list.close();
+    return list.error();
+}
+
+/// Concatenate the chunks the list `from` names into the new file `to`,
+/// and report its size.
+std::error_code materialize_file(llvm::StringRef from,
+                                 llvm::StringRef chunk_dir,
+                                 llvm::StringRef to,
+                                 std::uint64_t& size) {
+    auto buffer = llvm::MemoryBuffer::getFile(from, false, false);
+    if(!buffer) {
+        return buffer.getError();
+    }
+    std::vector<ChunkId> ids;
+    if(!read_chunk_list((*buffer)->getBuffer(), ids, size)) {
+        return std::make_error_code(std::errc::illegal_byte_sequence);
+    }
+
+    std::error_code ec;
+    llvm::raw_fd_ostream out(to, ec, llvm::sys::fs::OF_None);
+    if(ec) {
+        return ec;
+    }
+    llvm::SmallVector<std::uint8_t, 0> raw;
+    std::uint64_t written = 0;
+    for(auto id: ids) {
+        auto chunk = llvm::MemoryBuffer::getFile(path::join(chunk_dir, chunk_name(id)),
+                                                 false,
+                                                 false);
+        if(!chunk) {
+            return chunk.getError();
+        }
+        auto content = (*chunk)->getBuffer();
+        if(is_packed(content)) {
+            raw.clear();
+            if(auto error = unpack(content, raw)) {
+                return error;
+            }
+            content = llvm::toStringRef(raw);
+        }
+        out << content;
+        written += content.size();
+    }
+    out.close();
+    if(out.has_error()) {
+        return out.error();
+    }
+    if(written != size) {
+        return std::make_error_code(std::errc::illegal_byte_sequence);
+    }
+    return {};
+}
+
+/// A blob in a directory remote starts with the magic and the xxh3 of the
+/// rest, its payload: the blob, compressed when zstd is available.
+constexpr llvm::StringLiteral remote_magic = "CLR1";
+constexpr std::size_t remote_header_size = remote_magic.size() + sizeof(std::uint64_t);
+
+/// See CacheRemote::directory().
+class DirectoryRemote final : public CacheRemote {
+public:
+    explicit DirectoryRemote(std::string root) : root(std::move(root)) {}
+
+    bool fetch(const CacheNamespace& ns, llvm::StringRef key, llvm::StringRef dst) override {
+        auto path = blob_path(ns, key);
+        auto buffer = llvm::MemoryBuffer::getFile(path, false, false);
+        if(!buffer) {
+            return false;
+        }
+
+        auto content = (*buffer)->getBuffer();
+        if(content.size() < remote_header_size || !content.starts_with(remote_magic)) {
+            LOG_WARN("CacheStore: ignoring malformed remote blob {}", path);
+            return false;
+        }
+        auto hash = llvm::support::endian::read64le(content.data() + remote_magic.size());
+        auto payload = content.drop_front(remote_header_size);
+        if(llvm::xxh3_64bits(llvm::arrayRefFromStringRef(payload)) != hash) {
+            LOG_WARN("CacheStore: ignoring corrupt remote blob {}", path);
+            return false;
+        }
+
+        llvm::SmallVector<std::uint8_t, 0> raw;
+        if(is_packed(payload)) {
+            if(!llvm::compression::zstd::isAvailable() || unpack(payload, raw)) {
+                LOG_WARN("CacheStore: cannot unpack remote blob {}", path);
+                return false;
+            }
+            payload = llvm::toStringRef(raw);
+        }
+        return fs::write(dst, payload).has_value();
+    }
+
+    void upload(const CacheNamespace& ns, llvm::StringRef key, llvm::StringRef src) override {
+        auto buffer = llvm::MemoryBuffer::getFile(src, false, false);
+        if(!buffer) {
+            return;
+        }
+
+        llvm::SmallString<0> payload;
+        llvm::raw_svector_ostream os(payload);
+        if(llvm::compression::zstd::isAvailable()) {
+            pack((*buffer)->getBuffer(), os);
+        } else {
+            os << (*buffer)->getBuffer();
+        }
+        char hash[sizeof(std::uint64_t)];
+        llvm::support::endian::write64le(hash,
+                                         llvm::xxh3_64bits(llvm::arrayRefFromStringRef(payload)));
+
+        // Published by rename like a local commit, so readers on other
+        // machines never see a torn blob.
+        auto path = blob_path(ns, key);
+        auto tmp_path = std::format("{}.{}-{}.tmp",
+                                    path,
+                                    llvm::sys::Process::getProcessId(),
+                                    next_tmp_id.fetch_add(1));
+        llvm::sys::fs::create_directories(path::parent_path(path));
+        std::error_code ec;
+        {
+            llvm::raw_fd_ostream out(tmp_path, ec, llvm::sys::fs::OF_None);
+            if(!ec) {
+                out << remote_magic;
+                out.write(hash, sizeof(hash));
+                out << payload;
+                out.close();
+                ec = out.error();
+            }
+        }
+        if(!ec) {
+            if(auto result = fs::rename(tmp_path, path); !result) {
+                ec = result.error();
+            }
+        }
+        if(ec) {
+            LOG_DEBUG("CacheStore: failed to upload {}: {}", path, ec.message());
+            llvm::sys::fs::remove(tmp_path);
+        }
+    }
+
+private:
+    std::string blob_path(const CacheNamespace& ns, llvm::StringRef key) const {
+        return path::join(root,
+                          std::format("{}.v{}", ns.name, ns.version),
+                          key.str() + ns.extension);
+    }
+
+    std::string root;
+    std::atomic<std::uint64_t> next_tmp_id = 0;
+};
+
+/// Stamp a file with the current time.  An unpacked copy is only trusted
+/// across restarts when it is not older than its blob.
+std::error_code touch_file(llvm::StringRef path) {
+    int fd = -1;
+    if(auto ec = llvm::sys::fs::openFileForWrite(path, fd, llvm::sys::fs::CD_OpenExisting)) {
+        return ec;
+    }
+    auto now = std::chrono::time_point_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now());
+    auto ec = llvm::sys::fs::setLastAccessAndModificationTime(fd, now);
+    llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+    return ec;
+}
+
 /// Remove directory children whose name parses as a dead pid.
 /// Used for both `tmp/{pid}` and Scratch `{ns}/{pid}` layouts.
 void sweep_dead_pid_dirs(llvm::StringRef dir, std::uint32_t self_pid) {
@@ -142,12 +686,35 @@ std::int64_t now_ms() {
     return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
 }
 
+std::uint64_t elapsed_us(std::chrono::steady_clock::time_point start) {
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
 }  // namespace
 
 struct CacheStore::State {
     struct Entry {
         std::uint64_t size = 0;
-        std::int64_t atime = 0;
+        /// Stored by lookups under the shared lock, hence atomic.
+        std::atomic<std::int64_t> atime = 0;
+
+        /// Size of the unpacked copy in a compressed namespace; 0 while
+        /// there is none.
+        std::uint64_t unpacked_size = 0;
+
+        /// Milliseconds from begin_store to commit, i.e. what a miss costs
+        /// to rebuild; 0 when unknown.
+        std::int64_t cost_ms = 0;
+
+        /// In a chunked namespace, the distinct chunks of the blob and its
+        /// raw size, which its chunk list (`size`) does not tell.
+        std::vector<ChunkId> chunks;
+        std::uint64_t raw_size = 0;
+
+        /// File identity of the blob; a blob replaced by another instance
+        /// gets a new one (commits rename a fresh file into place).
+        llvm::sys::fs::UniqueID id;
     };
 
     struct Namespace {
@@ -155,11 +722,38 @@ struct CacheStore::State {
         /// Directory holding this namespace's blobs: `{base}/{name}` for
         /// LRU/Persistent, `{base}/{name}/{pid}` for Scratch.
         std::string dir;
+        /// `{dir}/unpacked` when the namespace is compressed or chunked,
+        /// else empty.
+        std::string unpacked_dir;
+        /// `{dir}/chunks` when the namespace is chunked, else empty.
+        std::string chunk_dir;
         llvm::StringMap<Entry> entries;
+        /// The chunks blobs reference, each with how many do; a chunk is in
+        /// total_size once, and goes with the last blob referencing it.
+        struct Chunk {
+            std::uint32_t refs = 0;
+            std::uint64_t size = 0;
+        };
+        llvm::DenseMap<ChunkId, Chunk> chunks;
+        /// Blobs and unpacked copies together.
         std::uint64_t total_size = 0;
+        /// Budget in force: config.max_bytes, or what disk_fraction makes
+        /// of the free space last measured.  0 means unlimited.
+        std::uint64_t budget = 0;
+        /// Counters since registration or the last stats(reset); hits and
+        /// misses apart, as lookups count them under the shared lock.
+        CacheStats stats;
+        std::atomic<std::uint64_t> hits = 0;
+        std::atomic<std::uint64_t> misses = 0;
     };
 
-    std::mutex mutex;
+    /// Shared by lookups, which only read the maps (atimes and counters
+    /// are atomics); exclusive for everything that changes them.
+    std::shared_mutex mutex;
+
+    /// Serializes checkpoints and guards the manifest* fields.  Taken
+    /// before `mutex`, if both are.
+    std::mutex checkpoint_mutex;
 
     /// `{root}/cache/v{version}` — everything the store manages lives here.
     std::string base;
@@ -171,35 +765,143 @@ struct CacheStore::State {
 
     llvm::StringMap<Namespace> namespaces;
 
-    /// Last-accessed times loaded from the manifest, keyed by "{ns}/{key}".
-    /// Consumed when the corresponding namespace is registered.
-    llvm::StringMap<std::int64_t> manifest_atimes;
+    /// Lock files taken by try_lock(), held until the store is destroyed.
+    llvm::SmallVector<llvm::sys::fs::file_t> locks;
+
+    /// What manifest.bin holds, keyed by "{ns}/{key}": read on open for
+    /// namespaces to take their last-accessed times from when registered,
+    /// then kept in step with the file by checkpoints.
+    llvm::StringMap<ManifestRecord> manifest;
 
-    std::uint64_t next_tmp_id = 0;
+    /// Records in manifest.bin, for checkpoints to append to it.
+    Journal manifest_file{manifest_magic};
 
-    std::uint32_t changes_since_checkpoint = 0;
-    bool dirty = false;
+    /// See CacheStore::set_remote().
+    std::unique_ptr<CacheRemote> remote;
+    bool upload = false;
+
+    /// "{ns}/{key}" of the blobs a remote fetch was tried for and missed;
+    /// each key is asked for once per instance.
+    llvm::StringSet<> remote_misses;
+
+    /// Lookups and commits per namespace when CacheStore::checkpoint()
+    /// last logged its counters; quiet namespaces are not logged again.
+    llvm::StringMap<std::uint64_t> reported;
+
+    std::atomic<std::uint64_t> next_tmp_id = 0;
+
+    std::atomic<std::uint32_t> changes_since_checkpoint = 0;
+    std::atomic<bool> dirty = false;
 
     /// Logical clock: strictly increasing per issued stamp so that LRU
     /// ordering is deterministic even within one millisecond.
-    std::int64_t last_stamp = 0;
+    std::atomic<std::int64_t> last_stamp = 0;
 
     std::int64_t next_stamp() {
-        last_stamp = std::max(now_ms(), last_stamp + 1);
-        return last_stamp;
+        auto last = last_stamp.load(std::memory_order_relaxed);
+        std::int64_t next = 0;
+        do {
+            next = std::max(now_ms(), last + 1);
+        } while(!last_stamp.compare_exchange_weak(last, next, std::memory_order_relaxed));
+        return next;
     }
 
     std::string blob_path(const Namespace& ns, llvm::StringRef key) const {
         return path::join(ns.dir, key.str() + ns.config.extension);
     }
 
+    std::string unpacked_path(const Namespace& ns, llvm::StringRef key) const {
+        return path::join(ns.unpacked_dir, key.str() + ns.config.extension);
+    }
+
+    std::string next_tmp_path(const Namespace& ns) {
+        auto tmp_name = std::format("{}{}", next_tmp_id++, ns.config.extension);
+        return path::join(tmp_dir, tmp_name);
+    }
+
     Namespace* find_namespace(llvm::StringRef name) {
         auto it = namespaces.find(name);
         return it != namespaces.end() ? &it->second : nullptr;
     }
 
+    ~State() {
+        for(auto file: locks) {
+            llvm::sys::fs::unlockFile(file);
+            llvm::sys::fs::closeFile(file);
+        }
+    }
+
+    /// A blob between the halves of a commit: checked and, in compressed
+    /// namespaces, compressed, but neither synced nor published.
+    struct Staged {
+        PendingEntry pending;
+        /// The file to publish: the tmp file, or its compressed copy.
+        std::string source;
+        llvm::sys::fs::file_status status;
+        std::uint64_t unpacked_size = 0;
+        bool durable = false;
+        const CacheNamespace* config = nullptr;
+        /// In a chunked namespace: the distinct chunks of the blob, and
+        /// those written because the namespace lacked them.
+        std::vector<ChunkId> chunks;
+        std::vector<StagedChunk> new_chunks;
+        /// Time spent syncing it, or its share of a filesystem sync.
+        std::uint64_t sync_us = 0;
+    };
+
+    std::expected<Staged, std::error_code> stage(PendingEntry pending);
+
+    /// fsync the files of a durable blob; drops them on failure.
+    std::error_code sync(const Staged& staged);
+
+    /// Rename the blob into place and account for it.  Returns the path
+    /// callers read, and adds the directories to sync to `published_dirs`.
+    CommitResult publish(Staged& staged, llvm::StringSet<>& published_dirs);
+
+    /// GreedyDual-Size priority of an entry, with the clock for inflation
+    /// value: its last-accessed time plus a credit proportional to its
+    /// rebuild cost per byte.  Eviction takes the lowest first, so a blob
+    /// that is slow to build and small outlives cheap churn a while longer.
+    static std::int64_t retention(const Entry& entry) {
+        if(entry.cost_ms < min_cost_ms) {
+            return entry.atime;
+        }
+        auto size = entry.chunks.empty() ? entry.size : entry.raw_size;
+        auto mib = std::max<std::uint64_t>(size >> 20, 1);
+        auto credit = entry.cost_ms * credit_per_cost_ms / static_cast<std::int64_t>(mib);
+        return entry.atime + std::min(credit, max_credit_ms);
+    }
+
+    /// Count a reference of a blob to each of `ids`.  Fails, taking none,
+    /// when a chunk not referenced yet is missing from disk.
+    std::error_code retain_chunks(Namespace& ns, llvm::ArrayRef<ChunkId> ids);
+
+    /// Drop the references of a blob to `ids`; chunks no blob references
+    /// any more are deleted unless `keep_files`, as when another instance
+    /// owns the directory.  Returns the bytes freed.
+    std::uint64_t release_chunks(Namespace& ns,
+                                 llvm::ArrayRef<ChunkId> ids,
+                                 bool keep_files = false);
+
+    /// Take the chunk references of `entry` from its chunk list on disk.
+    /// False, changing nothing, when the list is corrupt or names a
+    /// missing chunk.
+    bool scan_chunks(Namespace& ns, llvm::StringRef key, Entry& entry);
+
     void evict_locked(Namespace& ns, llvm::StringRef keep_key);
-    void checkpoint_locked();
+
+    /// Measure the free space of the cache volume again, reset the budgets
+    /// of the namespaces sized from it and evict down to them.
+    void size_budgets_locked();
+
+    /// Persist the manifest if anything changed.  Diffs the entries under
+    /// the shared lock and writes the file under checkpoint_mutex alone,
+    /// so lookups go on meanwhile; call it holding neither.
+    void checkpoint();
+
+    /// Sync `ns.entries` with the blobs in its directory.  Returns the keys
+    /// that appeared, vanished or were replaced since the last scan.
+    llvm::SmallVector<std::string> scan_locked(Namespace& ns);
 };
 
 CacheStore::CacheStore(std::unique_ptr<State> state) : state(std::move(state)) {}
@@ -210,6 +912,15 @@ CacheStore& CacheStore::operator=(CacheStore&&) noexcept = default;
 
 CacheStore::~CacheStore() = default;
 
+std::unique_ptr<CacheRemote> CacheRemote::directory(llvm::StringRef root,
+                                                    std::uint32_t version) {
+    return std::make_unique<DirectoryRemote>(path::join(root, std::format("v{}", version)));
+}
+
+std::string CacheStore::versioned_dir(llvm::StringRef root, std::uint32_t version) {
+    return path::join(root, "cache", std::format("v{}", version));
+}
+
 std::expected<CacheStore, std::error_code> CacheStore::open(llvm::StringRef root,
                                                             std::uint32_t version) {
     assert(!root.empty() && "cache root must not be empty");
@@ -225,13 +936,23 @@ std::expected<CacheStore, std::error_code> CacheStore::open(llvm::StringRef root
         return std::unexpected(ec);
     }
 
-    // Discard anything that isn't the current layout version: older version
-    // directories and any stray files.
+    // Older layouts, newest first, hand their namespace directories over;
+    // registration then keeps the Persistent ones and drops the rest.
+    // Everything else that isn't the current layout goes: newer layouts and
+    // any stray files.
+    llvm::SmallVector<std::pair<std::uint32_t, std::string>> older;
     std::error_code ec;
     for(auto it = llvm::sys::fs::directory_iterator(parent, ec);
         !ec && it != llvm::sys::fs::directory_iterator();
         it.increment(ec)) {
-        if(path::filename(it->path()) == version_dir) {
+        auto name = path::filename(it->path());
+        if(name == version_dir) {
+            continue;
+        }
+        std::uint32_t old_version = 0;
+        if(name.consume_front("v") && !name.getAsInteger(10, old_version) &&
+           old_version < version && llvm::sys::fs::is_directory(it->path())) {
+            older.emplace_back(old_version, it->path());
             continue;
         }
         LOG_INFO("CacheStore: discarding stale cache layout {}", it->path());
@@ -242,22 +963,51 @@ std::expected<CacheStore, std::error_code> CacheStore::open(llvm::StringRef root
         }
     }
 
-    // Load the manifest.  Corrupt or missing is fine: registration falls
-    // back to a directory scan with mtimes as last-accessed times.
-    auto manifest_path = path::join(state->base, "manifest.json");
-    if(auto content = fs::read(manifest_path)) {
+    std::ranges::sort(older, std::ranges::greater{});
+    for(auto& [_, old_dir]: older) {
+        for(auto it = llvm::sys::fs::directory_iterator(old_dir, ec);
+            !ec && it != llvm::sys::fs::directory_iterator();
+            it.increment(ec)) {
+            auto name = path::filename(it->path());
+            if(name == "tmp" || !llvm::sys::fs::is_directory(it->path())) {
+                continue;
+            }
+            auto target = path::join(state->base, name);
+            if(llvm::sys::fs::exists(target)) {
+                continue;
+            }
+            // The version file stays behind: after a layout bump the blobs
+            // are of unknown version, so only Persistent ones survive.
+            if(fs::rename(it->path(), target)) {
+                LOG_INFO("CacheStore: carried {} over from {}", name, old_dir);
+            }
+        }
+        LOG_INFO("CacheStore: discarding stale cache layout {}", old_dir);
+        fs::remove_all(old_dir);
+    }
+
+    // Load the manifest, mapped rather than read when large.  Corrupt or
+    // missing is fine: registration falls back to a directory scan with
+    // mtimes as last-accessed times.
+    auto manifest_path = path::join(state->base, "manifest.bin");
+    auto legacy_path = path::join(state->base, "manifest.json");
+    if(auto buffer = llvm::MemoryBuffer::getFile(manifest_path, false, false)) {
+        if(!read_manifest(state->manifest_file, (*buffer)->getBuffer(), state->manifest)) {
+            LOG_WARN("CacheStore: damaged manifest {}, kept {} records",
+                     manifest_path,
+                     state->manifest.size());
+        }
+    } else if(auto content = fs::read(legacy_path)) {
         ManifestData data;
         if(kota::codec::json::from_json(*content, data)) {
             for(auto& entry: data.entries) {
-                auto key = entry.ns + "/" + entry.key;
-                state->manifest_atimes[key] = entry.atime;
-                state->last_stamp = std::max(state->last_stamp, entry.atime);
+                state->manifest[entry.ns + "/" + entry.key] = {entry.atime, *entry.cost};
             }
-        } else {
-            LOG_WARN("CacheStore: corrupt manifest {}, rebuilding from directory scan",
-                     manifest_path);
         }
     }
+    for(auto& record: state->manifest) {
+        state->last_stamp = std::max(state->last_stamp.load(), record.second.atime);
+    }
 
     // The only crash residue are in-flight tmp files; committed blobs are
     // complete by construction (atomic rename).  Sweep tmp directories of
@@ -285,6 +1035,28 @@ void CacheStore::register_namespace(CacheNamespace ns) {
     if(!inserted) {
         return;
     }
+
+    // A namespace without a version file was written by a layout that did
+    // not record one: its version is unknown.
+    auto version_path = path::join(state->base, ns.name + ".version");
+    std::optional<std::uint32_t> written_version;
+    if(auto content = fs::read(version_path)) {
+        std::uint32_t value = 0;
+        if(!llvm::StringRef(*content).trim().getAsInteger(10, value)) {
+            written_version = value;
+        }
+    }
+    if(written_version != ns.version) {
+        if(ns.policy != CachePolicy::Persistent) {
+            LOG_INFO("CacheStore: dropping {} blobs of another format version", ns.name);
+            fs::remove_all(ns_dir);
+            llvm::sys::fs::create_directories(ns_dir);
+        }
+        if(!fs::write(version_path, std::to_string(ns.version))) {
+            LOG_WARN("CacheStore: failed to record the version of {}", ns.name);
+        }
+    }
+
     auto& ns_state = it->second;
     ns_state.config = std::move(ns);
 
@@ -300,15 +1072,73 @@ void CacheStore::register_namespace(CacheNamespace ns) {
 
     ns_state.dir = std::move(ns_dir);
 
+    // Chunk lists mean nothing to a namespace that is no longer chunked;
+    // the other way round, blobs that are not are dropped by the scan.
+    auto unpacked_dir = path::join(ns_state.dir, "unpacked");
+    auto chunk_dir = path::join(ns_state.dir, "chunks");
+    bool lru = ns_state.config.policy == CachePolicy::LRU;
+    bool chunked = ns_state.config.codec == CacheCodec::Chunked && lru;
+    if(!chunked && llvm::sys::fs::is_directory(chunk_dir)) {
+        LOG_INFO("CacheStore: dropping the chunked blobs of {}", ns_state.config.name);
+        fs::remove_all(ns_state.dir);
+        llvm::sys::fs::create_directories(ns_state.dir);
+    }
+    bool compressed = false;
+    if(ns_state.config.codec == CacheCodec::Zstd && lru) {
+        compressed = llvm::compression::zstd::isAvailable();
+        if(!compressed) {
+            LOG_INFO("CacheStore: zstd unavailable, storing {} uncompressed", ns_state.config.name);
+        }
+    }
+    if(compressed || chunked) {
+        ns_state.unpacked_dir = std::move(unpacked_dir);
+        llvm::sys::fs::create_directories(ns_state.unpacked_dir);
+    } else if(llvm::sys::fs::is_directory(unpacked_dir)) {
+        // Left over from when the namespace was compressed.
+        fs::remove_all(unpacked_dir);
+    }
+    if(chunked) {
+        ns_state.chunk_dir = std::move(chunk_dir);
+        llvm::sys::fs::create_directories(ns_state.chunk_dir);
+    }
+
     // Adopt blobs already on disk.  The directory scan, not the manifest,
     // decides existence: this also picks up blobs committed after the last
     // checkpoint of a crashed instance.
+    state->scan_locked(ns_state);
+
+    // Chunks no blob references are left by a crash between publishing
+    // the chunks of a blob and its list, or by blobs removed since.
     std::error_code ec;
-    for(auto iter = llvm::sys::fs::directory_iterator(ns_state.dir, ec);
+    for(auto it = llvm::sys::fs::directory_iterator(ns_state.chunk_dir, ec);
+        chunked && !ec && it != llvm::sys::fs::directory_iterator();
+        it.increment(ec)) {
+        auto name = path::filename(it->path());
+        std::uint64_t high = 0, low = 0;
+        if(name.size() != 32 || name.take_front(16).getAsInteger(16, high) ||
+           name.drop_front(16).getAsInteger(16, low) || !ns_state.chunks.contains({high, low})) {
+            llvm::sys::fs::remove(it->path());
+        }
+    }
+
+    // Enforce the budget immediately in case it shrank since the last run.
+    ns_state.budget = ns_state.config.max_bytes;
+    state->size_budgets_locked();
+    state->evict_locked(ns_state, "");
+}
+
+llvm::SmallVector<std::string> CacheStore::State::scan_locked(Namespace& ns) {
+    llvm::SmallVector<std::string> changed;
+    llvm::StringSet<> seen;
+    /// Blob mtimes, to tell fresh unpacked copies from stale ones.
+    llvm::StringMap<llvm::sys::TimePoint<>> modified;
+
+    std::error_code ec;
+    for(auto iter = llvm::sys::fs::directory_iterator(ns.dir, ec);
         !ec && iter != llvm::sys::fs::directory_iterator();
         iter.increment(ec)) {
         auto filename = path::filename(iter->path());
-        auto& ext = ns_state.config.extension;
+        auto& ext = ns.config.extension;
         if(!ext.empty() && !filename.consume_back(ext)) {
             continue;
         }
@@ -318,38 +1148,265 @@ void CacheStore::register_namespace(CacheNamespace ns) {
            status.type() != llvm::sys::fs::file_type::regular_file) {
             continue;
         }
+        seen.insert(filename);
+        if(!ns.unpacked_dir.empty()) {
+            modified[filename] = status.getLastModificationTime();
+        }
 
-        auto atime_it = state->manifest_atimes.find(ns_state.config.name + "/" + filename.str());
-        auto atime = atime_it != state->manifest_atimes.end()
-                         ? atime_it->second
-                         : std::chrono::duration_cast<std::chrono::milliseconds>(
-                               status.getLastModificationTime().time_since_epoch())
-                               .count();
+        auto [it, inserted] = ns.entries.try_emplace(filename);
+        auto& entry = it->second;
+        if(!inserted && entry.id == status.getUniqueID()) {
+            continue;
+        }
 
-        ns_state.entries[filename] = {status.getSize(), atime};
-        ns_state.total_size += status.getSize();
+        if(inserted) {
+            auto record = manifest.find(ns.config.name + "/" + filename.str());
+            if(record != manifest.end()) {
+                entry.atime = record->second.atime;
+                entry.cost_ms = record->second.cost_ms;
+            } else {
+                entry.atime = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                  status.getLastModificationTime().time_since_epoch())
+                                  .count();
+            }
+        }
+        ns.total_size += status.getSize() - entry.size;
+        entry.size = status.getSize();
+        entry.id = status.getUniqueID();
+        changed.push_back(filename.str());
+        if(!ns.chunk_dir.empty() && !scan_chunks(ns, filename, entry)) {
+            LOG_WARN("CacheStore: dropping {} of {}, its chunks are missing",
+                     filename,
+                     ns.config.name);
+            llvm::sys::fs::remove(iter->path());
+            ns.total_size -= entry.size;
+            release_chunks(ns, entry.chunks, true);
+            ns.entries.erase(it);
+        }
     }
 
-    // Enforce the budget immediately in case it shrank since the last run.
-    state->evict_locked(ns_state, "");
+    llvm::SmallVector<std::string> vanished;
+    for(auto& entry: ns.entries) {
+        if(!seen.contains(entry.first())) {
+            vanished.push_back(entry.first().str());
+        }
+    }
+    for(auto& key: vanished) {
+        auto it = ns.entries.find(key);
+        ns.total_size -= it->second.size + it->second.unpacked_size;
+        // Whoever removed the blob removed the chunks it freed.
+        release_chunks(ns, it->second.chunks, true);
+        ns.entries.erase(it);
+        changed.push_back(std::move(key));
+    }
+
+    if(ns.unpacked_dir.empty()) {
+        return changed;
+    }
+
+    // A copy older than its blob was unpacked from the blob that one
+    // replaced; it goes, and so do the copies of vanished blobs.
+    llvm::StringSet<> fresh;
+    for(auto iter = llvm::sys::fs::directory_iterator(ns.unpacked_dir, ec);
+        !ec && iter != llvm::sys::fs::directory_iterator();
+        iter.increment(ec)) {
+        auto filename = path::filename(iter->path());
+        auto& ext = ns.config.extension;
+        llvm::sys::fs::file_status status;
+        if((!ext.empty() && !filename.consume_back(ext)) ||
+           llvm::sys::fs::status(iter->path(), status) ||
+           status.type() != llvm::sys::fs::file_type::regular_file) {
+            continue;
+        }
+
+        auto it = ns.entries.find(filename);
+        auto blob = modified.find(filename);
+        if(it == ns.entries.end() || blob == modified.end() ||
+           status.getLastModificationTime() < blob->second) {
+            llvm::sys::fs::remove(iter->path());
+            continue;
+        }
+        fresh.insert(filename);
+        ns.total_size += status.getSize() - it->second.unpacked_size;
+        it->second.unpacked_size = status.getSize();
+    }
+    for(auto& entry: ns.entries) {
+        if(!fresh.contains(entry.first())) {
+            ns.total_size -= entry.second.unpacked_size;
+            entry.second.unpacked_size = 0;
+        }
+    }
+    return changed;
 }
 
-std::optional<std::string> CacheStore::lookup(llvm::StringRef ns, llvm::StringRef key) {
+void CacheStore::rescan(llvm::StringRef ns, llvm::function_ref<void(llvm::StringRef)> changed) {
+    llvm::SmallVector<std::string> keys;
+    {
+        std::lock_guard guard(state->mutex);
+        auto* ns_state = state->find_namespace(ns);
+        if(!ns_state || ns_state->config.policy == CachePolicy::Scratch) {
+            return;
+        }
+        keys = state->scan_locked(*ns_state);
+    }
+
+    for(auto& key: keys) {
+        changed(key);
+    }
+}
+
+bool CacheStore::try_lock(llvm::StringRef name) {
+    auto lock_path = path::join(state->base, name.str() + ".lock");
+    auto file = llvm::sys::fs::openNativeFileForReadWrite(lock_path,
+                                                          llvm::sys::fs::CD_OpenAlways,
+                                                          llvm::sys::fs::OF_None);
+    if(!file) {
+        llvm::consumeError(file.takeError());
+        return false;
+    }
+    if(llvm::sys::fs::tryLockFile(*file)) {
+        llvm::sys::fs::closeFile(*file);
+        return false;
+    }
+
     std::lock_guard guard(state->mutex);
+    state->locks.push_back(*file);
+    return true;
+}
 
-    auto* ns_state = state->find_namespace(ns);
-    if(!ns_state) {
+std::optional<std::string> CacheStore::lookup(llvm::StringRef ns, llvm::StringRef key) {
+    std::string blob_path;
+    std::string tmp_path;
+    std::string chunk_dir;
+    llvm::sys::fs::UniqueID id;
+    {
+        std::shared_lock guard(state->mutex);
+
+        auto* ns_state = state->find_namespace(ns);
+        if(!ns_state) {
+            return std::nullopt;
+        }
+
+        auto it = ns_state->entries.find(key);
+        if(it == ns_state->entries.end()) {
+            ns_state->misses.fetch_add(1, std::memory_order_relaxed);
+            return std::nullopt;
+        }
+
+        ns_state->hits.fetch_add(1, std::memory_order_relaxed);
+        it->second.atime.store(state->next_stamp(), std::memory_order_relaxed);
+        state->dirty.store(true, std::memory_order_relaxed);
+        if(ns_state->unpacked_dir.empty()) {
+            return state->blob_path(*ns_state, key);
+        }
+        if(it->second.unpacked_size != 0) {
+            return state->unpacked_path(*ns_state, key);
+        }
+        blob_path = state->blob_path(*ns_state, key);
+        tmp_path = state->next_tmp_path(*ns_state);
+        chunk_dir = ns_state->chunk_dir;
+        id = it->second.id;
+    }
+
+    // The copy was evicted: decompress or reassemble it outside the lock,
+    // as commit() fsyncs outside it.
+    bool packed = true;
+    std::uint64_t size = 0;
+    auto ec = chunk_dir.empty() ? unpack_file(blob_path, tmp_path, packed, size)
+                                : materialize_file(blob_path, chunk_dir, tmp_path, size);
+    if(ec) {
+        LOG_WARN("CacheStore: cannot unpack {}: {}", blob_path, ec.message());
+        llvm::sys::fs::remove(tmp_path);
         return std::nullopt;
     }
+    if(!packed) {
+        return blob_path;
+    }
 
+    std::lock_guard guard(state->mutex);
+    auto* ns_state = state->find_namespace(ns);
     auto it = ns_state->entries.find(key);
-    if(it == ns_state->entries.end()) {
+    if(it == ns_state->entries.end() || it->second.id != id) {
+        // Evicted or replaced meanwhile.
+        llvm::sys::fs::remove(tmp_path);
         return std::nullopt;
     }
+    if(it->second.unpacked_size == 0) {
+        auto copy_path = state->unpacked_path(*ns_state, key);
+        if(!fs::rename(tmp_path, copy_path)) {
+            llvm::sys::fs::remove(tmp_path);
+            return std::nullopt;
+        }
+        ns_state->total_size += size;
+        it->second.unpacked_size = size;
+        state->evict_locked(*ns_state, key);
+    } else {
+        // Another lookup unpacked it first.
+        llvm::sys::fs::remove(tmp_path);
+    }
+    return state->unpacked_path(*ns_state, key);
+}
 
-    it->second.atime = state->next_stamp();
-    state->dirty = true;
-    return state->blob_path(*ns_state, key);
+bool CacheStore::prefetch(llvm::StringRef ns, llvm::StringRef key) {
+    std::string path;
+    {
+        std::shared_lock guard(state->mutex);
+        auto* ns_state = state->find_namespace(ns);
+        if(!ns_state) {
+            return false;
+        }
+        auto it = ns_state->entries.find(key);
+        if(it == ns_state->entries.end()) {
+            return false;
+        }
+        if(ns_state->unpacked_dir.empty()) {
+            path = state->blob_path(*ns_state, key);
+        } else if(it->second.unpacked_size != 0) {
+            path = state->unpacked_path(*ns_state, key);
+        } else {
+            return false;
+        }
+    }
+    return read_ahead(path);
+}
+
+std::optional<std::string> CacheStore::fetch(llvm::StringRef ns, llvm::StringRef key) {
+    if(auto path = lookup(ns, key)) {
+        return path;
+    }
+
+    const CacheNamespace* config = nullptr;
+    std::string tmp_path;
+    auto miss_key = ns.str() + "/" + key.str();
+    {
+        std::lock_guard guard(state->mutex);
+        auto* ns_state = state->find_namespace(ns);
+        if(!state->remote || !ns_state || !ns_state->config.shared ||
+           !state->remote_misses.insert(miss_key).second) {
+            return std::nullopt;
+        }
+        config = &ns_state->config;
+        tmp_path = state->next_tmp_path(*ns_state);
+    }
+
+    // Committed as if built here, except that it is not uploaded back; its
+    // cost is that of the download.
+    auto begun_at = now_ms();
+    if(!state->remote->fetch(*config, key, tmp_path)) {
+        llvm::sys::fs::remove(tmp_path);
+        return std::nullopt;
+    }
+    std::vector<PendingEntry> fetched;
+    fetched.push_back({ns.str(), key.str(), std::move(tmp_path), begun_at});
+    auto committed = commit_all(std::move(fetched), false);
+    if(!committed.front()) {
+        return std::nullopt;
+    }
+    LOG_DEBUG("CacheStore: fetched {} from the remote", miss_key);
+
+    std::lock_guard guard(state->mutex);
+    state->remote_misses.erase(miss_key);
+    return std::move(*committed.front());
 }
 
 CacheStore::PendingEntry CacheStore::begin_store(llvm::StringRef ns, llvm::StringRef key) {
@@ -362,104 +1419,357 @@ CacheStore::PendingEntry CacheStore::begin_store(llvm::StringRef ns, llvm::Strin
         return {};
     }
 
-    auto tmp_name = std::format("{}{}", state->next_tmp_id++, ns_state->config.extension);
-    return PendingEntry{ns.str(), key.str(), path::join(state->tmp_dir, tmp_name)};
+    return PendingEntry{ns.str(), key.str(), state->next_tmp_path(*ns_state), now_ms()};
 }
 
-std::expected<std::string, std::error_code> CacheStore::commit(PendingEntry pending) {
+auto CacheStore::State::stage(PendingEntry pending) -> std::expected<Staged, std::error_code> {
     if(pending.tmp_path.empty()) {
         return std::unexpected(std::make_error_code(std::errc::invalid_argument));
     }
 
-    llvm::sys::fs::file_status status;
-    if(auto ec = llvm::sys::fs::status(pending.tmp_path, status)) {
+    Staged staged;
+    if(auto ec = llvm::sys::fs::status(pending.tmp_path, staged.status)) {
         return std::unexpected(ec);
     }
 
     // Scratch blobs are cheap derivatives with no durability requirement;
     // they skip the fsync.
-    bool durable;
+    std::string packed_path;
+    Namespace* ns_state = nullptr;
     {
-        std::lock_guard guard(state->mutex);
-        auto* ns_state = state->find_namespace(pending.ns);
+        std::lock_guard guard(mutex);
+        ns_state = find_namespace(pending.ns);
         if(!ns_state) {
             return std::unexpected(std::make_error_code(std::errc::invalid_argument));
         }
-        durable = ns_state->config.policy != CachePolicy::Scratch;
+        staged.durable = ns_state->config.policy != CachePolicy::Scratch;
+        staged.config = &ns_state->config;
+        if(!ns_state->unpacked_dir.empty()) {
+            packed_path = next_tmp_path(*ns_state);
+        }
     }
 
-    // fsync outside the lock so lookups are not blocked behind disk flushes.
-    if(durable) {
-        if(auto ec = sync_file(pending.tmp_path)) {
-            llvm::sys::fs::remove(pending.tmp_path);
+    // Namespaces are never unregistered, and their directories and config
+    // never change after registration.
+    if(!ns_state->chunk_dir.empty()) {
+        staged.unpacked_size = staged.status.getSize();
+        auto ec = chunk_file(
+            pending.tmp_path,
+            packed_path,
+            ns_state->chunk_dir,
+            [&] { return next_tmp_path(*ns_state); },
+            staged.chunks,
+            staged.new_chunks);
+        if(!ec) {
+            ec = touch_file(pending.tmp_path);
+        }
+        if(!ec) {
+            ec = llvm::sys::fs::status(packed_path, staged.status);
+        }
+        if(ec) {
+            llvm::sys::fs::remove(packed_path);
+            for(auto& chunk: staged.new_chunks) {
+                llvm::sys::fs::remove(chunk.tmp_path);
+            }
             return std::unexpected(ec);
         }
+        staged.source = std::move(packed_path);
+        staged.pending = std::move(pending);
+        return staged;
     }
 
-    std::string final_path;
-    {
-        std::lock_guard guard(state->mutex);
+    // In a compressed namespace the compressed file is published and the
+    // tmp file becomes the unpacked copy, stamped so that it is not older
+    // than the blob.  Should compression fail, the raw blob is published.
+    // Done outside the lock so lookups are not blocked behind it.
+    staged.unpacked_size = staged.status.getSize();
+    if(!packed_path.empty()) {
+        auto ec = pack_file(pending.tmp_path, packed_path);
+        if(!ec) {
+            ec = touch_file(pending.tmp_path);
+        }
+        if(!ec) {
+            ec = llvm::sys::fs::status(packed_path, staged.status);
+        }
+        if(ec) {
+            LOG_WARN("CacheStore: storing {} uncompressed: {}", pending.key, ec.message());
+            llvm::sys::fs::remove(packed_path);
+            packed_path.clear();
+            if(auto ec2 = llvm::sys::fs::status(pending.tmp_path, staged.status)) {
+                return std::unexpected(ec2);
+            }
+        }
+    }
+    staged.source = packed_path.empty() ? pending.tmp_path : std::move(packed_path);
+    staged.pending = std::move(pending);
+    return staged;
+}
 
-        auto* ns_state = state->find_namespace(pending.ns);
-        if(!ns_state) {
-            return std::unexpected(std::make_error_code(std::errc::invalid_argument));
+std::error_code CacheStore::State::sync(const Staged& staged) {
+    if(!staged.durable) {
+        return {};
+    }
+    auto ec = sync_file(staged.pending.tmp_path);
+    if(!ec && staged.source != staged.pending.tmp_path) {
+        ec = sync_file(staged.source);
+    }
+    for(auto& chunk: staged.new_chunks) {
+        if(!ec) {
+            ec = sync_file(chunk.tmp_path);
         }
+    }
+    if(ec) {
+        llvm::sys::fs::remove(staged.pending.tmp_path);
+        llvm::sys::fs::remove(staged.source);
+        for(auto& chunk: staged.new_chunks) {
+            llvm::sys::fs::remove(chunk.tmp_path);
+        }
+    }
+    return ec;
+}
 
-        final_path = state->blob_path(*ns_state, pending.key);
-        if(auto result = fs::rename(pending.tmp_path, final_path); !result) {
-            if(same_content(pending.tmp_path, final_path)) {
-                // Benign collision: an identical blob is already published
-                // (Windows, destination currently open).  Keep the survivor
-                // and account for it.  This is verified by comparison, not
-                // assumed from the key: even LRU keys are not fully
-                // content-addressed (a dependency edit changes the PCH
-                // content without changing its key input).
-                llvm::sys::fs::remove(pending.tmp_path);
-                if(llvm::sys::fs::status(final_path, status)) {
-                    return std::unexpected(result.error());
+CacheStore::CommitResult CacheStore::State::publish(Staged& staged,
+                                                    llvm::StringSet<>& published_dirs) {
+    auto& pending = staged.pending;
+    auto& source_path = staged.source;
+    auto& status = staged.status;
+    bool packed = source_path != pending.tmp_path;
+
+    std::lock_guard guard(mutex);
+
+    auto* ns_state = find_namespace(pending.ns);
+    if(!ns_state) {
+        return std::unexpected(std::make_error_code(std::errc::invalid_argument));
+    }
+
+    // Chunks go into place before the list naming them.  A chunk another
+    // commit published meanwhile is as good as ours; one evicted since
+    // stage() looked is missing, which retain_chunks() reports.
+    if(!ns_state->chunk_dir.empty()) {
+        for(auto& chunk: staged.new_chunks) {
+            auto chunk_path = path::join(ns_state->chunk_dir, chunk_name(chunk.id));
+            if(!fs::rename(chunk.tmp_path, chunk_path)) {
+                llvm::sys::fs::remove(chunk.tmp_path);
+            }
+        }
+        if(!staged.new_chunks.empty()) {
+            published_dirs.insert(ns_state->chunk_dir);
+        }
+        if(auto ec = retain_chunks(*ns_state, staged.chunks)) {
+            llvm::sys::fs::remove(source_path);
+            llvm::sys::fs::remove(pending.tmp_path);
+            return std::unexpected(ec);
+        }
+    }
+
+    auto final_path = blob_path(*ns_state, pending.key);
+    if(auto renamed = fs::rename(source_path, final_path); !renamed) {
+        if(same_content(source_path, final_path)) {
+            // Benign collision: an identical blob is already published
+            // (Windows, destination currently open).  Keep the survivor
+            // and account for it.  This is verified by comparison, not
+            // assumed from the key: even LRU keys are not fully
+            // content-addressed (a dependency edit changes the PCH
+            // content without changing its key input).
+            llvm::sys::fs::remove(source_path);
+            if(llvm::sys::fs::status(final_path, status)) {
+                if(packed) {
+                    llvm::sys::fs::remove(pending.tmp_path);
                 }
-            } else {
-                // The destination is stale — a rewritten mutable key
-                // (Persistent/Scratch) or an LRU blob whose content drifted
-                // from its key.  Remove it and retry; if the rename still
-                // fails, report the error instead of silently dropping the
-                // new data.
-                llvm::sys::fs::remove(final_path);
-                if(auto retry = fs::rename(pending.tmp_path, final_path); !retry) {
+                release_chunks(*ns_state, staged.chunks);
+                return std::unexpected(renamed.error());
+            }
+        } else {
+            // The destination is stale — a rewritten mutable key
+            // (Persistent/Scratch) or an LRU blob whose content drifted
+            // from its key.  Remove it and retry; if the rename still
+            // fails, report the error instead of silently dropping the
+            // new data.
+            llvm::sys::fs::remove(final_path);
+            if(auto retry = fs::rename(source_path, final_path); !retry) {
+                llvm::sys::fs::remove(source_path);
+                if(packed) {
                     llvm::sys::fs::remove(pending.tmp_path);
-                    if(auto it = ns_state->entries.find(pending.key);
-                       it != ns_state->entries.end() && llvm::sys::fs::status(final_path, status)) {
-                        // The old blob is gone as well: drop its entry so
-                        // lookups don't hand out a dangling path.
-                        ns_state->total_size -= it->second.size;
-                        ns_state->entries.erase(it);
-                        state->dirty = true;
+                }
+                release_chunks(*ns_state, staged.chunks);
+                if(auto it = ns_state->entries.find(pending.key);
+                   it != ns_state->entries.end() && llvm::sys::fs::status(final_path, status)) {
+                    // The old blob is gone as well: drop its entry so
+                    // lookups don't hand out a dangling path.
+                    if(it->second.unpacked_size != 0) {
+                        llvm::sys::fs::remove(unpacked_path(*ns_state, pending.key));
                     }
-                    return std::unexpected(retry.error());
+                    ns_state->total_size -= it->second.size + it->second.unpacked_size;
+                    release_chunks(*ns_state, it->second.chunks);
+                    ns_state->entries.erase(it);
+                    dirty = true;
                 }
+                return std::unexpected(retry.error());
             }
         }
+    }
 
-        auto& entry = ns_state->entries[pending.key];
-        // Unsigned wraparound is intentional and exact here: entry.size is
-        // already included in total_size, so total + new - old stays correct
-        // even when the replacement blob is smaller.
-        ns_state->total_size += status.getSize() - entry.size;
-        entry.size = status.getSize();
-        entry.atime = state->next_stamp();
+    auto& entry = ns_state->entries[pending.key];
+    // Unsigned wraparound is intentional and exact here: entry.size is
+    // already included in total_size, so total + new - old stays correct
+    // even when the replacement blob is smaller.
+    ns_state->total_size += status.getSize() - entry.size;
+    entry.size = status.getSize();
+    entry.atime = next_stamp();
+    entry.id = status.getUniqueID();
+    entry.cost_ms = pending.begun_at != 0 ? std::max<std::int64_t>(now_ms() - pending.begun_at, 0)
+                                          : 0;
+    // The new chunks are retained already; only what the old blob alone
+    // used goes.
+    release_chunks(*ns_state, entry.chunks);
+    entry.chunks = std::move(staged.chunks);
+    entry.raw_size = entry.chunks.empty() ? 0 : staged.unpacked_size;
+    ns_state->stats.commits += 1;
+    ns_state->stats.written_bytes += status.getSize();
+    for(auto& chunk: staged.new_chunks) {
+        ns_state->stats.written_bytes += chunk.size;
+    }
+    ns_state->stats.sync_us += staged.sync_us;
+    CommitResult result = std::move(final_path);
+    if(staged.durable) {
+        published_dirs.insert(ns_state->dir);
+    }
 
-        if(ns_state->config.policy == CachePolicy::LRU) {
-            state->evict_locked(*ns_state, pending.key);
+    if(!ns_state->unpacked_dir.empty()) {
+        // Any copy already there is of the replaced blob.
+        auto copy_path = unpacked_path(*ns_state, pending.key);
+        ns_state->total_size -= entry.unpacked_size;
+        entry.unpacked_size = 0;
+        if(packed) {
+            auto renamed = fs::rename(pending.tmp_path, copy_path);
+            if(!renamed) {
+                llvm::sys::fs::remove(copy_path);
+                renamed = fs::rename(pending.tmp_path, copy_path);
+            }
+            if(renamed) {
+                ns_state->total_size += staged.unpacked_size;
+                ns_state->stats.written_bytes += staged.unpacked_size;
+                entry.unpacked_size = staged.unpacked_size;
+                result = std::move(copy_path);
+            } else {
+                // The blob stays; the next lookup unpacks it.
+                llvm::sys::fs::remove(pending.tmp_path);
+                result = std::unexpected(renamed.error());
+            }
+        } else {
+            llvm::sys::fs::remove(copy_path);
         }
+    }
 
-        if(ns_state->config.policy != CachePolicy::Scratch) {
-            state->dirty = true;
-            state->changes_since_checkpoint += 1;
+    if(ns_state->config.policy == CachePolicy::LRU) {
+        evict_locked(*ns_state, pending.key);
+    }
+
+    if(ns_state->config.policy != CachePolicy::Scratch) {
+        dirty = true;
+        changes_since_checkpoint += 1;
+    }
+    return result;
+}
+
+CacheStore::CommitResult CacheStore::commit(PendingEntry pending) {
+    std::vector<PendingEntry> batch;
+    batch.push_back(std::move(pending));
+    return std::move(commit_batch(std::move(batch)).front());
+}
+
+std::vector<CacheStore::CommitResult> CacheStore::commit_batch(std::vector<PendingEntry> pending) {
+    return commit_all(std::move(pending), true);
+}
+
+std::vector<CacheStore::CommitResult> CacheStore::commit_all(std::vector<PendingEntry> pending,
+                                                             bool upload) {
+    trace::Span span("CacheCommit");
+    std::vector<CommitResult> results(pending.size());
+    std::vector<std::optional<State::Staged>> staged(pending.size());
+
+    std::size_t durable = 0;
+    for(std::size_t i = 0; i < pending.size(); ++i) {
+        if(auto result = state->stage(std::move(pending[i]))) {
+            durable += result->durable;
+            staged[i] = std::move(*result);
+        } else {
+            results[i] = std::unexpected(result.error());
+        }
+    }
+
+    // Every blob is synced before any is renamed into place: a published
+    // blob is complete, whichever blobs a crash cuts off.
+    auto sync_start = std::chrono::steady_clock::now();
+    bool synced = durable >= sync_filesystem_threshold && !sync_filesystem(state->tmp_dir);
+    if(synced) {
+        auto share = elapsed_us(sync_start) / durable;
+        for(auto& entry: staged) {
+            if(entry && entry->durable) {
+                entry->sync_us = share;
+            }
+        }
+    }
+    llvm::StringSet<> dirs;
+    for(std::size_t i = 0; i < staged.size(); ++i) {
+        if(!staged[i]) {
+            continue;
+        }
+        if(!synced) {
+            auto start = std::chrono::steady_clock::now();
+            auto ec = state->sync(*staged[i]);
+            staged[i]->sync_us = elapsed_us(start);
+            if(ec) {
+                results[i] = std::unexpected(ec);
+                continue;
+            }
+        }
+        results[i] = state->publish(*staged[i], dirs);
+    }
+
+    for(auto& dir: dirs) {
+        if(auto ec = sync_directory(dir.first())) {
+            LOG_WARN("CacheStore: failed to sync {}: {}", dir.first(), ec.message());
+        }
+    }
+
+    // Out of space: give some back now, so the next write does not fail
+    // the same way.
+    auto full = [](const CommitResult& result) {
+        return !result && result.error() == std::errc::no_space_on_device;
+    };
+    if(std::ranges::any_of(results, full)) {
+        std::lock_guard guard(state->mutex);
+        state->size_budgets_locked();
+    }
+
+    // Uploads last: the local commit does not wait on the network.
+    if(upload && state->upload) {
+        for(std::size_t i = 0; i < staged.size(); ++i) {
+            if(staged[i] && staged[i]->config->shared && results[i]) {
+                state->remote->upload(*staged[i]->config, staged[i]->pending.key, *results[i]);
+            }
         }
     }
 
     maybe_checkpoint();
-    return final_path;
+    return results;
+}
+
+kota::task<std::vector<CacheStore::CommitResult>>
+    CacheStore::commit_batch_async(std::vector<PendingEntry> pending) {
+    auto results = co_await kota::queue([&] { return commit_batch(std::move(pending)); });
+    if(results.has_value()) {
+        co_return std::move(results.value());
+    }
+
+    // Never ran: nothing was published.
+    for(auto& entry: pending) {
+        abort(entry);
+    }
+    co_return std::vector<CommitResult>(
+        pending.size(),
+        std::unexpected(std::make_error_code(std::errc::operation_canceled)));
 }
 
 void CacheStore::abort(const PendingEntry& pending) {
@@ -483,7 +1793,11 @@ void CacheStore::invalidate(llvm::StringRef ns, llvm::StringRef key) {
         }
 
         llvm::sys::fs::remove(state->blob_path(*ns_state, key));
-        ns_state->total_size -= it->second.size;
+        if(it->second.unpacked_size != 0) {
+            llvm::sys::fs::remove(state->unpacked_path(*ns_state, key));
+        }
+        ns_state->total_size -= it->second.size + it->second.unpacked_size;
+        state->release_chunks(*ns_state, it->second.chunks);
         ns_state->entries.erase(it);
 
         if(ns_state->config.policy != CachePolicy::Scratch) {
@@ -498,7 +1812,7 @@ void CacheStore::invalidate(llvm::StringRef ns, llvm::StringRef key) {
 void CacheStore::for_each_key(llvm::StringRef ns, llvm::function_ref<void(llvm::StringRef)> fn) {
     llvm::SmallVector<std::string> keys;
     {
-        std::lock_guard guard(state->mutex);
+        std::shared_lock guard(state->mutex);
         auto* ns_state = state->find_namespace(ns);
         if(!ns_state) {
             return;
@@ -514,19 +1828,117 @@ void CacheStore::for_each_key(llvm::StringRef ns, llvm::function_ref<void(llvm::
     }
 }
 
+void CacheStore::set_remote(std::unique_ptr<CacheRemote> remote, bool upload) {
+    std::lock_guard guard(state->mutex);
+    state->remote = std::move(remote);
+    state->upload = upload && state->remote;
+    state->remote_misses.clear();
+}
+
+bool CacheStore::is_shared(llvm::StringRef ns) {
+    std::shared_lock guard(state->mutex);
+    auto* ns_state = state->find_namespace(ns);
+    return state->remote && ns_state && ns_state->config.shared;
+}
+
 llvm::StringRef CacheStore::base_dir() const {
     return state->base;
 }
 
+bool CacheStore::State::scan_chunks(Namespace& ns, llvm::StringRef key, Entry& entry) {
+    auto buffer = llvm::MemoryBuffer::getFile(blob_path(ns, key), false, false);
+    std::vector<ChunkId> ids;
+    std::uint64_t raw_size = 0;
+    if(!buffer || !read_chunk_list((*buffer)->getBuffer(), ids, raw_size)) {
+        return false;
+    }
+    llvm::DenseSet<ChunkId> distinct;
+    std::erase_if(ids, [&](ChunkId id) { return !distinct.insert(id).second; });
+    if(retain_chunks(ns, ids)) {
+        return false;
+    }
+    release_chunks(ns, entry.chunks, true);
+    entry.chunks = std::move(ids);
+    entry.raw_size = raw_size;
+    return true;
+}
+
+std::error_code CacheStore::State::retain_chunks(Namespace& ns, llvm::ArrayRef<ChunkId> ids) {
+    for(std::size_t i = 0; i < ids.size(); ++i) {
+        auto& chunk = ns.chunks[ids[i]];
+        if(chunk.refs == 0) {
+            llvm::sys::fs::file_status status;
+            if(auto ec = llvm::sys::fs::status(path::join(ns.chunk_dir, chunk_name(ids[i])),
+                                               status)) {
+                ns.chunks.erase(ids[i]);
+                release_chunks(ns, ids.take_front(i));
+                return ec;
+            }
+            chunk.size = status.getSize();
+            ns.total_size += chunk.size;
+        }
+        chunk.refs += 1;
+    }
+    return {};
+}
+
+std::uint64_t CacheStore::State::release_chunks(Namespace& ns,
+                                                llvm::ArrayRef<ChunkId> ids,
+                                                bool keep_files) {
+    std::uint64_t freed = 0;
+    for(auto id: ids) {
+        auto it = ns.chunks.find(id);
+        if(it == ns.chunks.end() || --it->second.refs != 0) {
+            continue;
+        }
+        if(!keep_files) {
+            llvm::sys::fs::remove(path::join(ns.chunk_dir, chunk_name(id)));
+        }
+        ns.total_size -= it->second.size;
+        freed += it->second.size;
+        ns.chunks.erase(it);
+    }
+    return freed;
+}
+
+void CacheStore::State::size_budgets_locked() {
+    std::optional<llvm::sys::fs::space_info> space;
+    for(auto& [name, ns]: namespaces) {
+        if(ns.config.disk_fraction <= 0 || ns.config.policy != CachePolicy::LRU) {
+            ns.budget = ns.config.max_bytes;
+            continue;
+        }
+        if(!space) {
+            auto info = llvm::sys::fs::disk_space(base);
+            if(!info) {
+                // Keep the budgets of the last measurement, if any.
+                LOG_WARN("CacheStore: cannot measure free space: {}", info.getError().message());
+                return;
+            }
+            space = *info;
+        }
+        auto room = static_cast<double>(space->available + ns.total_size) *
+                    std::min(ns.config.disk_fraction, 1.0);
+        auto budget = std::max<std::uint64_t>(static_cast<std::uint64_t>(room), 1);
+        if(ns.config.max_bytes != 0) {
+            budget = std::min(budget, ns.config.max_bytes);
+        }
+        if(budget < ns.budget) {
+            LOG_INFO("CacheStore: budget of {} down to {} bytes", name, budget);
+        }
+        ns.budget = budget;
+        evict_locked(ns, "");
+    }
+}
+
 void CacheStore::State::evict_locked(Namespace& ns, llvm::StringRef keep_key) {
-    if(ns.config.policy != CachePolicy::LRU || ns.config.max_bytes == 0 ||
-       ns.total_size <= ns.config.max_bytes) {
+    if(ns.config.policy != CachePolicy::LRU || ns.budget == 0 || ns.total_size <= ns.budget) {
         return;
     }
 
     struct Candidate {
         llvm::StringRef key;
-        std::int64_t atime;
+        std::int64_t retention;
         std::uint64_t size;
     };
 
@@ -534,13 +1946,31 @@ void CacheStore::State::evict_locked(Namespace& ns, llvm::StringRef keep_key) {
     candidates.reserve(ns.entries.size());
     for(auto& entry: ns.entries) {
         if(entry.first() != keep_key) {
-            candidates.push_back({entry.first(), entry.second.atime, entry.second.size});
+            candidates.push_back({entry.first(), retention(entry.second), entry.second.size});
+        }
+    }
+    std::ranges::sort(candidates, {}, &Candidate::retention);
+
+    // Unpacked copies go first: their blobs stay, and a later lookup
+    // restores a copy for the price of decompressing it.
+    if(!ns.unpacked_dir.empty()) {
+        for(auto& candidate: candidates) {
+            if(ns.total_size <= ns.budget) {
+                return;
+            }
+            auto& entry = ns.entries.find(candidate.key)->second;
+            if(entry.unpacked_size == 0 ||
+               llvm::sys::fs::remove(unpacked_path(ns, candidate.key))) {
+                continue;
+            }
+            ns.total_size -= entry.unpacked_size;
+            ns.stats.dropped_copies += 1;
+            entry.unpacked_size = 0;
         }
     }
-    std::ranges::sort(candidates, {}, &Candidate::atime);
 
     for(auto& candidate: candidates) {
-        if(ns.total_size <= ns.config.max_bytes) {
+        if(ns.total_size <= ns.budget) {
             break;
         }
         // A failed delete (e.g. the file is open on Windows) keeps the
@@ -555,63 +1985,157 @@ void CacheStore::State::evict_locked(Namespace& ns, llvm::StringRef keep_key) {
                   candidate.key,
                   candidate.size,
                   ns.config.name);
-        ns.total_size -= candidate.size;
-        ns.entries.erase(candidate.key);
+        auto it = ns.entries.find(candidate.key);
+        if(it->second.unpacked_size != 0) {
+            // Should the copy survive, the next scan removes it as an orphan.
+            llvm::sys::fs::remove(unpacked_path(ns, candidate.key));
+        }
+        ns.total_size -= candidate.size + it->second.unpacked_size;
+        ns.stats.evictions += 1;
+        ns.stats.evicted_bytes += candidate.size + it->second.unpacked_size +
+                                  release_chunks(ns, it->second.chunks);
+        ns.stats.evicted_cost_ms += it->second.cost_ms;
+        ns.entries.erase(it);
         dirty = true;
     }
 }
 
-void CacheStore::State::checkpoint_locked() {
-    if(!dirty) {
+void CacheStore::State::checkpoint() {
+    std::lock_guard checkpoint_guard(checkpoint_mutex);
+    std::shared_lock guard(mutex);
+    if(!dirty.exchange(false)) {
         return;
     }
+    changes_since_checkpoint = 0;
 
-    ManifestData data;
+    // Records of what changed since the last checkpoint: new or touched
+    // blobs, and those of registered namespaces that are gone.  Records of
+    // namespaces not registered (yet) are left as they are.
+    llvm::SmallVector<char, 0> journal;
+    std::size_t appended = 0;
     for(auto& [name, ns_state]: namespaces) {
         if(ns_state.config.policy == CachePolicy::Scratch) {
             continue;
         }
         for(auto& entry: ns_state.entries) {
-            data.entries.push_back({name.str(), entry.first().str(), entry.second.atime});
+            ManifestRecord record{entry.second.atime.load(std::memory_order_relaxed),
+                                  entry.second.cost_ms};
+            auto [it, inserted] = manifest.try_emplace(name.str() + "/" + entry.first().str());
+            if(!inserted && it->second == record) {
+                continue;
+            }
+            it->second = record;
+            write_record(journal, ManifestOp::Put, it->first(), record);
+            appended += 1;
         }
     }
+    for(auto it = manifest.begin(); it != manifest.end();) {
+        auto current = it++;
+        auto [ns, key] = current->first().split('/');
+        auto* ns_state = find_namespace(ns);
+        if(!ns_state || ns_state->config.policy == CachePolicy::Scratch ||
+           ns_state->entries.contains(key)) {
+            continue;
+        }
+        write_record(journal, ManifestOp::Remove, current->first(), {});
+        appended += 1;
+        manifest.erase(current);
+    }
+
+    // The file IO leaves the store to lookups and commits.  The manifest
+    // itself only changes under checkpoint_mutex, and is only read by
+    // registration and scans otherwise.
+    guard.unlock();
 
-    auto json = kota::codec::json::to_json(data);
-    if(!json) {
-        LOG_WARN("CacheStore: failed to serialize manifest");
+    auto manifest_path = path::join(base, "manifest.bin");
+    if(!manifest_file.should_compact(appended, manifest.size())) {
+        if(auto ec = manifest_file.append(manifest_path, llvm::toStringRef(journal), appended)) {
+            LOG_WARN("CacheStore: failed to append to manifest: {}", ec.message());
+            dirty = true;
+        }
         return;
     }
 
-    auto manifest_path = path::join(base, "manifest.json");
-    auto tmp_path = path::join(tmp_dir, "manifest.json");
-    if(auto result = fs::write(tmp_path, *json); !result) {
-        LOG_WARN("CacheStore: failed to write manifest: {}", result.error().message());
-        return;
+    // Compact: one record per blob, published atomically.
+    manifest_file.reset(journal);
+    for(auto& record: manifest) {
+        write_record(journal, ManifestOp::Put, record.first(), record.second);
     }
-    if(auto result = fs::rename(tmp_path, manifest_path); !result) {
-        LOG_WARN("CacheStore: failed to publish manifest: {}", result.error().message());
+    auto tmp_path = path::join(tmp_dir, "manifest.bin");
+    if(auto ec = manifest_file.compact(manifest_path,
+                                       tmp_path,
+                                       llvm::toStringRef(journal),
+                                       manifest.size())) {
+        LOG_WARN("CacheStore: failed to write manifest: {}", ec.message());
+        dirty = true;
         return;
     }
+    llvm::sys::fs::remove(path::join(base, "manifest.json"));
+}
 
-    dirty = false;
-    changes_since_checkpoint = 0;
+std::vector<CacheStats> CacheStore::stats(bool reset) {
+    std::lock_guard guard(state->mutex);
+    std::vector<CacheStats> result;
+    for(auto& [name, ns_state]: state->namespaces) {
+        auto& stats = result.emplace_back(ns_state.stats);
+        stats.name = name.str();
+        stats.entries = ns_state.entries.size();
+        stats.bytes = ns_state.total_size;
+        stats.max_bytes = ns_state.budget;
+        stats.hits = reset ? ns_state.hits.exchange(0) : ns_state.hits.load();
+        stats.misses = reset ? ns_state.misses.exchange(0) : ns_state.misses.load();
+        if(reset) {
+            ns_state.stats = {};
+        }
+    }
+    std::ranges::sort(result, {}, &CacheStats::name);
+    return result;
 }
 
 void CacheStore::checkpoint() {
+    // Free space is measured here rather than on every commit: it changes
+    // slowly, and the pressure of other programs is only seen this way.
+    {
+        std::lock_guard guard(state->mutex);
+        state->size_budgets_locked();
+    }
+    state->checkpoint();
+
+    // The counters as stats() has them, which a reset may have cleared.
+    auto all = stats();
     std::lock_guard guard(state->mutex);
-    state->checkpoint_locked();
+    for(auto& ns: all) {
+        auto activity = ns.hits + ns.misses + ns.commits;
+        auto& reported = state->reported[ns.name];
+        if(activity == reported) {
+            continue;
+        }
+        reported = activity;
+        LOG_INFO("CacheStore: {}: {} entries, {}/{} bytes, {} hits, {} misses, {} commits "
+                 "({} bytes, {} ms in sync), {} evictions ({} bytes)",
+                 ns.name,
+                 ns.entries,
+                 ns.bytes,
+                 ns.max_bytes,
+                 ns.hits,
+                 ns.misses,
+                 ns.commits,
+                 ns.written_bytes,
+                 ns.sync_us / 1000,
+                 ns.evictions,
+                 ns.evicted_bytes);
+    }
 }
 
 void CacheStore::maybe_checkpoint() {
-    std::lock_guard guard(state->mutex);
     if(state->changes_since_checkpoint >= checkpoint_interval) {
-        state->checkpoint_locked();
+        state->checkpoint();
     }
 }
 
 void CacheStore::shutdown() {
+    state->checkpoint();
     std::lock_guard guard(state->mutex);
-    state->checkpoint_locked();
 
     fs::remove_all(state->tmp_dir);
     for(auto& [name, ns_state]: state->namespaces) {
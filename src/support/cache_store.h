@@ -6,7 +6,9 @@
 #include <optional>
 #include <string>
 #include <system_error>
+#include <vector>
 
+#include "kota/async/async.h"
 #include "llvm/ADT/STLFunctionalExtras.h"
 #include "llvm/ADT/StringRef.h"
 
@@ -28,6 +30,26 @@ enum class CachePolicy : std::uint8_t {
     Scratch,
 };
 
+/// How the blobs of a namespace are stored at rest.
+enum class CacheCodec : std::uint8_t {
+    None,
+
+    /// zstd-compressed.  Readers such as clang's PCH loader need the raw
+    /// bytes at a stable path, so every blob in use also has an unpacked
+    /// copy under `{ns}/unpacked/`.  Copies count against the budget and
+    /// are evicted before any blob: the budget holds a raw working set and
+    /// a compressed cold set.  Falls back to None without zstd support.
+    Zstd,
+
+    /// Split at content-defined boundaries (FastCDC) into chunks kept once
+    /// per namespace under `{ns}/chunks/`, zstd-compressed when available;
+    /// the blob itself is the list of its chunks.  Blobs that share long
+    /// runs of bytes, such as PCHs differing in their last includes, share
+    /// the chunks of those runs.  Blobs in use have unpacked copies as
+    /// with Zstd.
+    Chunked,
+};
+
 /// Static configuration of a cache namespace.
 struct CacheNamespace {
     /// Directory name under the store root, e.g. "pch".
@@ -41,33 +63,111 @@ struct CacheNamespace {
     /// Size budget for LRU namespaces; 0 means unlimited.
     /// Ignored for Persistent and Scratch.
     std::uint64_t max_bytes = 0;
+
+    /// When nonzero, the LRU budget follows the disk instead: this fraction
+    /// of what the namespace could grow to, its blobs plus the space
+    /// available on the cache volume, capped by max_bytes if set.  It is
+    /// measured again at every checkpoint, so the namespace gives space
+    /// back as the disk fills up.
+    double disk_fraction = 0;
+
+    /// Format version of the blobs.  When a registered namespace finds its
+    /// directory written under another (or an unknown) version, LRU and
+    /// Scratch blobs are dropped; Persistent blobs are kept for the owner to
+    /// read or upgrade blob by blob.
+    std::uint32_t version = 0;
+
+    /// Only LRU namespaces are compressed or chunked: elsewhere the
+    /// unpacked copies would have no budget to stay within.
+    CacheCodec codec = CacheCodec::None;
+
+    /// Blobs of the namespace go through the remote tier, if one is set
+    /// (see CacheStore::set_remote).  Only for keys that name the same
+    /// content on every machine.
+    bool shared = false;
+};
+
+/// A tier behind the local store that several machines share.  Blobs go
+/// in and out as their raw content; how a backend keeps and checks them
+/// is its own business.  Implementations must be thread-safe.
+class CacheRemote {
+public:
+    virtual ~CacheRemote() = default;
+
+    /// Write blob `key` of `ns` to the new file `dst`.  False on a miss,
+    /// including a blob that fails the backend's integrity check.
+    virtual bool fetch(const CacheNamespace& ns, llvm::StringRef key, llvm::StringRef dst) = 0;
+
+    /// Publish the blob at `src` as `key` of `ns`; best effort.
+    virtual void upload(const CacheNamespace& ns, llvm::StringRef key, llvm::StringRef src) = 0;
+
+    /// A remote in a directory every machine mounts, e.g. a network share:
+    /// `{root}/v{version}/{ns}.v{ns version}/{key}{ext}`.  Blobs are stored
+    /// compressed when zstd is available, with an xxh3 hash of their
+    /// content that fetch() checks.  Nothing is ever removed from it;
+    /// trimming the directory is up to its owner.
+    static std::unique_ptr<CacheRemote> directory(llvm::StringRef root, std::uint32_t version);
+};
+
+/// Occupancy and counters of one namespace (see CacheStore::stats).
+struct CacheStats {
+    std::string name;
+    std::uint64_t entries = 0;
+    /// Blobs and unpacked copies together, against the budget (0: none).
+    std::uint64_t bytes = 0;
+    std::uint64_t max_bytes = 0;
+    /// Lookups are hits plus misses.
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    /// Blobs published, the bytes they added (blob, new chunks and
+    /// unpacked copy), and the time spent syncing their files to disk.
+    std::uint64_t commits = 0;
+    std::uint64_t written_bytes = 0;
+    std::uint64_t sync_us = 0;
+    /// Blobs evicted, their bytes, and the build time they took: what
+    /// eviction has cost in rebuilds should they be asked for again.
+    std::uint64_t evictions = 0;
+    std::uint64_t evicted_bytes = 0;
+    std::uint64_t evicted_cost_ms = 0;
+    /// Unpacked copies evicted while their blobs stayed.
+    std::uint64_t dropped_copies = 0;
 };
 
 /// Content-addressed blob store with atomic writes, crash recovery and
 /// per-namespace lifecycle policies.
 ///
 /// Responsibility split: the store only manages blob lifecycle — atomic
-/// two-phase writes (begin_store/commit), LRU accounting and eviction,
+/// two-phase writes (begin_store/commit), access accounting and eviction,
 /// orphan cleanup and the manifest checkpoint.  Keys are opaque,
 /// filename-safe strings constructed by the caller (project convention:
 /// hex of llvm::xxh3_128bits, optionally with a readable prefix).
 /// Dependency tracking and staleness decisions are the caller's job.
 ///
 /// On-disk layout under `{root}/cache/v{version}/`:
-///   manifest.json        last-accessed checkpoint (not a source of truth)
+///   manifest.bin         journal of last-accessed times (not a source of truth)
 ///   tmp/{pid}/           in-flight writes of one live instance
 ///   {ns}/{key}{ext}      committed blobs (LRU / Persistent)
 ///   {ns}/{pid}/{key}{ext}  Scratch blobs of one live instance
+///   {ns}/unpacked/{key}{ext}  raw copies of compressed blobs (see CacheCodec)
+///   {ns}/chunks/{hash}   chunks of the blobs of a chunked namespace
+///
+///   {ns}.version         format version the namespace was written with
+///   {name}.lock          taken by the instance that try_lock()ed it
 ///
 /// A blob is complete iff it exists at its final path (atomic rename); the
 /// only crash residue is tmp files, swept on open().  Opening a root whose
-/// layout version differs discards the old directory entirely.
+/// layout version is newer carries the namespace directories of older
+/// layouts over, without their versions, and discards the rest; so a
+/// layout bump drops every blob except the Persistent ones, which their
+/// owner upgrades (see CacheNamespace::version).
 ///
 /// The store is passive: it owns no timer and never blocks waiting for IO
 /// completion beyond the call itself.  Periodic checkpoint() scheduling is
 /// the owner's responsibility.  All methods are thread-safe so that heavy
 /// calls (commit's fsync, checkpoint) can be offloaded to a worker thread
-/// while lookups continue on the event loop.  A synchronous operation runs
+/// while lookups continue on the event loop.  Lookups only share the lock,
+/// with each other and with a checkpoint's IO; just the in-memory part of
+/// a commit or eviction excludes them.  A synchronous operation runs
 /// to completion once started, so cancellation can never observe a torn
 /// mid-operation state.
 ///
@@ -85,41 +185,92 @@ public:
         std::string ns;
         std::string key;
         std::string tmp_path;
+        /// Wall-clock ms of begin_store; the time until commit is recorded
+        /// as the blob's build cost.  0 for none.
+        std::int64_t begun_at = 0;
     };
 
-    /// Open (creating if necessary) the store under `root`.  Any sibling
-    /// version directory other than v{version} is deleted.  Loads the
-    /// manifest if present and sweeps tmp directories of dead instances.
+    /// Open (creating if necessary) the store under `root`.  Namespace
+    /// directories of an older layout version are moved into v{version}
+    /// when it has none of its own; every other sibling of v{version} is
+    /// deleted.  Loads the manifest if present and sweeps tmp directories
+    /// of dead instances.
     static std::expected<CacheStore, std::error_code> open(llvm::StringRef root,
                                                            std::uint32_t version);
 
+    /// The versioned root a store opened under `root` uses, e.g.
+    /// `{root}/cache/v1`; for reading a store that is not opened, such as
+    /// a copy another machine wrote.
+    static std::string versioned_dir(llvm::StringRef root, std::uint32_t version);
+
     CacheStore(CacheStore&&) noexcept;
     CacheStore& operator=(CacheStore&&) noexcept;
     ~CacheStore();
 
     /// Register a namespace and scan its directory to rebuild in-memory
-    /// state.  Blobs already on disk are adopted; their last-accessed time
-    /// comes from the manifest, falling back to file mtime.  For Scratch
-    /// namespaces this cleans dead-pid subdirectories instead.
+    /// state.  Blobs already on disk are adopted, unless written under
+    /// another version of a non-Persistent namespace; their last-accessed
+    /// time comes from the manifest, falling back to file mtime.  For
+    /// Scratch namespaces this cleans dead-pid subdirectories instead.
     void register_namespace(CacheNamespace ns);
 
     /// Return the absolute blob path on hit and refresh its in-memory
-    /// last-accessed time (persisted on the next checkpoint).  No disk IO.
+    /// last-accessed time (persisted on the next checkpoint).  No disk IO,
+    /// except in compressed namespaces: there the path is that of the
+    /// unpacked copy, which is decompressed first if it was evicted.
     std::optional<std::string> lookup(llvm::StringRef ns, llvm::StringRef key);
 
+    /// Start reading blob `key` of `ns` into the page cache, for a reader
+    /// about to map it (clang loading a PCH) not to stall on disk.  Returns
+    /// without waiting for the reads, false if nothing was started: no
+    /// such blob, an evicted unpacked copy (lookup() restores it), or no
+    /// readahead on the platform.  Touches neither access times nor stats.
+    bool prefetch(llvm::StringRef ns, llvm::StringRef key);
+
+    /// lookup(), falling back on a miss in a shared namespace to the remote
+    /// tier: a blob found there is committed locally and its path returned.
+    /// Each key is asked for once per instance.  Blocks on remote IO, so
+    /// call it off the event loop.
+    std::optional<std::string> fetch(llvm::StringRef ns, llvm::StringRef key);
+
     /// Begin a two-phase write: returns a unique tmp path the blob must be
     /// written to (safe to hand to a worker process).
     PendingEntry begin_store(llvm::StringRef ns, llvm::StringRef key);
 
+    using CommitResult = std::expected<std::string, std::error_code>;
+
     /// Finish a two-phase write: fsync the tmp file and atomically rename
-    /// it to its final path.  Triggers LRU eviction when the namespace
-    /// exceeds its budget.  Returns the final blob path.
+    /// it to its final path, then fsync the directory.  Triggers eviction
+    /// when an LRU namespace exceeds its budget: blobs go in order of last
+    /// access, each pushed back by a credit for its build cost per byte, so
+    /// a large cheap blob goes before a small one that took long to build.
+    /// Returns the final blob path.  In compressed namespaces the compressed
+    /// blob is published and the tmp file, still raw, becomes its unpacked
+    /// copy, whose path is returned.
     ///
     /// On a rename collision (Windows, destination open) the existing blob
     /// is kept only when verified byte-identical to the new one; otherwise
     /// the stale destination is removed and the rename retried, and if the
     /// new blob still cannot be published an error is returned.
-    std::expected<std::string, std::error_code> commit(PendingEntry pending);
+    CommitResult commit(PendingEntry pending);
+
+    /// commit() many blobs with one round of syncs: all files are flushed
+    /// (on Linux with a single syncfs once the batch is large enough), then
+    /// renamed into place, then each namespace directory is synced once.
+    /// Results are in the order of `pending`; a failed blob does not hold
+    /// the others back.
+    std::vector<CommitResult> commit_batch(std::vector<PendingEntry> pending);
+
+    /// commit_batch() on the thread pool, keeping the event loop free.
+    kota::task<std::vector<CommitResult>> commit_batch_async(std::vector<PendingEntry> pending);
+
+    /// Put `remote` behind the store for fetch(); with `upload`, commits to
+    /// shared namespaces are also written through to it, after the local
+    /// commit is done.  Set before the store is used from several threads.
+    void set_remote(std::unique_ptr<CacheRemote> remote, bool upload);
+
+    /// Whether a remote is set and `ns` is shared with it.
+    bool is_shared(llvm::StringRef ns);
 
     /// Cancel a two-phase write and delete the tmp file.
     void abort(const PendingEntry& pending);
@@ -132,15 +283,32 @@ public:
     /// Iterates over a snapshot, so fn may call back into the store.
     void for_each_key(llvm::StringRef ns, llvm::function_ref<void(llvm::StringRef)> fn);
 
+    /// Re-read the directory of a namespace another instance writes to:
+    /// adopt blobs it committed, forget the ones it removed, and call
+    /// `changed` with every key that appeared, vanished or was replaced
+    /// since the last scan.  No-op for Scratch namespaces.
+    void rescan(llvm::StringRef ns, llvm::function_ref<void(llvm::StringRef)> changed);
+
+    /// Take the exclusive, non-blocking lock `{base}/{name}.lock`, held
+    /// until the store is destroyed (or the process exits).  Returns false
+    /// while another instance holds it.  Instances sharing a store use it to
+    /// elect the one that writes a namespace.
+    bool try_lock(llvm::StringRef name);
+
     /// The versioned root directory, e.g. `{root}/cache/v1`.  Callers may
     /// place their own metadata files directly under it (the store only
     /// manages namespace subdirectories); they die with the version.
     llvm::StringRef base_dir() const;
 
-    /// Atomically persist the manifest (key sizes and last-accessed times)
+    /// Occupancy and counters of every registered namespace, by name.
+    /// With `reset`, the counters start over after being read.
+    std::vector<CacheStats> stats(bool reset = false);
+
+    /// Atomically persist the manifest (last-accessed times and costs)
     /// if anything changed.  Also runs automatically every few commits;
     /// the owner should additionally schedule it periodically and call
-    /// shutdown() on exit.
+    /// shutdown() on exit.  Scheduled calls also log the counters of each
+    /// namespace used since the last one.
     void checkpoint();
 
     /// Final checkpoint plus removal of this instance's tmp and Scratch
@@ -152,6 +320,9 @@ private:
 
     explicit CacheStore(std::unique_ptr<State> state);
 
+    /// commit_batch(), uploading to the remote only if `upload`.
+    std::vector<CommitResult> commit_all(std::vector<PendingEntry> pending, bool upload);
+
     /// Checkpoint if enough changes accumulated since the last one.
     void maybe_checkpoint();
 
@@ -0,0 +1,129 @@
+#include "support/cgroup.h"
+
+#include <memory>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace clice::cgroup {
+
+namespace {
+
+#if defined(__linux__)
+constexpr llvm::StringLiteral mount_point = "/sys/fs/cgroup";
+
+/// Write `value` to a cgroup interface file in one write(2), as the kernel
+/// parses each write on its own.
+bool write_file(const llvm::Twine& path, llvm::StringRef value) {
+    llvm::SmallString<256> storage;
+    int fd = ::open(path.toNullTerminatedStringRef(storage).data(), O_WRONLY | O_CLOEXEC);
+    if(fd < 0)
+        return false;
+    auto written = ::write(fd, value.data(), value.size());
+    ::close(fd);
+    return written == static_cast<ssize_t>(value.size());
+}
+
+std::string read_file(const llvm::Twine& path) {
+    auto file = llvm::MemoryBuffer::getFileAsStream(path);
+    if(!file)
+        return {};
+    return (*file)->getBuffer().str();
+}
+
+/// The cgroup v2 path of this process ("0::/user.slice/...").
+std::string own_cgroup() {
+    auto content = read_file("/proc/self/cgroup");
+    llvm::StringRef rest = content;
+    while(!rest.empty()) {
+        auto [line, tail] = rest.split('\n');
+        rest = tail;
+        if(line.consume_front("0::"))
+            return (mount_point + line.trim()).str();
+    }
+    return {};
+}
+#endif
+
+}  // namespace
+
+std::optional<Tree> Tree::open(llvm::StringRef root) {
+#if defined(__linux__)
+    Tree tree;
+    if(root == "auto") {
+        tree.root = own_cgroup();
+    } else if(llvm::sys::path::is_absolute(root)) {
+        tree.root = root.str();
+    } else {
+        tree.root = (mount_point + "/" + root).str();
+    }
+    if(tree.root.empty() || ::access((tree.root + "/cgroup.subtree_control").c_str(), W_OK) != 0)
+        return std::nullopt;
+
+    auto controllers = read_file(tree.root + "/cgroup.controllers");
+    if(!llvm::StringRef(controllers).contains("cpu") ||
+       !llvm::StringRef(controllers).contains("memory"))
+        return std::nullopt;
+
+    if(own_cgroup() == tree.root && !tree.attach("master", ::getpid()))
+        return std::nullopt;
+    // Fails while other processes remain in the root (no internal processes).
+    if(!write_file(tree.root + "/cgroup.subtree_control", "+cpu +memory"))
+        return std::nullopt;
+    return tree;
+#else
+    (void)root;
+    return std::nullopt;
+#endif
+}
+
+bool Tree::attach(llvm::StringRef name, int pid) {
+#if defined(__linux__)
+    auto leaf = root + "/" + name.str();
+    if(auto ec = llvm::sys::fs::create_directory(leaf); ec)
+        return false;
+    return write_file(leaf + "/cgroup.procs", std::to_string(pid));
+#else
+    (void)name;
+    (void)pid;
+    return false;
+#endif
+}
+
+bool Tree::set(llvm::StringRef name, llvm::StringRef file, llvm::StringRef value) {
+#if defined(__linux__)
+    return write_file(llvm::Twine(root) + "/" + name + "/" + file, value);
+#else
+    (void)name;
+    (void)file;
+    (void)value;
+    return false;
+#endif
+}
+
+std::uint64_t Tree::oom_kills(llvm::StringRef name) {
+#if defined(__linux__)
+    auto content = read_file(llvm::Twine(root) + "/" + name + "/memory.events");
+    llvm::StringRef rest = content;
+    while(!rest.empty()) {
+        auto [line, tail] = rest.split('\n');
+        rest = tail;
+        std::uint64_t count = 0;
+        if(line.consume_front("oom_kill ") && !line.trim().getAsInteger(10, count))
+            return count;
+    }
+#else
+    (void)name;
+#endif
+    return 0;
+}
+
+}  // namespace clice::cgroup
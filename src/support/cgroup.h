@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "llvm/ADT/StringRef.h"
+
+namespace clice::cgroup {
+
+/// A cgroup v2 subtree delegated to this user, in which every worker gets a
+/// leaf of its own so its CPU weight and memory limits apply to it alone.
+/// Linux only; open() fails everywhere else.
+class Tree {
+public:
+    /// Open `root`: a path below /sys/fs/cgroup (or an absolute one), or
+    /// "auto" for the cgroup of this process.  If this process lives in
+    /// the root itself it moves into a `master` leaf first, since a cgroup
+    /// with processes of its own cannot enable controllers for children.
+    /// Nullopt when the root is not writable or lacks the cpu and memory
+    /// controllers.
+    static std::optional<Tree> open(llvm::StringRef root);
+
+    /// Move `pid` into the leaf `name`, creating it when missing.
+    bool attach(llvm::StringRef name, int pid);
+
+    /// Write `value` to the interface `file` (e.g. "cpu.weight") of `name`.
+    bool set(llvm::StringRef name, llvm::StringRef file, llvm::StringRef value);
+
+    /// How often the kernel killed a process of `name` at its memory.max.
+    std::uint64_t oom_kills(llvm::StringRef name);
+
+    const std::string& path() const {
+        return root;
+    }
+
+private:
+    std::string root;
+};
+
+}  // namespace clice::cgroup
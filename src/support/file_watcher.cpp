@@ -0,0 +1,142 @@
+#include "support/file_watcher.h"
+
+#include <utility>
+
+#ifdef __linux__
+#include <cerrno>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "support/filesystem.h"
+
+namespace clice {
+
+FileWatcher::FileWatcher(FileWatcher&& other) noexcept :
+    fd(std::exchange(other.fd, -1)), directories(std::move(other.directories)),
+    descriptors(std::move(other.descriptors)) {}
+
+FileWatcher& FileWatcher::operator=(FileWatcher&& other) noexcept {
+    if(this != &other) {
+        std::swap(fd, other.fd);
+        std::swap(directories, other.directories);
+        std::swap(descriptors, other.descriptors);
+    }
+    return *this;
+}
+
+#ifdef __linux__
+
+/// Writes are reported on close rather than per write() so a large save
+/// produces one event; IN_MODIFY still catches writers that keep the file
+/// open (mmap, log-style appends).
+constexpr std::uint32_t watch_mask = IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_MOVED_TO |
+                                     IN_DELETE | IN_MOVED_FROM | IN_DELETE_SELF | IN_MOVE_SELF |
+                                     IN_ONLYDIR;
+
+std::expected<FileWatcher, std::error_code> FileWatcher::create() {
+    int fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(fd < 0) {
+        return std::unexpected(std::error_code(errno, std::generic_category()));
+    }
+    return FileWatcher(fd);
+}
+
+FileWatcher::~FileWatcher() {
+    if(fd >= 0) {
+        ::close(fd);
+    }
+}
+
+std::error_code FileWatcher::add_directory(llvm::StringRef dir) {
+    if(directories.contains(dir)) {
+        return {};
+    }
+
+    std::string path = dir.str();
+    int wd = ::inotify_add_watch(fd, path.c_str(), watch_mask);
+    if(wd < 0) {
+        return std::error_code(errno, std::generic_category());
+    }
+
+    // inotify hands out one descriptor per inode, so a second spelling of a
+    // watched directory (through a symlink) would have its events reported
+    // under the first one.  Refuse it rather than report misleading paths.
+    auto [it, inserted] = descriptors.try_emplace(wd, path);
+    if(!inserted && it->second != path) {
+        return std::make_error_code(std::errc::file_exists);
+    }
+    directories[dir] = wd;
+    return {};
+}
+
+void FileWatcher::poll(llvm::SmallVectorImpl<Event>& events) {
+    alignas(inotify_event) char buffer[16 * 1024];
+    while(true) {
+        auto n = ::read(fd, buffer, sizeof(buffer));
+        if(n <= 0) {
+            // EAGAIN: the queue is drained.
+            return;
+        }
+
+        for(char* p = buffer; p < buffer + n;) {
+            auto* event = reinterpret_cast<inotify_event*>(p);
+            p += sizeof(inotify_event) + event->len;
+
+            if(event->mask & IN_Q_OVERFLOW) {
+                events.push_back({{}, Change::Overflow});
+                continue;
+            }
+
+            auto it = descriptors.find(event->wd);
+            if(it == descriptors.end()) {
+                continue;
+            }
+
+            if(event->mask & IN_IGNORED) {
+                // The watch is gone (directory deleted or unmounted).
+                for(auto dir = directories.begin(); dir != directories.end();) {
+                    auto current = dir++;
+                    if(current->second == event->wd) {
+                        directories.erase(current);
+                    }
+                }
+                descriptors.erase(it);
+                continue;
+            }
+
+            if(event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                // Entries that leave with their directory produce no events
+                // of their own, so the caller cannot know what went away.
+                events.push_back({{}, Change::Overflow});
+                continue;
+            }
+
+            if(event->len == 0) {
+                continue;
+            }
+
+            auto change = (event->mask & (IN_DELETE | IN_MOVED_FROM)) ? Change::Removed
+                                                                     : Change::Modified;
+            events.push_back({path::join(it->second, event->name), change});
+        }
+    }
+}
+
+#else
+
+std::expected<FileWatcher, std::error_code> FileWatcher::create() {
+    return std::unexpected(std::make_error_code(std::errc::not_supported));
+}
+
+FileWatcher::~FileWatcher() = default;
+
+std::error_code FileWatcher::add_directory(llvm::StringRef dir) {
+    return std::make_error_code(std::errc::not_supported);
+}
+
+void FileWatcher::poll(llvm::SmallVectorImpl<Event>& events) {}
+
+#endif
+
+}  // namespace clice
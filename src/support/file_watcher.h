@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <expected>
+#include <string>
+#include <system_error>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace clice {
+
+/// Native change notification for a set of directories, each watched for
+/// its direct entries only (not recursively).
+///
+/// Backed by inotify on Linux.  Other platforms have no backend yet and
+/// create() fails with `not_supported`; callers fall back to stat-based
+/// staleness checks there.
+///
+/// The watcher never blocks: poll() drains whatever the kernel has queued
+/// and returns, so it can be driven from a timer on the event loop.
+class FileWatcher {
+public:
+    enum class Change : std::uint8_t {
+        /// Written, created, or renamed into a watched directory.
+        Modified,
+
+        /// Deleted or renamed away.
+        Removed,
+
+        /// The kernel queue overflowed and events were lost; `path` is
+        /// empty.  Anything watched may have changed.
+        Overflow,
+    };
+
+    struct Event {
+        std::string path;
+        Change change = Change::Modified;
+    };
+
+    static std::expected<FileWatcher, std::error_code> create();
+
+    FileWatcher(FileWatcher&& other) noexcept;
+    FileWatcher& operator=(FileWatcher&& other) noexcept;
+    ~FileWatcher();
+
+    /// Start watching the entries of `dir`.  Watching a directory twice is
+    /// a no-op.  Fails when the directory is missing, is another spelling
+    /// of a watched directory, or the per-user watch limit is exhausted.
+    std::error_code add_directory(llvm::StringRef dir);
+
+    bool watches(llvm::StringRef dir) const {
+        return directories.contains(dir);
+    }
+
+    std::size_t directory_count() const {
+        return directories.size();
+    }
+
+    /// Append pending events to `events` without blocking.
+    void poll(llvm::SmallVectorImpl<Event>& events);
+
+private:
+    explicit FileWatcher(int fd) : fd(fd) {}
+
+    int fd = -1;
+
+    /// Watched directory → watch descriptor.
+    llvm::StringMap<int> directories;
+
+    /// Watch descriptor → directory, for resolving event names.
+    llvm::DenseMap<int, std::string> descriptors;
+};
+
+}  // namespace clice
@@ -4,11 +4,15 @@
 #include <cstdlib>
 #include <expected>
 #include <memory>
+#include <mutex>
 #include <print>
 #include <string>
+#include <utility>
 
 #include "support/format.h"
 
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
@@ -180,4 +184,141 @@ public:
     }
 };
 
+/// Remembers every status and file read for its lifetime, so consecutive
+/// compilations sharing it (a batched Index build, successive versions of an
+/// open document) stat and read common headers and modules once.  Only for
+/// files that do not change while it is alive.  Safe to share between
+/// threads: a document's AST can read through it while its next compile runs.
+/// A cache kept across changes on disk is forked, without what changed.
+class CachingFS : public vfs::ProxyFileSystem {
+public:
+    explicit CachingFS(llvm::IntrusiveRefCntPtr<vfs::FileSystem> fs = new ThreadSafeFS()) :
+        ProxyFileSystem(std::move(fs)) {}
+
+    /// Pass PCH and PCM files through uncached: they are build outputs the
+    /// server rewrites, and large.
+    bool skip_build_outputs = false;
+
+    class CachedFile : public vfs::File {
+    public:
+        CachedFile(vfs::Status stat, llvm::MemoryBufferRef buffer) :
+            stat(std::move(stat)), buffer(buffer) {}
+
+        llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> getBuffer(const llvm::Twine& Name,
+                                                                     int64_t FileSize,
+                                                                     bool RequiresNullTerminator,
+                                                                     bool IsVolatile) override {
+            return llvm::MemoryBuffer::getMemBuffer(buffer, RequiresNullTerminator);
+        }
+
+        llvm::ErrorOr<vfs::Status> status() override {
+            return stat;
+        }
+
+        llvm::ErrorOr<std::string> getName() override {
+            return stat.getName().str();
+        }
+
+        std::error_code close() override {
+            return {};
+        }
+
+    private:
+        vfs::Status stat;
+        llvm::MemoryBufferRef buffer;
+    };
+
+    llvm::ErrorOr<vfs::Status> status(const llvm::Twine& InPath) override {
+        llvm::SmallString<128> Path;
+        InPath.toVector(Path);
+        makeAbsolute(Path);
+        if(skip_build_outputs && is_build_output(Path)) {
+            return getUnderlyingFS().status(Path);
+        }
+
+        std::lock_guard guard(lock);
+        if(auto it = statuses.find(Path); it != statuses.end()) {
+            return it->second;
+        }
+        auto result = getUnderlyingFS().status(Path);
+        statuses.try_emplace(Path, result);
+        return result;
+    }
+
+    llvm::ErrorOr<std::unique_ptr<vfs::File>> openFileForRead(const llvm::Twine& InPath) override {
+        llvm::SmallString<128> Path;
+        InPath.toVector(Path);
+        makeAbsolute(Path);
+        if(skip_build_outputs && is_build_output(Path)) {
+            return getUnderlyingFS().openFileForRead(Path);
+        }
+
+        std::lock_guard guard(lock);
+        auto it = files.find(Path);
+        if(it == files.end()) {
+            auto file = getUnderlyingFS().openFileForRead(Path);
+            if(!file) {
+                return file.getError();
+            }
+            auto stat = (*file)->status();
+            if(!stat) {
+                return stat.getError();
+            }
+            auto buffer = (*file)->getBuffer(Path, stat->getSize(), true, false);
+            if(!buffer) {
+                return buffer.getError();
+            }
+            bytes += (*buffer)->getBufferSize();
+            std::shared_ptr<llvm::MemoryBuffer> shared = std::move(*buffer);
+            it = files.try_emplace(Path, std::move(*stat), std::move(shared)).first;
+        }
+        return std::make_unique<CachedFile>(it->second.first, *it->second.second);
+    }
+
+    /// A cache over the same file system holding what this one holds, but
+    /// the files named like one of `changed` and the paths found missing,
+    /// which may exist by now.  Matching on the file name drops entries
+    /// reached through another spelling of a changed path too.  Contents
+    /// are shared, not copied.
+    llvm::IntrusiveRefCntPtr<CachingFS> fork(llvm::ArrayRef<std::string> changed) {
+        llvm::StringSet<> names;
+        for(auto& file: changed) {
+            names.insert(path::filename(file));
+        }
+
+        llvm::IntrusiveRefCntPtr<CachingFS> forked = new CachingFS(&getUnderlyingFS());
+        forked->skip_build_outputs = skip_build_outputs;
+        std::lock_guard guard(lock);
+        for(auto& entry: statuses) {
+            if(entry.second && !names.contains(path::filename(entry.getKey()))) {
+                forked->statuses.try_emplace(entry.getKey(), entry.second);
+            }
+        }
+        for(auto& entry: files) {
+            if(!names.contains(path::filename(entry.getKey()))) {
+                forked->bytes += entry.second.second->getBufferSize();
+                forked->files.try_emplace(entry.getKey(), entry.second);
+            }
+        }
+        return forked;
+    }
+
+    /// Total size of the file contents held.
+    std::size_t size_in_bytes() {
+        std::lock_guard guard(lock);
+        return bytes;
+    }
+
+private:
+    static bool is_build_output(llvm::StringRef file) {
+        auto extension = path::extension(file);
+        return extension == ".pch" || extension == ".pcm";
+    }
+
+    std::mutex lock;
+    std::size_t bytes = 0;
+    llvm::StringMap<llvm::ErrorOr<vfs::Status>> statuses;
+    llvm::StringMap<std::pair<vfs::Status, std::shared_ptr<llvm::MemoryBuffer>>> files;
+};
+
 }  // namespace clice
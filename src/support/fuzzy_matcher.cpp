@@ -51,6 +51,8 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <type_traits>
 
 #include "llvm/Support/Format.h"
 
@@ -96,7 +98,17 @@ std::optional<float> FuzzyMatcher::match(llvm::StringRef word) {
     if(!(word_contains_pattern = init(word))) {
         return std::nullopt;
     }
+    return score_word();
+}
+
+std::optional<float> FuzzyMatcher::match(const PreparedWord& word) {
+    if(!(word_contains_pattern = init(word))) {
+        return std::nullopt;
+    }
+    return score_word();
+}
 
+std::optional<float> FuzzyMatcher::score_word() {
     if(!pat_n) {
         return 1;
     }
@@ -119,6 +131,56 @@ std::optional<float> FuzzyMatcher::match(llvm::StringRef word) {
     return score;
 }
 
+std::vector<FuzzyMatcher::Scored> FuzzyMatcher::match_batch(llvm::ArrayRef<llvm::StringRef> words,
+                                                            std::size_t limit) {
+    return batch(words, limit);
+}
+
+std::vector<FuzzyMatcher::Scored>
+    FuzzyMatcher::match_batch(llvm::ArrayRef<const PreparedWord*> words, std::size_t limit) {
+    return batch(words, limit);
+}
+
+template <typename Word>
+std::vector<FuzzyMatcher::Scored> FuzzyMatcher::batch(llvm::ArrayRef<Word> words,
+                                                      std::size_t limit) {
+    // With a limit, results is a heap whose front is the worst match kept.
+    auto better = [](const Scored& lhs, const Scored& rhs) {
+        if(lhs.score != rhs.score) {
+            return lhs.score > rhs.score;
+        }
+        return lhs.index < rhs.index;
+    };
+
+    std::vector<Scored> results;
+    for(std::uint32_t I = 0; I < words.size(); ++I) {
+        std::optional<float> score;
+        if constexpr(std::is_pointer_v<Word>) {
+            score = match(*words[I]);
+        } else {
+            score = match(words[I]);
+        }
+        if(!score) {
+            continue;
+        }
+
+        Scored scored{I, *score};
+        if(limit == 0) {
+            results.push_back(scored);
+        } else if(results.size() < limit) {
+            results.push_back(scored);
+            std::ranges::push_heap(results, better);
+        } else if(better(scored, results.front())) {
+            std::ranges::pop_heap(results, better);
+            results.back() = scored;
+            std::ranges::push_heap(results, better);
+        }
+    }
+
+    std::ranges::sort(results, better);
+    return results;
+}
+
 // We get CharTypes from a lookup table. Each is 2 bits, 4 fit in each byte.
 // The top 6 bits of the char select the byte, the bottom 2 select the offset.
 // e.g. 'q' = 011100 01 = byte 28 (55), bits 3-2 (01) -> Lower.
@@ -193,6 +255,25 @@ CharTypeSet calculate_roles(llvm::StringRef text, llvm::MutableArrayRef<CharRole
     return TypeSet;
 }
 
+// Cheap subsequence check: one memchr (vectorized by the C library) per
+// pattern character, giving up once the rest of the pattern can't fit.
+static bool contains_subsequence(const char* word, int word_n, const char* pat, int pat_n) {
+    const char* cursor = word;
+    const char* end = word + word_n;
+    for(int P = 0; P != pat_n; ++P) {
+        if(end - cursor < pat_n - P) {
+            return false;
+        }
+
+        auto hit = static_cast<const char*>(std::memchr(cursor, pat[P], end - cursor));
+        if(!hit) {
+            return false;
+        }
+        cursor = hit + 1;
+    }
+    return true;
+}
+
 // Sets up the data structures matching Word.
 // Returns false if we can cheaply determine that no match is possible.
 bool FuzzyMatcher::init(llvm::StringRef new_word) {
@@ -206,19 +287,13 @@ bool FuzzyMatcher::init(llvm::StringRef new_word) {
         return true;
     }
 
+    // Branch-free, so the compiler vectorizes it.
     for(int I = 0; I < word_n; ++I) {
         low_word[I] = lower(word[I]);
     }
 
-    // Cheap subsequence check.
-    for(int W = 0, P = 0; P != pat_n; ++W) {
-        if(W == word_n) {
-            return false;
-        }
-
-        if(low_word[W] == low_pat[P]) {
-            ++P;
-        }
+    if(!contains_subsequence(low_word, word_n, low_pat, pat_n)) {
+        return false;
     }
 
     // FIXME: some words are hard to tokenize algorithmically.
@@ -229,6 +304,50 @@ bool FuzzyMatcher::init(llvm::StringRef new_word) {
     return true;
 }
 
+// Same as init(Word.word()), copying the roles PreparedWord computed up front.
+bool FuzzyMatcher::init(const PreparedWord& prepared) {
+    word_n = prepared.size;
+    if(pat_n > word_n) {
+        return false;
+    }
+
+    std::copy_n(prepared.text, word_n, word);
+    if(pat_n == 0) {
+        return true;
+    }
+
+    for(int I = 0; I < word_n; ++I) {
+        low_word[I] = lower(word[I]);
+    }
+    if(!contains_subsequence(low_word, word_n, low_pat, pat_n)) {
+        return false;
+    }
+
+    std::copy_n(prepared.roles, word_n, word_role);
+    word_type_set = prepared.type_set;
+    return true;
+}
+
+PreparedWord::PreparedWord(llvm::StringRef word) {
+    word = word.take_front(FuzzyMatcher::MaxWord);
+    owned = std::make_unique<char[]>(2 * word.size());
+    std::ranges::copy(word, owned.get());
+    prepare(llvm::StringRef(owned.get(), word.size()),
+            reinterpret_cast<CharRole*>(owned.get() + word.size()));
+}
+
+PreparedWord::PreparedWord(llvm::StringRef word, llvm::BumpPtrAllocator& storage) {
+    word = word.take_front(FuzzyMatcher::MaxWord);
+    prepare(word, storage.Allocate<CharRole>(word.size()));
+}
+
+void PreparedWord::prepare(llvm::StringRef word, CharRole* word_roles) {
+    text = word.data();
+    roles = word_roles;
+    size = word.size();
+    type_set = calculate_roles(word, llvm::MutableArrayRef(word_roles, word.size()));
+}
+
 // The forwards pass finds the mappings of Pattern onto Word.
 // Score = best score achieved matching Word[..W] against Pat[..P].
 // Unlike other tables, indices range from 0 to N *inclusive*
@@ -1,10 +1,15 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
 #include <optional>
+#include <string>
+#include <vector>
 
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
 #include "llvm/Support/raw_ostream.h"
 
 namespace clice {
@@ -51,6 +56,8 @@ enum CharRole : unsigned char {
 // heuristics for dealing with poorly-segmented identifiers like "strndup".
 CharTypeSet calculate_roles(llvm::StringRef Text, llvm::MutableArrayRef<CharRole> Roles);
 
+class PreparedWord;
+
 // A matcher capable of matching and scoring strings against a single pattern.
 // It's optimized for matching against many strings - match() does not allocate.
 class FuzzyMatcher {
@@ -64,6 +71,22 @@ public:
     // Characters beyond MaxWord are ignored.
     std::optional<float> match(llvm::StringRef Word);
 
+    // Same as match(Word.word()), reusing the prepared segmentation.
+    std::optional<float> match(const PreparedWord& Word);
+
+    struct Scored {
+        // Position of the word in the batch.
+        std::uint32_t index;
+        float score;
+    };
+
+    // Match every word of a batch, returning the matches best first (ties in
+    // batch order).  Words that can't match are rejected before scoring.
+    // A nonzero Limit keeps only the best Limit matches, in a bounded heap.
+    std::vector<Scored> match_batch(llvm::ArrayRef<llvm::StringRef> Words, std::size_t Limit = 0);
+    std::vector<Scored> match_batch(llvm::ArrayRef<const PreparedWord*> Words,
+                                    std::size_t Limit = 0);
+
     llvm::StringRef pattern() const {
         return llvm::StringRef(Pat, pat_n);
     }
@@ -78,6 +101,8 @@ public:
     llvm::SmallString<256> dumpLast(llvm::raw_ostream&) const;
 
 private:
+    friend class PreparedWord;
+
     // We truncate the pattern and the word to bound the cost of matching.
     constexpr inline static int MaxPat = 63, MaxWord = 127;
     // Action describes how a word character was matched to the pattern.
@@ -89,6 +114,11 @@ private:
     constexpr static Action Match = true;  // Matched against a pattern character.
 
     bool init(llvm::StringRef Word);
+    bool init(const PreparedWord& Word);
+    // Score the word set up by init().
+    std::optional<float> score_word();
+    template <typename Word>
+    std::vector<Scored> batch(llvm::ArrayRef<Word> Words, std::size_t Limit);
     void build_graph();
     bool allow_match(int P, int W, Action Last) const;
     int skip_penalty(int W, Action Last) const;
@@ -121,4 +151,37 @@ private:
     ScoreInfo scores[MaxPat + 1][MaxWord + 1][/* Last Action */ 2];
 };
 
+// A word with its segmentation computed up front, for words matched over
+// and over, like index symbol names on each keystroke.  FuzzyMatcher::match()
+// then skips computing the roles of the word.
+class PreparedWord {
+public:
+    PreparedWord() = default;
+
+    // Characters beyond FuzzyMatcher's MaxWord are dropped.  Keeps a copy of
+    // the word.
+    explicit PreparedWord(llvm::StringRef Word);
+
+    // Same, but refers to Word, which must outlive this, as interned names
+    // do; only its roles are kept, in Storage.
+    PreparedWord(llvm::StringRef Word, llvm::BumpPtrAllocator& Storage);
+
+    llvm::StringRef word() const {
+        return llvm::StringRef(text, size);
+    }
+
+private:
+    friend class FuzzyMatcher;
+
+    void prepare(llvm::StringRef Word, CharRole* Roles);
+
+    const char* text = nullptr;
+    const CharRole* roles = nullptr;
+    std::uint32_t size = 0;
+    CharTypeSet type_set = 0;
+
+    // The word and its CharRoles back to back, unless Word is referred to.
+    std::unique_ptr<char[]> owned;
+};
+
 }  // namespace clice
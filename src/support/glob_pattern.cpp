@@ -1,7 +1,13 @@
 #include "support/glob_pattern.h"
 
+#include <algorithm>
+#include <bit>
 #include <format>
 #include <limits>
+#include <map>
+#include <utility>
+
+#include "llvm/ADT/DenseMap.h"
 
 namespace clice {
 
@@ -209,6 +215,32 @@ std::expected<GlobPattern, std::string> GlobPattern::create(llvm::StringRef s,
         }
     }
 
+    // The trailing run without metacharacters is matched literally; keep the
+    // part all sub-patterns share.  An escaped character only ends the run
+    // early, which is safe.  Trailing slashes are left out: a string may end
+    // where only `*` and `/` remain in the pattern.  So is a slash after
+    // `**`, which may match no segment at all.
+    for(size_t i = 0; i < pat.sub_globs.size(); ++i) {
+        auto sub = pat.sub_globs[i].getPat();
+        auto start = sub.find_last_of("?*[]\\");
+        auto tail = start == llvm::StringRef::npos ? sub : sub.substr(start + 1);
+        if(start != llvm::StringRef::npos && sub[start] == '*') {
+            tail.consume_front("/");
+        }
+        tail = tail.rtrim('/');
+        if(i == 0) {
+            pat.suffix = tail.str();
+            continue;
+        }
+        llvm::StringRef common = pat.suffix;
+        size_t n = 0;
+        while(n < common.size() && n < tail.size() &&
+              common[common.size() - 1 - n] == tail[tail.size() - 1 - n]) {
+            ++n;
+        }
+        pat.suffix = common.take_back(n).str();
+    }
+
     return pat;
 }
 
@@ -305,6 +337,16 @@ bool GlobPattern::match(llvm::StringRef str) const {
         str = str.substr(1);
     }
 
+    if(!str.ends_with(suffix)) {
+        return false;
+    }
+
+    // The backtracking matcher also collapses repeated slashes; the DFA
+    // does not.
+    if(dfa && !str.contains("//")) {
+        return dfa->match(str);
+    }
+
     for(auto& Glob: sub_globs) {
         if(Glob.match(str)) {
             return true;
@@ -559,4 +601,270 @@ bool GlobPattern::SubGlobPattern::match(llvm::StringRef str) const {
     return s == s_end;
 }
 
+namespace {
+
+/// One position of a sub-pattern in the NFA compile() determinizes.
+struct GlobToken {
+    enum Kind : std::uint8_t {
+        /// One byte of `bytes`.
+        Byte,
+        /// `*` within a segment: any run without `/`.
+        SegmentRun,
+        /// `**` or `*` ending the pattern: any run at all.
+        AnyRun,
+        /// `**/`: any run of whole segments, each with its `/`, or none.
+        Segments,
+        /// The end of a sub-pattern.
+        End,
+    };
+
+    Kind kind;
+    GlobCharSet bytes;
+
+    /// A plain `/`, which a string may stop before together with `*`.
+    bool slash = false;
+};
+
+}  // namespace
+
+bool GlobPattern::compile() {
+    // Positions are bits of a 64-bit state set; keep the top two free, they
+    // are DenseMap's reserved keys.
+    constexpr size_t max_positions = 62;
+    constexpr size_t max_states = 1024;
+
+    if(sub_globs.empty()) {
+        return false;
+    }
+
+    std::vector<GlobToken> tokens;
+    std::uint64_t start = 0;
+    for(auto& sub: sub_globs) {
+        auto pat = sub.getPat();
+        auto first = tokens.size();
+        size_t b = 0;
+        for(size_t i = 0; i < pat.size();) {
+            GlobToken token{GlobToken::Byte, {}};
+            switch(pat[i]) {
+                case '?': return false;
+                case '[': {
+                    token.bytes = sub.brackets[b].bytes;
+                    i = sub.brackets[b].next_offset;
+                    ++b;
+                    break;
+                }
+                case '\\': {
+                    token.bytes.set(uint8_t(pat[i + 1]));
+                    i += 2;
+                    break;
+                }
+                case '*': {
+                    if(i + 1 == pat.size() || pat[i + 1] != '*') {
+                        token.kind = GlobToken::SegmentRun;
+                        ++i;
+                        break;
+                    }
+                    if(i != 0 && pat[i - 1] != '/') {
+                        return false;
+                    }
+                    i += 2;
+                    if(i == pat.size()) {
+                        token.kind = GlobToken::AnyRun;
+                    } else if(pat[i] == '/') {
+                        token.kind = GlobToken::Segments;
+                        ++i;
+                    } else {
+                        return false;
+                    }
+                    break;
+                }
+                default: {
+                    token.bytes.set(uint8_t(pat[i]));
+                    token.slash = pat[i] == '/';
+                    ++i;
+                    break;
+                }
+            }
+            tokens.push_back(token);
+        }
+        // A trailing `*` runs past slashes too.
+        if(tokens.size() > first && tokens.back().kind == GlobToken::SegmentRun) {
+            tokens.back().kind = GlobToken::AnyRun;
+        }
+        start |= std::uint64_t(1) << first;
+        tokens.push_back({GlobToken::End, {}});
+        if(tokens.size() > max_positions) {
+            return false;
+        }
+    }
+
+    // closure[i]: the positions entered with position i, since runs may be
+    // empty.  A string may also end wherever only runs and plain slashes
+    // remain.
+    auto n = tokens.size();
+    std::vector<std::uint64_t> closure(n);
+    std::uint64_t accept = 0;
+    bool rest_empty = true;
+    for(size_t i = n; i-- > 0;) {
+        auto& token = tokens[i];
+        auto bit = std::uint64_t(1) << i;
+        closure[i] = bit;
+        switch(token.kind) {
+            case GlobToken::End: rest_empty = true; break;
+            case GlobToken::SegmentRun:
+            case GlobToken::AnyRun:
+            case GlobToken::Segments: closure[i] |= closure[i + 1]; break;
+            case GlobToken::Byte: rest_empty = rest_empty && token.slash; break;
+        }
+        if(rest_empty) {
+            accept |= bit;
+        }
+    }
+    std::uint64_t start_set = 0;
+    for(auto bits = start; bits; bits &= bits - 1) {
+        start_set |= closure[std::countr_zero(bits)];
+    }
+
+    auto step = [&](std::uint64_t set, uint8_t c) {
+        std::uint64_t next = 0;
+        for(; set; set &= set - 1) {
+            auto i = std::countr_zero(set);
+            auto& token = tokens[i];
+            switch(token.kind) {
+                case GlobToken::Byte: {
+                    if(token.bytes[c]) {
+                        next |= closure[i + 1];
+                    }
+                    break;
+                }
+                case GlobToken::SegmentRun: {
+                    if(c != '/') {
+                        next |= closure[i];
+                    }
+                    break;
+                }
+                case GlobToken::AnyRun: next |= closure[i]; break;
+                case GlobToken::Segments: {
+                    next |= std::uint64_t(1) << i;
+                    if(c == '/') {
+                        next |= closure[i + 1];
+                    }
+                    break;
+                }
+                case GlobToken::End: break;
+            }
+        }
+        return next;
+    };
+
+    // Bytes no token tells apart share a class.
+    Dfa result;
+    std::map<std::pair<std::uint64_t, bool>, std::uint8_t> signatures;
+    std::vector<uint8_t> representatives;
+    for(unsigned c = 0; c < 256; ++c) {
+        std::uint64_t signature = 0;
+        for(size_t i = 0; i < n; ++i) {
+            if(tokens[i].kind == GlobToken::Byte && tokens[i].bytes[c]) {
+                signature |= std::uint64_t(1) << i;
+            }
+        }
+        auto [it, inserted] =
+            signatures.try_emplace({signature, c == '/'}, std::uint8_t(representatives.size()));
+        if(inserted) {
+            representatives.push_back(uint8_t(c));
+        }
+        result.classes[c] = it->second;
+    }
+    result.class_count = representatives.size();
+
+    // Subset construction; state 0 is the empty set.
+    std::vector<std::uint64_t> sets = {0, start_set};
+    llvm::DenseMap<std::uint64_t, std::uint16_t> ids;
+    ids.try_emplace(0, 0);
+    ids.try_emplace(start_set, 1);
+    result.next.assign(2 * result.class_count, 0);
+    for(size_t state = 1; state < sets.size(); ++state) {
+        for(std::uint32_t cls = 0; cls < result.class_count; ++cls) {
+            auto next = step(sets[state], representatives[cls]);
+            auto [it, inserted] = ids.try_emplace(next, std::uint16_t(sets.size()));
+            if(inserted) {
+                if(sets.size() == max_states) {
+                    return false;
+                }
+                sets.push_back(next);
+                result.next.resize(sets.size() * result.class_count, 0);
+            }
+            result.next[state * result.class_count + cls] = it->second;
+        }
+    }
+
+    result.accepting.resize(sets.size());
+    for(size_t state = 0; state < sets.size(); ++state) {
+        result.accepting[state] = (sets[state] & accept) != 0;
+    }
+
+    dfa = std::move(result);
+    return true;
+}
+
+bool GlobPattern::Dfa::match(llvm::StringRef s) const {
+    std::uint32_t state = 1;
+    for(char c: s) {
+        state = next[state * class_count + classes[uint8_t(c)]];
+        if(state == 0) {
+            return false;
+        }
+    }
+    return accepting[state];
+}
+
+void GlobSet::add(GlobPattern pattern, std::uint32_t value) {
+    auto index = static_cast<std::uint32_t>(entries.size());
+    auto prefix = pattern.literal_prefix();
+    if(prefix.empty()) {
+        unanchored.push_back(index);
+    } else {
+        by_prefix[prefix].push_back(index);
+        auto it = std::lower_bound(prefix_lengths.begin(), prefix_lengths.end(), prefix.size());
+        if(it == prefix_lengths.end() || *it != prefix.size()) {
+            prefix_lengths.insert(it, prefix.size());
+        }
+    }
+    entries.push_back({std::move(pattern), value});
+}
+
+void GlobSet::match(llvm::StringRef s, llvm::SmallVectorImpl<std::uint32_t>& values) const {
+    auto first = values.size();
+    auto test = [&](std::uint32_t index) {
+        auto& entry = entries[index];
+        if(entry.pattern.match(s)) {
+            values.push_back(entry.value);
+        }
+    };
+
+    for(auto index: unanchored) {
+        test(index);
+    }
+    for(auto length: prefix_lengths) {
+        if(length > s.size()) {
+            break;
+        }
+        if(auto it = by_prefix.find(s.take_front(length)); it != by_prefix.end()) {
+            for(auto index: it->second) {
+                test(index);
+            }
+        }
+    }
+
+    std::sort(values.begin() + first, values.end());
+    values.erase(std::unique(values.begin() + first, values.end()), values.end());
+}
+
+void GlobSet::clear() {
+    entries.clear();
+    by_prefix.clear();
+    prefix_lengths.clear();
+    unanchored.clear();
+}
+
 }  // namespace clice
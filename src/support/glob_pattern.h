@@ -1,11 +1,16 @@
 #pragma once
 
+#include <array>
 #include <bitset>
+#include <cstdint>
 #include <expected>
+#include <optional>
 #include <string>
+#include <vector>
 
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
 
 namespace clice {
@@ -56,6 +61,27 @@ public:
     /// \returns \p true if \p str matches this glob pattern
     bool match(llvm::StringRef s) const;
 
+    /// Compile the sub-patterns into one DFA, which match() then runs instead
+    /// of backtracking.  Fails, leaving the pattern to backtrack, when a
+    /// sub-pattern uses `?` or a `**` that is not a whole segment, or when the
+    /// pattern is too large.
+    bool compile();
+
+    bool compiled() const {
+        return dfa.has_value();
+    }
+
+    /// The literal text every match starts with.
+    llvm::StringRef literal_prefix() const {
+        return prefix;
+    }
+
+    /// The literal text every match ends with (may be empty).  match()
+    /// rejects strings without it before matching the sub-patterns.
+    llvm::StringRef literal_suffix() const {
+        return suffix;
+    }
+
 private:
     /// GlobPattern is seperated into `Prefix + SubGlobPattern`
     std::string prefix;
@@ -71,6 +97,25 @@ private:
     ///
     bool prefix_at_seg_end = false;
 
+    /// Common trailing literal of the sub-patterns.
+    std::string suffix;
+
+    /// A DFA over byte classes built by compile().
+    struct Dfa {
+        std::array<std::uint8_t, 256> classes = {};
+        std::uint32_t class_count = 0;
+
+        /// Transitions, by state * class_count + class.  State 0 is the dead
+        /// state and state 1 the start.
+        std::vector<std::uint16_t> next;
+
+        std::vector<bool> accepting;
+
+        bool match(llvm::StringRef s) const;
+    };
+
+    std::optional<Dfa> dfa;
+
     /// SubGlobPattern:
     /// Pattern `foo.{c,cpp,cppm}`
     /// -> extend to 3 SubGlobPatterns: `foo.c`, `foo.cpp`, `foo.cppm`
@@ -116,4 +161,38 @@ private:
     llvm::SmallVector<SubGlobPattern, 1> sub_globs;
 };
 
+/// A set of glob patterns, each carrying a value, that finds every pattern a
+/// string matches in one lookup.  Patterns are bucketed by literal prefix:
+/// only the buckets of the string's own prefixes, and the patterns without
+/// one, are tried.
+class GlobSet {
+public:
+    void add(GlobPattern pattern, std::uint32_t value);
+
+    /// Append the values of all patterns matching `s` to `values`, sorted
+    /// and without duplicates.
+    void match(llvm::StringRef s, llvm::SmallVectorImpl<std::uint32_t>& values) const;
+
+    bool empty() const {
+        return entries.empty();
+    }
+
+    void clear();
+
+private:
+    struct Entry {
+        GlobPattern pattern;
+        std::uint32_t value;
+    };
+
+    std::vector<Entry> entries;
+
+    /// Entries by literal prefix, and the distinct prefix lengths, ascending.
+    llvm::StringMap<llvm::SmallVector<std::uint32_t, 1>> by_prefix;
+    llvm::SmallVector<std::size_t> prefix_lengths;
+
+    /// Entries whose patterns have no literal prefix.
+    llvm::SmallVector<std::uint32_t> unanchored;
+};
+
 }  // namespace clice
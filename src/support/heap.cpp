@@ -0,0 +1,27 @@
+#include "support/heap.h"
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+namespace clice::heap {
+
+Stats stats() {
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+    auto info = mallinfo2();
+    return {
+        .reserved = info.arena + info.hblkhd,
+        .in_use = info.uordblks + info.hblkhd,
+    };
+#else
+    return {};
+#endif
+}
+
+void trim() {
+#if defined(__GLIBC__)
+    malloc_trim(0);
+#endif
+}
+
+}  // namespace clice::heap
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+
+namespace clice::heap {
+
+/// What the process's malloc holds, in bytes; zero where the allocator
+/// does not report it (anything but glibc).
+struct Stats {
+    /// Taken from the system: arenas and large chunks mapped on their own.
+    std::size_t reserved = 0;
+
+    /// Handed out and not freed yet.
+    std::size_t in_use = 0;
+};
+
+Stats stats();
+
+/// Give the free pages of every malloc arena back to the system.  Freed
+/// ASTs otherwise stay in glibc's arenas, and the worker's resident memory
+/// never drops below its peak.  Takes a while on a large heap; call it off
+/// the event loop.
+void trim();
+
+}  // namespace clice::heap
@@ -0,0 +1,108 @@
+#include "support/journal.h"
+
+#include "support/filesystem.h"
+
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+
+namespace clice {
+
+bool Journal::replay(llvm::StringRef content, llvm::function_ref<bool(const Record&)> apply) {
+    records = 0;
+    size = content.size();
+    rewrite = true;
+    if(!content.consume_front(magic)) {
+        return false;
+    }
+    while(!content.empty()) {
+        if(content.size() < header_size) {
+            return false;
+        }
+        auto* header = content.data();
+        auto length = header_size + std::size_t(llvm::support::endian::read32le(header + 8));
+        if(content.size() < length) {
+            return false;
+        }
+        auto hash = llvm::xxh3_64bits(llvm::arrayRefFromStringRef(content.slice(4, length)));
+        if(llvm::support::endian::read32le(header) != static_cast<std::uint32_t>(hash)) {
+            return false;
+        }
+
+        Record record{static_cast<std::uint8_t>(header[4]),
+                      static_cast<std::uint8_t>(header[5]),
+                      content.slice(header_size, length)};
+        if(!apply(record)) {
+            return false;
+        }
+        records += 1;
+        content = content.drop_front(length);
+    }
+    rewrite = false;
+    return true;
+}
+
+void Journal::write(llvm::SmallVectorImpl<char>& out,
+                    std::uint8_t op,
+                    std::uint8_t kind,
+                    llvm::StringRef body) {
+    auto start = out.size();
+    out.resize(start + header_size);
+    out.append(body.begin(), body.end());
+
+    auto* header = out.data() + start;
+    header[4] = static_cast<char>(op);
+    header[5] = static_cast<char>(kind);
+    llvm::support::endian::write16le(header + 6, 0);
+    llvm::support::endian::write32le(header + 8, static_cast<std::uint32_t>(body.size()));
+    auto hash = llvm::xxh3_64bits(
+        llvm::arrayRefFromStringRef(llvm::StringRef(header + 4, out.size() - start - 4)));
+    llvm::support::endian::write32le(header, static_cast<std::uint32_t>(hash));
+}
+
+void Journal::check(llvm::StringRef path) {
+    std::uint64_t current = 0;
+    if(!rewrite && (llvm::sys::fs::file_size(path, current) || current != size)) {
+        rewrite = true;
+    }
+}
+
+std::error_code Journal::append(llvm::StringRef path, llvm::StringRef content, std::size_t count) {
+    if(count == 0) {
+        return {};
+    }
+    std::error_code ec;
+    llvm::raw_fd_ostream out(path, ec, llvm::sys::fs::OF_Append);
+    if(!ec) {
+        out.write(content.data(), content.size());
+        out.close();
+        ec = out.error();
+    }
+    if(ec) {
+        rewrite = true;
+        return ec;
+    }
+    records += count;
+    size += content.size();
+    return {};
+}
+
+std::error_code Journal::compact(llvm::StringRef path,
+                                 llvm::StringRef tmp_path,
+                                 llvm::StringRef content,
+                                 std::size_t count) {
+    rewrite = true;
+    if(auto result = fs::write(tmp_path, content); !result) {
+        return result.error();
+    }
+    if(auto result = fs::rename(tmp_path, path); !result) {
+        return result.error();
+    }
+    records = count;
+    size = content.size();
+    rewrite = false;
+    return {};
+}
+
+}  // namespace clice
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace clice {
+
+/// A file of records that saves append to, for the metadata cache.bin and
+/// the store's manifest.bin keep across restarts.  After a magic of four
+/// bytes it holds little-endian records
+///   u32 checksum | u8 op | u8 kind | u16 unused | u32 body size | body
+/// the checksum being the low half of the xxh3 of the rest of the record.
+/// What op and kind mean is the owner's business.  A later record of an
+/// entry supersedes the earlier ones, so the file is compacted, rewritten
+/// with the live records only, once superseded ones make up more than
+/// half of it.
+class Journal {
+public:
+    struct Record {
+        std::uint8_t op = 0;
+        std::uint8_t kind = 0;
+        llvm::StringRef body;
+    };
+
+    explicit Journal(llvm::StringRef magic) : magic(magic) {}
+
+    /// Pass the records of the file `content` to `apply` in order, and
+    /// take `content` as the file the next save appends to.  False when it
+    /// is not entirely valid: the records before a torn or corrupt one, or
+    /// one `apply` rejects, are still applied, and the next save compacts.
+    bool replay(llvm::StringRef content, llvm::function_ref<bool(const Record&)> apply);
+
+    /// Encode a record at the end of `out`.
+    static void write(llvm::SmallVectorImpl<char>& out,
+                      std::uint8_t op,
+                      std::uint8_t kind,
+                      llvm::StringRef body);
+
+    /// Start `out` over as the content of a compacted file.
+    void reset(llvm::SmallVectorImpl<char>& out) const {
+        out.assign(magic.begin(), magic.end());
+    }
+
+    /// Whether a save of `appended` records to a file of `live` entries
+    /// compacts rather than appends.  Superseded records a file may hold
+    /// beyond its live ones are bounded by `slack` too, so that small
+    /// files are not rewritten every time.
+    bool should_compact(std::size_t appended, std::size_t live) const {
+        return rewrite || records + appended > 2 * live + slack;
+    }
+
+    /// Compact next time if the file at `path` is not the one this journal
+    /// last wrote: another process saved to it since.
+    void check(llvm::StringRef path);
+
+    /// Append `count` records encoded in `content` to the file at `path`.
+    /// A failed append may leave a torn tail: the next save compacts.
+    std::error_code append(llvm::StringRef path, llvm::StringRef content, std::size_t count);
+
+    /// Replace the file at `path` with `content`, which reset() started
+    /// and `count` records follow, staged at `tmp_path` and published by a
+    /// rename.  On failure the next save compacts again.
+    std::error_code compact(llvm::StringRef path,
+                            llvm::StringRef tmp_path,
+                            llvm::StringRef content,
+                            std::size_t count);
+
+    /// Records in the file, superseded ones included, and its size.
+    std::size_t records = 0;
+    std::uint64_t size = 0;
+
+    /// The file is missing, damaged or not ours: the next save compacts.
+    bool rewrite = true;
+
+private:
+    constexpr static std::size_t header_size = 12;
+    constexpr static std::size_t slack = 4096;
+
+    llvm::StringRef magic;
+};
+
+}  // namespace clice
@@ -3,10 +3,13 @@
 #include <array>
 #include <chrono>
 #include <memory>
+#include <span>
 #include <string>
+#include <vector>
 
 #include "support/filesystem.h"
 
+#include "spdlog/async.h"
 #include "spdlog/sinks/basic_file_sink.h"
 #include "spdlog/sinks/ringbuffer_sink.h"
 #include "spdlog/sinks/stdout_color_sinks.h"
@@ -21,24 +24,50 @@ static std::shared_ptr<spdlog::sinks::ringbuffer_sink_mt> ringbuffer_sink;
 
 constexpr static auto pattern = "[%Y-%m-%d %H:%M:%S.%e] [%^%l%$] [thread %t] [%s:%#] %v";
 
-void stderr_logger(std::string_view name, const Options& options) {
-    std::shared_ptr<spdlog::logger> logger;
+/// Messages the async queue holds before dropping the oldest.
+constexpr static std::size_t async_queue_size = 8192;
 
-    auto console_sink = std::make_shared<spdlog::sinks::stderr_color_sink_mt>(options.color);
-    if(options.replay_console) {
-        ringbuffer_sink = std::make_shared<spdlog::sinks::ringbuffer_sink_mt>(128);
-        std::array<spdlog::sink_ptr, 2> sinks = {console_sink, ringbuffer_sink};
-        logger = std::make_shared<spdlog::logger>(std::string(name), sinks.begin(), sinks.end());
+/// Make `sinks` the default logger.
+static void install_logger(std::string_view name,
+                           std::span<spdlog::sink_ptr> sinks,
+                           const Options& options) {
+    std::shared_ptr<spdlog::logger> logger;
+    if(options.async) {
+        // One queue for the process: file_logger replaces the stderr logger
+        // and both post to the same thread.
+        static bool started = false;
+        if(!started) {
+            spdlog::init_thread_pool(async_queue_size, 1);
+            spdlog::flush_every(options.flush_interval);
+            started = true;
+        }
+        auto policy = spdlog::async_overflow_policy::overrun_oldest;
+        logger = std::make_shared<spdlog::async_logger>(std::string(name),
+                                                        sinks.begin(),
+                                                        sinks.end(),
+                                                        spdlog::thread_pool(),
+                                                        policy);
+        logger->flush_on(Level::warn);
     } else {
-        logger = std::make_shared<spdlog::logger>(std::string(name), console_sink);
+        logger = std::make_shared<spdlog::logger>(std::string(name), sinks.begin(), sinks.end());
+        logger->flush_on(Level::trace);
     }
 
     logger->set_level(options.level);
     logger->set_pattern(pattern);
-    logger->flush_on(Level::trace);
     spdlog::set_default_logger(std::move(logger));
 }
 
+void stderr_logger(std::string_view name, const Options& options) {
+    std::vector<spdlog::sink_ptr> sinks;
+    sinks.push_back(std::make_shared<spdlog::sinks::stderr_color_sink_mt>(options.color));
+    if(options.replay_console) {
+        ringbuffer_sink = std::make_shared<spdlog::sinks::ringbuffer_sink_mt>(128);
+        sinks.push_back(ringbuffer_sink);
+    }
+    install_logger(name, sinks, options);
+}
+
 void file_logger(std::string_view name, std::string_view dir, const Options& options) {
     if(auto ec = llvm::sys::fs::create_directories(dir)) {
         spdlog::error("Failed to create log directory {}: {}", std::string(dir), ec.message());
@@ -61,11 +90,7 @@ void file_logger(std::string_view name, std::string_view dir, const Options& opt
 
     auto console_sink = std::make_shared<spdlog::sinks::stderr_color_sink_mt>(options.color);
     std::array<spdlog::sink_ptr, 2> sinks = {file_sink, console_sink};
-    auto logger = std::make_shared<spdlog::logger>(std::string(name), sinks.begin(), sinks.end());
-    logger->set_level(options.level);
-    logger->set_pattern(pattern);
-    logger->flush_on(Level::trace);
-    spdlog::set_default_logger(std::move(logger));
+    install_logger(name, sinks, options);
 
     // Replay buffered logs after swapping the default logger, so no messages
     // emitted between the snapshot and the swap are lost.
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <concepts>
 #include <cstdlib>
 #include <format>
@@ -11,15 +12,32 @@
 
 #include "spdlog/spdlog.h"
 
+/// Lowest level compiled in, as a spdlog level number; the macros below it
+/// expand to nothing, arguments included.  Set with CLICE_LOG_ACTIVE_LEVEL
+/// in CMake.
+#ifndef CLICE_LOG_ACTIVE_LEVEL
+#define CLICE_LOG_ACTIVE_LEVEL 0
+#endif
+
 namespace clice::logging {
 
 using Level = spdlog::level::level_enum;
 using ColorMode = spdlog::color_mode;
 
+constexpr inline Level active_level = static_cast<Level>(CLICE_LOG_ACTIVE_LEVEL);
+
 struct Options {
     Level level = Level::info;
     ColorMode color = ColorMode::automatic;
     bool replay_console = true;
+
+    /// Hand messages to a background thread through a bounded queue, the
+    /// oldest dropped when it is full, and flush every `flush_interval`
+    /// (at once for warnings and errors) instead of after each message.
+    /// What is still queued is lost on a crash.  Starts threads: not for the
+    /// zygote, which must stay single threaded.
+    bool async = false;
+    std::chrono::milliseconds flush_interval{500};
 };
 
 extern Options options;
@@ -101,8 +119,10 @@ void critical [[noreturn]] (logging_format<Args...> fmt, Args&&... args) {
 
 #define LOG_MESSAGE(name, fmt, ...)                                                                \
     do {                                                                                           \
-        if(clice::logging::options.level <= clice::logging::Level::name) {                         \
-            clice::logging::name(fmt __VA_OPT__(, ) __VA_ARGS__);                                  \
+        if constexpr(clice::logging::Level::name >= clice::logging::active_level) {                \
+            if(clice::logging::options.level <= clice::logging::Level::name) {                     \
+                clice::logging::name(fmt __VA_OPT__(, ) __VA_ARGS__);                              \
+            }                                                                                      \
         }                                                                                          \
     } while(0)
 
@@ -5,11 +5,13 @@
 #include "support/markup.h"
 
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <cstddef>
 #include <iterator>
 #include <memory>
 #include <string>
+#include <string_view>
 
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/SmallVector.h"
@@ -169,49 +171,53 @@ bool needs_leading_escape(char c, llvm::StringRef before, llvm::StringRef after,
     }
 }
 
+/// The characters needs_leading_escape() may escape; the rest are copied
+/// without asking.
+constexpr auto escapable = [] {
+    std::array<bool, 256> table{};
+    for(char c: std::string_view("\\`~#]=_-+*<>&.)")) {
+        table[static_cast<unsigned char>(c)] = true;
+    }
+    return table;
+}();
+
 /// Escape a markdown text block. Ensures the punctuation will not introduce
 /// any of the markdown constructs.
-std::string render_text(llvm::StringRef input, bool starts_line) {
-    std::string result;
-    for(unsigned i = 0; i < input.size(); ++i) {
-        if(needs_leading_escape(input[i], input.substr(0, i), input.substr(i + 1), starts_line)) {
-            result.push_back('\\');
+void render_text(llvm::raw_ostream& os, llvm::StringRef input, bool starts_line) {
+    std::size_t written = 0;
+    for(std::size_t i = 0; i < input.size(); ++i) {
+        if(escapable[static_cast<unsigned char>(input[i])] &&
+           needs_leading_escape(input[i], input.substr(0, i), input.substr(i + 1), starts_line)) {
+            os << input.slice(written, i) << '\\';
+            written = i;
         }
-        result.push_back(input[i]);
     }
-    return result;
+    os << input.substr(written);
 }
 
-/// Renders \p input as an inline block of code in markdown. The returned value
-/// is surrounded by backticks and the inner contents are properly escaped.
-std::string render_inline_block(llvm::StringRef input) {
-    std::string result;
+/// Renders \p input as an inline block of code in markdown, surrounded by
+/// backticks and with the inner contents properly escaped.
+void render_inline_block(llvm::raw_ostream& os, llvm::StringRef input) {
+    // Doubling backticks keeps the ends of the contents what they were.  If
+    // they start or end with a backtick, add spaces on both sides: markdown
+    // renderers ignore them.  They also ignore the first and last space if
+    // both are there, so add an extra pair to render what the user intended.
+    bool pad = input.starts_with("`") || input.ends_with("`") ||
+               (input.starts_with(" ") && input.ends_with(" "));
+
+    os << (pad ? "` " : "`");
     // Double all backticks to make sure we don't close the inline block early.
     for(std::size_t from = 0; from < input.size();) {
-        std::size_t next = input.find("`", from);
-        result += input.substr(from, next - from);
+        std::size_t next = input.find('`', from);
+        os << input.slice(from, next);
         if(next == llvm::StringRef::npos) {
             break;
         }
-        result += "``";  // Double the found backtick.
+        os << "``";  // Double the found backtick.
 
         from = next + 1;
     }
-
-    // If results starts with a backtick, add spaces on both sides. The spaces
-    // are ignored by markdown renderers.
-    if(llvm::StringRef(result).starts_with("`") || llvm::StringRef(result).ends_with("`")) {
-        return "` " + std::move(result) + " `";
-    }
-
-    // Markdown render should ignore first and last space if both are there. We
-    // add an extra pair of spaces in that case to make sure we render what the
-    // user intended.
-    if(llvm::StringRef(result).starts_with(" ") && llvm::StringRef(result).ends_with(" ")) {
-        return "` " + std::move(result) + " `";
-    }
-
-    return "`" + std::move(result) + "`";
+    os << (pad ? " `" : "`");
 }
 
 /// Get marker required for \p input to represent a markdown codeblock. It
@@ -243,10 +249,12 @@ std::string canonicalize_spaces(llvm::StringRef input) {
     return llvm::join(words, " ");
 }
 
-std::string render_blocks(llvm::ArrayRef<std::unique_ptr<Block>> children,
-                          void (Block::*render_func)(llvm::raw_ostream&) const) {
-    std::string text;
-    llvm::raw_string_ostream os(text);
+/// Appends to `out`, which is compacted in place rather than copied.
+void render_blocks(llvm::ArrayRef<std::unique_ptr<Block>> children,
+                   void (Block::*render_func)(llvm::raw_ostream&) const,
+                   std::string& out) {
+    auto start = out.size();
+    llvm::raw_string_ostream os(out);
 
     // Trim rulers.
     children = children.drop_while([](const std::unique_ptr<Block>& c) { return c->is_ruler(); });
@@ -264,19 +272,27 @@ std::string render_blocks(llvm::ArrayRef<std::unique_ptr<Block>> children,
     }
 
     // Get rid of redundant empty lines introduced in plaintext while imitating
-    // padding in markdown.
-    std::string adjusted;
-    llvm::StringRef trimmed = llvm::StringRef(text).trim();
-    adjusted.reserve(trimmed.size());
-    for(char c: trimmed) {
+    // padding in markdown.  Nothing moves right, so this is done in place.
+    os.flush();
+    auto end = out.size();
+    auto first = start;
+    while(first < end && llvm::isSpace(out[first])) {
+        ++first;
+    }
+    while(end > first && llvm::isSpace(out[end - 1])) {
+        --end;
+    }
+
+    auto written = start;
+    for(auto i = first; i < end; ++i) {
         // We allow at most two consecutive newlines.
-        if(c == '\n' && llvm::StringRef(adjusted).ends_with("\n\n")) {
+        if(out[i] == '\n' && written - start >= 2 && out[written - 1] == '\n' &&
+           out[written - 2] == '\n') {
             continue;
         }
-        adjusted.push_back(c);
+        out[written++] = out[i];
     }
-
-    return adjusted;
+    out.resize(written);
 }
 
 /// Separates two blocks with extra spacing. Note that it might render
@@ -329,20 +345,19 @@ private:
     std::string language;
 };
 
-/// Inserts two spaces after each `\n` to indent each line. First line is not
-/// indented.
-std::string indent_lines(llvm::StringRef input) {
+/// Writes \p input with two spaces after each `\n` to indent each line.
+/// First line is not indented.
+void write_indented(llvm::raw_ostream& os, llvm::StringRef input) {
     assert(!input.ends_with("\n") && "Input should've been trimmed.");
-    std::string indented;
-    // We'll add 2 spaces after each new line.
-    indented.reserve(input.size() + input.count('\n') * 2);
-    for(char c: input) {
-        indented += c;
-        if(c == '\n') {
-            indented.append("  ");
+    while(true) {
+        auto [line, rest] = input.split('\n');
+        os << line;
+        if(line.size() == input.size()) {
+            break;
         }
+        os << "\n  ";
+        input = rest;
     }
-    return indented;
 }
 
 class Heading : public Paragraph {
@@ -400,8 +415,8 @@ void Paragraph::render_markdown(llvm::raw_ostream& os) const {
         }
 
         switch(chunk.kind) {
-            case Chunk::PlainText: os << render_text(chunk.contents, !has_chunks); break;
-            case Chunk::InlineCode: os << render_inline_block(chunk.contents); break;
+            case Chunk::PlainText: render_text(os, chunk.contents, !has_chunks); break;
+            case Chunk::InlineCode: render_inline_block(os, chunk.contents); break;
         }
 
         has_chunks = true;
@@ -476,20 +491,26 @@ BulletList::BulletList() = default;
 BulletList::~BulletList() = default;
 
 void BulletList::render_markdown(llvm::raw_ostream& os) const {
+    std::string item_text;
     for(auto& item: items) {
-        // Instead of doing this we might prefer passing the indent to children
-        // to get rid of the copies, if it turns out to be a bottleneck.
-        os << "- " << indent_lines(item.as_markdown()) << '\n';
+        item_text.clear();
+        item.render_markdown(item_text);
+        os << "- ";
+        write_indented(os, item_text);
+        os << '\n';
     }
     // We need a new line after list to terminate it in markdown.
     os << '\n';
 }
 
 void BulletList::render_plain_text(llvm::raw_ostream& os) const {
+    std::string item_text;
     for(auto& item: items) {
-        // Instead of doing this we might prefer passing the indent to children
-        // to get rid of the copies, if it turns out to be a bottleneck.
-        os << "- " << indent_lines(item.as_plain_text()) << '\n';
+        item_text.clear();
+        item.render_plain_text(item_text);
+        os << "- ";
+        write_indented(os, item_text);
+        os << '\n';
     }
 }
 
@@ -541,12 +562,24 @@ BulletList& Document::add_bullet_list() {
     return *static_cast<BulletList*>(children.back().get());
 }
 
+void Document::render_markdown(std::string& out) const {
+    render_blocks(children, &Block::render_markdown, out);
+}
+
+void Document::render_plain_text(std::string& out) const {
+    render_blocks(children, &Block::render_plain_text, out);
+}
+
 std::string Document::as_markdown() const {
-    return render_blocks(children, &Block::render_markdown);
+    std::string result;
+    render_markdown(result);
+    return result;
 }
 
 std::string Document::as_plain_text() const {
-    return render_blocks(children, &Block::render_plain_text);
+    std::string result;
+    render_plain_text(result);
+    return result;
 }
 
 }  // namespace clice::markup
@@ -139,6 +139,13 @@ public:
     /// Doesn't contain any trailing newlines.
     std::string as_plain_text() const;
 
+    /// Append what as_markdown() returns to \p out, so that one buffer can be
+    /// reused across documents.
+    void render_markdown(std::string& out) const;
+
+    /// Append what as_plain_text() returns to \p out.
+    void render_plain_text(std::string& out) const;
+
 private:
     std::vector<std::unique_ptr<Block>> children;
 };
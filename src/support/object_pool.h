@@ -5,10 +5,19 @@
 #include <concepts>
 #include <cstdint>
 #include <cstring>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <tuple>
 #include <vector>
 
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Support/Allocator.h"
@@ -50,11 +59,17 @@ public:
         return it->second;
     }
 
-    llvm::StringRef get(ID id) {
+    llvm::StringRef get(ID id) const {
         assert(id < strings.size());
         return strings[id];
     }
 
+    /// The ID of `s` if it was saved, 0 otherwise.
+    ID find(llvm::StringRef s) const {
+        auto it = cache.find(s);
+        return it == cache.end() ? ID(0) : it->second;
+    }
+
     llvm::StringRef save(llvm::StringRef s) {
         return get(get(s));
     }
@@ -176,6 +191,294 @@ private:
     llvm::DenseMap<object_ptr<T>, ID> cache;
 };
 
+/// Spread a hash over `2^bits` shards by its high bits, leaving the low
+/// ones, which the shard's own table buckets by, evenly used.
+template <unsigned bits>
+inline unsigned shard_of_hash(unsigned hash) {
+    return static_cast<unsigned>((std::uint32_t(hash) * 0x9E3779B1u) >> (32 - bits));
+}
+
+/// StringSet safe to share between threads.  Strings are spread over shards
+/// by hash, each a StringSet with its own lock and allocator, so threads
+/// interning different strings rarely wait on each other.  An ID keeps its
+/// shard in its low bits; IDs are stable but not dense, and 0 is still the
+/// empty string.
+class ConcurrentStringSet {
+public:
+    using ID = std::uint32_t;
+
+    ConcurrentStringSet() : shards(std::make_unique<std::array<Shard, shard_count>>()) {}
+
+    /// Not thread-safe; a moved-from set can only be assigned or destroyed.
+    ConcurrentStringSet(ConcurrentStringSet&&) noexcept = default;
+    ConcurrentStringSet& operator=(ConcurrentStringSet&&) noexcept = default;
+
+    ID get(llvm::StringRef s) {
+        return save_with_id(s).second;
+    }
+
+    llvm::StringRef get(ID id) const {
+        if(id == 0) {
+            return {};
+        }
+        auto& shard = (*shards)[id & shard_mask];
+        std::shared_lock guard(shard.lock);
+        return shard.strings.get(id >> shard_bits);
+    }
+
+    /// The ID of `s` if it was saved, 0 otherwise.
+    ID find(llvm::StringRef s) const {
+        if(s.empty()) {
+            return ID(0);
+        }
+        auto index = shard_of(s);
+        auto& shard = (*shards)[index];
+        std::shared_lock guard(shard.lock);
+        auto local = shard.strings.find(s);
+        return local == 0 ? ID(0) : (local << shard_bits) | index;
+    }
+
+    llvm::StringRef save(llvm::StringRef s) {
+        return save_with_id(s).first;
+    }
+
+private:
+    constexpr static unsigned shard_bits = 4;
+    constexpr static unsigned shard_count = 1u << shard_bits;
+    constexpr static ID shard_mask = shard_count - 1;
+
+    struct Shard {
+        mutable std::shared_mutex lock;
+        llvm::BumpPtrAllocator allocator;
+        StringSet strings{&allocator};
+    };
+
+    static unsigned shard_of(llvm::StringRef s) {
+        return shard_of_hash<shard_bits>(llvm::DenseMapInfo<llvm::StringRef>::getHashValue(s));
+    }
+
+    std::pair<llvm::StringRef, ID> save_with_id(llvm::StringRef s) {
+        if(s.empty()) {
+            return {llvm::StringRef(), ID(0)};
+        }
+
+        auto index = shard_of(s);
+        auto& shard = (*shards)[index];
+        {
+            std::shared_lock guard(shard.lock);
+            if(auto local = shard.strings.find(s)) {
+                return {shard.strings.get(local), (local << shard_bits) | index};
+            }
+        }
+
+        std::unique_lock guard(shard.lock);
+        auto local = shard.strings.get(s);
+        assert(local < (ID(1) << (32 - shard_bits)) && "ConcurrentStringSet is full");
+        return {shard.strings.get(local), (local << shard_bits) | index};
+    }
+
+    std::unique_ptr<std::array<Shard, shard_count>> shards;
+};
+
+/// Epoch-based reclamation for objects that readers reach without a lock.
+/// A reader pins the current epoch for as long as it holds such objects;
+/// an object removed in epoch `e` may be reused once no thread is left
+/// pinned at `e` or before.
+class EpochDomain {
+public:
+    class Guard {
+    public:
+        explicit Guard(std::atomic<std::uint64_t>* slot) : slot(slot) {}
+
+        Guard(Guard&& other) noexcept : slot(std::exchange(other.slot, nullptr)) {}
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+        Guard& operator=(Guard&&) = delete;
+
+        ~Guard() {
+            if(slot) {
+                slot->store(0, std::memory_order_release);
+            }
+        }
+
+    private:
+        std::atomic<std::uint64_t>* slot;
+    };
+
+    /// Pin the current epoch.  Guards may nest, each taking a slot; with every
+    /// slot taken this waits for one to free up.
+    Guard pin() {
+        auto start = std::hash<std::thread::id>{}(std::this_thread::get_id());
+        while(true) {
+            for(std::size_t i = 0; i < slot_count; ++i) {
+                auto& slot = pinned[(start + i) % slot_count];
+                std::uint64_t expected = 0;
+                // A stale epoch only makes the pin more conservative.
+                if(slot.compare_exchange_strong(expected, epoch.load())) {
+                    return Guard(&slot);
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    /// Close the current epoch, returning it: what objects removed now are
+    /// tagged with.
+    std::uint64_t retire() {
+        return epoch.fetch_add(1);
+    }
+
+    /// Whether no thread pinned at `retired` or before is left.
+    bool reclaimable(std::uint64_t retired) const {
+        for(auto& slot: pinned) {
+            auto value = slot.load();
+            if(value != 0 && value <= retired) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    constexpr static std::size_t slot_count = 64;
+
+    std::atomic<std::uint64_t> epoch = 1;
+    std::array<std::atomic<std::uint64_t>, slot_count> pinned{};
+};
+
+/// ObjectSet safe to share between threads, sharded like
+/// ConcurrentStringSet.  The object of an ID never moves, so an object_ptr
+/// stays valid without a lock until the object is removed; a removed slot
+/// is reused only once the threads that may still hold it, those pinned
+/// through pin() when it was removed, have let go.
+template <typename T>
+class ConcurrentObjectSet {
+public:
+    using ID = std::uint32_t;
+
+    /// Fills in the object just stored, under its shard's lock, e.g. to copy
+    /// what it borrows onto the shard's allocator.
+    using Persist = llvm::function_ref<void(T&, llvm::BumpPtrAllocator&)>;
+
+    ConcurrentObjectSet() : state(std::make_unique<State>()) {}
+
+    /// Not thread-safe; a moved-from set can only be assigned or destroyed.
+    ConcurrentObjectSet(ConcurrentObjectSet&&) noexcept = default;
+    ConcurrentObjectSet& operator=(ConcurrentObjectSet&&) noexcept = default;
+
+    ID get(const T& object, Persist persist = nullptr) {
+        auto index = shard_of(object);
+        auto& shard = state->shards[index];
+        auto key = object_ptr(const_cast<T*>(&object));
+        {
+            std::shared_lock guard(shard.lock);
+            if(auto it = shard.cache.find(key); it != shard.cache.end()) {
+                return (it->second << shard_bits) | index;
+            }
+        }
+
+        std::unique_lock guard(shard.lock);
+        auto [it, success] = shard.cache.try_emplace(key, ID(0));
+        if(!success) {
+            return (it->second << shard_bits) | index;
+        }
+
+        object_ptr<T> stored;
+        ID local;
+        auto& retired = shard.retired;
+        if(!retired.empty() && state->epochs.reclaimable(std::get<2>(retired.front()))) {
+            std::tie(stored, local, std::ignore) = shard.retired.front();
+            shard.retired.pop_front();
+            std::destroy_at(stored.ptr);
+            new (stored.ptr) T(object);
+        } else {
+            local = ID(shard.objects.size());
+            assert(local < (ID(1) << (32 - shard_bits)) && "ConcurrentObjectSet is full");
+            stored = object_ptr<T>(new (shard.allocator.Allocate<T>(1)) T(object));
+            shard.objects.emplace_back();
+        }
+
+        if(persist) {
+            persist(*stored, shard.allocator);
+        }
+        it->first = stored;
+        it->second = local;
+        shard.objects[local] = stored;
+        return (local << shard_bits) | index;
+    }
+
+    object_ptr<T> get(ID id) const {
+        auto& shard = state->shards[id & shard_mask];
+        std::shared_lock guard(shard.lock);
+        assert((id >> shard_bits) < shard.objects.size());
+        return shard.objects[id >> shard_bits];
+    }
+
+    object_ptr<T> save(const T& object, Persist persist = nullptr) {
+        return this->get(this->get(object, persist));
+    }
+
+    /// Pin the epoch while holding objects another thread may remove.
+    EpochDomain::Guard pin() {
+        return state->epochs.pin();
+    }
+
+    void remove(object_ptr<T> object) {
+        auto& shard = state->shards[shard_of(*object)];
+        std::unique_lock guard(shard.lock);
+        auto it = shard.cache.find(object);
+        if(it == shard.cache.end() || it->first != object) {
+            return;
+        }
+
+        auto local = it->second;
+        shard.cache.erase(it);
+        shard.objects[local] = nullptr;
+        shard.retired.emplace_back(object, local, state->epochs.retire());
+    }
+
+private:
+    constexpr static unsigned shard_bits = 4;
+    constexpr static unsigned shard_count = 1u << shard_bits;
+    constexpr static ID shard_mask = shard_count - 1;
+
+    struct Shard {
+        mutable std::shared_mutex lock;
+        llvm::BumpPtrAllocator allocator;
+        std::vector<object_ptr<T>> objects;
+        llvm::DenseMap<object_ptr<T>, ID> cache;
+
+        /// Removed objects with the epoch they were removed in, oldest first.
+        std::deque<std::tuple<object_ptr<T>, ID, std::uint64_t>> retired;
+
+        ~Shard() {
+            if constexpr(!std::is_trivially_destructible_v<T>) {
+                for(auto object: objects) {
+                    if(object) {
+                        std::destroy_at(object.ptr);
+                    }
+                }
+                for(auto& [object, _, epoch]: retired) {
+                    std::destroy_at(object.ptr);
+                }
+            }
+        }
+    };
+
+    static unsigned shard_of(const T& object) {
+        using U = std::remove_cvref_t<T>;
+        return shard_of_hash<shard_bits>(llvm::DenseMapInfo<U>::getHashValue(object));
+    }
+
+    struct State {
+        std::array<Shard, shard_count> shards;
+        EpochDomain epochs;
+    };
+
+    std::unique_ptr<State> state;
+};
+
 }  // namespace clice
 
 namespace llvm {
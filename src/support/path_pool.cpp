@@ -0,0 +1,141 @@
+#include "support/path_pool.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/xxhash.h"
+
+namespace clice {
+
+namespace {
+
+// Normalize backslashes to forward slashes so that paths from different
+// sources (URI decoding, CDB, include resolution) compare equal on
+// Windows where native separators are backslashes.
+llvm::StringRef normalize(llvm::StringRef path, llvm::SmallVectorImpl<char>& storage) {
+    if(!path.contains('\\'))
+        return path;
+    storage.assign(path.begin(), path.end());
+    std::replace(storage.begin(), storage.end(), '\\', '/');
+    return llvm::StringRef(storage.data(), storage.size());
+}
+
+}  // namespace
+
+unsigned PathPool::shard_of(llvm::StringRef path) {
+    return static_cast<unsigned>(llvm::xxh3_64bits(path) % shard_count);
+}
+
+std::uint32_t PathPool::append(llvm::StringRef key) {
+    auto id = state->next.load(std::memory_order_relaxed);
+    assert(id != UINT32_MAX && "PathPool is full");
+
+    auto parent = llvm::sys::path::parent_path(key, llvm::sys::path::Style::posix);
+    auto directory_count = static_cast<std::uint32_t>(state->directory_ids.size());
+    auto [it, inserted] = state->directory_ids.try_emplace(parent, directory_count);
+    if(inserted)
+        state->directories.slot(directory_count) = parent;
+
+    state->entries.slot(id) = {key, it->second};
+    state->next.store(id + 1, std::memory_order_release);
+    return id;
+}
+
+std::uint32_t PathPool::intern(llvm::StringRef path) {
+    llvm::SmallString<256> storage;
+    path = normalize(path, storage);
+    auto& shard = state->shards[shard_of(path)];
+    {
+        std::shared_lock guard(shard.lock);
+        if(auto it = shard.ids.find(path); it != shard.ids.end())
+            return it->second;
+    }
+
+    // One lock numbers the new paths of every shard, so IDs follow the
+    // interning order.
+    std::unique_lock guard(shard.lock);
+    std::lock_guard numbering(state->numbering);
+    auto [it, inserted] = shard.ids.try_emplace(path, 0);
+    if(inserted)
+        it->second = append(it->getKey());
+    return it->second;
+}
+
+void PathPool::intern_all(llvm::ArrayRef<llvm::StringRef> paths,
+                          llvm::MutableArrayRef<std::uint32_t> ids) {
+    assert(paths.size() == ids.size());
+    std::vector<std::string> storage;
+    std::vector<llvm::StringRef> keys;
+    std::vector<unsigned> shards;
+    keys.reserve(paths.size());
+    shards.reserve(paths.size());
+    for(auto path: paths) {
+        if(path.contains('\\')) {
+            auto& normalized = storage.emplace_back(path.str());
+            std::replace(normalized.begin(), normalized.end(), '\\', '/');
+            path = normalized;
+        }
+        keys.push_back(path);
+        shards.push_back(shard_of(path));
+    }
+
+    // Known paths first, one shared lock per shard.
+    constexpr auto missing = UINT32_MAX;
+    bool all_known = true;
+    for(unsigned s = 0; s < shard_count; ++s) {
+        auto& shard = state->shards[s];
+        std::shared_lock guard(shard.lock);
+        for(std::size_t i = 0; i < keys.size(); ++i) {
+            if(shards[i] != s)
+                continue;
+            auto it = shard.ids.find(keys[i]);
+            ids[i] = it == shard.ids.end() ? missing : it->second;
+            all_known &= ids[i] != missing;
+        }
+    }
+    if(all_known)
+        return;
+
+    // Then the new ones, in input order under every lock at once.  Another
+    // thread may have interned some meanwhile.
+    std::array<std::unique_lock<std::shared_mutex>, shard_count> guards;
+    for(unsigned s = 0; s < shard_count; ++s) {
+        guards[s] = std::unique_lock(state->shards[s].lock);
+    }
+    std::lock_guard numbering(state->numbering);
+    for(std::size_t i = 0; i < keys.size(); ++i) {
+        if(ids[i] != missing)
+            continue;
+        auto& shard = state->shards[shards[i]];
+        auto [it, inserted] = shard.ids.try_emplace(keys[i], 0);
+        if(inserted)
+            it->second = append(it->getKey());
+        ids[i] = it->second;
+    }
+}
+
+std::optional<std::uint32_t> PathPool::find_directory(llvm::StringRef directory) const {
+    llvm::SmallString<256> storage;
+    directory = normalize(directory, storage);
+    std::lock_guard guard(state->numbering);
+    auto it = state->directory_ids.find(directory);
+    if(it == state->directory_ids.end())
+        return std::nullopt;
+    return it->second;
+}
+
+std::optional<std::uint32_t> PathPool::find(llvm::StringRef path) const {
+    llvm::SmallString<256> storage;
+    path = normalize(path, storage);
+    auto& shard = state->shards[shard_of(path)];
+    std::shared_lock guard(shard.lock);
+    auto it = shard.ids.find(path);
+    if(it == shard.ids.end())
+        return std::nullopt;
+    return it->second;
+}
+
+}  // namespace clice
@@ -1,52 +1,160 @@
 #pragma once
 
-#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <cassert>
 #include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <utility>
 
-#include "llvm/ADT/SmallString.h"
-#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
-#include "llvm/Support/Allocator.h"
 
 namespace clice {
 
 /// Intern pool that maps file paths to compact uint32_t IDs.
-struct PathPool {
-    llvm::BumpPtrAllocator allocator;
-    llvm::SmallVector<llvm::StringRef> paths;
-    llvm::StringMap<std::uint32_t> cache;
-
-    std::uint32_t intern(llvm::StringRef path) {
-        // Normalize backslashes to forward slashes so that paths from different
-        // sources (URI decoding, CDB, include resolution) compare equal on
-        // Windows where native separators are backslashes.
-        llvm::SmallString<256> normalized;
-        bool needs_normalize = path.contains('\\');
-        if(needs_normalize) {
-            normalized = path;
-            std::replace(normalized.begin(), normalized.end(), '\\', '/');
-            path = normalized;
-        }
+///
+/// Safe to share between threads.  Paths are spread over shards by hash,
+/// each behind its own reader-writer lock, and the path of an ID sits in
+/// chunks that never move, so resolve() takes no lock.  IDs are handed out
+/// in interning order: the same sequence of intern() calls always numbers
+/// paths the same way, and intern_all() numbers its new paths in input
+/// order, so a wave scanned in parallel and interned in one call stays
+/// reproducible.
+///
+/// Every path also knows its directory, numbered apart from the paths, so
+/// that grouping by directory compares integers rather than strings.
+class PathPool {
+public:
+    PathPool() : state(std::make_unique<State>()) {}
 
-        auto [it, inserted] = cache.try_emplace(path, paths.size());
-        if(inserted) {
-            // Allocate with null terminator so that resolve().data() is safe
-            // to use as const char* (e.g. in MemoryBuffer::getFile which calls strlen).
-            const std::size_t n = path.size();
-            char* buf = allocator.Allocate<char>(n + 1);
-            std::copy(path.begin(), path.end(), buf);
-            buf[n] = '\0';
-            paths.push_back(llvm::StringRef(buf, n));
-        }
-        return it->second;
-    }
+    /// Not thread-safe; a moved-from pool can only be assigned or destroyed.
+    PathPool(PathPool&&) noexcept = default;
+    PathPool& operator=(PathPool&&) noexcept = default;
+
+    std::uint32_t intern(llvm::StringRef path);
 
+    /// Intern every path of `paths` into the same slot of `ids`, taking each
+    /// shard lock once rather than once per path.
+    void intern_all(llvm::ArrayRef<llvm::StringRef> paths,
+                    llvm::MutableArrayRef<std::uint32_t> ids);
+
+    /// Look up a path without interning it.
+    std::optional<std::uint32_t> find(llvm::StringRef path) const;
+
+    /// The path of `id`, NUL-terminated so that data() can be passed as a
+    /// C string (e.g. to MemoryBuffer::getFile, which calls strlen).
     llvm::StringRef resolve(std::uint32_t id) const {
-        assert(id < paths.size());
-        return paths[id];
+        assert(id < size());
+        return state->entries[id].path;
+    }
+
+    /// ID of the directory holding the path of `id`, as parent_path() names
+    /// it.  Directories are numbered in the order first seen.
+    std::uint32_t directory_of(std::uint32_t id) const {
+        assert(id < size());
+        return state->entries[id].directory;
+    }
+
+    /// The directory `directory_of()` gave.  A prefix of one of the paths,
+    /// so not NUL-terminated.
+    llvm::StringRef directory(std::uint32_t directory_id) const {
+        return state->directories[directory_id];
+    }
+
+    /// Look up a directory without adding it.
+    std::optional<std::uint32_t> find_directory(llvm::StringRef directory) const;
+
+    /// Number of paths interned, so IDs below it are valid.  A path being
+    /// interned on another thread may not resolve yet: walk the IDs from the
+    /// thread that interns, or once it is done.
+    std::uint32_t size() const {
+        return state->next.load(std::memory_order_acquire);
+    }
+
+private:
+    constexpr static unsigned shard_count = 16;
+
+    /// Chunk `i` holds `first_chunk_size << i` paths, enough for any ID in
+    /// `chunk_count` of them.
+    constexpr static unsigned first_chunk_bits = 10;
+    constexpr static unsigned chunk_count = 32 - first_chunk_bits + 1;
+
+    static std::pair<unsigned, std::uint32_t> locate(std::uint32_t id) {
+        auto slot = (std::uint64_t(id) >> first_chunk_bits) + 1;
+        auto chunk = static_cast<unsigned>(std::bit_width(slot) - 1);
+        auto first = ((std::uint64_t(1) << chunk) - 1) << first_chunk_bits;
+        return {chunk, static_cast<std::uint32_t>(id - first)};
     }
+
+    /// Append-only array whose elements never move, read without a lock at
+    /// any index handed out.  Writers are serialized by `numbering`.
+    template <typename T>
+    struct Chunks {
+        std::array<std::atomic<T*>, chunk_count> chunks{};
+
+        ~Chunks() {
+            for(auto& chunk: chunks) {
+                delete[] chunk.load(std::memory_order_relaxed);
+            }
+        }
+
+        const T& operator[](std::uint32_t index) const {
+            auto [chunk, offset] = locate(index);
+            auto* elements = chunks[chunk].load(std::memory_order_acquire);
+            assert(elements);
+            return elements[offset];
+        }
+
+        T& slot(std::uint32_t index) {
+            auto [chunk, offset] = locate(index);
+            auto* elements = chunks[chunk].load(std::memory_order_relaxed);
+            if(!elements) {
+                elements = new T[std::size_t(1) << (first_chunk_bits + chunk)];
+                chunks[chunk].store(elements, std::memory_order_release);
+            }
+            return elements[offset];
+        }
+    };
+
+    struct Entry {
+        llvm::StringRef path;
+        std::uint32_t directory = 0;
+    };
+
+    struct Shard {
+        mutable std::shared_mutex lock;
+        /// Keys are stable and NUL-terminated: they are what resolve() returns.
+        llvm::StringMap<std::uint32_t> ids;
+    };
+
+    struct State {
+        std::array<Shard, shard_count> shards;
+        Chunks<Entry> entries;
+        std::atomic<std::uint32_t> next = 0;
+
+        /// Directories point into the first path seen in each.
+        Chunks<llvm::StringRef> directories;
+        llvm::DenseMap<llvm::StringRef, std::uint32_t> directory_ids;
+
+        /// Held, after the shard lock, while new paths are numbered; guards
+        /// `directory_ids` too.
+        mutable std::mutex numbering;
+    };
+
+    static unsigned shard_of(llvm::StringRef path);
+
+    /// Number the new path `key` (a shard key); its shard lock and
+    /// `numbering` are held.
+    std::uint32_t append(llvm::StringRef key);
+
+    std::unique_ptr<State> state;
 };
 
 }  // namespace clice
@@ -0,0 +1,154 @@
+#include "support/position_map.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "kota/ipc/lsp/text.h"
+
+namespace clice {
+
+namespace {
+
+namespace protocol = kota::ipc::protocol;
+
+/// Bytes of the UTF-8 sequence `lead` starts; a stray continuation byte
+/// counts as one.
+std::uint32_t sequence_length(unsigned char lead) {
+    if(lead >= 0xF0) {
+        return 4;
+    }
+    if(lead >= 0xE0) {
+        return 3;
+    }
+    if(lead >= 0xC0) {
+        return 2;
+    }
+    return 1;
+}
+
+}  // namespace
+
+PositionMap::PositionMap(std::string_view content,
+                         std::vector<std::uint32_t> starts,
+                         PositionEncoding encoding) :
+    text(content), line_starts(std::move(starts)), position_encoding(encoding) {
+    if(line_starts.empty()) {
+        line_starts.push_back(0);
+    }
+
+    auto lines = static_cast<std::uint32_t>(line_starts.size());
+    // Columns in UTF-8 are byte offsets on every line.
+    if(encoding == PositionEncoding::UTF8 || is_ascii(text)) {
+        ascii_lines.assign((lines + 63) / 64, ~std::uint64_t(0));
+        return;
+    }
+
+    ascii_lines.assign((lines + 63) / 64, 0);
+    for(std::uint32_t line = 0; line < lines; ++line) {
+        auto start = line_starts[line];
+        auto end =
+            line + 1 < lines ? line_starts[line + 1] : static_cast<std::uint32_t>(text.size());
+        auto content_of_line = text.substr(start, end - start);
+        if(is_ascii(content_of_line)) {
+            ascii_lines[line / 64] |= std::uint64_t(1) << (line % 64);
+            continue;
+        }
+
+        auto first = static_cast<std::uint32_t>(shifts.size());
+        std::uint32_t excess = 0;
+        for(std::uint32_t i = 0; i < content_of_line.size();) {
+            auto lead = static_cast<unsigned char>(content_of_line[i]);
+            if(lead < 0x80) {
+                i += 1;
+                continue;
+            }
+            auto length = std::min(sequence_length(lead),
+                                   static_cast<std::uint32_t>(content_of_line.size()) - i);
+            std::uint32_t units = 1;
+            if(encoding == PositionEncoding::UTF16 && length == 4) {
+                units = 2;
+            }
+            i += length;
+            excess += length - units;
+            shifts.push_back({.end = i, .excess = excess});
+        }
+        tables[line] = {first, static_cast<std::uint32_t>(shifts.size())};
+    }
+}
+
+PositionMap::PositionMap(std::string_view content, PositionEncoding encoding) :
+    PositionMap(content, kota::ipc::lsp::build_line_starts(content), encoding) {}
+
+bool PositionMap::is_ascii(std::string_view text) {
+    constexpr std::uint64_t high_bits = 0x8080808080808080ULL;
+    std::size_t i = 0;
+    for(; i + 8 <= text.size(); i += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, text.data() + i, sizeof(word));
+        if(word & high_bits) {
+            return false;
+        }
+    }
+    for(; i < text.size(); ++i) {
+        if(static_cast<unsigned char>(text[i]) & 0x80) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::uint32_t PositionMap::line_of(std::uint32_t offset) const {
+    auto count = line_starts.size();
+    // Features convert in text order: the same line or the next.
+    if(line_starts[last_line] <= offset) {
+        if(last_line + 1 == count || offset < line_starts[last_line + 1]) {
+            return last_line;
+        }
+        if(last_line + 2 == count || offset < line_starts[last_line + 2]) {
+            return ++last_line;
+        }
+    }
+    auto it = std::ranges::upper_bound(line_starts, offset);
+    last_line = static_cast<std::uint32_t>(it - line_starts.begin() - 1);
+    return last_line;
+}
+
+std::uint32_t PositionMap::column(std::uint32_t line, std::uint32_t bytes) const {
+    if(ascii_lines[line / 64] & (std::uint64_t(1) << (line % 64))) {
+        return bytes;
+    }
+    auto [first, last] = tables.lookup(line);
+    auto it = std::upper_bound(shifts.begin() + first,
+                               shifts.begin() + last,
+                               bytes,
+                               [](std::uint32_t value, const Shift& shift) {
+                                   return value < shift.end;
+                               });
+    if(it == shifts.begin() + first) {
+        return bytes;
+    }
+    return bytes - std::prev(it)->excess;
+}
+
+std::optional<protocol::Position> PositionMap::to_position(std::uint32_t offset) const {
+    if(offset > text.size()) {
+        return std::nullopt;
+    }
+    auto line = line_of(offset);
+    protocol::Position position;
+    position.line = line;
+    position.character = column(line, offset - line_starts[line]);
+    return position;
+}
+
+std::optional<protocol::Range> PositionMap::to_range(std::uint32_t begin,
+                                                     std::uint32_t end) const {
+    auto start = to_position(begin);
+    auto stop = to_position(end);
+    if(!start || !stop) {
+        return std::nullopt;
+    }
+    return protocol::Range{.start = *start, .end = *stop};
+}
+
+}  // namespace clice
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "kota/ipc/lsp/position.h"
+#include "kota/ipc/lsp/protocol.h"
+#include "llvm/ADT/DenseMap.h"
+
+namespace clice {
+
+/// Converts byte offsets of one text to LSP positions, like
+/// kota::ipc::lsp::LineMap, but without scanning the line of each offset.
+/// Built once per text: a bit per line records whether it is pure ASCII,
+/// where a column is the byte offset in the line, and each other line keeps
+/// a table of its multi-byte characters to correct the column by.  For the
+/// features converting every token of a large file.
+///
+/// Lookups remember the line of the previous one, so offsets given in order
+/// find their line without a search; a map is not to be shared across
+/// threads.
+class PositionMap {
+public:
+    using PositionEncoding = kota::ipc::lsp::PositionEncoding;
+
+    PositionMap(std::string_view content,
+                std::vector<std::uint32_t> line_starts,
+                PositionEncoding encoding = PositionEncoding::UTF16);
+
+    PositionMap(std::string_view content, PositionEncoding encoding = PositionEncoding::UTF16);
+
+    std::string_view content() const {
+        return text;
+    }
+
+    PositionEncoding encoding() const {
+        return position_encoding;
+    }
+
+    /// The position of `offset`, none past the end of the text.
+    std::optional<kota::ipc::protocol::Position> to_position(std::uint32_t offset) const;
+
+    std::optional<kota::ipc::protocol::Range> to_range(std::uint32_t begin,
+                                                       std::uint32_t end) const;
+
+    /// Whether `text` holds no byte over 127; eight bytes at a time.
+    static bool is_ascii(std::string_view text);
+
+private:
+    /// A multi-byte character of a line: the byte it ends before, from the
+    /// line start, and the bytes the line has counted over its code units
+    /// up to there.
+    struct Shift {
+        std::uint32_t end;
+        std::uint32_t excess;
+    };
+
+    std::uint32_t line_of(std::uint32_t offset) const;
+
+    std::uint32_t column(std::uint32_t line, std::uint32_t bytes) const;
+
+    std::string_view text;
+    std::vector<std::uint32_t> line_starts;
+    PositionEncoding position_encoding;
+
+    /// Bit `line % 64` of word `line / 64` is set for pure ASCII lines.
+    std::vector<std::uint64_t> ascii_lines;
+
+    /// The shifts of the other lines, by line: a range of `shifts`.
+    llvm::DenseMap<std::uint32_t, std::pair<std::uint32_t, std::uint32_t>> tables;
+    std::vector<Shift> shifts;
+
+    mutable std::uint32_t last_line = 0;
+};
+
+}  // namespace clice
@@ -0,0 +1,153 @@
+#include "support/shared_blob.h"
+
+#include <format>
+
+#ifdef __linux__
+#include <cerrno>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+#include "support/filesystem.h"
+#include "support/logging.h"
+
+#include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace clice::shared_blob {
+
+namespace {
+
+constexpr llvm::StringLiteral dir_prefix = "clice-";
+
+/// See set_receiver(); 0 until then.
+std::uint32_t receiver_pid = 0;
+
+std::uint32_t self_pid() {
+    return static_cast<std::uint32_t>(llvm::sys::Process::getProcessId());
+}
+
+#ifdef __linux__
+
+constexpr llvm::StringLiteral shm_root = "/dev/shm";
+
+bool is_pid_alive(std::uint32_t pid) {
+    return ::kill(static_cast<pid_t>(pid), 0) == 0 || errno == EPERM;
+}
+
+#endif
+
+}  // namespace
+
+std::string segment_dir(std::uint32_t owner_pid) {
+#ifdef __linux__
+    return std::format("{}/{}{}", shm_root.str(), dir_prefix.str(), owner_pid);
+#else
+    (void)owner_pid;
+    return {};
+#endif
+}
+
+void open_session() {
+#ifdef __linux__
+    if(!fs::is_directory(shm_root))
+        return;
+
+    auto self = self_pid();
+    std::error_code ec;
+    for(auto it = fs::directory_iterator(shm_root, ec); !ec && it != fs::directory_iterator();
+        it.increment(ec)) {
+        auto name = path::filename(it->path());
+        std::uint32_t pid = 0;
+        if(!name.consume_front(dir_prefix) || name.getAsInteger(10, pid))
+            continue;
+        if(pid == self || is_pid_alive(pid))
+            continue;
+        fs::remove_all(it->path());
+        LOG_DEBUG("Removed stale shared segments {}", it->path());
+    }
+
+    auto dir = segment_dir(self);
+    if(auto error = fs::create_directory(dir))
+        LOG_WARN("Shared segments disabled, cannot create {}: {}", dir, error.message());
+#endif
+}
+
+void close_session() {
+    auto dir = segment_dir(self_pid());
+    if(!dir.empty())
+        fs::remove_all(dir);
+}
+
+void set_receiver(std::uint32_t pid) {
+    receiver_pid = pid;
+}
+
+std::string publish(llvm::StringRef data) {
+#ifdef __linux__
+    if(receiver_pid == 0)
+        return {};
+    auto dir = segment_dir(receiver_pid);
+    if(!fs::is_directory(dir))
+        return {};
+
+    int fd = -1;
+    llvm::SmallString<128> path;
+    if(auto error = fs::createUniqueFile(path::join(dir, "%%%%%%%%%%%%.blob"), fd, path)) {
+        LOG_WARN("Failed to create shared segment in {}: {}", dir, error.message());
+        return {};
+    }
+
+    llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+    os << data;
+    os.close();
+    if(os.has_error()) {
+        LOG_WARN("Failed to write shared segment {}: {}", path, os.error().message());
+        os.clear_error();
+        fs::remove(path);
+        return {};
+    }
+    return path.str().str();
+#else
+    (void)data;
+    return {};
+#endif
+}
+
+std::unique_ptr<llvm::MemoryBuffer> take(llvm::StringRef handle) {
+    auto dir = segment_dir(self_pid());
+    if(dir.empty() || path::parent_path(handle) != dir)
+        return nullptr;
+
+    auto buffer = llvm::MemoryBuffer::getFile(handle,
+                                              /*IsText=*/false,
+                                              /*RequiresNullTerminator=*/false);
+    // Unlink right away: the mapping keeps the pages alive and nothing else
+    // will ever open this segment again.
+    fs::remove(handle);
+    if(!buffer) {
+        LOG_WARN("Failed to map shared segment {}: {}", handle, buffer.getError().message());
+        return nullptr;
+    }
+    return std::move(*buffer);
+}
+
+void offload(std::string& data, std::string& handle) {
+    if(data.size() < threshold)
+        return;
+    auto published = publish(data);
+    if(published.empty())
+        return;
+    handle = std::move(published);
+    data.clear();
+    data.shrink_to_fit();
+}
+
+Payload::Payload(const std::string& inline_data, llvm::StringRef handle) : bytes(inline_data) {
+    if(handle.empty())
+        return;
+    mapped = take(handle);
+    bytes = mapped ? mapped->getBuffer() : llvm::StringRef();
+}
+
+}  // namespace clice::shared_blob
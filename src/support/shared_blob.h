@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+namespace clice::shared_blob {
+
+/// Payloads at least this large are handed from a worker to its master
+/// through a memory-backed file instead of the IPC pipe.
+constexpr std::size_t threshold = 1024 * 1024;
+
+/// Directory holding the segments addressed to process `owner_pid`, or
+/// empty when the platform has no memory-backed filesystem we can use
+/// (only /dev/shm on Linux for now).
+std::string segment_dir(std::uint32_t owner_pid);
+
+/// Receiver side: create this process's segment directory and remove the
+/// directories of dead owners.  Workers only offload payloads once their
+/// master has done this, so it doubles as the opt-in.
+void open_session();
+
+/// Receiver side: remove this process's segment directory and any segments
+/// that were never taken (e.g. responses to cancelled requests).
+void close_session();
+
+/// Sender side: address segments to process `pid`, the master that spawned
+/// this worker (directly or through the zygote).  Nothing is published
+/// until it is set.
+void set_receiver(std::uint32_t pid);
+
+/// Sender side: write `data` into a fresh segment addressed to the receiver
+/// and return its handle.  Returns an empty string when there is no
+/// receiver, it has no session, or on failure; the caller should then send
+/// the payload inline.
+std::string publish(llvm::StringRef data);
+
+/// Receiver side: map the segment named by `handle` and unlink it.  The
+/// mapping stays valid until the returned buffer is destroyed.  Returns null
+/// on failure or when `handle` is not one of this process's segments.
+std::unique_ptr<llvm::MemoryBuffer> take(llvm::StringRef handle);
+
+/// Sender side: move `data` into a segment when it is large enough, storing
+/// the handle in `handle` and clearing `data`.  Leaves both untouched when
+/// the payload is small or no segment could be created.
+void offload(std::string& data, std::string& handle);
+
+/// Receiver side view of a payload that travelled either inline or through
+/// a segment.
+class Payload {
+public:
+    Payload(const std::string& inline_data, llvm::StringRef handle);
+
+    const char* data() const {
+        return bytes.data();
+    }
+
+    std::size_t size() const {
+        return bytes.size();
+    }
+
+    bool empty() const {
+        return bytes.empty();
+    }
+
+private:
+    std::unique_ptr<llvm::MemoryBuffer> mapped;
+    llvm::StringRef bytes;
+};
+
+}  // namespace clice::shared_blob
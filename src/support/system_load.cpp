@@ -0,0 +1,146 @@
+#include "support/system_load.h"
+
+#include <cstdlib>
+#include <memory>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#include <sys/qos.h>
+#include <sys/resource.h>
+#endif
+
+namespace clice::system_load {
+
+namespace {
+
+#if defined(__linux__)
+/// From linux/ioprio.h, which glibc does not wrap.
+constexpr int ioprio_who_process = 1;
+constexpr int ioprio_class_shift = 13;
+constexpr int ioprio_class_best_effort = 2;
+constexpr int ioprio_lowest_level = 7;
+
+llvm::StringRef read_attribute(const llvm::Twine& path, std::unique_ptr<llvm::MemoryBuffer>& buf) {
+    auto file = llvm::MemoryBuffer::getFileAsStream(path);
+    if(!file)
+        return {};
+    buf = std::move(*file);
+    return buf->getBuffer().trim();
+}
+#endif
+
+}  // namespace
+
+std::optional<double> load_average() {
+#if defined(_WIN32)
+    return std::nullopt;
+#else
+    double load[1];
+    if(::getloadavg(load, 1) != 1)
+        return std::nullopt;
+    return load[0];
+#endif
+}
+
+std::optional<bool> on_battery() {
+#if defined(__linux__)
+    std::error_code ec;
+    bool mains = false;
+    bool discharging = false;
+    for(llvm::sys::fs::directory_iterator it("/sys/class/power_supply", ec), end;
+        !ec && it != end;
+        it.increment(ec)) {
+        std::unique_ptr<llvm::MemoryBuffer> type_buf;
+        std::unique_ptr<llvm::MemoryBuffer> state_buf;
+        auto type = read_attribute(it->path() + "/type", type_buf);
+        if(type == "Mains" || type == "USB") {
+            mains |= read_attribute(it->path() + "/online", state_buf) == "1";
+        } else if(type == "Battery") {
+            discharging |= read_attribute(it->path() + "/status", state_buf) == "Discharging";
+        }
+    }
+    if(!mains && !discharging)
+        return std::nullopt;
+    return discharging && !mains;
+#else
+    return std::nullopt;
+#endif
+}
+
+std::vector<unsigned> allowed_cpus() {
+    std::vector<unsigned> cpus;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(::sched_getaffinity(0, sizeof(set), &set) != 0)
+        return cpus;
+    for(unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if(CPU_ISSET(cpu, &set))
+            cpus.push_back(cpu);
+    }
+#endif
+    return cpus;
+}
+
+bool set_affinity(int pid, llvm::ArrayRef<unsigned> cpus) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(auto cpu: cpus)
+        CPU_SET(cpu, &set);
+    return !cpus.empty() && ::sched_setaffinity(pid, sizeof(set), &set) == 0;
+#else
+    (void)pid;
+    (void)cpus;
+    return false;
+#endif
+}
+
+ScopedBackground::ScopedBackground() {
+#if defined(__linux__)
+    saved_io = static_cast<int>(::syscall(SYS_ioprio_get, ioprio_who_process, 0));
+    if(saved_io >= 0) {
+        ::syscall(SYS_ioprio_set,
+                  ioprio_who_process,
+                  0,
+                  (ioprio_class_best_effort << ioprio_class_shift) | ioprio_lowest_level);
+    }
+#elif defined(__APPLE__)
+    saved_io = ::getiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD);
+    if(saved_io >= 0)
+        ::setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD, IOPOL_THROTTLE);
+    qos_class_t qos;
+    if(::pthread_get_qos_class_np(::pthread_self(), &qos, &saved_relative) == 0) {
+        saved_qos = static_cast<int>(qos);
+        ::pthread_set_qos_class_self_np(QOS_CLASS_UTILITY, 0);
+    }
+#endif
+}
+
+ScopedBackground::~ScopedBackground() {
+#if defined(__linux__)
+    if(saved_io >= 0)
+        ::syscall(SYS_ioprio_set, ioprio_who_process, 0, saved_io);
+#elif defined(__APPLE__)
+    if(saved_io >= 0)
+        ::setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD, saved_io);
+    if(saved_qos >= 0) {
+        auto qos = static_cast<qos_class_t>(saved_qos);
+        // A thread never given a class reports it unspecified, which cannot
+        // be set back; the default class is the nearest.
+        ::pthread_set_qos_class_self_np(qos == QOS_CLASS_UNSPECIFIED ? QOS_CLASS_DEFAULT : qos,
+                                        saved_relative);
+    }
+#endif
+}
+
+}  // namespace clice::system_load
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include "llvm/ADT/ArrayRef.h"
+
+namespace clice::system_load {
+
+/// The one-minute load average, nullopt where the platform has none
+/// (Windows).
+std::optional<double> load_average();
+
+/// Whether the machine runs on battery: a battery discharges and no mains
+/// supply is online.  Nullopt when not known (anything but Linux, or a
+/// machine without power supply information).
+std::optional<bool> on_battery();
+
+/// The CPUs this process may run on, empty where unknown (anything but
+/// Linux).
+std::vector<unsigned> allowed_cpus();
+
+/// Restrict process `pid` to `cpus`; false where not supported.
+bool set_affinity(int pid, llvm::ArrayRef<unsigned> cpus);
+
+/// Lower the I/O priority of the calling thread to the lowest best-effort
+/// level (Linux ioprio) or to throttled I/O and the utility QoS class
+/// (macOS), for its lifetime.  Does nothing elsewhere.
+class ScopedBackground {
+public:
+    ScopedBackground();
+
+    ~ScopedBackground();
+
+    ScopedBackground(const ScopedBackground&) = delete;
+    ScopedBackground& operator=(const ScopedBackground&) = delete;
+
+private:
+    int saved_io = -1;
+    int saved_qos = -1;
+    int saved_relative = 0;
+};
+
+}  // namespace clice::system_load
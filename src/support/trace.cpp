@@ -0,0 +1,155 @@
+#include "support/trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <format>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <system_error>
+
+#include "support/filesystem.h"
+#include "support/logging.h"
+
+#include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/thread.h"
+
+namespace clice::trace {
+
+namespace {
+
+/// Events buffered before they are written out.
+constexpr std::size_t flush_threshold = 64 * 1024;
+
+struct Writer {
+    std::mutex lock;
+    std::unique_ptr<llvm::raw_fd_ostream> out;
+    std::string buffer;
+    std::int64_t offset = 0;
+    std::uint64_t pid = 0;
+    std::uint64_t next_id = 0;
+
+    void flush() {
+        out->write(buffer.data(), buffer.size());
+        out->flush();
+        buffer.clear();
+    }
+
+    void close() {
+        buffer += "\n]\n";
+        flush();
+        out.reset();
+    }
+
+    ~Writer() {
+        if(out)
+            close();
+    }
+};
+
+Writer writer;
+std::atomic<bool> active = false;
+
+void append_escaped(std::string& out, std::string_view text) {
+    for(char c: text) {
+        switch(c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if(static_cast<unsigned char>(c) < 0x20)
+                    std::format_to(std::back_inserter(out), "\\u{:04x}", static_cast<int>(c));
+                else
+                    out += c;
+        }
+    }
+}
+
+}  // namespace
+
+bool start(std::string_view dir, std::string_view name, std::int64_t offset) {
+    std::lock_guard guard(writer.lock);
+    if(writer.out)
+        return true;
+
+    if(auto ec = llvm::sys::fs::create_directories(dir)) {
+        LOG_WARN("Failed to create trace directory {}: {}", dir, ec.message());
+        return false;
+    }
+    // A respawned worker reuses its name: keep the file of the one that died.
+    auto pid = static_cast<std::uint64_t>(llvm::sys::Process::getProcessId());
+    auto file = path::join(dir, std::format("{}-{}.trace.json", name, pid));
+    std::error_code ec;
+    auto out = std::make_unique<llvm::raw_fd_ostream>(file, ec, llvm::sys::fs::OF_None);
+    if(ec) {
+        LOG_WARN("Failed to open trace file {}: {}", file, ec.message());
+        return false;
+    }
+
+    writer.out = std::move(out);
+    writer.offset = offset;
+    writer.pid = pid;
+    writer.buffer = "[\n";
+    std::format_to(std::back_inserter(writer.buffer),
+                   R"({{"ph":"M","name":"process_name","pid":{},"args":{{"name":")",
+                   writer.pid);
+    append_escaped(writer.buffer, name);
+    writer.buffer += "\"}}";
+    active.store(true, std::memory_order_release);
+    LOG_INFO("Writing trace events to {}", file);
+    return true;
+}
+
+void stop() {
+    std::lock_guard guard(writer.lock);
+    active.store(false, std::memory_order_release);
+    if(writer.out)
+        writer.close();
+}
+
+bool enabled() {
+    return active.load(std::memory_order_relaxed);
+}
+
+std::int64_t clock() {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void span(std::string_view name, std::string_view detail, std::int64_t begin, std::int64_t end) {
+    std::lock_guard guard(writer.lock);
+    if(!writer.out)
+        return;
+
+    // IDs are matched across every file of the session: keep the pid in
+    // the upper bits.
+    auto id = (writer.pid << 32) | writer.next_id++;
+    auto tid = llvm::get_threadid();
+    auto event = [&](char phase, std::int64_t ts, bool args) {
+        std::format_to(std::back_inserter(writer.buffer),
+                       ",\n{{\"ph\":\"{}\",\"cat\":\"clice\",\"id\":\"0x{:x}\",\"pid\":{},"
+                       "\"tid\":{},\"ts\":{},\"name\":\"",
+                       phase,
+                       id,
+                       writer.pid,
+                       tid,
+                       ts + writer.offset);
+        append_escaped(writer.buffer, name);
+        writer.buffer += '"';
+        if(args && !detail.empty()) {
+            writer.buffer += ",\"args\":{\"detail\":\"";
+            append_escaped(writer.buffer, detail);
+            writer.buffer += "\"}";
+        }
+        writer.buffer += '}';
+    };
+    event('b', begin, true);
+    event('e', end, false);
+
+    if(writer.buffer.size() >= flush_threshold)
+        writer.flush();
+}
+
+}  // namespace clice::trace
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace clice::trace {
+
+/// Each process writes its spans to `<dir>/<name>-<pid>.trace.json` in the
+/// Chrome trace-event format, as async begin/end pairs so that spans of
+/// coroutines interleaving on one event loop still nest.  Timestamps are
+/// steady-clock microseconds shifted onto the master's clock, and span IDs
+/// carry the pid, so the files of one session concatenate into a single
+/// timeline that Perfetto or chrome://tracing can open.
+
+/// Begin tracing this process.  `offset` is added to every timestamp: what
+/// the master's clock reads minus this one's.  False when the file cannot
+/// be opened.
+bool start(std::string_view dir, std::string_view name, std::int64_t offset = 0);
+
+/// Write the buffered events and close the file; also done at exit.
+void stop();
+
+bool enabled();
+
+/// Microseconds on the steady clock, without the offset.
+std::int64_t clock();
+
+/// Record a span of `name` from `begin` to `end`, both clock() readings.
+void span(std::string_view name, std::string_view detail, std::int64_t begin, std::int64_t end);
+
+/// Records the span of its own lifetime.  Costs a bool check when tracing
+/// is off.
+class Span {
+public:
+    explicit Span(std::string_view name, std::string_view detail = {}) : name(name) {
+        if(enabled()) {
+            this->detail = detail;
+            begin = clock();
+        }
+    }
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+    ~Span() {
+        if(begin >= 0)
+            span(name, detail, begin, clock());
+    }
+
+private:
+    std::string_view name;
+    std::string detail;
+    std::int64_t begin = -1;
+};
+
+}  // namespace clice::trace
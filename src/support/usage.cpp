@@ -0,0 +1,183 @@
+#include "support/usage.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#if defined(_WIN32)
+// Guarded as in support/cache_store.cpp.
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+namespace clice::usage {
+
+namespace {
+
+/// Bumped by operator new, hence constinit: no TLS guard may run inside it.
+constinit thread_local std::uint64_t allocations = 0;
+constinit thread_local std::uint64_t allocated_bytes = 0;
+
+std::uint64_t thread_cpu_us() {
+#if defined(_WIN32)
+    FILETIME creation, exit, kernel, user;
+    if(!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+        return 0;
+    auto ticks = [](const FILETIME& time) {
+        return (std::uint64_t(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+    };
+    // In units of 100ns.
+    return (ticks(kernel) + ticks(user)) / 10;
+#else
+    timespec time;
+    if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) != 0)
+        return 0;
+    return std::uint64_t(time.tv_sec) * 1'000'000 + std::uint64_t(time.tv_nsec) / 1'000;
+#endif
+}
+
+}  // namespace
+
+Sample thread_usage() {
+    return {
+        .allocations = allocations,
+        .allocated_bytes = allocated_bytes,
+        .cpu_us = thread_cpu_us(),
+    };
+}
+
+}  // namespace clice::usage
+
+#if CLICE_ALLOCATION_ACCOUNTING
+
+// Replacing operator new in the library rather than in clice.cc is enough:
+// the workers link this file in for thread_usage(), and a definition in the
+// executable wins over the one of the C++ runtime.  The aligned forms
+// matter most, as LLVM's BumpPtrAllocator, and so clang's AST, allocate
+// through them.
+
+namespace {
+
+void* counted_malloc(std::size_t size) {
+    clice::usage::allocations += 1;
+    clice::usage::allocated_bytes += size;
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void* counted_aligned(std::size_t size, std::align_val_t alignment) {
+    clice::usage::allocations += 1;
+    clice::usage::allocated_bytes += size;
+    auto align = static_cast<std::size_t>(alignment);
+#if defined(_WIN32)
+    return _aligned_malloc(size == 0 ? 1 : size, align);
+#else
+    void* p = nullptr;
+    if(::posix_memalign(&p, std::max(align, sizeof(void*)), size == 0 ? 1 : size) != 0)
+        return nullptr;
+    return p;
+#endif
+}
+
+void aligned_free(void* p) {
+#if defined(_WIN32)
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void* checked(void* p) {
+    // Built without exceptions: a failed allocation ends the process, as
+    // the runtime's operator new does then.
+    if(!p)
+        std::abort();
+    return p;
+}
+
+}  // namespace
+
+void* operator new(std::size_t size) {
+    return checked(counted_malloc(size));
+}
+
+void* operator new[](std::size_t size) {
+    return checked(counted_malloc(size));
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return counted_malloc(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return counted_malloc(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    return checked(counted_aligned(size, alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+    return checked(counted_aligned(size, alignment));
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return counted_aligned(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return counted_aligned(size, alignment);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    aligned_free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept {
+    aligned_free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept {
+    aligned_free(p);
+}
+
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept {
+    aligned_free(p);
+}
+
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+    aligned_free(p);
+}
+
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+    aligned_free(p);
+}
+
+#endif
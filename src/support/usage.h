@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+
+namespace clice::usage {
+
+/// What a thread has used: the allocations it made through operator new
+/// and its CPU time.  Allocations are only counted in builds configured
+/// with CLICE_ALLOCATION_ACCOUNTING, which replace the global operator new;
+/// elsewhere they stay 0.  Memory clang and LLVM take from malloc directly
+/// (SmallVector, for one) is not seen either way.
+struct Sample {
+    std::uint64_t allocations = 0;
+    std::uint64_t allocated_bytes = 0;
+    std::uint64_t cpu_us = 0;
+
+    Sample& operator+=(const Sample& other) {
+        allocations += other.allocations;
+        allocated_bytes += other.allocated_bytes;
+        cpu_us += other.cpu_us;
+        return *this;
+    }
+
+    friend Sample operator-(const Sample& lhs, const Sample& rhs) {
+        return {
+            .allocations = lhs.allocations - rhs.allocations,
+            .allocated_bytes = lhs.allocated_bytes - rhs.allocated_bytes,
+            .cpu_us = lhs.cpu_us - rhs.cpu_us,
+        };
+    }
+};
+
+/// Whether this build counts allocations.
+constexpr bool counts_allocations() {
+#if CLICE_ALLOCATION_ACCOUNTING
+    return true;
+#else
+    return false;
+#endif
+}
+
+/// The calling thread's usage since it started.
+Sample thread_usage();
+
+/// Adds what the calling thread uses during its lifetime to `total`.  For
+/// work handed to a thread pool, put it in the function that runs there:
+/// the usage of the thread awaiting it is not the work's.
+class Meter {
+public:
+    explicit Meter(Sample& total) : total(total), start(thread_usage()) {}
+
+    Meter(const Meter&) = delete;
+    Meter& operator=(const Meter&) = delete;
+
+    ~Meter() {
+        total += thread_usage() - start;
+    }
+
+private:
+    Sample& total;
+    Sample start;
+};
+
+}  // namespace clice::usage
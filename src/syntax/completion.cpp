@@ -1,9 +1,11 @@
 #include "syntax/completion.h"
 
+#include <algorithm>
+
 #include "syntax/include_resolver.h"
 
 #include "llvm/ADT/SmallString.h"
-#include "llvm/ADT/StringSet.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Path.h"
 
@@ -67,6 +69,17 @@ std::vector<IncludeCandidate> complete_include_path(const ResolvedSearchConfig&
                                                     llvm::StringRef prefix,
                                                     bool angled,
                                                     DirListingCache& dir_cache) {
+    IncludeCompletionIndex index;
+    return index.complete(resolved, prefix, angled, dir_cache);
+}
+
+std::vector<IncludeCandidate> IncludeCompletionIndex::complete(const ResolvedSearchConfig& resolved,
+                                                               llvm::StringRef prefix,
+                                                               bool angled,
+                                                               DirListingCache& dir_cache) {
+    // Bounds the tables kept for the subdirectories typed into over a session.
+    constexpr std::size_t max_tables = 512;
+
     llvm::StringRef dir_prefix;
     llvm::StringRef file_prefix = prefix;
     auto slash_pos = prefix.rfind('/');
@@ -77,42 +90,69 @@ std::vector<IncludeCandidate> complete_include_path(const ResolvedSearchConfig&
 
     unsigned start_idx = angled ? resolved.angled_start_idx : 0;
 
-    std::vector<IncludeCandidate> results;
-    llvm::StringSet<> seen;
-
+    // The listings the table stands for, as they are now.
+    std::string key;
+    llvm::SmallVector<llvm::SmallString<256>> dirs;
+    llvm::SmallVector<Source> sources;
     for(unsigned i = start_idx; i < resolved.dirs.size(); ++i) {
         auto& search_dir = resolved.dirs[i];
+        key += search_dir.path;
+        key += '\0';
 
-        const llvm::StringSet<>* entries = nullptr;
+        auto& dir = dirs.emplace_back(search_dir.path);
+        const llvm::StringSet<>* entries = search_dir.entries;
         if(!dir_prefix.empty()) {
-            llvm::SmallString<256> sub_path(search_dir.path);
-            llvm::sys::path::append(sub_path, dir_prefix);
-            entries = resolve_dir(sub_path, dir_cache);
-        } else {
-            entries = search_dir.entries;
+            llvm::sys::path::append(dir, dir_prefix);
+            entries = resolve_dir(dir, dir_cache);
         }
+        auto mtime = dir_cache.mtimes.find(dir);
+        sources.push_back({entries, mtime == dir_cache.mtimes.end() ? -1 : mtime->second});
+    }
+    key += dir_prefix;
 
-        if(!entries)
-            continue;
-
-        for(auto& entry: *entries) {
-            auto name = entry.getKey();
-            if(!name.starts_with(file_prefix))
-                continue;
-            if(!seen.insert(name).second)
+    if(!tables.contains(key) && tables.size() >= max_tables) {
+        tables.clear();
+    }
+    auto& table = tables[key];
+    if(table.names.empty() || !std::ranges::equal(table.sources, sources)) {
+        table.dirs.clear();
+        for(auto& dir: dirs) {
+            table.dirs.push_back(dir.str().str());
+        }
+        table.sources.assign(sources.begin(), sources.end());
+        table.names.clear();
+        for(std::uint32_t i = 0; i < sources.size(); ++i) {
+            if(!sources[i].entries) {
                 continue;
-
-            llvm::SmallString<256> full_path(search_dir.path);
-            if(!dir_prefix.empty()) {
-                llvm::sys::path::append(full_path, dir_prefix);
             }
-            llvm::sys::path::append(full_path, name);
+            for(auto& entry: *sources[i].entries) {
+                table.names.push_back({.name = entry.getKey().str(), .dir = i});
+            }
+        }
 
-            bool is_dir = false;
-            llvm::sys::fs::is_directory(llvm::Twine(full_path), is_dir);
+        // Stable, so the first directory listing a name is the one kept.
+        std::ranges::stable_sort(table.names, {}, &Name::name);
+        auto [first, last] = std::ranges::unique(table.names, {}, &Name::name);
+        table.names.erase(first, last);
+    }
 
-            results.push_back({name.str(), is_dir});
+    std::vector<IncludeCandidate> results;
+    auto it = std::ranges::lower_bound(table.names, file_prefix, {}, [](const Name& name) {
+        return llvm::StringRef(name.name);
+    });
+    for(; it != table.names.end() && llvm::StringRef(it->name).starts_with(file_prefix); ++it) {
+        if(it->directory < 0) {
+            // A subdirectory the cache has listed needs no stat.
+            llvm::SmallString<256> full_path(table.dirs[it->dir]);
+            llvm::sys::path::append(full_path, it->name);
+            auto* listed = dir_cache.find(full_path);
+            bool is_dir = listed && !listed->empty();
+            if(!is_dir) {
+                llvm::sys::fs::is_directory(llvm::Twine(full_path), is_dir);
+            }
+            it->directory = is_dir;
         }
+        results.push_back({it->name, it->directory == 1});
     }
 
     return results;
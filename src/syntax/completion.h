@@ -5,7 +5,9 @@
 #include <vector>
 
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
 
 namespace clice {
 
@@ -43,9 +45,9 @@ struct IncludeCandidate {
     bool is_directory = false;
 };
 
-/// Return file/directory names matching a prefix in the given search paths.
+/// Return file/directory names matching a prefix in the given search paths,
+/// sorted by name.
 /// @param resolved  Pre-resolved search directories with cached directory listings.
-/// @param angled_start  Index where angled (<>) search dirs begin.
 /// @param prefix    Partially-typed include path (e.g. "vec" or "sys/").
 /// @param angled    True for <> includes, false for "" includes.
 /// @param dir_cache  Shared directory listing cache (for subdirectory lookups).
@@ -54,4 +56,56 @@ std::vector<IncludeCandidate> complete_include_path(const ResolvedSearchConfig&
                                                     bool angled,
                                                     DirListingCache& dir_cache);
 
+/// The names complete_include_path() matches against, kept across requests.
+/// One table per search list and directory prefix ("" for `<vec`, "sys"
+/// for `<sys/ty`) holds the names of its directories sorted, so a prefix
+/// is one binary search away instead of a pass over every listing.  A
+/// table is built from the DirListingCache the first time a completion
+/// reaches it and again once one of its listings is replaced or listed
+/// again; nothing is read from disk but the directories missing from the
+/// cache and one stat per name returned, the first time it is returned.
+class IncludeCompletionIndex {
+public:
+    std::vector<IncludeCandidate> complete(const ResolvedSearchConfig& resolved,
+                                           llvm::StringRef prefix,
+                                           bool angled,
+                                           DirListingCache& dir_cache);
+
+    void clear() {
+        tables.clear();
+    }
+
+    /// Tables built (testing/diagnostics).
+    std::size_t size() const {
+        return tables.size();
+    }
+
+private:
+    struct Name {
+        std::string name;
+
+        /// Index into Table::dirs of the first directory listing the name.
+        std::uint32_t dir = 0;
+
+        /// 1 for a directory, 0 for a file, -1 until first returned.
+        std::int8_t directory = -1;
+    };
+
+    /// A listing a table was built from, to tell when it is replaced.
+    struct Source {
+        const llvm::StringSet<>* entries = nullptr;
+        std::int64_t mtime = -1;
+
+        friend bool operator==(const Source&, const Source&) = default;
+    };
+
+    struct Table {
+        std::vector<std::string> dirs;
+        std::vector<Source> sources;
+        std::vector<Name> names;
+    };
+
+    llvm::StringMap<Table> tables;
+};
+
 }  // namespace clice
@@ -2,6 +2,9 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cstring>
+#include <iterator>
+#include <thread>
 
 #include "command/search_config.h"
 #include "command/toolchain.h"
@@ -10,12 +13,15 @@
 #include "syntax/scan.h"
 
 #include "kota/async/async.h"
+#include "kota/codec/json/json.h"
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/StringSet.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/StringSaver.h"
+#include "llvm/Support/xxhash.h"
 
 namespace clice {
 
@@ -41,6 +47,9 @@ void DependencyGraph::set_includes(std::uint32_t path_id,
                                    llvm::SmallVector<std::uint32_t> included_ids) {
     IncludeKey key{path_id, config_id};
     includes[key] = std::move(included_ids);
+    host_cache_.clear();
+    chain_cache_.clear();
+    unpatched_.insert(path_id);
     auto& configs = file_configs[path_id];
     if(std::find(configs.begin(), configs.end(), config_id) == configs.end()) {
         configs.push_back(config_id);
@@ -56,6 +65,10 @@ llvm::ArrayRef<std::uint32_t> DependencyGraph::get_includes(std::uint32_t path_i
     return {};
 }
 
+bool DependencyGraph::has_includes(std::uint32_t path_id, std::uint32_t config_id) const {
+    return includes.contains(IncludeKey{path_id, config_id});
+}
+
 llvm::SmallVector<std::uint32_t> DependencyGraph::get_all_includes(std::uint32_t path_id) const {
     llvm::DenseMap<std::uint32_t, std::size_t> seen;  // raw_id -> index in result
     llvm::SmallVector<std::uint32_t> result;
@@ -83,6 +96,14 @@ llvm::SmallVector<std::uint32_t> DependencyGraph::get_all_includes(std::uint32_t
     return result;
 }
 
+void DependencyGraph::for_each_includes(
+    llvm::function_ref<void(IncludeKey key, llvm::ArrayRef<std::uint32_t> included_ids)> callback)
+    const {
+    for(auto& [key, ids]: includes) {
+        callback(key, ids);
+    }
+}
+
 std::size_t DependencyGraph::file_count() const {
     return file_configs.size();
 }
@@ -99,44 +120,203 @@ std::size_t DependencyGraph::edge_count() const {
     return count;
 }
 
+llvm::ArrayRef<std::uint32_t> DependencyGraph::Adjacency::row(std::uint32_t id) const {
+    if(!delta.empty()) {
+        if(auto it = delta.find(id); it != delta.end()) {
+            return it->second;
+        }
+    }
+    if(std::size_t(id) + 1 >= offsets.size()) {
+        return {};
+    }
+    return llvm::ArrayRef(values).slice(offsets[id], offsets[id + 1] - offsets[id]);
+}
+
+llvm::SmallVectorImpl<std::uint32_t>& DependencyGraph::Adjacency::edit(std::uint32_t id) {
+    auto [it, inserted] = delta.try_emplace(id);
+    if(inserted && std::size_t(id) + 1 < offsets.size()) {
+        auto packed = llvm::ArrayRef(values).slice(offsets[id], offsets[id + 1] - offsets[id]);
+        it->second.assign(packed.begin(), packed.end());
+    }
+    return it->second;
+}
+
+void DependencyGraph::Adjacency::compact() {
+    std::size_t rows = offsets.empty() ? 0 : offsets.size() - 1;
+    for(auto& entry: delta) {
+        rows = std::max(rows, std::size_t(entry.first) + 1);
+    }
+
+    std::vector<std::uint32_t> packed_offsets;
+    std::vector<std::uint32_t> packed;
+    packed_offsets.reserve(rows + 1);
+    packed.reserve(values.size());
+    for(std::uint32_t id = 0; id < rows; ++id) {
+        packed_offsets.push_back(static_cast<std::uint32_t>(packed.size()));
+        llvm::append_range(packed, row(id));
+    }
+    packed_offsets.push_back(static_cast<std::uint32_t>(packed.size()));
+
+    offsets = std::move(packed_offsets);
+    values = std::move(packed);
+    delta.clear();
+}
+
+void DependencyGraph::Adjacency::clear() {
+    offsets.clear();
+    values.clear();
+    delta.clear();
+}
+
 void DependencyGraph::build_reverse_map() {
-    reverse_includes_.clear();
+    host_cache_.clear();
+    chain_cache_.clear();
+    unpatched_.clear();
+    forward_ = {};
+    reverse_ = {};
+
+    std::uint32_t rows = 0;
     for(auto& [key, ids]: includes) {
+        rows = std::max(rows, key.path_id + 1);
         for(auto flagged_id: ids) {
-            auto included_id = flagged_id & PATH_ID_MASK;
-            auto& vec = reverse_includes_[included_id];
-            if(llvm::find(vec, key.path_id) == vec.end()) {
-                vec.push_back(key.path_id);
+            rows = std::max(rows, (flagged_id & PATH_ID_MASK) + 1);
+        }
+    }
+
+    // Forward rows in PathID order, counting the includers of each file.
+    forward_.offsets.reserve(rows + 1);
+    std::vector<std::uint32_t> counts(rows + 1, 0);
+    for(std::uint32_t id = 0; id < rows; ++id) {
+        forward_.offsets.push_back(static_cast<std::uint32_t>(forward_.values.size()));
+        if(!file_configs.contains(id)) {
+            continue;
+        }
+        for(auto flagged_id: get_all_includes(id)) {
+            forward_.values.push_back(flagged_id);
+            counts[(flagged_id & PATH_ID_MASK) + 1] += 1;
+        }
+    }
+    forward_.offsets.push_back(static_cast<std::uint32_t>(forward_.values.size()));
+
+    // Reverse rows by counting sort.  get_all_includes() lists a file once,
+    // so each includer appears once per row, and in PathID order.
+    for(std::uint32_t id = 0; id < rows; ++id) {
+        counts[id + 1] += counts[id];
+    }
+    reverse_.offsets = counts;
+    reverse_.values.resize(forward_.values.size());
+    for(std::uint32_t id = 0; id < rows; ++id) {
+        for(auto flagged_id: forward_.row(id)) {
+            reverse_.values[counts[flagged_id & PATH_ID_MASK]++] = id;
+        }
+    }
+}
+
+void DependencyGraph::patch_reverse_map() {
+    for(auto path_id: unpatched_) {
+        patch_rows(path_id);
+    }
+    unpatched_.clear();
+}
+
+DependencyGraph::IncludeChanges DependencyGraph::patch_rows(std::uint32_t path_id) {
+    auto targets = [&](llvm::ArrayRef<std::uint32_t> flagged_ids) {
+        llvm::SmallVector<std::uint32_t> ids;
+        for(auto id: flagged_ids) {
+            ids.push_back(id & PATH_ID_MASK);
+        }
+        llvm::sort(ids);
+        return ids;
+    };
+
+    // The packed row is what the reverse rows were built from.
+    IncludeChanges changes;
+    auto before = targets(forward_.row(path_id));
+    auto all = get_all_includes(path_id);
+    auto after = targets(all);
+
+    std::ranges::set_difference(after, before, std::back_inserter(changes.added));
+    std::ranges::set_difference(before, after, std::back_inserter(changes.removed));
+
+    // The packed rows stay; the ones changed go to the deltas.
+    forward_.edit(path_id).assign(all.begin(), all.end());
+    for(auto id: changes.added) {
+        auto& includers = reverse_.edit(id);
+        includers.insert(llvm::lower_bound(includers, path_id), path_id);
+    }
+    for(auto id: changes.removed) {
+        auto& includers = reverse_.edit(id);
+        if(auto pos = llvm::find(includers, path_id); pos != includers.end()) {
+            includers.erase(pos);
+        }
+    }
+    if(forward_.delta.size() > Adjacency::max_delta) {
+        forward_.compact();
+    }
+    if(reverse_.delta.size() > Adjacency::max_delta) {
+        reverse_.compact();
+    }
+    return changes;
+}
+
+DependencyGraph::IncludeChanges DependencyGraph::update_includes(
+    std::uint32_t path_id,
+    llvm::function_ref<llvm::SmallVector<std::uint32_t>(std::uint32_t config_id)> includes_of) {
+    auto fc_it = file_configs.find(path_id);
+    if(fc_it == file_configs.end()) {
+        return {};
+    }
+
+    for(auto config_id: fc_it->second) {
+        auto ids = includes_of(config_id);
+        includes[IncludeKey{path_id, config_id}] = std::move(ids);
+    }
+    unpatched_.erase(path_id);
+    auto changes = patch_rows(path_id);
+
+    // Edges out of a file that is no ancestor of a header leave its hosts
+    // alone, unless they make the file one: an added edge into an ancestor.
+    // A removed edge into an ancestor implies the file was one already.
+    if(!changes.added.empty() || !changes.removed.empty()) {
+        for(auto it = host_cache_.begin(); it != host_cache_.end();) {
+            auto current = it++;
+            auto& ancestors = current->second.ancestors;
+            if(ancestors.contains(path_id) ||
+               llvm::any_of(changes.added, [&](auto id) { return ancestors.contains(id); })) {
+                host_cache_.erase(current);
+            }
+        }
+        for(auto it = chain_cache_.begin(); it != chain_cache_.end();) {
+            auto current = it++;
+            if(current->second.visited.contains(path_id)) {
+                chain_cache_.erase(current);
             }
         }
     }
+    return changes;
 }
 
 llvm::ArrayRef<std::uint32_t> DependencyGraph::get_includers(std::uint32_t path_id) const {
-    auto it = reverse_includes_.find(path_id);
-    if(it != reverse_includes_.end()) {
-        return it->second;
-    }
-    return {};
+    return reverse_.row(path_id);
 }
 
-llvm::SmallVector<std::uint32_t, 4>
-    DependencyGraph::find_host_sources(std::uint32_t header_path_id) const {
-    llvm::SmallVector<std::uint32_t, 4> result;
-    llvm::DenseSet<std::uint32_t> visited;
+void DependencyGraph::search_hosts(std::uint32_t header,
+                                   std::size_t limit,
+                                   llvm::SmallVectorImpl<std::uint32_t>& hosts,
+                                   llvm::DenseSet<std::uint32_t>& visited) const {
     llvm::SmallVector<std::uint32_t, 16> queue;
 
-    queue.push_back(header_path_id);
-    visited.insert(header_path_id);
+    queue.push_back(header);
+    visited.insert(header);
 
-    while(!queue.empty()) {
+    while(!queue.empty() && hosts.size() < limit) {
         auto current = queue.pop_back_val();
         auto includers = get_includers(current);
         if(includers.empty()) {
             // No includers: this is a root (source file).
             // Exclude the starting header itself.
-            if(current != header_path_id) {
-                result.push_back(current);
+            if(current != header) {
+                hosts.push_back(current);
             }
             continue;
         }
@@ -146,7 +326,48 @@ llvm::SmallVector<std::uint32_t, 4>
             }
         }
     }
+}
+
+DependencyGraph::HostCache& DependencyGraph::host_cache(std::uint32_t header) const {
+    auto [it, inserted] = host_cache_.try_emplace(header);
+    if(inserted) {
+        auto& cache = it->second;
+        llvm::DenseSet<std::uint32_t> visited;
+        search_hosts(header, SIZE_MAX, cache.hosts, visited);
+        for(auto id: visited) {
+            cache.ancestors.add(id);
+        }
+        cache.host_set.addMany(cache.hosts.size(), cache.hosts.data());
+        cache.ancestors.runOptimize();
+        cache.host_set.runOptimize();
+    }
+    return it->second;
+}
+
+llvm::SmallVector<std::uint32_t, 4>
+    DependencyGraph::find_host_sources(std::uint32_t header_path_id) const {
+    return host_cache(header_path_id).hosts;
+}
+
+const Bitmap& DependencyGraph::host_set(std::uint32_t header_path_id) const {
+    return host_cache(header_path_id).host_set;
+}
+
+const Bitmap& DependencyGraph::dependents(std::uint32_t header_path_id) const {
+    return host_cache(header_path_id).ancestors;
+}
+
+llvm::SmallVector<std::uint32_t, 4>
+    DependencyGraph::find_host_sources(std::uint32_t header_path_id, std::size_t limit) const {
+    llvm::SmallVector<std::uint32_t, 4> result;
+    if(auto it = host_cache_.find(header_path_id); it != host_cache_.end()) {
+        auto& hosts = it->second.hosts;
+        result.append(hosts.begin(), hosts.begin() + std::min(limit, hosts.size()));
+        return result;
+    }
 
+    llvm::DenseSet<std::uint32_t> visited;
+    search_hosts(header_path_id, limit, result, visited);
     return result;
 }
 
@@ -156,6 +377,12 @@ std::vector<std::uint32_t> DependencyGraph::find_include_chain(std::uint32_t hos
         return {host_path_id};
     }
 
+    auto [cache_it, inserted] = chain_cache_.try_emplace({host_path_id, target_path_id});
+    auto& cache = cache_it->second;
+    if(!inserted) {
+        return cache.chain;
+    }
+
     // BFS: predecessor map for path reconstruction.
     llvm::DenseMap<std::uint32_t, std::uint32_t> prev;
     llvm::SmallVector<std::uint32_t, 16> queue;
@@ -167,8 +394,7 @@ std::vector<std::uint32_t> DependencyGraph::find_include_chain(std::uint32_t hos
     while(!queue.empty() && !found) {
         llvm::SmallVector<std::uint32_t, 16> next_queue;
         for(auto current: queue) {
-            auto includes_union = get_all_includes(current);
-            for(auto flagged_id: includes_union) {
+            for(auto flagged_id: forward_.row(current)) {
                 auto child = flagged_id & PATH_ID_MASK;
                 if(prev.find(child) == prev.end()) {
                     prev[child] = current;
@@ -186,6 +412,12 @@ std::vector<std::uint32_t> DependencyGraph::find_include_chain(std::uint32_t hos
         queue = std::move(next_queue);
     }
 
+    // Only edges out of the files the search reached could make a shorter
+    // chain, or one where there was none.
+    for(auto& entry: prev) {
+        cache.visited.insert(entry.first);
+    }
+
     if(!found) {
         return {};
     }
@@ -199,6 +431,7 @@ std::vector<std::uint32_t> DependencyGraph::find_include_chain(std::uint32_t hos
     }
     chain.push_back(host_path_id);
     std::reverse(chain.begin(), chain.end());
+    cache.chain = chain;
     return chain;
 }
 
@@ -212,7 +445,11 @@ struct FileScanResult {
     std::uint32_t path_id;
     std::uint32_t config_id;
     ScanResult scan_result;
+    ScanCache::FileStamp stamp;
     bool read_failed = false;
+    /// The file is unchanged since `cached`: scan_result is left empty and
+    /// the cached result applies.
+    bool reused = false;
     std::int64_t read_us = 0;
     std::int64_t scan_us = 0;
 };
@@ -220,13 +457,34 @@ struct FileScanResult {
 /// Scan a single file: read content + lexer scan.
 /// Runs on libuv worker thread via queue().
 /// @param path  Stable pointer from PathPool (must outlive the task).
-FileScanResult scan_file_worker(const char* path, std::uint32_t path_id, std::uint32_t config_id) {
+/// @param cached  Stamp of the cached scan of the file, if any.  A file
+///               whose size and mtime match it is not read; one whose
+///               content hash matches it is not lexed.
+FileScanResult scan_file_worker(const char* path,
+                                std::uint32_t path_id,
+                                std::uint32_t config_id,
+                                std::optional<ScanCache::FileStamp> cached) {
     FileScanResult result;
     result.path = path;
     result.path_id = path_id;
     result.config_id = config_id;
 
     auto t0 = std::chrono::steady_clock::now();
+    llvm::sys::fs::file_status status;
+    if(llvm::sys::fs::status(result.path, status)) {
+        result.read_failed = true;
+        return result;
+    }
+    result.stamp.size = status.getSize();
+    result.stamp.mtime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             status.getLastModificationTime().time_since_epoch())
+                             .count();
+    if(cached && cached->size == result.stamp.size && cached->mtime == result.stamp.mtime) {
+        result.stamp.hash = cached->hash;
+        result.reused = true;
+        return result;
+    }
+
     // Force read() instead of mmap: RequiresNullTerminator=true makes LLVM
     // fall back to read() for page-aligned files, and IsVolatile=true forces
     // read() unconditionally — bypassing mmap entirely.  This separates
@@ -244,20 +502,344 @@ FileScanResult scan_file_worker(const char* path, std::uint32_t path_id, std::ui
         return result;
     }
 
-    result.scan_result = scan((*buf)->getBuffer());
+    auto content = (*buf)->getBuffer();
+    result.stamp.size = content.size();
+    result.stamp.hash = llvm::xxh3_64bits(content);
+    if(cached && cached->size == result.stamp.size && cached->hash == result.stamp.hash) {
+        result.reused = true;
+        return result;
+    }
+
+    result.scan_result = scan(content);
     auto t2 = std::chrono::steady_clock::now();
     result.scan_us = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
 
     return result;
 }
 
+/// Listing of one directory, read on a worker thread.
+struct DirEntry {
+    std::string dir_path;
+    llvm::StringSet<> entries;
+    std::int64_t mtime = -1;
+    std::int64_t us = 0;
+};
+
+/// Start listing each of `dirs` on the thread pool, one task per directory,
+/// so that on a slow (network) filesystem the listings wait on the server
+/// side by side instead of one after another.
+std::vector<kota::task<DirEntry, kota::error>> queue_dir_listings(const llvm::StringSet<>& dirs,
+                                                                  kota::event_loop& loop) {
+    std::vector<kota::task<DirEntry, kota::error>> tasks;
+    tasks.reserve(dirs.size());
+    for(auto& entry: dirs) {
+        tasks.push_back(kota::queue(
+            [dir_path = entry.getKey().str()]() mutable -> DirEntry {
+                auto t0 = std::chrono::steady_clock::now();
+                DirEntry result{std::move(dir_path), {}, -1, 0};
+                result.entries = list_dir(result.dir_path, &result.mtime);
+                auto t1 = std::chrono::steady_clock::now();
+                result.us = std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count();
+                return result;
+            },
+            loop));
+    }
+    return tasks;
+}
+
+/// Move finished listings into `cache`, counting them as listings in
+/// `counters`.
+void add_dir_listings(std::vector<DirEntry>& listings,
+                      DirListingCache& cache,
+                      StatCounters& counters) {
+    for(auto& entry: listings) {
+        counters.dir_listings++;
+        counters.us += entry.us;
+        if(cache.dirs.try_emplace(entry.dir_path, std::move(entry.entries)).second) {
+            cache.mtimes.insert_or_assign(entry.dir_path, entry.mtime);
+        }
+    }
+}
+
+/// Key of an angled include in the include cache.  Resolution of those
+/// depends only on the search list, not on the includer's directory, so
+/// the key is a node of SearchChains: one shared by several configs
+/// answers for all of them.
+void include_cache_key(std::uint32_t chain_node,
+                       llvm::StringRef name,
+                       llvm::SmallVectorImpl<char>& key) {
+    key.clear();
+    auto bytes = reinterpret_cast<const char*>(&chain_node);
+    key.append(bytes, bytes + sizeof(std::uint32_t));
+    key.append(name.begin(), name.end());
+}
+
+/// Drop the include cache answers that searched a directory of `changed`,
+/// found or not: those of the chain nodes whose list has one of them, or a
+/// directory above one (the parent of a multi-component include).
+void invalidate_includes(const SearchChains& chains,
+                         llvm::ArrayRef<std::string> changed,
+                         llvm::StringMap<ScanCache::CachedInclude>& include_cache) {
+    auto changed_under = [&](llvm::StringRef dir) {
+        return llvm::any_of(changed, [&](llvm::StringRef path) {
+            return path.starts_with(dir) &&
+                   (path.size() == dir.size() || llvm::sys::path::is_separator(path[dir.size()]));
+        });
+    };
+
+    // Parents precede their children in `nodes`.
+    auto& nodes = chains.nodes;
+    std::vector<bool> stale(nodes.size(), false);
+    for(std::size_t node = 1; node < nodes.size(); ++node) {
+        stale[node] = stale[nodes[node].parent] || changed_under(nodes[node].dir);
+    }
+
+    for(auto it = include_cache.begin(); it != include_cache.end();) {
+        auto current = it++;
+        std::uint32_t node = 0;
+        auto key = current->getKey();
+        if(key.size() >= sizeof(node)) {
+            std::memcpy(&node, key.data(), sizeof(node));
+        }
+        if(node < stale.size() && stale[node]) {
+            include_cache.erase(current);
+        }
+    }
+}
+
+/// One include of a scanned file, resolved on a worker thread.  Paths are
+/// interned afterwards on the loop thread, so a resolution found in the
+/// shared include cache carries its path id and any other one its path.
+struct ResolvedInclude {
+    std::uint32_t path_id = UINT32_MAX;
+    std::string path;
+    unsigned found_dir_idx = 0;
+
+    /// Answered by the shared or the worker's own include cache.
+    bool cache_hit = false;
+
+    bool resolved() const {
+        return path_id != UINT32_MAX || !path.empty();
+    }
+};
+
+/// What one resolve_wave_chunk() call leaves to merge on the loop thread.
+struct ResolvedChunk {
+    DirListingCache dir_cache;
+    StatCounters counters;
+
+    /// Angled includes resolved by this chunk, keyed like the include
+    /// cache.  found_dir_idx counts from the config's angled_start_idx.
+    llvm::StringMap<ResolvedInclude> include_cache;
+};
+
+/// State the chunks of a wave share, only read while they run.
+struct WaveState {
+    const llvm::DenseMap<std::uint32_t, ResolvedSearchConfig>& configs;
+    const SearchChains& chains;
+    const llvm::DenseMap<std::uint32_t, std::uint32_t>& config_chains;
+    const DirListingCache& dir_cache;
+    const llvm::StringMap<ScanCache::CachedInclude>& include_cache;
+    const llvm::DenseMap<std::uint32_t, unsigned>& scanned_files;
+};
+
+/// Resolve the includes of `files` into `out`, one vector per file.  Runs on
+/// a worker thread alongside other chunks of the same wave: `state` is only
+/// read, and directories and angled includes it is missing go to caches of
+/// this chunk alone.
+ResolvedChunk resolve_wave_chunk(llvm::ArrayRef<FileScanResult> files,
+                                 llvm::MutableArrayRef<std::vector<ResolvedInclude>> out,
+                                 const WaveState& state) {
+    ResolvedChunk chunk;
+    chunk.dir_cache.shared = &state.dir_cache;
+    llvm::SmallString<80> cache_key;
+
+    // Where `name` falls within the list of `node`, if either cache knows;
+    // found_dir_idx of the answer counts from angled_start_idx.
+    auto lookup = [&](std::uint32_t node,
+                      llvm::StringRef name) -> std::optional<ResolvedInclude> {
+        include_cache_key(node, name, cache_key);
+        auto shared_it = state.include_cache.find(cache_key);
+        if(shared_it != state.include_cache.end()) {
+            return ResolvedInclude{shared_it->second.path_id, {}, shared_it->second.found_dir_idx};
+        }
+        auto local_it = chunk.include_cache.find(cache_key);
+        if(local_it != chunk.include_cache.end()) {
+            return local_it->second;
+        }
+        return std::nullopt;
+    };
+
+    for(std::size_t i = 0; i < files.size(); ++i) {
+        auto& file = files[i];
+        if(file.read_failed) {
+            continue;
+        }
+
+        auto rc_it = state.configs.find(file.config_id);
+        if(rc_it == state.configs.end()) {
+            continue;
+        }
+
+        auto& config = rc_it->second;
+        auto chain = state.config_chains.lookup(file.config_id);
+        auto includer_dir = llvm::sys::path::parent_path(file.path);
+        auto* includer_entries = resolve_dir(includer_dir, chunk.dir_cache, &chunk.counters);
+
+        // Look up the found_dir_idx for this file (stored when it was discovered).
+        unsigned includer_found_dir_idx = 0;
+        auto sf_it = state.scanned_files.find(file.path_id);
+        if(sf_it != state.scanned_files.end()) {
+            includer_found_dir_idx = sf_it->second;
+        }
+
+        auto& includes = out[i];
+        includes.resize(file.scan_result.includes.size());
+        for(std::size_t j = 0; j < includes.size(); ++j) {
+            auto& inc = file.scan_result.includes[j];
+            auto& result = includes[j];
+
+            if(!inc.is_angled || inc.is_include_next || llvm::sys::path::is_absolute(inc.path)) {
+                auto resolved = resolve_include(inc.path,
+                                                inc.is_angled,
+                                                includer_entries,
+                                                includer_dir,
+                                                inc.is_include_next,
+                                                includer_found_dir_idx,
+                                                config,
+                                                chunk.dir_cache,
+                                                &chunk.counters);
+                if(resolved.has_value()) {
+                    result.path = resolved->path.str();
+                    result.found_dir_idx = resolved->found_dir_idx;
+                }
+                continue;
+            }
+
+            if(auto answer = lookup(chain, inc.path)) {
+                if(!answer->resolved()) {
+                    chunk.counters.negative_hits++;
+                }
+                result = std::move(*answer);
+                result.found_dir_idx += config.angled_start_idx;
+                result.cache_hit = true;
+                continue;
+            }
+
+            // Walk up the prefixes this list shares with other configs.  An
+            // answer for one decides the include if it was found there, and
+            // otherwise leaves only the directories past it to search.
+            auto& nodes = state.chains.nodes;
+            std::optional<ResolvedInclude> answer;
+            std::uint32_t answered = 0;
+            std::uint32_t deepest_shared = 0;
+            for(auto node = nodes[chain].parent; node != 0; node = nodes[node].parent) {
+                if(nodes[node].users < 2) {
+                    continue;
+                }
+                if(deepest_shared == 0) {
+                    deepest_shared = node;
+                }
+                answer = lookup(node, inc.path);
+                if(answer) {
+                    answered = node;
+                    break;
+                }
+            }
+
+            ResolvedInclude found;
+            auto searched = nodes[answered].depth;
+            if(answer && answer->resolved()) {
+                found = std::move(*answer);
+                result.cache_hit = true;
+            } else {
+                // Searching from the first unanswered directory is
+                // #include_next from the one before it.
+                unsigned resume_after = searched ? config.angled_start_idx + searched - 1 : 0;
+                auto resolved = resolve_include(inc.path,
+                                                /*is_angled=*/true,
+                                                includer_entries,
+                                                includer_dir,
+                                                /*is_include_next=*/searched != 0,
+                                                resume_after,
+                                                config,
+                                                chunk.dir_cache,
+                                                &chunk.counters);
+                if(resolved.has_value()) {
+                    found.path = resolved->path.str();
+                    found.found_dir_idx = resolved->found_dir_idx - config.angled_start_idx;
+                }
+            }
+
+            include_cache_key(chain, inc.path, cache_key);
+            chunk.include_cache.try_emplace(cache_key, found);
+            if(deepest_shared != 0 && deepest_shared != answered) {
+                // Record the answer for the deepest shared prefix as well.
+                ResolvedInclude within;
+                if(found.resolved() && found.found_dir_idx < nodes[deepest_shared].depth) {
+                    within = found;
+                }
+                include_cache_key(deepest_shared, inc.path, cache_key);
+                chunk.include_cache.try_emplace(cache_key, std::move(within));
+            }
+
+            result.path_id = found.path_id;
+            result.path = std::move(found.path);
+            result.found_dir_idx = found.found_dir_idx + config.angled_start_idx;
+        }
+    }
+    return chunk;
+}
+
 /// The async scan implementation that runs on a local event loop.
+/// Add to `dirs` the directories resolving the includes of `files` would
+/// list that the shared dir cache lacks: the includers' own directories and
+/// what collect_include_dirs() guesses for each include the shared include
+/// cache does not answer.
+void collect_wave_dirs(llvm::ArrayRef<FileScanResult> files,
+                       const WaveState& state,
+                       llvm::StringSet<>& dirs) {
+    llvm::SmallString<80> cache_key;
+    for(auto& file: files) {
+        if(file.read_failed) {
+            continue;
+        }
+        auto rc_it = state.configs.find(file.config_id);
+        if(rc_it == state.configs.end()) {
+            continue;
+        }
+
+        auto chain = state.config_chains.lookup(file.config_id);
+        auto includer_dir = llvm::sys::path::parent_path(file.path);
+        auto* includer_entries = state.dir_cache.find(includer_dir);
+        if(!includer_entries && !includer_dir.empty()) {
+            dirs.insert(includer_dir);
+        }
+        for(auto& inc: file.scan_result.includes) {
+            if(inc.is_angled && !inc.is_include_next) {
+                include_cache_key(chain, inc.path, cache_key);
+                if(state.include_cache.contains(cache_key)) {
+                    continue;
+                }
+            }
+            collect_include_dirs(inc.path,
+                                 inc.is_angled,
+                                 includer_entries,
+                                 includer_dir,
+                                 rc_it->second,
+                                 state.dir_cache,
+                                 dirs);
+        }
+    }
+}
+
 kota::task<> scan_impl(CompilationDatabase& cdb,
                        Toolchain& toolchain,
                        PathPool& path_pool,
                        DependencyGraph& graph,
                        ScanReport& report,
                        ScanCache* ext_cache,
+                       const llvm::DenseSet<std::uint32_t>* sources,
                        kota::event_loop& loop,
                        const RuleMatcher& rule_matcher) {
     auto start_time = std::chrono::steady_clock::now();
@@ -279,6 +861,25 @@ kota::task<> scan_impl(CompilationDatabase& cdb,
     // Not cached — rebuilt on cold runs from CDB state which is cheap.
     llvm::SmallVector<CompilationDatabase::ConfigGroup> config_groups;
 
+    // Extract the SearchConfig of one group, returning the microseconds spent.
+    auto extract_config = [&](std::uint32_t config_id) -> std::int64_t {
+        auto& group = config_groups[config_id];
+        auto representative_path = llvm::StringRef(group.command.source_file);
+
+        // Apply per-file rules so that [[rules]]-modified -I/-isystem/-std
+        // flags are reflected in the search config used by the scan.
+        std::vector<std::string> rule_append, rule_remove;
+        if(rule_matcher)
+            rule_matcher(representative_path, rule_append, rule_remove);
+
+        auto t0 = std::chrono::steady_clock::now();
+        auto cmd = cdb.group_command(group, {.remove = rule_remove, .append = rule_append});
+        toolchain.resolve_or_warn(cmd);
+        configs[config_id] = extract_search_config(cmd.to_argv(), cmd.resolved.directory);
+        auto t1 = std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count();
+    };
+
     if(!have_config_cache) {
         // Ask CDB for unique compilation configs. Each ConfigGroup bundles:
         //   - file_ids:  all CDB path_ids sharing the same (dir, canonical, patch)
@@ -311,24 +912,28 @@ kota::task<> scan_impl(CompilationDatabase& cdb,
         // Toolchain is now warm, so resolve() hits cache.
         std::int64_t lookup_us = 0;
         for(std::uint32_t config_id = 0; config_id < config_groups.size(); ++config_id) {
-            auto& group = config_groups[config_id];
-            auto representative_path = llvm::StringRef(group.command.source_file);
-
-            // Apply per-file rules so that [[rules]]-modified -I/-isystem/-std
-            // flags are reflected in the search config used by the scan.
-            std::vector<std::string> rule_append, rule_remove;
-            if(rule_matcher)
-                rule_matcher(representative_path, rule_append, rule_remove);
-
-            auto t0 = std::chrono::steady_clock::now();
-            auto cmd = cdb.group_command(group, {.remove = rule_remove, .append = rule_append});
-            toolchain.resolve_or_warn(cmd);
-            configs[config_id] = extract_search_config(cmd.to_argv(), cmd.resolved.directory);
-            auto t1 = std::chrono::steady_clock::now();
-            lookup_us += std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count();
+            lookup_us += extract_config(config_id);
         }
         report.config_loop_ms = lookup_us / 1000;
         LOG_INFO("Config extracted: {} groups, {:.1f}ms", configs.size(), lookup_us / 1000.0);
+    } else if(!ext_cache->stale_configs.empty()) {
+        // A config reload dropped the groups whose rules changed; the CDB is
+        // the same, so its groups keep their ids.
+        config_groups = cdb.unique_configs();
+        std::int64_t lookup_us = 0;
+        for(auto config_id: ext_cache->stale_configs) {
+            if(config_id < config_groups.size()) {
+                lookup_us += extract_config(config_id);
+            }
+        }
+        report.config_loop_ms = lookup_us / 1000;
+        LOG_INFO("Config extracted again: {} of {} groups, {:.1f}ms",
+                 ext_cache->stale_configs.size(),
+                 configs.size(),
+                 lookup_us / 1000.0);
+    }
+    if(ext_cache) {
+        ext_cache->stale_configs.clear();
     }
 
     auto config_end = std::chrono::steady_clock::now();
@@ -343,74 +948,74 @@ kota::task<> scan_impl(CompilationDatabase& cdb,
     llvm::StringMap<ScanCache::CachedInclude>& include_cache =
         ext_cache ? ext_cache->include_cache : local_include_cache;
 
-    // Collect all unique search dirs and launch readdir tasks on the
-    // thread pool.  Tasks start executing immediately but are NOT awaited
-    // here — instead they run concurrently with Wave 0's file scanning
-    // (Optimization 1: overlap dir cache with Phase 1).  We only await
-    // them before Phase 2 of Wave 0, which is the first consumer.
-
-    struct DirEntry {
-        std::string dir_path;
-        llvm::StringSet<> entries;
-    };
+    // Listings kept from an earlier scan are checked against the directories'
+    // modification times; the include cache answers that searched a changed
+    // one go once the search chains are known.
+    std::vector<std::string> changed_dirs;
+    if(ext_cache) {
+        changed_dirs = dir_cache.refresh();
+        report.dirs_changed = changed_dirs.size();
+    }
 
+    // Collect all unique search dirs not listed yet and launch readdir
+    // tasks on the thread pool.  Tasks start executing immediately but are
+    // NOT awaited here — instead they run concurrently with Wave 0's file
+    // scanning (Optimization 1: overlap dir cache with Phase 1).  We only
+    // await them before Phase 2 of Wave 0, which is the first consumer.
     std::vector<kota::task<DirEntry, kota::error>> pending_dir_tasks;
-
-    if(dir_cache.dirs.empty()) {
+    {
         llvm::StringSet<> unique_dirs;
+        auto add = [&](llvm::StringRef dir) {
+            if(!dir.empty() && !dir_cache.find(dir)) {
+                unique_dirs.insert(dir);
+            }
+        };
         for(auto& [config_id, config]: configs) {
             for(auto& dir: config.dirs) {
-                unique_dirs.insert(dir.path);
+                add(dir.path);
             }
         }
-        // Also prefetch parent directories of source files (for quoted include resolution).
+        // Also prefetch parent directories of source files (for quoted include
+        // resolution).  A partial scan lists only those of its own sources;
+        // the rest are listed on demand by a later scan that reaches them.
         for(auto& entry: cdb.get_entries()) {
             auto file_path = cdb.resolve_path(entry.file);
-            auto dir = llvm::sys::path::parent_path(file_path);
-            if(!dir.empty()) {
-                unique_dirs.insert(dir);
+            if(sources) {
+                auto path_id = path_pool.find(file_path);
+                if(!path_id || !sources->contains(*path_id)) {
+                    continue;
+                }
             }
+            add(llvm::sys::path::parent_path(file_path));
         }
 
-        pending_dir_tasks.reserve(unique_dirs.size());
-        for(auto& entry: unique_dirs) {
-            auto dir_path = entry.getKey().str();
-            pending_dir_tasks.push_back(kota::queue(
-                [dir_path = std::move(dir_path)]() -> DirEntry {
-                    DirEntry result;
-                    result.dir_path = dir_path;
-                    std::error_code ec;
-                    llvm::sys::fs::directory_iterator di(result.dir_path, ec);
-                    for(; !ec && di != llvm::sys::fs::directory_iterator(); di.increment(ec)) {
-                        result.entries.insert(llvm::sys::path::filename(di->path()));
-                    }
-                    return result;
-                },
-                loop));
+        if(!unique_dirs.empty()) {
+            pending_dir_tasks = queue_dir_listings(unique_dirs, loop);
+            LOG_INFO("Launched {} dir cache tasks (running in background)",
+                     pending_dir_tasks.size());
         }
-        LOG_INFO("Launched {} dir cache tasks (running in background)", pending_dir_tasks.size());
     }
 
     // Track which files have been scanned (by path_id — cheaper than string hash).
     // Value: found_dir_idx needed for #include_next.
     llvm::DenseMap<std::uint32_t, unsigned> scanned_files;
 
-    // Wave 0: all source files from CDB.
+    // Directives of the headers the scan_module_decl() fallbacks below
+    // preprocess, shared by all of them.  Only used on the loop thread.
+    SharedScanCache module_decl_cache;
+
+    // Wave 0: all source files from CDB, or those of them in `sources`.
     // Re-use the cached initial_wave when available; otherwise build from
     // config_groups, converting CDB path_ids → PathPool path_ids.
     std::vector<WaveEntry> current_wave;
     if(have_config_cache) {
         current_wave = ext_cache->initial_wave;
-        for(auto& entry: current_wave) {
-            scanned_files.try_emplace(entry.path_id, entry.found_dir_idx);
-        }
     } else {
         current_wave.reserve(cdb.get_entries().size());
         for(std::uint32_t config_id = 0; config_id < config_groups.size(); ++config_id) {
             for(auto cdb_file_id: config_groups[config_id].file_ids) {
                 auto file_path = cdb.resolve_path(cdb_file_id);
                 auto pool_id = path_pool.intern(file_path);
-                scanned_files.try_emplace(pool_id, 0u);
                 current_wave.push_back({pool_id, config_id, /*found_dir_idx=*/0});
             }
         }
@@ -418,6 +1023,13 @@ kota::task<> scan_impl(CompilationDatabase& cdb,
             ext_cache->initial_wave = current_wave;
         }
     }
+    if(sources) {
+        std::erase_if(current_wave,
+                      [&](const WaveEntry& entry) { return !sources->contains(entry.path_id); });
+    }
+    for(auto& entry: current_wave) {
+        scanned_files.try_emplace(entry.path_id, entry.found_dir_idx);
+    }
 
     report.source_files = current_wave.size();
     std::size_t wave_num = 0;
@@ -429,101 +1041,97 @@ kota::task<> scan_impl(CompilationDatabase& cdb,
     // of the Phase 1 wait time for subsequent waves.
     std::vector<kota::task<FileScanResult, kota::error>> prefetch_tasks;
 
+    // Queue the scan of a file, passing along the stamp of its cached scan.
+    auto queue_scan = [&](std::uint32_t path_id, std::uint32_t config_id) {
+        std::optional<ScanCache::FileStamp> stamp;
+        if(ext_cache) {
+            auto it = ext_cache->scan_results.find(path_id);
+            if(it != ext_cache->scan_results.end()) {
+                stamp = it->second.stamp;
+            }
+        }
+        auto path = path_pool.resolve(path_id).data();
+        return kota::queue(
+            [path, path_id, config_id, stamp]() {
+                return scan_file_worker(path, path_id, config_id, stamp);
+            },
+            loop);
+    };
+
     // Pre-resolved search configs: built once after dir cache is populated,
     // then reused for all waves.  Eliminates StringMap lookups in Phase 2.
     llvm::DenseMap<std::uint32_t, ResolvedSearchConfig> resolved_configs;
 
+    // Angled search lists of the configs as prefix chains, and the chain
+    // node of each config: the include cache is keyed by these.
+    SearchChains search_chains;
+    llvm::DenseMap<std::uint32_t, std::uint32_t> config_chains;
+
     while(!current_wave.empty()) {
         auto wave_start = std::chrono::steady_clock::now();
 
         // Phase 1: Read + scan all files in parallel on the thread pool.
-        // Files with a cached ScanResult skip I/O and lexing entirely.
+        // Files with a cached ScanResult are only stat'ed, and unless their
+        // size or mtime changed neither read nor lexed.
         // For waves > 0, files discovered during the previous wave's Phase 2
         // already have running scan tasks in prefetch_tasks.
         std::vector<FileScanResult> scan_results;
         scan_results.reserve(current_wave.size());
         std::size_t wave_cache_hits = 0;
 
-        // Collect cache hits first (applies to all waves).
-        for(auto& entry: current_wave) {
-            if(ext_cache) {
-                auto it = ext_cache->scan_results.find(entry.path_id);
-                if(it != ext_cache->scan_results.end()) {
-                    scan_results.push_back({path_pool.resolve(entry.path_id).data(),
-                                            entry.path_id,
-                                            entry.config_id,
-                                            it->second,
-                                            false,
-                                            0,
-                                            0});
-                    report.scan_cache_hits++;
-                    wave_cache_hits++;
-                }
-            }
-        }
-
+        std::vector<kota::task<FileScanResult, kota::error>> scan_tasks;
         if(!prefetch_tasks.empty()) {
             // Waves 1+: await prefetched scan tasks from previous Phase 2.
-            auto scan_outcome = co_await kota::when_all(std::move(prefetch_tasks));
+            scan_tasks = std::move(prefetch_tasks);
             prefetch_tasks.clear();
-            if(scan_outcome.has_error()) {
-                LOG_ERROR("Prefetch scan failed: {}", scan_outcome.error().message());
-                break;
-            }
-            for(auto& r: *scan_outcome) {
-                if(!r.read_failed && ext_cache) {
-                    ext_cache->scan_results.try_emplace(r.path_id, r.scan_result);
-                }
-                scan_results.push_back(std::move(r));
-            }
         } else {
-            // Wave 0 (or warm run with all cache hits): create scan tasks now.
-            std::vector<kota::task<FileScanResult, kota::error>> scan_tasks;
+            // Wave 0: create scan tasks now.
             scan_tasks.reserve(current_wave.size());
             for(auto& entry: current_wave) {
-                auto pid = entry.path_id;
-                auto cid = entry.config_id;
-                // Skip files already served from cache above.
-                if(ext_cache && ext_cache->scan_results.count(pid)) {
-                    continue;
-                }
-                auto path = path_pool.resolve(pid).data();
-                scan_tasks.push_back(
-                    kota::queue([path, pid, cid]() { return scan_file_worker(path, pid, cid); },
-                                loop));
-            }
-
-            // Optimization 1: await dir cache tasks concurrently with scan tasks.
-            // Both sets of tasks run on the same thread pool.  By awaiting dir
-            // tasks first (while scan tasks continue in the background), we pay
-            // max(dir_time, scan_time) instead of dir_time + scan_time.
-            if(!pending_dir_tasks.empty()) {
-                auto dir_t0 = std::chrono::steady_clock::now();
-                auto dir_outcome = co_await kota::when_all(std::move(pending_dir_tasks));
-                pending_dir_tasks.clear();
-                if(dir_outcome.has_value()) {
-                    for(auto& entry: *dir_outcome) {
-                        dir_cache.dirs.try_emplace(entry.dir_path, std::move(entry.entries));
-                    }
-                    LOG_INFO("Pre-populated dir cache: {} directories", dir_outcome->size());
-                }
-                auto dir_t1 = std::chrono::steady_clock::now();
-                report.dir_cache_ms =
-                    std::chrono::duration_cast<std::chrono::milliseconds>(dir_t1 - dir_t0).count();
+                scan_tasks.push_back(queue_scan(entry.path_id, entry.config_id));
             }
+        }
 
-            if(!scan_tasks.empty()) {
-                auto scan_outcome = co_await kota::when_all(std::move(scan_tasks));
-                if(scan_outcome.has_error()) {
-                    LOG_ERROR("Parallel scan failed: {}", scan_outcome.error().message());
-                    break;
-                }
-                for(auto& r: *scan_outcome) {
-                    if(!r.read_failed && ext_cache) {
-                        ext_cache->scan_results.try_emplace(r.path_id, r.scan_result);
-                    }
-                    scan_results.push_back(std::move(r));
+        // Optimization 1: await dir cache tasks concurrently with scan tasks.
+        // Both sets of tasks run on the same thread pool.  By awaiting dir
+        // tasks first (while scan tasks continue in the background), we pay
+        // max(dir_time, scan_time) instead of dir_time + scan_time.
+        if(!pending_dir_tasks.empty()) {
+            auto dir_t0 = std::chrono::steady_clock::now();
+            auto dir_outcome = co_await kota::when_all(std::move(pending_dir_tasks));
+            pending_dir_tasks.clear();
+            if(dir_outcome.has_value()) {
+                StatCounters prefetch_counters;
+                add_dir_listings(*dir_outcome, dir_cache, prefetch_counters);
+                report.dir_listings += prefetch_counters.dir_listings;
+                report.fs_us += prefetch_counters.us;
+                LOG_INFO("Pre-populated dir cache: {} directories", dir_outcome->size());
+            }
+            auto dir_t1 = std::chrono::steady_clock::now();
+            report.dir_cache_ms =
+                std::chrono::duration_cast<std::chrono::milliseconds>(dir_t1 - dir_t0).count();
+        }
+
+        if(!scan_tasks.empty()) {
+            auto scan_outcome = co_await kota::when_all(std::move(scan_tasks));
+            if(scan_outcome.has_error()) {
+                LOG_ERROR("Parallel scan failed: {}", scan_outcome.error().message());
+                break;
+            }
+            for(auto& r: *scan_outcome) {
+                if(r.reused) {
+                    // Unchanged since cached; a read may have refreshed the stamp.
+                    auto& cached = ext_cache->scan_results[r.path_id];
+                    cached.stamp = r.stamp;
+                    r.scan_result = cached.result;
+                    report.scan_cache_hits++;
+                    wave_cache_hits++;
+                } else if(ext_cache && r.read_failed) {
+                    ext_cache->scan_results.erase(r.path_id);
+                } else if(ext_cache) {
+                    ext_cache->scan_results[r.path_id] = {r.stamp, r.scan_result};
                 }
+                scan_results.push_back(std::move(r));
             }
         }
 
@@ -541,18 +1149,130 @@ kota::task<> scan_impl(CompilationDatabase& cdb,
             for(auto& [config_id, config]: configs) {
                 resolved_configs[config_id] = resolve_search_config(config, dir_cache);
             }
+
+            // Intern in config_id order so that node ids, and with them the
+            // keys of a persistent include cache, are the same on every scan.
+            llvm::SmallVector<std::uint32_t> config_ids;
+            for(auto& entry: configs) {
+                config_ids.push_back(entry.first);
+            }
+            llvm::sort(config_ids);
+            for(auto config_id: config_ids) {
+                config_chains[config_id] = search_chains.intern(configs[config_id]);
+            }
+            if(!changed_dirs.empty()) {
+                invalidate_includes(search_chains, changed_dirs, include_cache);
+            }
+        }
+
+        // Phase 2: Resolve includes in parallel.  The wave is split into one
+        // contiguous chunk per worker thread; every chunk reads the shared
+        // dir and include caches, which stay frozen until all chunks are done,
+        // and collects what they are missing in caches of its own.
+        std::vector<std::vector<ResolvedInclude>> wave_includes(scan_results.size());
+        std::vector<ResolvedChunk> chunks;
+        StatCounters wave_stat_counters;
+        {
+            auto r_t0 = std::chrono::steady_clock::now();
+            llvm::ArrayRef<FileScanResult> files = scan_results;
+            llvm::MutableArrayRef<std::vector<ResolvedInclude>> out = wave_includes;
+
+            // Small waves are not worth the round trip through the pool.
+            constexpr std::size_t min_chunk_files = 64;
+            std::size_t chunk_count = std::max(1u, std::thread::hardware_concurrency());
+            chunk_count = std::min(chunk_count, files.size() / min_chunk_files);
+
+            WaveState state{resolved_configs,
+                            search_chains,
+                            config_chains,
+                            dir_cache,
+                            include_cache,
+                            scanned_files};
+
+            // List every directory the chunks would miss up front, all at
+            // once, rather than one readdir() after another inside them.
+            llvm::StringSet<> missing_dirs;
+            collect_wave_dirs(files, state, missing_dirs);
+            if(!missing_dirs.empty()) {
+                auto dir_outcome = co_await kota::when_all(queue_dir_listings(missing_dirs, loop));
+                if(dir_outcome.has_value()) {
+                    add_dir_listings(*dir_outcome, dir_cache, wave_stat_counters);
+                }
+            }
+
+            if(chunk_count <= 1) {
+                chunks.push_back(resolve_wave_chunk(files, out, state));
+            } else {
+                std::vector<kota::task<ResolvedChunk, kota::error>> resolve_tasks;
+                resolve_tasks.reserve(chunk_count);
+                auto chunk_size = (files.size() + chunk_count - 1) / chunk_count;
+                for(std::size_t begin = 0; begin < files.size(); begin += chunk_size) {
+                    auto size = std::min(chunk_size, files.size() - begin);
+                    resolve_tasks.push_back(kota::queue(
+                        [files = files.slice(begin, size), out = out.slice(begin, size), &state]() {
+                            return resolve_wave_chunk(files, out, state);
+                        },
+                        loop));
+                }
+                auto resolve_outcome = co_await kota::when_all(std::move(resolve_tasks));
+                if(resolve_outcome.has_error()) {
+                    LOG_ERROR("Parallel include resolution failed: {}",
+                              resolve_outcome.error().message());
+                    break;
+                }
+                chunks = std::move(*resolve_outcome);
+            }
+
+            for(auto& chunk: chunks) {
+                dir_cache.merge(std::move(chunk.dir_cache));
+                wave_stat_counters.dir_listings += chunk.counters.dir_listings;
+                wave_stat_counters.dir_hits += chunk.counters.dir_hits;
+                wave_stat_counters.lookups += chunk.counters.lookups;
+                wave_stat_counters.negative_hits += chunk.counters.negative_hits;
+                wave_stat_counters.us += chunk.counters.us;
+            }
+
+            auto r_t1 = std::chrono::steady_clock::now();
+            report.p2_resolve_us +=
+                std::chrono::duration_cast<std::chrono::microseconds>(r_t1 - r_t0).count();
         }
 
-        // Phase 2+3: Resolve includes, intern paths, build graph, collect next wave.
-        // Merged into a single pass to avoid intermediate string allocations.
+        // Phase 3: Intern resolved paths, build graph, collect next wave.
+        // Serial on the loop thread, in scan order, so path ids and the
+        // graph do not depend on how the wave was split.
         // Optimization 2: newly discovered files are immediately queued for
         // scanning (prefetch_tasks), overlapping Phase 1 of the next wave
-        // with Phase 2 of the current wave.
+        // with the rest of this one.
         std::vector<WaveEntry> next_wave;
         next_wave.reserve(current_wave.size());  // Heuristic: next wave ≤ current wave.
-        StatCounters wave_stat_counters;
 
-        for(auto& scan_result: scan_results) {
+        // The wave's new include targets are interned in one call, in the
+        // order the loop below visits them.
+        std::vector<ResolvedInclude*> unnumbered;
+        for(std::size_t file_idx = 0; file_idx < scan_results.size(); ++file_idx) {
+            auto& scan_result = scan_results[file_idx];
+            if(scan_result.read_failed || !resolved_configs.contains(scan_result.config_id))
+                continue;
+            for(auto& resolved: wave_includes[file_idx]) {
+                if(resolved.path_id == UINT32_MAX && resolved.resolved())
+                    unnumbered.push_back(&resolved);
+            }
+        }
+        if(!unnumbered.empty()) {
+            std::vector<llvm::StringRef> paths;
+            paths.reserve(unnumbered.size());
+            for(auto* resolved: unnumbered) {
+                paths.push_back(resolved->path);
+            }
+            std::vector<std::uint32_t> ids(paths.size());
+            path_pool.intern_all(paths, ids);
+            for(std::size_t i = 0; i < unnumbered.size(); ++i) {
+                unnumbered[i]->path_id = ids[i];
+            }
+        }
+
+        for(std::size_t file_idx = 0; file_idx < scan_results.size(); ++file_idx) {
+            auto& scan_result = scan_results[file_idx];
             report.total_files++;
 
             if(scan_result.read_failed) {
@@ -560,36 +1280,39 @@ kota::task<> scan_impl(CompilationDatabase& cdb,
                 continue;
             }
 
-            auto rc_it = resolved_configs.find(scan_result.config_id);
-            if(rc_it == resolved_configs.end()) {
+            if(!resolved_configs.contains(scan_result.config_id)) {
                 continue;
             }
 
-            auto& resolved_config = rc_it->second;
-            auto includer_dir = llvm::sys::path::parent_path(scan_result.path);
-            auto* includer_entries = resolve_dir(includer_dir, dir_cache, &wave_stat_counters);
-
-            // Look up the found_dir_idx for this file (stored when it was discovered).
-            unsigned includer_found_dir_idx = 0;
-            auto sf_it = scanned_files.find(scan_result.path_id);
-            if(sf_it != scanned_files.end()) {
-                includer_found_dir_idx = sf_it->second;
-            }
-
             // Record module interface unit mapping.
             // When the module declaration is inside a conditional directive
-            // (need_preprocess=true), fall back to scan_module_decl() which
-            // runs a lightweight preprocessor pass to resolve the actual
-            // module name. This only applies to source files (wave 0) since
-            // headers cannot contain module declarations.
+            // (need_preprocess=true), evaluate the conditionals with the
+            // command line's macros first, and only when they depend on
+            // something else fall back to scan_module_decl(), which runs a
+            // lightweight preprocessor pass to resolve the actual module
+            // name. This only applies to source files (wave 0) since headers
+            // cannot contain module declarations.
             if(scan_result.scan_result.need_preprocess && wave_num == 0) {
                 auto file_path = llvm::StringRef(scan_result.path);
                 auto contexts = cdb.lookup(file_path);
                 if(!contexts.empty()) {
                     toolchain.resolve_or_warn(contexts[0]);
                     auto& cmd = contexts[0];
-                    auto fallback =
-                        scan_module_decl(cmd.to_argv(), cmd.resolved.directory, /*content=*/{});
+                    auto argv = cmd.to_argv();
+                    std::optional<ScanResult> decided;
+                    if(auto buffer = llvm::MemoryBuffer::getFile(file_path)) {
+                        decided = evaluate_module_decl((*buffer)->getBuffer(), argv);
+                    }
+                    if(decided) {
+                        report.module_decls_evaluated++;
+                    } else {
+                        report.module_decl_fallbacks++;
+                        decided = scan_module_decl(argv,
+                                                   cmd.resolved.directory,
+                                                   {},
+                                                   &module_decl_cache);
+                    }
+                    auto& fallback = *decided;
                     if(!fallback.module_name.empty()) {
                         scan_result.scan_result.module_name = std::move(fallback.module_name);
                         scan_result.scan_result.is_interface_unit = fallback.is_interface_unit;
@@ -597,10 +1320,11 @@ kota::task<> scan_impl(CompilationDatabase& cdb,
                         if(ext_cache) {
                             auto cache_it = ext_cache->scan_results.find(scan_result.path_id);
                             if(cache_it != ext_cache->scan_results.end()) {
-                                cache_it->second.module_name = scan_result.scan_result.module_name;
-                                cache_it->second.is_interface_unit =
+                                auto& cached = cache_it->second.result;
+                                cached.module_name = scan_result.scan_result.module_name;
+                                cached.is_interface_unit =
                                     scan_result.scan_result.is_interface_unit;
-                                cache_it->second.need_preprocess = false;
+                                cached.need_preprocess = false;
                             }
                         }
                     }
@@ -609,6 +1333,8 @@ kota::task<> scan_impl(CompilationDatabase& cdb,
 
             if(scan_result.scan_result.is_interface_unit) {
                 graph.add_module(scan_result.scan_result.module_name, scan_result.path_id);
+                report.interface_units.emplace_back(scan_result.path_id,
+                                                    scan_result.scan_result.module_name);
             }
 
             report.includes_found += scan_result.scan_result.includes.size();
@@ -616,67 +1342,20 @@ kota::task<> scan_impl(CompilationDatabase& cdb,
             llvm::SmallVector<std::uint32_t> include_ids;
             include_ids.reserve(scan_result.scan_result.includes.size());
 
-            for(auto& inc: scan_result.scan_result.includes) {
-                // For angled includes, resolution depends only on config (not includer dir).
-                // Cache these to skip redundant directory searches across files.
-                bool cache_eligible = inc.is_angled && !inc.is_include_next;
-                llvm::SmallString<80> cache_key;
-                if(cache_eligible) {
-                    cache_key.append(reinterpret_cast<const char*>(&scan_result.config_id),
-                                     reinterpret_cast<const char*>(&scan_result.config_id) +
-                                         sizeof(std::uint32_t));
-                    cache_key += inc.path;
-
-                    auto cache_it = include_cache.find(cache_key);
-                    if(cache_it != include_cache.end()) {
-                        report.include_cache_hits++;
-                        auto& cached = cache_it->second;
-                        if(cached.path_id == UINT32_MAX) {
-                            report.unresolved.push_back({
-                                std::move(inc.path),
-                                std::string(path_pool.resolve(scan_result.path_id)),
-                                inc.is_angled,
-                                inc.conditional,
-                            });
-                            continue;
-                        }
-                        report.includes_resolved++;
-                        // Jump directly to edge building with cached path_id.
-                        std::uint32_t flagged_id = cached.path_id;
-                        if(inc.conditional) {
-                            flagged_id |= DependencyGraph::CONDITIONAL_FLAG;
-                            report.conditional_edges++;
-                        } else {
-                            report.unconditional_edges++;
-                        }
-                        report.total_edges++;
-                        include_ids.push_back(flagged_id);
-                        if(scanned_files.try_emplace(cached.path_id, cached.found_dir_idx).second) {
-                            next_wave.push_back(
-                                {cached.path_id, scan_result.config_id, cached.found_dir_idx});
-                        }
-                        continue;
-                    }
+            auto& resolved_includes = wave_includes[file_idx];
+            for(std::size_t inc_idx = 0; inc_idx < resolved_includes.size(); ++inc_idx) {
+                auto& inc = scan_result.scan_result.includes[inc_idx];
+                auto& resolved = resolved_includes[inc_idx];
+                if(resolved.cache_hit) {
+                    report.include_cache_hits++;
                 }
 
-                auto r_t0 = std::chrono::steady_clock::now();
-                auto resolved = resolve_include(inc.path,
-                                                inc.is_angled,
-                                                includer_entries,
-                                                includer_dir,
-                                                inc.is_include_next,
-                                                includer_found_dir_idx,
-                                                resolved_config,
-                                                dir_cache,
-                                                &wave_stat_counters);
-                auto r_t1 = std::chrono::steady_clock::now();
-                report.p2_resolve_us +=
-                    std::chrono::duration_cast<std::chrono::microseconds>(r_t1 - r_t0).count();
-                if(!resolved.has_value()) {
-                    if(cache_eligible) {
-                        include_cache.try_emplace(cache_key,
-                                                  ScanCache::CachedInclude{UINT32_MAX, 0});
-                    }
+                std::uint32_t inc_path_id = resolved.path_id;
+                if(inc_path_id == UINT32_MAX && resolved.resolved()) {
+                    inc_path_id = path_pool.intern(resolved.path);
+                }
+
+                if(inc_path_id == UINT32_MAX) {
                     report.unresolved.push_back({
                         std::move(inc.path),
                         std::string(path_pool.resolve(scan_result.path_id)),
@@ -686,15 +1365,8 @@ kota::task<> scan_impl(CompilationDatabase& cdb,
                     continue;
                 }
 
-                auto inc_path_id = path_pool.intern(resolved->path);
                 report.includes_resolved++;
 
-                if(cache_eligible) {
-                    include_cache.try_emplace(
-                        cache_key,
-                        ScanCache::CachedInclude{inc_path_id, resolved->found_dir_idx});
-                }
-
                 std::uint32_t flagged_id = inc_path_id;
                 if(inc.conditional) {
                     flagged_id |= DependencyGraph::CONDITIONAL_FLAG;
@@ -705,29 +1377,38 @@ kota::task<> scan_impl(CompilationDatabase& cdb,
                 report.total_edges++;
                 include_ids.push_back(flagged_id);
 
-                if(scanned_files.try_emplace(inc_path_id, resolved->found_dir_idx).second) {
+                if(scanned_files.try_emplace(inc_path_id, resolved.found_dir_idx).second) {
                     next_wave.push_back(
-                        {inc_path_id, scan_result.config_id, resolved->found_dir_idx});
+                        {inc_path_id, scan_result.config_id, resolved.found_dir_idx});
                     // Prefetch: start scanning this file immediately on the
                     // thread pool so it's ready when the next wave begins.
-                    if(!ext_cache ||
-                       ext_cache->scan_results.find(inc_path_id) == ext_cache->scan_results.end()) {
-                        auto inc_path = path_pool.resolve(inc_path_id).data();
-                        prefetch_tasks.push_back(kota::queue(
-                            [inc_path, inc_path_id, cid = scan_result.config_id]() {
-                                return scan_file_worker(inc_path, inc_path_id, cid);
-                            },
-                            loop));
-                    }
+                    prefetch_tasks.push_back(queue_scan(inc_path_id, scan_result.config_id));
                 }
             }
 
             graph.set_includes(scan_result.path_id, scan_result.config_id, std::move(include_ids));
         }
 
+        // Keep what the chunks resolved for angled includes for the next
+        // waves; unresolved ones are cached as UINT32_MAX.  Every path found
+        // was interned above, so this does not add ids.
+        for(auto& chunk: chunks) {
+            for(auto& entry: chunk.include_cache) {
+                auto& resolved = entry.getValue();
+                auto path_id = resolved.path_id;
+                if(path_id == UINT32_MAX && resolved.resolved()) {
+                    path_id = path_pool.intern(resolved.path);
+                }
+                include_cache.try_emplace(
+                    entry.getKey(),
+                    ScanCache::CachedInclude{path_id, resolved.found_dir_idx});
+            }
+        }
+
         report.dir_listings += wave_stat_counters.dir_listings;
         report.dir_hits += wave_stat_counters.dir_hits;
         report.fs_lookups += wave_stat_counters.lookups;
+        report.include_negative_hits += wave_stat_counters.negative_hits;
         report.fs_us += wave_stat_counters.us;
 
         auto phase2_end = std::chrono::steady_clock::now();
@@ -794,9 +1475,394 @@ ScanReport scan_dependency_graph(CompilationDatabase& cdb,
     }
 
     kota::event_loop loop;
-    loop.schedule(scan_impl(cdb, toolchain, path_pool, graph, report, cache, loop, rule_matcher));
+    loop.schedule(
+        scan_impl(cdb, toolchain, path_pool, graph, report, cache, nullptr, loop, rule_matcher));
     loop.run();
     return report;
 }
 
+ScanReport scan_dependency_sources(CompilationDatabase& cdb,
+                                   Toolchain& toolchain,
+                                   PathPool& path_pool,
+                                   DependencyGraph& graph,
+                                   ScanCache& cache,
+                                   llvm::ArrayRef<std::uint32_t> sources,
+                                   const RuleMatcher& rule_matcher) {
+    ScanReport report;
+    if(cdb.get_entries().empty() || sources.empty()) {
+        return report;
+    }
+
+    llvm::DenseSet<std::uint32_t> selected(sources.begin(), sources.end());
+    kota::event_loop loop;
+    loop.schedule(
+        scan_impl(cdb, toolchain, path_pool, graph, report, &cache, &selected, loop, rule_matcher));
+    loop.run();
+    return report;
+}
+
+kota::task<ScanReport> scan_dependency_sources_async(CompilationDatabase& cdb,
+                                                     Toolchain& toolchain,
+                                                     PathPool& path_pool,
+                                                     DependencyGraph& graph,
+                                                     ScanCache& cache,
+                                                     std::vector<std::uint32_t> sources,
+                                                     kota::event_loop& loop,
+                                                     RuleMatcher rule_matcher) {
+    ScanReport report;
+    if(cdb.get_entries().empty() || sources.empty()) {
+        co_return report;
+    }
+
+    llvm::DenseSet<std::uint32_t> selected(sources.begin(), sources.end());
+    co_await scan_impl(cdb,
+                       toolchain,
+                       path_pool,
+                       graph,
+                       report,
+                       &cache,
+                       &selected,
+                       loop,
+                       rule_matcher);
+    co_return report;
+}
+
+DependencyGraph::IncludeChanges update_file_includes(DependencyGraph& graph,
+                                                     PathPool& path_pool,
+                                                     ScanCache& cache,
+                                                     std::uint32_t path_id,
+                                                     const ScanResult& result) {
+    auto includer_dir = llvm::sys::path::parent_path(path_pool.resolve(path_id));
+    cache.dir_cache.dirs.erase(includer_dir);
+
+    // The search dir a file was found in is not kept past the scan, so an
+    // #include_next in it searches from the start.
+    auto resolve_includes = [&](std::uint32_t includer,
+                                const ScanResult& scanned,
+                                const ResolvedSearchConfig& config) {
+        auto dir = llvm::sys::path::parent_path(path_pool.resolve(includer));
+        auto* entries = resolve_dir(dir, cache.dir_cache);
+        llvm::SmallVector<std::uint32_t> ids;
+        for(auto& inc: scanned.includes) {
+            auto resolved = resolve_include(inc.path,
+                                            inc.is_angled,
+                                            entries,
+                                            dir,
+                                            inc.is_include_next,
+                                            /*found_dir_idx=*/0,
+                                            config,
+                                            cache.dir_cache);
+            if(!resolved) {
+                continue;
+            }
+            auto id = path_pool.intern(resolved->path);
+            ids.push_back(inc.conditional ? id | DependencyGraph::CONDITIONAL_FLAG : id);
+        }
+        return ids;
+    };
+
+    llvm::DenseMap<std::uint32_t, ResolvedSearchConfig> resolved_configs;
+    llvm::SmallVector<std::pair<std::uint32_t, std::uint32_t>> unscanned;
+    auto changes = graph.update_includes(path_id, [&](std::uint32_t config_id) {
+        // A config the cache does not know keeps the edges it had.
+        auto old_ids = graph.get_includes(path_id, config_id);
+        auto config = cache.configs.find(config_id);
+        if(config == cache.configs.end()) {
+            return llvm::SmallVector<std::uint32_t>(old_ids.begin(), old_ids.end());
+        }
+
+        auto& resolved_config = resolved_configs[config_id];
+        resolved_config = resolve_search_config(config->second, cache.dir_cache);
+        auto ids = resolve_includes(path_id, result, resolved_config);
+        for(auto id: ids) {
+            unscanned.emplace_back(id & ~DependencyGraph::CONDITIONAL_FLAG, config_id);
+        }
+        return ids;
+    });
+
+    // Headers the scan never reached, like one the file includes for the
+    // first time, are scanned here, and so are the new headers they include.
+    bool scanned_any = false;
+    while(!unscanned.empty()) {
+        auto [id, config_id] = unscanned.pop_back_val();
+        if(graph.has_includes(id, config_id)) {
+            continue;
+        }
+
+        std::optional<ScanCache::FileStamp> stamp;
+        auto cached = cache.scan_results.find(id);
+        if(cached != cache.scan_results.end()) {
+            stamp = cached->second.stamp;
+        }
+        auto scanned = scan_file_worker(path_pool.resolve(id).data(), id, config_id, stamp);
+        if(scanned.read_failed) {
+            cache.scan_results.erase(id);
+            continue;
+        }
+        auto& entry = cache.scan_results[id];
+        entry.stamp = scanned.stamp;
+        if(!scanned.reused) {
+            entry.result = std::move(scanned.scan_result);
+        }
+
+        auto ids = resolve_includes(id, entry.result, resolved_configs[config_id]);
+        for(auto included: ids) {
+            unscanned.emplace_back(included & ~DependencyGraph::CONDITIONAL_FLAG, config_id);
+        }
+        graph.set_includes(id, config_id, std::move(ids));
+        scanned_any = true;
+    }
+    if(scanned_any) {
+        graph.patch_reverse_map();
+    }
+    return changes;
+}
+
+namespace {
+
+struct SnapshotConfig {
+    std::uint32_t id;
+    SearchConfig config;
+};
+
+struct SnapshotScanResult {
+    std::uint32_t path;  // index into ScanSnapshot::paths
+    ScanCache::FileStamp stamp;
+    ScanResult result;
+};
+
+struct SnapshotIncludes {
+    std::uint32_t path;  // index into ScanSnapshot::paths
+    std::uint32_t config;
+    /// Indices into ScanSnapshot::paths, CONDITIONAL_FLAG kept.
+    std::vector<std::uint32_t> includes;
+};
+
+struct SnapshotModule {
+    std::string name;
+    std::vector<std::uint32_t> paths;
+};
+
+struct ScanSnapshot {
+    /// Start of the scan, in nanoseconds since the epoch.
+    std::int64_t scanned_at = 0;
+
+    std::vector<std::string> paths;
+
+    /// Directories the scan listed, split by whether they existed after it.
+    std::vector<std::string> directories;
+    std::vector<std::string> missing_directories;
+
+    std::vector<SnapshotConfig> configs;
+
+    /// Path ids are indices into `paths`.
+    std::vector<WaveEntry> initial_wave;
+
+    std::vector<SnapshotScanResult> scan_results;
+    std::vector<SnapshotIncludes> includes;
+    std::vector<SnapshotModule> modules;
+};
+
+/// Directories whose listing decides include resolution: those of the search
+/// configs and the ones holding the scanned files (quoted includes), and
+/// under each of them the subdirectories an include like "sys/types.h"
+/// looks in.  A header created in such a subdirectory leaves the mtime of
+/// the search dir alone.
+llvm::StringSet<> scanned_directories(const ScanSnapshot& snapshot) {
+    llvm::StringSet<> search_dirs;
+    for(auto& [id, config]: snapshot.configs) {
+        for(auto& dir: config.dirs) {
+            search_dirs.insert(dir.path);
+        }
+    }
+
+    llvm::StringSet<> dirs;
+    auto add_subdirs = [&](llvm::StringRef dir, llvm::StringRef include) {
+        if(llvm::sys::path::is_absolute(include)) {
+            return;
+        }
+        for(auto sub = llvm::sys::path::parent_path(include); !sub.empty();
+            sub = llvm::sys::path::parent_path(sub)) {
+            llvm::SmallString<256> path(dir);
+            llvm::sys::path::append(path, sub);
+            dirs.insert(path);
+        }
+    };
+
+    // Quoted includes fall back to the search dirs as well.
+    llvm::StringSet<> names;
+    for(auto& [path, stamp, result]: snapshot.scan_results) {
+        auto dir = llvm::sys::path::parent_path(snapshot.paths[path]);
+        for(auto& include: result.includes) {
+            if(!include.is_angled) {
+                add_subdirs(dir, include.path);
+            }
+            names.insert(include.path);
+        }
+    }
+    for(auto& dir: search_dirs) {
+        dirs.insert(dir.getKey());
+        for(auto& include: names) {
+            add_subdirs(dir.getKey(), include.getKey());
+        }
+    }
+    for(auto& path: snapshot.paths) {
+        auto dir = llvm::sys::path::parent_path(path);
+        if(!dir.empty()) {
+            dirs.insert(dir);
+        }
+    }
+    return dirs;
+}
+
+}  // namespace
+
+std::string save_scan_snapshot(const PathPool& path_pool,
+                               const DependencyGraph& graph,
+                               const ScanCache& cache,
+                               std::chrono::system_clock::time_point scanned_at) {
+    ScanSnapshot snapshot;
+    snapshot.scanned_at =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(scanned_at.time_since_epoch())
+            .count();
+
+    llvm::DenseMap<std::uint32_t, std::uint32_t> indices;
+    auto intern = [&](std::uint32_t path_id) {
+        auto [it, inserted] =
+            indices.try_emplace(path_id, static_cast<std::uint32_t>(snapshot.paths.size()));
+        if(inserted) {
+            snapshot.paths.push_back(path_pool.resolve(path_id).str());
+        }
+        return it->second;
+    };
+
+    for(auto& [id, config]: cache.configs) {
+        snapshot.configs.push_back({id, config});
+    }
+    for(auto entry: cache.initial_wave) {
+        entry.path_id = intern(entry.path_id);
+        snapshot.initial_wave.push_back(entry);
+    }
+    for(auto& [path_id, cached]: cache.scan_results) {
+        snapshot.scan_results.push_back({intern(path_id), cached.stamp, cached.result});
+    }
+    graph.for_each_includes([&](DependencyGraph::IncludeKey key,
+                                llvm::ArrayRef<std::uint32_t> included_ids) {
+        SnapshotIncludes entry{intern(key.path_id), key.config_id, {}};
+        for(auto id: included_ids) {
+            auto flag = id & DependencyGraph::CONDITIONAL_FLAG;
+            entry.includes.push_back(intern(id & DependencyGraph::PATH_ID_MASK) | flag);
+        }
+        snapshot.includes.push_back(std::move(entry));
+    });
+    for(auto& [name, path_ids]: graph.modules()) {
+        SnapshotModule entry{name.str(), {}};
+        for(auto path_id: path_ids) {
+            entry.paths.push_back(intern(path_id));
+        }
+        snapshot.modules.push_back(std::move(entry));
+    }
+
+    for(auto& dir: scanned_directories(snapshot)) {
+        auto& list = llvm::sys::fs::is_directory(dir.getKey()) ? snapshot.directories
+                                                                : snapshot.missing_directories;
+        list.push_back(dir.getKey().str());
+    }
+
+    auto json = kota::codec::json::to_json(snapshot);
+    if(!json) {
+        LOG_WARN("Failed to serialize dependency scan snapshot");
+        return {};
+    }
+    return std::move(*json);
+}
+
+std::optional<std::size_t> load_scan_snapshot(llvm::StringRef content,
+                                              PathPool& path_pool,
+                                              DependencyGraph& graph,
+                                              ScanCache& cache) {
+    ScanSnapshot snapshot;
+    if(!kota::codec::json::from_json(content, snapshot)) {
+        return std::nullopt;
+    }
+
+    // Check every index first, so a damaged snapshot changes nothing.
+    auto count = snapshot.paths.size();
+    auto valid = [&](std::uint32_t index) {
+        return (index & DependencyGraph::PATH_ID_MASK) < count;
+    };
+    bool consistent = std::ranges::all_of(snapshot.initial_wave,
+                                          [&](auto& entry) { return valid(entry.path_id); }) &&
+                      std::ranges::all_of(snapshot.scan_results,
+                                          [&](auto& entry) { return valid(entry.path); });
+    for(auto& entry: snapshot.includes) {
+        consistent = consistent && valid(entry.path) && std::ranges::all_of(entry.includes, valid);
+    }
+    for(auto& entry: snapshot.modules) {
+        consistent = consistent && std::ranges::all_of(entry.paths, valid);
+    }
+    if(!consistent) {
+        return std::nullopt;
+    }
+
+    // A file or listing is current if it has not been touched since the
+    // scan started; missing directories must still be missing.
+    auto scanned_at = std::chrono::nanoseconds(snapshot.scanned_at);
+    auto modified = [&](llvm::StringRef path) {
+        llvm::sys::fs::file_status status;
+        if(llvm::sys::fs::status(path, status)) {
+            return true;
+        }
+        return status.getLastModificationTime().time_since_epoch() >= scanned_at;
+    };
+
+    std::size_t changed = 0;
+    for(auto& dir: snapshot.directories) {
+        changed += modified(dir);
+    }
+    for(auto& dir: snapshot.missing_directories) {
+        changed += llvm::sys::fs::exists(dir);
+    }
+
+    std::vector<std::uint32_t> ids;
+    ids.reserve(count);
+    for(auto& path: snapshot.paths) {
+        ids.push_back(path_pool.intern(path));
+    }
+
+    for(auto& [id, config]: snapshot.configs) {
+        cache.configs[id] = std::move(config);
+    }
+    for(auto entry: snapshot.initial_wave) {
+        entry.path_id = ids[entry.path_id];
+        cache.initial_wave.push_back(entry);
+    }
+    // Results of modified files are kept too: the rescan checks them by
+    // stamp, so a file touched without a change in content is not lexed.
+    for(auto& [path, stamp, result]: snapshot.scan_results) {
+        changed += modified(snapshot.paths[path]);
+        cache.scan_results.try_emplace(ids[path], ScanCache::CachedScan{stamp, std::move(result)});
+    }
+
+    if(changed != 0) {
+        return changed;
+    }
+
+    for(auto& entry: snapshot.includes) {
+        llvm::SmallVector<std::uint32_t> included_ids;
+        included_ids.reserve(entry.includes.size());
+        for(auto index: entry.includes) {
+            auto flag = index & DependencyGraph::CONDITIONAL_FLAG;
+            included_ids.push_back(ids[index & DependencyGraph::PATH_ID_MASK] | flag);
+        }
+        graph.set_includes(ids[entry.path], entry.config, std::move(included_ids));
+    }
+    for(auto& entry: snapshot.modules) {
+        for(auto index: entry.paths) {
+            graph.add_module(entry.name, ids[index]);
+        }
+    }
+    return 0;
+}
+
 }  // namespace clice
@@ -1,17 +1,24 @@
 #pragma once
 
+#include <chrono>
 #include <cstdint>
 #include <functional>
+#include <optional>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "command/command.h"
+#include "support/bitmap.h"
 #include "support/path_pool.h"
 #include "syntax/include_resolver.h"
 #include "syntax/scan.h"
 
+#include "kota/async/async.h"
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
@@ -55,13 +62,22 @@ public:
         }
     };
 
+    /// Edges of one file an update added or removed, by included PathID
+    /// (flags stripped), counting its includes under all configs together.
+    struct IncludeChanges {
+        llvm::SmallVector<std::uint32_t> added;
+        llvm::SmallVector<std::uint32_t> removed;
+    };
+
     /// Register a module interface unit: module name -> PathID.
     void add_module(llvm::StringRef module_name, std::uint32_t path_id);
 
     /// Look up all PathIDs that provide a given module (may have multiple candidates).
     llvm::ArrayRef<std::uint32_t> lookup_module(llvm::StringRef module_name) const;
 
-    /// Set the direct include list for a (file, config) pair.
+    /// Set the direct include list for a (file, config) pair.  The packed
+    /// rows of the file stay as they were until the next build_reverse_map()
+    /// or patch_reverse_map().
     void set_includes(std::uint32_t path_id,
                       std::uint32_t config_id,
                       llvm::SmallVector<std::uint32_t> included_ids);
@@ -70,24 +86,64 @@ public:
     llvm::ArrayRef<std::uint32_t> get_includes(std::uint32_t path_id,
                                                std::uint32_t config_id) const;
 
+    /// Whether the includes of (file, config) were set, even to none.
+    bool has_includes(std::uint32_t path_id, std::uint32_t config_id) const;
+
+    /// Call `callback` with every (file, config) pair and its direct includes.
+    void for_each_includes(
+        llvm::function_ref<void(IncludeKey key, llvm::ArrayRef<std::uint32_t> included_ids)>
+            callback) const;
+
     /// Get the union of includes across all configs for a file.
     llvm::SmallVector<std::uint32_t> get_all_includes(std::uint32_t path_id) const;
 
-    /// Build the reverse include map from the forward includes.
+    /// Freeze the graph for queries: pack each file's includes (the union of
+    /// get_all_includes()) and includers into arrays indexed by PathID.
     /// Must be called after all set_includes() calls are complete.
     void build_reverse_map();
 
-    /// Get the direct includers of a file (files that directly include path_id).
+    /// Bring the packed rows up to date with the set_includes() calls since
+    /// the last build_reverse_map() or patch, at the cost of the rows those
+    /// calls touched instead of the whole graph.  For a graph growing in
+    /// batches, like a lazy dependency scan.
+    void patch_reverse_map();
+
+    /// Replace the include list of `path_id` under each config it has with
+    /// `includes(config_id)` and patch the reverse map in place, so an
+    /// update costs O(degree) rather than a build_reverse_map().  No effect
+    /// on a file without include entries.
+    IncludeChanges update_includes(
+        std::uint32_t path_id,
+        llvm::function_ref<llvm::SmallVector<std::uint32_t>(std::uint32_t config_id)> includes);
+
+    /// Get the direct includers of a file (files that directly include path_id),
+    /// in PathID order.
     llvm::ArrayRef<std::uint32_t> get_includers(std::uint32_t path_id) const;
 
     /// BFS upward through reverse edges to find all source files (roots)
     /// that transitively include header_path_id.
     /// Source files are those that have no includers (i.e. they are roots in the graph).
+    /// Memoized per header until an edge change can affect it.
     llvm::SmallVector<std::uint32_t, 4> find_host_sources(std::uint32_t header_path_id) const;
 
+    /// The first `limit` hosts of find_host_sources(), in the same order.
+    /// Stops the search once they are found, so a header included by most
+    /// of the project costs no more than one included by a few.
+    llvm::SmallVector<std::uint32_t, 4> find_host_sources(std::uint32_t header_path_id,
+                                                          std::size_t limit) const;
+
+    /// The hosts of find_host_sources() as a set, memoized alike.
+    const Bitmap& host_set(std::uint32_t header_path_id) const;
+
+    /// The header and every file that transitively includes it, memoized
+    /// alike.
+    const Bitmap& dependents(std::uint32_t header_path_id) const;
+
     /// BFS forward through include edges to find the shortest include chain
-    /// from host_path_id to target_path_id.
+    /// from host_path_id to target_path_id.  Like get_includers(), needs
+    /// build_reverse_map().
     /// Returns [host, intermediate1, ..., target], or empty if no path exists.
+    /// Memoized per (host, target) until an edge change can affect it.
     std::vector<std::uint32_t> find_include_chain(std::uint32_t host_path_id,
                                                   std::uint32_t target_path_id) const;
 
@@ -106,6 +162,62 @@ public:
     }
 
 private:
+    /// Compressed sparse rows: the row of PathID `id` is
+    /// values[offsets[id], offsets[id + 1]).  Rows update_includes() changed
+    /// since the last compact() are in `delta` instead.
+    struct Adjacency {
+        std::vector<std::uint32_t> offsets;
+        std::vector<std::uint32_t> values;
+        llvm::DenseMap<std::uint32_t, llvm::SmallVector<std::uint32_t, 4>> delta;
+
+        /// Rows in the delta before compact() folds them into the arrays.
+        constexpr static std::size_t max_delta = 4096;
+
+        llvm::ArrayRef<std::uint32_t> row(std::uint32_t id) const;
+
+        /// The row of `id`, moved to the delta to be modified.
+        llvm::SmallVectorImpl<std::uint32_t>& edit(std::uint32_t id);
+
+        /// Repack the arrays with the delta rows.
+        void compact();
+
+        void clear();
+    };
+
+    /// Memoized upward search from one header.
+    struct HostCache {
+        /// Every file the search visited: the header and all files that
+        /// transitively include it.
+        Bitmap ancestors;
+
+        llvm::SmallVector<std::uint32_t, 4> hosts;
+        Bitmap host_set;
+    };
+
+    /// Memoized forward search from a host to a target.
+    struct ChainCache {
+        /// Files the search reached.  Only edges out of these can change
+        /// the shortest chain.
+        llvm::DenseSet<std::uint32_t> visited;
+
+        /// Empty if there is no chain.
+        std::vector<std::uint32_t> chain;
+    };
+
+    /// Push the roots above `header` onto `hosts`, at most `limit` of them,
+    /// recording the files visited in `visited`.
+    void search_hosts(std::uint32_t header,
+                      std::size_t limit,
+                      llvm::SmallVectorImpl<std::uint32_t>& hosts,
+                      llvm::DenseSet<std::uint32_t>& visited) const;
+
+    /// The memoized search from `header`, run now if there is none.
+    HostCache& host_cache(std::uint32_t header) const;
+
+    /// Repack the forward row of `path_id` from its include entries and
+    /// move the file between the reverse rows of the targets that changed.
+    IncludeChanges patch_rows(std::uint32_t path_id);
+
     /// Module name -> PathIDs (multiple candidates possible, e.g. different targets).
     llvm::StringMap<llvm::SmallVector<std::uint32_t, 2>> module_to_path;
 
@@ -116,9 +228,22 @@ private:
     /// Track which files have any include entries (for file_count).
     llvm::DenseMap<std::uint32_t, llvm::SmallVector<std::uint32_t>> file_configs;
 
-    /// Reverse include map: PathID -> list of PathIDs that directly include it.
-    /// Populated by build_reverse_map().
-    llvm::DenseMap<std::uint32_t, llvm::SmallVector<std::uint32_t, 4>> reverse_includes_;
+    /// Includes of each file across its configs, flags kept as in
+    /// get_all_includes(), and the includers of each file.  Packed by
+    /// build_reverse_map(), so the searches below walk contiguous memory.
+    Adjacency forward_;
+    Adjacency reverse_;
+
+    /// Files set_includes() changed since their rows were last packed.
+    llvm::DenseSet<std::uint32_t> unpatched_;
+
+    /// Header PathID -> memoized host search; not thread-safe, like the
+    /// rest of the graph.  Cleared by set_includes() and build_reverse_map();
+    /// update_includes() drops only the entries its edge changes can affect.
+    mutable llvm::DenseMap<std::uint32_t, HostCache> host_cache_;
+
+    /// (host, target) -> memoized chain search, invalidated alike.
+    mutable llvm::DenseMap<std::pair<std::uint32_t, std::uint32_t>, ChainCache> chain_cache_;
 };
 
 /// A (file, search-config) pair used to track per-wave work items.
@@ -151,6 +276,11 @@ struct ScanReport {
 
     /// Module info.
     std::size_t modules = 0;
+    std::size_t module_decls_evaluated = 0;  // Conditional decls decided without preprocessing.
+    std::size_t module_decl_fallbacks = 0;   // Conditional decls left to scan_module_decl().
+
+    /// The module interface units the scan found, with their module names.
+    std::vector<std::pair<std::uint32_t, std::string>> interface_units;
 
     /// BFS wave count.
     std::size_t waves = 0;
@@ -171,15 +301,17 @@ struct ScanReport {
     std::int64_t scan_us = 0;  // Lexer scan (cumulative across threads).
     std::int64_t fs_us = 0;    // Filesystem ops (readdir calls).
 
-    /// Phase 2 breakdown (microseconds, single-threaded).
-    std::int64_t p2_resolve_us = 0;  // resolve_include() calls.
+    /// Phase 2 breakdown (microseconds, wall-clock).
+    std::int64_t p2_resolve_us = 0;  // Parallel resolve_include() step.
 
     /// Filesystem call counts.
-    std::size_t dir_listings = 0;        // Actual readdir() calls (dir cache misses).
-    std::size_t dir_hits = 0;            // Directory cache hits (no syscall).
-    std::size_t fs_lookups = 0;          // Total file existence lookups.
-    std::size_t include_cache_hits = 0;  // Include resolution cache hits (skipped resolve).
-    std::size_t scan_cache_hits = 0;     // Scan result cache hits (skipped I/O + lexer).
+    std::size_t dir_listings = 0;           // Actual readdir() calls (dir cache misses).
+    std::size_t dir_hits = 0;               // Directory cache hits (no syscall).
+    std::size_t fs_lookups = 0;             // Total file existence lookups.
+    std::size_t include_cache_hits = 0;     // Include resolution cache hits (skipped resolve).
+    std::size_t include_negative_hits = 0;  // Of those, includes known not to resolve.
+    std::size_t dirs_changed = 0;           // Cached listings found modified and listed again.
+    std::size_t scan_cache_hits = 0;        // Scan result cache hits (skipped I/O + lexer).
 
     /// Per-wave timing breakdown for cold start analysis.
     struct WaveStats {
@@ -221,7 +353,16 @@ struct ScanCache {
     /// Directory listing cache: dir path → set of filenames.
     DirListingCache dir_cache;
 
-    /// Angled-include resolution cache: (config_id bytes + header) → {path_id, found_dir_idx}.
+    /// Angled-include resolution cache: (search chain node bytes + header) →
+    /// {path_id, found_dir_idx}, path_id UINT32_MAX for a header found in
+    /// none of the directories: a negative cache, so the thousands of
+    /// headers that never resolve (not yet generated, or for another
+    /// platform) are not searched for again.  Answers through a directory
+    /// whose listing changed are dropped when the next scan refreshes it.
+    /// The node is one of SearchChains built from `configs`, so configs
+    /// sharing a prefix of their angled search list share the entries for
+    /// headers found within it.  found_dir_idx counts from the config's
+    /// angled_start_idx.
     /// path_id values are valid only for the PathPool used during the scan
     /// that populated this cache.  If PathPool is reset between scans, clear
     /// this cache too (or pass nullptr to scan_dependency_graph).
@@ -232,12 +373,28 @@ struct ScanCache {
 
     llvm::StringMap<CachedInclude> include_cache;
 
-    /// Lexer scan result cache: path_id → ScanResult.
-    /// Populated on the first scan of each file.  On subsequent calls the
-    /// worker-thread file read and lexer scan are skipped entirely, making
-    /// warm-run Phase 1 effectively free.
-    /// Invalidate per-entry when a file changes on disk.
-    llvm::DenseMap<std::uint32_t, ScanResult> scan_results;
+    /// What a scan result was computed from: the file's size and
+    /// modification time (nanoseconds since the epoch) when it was read,
+    /// and the xxh3 hash of its content.
+    struct FileStamp {
+        std::uint64_t size = 0;
+        std::int64_t mtime = 0;
+        std::uint64_t hash = 0;
+    };
+
+    struct CachedScan {
+        FileStamp stamp;
+        ScanResult result;
+    };
+
+    /// Lexer scan result cache: path_id → the file's last scan and its stamp.
+    /// Populated on the first scan of each file.  On subsequent calls each
+    /// cached file is only stat'ed: with size and mtime unchanged its result
+    /// is reused as is.  Otherwise it is read and hashed, and only lexed
+    /// again if the hash differs, so touching files (atomic-rename saves,
+    /// branch switches) costs a read, not a rescan.  No per-entry
+    /// invalidation is needed when a file changes on disk.
+    llvm::DenseMap<std::uint32_t, CachedScan> scan_results;
 
     // Populated during the first scan and reused on all subsequent calls
     // when the compilation database has not changed.
@@ -249,6 +406,33 @@ struct ScanCache {
 
     /// Pre-built initial wave (wave 0): all source files with their config IDs.
     std::vector<WaveEntry> initial_wave;
+
+    /// Drop what was derived from the compilation database: the configs,
+    /// the initial wave and the include resolutions made under them.
+    /// Directory listings and scan results depend only on the file system
+    /// and stay.
+    void invalidate_configs() {
+        configs.clear();
+        initial_wave.clear();
+        include_cache.clear();
+        stale_configs.clear();
+    }
+
+    /// Configs dropped by invalidate_configs(ids), extracted again by the
+    /// next scan.
+    llvm::SmallVector<std::uint32_t> stale_configs;
+
+    /// Drop only the configs `ids`, for a change of the `[[rules]]` their
+    /// groups match under the same CDB: the next scan extracts those again
+    /// and keeps the rest and the initial wave.  The include resolutions
+    /// go all the same, since search chain node ids follow the configs.
+    void invalidate_configs(llvm::ArrayRef<std::uint32_t> ids) {
+        for(auto id: ids) {
+            configs.erase(id);
+            stale_configs.push_back(id);
+        }
+        include_cache.clear();
+    }
 };
 
 /// Callback for per-file rule-based flag modification. Given a file path,
@@ -276,4 +460,70 @@ ScanReport scan_dependency_graph(CompilationDatabase& cdb,
                                  ScanCache* cache = nullptr,
                                  const RuleMatcher& rule_matcher = {});
 
+/// Like scan_dependency_graph(), but wave 0 holds only the CDB files among
+/// `sources` (PathPool ids): `graph` gains the edges of the files they reach
+/// and keeps those of earlier scans.  Lets a huge CDB be scanned in parts,
+/// the files it needs first.  Headers reached again are resolved again,
+/// from the scan results `cache` keeps; configs and the full wave 0 are
+/// built on the first call only.  Only directories of `sources` are listed
+/// up front, others when first needed.
+ScanReport scan_dependency_sources(CompilationDatabase& cdb,
+                                   Toolchain& toolchain,
+                                   PathPool& path_pool,
+                                   DependencyGraph& graph,
+                                   ScanCache& cache,
+                                   llvm::ArrayRef<std::uint32_t> sources,
+                                   const RuleMatcher& rule_matcher = {});
+
+/// scan_dependency_sources() as a task on `loop`, the caller's own event
+/// loop: reads, lexing and directory listings go to the thread pool and the
+/// loop serves other work meanwhile.  The graph, pool and cache are only
+/// touched on the loop thread, but the caller must not start another scan
+/// over them until this one is done.
+kota::task<ScanReport> scan_dependency_sources_async(CompilationDatabase& cdb,
+                                                     Toolchain& toolchain,
+                                                     PathPool& path_pool,
+                                                     DependencyGraph& graph,
+                                                     ScanCache& cache,
+                                                     std::vector<std::uint32_t> sources,
+                                                     kota::event_loop& loop,
+                                                     RuleMatcher rule_matcher = {});
+
+/// Resolve the includes of `result`, a new scan of `path_id`, under each
+/// config the file was scanned with and update its edges in `graph` (see
+/// DependencyGraph::update_includes()).  The listing of the file's own
+/// directory is refreshed first, for headers created next to it since.
+/// Included headers without edges under a config yet are scanned under it,
+/// with the new headers they include in turn.
+DependencyGraph::IncludeChanges update_file_includes(DependencyGraph& graph,
+                                                     PathPool& path_pool,
+                                                     ScanCache& cache,
+                                                     std::uint32_t path_id,
+                                                     const ScanResult& result);
+
+/// Serialize `graph` and the parts of `cache` that depend only on the
+/// compilation database and on file contents (configs, initial wave, scan
+/// results) as a JSON snapshot.  `scanned_at` is when the scan that built
+/// them started; files modified since are stale on load.  Directory
+/// listings and include resolutions are left out: they depend on files
+/// that did not exist at scan time.
+std::string save_scan_snapshot(const PathPool& path_pool,
+                               const DependencyGraph& graph,
+                               const ScanCache& cache,
+                               std::chrono::system_clock::time_point scanned_at);
+
+/// Load a snapshot written by save_scan_snapshot(), interning its paths in
+/// `path_pool`.  Returns the number of scanned files and directories
+/// modified since the scan, or nullopt if the snapshot is unreadable.
+///
+/// With nothing modified the graph is restored into `graph` and no scan is
+/// needed.  Otherwise `graph` is left alone and `cache` is seeded with the
+/// configs and the stamped scan results, so a following
+/// scan_dependency_graph() only reads the files whose size or mtime changed
+/// and only lexes those whose content did.
+std::optional<std::size_t> load_scan_snapshot(llvm::StringRef snapshot,
+                                              PathPool& path_pool,
+                                              DependencyGraph& graph,
+                                              ScanCache& cache);
+
 }  // namespace clice
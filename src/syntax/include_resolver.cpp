@@ -9,22 +9,57 @@
 
 namespace clice {
 
-const llvm::StringSet<>* resolve_dir(llvm::StringRef dir,
-                                     DirListingCache& cache,
-                                     StatCounters* counters) {
-    auto it = cache.dirs.find(dir);
-    if(it != cache.dirs.end()) {
-        if(counters) {
-            counters->dir_hits++;
+const llvm::StringSet<>* DirListingCache::find(llvm::StringRef dir) const {
+    if(shared) {
+        if(auto* entries = shared->find(dir)) {
+            return entries;
         }
-        return &it->second;
     }
+    auto it = dirs.find(dir);
+    return it != dirs.end() ? &it->second : nullptr;
+}
 
-    if(counters) {
-        counters->dir_listings++;
+void DirListingCache::merge(DirListingCache&& other) {
+    for(auto& entry: other.dirs) {
+        if(dirs.try_emplace(entry.getKey(), std::move(entry.getValue())).second) {
+            if(auto it = other.mtimes.find(entry.getKey()); it != other.mtimes.end()) {
+                mtimes.try_emplace(entry.getKey(), it->second);
+            }
+        }
     }
+    other.dirs.clear();
+    other.mtimes.clear();
+}
 
-    auto t0 = std::chrono::steady_clock::now();
+/// Modification time of `dir` in nanoseconds since the epoch, or -1.
+static std::int64_t dir_mtime(llvm::StringRef dir) {
+    llvm::sys::fs::file_status status;
+    if(llvm::sys::fs::status(dir, status)) {
+        return -1;
+    }
+    auto mtime = status.getLastModificationTime().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(mtime).count();
+}
+
+std::vector<std::string> DirListingCache::refresh() {
+    std::vector<std::string> changed;
+    for(auto& entry: dirs) {
+        auto dir = entry.getKey();
+        auto it = mtimes.find(dir);
+        // A listing of unknown age is taken as current.
+        if(it == mtimes.end() || dir_mtime(dir) == it->second) {
+            continue;
+        }
+        entry.getValue() = list_dir(dir, &it->second);
+        changed.push_back(dir.str());
+    }
+    return changed;
+}
+
+llvm::StringSet<> list_dir(llvm::StringRef dir, std::int64_t* mtime) {
+    if(mtime) {
+        *mtime = dir_mtime(dir);
+    }
     llvm::StringSet<> entries;
     std::error_code ec;
     llvm::sys::fs::directory_iterator di(dir, ec);
@@ -34,15 +69,54 @@ const llvm::StringSet<>* resolve_dir(llvm::StringRef dir,
     for(; !ec && di != llvm::sys::fs::directory_iterator(); di.increment(ec)) {
         entries.insert(llvm::sys::path::filename(di->path()));
     }
+    return entries;
+}
+
+const llvm::StringSet<>* resolve_dir(llvm::StringRef dir,
+                                     DirListingCache& cache,
+                                     StatCounters* counters) {
+    if(auto* entries = cache.find(dir)) {
+        if(counters) {
+            counters->dir_hits++;
+        }
+        return entries;
+    }
+
+    if(counters) {
+        counters->dir_listings++;
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    std::int64_t mtime = -1;
+    auto entries = list_dir(dir, &mtime);
     auto t1 = std::chrono::steady_clock::now();
     if(counters) {
         counters->us += std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count();
     }
 
     auto [new_it, _] = cache.dirs.try_emplace(dir, std::move(entries));
+    cache.mtimes.insert_or_assign(dir, mtime);
     return &new_it->second;
 }
 
+std::uint32_t SearchChains::intern(const SearchConfig& config) {
+    std::uint32_t node = 0;
+    llvm::SmallString<256> key;
+    for(auto i = config.angled_start_idx; i < config.dirs.size(); ++i) {
+        key.assign(reinterpret_cast<const char*>(&node),
+                   reinterpret_cast<const char*>(&node) + sizeof(node));
+        key += config.dirs[i].path;
+        auto [it, inserted] = index.try_emplace(key, nodes.size());
+        if(inserted) {
+            auto dir = it->getKey().drop_front(sizeof(node));
+            nodes.push_back({node, nodes[node].depth + 1, 0, dir});
+        }
+        node = it->second;
+        nodes[node].users++;
+    }
+    return node;
+}
+
 ResolvedSearchConfig resolve_search_config(const SearchConfig& config, DirListingCache& cache) {
     ResolvedSearchConfig resolved;
     resolved.angled_start_idx = config.angled_start_idx;
@@ -99,6 +173,43 @@ bool check_in_dir(llvm::StringRef dir_path,
 
 }  // namespace
 
+void collect_include_dirs(llvm::StringRef filename,
+                          bool is_angled,
+                          const llvm::StringSet<>* includer_entries,
+                          llvm::StringRef includer_dir,
+                          const ResolvedSearchConfig& config,
+                          const DirListingCache& cache,
+                          llvm::StringSet<>& dirs) {
+    auto first_sep = filename.find_first_of("/\\");
+    if(first_sep == llvm::StringRef::npos || llvm::sys::path::is_absolute(filename)) {
+        return;
+    }
+
+    // The same rejection and the same subdirectory as check_in_dir().
+    auto first_component = filename.substr(0, first_sep);
+    bool relative = first_component == "." || first_component == "..";
+    llvm::SmallString<256> full;
+    auto add = [&](llvm::StringRef dir, const llvm::StringSet<>* entries) {
+        if(!relative && !entries->contains(first_component)) {
+            return;
+        }
+        full = dir;
+        llvm::sys::path::append(full, filename);
+        auto parent = llvm::sys::path::parent_path(full);
+        if(!cache.find(parent)) {
+            dirs.insert(parent);
+        }
+    };
+
+    if(!is_angled && includer_entries) {
+        add(includer_dir, includer_entries);
+    }
+    unsigned start = is_angled ? config.angled_start_idx : 0;
+    for(unsigned i = start; i < config.dirs.size(); ++i) {
+        add(config.dirs[i].path, config.dirs[i].entries);
+    }
+}
+
 std::optional<ResolveResult> resolve_include(llvm::StringRef filename,
                                              bool is_angled,
                                              const llvm::StringSet<>* includer_entries,
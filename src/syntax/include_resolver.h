@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <optional>
+#include <vector>
 
 #include "command/search_config.h"
 
@@ -24,27 +25,54 @@ struct ResolveResult {
 
 /// Counters for filesystem call tracking during include resolution.
 struct StatCounters {
-    std::size_t dir_listings = 0;  // Actual readdir() calls (directory cache misses).
-    std::size_t dir_hits = 0;      // Directory cache hits (no syscall).
-    std::size_t lookups = 0;       // Total file existence lookups.
-    std::int64_t us = 0;           // Microseconds spent in filesystem ops.
+    std::size_t dir_listings = 0;   // Actual readdir() calls (directory cache misses).
+    std::size_t dir_hits = 0;       // Directory cache hits (no syscall).
+    std::size_t lookups = 0;        // Total file existence lookups.
+    std::size_t negative_hits = 0;  // Includes known unresolvable (no search).
+    std::int64_t us = 0;            // Microseconds spent in filesystem ops.
 };
 
 /// Cache of directory listings for fast file existence checks.
 /// Instead of calling stat() for each candidate path, we list directory
 /// contents once via readdir() and do in-memory set lookups thereafter.
 /// This is dramatically faster on Windows where individual stat() calls
-/// are very expensive (~10x slower than Linux).
+/// are very expensive (~10x slower than Linux).  refresh() lists again the
+/// directories modified since.
 ///
-/// TODO: add per-directory invalidation for incremental updates (currently
-/// the entire cache must be discarded when files change on disk).
 /// TODO: on case-insensitive filesystems (macOS HFS+/APFS, Windows NTFS),
 /// the readdir-based first-component optimization in resolve_include may
 /// produce false negatives when the #include casing differs from disk.
 struct DirListingCache {
     llvm::StringMap<llvm::StringSet<>> dirs;
+
+    /// Modification time of each directory in `dirs` when it was listed,
+    /// in nanoseconds since the epoch.
+    llvm::StringMap<std::int64_t> mtimes;
+
+    /// Listings looked up before `dirs` and never modified through this
+    /// cache.  Lets each thread fill a cache of its own over one shared
+    /// cache that stays frozen while the threads run; merge() folds the
+    /// new listings back afterwards.
+    const DirListingCache* shared = nullptr;
+
+    /// The listing of `dir` in `shared` or in this cache, or null.
+    const llvm::StringSet<>* find(llvm::StringRef dir) const;
+
+    /// Move the listings of `other` this cache does not have yet into it.
+    void merge(DirListingCache&& other);
+
+    /// Stat every directory listed here and list again those whose
+    /// modification time changed, in place, so pointers to the listings
+    /// stay valid.  Returns the directories listed again.
+    std::vector<std::string> refresh();
 };
 
+/// The names in `dir` via readdir(); empty if it cannot be listed.  `mtime`,
+/// when given, receives the directory's modification time (nanoseconds
+/// since the epoch, -1 if it cannot be stat'ed), taken before the listing
+/// so that a change made while listing shows as a later one.
+llvm::StringSet<> list_dir(llvm::StringRef dir, std::int64_t* mtime = nullptr);
+
 /// A search directory with a pre-resolved pointer to its cached entries.
 /// The pointer is stable because StringMap allocates entries on the heap.
 struct ResolvedSearchDir {
@@ -61,6 +89,37 @@ struct ResolvedSearchConfig {
     unsigned after_start_idx = 0;
 };
 
+/// Angled search lists of configs interned as prefix chains.  A node stands
+/// for the list of its parent plus one more directory, so configs whose
+/// lists differ only in trailing directories share the nodes of their
+/// common prefix: where an angled include resolves within a shared prefix
+/// holds for every config through it.
+struct SearchChains {
+    struct Node {
+        std::uint32_t parent = 0;
+
+        /// Directories in the list this node stands for.
+        std::uint32_t depth = 0;
+
+        /// Number of interned lists that have this node as a prefix.
+        std::uint32_t users = 0;
+
+        /// The directory this node adds to the list of its parent, pointing
+        /// into `index`.
+        llvm::StringRef dir;
+    };
+
+    /// Node 0 is the empty list.
+    std::vector<Node> nodes = {Node{}};
+
+    /// (parent node bytes + directory) → node.
+    llvm::StringMap<std::uint32_t> index;
+
+    /// Intern the angled part of `config`, dirs[angled_start_idx..], and
+    /// return the node of the whole list.
+    std::uint32_t intern(const SearchConfig& config);
+};
+
 /// Resolve a single directory to its cached StringSet.
 /// Returns a stable pointer into the DirListingCache.
 /// On cache miss, lazily populates via readdir().
@@ -73,6 +132,19 @@ const llvm::StringSet<>* resolve_dir(llvm::StringRef dir,
 /// the result for all resolve_include() calls with that config.
 ResolvedSearchConfig resolve_search_config(const SearchConfig& config, DirListingCache& cache);
 
+/// Add to `dirs` the directories resolve_include() may have to list for
+/// `filename` that `cache` does not have: for a multi-component name, its
+/// parent under the includer's directory and under every search dir whose
+/// listing has the name's first component.  Lets a caller list them all at
+/// once, in parallel, before resolving.  `includer_entries` may be null.
+void collect_include_dirs(llvm::StringRef filename,
+                          bool is_angled,
+                          const llvm::StringSet<>* includer_entries,
+                          llvm::StringRef includer_dir,
+                          const ResolvedSearchConfig& config,
+                          const DirListingCache& cache,
+                          llvm::StringSet<>& dirs);
+
 /// Resolve an include directive using pre-resolved config and includer entries.
 ///
 /// @param filename         Raw include name (without delimiters)
@@ -1,5 +1,9 @@
 #include "syntax/lexer.h"
 
+#include <string>
+#include <vector>
+
+#include "llvm/TargetParser/Triple.h"
 #include "clang/Lex/Lexer.h"
 
 namespace clice {
@@ -106,6 +110,20 @@ Token Lexer::advance_until(TokenKind kind) {
     }
 }
 
+const clang::LangOptions& cxx_lang_options() {
+    static const clang::LangOptions options = [] {
+        clang::LangOptions options;
+        std::vector<std::string> includes;
+        clang::LangOptions::setLangDefaults(options,
+                                            clang::Language::CXX,
+                                            llvm::Triple(),
+                                            includes,
+                                            clang::LangStandard::lang_cxx20);
+        return options;
+    }();
+    return options;
+}
+
 static bool is_directive_keyword(llvm::StringRef word) {
     return word == "include" || word == "include_next" || word == "import" || word == "embed" ||
            word == "__has_include" || word == "__has_include_next" || word == "__has_embed";
@@ -73,6 +73,10 @@ private:
     std::unique_ptr<clang::Lexer> lexer;
 };
 
+/// Options to lex C++ source without a compile command: line comments,
+/// raw strings and the C++20 keywords are recognized.
+const clang::LangOptions& cxx_lang_options();
+
 /// Find the range of the filename argument in a preprocessor directive line.
 /// `content` is the full source text, `offset` points at or before the directive keyword.
 /// Returns the range of the first filename-like token (header name, string literal,
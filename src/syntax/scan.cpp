@@ -1,10 +1,15 @@
 #include "syntax/scan.h"
 
+#include <algorithm>
+#include <bit>
 #include <deque>
+#include <limits>
 
 #include "syntax/lexer.h"
 
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/StringSet.h"
+#include "llvm/Support/Endian.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "clang/Basic/DiagnosticOptions.h"
 #include "clang/Basic/FileEntry.h"
@@ -19,11 +24,356 @@
 
 namespace clice {
 
+namespace {
+
+/// Word-at-a-time search for the bytes that can change the lexing state of
+/// a line: newline, '/', quotes and backslash.  Everything else is skipped
+/// eight bytes at a time.
+const char* find_special(const char* p, const char* end) {
+    constexpr std::uint64_t ones = 0x0101010101010101ULL;
+    constexpr std::uint64_t highs = 0x8080808080808080ULL;
+
+    /// High bit set in each byte of `word` equal to `c`.  Only the lowest
+    /// such byte is exact; bytes above it may be false positives.
+    auto matches = [](std::uint64_t word, unsigned char c) {
+        auto x = word ^ (ones * c);
+        return (x - ones) & ~x & highs;
+    };
+
+    for(; end - p >= 8; p += 8) {
+        // Read as little-endian so the lowest match is the first in memory.
+        auto word = llvm::support::endian::read64le(p);
+        auto mask = matches(word, '\n') | matches(word, '/') | matches(word, '"') |
+                    matches(word, '\'') | matches(word, '\\');
+        if(mask) {
+            return p + std::countr_zero(mask) / 8;
+        }
+    }
+
+    for(; p != end; ++p) {
+        if(*p == '\n' || *p == '/' || *p == '"' || *p == '\'' || *p == '\\') {
+            return p;
+        }
+    }
+    return end;
+}
+
+bool is_identifier_char(char c) {
+    return llvm::isAlnum(c) || c == '_';
+}
+
+/// The identifier ending right before `p`, or empty if there is none.
+llvm::StringRef identifier_before(const char* begin, const char* p) {
+    auto start = p;
+    while(start != begin && is_identifier_char(start[-1])) {
+        --start;
+    }
+    return llvm::StringRef(start, p - start);
+}
+
+/// Whether `p` starts the identifier `word`.
+bool starts_word(const char* p, const char* end, llvm::StringRef word) {
+    return llvm::StringRef(p, end - p).starts_with(word) &&
+           (p + word.size() == end || !is_identifier_char(p[word.size()]));
+}
+
+const char* skip_blank(const char* p, const char* end) {
+    while(p != end && (*p == ' ' || *p == '\t' || *p == '\f' || *p == '\v' || *p == '\r')) {
+        ++p;
+    }
+    return p;
+}
+
+/// Whether the newline at `p` ends a line continued with a backslash.
+bool is_continued(const char* begin, const char* p) {
+    if(p != begin && p[-1] == '\r') {
+        --p;
+    }
+    return p != begin && p[-1] == '\\';
+}
+
+/// Skip the string, raw string or character literal whose opening quote is
+/// `p`.  Returns the position after it, or null if it runs past its line
+/// (or the file) in a way only the full lexer handles.
+const char* skip_literal(const char* begin, const char* p, const char* end) {
+    auto prefix = identifier_before(begin, p);
+    if(*p == '\'') {
+        // A quote inside a number is a digit separator, as in 1'000.
+        if(!prefix.empty() && llvm::isDigit(prefix.front())) {
+            return p + 1;
+        }
+    } else if(prefix == "R" || prefix == "u8R" || prefix == "uR" || prefix == "UR" ||
+              prefix == "LR") {
+        auto rest = llvm::StringRef(p + 1, end - p - 1);
+        auto open = rest.find('(');
+        if(open == llvm::StringRef::npos || open > 16) {
+            return nullptr;
+        }
+        auto terminator = (")" + rest.take_front(open) + "\"").str();
+        auto close = rest.find(terminator, open);
+        if(close == llvm::StringRef::npos) {
+            return nullptr;
+        }
+        return rest.data() + close + terminator.size();
+    }
+
+    auto quote = *p;
+    for(++p; p != end; ++p) {
+        if(*p == '\\') {
+            if(++p == end) {
+                break;
+            }
+        } else if(*p == quote) {
+            return p + 1;
+        }
+        if(*p == '\n') {
+            return nullptr;
+        }
+    }
+    return nullptr;
+}
+
+/// End of the directive starting at `p`: its terminating newline, or `end`.
+/// Returns null for directives the filter cannot bound on its own: a block
+/// comment or literal running into the next line, or a module or import
+/// declaration not closed by ';' on its line.
+const char* directive_end(const char* begin, const char* p, const char* end) {
+    bool needs_semi = *p != '#';
+    bool seen_semi = false;
+
+    // A header name is not lexed as a literal and may contain "//".
+    auto word = p + (*p == '#');
+    word = skip_blank(word, end);
+    if(starts_word(word, end, "export")) {
+        word = skip_blank(word + 6, end);
+    }
+    auto keyword = llvm::StringRef(word, end - word);
+    if(keyword.starts_with("include") || starts_word(word, end, "import")) {
+        while(word != end && is_identifier_char(*word)) {
+            ++word;
+        }
+        word = skip_blank(word, end);
+        if(word != end && *word == '<') {
+            auto close = std::find(word, end, '>');
+            if(close == end || std::find(word, close, '\n') != close) {
+                return nullptr;
+            }
+            p = close + 1;
+        }
+    }
+
+    while(true) {
+        auto q = find_special(p, end);
+        if(needs_semi && !seen_semi) {
+            seen_semi = std::find(p, q, ';') != q;
+        }
+        if(q == end) {
+            return needs_semi && !seen_semi ? nullptr : end;
+        }
+
+        switch(*q) {
+            case '\n': {
+                if(is_continued(begin, q)) {
+                    p = q + 1;
+                    break;
+                }
+                return needs_semi && !seen_semi ? nullptr : q;
+            }
+            case '/': {
+                if(q + 1 != end && q[1] == '/') {
+                    auto newline = std::find(q, end, '\n');
+                    if(newline != end && is_continued(begin, newline)) {
+                        return nullptr;
+                    }
+                    p = newline;
+                } else if(q + 1 != end && q[1] == '*') {
+                    auto comment = llvm::StringRef(q + 2, end - q - 2);
+                    auto close = comment.find("*/");
+                    if(close == llvm::StringRef::npos ||
+                       comment.take_front(close).contains('\n')) {
+                        return nullptr;
+                    }
+                    p = comment.data() + close + 2;
+                } else {
+                    p = q + 1;
+                }
+                break;
+            }
+            case '"':
+            case '\'': {
+                p = skip_literal(begin, q, end);
+                if(!p || std::find(q, p, '\n') != p) {
+                    return nullptr;
+                }
+                break;
+            }
+            default: {
+                p = q + 1;
+                break;
+            }
+        }
+    }
+}
+
+/// Whether a line whose first token starts at `p` may be a directive:
+/// a preprocessor line or a module, import or export module/import line.
+bool is_directive_start(const char* p, const char* end) {
+    switch(*p) {
+        case '#': return true;
+        case 'i': return starts_word(p, end, "import");
+        case 'm': return starts_word(p, end, "module");
+        case 'e': {
+            if(!starts_word(p, end, "export")) {
+                return false;
+            }
+            auto next = skip_blank(p + 6, end);
+            return next == end || *next == '\n' || starts_word(next, end, "module") ||
+                   starts_word(next, end, "import");
+        }
+        default: return false;
+    }
+}
+
+/// Copy the lines of `content` that may be directives into `out`, skipping
+/// comments and literals so that nothing inside them is taken for one.
+/// Most of a source file is not directives, and the dependency directives
+/// scanner then only lexes what was copied.  Returns false when the file
+/// has something the filter leaves to the full scanner (a backslash line
+/// continuation outside a directive, an unterminated literal, ...).
+bool filter_directive_lines(llvm::StringRef content, std::string& out) {
+    auto begin = content.begin();
+    auto end = content.end();
+    auto p = begin;
+    if(content.starts_with("\xEF\xBB\xBF")) {
+        p += 3;
+    }
+
+    // Whether only whitespace and comments precede `p` on its line.
+    bool blank = true;
+    while(p != end) {
+        if(blank) {
+            p = skip_blank(p, end);
+            if(p == end) {
+                break;
+            }
+            if(*p == '\n') {
+                ++p;
+                continue;
+            }
+            if(is_directive_start(p, end)) {
+                // "export" alone on its line may continue with a module
+                // declaration on the next.
+                if(*p == 'e') {
+                    auto next = skip_blank(p + 6, end);
+                    if(next == end || *next == '\n') {
+                        return false;
+                    }
+                }
+                auto line_end = directive_end(begin, p, end);
+                if(!line_end) {
+                    return false;
+                }
+                out.append(p, line_end);
+                out += '\n';
+                p = line_end;
+                continue;
+            }
+            if(*p != '/' || p + 1 == end || (p[1] != '/' && p[1] != '*')) {
+                blank = false;
+            }
+        }
+
+        p = find_special(p, end);
+        if(p == end) {
+            break;
+        }
+
+        switch(*p) {
+            case '\n': {
+                blank = true;
+                ++p;
+                break;
+            }
+            case '/': {
+                if(p + 1 != end && p[1] == '/') {
+                    p = std::find(p, end, '\n');
+                    if(p != end && is_continued(begin, p)) {
+                        return false;
+                    }
+                } else if(p + 1 != end && p[1] == '*') {
+                    auto comment = llvm::StringRef(p + 2, end - p - 2);
+                    auto close = comment.find("*/");
+                    p = close == llvm::StringRef::npos ? end : comment.data() + close + 2;
+                } else {
+                    ++p;
+                }
+                break;
+            }
+            case '"':
+            case '\'': {
+                p = skip_literal(begin, p, end);
+                if(!p) {
+                    return false;
+                }
+                break;
+            }
+            case '\\': {
+                auto next = p + 1;
+                if(next != end && *next == '\r') {
+                    ++next;
+                }
+                if(next == end || *next == '\n') {
+                    return false;
+                }
+                ++p;
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+/// The module name a module declaration directive names: the identifiers,
+/// '.' and ':' after the `module` keyword.  Empty for `module;`.
+std::string module_decl_name(llvm::StringRef content,
+                             const clang::dependency_directives_scan::Directive& dir) {
+    std::string module_name;
+    bool seen_module_keyword = false;
+    for(auto& tok: dir.Tokens) {
+        if(!seen_module_keyword) {
+            if(tok.is(clang::tok::raw_identifier)) {
+                auto spelling = content.substr(tok.Offset, tok.Length);
+                if(spelling == "module") {
+                    seen_module_keyword = true;
+                }
+            }
+            continue;
+        }
+        if(tok.is(clang::tok::raw_identifier)) {
+            module_name += content.substr(tok.Offset, tok.Length);
+        } else if(tok.is(clang::tok::period)) {
+            module_name += '.';
+        } else if(tok.is(clang::tok::colon)) {
+            module_name += ':';
+        }
+    }
+    return module_name;
+}
+
+}  // namespace
+
 ScanResult scan(llvm::StringRef content) {
     namespace dds = clang::dependency_directives_scan;
 
     ScanResult result;
 
+    // Include names and module names are copied out of the directives, so
+    // scanning only the candidate lines gives the same result.
+    std::string directive_lines;
+    if(filter_directive_lines(content, directive_lines)) {
+        content = directive_lines;
+    }
+
     llvm::SmallVector<dds::Token> tokens;
     llvm::SmallVector<dds::Directive> directives;
 
@@ -85,52 +435,625 @@ ScanResult scan(llvm::StringRef content) {
                     return result;
                 }
 
-                // Collect module name from tokens: skip keywords, then
-                // collect identifiers, '.', ':'.
-                std::string module_name;
-                bool seen_module_keyword = false;
-                for(auto& tok: dir.Tokens) {
-                    if(!seen_module_keyword) {
-                        if(tok.is(clang::tok::raw_identifier)) {
-                            auto spelling = content.substr(tok.Offset, tok.Length);
-                            if(spelling == "module") {
-                                seen_module_keyword = true;
-                            }
-                        }
-                        continue;
+                result.module_name = module_decl_name(content, dir);
+                result.is_interface_unit = (dir.Kind == dds::cxx_export_module_decl);
+                break;
+            }
+            default: {
+                break;
+            }
+        }
+    }
+
+    return result;
+}
+
+namespace {
+
+namespace dds = clang::dependency_directives_scan;
+
+/// Decides the conditionals of one file over its dependency directives,
+/// knowing only the macros of the command line and of the file itself.
+/// Every answer is either definite or unknown, and an unknown one around a
+/// module declaration leaves the file to the preprocessor.
+class ConditionEvaluator {
+public:
+    explicit ConditionEvaluator(llvm::ArrayRef<const char*> arguments) {
+        for(std::size_t i = 0; i < arguments.size(); ++i) {
+            llvm::StringRef arg = arguments[i];
+            if(arg.consume_front("-std=") || arg.consume_front("--std=")) {
+                gnu = arg.starts_with("gnu");
+                continue;
+            }
+            if(arg == "-ansi" || arg.starts_with("/std:") || arg.starts_with("-std:")) {
+                gnu = false;
+                continue;
+            }
+            if(arg.starts_with("-include") || arg.starts_with("-imacros")) {
+                // A forced include may define anything.
+                included = true;
+                continue;
+            }
+            if(!arg.starts_with("-D") && !arg.starts_with("-U")) {
+                continue;
+            }
+            bool undefine = arg[1] == 'U';
+            auto value = arg.drop_front(2);
+            if(value.empty()) {
+                if(i + 1 == arguments.size()) {
+                    break;
+                }
+                value = arguments[++i];
+            }
+            auto [name, body] = value.split('=');
+            if(undefine) {
+                macros[name] = Macro{Macro::Undefined};
+            } else if(name.contains('(')) {
+                macros[name.take_until([](char c) { return c == '('; })] =
+                    Macro{Macro::Function};
+            } else {
+                auto text = value.contains('=') ? body.str() : std::string("1");
+                macros[name] = Macro{Macro::Object, std::move(text)};
+            }
+        }
+    }
+
+    std::optional<ScanResult> run(llvm::StringRef content,
+                                  llvm::ArrayRef<dds::Directive> directives) {
+        for(auto& dir: directives) {
+            switch(dir.Kind) {
+                case dds::pp_if:
+                case dds::pp_ifdef:
+                case dds::pp_ifndef: {
+                    Conditional frame{.parent = state()};
+                    if(frame.parent == State::Inactive) {
+                        frame.taken = true;
+                    } else {
+                        enter_branch(frame, condition(content, dir));
+                    }
+                    conditionals.push_back(frame);
+                    break;
+                }
+                case dds::pp_elif:
+                case dds::pp_elifdef:
+                case dds::pp_elifndef:
+                case dds::pp_else: {
+                    if(conditionals.empty()) {
+                        return std::nullopt;
                     }
-                    if(tok.is(clang::tok::raw_identifier)) {
-                        module_name += content.substr(tok.Offset, tok.Length);
-                    } else if(tok.is(clang::tok::period)) {
-                        module_name += '.';
-                    } else if(tok.is(clang::tok::colon)) {
-                        module_name += ':';
+                    auto& frame = conditionals.back();
+                    if(frame.taken) {
+                        frame.current = State::Inactive;
+                    } else if(dir.Kind == dds::pp_else) {
+                        enter_branch(frame, true);
+                    } else {
+                        enter_branch(frame, condition(content, dir));
                     }
+                    break;
+                }
+                case dds::pp_endif: {
+                    if(conditionals.empty()) {
+                        return std::nullopt;
+                    }
+                    conditionals.pop_back();
+                    break;
+                }
+                case dds::pp_define:
+                case dds::pp_undef: {
+                    if(state() != State::Inactive) {
+                        define(content, dir);
+                    }
+                    break;
+                }
+                case dds::pp_include:
+                case dds::pp_include_next:
+                case dds::pp_import:
+                case dds::pp___include_macros: {
+                    if(state() != State::Inactive) {
+                        included = true;
+                    }
+                    break;
                 }
+                case dds::cxx_module_decl:
+                case dds::cxx_export_module_decl: {
+                    if(state() == State::Inactive) {
+                        break;
+                    }
+                    if(state() == State::Unknown) {
+                        return std::nullopt;
+                    }
+                    // `module;` starts the global module fragment.
+                    auto name = module_decl_name(content, dir);
+                    if(name.empty()) {
+                        break;
+                    }
+                    ScanResult result;
+                    result.module_name = std::move(name);
+                    result.is_interface_unit = dir.Kind == dds::cxx_export_module_decl;
+                    return result;
+                }
+                default: {
+                    break;
+                }
+            }
+        }
+        return ScanResult();
+    }
 
-                result.module_name = std::move(module_name);
-                result.is_interface_unit = (dir.Kind == dds::cxx_export_module_decl);
+private:
+    struct Macro {
+        enum Kind {
+            Object,
+            Function,
+            /// #undef'd by the command line or the file.
+            Undefined,
+            /// (Un)defined in a branch whose condition is unknown.
+            Unknown,
+        } kind;
+
+        /// Replacement text of an object-like macro.
+        std::string body = {};
+    };
+
+    enum class State {
+        Active,
+        Inactive,
+        Unknown,
+    };
+
+    struct Conditional {
+        State parent;
+
+        State current = State::Inactive;
+
+        /// Whether a branch of the group is known to be taken.
+        bool taken = false;
+
+        /// Whether a branch whose condition is unknown came before.
+        bool maybe_taken = false;
+    };
+
+    using Value = std::optional<std::int64_t>;
+
+    /// A cursor over the tokens of a condition.
+    struct Expression {
+        llvm::StringRef content;
+        llvm::ArrayRef<dds::Token> tokens;
+        std::size_t pos = 0;
+        unsigned depth = 0;
+        bool failed = false;
+
+        bool at(clang::tok::TokenKind kind) const {
+            return pos < tokens.size() && tokens[pos].is(kind);
+        }
+
+        llvm::StringRef spelling() const {
+            return content.substr(tokens[pos].Offset, tokens[pos].Length);
+        }
+
+        bool done() const {
+            return pos == tokens.size() || tokens[pos].is(clang::tok::eod);
+        }
+    };
+
+    State state() const {
+        return conditionals.empty() ? State::Active : conditionals.back().current;
+    }
+
+    /// Enter the branch of `frame` whose condition is `holds`; one is taken
+    /// when its condition holds and no branch before it was.
+    static void enter_branch(Conditional& frame, std::optional<bool> holds) {
+        if(holds == false) {
+            frame.current = State::Inactive;
+            return;
+        }
+        bool definite = holds.has_value() && !frame.maybe_taken;
+        frame.current =
+            definite && frame.parent == State::Active ? State::Active : State::Unknown;
+        if(definite) {
+            frame.taken = true;
+        } else {
+            frame.maybe_taken = true;
+        }
+    }
+
+    /// The tokens of a directive after its keyword.
+    static llvm::ArrayRef<dds::Token> operands(const dds::Directive& dir) {
+        auto tokens = dir.Tokens;
+        while(!tokens.empty() && !tokens.front().is(clang::tok::raw_identifier)) {
+            tokens = tokens.drop_front();
+        }
+        return tokens.empty() ? tokens : tokens.drop_front();
+    }
+
+    static bool is_reserved(llvm::StringRef name) {
+        return name.starts_with("__") ||
+               (name.size() > 1 && name[0] == '_' && llvm::isUpper(name[1]));
+    }
+
+    /// Whether `name`, no macro here, may still be one: an #include before
+    /// may define it, and the compiler predefines reserved names, and in
+    /// GNU modes also ones such as `linux` and `unix`.
+    bool may_be_macro(llvm::StringRef name) const {
+        return included || gnu || is_reserved(name);
+    }
+
+    /// Whether `name` is a macro; unknown when it may be one defined
+    /// elsewhere (see may_be_macro()).
+    std::optional<bool> is_defined(llvm::StringRef name) const {
+        auto it = macros.find(name);
+        if(it != macros.end()) {
+            switch(it->second.kind) {
+                case Macro::Object:
+                case Macro::Function: return true;
+                case Macro::Undefined: return false;
+                case Macro::Unknown: return std::nullopt;
+            }
+        }
+        if(may_be_macro(name)) {
+            return std::nullopt;
+        }
+        return false;
+    }
+
+    void define(llvm::StringRef content, const dds::Directive& dir) {
+        auto tokens = operands(dir);
+        if(tokens.empty() || !tokens.front().is(clang::tok::raw_identifier)) {
+            return;
+        }
+        auto& name = tokens.front();
+        auto& macro = macros[content.substr(name.Offset, name.Length)];
+        if(state() == State::Unknown) {
+            macro = Macro{Macro::Unknown};
+            return;
+        }
+        if(dir.Kind == dds::pp_undef) {
+            macro = Macro{Macro::Undefined};
+            return;
+        }
+
+        // A '(' right after the name makes a function-like macro.
+        tokens = tokens.drop_front();
+        if(!tokens.empty() && tokens.front().is(clang::tok::l_paren) &&
+           tokens.front().Offset == name.Offset + name.Length) {
+            macro = Macro{Macro::Function};
+            return;
+        }
+        if(!tokens.empty() && tokens.back().is(clang::tok::eod)) {
+            tokens = tokens.drop_back();
+        }
+        std::string body;
+        if(!tokens.empty()) {
+            auto begin = tokens.front().Offset;
+            auto end = tokens.back().Offset + tokens.back().Length;
+            body = content.slice(begin, end).str();
+        }
+        macro = Macro{Macro::Object, std::move(body)};
+    }
+
+    std::optional<bool> condition(llvm::StringRef content, const dds::Directive& dir) {
+        auto tokens = operands(dir);
+        if(dir.Kind != dds::pp_if && dir.Kind != dds::pp_elif) {
+            if(tokens.empty() || !tokens.front().is(clang::tok::raw_identifier)) {
+                return std::nullopt;
+            }
+            auto& name = tokens.front();
+            auto defined = is_defined(content.substr(name.Offset, name.Length));
+            bool negated = dir.Kind == dds::pp_ifndef || dir.Kind == dds::pp_elifndef;
+            if(!defined) {
+                return std::nullopt;
+            }
+            return *defined != negated;
+        }
+
+        Expression expr{content, tokens};
+        auto value = evaluate(expr);
+        if(expr.failed || !value) {
+            return std::nullopt;
+        }
+        return *value != 0;
+    }
+
+    /// Evaluate a whole condition; fails unless every token is consumed.
+    Value evaluate(Expression& expr) {
+        auto value = ternary(expr);
+        if(!expr.done()) {
+            expr.failed = true;
+        }
+        return expr.failed ? std::nullopt : value;
+    }
+
+    Value ternary(Expression& expr) {
+        auto cond = binary(expr, 1);
+        if(!expr.at(clang::tok::question)) {
+            return cond;
+        }
+        ++expr.pos;
+        auto lhs = ternary(expr);
+        if(!expr.at(clang::tok::colon)) {
+            expr.failed = true;
+            return std::nullopt;
+        }
+        ++expr.pos;
+        auto rhs = ternary(expr);
+        if(cond) {
+            return *cond ? lhs : rhs;
+        }
+        return lhs == rhs ? lhs : std::nullopt;
+    }
+
+    static unsigned precedence(clang::tok::TokenKind kind) {
+        switch(kind) {
+            case clang::tok::pipepipe: return 1;
+            case clang::tok::ampamp: return 2;
+            case clang::tok::pipe: return 3;
+            case clang::tok::caret: return 4;
+            case clang::tok::amp: return 5;
+            case clang::tok::equalequal:
+            case clang::tok::exclaimequal: return 6;
+            case clang::tok::less:
+            case clang::tok::greater:
+            case clang::tok::lessequal:
+            case clang::tok::greaterequal: return 7;
+            case clang::tok::lessless:
+            case clang::tok::greatergreater: return 8;
+            case clang::tok::plus:
+            case clang::tok::minus: return 9;
+            case clang::tok::star:
+            case clang::tok::slash:
+            case clang::tok::percent: return 10;
+            default: return 0;
+        }
+    }
+
+    Value binary(Expression& expr, unsigned min_precedence) {
+        auto lhs = unary(expr);
+        while(!expr.failed && !expr.done()) {
+            auto kind = expr.tokens[expr.pos].Kind;
+            auto prec = precedence(kind);
+            if(prec == 0 || prec < min_precedence) {
                 break;
             }
+            ++expr.pos;
+            auto rhs = binary(expr, prec + 1);
+            lhs = apply(kind, lhs, rhs);
+        }
+        return lhs;
+    }
+
+    static Value apply(clang::tok::TokenKind kind, Value lhs, Value rhs) {
+        // Either side alone may decide a logical operator.
+        if(kind == clang::tok::ampamp && (lhs == 0 || rhs == 0)) {
+            return 0;
+        }
+        if(kind == clang::tok::pipepipe && ((lhs && *lhs) || (rhs && *rhs))) {
+            return 1;
+        }
+        if(!lhs || !rhs) {
+            return std::nullopt;
+        }
+        auto a = *lhs;
+        auto b = *rhs;
+        // Overflow wraps, as it does in clang's preprocessor, rather than
+        // being undefined here.
+        auto ua = static_cast<std::uint64_t>(a);
+        auto ub = static_cast<std::uint64_t>(b);
+        switch(kind) {
+            case clang::tok::pipepipe: return a || b;
+            case clang::tok::ampamp: return a && b;
+            case clang::tok::pipe: return a | b;
+            case clang::tok::caret: return a ^ b;
+            case clang::tok::amp: return a & b;
+            case clang::tok::equalequal: return a == b;
+            case clang::tok::exclaimequal: return a != b;
+            case clang::tok::less: return a < b;
+            case clang::tok::greater: return a > b;
+            case clang::tok::lessequal: return a <= b;
+            case clang::tok::greaterequal: return a >= b;
+            case clang::tok::lessless: return b < 0 || b >= 64 ? Value() : wrap(ua << b);
+            case clang::tok::greatergreater: return b < 0 || b >= 64 ? Value() : Value(a >> b);
+            case clang::tok::plus: return wrap(ua + ub);
+            case clang::tok::minus: return wrap(ua - ub);
+            case clang::tok::star: return wrap(ua * ub);
+            case clang::tok::slash: return divisible(a, b) ? Value(a / b) : Value();
+            case clang::tok::percent: return divisible(a, b) ? Value(a % b) : Value();
+            default: return std::nullopt;
+        }
+    }
+
+    static Value wrap(std::uint64_t value) {
+        return static_cast<std::int64_t>(value);
+    }
+
+    /// Whether `a / b` is defined: not by zero, nor the one quotient that
+    /// does not fit.
+    static bool divisible(std::int64_t a, std::int64_t b) {
+        return b != 0 && !(b == -1 && a == std::numeric_limits<std::int64_t>::min());
+    }
+
+    Value unary(Expression& expr) {
+        if(expr.done()) {
+            expr.failed = true;
+            return std::nullopt;
+        }
+        auto kind = expr.tokens[expr.pos].Kind;
+        switch(kind) {
+            case clang::tok::exclaim:
+            case clang::tok::minus:
+            case clang::tok::plus:
+            case clang::tok::tilde: {
+                ++expr.pos;
+                auto value = unary(expr);
+                if(!value) {
+                    return std::nullopt;
+                }
+                if(kind == clang::tok::exclaim) {
+                    return !*value;
+                }
+                if(kind == clang::tok::minus) {
+                    return wrap(-static_cast<std::uint64_t>(*value));
+                }
+                return kind == clang::tok::tilde ? ~*value : *value;
+            }
+            case clang::tok::l_paren: {
+                ++expr.pos;
+                auto value = ternary(expr);
+                if(!expr.at(clang::tok::r_paren)) {
+                    expr.failed = true;
+                    return std::nullopt;
+                }
+                ++expr.pos;
+                return value;
+            }
+            case clang::tok::numeric_constant: {
+                auto spelling = expr.spelling();
+                ++expr.pos;
+                return number(expr, spelling);
+            }
+            case clang::tok::raw_identifier: {
+                auto name = expr.spelling();
+                ++expr.pos;
+                if(name == "defined") {
+                    return defined(expr);
+                }
+                if(name == "true" || name == "false") {
+                    return name == "true";
+                }
+                return identifier(expr, name);
+            }
             default: {
-                break;
+                // Character literals and anything else are left to the
+                // preprocessor.
+                expr.failed = true;
+                return std::nullopt;
             }
         }
     }
 
-    return result;
+    static Value number(Expression& expr, llvm::StringRef spelling) {
+        std::string digits;
+        for(char c: spelling.rtrim("uUlLzZ")) {
+            if(c != '\'') {
+                digits += c;
+            }
+        }
+        std::uint64_t value;
+        if(llvm::StringRef(digits).getAsInteger(0, value)) {
+            expr.failed = true;
+            return std::nullopt;
+        }
+        return static_cast<std::int64_t>(value);
+    }
+
+    Value defined(Expression& expr) {
+        bool paren = expr.at(clang::tok::l_paren);
+        if(paren) {
+            ++expr.pos;
+        }
+        if(!expr.at(clang::tok::raw_identifier)) {
+            expr.failed = true;
+            return std::nullopt;
+        }
+        auto result = is_defined(expr.spelling());
+        ++expr.pos;
+        if(paren) {
+            if(!expr.at(clang::tok::r_paren)) {
+                expr.failed = true;
+                return std::nullopt;
+            }
+            ++expr.pos;
+        }
+        if(!result) {
+            return std::nullopt;
+        }
+        return *result;
+    }
+
+    /// The value of an identifier: its macro's replacement evaluated, or zero
+    /// when it is no macro.
+    Value identifier(Expression& expr, llvm::StringRef name) {
+        auto it = macros.find(name);
+        if(it == macros.end() || it->second.kind == Macro::Undefined) {
+            if(it == macros.end() && may_be_macro(name)) {
+                // A header or the compiler may make it a function-like
+                // macro, so nothing after it can be trusted either.
+                if(expr.at(clang::tok::l_paren)) {
+                    expr.failed = true;
+                }
+                return std::nullopt;
+            }
+            return 0;
+        }
+        if(it->second.kind != Macro::Object || expr.depth == 16) {
+            expr.failed = true;
+            return std::nullopt;
+        }
+
+        // Lex the replacement as the condition of an #if of its own.
+        auto text = "#if " + it->second.body + "\n";
+        llvm::SmallVector<dds::Token> tokens;
+        llvm::SmallVector<dds::Directive> directives;
+        if(clang::scanSourceForDependencyDirectives(text, tokens, directives) ||
+           directives.empty() || directives.front().Kind != dds::pp_if) {
+            expr.failed = true;
+            return std::nullopt;
+        }
+        Expression replacement{text, operands(directives.front())};
+        replacement.depth = expr.depth + 1;
+        auto value = evaluate(replacement);
+        if(replacement.failed) {
+            expr.failed = true;
+        }
+        return value;
+    }
+
+    llvm::StringMap<Macro> macros;
+
+    llvm::SmallVector<Conditional> conditionals;
+
+    /// Whether an #include was reached, after which any macro not known
+    /// here may have been defined.
+    bool included = false;
+
+    /// Whether the language mode is a GNU one, the default without -std.
+    bool gnu = true;
+};
+
+}  // namespace
+
+std::optional<ScanResult> evaluate_module_decl(llvm::StringRef content,
+                                               llvm::ArrayRef<const char*> arguments) {
+    std::string directive_lines;
+    if(filter_directive_lines(content, directive_lines)) {
+        content = directive_lines;
+    }
+
+    llvm::SmallVector<dds::Token> tokens;
+    llvm::SmallVector<dds::Directive> directives;
+    if(clang::scanSourceForDependencyDirectives(content, tokens, directives)) {
+        return std::nullopt;
+    }
+    return ConditionEvaluator(arguments).run(content, directives);
 }
 
 namespace {
 
 class ScanDirectivesGetter : public clang::DependencyDirectivesGetter {
 public:
-    ScanDirectivesGetter(SharedScanCache* cache, clang::FileManager& file_mgr) :
-        cache(cache), file_mgr(&file_mgr) {}
+    ScanDirectivesGetter(SharedScanCache* cache,
+                         clang::FileManager& file_mgr,
+                         llvm::ArrayRef<std::string> skipped = {}) :
+        cache(cache), file_mgr(&file_mgr) {
+        for(auto& file: skipped) {
+            this->skipped.insert(file);
+        }
+    }
 
     std::unique_ptr<clang::DependencyDirectivesGetter>
         cloneFor(clang::FileManager& new_file_mgr) override {
-        return std::make_unique<ScanDirectivesGetter>(cache, new_file_mgr);
+        auto clone = std::make_unique<ScanDirectivesGetter>(cache, new_file_mgr);
+        clone->skipped = skipped;
+        return clone;
     }
 
     std::optional<llvm::ArrayRef<clang::dependency_directives_scan::Directive>>
@@ -139,12 +1062,21 @@ public:
         if(path.empty()) {
             path = file.getName();
         }
+        if(!skipped.empty() && (skipped.contains(path) || skipped.contains(file.getName()))) {
+            return std::nullopt;
+        }
 
-        // Check cache first.
+        // Check cache first; an entry outlives compiles when the cache does,
+        // so it must still describe the file.
+        auto size = static_cast<std::int64_t>(file.getSize());
+        auto mtime = static_cast<std::int64_t>(file.getModificationTime());
         if(cache) {
             auto it = cache->entries.find(path);
             if(it != cache->entries.end()) {
-                return llvm::ArrayRef(it->second.directives);
+                if(it->second.size == size && it->second.mtime == mtime) {
+                    return llvm::ArrayRef(it->second.directives);
+                }
+                cache->entries.erase(it);
             }
         }
 
@@ -169,6 +1101,8 @@ public:
         }
 
         entry_ptr->source = std::move(source);
+        entry_ptr->size = size;
+        entry_ptr->mtime = mtime;
 
         if(clang::scanSourceForDependencyDirectives(entry_ptr->source,
                                                     entry_ptr->tokens,
@@ -188,6 +1122,7 @@ public:
 private:
     SharedScanCache* cache;
     clang::FileManager* file_mgr;
+    llvm::StringSet<> skipped;
     std::deque<SharedScanCache::CachedEntry> local_entries;
 };
 
@@ -328,6 +1263,13 @@ std::unique_ptr<clang::CompilerInstance>
 
 }  // namespace
 
+std::unique_ptr<clang::DependencyDirectivesGetter>
+    directives_getter(SharedScanCache* cache,
+                      clang::FileManager& file_mgr,
+                      llvm::ArrayRef<std::string> skipped) {
+    return std::make_unique<ScanDirectivesGetter>(cache, file_mgr, skipped);
+}
+
 ScanResult scan_precise(llvm::ArrayRef<const char*> arguments,
                         llvm::StringRef directory,
                         llvm::StringRef content,
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -11,6 +13,13 @@
 #include "llvm/Support/VirtualFileSystem.h"
 #include "clang/Lex/DependencyDirectivesScanner.h"
 
+namespace clang {
+
+class DependencyDirectivesGetter;
+class FileManager;
+
+}  // namespace clang
+
 namespace clice {
 
 struct ScanResult {
@@ -61,12 +70,27 @@ struct SharedScanCache {
 
         /// Scanned directives (referencing tokens above).
         llvm::SmallVector<clang::dependency_directives_scan::Directive> directives;
+
+        /// Size and modification time of the file when scanned; an entry
+        /// whose file no longer matches is scanned again.
+        std::int64_t size = -1;
+        std::int64_t mtime = 0;
     };
 
     /// path -> cached scan result.
     llvm::StringMap<CachedEntry> entries;
 };
 
+/// Hand a preprocessor the dependency directives of the files it enters,
+/// scanned once into `cache` (or a private one when null), so that only
+/// their directives are lexed.  For preprocessing alone: a file entered so
+/// yields no other token.  Files in `skipped`, such as ones whose buffer is
+/// remapped, are lexed in full.  `cache` is not locked: one user at a time.
+std::unique_ptr<clang::DependencyDirectivesGetter>
+    directives_getter(SharedScanCache* cache,
+                      clang::FileManager& file_mgr,
+                      llvm::ArrayRef<std::string> skipped = {});
+
 /// Quick lexer-based scan for module name and include file names.
 /// If module declaration is inside #if/#ifdef, sets need_preprocess=true
 /// and module_name will be empty.
@@ -95,6 +119,17 @@ ScanResult scan_module_decl(llvm::ArrayRef<const char*> arguments,
                             SharedScanCache* cache = nullptr,
                             llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> vfs = nullptr);
 
+/// Decide a module declaration `scan()` left to the preprocessor without
+/// running one: evaluates the conditionals over the dependency directives of
+/// `content`, knowing the macros `arguments` define or undefine (-D/-U) and
+/// the ones the file defines itself.  Returns std::nullopt when that is not
+/// enough -- a condition uses a macro an earlier #include may define, one the
+/// compiler may predefine (any unknown name in GNU modes), or a function-like
+/// macro -- and `scan_module_decl()` has to run.  Only populates
+/// `module_name` and `is_interface_unit`.
+std::optional<ScanResult> evaluate_module_decl(llvm::StringRef content,
+                                               llvm::ArrayRef<const char*> arguments);
+
 /// Compute preamble bound (moved from compile/preamble).
 std::uint32_t compute_preamble_bound(llvm::StringRef content);
 
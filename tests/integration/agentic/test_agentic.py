@@ -206,6 +206,38 @@ async def test_rpc_project_files_filter(indexed_agentic, workspace):
         assert f["kind"] == "source"
 
 
+@pytest.mark.workspace("index_features")
+async def test_rpc_project_files_pages(indexed_agentic, workspace):
+    rpc, _ = indexed_agentic
+    everything = rpc.request("agentic/projectFiles", {"fields": []})["result"]
+    assert all("kind" not in f for f in everything["files"])
+    expected = [f["path"] for f in everything["files"]]
+    assert everything["matched"] == len(expected)
+
+    # One file per page, in the same order as the full listing.
+    paged = []
+    cursor = None
+    while True:
+        params = {"limit": 1, "fields": []}
+        if cursor:
+            params["cursor"] = cursor
+        page = rpc.request("agentic/projectFiles", params)["result"]
+        paged += [f["path"] for f in page["files"]]
+        cursor = page.get("nextCursor")
+        if not cursor:
+            break
+    assert paged == expected
+
+    cpp = rpc.request("agentic/projectFiles", {"glob": "**/*.cpp"})["result"]
+    assert cpp["files"] and all(f["path"].endswith(".cpp") for f in cpp["files"])
+
+    fuzzy = rpc.request("agentic/projectFiles", {"query": "main"})["result"]
+    assert fuzzy["files"][0]["path"].endswith("main.cpp")
+
+    bad = rpc.request("agentic/projectFiles", {"glob": "{"})
+    assert "error" in bad
+
+
 @pytest.mark.workspace("index_features")
 async def test_rpc_symbol_search(indexed_agentic, workspace):
     rpc, _ = indexed_agentic
@@ -336,6 +368,60 @@ async def test_rpc_references_include_decl(indexed_agentic, workspace):
     assert 31 in lines, f"expected declaration line 31 in {lines}"
 
 
+@pytest.mark.workspace("index_features")
+async def test_rpc_references_paged(indexed_agentic, workspace):
+    rpc, _ = indexed_agentic
+    lines = []
+    cursor = None
+    for _ in range(10):
+        params = {"name": "global_var", "includeDeclaration": True, "limit": 1}
+        if cursor is not None:
+            params["cursor"] = cursor
+        resp = rpc.request("agentic/references", params)
+        assert "result" in resp, f"unexpected response: {resp}"
+        result = resp["result"]
+        assert result["total"] <= 1
+        lines += [r["line"] for r in result["references"]]
+        cursor = result.get("nextCursor")
+        if cursor is None:
+            break
+    assert cursor is None, "pagination did not finish"
+    assert sorted(lines) == [31, 34, 38]
+
+    resp = rpc.request("agentic/references", {"name": "global_var", "cursor": "bogus"})
+    assert "error" in resp
+
+
+@pytest.mark.workspace("index_features")
+async def test_rpc_compact_paths(indexed_agentic, workspace):
+    rpc, _ = indexed_agentic
+    resp = rpc.request("agentic/configure", {"compactPaths": True})
+    assert resp["result"]["compactPaths"] is True
+
+    params = {"name": "global_var", "includeDeclaration": True}
+    first = rpc.request("agentic/references", params)["result"]
+    names = {p["id"]: p["path"] for p in first["newPaths"]}
+    assert names
+    for ref in first["references"]:
+        assert "file" not in ref
+        assert "main.cpp" in names[ref["fileId"]]
+
+    # Paths already sent are not sent again.
+    second = rpc.request("agentic/references", params)["result"]
+    assert "newPaths" not in second
+    assert [r["fileId"] for r in second["references"]] == [
+        r["fileId"] for r in first["references"]
+    ]
+
+    files = rpc.request("agentic/projectFiles", {})["result"]
+    names.update({p["id"]: p["path"] for p in files.get("newPaths", [])})
+    assert all(f["pathId"] in names for f in files["files"])
+
+    rpc.request("agentic/configure", {"compactPaths": False})
+    plain = rpc.request("agentic/references", params)["result"]
+    assert all("main.cpp" in r["file"] for r in plain["references"])
+
+
 @pytest.mark.workspace("index_features")
 async def test_rpc_call_graph_incoming(indexed_agentic, workspace):
     rpc, _ = indexed_agentic
@@ -473,6 +559,29 @@ async def test_rpc_symbol_id_roundtrip(indexed_agentic, workspace):
     assert defn["result"]["symbolId"] == compute["symbolId"]
 
 
+@pytest.mark.workspace("index_features")
+async def test_rpc_batch(indexed_agentic, workspace):
+    rpc, _ = indexed_agentic
+    resp = rpc.request(
+        "agentic/batch",
+        {
+            "queries": [
+                {"symbolSearch": {"query": "add"}},
+                {"definition": {"name": "add"}},
+                {"definition": {"name": "nonexistent_symbol_xyz"}},
+                {},
+            ]
+        },
+    )
+    assert "result" in resp, f"unexpected response: {resp}"
+    answers = resp["result"]["answers"]
+    assert len(answers) == 4
+    assert any(s["name"] == "add" for s in answers[0]["symbolSearch"]["symbols"])
+    assert answers[1]["definition"]["name"] == "add"
+    assert "error" in answers[2]
+    assert "error" in answers[3]
+
+
 @pytest.mark.workspace("index_features")
 async def test_rpc_file_deps(indexed_agentic, workspace):
     rpc, _ = indexed_agentic
@@ -1,8 +1,8 @@
 """Integration tests for persistent PCH/PCM cache.
 
 Verifies that PCH/PCM artifacts are written to the unified cache store
-(.clice/cache/v1/{pch,pcm}/) with content-addressed filenames, survive
-server restarts via cache.json, and are properly reused across sessions.
+(.clice/cache/v3/{pch,pcm}/) with content-addressed filenames, survive
+server restarts via cache.bin, and are properly reused across sessions.
 """
 
 import asyncio
@@ -23,7 +23,7 @@ from tests.integration.utils.cache import (
     list_pcm_files,
     list_tmp_files,
     pin_cache_to_workspace,
-    read_cache_json,
+    read_cache_meta,
 )
 from tests.integration.utils.assertions import assert_clean_compile
 
@@ -51,8 +51,8 @@ async def test_pch_written_to_cache_dir(client, tmp_path):
     )
 
 
-async def test_cache_json_persisted(client, tmp_path):
-    """After a PCH build, cache.json should be written with the entry."""
+async def test_cache_meta_persisted(client, tmp_path):
+    """After a PCH build, cache.bin should be written with the entry."""
     pin_cache_to_workspace(tmp_path)
     (tmp_path / "header.h").write_text("#pragma once\nint global_val = 42;\n")
     (tmp_path / "main.cpp").write_text(
@@ -64,10 +64,10 @@ async def test_cache_json_persisted(client, tmp_path):
     uri, _ = await client.open_and_wait(tmp_path / "main.cpp")
     assert_clean_compile(client, uri)
 
-    cache = read_cache_json(tmp_path)
-    assert cache is not None, "cache.json should exist after PCH build"
-    assert "pch" in cache, "cache.json should have 'pch' section"
-    assert len(cache["pch"]) >= 1, "Expected at least one PCH entry in cache.json"
+    cache = read_cache_meta(tmp_path)
+    assert cache is not None, "cache.bin should exist after PCH build"
+    assert "pch" in cache, "cache.bin should have 'pch' section"
+    assert len(cache["pch"]) >= 1, "Expected at least one PCH entry in cache.bin"
 
     # Verify the entry has expected fields.
     entry = cache["pch"][0]
@@ -113,7 +113,7 @@ async def test_pch_reused_on_close_reopen(client, tmp_path):
 
 
 async def test_pch_survives_server_restart(executable, tmp_path):
-    """PCH cache should survive a full server restart — cache.json is
+    """PCH cache should survive a full server restart — cache.bin is
     loaded on startup and the existing .pch file is reused."""
     pin_cache_to_workspace(tmp_path)
     (tmp_path / "header.h").write_text("#pragma once\nstruct Baz { int z; };\n")
@@ -131,8 +131,8 @@ async def test_pch_survives_server_restart(executable, tmp_path):
     assert len(pch_files_s1) >= 1, "PCH should be created in session 1"
     pch_mtime_s1 = pch_files_s1[0].stat().st_mtime
 
-    cache_s1 = read_cache_json(tmp_path)
-    assert cache_s1 is not None, "cache.json should exist after session 1"
+    cache_s1 = read_cache_meta(tmp_path)
+    assert cache_s1 is not None, "cache.bin should exist after session 1"
 
     await shutdown_client(c1)
 
@@ -155,6 +155,65 @@ async def test_pch_survives_server_restart(executable, tmp_path):
     await shutdown_client(c2)
 
 
+async def wait_for_compile_result(workspace, timeout: float = 10.0) -> dict:
+    """Wait until cache.bin records a compile result, and return it."""
+    deadline = asyncio.get_running_loop().time() + timeout
+    while True:
+        cache = read_cache_meta(workspace)
+        if cache and cache.get("compile"):
+            return cache["compile"][0]
+        assert asyncio.get_running_loop().time() < deadline, "No compile result cached"
+        await asyncio.sleep(0.1)
+
+
+async def test_cached_diagnostics_on_reopen(executable, tmp_path):
+    """An unchanged file reopened after a restart gets its diagnostics from
+    the cache on didOpen, before any request builds the AST."""
+    pin_cache_to_workspace(tmp_path)
+    (tmp_path / "header.h").write_text("#pragma once\nstruct Qux { int q; };\n")
+    (tmp_path / "main.cpp").write_text(
+        '#include "header.h"\nint main() { Qux q; return q.missing; }\n'
+    )
+    write_cdb(tmp_path, ["main.cpp"])
+
+    c1 = await make_client(executable, tmp_path)
+    uri, _ = await c1.open_and_wait(tmp_path / "main.cpp")
+    assert len(c1.diagnostics[uri]) >= 1
+    entry = await wait_for_compile_result(tmp_path)
+    assert (cache_root(tmp_path) / "compile" / f"{entry['key']}.json").exists()
+    await shutdown_client(c1)
+
+    c2 = await make_client(executable, tmp_path)
+    uri2, _ = c2.open(tmp_path / "main.cpp")
+    await c2.wait_diagnostics(uri2, timeout=10.0)
+    messages = [d.message for d in c2.diagnostics[uri2]]
+    assert any("missing" in m for m in messages), messages
+    await shutdown_client(c2)
+
+
+async def test_no_cached_diagnostics_after_header_change(executable, tmp_path):
+    """A cached result whose dependencies changed on disk is not published."""
+    pin_cache_to_workspace(tmp_path)
+    (tmp_path / "header.h").write_text("#pragma once\nstruct Qux { int q; };\n")
+    (tmp_path / "main.cpp").write_text(
+        '#include "header.h"\nint main() { Qux q; return q.missing; }\n'
+    )
+    write_cdb(tmp_path, ["main.cpp"])
+
+    c1 = await make_client(executable, tmp_path)
+    await c1.open_and_wait(tmp_path / "main.cpp")
+    await wait_for_compile_result(tmp_path)
+    await shutdown_client(c1)
+
+    (tmp_path / "header.h").write_text("#pragma once\nstruct Qux { int missing; };\n")
+
+    c2 = await make_client(executable, tmp_path)
+    uri2, _ = c2.open(tmp_path / "main.cpp")
+    with pytest.raises(asyncio.TimeoutError):
+        await c2.wait_diagnostics(uri2, timeout=2.0)
+    await shutdown_client(c2)
+
+
 async def test_shared_preamble_shares_pch(client, tmp_path):
     """Two files with identical preambles should share the same PCH file
     (content-addressed by preamble hash)."""
@@ -181,6 +240,32 @@ async def test_shared_preamble_shares_pch(client, tmp_path):
         f"Expected exactly 1 PCH file for shared preamble, got {len(pch_files)}: "
         f"{[f.name for f in pch_files]}"
     )
+    # The in-memory cache is keyed by content too, so the two files share
+    # one entry instead of tracking the same blob twice.
+    cache = read_cache_meta(tmp_path)
+    assert cache is not None and len(cache["pch"]) == 1
+
+
+async def test_cache_meta_appends_changes(client, tmp_path):
+    """A later build appends its entries to cache.bin instead of rewriting
+    it, and paths are stored once however many entries name them."""
+    pin_cache_to_workspace(tmp_path)
+    (tmp_path / "a.h").write_text("#pragma once\nint val_a = 1;\n")
+    (tmp_path / "b.h").write_text('#pragma once\n#include "a.h"\nint val_b = 2;\n')
+    (tmp_path / "a.cpp").write_text('#include "a.h"\nint fa() { return val_a; }\n')
+    (tmp_path / "b.cpp").write_text('#include "b.h"\nint fb() { return val_b; }\n')
+    write_cdb(tmp_path, ["a.cpp", "b.cpp"])
+    await client.initialize(tmp_path)
+
+    await client.open_and_wait(tmp_path / "a.cpp")
+    before = (cache_root(tmp_path) / "cache.bin").read_bytes()
+    await client.open_and_wait(tmp_path / "b.cpp")
+    after = (cache_root(tmp_path) / "cache.bin").read_bytes()
+    assert len(after) > len(before) and after.startswith(before)
+
+    cache = read_cache_meta(tmp_path)
+    assert cache is not None and len(cache["pch"]) == 2
+    assert len(cache["paths"]) == len(set(cache["paths"]))
 
 
 async def test_different_preamble_different_pch(client, tmp_path):
@@ -206,6 +291,81 @@ async def test_different_preamble_different_pch(client, tmp_path):
     )
 
 
+async def test_appended_include_chains_pch(client, tmp_path):
+    """Appending an include to a preamble that already has a PCH should
+    build a delta PCH chained on the old one instead of a full rebuild."""
+    pin_cache_to_workspace(tmp_path)
+    (tmp_path / "a.h").write_text("#pragma once\nint val_a = 1;\n")
+    (tmp_path / "b.h").write_text("#pragma once\nint val_b = 2;\n")
+    (tmp_path / "main.cpp").write_text('#include "a.h"\nint f() { return val_a; }\n')
+    write_cdb(tmp_path, ["main.cpp"])
+    await client.initialize(tmp_path)
+
+    uri, _ = await client.open_and_wait(tmp_path / "main.cpp")
+    assert_clean_compile(client, uri)
+
+    client.text_document_did_close(DidCloseTextDocumentParams(text_document=doc(uri)))
+    await asyncio.sleep(0.5)
+    client.diagnostics.pop(uri, None)
+    (tmp_path / "main.cpp").write_text(
+        '#include "a.h"\n#include "b.h"\nint f() { return val_a + val_b; }\n'
+    )
+
+    uri2, _ = await client.open_and_wait(tmp_path / "main.cpp")
+    assert_clean_compile(client, uri2)
+
+    cache = read_cache_meta(tmp_path)
+    assert cache is not None and len(cache["pch"]) == 2
+    keys = {entry["key"] for entry in cache["pch"]}
+    chained = [entry for entry in cache["pch"] if entry.get("base")]
+    assert len(chained) == 1, f"Expected one chained PCH, got: {cache['pch']}"
+    assert chained[0]["base"] in keys
+
+
+async def _wait_pch_count(workspace, count: int, deadline: float = 30.0) -> list:
+    end = asyncio.get_event_loop().time() + deadline
+    while asyncio.get_event_loop().time() < end:
+        if len(list_pch_files(workspace)) >= count:
+            break
+        await asyncio.sleep(0.2)
+    return list_pch_files(workspace)
+
+
+async def test_pch_prewarmed_on_open(client, tmp_path):
+    """didOpen alone should start the PCH build, before any feature request
+    asks for it."""
+    pin_cache_to_workspace(tmp_path)
+    (tmp_path / "header.h").write_text("#pragma once\nint warm = 1;\n")
+    (tmp_path / "main.cpp").write_text('#include "header.h"\nint f() { return warm; }\n')
+    write_cdb(tmp_path, ["main.cpp"])
+    await client.initialize(tmp_path)
+
+    client.open(tmp_path / "main.cpp")
+    pch_files = await _wait_pch_count(tmp_path, 1)
+    assert len(pch_files) == 1, "didOpen should build the PCH speculatively"
+
+
+async def test_neighbour_pch_warmed_when_idle(client, tmp_path):
+    """Opening a file should also warm the PCH of a source file in the same
+    directory once background indexing is idle."""
+    pin_cache_to_workspace(tmp_path)
+    (tmp_path / "a.h").write_text("#pragma once\nint val_a = 1;\n")
+    (tmp_path / "b.h").write_text("#pragma once\nint val_b = 2;\n")
+    (tmp_path / "a.cpp").write_text('#include "a.h"\nint fa() { return val_a; }\n')
+    (tmp_path / "b.cpp").write_text('#include "b.h"\nint fb() { return val_b; }\n')
+    write_cdb(tmp_path, ["a.cpp", "b.cpp"])
+    await client.initialize(tmp_path)
+
+    uri_a, _ = await client.open_and_wait(tmp_path / "a.cpp")
+    assert_clean_compile(client, uri_a)
+
+    # b.cpp is never opened; its PCH comes from neighbour warm-up.
+    pch_files = await _wait_pch_count(tmp_path, 2)
+    assert len(pch_files) == 2, (
+        f"Expected the neighbour's PCH to be warmed, got: {[f.name for f in pch_files]}"
+    )
+
+
 async def test_pch_rebuilt_on_header_change(client, tmp_path):
     """When a preamble header changes, a new PCH should be built
     (different hash → different filename). The old one remains for cleanup."""
@@ -0,0 +1,52 @@
+"""Integration tests for the clice/workerStats extension request."""
+
+import pytest
+
+
+def get_field(obj, key, default=None):
+    if isinstance(obj, dict):
+        return obj.get(key, default)
+    return getattr(obj, key, default)
+
+
+@pytest.mark.workspace("hello_world")
+async def test_worker_stats_reports_workers(client, workspace):
+    """After a compile, the owning stateful worker has a latency sample."""
+    await client.open_and_wait(workspace / "main.cpp")
+
+    result = await client.worker_stats()
+    assert result is not None
+
+    workers = get_field(result, "workers", [])
+    assert workers, "Should report at least one worker"
+    assert any(get_field(w, "stateful") for w in workers)
+    assert any(get_field(w, "stateful") is False for w in workers)
+
+    bounds = get_field(result, "bucketBoundsMs", [])
+    for w in workers:
+        latency = get_field(w, "latency")
+        assert len(get_field(latency, "buckets", [])) == len(bounds) + 1
+
+    stateful_requests = sum(
+        get_field(get_field(w, "latency"), "count", 0)
+        for w in workers
+        if get_field(w, "stateful")
+    )
+    assert stateful_requests >= 1
+
+    priorities = [get_field(q, "priority") for q in get_field(result, "queues", [])]
+    assert priorities == ["High", "Low"]
+
+
+@pytest.mark.workspace("hello_world")
+async def test_worker_stats_reset(client, workspace):
+    """reset=true returns the current figures and clears them."""
+    await client.open_and_wait(workspace / "main.cpp")
+
+    await client.worker_stats(reset=True)
+    result = await client.worker_stats()
+    # Background indexing may land on stateless workers in between; the
+    # stateful worker stays idle.
+    for w in get_field(result, "workers", []):
+        if get_field(w, "stateful"):
+            assert get_field(get_field(w, "latency"), "count", 0) == 0
@@ -106,6 +106,52 @@ async def test_include_completion_empty_prefix(client, workspace):
     client.close(uri)
 
 
+@pytest.mark.workspace("include_completion")
+async def test_completion_narrows_while_typing(client, workspace):
+    """Extending the completed identifier narrows the previous items."""
+    uri, _ = await client.open_and_wait(workspace / "main.cpp")
+
+    source = "int value_one;\nint value_two;\nint other;\nint main() { return va"
+    did_change(client, uri, 1, source)
+    result = await client.completion_at(uri, 3, 22)
+    assert result is not None
+    items = result.items if hasattr(result, "items") else result
+    labels = [item.label for item in items]
+    assert "value_one" in labels and "value_two" in labels
+
+    did_change(client, uri, 2, source + "lue_t")
+    result = await client.completion_at(uri, 3, 27)
+    assert result is not None
+    items = result.items if hasattr(result, "items") else result
+    labels = [item.label for item in items]
+    assert "value_two" in labels
+    assert "value_one" not in labels
+    assert "other" not in labels
+    for item in items:
+        if item.label == "value_two" and item.text_edit is not None:
+            assert item.text_edit.range.start.character == 20
+            assert item.text_edit.range.end.character == 27
+
+    client.close(uri)
+
+
+@pytest.mark.workspace("include_completion")
+async def test_completion_after_compile_sees_edits(client, workspace):
+    """Completion on the worker holding the AST uses the current buffer."""
+    uri, _ = await client.open_and_wait(workspace / "main.cpp")
+
+    for version, name in enumerate(["first_name", "second_name"], start=1):
+        source = f"int {name};\nint main() {{ return {name[:3]}"
+        did_change(client, uri, version, source)
+        result = await client.completion_at(uri, 1, 23)
+        assert result is not None
+        items = result.items if hasattr(result, "items") else result
+        labels = [item.label for item in items]
+        assert name in labels, f"Expected {name!r} in completion labels, got: {labels}"
+
+    client.close(uri)
+
+
 @pytest.mark.workspace("modules/chained_modules")
 async def test_import_completion_basic(client, workspace):
     """Import completion should list known modules."""
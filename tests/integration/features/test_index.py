@@ -1,5 +1,5 @@
 """Integration tests for index-based LSP features: GoToDefinition, FindReferences,
-CallHierarchy, TypeHierarchy, and WorkspaceSymbol."""
+CallHierarchy, TypeHierarchy, Rename, and WorkspaceSymbol."""
 
 import pytest
 from lsprotocol.types import (
@@ -7,6 +7,9 @@ from lsprotocol.types import (
     CallHierarchyOutgoingCallsParams,
     CallHierarchyPrepareParams,
     Position,
+    ReferenceContext,
+    ReferenceParams,
+    RenameParams,
     TypeHierarchyPrepareParams,
     TypeHierarchySubtypesParams,
     TypeHierarchySupertypesParams,
@@ -55,6 +58,56 @@ async def test_find_references(client, workspace):
     client.close(uri)
 
 
+@pytest.mark.workspace("index_features")
+async def test_find_references_partial_results(client, workspace):
+    """Test FindReferences with a partialResultToken streams the locations as $/progress."""
+    uri, _ = await client.open_and_wait(workspace / "main.cpp")
+    assert await wait_for_index(client, uri), "Index not ready after 30s"
+
+    result = await client.text_document_references_async(
+        ReferenceParams(
+            text_document=doc(uri),
+            position=Position(line=30, character=4),
+            context=ReferenceContext(include_declaration=True),
+            partial_result_token="refs-partial",
+        )
+    )
+    assert result == [], f"Expected the final response to be empty, got {result}"
+
+    streamed = [
+        loc
+        for event in client.progress_events
+        if event["token"] == "refs-partial"
+        for loc in event["value"]
+    ]
+    assert len(streamed) >= 3, f"Expected >=3 streamed refs, got {streamed}"
+
+    client.close(uri)
+
+
+@pytest.mark.workspace("index_features")
+async def test_rename(client, workspace):
+    """Test rename edits the definition and every use of global_var."""
+    uri, _ = await client.open_and_wait(workspace / "main.cpp")
+    assert await wait_for_index(client, uri), "Index not ready after 30s"
+
+    result = await client.text_document_rename_async(
+        RenameParams(
+            text_document=doc(uri),
+            position=Position(line=30, character=4),
+            new_name="counter",
+        )
+    )
+    assert result is not None and result.changes, f"Rename returned {result}"
+    edits = result.changes.get(uri, [])
+    assert sorted(e.range.start.line for e in edits) == [30, 33, 37], (
+        f"Expected edits on lines 30, 33 and 37, got {edits}"
+    )
+    assert all(e.new_text == "counter" for e in edits)
+
+    client.close(uri)
+
+
 @pytest.mark.workspace("index_features")
 async def test_call_hierarchy_prepare(client, workspace):
     """Test prepareCallHierarchy returns a CallHierarchyItem for 'add'."""
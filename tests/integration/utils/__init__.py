@@ -12,7 +12,7 @@ from tests.integration.utils.cache import (
     list_pch_files,
     list_pcm_files,
     list_tmp_files,
-    read_cache_json,
+    read_cache_meta,
 )
 
 __all__ = [
@@ -28,5 +28,5 @@ __all__ = [
     "list_pch_files",
     "list_pcm_files",
     "list_tmp_files",
-    "read_cache_json",
+    "read_cache_meta",
 ]
@@ -1,11 +1,11 @@
 """Cache inspection helpers for persistent cache tests."""
 
-import json
+import struct
 from pathlib import Path
 
 # Versioned root of the unified cache store; bump together with
 # cache_format_version in src/server/workspace/workspace.h.
-CACHE_ROOT = Path(".clice") / "cache" / "v1"
+CACHE_ROOT = Path(".clice") / "cache" / "v3"
 
 
 def cache_root(workspace: Path) -> Path:
@@ -36,12 +36,105 @@ def list_pcm_files(workspace: Path) -> list[Path]:
     return sorted(pcm_dir.glob("*.pcm"))
 
 
-def read_cache_json(workspace: Path) -> dict | None:
-    """Read and parse cache.json, or return None if absent."""
-    path = cache_root(workspace) / "cache.json"
+class _Reader:
+    """Little-endian fields of a cache.bin record body."""
+
+    def __init__(self, data: bytes):
+        self.data = data
+        self.pos = 0
+
+    def take(self, size: int) -> bytes:
+        field = self.data[self.pos : self.pos + size]
+        self.pos += size
+        return field
+
+    def u8(self) -> int:
+        return self.take(1)[0]
+
+    def u32(self) -> int:
+        return struct.unpack("<I", self.take(4))[0]
+
+    def u64(self) -> int:
+        return struct.unpack("<Q", self.take(8))[0]
+
+    def i64(self) -> int:
+        return struct.unpack("<q", self.take(8))[0]
+
+    def str(self) -> str:
+        return self.take(self.u32()).decode()
+
+    def deps(self, entry: dict) -> None:
+        entry["build_at"] = self.i64()
+        entry["deps"] = [
+            {"path": self.u32(), "hash": self.u64()} for _ in range(self.u32())
+        ]
+
+
+# Record ops and entry kinds of cache.bin (see workspace.cpp).
+_OP_PATH, _OP_PUT, _OP_REMOVE = 0, 1, 2
+_SECTIONS = {1: "pch", 2: "pcm", 3: "compile", 4: "module_scans"}
+
+
+def _decode_entry(kind: int, body: bytes) -> dict:
+    r = _Reader(body)
+    entry_id = r.str()
+    if kind == 1:
+        entry = {"key": entry_id, "source_file": r.u32(), "bound": r.u32()}
+        entry["base"] = r.str()
+        r.deps(entry)
+    elif kind == 2:
+        entry = {"key": entry_id, "source_file": r.u32(), "module_name": r.str()}
+        r.deps(entry)
+        entry["remote"] = bool(r.u8())
+    else:
+        entry = {"source_file": r.u32(), "key": r.str()}
+        r.deps(entry)
+        if kind == 4:
+            entry["module_name"] = r.str()
+            entry["is_interface_unit"] = bool(r.u8())
+            entry["imports"] = [r.str() for _ in range(r.u32())]
+    return entry
+
+
+def read_cache_meta(workspace: Path) -> dict | None:
+    """Replay cache.bin into the sections of its live entries, or return
+    None if absent.
+
+    Entries keep the field names of the cache.json older releases wrote;
+    "paths" is the path table that "source_file" and deps index into.
+    Checksums are not verified: a torn tail just ends the replay.
+    """
+    path = cache_root(workspace) / "cache.bin"
     if not path.exists():
         return None
-    return json.loads(path.read_text())
+    data = path.read_bytes()
+    if not data.startswith(b"CLC1"):
+        return None
+
+    paths: list[str] = []
+    entries: dict[tuple[int, bytes], bytes] = {}
+    pos = 4
+    while pos + 12 <= len(data):
+        op, kind = data[pos + 4], data[pos + 5]
+        (size,) = struct.unpack_from("<I", data, pos + 8)
+        body = data[pos + 12 : pos + 12 + size]
+        if len(body) < size:
+            break
+        pos += 12 + size
+        if op == _OP_PATH:
+            paths.append(body.decode())
+        elif op == _OP_PUT:
+            (id_size,) = struct.unpack_from("<I", body)
+            entries[(kind, body[4 : 4 + id_size])] = body
+        elif op == _OP_REMOVE:
+            entries.pop((kind, body), None)
+
+    cache: dict = {"paths": paths}
+    for name in _SECTIONS.values():
+        cache[name] = []
+    for (kind, _), body in entries.items():
+        cache[_SECTIONS[kind]].append(_decode_entry(kind, body))
+    return cache
 
 
 def list_tmp_files(workspace: Path) -> list[Path]:
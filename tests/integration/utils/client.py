@@ -376,6 +376,13 @@ class CliceClient(BaseLanguageClient):
             timeout=timeout,
         )
 
+    async def worker_stats(self, *, reset: bool = False, timeout: float = 30.0):
+        """Send clice/workerStats extension request."""
+        return await asyncio.wait_for(
+            self.protocol.send_request_async("clice/workerStats", {"reset": reset}),
+            timeout=timeout,
+        )
+
     async def switch_context(
         self, uri: str, context_uri: str, *, timeout: float = 30.0
     ):
@@ -103,6 +103,38 @@ TEST_CASE(FullKeepsCodegen) {
               canon({"clang++", "-O2", "-DFOO"}, ArgsProfile::Full));
 }
 
+TEST_CASE(HashFollowsRendering) {
+    std::vector<std::string> args = {"clang++", "-std=c++20", "-g", "-DFOO"};
+    auto hash = canonical_hash(args, ArgsProfile::Frontend);
+    ASSERT_EQ(hash.size(), std::size_t(32));
+    std::vector<std::string> without_codegen = {"clang++", "-std=c++20", "-DFOO"};
+    ASSERT_EQ(hash, canonical_hash(without_codegen, ArgsProfile::Frontend));
+    ASSERT_NE(hash, canonical_hash(args, ArgsProfile::Full));
+    std::vector<std::string> other_std = {"clang++", "-std=c++17", "-DFOO"};
+    ASSERT_NE(hash, canonical_hash(other_std, ArgsProfile::Frontend));
+}
+
+TEST_CASE(HashCacheMemoizes) {
+    CanonicalHashCache cache;
+    std::vector<std::string> args = {"clang++", "-std=c++20", "-Wall", "-DFOO"};
+
+    auto frontend = cache.get(args, ArgsProfile::Frontend).str();
+    ASSERT_EQ(frontend, canonical_hash(args, ArgsProfile::Frontend));
+    ASSERT_EQ(cache.get(args, ArgsProfile::Frontend), llvm::StringRef(frontend));
+    ASSERT_EQ(cache.size(), std::size_t(1));
+
+    // The profile is part of the memo key.
+    ASSERT_EQ(cache.get(args, ArgsProfile::Preprocessing),
+              canonical_hash(args, ArgsProfile::Preprocessing));
+    ASSERT_EQ(cache.size(), std::size_t(2));
+
+    // Argument boundaries are too: joining two arguments is another command.
+    std::vector<std::string> joined = {"clang++", "-std=c++20-Wall", "-DFOO"};
+    ASSERT_EQ(cache.get(joined, ArgsProfile::Frontend),
+              canonical_hash(joined, ArgsProfile::Frontend));
+    ASSERT_EQ(cache.size(), std::size_t(3));
+}
+
 };  // TEST_SUITE(Canonicalize)
 
 }  // namespace
@@ -1,3 +1,5 @@
+#include <format>
+
 #include "test/test.h"
 #include "command/argument_parser.h"
 #include "command/command.h"
@@ -160,6 +162,60 @@ TEST_CASE(DefaultFallback) {
     ASSERT_EQ(h_results.front().to_argv()[0], "clang"sv);
 };
 
+TEST_CASE(NeighbourFallback) {
+    /// A file without an entry takes the command of its nearest neighbour.
+    CompilationDatabase database;
+    auto options = quiet_options();
+
+    auto src = path::join("/project", "src");
+    database.add_command(src, path::join(src, "a.cpp"), "clang++ -DSRC a.cpp");
+    database.add_command(src, path::join(src, "net", "b.cpp"), "clang++ -DNET b.cpp");
+    database.add_command(src, path::join(src, "net", "c.c"), "clang -DNETC c.c");
+    database.add_command("/other", path::join("/other", "d.cpp"), "clang++ -DOTHER d.cpp");
+
+    auto flags_of = [&](llvm::StringRef file) {
+        auto result = database.lookup(file, options);
+        return print_argv(result.front().to_argv());
+    };
+
+    /// Same directory wins over a file elsewhere under the common parent.
+    auto fresh = path::join(src, "net", "fresh.cpp");
+    EXPECT_FALSE(database.has_entry(fresh));
+    EXPECT_CONTAINS(flags_of(fresh), "-DNET");
+    EXPECT_CONTAINS(flags_of(path::join(src, "net", "fresh.c")), "-DNETC");
+
+    /// Headers take any language; new directories take their parent's.
+    EXPECT_CONTAINS(flags_of(path::join("/other", "fresh.h")), "-DOTHER");
+    EXPECT_CONTAINS(flags_of(path::join("/other", "sub", "new.cpp")), "-DOTHER");
+
+    /// The source file stays the one looked up.
+    auto result = database.lookup(fresh, options);
+    EXPECT_EQ(llvm::StringRef(result.front().source_file), fresh);
+
+    /// Nothing in common but the root: the default command.
+    auto lone = flags_of(path::join("/elsewhere", "x.cpp"));
+    EXPECT_NOT_CONTAINS(lone, "-D");
+    EXPECT_CONTAINS(lone, "-std=c++20");
+    EXPECT_FALSE(database.find_neighbour(path::join("/elsewhere", "x.cpp")).has_value());
+};
+
+TEST_CASE(FilesInDirectory) {
+    CompilationDatabase database;
+    auto src = path::join("/project", "src");
+    database.add_command(src, path::join(src, "a.cpp"), "clang++ a.cpp");
+    database.add_command(src, path::join(src, "a.cpp"), "clang++ -DTWICE a.cpp");
+    database.add_command(src, path::join(src, "net", "b.cpp"), "clang++ b.cpp");
+
+    auto files = database.files_in(src);
+    ASSERT_EQ(files.size(), 1U);
+    EXPECT_EQ(database.resolve_path(files[0]), path::join(src, "a.cpp"));
+    EXPECT_TRUE(database.files_in(path::join("/project", "none")).empty());
+
+    /// The index follows the entries.
+    database.add_command(src, path::join(src, "c.cpp"), "clang++ c.cpp");
+    EXPECT_EQ(database.files_in(src).size(), 2U);
+};
+
 TEST_CASE(MultiCommand) {
     /// A file can have multiple compilation commands (e.g. different configs).
     CompilationDatabase database;
@@ -426,7 +482,9 @@ TEST_CASE(MoveSemantics) {
 
 /// Write JSON to a temp file, load into a CDB, remove the file.
 /// Returns the number of entries loaded.
-std::size_t load_json(CompilationDatabase& database, llvm::StringRef json) {
+std::size_t load_json(CompilationDatabase& database,
+                      llvm::StringRef json,
+                      CompilationChanges* changes = nullptr) {
     auto path = fs::createTemporaryFile("cdb", "json");
     if(!path)
         return 0;
@@ -437,7 +495,7 @@ std::size_t load_json(CompilationDatabase& database, llvm::StringRef json) {
             return 0;
         out << json;
     }
-    auto count = database.load(*path);
+    auto count = database.load(*path, changes);
     llvm::sys::fs::remove(*path);
     return count;
 }
@@ -552,6 +610,94 @@ TEST_CASE(LoadReload) {
     EXPECT_CONTAINS(print_argv(b.front().to_argv()), "-std=c++23");
 };
 
+TEST_CASE(LoadChanges) {
+    /// A reload reports the files whose entries it added, removed or changed.
+    CompilationDatabase database;
+    load_json(database, R"([
+        {"directory": "/build", "file": "a.cpp", "arguments": ["clang++", "-DA", "a.cpp"]},
+        {"directory": "/build", "file": "b.cpp", "arguments": ["clang++", "-DB", "b.cpp"]},
+        {"directory": "/build", "file": "c.cpp", "arguments": ["clang++", "-DC1", "c.cpp"]},
+        {"directory": "/build", "file": "c.cpp", "arguments": ["clang++", "-DC2", "c.cpp"]}
+    ])");
+
+    /// b.cpp changes, c.cpp only swaps its entries, d.cpp is new.
+    llvm::StringRef reloaded = R"([
+        {"directory": "/build", "file": "b.cpp", "arguments": ["clang++", "-DB2", "b.cpp"]},
+        {"directory": "/build", "file": "c.cpp", "arguments": ["clang++", "-DC2", "c.cpp"]},
+        {"directory": "/build", "file": "c.cpp", "arguments": ["clang++", "-DC1", "c.cpp"]},
+        {"directory": "/build", "file": "d.cpp", "arguments": ["clang++", "-DD", "d.cpp"]}
+    ])";
+    CompilationChanges changes;
+    ASSERT_EQ(load_json(database, reloaded, &changes), 4U);
+
+    auto names = [&](llvm::ArrayRef<std::uint32_t> ids) {
+        std::vector<std::string> result;
+        for(auto id: ids) {
+            result.push_back(database.resolve_path(id).str());
+        }
+        return result;
+    };
+    EXPECT_EQ(names(changes.added), std::vector{path::join("/build", "d.cpp")});
+    EXPECT_EQ(names(changes.removed), std::vector{path::join("/build", "a.cpp")});
+    EXPECT_EQ(names(changes.changed), std::vector{path::join("/build", "b.cpp")});
+
+    /// Loading the same file again changes nothing.
+    CompilationChanges none;
+    ASSERT_EQ(load_json(database, reloaded, &none), 4U);
+    EXPECT_TRUE(none.empty());
+};
+
+TEST_CASE(AddShards) {
+    /// add() loads a second CDB next to the first and replaces only its own
+    /// entries when loaded again.
+    auto primary = fs::createTemporaryFile("cdb", "json");
+    auto shard = fs::createTemporaryFile("cdb", "json");
+    ASSERT_TRUE(primary.has_value());
+    ASSERT_TRUE(shard.has_value());
+    ASSERT_TRUE(fs::write(*primary, R"([
+        {"directory": "/app", "file": "a.cpp", "arguments": ["clang++", "-DA", "a.cpp"]}
+    ])").has_value());
+    ASSERT_TRUE(fs::write(*shard, R"([
+        {"directory": "/lib", "file": "b.cpp", "arguments": ["clang++", "-DB", "b.cpp"]}
+    ])").has_value());
+
+    CompilationDatabase database;
+    ASSERT_EQ(database.load(*primary), 1U);
+
+    CompilationChanges changes;
+    ASSERT_EQ(database.add(*shard, &changes), 1U);
+    ASSERT_EQ(database.sources().size(), 2U);
+    EXPECT_EQ(database.get_entries().size(), 2U);
+    ASSERT_EQ(changes.added.size(), 1U);
+    EXPECT_EQ(database.resolve_path(changes.added.front()), path::join("/lib", "b.cpp"));
+    EXPECT_TRUE(database.has_entry(path::join("/app", "a.cpp")));
+
+    /// Rewriting the shard leaves the primary entries alone.
+    ASSERT_TRUE(fs::write(*shard, R"([
+        {"directory": "/lib", "file": "b.cpp", "arguments": ["clang++", "-DB2", "b.cpp"]},
+        {"directory": "/lib", "file": "c.cpp", "arguments": ["clang++", "-DC", "c.cpp"]}
+    ])").has_value());
+    CompilationChanges reloaded;
+    ASSERT_EQ(database.add(*shard, &reloaded), 2U);
+    ASSERT_EQ(database.sources().size(), 2U);
+    EXPECT_EQ(database.get_entries().size(), 3U);
+    EXPECT_EQ(reloaded.added.size(), 1U);
+    EXPECT_EQ(reloaded.changed.size(), 1U);
+    EXPECT_TRUE(reloaded.removed.empty());
+    EXPECT_TRUE(database.has_entry(path::join("/app", "a.cpp")));
+
+    /// A shard that cannot be read keeps its previous entries.
+    llvm::sys::fs::remove(*shard);
+    EXPECT_EQ(database.add(*shard), 0U);
+    EXPECT_EQ(database.get_entries().size(), 3U);
+
+    /// load() starts over from one source.
+    ASSERT_EQ(database.load(*primary), 1U);
+    EXPECT_EQ(database.sources().size(), 1U);
+    EXPECT_FALSE(database.has_entry(path::join("/lib", "b.cpp")));
+    llvm::sys::fs::remove(*primary);
+};
+
 TEST_CASE(LoadCommandQuoting) {
     /// "command" string with spaces in paths and quoted defines.
     CompilationDatabase database;
@@ -601,6 +747,36 @@ TEST_CASE(LoadRelativePath) {
     EXPECT_CONTAINS(print_argv(results3.front().to_argv()), "clang");
 };
 
+TEST_CASE(LoadChunked) {
+    /// Large enough to be split into several chunks parsed in parallel; the
+    /// strings hold commas, brackets and escapes the splitter has to skip.
+    constexpr std::size_t count = 8000;
+    std::string json = "[\n";
+    for(std::size_t i = 0; i < count; ++i) {
+        if(i != 0) {
+            json += ",\n";
+        }
+        json += std::format(R"({{"directory": "/build", "file": "f{0}.cpp", "arguments": )"
+                            R"(["clang++", "-DMSG=\"a, [b]}}\"", "-DP=C:\\", )"
+                            R"("-DN={0}", "f{0}.cpp"]}})",
+                            i);
+    }
+    json += "\n]";
+
+    CompilationDatabase database;
+    ASSERT_EQ(load_json(database, json), count);
+
+    auto options = quiet_options();
+    for(std::size_t i: {std::size_t(0), std::size_t(4321), count - 1}) {
+        auto file = path::join("/build", std::format("f{}.cpp", i));
+        auto result = database.lookup(file, options);
+        ASSERT_EQ(result.size(), 1U);
+        auto argv = print_argv(result.front().to_argv());
+        EXPECT_CONTAINS(argv, std::format("-DN={}", i));
+        EXPECT_CONTAINS(argv, "a, [b]}");
+    }
+};
+
 TEST_CASE(Module) {
     // TODO: revisit module command handling.
 }
@@ -1,11 +1,13 @@
 #include <algorithm>
 #include <optional>
 
+#include "test/temp_dir.h"
 #include "test/test.h"
 #include "command/argument_parser.h"
 #include "command/command.h"
 #include "command/toolchain.h"
 #include "compile/compilation.h"
+#include "support/cache_store.h"
 #include "support/logging.h"
 
 namespace clice::testing {
@@ -353,6 +355,108 @@ TEST_CASE(ResolveMainFileName, skip = Windows) {
     EXPECT_TRUE(reinjected);
 }
 
+TEST_CASE(ResolveSharedCommand, skip = Windows) {
+    auto driver = create_fake_clang(fake_cc1_line);
+    ASSERT_TRUE(driver.has_value());
+
+    auto make = [&](const char* file, const char* include) {
+        CompileCommand cmd;
+        cmd.resolved.flags = {driver->c_str(), "-std=c++23", include};
+        cmd.source_file = file;
+        return cmd;
+    };
+    auto mentions = [](const CompileCommand& cmd, llvm::StringRef dir) {
+        return std::ranges::any_of(cmd.resolved.flags,
+                                   [&](llvm::StringRef arg) { return arg.ends_with(dir); });
+    };
+
+    Toolchain tc;
+    auto a = make("/tmp/a.cpp", "-I/tmp/inc");
+    auto b = make("/tmp/b.cpp", "-I/tmp/inc");
+    ASSERT_TRUE(tc.resolve(a).has_value());
+    ASSERT_TRUE(tc.resolve(b).has_value());
+
+    // Files sharing a command share its resolved flags; only to_argv()
+    // tells them apart.
+    EXPECT_EQ(tc.resolved_size(), std::size_t(1));
+    EXPECT_EQ(a.resolved.flags, b.resolved.flags);
+    EXPECT_TRUE(b.resolved.is_cc1);
+    EXPECT_TRUE(mentions(b, "/tmp/inc"));
+    EXPECT_EQ(b.to_argv().back(), "/tmp/b.cpp"sv);
+
+    // Another user-content flag or extension is another command.
+    auto c = make("/tmp/c.cpp", "-I/tmp/other");
+    auto d = make("/tmp/d.c", "-I/tmp/inc");
+    ASSERT_TRUE(tc.resolve(c).has_value());
+    ASSERT_TRUE(tc.resolve(d).has_value());
+    EXPECT_EQ(tc.resolved_size(), std::size_t(3));
+    EXPECT_TRUE(mentions(c, "/tmp/other"));
+    EXPECT_FALSE(mentions(c, "/tmp/inc"));
+}
+
+TEST_CASE(ResolveFromStore, skip = Windows) {
+    TempDir tmp;
+    auto store = CacheStore::open(tmp.path("store"), 1);
+    ASSERT_TRUE(store.has_value());
+    store->register_namespace({.name = "toolchain",
+                               .extension = ".json",
+                               .policy = CachePolicy::LRU,
+                               .max_bytes = 1 << 20});
+
+    // A fake driver that also counts its runs in a log.
+    auto driver = tmp.path("fake.clang");
+    auto log = tmp.path("runs.log");
+    auto write_driver = [&](llvm::StringRef std) {
+        auto script = "#!/bin/sh\necho run >> '" + log + "'\necho ' \"/usr/bin/clang-22\" " +
+                      "\"-cc1\" \"" + std.str() + "\"' >&2\n";
+        return fs::write(driver, script).has_value() &&
+               !fs::setPermissions(driver, fs::all_read | fs::all_write | fs::all_exe);
+    };
+    auto runs = [&] {
+        auto content = fs::read(log);
+        return content ? llvm::StringRef(*content).count('\n') : 0;
+    };
+    ASSERT_TRUE(write_driver("-std=c++23"));
+
+    CompileCommand cmd;
+    cmd.resolved.flags = {driver.c_str(), "-std=c++23"};
+    cmd.source_file = "/tmp/a.cpp";
+
+    {
+        Toolchain tc;
+        tc.set_store(&*store);
+        ASSERT_TRUE(tc.resolve(cmd).has_value());
+    }
+    EXPECT_EQ(runs(), std::size_t(1));
+
+    // A new Toolchain, as after a restart, takes the result from the store.
+    CompileCommand again;
+    again.resolved.flags = {driver.c_str(), "-std=c++23"};
+    again.source_file = "/tmp/a.cpp";
+    {
+        Toolchain tc;
+        tc.set_store(&*store);
+        ASSERT_TRUE(tc.resolve(again).has_value());
+        EXPECT_EQ(tc.cache_size(), std::size_t(1));
+    }
+    EXPECT_EQ(runs(), std::size_t(1));
+    EXPECT_TRUE(std::ranges::contains(again.resolved.flags, llvm::StringRef("-std=c++23")));
+
+    // Replacing the driver misses the stored result (a different size, so
+    // even a coarse mtime cannot hide the change).
+    ASSERT_TRUE(write_driver("-std=gnu++20"));
+    CompileCommand replaced;
+    replaced.resolved.flags = {driver.c_str(), "-std=c++23"};
+    replaced.source_file = "/tmp/a.cpp";
+    {
+        Toolchain tc;
+        tc.set_store(&*store);
+        ASSERT_TRUE(tc.resolve(replaced).has_value());
+    }
+    EXPECT_EQ(runs(), std::size_t(2));
+    EXPECT_TRUE(std::ranges::contains(replaced.resolved.flags, llvm::StringRef("-std=gnu++20")));
+}
+
 TEST_CASE(ResolveKeepsSemanticFlags, skip = !CIEnvironment) {
     auto file = fs::createTemporaryFile("clice", "cpp");
     if(!file) {
@@ -46,6 +46,36 @@ struct Bar {
     ASSERT_EQ(unit->top_level_decls().size(), 4U);
 }
 
+TEST_CASE(TopLevelDeclsInRange) {
+    add_main("main.cpp", R"(
+int $(x)x = 1;
+
+[[maybe_unused]] static int attributed = 2;
+
+void foo() {}
+
+struct Bar {
+    int $(y)y;
+};
+)");
+    ASSERT_TRUE(compile());
+
+    auto names = [&](LocalSourceRange range) {
+        std::vector<std::string> result;
+        for(auto* decl: unit->top_level_decls(range)) {
+            result.push_back(llvm::cast<clang::NamedDecl>(decl)->getNameAsString());
+        }
+        return result;
+    };
+
+    // Attributes may start before the extent, such decls are always kept.
+    auto x = point("x");
+    auto y = point("y");
+    EXPECT_EQ(names({x, x}), (std::vector<std::string>{"x", "attributed"}));
+    EXPECT_EQ(names({y, y}), (std::vector<std::string>{"attributed", "Bar"}));
+    EXPECT_EQ(names({x, y}), (std::vector<std::string>{"x", "attributed", "foo", "Bar"}));
+}
+
 TEST_CASE(StopCompilation) {
     std::shared_ptr<std::atomic_bool> stop = std::make_shared<std::atomic_bool>(false);
 
@@ -64,6 +94,35 @@ int main() { return 0; }
     ASSERT_FALSE(built.completed());
 }
 
+TEST_CASE(StopReportsFatalError) {
+    add_file("header.h", R"(
+#pragma once
+template <typename T>
+struct Box { T value; };
+)");
+
+    llvm::StringRef content = R"(
+#include "header.h"
+Box<int> box;
+)";
+    add_main("main.cpp", content);
+
+    prepare();
+    params.stop->store(true);
+
+    // The preprocessor sees the flag as soon as it enters a file and turns
+    // it into a fatal error, which stops includes and instantiations.
+    auto built = clice::compile(params);
+    ASSERT_FALSE(built.completed());
+
+    bool reported = false;
+    for(auto& diag: built.diagnostics()) {
+        if(diag.message == "compilation cancelled")
+            reported = true;
+    }
+    EXPECT_TRUE(reported);
+}
+
 TEST_CASE(PCHBuildPopulatesInfo) {
     add_file("preamble.h", R"(
 #pragma once
@@ -277,6 +336,73 @@ int bar() { return 3; }
     ASSERT_TRUE(unit->top_level_decls().size() >= 1U);
 }
 
+TEST_CASE(SkipFunctionBodies) {
+    llvm::StringRef content = R"(
+int skipped() { return undeclared_a; }
+
+int parsed() { return undeclared_b; }
+
+struct S {
+    int member() { return undeclared_c; }
+};
+)";
+    add_main("main.cpp", content);
+
+    prepare();
+    params.skip_bodies = true;
+    auto offset = static_cast<std::uint32_t>(content.find("undeclared_b"));
+    params.parsed_bodies.push_back({offset, offset});
+
+    auto built = clice::compile(params);
+    ASSERT_TRUE(built.completed());
+
+    // Only the body the caller asked for is parsed, so only its error shows.
+    EXPECT_EQ(built.skipped_bodies().size(), 2U);
+    std::size_t errors = 0;
+    for(auto& diag: built.diagnostics()) {
+        if(diag.id.level == DiagnosticLevel::Error) {
+            errors += 1;
+            EXPECT_TRUE(llvm::StringRef(diag.message).contains("undeclared_b"));
+        }
+    }
+    EXPECT_EQ(errors, 1U);
+}
+
+TEST_CASE(SkipHeaderBodies) {
+    add_file("known.h", R"(
+#pragma once
+inline int known() { return undeclared_a; }
+)");
+    add_file("other.h", R"(
+#pragma once
+inline int other() { return undeclared_b; }
+)");
+    add_main("main.cpp", R"(
+#include "known.h"
+#include "other.h"
+int main_body() { return undeclared_c; }
+)");
+
+    prepare();
+    params.skip_header_bodies.insert(TestVFS::path("known.h"));
+
+    auto built = clice::compile(params);
+    ASSERT_TRUE(built.completed());
+
+    // The main file and the other header are parsed in full.
+    ASSERT_EQ(built.skipped_headers().size(), 1U);
+    EXPECT_EQ(built.skipped_headers()[0], TestVFS::path("known.h"));
+    EXPECT_TRUE(built.skipped_bodies().empty());
+    std::size_t errors = 0;
+    for(auto& diag: built.diagnostics()) {
+        if(diag.id.level == DiagnosticLevel::Error) {
+            errors += 1;
+            EXPECT_FALSE(llvm::StringRef(diag.message).contains("undeclared_a"));
+        }
+    }
+    EXPECT_EQ(errors, 2U);
+}
+
 };  // TEST_SUITE(Compiler)
 
 TEST_SUITE(PreambleHash) {
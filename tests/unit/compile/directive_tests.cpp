@@ -278,6 +278,59 @@ TEST_CASE(HasEmbed) {
     EXPECT_HAS_EMBED(1, "1", "non-existed.bin", /*exists=*/false);
 };
 
+TEST_CASE(Scope) {
+    add_files("main.cpp", R"cpp(
+#[header.h]
+#pragma once
+#define VALUE 1
+#ifdef VALUE
+int header = VALUE;
+#endif
+
+#[main.cpp]
+#include "header.h"
+#if VALUE
+int x = VALUE;
+#endif
+)cpp");
+
+    auto compile_in = [&](DirectiveScope scope, llvm::StringRef file = "") {
+        prepare("-std=c++23");
+        params.directive_scope = scope;
+        if(!file.empty()) {
+            params.directive_files.insert(file);
+        }
+        return try_compile();
+    };
+
+    ASSERT_TRUE(compile_in(DirectiveScope::All));
+    auto main = unit->interested_file();
+    ASSERT_EQ(unit->directives()[main].includes.size(), 1U);
+    auto header = unit->directives()[main].includes[0].fid;
+    auto header_path = unit->file_path(header).str();
+    EXPECT_EQ(unit->directives()[header].macros.size(), 3U);
+    EXPECT_EQ(unit->directives()[main].macros.size(), 2U);
+
+    // Includes are kept everywhere, so the dependencies stay complete.
+    ASSERT_TRUE(compile_in(DirectiveScope::MainFile));
+    main = unit->interested_file();
+    ASSERT_EQ(unit->directives()[main].includes.size(), 1U);
+    header = unit->directives()[main].includes[0].fid;
+    EXPECT_EQ(unit->directives()[main].macros.size(), 2U);
+    EXPECT_EQ(unit->directives()[main].conditions.size(), 2U);
+    EXPECT_TRUE(unit->directives()[header].macros.empty());
+    EXPECT_TRUE(unit->directives()[header].pragmas.empty());
+    EXPECT_TRUE(unit->directives()[header].conditions.empty());
+    EXPECT_EQ(unit->deps().size(), 1U);
+
+    ASSERT_TRUE(compile_in(DirectiveScope::Files, header_path));
+    main = unit->interested_file();
+    header = unit->directives()[main].includes[0].fid;
+    EXPECT_EQ(unit->directives()[header].macros.size(), 3U);
+    EXPECT_EQ(unit->directives()[header].pragmas.size(), 1U);
+    EXPECT_TRUE(unit->directives()[main].macros.empty());
+};
+
 };  // TEST_SUITE(Directive)
 
 }  // namespace
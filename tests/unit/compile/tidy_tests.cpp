@@ -30,6 +30,65 @@ TEST_CASE(Tidy) {
     ASSERT_FALSE(unit.diagnostics().empty());
 }
 
+std::vector<Diagnostic> tidy_diagnostics(CompilationUnit& unit) {
+    std::vector<Diagnostic> result;
+    for(auto& diag: unit.diagnostics()) {
+        if(diag.id.source == DiagnosticSource::ClangTidy) {
+            result.push_back(diag);
+        }
+    }
+    return result;
+}
+
+TEST_CASE(Incremental) {
+    llvm::StringRef a = "double a(int x, int y) { return x / y; }\n";
+    llvm::StringRef b = "double b(int x, int y) { return x / y; }\n";
+    auto vfs = llvm::makeIntrusiveRefCnt<TestVFS>();
+    vfs->add("main.cpp", (a + b).str());
+
+    std::string main_path = TestVFS::path("main.cpp");
+    auto run = [&](std::optional<std::vector<LocalSourceRange>> ranges,
+                   std::vector<Diagnostic> reused) {
+        CompilationParams params;
+        params.kind = CompilationKind::Content;
+        params.clang_tidy = true;
+        params.tidy_ranges = std::move(ranges);
+        params.tidy_reused = std::move(reused);
+        params.tidy_profile = true;
+        params.vfs = vfs;
+        params.arguments = {"clang++", "-ffreestanding", "-Xclang", "-undef", main_path.c_str()};
+        return compile(params);
+    };
+
+    auto full = run(std::nullopt, {});
+    ASSERT_TRUE(full.completed());
+    auto previous = tidy_diagnostics(full);
+    ASSERT_TRUE(previous.size() == 2);
+    ASSERT_TRUE(previous[0].range.begin < a.size() && previous[1].range.begin > a.size());
+    auto timed = [](auto& timing) {
+        return timing.first == "bugprone-integer-division";
+    };
+    ASSERT_TRUE(llvm::any_of(full.tidy_timings(), timed));
+
+    // Only `b` is matched again; the result for `a` is the previous one.
+    std::vector<LocalSourceRange> edited = {
+        {static_cast<std::uint32_t>(a.size() + 7), static_cast<std::uint32_t>(a.size() + 8)}
+    };
+    auto partial = run(edited, {});
+    ASSERT_TRUE(partial.completed());
+    auto fresh = tidy_diagnostics(partial);
+    ASSERT_TRUE(fresh.size() == 1 && fresh[0].range.begin > a.size());
+
+    auto merged = run(edited, previous);
+    ASSERT_TRUE(merged.completed());
+    ASSERT_TRUE(tidy_diagnostics(merged).size() == 2);
+
+    // Nothing edited: every result is reused.
+    auto unchanged = run(std::vector<LocalSourceRange>{}, previous);
+    ASSERT_TRUE(unchanged.completed());
+    ASSERT_TRUE(tidy_diagnostics(unchanged).size() == 2);
+}
+
 };  // TEST_SUITE(ClangTidy)
 }  // namespace
 }  // namespace clice::testing
@@ -0,0 +1,74 @@
+#include "test/test.h"
+#include "compile/compilation_unit.h"
+#include "compile/time_trace.h"
+
+namespace clice::testing {
+
+namespace {
+
+constexpr llvm::StringRef trace_json = R"({"traceEvents":[
+{"ph":"X","name":"Source","dur":3000,"args":{"detail":"/include/a.h"}},
+{"ph":"X","name":"Source","dur":1000,"args":{"detail":"/include/b.h"}},
+{"ph":"X","name":"Source","dur":2000,"args":{"detail":"/include/b.h"}},
+{"ph":"X","name":"Source","dur":500,"args":{"detail":"<built-in>"}},
+{"ph":"X","name":"InstantiateClass","dur":4000,"args":{"detail":"std::vector<int>"}},
+{"ph":"X","name":"InstantiateClass","dur":1000,
+ "args":{"detail":"std::vector<std::pair<int, int>>"}},
+{"ph":"X","name":"InstantiateFunction","dur":2500,"args":{"detail":"std::vector<int>::push_back"}},
+{"ph":"X","name":"ParseClass","dur":9000,"args":{"detail":"S"}},
+{"ph":"M","name":"process_name","args":{"name":"clice"}}
+]})";
+
+TEST_SUITE(TimeTrace) {
+
+TEST_CASE(Summarize) {
+    auto trace = summarize_time_trace(trace_json, 10);
+
+    ASSERT_EQ(trace.headers.size(), 2U);
+    EXPECT_EQ(trace.headers[0].name, "/include/a.h");
+    EXPECT_EQ(trace.headers[0].ms, 3.0);
+    EXPECT_EQ(trace.headers[1].name, "/include/b.h");
+    EXPECT_EQ(trace.headers[1].ms, 3.0);
+    EXPECT_EQ(trace.headers[1].count, 2U);
+
+    ASSERT_EQ(trace.instantiations.size(), 3U);
+    EXPECT_EQ(trace.instantiations[0].name, "std::vector<int>");
+    EXPECT_EQ(trace.instantiations[1].name, "std::vector<int>::push_back");
+
+    ASSERT_EQ(trace.templates.size(), 2U);
+    EXPECT_EQ(trace.templates[0].name, "std::vector");
+    EXPECT_EQ(trace.templates[0].ms, 5.0);
+    EXPECT_EQ(trace.templates[0].count, 2U);
+    EXPECT_EQ(trace.templates[1].name, "std::vector::push_back");
+
+    auto top = summarize_time_trace(trace_json, 1);
+    EXPECT_EQ(top.instantiations.size(), 1U);
+
+    EXPECT_TRUE(summarize_time_trace("not json", 10).headers.empty());
+}
+
+TEST_CASE(Report) {
+    TimeTraceReport report;
+    auto trace = summarize_time_trace(trace_json, 10);
+    report.record(1, CompilationKind::Content, trace);
+    report.record(2, CompilationKind::Content, trace);
+    report.record(1, CompilationKind::Indexing, trace);
+    // A recompile replaces the file's earlier trace.
+    report.record(2, CompilationKind::Content, trace);
+    EXPECT_EQ(report.size(), 3U);
+
+    auto summary = report.summary(1);
+    ASSERT_EQ(summary.headers.size(), 1U);
+    EXPECT_EQ(summary.headers[0].name, "/include/a.h");
+    EXPECT_EQ(summary.headers[0].ms, 9.0);
+    EXPECT_EQ(summary.headers[0].count, 3U);
+
+    report.clear();
+    EXPECT_EQ(report.size(), 0U);
+}
+
+};  // TEST_SUITE(TimeTrace)
+
+}  // namespace
+
+}  // namespace clice::testing
@@ -0,0 +1,47 @@
+#include "test/test.h"
+#include "test/tester.h"
+#include "feature/feature.h"
+
+namespace clice::testing {
+
+namespace {
+
+TEST_SUITE(code_action, Tester) {
+
+TEST_CASE(QuickFix) {
+    add_main("main.cpp", R"cpp(
+int x = 1
+int y = 2;
+)cpp");
+    ASSERT_TRUE(compile());
+
+    auto fixes = feature::code_actions(*unit, {});
+    ASSERT_EQ(fixes.size(), 1U);
+    EXPECT_TRUE(fixes[0].is_preferred.value_or(false));
+    EXPECT_FALSE(fixes[0].edit.has_value());
+
+    // Out of the requested range.
+    auto length = static_cast<std::uint32_t>(unit->interested_content().size());
+    EXPECT_TRUE(feature::code_actions(*unit, {length, length}).empty());
+
+    auto fix = fixes[0];
+    ASSERT_TRUE(feature::resolve_code_action(*unit, fix));
+    ASSERT_TRUE(fix.edit.has_value() && fix.edit->changes.has_value());
+    ASSERT_EQ(fix.edit->changes->size(), 1U);
+    auto& edits = fix.edit->changes->begin()->second;
+    ASSERT_EQ(edits.size(), 1U);
+    EXPECT_EQ(edits[0].new_text, ";");
+    EXPECT_EQ(edits[0].range.start.line, 1U);
+    EXPECT_EQ(edits[0].range.start.character, 9U);
+
+    // The diagnostic the action names has changed.
+    auto stale = fixes[0];
+    stale.title = "something else";
+    EXPECT_FALSE(feature::resolve_code_action(*unit, stale));
+}
+
+};  // TEST_SUITE(code_action)
+
+}  // namespace
+
+}  // namespace clice::testing
@@ -3,6 +3,7 @@
 
 #include "test/annotation.h"
 #include "test/test.h"
+#include "test/tester.h"
 #include "feature/feature.h"
 
 namespace clice::testing {
@@ -14,16 +15,22 @@ namespace protocol = kota::ipc::protocol;
 TEST_SUITE(CodeCompletion) {
 
 std::vector<protocol::CompletionItem> items;
+bool incomplete = false;
 llvm::IntrusiveRefCntPtr<TestVFS> vfs;
 std::string main_path;
 
-void code_complete(llvm::StringRef code, feature::CodeCompletionOptions options = {}) {
+void code_complete(llvm::StringRef code,
+                   feature::CodeCompletionOptions options = {},
+                   llvm::StringRef header = {}) {
     vfs = llvm::makeIntrusiveRefCnt<TestVFS>();
 
     CompilationParams params;
     auto annotation = AnnotatedSource::from(code);
 
     vfs->add("main.cpp", annotation.content);
+    if(!header.empty()) {
+        vfs->add("header.h", header);
+    }
     params.vfs = vfs;
     main_path = TestVFS::path("main.cpp");
     params.arguments =
@@ -31,7 +38,9 @@ void code_complete(llvm::StringRef code, feature::CodeCompletionOptions options
     params.completion = {main_path, annotation.offsets.lookup("pos")};
     params.add_remapped_file(main_path, annotation.content);
 
-    items = feature::code_complete(params, options, feature::PositionEncoding::UTF8);
+    auto list = feature::code_complete(params, options, feature::PositionEncoding::UTF8);
+    items = std::move(list.items);
+    incomplete = list.is_incomplete;
 }
 
 auto find_item(llvm::StringRef label) {
@@ -40,6 +49,15 @@ auto find_item(llvm::StringRef label) {
     });
 }
 
+double score_of(llvm::StringRef label) {
+    auto it = find_item(label);
+    double score = 0;
+    if(it == items.end() || !it->sort_text || llvm::StringRef(*it->sort_text).getAsDouble(score)) {
+        return -1;
+    }
+    return score;
+}
+
 TEST_CASE(Score) {
     code_complete(R"cpp(
 int foooo(int x);
@@ -437,6 +455,64 @@ void bar() {
 )cpp");
 }
 
+TEST_CASE(Limit) {
+    constexpr auto code = R"cpp(
+int foo1, foo2, foo3, foo4;
+int x = fo$(pos)
+)cpp";
+    code_complete(code);
+    EXPECT_FALSE(incomplete);
+    EXPECT_GE(items.size(), 4u);
+
+    // The best ranked are kept, and the client told to ask again.
+    code_complete(code, {.limit = 2});
+    EXPECT_TRUE(incomplete);
+    EXPECT_EQ(items.size(), 2u);
+}
+
+TEST_CASE(Proximity) {
+    code_complete(R"cpp(
+#include "header.h"
+int foo_main;
+int x = foo_$(pos)
+)cpp",
+                  {},
+                  "int foo_head;\n");
+
+    // Matched alike, the declaration of the file edited ranks higher.
+    ASSERT_GT(score_of("foo_head"), 0.0);
+    EXPECT_GT(score_of("foo_main"), score_of("foo_head"));
+}
+
+TEST_CASE(Resolve) {
+    constexpr auto code = R"cpp(
+/// Adds two numbers.
+int add(int lhs, int rhs);
+int x = ad$(pos)
+)cpp";
+    code_complete(code);
+    auto it = find_item("add");
+    ASSERT_TRUE(it != items.end());
+    ASSERT_TRUE(it->data.has_value());
+
+    Tester tester;
+    tester.add_main("main.cpp", code);
+    ASSERT_TRUE(tester.compile());
+
+    auto item = *it;
+    ASSERT_TRUE(feature::resolve_completion(*tester.unit, item));
+    ASSERT_TRUE(item.detail.has_value());
+    EXPECT_EQ(*item.detail, "int add(int lhs, int rhs)");
+    ASSERT_TRUE(item.documentation.has_value());
+    auto* documentation = std::get_if<protocol::MarkupContent>(&*item.documentation);
+    ASSERT_TRUE(documentation != nullptr);
+    EXPECT_NE(documentation->value.find("Adds two numbers"), std::string::npos);
+
+    // Another symbol of the same name is not resolved.
+    item.data = protocol::LSPAny(std::int64_t(1));
+    EXPECT_FALSE(feature::resolve_completion(*tester.unit, item));
+}
+
 };  // TEST_SUITE(CodeCompletion)
 
 }  // namespace
@@ -0,0 +1,84 @@
+#include <string>
+#include <vector>
+
+#include "test/test.h"
+#include "test/tester.h"
+#include "feature/feature.h"
+
+#include "kota/codec/json/json.h"
+#include "kota/ipc/codec/json.h"
+
+namespace clice::testing {
+
+namespace {
+
+namespace protocol = kota::ipc::protocol;
+
+TEST_SUITE(diagnostics, Tester) {
+
+TEST_CASE(StreamedJSON) {
+    add_files("main.cpp", R"cpp(
+#[test.h]
+int header_error = "\"quoted\"";
+
+#[main.cpp]
+#include "test.h"
+
+template <typename T>
+void f(T t) {
+    t.missing();
+}
+
+[[deprecated]] void old();
+
+void g() {
+    f(1);
+    f(2);
+    f(1.0);
+    old();
+    int unused;
+}
+)cpp");
+    ASSERT_TRUE(compile("-std=c++17"));
+
+    auto expected = feature::diagnostics(*unit);
+    ASSERT_FALSE(expected.empty());
+    auto expected_json = kota::codec::json::to_json<kota::ipc::lsp_config>(expected);
+    ASSERT_TRUE(expected_json.has_value());
+
+    // Same diagnostics, once parsed back.
+    auto streamed = feature::diagnostics_json(*unit);
+    std::vector<protocol::Diagnostic> parsed;
+    ASSERT_TRUE(bool(kota::codec::json::from_json(streamed, parsed)));
+    auto parsed_json = kota::codec::json::to_json<kota::ipc::lsp_config>(parsed);
+    ASSERT_TRUE(parsed_json.has_value());
+    EXPECT_EQ(*parsed_json, *expected_json);
+}
+
+TEST_CASE(Limit) {
+    add_main("main.cpp", R"cpp(
+int a = "a";
+int b = "b";
+int c = "c";
+)cpp");
+    ASSERT_TRUE(compile());
+    ASSERT_EQ(feature::diagnostics(*unit).size(), 3U);
+
+    std::vector<protocol::Diagnostic> parsed;
+    auto capped = feature::diagnostics_json(*unit, feature::PositionEncoding::UTF16, 2);
+    ASSERT_TRUE(bool(kota::codec::json::from_json(capped, parsed)));
+    ASSERT_EQ(parsed.size(), 2U);
+    EXPECT_EQ(parsed[0].range.start.line, 1U);
+    EXPECT_EQ(parsed[1].range.start.line, 2U);
+
+    auto all = feature::diagnostics_json(*unit, feature::PositionEncoding::UTF16, 0);
+    std::vector<protocol::Diagnostic> everything;
+    ASSERT_TRUE(bool(kota::codec::json::from_json(all, everything)));
+    EXPECT_EQ(everything.size(), 3U);
+}
+
+};  // TEST_SUITE(diagnostics)
+
+}  // namespace
+
+}  // namespace clice::testing
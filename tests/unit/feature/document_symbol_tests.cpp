@@ -7,6 +7,7 @@
 #include <string_view>
 #include <vector>
 
+#include "test/annotation.h"
 #include "test/test.h"
 #include "test/tester.h"
 #include "feature/feature.h"
@@ -187,6 +188,52 @@ VAR(test)
     ASSERT_EQ(total_size(symbols), 3U);
 }
 
+TEST_CASE(Syntactic) {
+    auto source = AnnotatedSource::from(R"cpp(
+namespace $(ns)a::b {
+template <class T>
+struct $(S)S : Base<T> {
+    $(ctor)S() : x(1), y{2} {}
+    void $(method)method(int) const;
+public:
+    int x, y;
+};
+enum class $(E)E : int { A, B };
+}
+
+int $(main)main() {
+    struct Local {};
+    return 0;
+}
+)cpp");
+
+    auto symbols = feature::syntactic_document_symbols(source.content);
+    ASSERT_EQ(symbols.size(), 2U);
+    EXPECT_EQ(symbols[0].name, "a::b");
+    EXPECT_TRUE(symbols[0].kind == SymbolKind::Namespace);
+    EXPECT_EQ(symbols[0].selection_range.begin, source.offsets["ns"]);
+    EXPECT_EQ(symbols[1].name, "main");
+    EXPECT_TRUE(symbols[1].kind == SymbolKind::Function);
+    EXPECT_EQ(symbols[1].selection_range.begin, source.offsets["main"]);
+    EXPECT_TRUE(symbols[1].children.empty());
+
+    auto& children = symbols[0].children;
+    ASSERT_EQ(children.size(), 2U);
+    EXPECT_EQ(children[0].name, "S");
+    EXPECT_EQ(children[0].detail, "struct");
+    EXPECT_EQ(children[0].selection_range.begin, source.offsets["S"]);
+    EXPECT_EQ(children[1].name, "E");
+    EXPECT_TRUE(children[1].kind == SymbolKind::Enum);
+    EXPECT_EQ(children[1].selection_range.begin, source.offsets["E"]);
+
+    auto& members = children[0].children;
+    ASSERT_EQ(members.size(), 2U);
+    EXPECT_TRUE(members[0].kind == SymbolKind::Method);
+    EXPECT_EQ(members[0].selection_range.begin, source.offsets["ctor"]);
+    EXPECT_EQ(members[1].name, "method");
+    EXPECT_EQ(members[1].selection_range.begin, source.offsets["method"]);
+}
+
 void format_document_symbols(std::string& out,
                              std::string_view content,
                              std::span<const std::uint32_t> line_starts,
@@ -1,6 +1,7 @@
 #include <cstdint>
 #include <vector>
 
+#include "test/annotation.h"
 #include "test/test.h"
 #include "test/tester.h"
 #include "feature/feature.h"
@@ -432,6 +433,38 @@ $(1)#pragma region level1
 )cpp");
 }
 
+TEST_CASE(Syntactic) {
+    auto source = AnnotatedSource::from(R"cpp(
+$(1)// first
+// second$(2)
+
+namespace ns $(3){
+struct S $(5){
+    void f() $(7){
+        int x = 1;
+    }$(8)
+    int y = {1};
+}$(6);
+}$(4)
+
+$(9)#pragma region r
+int z;
+#$(10)pragma endregion
+)cpp");
+
+    auto ranges = feature::syntactic_folding_ranges(source.content);
+    ASSERT_EQ(ranges.size(), 5U);
+    for(std::uint32_t i = 0; i < ranges.size(); ++i) {
+        EXPECT_EQ(ranges[i].range.begin, source.offsets[std::to_string(i * 2 + 1)]);
+        EXPECT_EQ(ranges[i].range.end, source.offsets[std::to_string(i * 2 + 2)]);
+    }
+    ASSERT_TRUE(ranges[0].kind.has_value());
+    EXPECT_EQ(static_cast<const std::string&>(*ranges[0].kind), "comment");
+    EXPECT_EQ(ranges[1].collapsed_text, "{...}");
+    ASSERT_TRUE(ranges[4].kind.has_value());
+    EXPECT_EQ(static_cast<const std::string&>(*ranges[4].kind), "region");
+}
+
 TEST_CASE(snapshot) {
     ASSERT_SNAPSHOT_GLOB(corpus_dir, "**/*.cpp", [&](std::string_view path) -> std::string {
         if(!compile_file(path))
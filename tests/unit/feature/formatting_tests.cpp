@@ -35,6 +35,60 @@ TEST_CASE(IncludeSort) {
     ASSERT_NE(edits.size(), 0U);
 }
 
+TEST_CASE(StyleCache) {
+    llvm::StringRef code = "int x=1;\n";
+    feature::FormatStyleCache cache;
+    auto first = cache.style("dir/main.cpp");
+    auto second = cache.style("dir/other.cpp");
+    ASSERT_TRUE(first.has_value());
+    ASSERT_TRUE(second.has_value());
+    EXPECT_EQ(*first, *second);
+
+    auto cached = feature::document_format("dir/main.cpp",
+                                           code,
+                                           std::nullopt,
+                                           feature::PositionEncoding::UTF16,
+                                           &cache);
+    auto fresh = feature::document_format("dir/main.cpp", code, std::nullopt);
+    EXPECT_EQ(cached.size(), fresh.size());
+
+    cache.clear();
+    ASSERT_TRUE(cache.style("dir/main.cpp").has_value());
+}
+
+TEST_CASE(OnTypeStatement) {
+    llvm::StringRef code = "int main() {\n    int   x =  1;\n    int   y =  2;\n}\n";
+    auto offset = static_cast<std::uint32_t>(code.find("2;") + 2);
+    auto edits = feature::on_type_format("main.cpp", code, offset);
+    ASSERT_NE(edits.size(), 0U);
+    for(auto& edit: edits) {
+        EXPECT_EQ(edit.range.start.line, 2U);
+        EXPECT_EQ(edit.range.end.line, 2U);
+    }
+}
+
+TEST_CASE(OnTypeBlock) {
+    llvm::StringRef code = "int   a =  0;\nvoid f() {\nint x=1;\n}\nint   z =  3;\n";
+    auto offset = static_cast<std::uint32_t>(code.find("}") + 1);
+    auto edits = feature::on_type_format("main.cpp", code, offset);
+    ASSERT_NE(edits.size(), 0U);
+    for(auto& edit: edits) {
+        EXPECT_GE(edit.range.start.line, 1U);
+        EXPECT_LE(edit.range.end.line, 3U);
+    }
+}
+
+TEST_CASE(OnTypeInComment) {
+    llvm::StringRef code = "int   x =  1; // a;";
+    auto edits =
+        feature::on_type_format("main.cpp", code, static_cast<std::uint32_t>(code.size()));
+    EXPECT_EQ(edits.size(), 0U);
+
+    // Not a `;` or `}`.
+    edits = feature::on_type_format("main.cpp", code, 3);
+    EXPECT_EQ(edits.size(), 0U);
+}
+
 };  // TEST_SUITE(Formatting)
 
 }  // namespace
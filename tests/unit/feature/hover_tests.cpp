@@ -996,6 +996,34 @@ int $foo = 1;
     ASSERT_TRUE(content->value.find("variable foo") != std::string::npos);
 }
 
+TEST_CASE(cached_documentation) {
+    add_main("main.cpp", R"cpp(
+/// Tests primality of `p`.
+///
+/// Second paragraph.
+bool is_prime(int p);
+bool $(first)is_prime(int p);
+bool x = $(second)is_prime(7);
+)cpp");
+    ASSERT_TRUE(compile());
+
+    auto render = [&](llvm::StringRef name, feature::HoverCache* cache) {
+        auto hover = feature::hover(*unit, point(name), {.cache = cache});
+        auto* content = hover ? std::get_if<protocol::MarkupContent>(&hover->contents) : nullptr;
+        return content ? content->value : std::string();
+    };
+
+    auto first = render("first", nullptr);
+    auto second = render("second", nullptr);
+    ASSERT_TRUE(first.find("Second paragraph.") != std::string::npos);
+
+    // Later hovers on the symbol are answered from the cache.
+    feature::HoverCache cache;
+    ASSERT_EQ(render("first", &cache), first);
+    ASSERT_EQ(render("second", &cache), second);
+    ASSERT_EQ(render("first", &cache), first);
+}
+
 TEST_CASE(protocol_range) {
     run(R"cpp(
 int $foo = 1;
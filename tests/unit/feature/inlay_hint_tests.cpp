@@ -1535,6 +1535,45 @@ TEST_CASE(Dependent, skip = true) {
     EXPECT_HINT("2", "par3:");
 }
 
+TEST_CASE(Cache) {
+    add_main("main.cpp", R"(
+void foo(int a, int b);
+
+void bar() {
+    auto x = 1;
+    foo(1, 2);
+    $auto y = 2.0;
+    foo(3, 4);
+}
+)");
+    ASSERT_TRUE(compile_with_pch("-std=c++23"));
+
+    auto labels = [](llvm::ArrayRef<feature::InlayHint> hints) {
+        std::vector<std::pair<std::uint32_t, std::string>> result;
+        for(auto& hint: hints) {
+            result.emplace_back(hint.offset, hint.label);
+        }
+        return result;
+    };
+
+    auto size = static_cast<std::uint32_t>(unit->interested_content().size());
+    auto middle = nameless_points()[0];
+    auto whole = feature::inlay_hints(*unit, {0, size});
+    ASSERT_EQ(whole.size(), 6U);
+
+    feature::InlayHintCache cache;
+    auto first = feature::inlay_hints(*unit, {0, middle}, {.cache = &cache});
+    EXPECT_EQ(labels(first), labels(feature::inlay_hints(*unit, {0, middle})));
+    EXPECT_EQ(cache.missing({0, size}).size(), 1U);
+
+    // A scrolled viewport only visits what the first one left out.
+    auto scrolled = feature::inlay_hints(*unit, {0, size}, {.cache = &cache});
+    EXPECT_EQ(labels(scrolled), labels(whole));
+    EXPECT_TRUE(cache.missing({middle, size}).empty());
+    EXPECT_EQ(labels(feature::inlay_hints(*unit, {middle, size}, {.cache = &cache})),
+              labels(feature::inlay_hints(*unit, {middle, size})));
+}
+
 TEST_CASE(snapshot) {
     ASSERT_SNAPSHOT_GLOB(corpus_dir, "**/*.cpp", [&](std::string_view path) -> std::string {
         if(!compile_file(path))
@@ -4,6 +4,7 @@
 #include <optional>
 #include <vector>
 
+#include "test/annotation.h"
 #include "test/test.h"
 #include "test/tester.h"
 #include "feature/feature.h"
@@ -159,6 +160,31 @@ TEST_CASE(BasicLexicalKinds) {
     EXPECT_TOKEN("c0", SymbolKind::Comment);
 }
 
+TEST_CASE(Syntactic) {
+    auto source = AnnotatedSource::from(R"cpp(
+@d0[#define] @m0[SQUARE](x) ((x) * (x))
+@k0[int] @i0[area] = @m1[SQUARE](@n0[3]); @c0[// done]
+)cpp");
+
+    auto tokens = feature::syntactic_semantic_tokens(source.content);
+    auto kind_of = [&](llvm::StringRef name) {
+        for(auto& token: tokens) {
+            if(token.range == source.ranges[name]) {
+                return SymbolKind::Kind(token.kind);
+            }
+        }
+        return SymbolKind::Conflict;
+    };
+    EXPECT_EQ(kind_of("d0"), SymbolKind::Directive);
+    EXPECT_EQ(kind_of("m0"), SymbolKind::Macro);
+    EXPECT_EQ(kind_of("k0"), SymbolKind::Keyword);
+    EXPECT_EQ(kind_of("m1"), SymbolKind::Macro);
+    EXPECT_EQ(kind_of("n0"), SymbolKind::Number);
+    EXPECT_EQ(kind_of("c0"), SymbolKind::Comment);
+    // Left to the caller to name.
+    EXPECT_EQ(kind_of("i0"), SymbolKind::Invalid);
+}
+
 TEST_CASE(IncludeDirective) {
     add_file("fake.h", "// fake header\n");
     add_main("main.cpp", R"cpp(
@@ -584,6 +610,70 @@ void f() {
     EXPECT_TOKEN("v2", SymbolKind::Variable, definition);
 }
 
+TEST_CASE(Range) {
+    add_main("main.cpp", R"cpp(
+int @f0[first](int a) { return a; }
+int @f1[second](int @p1[b]) { return @r1[b]; }
+@k2[int] @f2[third]() { return 0; }
+)cpp");
+    ASSERT_TRUE(compile_with_pch());
+
+    // The viewport is the second line; neither neighbor is visited.
+    LocalSourceRange view{range("f1").begin, range("r1").end};
+    tokens = feature::semantic_tokens(*unit, view, feature::PositionEncoding::UTF8);
+    decoded = decode_utf8_tokens(unit->interested_content(), tokens);
+    EXPECT_TRUE(find_by_range("f1") != nullptr);
+    EXPECT_TRUE(find_by_range("p1") != nullptr);
+    EXPECT_TRUE(find_by_range("r1") != nullptr);
+    EXPECT_NO_TOKEN("f0");
+    EXPECT_NO_TOKEN("f2");
+    EXPECT_NO_TOKEN("k2");
+
+    // The same tokens as the whole file has there.
+    auto restricted = decoded;
+    tokens = feature::semantic_tokens(*unit, feature::PositionEncoding::UTF8);
+    decoded = decode_utf8_tokens(unit->interested_content(), tokens);
+    std::erase_if(decoded, [&](const DecodedToken& token) { return !token.range.intersects(view); });
+    ASSERT_EQ(restricted.size(), decoded.size());
+    for(std::size_t i = 0; i < decoded.size(); ++i) {
+        EXPECT_EQ(restricted[i].range, decoded[i].range);
+        EXPECT_EQ(restricted[i].type, decoded[i].type);
+        EXPECT_EQ(restricted[i].modifiers, decoded[i].modifiers);
+    }
+}
+
+TEST_CASE(Edits) {
+    using Data = std::vector<std::uint32_t>;
+    Data previous = {0, 0, 3, 1, 0, 1, 4, 2, 5, 0, 0, 3, 1, 5, 0};
+    EXPECT_TRUE(feature::semantic_tokens_edits(previous, previous).empty());
+
+    // The middle token changes; an operand matches its old value, and the
+    // edit still spans the whole token.
+    Data current = {0, 0, 3, 1, 0, 1, 4, 2, 7, 0, 0, 3, 1, 5, 0};
+    auto edits = feature::semantic_tokens_edits(previous, current);
+    ASSERT_EQ(edits.size(), 1u);
+    EXPECT_EQ(edits[0].start, 5u);
+    EXPECT_EQ(edits[0].delete_count, 5u);
+    EXPECT_EQ(edits[0].data.value_or(Data{}), (Data{1, 4, 2, 7, 0}));
+
+    // A token inserted at the front.
+    current = {0, 0, 1, 2, 0};
+    current.insert(current.end(), previous.begin(), previous.end());
+    edits = feature::semantic_tokens_edits(previous, current);
+    ASSERT_EQ(edits.size(), 1u);
+    EXPECT_EQ(edits[0].start, 0u);
+    EXPECT_EQ(edits[0].delete_count, 0u);
+    EXPECT_EQ(edits[0].data.value_or(Data{}), (Data{0, 0, 1, 2, 0}));
+
+    // The last token removed.
+    current.assign(previous.begin(), previous.begin() + 10);
+    edits = feature::semantic_tokens_edits(previous, current);
+    ASSERT_EQ(edits.size(), 1u);
+    EXPECT_EQ(edits[0].start, 10u);
+    EXPECT_EQ(edits[0].delete_count, 5u);
+    EXPECT_FALSE(edits[0].data.has_value());
+}
+
 TEST_CASE(snapshot) {
     ASSERT_SNAPSHOT_GLOB(corpus_dir, "**/*.cpp", [&](std::string_view path) -> std::string {
         if(!compile_file(path))
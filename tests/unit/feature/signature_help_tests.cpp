@@ -23,6 +23,21 @@ void run(llvm::StringRef code) {
     help = feature::signature_help(params, {});
 }
 
+/// Signature help from the compiled AST, the text being unchanged since.
+std::optional<protocol::SignatureHelp> from_ast(llvm::StringRef code) {
+    add_main("main.cpp", code);
+    if(!compile()) {
+        return std::nullopt;
+    }
+    auto unchanged = [](std::uint32_t offset) -> std::optional<std::uint32_t> {
+        return offset;
+    };
+    return feature::signature_help(*unit,
+                                   sources.all_files["main.cpp"].content,
+                                   nameless_points()[0],
+                                   unchanged);
+}
+
 TEST_CASE(Simple) {
     run(R"cpp(
 void foo();
@@ -39,6 +54,74 @@ int main() {
     ASSERT_EQ(help.signatures.size(), 3U);
 }
 
+TEST_CASE(FromAST) {
+    auto result = from_ast(R"cpp(
+void foo();
+
+void foo(int x);
+
+void foo(int x, int y);
+
+int main() {
+    foo(1, $2);
+}
+)cpp");
+
+    ASSERT_TRUE(result.has_value());
+    ASSERT_EQ(result->signatures.size(), 3U);
+    ASSERT_TRUE(result->active_signature.has_value());
+    EXPECT_EQ(result->signatures[*result->active_signature].label, "foo(int x, int y) -> void");
+}
+
+TEST_CASE(FromASTConstructor) {
+    auto result = from_ast(R"cpp(
+struct S {
+    S(int x);
+    S(int x, int y);
+};
+
+S s($1);
+)cpp");
+
+    ASSERT_TRUE(result.has_value());
+    ASSERT_EQ(result->signatures.size(), 2U);
+    EXPECT_EQ(result->signatures[0].label, "S(int x)");
+}
+
+TEST_CASE(FromASTNoCall) {
+    auto result = from_ast(R"cpp(
+void foo(int x);
+
+int main() {
+    if($true) {}
+}
+)cpp");
+
+    ASSERT_TRUE(result.has_value());
+    EXPECT_TRUE(result->signatures.empty());
+}
+
+TEST_CASE(FromASTEdited) {
+    add_main("main.cpp", R"cpp(
+void foo(int x);
+
+int main() {
+    foo($1);
+}
+)cpp");
+    ASSERT_TRUE(compile());
+
+    // The callee was typed after the AST was built.
+    auto edited = [](std::uint32_t) -> std::optional<std::uint32_t> {
+        return std::nullopt;
+    };
+    auto result = feature::signature_help(*unit,
+                                          sources.all_files["main.cpp"].content,
+                                          nameless_points()[0],
+                                          edited);
+    EXPECT_FALSE(result.has_value());
+}
+
 };  // TEST_SUITE(SignatureHelp)
 
 }  // namespace
@@ -0,0 +1,99 @@
+#include "test/test.h"
+#include "test/tester.h"
+#include "index/call_graph.h"
+#include "index/merged_index.h"
+
+namespace clice::testing {
+
+namespace {
+
+TEST_SUITE(CallGraph, Tester) {
+
+index::MergedIndex merged;
+
+void build_index(llvm::StringRef code) {
+    add_main("main.cpp", code);
+    ASSERT_TRUE(compile());
+
+    auto tu_index = index::TUIndex::build(*unit);
+    auto fid = unit->interested_file();
+    merged.merge(0, tu_index.graph.include_location_id(fid), tu_index.main_file_index, {});
+}
+
+index::SymbolHash symbol(llvm::StringRef pos) {
+    auto offset = point(pos);
+    index::SymbolHash hash = 0;
+    merged.lookup(offset, [&](const index::Occurrence& occurrence) {
+        hash = occurrence.target;
+        return false;
+    });
+    return hash;
+}
+
+std::vector<index::CallGraph::Call> callers(index::CallGraph& graph, index::SymbolHash hash) {
+    std::vector<index::CallGraph::Call> calls;
+    graph.callers(hash, [&](const index::CallGraph::Call& call) {
+        calls.push_back(call);
+        return true;
+    });
+    return calls;
+}
+
+std::vector<index::CallGraph::Call> callees(index::CallGraph& graph, index::SymbolHash hash) {
+    std::vector<index::CallGraph::Call> calls;
+    graph.callees(hash, [&](const index::CallGraph::Call& call) {
+        calls.push_back(call);
+        return true;
+    });
+    return calls;
+}
+
+TEST_CASE(CallersAndCallees) {
+    build_index(R"(
+            void $(leaf)leaf() {}
+            void $(mid)mid() { leaf(); }
+            void $(root)root() { mid(); leaf(); }
+        )");
+
+    auto leaf = symbol("leaf");
+    auto mid = symbol("mid");
+    auto root = symbol("root");
+    ASSERT_TRUE(leaf != 0 && mid != 0 && root != 0);
+
+    index::CallGraph graph;
+    graph.set(7, index::CallGraph::collect(7, merged));
+    EXPECT_EQ(graph.size(), 3U);
+
+    auto to_leaf = callers(graph, leaf);
+    ASSERT_EQ(to_leaf.size(), 2U);
+    // By range within the file.
+    EXPECT_EQ(to_leaf[0].caller, mid);
+    EXPECT_EQ(to_leaf[1].caller, root);
+    EXPECT_EQ(to_leaf[0].file, 7U);
+
+    auto from_root = callees(graph, root);
+    ASSERT_EQ(from_root.size(), 2U);
+    EXPECT_EQ(from_root[0].callee, mid);
+    EXPECT_EQ(from_root[1].callee, leaf);
+    EXPECT_TRUE(callers(graph, root).empty());
+
+    // Two levels up from leaf, in memory.
+    EXPECT_EQ(callers(graph, mid).size(), 1U);
+
+    graph.remove(7);
+    EXPECT_EQ(graph.size(), 0U);
+    EXPECT_TRUE(callers(graph, leaf).empty());
+
+    // An invalidated file is collected again from its shard on refresh.
+    graph.invalidate(7);
+    graph.refresh([&](std::uint32_t) -> const index::MergedIndex* { return &merged; });
+    EXPECT_EQ(callers(graph, leaf).size(), 2U);
+
+    graph.invalidate(7);
+    graph.refresh([](std::uint32_t) -> const index::MergedIndex* { return nullptr; });
+    EXPECT_TRUE(callees(graph, root).empty());
+}
+
+};  // TEST_SUITE(CallGraph)
+}  // namespace
+}  // namespace clice::testing
@@ -1,6 +1,11 @@
+#include "test/temp_dir.h"
 #include "test/test.h"
 #include "test/tester.h"
 #include "index/merged_index.h"
+#include "index/serialization.h"
+#include "support/filesystem.h"
+
+#include "llvm/Support/xxhash.h"
 
 namespace clice::testing {
 
@@ -199,6 +204,160 @@ TEST_CASE(SerializationRoundTripInMemory) {
     ASSERT_TRUE(found);
 }
 
+TEST_CASE(Outline) {
+    build_index(R"(
+            namespace ns {
+            struct $(outer)Outer {
+                void $(method)method() {}
+            };
+            }
+            int $(free)free_func() { return 0; }
+        )");
+
+    index::MergedIndex merged;
+    auto fid = unit->interested_file();
+    merged.merge(0, tu_index.graph.include_location_id(fid), tu_index.main_file_index, {});
+
+    auto symbol_at = [&](llvm::StringRef pos) {
+        index::SymbolHash hash = 0;
+        merged.lookup(point(pos), [&](const index::Occurrence& occurrence) {
+            hash = occurrence.target;
+            return false;
+        });
+        return hash;
+    };
+    auto position = [](const std::vector<index::OutlineEntry>& outline, index::SymbolHash hash) {
+        auto it = std::ranges::find(outline, hash, &index::OutlineEntry::symbol);
+        return static_cast<std::uint32_t>(it - outline.begin());
+    };
+
+    auto outline = merged.outline();
+    auto outer = position(outline, symbol_at("outer"));
+    auto method = position(outline, symbol_at("method"));
+    auto free_func = position(outline, symbol_at("free"));
+    ASSERT_TRUE(outer < outline.size() && method < outline.size() && free_func < outline.size());
+    EXPECT_EQ(outline[method].parent, outer);
+    EXPECT_EQ(outline[free_func].parent, index::OutlineEntry::no_parent);
+    EXPECT_TRUE(outline[outer].range.begin < outline[method].range.begin);
+    EXPECT_TRUE(outline[method].range.end < outline[outer].range.end);
+
+    // Stored in the blob as it was derived.
+    llvm::SmallString<4096> buf;
+    llvm::raw_svector_ostream os(buf);
+    merged.serialize(os);
+    auto stored = index::MergedIndex(buf).outline();
+    ASSERT_EQ(stored.size(), outline.size());
+    for(std::size_t i = 0; i < outline.size(); ++i) {
+        EXPECT_EQ(stored[i].symbol, outline[i].symbol);
+        EXPECT_EQ(stored[i].parent, outline[i].parent);
+        EXPECT_EQ(stored[i].range.begin, outline[i].range.begin);
+        EXPECT_EQ(stored[i].range.end, outline[i].range.end);
+    }
+}
+
+TEST_CASE(Documentation) {
+    build_index(R"(
+            /// Adds one.
+            int $(inc)inc(int x);
+
+            int inc(int x) { return x + 1; }
+
+            int $(plain)plain();
+        )");
+
+    index::MergedIndex merged;
+    auto fid = unit->interested_file();
+    merged.merge(0, tu_index.graph.include_location_id(fid), tu_index.main_file_index, {});
+
+    auto symbol_at = [&](llvm::StringRef pos) {
+        index::SymbolHash hash = 0;
+        merged.lookup(point(pos), [&](const index::Occurrence& occurrence) {
+            hash = occurrence.target;
+            return false;
+        });
+        return hash;
+    };
+    auto inc = symbol_at("inc");
+    auto plain = symbol_at("plain");
+    ASSERT_EQ(tu_index.main_file_index.documents.size(), 1U);
+    ASSERT_EQ(merged.documentation(inc), std::optional<std::string>("Adds one."));
+    EXPECT_FALSE(merged.documentation(plain).has_value());
+
+    // Read from the blob without inflating it.
+    llvm::SmallString<4096> buf;
+    llvm::raw_svector_ostream os(buf);
+    merged.serialize(os);
+    index::MergedIndex stored(buf);
+    EXPECT_EQ(stored.documentation(inc), std::optional<std::string>("Adds one."));
+    EXPECT_FALSE(stored.documentation(plain).has_value());
+}
+
+TEST_CASE(LoadCurrentSchema) {
+    build_index(R"(
+            int foo() { return 42; }
+        )");
+
+    index::MergedIndex merged;
+    merged.merge(0, tu_index.built_at, {}, tu_index.main_file_index, {});
+
+    std::string buffer;
+    llvm::raw_string_ostream os(buffer);
+    merged.serialize(os);
+
+    TempDir tmp;
+    auto path = tmp.path("shard.idx");
+    ASSERT_TRUE(fs::write(path, buffer).has_value());
+
+    // A blob of the current schema needs no upgrade.
+    auto loaded = index::MergedIndex::load(path);
+    ASSERT_FALSE(loaded.need_rewrite());
+    bool found = false;
+    loaded.referenced_symbols([&](index::SymbolHash) { found = true; });
+    ASSERT_TRUE(found);
+}
+
+TEST_CASE(LoadRowLayoutShard) {
+    // A blob of before versioning lacks the columns and reads as version 0.
+    flatbuffers::FlatBufferBuilder builder;
+    builder.Finish(index::binary::CreateMergedIndex(builder));
+
+    TempDir tmp;
+    auto path = tmp.path("shard.idx");
+    auto blob = llvm::StringRef(reinterpret_cast<const char*>(builder.GetBufferPointer()),
+                                builder.GetSize());
+    ASSERT_TRUE(fs::write(path, blob).has_value());
+
+    auto loaded = index::MergedIndex::load(path);
+    EXPECT_TRUE(loaded.need_update({}));
+    bool found = false;
+    loaded.referenced_symbols([&](index::SymbolHash) { found = true; });
+    loaded.lookup(0, [&](const index::Occurrence&) { return found = true; });
+    EXPECT_FALSE(found);
+}
+
+TEST_CASE(ContentHash) {
+    std::string content = "int foo() { return 42; }\nint bar();\n";
+    build_index(content);
+
+    index::MergedIndex merged;
+    merged.merge(0, tu_index.built_at, {}, tu_index.main_file_index, content);
+    auto hash = llvm::xxh3_64bits(content);
+    EXPECT_EQ(merged.content_hash(), hash);
+    auto lines = merged.line_starts().size();
+    EXPECT_GE(lines, 2U);
+
+    // Only the hash and the line starts are written, never the text.
+    llvm::SmallString<0> buf;
+    llvm::raw_svector_ostream os(buf);
+    merged.serialize(os);
+    EXPECT_EQ(llvm::StringRef(buf).find("return 42"), llvm::StringRef::npos);
+
+    index::MergedIndex stored(buf);
+    EXPECT_EQ(stored.content_hash(), hash);
+    EXPECT_EQ(stored.line_starts().size(), lines);
+    EXPECT_TRUE(stored.stored_content().empty());
+}
+
 TEST_CASE(RemoveCompilationContext) {
     build_index(R"(
             int foo() { return 42; }
@@ -261,6 +420,58 @@ TEST_CASE(RemoveHeaderContext) {
     merged_header.serialize(os);
 }
 
+TEST_CASE(HeaderContextPerHost) {
+    add_file("header.h", R"(
+            #pragma once
+            inline int shared() { return 1; }
+        )");
+    add_main("main.cpp", R"(
+            #include "header.h"
+            int use() { return shared(); }
+        )");
+    ASSERT_TRUE(compile());
+    tu_index = index::TUIndex::build(*unit);
+
+    auto fid = unit->file_id("header.h");
+    auto include_id = tu_index.graph.include_location_id(fid);
+    auto& file_index = tu_index.file_indices[fid];
+
+    // Two source files include the header at the same include location.
+    index::MergedIndex merged;
+    ASSERT_TRUE(merged.merge(0, include_id, file_index, {}));
+    ASSERT_TRUE(merged.merge(1, include_id, file_index, {}));
+
+    // Recompiling the first one replaces only its own context.
+    ASSERT_TRUE(merged.merge(0, include_id, file_index, {}));
+    ASSERT_TRUE(merged.context_index(0).has_value());
+    ASSERT_TRUE(merged.context_index(1).has_value());
+
+    merged.remove(0);
+    ASSERT_FALSE(merged.context_index(0).has_value());
+    ASSERT_TRUE(merged.context_index(1).has_value());
+}
+
+TEST_CASE(Clone) {
+    build_index(R"(
+            int foo() { return 42; }
+        )");
+
+    index::MergedIndex merged;
+    merged.merge(0, tu_index.built_at, {}, tu_index.main_file_index, {});
+
+    auto copy = merged.clone();
+    ASSERT_TRUE(merged == copy);
+
+    // Changing the copy leaves the original as it was.
+    copy.remove(0);
+    ASSERT_FALSE(copy.context_index(0).has_value());
+    ASSERT_TRUE(merged.context_index(0).has_value());
+
+    merged.seal();
+    auto sealed = merged.clone();
+    ASSERT_TRUE(merged == sealed);
+}
+
 TEST_CASE(RemovedBitmapRoundTrip) {
     build_index(R"(
             int foo() { return 42; }
@@ -317,6 +528,188 @@ TEST_CASE(LookupFiltersRemoved) {
     ASSERT_FALSE(found_after);
 }
 
+TEST_CASE(BufferLookupFiltersRemoved) {
+    build_index(R"(
+            int $(target)foo() { return 42; }
+        )");
+
+    index::MergedIndex merged;
+    std::vector<index::IncludeLocation> locations;
+    merged.merge(0, tu_index.built_at, std::move(locations), tu_index.main_file_index, {});
+    merged.remove(0);
+
+    llvm::SmallString<4096> buf;
+    llvm::raw_svector_ostream os(buf);
+    merged.serialize(os);
+
+    // Lookups read the serialized buffer without inflating it.
+    auto restored = index::MergedIndex(buf);
+    auto offset = point("target");
+    bool found = false;
+    restored.lookup(offset, [&](const index::Occurrence& occ) {
+        found = true;
+        return true;
+    });
+    ASSERT_FALSE(found);
+    ASSERT_FALSE(restored.need_rewrite());
+}
+
+TEST_CASE(SealedLookup) {
+    build_index(R"(
+            struct Base {};
+            struct Derived : Base {};
+            int foo() { return 42; }
+            int bar() { return foo() + foo(); }
+        )");
+
+    index::MergedIndex merged;
+    merged.merge(0, tu_index.built_at, {}, tu_index.main_file_index, {});
+
+    auto collect = [&](index::MergedIndex& index) {
+        std::vector<std::tuple<std::uint32_t, std::uint32_t, index::SymbolHash>> result;
+        for(auto& occ: tu_index.main_file_index.occurrences) {
+            index.lookup(occ.range.begin, [&](const index::Occurrence& o) {
+                result.emplace_back(o.range.begin, o.range.end, o.target);
+                return true;
+            });
+        }
+        for(auto& [symbol, relations]: tu_index.main_file_index.relations) {
+            for(auto& relation: relations) {
+                index.lookup(symbol, relation.kind, [&](const index::Relation& r) {
+                    result.emplace_back(r.range.begin, r.range.end, r.target_symbol);
+                    return true;
+                });
+            }
+        }
+        std::ranges::sort(result);
+        return result;
+    };
+
+    auto expected = collect(merged);
+    ASSERT_FALSE(expected.empty());
+
+    merged.seal();
+    ASSERT_TRUE(merged.need_rewrite());
+    ASSERT_TRUE(collect(merged) == expected);
+
+    merged.mark_saved();
+    ASSERT_FALSE(merged.need_rewrite());
+
+    // Merging again inflates the sealed buffer.
+    merged.merge(1, tu_index.built_at, {}, tu_index.main_file_index, {});
+    ASSERT_TRUE(merged.need_rewrite());
+    ASSERT_TRUE(collect(merged) == expected);
+}
+
+TEST_CASE(ReferencedSymbols) {
+    build_index(R"(
+            int foo() { return 42; }
+            int bar() { return foo(); }
+        )");
+
+    index::MergedIndex merged;
+    merged.merge(0, tu_index.built_at, {}, tu_index.main_file_index, {});
+
+    auto collect = [](index::MergedIndex& index) {
+        std::vector<index::SymbolHash> result;
+        index.referenced_symbols([&](index::SymbolHash hash) { result.push_back(hash); });
+        std::ranges::sort(result);
+        return result;
+    };
+
+    std::vector<index::SymbolHash> expected;
+    for(auto& [symbol, _]: tu_index.main_file_index.relations) {
+        expected.push_back(symbol);
+    }
+    std::ranges::sort(expected);
+    ASSERT_FALSE(expected.empty());
+    ASSERT_TRUE(collect(merged) == expected);
+
+    merged.seal();
+    ASSERT_TRUE(collect(merged) == expected);
+
+    // Merging the same file again replaces its context, so one remove drops
+    // every reference.
+    merged.merge(0, tu_index.built_at, {}, tu_index.main_file_index, {});
+    ASSERT_TRUE(collect(merged) == expected);
+    merged.remove(0);
+    ASSERT_TRUE(collect(merged).empty());
+
+    merged.seal();
+    ASSERT_TRUE(collect(merged).empty());
+}
+
+TEST_CASE(KnownHashMerge) {
+    build_index(R"(
+            int foo() { return 42; }
+            int bar() { return foo(); }
+        )");
+
+    auto hash = tu_index.main_file_index.hash();
+    index::FileIndex reused{.known_hash = hash};
+
+    // Nothing to reuse yet: the merge is refused and changes nothing.
+    index::MergedIndex merged;
+    std::vector<std::string> hashes;
+    auto collect = [&] {
+        hashes.clear();
+        merged.canonical_hashes([&](llvm::StringRef key) { hashes.push_back(key.str()); });
+    };
+    ASSERT_FALSE(merged.merge(0, 0, reused, {}));
+    collect();
+    ASSERT_TRUE(hashes.empty());
+
+    ASSERT_TRUE(merged.merge(0, 0, tu_index.main_file_index, {}));
+    collect();
+    ASSERT_EQ(hashes.size(), 1U);
+    ASSERT_EQ(hashes.front(), std::string(reinterpret_cast<const char*>(hash.data()), hash.size()));
+
+    // A second includer reuses the index, so it outlives the first.
+    ASSERT_TRUE(merged.merge(1, 0, reused, {}));
+    merged.remove(0);
+    bool found = false;
+    merged.referenced_symbols([&](index::SymbolHash) { found = true; });
+    ASSERT_TRUE(found);
+}
+
+TEST_CASE(KnownContexts) {
+    build_index(R"(
+            int foo() { return 42; }
+        )");
+
+    auto& file_index = tu_index.main_file_index;
+    auto hash = file_index.hash();
+    auto& context = file_index.context_hash.emplace();
+    context.fill(7);
+
+    index::MergedIndex merged;
+    merged.merge(0, 0, file_index, {});
+
+    auto as_string = [](const index::FileIndexHash& hash) {
+        return std::string(reinterpret_cast<const char*>(hash.data()), hash.size());
+    };
+    auto collect = [](index::MergedIndex& index) {
+        std::vector<std::pair<std::string, std::string>> result;
+        index.known_contexts([&](llvm::StringRef context, llvm::StringRef hash) {
+            result.emplace_back(context.str(), hash.str());
+        });
+        return result;
+    };
+    std::vector<std::pair<std::string, std::string>> expected{
+        {as_string(context), as_string(hash)}
+    };
+    ASSERT_TRUE(collect(merged) == expected);
+
+    merged.seal();
+    ASSERT_TRUE(collect(merged) == expected);
+
+    std::string buffer;
+    llvm::raw_string_ostream os(buffer);
+    merged.serialize(os);
+    auto loaded = index::MergedIndex(buffer);
+    ASSERT_TRUE(collect(loaded) == expected);
+}
+
 TEST_CASE(CacheInvalidatedAfterMerge) {
     build_index(R"(
             int $(first)foo() { return 42; }
@@ -357,6 +750,106 @@ TEST_CASE(CacheInvalidatedAfterMerge) {
     ASSERT_TRUE(found_second);
 }
 
+TEST_CASE(LookupInContext) {
+    // Two hosts see the same header position as different symbols.
+    index::MergedIndex merged;
+    build_index(R"(
+            int $(pos)foo() { return 42; }
+        )");
+    auto offset = point("pos");
+    merged.merge(0,
+                 tu_index.graph.include_location_id(unit->interested_file()),
+                 tu_index.main_file_index,
+                 {});
+
+    build_index(R"(
+            int $(pos)bar() { return 42; }
+        )");
+    ASSERT_EQ(point("pos"), offset);
+    merged.merge(1,
+                 tu_index.graph.include_location_id(unit->interested_file()),
+                 tu_index.main_file_index,
+                 {});
+
+    auto targets = [&](index::MergedIndex& index, std::optional<std::uint32_t> context) {
+        llvm::SmallVector<index::SymbolHash> result;
+        auto collect = [&](const index::Occurrence& o) {
+            result.push_back(o.target);
+            return true;
+        };
+        if(context)
+            index.lookup_in_context(*context, offset, collect);
+        else
+            index.lookup(offset, collect);
+        return result;
+    };
+
+    auto check = [&](index::MergedIndex& index) {
+        auto first = index.context_index(0);
+        auto second = index.context_index(1);
+        ASSERT_TRUE(first.has_value());
+        ASSERT_TRUE(second.has_value());
+        ASSERT_FALSE(index.context_index(2).has_value());
+
+        auto in_first = targets(index, first);
+        auto in_second = targets(index, second);
+        ASSERT_EQ(in_first.size(), 1U);
+        ASSERT_EQ(in_second.size(), 1U);
+        ASSERT_NE(in_first[0], in_second[0]);
+        ASSERT_EQ(targets(index, std::nullopt).size(), 2U);
+    };
+
+    check(merged);
+
+    llvm::SmallString<4096> buf;
+    llvm::raw_svector_ostream os(buf);
+    merged.serialize(os);
+    auto restored = index::MergedIndex(buf);
+    check(restored);
+    ASSERT_FALSE(restored.need_rewrite());
+}
+
+TEST_CASE(CompactDropsRemoved) {
+    build_index(R"(
+            int $(pos)foo() { return 42; }
+        )");
+    auto offset = point("pos");
+    index::MergedIndex merged;
+    merged.merge(0, tu_index.built_at, {}, tu_index.main_file_index, {});
+
+    build_index(R"(
+            int bar() { return 42; }
+        )");
+    merged.merge(1, tu_index.built_at, {}, tu_index.main_file_index, {});
+    index::MergedIndex expected;
+    expected.merge(1, tu_index.built_at, {}, tu_index.main_file_index, {});
+
+    merged.remove(0);
+    ASSERT_EQ(merged.garbage_ratio(), 0.5);
+
+    llvm::SmallString<4096> before;
+    llvm::raw_svector_ostream before_os(before);
+    merged.serialize(before_os);
+    ASSERT_EQ(index::MergedIndex(before).garbage_ratio(), 0.5);
+
+    merged.compact();
+    ASSERT_EQ(merged.garbage_ratio(), 0.0);
+    ASSERT_TRUE(merged.context_index(1) == std::optional<std::uint32_t>(0));
+    ASSERT_TRUE(merged == expected);
+
+    bool found = false;
+    merged.lookup(offset, [&](const index::Occurrence&) {
+        found = true;
+        return true;
+    });
+    ASSERT_FALSE(found);
+
+    llvm::SmallString<4096> after;
+    llvm::raw_svector_ostream after_os(after);
+    merged.serialize(after_os);
+    ASSERT_TRUE(after.size() < before.size());
+}
+
 TEST_CASE(LocalSymbolTable) {
     build_index(R"(
             void foo() { int local = 42; }
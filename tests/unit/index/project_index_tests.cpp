@@ -146,6 +146,106 @@ TEST_CASE(SerializationRoundTrip) {
     }
 }
 
+TEST_CASE(SegmentRoundTrip) {
+    index::TUIndex tu;
+    ASSERT_TRUE(build_and_index(R"(
+            struct Foo { int x; };
+            void bar(Foo f) { f.x = 42; }
+            int baz() { return 1; }
+        )",
+                                tu));
+
+    index::ProjectIndex project;
+    project.merge(tu);
+    ASSERT_EQ(project.dirty_segments, ~std::uint64_t(0));
+
+    // Write every segment, then the header naming their versions.
+    std::vector<std::string> segments(index::ProjectIndex::segment_count);
+    project.serialize_segments(project.dirty_segments,
+                               [&](std::uint32_t segment, llvm::StringRef data) {
+                                   segments[segment] = data.str();
+                               });
+    project.segment_versions.assign(index::ProjectIndex::segment_count, 1);
+
+    llvm::SmallString<4096> buf;
+    llvm::raw_svector_ostream os(buf);
+    project.serialize_header(os);
+
+    auto restored = index::ProjectIndex::from(buf.data());
+    ASSERT_TRUE(restored.symbols.empty());
+    ASSERT_EQ(restored.dirty_segments, 0U);
+    ASSERT_EQ(restored.segment_versions.size(), index::ProjectIndex::segment_count);
+    ASSERT_EQ(restored.path_pool.paths.size(), project.path_pool.paths.size());
+
+    for(auto& segment: segments) {
+        restored.load_segment(segment.data());
+    }
+    ASSERT_EQ(restored.symbols.size(), project.symbols.size());
+    for(auto& [hash, symbol]: project.symbols) {
+        ASSERT_TRUE(restored.symbols.contains(hash));
+        ASSERT_EQ(restored.name_of(restored.symbols[hash]), project.name_of(symbol));
+    }
+
+    // Merging marks only the segments of the symbols it touches.
+    restored.merge(tu);
+    std::uint64_t expected = 0;
+    for(auto& [hash, symbol]: tu.symbols) {
+        if(symbol.scope == index::SymbolScope::External) {
+            expected |= std::uint64_t(1) << index::ProjectIndex::segment_of(hash);
+        }
+    }
+    ASSERT_EQ(restored.dirty_segments, expected);
+}
+
+TEST_CASE(UpdateReferences) {
+    index::ProjectIndex project;
+    project.symbols[1].name = project.names.get("foo");
+    project.symbols[2].name = project.names.get("bar");
+    project.symbols[1].reference_files.add(7);
+    project.dirty_segments = 0;
+
+    project.update_references(7, {2, 3}, {1});
+    ASSERT_FALSE(project.symbols[1].reference_files.contains(7));
+    ASSERT_TRUE(project.symbols[2].reference_files.contains(7));
+
+    // Symbols outside the table are not added.
+    ASSERT_FALSE(project.symbols.contains(3));
+    ASSERT_EQ(project.dirty_segments, std::uint64_t(1) << index::ProjectIndex::segment_of(1));
+
+    // Nothing changes, so nothing is dirtied.
+    project.dirty_segments = 0;
+    project.update_references(7, {2}, {1});
+    ASSERT_EQ(project.dirty_segments, 0U);
+}
+
+TEST_CASE(UpdateDefinitions) {
+    index::ProjectIndex project;
+    project.symbols[1].name = project.names.get("foo");
+    project.symbols[2].name = project.names.get("bar");
+    project.dirty_segments = 0;
+
+    index::DefinitionLocation foo{.path_id = 7, .begin_line = 3, .end_line = 3, .end_character = 3};
+    index::DefinitionLocation bar{.path_id = 8, .begin_line = 1, .end_line = 1, .end_character = 3};
+    project.update_definitions(7, {{1, foo}, {3, foo}}, {});
+    project.update_definitions(8, {{2, bar}}, {});
+    ASSERT_TRUE(project.symbols[1].definition == foo);
+    ASSERT_FALSE(project.symbols.contains(3));
+
+    // File 7 references bar without defining it: bar stays defined in 8.
+    project.update_definitions(7, {}, {1, 2});
+    ASSERT_FALSE(project.symbols[1].definition.has_value());
+    ASSERT_TRUE(project.symbols[2].definition == bar);
+
+    project.update_definitions(7, {{1, foo}}, {});
+    llvm::SmallString<4096> buf;
+    llvm::raw_svector_ostream os(buf);
+    project.serialize(os);
+    auto restored = index::ProjectIndex::from(buf.data());
+    ASSERT_TRUE(restored.definitions_complete);
+    ASSERT_TRUE(restored.symbols[1].definition == foo);
+    ASSERT_TRUE(restored.symbols[2].definition == bar);
+}
+
 TEST_CASE(FileIdsMapCorrectness) {
     index::TUIndex tu;
     ASSERT_TRUE(build_and_index(R"(
@@ -180,9 +280,9 @@ TEST_CASE(NameSurvivesRoundTrip) {
     bool found_var = false;
     bool found_func = false;
     for(auto& [hash, symbol]: project.symbols) {
-        if(symbol.name == "my_variable")
+        if(project.name_of(symbol) == "my_variable")
             found_var = true;
-        if(symbol.name == "my_function")
+        if(project.name_of(symbol) == "my_function")
             found_func = true;
     }
     ASSERT_TRUE(found_var);
@@ -197,11 +297,59 @@ TEST_CASE(NameSurvivesRoundTrip) {
     // Verify names survive round-trip.
     for(auto& [hash, symbol]: project.symbols) {
         ASSERT_TRUE(restored.symbols.contains(hash));
-        ASSERT_EQ(restored.symbols[hash].name, symbol.name);
+        ASSERT_EQ(restored.name_of(restored.symbols[hash]), project.name_of(symbol));
         ASSERT_EQ(restored.symbols[hash].kind.value(), symbol.kind.value());
     }
 }
 
+TEST_CASE(SharedNameInterned) {
+    index::TUIndex tu;
+    ASSERT_TRUE(build_and_index(R"(
+            void overloaded(int) {}
+            void overloaded(double) {}
+        )",
+                                tu));
+
+    index::ProjectIndex project;
+    project.merge(tu);
+
+    auto collect = [](index::ProjectIndex& index) {
+        llvm::SmallVector<std::uint32_t> ids;
+        for(auto& [hash, symbol]: index.symbols) {
+            if(index.name_of(symbol) == "overloaded")
+                ids.push_back(symbol.name);
+        }
+        return ids;
+    };
+
+    auto ids = collect(project);
+    ASSERT_EQ(ids.size(), 2U);
+    ASSERT_EQ(ids[0], ids[1]);
+
+    // Still one name after a round trip.
+    llvm::SmallString<4096> buf;
+    llvm::raw_svector_ostream os(buf);
+    project.serialize(os);
+    auto restored = index::ProjectIndex::from(buf.data());
+    auto restored_ids = collect(restored);
+    ASSERT_EQ(restored_ids.size(), 2U);
+    ASSERT_EQ(restored_ids[0], restored_ids[1]);
+}
+
+TEST_CASE(RemapPaths) {
+    index::PathPool pool;
+    auto a = pool.path_id("/ci/src/a.cpp");
+    auto b = pool.path_id("/ci/srcx/b.cpp");
+    auto c = pool.path_id("/usr/include/c.h");
+
+    pool.remap("/ci/src/", "/home/me/src");
+    ASSERT_EQ(pool.path(a), "/home/me/src/a.cpp");
+    ASSERT_EQ(pool.path(b), "/ci/srcx/b.cpp");
+    ASSERT_EQ(pool.path(c), "/usr/include/c.h");
+    ASSERT_EQ(pool.path_id("/home/me/src/a.cpp"), a);
+    ASSERT_TRUE(pool.find("/ci/src/a.cpp") == pool.cache.end());
+}
+
 TEST_CASE(LocalSymbolsExcluded) {
     index::TUIndex tu;
     ASSERT_TRUE(build_and_index(R"(
@@ -219,11 +367,11 @@ TEST_CASE(LocalSymbolsExcluded) {
     bool found_static = false;
     bool found_local = false;
     for(auto& [hash, symbol]: project.symbols) {
-        if(symbol.name == "global")
+        if(project.name_of(symbol) == "global")
             found_global = true;
-        if(symbol.name == "file_static")
+        if(project.name_of(symbol) == "file_static")
             found_static = true;
-        if(symbol.name == "local")
+        if(project.name_of(symbol) == "local")
             found_local = true;
     }
     ASSERT_TRUE(found_global);
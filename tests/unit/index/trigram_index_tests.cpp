@@ -0,0 +1,49 @@
+#include <algorithm>
+#include <vector>
+
+#include "test/test.h"
+#include "index/trigram_index.h"
+
+namespace clice::testing {
+namespace {
+
+TEST_SUITE(TrigramIndex) {
+
+std::vector<index::SymbolHash> lookup(const index::TrigramIndex& names, llvm::StringRef query) {
+    std::vector<index::SymbolHash> result;
+    names.candidates(query, [&](index::SymbolHash hash, const PreparedWord&) {
+        result.push_back(hash);
+    });
+    std::ranges::sort(result);
+    return result;
+}
+
+TEST_CASE(Candidates) {
+    index::TrigramIndex names;
+    names.insert(1, "fooBarBaz");
+    names.insert(2, "foo_bar");
+    names.insert(3, "other");
+    names.insert(4, "");
+    ASSERT_EQ(names.size(), 3U);
+
+    using Hashes = std::vector<index::SymbolHash>;
+
+    // Contiguous trigrams, case-insensitive.
+    ASSERT_TRUE(lookup(names, "bar") == Hashes({1, 2}));
+    ASSERT_TRUE(lookup(names, "BARB") == Hashes({1}));
+
+    // Segment heads.
+    ASSERT_TRUE(lookup(names, "fbb") == Hashes({1}));
+
+    // Short queries match prefixes only.
+    ASSERT_TRUE(lookup(names, "fo") == Hashes({1, 2}));
+    ASSERT_TRUE(lookup(names, "o") == Hashes({3}));
+
+    ASSERT_TRUE(lookup(names, "xyz").empty());
+    ASSERT_TRUE(lookup(names, "").empty());
+}
+
+};  // TEST_SUITE(TrigramIndex)
+
+}  // namespace
+}  // namespace clice::testing
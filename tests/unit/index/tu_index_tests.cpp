@@ -484,6 +484,139 @@ TEST_CASE(CrossFileHeaderIndex) {
     ASSERT_TRUE(found_in_header);
 }
 
+TEST_CASE(KnownHeaderIndex) {
+    add_file("header.h", R"(
+            #pragma once
+            int helper();
+        )");
+    add_main("main.cpp", R"(
+            #include "header.h"
+            int main() { return helper(); }
+        )");
+    ASSERT_TRUE(compile());
+
+    auto header = unit->file_id("header.h");
+    auto full = index::TUIndex::build(*unit);
+    auto hash = full.file_indices[header].hash();
+
+    std::vector<std::string> asked;
+    auto known = [&](llvm::StringRef path, const index::FileIndexHash& candidate) {
+        asked.push_back(path.str());
+        return candidate == hash;
+    };
+    tu_index = index::TUIndex::build(*unit, false, known);
+
+    // Only headers are offered, and the known one keeps nothing but its hash.
+    auto ends_with = [](llvm::StringRef suffix) {
+        return [suffix](llvm::StringRef path) { return path.ends_with(suffix); };
+    };
+    ASSERT_TRUE(std::ranges::any_of(asked, ends_with("header.h")));
+    ASSERT_TRUE(std::ranges::none_of(asked, ends_with("main.cpp")));
+    auto& reused = tu_index.file_indices[header];
+    ASSERT_TRUE(reused.known_hash == hash);
+    ASSERT_TRUE(reused.relations.empty());
+    ASSERT_TRUE(reused.occurrences.empty());
+    ASSERT_TRUE(reused.hash() == hash);
+    ASSERT_FALSE(tu_index.main_file_index.occurrences.empty());
+
+    std::string buffer;
+    llvm::raw_string_ostream os(buffer);
+    tu_index.serialize(os);
+    auto loaded = index::TUIndex::from(buffer.data());
+    bool found = false;
+    for(auto& [_, file_index]: loaded.path_file_indices) {
+        if(file_index.known_hash) {
+            ASSERT_TRUE(file_index.hash() == hash);
+            found = true;
+        }
+    }
+    ASSERT_TRUE(found);
+}
+
+TEST_CASE(KnownHeaderContext) {
+    add_file("header.h", R"(
+            #pragma once
+            #ifdef FAST
+            int fast_helper();
+            #else
+            int helper();
+            #endif
+        )");
+    add_main("main.cpp", R"(
+            #include "header.h"
+            int main() { return helper(); }
+        )");
+    ASSERT_TRUE(compile());
+
+    auto header = unit->file_id("header.h");
+    auto full = index::TUIndex::build(*unit);
+    auto& header_index = full.file_indices[header];
+    ASSERT_TRUE(header_index.context_hash.has_value());
+    ASSERT_FALSE(full.main_file_index.context_hash.has_value());
+    auto context = *header_index.context_hash;
+    auto hash = header_index.hash();
+
+    // The context is a function of the header and its preprocessor state.
+    ASSERT_TRUE(index::TUIndex::build(*unit).file_indices[header].context_hash == context);
+
+    auto known_context = [&](llvm::StringRef path, const index::FileIndexHash& candidate)
+        -> std::optional<index::FileIndexHash> {
+        if(path.ends_with("header.h") && candidate == context)
+            return hash;
+        return std::nullopt;
+    };
+    tu_index = index::TUIndex::build(*unit, false, {}, known_context);
+
+    auto& skipped = tu_index.file_indices[header];
+    ASSERT_TRUE(skipped.known_hash == hash);
+    ASSERT_TRUE(skipped.context_hash == context);
+    ASSERT_TRUE(skipped.relations.empty());
+    ASSERT_TRUE(skipped.occurrences.empty());
+
+    // The main file still sees the header's symbols.
+    ASSERT_TRUE(tu_index.main_file_index.occurrences.size() ==
+                full.main_file_index.occurrences.size());
+}
+
+TEST_CASE(KnownHeaderIncludesFile) {
+    add_file("colors.def", R"(
+            RED,
+            GREEN,
+        )");
+    add_file("header.h", R"(
+            #pragma once
+            enum Color {
+            #include "colors.def"
+            };
+        )");
+    add_main("main.cpp", R"(
+            #include "header.h"
+            Color color = RED;
+        )");
+    ASSERT_TRUE(compile());
+
+    auto header = unit->file_id("header.h");
+    auto colors = unit->file_id("colors.def");
+    auto full = index::TUIndex::build(*unit);
+    auto context = *full.file_indices[header].context_hash;
+    auto hash = full.file_indices[header].hash();
+    ASSERT_FALSE(full.file_indices[colors].occurrences.empty());
+
+    auto known_context = [&](llvm::StringRef path, const index::FileIndexHash& candidate)
+        -> std::optional<index::FileIndexHash> {
+        if(path.ends_with("header.h") && candidate == context)
+            return hash;
+        return std::nullopt;
+    };
+    tu_index = index::TUIndex::build(*unit, false, {}, known_context);
+
+    // The enumerators are declared inside the skipped header's enum, but
+    // located in the file it includes there.
+    ASSERT_TRUE(tu_index.file_indices[header].occurrences.empty());
+    ASSERT_TRUE(tu_index.file_indices[colors].occurrences.size() ==
+                full.file_indices[colors].occurrences.size());
+}
+
 TEST_CASE(SymbolKinds) {
     build_index(R"(
             struct $(cls)MyClass {};
@@ -0,0 +1,100 @@
+#include "test/test.h"
+#include "test/tester.h"
+#include "index/merged_index.h"
+#include "index/type_hierarchy.h"
+
+namespace clice::testing {
+
+namespace {
+
+using Walk = std::vector<std::pair<index::SymbolHash, std::uint32_t>>;
+
+Walk walk(const index::TypeHierarchy& hierarchy,
+          index::SymbolHash symbol,
+          bool supertypes,
+          std::uint32_t max_depth) {
+    Walk result;
+    hierarchy.walk(symbol, supertypes, max_depth, [&](index::SymbolHash hash, std::uint32_t depth) {
+        result.emplace_back(hash, depth);
+    });
+    return result;
+}
+
+TEST_SUITE(TypeHierarchy, Tester) {
+
+TEST_CASE(Closure) {
+    // 1 <- 2 <- 4, 1 <- 3 <- 4 (a diamond) and 4 <- 5, over two files.
+    index::TypeHierarchy hierarchy;
+    hierarchy.set(0, {{2, 1}, {3, 1}});
+    hierarchy.set(1, {{4, 2}, {4, 3}, {5, 4}, {2, 1}});
+    EXPECT_EQ(hierarchy.size(), 5U);
+
+    auto subtypes = walk(hierarchy, 1, false, 0);
+    ASSERT_EQ(subtypes.size(), 4U);
+    EXPECT_EQ(subtypes[0], std::pair<index::SymbolHash, std::uint32_t>(2, 1));
+    EXPECT_EQ(subtypes[1], std::pair<index::SymbolHash, std::uint32_t>(3, 1));
+    EXPECT_EQ(subtypes[2], std::pair<index::SymbolHash, std::uint32_t>(4, 2));
+    EXPECT_EQ(subtypes[3], std::pair<index::SymbolHash, std::uint32_t>(5, 3));
+
+    EXPECT_EQ(walk(hierarchy, 1, false, 2).size(), 3U);
+    EXPECT_EQ(walk(hierarchy, 5, true, 0).size(), 4U);
+    EXPECT_EQ(walk(hierarchy, 5, true, 1).size(), 1U);
+
+    // An edge stays while another file records it.
+    hierarchy.remove(1);
+    EXPECT_EQ(hierarchy.derived(1).size(), 2U);
+    EXPECT_TRUE(hierarchy.bases(4).empty());
+    hierarchy.remove(0);
+    EXPECT_EQ(hierarchy.size(), 0U);
+    EXPECT_TRUE(hierarchy.derived(1).empty());
+
+    // Neighbours from outside the graph join the walk.
+    hierarchy.set(0, {{2, 1}});
+    Walk more;
+    hierarchy.walk(
+        1,
+        false,
+        0,
+        [&](index::SymbolHash hash, std::uint32_t depth) { more.emplace_back(hash, depth); },
+        [](index::SymbolHash symbol, llvm::SmallVectorImpl<index::SymbolHash>& out) {
+            if(symbol == 2)
+                out.push_back(6);
+        });
+    ASSERT_EQ(more.size(), 2U);
+    EXPECT_EQ(more[1], std::pair<index::SymbolHash, std::uint32_t>(6, 2));
+}
+
+TEST_CASE(Collect) {
+    add_main("main.cpp", R"(
+            struct Base {};
+            struct Left : Base {};
+            struct Right : Base {};
+            struct Bottom : Left, Right {};
+        )");
+    ASSERT_TRUE(compile());
+
+    auto tu_index = index::TUIndex::build(*unit);
+    index::MergedIndex merged;
+    auto fid = unit->interested_file();
+    merged.merge(0, tu_index.graph.include_location_id(fid), tu_index.main_file_index, {});
+
+    index::TypeHierarchy hierarchy;
+    hierarchy.invalidate(3);
+    hierarchy.refresh([&](std::uint32_t) -> const index::MergedIndex* { return &merged; });
+    EXPECT_EQ(hierarchy.size(), 4U);
+
+    // Bottom is the one type with two bases.
+    index::SymbolHash bottom = 0;
+    for(auto& edge: index::TypeHierarchy::collect(merged)) {
+        if(hierarchy.bases(edge.derived).size() == 2)
+            bottom = edge.derived;
+    }
+    ASSERT_TRUE(bottom != 0);
+    auto supertypes = walk(hierarchy, bottom, true, 0);
+    ASSERT_EQ(supertypes.size(), 3U);
+    EXPECT_EQ(supertypes[2].second, 2U);
+}
+
+};  // TEST_SUITE(TypeHierarchy)
+}  // namespace
+}  // namespace clice::testing
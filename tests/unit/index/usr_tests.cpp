@@ -348,6 +348,57 @@ public:
     ASSERT_NE(usr1, usr2);
 }
 
+TEST_CASE(USRContextCacheMatches) {
+    llvm::StringRef content = R"cpp(
+namespace outer::inner {
+template <typename T, int N>
+struct Box {
+    struct Nested {
+        void get(T*, int);
+        T value;
+    };
+    template <typename U>
+    void put(U, Box<T, N>&);
+    static constexpr int size = N;
+};
+
+template <>
+struct Box<Box<char, 1>*, 2> {
+    void get(Box<char, 1>*);
+    void other(Box<char, 1>*, Box<char, 1>*);
+};
+
+static void local() {
+    struct Local {
+        int field;
+    };
+    auto lambda = [](int x) { return x; };
+}
+}  // namespace outer::inner
+
+extern "C" {
+struct C {
+    int c;
+};
+}
+)cpp";
+
+    USRTester tester("main.cpp", content);
+    tester.run();
+
+    // The second pass replays every scope from the cache the first filled.
+    index::USRContextCache cache;
+    for(int pass = 0; pass < 2; ++pass) {
+        for(auto& [offset, info]: tester.USRs) {
+            llvm::SmallString<128> cached;
+            ASSERT_FALSE(index::generateUSRForDecl(info.decl, cached, &cache));
+            ASSERT_EQ(cached.str(), info.USR.str());
+        }
+    }
+    ASSERT_TRUE(tester.USRs.size() > 10);
+    ASSERT_FALSE(cache.contexts.empty());
+}
+
 };  // TEST_SUITE(USR)
 
 }  // namespace
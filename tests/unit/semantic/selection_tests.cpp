@@ -770,6 +770,45 @@ auto Func(Fo$o auto V) -> Fo$o decltype(auto) {
     }
 }
 
+TEST_CASE(Batch) {
+    constexpr auto code = R"cpp(
+struct S {
+    int field;
+    int get() const { return fi$eld; }
+};
+
+int f$oo(S s) {
+    return s.g$et() + @range[s.field];
+}
+
+#define ADD(a, b) a + b
+int bar = A$DD(1, 2) + f$oo({});
+  )cpp";
+
+    add_main("main.cpp", code);
+    ASSERT_TRUE(compile());
+
+    std::vector<LocalSourceRange> ranges;
+    for(auto point: nameless_points()) {
+        ranges.emplace_back(point, point);
+    }
+    ranges.push_back(range("range"));
+
+    auto dump = [](const SelectionTree& tree) {
+        std::string result;
+        llvm::raw_string_ostream os(result);
+        os << tree;
+        return result;
+    };
+
+    // One traversal yields the same trees as one per range.
+    auto trees = SelectionTree::create_right(*unit, ranges);
+    ASSERT_EQ(trees.size(), ranges.size());
+    for(std::size_t i = 0; i < ranges.size(); ++i) {
+        EXPECT_EQ(dump(trees[i]), dump(SelectionTree::create_right(*unit, ranges[i])));
+    }
+}
+
 };  // TEST_SUITE(SelectionTree)
 
 }  // namespace clice::testing
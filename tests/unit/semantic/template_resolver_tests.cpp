@@ -945,6 +945,37 @@ TEST_CASE(Standard) {
     EXPECT_EQ(input.getCanonicalType(), target.getCanonicalType());
 };
 
+TEST_CASE(Memoized) {
+    add_main("main.cpp", R"code(
+        template <typename T>
+        struct A {
+            using type = T;
+        };
+
+        template <typename T>
+        struct B {
+            using input = typename A<T>::type;
+            using expect = T;
+        };
+    )code");
+    ASSERT_TRUE(compile());
+
+    InputFinder finder(*unit);
+    finder.TraverseAST(unit->context());
+
+    auto& resolver = unit->resolver();
+    auto first = resolver.resolve(finder.input);
+    EXPECT_EQ(resolver.stats().misses, 1U);
+    EXPECT_EQ(resolver.stats().hits, 0U);
+
+    // A later query over the same code reuses the result.
+    auto second = resolver.resolve(finder.input);
+    EXPECT_EQ(resolver.stats().misses, 1U);
+    EXPECT_EQ(resolver.stats().hits, 1U);
+    EXPECT_EQ(first, second);
+    EXPECT_EQ(second.getCanonicalType(), finder.expect.getCanonicalType());
+}
+
 };  // TEST_SUITE(TemplateResolver)
 
 }  // namespace
@@ -0,0 +1,108 @@
+#include "test/test.h"
+#include "server/worker/argument_cache.h"
+
+namespace clice::testing {
+namespace {
+
+using Args = std::vector<std::string>;
+
+/// What the master sends for `arguments`, and what the worker makes of it.
+struct Sent {
+    std::uint64_t id = 0;
+    bool known = false;
+    Args arguments;
+};
+
+Sent send(ArgumentIds& ids, Args arguments) {
+    Sent sent{.arguments = std::move(arguments)};
+    ids.compact(sent.id, sent.known, sent.arguments);
+    return sent;
+}
+
+std::optional<Args> receive(ArgumentCache& cache, const Sent& sent) {
+    return cache.resolve(sent.id, sent.known, sent.arguments);
+}
+
+TEST_SUITE(ArgumentCache) {
+
+TEST_CASE(Driver) {
+    ArgumentIds ids;
+    ArgumentCache cache;
+
+    Args a{"clang++", "-std=c++20", "-DA", "/src/a.cpp"};
+    auto first = send(ids, a);
+    EXPECT_NE(first.id, 0u);
+    EXPECT_FALSE(first.known);
+    EXPECT_EQ(first.arguments, a);
+    EXPECT_EQ(receive(cache, first).value_or(Args{}), a);
+
+    // Another file of the same group only sends its path.
+    Args b{"clang++", "-std=c++20", "-DA", "/src/b.cpp"};
+    auto second = send(ids, b);
+    EXPECT_EQ(second.id, first.id);
+    EXPECT_TRUE(second.known);
+    EXPECT_EQ(second.arguments, Args{"/src/b.cpp"});
+    EXPECT_EQ(receive(cache, second).value_or(Args{}), b);
+
+    // Other flags, other template.
+    auto other = send(ids, {"clang++", "-DB", "/src/c.cpp"});
+    EXPECT_NE(other.id, first.id);
+    EXPECT_FALSE(other.known);
+}
+
+TEST_CASE(Cc1) {
+    ArgumentIds ids;
+    ArgumentCache cache;
+
+    Args a{"clang", "-cc1", "-main-file-name", "a.cpp", "-std=c++20", "/src/a.cpp"};
+    Args b{"clang", "-cc1", "-main-file-name", "b.cpp", "-std=c++20", "/src/b.cpp"};
+    EXPECT_EQ(receive(cache, send(ids, a)).value_or(Args{}), a);
+
+    auto second = send(ids, b);
+    EXPECT_TRUE(second.known);
+    EXPECT_EQ(second.arguments, (Args{"/src/b.cpp", "b.cpp"}));
+    EXPECT_EQ(receive(cache, second).value_or(Args{}), b);
+}
+
+TEST_CASE(UnknownTemplate) {
+    ArgumentIds ids;
+    ArgumentCache first;
+    Args a{"clang++", "-DA", "/src/a.cpp"};
+    EXPECT_EQ(receive(first, send(ids, a)).value_or(Args{}), a);
+
+    // A respawned worker holds nothing yet.
+    ArgumentCache respawned;
+    auto second = send(ids, {"clang++", "-DA", "/src/b.cpp"});
+    EXPECT_TRUE(second.known);
+    EXPECT_FALSE(receive(respawned, second).has_value());
+
+    // Once forgotten, the next request goes in full again.
+    ids.clear();
+    Args b{"clang++", "-DA", "/src/b.cpp"};
+    auto resent = send(ids, b);
+    EXPECT_FALSE(resent.known);
+    EXPECT_EQ(receive(respawned, resent).value_or(Args{}), b);
+}
+
+TEST_CASE(Bounded) {
+    ArgumentIds ids;
+    for(std::size_t i = 0; i < ArgumentIds::max_entries; ++i) {
+        send(ids, {"clang++", "-D" + std::to_string(i), "/src/a.cpp"});
+    }
+    EXPECT_EQ(ids.size(), ArgumentIds::max_entries);
+
+    // Past the cap, new templates are sent whole and untagged.
+    auto extra = send(ids, {"clang++", "-DEXTRA", "/src/a.cpp"});
+    EXPECT_EQ(extra.id, 0u);
+    EXPECT_EQ(ids.size(), ArgumentIds::max_entries);
+
+    // No arguments, nothing to compact.
+    auto empty = send(ids, {});
+    EXPECT_EQ(empty.id, 0u);
+    EXPECT_TRUE(empty.arguments.empty());
+}
+
+};  // TEST_SUITE(ArgumentCache)
+
+}  // namespace
+}  // namespace clice::testing
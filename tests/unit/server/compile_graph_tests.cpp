@@ -101,6 +101,7 @@ struct Request {
     kota::cancellation_source source;
     std::optional<bool> result;
     bool done = false;
+    bool urgent = false;
 };
 
 TEST_SUITE(CompileGraph) {
@@ -130,7 +131,8 @@ void execute(F&& fn) {
 }
 
 kota::task<> run_request(std::uint32_t path_id, Request& req) {
-    auto result = co_await kota::with_token(graph->compile(path_id), req.source.token());
+    auto result =
+        co_await kota::with_token(graph->compile(path_id, req.urgent), req.source.token());
     req.done = true;
     if(result.has_value()) {
         req.result = *result;
@@ -138,7 +140,8 @@ kota::task<> run_request(std::uint32_t path_id, Request& req) {
 }
 
 kota::task<> run_deps_request(std::uint32_t path_id, Request& req) {
-    auto result = co_await kota::with_token(graph->compile_deps(path_id), req.source.token());
+    auto result =
+        co_await kota::with_token(graph->compile_deps(path_id, req.urgent), req.source.token());
     req.done = true;
     if(result.has_value()) {
         req.result = *result;
@@ -1203,6 +1206,56 @@ TEST_CASE(update_introduced_cycle) {
     });
 }
 
+TEST_CASE(order_repaired_on_resolve) {
+    // Each unit is seen before its dependencies, so every resolved edge
+    // reorders part of the chain; it never reads as a cycle.
+    make_graph(tracking_dispatch(compiled),
+               static_resolver({
+                   {1, {2, 4}},
+                   {2, {3}   },
+                   {3, {4}   },
+                   {5, {1}   }
+    }));
+
+    execute([&]() -> kota::task<> {
+        auto result = co_await graph->compile(5).catch_cancel();
+        EXPECT_TRUE(result.has_value() && *result);
+        EXPECT_TRUE(graph->acyclic());
+        EXPECT_EQ(compiled, (std::vector<std::uint32_t>{4, 3, 2, 1, 5}));
+    });
+}
+
+TEST_CASE(update_breaks_cycle) {
+    // The edge closing 1 -> 2 -> 1 is dropped with 2's dependencies, and the
+    // graph compiles again once 2 stops importing 1.
+    bool cyclic = true;
+    auto resolver = [&](std::uint32_t path_id) -> llvm::SmallVector<std::uint32_t> {
+        if(path_id == 1) {
+            return {2};
+        }
+        if(path_id == 2 && cyclic) {
+            return {1};
+        }
+        return {};
+    };
+
+    make_graph(instant_dispatch(), std::move(resolver));
+
+    execute([&]() -> kota::task<> {
+        auto r1 = co_await graph->compile(1).catch_cancel();
+        EXPECT_TRUE(r1.has_value() && !*r1);
+        EXPECT_FALSE(graph->acyclic());
+
+        cyclic = false;
+        graph->update(2);
+        EXPECT_TRUE(graph->acyclic());
+
+        auto r2 = co_await graph->compile(1).catch_cancel();
+        EXPECT_TRUE(r2.has_value() && *r2);
+        EXPECT_TRUE(graph->acyclic());
+    });
+}
+
 /// ============================================================================
 ///                      Shared dependencies & cancellation
 /// ============================================================================
@@ -1514,6 +1567,196 @@ TEST_CASE(rerequest_within_grace) {
     });
 }
 
+/// ============================================================================
+///                                 Scheduling
+/// ============================================================================
+///
+/// Ready units share max_parallel dispatch slots; a freed slot goes to the
+/// unit with the longest chain of dirty dependents behind it.
+
+TEST_CASE(max_parallel_caps_dispatch) {
+    // Six independent dependencies but two slots: never more than two
+    // dispatches overlap, and every unit still compiles.
+    int in_flight = 0;
+    int peak = 0;
+    auto dispatch = [&](std::uint32_t path_id) -> kota::task<bool> {
+        in_flight += 1;
+        peak = std::max(peak, in_flight);
+        co_await kota::sleep(1);
+        in_flight -= 1;
+        compiled.push_back(path_id);
+        co_return true;
+    };
+    make_graph(dispatch,
+               static_resolver({
+                   {1, {2, 3, 4, 5, 6, 7}}
+    }));
+    graph->set_max_parallel(2);
+
+    execute([&]() -> kota::task<> {
+        auto result = co_await graph->compile(1).catch_cancel();
+        EXPECT_TRUE(result.has_value());
+        EXPECT_TRUE(*result);
+        EXPECT_EQ(compiled.size(), 7u);
+        EXPECT_EQ(peak, 2);
+        EXPECT_EQ(graph->dispatching(), 0u);
+    });
+}
+
+TEST_CASE(critical_path_first) {
+    // 1 -> {3, 4, 2}, 2 -> 5 -> 6, one slot. 3 takes the slot first; 4 and
+    // 6 queue behind it. 6 has a chain of three dirty dependents and 4 only
+    // one, so 6 wins the slot although 4 queued first.
+    auto dispatch = [&](std::uint32_t path_id) -> kota::task<bool> {
+        co_await kota::sleep(1);
+        compiled.push_back(path_id);
+        co_return true;
+    };
+    make_graph(dispatch,
+               static_resolver({
+                   {1, {3, 4, 2}},
+                   {2, {5}      },
+                   {5, {6}      }
+    }));
+    graph->set_max_parallel(1);
+
+    execute([&]() -> kota::task<> {
+        auto result = co_await graph->compile(1).catch_cancel();
+        EXPECT_TRUE(result.has_value());
+        EXPECT_TRUE(*result);
+        EXPECT_EQ(compiled.size(), 6u);
+        EXPECT_EQ(compiled.front(), 3u);
+        EXPECT_TRUE(ranges::find(compiled, 6u) < ranges::find(compiled, 4u));
+        EXPECT_EQ(graph->remaining_path(6), 0u);
+    });
+}
+
+TEST_CASE(remaining_path_counts_dirty_dependents) {
+    // The rank only counts dependents that still have to be built.
+    ManualDispatch md;
+    make_graph(md.fn(),
+               static_resolver({
+                   {1, {2}},
+                   {2, {3}}
+    }));
+
+    execute([&]() -> kota::task<> {
+        auto driver = [&]() -> kota::task<> {
+            co_await md.gate(3).started.wait();
+            EXPECT_EQ(graph->remaining_path(3), 2u);
+            EXPECT_EQ(graph->remaining_path(2), 1u);
+            EXPECT_EQ(graph->remaining_path(1), 0u);
+            md.open({1, 2, 3});
+            co_return;
+        };
+
+        Request req;
+        co_await kota::when_all(run_request(1, req), driver());
+        EXPECT_TRUE(req.result == true);
+        EXPECT_EQ(graph->remaining_path(3), 0u);
+    });
+}
+
+TEST_CASE(urgent_first) {
+    // One slot held by 10; 11 queues before the urgent 12, yet 12 gets the
+    // slot next.
+    ManualDispatch md;
+    make_graph(md.fn(), static_resolver({}));
+    graph->set_max_parallel(1);
+
+    execute([&]() -> kota::task<> {
+        auto driver = [&]() -> kota::task<> {
+            co_await md.gate(10).started.wait();
+            md.open({10});
+            co_await md.gate(12).started.wait();
+            EXPECT_EQ(md.gate(11).calls, 0);
+            md.open({11, 12});
+        };
+
+        Request blocker, background, interactive;
+        interactive.urgent = true;
+        co_await kota::when_all(run_request(10, blocker),
+                                run_request(11, background),
+                                run_request(12, interactive),
+                                driver());
+        EXPECT_TRUE(background.result == true);
+        EXPECT_TRUE(interactive.result == true);
+    });
+}
+
+TEST_CASE(urgency_inherited) {
+    // 4 -> 3 compiles in the background; an urgent request for 1 -> 2 -> 3
+    // makes the shared 3 urgent and reports it as already compiling. 4
+    // itself stays background, and urgency ends with the request.
+    ManualDispatch md;
+    make_graph(md.fn(),
+               static_resolver({
+                   {1, {2}},
+                   {2, {3}},
+                   {4, {3}}
+    }));
+    std::vector<std::uint32_t> promoted;
+    graph->on_promote = [&](std::uint32_t path_id) {
+        promoted.push_back(path_id);
+    };
+
+    execute([&]() -> kota::task<> {
+        Request background, interactive;
+        interactive.urgent = true;
+
+        auto driver = [&]() -> kota::task<> {
+            co_await md.gate(3).started.wait();
+            EXPECT_FALSE(graph->urgent(3));
+            EXPECT_TRUE(promoted.empty());
+
+            auto check = [&]() -> kota::task<> {
+                EXPECT_TRUE(graph->urgent(1));
+                EXPECT_TRUE(graph->urgent(2));
+                EXPECT_TRUE(graph->urgent(3));
+                EXPECT_FALSE(graph->urgent(4));
+                EXPECT_TRUE(ranges::contains(promoted, 3u));
+                md.open({1, 2, 3, 4});
+                co_return;
+            };
+            co_await kota::when_all(run_request(1, interactive), check());
+        };
+
+        co_await kota::when_all(run_request(4, background), driver());
+        EXPECT_TRUE(background.result == true);
+        EXPECT_TRUE(interactive.result == true);
+        EXPECT_FALSE(graph->urgent(3));
+    });
+}
+
+TEST_CASE(progress_reports) {
+    // Progress counts the rounds of one busy period and ends with
+    // finished == started.
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> reports;
+    make_graph(tracking_dispatch(compiled),
+               static_resolver({
+                   {1, {2}},
+                   {2, {3}}
+    }));
+    graph->on_progress = [&](std::uint32_t finished, std::uint32_t started) {
+        reports.emplace_back(finished, started);
+    };
+
+    execute([&]() -> kota::task<> {
+        co_await graph->compile(1).catch_cancel();
+        EXPECT_FALSE(reports.empty());
+        EXPECT_EQ(reports.back().first, 3u);
+        EXPECT_EQ(reports.back().second, 3u);
+        EXPECT_TRUE(ranges::all_of(reports, [](auto& r) { return r.first <= r.second; }));
+
+        // A new busy period starts counting from zero.
+        reports.clear();
+        graph->update(3);
+        co_await graph->compile(1).catch_cancel();
+        EXPECT_EQ(reports.front().first, 0u);
+        EXPECT_EQ(reports.back().second, 3u);
+    });
+}
+
 /// ============================================================================
 ///                                  Lifecycle
 /// ============================================================================
@@ -146,6 +146,7 @@ TEST_CASE(ApplyDefaults) {
     config.apply_defaults("/workspace");
     EXPECT_EQ(*config.project.enable_indexing, true);
     EXPECT_EQ(*config.project.idle_timeout_ms, 3000);
+    EXPECT_EQ(*config.project.compile_debounce_ms, 300);
     EXPECT_EQ(config.project.max_active_file.value, 8);
     EXPECT_EQ(config.project.stateful_worker_count.value, 2u);
     EXPECT_GE(config.project.stateless_worker_count.value, 2u);
@@ -504,6 +505,20 @@ append = ["-DTOML_ONLY"]
     EXPECT_EQ(append[0], "-DFROM_JSON");
 }
 
+TEST_CASE(SameRules) {
+    Config config;
+    config.rules.push_back(ConfigRule{.patterns = {"**/*.cpp"}, .append = {"-DA"}});
+    Config other = config;
+    EXPECT_TRUE(config.same_rules(other));
+
+    other.rules[0].append.push_back("-DB");
+    EXPECT_FALSE(config.same_rules(other));
+
+    other = config;
+    other.rules.push_back(ConfigRule{.patterns = {"**/*.h"}});
+    EXPECT_FALSE(config.same_rules(other));
+}
+
 };  // TEST_SUITE(Config)
 
 }  // namespace clice::testing
@@ -0,0 +1,124 @@
+#include <format>
+#include <string>
+#include <vector>
+
+#include "test/temp_dir.h"
+#include "test/test.h"
+#include "server/workspace/workspace.h"
+
+namespace clice::testing {
+namespace {
+
+TEST_SUITE(DepsSnapshot) {
+
+/// Create `count` small headers and return their paths.
+std::vector<std::string> make_deps(TempDir& tmp, int count) {
+    std::vector<std::string> deps;
+    for(int i = 0; i < count; ++i) {
+        auto name = std::format("dep{}.h", i);
+        tmp.touch(name, std::format("int dep{};\n", i));
+        deps.push_back(tmp.path(name));
+    }
+    return deps;
+}
+
+TEST_CASE(Unchanged) {
+    TempDir tmp;
+    PathPool pool;
+    auto deps = make_deps(tmp, 8);
+    auto snap = capture_deps_snapshot(pool, deps);
+    ASSERT_EQ(snap.hashes.size(), deps.size());
+    EXPECT_FALSE(deps_changed(pool, snap));
+}
+
+TEST_CASE(TouchedButSameContent) {
+    TempDir tmp;
+    PathPool pool;
+    auto deps = make_deps(tmp, 200);
+    auto snap = capture_deps_snapshot(pool, deps);
+
+    // Pretend the build is older than every file: each one gets re-hashed,
+    // in parallel since the list is long.
+    snap.build_at -= 10;
+    EXPECT_FALSE(deps_changed(pool, snap));
+}
+
+TEST_CASE(ContentChanged) {
+    TempDir tmp;
+    PathPool pool;
+    auto deps = make_deps(tmp, 200);
+    auto snap = capture_deps_snapshot(pool, deps);
+
+    tmp.touch("dep150.h", "int changed;\n");
+    snap.build_at -= 10;
+    EXPECT_TRUE(deps_changed(pool, snap));
+}
+
+TEST_CASE(FileRemoved) {
+    TempDir tmp;
+    PathPool pool;
+    auto deps = make_deps(tmp, 4);
+    auto snap = capture_deps_snapshot(pool, deps);
+
+    llvm::sys::fs::remove(deps[2]);
+    EXPECT_TRUE(deps_changed(pool, snap));
+}
+
+#ifdef __linux__
+
+TEST_CASE(WatchedFastPath) {
+    TempDir tmp;
+    Workspace workspace;
+    auto watcher = FileWatcher::create();
+    ASSERT_TRUE(watcher.has_value());
+    workspace.watcher.emplace(std::move(*watcher));
+    workspace.fs_epoch = 1;
+
+    auto deps = make_deps(tmp, 4);
+    auto snap = workspace.snapshot_deps(deps, workspace.fs_epoch);
+    EXPECT_EQ(snap.epoch, 1u);
+    EXPECT_TRUE(workspace.watcher->watches(tmp.root.str()));
+
+    // No event since the snapshot: fresh without looking at the files.
+    llvm::sys::fs::remove(deps[1]);
+    EXPECT_FALSE(workspace.deps_stale(snap));
+
+    // Once the epoch moves, the real check runs.
+    workspace.fs_epoch += 1;
+    EXPECT_TRUE(workspace.deps_stale(snap));
+}
+
+TEST_CASE(WatchedCheckAdvancesEpoch) {
+    TempDir tmp;
+    Workspace workspace;
+    auto watcher = FileWatcher::create();
+    ASSERT_TRUE(watcher.has_value());
+    workspace.watcher.emplace(std::move(*watcher));
+    workspace.fs_epoch = 1;
+
+    auto deps = make_deps(tmp, 4);
+    auto snap = workspace.snapshot_deps(deps, workspace.fs_epoch);
+
+    // Another tracked file changed: the check passes and catches up.
+    workspace.fs_epoch += 1;
+    EXPECT_FALSE(workspace.deps_stale(snap));
+    EXPECT_EQ(snap.epoch, 2u);
+}
+
+#endif
+
+TEST_CASE(UnwatchedKeepsStatCheck) {
+    TempDir tmp;
+    Workspace workspace;
+    auto deps = make_deps(tmp, 4);
+    auto snap = workspace.snapshot_deps(deps, 1);
+    EXPECT_EQ(snap.epoch, 0u);
+
+    llvm::sys::fs::remove(deps[1]);
+    EXPECT_TRUE(workspace.deps_stale(snap));
+}
+
+};  // TEST_SUITE(DepsSnapshot)
+
+}  // namespace
+}  // namespace clice::testing
@@ -0,0 +1,103 @@
+#include "test/test.h"
+#include "server/worker/edit_map.h"
+
+namespace clice::testing {
+namespace {
+
+TEST_SUITE(EditMap) {
+
+TEST_CASE(Empty) {
+    EditMap edits;
+    EXPECT_TRUE(edits.empty());
+    EXPECT_EQ(edits.to_new(7).value_or(-1u), 7u);
+    EXPECT_EQ(edits.to_old(7).value_or(-1u), 7u);
+}
+
+TEST_CASE(Insertion) {
+    // "int x;" -> "int long x;": 5 bytes inserted at offset 4.
+    EditMap edits;
+    edits.push(4, 0, 5, 2);
+
+    EXPECT_EQ(edits.to_new(2).value_or(-1u), 2u);
+    EXPECT_EQ(edits.to_new(4).value_or(-1u), 4u);
+    EXPECT_EQ(edits.to_new(5).value_or(-1u), 10u);
+
+    EXPECT_EQ(edits.to_old(10).value_or(-1u), 5u);
+    EXPECT_FALSE(edits.to_old(6).has_value());
+}
+
+TEST_CASE(Replacement) {
+    // 3 bytes at offset 10 replaced by 1.
+    EditMap edits;
+    edits.push(10, 3, 1, 2);
+
+    EXPECT_FALSE(edits.to_new(11).has_value());
+    EXPECT_EQ(edits.to_new(13).value_or(-1u), 11u);
+    EXPECT_EQ(edits.to_old(11).value_or(-1u), 13u);
+}
+
+TEST_CASE(Chain) {
+    EditMap edits;
+    edits.push(0, 0, 4, 2);
+    edits.push(10, 2, 0, 3);
+
+    // 8 -> 12 after the first edit, then 10 after the second.
+    EXPECT_EQ(edits.to_new(8).value_or(-1u), 10u);
+    EXPECT_EQ(edits.to_new(9).value_or(-1u), 11u);
+    EXPECT_EQ(edits.to_old(11).value_or(-1u), 9u);
+    EXPECT_FALSE(edits.to_old(2).has_value());
+}
+
+TEST_CASE(Exact) {
+    EditMap edits;
+    edits.push(6, 0, 1, 2);
+
+    // Insertions before or right after a token only shift it.
+    auto shifted = edits.to_new_exact(8, 10);
+    ASSERT_TRUE(shifted.has_value());
+    EXPECT_EQ(shifted->first, 9u);
+    EXPECT_EQ(shifted->second, 11u);
+
+    auto kept = edits.to_new_exact(4, 6);
+    ASSERT_TRUE(kept.has_value());
+    EXPECT_EQ(kept->first, 4u);
+    EXPECT_EQ(kept->second, 6u);
+
+    // An insertion inside the token drops it.
+    EXPECT_FALSE(edits.to_new_exact(5, 7).has_value());
+}
+
+TEST_CASE(DropThrough) {
+    EditMap edits;
+    edits.push(0, 0, 4, 2);
+    edits.push(0, 0, 4, 3);
+
+    edits.drop_through(2);
+    EXPECT_FALSE(edits.empty());
+    EXPECT_EQ(edits.to_new(0).value_or(-1u), 0u);
+    EXPECT_EQ(edits.to_new(1).value_or(-1u), 5u);
+
+    edits.drop_through(3);
+    EXPECT_TRUE(edits.empty());
+}
+
+TEST_CASE(Touched) {
+    EditMap edits;
+    edits.push(10, 2, 5, 1);
+    edits.push(0, 0, 3, 2);
+    // Deletes the end of the first replacement and what follows it.
+    edits.push(17, 4, 0, 3);
+
+    auto touched = edits.touched();
+    ASSERT_EQ(touched.size(), 2u);
+    EXPECT_TRUE(touched[0] == std::pair<std::uint32_t, std::uint32_t>(0, 3));
+    EXPECT_TRUE(touched[1] == std::pair<std::uint32_t, std::uint32_t>(13, 17));
+
+    edits.clear();
+    EXPECT_TRUE(edits.touched().empty());
+}
+
+};  // TEST_SUITE(EditMap)
+
+}  // namespace
+}  // namespace clice::testing
@@ -0,0 +1,91 @@
+#include "test/test.h"
+#include "server/worker/file_changes.h"
+
+namespace clice::testing {
+namespace {
+
+using Paths = std::vector<std::string>;
+
+TEST_SUITE(FileChangeLog) {
+
+TEST_CASE(Unstarted) {
+    FileChangeLog log;
+    log.record("/src/a.h");
+    EXPECT_EQ(log.epoch(), 0u);
+
+    Paths changed;
+    EXPECT_FALSE(log.changes_since(0, changed));
+}
+
+TEST_CASE(ChangesSince) {
+    FileChangeLog log;
+    log.start();
+    auto first = log.epoch();
+    EXPECT_NE(first, 0u);
+
+    log.record("/src/a.h");
+    auto second = log.epoch();
+    log.record("/src/b.h");
+
+    Paths changed;
+    EXPECT_TRUE(log.changes_since(first, changed));
+    EXPECT_EQ(changed, (Paths{"/src/a.h", "/src/b.h"}));
+
+    changed.clear();
+    EXPECT_TRUE(log.changes_since(second, changed));
+    EXPECT_EQ(changed, Paths{"/src/b.h"});
+
+    // Up to date: nothing to drop.
+    changed.clear();
+    EXPECT_TRUE(log.changes_since(log.epoch(), changed));
+    EXPECT_TRUE(changed.empty());
+
+    // A new process has seen no epoch.
+    EXPECT_FALSE(log.changes_since(0, changed));
+}
+
+TEST_CASE(Lost) {
+    FileChangeLog log;
+    log.start();
+    auto first = log.epoch();
+    log.record("/src/a.h");
+    log.reset();
+    auto after = log.epoch();
+    EXPECT_GT(after, first);
+
+    Paths changed;
+    EXPECT_FALSE(log.changes_since(first, changed));
+    EXPECT_TRUE(log.changes_since(after, changed));
+    EXPECT_TRUE(changed.empty());
+}
+
+TEST_CASE(Bounded) {
+    FileChangeLog log;
+    log.start();
+    auto first = log.epoch();
+    for(std::size_t i = 0; i <= FileChangeLog::max_entries; ++i) {
+        log.record("/src/" + std::to_string(i) + ".h");
+    }
+
+    // The oldest change is forgotten, so are the epochs before it.
+    Paths changed;
+    EXPECT_FALSE(log.changes_since(first, changed));
+    EXPECT_TRUE(log.changes_since(first + 1, changed));
+    EXPECT_EQ(changed.size(), FileChangeLog::max_entries);
+}
+
+TEST_CASE(Stopped) {
+    FileChangeLog log;
+    log.start();
+    log.stop();
+    EXPECT_EQ(log.epoch(), 0u);
+
+    // Not restarted by a later start.
+    log.start();
+    EXPECT_EQ(log.epoch(), 0u);
+}
+
+};  // TEST_SUITE(FileChangeLog)
+
+}  // namespace
+}  // namespace clice::testing
@@ -0,0 +1,46 @@
+#include "test/test.h"
+#include "server/worker/path_map.h"
+
+namespace clice::testing {
+namespace {
+
+TEST_SUITE(PathMap) {
+
+TEST_CASE(Prefixes) {
+    auto map = PathMap::parse({
+        "/home/me/src=/sandbox/src",
+        "/home/me/src/third_party=/deps/",
+        "x",
+    });
+    ASSERT_EQ(map.entries().size(), 2U);
+
+    EXPECT_EQ(map.map("/home/me/src/main.cpp"), "/sandbox/src/main.cpp");
+    EXPECT_EQ(map.map("/home/me/src"), "/sandbox/src");
+    // The longest prefix wins, and prefixes match whole components.
+    EXPECT_EQ(map.map("/home/me/src/third_party/a.h"), "/deps/a.h");
+    EXPECT_EQ(map.map("/home/me/srcs/a.h"), "/home/me/srcs/a.h");
+    EXPECT_EQ(map.map("/usr/include/stdio.h"), "/usr/include/stdio.h");
+
+    auto back = map.reversed();
+    EXPECT_EQ(back.map("/sandbox/src/main.cpp"), "/home/me/src/main.cpp");
+    EXPECT_EQ(back.map("/deps/a.h"), "/home/me/src/third_party/a.h");
+}
+
+TEST_CASE(Arguments) {
+    PathMap map;
+    map.add("/home/me/src", "/sandbox/src");
+
+    EXPECT_EQ(map.map_argument("/home/me/src/main.cpp"), "/sandbox/src/main.cpp");
+    EXPECT_EQ(map.map_argument("-I/home/me/src/include"), "-I/sandbox/src/include");
+    EXPECT_EQ(map.map_argument("--sysroot=/home/me/src/root"), "--sysroot=/sandbox/src/root");
+    EXPECT_EQ(map.map_argument("-fmodule-file=m=/home/me/src/m.pcm"),
+              "-fmodule-file=m=/sandbox/src/m.pcm");
+    EXPECT_EQ(map.map_argument("-std=c++20"), "-std=c++20");
+    EXPECT_EQ(map.map_argument("-O2"), "-O2");
+    EXPECT_EQ(map.map_argument("-I/usr/include"), "-I/usr/include");
+}
+
+};  // TEST_SUITE(PathMap)
+
+}  // namespace
+}  // namespace clice::testing
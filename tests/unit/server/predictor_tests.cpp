@@ -0,0 +1,53 @@
+#include "test/test.h"
+#include "server/service/predictor.h"
+
+namespace clice::testing {
+namespace {
+
+TEST_SUITE(NextFilePredictor) {
+
+TEST_CASE(Signals) {
+    NextFilePredictor predictor;
+    // 1 -> 2 twice, 1 -> 3 once.
+    for(auto id: {1u, 2u, 1u, 3u, 1u, 2u})
+        predictor.record_open(id);
+
+    std::vector<std::uint32_t> history = {2, 3};
+    EXPECT_EQ(predictor.rank(1, {}, {}, 5), history);
+
+    // The definition under the cursor beats a file reached once; the
+    // includes come last, and the current file never.
+    std::vector<std::uint32_t> definitions = {3};
+    std::vector<std::uint32_t> includes = {1, 4};
+    std::vector<std::uint32_t> ranked = {3, 2, 4};
+    EXPECT_EQ(predictor.rank(1, definitions, includes, 5), ranked);
+    EXPECT_EQ(predictor.rank(1, definitions, includes, 1).size(), 1U);
+
+    auto open = [](std::uint32_t id) { return id == 3; };
+    std::vector<std::uint32_t> closed = {2, 4};
+    EXPECT_EQ(predictor.rank(1, definitions, includes, 5, open), closed);
+
+    EXPECT_TRUE(predictor.rank(7, {}, {}, 5).empty());
+}
+
+TEST_CASE(BoundedHistory) {
+    NextFilePredictor predictor;
+    // Ten files follow 0, the first one twice; the rarest make room.
+    for(std::uint32_t id = 1; id <= 10; ++id) {
+        predictor.record_open(0);
+        predictor.record_open(id);
+        if(id == 1) {
+            predictor.record_open(0);
+            predictor.record_open(1);
+        }
+    }
+    auto ranked = predictor.rank(0, {}, {}, 20);
+    EXPECT_EQ(ranked.size(), 8U);
+    EXPECT_EQ(ranked.front(), 1U);
+    EXPECT_EQ(ranked.back(), 10U);
+}
+
+};  // TEST_SUITE(NextFilePredictor)
+
+}  // namespace
+}  // namespace clice::testing
@@ -0,0 +1,76 @@
+#include "test/test.h"
+#include "server/compiler/indexer.h"
+#include "server/service/session.h"
+
+namespace clice::testing {
+namespace {
+
+namespace lsp = kota::ipc::lsp;
+
+TEST_SUITE(Session) {
+
+TEST_CASE(EditLineStarts) {
+    Session session;
+    session.set_text("int a;\nint b;\nint c;\n");
+
+    auto check = [&](llvm::StringRef expected) {
+        EXPECT_EQ(session.text, expected.str());
+        EXPECT_EQ(session.line_starts, lsp::build_line_starts(session.text));
+    };
+
+    // Typing within a line.
+    session.edit(4, 1, "alpha");
+    check("int alpha;\nint b;\nint c;\n");
+
+    // Splitting a line.
+    session.edit(10, 0, "\nint x;");
+    check("int alpha;\nint x;\nint b;\nint c;\n");
+
+    // Joining lines, across several newlines.
+    session.edit(9, 15, " = 0;");
+    check("int alpha = 0;\nint c;\n");
+
+    // Deleting everything before the end.
+    session.edit(0, 15, "");
+    check("int c;\n");
+
+    session.edit(7, 0, "a\nb\n");
+    check("int c;\na\nb\n");
+}
+
+TEST_CASE(OverlayEdits) {
+    Session session;
+    session.set_text("int foo() { return 0; }\nint x = foo();\n");
+    session.file_index.emplace();
+    EXPECT_TRUE(session.index_edits.empty());
+
+    index::Relation definition{.kind = RelationKind::Definition, .range = {4, 7}};
+    definition.set_definition_range({0, 23});
+    index::Relation reference{.kind = RelationKind::Reference, .range = {32, 35}};
+
+    // Typing in the body moves the reference and stretches the definition.
+    session.edit(19, 1, "42");
+    auto moved = Indexer::move_overlay(session, definition);
+    ASSERT_TRUE(moved.has_value());
+    EXPECT_EQ(moved->range.begin, 4U);
+    EXPECT_EQ(moved->definition_range().end, 24U);
+    moved = Indexer::move_overlay(session, reference);
+    ASSERT_TRUE(moved.has_value());
+    EXPECT_EQ(moved->range.begin, 33U);
+    EXPECT_EQ(session.text.substr(moved->range.begin, 3), "foo");
+
+    // Editing the name drops it.
+    session.edit(5, 1, "x");
+    EXPECT_FALSE(Indexer::move_overlay(session, definition).has_value());
+    EXPECT_TRUE(Indexer::move_overlay(session, reference).has_value());
+
+    session.index_edits.clear();
+    moved = Indexer::move_overlay(session, reference);
+    ASSERT_TRUE(moved.has_value());
+    EXPECT_EQ(moved->range.begin, 32U);
+}
+
+};  // TEST_SUITE(Session)
+
+}  // namespace
+}  // namespace clice::testing
@@ -11,6 +11,8 @@ namespace clice::testing {
 
 namespace {
 
+namespace protocol = kota::ipc::protocol;
+
 TEST_SUITE(StatefulWorker) {
 
 TEST_CASE(SpawnAndExit) {
@@ -271,20 +273,28 @@ TEST_CASE(DocumentSymbolWithoutCompile) {
     ASSERT_TRUE(test_done);
 }
 
-TEST_CASE(DocumentLinkWithoutCompile) {
+TEST_CASE(CompileReportsLinks) {
+    TempDir tmp;
+    tmp.touch("links_header.h", "int answer();\n");
+    tmp.touch("links_test.cpp", "#include \"links_header.h\"\nint main() { return answer(); }\n");
+    auto src = tmp.path("links_test.cpp");
+
     WorkerHandle w;
     ASSERT_TRUE(w.spawn(4ULL * 1024 * 1024 * 1024));
 
     bool test_done = false;
 
     w.run([&]() -> kota::task<> {
-        worker::QueryParams params;
-        params.kind = worker::QueryKind::DocumentLink;
-        params.path = "/tmp/nonexistent.cpp";
+        worker::CompileParams params;
+        params.path = src;
+        params.version = 1;
+        params.text = "#include \"links_header.h\"\nint main() { return answer(); }\n";
+        params.directory = "/tmp";
+        params.arguments = make_args(src);
 
         auto result = co_await w.peer->send_request(params);
         CO_ASSERT_TRUE(result.has_value());
-        EXPECT_EQ(result.value().data, std::string("null"));
+        EXPECT_NE(result.value().links.data.find("links_header.h"), std::string::npos);
         test_done = true;
         w.peer->close_output();
     });
@@ -384,6 +394,166 @@ TEST_CASE(MultipleSequentialRequests) {
     ASSERT_TRUE(test_done);
 }
 
+TEST_CASE(QueryBatch) {
+    TempDir tmp;
+    tmp.touch("batch_test.cpp", "int foo() {\n    return 1;\n}\n");
+    auto src = tmp.path("batch_test.cpp");
+
+    WorkerHandle w;
+    ASSERT_TRUE(w.spawn(4ULL * 1024 * 1024 * 1024));
+
+    bool test_done = false;
+
+    w.run([&]() -> kota::task<> {
+        worker::CompileParams cp;
+        cp.path = src;
+        cp.version = 1;
+        cp.text = "int foo() {\n    return 1;\n}\n";
+        cp.directory = "/tmp";
+        cp.arguments = make_args(src);
+        CO_ASSERT_TRUE((co_await w.peer->send_request(cp)).has_value());
+
+        worker::QueryBatchParams bp;
+        bp.path = src;
+        for(auto kind: {worker::QueryKind::SemanticTokens,
+                        worker::QueryKind::FoldingRange,
+                        worker::QueryKind::DocumentSymbol}) {
+            auto& query = bp.queries.emplace_back();
+            query.kind = kind;
+            query.path = src;
+        }
+        auto batch = co_await w.peer->send_request(bp);
+        CO_ASSERT_TRUE(batch.has_value());
+        CO_ASSERT_TRUE(batch.value().size() == 3u);
+
+        // Each answer is the one its query gets on its own.
+        for(std::size_t i = 0; i < bp.queries.size(); ++i) {
+            auto single = co_await w.peer->send_request(bp.queries[i]);
+            CO_ASSERT_TRUE(single.has_value());
+            EXPECT_NE(batch.value()[i].data, std::string("null"));
+            if(i != 0) {
+                EXPECT_EQ(batch.value()[i].data, single.value().data);
+            }
+        }
+
+        test_done = true;
+        w.peer->close_output();
+    });
+
+    ASSERT_TRUE(test_done);
+}
+
+TEST_CASE(SemanticTokensDelta) {
+    TempDir tmp;
+    tmp.touch("delta_test.cpp", "int foo = 1;\n");
+    auto src = tmp.path("delta_test.cpp");
+
+    WorkerHandle w;
+    ASSERT_TRUE(w.spawn(4ULL * 1024 * 1024 * 1024));
+
+    bool test_done = false;
+
+    w.run([&]() -> kota::task<> {
+        worker::CompileParams cp;
+        cp.path = src;
+        cp.version = 1;
+        cp.text = "int foo = 1;\n";
+        cp.directory = "/tmp";
+        cp.arguments = make_args(src);
+        CO_ASSERT_TRUE((co_await w.peer->send_request(cp)).has_value());
+
+        worker::QueryParams tp;
+        tp.kind = worker::QueryKind::SemanticTokens;
+        tp.path = src;
+        auto full = co_await w.peer->send_request(tp);
+        CO_ASSERT_TRUE(full.has_value());
+        protocol::SemanticTokens tokens;
+        CO_ASSERT_TRUE(kota::codec::json::parse(full.value().data, tokens).has_value());
+        CO_ASSERT_TRUE(tokens.result_id.has_value());
+        EXPECT_FALSE(tokens.data.empty());
+
+        // Nothing changed: no edits, and the same result stands.
+        tp.previous_result_id = *tokens.result_id;
+        auto same = co_await w.peer->send_request(tp);
+        CO_ASSERT_TRUE(same.has_value());
+        protocol::SemanticTokensDelta delta;
+        CO_ASSERT_TRUE(kota::codec::json::parse(same.value().data, delta).has_value());
+        EXPECT_EQ(delta.result_id, tokens.result_id);
+        EXPECT_TRUE(delta.edits.empty());
+
+        // A token added at the end is one edit past the old tokens.
+        cp.version = 2;
+        cp.text = "int foo = 1;\nint bar = 2;\n";
+        CO_ASSERT_TRUE((co_await w.peer->send_request(cp)).has_value());
+        auto changed = co_await w.peer->send_request(tp);
+        CO_ASSERT_TRUE(changed.has_value());
+        CO_ASSERT_TRUE(kota::codec::json::parse(changed.value().data, delta).has_value());
+        EXPECT_NE(delta.result_id, tokens.result_id);
+        CO_ASSERT_TRUE(delta.edits.size() == 1u);
+        EXPECT_EQ(delta.edits[0].start, tokens.data.size());
+        EXPECT_EQ(delta.edits[0].delete_count, 0u);
+
+        // An id the worker no longer holds gets the tokens in full.
+        auto again = co_await w.peer->send_request(tp);
+        CO_ASSERT_TRUE(again.has_value());
+        tokens = {};
+        CO_ASSERT_TRUE(kota::codec::json::parse(again.value().data, tokens).has_value());
+        EXPECT_EQ(tokens.result_id, delta.result_id);
+        EXPECT_FALSE(tokens.data.empty());
+
+        test_done = true;
+        w.peer->close_output();
+    });
+
+    ASSERT_TRUE(test_done);
+}
+
+TEST_CASE(PrecomputeFeatures) {
+    TempDir tmp;
+    tmp.touch("precompute_test.cpp", "namespace n {\nint foo() {\n    return 1;\n}\n}\n");
+    auto src = tmp.path("precompute_test.cpp");
+
+    WorkerHandle w;
+    ASSERT_TRUE(w.spawn(4ULL * 1024 * 1024 * 1024));
+
+    bool test_done = false;
+
+    w.run([&]() -> kota::task<> {
+        worker::CompileParams cp;
+        cp.path = src;
+        cp.version = 1;
+        cp.text = "namespace n {\nint foo() {\n    return 1;\n}\n}\n";
+        cp.directory = "/tmp";
+        cp.arguments = make_args(src);
+        cp.precompute_features = true;
+        CO_ASSERT_TRUE((co_await w.peer->send_request(cp)).has_value());
+
+        // Whether or not the precomputation has finished, the answers are
+        // those of the AST.
+        worker::QueryParams qp;
+        qp.path = src;
+        qp.kind = worker::QueryKind::DocumentSymbol;
+        auto symbols = co_await w.peer->send_request(qp);
+        CO_ASSERT_TRUE(symbols.has_value());
+        EXPECT_NE(symbols.value().data.find("foo"), std::string::npos);
+
+        qp.kind = worker::QueryKind::FoldingRange;
+        auto folding = co_await w.peer->send_request(qp);
+        CO_ASSERT_TRUE(folding.has_value());
+        EXPECT_NE(folding.value().data, std::string("[]"));
+
+        qp.kind = worker::QueryKind::SemanticTokens;
+        auto tokens = co_await w.peer->send_request(qp);
+        CO_ASSERT_TRUE(tokens.has_value());
+        EXPECT_NE(tokens.value().data, std::string("null"));
+
+        test_done = true;
+        w.peer->close_output();
+    });
+
+    ASSERT_TRUE(test_done);
+}
+
 TEST_CASE(MultipleDocuments) {
     TempDir tmp;
     std::vector<std::string> paths;
@@ -501,6 +671,278 @@ TEST_CASE(SpawnWithMemoryLimit) {
     ASSERT_TRUE(test_done);
 }
 
+TEST_CASE(CompileReportsMemoryUsage) {
+    TempDir tmp;
+    tmp.touch("memory_usage.cpp", "struct S { int x; };\nint main() { return S{}.x; }\n");
+    auto src = tmp.path("memory_usage.cpp");
+
+    WorkerHandle w;
+    ASSERT_TRUE(w.spawn(4ULL * 1024 * 1024 * 1024));
+
+    bool test_done = false;
+
+    w.run([&]() -> kota::task<> {
+        worker::CompileParams cp;
+        cp.path = src;
+        cp.version = 1;
+        cp.text = "struct S { int x; };\nint main() { return S{}.x; }\n";
+        cp.directory = "/tmp";
+        cp.arguments = make_args(src);
+
+        auto result = co_await w.peer->send_request(cp);
+        CO_ASSERT_TRUE(result.has_value());
+        EXPECT_GT(result.value().memory_usage, 0u);
+
+        test_done = true;
+        w.peer->close_output();
+    });
+
+    ASSERT_TRUE(test_done);
+}
+
+TEST_CASE(EvictOverMemoryLimit) {
+    TempDir tmp;
+    tmp.touch("evict_a.cpp", "int evict_a = 1;\n");
+    tmp.touch("evict_b.cpp", "int evict_b = 2;\n");
+    auto a = tmp.path("evict_a.cpp");
+    auto b = tmp.path("evict_b.cpp");
+
+    WorkerHandle w;
+    // Any real AST exceeds a 1-byte budget, so only the latest document survives.
+    ASSERT_TRUE(w.spawn(1));
+
+    std::vector<std::string> evicted;
+    w.peer->on_notification(
+        [&](const worker::EvictedParams& params) { evicted.push_back(params.path); });
+
+    bool test_done = false;
+
+    w.run([&]() -> kota::task<> {
+        worker::CompileParams cp;
+        cp.path = a;
+        cp.version = 1;
+        cp.text = "int evict_a = 1;\n";
+        cp.directory = "/tmp";
+        cp.arguments = make_args(a);
+        auto r1 = co_await w.peer->send_request(cp);
+        CO_ASSERT_TRUE(r1.has_value());
+
+        // The document just compiled is never evicted.
+        EXPECT_TRUE(evicted.empty());
+
+        cp.path = b;
+        cp.text = "int evict_b = 2;\n";
+        cp.arguments = make_args(b);
+        auto r2 = co_await w.peer->send_request(cp);
+        CO_ASSERT_TRUE(r2.has_value());
+
+        CO_ASSERT_TRUE(evicted.size() == 1);
+        EXPECT_EQ(evicted[0], a);
+
+        // The evicted document no longer has an AST.
+        worker::QueryParams hp;
+        hp.kind = worker::QueryKind::Hover;
+        hp.path = a;
+        hp.offset = 4;
+        auto h1 = co_await w.peer->send_request(hp);
+        CO_ASSERT_TRUE(h1.has_value());
+        EXPECT_EQ(h1.value().data, std::string("null"));
+
+        hp.path = b;
+        auto h2 = co_await w.peer->send_request(hp);
+        CO_ASSERT_TRUE(h2.has_value());
+        EXPECT_NE(h2.value().data, std::string("null"));
+
+        test_done = true;
+        w.peer->close_output();
+    });
+
+    ASSERT_TRUE(test_done);
+}
+
+TEST_CASE(SyncedCompileAppliesEdits) {
+    TempDir tmp;
+    tmp.touch("synced.cpp", "int sync_a = 1;\n");
+    auto src = tmp.path("synced.cpp");
+
+    WorkerHandle w;
+    ASSERT_TRUE(w.spawn(4ULL * 1024 * 1024 * 1024));
+
+    bool test_done = false;
+
+    w.run([&]() -> kota::task<> {
+        worker::CompileParams cp;
+        cp.path = src;
+        cp.version = 1;
+        cp.text = "int sync_a = 1;\n";
+        cp.directory = "/tmp";
+        cp.arguments = make_args(src);
+        auto r1 = co_await w.peer->send_request(cp);
+        CO_ASSERT_TRUE(r1.has_value());
+
+        // Rename sync_a -> sync_b through an edit against version 1.
+        worker::DocumentUpdateParams up;
+        up.path = src;
+        up.version = 2;
+        up.base_version = 1;
+        up.edits.push_back({4, 6, "sync_b"});
+        w.peer->send_notification(up);
+
+        cp.version = 2;
+        cp.text.clear();
+        cp.synced = true;
+        auto r2 = co_await w.peer->send_request(cp);
+        CO_ASSERT_TRUE(r2.has_value());
+        EXPECT_FALSE(r2.value().out_of_sync);
+
+        worker::QueryParams hp;
+        hp.kind = worker::QueryKind::Hover;
+        hp.path = src;
+        hp.offset = 4;
+        auto h = co_await w.peer->send_request(hp);
+        CO_ASSERT_TRUE(h.has_value());
+        EXPECT_NE(h.value().data.find("sync_b"), std::string::npos);
+
+        // An update without edits drops the worker's copy.
+        up.version = 3;
+        up.base_version = 2;
+        up.edits.clear();
+        w.peer->send_notification(up);
+
+        cp.version = 3;
+        auto r3 = co_await w.peer->send_request(cp);
+        CO_ASSERT_TRUE(r3.has_value());
+        EXPECT_TRUE(r3.value().out_of_sync);
+
+        test_done = true;
+        w.peer->close_output();
+    });
+
+    ASSERT_TRUE(test_done);
+}
+
+TEST_CASE(FreshDepsSkipSnapshot) {
+    TempDir tmp;
+    tmp.touch("fresh_a.h", "int fresh_a();\n");
+    tmp.touch("fresh_b.h", "int fresh_b();\n");
+    tmp.touch("fresh.cpp", "#include \"fresh_a.h\"\nint x = 1;\n");
+    auto src = tmp.path("fresh.cpp");
+
+    WorkerHandle w;
+    ASSERT_TRUE(w.spawn(4ULL * 1024 * 1024 * 1024));
+
+    bool test_done = false;
+
+    w.run([&]() -> kota::task<> {
+        worker::CompileParams cp;
+        cp.path = src;
+        cp.version = 1;
+        cp.text = "#include \"fresh_a.h\"\nint x = 1;\n";
+        cp.directory = tmp.root.str().str();
+        cp.arguments = make_args(src);
+        auto r1 = co_await w.peer->send_request(cp);
+        CO_ASSERT_TRUE(r1.has_value());
+        EXPECT_FALSE(r1.value().deps_unchanged);
+        EXPECT_FALSE(r1.value().deps.empty());
+
+        // A body edit with nothing changed on disk keeps the snapshot.
+        cp.version = 2;
+        cp.text = "#include \"fresh_a.h\"\nint x = 2;\n";
+        cp.deps_fresh = true;
+        auto r2 = co_await w.peer->send_request(cp);
+        CO_ASSERT_TRUE(r2.has_value());
+        EXPECT_TRUE(r2.value().deps_unchanged);
+        EXPECT_TRUE(r2.value().deps.empty());
+
+        // A new include changes the dependency list.
+        cp.version = 3;
+        cp.text = "#include \"fresh_a.h\"\n#include \"fresh_b.h\"\nint x = 2;\n";
+        auto r3 = co_await w.peer->send_request(cp);
+        CO_ASSERT_TRUE(r3.has_value());
+        EXPECT_FALSE(r3.value().deps_unchanged);
+
+        // Without the master's word the cache is dropped.
+        cp.version = 4;
+        cp.deps_fresh = false;
+        auto r4 = co_await w.peer->send_request(cp);
+        CO_ASSERT_TRUE(r4.has_value());
+        EXPECT_FALSE(r4.value().deps_unchanged);
+        EXPECT_FALSE(r4.value().deps.empty());
+
+        test_done = true;
+        w.peer->close_output();
+    });
+
+    ASSERT_TRUE(test_done);
+}
+
+TEST_CASE(StaleQueryMapsEdits) {
+    std::string text = "int foo() { return 42; }\nint main() { return foo(); }\n";
+    TempDir tmp;
+    tmp.touch("stale.cpp", text);
+    auto src = tmp.path("stale.cpp");
+
+    WorkerHandle w;
+    ASSERT_TRUE(w.spawn(4ULL * 1024 * 1024 * 1024));
+
+    bool test_done = false;
+
+    w.run([&]() -> kota::task<> {
+        worker::CompileParams cp;
+        cp.path = src;
+        cp.version = 1;
+        cp.text = text;
+        cp.directory = "/tmp";
+        cp.arguments = make_args(src);
+        auto r1 = co_await w.peer->send_request(cp);
+        CO_ASSERT_TRUE(r1.has_value());
+
+        // Insert a line on top; no recompile follows.
+        worker::DocumentUpdateParams up;
+        up.path = src;
+        up.version = 2;
+        up.base_version = 1;
+        up.edits.push_back({0, 0, "int pad;\n"});
+        w.peer->send_notification(up);
+
+        // 'foo' in 'return foo();' moved from offset 47 to 56.
+        worker::QueryParams hp;
+        hp.kind = worker::QueryKind::Hover;
+        hp.path = src;
+        hp.stale = true;
+        hp.version = 2;
+        hp.offset = 56;
+        auto h = co_await w.peer->send_request(hp);
+        CO_ASSERT_TRUE(h.has_value());
+        EXPECT_NE(h.value().data.find("foo"), std::string::npos);
+
+        // Inside the inserted text there is nothing to map back to.
+        hp.offset = 4;
+        auto inside = co_await w.peer->send_request(hp);
+        EXPECT_FALSE(inside.has_value());
+
+        // The worker's text is not at the requested version.
+        hp.offset = 56;
+        hp.version = 3;
+        auto ahead = co_await w.peer->send_request(hp);
+        EXPECT_FALSE(ahead.has_value());
+
+        worker::QueryParams tp;
+        tp.kind = worker::QueryKind::SemanticTokens;
+        tp.path = src;
+        tp.stale = true;
+        tp.version = 2;
+        auto tokens = co_await w.peer->send_request(tp);
+        CO_ASSERT_TRUE(tokens.has_value());
+        EXPECT_NE(tokens.value().data, std::string("null"));
+
+        test_done = true;
+        w.peer->close_output();
+    });
+
+    ASSERT_TRUE(test_done);
+}
+
 };  // TEST_SUITE(StatefulWorker)
 
 }  // namespace
@@ -278,6 +278,47 @@ TEST_CASE(MultipleStatelessRequests) {
     ASSERT_TRUE(test_done);
 }
 
+TEST_CASE(UsageRequest) {
+    TempDir tmp;
+    tmp.touch("usage.cpp", "int usage_var = 1;\n");
+    auto path = tmp.path("usage.cpp");
+
+    WorkerHandle w;
+    ASSERT_TRUE(w.spawn());
+
+    bool test_done = false;
+
+    w.run([&]() -> kota::task<> {
+        for(int i = 0; i < 2; i++) {
+            worker::BuildParams params;
+            params.kind = worker::BuildKind::Index;
+            params.file = path;
+            params.directory = "/tmp";
+            params.arguments = make_args(path);
+            auto result = co_await w.peer->send_request(params);
+            EXPECT_TRUE(result.has_value());
+        }
+
+        auto usage = co_await w.peer->send_request(worker::UsageParams{});
+        ASSERT_TRUE(usage.has_value());
+        ASSERT_EQ(usage.value().size(), 1U);
+        auto& entry = usage.value()[0];
+        EXPECT_EQ(entry.kind, "Index");
+        EXPECT_EQ(entry.requests, 2U);
+        EXPECT_TRUE(entry.cpu_us > 0);
+
+        // Reported figures are not reported again.
+        auto again = co_await w.peer->send_request(worker::UsageParams{});
+        ASSERT_TRUE(again.has_value());
+        EXPECT_TRUE(again.value().empty());
+
+        test_done = true;
+        w.peer->close_output();
+    });
+
+    ASSERT_TRUE(test_done);
+}
+
 };  // TEST_SUITE(StatelessWorkerExtended)
 
 }  // namespace
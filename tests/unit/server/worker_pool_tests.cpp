@@ -1,4 +1,5 @@
 #include "test/test.h"
+#include "server/protocol/extension.h"
 #include "server/protocol/worker.h"
 #include "server/worker/worker_pool.h"
 #include "server/worker_test_helpers.h"
@@ -37,6 +38,46 @@ struct WorkerPoolFixture {
         }
     }
 
+    void add_standby() {
+        auto idx = pool.stateless_workers.size();
+        pool.stateless_workers.push_back(WorkerPool::WorkerProcess{});
+        auto& w = pool.stateless_workers.back();
+        w.name = "SL-" + std::to_string(idx);
+        w.alive = true;
+        w.standby = true;
+    }
+
+    /// Scaling bounds; the standby is off so no real process is spawned.
+    void set_scaling(std::uint32_t min, std::uint32_t max) {
+        pool.options.min_stateless = min;
+        pool.options.max_stateless = max;
+        pool.options.warm_standby = false;
+    }
+
+    bool scale_up() {
+        return pool.scale_up_worker();
+    }
+
+    void retire_idle() {
+        pool.retire_idle_worker();
+    }
+
+    bool is_standby(std::size_t idx) const {
+        return pool.stateless_workers[idx].standby;
+    }
+
+    bool is_retiring(std::size_t idx) const {
+        return pool.stateless_workers[idx].retiring;
+    }
+
+    void record_request(std::size_t idx, bool stateful, bool ok) {
+        auto& workers = stateful ? pool.stateful_workers : pool.stateless_workers;
+        WorkerPool::record_request(workers[idx],
+                                   std::chrono::steady_clock::now() -
+                                       std::chrono::milliseconds(20),
+                                   ok);
+    }
+
     void add_stateful(bool alive = true, std::size_t owned = 0) {
         auto idx = pool.stateful_workers.size();
         pool.stateful_workers.push_back(WorkerPool::WorkerProcess{});
@@ -76,6 +117,116 @@ struct WorkerPoolFixture {
         pool.clear_owner(idx);
     }
 
+    void record_memory(std::uint32_t path_id, std::size_t idx, std::size_t bytes) {
+        pool.record_memory(path_id, idx, bytes);
+    }
+
+    void enable_migration(std::uint64_t memory_limit, std::vector<std::uint32_t>& migrated) {
+        pool.options.stateful_migration = true;
+        pool.options.worker_memory_limit = memory_limit;
+        pool.on_migrate = [&migrated](std::uint32_t path_id) {
+            migrated.push_back(path_id);
+        };
+    }
+
+    void rebalance() {
+        pool.rebalance_stateful();
+    }
+
+    std::size_t stateful_memory(std::size_t idx) const {
+        return pool.stateful_workers[idx].memory_usage;
+    }
+
+    static worker::BuildParams build(worker::BuildKind kind, std::string file) {
+        worker::BuildParams params;
+        params.kind = kind;
+        params.file = std::move(file);
+        return params;
+    }
+
+    void record_cost(worker::BuildKind kind, std::string file, double ms) {
+        pool.record_cost(build(kind, std::move(file)), ms);
+    }
+
+    double estimate_cost(worker::BuildKind kind, std::string file) const {
+        return pool.estimate_cost(build(kind, std::move(file)));
+    }
+
+    double estimate_batch_cost(const std::vector<std::string>& files) const {
+        auto params = build(worker::BuildKind::Index, files.front());
+        for(auto& file: files)
+            params.batch.push_back({.file = file});
+        return pool.estimate_cost(params);
+    }
+
+    /// Queue low-priority entries with the given costs, drop the `cancelled`
+    /// one if any, and dispatch onto the idle workers; returns which entries
+    /// were dispatched.
+    llvm::SmallVector<bool> test_low_order(const std::vector<double>& costs,
+                                           bool starved,
+                                           std::optional<std::size_t> cancelled = {}) {
+        llvm::SmallVector<std::unique_ptr<WorkerPool::PendingStateless>> pending;
+        auto now = std::chrono::steady_clock::now();
+        for(auto cost: costs) {
+            pending.push_back(
+                std::make_unique<WorkerPool::PendingStateless>(worker::Priority::Low));
+            pending.back()->cost_ms = cost;
+            pending.back()->enqueued_at = starved ? now - std::chrono::minutes(5) : now;
+            pool.push_low_pending(*pending.back());
+        }
+        if(cancelled)
+            pending[*cancelled].reset();
+        pool.try_dispatch_pending();
+        llvm::SmallVector<bool> dispatched;
+        for(auto& p: pending)
+            dispatched.push_back(p && p->ready.is_set());
+        return dispatched;
+    }
+
+    /// Queue low-priority builds, promote the `kind` builds of `file`, and
+    /// return which entries were dispatched and whether any was promoted.
+    std::pair<llvm::SmallVector<bool>, bool> test_promote(
+        const std::vector<worker::BuildParams>& builds,
+        worker::BuildKind kind,
+        llvm::StringRef file) {
+        llvm::SmallVector<std::unique_ptr<WorkerPool::PendingStateless>> pending;
+        for(auto& params: builds) {
+            pending.push_back(
+                std::make_unique<WorkerPool::PendingStateless>(worker::Priority::Low));
+            pending.back()->build = &params;
+            pending.back()->enqueued_at = std::chrono::steady_clock::now();
+            pool.push_low_pending(*pending.back());
+        }
+        bool promoted = pool.promote(kind, file);
+        llvm::SmallVector<bool> dispatched;
+        for(auto& p: pending)
+            dispatched.push_back(p->ready.is_set());
+        return {dispatched, promoted};
+    }
+
+    /// Mark stateless worker idx as running a preemptible Index job.
+    std::shared_ptr<kota::cancellation_source> run_index(std::size_t idx,
+                                                         double cost_ms,
+                                                         std::string file) {
+        auto& w = pool.stateless_workers[idx];
+        w.preemptible = true;
+        w.current_cost_ms = cost_ms;
+        w.current_file = std::move(file);
+        w.started_at = std::chrono::steady_clock::now();
+        auto src = std::make_shared<kota::cancellation_source>();
+        pool.slot_cancel_sources.resize(pool.stateless_workers.size());
+        pool.slot_cancel_sources[idx] = src;
+        return src;
+    }
+
+    bool preempt() {
+        return pool.preempt_low_for_high();
+    }
+
+    bool is_preempted(std::size_t idx) const {
+        return pool.stateless_workers[idx].preempted;
+    }
+
     std::size_t pick_idle() {
         return pool.pick_idle_stateless();
     }
@@ -96,14 +247,23 @@ struct WorkerPoolFixture {
         return pool.process_crash(index, stateful, exit_code, exit_signal);
     }
 
-    bool start(std::uint32_t stateless = 2, std::uint32_t stateful = 0) {
+    bool start(std::uint32_t stateless = 2, std::uint32_t stateful = 0, bool zygote = false) {
         WorkerPoolOptions opts;
         opts.self_path = clice_binary();
         opts.stateless_count = stateless;
         opts.stateful_count = stateful;
+        opts.zygote = zygote;
         return pool.start(opts);
     }
 
+    bool has_zygote() const {
+        return pool.zygote && pool.zygote->alive();
+    }
+
+    bool is_forked(std::size_t idx) const {
+        return pool.stateless_workers[idx].forked_pid > 0;
+    }
+
     kota::task<> stop() {
         return pool.stop();
     }
@@ -115,7 +275,7 @@ struct WorkerPoolFixture {
     }
 
     void kill_worker(std::size_t idx) {
-        pool.stateless_workers[idx].proc.kill(9);
+        WorkerPool::signal_worker(pool.stateless_workers[idx], 9);
     }
 
     std::size_t low_limit() const {
@@ -151,7 +311,8 @@ struct WorkerPoolFixture {
     }
 
     int worker_pid(std::size_t idx) const {
-        return pool.stateless_workers[idx].proc.pid();
+        auto& w = pool.stateless_workers[idx];
+        return w.forked_pid > 0 ? w.forked_pid : w.proc.pid();
     }
 
     struct PriorityResult {
@@ -180,8 +341,7 @@ struct WorkerPoolFixture {
         auto low = std::make_unique<WorkerPool::PendingStateless>(worker::Priority::Low);
         pool.high_queue.push_back(high.get());
         high->queue = &pool.high_queue;
-        pool.low_queue.push_back(low.get());
-        low->queue = &pool.low_queue;
+        pool.push_low_pending(*low);
         pool.release_stateless_slot(release_idx);
         return {high->ready.is_set(), low->ready.is_set()};
     }
@@ -191,8 +351,7 @@ struct WorkerPoolFixture {
         for(std::size_t i = 0; i < count; ++i) {
             pending.push_back(
                 std::make_unique<WorkerPool::PendingStateless>(worker::Priority::Low));
-            pool.low_queue.push_back(pending.back().get());
-            pending.back()->queue = &pool.low_queue;
+            pool.push_low_pending(*pending.back());
         }
         pool.try_dispatch_pending();
         std::size_t dispatched = 0;
@@ -239,8 +398,7 @@ struct WorkerPoolFixture {
     bool test_pending_cleanup_low() {
         {
             WorkerPool::PendingStateless pending(worker::Priority::Low);
-            pool.low_queue.push_back(&pending);
-            pending.queue = &pool.low_queue;
+            pool.push_low_pending(pending);
             if(pool.low_queue.size() != 1)
                 return false;
         }
@@ -371,6 +529,101 @@ TEST_CASE(ClearOwner) {
     EXPECT_TRUE(f.has_owner(200));
 }
 
+TEST_CASE(PickMostFreeMemory) {
+    WorkerPoolFixture f;
+    f.add_stateful(true, 0);
+    f.add_stateful(true, 0);
+    f.assign_worker(100);
+    f.record_memory(100, 0, 800);
+    f.assign_worker(200);
+    f.record_memory(200, 1, 100);
+    f.assign_worker(300);
+    f.record_memory(300, 1, 100);
+    // Worker 1 owns more documents but far less memory.
+    EXPECT_EQ(f.pick_least_loaded(), 1u);
+}
+
+TEST_CASE(RecordMemoryReplaces) {
+    WorkerPoolFixture f;
+    f.add_stateful(true, 0);
+    f.assign_worker(100);
+    f.record_memory(100, 0, 500);
+    f.record_memory(100, 0, 200);
+    EXPECT_EQ(f.stateful_memory(0), 200u);
+}
+
+TEST_CASE(RecordMemoryIgnoresStaleOwner) {
+    WorkerPoolFixture f;
+    f.add_stateful(true, 0);
+    f.add_stateful(true, 0);
+    auto idx = f.assign_worker(100);
+    f.record_memory(100, 1 - idx, 500);
+    f.record_memory(999, idx, 500);
+    EXPECT_EQ(f.stateful_memory(0), 0u);
+    EXPECT_EQ(f.stateful_memory(1), 0u);
+}
+
+TEST_CASE(RemoveOwnerReleasesMemory) {
+    WorkerPoolFixture f;
+    f.add_stateful(true, 0);
+    f.assign_worker(100);
+    f.assign_worker(200);
+    f.record_memory(100, 0, 300);
+    f.record_memory(200, 0, 400);
+    f.remove_owner(100);
+    EXPECT_EQ(f.stateful_memory(0), 400u);
+    f.clear_owner(0);
+    EXPECT_EQ(f.stateful_memory(0), 0u);
+}
+
+TEST_CASE(RebalanceMigratesColdest) {
+    WorkerPoolFixture f;
+    f.add_stateful(true, 0);
+    f.add_stateful(true, 0);
+    std::vector<std::uint32_t> migrated;
+    f.enable_migration(1000, migrated);
+
+    f.assign_worker(100);
+    f.record_memory(100, 0, 300);
+    // Worker 1 now has less memory, so the next three documents land there.
+    f.assign_worker(200);
+    f.record_memory(200, 1, 100);
+    f.assign_worker(300);
+    f.record_memory(300, 1, 50);
+    f.assign_worker(400);
+    f.record_memory(400, 1, 400);
+    EXPECT_EQ(f.owner_of(400), 1u);
+
+    // 550 vs 300: below 2x, nothing to do.
+    f.rebalance();
+    EXPECT_TRUE(migrated.empty());
+
+    // 1050 vs 300: the coldest document on worker 1 is 200.
+    f.record_memory(400, 1, 900);
+    f.rebalance();
+    EXPECT_EQ(migrated.size(), 1u);
+    EXPECT_EQ(migrated[0], 200u);
+
+    // Cooldown suppresses an immediate follow-up.
+    f.rebalance();
+    EXPECT_EQ(migrated.size(), 1u);
+}
+
+TEST_CASE(RebalanceSkipsSmallGap) {
+    WorkerPoolFixture f;
+    f.add_stateful(true, 0);
+    f.add_stateful(true, 0);
+    std::vector<std::uint32_t> migrated;
+    f.enable_migration(1ULL << 30, migrated);
+    f.assign_worker(100);
+    f.record_memory(100, 0, 64);
+    f.assign_worker(200);
+    f.record_memory(200, 1, 32);
+    // Twice the memory, but the gap is tiny compared to the budget.
+    f.rebalance();
+    EXPECT_TRUE(migrated.empty());
+}
+
 };  // TEST_SUITE(WorkerPoolStateful)
 
 TEST_SUITE(WorkerPoolScheduling) {
@@ -557,6 +810,170 @@ TEST_CASE(PendingCleanupOnDestroy) {
     EXPECT_TRUE(f.test_pending_cleanup_low());
 }
 
+TEST_CASE(CostModelLearns) {
+    using K = worker::BuildKind;
+    WorkerPoolFixture f;
+    EXPECT_EQ(f.estimate_cost(K::Index, "a.cpp"), 0.0);
+    f.record_cost(K::Index, "a.cpp", 400);
+    EXPECT_EQ(f.estimate_cost(K::Index, "a.cpp"), 400.0);
+    // Unseen files fall back to the per-kind average.
+    EXPECT_EQ(f.estimate_cost(K::Index, "b.cpp"), 400.0);
+    EXPECT_EQ(f.estimate_cost(K::BuildPCH, "a.cpp"), 0.0);
+    f.record_cost(K::Index, "a.cpp", 800);
+    EXPECT_EQ(f.estimate_cost(K::Index, "a.cpp"), 500.0);
+}
+
+TEST_CASE(CostModelSumsBatch) {
+    using K = worker::BuildKind;
+    WorkerPoolFixture f;
+    f.record_cost(K::Index, "a.cpp", 400);
+    f.record_cost(K::Index, "b.cpp", 800);
+    // a.cpp and b.cpp by their own cost, c.cpp by the kind average.
+    EXPECT_EQ(f.estimate_batch_cost({"a.cpp", "b.cpp", "c.cpp"}), 1700.0);
+}
+
+TEST_CASE(LowQueueShortestFirst) {
+    WorkerPoolFixture f;
+    f.add_stateless();
+    f.set_limits(1, 1);
+    auto r = f.test_low_order({300, 20, 100}, false);
+    EXPECT_FALSE(r[0]);
+    EXPECT_TRUE(r[1]);
+    EXPECT_FALSE(r[2]);
+}
+
+TEST_CASE(LowQueueSkipsCancelled) {
+    // The cheapest entry left the queue; the next cheapest runs instead.
+    WorkerPoolFixture f;
+    f.add_stateless();
+    f.set_limits(1, 1);
+    auto r = f.test_low_order({300, 20, 100}, false, 1);
+    EXPECT_FALSE(r[0]);
+    EXPECT_FALSE(r[1]);
+    EXPECT_TRUE(r[2]);
+    EXPECT_EQ(f.low_queue_size(), 0U);
+}
+
+TEST_CASE(LowQueueStarvedFifo) {
+    WorkerPoolFixture f;
+    f.add_stateless();
+    f.set_limits(1, 1);
+    auto r = f.test_low_order({300, 20}, true);
+    EXPECT_TRUE(r[0]);
+    EXPECT_FALSE(r[1]);
+}
+
+TEST_CASE(PromoteQueuedBuild) {
+    // The low limit is used up, so only the promoted build may run.
+    WorkerPoolFixture f;
+    f.add_stateless(true, true);
+    f.add_stateless();
+    f.set_limits(1, 1);
+    using K = worker::BuildKind;
+    std::vector builds = {
+        WorkerPoolFixture::build(K::Index, "a.cppm"),
+        WorkerPoolFixture::build(K::BuildPCM, "a.cppm"),
+        WorkerPoolFixture::build(K::BuildPCM, "b.cppm"),
+    };
+    auto [dispatched, promoted] = f.test_promote(builds, K::BuildPCM, "a.cppm");
+    EXPECT_TRUE(promoted);
+    EXPECT_FALSE(dispatched[0]);
+    EXPECT_TRUE(dispatched[1]);
+    EXPECT_FALSE(dispatched[2]);
+}
+
+TEST_CASE(PromoteMissingBuild) {
+    WorkerPoolFixture f;
+    f.add_stateless(true, true);
+    f.set_limits(1, 1);
+    std::vector builds = {WorkerPoolFixture::build(worker::BuildKind::BuildPCM, "a.cppm")};
+    auto [dispatched, promoted] = f.test_promote(builds, worker::BuildKind::BuildPCM, "b.cppm");
+    EXPECT_FALSE(promoted);
+    EXPECT_FALSE(dispatched[0]);
+}
+
+TEST_CASE(PreemptLongestRemaining) {
+    WorkerPoolFixture f;
+    f.add_stateless(true, true);
+    f.add_stateless(true, true);
+    f.add_stateless(true, false);
+    auto short_job = f.run_index(0, 100, "short.cpp");
+    auto long_job = f.run_index(1, 60000, "long.cpp");
+    EXPECT_TRUE(f.preempt());
+    EXPECT_FALSE(short_job->cancelled());
+    EXPECT_TRUE(long_job->cancelled());
+    EXPECT_TRUE(f.is_preempted(1));
+
+    // The long job is already being preempted; the short one is next.
+    EXPECT_TRUE(f.preempt());
+    EXPECT_TRUE(short_job->cancelled());
+    EXPECT_FALSE(f.preempt());
+}
+
+TEST_CASE(PreemptSkipsNonIndex) {
+    WorkerPoolFixture f;
+    f.add_stateless(true, true);
+    f.set_limits(1, 1);
+    EXPECT_FALSE(f.preempt());
+}
+
+TEST_CASE(PickIdleSkipsStandby) {
+    WorkerPoolFixture f;
+    f.add_stateless(true, true);
+    f.add_standby();
+    EXPECT_EQ(f.pick_idle(), SIZE_MAX);
+    EXPECT_EQ(f.alive_count(), 1u);
+}
+
+TEST_CASE(ScaleUpPromotesStandby) {
+    WorkerPoolFixture f;
+    f.add_stateless(true, true);
+    f.add_standby();
+    f.set_scaling(1, 4);
+
+    ASSERT_TRUE(f.scale_up());
+    EXPECT_FALSE(f.is_standby(1));
+    EXPECT_EQ(f.alive_count(), 2u);
+    EXPECT_EQ(f.pick_idle(), 1u);
+}
+
+TEST_CASE(ScaleUpRespectsMax) {
+    WorkerPoolFixture f;
+    f.add_stateless();
+    f.add_standby();
+    f.set_scaling(1, 1);
+
+    EXPECT_FALSE(f.scale_up());
+    EXPECT_TRUE(f.is_standby(1));
+}
+
+TEST_CASE(ScaleAheadOnQueueGrowth) {
+    WorkerPoolFixture f;
+    f.add_stateless(true, true);
+    f.add_standby();
+    f.set_scaling(1, 4);
+    f.set_limits(0, 0);
+
+    // Two queued per worker and growing: the standby is promoted without
+    // waiting for the monitor's saturation ticks.  It stays reserved for
+    // high priority work, so nothing low priority is dispatched yet.
+    EXPECT_EQ(f.test_low_dispatch(2), 0u);
+    EXPECT_FALSE(f.is_standby(1));
+    EXPECT_EQ(f.alive_count(), 2u);
+}
+
+TEST_CASE(RetireSkipsStandby) {
+    WorkerPoolFixture f;
+    f.add_stateless();
+    f.add_stateless();
+    f.add_standby();
+    f.set_scaling(1, 4);
+
+    f.retire_idle();
+    EXPECT_FALSE(f.is_retiring(2));
+    EXPECT_TRUE(f.is_retiring(1));
+}
+
 TEST_CASE(DispatchClearsQueue) {
     WorkerPoolFixture f;
     f.add_stateless(true, true);
@@ -863,6 +1280,60 @@ TEST_CASE(MaxLowLimitClamped) {
 
 };  // TEST_SUITE(WorkerPoolCrash)
 
+TEST_SUITE(WorkerPoolTelemetry) {
+
+TEST_CASE(HistogramBuckets) {
+    LatencyHistogram h;
+    h.record(3.0);
+    h.record(5.0);
+    h.record(7.0);
+    h.record(60000.0);
+
+    auto stats = h.snapshot();
+    EXPECT_EQ(stats.count, 4u);
+    ASSERT_EQ(stats.buckets.size(), LatencyHistogram::bounds_ms.size() + 1);
+    EXPECT_EQ(stats.buckets[0], 2u);
+    EXPECT_EQ(stats.buckets[1], 1u);
+    EXPECT_EQ(stats.buckets.back(), 1u);
+    EXPECT_EQ(stats.max_ms, 60000.0);
+}
+
+TEST_CASE(StatsPerWorker) {
+    WorkerPoolFixture f;
+    f.add_stateless();
+    f.add_stateful();
+    f.record_request(0, false, true);
+    f.record_request(0, false, false);
+    f.record_request(0, true, true);
+
+    auto stats = f.pool.stats();
+    ASSERT_EQ(stats.workers.size(), 2u);
+    EXPECT_EQ(stats.workers[0].name, "SL-0");
+    EXPECT_EQ(stats.workers[0].latency.count, 1u);
+    EXPECT_EQ(stats.workers[0].failures, 1u);
+    EXPECT_GE(stats.workers[0].busy_ms, 40.0);
+    EXPECT_TRUE(stats.workers[1].stateful);
+    EXPECT_EQ(stats.workers[1].latency.count, 1u);
+
+    ASSERT_EQ(stats.queues.size(), 2u);
+    EXPECT_EQ(stats.queues[0].priority, "High");
+    EXPECT_EQ(stats.build_kinds.size(), 6u);
+    EXPECT_EQ(stats.build_kinds[2].kind, "Index");
+}
+
+TEST_CASE(StatsCountsCrashes) {
+    WorkerPoolFixture f;
+    f.add_stateless();
+    f.add_stateless();
+    f.simulate_crash(0, false);
+
+    auto stats = f.pool.stats(/*reset=*/true);
+    EXPECT_EQ(stats.crashes, 1u);
+    EXPECT_EQ(f.pool.stats().crashes, 0u);
+}
+
+};  // TEST_SUITE(WorkerPoolTelemetry)
+
 TEST_SUITE(WorkerPoolIntegration) {
 
 TEST_CASE(StartAndStop) {
@@ -954,6 +1425,50 @@ TEST_CASE(CrashNotification) {
     EXPECT_TRUE(done);
 }
 
+#ifdef __linux__
+
+TEST_CASE(ZygoteForkAndRestart) {
+    TempDir tmp;
+    tmp.touch("test.cpp", "int x = 1;\n");
+    auto src = tmp.path("test.cpp");
+
+    WorkerPoolFixture f;
+    bool done = false;
+    f.run([&]() -> kota::task<> {
+        CO_ASSERT_TRUE(f.start(2, 0, /*zygote=*/true));
+        CO_ASSERT_TRUE(f.has_zygote());
+        EXPECT_TRUE(f.is_forked(0));
+
+        worker::BuildParams params;
+        params.priority = worker::Priority::High;
+        params.kind = worker::BuildKind::Index;
+        params.file = src;
+        params.directory = "/tmp";
+        params.arguments = make_args(src);
+
+        auto result = co_await f.pool.send_stateless(params);
+        EXPECT_TRUE(result.has_value());
+
+        // The exit is reported by the zygote and the slot is forked again.
+        auto pid = f.worker_pid(0);
+        f.kill_worker(0);
+        for(int i = 0; i < 50; ++i) {
+            co_await kota::sleep(100);
+            if(f.worker_alive(0) && f.worker_pid(0) != pid)
+                break;
+        }
+        EXPECT_TRUE(f.worker_alive(0));
+        EXPECT_NE(f.worker_pid(0), pid);
+        EXPECT_TRUE(f.is_forked(0));
+
+        co_await f.stop();
+        done = true;
+    });
+    EXPECT_TRUE(done);
+}
+
+#endif
+
 };  // TEST_SUITE(WorkerPoolIntegration)
 
 }  // namespace
@@ -0,0 +1,46 @@
+#include <vector>
+
+#include "test/test.h"
+#include "server/workspace/workspace.h"
+
+namespace clice::testing {
+namespace {
+
+TEST_SUITE(Workspace) {
+
+TEST_CASE(ContextCandidates) {
+    // 1, 2, 3 and 4 all include 20.
+    Workspace workspace;
+    auto& graph = workspace.dep_graph;
+    for(std::uint32_t host: {1, 2, 3, 4}) {
+        graph.set_includes(host, 0, {20});
+    }
+    graph.build_reverse_map();
+
+    using Ids = std::vector<std::uint32_t>;
+    auto candidates = [&] {
+        auto ranked = workspace.context_candidates(20);
+        return Ids(ranked.begin(), ranked.end());
+    };
+    auto hosts = graph.find_host_sources(20);
+    EXPECT_EQ(candidates(), Ids(hosts.begin(), hosts.end()));
+
+    // Ranked once: a PCH built later does not reorder the same hosts.
+    workspace.pch_cache["pch"].source = hosts[2];
+    EXPECT_EQ(candidates(), Ids(hosts.begin(), hosts.end()));
+
+    // New hosts rank again, compiled ones first, then the others in order.
+    graph.set_includes(5, 0, {20});
+    graph.build_reverse_map();
+    hosts = graph.find_host_sources(20);
+    ASSERT_EQ(hosts.size(), 5u);
+    auto ranked = candidates();
+    ASSERT_EQ(ranked.size(), 5u);
+    EXPECT_EQ(ranked[0], workspace.pch_cache["pch"].source);
+    EXPECT_TRUE(workspace.context_candidates(30).empty());
+}
+
+};  // TEST_SUITE(Workspace)
+
+}  // namespace
+}  // namespace clice::testing
@@ -1,6 +1,10 @@
+#include <atomic>
 #include <cstdlib>
 #include <format>
 #include <print>
+#include <string>
+#include <thread>
+#include <vector>
 
 #ifndef _WIN32
 #include <unistd.h>
@@ -11,6 +15,7 @@
 #include "support/cache_store.h"
 #include "support/filesystem.h"
 
+#include "llvm/Support/Compression.h"
 #include "llvm/Support/Process.h"
 
 namespace clice::testing {
@@ -130,6 +135,68 @@ TEST_CASE(VersionBumpDiscards) {
     ASSERT_FALSE(llvm::sys::fs::exists(tmp.path("root/cache/v1")));
 }
 
+TEST_CASE(VersionBumpKeepsPersistent) {
+    TempDir tmp;
+    auto register_index = [](CacheStore& store) {
+        store.register_namespace(
+            {.name = "index", .extension = ".idx", .policy = CachePolicy::Persistent});
+    };
+    {
+        auto store = open_store(tmp);
+        register_lru(store);
+        register_index(store);
+        put(store, "pch", "k1", "rebuildable");
+        put(store, "index", "shard", "expensive");
+        store.shutdown();
+    }
+
+    // The index is carried over to the new layout; the PCH of an unknown
+    // format version is not.
+    auto store = open_store(tmp, version + 1);
+    register_lru(store);
+    register_index(store);
+    ASSERT_FALSE(store.lookup("pch", "k1").has_value());
+    auto hit = store.lookup("index", "shard");
+    ASSERT_TRUE(hit.has_value());
+    ASSERT_TRUE(llvm::StringRef(*hit).contains("v2"));
+    ASSERT_EQ(fs::read(*hit).value_or(""), "expensive");
+    ASSERT_FALSE(llvm::sys::fs::exists(tmp.path("root/cache/v1")));
+}
+
+TEST_CASE(NamespaceVersionChange) {
+    TempDir tmp;
+    auto register_both = [](CacheStore& store, std::uint32_t ns_version) {
+        store.register_namespace({.name = "pch",
+                                  .extension = ".pch",
+                                  .policy = CachePolicy::LRU,
+                                  .version = ns_version});
+        store.register_namespace({.name = "index",
+                                  .extension = ".idx",
+                                  .policy = CachePolicy::Persistent,
+                                  .version = ns_version});
+    };
+    {
+        auto store = open_store(tmp);
+        register_both(store, 1);
+        put(store, "pch", "k1", "pch");
+        put(store, "index", "shard", "index");
+        store.shutdown();
+    }
+    {
+        // Same versions: everything is adopted.
+        auto store = open_store(tmp);
+        register_both(store, 1);
+        ASSERT_TRUE(store.lookup("pch", "k1").has_value());
+        ASSERT_TRUE(store.lookup("index", "shard").has_value());
+        store.shutdown();
+    }
+
+    auto store = open_store(tmp);
+    register_both(store, 2);
+    ASSERT_FALSE(store.lookup("pch", "k1").has_value());
+    ASSERT_TRUE(store.lookup("index", "shard").has_value());
+}
+
 TEST_CASE(LegacyLayoutDiscarded) {
     TempDir tmp;
     // Pre-versioning layout: blobs and metadata directly under cache/.
@@ -175,6 +242,90 @@ TEST_CASE(LruEviction) {
     ASSERT_TRUE(store.lookup("pch", "c").has_value());
 }
 
+TEST_CASE(CostAwareEviction) {
+    TempDir tmp;
+    auto store = open_store(tmp);
+    register_lru(store, 25);
+
+    // "slow" took ten seconds to build, so it outlives "fast" although it
+    // is the colder of the two.
+    auto pending = store.begin_store("pch", "slow");
+    pending.begun_at -= 10'000;
+    ASSERT_TRUE(fs::write(pending.tmp_path, "ssssssssss").has_value());
+    ASSERT_TRUE(store.commit(std::move(pending)).has_value());
+    put(store, "pch", "fast", "ffffffffff");
+    ASSERT_TRUE(store.lookup("pch", "fast").has_value());
+
+    put(store, "pch", "c", "cccccccccc");
+    ASSERT_FALSE(store.lookup("pch", "fast").has_value());
+    ASSERT_TRUE(store.lookup("pch", "slow").has_value());
+
+    auto stats = store.stats(true);
+    ASSERT_EQ(stats.size(), 1u);
+    EXPECT_EQ(stats[0].name, "pch");
+    EXPECT_EQ(stats[0].entries, 2u);
+    EXPECT_EQ(stats[0].bytes, 20u);
+    EXPECT_EQ(stats[0].max_bytes, 25u);
+    EXPECT_EQ(stats[0].hits, 2u);
+    EXPECT_EQ(stats[0].misses, 1u);
+    EXPECT_EQ(stats[0].commits, 3u);
+    EXPECT_EQ(stats[0].written_bytes, 30u);
+    EXPECT_EQ(stats[0].evictions, 1u);
+    EXPECT_EQ(stats[0].evicted_bytes, 10u);
+
+    // Reset the counters, not the occupancy.
+    stats = store.stats();
+    EXPECT_EQ(stats[0].hits, 0u);
+    EXPECT_EQ(stats[0].commits, 0u);
+    EXPECT_EQ(stats[0].evictions, 0u);
+    EXPECT_EQ(stats[0].entries, 2u);
+}
+
+TEST_CASE(Prefetch) {
+    TempDir tmp;
+    auto store = open_store(tmp);
+    register_lru(store);
+    put(store, "pch", "a", "aaaaaaaaaa");
+
+    EXPECT_FALSE(store.prefetch("pch", "missing"));
+    EXPECT_FALSE(store.prefetch("other", "a"));
+#ifndef _WIN32
+    EXPECT_TRUE(store.prefetch("pch", "a"));
+#endif
+    // A hint, not an access.
+    EXPECT_EQ(store.stats()[0].hits, 0u);
+}
+
+TEST_CASE(DiskBudget) {
+    TempDir tmp;
+    auto store = open_store(tmp);
+    // Any disk has room for 25 bytes, so the cap decides.
+    store.register_namespace({.name = "pch",
+                              .extension = ".pch",
+                              .policy = CachePolicy::LRU,
+                              .max_bytes = 25,
+                              .disk_fraction = 1});
+    // No disk yields a byte at this fraction: one blob at a time.
+    store.register_namespace({.name = "pcm",
+                              .extension = ".pcm",
+                              .policy = CachePolicy::LRU,
+                              .disk_fraction = 1e-15});
+
+    put(store, "pcm", "a", "aaaaaaaaaa");
+    put(store, "pcm", "b", "bbbbbbbbbb");
+    EXPECT_FALSE(store.lookup("pcm", "a").has_value());
+    EXPECT_TRUE(store.lookup("pcm", "b").has_value());
+
+    store.checkpoint();
+    auto stats = store.stats();
+    ASSERT_EQ(stats.size(), 2u);
+    EXPECT_EQ(stats[0].name, "pch");
+    EXPECT_EQ(stats[0].max_bytes, 25u);
+    EXPECT_EQ(stats[1].max_bytes, 1u);
+    // Checkpoints enforce the budget too, sparing no blob.
+    EXPECT_EQ(stats[1].entries, 0u);
+}
+
 TEST_CASE(FreshCommitNotEvicted) {
     TempDir tmp;
     auto store = open_store(tmp);
@@ -295,8 +446,8 @@ TEST_CASE(MissingManifestRescans) {
         store.shutdown();
     }
 
-    [[maybe_unused]] auto removed = llvm::sys::fs::remove(tmp.path("root/cache/v1/manifest.json"));
-    ASSERT_FALSE(llvm::sys::fs::exists(tmp.path("root/cache/v1/manifest.json")));
+    [[maybe_unused]] auto removed = llvm::sys::fs::remove(tmp.path("root/cache/v1/manifest.bin"));
+    ASSERT_FALSE(llvm::sys::fs::exists(tmp.path("root/cache/v1/manifest.bin")));
 
     auto store = open_store(tmp);
     register_lru(store);
@@ -314,7 +465,7 @@ TEST_CASE(CorruptManifestRescans) {
         store.shutdown();
     }
 
-    tmp.touch("root/cache/v1/manifest.json", "this is not json {{{");
+    tmp.touch("root/cache/v1/manifest.bin", "this is not a manifest");
 
     auto store = open_store(tmp);
     register_lru(store);
@@ -375,7 +526,7 @@ TEST_CASE(ScratchBasics) {
 
     // Scratch entries never enter the manifest.
     store.checkpoint();
-    auto manifest = fs::read(tmp.path("root/cache/v1/manifest.json"));
+    auto manifest = fs::read(tmp.path("root/cache/v1/manifest.bin"));
     if(manifest.has_value()) {
         ASSERT_FALSE(llvm::StringRef(*manifest).contains("header_context"));
     }
@@ -434,6 +585,94 @@ TEST_CASE(ManifestAtimePersisted) {
     ASSERT_FALSE(store.lookup("pch", "b").has_value());
 }
 
+TEST_CASE(ManifestJournal) {
+    TempDir tmp;
+    auto manifest_path = tmp.path("root/cache/v1/manifest.bin");
+    {
+        auto store = open_store(tmp);
+        register_lru(store);
+        put(store, "pch", "a", "aaaaaaaaaa");
+        put(store, "pch", "b", "bbbbbbbbbb");
+        store.shutdown();
+    }
+    std::uint64_t written = 0;
+    ASSERT_FALSE(llvm::sys::fs::file_size(manifest_path, written));
+
+    // Touching "b" appends its record instead of rewriting the file.
+    {
+        auto store = open_store(tmp);
+        register_lru(store);
+        ASSERT_TRUE(store.lookup("pch", "b").has_value());
+        store.shutdown();
+    }
+    std::uint64_t appended = 0;
+    ASSERT_FALSE(llvm::sys::fs::file_size(manifest_path, appended));
+    EXPECT_GT(appended, written);
+
+    // A torn tail, as a crash mid-append leaves, drops only itself.
+    auto content = fs::read(manifest_path);
+    ASSERT_TRUE(content.has_value());
+    ASSERT_TRUE(fs::write(manifest_path, *content + "torn").has_value());
+
+    auto store = open_store(tmp);
+    register_lru(store, 15);
+    ASSERT_FALSE(store.lookup("pch", "a").has_value());
+    ASSERT_TRUE(store.lookup("pch", "b").has_value());
+}
+
+TEST_CASE(LegacyManifestRead) {
+    TempDir tmp;
+    {
+        auto store = open_store(tmp);
+        register_lru(store);
+        put(store, "pch", "a", "aaaaaaaaaa");
+        put(store, "pch", "b", "bbbbbbbbbb");
+        store.shutdown();
+    }
+
+    // Only the JSON manifest of an older release says "a" is the hotter.
+    [[maybe_unused]] auto removed = llvm::sys::fs::remove(tmp.path("root/cache/v1/manifest.bin"));
+    tmp.touch("root/cache/v1/manifest.json",
+              R"({"entries":[{"ns":"pch","key":"a","atime":2},{"ns":"pch","key":"b","atime":1}]})");
+
+    auto store = open_store(tmp);
+    register_lru(store, 15);
+    ASSERT_TRUE(store.lookup("pch", "a").has_value());
+    ASSERT_FALSE(store.lookup("pch", "b").has_value());
+
+    store.checkpoint();
+    ASSERT_TRUE(llvm::sys::fs::exists(tmp.path("root/cache/v1/manifest.bin")));
+    ASSERT_FALSE(llvm::sys::fs::exists(tmp.path("root/cache/v1/manifest.json")));
+}
+
+TEST_CASE(ConcurrentLookups) {
+    TempDir tmp;
+    auto store = open_store(tmp);
+    register_lru(store);
+    put(store, "pch", "hot", "hhhhhhhhhh");
+
+    // Lookups on other threads while this one commits and checkpoints.
+    std::vector<std::thread> readers;
+    std::atomic<int> missed = 0;
+    for(int i = 0; i < 4; ++i) {
+        readers.emplace_back([&] {
+            for(int n = 0; n < 1000; ++n) {
+                missed += !store.lookup("pch", "hot").has_value();
+            }
+        });
+    }
+    for(int i = 0; i < 32; ++i) {
+        put(store, "pch", std::format("k{}", i), "blob");
+        store.checkpoint();
+    }
+    for(auto& reader: readers) {
+        reader.join();
+    }
+
+    EXPECT_EQ(missed.load(), 0);
+    EXPECT_EQ(store.stats()[0].hits, 4000u);
+}
+
 TEST_CASE(CheckpointAutoTriggers) {
     TempDir tmp;
     auto store = open_store(tmp);
@@ -444,11 +683,246 @@ TEST_CASE(CheckpointAutoTriggers) {
     for(int i = 0; i < 16; ++i) {
         put(store, "pch", std::format("k{}", i), "blob");
     }
-    auto manifest = fs::read(tmp.path("root/cache/v1/manifest.json"));
+    auto manifest = fs::read(tmp.path("root/cache/v1/manifest.bin"));
     ASSERT_TRUE(manifest.has_value());
     ASSERT_TRUE(llvm::StringRef(*manifest).contains("k0"));
 }
 
+TEST_CASE(RescanFollowsOtherInstance) {
+    TempDir tmp;
+    auto owner = open_store(tmp);
+    auto reader = open_store(tmp);
+    CacheNamespace index{.name = "index", .extension = ".idx", .policy = CachePolicy::Persistent};
+    owner.register_namespace(index);
+    reader.register_namespace(index);
+
+    auto rescan = [&] {
+        std::vector<std::string> keys;
+        reader.rescan("index", [&](llvm::StringRef key) { keys.push_back(key.str()); });
+        return keys;
+    };
+
+    put(owner, "index", "a", "first");
+    ASSERT_FALSE(reader.lookup("index", "a").has_value());
+    ASSERT_TRUE(rescan() == std::vector<std::string>{"a"});
+    ASSERT_TRUE(reader.lookup("index", "a").has_value());
+    ASSERT_TRUE(rescan().empty());
+
+    // A rewrite of the same size is still seen: the blob is a new file.
+    put(owner, "index", "a", "again");
+    ASSERT_TRUE(rescan() == std::vector<std::string>{"a"});
+
+    owner.invalidate("index", "a");
+    ASSERT_TRUE(rescan() == std::vector<std::string>{"a"});
+    ASSERT_FALSE(reader.lookup("index", "a").has_value());
+
+    ASSERT_TRUE(owner.try_lock("index"));
+}
+
+TEST_CASE(CommitBatch) {
+    TempDir tmp;
+    auto store = open_store(tmp);
+    store.register_namespace(
+        {.name = "index", .extension = ".idx", .policy = CachePolicy::Persistent});
+
+    // Enough blobs for the filesystem-wide sync, plus one that fails.
+    std::vector<CacheStore::PendingEntry> batch;
+    for(int i = 0; i < 12; ++i) {
+        auto pending = store.begin_store("index", std::format("k{}", i));
+        require(fs::write(pending.tmp_path, std::format("blob {}", i)).has_value(),
+                "tmp write failed");
+        batch.push_back(std::move(pending));
+    }
+    batch.push_back({.ns = "index", .key = "missing", .tmp_path = tmp.path("nowhere")});
+
+    auto results = store.commit_batch(std::move(batch));
+    ASSERT_EQ(results.size(), 13u);
+    for(int i = 0; i < 12; ++i) {
+        ASSERT_TRUE(results[i].has_value());
+        ASSERT_EQ(store.lookup("index", std::format("k{}", i)).value_or(""), *results[i]);
+        ASSERT_EQ(fs::read(*results[i]).value_or(""), std::format("blob {}", i));
+    }
+    ASSERT_FALSE(results[12].has_value());
+    ASSERT_FALSE(store.lookup("index", "missing").has_value());
+}
+
+TEST_CASE(Remote) {
+    TempDir tmp;
+    auto open_at = [&](llvm::StringRef root, bool upload) {
+        auto store = CacheStore::open(tmp.path(root), version);
+        require(store.has_value(), "CacheStore::open failed");
+        store->register_namespace({.name = "pcm",
+                                   .extension = ".pcm",
+                                   .policy = CachePolicy::LRU,
+                                   .shared = true});
+        register_lru(*store);
+        store->set_remote(CacheRemote::directory(tmp.path("remote"), version), upload);
+        return std::move(*store);
+    };
+    auto builder = open_at("builder", true);
+    auto user = open_at("user", false);
+    ASSERT_TRUE(user.is_shared("pcm"));
+    ASSERT_FALSE(user.is_shared("pch"));
+
+    put(builder, "pcm", "m", "module blob");
+    put(builder, "pch", "p", "not shared");
+
+    // A plain lookup stays local; fetch falls back to the remote.
+    ASSERT_FALSE(user.lookup("pcm", "m").has_value());
+    auto fetched = user.fetch("pcm", "m");
+    ASSERT_TRUE(fetched.has_value());
+    ASSERT_EQ(fs::read(*fetched).value_or(""), "module blob");
+    ASSERT_EQ(user.lookup("pcm", "m").value_or(""), *fetched);
+    ASSERT_FALSE(user.fetch("pch", "p").has_value());
+    ASSERT_FALSE(user.fetch("pcm", "missing").has_value());
+
+    // What the user builds stays local.
+    put(user, "pcm", "u", "local");
+    ASSERT_FALSE(builder.fetch("pcm", "u").has_value());
+
+    // A damaged remote blob is a miss.
+    put(builder, "pcm", "bad", "to be damaged");
+    auto remote_path = tmp.path("remote/v1/pcm.v0/bad.pcm");
+    auto content = fs::read(remote_path);
+    ASSERT_TRUE(content.has_value());
+    content->back() ^= 1;
+    ASSERT_TRUE(fs::write(remote_path, *content).has_value());
+    ASSERT_FALSE(user.fetch("pcm", "bad").has_value());
+}
+
+TEST_CASE(Compressed) {
+    if(!llvm::compression::zstd::isAvailable()) {
+        return;
+    }
+
+    TempDir tmp;
+    std::string raw(64 * 1024, 'a');
+    auto blob_path = tmp.path("root/cache/v1/pch/a.pch");
+    {
+        auto store = open_store(tmp);
+        store.register_namespace({.name = "pch",
+                                  .extension = ".pch",
+                                  .policy = CachePolicy::LRU,
+                                  .codec = CacheCodec::Zstd});
+
+        // Callers get the raw copy; the blob at rest is compressed.
+        auto path = put(store, "pch", "a", raw);
+        ASSERT_TRUE(llvm::StringRef(path).ends_with("unpacked/a.pch"));
+        ASSERT_EQ(fs::read(path).value_or(""), raw);
+        auto blob = fs::read(blob_path).value_or("");
+        ASSERT_TRUE(llvm::StringRef(blob).starts_with("CLZ1"));
+        ASSERT_TRUE(blob.size() < raw.size());
+        ASSERT_EQ(store.lookup("pch", "a").value_or(""), path);
+        store.shutdown();
+    }
+
+    // The copy outlives the instance, and a lost one is unpacked again.
+    auto store = open_store(tmp);
+    store.register_namespace({.name = "pch",
+                              .extension = ".pch",
+                              .policy = CachePolicy::LRU,
+                              .codec = CacheCodec::Zstd});
+    auto hit = store.lookup("pch", "a");
+    ASSERT_TRUE(hit.has_value());
+    ASSERT_EQ(fs::read(*hit).value_or(""), raw);
+
+    store.invalidate("pch", "a");
+    ASSERT_FALSE(llvm::sys::fs::exists(*hit));
+    ASSERT_FALSE(llvm::sys::fs::exists(blob_path));
+}
+
+TEST_CASE(CompressedEvictsCopiesFirst) {
+    if(!llvm::compression::zstd::isAvailable()) {
+        return;
+    }
+
+    TempDir tmp;
+    auto store = open_store(tmp);
+    store.register_namespace({.name = "pch",
+                              .extension = ".pch",
+                              .policy = CachePolicy::LRU,
+                              .max_bytes = 100 * 1024,
+                              .codec = CacheCodec::Zstd});
+
+    std::string raw_a(64 * 1024, 'a');
+    std::string raw_b(64 * 1024, 'b');
+    auto copy_a = put(store, "pch", "a", raw_a);
+    auto copy_b = put(store, "pch", "b", raw_b);
+
+    // Two copies exceed the budget: the older one goes, its blob stays.
+    ASSERT_FALSE(llvm::sys::fs::exists(copy_a));
+    ASSERT_TRUE(llvm::sys::fs::exists(copy_b));
+    ASSERT_TRUE(llvm::sys::fs::exists(tmp.path("root/cache/v1/pch/a.pch")));
+
+    // Looking it up brings it back at the same path, at the cost of b's.
+    ASSERT_EQ(store.lookup("pch", "a").value_or(""), copy_a);
+    ASSERT_EQ(fs::read(copy_a).value_or(""), raw_a);
+    ASSERT_FALSE(llvm::sys::fs::exists(copy_b));
+    ASSERT_EQ(store.lookup("pch", "b").value_or(""), copy_b);
+    ASSERT_EQ(fs::read(copy_b).value_or(""), raw_b);
+}
+
+TEST_CASE(Chunked) {
+    // Incompressible bytes, so that chunking alone saves the space.
+    std::string shared(1024 * 1024, '\0');
+    std::uint64_t seed = 1;
+    for(auto& c: shared) {
+        seed = seed * 6364136223846793005 + 1442695040888963407;
+        c = static_cast<char>(seed >> 56);
+    }
+    auto raw_a = shared + std::string(32 * 1024, 'a');
+    auto raw_b = shared + std::string(32 * 1024, 'b');
+
+    auto chunks_size = [&](const TempDir& tmp) {
+        std::uint64_t total = 0;
+        std::error_code ec;
+        for(auto it = llvm::sys::fs::directory_iterator(tmp.path("root/cache/v1/pch/chunks"), ec);
+            !ec && it != llvm::sys::fs::directory_iterator();
+            it.increment(ec)) {
+            std::uint64_t size = 0;
+            if(!llvm::sys::fs::file_size(it->path(), size)) {
+                total += size;
+            }
+        }
+        return total;
+    };
+    auto register_chunked = [](CacheStore& store) {
+        store.register_namespace({.name = "pch",
+                                  .extension = ".pch",
+                                  .policy = CachePolicy::LRU,
+                                  .codec = CacheCodec::Chunked});
+    };
+
+    TempDir tmp;
+    {
+        auto store = open_store(tmp);
+        register_chunked(store);
+        ASSERT_EQ(fs::read(put(store, "pch", "a", raw_a)).value_or(""), raw_a);
+        ASSERT_EQ(fs::read(put(store, "pch", "b", raw_b)).value_or(""), raw_b);
+
+        // The blobs share the chunks of their common prefix.
+        auto stored = chunks_size(tmp);
+        EXPECT_GT(stored, raw_a.size() / 2);
+        EXPECT_LT(stored, raw_a.size() + raw_a.size() / 2);
+        store.shutdown();
+    }
+
+    // Lost copies are reassembled from the chunks, after a restart too.
+    fs::remove_all(tmp.path("root/cache/v1/pch/unpacked"));
+    auto store = open_store(tmp);
+    register_chunked(store);
+    auto hit = store.lookup("pch", "b");
+    ASSERT_TRUE(hit.has_value());
+    ASSERT_EQ(fs::read(*hit).value_or(""), raw_b);
+
+    // Chunks go with the last blob that uses them.
+    store.invalidate("pch", "a");
+    ASSERT_EQ(fs::read(store.lookup("pch", "b").value_or("")).value_or(""), raw_b);
+    store.invalidate("pch", "b");
+    EXPECT_EQ(chunks_size(tmp), 0u);
+    EXPECT_EQ(store.stats()[0].bytes, 0u);
+}
+
 };  // TEST_SUITE(CacheStore)
 
 }  // namespace
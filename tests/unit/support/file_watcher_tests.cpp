@@ -0,0 +1,82 @@
+#include <string>
+
+#include "test/temp_dir.h"
+#include "test/test.h"
+#include "support/file_watcher.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/FileSystem.h"
+
+namespace clice::testing {
+namespace {
+
+#ifdef __linux__
+
+TEST_SUITE(FileWatcher) {
+
+bool saw(llvm::ArrayRef<FileWatcher::Event> events,
+         llvm::StringRef path,
+         FileWatcher::Change change) {
+    for(auto& event: events) {
+        if(event.path == path && event.change == change)
+            return true;
+    }
+    return false;
+}
+
+TEST_CASE(ReportsWrites) {
+    TempDir tmp;
+    tmp.touch("a.h", "int a;");
+
+    auto watcher = FileWatcher::create();
+    ASSERT_TRUE(watcher.has_value());
+    ASSERT_FALSE(bool(watcher->add_directory(tmp.root.str())));
+    EXPECT_TRUE(watcher->watches(tmp.root.str()));
+
+    llvm::SmallVector<FileWatcher::Event> events;
+    watcher->poll(events);
+    EXPECT_TRUE(events.empty());
+
+    tmp.touch("a.h", "int b;");
+    watcher->poll(events);
+    EXPECT_TRUE(saw(events, tmp.path("a.h"), FileWatcher::Change::Modified));
+}
+
+TEST_CASE(ReportsRemovals) {
+    TempDir tmp;
+    tmp.touch("a.h", "int a;");
+
+    auto watcher = FileWatcher::create();
+    ASSERT_TRUE(watcher.has_value());
+    ASSERT_FALSE(bool(watcher->add_directory(tmp.root.str())));
+
+    llvm::sys::fs::remove(tmp.path("a.h"));
+    llvm::SmallVector<FileWatcher::Event> events;
+    watcher->poll(events);
+    EXPECT_TRUE(saw(events, tmp.path("a.h"), FileWatcher::Change::Removed));
+}
+
+TEST_CASE(IgnoresOtherDirectories) {
+    TempDir tmp;
+    tmp.mkdir("watched");
+    tmp.mkdir("other");
+
+    auto watcher = FileWatcher::create();
+    ASSERT_TRUE(watcher.has_value());
+    ASSERT_FALSE(bool(watcher->add_directory(tmp.path("watched"))));
+    ASSERT_FALSE(bool(watcher->add_directory(tmp.path("watched"))));
+    EXPECT_EQ(watcher->directory_count(), 1u);
+    EXPECT_TRUE(bool(watcher->add_directory(tmp.path("missing"))));
+
+    tmp.touch("other/b.h", "int b;");
+    llvm::SmallVector<FileWatcher::Event> events;
+    watcher->poll(events);
+    EXPECT_TRUE(events.empty());
+}
+
+};  // TEST_SUITE(FileWatcher)
+
+#endif
+
+}  // namespace
+}  // namespace clice::testing
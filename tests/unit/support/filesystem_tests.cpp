@@ -0,0 +1,85 @@
+#include "test/test.h"
+#include "support/filesystem.h"
+
+namespace clice::testing {
+namespace {
+
+TEST_SUITE(CachingFS) {
+
+TEST_CASE(ReadsThrough) {
+    llvm::IntrusiveRefCntPtr<vfs::InMemoryFileSystem> memory = new vfs::InMemoryFileSystem();
+    memory->addFile("/src/a.h", 0, llvm::MemoryBuffer::getMemBuffer("int a;"));
+
+    CachingFS fs(memory);
+    auto file = fs.openFileForRead("/src/a.h");
+    ASSERT_TRUE(bool(file));
+    auto buffer = (*file)->getBuffer("/src/a.h", -1, true, false);
+    ASSERT_TRUE(bool(buffer));
+    EXPECT_EQ((*buffer)->getBuffer(), "int a;");
+
+    auto stat = fs.status("/src/a.h");
+    ASSERT_TRUE(bool(stat));
+    EXPECT_EQ(stat->getSize(), 6u);
+}
+
+TEST_CASE(RemembersMisses) {
+    llvm::IntrusiveRefCntPtr<vfs::InMemoryFileSystem> memory = new vfs::InMemoryFileSystem();
+    CachingFS fs(memory);
+    EXPECT_FALSE(bool(fs.status("/src/b.h")));
+
+    // Files are assumed not to change while the cache is alive.
+    memory->addFile("/src/b.h", 0, llvm::MemoryBuffer::getMemBuffer("int b;"));
+    EXPECT_FALSE(bool(fs.status("/src/b.h")));
+    EXPECT_TRUE(bool(memory->status("/src/b.h")));
+}
+
+TEST_CASE(SharesContents) {
+    llvm::IntrusiveRefCntPtr<vfs::InMemoryFileSystem> memory = new vfs::InMemoryFileSystem();
+    memory->addFile("/src/c.h", 0, llvm::MemoryBuffer::getMemBuffer("int c;"));
+
+    CachingFS fs(memory);
+    auto first = fs.openFileForRead("/src/c.h");
+    auto second = fs.openFileForRead("/src/c.h");
+    ASSERT_TRUE(bool(first) && bool(second));
+    auto a = (*first)->getBuffer("/src/c.h", -1, true, false);
+    auto b = (*second)->getBuffer("/src/c.h", -1, true, false);
+    ASSERT_TRUE(bool(a) && bool(b));
+    EXPECT_EQ((*a)->getBufferStart(), (*b)->getBufferStart());
+}
+
+TEST_CASE(Fork) {
+    llvm::IntrusiveRefCntPtr<vfs::InMemoryFileSystem> memory = new vfs::InMemoryFileSystem();
+    memory->addFile("/src/d.h", 0, llvm::MemoryBuffer::getMemBuffer("int d;"));
+    memory->addFile("/src/e.h", 0, llvm::MemoryBuffer::getMemBuffer("int e;"));
+
+    llvm::IntrusiveRefCntPtr<CachingFS> fs = new CachingFS(memory);
+    auto start = [](CachingFS& fs, llvm::StringRef path) -> const char* {
+        auto file = fs.openFileForRead(path);
+        if(!file) {
+            return nullptr;
+        }
+        auto buffer = (*file)->getBuffer(path, -1, true, false);
+        return buffer ? (*buffer)->getBufferStart() : nullptr;
+    };
+    auto d = start(*fs, "/src/d.h");
+    auto e = start(*fs, "/src/e.h");
+    ASSERT_TRUE(d && e);
+    EXPECT_EQ(fs->size_in_bytes(), 12u);
+    EXPECT_FALSE(bool(fs->status("/src/f.h")));
+    memory->addFile("/src/f.h", 0, llvm::MemoryBuffer::getMemBuffer("int f;"));
+
+    // Unchanged contents are shared; a changed file and a miss are looked
+    // up again.
+    auto forked = fs->fork({"/src/e.h"});
+    EXPECT_EQ(forked->size_in_bytes(), 6u);
+    EXPECT_EQ(start(*forked, "/src/d.h"), d);
+    EXPECT_TRUE(start(*forked, "/src/e.h"));
+    EXPECT_EQ(forked->size_in_bytes(), 12u);
+    EXPECT_TRUE(bool(forked->status("/src/f.h")));
+    EXPECT_FALSE(bool(fs->status("/src/f.h")));
+}
+
+};  // TEST_SUITE(CachingFS)
+
+}  // namespace
+}  // namespace clice::testing
@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "test/test.h"
+#include "support/fuzzy_matcher.h"
+
+namespace clice::testing {
+
+namespace {
+
+std::vector<std::uint32_t> indices(const std::vector<FuzzyMatcher::Scored>& scored) {
+    std::vector<std::uint32_t> result;
+    for(auto& entry: scored) {
+        result.push_back(entry.index);
+    }
+    return result;
+}
+
+TEST_SUITE(FuzzyMatcher) {
+
+TEST_CASE(Subsequence) {
+    FuzzyMatcher matcher("u_p");
+    ASSERT_TRUE(matcher.match("unique_ptr").has_value());
+    ASSERT_TRUE(matcher.match("Unique_Ptr").has_value());
+    ASSERT_FALSE(matcher.match("pu_").has_value());
+    ASSERT_FALSE(matcher.match("up").has_value());
+    ASSERT_FALSE(matcher.match("").has_value());
+
+    FuzzyMatcher empty("");
+    ASSERT_TRUE(empty.match("anything") == 1.0f);
+}
+
+TEST_CASE(BatchMatchesMatch) {
+    std::vector<llvm::StringRef> words = {"fooBar", "barFoo", "fb", "xyz", "foo_bar", "FooBar"};
+    FuzzyMatcher matcher("fb");
+    auto batch = matcher.match_batch(words);
+
+    std::vector<FuzzyMatcher::Scored> expected;
+    for(std::uint32_t i = 0; i < words.size(); ++i) {
+        if(auto score = matcher.match(words[i])) {
+            expected.push_back({i, *score});
+        }
+    }
+    ASSERT_EQ(batch.size(), expected.size());
+    for(auto& entry: batch) {
+        ASSERT_EQ(*matcher.match(words[entry.index]), entry.score);
+    }
+    for(std::size_t i = 1; i < batch.size(); ++i) {
+        ASSERT_TRUE(batch[i - 1].score > batch[i].score ||
+                    (batch[i - 1].score == batch[i].score && batch[i - 1].index < batch[i].index));
+    }
+}
+
+TEST_CASE(BatchLimit) {
+    std::vector<llvm::StringRef> words = {"a", "ab", "abc", "b", "abcd", "a_b"};
+    FuzzyMatcher matcher("a");
+
+    auto all = matcher.match_batch(words);
+    ASSERT_EQ(all.size(), 5u);
+
+    for(std::size_t limit = 1; limit <= 6; ++limit) {
+        auto top = indices(matcher.match_batch(words, limit));
+        auto expected = indices(all);
+        expected.resize(std::min(limit, expected.size()));
+        ASSERT_TRUE(top == expected);
+    }
+}
+
+TEST_CASE(PreparedWordMatchesWord) {
+    std::vector<llvm::StringRef> words = {"unique_ptr", "UniquePtr", "UNIQUE_PTR", "up", "", "u"};
+    std::vector<PreparedWord> prepared;
+    for(auto word: words) {
+        prepared.emplace_back(word);
+    }
+
+    for(auto pattern: {"", "u", "up", "u_p", "UP", "uniq"}) {
+        FuzzyMatcher matcher(pattern);
+        for(std::size_t i = 0; i < words.size(); ++i) {
+            ASSERT_EQ(prepared[i].word(), words[i]);
+            ASSERT_TRUE(matcher.match(prepared[i]) == matcher.match(words[i]));
+        }
+    }
+
+    std::string long_word(200, 'x');
+    ASSERT_EQ(PreparedWord(long_word).word().size(), 127u);
+}
+
+};  // TEST_SUITE(FuzzyMatcher)
+
+}  // namespace
+
+}  // namespace clice::testing
@@ -494,8 +494,120 @@ TEST_CASE(WildGlob) {
     ASSERT_FALSE(Pat26.match("something/folder/foo.js"));
 }
 
+TEST_CASE(Affixes) {
+    PATDEF(Pat1, "src/**/*.cpp")
+    ASSERT_EQ(Pat1.literal_prefix(), "src");
+    ASSERT_EQ(Pat1.literal_suffix(), ".cpp");
+
+    PATDEF(Pat2, "**/*.{cpp,hpp}")
+    ASSERT_EQ(Pat2.literal_prefix(), "");
+    ASSERT_EQ(Pat2.literal_suffix(), "pp");
+
+    PATDEF(Pat3, "**/test[0-9]")
+    ASSERT_EQ(Pat3.literal_suffix(), "");
+
+    PATDEF(Pat4, "**/a\\*b")
+    ASSERT_EQ(Pat4.literal_suffix(), "b");
+}
+
+TEST_CASE(Compiled) {
+    struct Case {
+        const char* pattern;
+        const char* path;
+        bool matched;
+    };
+
+    // Agreement with the backtracking matcher on the shapes rules use.
+    Case cases[] = {
+        {"**/*.cpp",                    "src/a.cpp",                          true },
+        {"**/*.cpp",                    "a.cpp",                              true },
+        {"**/*.cpp",                    "src/a.cc",                           false},
+        {"**/x",                        "x",                                  true },
+        {"**/.*",                       "/.git",                              true },
+        {"**/.*",                       "pat.h/hidden.txt",                   false},
+        {".*",                          "path/.git",                          false},
+        {"some/**/*.js",                "some/foo.js",                        true },
+        {"some/**/*.js",                "some/folder/foo.js",                 true },
+        {"some/**/*.js",                "something/foo.js",                   false},
+        {"src/**",                      "src",                                true },
+        {"src/**",                      "src/a/b.h",                          true },
+        {"src/*",                       "src/a/b.h",                          true },
+        {"src/*.h",                     "src/a/b.h",                          false},
+        {"foo.[!0-9]",                  "foo.f",                              true },
+        {"foo.[!0-9]",                  "foo.5",                              false},
+        {R"(\{\*\})",                    "{*}",                                true },
+        {"proj/{build*,include,src}/*.{cc,cpp,h,hpp}", "proj/build-xxx/foo.cpp", true },
+        {"proj/{build*,include,src}/*.{cc,cpp,h,hpp}",
+         "proj/build-xxx/xxx/yyy/zzz/foo.cpp",
+         false},
+    };
+
+    for(auto& c: cases) {
+        auto pattern = GlobPattern::create(c.pattern);
+        ASSERT_TRUE(pattern.has_value());
+        auto backtracking = pattern->match(c.path);
+        ASSERT_EQ(backtracking, c.matched);
+        ASSERT_TRUE(pattern->compile());
+        ASSERT_TRUE(pattern->compiled());
+        ASSERT_EQ(pattern->match(c.path), c.matched);
+    }
+
+    // `?` and a `**` inside a segment keep backtracking.
+    auto any = GlobPattern::create("**/?*.cpp");
+    ASSERT_TRUE(any.has_value());
+    ASSERT_FALSE(any->compile());
+    auto partial = GlobPattern::create("src/a**b");
+    ASSERT_TRUE(partial.has_value());
+    ASSERT_FALSE(partial->compile());
+}
+
 };  // TEST_SUITE(GlobPattern)
 
+TEST_SUITE(GlobSet) {
+
+GlobPattern glob(llvm::StringRef pattern) {
+    auto result = GlobPattern::create(pattern);
+    assert(result.has_value());
+    return std::move(*result);
+}
+
+std::vector<std::uint32_t> match(const GlobSet& set, llvm::StringRef s) {
+    llvm::SmallVector<std::uint32_t> values;
+    set.match(s, values);
+    return {values.begin(), values.end()};
+}
+
+TEST_CASE(Match) {
+    GlobSet set;
+    set.add(glob("**/*.cpp"), 2);
+    set.add(glob("src/**"), 0);
+    set.add(glob("src/lib/*.h"), 1);
+    set.add(glob("src/**/*.cpp"), 2);
+    set.add(glob("tests/**"), 3);
+
+    using values = std::vector<std::uint32_t>;
+    ASSERT_EQ(match(set, "src/lib/a.cpp"), (values{0, 2}));
+    ASSERT_EQ(match(set, "src/lib/a.h"), (values{0, 1}));
+    ASSERT_EQ(match(set, "src/lib/sub/a.h"), (values{0}));
+    ASSERT_EQ(match(set, "tests/a.cpp"), (values{2, 3}));
+    ASSERT_EQ(match(set, "other/a.h"), values{});
+    ASSERT_EQ(match(set, "s"), values{});
+}
+
+TEST_CASE(Empty) {
+    GlobSet set;
+    ASSERT_TRUE(set.empty());
+    ASSERT_EQ(match(set, "a.cpp"), std::vector<std::uint32_t>{});
+
+    set.add(glob("*.cpp"), 0);
+    ASSERT_FALSE(set.empty());
+    set.clear();
+    ASSERT_TRUE(set.empty());
+    ASSERT_EQ(match(set, "a.cpp"), std::vector<std::uint32_t>{});
+}
+
+};  // TEST_SUITE(GlobSet)
+
 }  // namespace
 
 }  // namespace clice::testing
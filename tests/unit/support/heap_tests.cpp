@@ -0,0 +1,35 @@
+#include <memory>
+#include <vector>
+
+#include "test/test.h"
+#include "support/heap.h"
+
+namespace clice::testing {
+namespace {
+
+TEST_SUITE(Heap) {
+
+TEST_CASE(StatsAndTrim) {
+    auto before = heap::stats();
+    EXPECT_TRUE(before.in_use <= before.reserved);
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    for(int i = 0; i < 1024; ++i) {
+        blocks.push_back(std::make_unique<char[]>(1024));
+    }
+    auto held = heap::stats();
+#if defined(__GLIBC__)
+    EXPECT_TRUE(held.in_use >= before.in_use + 1024 * 1024);
+#endif
+
+    blocks.clear();
+    heap::trim();
+    auto after = heap::stats();
+    EXPECT_TRUE(after.in_use < held.in_use || held.in_use == 0);
+    EXPECT_TRUE(after.in_use <= after.reserved);
+}
+
+};  // TEST_SUITE(Heap)
+
+}  // namespace
+}  // namespace clice::testing
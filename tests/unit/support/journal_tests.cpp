@@ -0,0 +1,92 @@
+#include <string>
+#include <vector>
+
+#include "test/temp_dir.h"
+#include "test/test.h"
+#include "support/filesystem.h"
+#include "support/journal.h"
+
+namespace clice::testing {
+namespace {
+
+constexpr llvm::StringLiteral magic = "TST1";
+
+std::vector<std::string> replay(Journal& journal, llvm::StringRef content, bool& valid) {
+    std::vector<std::string> bodies;
+    valid = journal.replay(content, [&](const Journal::Record& record) {
+        bodies.push_back(std::to_string(record.op) + ":" + record.body.str());
+        return true;
+    });
+    return bodies;
+}
+
+TEST_SUITE(Journal) {
+
+TEST_CASE(AppendAndCompact) {
+    TempDir tmp;
+    auto path = tmp.path("journal.bin");
+    Journal journal{magic};
+
+    llvm::SmallVector<char, 0> out;
+    journal.reset(out);
+    Journal::write(out, 1, 0, "a");
+    Journal::write(out, 1, 0, "b");
+    ASSERT_TRUE(journal.should_compact(0, 0));
+    ASSERT_FALSE(journal.compact(path, tmp.path("journal.tmp"), llvm::toStringRef(out), 2));
+    EXPECT_EQ(journal.records, 2U);
+    EXPECT_FALSE(journal.rewrite);
+
+    out.clear();
+    Journal::write(out, 2, 0, "a");
+    ASSERT_FALSE(journal.should_compact(1, 1));
+    ASSERT_FALSE(journal.append(path, llvm::toStringRef(out), 1));
+    journal.check(path);
+    EXPECT_FALSE(journal.rewrite);
+
+    Journal loaded{magic};
+    bool valid = false;
+    auto bodies = replay(loaded, fs::read(path).value_or(""), valid);
+    ASSERT_TRUE(valid);
+    ASSERT_EQ(bodies.size(), 3U);
+    EXPECT_EQ(bodies[2], "2:a");
+    EXPECT_EQ(loaded.records, 3U);
+    EXPECT_FALSE(loaded.rewrite);
+
+    // Another writer appended since: the file is rewritten next time.
+    Journal::write(out, 1, 0, "c");
+    ASSERT_FALSE(loaded.append(path, llvm::toStringRef(out), 2));
+    journal.check(path);
+    EXPECT_TRUE(journal.rewrite);
+}
+
+TEST_CASE(TornTail) {
+    llvm::SmallVector<char, 0> out;
+    Journal journal{magic};
+    journal.reset(out);
+    Journal::write(out, 1, 0, "kept");
+    Journal::write(out, 1, 0, "torn");
+
+    bool valid = true;
+    auto content = llvm::toStringRef(out);
+    auto bodies = replay(journal, content.drop_back(1), valid);
+    EXPECT_FALSE(valid);
+    ASSERT_EQ(bodies.size(), 1U);
+    EXPECT_EQ(bodies[0], "1:kept");
+    EXPECT_TRUE(journal.rewrite);
+
+    // A flipped byte fails the checksum.
+    std::string corrupt = content.str();
+    corrupt.back() ^= 1;
+    bodies = replay(journal, corrupt, valid);
+    EXPECT_FALSE(valid);
+    EXPECT_EQ(bodies.size(), 1U);
+
+    bodies = replay(journal, "XXXX", valid);
+    EXPECT_FALSE(valid);
+    EXPECT_TRUE(bodies.empty());
+}
+
+};  // TEST_SUITE(Journal)
+
+}  // namespace
+}  // namespace clice::testing
@@ -380,6 +380,22 @@ TEST_CASE(BulletListRender) {
     ASSERT_EQ(l.as_plain_text(), expected_plain_text);
 }
 
+TEST_CASE(RenderIntoBuffer) {
+    Document d;
+    d.add_paragraph().append_text("foo");
+    d.add_ruler();
+    d.add_code_block("int x;");
+
+    // Appends, trimming only what it rendered.
+    std::string buffer = "  ";
+    d.render_markdown(buffer);
+    ASSERT_EQ(buffer, "  " + d.as_markdown());
+    buffer.clear();
+    d.render_plain_text(buffer);
+    ASSERT_EQ(buffer, d.as_plain_text());
+    ASSERT_EQ(buffer, "foo\n\nint x;");
+}
+
 };  // TEST_SUITE(Markup)
 
 }  // namespace
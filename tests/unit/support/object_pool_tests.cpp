@@ -0,0 +1,72 @@
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "test/test.h"
+#include "support/object_pool.h"
+
+namespace clice::testing {
+namespace {
+
+TEST_SUITE(ObjectPool) {
+
+TEST_CASE(ConcurrentStrings) {
+    ConcurrentStringSet strings;
+    EXPECT_EQ(strings.get(""), 0u);
+    EXPECT_EQ(strings.get(0u), "");
+
+    constexpr int threads = 4;
+    constexpr int per_thread = 2000;
+    std::vector<std::vector<const char*>> saved(threads);
+    std::vector<std::thread> workers;
+    for(int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            // Every thread saves the same strings, in a different order.
+            saved[t].resize(per_thread);
+            for(int i = 0; i < per_thread; ++i) {
+                auto n = (i + t * 500) % per_thread;
+                saved[t][n] = strings.save("-DMACRO_" + std::to_string(n)).data();
+            }
+        });
+    }
+    for(auto& worker: workers) {
+        worker.join();
+    }
+
+    for(int t = 1; t < threads; ++t) {
+        EXPECT_TRUE(saved[t] == saved[0]);
+    }
+    auto id = strings.find("-DMACRO_42");
+    ASSERT_NE(id, 0u);
+    EXPECT_EQ(strings.get(id).data(), saved[0][42]);
+    EXPECT_EQ(strings.find("-DMISSING"), 0u);
+}
+
+TEST_CASE(ConcurrentObjects) {
+    ConcurrentObjectSet<int> objects;
+    auto a = objects.save(1);
+    EXPECT_EQ(objects.save(1).ptr, a.ptr);
+    EXPECT_EQ(*a, 1);
+
+    // Removed while pinned: the slot is not reused until the pin ends.
+    {
+        auto guard = objects.pin();
+        objects.remove(a);
+        auto b = objects.save(2);
+        EXPECT_NE(b.ptr, a.ptr);
+        EXPECT_EQ(*a, 1);
+    }
+    auto c = objects.save(3);
+    EXPECT_EQ(c.ptr, a.ptr);
+    EXPECT_EQ(*c, 3);
+
+    int persisted = 0;
+    objects.save(4, [&](int& value, llvm::BumpPtrAllocator&) { persisted = value; });
+    objects.save(4, [&](int& value, llvm::BumpPtrAllocator&) { persisted = -1; });
+    EXPECT_EQ(persisted, 4);
+}
+
+};  // TEST_SUITE(ObjectPool)
+
+}  // namespace
+}  // namespace clice::testing
@@ -0,0 +1,117 @@
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "test/test.h"
+#include "support/path_pool.h"
+
+namespace clice::testing {
+namespace {
+
+TEST_SUITE(PathPool) {
+
+TEST_CASE(Intern) {
+    PathPool pool;
+    auto a = pool.intern("/src/a.cpp");
+    auto b = pool.intern("/src/b.cpp");
+    EXPECT_EQ(a, 0u);
+    EXPECT_EQ(b, 1u);
+    EXPECT_EQ(pool.intern("/src/a.cpp"), a);
+    EXPECT_EQ(pool.size(), 2u);
+
+    EXPECT_EQ(pool.resolve(b), "/src/b.cpp");
+    EXPECT_EQ(pool.resolve(b).data()[pool.resolve(b).size()], '\0');
+    EXPECT_EQ(pool.find("/src/b.cpp").value_or(~0u), b);
+    EXPECT_FALSE(pool.find("/src/c.cpp").has_value());
+
+    // Backslashes are the same separator.
+    EXPECT_EQ(pool.intern("\\src\\a.cpp"), a);
+    EXPECT_EQ(pool.find("\\src\\b.cpp").value_or(~0u), b);
+}
+
+TEST_CASE(Chunks) {
+    // Past the first chunks, earlier paths stay where they are.
+    PathPool pool;
+    auto first = pool.resolve(pool.intern("/src/0.h")).data();
+    for(int i = 1; i < 5000; ++i) {
+        EXPECT_EQ(pool.intern("/src/" + std::to_string(i) + ".h"), std::uint32_t(i));
+    }
+    EXPECT_EQ(pool.resolve(0).data(), first);
+    EXPECT_EQ(pool.resolve(1023), "/src/1023.h");
+    EXPECT_EQ(pool.resolve(1024), "/src/1024.h");
+    EXPECT_EQ(pool.resolve(4999), "/src/4999.h");
+}
+
+TEST_CASE(InternAll) {
+    PathPool pool;
+    auto known = pool.intern("/src/b.h");
+
+    std::vector<llvm::StringRef> paths{"/src/c.h", "/src/b.h", "/src/a.h", "/src/c.h"};
+    std::vector<std::uint32_t> ids(paths.size());
+    pool.intern_all(paths, ids);
+
+    // New paths are numbered in input order.
+    EXPECT_EQ(ids, (std::vector<std::uint32_t>{1, known, 2, 1}));
+    EXPECT_EQ(pool.size(), 3u);
+    EXPECT_EQ(pool.resolve(2), "/src/a.h");
+}
+
+TEST_CASE(Directories) {
+    PathPool pool;
+    auto a = pool.intern("/src/a.cpp");
+    auto header = pool.intern("/include/a.h");
+    auto b = pool.intern("\\src\\b.cpp");
+    auto nested = pool.intern("/src/detail/c.cpp");
+
+    EXPECT_EQ(pool.directory_of(a), pool.directory_of(b));
+    EXPECT_NE(pool.directory_of(a), pool.directory_of(header));
+    EXPECT_NE(pool.directory_of(a), pool.directory_of(nested));
+
+    // Numbered in the order first seen.
+    EXPECT_EQ(pool.directory_of(a), 0u);
+    EXPECT_EQ(pool.directory_of(header), 1u);
+    EXPECT_EQ(pool.directory_of(nested), 2u);
+
+    EXPECT_EQ(pool.directory(pool.directory_of(b)), "/src");
+    EXPECT_EQ(pool.directory(pool.directory_of(nested)), "/src/detail");
+    EXPECT_EQ(pool.find_directory("/include").value_or(~0u), pool.directory_of(header));
+    EXPECT_EQ(pool.find_directory("\\src").value_or(~0u), pool.directory_of(a));
+    EXPECT_FALSE(pool.find_directory("/src/a.cpp").has_value());
+}
+
+TEST_CASE(Concurrent) {
+    PathPool pool;
+    constexpr int threads = 4;
+    constexpr int per_thread = 2000;
+    std::vector<std::vector<std::uint32_t>> ids(threads);
+    std::vector<std::thread> workers;
+    for(int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            // Every thread interns the same paths, in a different order.
+            for(int i = 0; i < per_thread; ++i) {
+                auto n = (i + t * 500) % per_thread;
+                auto id = pool.intern("/src/" + std::to_string(n) + ".h");
+                ids[t].push_back(id);
+                pool.resolve(id);
+            }
+        });
+    }
+    for(auto& worker: workers) {
+        worker.join();
+    }
+
+    EXPECT_EQ(pool.size(), std::uint32_t(per_thread));
+    for(int n = 0; n < per_thread; ++n) {
+        auto path = "/src/" + std::to_string(n) + ".h";
+        auto id = pool.find(path);
+        ASSERT_TRUE(id.has_value());
+        EXPECT_EQ(pool.resolve(*id), path);
+        // Thread 0 went in order: all of them got the same IDs.
+        EXPECT_EQ(ids[0][n], *id);
+    }
+}
+
+};  // TEST_SUITE(PathPool)
+
+}  // namespace
+}  // namespace clice::testing
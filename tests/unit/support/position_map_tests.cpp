@@ -0,0 +1,69 @@
+#include <string>
+#include <vector>
+
+#include "test/test.h"
+#include "support/position_map.h"
+
+namespace clice::testing {
+
+namespace {
+
+using kota::ipc::lsp::PositionEncoding;
+
+/// Offsets on character boundaries, where both maps must agree.
+std::vector<std::uint32_t> boundaries(std::string_view text) {
+    std::vector<std::uint32_t> result;
+    for(std::uint32_t i = 0; i <= text.size(); ++i) {
+        if(i == text.size() || (static_cast<unsigned char>(text[i]) & 0xC0) != 0x80) {
+            result.push_back(i);
+        }
+    }
+    return result;
+}
+
+TEST_SUITE(PositionMap) {
+
+TEST_CASE(ASCII) {
+    EXPECT_TRUE(PositionMap::is_ascii(""));
+    EXPECT_TRUE(PositionMap::is_ascii("int main() { return 0; }\n"));
+    EXPECT_FALSE(PositionMap::is_ascii("int main() { return 0; } // \xC3\xA9"));
+    EXPECT_FALSE(PositionMap::is_ascii("\xC3\xA9"));
+
+    PositionMap map("int x;\nint y;\n");
+    auto position = map.to_position(11);
+    ASSERT_TRUE(position.has_value());
+    EXPECT_EQ(position->line, 1U);
+    EXPECT_EQ(position->character, 4U);
+    EXPECT_FALSE(map.to_position(15).has_value());
+}
+
+TEST_CASE(MatchesLineMap) {
+    std::string text = "int x; // caf\xC3\xA9\n"
+                       "\n"
+                       "auto s = \"\xE4\xB8\xAD\xE6\x96\x87\xF0\x9F\x98\x80!\";\n"
+                       "int y;\n"
+                       "\xF0\x9F\x98\x80\xF0\x9F\x98\x80 end";
+    auto offsets = boundaries(text);
+    for(auto encoding: {PositionEncoding::UTF8, PositionEncoding::UTF16, PositionEncoding::UTF32}) {
+        PositionMap map(text, encoding);
+        kota::ipc::lsp::LineMap expected(text, encoding);
+
+        // In order, then backwards, so the remembered line misses.
+        for(int pass = 0; pass < 2; ++pass) {
+            for(std::size_t i = 0; i < offsets.size(); ++i) {
+                auto offset = pass == 0 ? offsets[i] : offsets[offsets.size() - 1 - i];
+                auto actual = map.to_position(offset);
+                auto wanted = expected.to_position(offset);
+                ASSERT_TRUE(actual.has_value() && wanted.has_value());
+                EXPECT_EQ(actual->line, wanted->line);
+                EXPECT_EQ(actual->character, wanted->character);
+            }
+        }
+    }
+}
+
+};  // TEST_SUITE(PositionMap)
+
+}  // namespace
+
+}  // namespace clice::testing
@@ -0,0 +1,61 @@
+#include "test/test.h"
+#include "support/filesystem.h"
+#include "support/shared_blob.h"
+
+#include "llvm/Support/Process.h"
+
+namespace clice::testing {
+namespace {
+
+TEST_SUITE(SharedBlob) {
+
+TEST_CASE(InlinePayload) {
+    std::string data = "inline bytes";
+    shared_blob::Payload payload(data, "");
+    EXPECT_EQ(llvm::StringRef(payload.data(), payload.size()), "inline bytes");
+    EXPECT_FALSE(payload.empty());
+}
+
+TEST_CASE(OffloadKeepsSmallPayload) {
+    std::string data = "small";
+    std::string handle;
+    shared_blob::offload(data, handle);
+    EXPECT_EQ(data, "small");
+    EXPECT_TRUE(handle.empty());
+}
+
+TEST_CASE(TakeRejectsForeignPath) {
+    EXPECT_TRUE(shared_blob::take("/tmp/not-a-segment.blob") == nullptr);
+}
+
+#ifdef __linux__
+
+TEST_CASE(TakeMapsAndUnlinks) {
+    shared_blob::open_session();
+    auto dir = shared_blob::segment_dir(llvm::sys::Process::getProcessId());
+    if(!fs::is_directory(dir))
+        return;  // No /dev/shm in this environment.
+
+    auto segment = path::join(dir, "test.blob");
+    ASSERT_TRUE(fs::write(segment, "segment bytes").has_value());
+
+    {
+        shared_blob::Payload payload("", segment);
+        EXPECT_EQ(llvm::StringRef(payload.data(), payload.size()), "segment bytes");
+        EXPECT_FALSE(fs::exists(segment));
+    }
+
+    // A second take of the same handle finds nothing.
+    shared_blob::Payload again("", segment);
+    EXPECT_TRUE(again.empty());
+
+    shared_blob::close_session();
+    EXPECT_FALSE(fs::exists(dir));
+}
+
+#endif
+
+};  // TEST_SUITE(SharedBlob)
+
+}  // namespace
+}  // namespace clice::testing
@@ -0,0 +1,63 @@
+#include "test/test.h"
+#include "support/cgroup.h"
+#include "support/system_load.h"
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace clice::testing {
+namespace {
+
+TEST_SUITE(SystemLoad) {
+
+TEST_CASE(LoadAverage) {
+    auto load = system_load::load_average();
+#if defined(_WIN32)
+    EXPECT_FALSE(load.has_value());
+#else
+    ASSERT_TRUE(load.has_value());
+    EXPECT_TRUE(*load >= 0);
+#endif
+    // Unknown on most machines; it must not fail where it is.
+    (void)system_load::on_battery();
+}
+
+TEST_CASE(ScopedBackground) {
+#if defined(__linux__)
+    auto before = ::syscall(SYS_ioprio_get, 1, 0);
+    {
+        system_load::ScopedBackground background;
+        auto lowered = ::syscall(SYS_ioprio_get, 1, 0);
+        if(before >= 0) {
+            EXPECT_EQ(lowered, (2 << 13) | 7);
+        }
+    }
+    EXPECT_EQ(::syscall(SYS_ioprio_get, 1, 0), before);
+#else
+    system_load::ScopedBackground background;
+#endif
+}
+
+TEST_CASE(Affinity) {
+    auto cpus = system_load::allowed_cpus();
+#if defined(__linux__)
+    ASSERT_FALSE(cpus.empty());
+    // Pinning to the current set changes nothing, but goes through.
+    EXPECT_TRUE(system_load::set_affinity(::getpid(), cpus));
+    EXPECT_EQ(system_load::allowed_cpus(), cpus);
+#else
+    EXPECT_TRUE(cpus.empty());
+#endif
+    EXPECT_FALSE(system_load::set_affinity(0, {}));
+}
+
+TEST_CASE(CgroupTree) {
+    EXPECT_FALSE(cgroup::Tree::open("/nonexistent/clice").has_value());
+}
+
+};  // TEST_SUITE(SystemLoad)
+
+}  // namespace
+}  // namespace clice::testing
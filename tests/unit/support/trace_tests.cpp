@@ -0,0 +1,54 @@
+#include <format>
+
+#include "test/temp_dir.h"
+#include "test/test.h"
+#include "support/trace.h"
+
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Process.h"
+
+namespace clice::testing {
+namespace {
+
+TEST_SUITE(Trace) {
+
+TEST_CASE(Spans) {
+    TempDir tmp;
+    EXPECT_FALSE(trace::enabled());
+    { trace::Span ignored("Ignored"); }
+
+    ASSERT_TRUE(trace::start(tmp.path("traces"), "SL-0", 1000));
+    EXPECT_TRUE(trace::enabled());
+    {
+        trace::Span span("Compile", "/src/\"a\".cpp");
+    }
+    trace::span("Merge", "", 10, 20);
+    trace::stop();
+    EXPECT_FALSE(trace::enabled());
+
+    auto pid = llvm::sys::Process::getProcessId();
+    auto file = tmp.path(std::format("traces/SL-0-{}.trace.json", pid));
+    auto buffer = llvm::MemoryBuffer::getFile(file);
+    ASSERT_TRUE(bool(buffer));
+    auto text = (*buffer)->getBuffer();
+
+    EXPECT_TRUE(text.starts_with("[\n"));
+    EXPECT_TRUE(text.ends_with("\n]\n"));
+    EXPECT_TRUE(text.contains(R"("name":"process_name")"));
+    EXPECT_TRUE(text.contains(R"("args":{"name":"SL-0"})"));
+    EXPECT_FALSE(text.contains("Ignored"));
+
+    // Escaped, and only on the begin event.
+    EXPECT_EQ(text.count(R"("detail":"/src/\"a\".cpp")"), 1u);
+    EXPECT_EQ(text.count(R"("ph":"b")"), 2u);
+    EXPECT_EQ(text.count(R"("ph":"e")"), 2u);
+
+    // On the master's clock.
+    EXPECT_TRUE(text.contains(R"("ts":1010,"name":"Merge")"));
+    EXPECT_TRUE(text.contains(R"("ts":1020,"name":"Merge")"));
+}
+
+};  // TEST_SUITE(Trace)
+
+}  // namespace
+}  // namespace clice::testing
@@ -0,0 +1,43 @@
+#include <memory>
+#include <vector>
+
+#include "test/test.h"
+#include "support/usage.h"
+
+namespace clice::testing {
+namespace {
+
+TEST_SUITE(Usage) {
+
+TEST_CASE(Meter) {
+    usage::Sample total;
+    {
+        usage::Meter meter(total);
+        std::vector<std::unique_ptr<int>> blocks;
+        for(int i = 0; i < 1000; ++i) {
+            blocks.push_back(std::make_unique<int>(i));
+        }
+        // Burn enough CPU for the thread clock to advance.
+        volatile std::uint64_t sum = 0;
+        for(std::uint64_t i = 0; i < 50'000'000; ++i) {
+            sum = sum + i;
+        }
+    }
+    EXPECT_TRUE(total.cpu_us > 0);
+    if(usage::counts_allocations()) {
+        EXPECT_TRUE(total.allocations >= 1000);
+        EXPECT_TRUE(total.allocated_bytes >= 1000 * sizeof(int));
+    } else {
+        EXPECT_EQ(total.allocations, 0U);
+    }
+
+    // Nothing is allocated between the two readings.
+    auto before = usage::thread_usage();
+    auto after = usage::thread_usage();
+    EXPECT_EQ((after - before).allocations, 0U);
+}
+
+};  // TEST_SUITE(Usage)
+
+}  // namespace
+}  // namespace clice::testing
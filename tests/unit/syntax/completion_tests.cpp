@@ -1,5 +1,7 @@
+#include "test/temp_dir.h"
 #include "test/test.h"
 #include "syntax/completion.h"
+#include "syntax/include_resolver.h"
 
 #include "llvm/ADT/DenseMap.h"
 
@@ -121,5 +123,76 @@ TEST_CASE(EmptyModules) {
 
 };  // TEST_SUITE(CompleteModuleImport)
 
+TEST_SUITE(CompleteIncludePath) {
+
+std::vector<std::string> labels(const std::vector<IncludeCandidate>& candidates) {
+    std::vector<std::string> result;
+    for(auto& candidate: candidates) {
+        result.push_back(candidate.is_directory ? candidate.name + "/" : candidate.name);
+    }
+    return result;
+}
+
+TEST_CASE(SortedAcrossDirs) {
+    TempDir tmp;
+    tmp.touch("quoted/abc_local.h");
+    tmp.touch("first/abc.h");
+    tmp.touch("first/abz/inner.h");
+    tmp.touch("second/abc.h");
+    tmp.touch("second/abd.h");
+    tmp.touch("second/xyz.h");
+
+    SearchConfig config;
+    config.dirs.push_back({tmp.path("quoted")});
+    config.dirs.push_back({tmp.path("first")});
+    config.dirs.push_back({tmp.path("second")});
+    config.angled_start_idx = 1;
+
+    DirListingCache dir_cache;
+    auto resolved = resolve_search_config(config, dir_cache);
+
+    IncludeCompletionIndex index;
+    auto angled = labels(index.complete(resolved, "ab", true, dir_cache));
+    EXPECT_EQ(angled, (std::vector<std::string>{"abc.h", "abd.h", "abz/"}));
+
+    auto quoted = labels(index.complete(resolved, "ab", false, dir_cache));
+    EXPECT_EQ(quoted, (std::vector<std::string>{"abc.h", "abc_local.h", "abd.h", "abz/"}));
+
+    auto inner = labels(index.complete(resolved, "abz/in", true, dir_cache));
+    EXPECT_EQ(inner, (std::vector<std::string>{"inner.h"}));
+    EXPECT_EQ(index.size(), 3U);
+
+    // The same query is answered from its table.
+    EXPECT_EQ(labels(index.complete(resolved, "ab", true, dir_cache)), angled);
+    EXPECT_EQ(index.size(), 3U);
+}
+
+TEST_CASE(RebuiltWhenListed) {
+    TempDir tmp;
+    tmp.touch("include/alpha.h");
+
+    SearchConfig config;
+    config.dirs.push_back({tmp.path("include")});
+
+    DirListingCache dir_cache;
+    auto resolved = resolve_search_config(config, dir_cache);
+
+    IncludeCompletionIndex index;
+    EXPECT_EQ(index.complete(resolved, "al", true, dir_cache).size(), 1U);
+
+    // A header added after the listing shows once the directory is listed
+    // again.
+    tmp.touch("include/algo.h");
+    EXPECT_EQ(index.complete(resolved, "al", true, dir_cache).size(), 1U);
+
+    dir_cache.dirs.erase(tmp.path("include"));
+    dir_cache.mtimes.erase(tmp.path("include"));
+    resolved = resolve_search_config(config, dir_cache);
+    auto names = labels(index.complete(resolved, "al", true, dir_cache));
+    EXPECT_EQ(names, (std::vector<std::string>{"algo.h", "alpha.h"}));
+}
+
+};  // TEST_SUITE(CompleteIncludePath)
+
 }  // namespace
 }  // namespace clice::testing
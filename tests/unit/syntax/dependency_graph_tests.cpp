@@ -1,3 +1,8 @@
+#include <chrono>
+#include <filesystem>
+#include <format>
+#include <vector>
+
 #include "test/cdb_helper.h"
 #include "test/temp_dir.h"
 #include "test/test.h"
@@ -184,6 +189,180 @@ TEST_CASE(EmptyIncludes) {
     EXPECT_EQ(graph.edge_count(), 0u);
 }
 
+TEST_CASE(UpdateIncludes) {
+    clice::DependencyGraph graph;
+    graph.set_includes(1, 0, {10, 20});
+    graph.set_includes(1, 1, {20});
+    graph.set_includes(2, 0, {10});
+    graph.build_reverse_map();
+
+    // 20 stays reachable through config 1, so only 10 is removed.
+    auto changes = graph.update_includes(1, [](std::uint32_t config_id) {
+        if(config_id == 0) {
+            return llvm::SmallVector<std::uint32_t>{30 | DependencyGraph::CONDITIONAL_FLAG};
+        }
+        return llvm::SmallVector<std::uint32_t>{20};
+    });
+    ASSERT_EQ(changes.added.size(), 1u);
+    EXPECT_EQ(changes.added[0], 30u);
+    ASSERT_EQ(changes.removed.size(), 1u);
+    EXPECT_EQ(changes.removed[0], 10u);
+
+    ASSERT_EQ(graph.get_includers(10).size(), 1u);
+    EXPECT_EQ(graph.get_includers(10)[0], 2u);
+    ASSERT_EQ(graph.get_includers(20).size(), 1u);
+    ASSERT_EQ(graph.get_includers(30).size(), 1u);
+    EXPECT_EQ(graph.get_includers(30)[0], 1u);
+    EXPECT_EQ(graph.get_includes(1, 0)[0], 30u | DependencyGraph::CONDITIONAL_FLAG);
+
+    // A file the graph has no entries for is left alone.
+    changes = graph.update_includes(3, [](std::uint32_t) {
+        return llvm::SmallVector<std::uint32_t>{10};
+    });
+    EXPECT_TRUE(changes.added.empty());
+    EXPECT_EQ(graph.file_count(), 2u);
+}
+
+TEST_CASE(HostSourcesMemoized) {
+    // 1 -> 10 -> 20, 2 -> 20, 3 -> 30.
+    clice::DependencyGraph graph;
+    graph.set_includes(1, 0, {10});
+    graph.set_includes(10, 0, {20});
+    graph.set_includes(2, 0, {20});
+    graph.set_includes(3, 0, {30});
+    graph.build_reverse_map();
+
+    using Ids = std::vector<std::uint32_t>;
+    auto hosts = [&](std::uint32_t header) {
+        auto found = graph.find_host_sources(header);
+        Ids ids(found.begin(), found.end());
+        llvm::sort(ids);
+        return ids;
+    };
+
+    EXPECT_EQ(hosts(20), (Ids{1, 2}));
+    EXPECT_EQ(graph.find_host_sources(30).size(), 1u);
+    EXPECT_EQ(graph.find_include_chain(1, 20), (Ids{1, 10, 20}));
+
+    // 3 now includes 20 as well, which changes the hosts of 20 but not
+    // those of 30.
+    auto set = [&](std::uint32_t file, llvm::SmallVector<std::uint32_t> ids) {
+        graph.update_includes(file, [&](std::uint32_t) { return ids; });
+    };
+    set(3, {30, 20});
+    EXPECT_EQ(hosts(20), (Ids{1, 2, 3}));
+    EXPECT_EQ(graph.find_host_sources(30).size(), 1u);
+
+    // A shorter chain replaces the memoized one.
+    set(1, {10, 20});
+    EXPECT_EQ(graph.find_include_chain(1, 20), (Ids{1, 20}));
+
+    // And a removed edge drops a chain through it.
+    set(1, {10});
+    set(10, {});
+    EXPECT_TRUE(graph.find_include_chain(1, 20).empty());
+    EXPECT_EQ(hosts(20), (Ids{2, 3}));
+}
+
+TEST_CASE(DependentSets) {
+    // 1 -> 10 -> 20, 2 -> 20.
+    clice::DependencyGraph graph;
+    graph.set_includes(1, 0, {10});
+    graph.set_includes(10, 0, {20});
+    graph.set_includes(2, 0, {20});
+    graph.build_reverse_map();
+
+    auto& hosts = graph.host_set(20);
+    EXPECT_EQ(hosts.cardinality(), 2u);
+    EXPECT_TRUE(hosts.contains(1));
+    EXPECT_TRUE(hosts.contains(2));
+
+    auto& dependents = graph.dependents(20);
+    EXPECT_EQ(dependents.cardinality(), 4u);
+    EXPECT_TRUE(dependents.contains(10));
+    EXPECT_TRUE(dependents.contains(20));
+
+    // An edit invalidates both.
+    graph.update_includes(2, [](std::uint32_t) { return llvm::SmallVector<std::uint32_t>{}; });
+    EXPECT_EQ(graph.host_set(20).cardinality(), 1u);
+    EXPECT_FALSE(graph.dependents(20).contains(2));
+}
+
+TEST_CASE(FirstHostSources) {
+    clice::DependencyGraph graph;
+    for(std::uint32_t source = 1; source <= 5; ++source) {
+        graph.set_includes(source, 0, {100});
+    }
+    graph.build_reverse_map();
+
+    // The bounded search returns a prefix of the full list, whether or
+    // not the full list is memoized yet.
+    auto first = graph.find_host_sources(100, 2);
+    ASSERT_EQ(first.size(), 2u);
+    auto all = graph.find_host_sources(100);
+    ASSERT_EQ(all.size(), 5u);
+    EXPECT_EQ(first[0], all[0]);
+    EXPECT_EQ(first[1], all[1]);
+    auto again = graph.find_host_sources(100, 2);
+    ASSERT_EQ(again.size(), 2u);
+    EXPECT_EQ(again[0], first[0]);
+    EXPECT_EQ(again[1], first[1]);
+    EXPECT_EQ(graph.find_host_sources(100, 10).size(), 5u);
+}
+
+TEST_CASE(PackedAfterUpdates) {
+    // Enough edited files to fold the edits back into the packed rows.
+    constexpr std::uint32_t files = 10000;
+    clice::DependencyGraph graph;
+    for(std::uint32_t source = 1; source <= files; ++source) {
+        graph.set_includes(source, 0, {100000});
+    }
+    graph.build_reverse_map();
+    EXPECT_EQ(graph.get_includers(100000).size(), std::size_t(files));
+
+    for(std::uint32_t source = 1; source <= files; source += 2) {
+        graph.update_includes(source, [&](std::uint32_t) {
+            return llvm::SmallVector<std::uint32_t>{100000 + source};
+        });
+    }
+    auto includers = graph.get_includers(100000);
+    ASSERT_EQ(includers.size(), std::size_t(files / 2));
+    EXPECT_TRUE(llvm::is_sorted(includers));
+    EXPECT_EQ(includers[0], 2u);
+    ASSERT_EQ(graph.get_includers(100001).size(), 1u);
+    EXPECT_EQ(graph.get_includers(100001)[0], 1u);
+    EXPECT_EQ(graph.find_include_chain(files - 1, 100000 + files - 1),
+              (std::vector<std::uint32_t>{files - 1, 100000 + files - 1}));
+    EXPECT_TRUE(graph.get_includers(200000).empty());
+}
+
+TEST_CASE(PatchReverseMap) {
+    clice::DependencyGraph graph;
+    graph.set_includes(1, 0, {10});
+    graph.build_reverse_map();
+
+    // A later batch adds files and extends one already packed.
+    graph.set_includes(2, 0, {10, 20});
+    graph.set_includes(20, 0, {30});
+    graph.set_includes(1, 1, {30});
+    graph.patch_reverse_map();
+
+    ASSERT_EQ(graph.get_includers(10).size(), 2u);
+    EXPECT_EQ(graph.get_includers(10)[0], 1u);
+    EXPECT_EQ(graph.get_includers(10)[1], 2u);
+    ASSERT_EQ(graph.get_includers(20).size(), 1u);
+    EXPECT_EQ(graph.get_includers(20)[0], 2u);
+    ASSERT_EQ(graph.get_includers(30).size(), 2u);
+    EXPECT_EQ(graph.get_includers(30)[0], 1u);
+    EXPECT_EQ(graph.get_includers(30)[1], 20u);
+
+    auto hosts = graph.find_host_sources(30);
+    llvm::sort(hosts);
+    ASSERT_EQ(hosts.size(), 2u);
+    EXPECT_EQ(hosts[0], 1u);
+    EXPECT_EQ(hosts[1], 2u);
+}
+
 };  // TEST_SUITE(DependencyGraph)
 
 // ============================================================================
@@ -331,7 +510,7 @@ TEST_CASE(ConditionalIncludes) {
     // Verify conditional flag.
     bool found_unconditional = false;
     bool found_conditional = false;
-    auto includes = graph.get_includes(pool.cache[tmp.path("src/main.cpp")], 0);
+    auto includes = graph.get_includes(*pool.find(tmp.path("src/main.cpp")), 0);
     for(auto id: includes) {
         if(id & DependencyGraph::CONDITIONAL_FLAG) {
             found_conditional = true;
@@ -556,6 +735,92 @@ export int value() { return util; }
     EXPECT_GE(graph.edge_count(), 1u);
 }
 
+TEST_CASE(ParallelResolve) {
+    // Enough source files for the wave to be resolved in several chunks.
+    constexpr std::size_t file_count = 256;
+
+    TempDir tmp;
+    tmp.touch("inc/shared.h", R"(int shared = 1;)");
+
+    std::vector<std::string> inc = {"-I", tmp.path("inc")};
+    std::vector<CDBEntry> entries;
+    for(std::size_t i = 0; i < file_count; ++i) {
+        auto name = std::format("src/dir{}/file{}.cpp", i % 8, i);
+        tmp.touch(std::format("src/dir{}/own{}.h", i % 8, i), "");
+        tmp.touch(name, std::format(R"(
+#include <shared.h>
+#include "own{}.h"
+#include <missing.h>
+)",
+                                    i));
+        entries.push_back({tmp.root, tmp.path(name), inc});
+    }
+
+    CompilationDatabase cdb;
+    PathPool pool;
+    DependencyGraph graph;
+    write_cdb(tmp, cdb, build_cdb_json(entries));
+    Toolchain tc;
+    auto report = scan_dependency_graph(cdb, tc, pool, graph);
+
+    EXPECT_EQ(report.includes_resolved, 2 * file_count);
+    EXPECT_EQ(report.unresolved.size(), file_count);
+    EXPECT_EQ(graph.edge_count(), 2 * file_count);
+
+    // Edges resolved in different chunks all point at the one id the
+    // shared header is interned as.
+    auto shared_id = pool.find(tmp.path("inc/shared.h"));
+    ASSERT_TRUE(shared_id.has_value());
+    for(std::size_t i = 0; i < file_count; ++i) {
+        auto file_id = pool.find(tmp.path(std::format("src/dir{}/file{}.cpp", i % 8, i)));
+        ASSERT_TRUE(file_id.has_value());
+        auto includes = graph.get_all_includes(*file_id);
+        EXPECT_EQ(includes.size(), 2u);
+        EXPECT_TRUE(llvm::is_contained(includes, *shared_id));
+    }
+}
+
+TEST_CASE(SharedSearchPrefix) {
+    TempDir tmp;
+    tmp.touch("inc1/a.h", "");
+    tmp.touch("inc2/b.h", "");
+    tmp.touch("inc3/c.h", "");
+    auto source = R"(
+#include <a.h>
+#include <c.h>
+)";
+    tmp.touch("src/base.cpp", source);
+    tmp.touch("src/extended.cpp", source);
+
+    CompilationDatabase cdb;
+    PathPool pool;
+    DependencyGraph graph;
+
+    // The configs differ only in a trailing -I, so the one resolved second
+    // finds <a.h> through the search prefix the two share.
+    std::vector<std::string> base = {"-I", tmp.path("inc1"), "-I", tmp.path("inc2")};
+    auto extended = base;
+    extended.insert(extended.end(), {"-I", tmp.path("inc3")});
+    auto json = build_cdb_json({
+        {tmp.root, tmp.path("src/base.cpp"),     base    },
+        {tmp.root, tmp.path("src/extended.cpp"), extended},
+    });
+    write_cdb(tmp, cdb, json);
+    Toolchain tc;
+    auto report = scan_dependency_graph(cdb, tc, pool, graph);
+
+    EXPECT_GE(report.include_cache_hits, 1u);
+    EXPECT_EQ(report.unresolved.size(), 1u);
+    EXPECT_EQ(graph.edge_count(), 3u);
+
+    auto base_id = pool.find(tmp.path("src/base.cpp"));
+    auto extended_id = pool.find(tmp.path("src/extended.cpp"));
+    ASSERT_TRUE(base_id.has_value());
+    ASSERT_TRUE(extended_id.has_value());
+    EXPECT_EQ(graph.get_all_includes(*base_id).size(), 1u);
+    EXPECT_EQ(graph.get_all_includes(*extended_id).size(), 2u);
+}
+
 TEST_CASE(ScanCacheWarmRun) {
     TempDir tmp;
     tmp.touch("inc/util.h", R"(int util = 1;)");
@@ -587,6 +852,268 @@ int main() {}
     EXPECT_EQ(graph2.file_count(), graph.file_count());
 }
 
+TEST_CASE(ScanCacheValidatesStamps) {
+    TempDir tmp;
+    tmp.touch("inc/util.h", R"(int util = 1;)");
+    tmp.touch("inc/extra.h", "");
+    tmp.touch("src/main.cpp", R"(#include "util.h")");
+
+    CompilationDatabase cdb;
+    PathPool pool;
+    ScanCache cache;
+    Toolchain tc;
+
+    auto json = build_cdb_json({
+        {tmp.root, tmp.path("src/main.cpp"), {"-I", tmp.path("inc")}}
+    });
+    write_cdb(tmp, cdb, json);
+
+    DependencyGraph graph;
+    scan_dependency_graph(cdb, tc, pool, graph, &cache);
+    auto util = pool.find(tmp.path("inc/util.h"));
+    ASSERT_TRUE(util.has_value());
+    EXPECT_TRUE(graph.get_all_includes(*util).empty());
+
+    // Rewritten with the same content: reused without lexing.
+    tmp.touch("src/main.cpp", R"(#include "util.h")");
+    DependencyGraph same;
+    auto unchanged = scan_dependency_graph(cdb, tc, pool, same, &cache);
+    EXPECT_EQ(unchanged.scan_cache_hits, 2u);
+    EXPECT_EQ(same.edge_count(), graph.edge_count());
+
+    // Changed behind the cache's back: rescanned without invalidation.
+    tmp.touch("inc/util.h", R"(#include "extra.h")");
+    DependencyGraph changed;
+    auto rescanned = scan_dependency_graph(cdb, tc, pool, changed, &cache);
+    EXPECT_EQ(rescanned.scan_cache_hits, 1u);
+    EXPECT_EQ(changed.get_all_includes(*util).size(), 1u);
+}
+
+TEST_CASE(ScanCacheRemembersMisses) {
+    TempDir tmp;
+    tmp.touch("inc/util.h", "");
+    tmp.touch("src/main.cpp", R"(
+#include <util.h>
+#include <generated.h>
+)");
+
+    CompilationDatabase cdb;
+    PathPool pool;
+    ScanCache cache;
+    Toolchain tc;
+
+    auto json = build_cdb_json({
+        {tmp.root, tmp.path("src/main.cpp"), {"-I", tmp.path("inc")}}
+    });
+    write_cdb(tmp, cdb, json);
+
+    DependencyGraph cold;
+    auto first = scan_dependency_graph(cdb, tc, pool, cold, &cache);
+    EXPECT_EQ(first.unresolved.size(), 1u);
+    EXPECT_EQ(first.include_negative_hits, 0u);
+
+    // The miss is remembered rather than searched for again.
+    DependencyGraph warm;
+    auto second = scan_dependency_graph(cdb, tc, pool, warm, &cache);
+    EXPECT_EQ(second.unresolved.size(), 1u);
+    EXPECT_EQ(second.include_negative_hits, 1u);
+    EXPECT_EQ(second.dirs_changed, 0u);
+
+    // Until the header appears in a directory it was searched in.  The
+    // directory's mtime is moved ahead explicitly: a coarse clock may give
+    // the new entry the listing's timestamp.
+    tmp.touch("inc/generated.h", "");
+    std::filesystem::last_write_time(tmp.path("inc"),
+                                     std::filesystem::file_time_type::clock::now() +
+                                         std::chrono::minutes(1));
+    DependencyGraph built;
+    auto third = scan_dependency_graph(cdb, tc, pool, built, &cache);
+    EXPECT_EQ(third.dirs_changed, 1u);
+    EXPECT_TRUE(third.unresolved.empty());
+    EXPECT_EQ(third.include_negative_hits, 0u);
+    EXPECT_EQ(built.edge_count(), 2u);
+}
+
+TEST_CASE(ScanSourcesInParts) {
+    TempDir tmp;
+    tmp.touch("inc/common.h", "");
+    tmp.touch("inc/only_b.h", "");
+    tmp.touch("src/a.cpp", R"(#include "common.h")");
+    tmp.touch("src/b.cpp", R"(
+#include "common.h"
+#include "only_b.h"
+)");
+
+    CompilationDatabase cdb;
+    PathPool pool;
+    ScanCache cache;
+    Toolchain tc;
+
+    auto json = build_cdb_json({
+        {tmp.root, tmp.path("src/a.cpp"), {"-I", tmp.path("inc")}},
+        {tmp.root, tmp.path("src/b.cpp"), {"-I", tmp.path("inc")}},
+    });
+    write_cdb(tmp, cdb, json);
+
+    auto a = pool.intern(tmp.path("src/a.cpp"));
+    auto b = pool.intern(tmp.path("src/b.cpp"));
+
+    DependencyGraph graph;
+    auto first = scan_dependency_sources(cdb, tc, pool, graph, cache, {a});
+    EXPECT_EQ(first.source_files, 1u);
+    EXPECT_EQ(graph.get_all_includes(a).size(), 1u);
+    EXPECT_TRUE(graph.get_all_includes(b).empty());
+    EXPECT_FALSE(pool.find(tmp.path("inc/only_b.h")).has_value());
+
+    // The second part adds its edges and keeps those of the first.
+    auto second = scan_dependency_sources(cdb, tc, pool, graph, cache, {b});
+    EXPECT_EQ(second.source_files, 1u);
+    EXPECT_EQ(graph.get_all_includes(a).size(), 1u);
+    EXPECT_EQ(graph.get_all_includes(b).size(), 2u);
+
+    DependencyGraph full;
+    scan_dependency_graph(cdb, tc, pool, full);
+    EXPECT_EQ(graph.edge_count(), full.edge_count());
+
+    graph.build_reverse_map();
+    auto common = pool.find(tmp.path("inc/common.h"));
+    ASSERT_TRUE(common.has_value());
+    EXPECT_EQ(graph.find_host_sources(*common).size(), 2u);
+}
+
+TEST_CASE(UpdateFileIncludes) {
+    TempDir tmp;
+    tmp.touch("inc/a.h", R"(int a = 1;)");
+    tmp.touch("inc/b.h", R"(
+#include "c.h"
+int b = c;
+)");
+    tmp.touch("inc/c.h", R"(int c = 2;)");
+    tmp.touch("src/main.cpp", R"(
+#include "a.h"
+int main() { return a; }
+)");
+
+    CompilationDatabase cdb;
+    PathPool pool;
+    ScanCache cache;
+    Toolchain tc;
+
+    auto json = build_cdb_json({
+        {tmp.root, tmp.path("src/main.cpp"), {"-I", tmp.path("inc")}}
+    });
+    write_cdb(tmp, cdb, json);
+
+    DependencyGraph graph;
+    scan_dependency_graph(cdb, tc, pool, graph, &cache);
+    graph.build_reverse_map();
+
+    auto main_id = pool.intern(tmp.path("src/main.cpp"));
+    auto a_id = pool.intern(tmp.path("inc/a.h"));
+    auto b_id = pool.intern(tmp.path("inc/b.h"));
+    ASSERT_EQ(graph.get_includers(a_id).size(), 1u);
+
+    // The saved file now includes b.h instead, and a header created next to
+    // it since the scan.
+    tmp.touch("src/local.h", R"(int l = 3;)");
+    auto result = scan(R"(
+#include "b.h"
+#include "local.h"
+int main() { return b + l; }
+)");
+    auto changes = update_file_includes(graph, pool, cache, main_id, result);
+    auto local_id = pool.intern(tmp.path("src/local.h"));
+
+    ASSERT_EQ(changes.removed.size(), 1u);
+    EXPECT_EQ(changes.removed[0], a_id);
+    ASSERT_EQ(changes.added.size(), 2u);
+    EXPECT_TRUE(llvm::is_contained(changes.added, b_id));
+    EXPECT_TRUE(llvm::is_contained(changes.added, local_id));
+    EXPECT_TRUE(graph.get_includers(a_id).empty());
+    ASSERT_EQ(graph.get_includers(b_id).size(), 1u);
+    EXPECT_EQ(graph.get_includers(b_id)[0], main_id);
+
+    // b.h was never reached by the scan; it is scanned now, with what it
+    // includes in turn.
+    auto c_id = pool.intern(tmp.path("inc/c.h"));
+    ASSERT_EQ(graph.get_includers(c_id).size(), 1u);
+    EXPECT_EQ(graph.get_includers(c_id)[0], b_id);
+    auto hosts = graph.find_host_sources(c_id);
+    ASSERT_EQ(hosts.size(), 1u);
+    EXPECT_EQ(hosts[0], main_id);
+}
+
+TEST_CASE(SnapshotRoundTrip) {
+    TempDir tmp;
+    tmp.touch("inc/header.h", R"(int x = 1;)");
+    tmp.touch("src/main.cpp", R"(
+#include "header.h"
+#include <sys/generated.h>
+int main() { return x; }
+)");
+
+    CompilationDatabase cdb;
+    PathPool pool;
+    ScanCache cache;
+    Toolchain tc;
+
+    auto json = build_cdb_json({
+        {tmp.root, tmp.path("src/main.cpp"), {"-I", tmp.path("inc")}}
+    });
+    write_cdb(tmp, cdb, json);
+
+    DependencyGraph graph;
+    scan_dependency_graph(cdb, tc, pool, graph, &cache);
+    ASSERT_GE(graph.edge_count(), 1u);
+
+    // Scanned after every touch: the snapshot is current and restores the
+    // graph, into a fresh pool.
+    auto later = std::chrono::system_clock::now() + std::chrono::hours(1);
+    auto snapshot = save_scan_snapshot(pool, graph, cache, later);
+    ASSERT_FALSE(snapshot.empty());
+
+    PathPool restored_pool;
+    DependencyGraph restored;
+    ScanCache restored_cache;
+    auto changed = load_scan_snapshot(snapshot, restored_pool, restored, restored_cache);
+    ASSERT_TRUE(changed.has_value());
+    EXPECT_EQ(*changed, 0u);
+    EXPECT_EQ(restored.file_count(), graph.file_count());
+    EXPECT_EQ(restored.edge_count(), graph.edge_count());
+
+    auto main_id = restored_pool.find(tmp.path("src/main.cpp"));
+    auto header_id = restored_pool.find(tmp.path("inc/header.h"));
+    ASSERT_TRUE(main_id.has_value());
+    ASSERT_TRUE(header_id.has_value());
+    auto includes = restored.get_all_includes(*main_id);
+    ASSERT_EQ(includes.size(), 1u);
+    EXPECT_EQ(includes[0] & DependencyGraph::PATH_ID_MASK, *header_id);
+
+    // Scanned before every touch: nothing is current, the graph stays empty
+    // and the rescan gets the configs and the stamped scan results back.
+    auto earlier = std::chrono::system_clock::time_point(std::chrono::seconds(1));
+    auto stale = save_scan_snapshot(pool, graph, cache, earlier);
+    DependencyGraph untouched;
+    ScanCache seeded;
+    changed = load_scan_snapshot(stale, restored_pool, untouched, seeded);
+    ASSERT_TRUE(changed.has_value());
+    EXPECT_GT(*changed, 0u);
+    EXPECT_EQ(untouched.file_count(), 0u);
+    EXPECT_EQ(seeded.scan_results.size(), cache.scan_results.size());
+    EXPECT_EQ(seeded.configs.size(), cache.configs.size());
+
+    EXPECT_FALSE(load_scan_snapshot("not json", restored_pool, untouched, seeded).has_value());
+
+    // A subdirectory an include looks in appears under a search dir.
+    tmp.touch("inc/sys/generated.h", R"(int g = 1;)");
+    DependencyGraph fresh;
+    ScanCache fresh_cache;
+    changed = load_scan_snapshot(snapshot, restored_pool, fresh, fresh_cache);
+    ASSERT_TRUE(changed.has_value());
+    EXPECT_GT(*changed, 0u);
+    EXPECT_EQ(fresh.file_count(), 0u);
+}
+
 // TODO: add tests for:
 // - Circular includes (A→B→A) to verify BFS terminates correctly
 // - get_all_includes flag merge: same header conditional in one config,
@@ -175,6 +175,36 @@ TEST_CASE(ResolveNotFound) {
     EXPECT_FALSE(result.has_value());
 }
 
+TEST_CASE(SearchChainsSharePrefix) {
+    SearchConfig base;
+    base.dirs = {{"/quoted"}, {"/a"}, {"/b"}};
+    base.angled_start_idx = 1;
+
+    // Differs only in a trailing dir; its quoted dirs do not matter.
+    SearchConfig extended;
+    extended.dirs = {{"/a"}, {"/b"}, {"/c"}};
+    extended.angled_start_idx = 0;
+
+    SearchConfig other;
+    other.dirs = {{"/b"}};
+
+    SearchChains chains;
+    auto base_node = chains.intern(base);
+    auto extended_node = chains.intern(extended);
+    auto other_node = chains.intern(other);
+
+    EXPECT_EQ(chains.nodes[base_node].depth, 2u);
+    EXPECT_EQ(chains.nodes[extended_node].depth, 3u);
+    EXPECT_EQ(chains.nodes[extended_node].parent, base_node);
+    EXPECT_EQ(chains.nodes[base_node].users, 2u);
+    EXPECT_EQ(chains.nodes[extended_node].users, 1u);
+
+    // "/b" alone is not a prefix of the others.
+    EXPECT_EQ(chains.nodes[other_node].parent, 0u);
+    EXPECT_EQ(chains.intern(other), other_node);
+    EXPECT_EQ(chains.nodes[other_node].users, 2u);
+}
+
 TEST_CASE(ResolveStatCacheHits) {
     TempDir tmp;
     tmp.touch("include/cached.h");
@@ -197,6 +227,47 @@ TEST_CASE(ResolveStatCacheHits) {
     EXPECT_EQ(result1->path, result2->path);
 }
 
+TEST_CASE(CollectIncludeDirs) {
+    TempDir tmp;
+    tmp.touch("a/lib/sub/x.h");
+    tmp.touch("b/other.h");
+    tmp.touch("src/lib/y.h");
+
+    SearchConfig config;
+    config.dirs = {{tmp.path("a")}, {tmp.path("b")}};
+    config.angled_start_idx = 0;
+
+    DirListingCache dir_cache;
+    auto resolved = resolve_search_config(config, dir_cache);
+    auto* includer_entries = resolve_dir(tmp.path("src"), dir_cache);
+
+    // Only the search dirs that have "lib" are candidates.
+    llvm::StringSet<> dirs;
+    collect_include_dirs("lib/sub/x.h", true, nullptr, "", resolved, dir_cache, dirs);
+    ASSERT_EQ(dirs.size(), 1u);
+    EXPECT_TRUE(dirs.contains(tmp.path("a/lib/sub")));
+
+    // A quoted include also looks next to its includer.
+    dirs.clear();
+    collect_include_dirs("lib/y.h",
+                         false,
+                         includer_entries,
+                         tmp.path("src"),
+                         resolved,
+                         dir_cache,
+                         dirs);
+    EXPECT_EQ(dirs.size(), 2u);
+    EXPECT_TRUE(dirs.contains(tmp.path("src/lib")));
+    EXPECT_TRUE(dirs.contains(tmp.path("a/lib")));
+
+    // Simple names and listed directories need nothing.
+    dirs.clear();
+    resolve_dir(tmp.path("a/lib/sub"), dir_cache);
+    collect_include_dirs("other.h", true, nullptr, "", resolved, dir_cache, dirs);
+    collect_include_dirs("lib/sub/x.h", true, nullptr, "", resolved, dir_cache, dirs);
+    EXPECT_TRUE(dirs.empty());
+}
+
 TEST_CASE(ResolveQuotedFallsBackToSearchDirs) {
     TempDir tmp;
     // Header not in includer dir, but in search dir.
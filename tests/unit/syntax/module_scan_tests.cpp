@@ -246,5 +246,125 @@ TEST_CASE(NoModule) {
 
 };  // TEST_SUITE(ModuleDeclFallback)
 
+// =============================================================================
+// evaluate_module_decl() — conditionals decided without a preprocessor
+// =============================================================================
+
+TEST_SUITE(ModuleDeclEvaluate) {
+
+TEST_CASE(CommandLineDefine) {
+    llvm::StringRef content = R"(
+#ifdef LEGACY_BUILD
+#else
+export module mylib;
+#endif
+)";
+    auto result = evaluate_module_decl(content, {"clang++", "-std=c++20"});
+    ASSERT_TRUE(result.has_value());
+    EXPECT_EQ(result->module_name, "mylib");
+    EXPECT_TRUE(result->is_interface_unit);
+
+    result = evaluate_module_decl(content, {"clang++", "-D", "LEGACY_BUILD"});
+    ASSERT_TRUE(result.has_value());
+    EXPECT_TRUE(result->module_name.empty());
+}
+
+TEST_CASE(Expressions) {
+    llvm::StringRef content = R"(
+#define VERSION (3 * 10 + 2)
+#if defined(USE_MODULES) && VERSION >= 32 && !defined(OLD)
+export module mylib:core;
+#elif MODE == 2
+module mylib;
+#endif
+)";
+    auto result = evaluate_module_decl(content, {"-std=c++20", "-DUSE_MODULES"});
+    ASSERT_TRUE(result.has_value());
+    EXPECT_EQ(result->module_name, "mylib:core");
+
+    result = evaluate_module_decl(content, {"-std=c++20", "-DMODE=2", "-DOLD"});
+    ASSERT_TRUE(result.has_value());
+    EXPECT_EQ(result->module_name, "mylib");
+    EXPECT_FALSE(result->is_interface_unit);
+
+    result =
+        evaluate_module_decl(content, {"-std=c++20", "-DUSE_MODULES", "-UUSE_MODULES"});
+    ASSERT_TRUE(result.has_value());
+    EXPECT_TRUE(result->module_name.empty());
+}
+
+TEST_CASE(UndecidedFallsBack) {
+    // The header may define USE_MODULES.
+    auto result = evaluate_module_decl(R"(
+module;
+#include "config.h"
+#ifdef USE_MODULES
+export module mylib;
+#endif
+)",
+                                       {});
+    EXPECT_FALSE(result.has_value());
+
+    // Predefined by the compiler.
+    result = evaluate_module_decl(R"(
+#if __cpp_modules >= 201907L
+export module mylib;
+#endif
+)",
+                                  {});
+    EXPECT_FALSE(result.has_value());
+
+    // An undecided condition elsewhere does not matter.
+    result = evaluate_module_decl(R"(
+module;
+#if __has_include(<version>)
+#include <version>
+#endif
+#ifndef NO_MODULES
+export module mylib;
+#endif
+)",
+                                  {"-DNO_MODULES"});
+    ASSERT_TRUE(result.has_value());
+    EXPECT_TRUE(result->module_name.empty());
+}
+
+TEST_CASE(GnuModePredefines) {
+    // GNU modes, the default, predefine names such as `linux`.
+    llvm::StringRef content = R"(
+#ifdef linux
+export module mylib;
+#endif
+)";
+    EXPECT_FALSE(evaluate_module_decl(content, {"clang++", "-std=gnu++20"}).has_value());
+    EXPECT_FALSE(evaluate_module_decl(content, {"clang++"}).has_value());
+
+    auto result = evaluate_module_decl(content, {"clang++", "-std=c++20"});
+    ASSERT_TRUE(result.has_value());
+    EXPECT_TRUE(result->module_name.empty());
+}
+
+TEST_CASE(OverflowWraps) {
+    auto result = evaluate_module_decl(R"(
+#if 0x7fffffffffffffff + 1 < 0 && -0x7fffffffffffffff - 1 < 0
+export module mylib;
+#endif
+)",
+                                       {"-std=c++20"});
+    ASSERT_TRUE(result.has_value());
+    EXPECT_EQ(result->module_name, "mylib");
+
+    // The quotient that does not fit is left to the preprocessor.
+    result = evaluate_module_decl(R"(
+#if (-0x7fffffffffffffff - 1) / -1
+export module mylib;
+#endif
+)",
+                                  {"-std=c++20"});
+    EXPECT_FALSE(result.has_value());
+}
+
+};  // TEST_SUITE(ModuleDeclEvaluate)
+
 }  // namespace
 }  // namespace clice::testing
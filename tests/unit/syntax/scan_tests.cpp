@@ -137,6 +137,60 @@ int main() {
     EXPECT_FALSE(result.need_preprocess);
 }
 
+TEST_CASE(DirectivesInCommentsAndLiterals) {
+    auto result = scan(R"cpp(
+#include <first.h>
+/* #include <block_comment.h> */
+// #include <line_comment.h>
+const char* s = "/* not a comment";
+auto raw = R"x(
+#include <raw_string.h>
+)x";
+int n = 1'000;
+char q = '"';
+/* leading comment */ #include <after_comment.h>
+int x; /* trailing
+*/ #include <not_a_directive.h>
+#include <last.h>
+)cpp");
+
+    ASSERT_EQ(result.includes.size(), 3u);
+    EXPECT_EQ(result.includes[0].path, "first.h");
+    EXPECT_EQ(result.includes[1].path, "after_comment.h");
+    EXPECT_EQ(result.includes[2].path, "last.h");
+}
+
+TEST_CASE(DirectiveContinuation) {
+    auto result = scan("#include \\\n  <continued.h>\nint x = 1; \\\n#include <joined.h>\n");
+
+    // The second line continuation makes the filter fall back to the full
+    // scanner; either way the include after it joins the previous line.
+    ASSERT_EQ(result.includes.size(), 1u);
+    EXPECT_EQ(result.includes[0].path, "continued.h");
+}
+
+TEST_CASE(ByteOrderMark) {
+    auto result = scan("\xEF\xBB\xBF#include <bom.h>\n");
+
+    ASSERT_EQ(result.includes.size(), 1u);
+    EXPECT_EQ(result.includes[0].path, "bom.h");
+}
+
+TEST_CASE(ModuleAmongCode) {
+    auto result = scan(R"(
+module;
+#include <header.h>
+export module my.module;
+export namespace ns {
+int f();
+}
+)");
+
+    EXPECT_EQ(result.module_name, "my.module");
+    EXPECT_TRUE(result.is_interface_unit);
+    ASSERT_EQ(result.includes.size(), 1u);
+}
+
 // === scan_precise() tests ===
 
 TEST_CASE(PreciseBasic) {
@@ -196,6 +250,30 @@ TEST_CASE(PreciseWithContent) {
     EXPECT_FALSE(result.includes[0].not_found);
 }
 
+TEST_CASE(PreciseSharedCache) {
+    auto main_path = TestVFS::path("main.cpp");
+    auto args = std::vector<const char*>{"clang++", "-std=c++20", main_path.c_str()};
+    auto project = [](llvm::StringRef header) {
+        auto vfs = llvm::makeIntrusiveRefCnt<TestVFS>();
+        vfs->add("main.cpp", R"(#include "header.h")");
+        vfs->add("header.h", header);
+        vfs->add("a.h");
+        vfs->add("long_name.h");
+        return vfs;
+    };
+
+    SharedScanCache cache;
+    auto first = scan_precise(args, TestVFS::root(), {}, &cache, project(R"(#include "a.h")"));
+    ASSERT_EQ(first.includes.size(), 2u);
+    EXPECT_TRUE(cache.entries.size() >= 2);
+
+    // A header that changed since it was cached is scanned again.
+    auto second =
+        scan_precise(args, TestVFS::root(), {}, &cache, project(R"(#include "long_name.h")"));
+    ASSERT_EQ(second.includes.size(), 2u);
+    EXPECT_TRUE(second.includes[1].path.find("long_name.h") != std::string::npos);
+}
+
 };  // TEST_SUITE(Scan)
 
 TEST_SUITE(PreambleBound) {